@@ -0,0 +1,61 @@
+#include "base/rw_mutex.h"
+
+#include <glog/logging.h>
+
+using std::lock_guard;
+using std::mutex;
+using std::unique_lock;
+
+namespace cert_trans {
+
+
+void RwMutex::lock() {
+  unique_lock<mutex> lock(lock_);
+  ++waiting_writers_;
+  writers_cv_.wait(lock, [this]() { return !writer_ && readers_ == 0; });
+  --waiting_writers_;
+  writer_ = true;
+}
+
+
+bool RwMutex::try_lock() {
+  lock_guard<mutex> lock(lock_);
+  if (writer_ || readers_ > 0) {
+    return false;
+  }
+  writer_ = true;
+  return true;
+}
+
+
+void RwMutex::unlock() {
+  lock_guard<mutex> lock(lock_);
+  CHECK(writer_);
+  writer_ = false;
+  if (waiting_writers_ > 0) {
+    writers_cv_.notify_one();
+  } else {
+    readers_cv_.notify_all();
+  }
+}
+
+
+void RwMutex::lock_shared() {
+  unique_lock<mutex> lock(lock_);
+  readers_cv_.wait(lock,
+                   [this]() { return !writer_ && waiting_writers_ == 0; });
+  ++readers_;
+}
+
+
+void RwMutex::unlock_shared() {
+  lock_guard<mutex> lock(lock_);
+  CHECK_GT(readers_, 0);
+  --readers_;
+  if (readers_ == 0 && waiting_writers_ > 0) {
+    writers_cv_.notify_one();
+  }
+}
+
+
+}  // namespace cert_trans
@@ -0,0 +1,69 @@
+#ifndef CERT_TRANS_BASE_RW_MUTEX_H_
+#define CERT_TRANS_BASE_RW_MUTEX_H_
+
+#include <condition_variable>
+#include <mutex>
+
+#include "base/macros.h"
+
+namespace cert_trans {
+
+
+// A reader-writer mutex, for data that is read a lot more often than
+// it is written. Any number of readers can hold it at once, or a
+// single writer (which is preferred: once a writer is waiting, new
+// readers wait for it to be done).
+//
+// Meets the Lockable requirements, so that std::lock_guard and
+// std::unique_lock can be used to hold it exclusively. Use ReaderLock
+// to hold it shared.
+class RwMutex {
+ public:
+  RwMutex() : readers_(0), writer_(false), waiting_writers_(0) {
+  }
+
+  void lock();
+  bool try_lock();
+  void unlock();
+
+  void lock_shared();
+  void unlock_shared();
+
+ private:
+  std::mutex lock_;
+  std::condition_variable readers_cv_;
+  std::condition_variable writers_cv_;
+  int readers_;
+  bool writer_;
+  int waiting_writers_;
+
+  DISALLOW_COPY_AND_ASSIGN(RwMutex);
+};
+
+
+// Holds a |Mutex| (such as RwMutex) shared for the duration of its
+// scope.
+template <class Mutex>
+class BasicReaderLock {
+ public:
+  explicit BasicReaderLock(Mutex* mutex) : mutex_(mutex) {
+    mutex_->lock_shared();
+  }
+
+  ~BasicReaderLock() {
+    mutex_->unlock_shared();
+  }
+
+ private:
+  Mutex* const mutex_;
+
+  DISALLOW_COPY_AND_ASSIGN(BasicReaderLock);
+};
+
+
+typedef BasicReaderLock<RwMutex> ReaderLock;
+
+
+}  // namespace cert_trans
+
+#endif  // CERT_TRANS_BASE_RW_MUTEX_H_
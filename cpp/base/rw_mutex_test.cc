@@ -0,0 +1,81 @@
+#include <gtest/gtest.h>
+#include <mutex>
+#include <thread>
+
+#include "base/notification.h"
+#include "base/rw_mutex.h"
+#include "util/testing.h"
+
+using cert_trans::Notification;
+using cert_trans::ReaderLock;
+using cert_trans::RwMutex;
+using std::chrono::milliseconds;
+using std::lock_guard;
+using std::thread;
+
+namespace {
+
+
+TEST(RwMutexTest, ReadersShare) {
+  RwMutex mutex;
+  ReaderLock lock1(&mutex);
+  ReaderLock lock2(&mutex);
+  EXPECT_FALSE(mutex.try_lock());
+}
+
+
+TEST(RwMutexTest, WriterExcludesReaders) {
+  RwMutex mutex;
+  mutex.lock();
+  EXPECT_FALSE(mutex.try_lock());
+
+  Notification locked;
+  thread reader([&mutex, &locked]() {
+    ReaderLock lock(&mutex);
+    locked.Notify();
+  });
+  EXPECT_FALSE(locked.WaitForNotificationWithTimeout(milliseconds(50)));
+  mutex.unlock();
+  locked.WaitForNotification();
+  reader.join();
+
+  EXPECT_TRUE(mutex.try_lock());
+  mutex.unlock();
+}
+
+
+TEST(RwMutexTest, WaitingWriterBlocksNewReaders) {
+  RwMutex mutex;
+  mutex.lock_shared();
+
+  Notification writer_locked;
+  thread writer([&mutex, &writer_locked]() {
+    lock_guard<RwMutex> lock(mutex);
+    writer_locked.Notify();
+  });
+  EXPECT_FALSE(writer_locked.WaitForNotificationWithTimeout(milliseconds(50)));
+
+  // The writer is waiting for the first reader, so this one has to
+  // wait for the writer.
+  Notification reader_locked;
+  thread reader([&mutex, &reader_locked]() {
+    ReaderLock lock(&mutex);
+    reader_locked.Notify();
+  });
+  EXPECT_FALSE(reader_locked.WaitForNotificationWithTimeout(milliseconds(50)));
+
+  mutex.unlock_shared();
+  writer_locked.WaitForNotification();
+  reader_locked.WaitForNotification();
+  writer.join();
+  reader.join();
+}
+
+
+}  // namespace
+
+
+int main(int argc, char** argv) {
+  cert_trans::test::InitTesting(argv[0], &argc, &argv, true);
+  return RUN_ALL_TESTS();
+}
@@ -1,19 +1,28 @@
 #include "client/async_log_client.h"
 
 #include <algorithm>
+#include <deque>
+#include <event2/buffer.h>
 #include <event2/http.h>
 #include <glog/logging.h>
 #include <iterator>
 #include <memory>
+#include <mutex>
+#include <string.h>
 
 #include "log/cert.h"
+#include "log/logged_certificate.h"
+#include "log/segment_storage.h"
 #include "proto/serializer.h"
+#include "util/executor.h"
 #include "util/json_wrapper.h"
 
 using cert_trans::AsyncLogClient;
 using cert_trans::Cert;
 using cert_trans::CertChain;
+using cert_trans::LoggedCertificate;
 using cert_trans::PreCertChain;
+using cert_trans::SegmentStorage;
 using cert_trans::URL;
 using cert_trans::UrlFetcher;
 using ct::DigitallySigned;
@@ -22,9 +31,15 @@ using ct::SignedCertificateTimestamp;
 using ct::SignedTreeHead;
 using std::back_inserter;
 using std::bind;
+using std::deque;
+using std::function;
+using std::lock_guard;
+using std::make_pair;
 using std::make_shared;
 using std::move;
+using std::mutex;
 using std::placeholders::_1;
+using std::placeholders::_2;
 using std::shared_ptr;
 using std::string;
 using std::to_string;
@@ -34,6 +49,19 @@ using std::vector;
 namespace {
 
 
+// The content type of get-entries replies in the binary format, which
+// the log nodes send each other when asked for it (see
+// server/handler.cc).
+const char kBinaryEntriesContentType[] = "application/x-ct-entries";
+// Likewise, for those made of the records of the entries, as they are
+// stored.
+const char kEntryRecordsContentType[] = "application/x-ct-entry-records";
+
+// How much of a get-entries reply can be received ahead of its
+// parsing, before the reading of it is paused.
+const size_t kMaxPendingEntriesBytes = 4 << 20;
+
+
 string UriEncode(const string& input) {
   const unique_ptr<char, void (*)(void*)> output(
       evhttp_uriencode(input.data(), input.size(), false), &free);
@@ -49,6 +77,10 @@ bool SanityCheck(UrlFetcher::Response* resp,
   // TODO(pphaneuf): We should report errors better. The easiest way
   // would be for this to use util::Task as well, so it could simply
   // pass on the status.
+  if (task->status().ok() && resp->status_code == HTTP_SERVUNAVAIL) {
+    done(AsyncLogClient::UNAVAILABLE);
+    return false;
+  }
   if (!task->status().ok() || resp->status_code != HTTP_OK) {
     done(AsyncLogClient::UNKNOWN_ERROR);
     return false;
@@ -141,82 +173,586 @@ void DoneGetRoots(UrlFetcher::Response* resp, vector<shared_ptr<Cert> >* roots,
 }
 
 
-void DoneGetEntries(UrlFetcher::Response* resp,
-                    vector<AsyncLogClient::Entry>* entries,
-                    const AsyncLogClient::Callback& done, util::Task* task) {
-  unique_ptr<UrlFetcher::Response> resp_deleter(CHECK_NOTNULL(resp));
-  unique_ptr<util::Task> task_deleter(CHECK_NOTNULL(task));
+// Fills in |log_entry| from the TLS encoding of its parts. |sct_data|
+// is optional.
+bool ParseEntry(const string& leaf_input, const string& extra_data,
+                const string* sct_data, AsyncLogClient::Entry* log_entry) {
+  if (Deserializer::DeserializeMerkleTreeLeaf(leaf_input, &log_entry->leaf) !=
+      Deserializer::OK) {
+    return false;
+  }
 
-  if (!SanityCheck(resp, done, task)) {
-    return;
+  if (sct_data) {
+    unique_ptr<SignedCertificateTimestamp> sct(new SignedCertificateTimestamp);
+    if (Deserializer::DeserializeSCT(*sct_data, sct.get()) !=
+        Deserializer::OK) {
+      return false;
+    }
+    log_entry->sct.reset(sct.release());
   }
 
-  JsonObject jresponse(resp->body);
-  if (!jresponse.Ok())
-    return done(AsyncLogClient::BAD_RESPONSE);
+  if (log_entry->leaf.timestamped_entry().entry_type() == ct::X509_ENTRY) {
+    Deserializer::DeserializeX509Chain(extra_data,
+                                       log_entry->entry.mutable_x509_entry());
+  } else if (log_entry->leaf.timestamped_entry().entry_type() ==
+             ct::PRECERT_ENTRY) {
+    Deserializer::DeserializePrecertChainEntry(
+        extra_data, log_entry->entry.mutable_precert_entry());
+  } else {
+    LOG(FATAL) << "Don't understand entry type: "
+               << log_entry->leaf.timestamped_entry().entry_type();
+  }
 
-  JsonArray jentries(jresponse, "entries");
-  if (!jentries.Ok())
-    return done(AsyncLogClient::BAD_RESPONSE);
+  return true;
+}
 
-  vector<AsyncLogClient::Entry> new_entries;
-  new_entries.reserve(jentries.Length());
 
-  for (int n = 0; n < jentries.Length(); ++n) {
-    JsonObject entry(jentries, n);
-    if (!entry.Ok()) {
-      return done(AsyncLogClient::BAD_RESPONSE);
+// Reads an opaque vector with a |prefix_length|-byte length at
+// |*pos| in |body|, and moves |*pos| past it.
+bool ReadOpaque(const string& body, size_t prefix_length, size_t* pos,
+                string* out) {
+  if (body.size() - *pos < prefix_length) {
+    return false;
+  }
+  size_t length(0);
+  for (size_t i = 0; i < prefix_length; ++i) {
+    length = (length << 8) | static_cast<unsigned char>(body[(*pos)++]);
+  }
+  if (body.size() - *pos < length) {
+    return false;
+  }
+  out->assign(body, *pos, length);
+  *pos += length;
+  return true;
+}
+
+
+// Parses a get-entries reply a piece at a time, as it arrives.
+class EntriesParser {
+ public:
+  virtual ~EntriesParser() = default;
+
+  // Parses the entries completed by |data|, the next piece of the
+  // reply, and appends them to |*entries|. Returns false if the reply
+  // is malformed.
+  virtual bool Parse(const string& data,
+                     vector<AsyncLogClient::Entry>* entries) = 0;
+
+  // Whether the whole reply was parsed.
+  virtual bool Complete() const = 0;
+
+ protected:
+  EntriesParser() = default;
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(EntriesParser);
+};
+
+
+// Parses a get-entries reply in the binary format, which is a series
+// of entries, each made of the leaf input, extra data and SCT as
+// opaque vectors with 3, 3 and 2-byte lengths, followed by an empty
+// leaf input.
+class BinaryEntriesParser : public EntriesParser {
+ public:
+  BinaryEntriesParser() : complete_(false) {
+  }
+
+  bool Parse(const string& data,
+             vector<AsyncLogClient::Entry>* entries) override {
+    buffer_.append(data);
+    size_t pos(0);
+    bool ok(true);
+    while (!complete_) {
+      // An entry is only consumed once all of it is there.
+      size_t next(pos);
+      string leaf_input;
+      if (!ReadOpaque(buffer_, 3, &next, &leaf_input)) {
+        break;
+      }
+      if (leaf_input.empty()) {
+        complete_ = true;
+        pos = next;
+        break;
+      }
+
+      string extra_data;
+      string sct_data;
+      if (!ReadOpaque(buffer_, 3, &next, &extra_data) ||
+          !ReadOpaque(buffer_, 2, &next, &sct_data)) {
+        break;
+      }
+      AsyncLogClient::Entry log_entry;
+      if (!ParseEntry(leaf_input, extra_data, &sct_data, &log_entry)) {
+        ok = false;
+        break;
+      }
+      entries->emplace_back(move(log_entry));
+      pos = next;
     }
+    buffer_.erase(0, pos);
 
-    JsonString leaf_input(entry, "leaf_input");
-    if (!leaf_input.Ok()) {
-      return done(AsyncLogClient::BAD_RESPONSE);
+    // Nothing may follow the end marker.
+    return ok && (!complete_ || buffer_.empty());
+  }
+
+  bool Complete() const override {
+    return complete_;
+  }
+
+ private:
+  // What was not parsed yet.
+  string buffer_;
+  bool complete_;
+};
+
+
+// Parses a get-entries reply made of the records of the entries from
+// |first| on, as SegmentStorage keeps them, followed by a record
+// header of zeros.
+class EntryRecordsParser : public EntriesParser {
+ public:
+  explicit EntryRecordsParser(int64_t first)
+      : next_index_(first), complete_(false) {
+  }
+
+  bool Parse(const string& data,
+             vector<AsyncLogClient::Entry>* entries) override {
+    buffer_.append(data);
+    size_t pos(0);
+    bool ok(true);
+    while (!complete_) {
+      size_t size;
+      string key;
+      string record;
+      const SegmentStorage::RecordStatus status(SegmentStorage::ReadRecord(
+          buffer_.data() + pos, buffer_.size() - pos, &size, &key, &record));
+      if (status == SegmentStorage::RECORD_INCOMPLETE) {
+        break;
+      }
+      if (status == SegmentStorage::RECORD_CORRUPT) {
+        const size_t length(SegmentStorage::kRecordHeaderLength);
+        complete_ = buffer_.compare(pos, length, string(length, '\0')) == 0;
+        if (complete_) {
+          pos += length;
+        } else {
+          ok = false;
+        }
+        break;
+      }
+
+      AsyncLogClient::Entry log_entry;
+      if (!ParseRecord(record, &log_entry)) {
+        ok = false;
+        break;
+      }
+      entries->emplace_back(move(log_entry));
+      ++next_index_;
+      pos += size;
     }
+    buffer_.erase(0, pos);
 
-    AsyncLogClient::Entry log_entry;
-    if (Deserializer::DeserializeMerkleTreeLeaf(leaf_input.FromBase64(),
-                                                &log_entry.leaf) !=
-        Deserializer::OK) {
-      return done(AsyncLogClient::BAD_RESPONSE);
+    // Nothing may follow the end marker.
+    return ok && (!complete_ || buffer_.empty());
+  }
+
+  bool Complete() const override {
+    return complete_;
+  }
+
+ private:
+  // Fills in |log_entry| from |record|, which must be that of the
+  // next entry.
+  bool ParseRecord(const string& record, AsyncLogClient::Entry* log_entry) {
+    LoggedCertificate logged;
+    if (!logged.ParseFromStorage(record) ||
+        logged.sequence_number() != next_index_) {
+      return false;
+    }
+    string leaf_buffer;
+    string extra_buffer;
+    const string* const leaf_input(logged.LeafInput(&leaf_buffer));
+    const string* const extra_data(logged.ExtraData(&extra_buffer));
+    if (!leaf_input || !extra_data ||
+        !ParseEntry(*leaf_input, *extra_data, nullptr, log_entry)) {
+      return false;
     }
+    log_entry->sct.reset(new SignedCertificateTimestamp(logged.sct()));
+    return true;
+  }
 
-    JsonString extra_data(entry, "extra_data");
-    if (!extra_data.Ok()) {
-      return done(AsyncLogClient::BAD_RESPONSE);
+  int64_t next_index_;
+  // What was not parsed yet.
+  string buffer_;
+  bool complete_;
+};
+
+
+bool IsJsonSpace(char c) {
+  return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+
+bool ParseJsonEntry(const string& json, AsyncLogClient::Entry* log_entry) {
+  JsonObject entry(json);
+  if (!entry.Ok()) {
+    return false;
+  }
+
+  JsonString leaf_input(entry, "leaf_input");
+  if (!leaf_input.Ok()) {
+    return false;
+  }
+
+  JsonString extra_data(entry, "extra_data");
+  if (!extra_data.Ok()) {
+    return false;
+  }
+
+  // This is an optional non-standard extension, used only by the log
+  // internally when running in clustered mode.
+  JsonString sct_data(entry, "sct");
+  const string sct(sct_data.Ok() ? sct_data.FromBase64() : "");
+
+  return ParseEntry(leaf_input.FromBase64(), extra_data.FromBase64(),
+                    sct_data.Ok() ? &sct : nullptr, log_entry);
+}
+
+
+// Parses a get-entries reply in the JSON format. Rather than waiting
+// for all of the reply to parse it at once, this picks out the
+// objects of its "entries" array as each one is complete, and parses
+// them on their own. The rest of the reply is only checked for its
+// brackets and strings being balanced.
+class JsonEntriesParser : public EntriesParser {
+ public:
+  JsonEntriesParser()
+      : pos_(0),
+        depth_(0),
+        started_(false),
+        in_string_(false),
+        escaped_(false),
+        string_start_(0),
+        in_entries_(false),
+        saw_entries_(false),
+        entry_start_(0) {
+  }
+
+  bool Parse(const string& data,
+             vector<AsyncLogClient::Entry>* entries) override {
+    buffer_.append(data);
+    for (; pos_ < buffer_.size(); ++pos_) {
+      const char c(buffer_[pos_]);
+      if (in_string_) {
+        if (escaped_) {
+          escaped_ = false;
+        } else if (c == '\\') {
+          escaped_ = true;
+        } else if (c == '"') {
+          in_string_ = false;
+          if (depth_ == 1) {
+            key_.assign(buffer_, string_start_, pos_ - string_start_);
+          }
+        }
+        continue;
+      }
+
+      if (depth_ == 0) {
+        if (IsJsonSpace(c)) {
+          continue;
+        }
+        if (started_ || c != '{') {
+          return false;
+        }
+        started_ = true;
+        depth_ = 1;
+        continue;
+      }
+
+      switch (c) {
+        case '"':
+          in_string_ = true;
+          string_start_ = pos_ + 1;
+          break;
+
+        case '{':
+        case '[':
+          if (depth_ == 1 && c == '[' && key_ == "entries") {
+            in_entries_ = true;
+            saw_entries_ = true;
+          } else if (in_entries_ && depth_ == 2) {
+            if (c != '{') {
+              return false;
+            }
+            entry_start_ = pos_;
+          }
+          ++depth_;
+          break;
+
+        case '}':
+        case ']':
+          --depth_;
+          if (in_entries_ && depth_ == 2) {
+            if (c != '}') {
+              return false;
+            }
+            entries->emplace_back();
+            if (!ParseJsonEntry(buffer_.substr(entry_start_,
+                                               pos_ + 1 - entry_start_),
+                                &entries->back())) {
+              entries->pop_back();
+              return false;
+            }
+          } else if (in_entries_ && depth_ == 1) {
+            if (c != ']') {
+              return false;
+            }
+            in_entries_ = false;
+          }
+          break;
+
+        default:
+          // Only the separators can be between entries.
+          if (in_entries_ && depth_ == 2 && c != ',' && !IsJsonSpace(c)) {
+            return false;
+          }
+      }
     }
 
-    // This is an optional non-standard extension, used only by the log
-    // internally when running in clustered mode.
-    JsonString sct_data(entry, "sct");
-    if (sct_data.Ok()) {
-      unique_ptr<SignedCertificateTimestamp> sct(
-          new SignedCertificateTimestamp);
-      if (Deserializer::DeserializeSCT(sct_data.FromBase64(), sct.get()) !=
-          Deserializer::OK) {
-        return done(AsyncLogClient::BAD_RESPONSE);
+    // Keep only what is still needed: the entry or key being read.
+    size_t keep(pos_);
+    if (in_entries_ && depth_ > 2) {
+      keep = entry_start_;
+    } else if (in_string_ && depth_ == 1) {
+      keep = string_start_;
+    }
+    buffer_.erase(0, keep);
+    pos_ -= keep;
+    entry_start_ -= std::min(entry_start_, keep);
+    string_start_ -= std::min(string_start_, keep);
+
+    return true;
+  }
+
+  bool Complete() const override {
+    return started_ && depth_ == 0 && saw_entries_;
+  }
+
+ private:
+  // What was not scanned yet, and possibly the start of an entry or
+  // key that is not complete.
+  string buffer_;
+  // Where to carry on scanning in |buffer_|.
+  size_t pos_;
+  // How many objects and arrays the scanning is in.
+  int depth_;
+  bool started_;
+  bool in_string_;
+  bool escaped_;
+  size_t string_start_;
+  // The last key of the top-level object.
+  string key_;
+  bool in_entries_;
+  bool saw_entries_;
+  size_t entry_start_;
+};
+
+
+// The state of a get-entries request, whose reply is parsed on the
+// executor while the rest of it is received.
+class GetEntriesState : public std::enable_shared_from_this<GetEntriesState> {
+ public:
+  // The entries asked for start at |first|.
+  GetEntriesState(util::Executor* executor, int64_t first,
+                  const AsyncLogClient::EntriesCallback& entries_cb,
+                  const AsyncLogClient::Callback& done)
+      : executor_(CHECK_NOTNULL(executor)),
+        first_(first),
+        entries_cb_(entries_cb),
+        done_(done),
+        parse_failed_(false),
+        parsing_(false),
+        fetch_done_(false) {
+  }
+
+  UrlFetcher::Response* response() {
+    return &response_;
+  }
+
+  // The callbacks for UrlFetcher::FetchStreaming(), and of its task.
+  void HeadersReceived();
+  bool BodyReceived(evbuffer* chunk, const std::function<void()>& resume);
+  void FetchDone(util::Task* task);
+
+ private:
+  // Parses what was received until there is nothing more, on the
+  // executor.
+  void ParsePending();
+  void Finish();
+
+  util::Executor* const executor_;
+  const int64_t first_;
+  const AsyncLogClient::EntriesCallback entries_cb_;
+  const AsyncLogClient::Callback done_;
+  UrlFetcher::Response response_;
+
+  // Set when the headers are received, if the reply is a success.
+  unique_ptr<EntriesParser> parser_;
+  // Only used by ParsePending().
+  bool parse_failed_;
+
+  std::mutex lock_;
+  // What was received but not parsed yet.
+  string pending_;
+  // Whether ParsePending() is running or about to.
+  bool parsing_;
+  // To resume the reading of the reply, if it was paused.
+  std::function<void()> resume_;
+  bool fetch_done_;
+  util::Status fetch_status_;
+
+  DISALLOW_COPY_AND_ASSIGN(GetEntriesState);
+};
+
+
+void GetEntriesState::HeadersReceived() {
+  if (response_.status_code != HTTP_OK) {
+    return;
+  }
+
+  // Other log nodes may reply in the binary format, or with the
+  // records of the entries, if it was asked for.
+  const auto content_type(response_.headers.find("Content-Type"));
+  if (content_type != response_.headers.end() &&
+      content_type->second.compare(0, strlen(kEntryRecordsContentType),
+                                   kEntryRecordsContentType) == 0) {
+    parser_.reset(new EntryRecordsParser(first_));
+  } else if (content_type != response_.headers.end() &&
+             content_type->second.compare(0,
+                                          strlen(kBinaryEntriesContentType),
+                                          kBinaryEntriesContentType) == 0) {
+    parser_.reset(new BinaryEntriesParser);
+  } else {
+    parser_.reset(new JsonEntriesParser);
+  }
+}
+
+
+bool GetEntriesState::BodyReceived(evbuffer* chunk,
+                                   const std::function<void()>& resume) {
+  const size_t length(evbuffer_get_length(chunk));
+  if (!parser_) {
+    CHECK_EQ(evbuffer_drain(chunk, length), 0);
+    return true;
+  }
+
+  bool start_parsing;
+  bool keep_reading;
+  {
+    std::lock_guard<std::mutex> lock(lock_);
+    const size_t old_size(pending_.size());
+    pending_.resize(old_size + length);
+    CHECK_EQ(evbuffer_remove(chunk, &pending_[old_size], length),
+             static_cast<int>(length));
+    start_parsing = !parsing_;
+    parsing_ = true;
+    keep_reading = pending_.size() < kMaxPendingEntriesBytes;
+    if (!keep_reading) {
+      resume_ = resume;
+    }
+  }
+
+  if (start_parsing) {
+    executor_->Add(bind(&GetEntriesState::ParsePending, shared_from_this()));
+  }
+  return keep_reading;
+}
+
+
+void GetEntriesState::FetchDone(util::Task* task) {
+  unique_ptr<util::Task> task_deleter(CHECK_NOTNULL(task));
+  {
+    std::lock_guard<std::mutex> lock(lock_);
+    fetch_done_ = true;
+    fetch_status_ = task->status();
+    // The last of the reply is still to be parsed, which finishes.
+    if (parsing_) {
+      return;
+    }
+  }
+  Finish();
+}
+
+
+void GetEntriesState::ParsePending() {
+  while (true) {
+    string data;
+    std::function<void()> resume;
+    bool finish;
+    {
+      std::lock_guard<std::mutex> lock(lock_);
+      if (pending_.empty()) {
+        parsing_ = false;
+        finish = fetch_done_;
+      } else {
+        data.swap(pending_);
+        resume.swap(resume_);
       }
-      log_entry.sct.reset(sct.release());
+    }
+    if (data.empty()) {
+      if (finish) {
+        Finish();
+      }
+      return;
+    }
+    if (resume) {
+      resume();
     }
 
-    if (log_entry.leaf.timestamped_entry().entry_type() == ct::X509_ENTRY) {
-      Deserializer::DeserializeX509Chain(extra_data.FromBase64(),
-                                         log_entry.entry.mutable_x509_entry());
-    } else if (log_entry.leaf.timestamped_entry().entry_type() ==
-               ct::PRECERT_ENTRY) {
-      Deserializer::DeserializePrecertChainEntry(
-          extra_data.FromBase64(), log_entry.entry.mutable_precert_entry());
-    } else {
-      LOG(FATAL) << "Don't understand entry type: "
-                 << log_entry.leaf.timestamped_entry().entry_type();
+    // Once the reply was found to be malformed, the rest of it is
+    // only received to reuse the connection.
+    vector<AsyncLogClient::Entry> entries;
+    if (!parse_failed_ && !parser_->Parse(data, &entries)) {
+      parse_failed_ = true;
+    }
+    if (!entries.empty()) {
+      entries_cb_(&entries);
     }
+  }
+}
 
-    new_entries.emplace_back(move(log_entry));
+
+void GetEntriesState::Finish() {
+  LOG_IF(INFO, !fetch_status_.ok()) << "GetEntries: " << fetch_status_;
+  if (fetch_status_.ok() && response_.status_code == HTTP_SERVUNAVAIL) {
+    return done_(AsyncLogClient::UNAVAILABLE);
+  }
+  if (!fetch_status_.ok() || response_.status_code != HTTP_OK) {
+    // TODO(pphaneuf): We should report errors better, see
+    // SanityCheck().
+    return done_(AsyncLogClient::UNKNOWN_ERROR);
   }
 
-  entries->reserve(entries->size() + new_entries.size());
-  move(new_entries.begin(), new_entries.end(), back_inserter(*entries));
+  if (!parser_ || parse_failed_ || !parser_->Complete()) {
+    return done_(AsyncLogClient::BAD_RESPONSE);
+  }
 
-  return done(AsyncLogClient::OK);
+  return done_(AsyncLogClient::OK);
+}
+
+
+void SetInclusionProof(const SignedTreeHead& sth, int64_t leaf_index,
+                       const vector<string>& path_nodes,
+                       MerkleAuditProof* proof) {
+  proof->Clear();
+  proof->set_version(ct::V1);
+  proof->set_tree_size(sth.tree_size());
+  proof->set_timestamp(sth.timestamp());
+  proof->mutable_tree_head_signature()->CopyFrom(sth.signature());
+  proof->set_leaf_index(leaf_index);
+  for (const string& path_node : path_nodes) {
+    proof->add_path_node(path_node);
+  }
 }
 
 
@@ -251,15 +787,67 @@ void DoneQueryInclusionProof(UrlFetcher::Response* resp,
     path_nodes.push_back(path_node.FromBase64());
   }
 
-  proof->Clear();
-  proof->set_version(ct::V1);
-  proof->set_tree_size(sth.tree_size());
-  proof->set_timestamp(sth.timestamp());
-  proof->mutable_tree_head_signature()->CopyFrom(sth.signature());
-  proof->set_leaf_index(leaf_index.Value());
-  for (vector<string>::const_iterator it = path_nodes.begin();
-       it != path_nodes.end(); ++it) {
-    proof->add_path_node(*it);
+  SetInclusionProof(sth, leaf_index.Value(), path_nodes, proof);
+
+  return done(AsyncLogClient::OK);
+}
+
+
+// The reply has the proofs of the hashes found in the tree, in the
+// order they were asked for.
+void DoneQueryInclusionProofs(UrlFetcher::Response* resp,
+                              const SignedTreeHead& sth,
+                              const vector<string>& hashes,
+                              vector<MerkleAuditProof>* proofs,
+                              const AsyncLogClient::Callback& done,
+                              util::Task* task) {
+  unique_ptr<UrlFetcher::Response> resp_deleter(CHECK_NOTNULL(resp));
+  unique_ptr<util::Task> task_deleter(CHECK_NOTNULL(task));
+
+  if (!SanityCheck(resp, done, task)) {
+    return;
+  }
+
+  JsonObject jresponse(resp->body);
+  if (!jresponse.Ok())
+    return done(AsyncLogClient::BAD_RESPONSE);
+
+  JsonArray jproofs(jresponse, "proofs");
+  if (!jproofs.Ok())
+    return done(AsyncLogClient::BAD_RESPONSE);
+
+  proofs->clear();
+  proofs->resize(hashes.size());
+  size_t next(0);
+  for (int i = 0; i < jproofs.Length(); ++i) {
+    JsonObject jproof(jproofs, i);
+    if (!jproof.Ok())
+      return done(AsyncLogClient::BAD_RESPONSE);
+
+    JsonString hash(jproof, "hash");
+    JsonInt leaf_index(jproof, "leaf_index");
+    JsonArray audit_path(jproof, "audit_path");
+    if (!hash.Ok() || !leaf_index.Ok() || leaf_index.Value() < 0 ||
+        !audit_path.Ok())
+      return done(AsyncLogClient::BAD_RESPONSE);
+
+    const string leaf_hash(hash.FromBase64());
+    while (next < hashes.size() && hashes[next] != leaf_hash) {
+      ++next;
+    }
+    if (next == hashes.size())
+      return done(AsyncLogClient::BAD_RESPONSE);
+
+    vector<string> path_nodes;
+    for (int n = 0; n < audit_path.Length(); ++n) {
+      JsonString path_node(audit_path, n);
+      if (!path_node.Ok())
+        return done(AsyncLogClient::BAD_RESPONSE);
+      path_nodes.push_back(path_node.FromBase64());
+    }
+
+    SetInclusionProof(sth, leaf_index.Value(), path_nodes,
+                      &(*proofs)[next++]);
   }
 
   return done(AsyncLogClient::OK);
@@ -370,19 +958,106 @@ URL NormalizeURL(const string& server_url) {
 namespace cert_trans {
 
 
+// Starts the requests of an AsyncLogClient within its budget, the
+// high priority ones first.
+class AsyncLogClient::RequestQueue
+    : public std::enable_shared_from_this<RequestQueue> {
+ public:
+  enum Priority {
+    HIGH,
+    LOW,
+  };
+
+  RequestQueue() : max_requests_(0), in_flight_(0) {
+  }
+
+  void SetMaxRequests(int max_requests) {
+    CHECK(max_requests == 0 || max_requests >= 2) << max_requests;
+    {
+      lock_guard<mutex> lock(lock_);
+      max_requests_ = max_requests;
+    }
+    StartPending();
+  }
+
+  // Runs |request|, which sends a request completing |task|, once
+  // there is room for it.
+  void Add(Priority priority, util::Task* task,
+           const function<void()>& request) {
+    task->CleanupWhenDone(bind(&RequestQueue::RequestDone,
+                               shared_from_this()));
+    {
+      lock_guard<mutex> lock(lock_);
+      (priority == HIGH ? high_pending_ : low_pending_).push_back(request);
+    }
+    StartPending();
+  }
+
+ private:
+  void RequestDone() {
+    {
+      lock_guard<mutex> lock(lock_);
+      CHECK_GT(in_flight_, 0);
+      --in_flight_;
+    }
+    StartPending();
+  }
+
+  // Must be called with |lock_| held.
+  bool HasRoom(Priority priority) const {
+    return max_requests_ == 0 ||
+           in_flight_ < (priority == HIGH ? max_requests_ : max_requests_ - 1);
+  }
+
+  void StartPending() {
+    vector<function<void()>> requests;
+    {
+      lock_guard<mutex> lock(lock_);
+      while (!high_pending_.empty() && HasRoom(HIGH)) {
+        requests.emplace_back(move(high_pending_.front()));
+        high_pending_.pop_front();
+        ++in_flight_;
+      }
+      while (!low_pending_.empty() && HasRoom(LOW)) {
+        requests.emplace_back(move(low_pending_.front()));
+        low_pending_.pop_front();
+        ++in_flight_;
+      }
+    }
+
+    for (const auto& request : requests) {
+      request();
+    }
+  }
+
+  mutex lock_;
+  int max_requests_;
+  int in_flight_;
+  deque<function<void()>> high_pending_;
+  deque<function<void()>> low_pending_;
+
+  DISALLOW_COPY_AND_ASSIGN(RequestQueue);
+};
+
+
 AsyncLogClient::AsyncLogClient(util::Executor* const executor,
                                UrlFetcher* fetcher, const string& server_url)
     : executor_(CHECK_NOTNULL(executor)),
       fetcher_(CHECK_NOTNULL(fetcher)),
-      server_url_(NormalizeURL(server_url)) {
+      server_url_(NormalizeURL(server_url)),
+      requests_(make_shared<RequestQueue>()) {
+}
+
+
+void AsyncLogClient::SetMaxRequests(int max_requests) {
+  requests_->SetMaxRequests(max_requests);
 }
 
 
 void AsyncLogClient::GetSTH(SignedTreeHead* sth, const Callback& done) {
   UrlFetcher::Response* const resp(new UrlFetcher::Response);
-  fetcher_->Fetch(GetURL("get-sth"), resp,
-                  new util::Task(bind(DoneGetSTH, resp, sth, done, _1),
-                                 executor_));
+  Fetch(GetURL("get-sth"), resp,
+        new util::Task(bind(DoneGetSTH, resp, sth, done, _1), executor_));
 }
 
 
@@ -390,9 +1065,8 @@ void AsyncLogClient::GetRoots(vector<shared_ptr<Cert> >* roots,
                               const Callback& done) {
   UrlFetcher::Response* const resp(new UrlFetcher::Response);
 
-  fetcher_->Fetch(GetURL("get-roots"), resp,
-                  new util::Task(bind(DoneGetRoots, resp, roots, done, _1),
-                                 executor_));
+  Fetch(GetURL("get-roots"), resp,
+        new util::Task(bind(DoneGetRoots, resp, roots, done, _1), executor_));
 }
 
 
@@ -415,6 +1089,29 @@ void AsyncLogClient::InternalGetEntries(int first, int last,
                                         vector<Entry>* entries,
                                         bool request_scts,
                                         const Callback& done) {
+  // The entries are only added to |*entries| if they all are there.
+  const shared_ptr<vector<Entry>> new_entries(make_shared<vector<Entry>>());
+  GetEntriesStreaming(first, last, request_scts,
+                      [new_entries](vector<Entry>* parsed) {
+                        move(parsed->begin(), parsed->end(),
+                             back_inserter(*new_entries));
+                      },
+                      [entries, new_entries, done](Status status) {
+                        if (status == OK) {
+                          entries->reserve(entries->size() +
+                                           new_entries->size());
+                          move(new_entries->begin(), new_entries->end(),
+                               back_inserter(*entries));
+                        }
+                        done(status);
+                      });
+}
+
+
+void AsyncLogClient::GetEntriesStreaming(int first, int last,
+                                         bool request_scts,
+                                         const EntriesCallback& entries_cb,
+                                         const Callback& done) {
   CHECK_GE(first, 0);
   CHECK_GE(last, 0);
 
@@ -427,10 +1124,29 @@ void AsyncLogClient::InternalGetEntries(int first, int last,
   url.SetQuery("start=" + to_string(first) + "&end=" + to_string(last) +
                (request_scts ? "&include_scts=true" : ""));
 
-  UrlFetcher::Response* const resp(new UrlFetcher::Response);
-  fetcher_->Fetch(url, resp,
-                  new util::Task(bind(DoneGetEntries, resp, entries, done, _1),
-                                 executor_));
+  UrlFetcher::Request req(url);
+  if (request_scts) {
+    // Only log nodes include the SCTs, and they can send the entries
+    // in a more compact format, or as they store them, which is the
+    // cheapest for them.
+    req.headers.insert(make_pair("Accept",
+                                 string(kEntryRecordsContentType) + ", " +
+                                     kBinaryEntriesContentType));
+  }
+
+  const shared_ptr<GetEntriesState> state(
+      make_shared<GetEntriesState>(executor_, first, entries_cb, done));
+  util::Task* const task(
+      new util::Task(bind(&GetEntriesState::FetchDone, state, _1),
+                     executor_));
+  UrlFetcher* const fetcher(fetcher_);
+  requests_->Add(RequestQueue::LOW, task, [fetcher, req, state, task]() {
+    fetcher->FetchStreaming(req, state->response(),
+                            bind(&GetEntriesState::HeadersReceived, state),
+                            bind(&GetEntriesState::BodyReceived, state, _1,
+                                 _2),
+                            task);
+  });
 }
 
 
@@ -445,9 +1161,35 @@ void AsyncLogClient::QueryInclusionProof(const SignedTreeHead& sth,
                "&tree_size=" + to_string(sth.tree_size()));
 
   UrlFetcher::Response* const resp(new UrlFetcher::Response);
-  fetcher_->Fetch(url, resp, new util::Task(bind(DoneQueryInclusionProof, resp,
-                                                 sth, proof, done, _1),
-                                            executor_));
+  Fetch(url, resp, new util::Task(bind(DoneQueryInclusionProof, resp, sth,
+                                       proof, done, _1),
+                                  executor_));
+}
+
+
+void AsyncLogClient::QueryInclusionProofs(
+    const SignedTreeHead& sth, const vector<string>& merkle_leaf_hashes,
+    vector<MerkleAuditProof>* proofs, const Callback& done) {
+  CHECK_GE(sth.tree_size(), 0);
+  CHECK_NOTNULL(proofs);
+
+  JsonArray jhashes;
+  for (const string& hash : merkle_leaf_hashes) {
+    jhashes.AddBase64(hash);
+  }
+
+  JsonObject jsend;
+  jsend.Add("tree_size", sth.tree_size());
+  jsend.Add("hashes", jhashes);
+
+  UrlFetcher::Request req(GetURL("get-proofs-by-hash"));
+  req.verb = UrlFetcher::Verb::POST;
+  req.body = jsend.ToString();
+
+  UrlFetcher::Response* const resp(new UrlFetcher::Response);
+  Fetch(req, resp, new util::Task(bind(DoneQueryInclusionProofs, resp, sth,
+                                       merkle_leaf_hashes, proofs, done, _1),
+                                  executor_));
 }
 
 
@@ -461,9 +1203,9 @@ void AsyncLogClient::GetSTHConsistency(int64_t first, int64_t second,
   url.SetQuery("first=" + to_string(first) + "&second=" + to_string(second));
 
   UrlFetcher::Response* const resp(new UrlFetcher::Response);
-  fetcher_->Fetch(url, resp, new util::Task(bind(DoneGetSTHConsistency, resp,
-                                                 proof, done, _1),
-                                            executor_));
+  Fetch(url, resp, new util::Task(bind(DoneGetSTHConsistency, resp, proof,
+                                       done, _1),
+                                  executor_));
 }
 
 
@@ -490,6 +1232,15 @@ URL AsyncLogClient::GetURL(const std::string& subpath) const {
 }
 
 
+void AsyncLogClient::Fetch(const UrlFetcher::Request& req,
+                           UrlFetcher::Response* resp, util::Task* task) {
+  UrlFetcher* const fetcher(fetcher_);
+  requests_->Add(RequestQueue::HIGH, task, [fetcher, req, resp, task]() {
+    fetcher->Fetch(req, resp, task);
+  });
+}
+
+
 void AsyncLogClient::InternalAddChain(const CertChain& cert_chain,
                                       SignedCertificateTimestamp* sct,
                                       bool pre_cert, const Callback& done) {
@@ -511,9 +1262,9 @@ void AsyncLogClient::InternalAddChain(const CertChain& cert_chain,
   req.body = jsend.ToString();
 
   UrlFetcher::Response* const resp(new UrlFetcher::Response);
-  fetcher_->Fetch(req, resp, new util::Task(bind(DoneInternalAddChain, resp,
-                                                 sct, done, _1),
-                                            executor_));
+  Fetch(req, resp, new util::Task(bind(DoneInternalAddChain, resp, sct, done,
+                                       _1),
+                                  executor_));
 }
 
 
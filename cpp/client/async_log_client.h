@@ -33,6 +33,9 @@ class AsyncLogClient {
     UNKNOWN_ERROR,
     UPLOAD_FAILED,
     INVALID_INPUT,
+    // The log answered with a 503, the request can be made again
+    // later.
+    UNAVAILABLE,
   };
 
   struct Entry {
@@ -43,6 +46,10 @@ class AsyncLogClient {
 
   typedef std::function<void(Status)> Callback;
 
+  // Called with the next few entries of a get-entries reply, in
+  // order, which may be moved out of |*entries|.
+  typedef std::function<void(std::vector<Entry>* entries)> EntriesCallback;
+
   // The "executor" will be used to run callbacks.
   // TODO(pphaneuf): The executor would not be necessary if we
   // converted this API to use util::Task.
@@ -51,6 +58,17 @@ class AsyncLogClient {
   AsyncLogClient(util::Executor* const executor, UrlFetcher* fetcher,
                  const std::string& server_uri);
 
+  const URL& server_url() const {
+    return server_url_;
+  }
+
+  // Limits the requests in flight to |max_requests|, or lifts the
+  // limit if it is 0, which is the default. The requests over the
+  // limit wait for one to finish, and get-entries requests only get
+  // |max_requests| - 1 of them, so that an STH or proof request never
+  // waits behind entries downloads. A limit must be at least 2.
+  void SetMaxRequests(int max_requests);
+
   void GetSTH(ct::SignedTreeHead* sth, const Callback& done);
 
   // This does not clear "roots" before appending to it.
@@ -69,10 +87,30 @@ class AsyncLogClient {
   void GetEntriesAndSCTs(int first, int last, std::vector<Entry>* entries,
                          const Callback& done);
 
+  // Same as GetEntries(), or GetEntriesAndSCTs() if |request_scts| is
+  // true, but passes the entries to |entries_cb| as the reply is
+  // parsed, while the rest of it is still downloading. Both callbacks
+  // are run on the executor, |done| after the last call to
+  // |entries_cb|. If |done| is called with an error, the entries
+  // passed on so far might not be all of those asked for.
+  void GetEntriesStreaming(int first, int last, bool request_scts,
+                           const EntriesCallback& entries_cb,
+                           const Callback& done);
+
   void QueryInclusionProof(const ct::SignedTreeHead& sth,
                            const std::string& merkle_leaf_hash,
                            ct::MerkleAuditProof* proof, const Callback& done);
 
+  // Non-standard batch version of QueryInclusionProof(), which only
+  // works with the logs of this implementation: sets |proofs| to one
+  // proof per hash of |merkle_leaf_hashes|, in the same order, with a
+  // single get-proofs-by-hash request. The proofs of the hashes which
+  // are not in the tree of |sth| are left empty, without a leaf index.
+  void QueryInclusionProofs(
+      const ct::SignedTreeHead& sth,
+      const std::vector<std::string>& merkle_leaf_hashes,
+      std::vector<ct::MerkleAuditProof>* proofs, const Callback& done);
+
   // This does not clear "proof" before appending to it.
   void GetSTHConsistency(int64_t first, int64_t second,
                          std::vector<std::string>* proof,
@@ -87,8 +125,14 @@ class AsyncLogClient {
                        const Callback& done);
 
  private:
+  class RequestQueue;
+
   URL GetURL(const std::string& subpath) const;
 
+  // Sends |req| once the request budget allows it.
+  void Fetch(const UrlFetcher::Request& req, UrlFetcher::Response* resp,
+             util::Task* task);
+
   void InternalGetEntries(int first, int last, std::vector<Entry>* entries,
                           bool request_scts, const Callback& done);
 
@@ -99,6 +143,8 @@ class AsyncLogClient {
   util::Executor* const executor_;
   UrlFetcher* const fetcher_;
   const URL server_url_;
+  // Shared with the tasks of the requests, which can outlive us.
+  const std::shared_ptr<RequestQueue> requests_;
 
   DISALLOW_COPY_AND_ASSIGN(AsyncLogClient);
 };
@@ -0,0 +1,331 @@
+#include "client/async_log_client.h"
+
+#include <algorithm>
+#include <event2/buffer.h>
+#include <functional>
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include <string>
+#include <vector>
+
+#include "base/notification.h"
+#include "log/logged_certificate.h"
+#include "log/segment_storage.h"
+#include "log/test_signer.h"
+#include "net/mock_url_fetcher.h"
+#include "proto/serializer.h"
+#include "util/testing.h"
+#include "util/thread_pool.h"
+#include "util/util.h"
+
+namespace cert_trans {
+namespace {
+
+using std::bind;
+using std::placeholders::_1;
+using std::placeholders::_2;
+using std::placeholders::_3;
+using std::placeholders::_4;
+using std::placeholders::_5;
+using std::string;
+using std::vector;
+using testing::_;
+using testing::Invoke;
+using util::Task;
+
+const char kLogUrl[] = "https://example.com";
+
+
+// Answers a streamed fetch with |body|, passed on in pieces of
+// |chunk_size| bytes.
+void HandleStreamingFetch(int status_code, const UrlFetcher::Headers& headers,
+                          const string& body, size_t chunk_size,
+                          const UrlFetcher::Request& req,
+                          UrlFetcher::Response* resp,
+                          const UrlFetcher::HeadersCallback& headers_cb,
+                          const UrlFetcher::BodyCallback& body_cb,
+                          Task* task) {
+  resp->status_code = status_code;
+  resp->headers = headers;
+  headers_cb();
+  for (size_t pos = 0; pos < body.size(); pos += chunk_size) {
+    evbuffer* const chunk(CHECK_NOTNULL(evbuffer_new()));
+    CHECK_EQ(evbuffer_add(chunk, body.data() + pos,
+                          std::min(chunk_size, body.size() - pos)),
+             0);
+    body_cb(chunk, []() {});
+    evbuffer_free(chunk);
+  }
+  task->Return();
+}
+
+
+class AsyncLogClientTest : public ::testing::Test {
+ protected:
+  AsyncLogClientTest() : client_(&pool_, &fetcher_, kLogUrl) {
+    for (int i = 0; i < 5; ++i) {
+      logged_.emplace_back();
+      test_signer_.CreateUniqueFakeSignature(&logged_.back());
+    }
+  }
+
+  string JsonReply() const {
+    string reply("{\"entries\":[");
+    for (size_t i = 0; i < logged_.size(); ++i) {
+      string leaf_input, extra_data;
+      CHECK(logged_[i].SerializeForLeaf(&leaf_input));
+      CHECK(logged_[i].SerializeExtraData(&extra_data));
+      reply += string(i > 0 ? ", " : "") + "{\"leaf_input\":\"" +
+               util::ToBase64(leaf_input) + "\",\"extra_data\":\"" +
+               util::ToBase64(extra_data) + "\"}";
+    }
+    return reply + "]}";
+  }
+
+  string BinaryReply() const {
+    string reply;
+    for (const auto& logged : logged_) {
+      string leaf_input, extra_data, sct_data;
+      CHECK(logged.SerializeForLeaf(&leaf_input));
+      CHECK(logged.SerializeExtraData(&extra_data));
+      CHECK_EQ(Serializer::OK,
+               Serializer::SerializeSCT(logged.sct(), &sct_data));
+      reply += Serializer::SerializeUint(leaf_input.size(), 3) + leaf_input +
+               Serializer::SerializeUint(extra_data.size(), 3) + extra_data +
+               Serializer::SerializeUint(sct_data.size(), 2) + sct_data;
+    }
+    return reply + Serializer::SerializeUint(0, 3);
+  }
+
+  // The records of the entries, as stored by SegmentStorage.
+  string RecordsReply() const {
+    const string dir(
+        util::CreateTemporaryDirectory("/tmp/async_log_client_testXXXXXX"));
+    {
+      SegmentStorage storage(dir, 1 << 20);
+      for (size_t i = 0; i < logged_.size(); ++i) {
+        LoggedCertificate logged(logged_[i]);
+        logged.set_sequence_number(i);
+        string record;
+        CHECK(logged.SerializeForStorage(&record));
+        CHECK_EQ(util::Status::OK,
+                 storage.CreateEntry(std::to_string(i), record));
+      }
+    }
+    string reply;
+    CHECK(util::ReadBinaryFile(dir + "/segment-00000000", &reply));
+    return reply + string(SegmentStorage::kRecordHeaderLength, '\0');
+  }
+
+  void ExpectFetch(int status_code, const UrlFetcher::Headers& headers,
+                   const string& body, size_t chunk_size) {
+    EXPECT_CALL(fetcher_, FetchStreaming(_, _, _, _, _))
+        .WillOnce(Invoke(bind(&HandleStreamingFetch, status_code, headers,
+                              body, chunk_size, _1, _2, _3, _4, _5)));
+  }
+
+  AsyncLogClient::Status GetEntries(bool request_scts,
+                                    vector<AsyncLogClient::Entry>* entries) {
+    Notification notify;
+    AsyncLogClient::Status status;
+    client_.GetEntriesStreaming(0, logged_.size() - 1, request_scts,
+                                [entries](
+                                    vector<AsyncLogClient::Entry>* parsed) {
+                                  std::move(parsed->begin(), parsed->end(),
+                                            back_inserter(*entries));
+                                },
+                                [&notify, &status](
+                                    AsyncLogClient::Status done_status) {
+                                  status = done_status;
+                                  notify.Notify();
+                                });
+    notify.WaitForNotification();
+    return status;
+  }
+
+  void ExpectEntries(const vector<AsyncLogClient::Entry>& entries,
+                     bool with_scts) const {
+    ASSERT_EQ(logged_.size(), entries.size());
+    for (size_t i = 0; i < entries.size(); ++i) {
+      EXPECT_EQ(logged_[i].sct().timestamp(),
+                entries[i].leaf.timestamped_entry().timestamp());
+      EXPECT_EQ(logged_[i].entry().type(),
+                entries[i].leaf.timestamped_entry().entry_type());
+      if (with_scts) {
+        ASSERT_TRUE(entries[i].sct);
+        TestSigner::TestEqualSCTs(logged_[i].sct(), *entries[i].sct);
+      } else {
+        EXPECT_FALSE(entries[i].sct);
+      }
+    }
+  }
+
+  ThreadPool pool_;
+  MockUrlFetcher fetcher_;
+  AsyncLogClient client_;
+  TestSigner test_signer_;
+  vector<LoggedCertificate> logged_;
+};
+
+
+TEST_F(AsyncLogClientTest, ParsesJsonInPieces) {
+  for (size_t chunk_size : {1, 7, 1 << 20}) {
+    ExpectFetch(200, UrlFetcher::Headers{}, JsonReply(), chunk_size);
+    vector<AsyncLogClient::Entry> entries;
+    EXPECT_EQ(AsyncLogClient::OK, GetEntries(false, &entries));
+    ExpectEntries(entries, false);
+  }
+}
+
+
+TEST_F(AsyncLogClientTest, ParsesBinaryInPieces) {
+  for (size_t chunk_size : {1, 7, 1 << 20}) {
+    ExpectFetch(200, UrlFetcher::Headers{{"Content-Type",
+                                          "application/x-ct-entries"}},
+                BinaryReply(), chunk_size);
+    vector<AsyncLogClient::Entry> entries;
+    EXPECT_EQ(AsyncLogClient::OK, GetEntries(true, &entries));
+    ExpectEntries(entries, true);
+  }
+}
+
+
+TEST_F(AsyncLogClientTest, ParsesRecordsInPieces) {
+  for (size_t chunk_size : {1, 7, 1 << 20}) {
+    ExpectFetch(200, UrlFetcher::Headers{{"Content-Type",
+                                          "application/x-ct-entry-records"}},
+                RecordsReply(), chunk_size);
+    vector<AsyncLogClient::Entry> entries;
+    EXPECT_EQ(AsyncLogClient::OK, GetEntries(true, &entries));
+    ExpectEntries(entries, true);
+  }
+}
+
+
+TEST_F(AsyncLogClientTest, RecordsOutOfOrder) {
+  logged_.resize(1);
+  const string record(RecordsReply());
+  // The record of entry 0 again, where that of entry 1 should be.
+  ExpectFetch(200, UrlFetcher::Headers{{"Content-Type",
+                                        "application/x-ct-entry-records"}},
+              record.substr(0, record.size() -
+                                   SegmentStorage::kRecordHeaderLength) +
+                  record,
+              1 << 20);
+  vector<AsyncLogClient::Entry> entries;
+  EXPECT_EQ(AsyncLogClient::BAD_RESPONSE, GetEntries(true, &entries));
+}
+
+
+TEST_F(AsyncLogClientTest, TruncatedReply) {
+  const string json(JsonReply());
+  ExpectFetch(200, UrlFetcher::Headers{}, json.substr(0, json.size() - 20),
+              7);
+  vector<AsyncLogClient::Entry> entries;
+  EXPECT_EQ(AsyncLogClient::BAD_RESPONSE, GetEntries(false, &entries));
+  EXPECT_GT(logged_.size(), entries.size());
+}
+
+
+TEST_F(AsyncLogClientTest, MalformedReply) {
+  ExpectFetch(200, UrlFetcher::Headers{}, "{\"entries\":[1, 2]}", 3);
+  vector<AsyncLogClient::Entry> entries;
+  EXPECT_EQ(AsyncLogClient::BAD_RESPONSE, GetEntries(false, &entries));
+  EXPECT_TRUE(entries.empty());
+}
+
+
+TEST_F(AsyncLogClientTest, ErrorStatus) {
+  ExpectFetch(500, UrlFetcher::Headers{}, JsonReply(), 7);
+  vector<AsyncLogClient::Entry> entries;
+  EXPECT_EQ(AsyncLogClient::UNKNOWN_ERROR, GetEntries(false, &entries));
+  EXPECT_TRUE(entries.empty());
+}
+
+
+TEST_F(AsyncLogClientTest, UnavailableStatus) {
+  ExpectFetch(503, UrlFetcher::Headers{}, "", 7);
+  vector<AsyncLogClient::Entry> entries;
+  EXPECT_EQ(AsyncLogClient::UNAVAILABLE, GetEntries(false, &entries));
+  EXPECT_TRUE(entries.empty());
+}
+
+
+TEST_F(AsyncLogClientTest, GetEntriesOnlyAddsCompleteReplies) {
+  const string json(JsonReply());
+  ExpectFetch(200, UrlFetcher::Headers{}, json.substr(0, json.size() - 20),
+              7);
+  vector<AsyncLogClient::Entry> entries;
+  Notification notify;
+  client_.GetEntries(0, logged_.size() - 1, &entries,
+                     [&notify](AsyncLogClient::Status status) {
+                       EXPECT_EQ(AsyncLogClient::BAD_RESPONSE, status);
+                       notify.Notify();
+                     });
+  notify.WaitForNotification();
+  EXPECT_TRUE(entries.empty());
+}
+
+
+TEST_F(AsyncLogClientTest, EntriesLeaveRoomForOtherRequests) {
+  client_.SetMaxRequests(2);
+  vector<Task*> entries_tasks;
+  Notification second_started;
+  EXPECT_CALL(fetcher_, FetchStreaming(_, _, _, _, _))
+      .Times(2)
+      .WillRepeatedly(Invoke([&entries_tasks, &second_started](
+          const UrlFetcher::Request&, UrlFetcher::Response* resp,
+          const UrlFetcher::HeadersCallback&, const UrlFetcher::BodyCallback&,
+          Task* task) {
+        resp->status_code = 500;
+        entries_tasks.push_back(task);
+        if (entries_tasks.size() == 2) {
+          second_started.Notify();
+        }
+      }));
+
+  Notification entries_done[2];
+  for (int i = 0; i < 2; ++i) {
+    client_.GetEntriesStreaming(0, 4, false,
+                                [](vector<AsyncLogClient::Entry>*) {},
+                                [&entries_done, i](AsyncLogClient::Status) {
+                                  entries_done[i].Notify();
+                                });
+  }
+  // The second get-entries waits for the first one...
+  EXPECT_EQ(1U, entries_tasks.size());
+
+  // ...but not the get-sth.
+  Task* sth_task(nullptr);
+  EXPECT_CALL(fetcher_, Fetch(_, _, _))
+      .WillOnce(Invoke([&sth_task](const UrlFetcher::Request&,
+                                   UrlFetcher::Response* resp, Task* task) {
+        resp->status_code = 500;
+        sth_task = task;
+      }));
+  ct::SignedTreeHead sth;
+  Notification sth_done;
+  client_.GetSTH(&sth, [&sth_done](AsyncLogClient::Status) {
+    sth_done.Notify();
+  });
+  ASSERT_NE(nullptr, sth_task);
+  EXPECT_EQ(1U, entries_tasks.size());
+
+  entries_tasks[0]->Return();
+  entries_done[0].WaitForNotification();
+  second_started.WaitForNotification();
+  entries_tasks[1]->Return();
+  entries_done[1].WaitForNotification();
+  sth_task->Return();
+  sth_done.WaitForNotification();
+}
+
+
+}  // namespace
+}  // namespace cert_trans
+
+
+int main(int argc, char** argv) {
+  cert_trans::test::InitTesting(argv[0], &argc, &argv, true);
+  return RUN_ALL_TESTS();
+}
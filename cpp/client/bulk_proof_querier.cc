@@ -0,0 +1,211 @@
+#include "client/bulk_proof_querier.h"
+
+#include <glog/logging.h>
+#include <vector>
+
+using std::bind;
+using std::lock_guard;
+using std::make_shared;
+using std::mutex;
+using std::placeholders::_1;
+using std::shared_ptr;
+using std::string;
+using std::unique_lock;
+using std::vector;
+
+namespace cert_trans {
+
+
+struct BulkProofQuerier::Batch {
+  // The submission index of the first hash.
+  int64_t first;
+  vector<string> names;
+  vector<string> hashes;
+  vector<ct::MerkleAuditProof> proofs;
+  vector<AsyncLogClient::Status> statuses;
+  // The one-by-one queries still in flight, guarded by |lock_|.
+  size_t remaining;
+};
+
+
+BulkProofQuerier::BulkProofQuerier(AsyncLogClient* client,
+                                   const ct::SignedTreeHead& sth,
+                                   int max_in_flight, int batch_size,
+                                   const ResultCallback& result_cb)
+    : client_(CHECK_NOTNULL(client)),
+      sth_(sth),
+      max_in_flight_(max_in_flight),
+      batch_size_(batch_size),
+      result_cb_(result_cb),
+      next_result_(0),
+      submitted_(0),
+      in_flight_(0),
+      batch_supported_(true),
+      finished_(0),
+      failed_(0) {
+  CHECK_GT(max_in_flight_, 0);
+  CHECK_GT(batch_size, 0);
+  CHECK(result_cb_);
+}
+
+
+BulkProofQuerier::~BulkProofQuerier() {
+  Wait();
+}
+
+
+void BulkProofQuerier::Query(const string& name, const string& leaf_hash) {
+  {
+    lock_guard<mutex> lock(lock_);
+    if (!filling_) {
+      filling_ = make_shared<Batch>();
+      filling_->first = submitted_;
+    }
+    filling_->names.push_back(name);
+    filling_->hashes.push_back(leaf_hash);
+    ++submitted_;
+  }
+  Flush(false);
+}
+
+
+int64_t BulkProofQuerier::Wait() {
+  Flush(true);
+  unique_lock<mutex> lock(lock_);
+  done_.wait(lock, [this]() { return in_flight_ == 0; });
+  LOG(INFO) << "Queried the proofs of " << finished_ << " hashes, "
+            << failed_ << " failed";
+  return failed_;
+}
+
+
+void BulkProofQuerier::Flush(bool partial) {
+  shared_ptr<Batch> batch;
+  {
+    unique_lock<mutex> lock(lock_);
+    if (!filling_ || (!partial && filling_->hashes.size() < batch_size_)) {
+      return;
+    }
+    done_.wait(lock, [this]() { return in_flight_ < max_in_flight_; });
+    ++in_flight_;
+    batch.swap(filling_);
+  }
+  Send(batch);
+}
+
+
+void BulkProofQuerier::Send(const shared_ptr<Batch>& batch) {
+  bool batch_supported;
+  {
+    lock_guard<mutex> lock(lock_);
+    batch_supported = batch_supported_;
+  }
+  if (!batch_supported) {
+    return SendOneByOne(batch);
+  }
+
+  client_->QueryInclusionProofs(sth_, batch->hashes, &batch->proofs,
+                                bind(&BulkProofQuerier::BatchDone, this,
+                                     batch, _1));
+}
+
+
+void BulkProofQuerier::SendOneByOne(const shared_ptr<Batch>& batch) {
+  const size_t size(batch->hashes.size());
+  batch->proofs.clear();
+  batch->proofs.resize(size);
+  batch->statuses.assign(size, AsyncLogClient::UNKNOWN_ERROR);
+  {
+    lock_guard<mutex> lock(lock_);
+    batch->remaining = size;
+  }
+  for (size_t i = 0; i < size; ++i) {
+    client_->QueryInclusionProof(sth_, batch->hashes[i], &batch->proofs[i],
+                                 bind(&BulkProofQuerier::OneDone, this, batch,
+                                      i, _1));
+  }
+}
+
+
+void BulkProofQuerier::BatchDone(const shared_ptr<Batch>& batch,
+                                 AsyncLogClient::Status status) {
+  if (status == AsyncLogClient::OK) {
+    for (const ct::MerkleAuditProof& proof : batch->proofs) {
+      batch->statuses.push_back(proof.has_leaf_index()
+                                    ? AsyncLogClient::OK
+                                    : AsyncLogClient::UNKNOWN_ERROR);
+    }
+    return Finish(batch);
+  }
+  // The log is there, but too busy for this batch.
+  if (status == AsyncLogClient::UNAVAILABLE) {
+    batch->statuses.assign(batch->hashes.size(), status);
+    return Finish(batch);
+  }
+
+  {
+    lock_guard<mutex> lock(lock_);
+    if (batch_supported_) {
+      LOG(WARNING) << "get-proofs-by-hash failed (" << status
+                   << "), querying the proofs one by one";
+      batch_supported_ = false;
+    }
+  }
+  SendOneByOne(batch);
+}
+
+
+void BulkProofQuerier::OneDone(const shared_ptr<Batch>& batch, size_t index,
+                               AsyncLogClient::Status status) {
+  batch->statuses[index] = status;
+  {
+    lock_guard<mutex> lock(lock_);
+    if (--batch->remaining > 0) {
+      return;
+    }
+  }
+  Finish(batch);
+}
+
+
+void BulkProofQuerier::Finish(const shared_ptr<Batch>& batch) {
+  int delivered(0);
+  int64_t finished(0);
+  int64_t failed(0);
+  {
+    lock_guard<mutex> lock(result_lock_);
+    done_batches_.emplace(batch->first, batch);
+    for (auto it = done_batches_.begin();
+         it != done_batches_.end() && it->first == next_result_;
+         it = done_batches_.erase(it)) {
+      const Batch& done_batch(*it->second);
+      for (size_t i = 0; i < done_batch.names.size(); ++i) {
+        LOG_IF(WARNING, done_batch.statuses[i] != AsyncLogClient::OK)
+            << "Querying the proof of " << done_batch.names[i]
+            << " failed: " << done_batch.statuses[i];
+        result_cb_(done_batch.names[i], done_batch.statuses[i],
+                   done_batch.proofs[i]);
+        if (done_batch.statuses[i] != AsyncLogClient::OK) {
+          ++failed;
+        }
+      }
+      next_result_ += done_batch.names.size();
+      finished += done_batch.names.size();
+      ++delivered;
+    }
+  }
+  if (delivered == 0) {
+    return;
+  }
+
+  {
+    lock_guard<mutex> lock(lock_);
+    in_flight_ -= delivered;
+    finished_ += finished;
+    failed_ += failed;
+  }
+  done_.notify_all();
+}
+
+
+}  // namespace cert_trans
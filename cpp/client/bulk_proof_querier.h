@@ -0,0 +1,98 @@
+#ifndef CERT_TRANS_CLIENT_BULK_PROOF_QUERIER_H_
+#define CERT_TRANS_CLIENT_BULK_PROOF_QUERIER_H_
+
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+
+#include "base/macros.h"
+#include "client/async_log_client.h"
+#include "proto/ct.pb.h"
+
+namespace cert_trans {
+
+
+// Queries the inclusion proofs of many leaf hashes in the tree of one
+// STH, |batch_size| of them per non-standard get-proofs-by-hash
+// request, with up to |max_in_flight| batches at once. If the log
+// fails a batch request (as the logs which do not have this request
+// do), the hashes of that batch and of all the later ones are queried
+// one by one with get-proof-by-hash instead, a whole batch at once;
+// AsyncLogClient::SetMaxRequests() limits how many of those are in
+// flight.
+class BulkProofQuerier {
+ public:
+  // Called with the name of each leaf hash, once its proof is known,
+  // and that proof if |status| is OK. |status| is UNKNOWN_ERROR if the
+  // hash is not in the tree. Called one at a time, in the order the
+  // hashes were submitted.
+  typedef std::function<void(const std::string& name,
+                             AsyncLogClient::Status status,
+                             const ct::MerkleAuditProof& proof)>
+      ResultCallback;
+
+  // Does not take ownership of |client|.
+  BulkProofQuerier(AsyncLogClient* client, const ct::SignedTreeHead& sth,
+                   int max_in_flight, int batch_size,
+                   const ResultCallback& result_cb);
+  // Waits for the hashes submitted so far.
+  ~BulkProofQuerier();
+
+  // Submits |leaf_hash|, first waiting for a batch slot if its batch
+  // is full and they are all in use.
+  void Query(const std::string& name, const std::string& leaf_hash);
+
+  // Waits for all the hashes submitted so far to be done, and returns
+  // how many of them failed.
+  int64_t Wait();
+
+ private:
+  struct Batch;
+
+  // Sends the batch being filled, if it is full or |partial|.
+  void Flush(bool partial);
+  void Send(const std::shared_ptr<Batch>& batch);
+  void SendOneByOne(const std::shared_ptr<Batch>& batch);
+  void BatchDone(const std::shared_ptr<Batch>& batch,
+                 AsyncLogClient::Status status);
+  void OneDone(const std::shared_ptr<Batch>& batch, size_t index,
+               AsyncLogClient::Status status);
+  // Passes on the results of |batch|, and of those after it which
+  // were waiting for it.
+  void Finish(const std::shared_ptr<Batch>& batch);
+
+  AsyncLogClient* const client_;
+  const ct::SignedTreeHead sth_;
+  const int max_in_flight_;
+  const size_t batch_size_;
+  const ResultCallback result_cb_;
+
+  // Serialises the calls to |result_cb_|.
+  std::mutex result_lock_;
+  // The batches done before those submitted earlier, by the index of
+  // their first hash.
+  std::map<int64_t, std::shared_ptr<Batch>> done_batches_;
+  int64_t next_result_;
+
+  std::mutex lock_;
+  std::condition_variable done_;
+  std::shared_ptr<Batch> filling_;
+  int64_t submitted_;
+  // Batches count as in flight until their results are passed on, so
+  // that those done early are not piled up.
+  int in_flight_;
+  bool batch_supported_;
+  int64_t finished_;
+  int64_t failed_;
+
+  DISALLOW_COPY_AND_ASSIGN(BulkProofQuerier);
+};
+
+
+}  // namespace cert_trans
+
+#endif  // CERT_TRANS_CLIENT_BULK_PROOF_QUERIER_H_
@@ -0,0 +1,238 @@
+#include "client/bulk_proof_querier.h"
+
+#include <event2/http.h>
+#include <functional>
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include <mutex>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+
+#include "net/mock_url_fetcher.h"
+#include "util/json_wrapper.h"
+#include "util/testing.h"
+#include "util/thread_pool.h"
+#include "util/util.h"
+
+namespace cert_trans {
+namespace {
+
+using std::bind;
+using std::lock_guard;
+using std::mutex;
+using std::placeholders::_1;
+using std::placeholders::_2;
+using std::placeholders::_3;
+using std::string;
+using std::to_string;
+using std::vector;
+using testing::_;
+using testing::AnyNumber;
+using testing::Invoke;
+using util::Task;
+
+const char kLogUrl[] = "https://example.com";
+const int64_t kTreeSize = 100;
+
+
+// The leaf hash of the entry at |index|, or of an entry that is not in
+// the tree if it is negative.
+string LeafHash(int index) {
+  return index < 0 ? string(32, 'z') : string(32, 'a' + index);
+}
+
+
+// The log's answer for |hash|, which is in the tree if its leaf index
+// is found.
+bool LeafIndex(const string& hash, int64_t* leaf_index) {
+  if (hash.size() != 32 || hash[0] == 'z') {
+    return false;
+  }
+  *leaf_index = hash[0] - 'a';
+  return true;
+}
+
+
+class BulkProofQuerierTest : public ::testing::Test {
+ protected:
+  BulkProofQuerierTest()
+      : client_(&pool_, &fetcher_, kLogUrl),
+        batch_supported_(true),
+        batch_requests_(0),
+        single_requests_(0) {
+    sth_.set_tree_size(kTreeSize);
+    sth_.set_timestamp(1234);
+    EXPECT_CALL(fetcher_, Fetch(_, _, _))
+        .Times(AnyNumber())
+        .WillRepeatedly(Invoke(
+            bind(&BulkProofQuerierTest::HandleFetch, this, _1, _2, _3)));
+  }
+
+  void HandleFetch(const UrlFetcher::Request& req,
+                   UrlFetcher::Response* resp, Task* task) {
+    if (req.url.Path() == "/ct/v1/get-proofs-by-hash") {
+      HandleGetProofs(req, resp);
+    } else {
+      EXPECT_EQ("/ct/v1/get-proof-by-hash", req.url.Path());
+      HandleGetProof(req, resp);
+    }
+    task->Return();
+  }
+
+  void HandleGetProofs(const UrlFetcher::Request& req,
+                       UrlFetcher::Response* resp) {
+    {
+      lock_guard<mutex> lock(lock_);
+      ++batch_requests_;
+    }
+    if (!batch_supported_) {
+      resp->status_code = HTTP_NOTFOUND;
+      return;
+    }
+
+    EXPECT_EQ(UrlFetcher::Verb::POST, req.verb);
+    JsonObject body(req.body);
+    JsonInt tree_size(body, "tree_size");
+    JsonArray hashes(body, "hashes");
+    ASSERT_TRUE(tree_size.Ok());
+    EXPECT_EQ(kTreeSize, tree_size.Value());
+    ASSERT_TRUE(hashes.Ok());
+
+    JsonArray proofs;
+    for (int i = 0; i < hashes.Length(); ++i) {
+      JsonString hash(hashes, i);
+      ASSERT_TRUE(hash.Ok());
+      int64_t leaf_index;
+      if (!LeafIndex(hash.FromBase64(), &leaf_index)) {
+        continue;
+      }
+      JsonArray audit_path;
+      audit_path.AddBase64("node");
+      JsonObject proof;
+      proof.AddBase64("hash", hash.FromBase64());
+      proof.Add("leaf_index", leaf_index);
+      proof.Add("audit_path", audit_path);
+      proofs.Add(&proof);
+    }
+    JsonObject reply;
+    reply.Add("proofs", proofs);
+    resp->status_code = HTTP_OK;
+    resp->body = reply.ToString();
+  }
+
+  void HandleGetProof(const UrlFetcher::Request& req,
+                      UrlFetcher::Response* resp) {
+    {
+      lock_guard<mutex> lock(lock_);
+      ++single_requests_;
+    }
+    // The hash is the first parameter.
+    const string query(req.url.Query());
+    ASSERT_EQ(0U, query.find("hash="));
+    const string encoded(query.substr(5, query.find('&') - 5));
+    char* const decoded(evhttp_uridecode(encoded.c_str(), 0, nullptr));
+    const string hash(util::FromBase64(decoded));
+    free(decoded);
+
+    int64_t leaf_index;
+    if (!LeafIndex(hash, &leaf_index)) {
+      resp->status_code = HTTP_BADREQUEST;
+      return;
+    }
+    JsonArray audit_path;
+    audit_path.AddBase64("node");
+    JsonObject reply;
+    reply.Add("leaf_index", leaf_index);
+    reply.Add("audit_path", audit_path);
+    resp->status_code = HTTP_OK;
+    resp->body = reply.ToString();
+  }
+
+  // Queries the proofs of the entries at |indices|, named after their
+  // position, and returns the number of failures.
+  int64_t Query(const vector<int>& indices, int max_in_flight,
+                int batch_size) {
+    BulkProofQuerier querier(
+        &client_, sth_, max_in_flight, batch_size,
+        [this](const string& name, AsyncLogClient::Status status,
+               const ct::MerkleAuditProof& proof) {
+          EXPECT_EQ(to_string(names_.size()), name);
+          names_.push_back(name);
+          statuses_.push_back(status);
+          if (status == AsyncLogClient::OK) {
+            EXPECT_EQ(kTreeSize, proof.tree_size());
+            ASSERT_EQ(1, proof.path_node_size());
+            EXPECT_EQ("node", proof.path_node(0));
+          }
+          leaf_indices_.push_back(proof.leaf_index());
+        });
+    for (size_t i = 0; i < indices.size(); ++i) {
+      querier.Query(to_string(i), LeafHash(indices[i]));
+    }
+    return querier.Wait();
+  }
+
+  ThreadPool pool_;
+  MockUrlFetcher fetcher_;
+  AsyncLogClient client_;
+  ct::SignedTreeHead sth_;
+  vector<string> names_;
+  vector<AsyncLogClient::Status> statuses_;
+  vector<int64_t> leaf_indices_;
+
+  bool batch_supported_;
+  mutex lock_;
+  int batch_requests_;
+  int single_requests_;
+};
+
+
+TEST_F(BulkProofQuerierTest, BatchesInOrder) {
+  EXPECT_EQ(1, Query({0, 1, 2, 3, -1, 5, 6, 7, 8, 9}, 2, 3));
+  EXPECT_EQ(4, batch_requests_);
+  EXPECT_EQ(0, single_requests_);
+  ASSERT_EQ(10U, statuses_.size());
+  for (int i = 0; i < 10; ++i) {
+    if (i == 4) {
+      EXPECT_EQ(AsyncLogClient::UNKNOWN_ERROR, statuses_[i]);
+    } else {
+      EXPECT_EQ(AsyncLogClient::OK, statuses_[i]) << i;
+      EXPECT_EQ(i, leaf_indices_[i]);
+    }
+  }
+}
+
+
+TEST_F(BulkProofQuerierTest, RepeatedHashes) {
+  EXPECT_EQ(0, Query({3, 3, 1, 3}, 1, 4));
+  EXPECT_EQ(vector<int64_t>({3, 3, 1, 3}), leaf_indices_);
+}
+
+
+TEST_F(BulkProofQuerierTest, FallsBackToSingleQueries) {
+  batch_supported_ = false;
+  EXPECT_EQ(1, Query({0, 1, 2, 3, -1, 5, 6}, 2, 3));
+  // Only the first batch is tried with get-proofs-by-hash.
+  EXPECT_EQ(1, batch_requests_);
+  EXPECT_EQ(7, single_requests_);
+  ASSERT_EQ(7U, statuses_.size());
+  for (int i = 0; i < 7; ++i) {
+    if (i == 4) {
+      EXPECT_EQ(AsyncLogClient::UNKNOWN_ERROR, statuses_[i]);
+    } else {
+      EXPECT_EQ(AsyncLogClient::OK, statuses_[i]) << i;
+      EXPECT_EQ(i, leaf_indices_[i]);
+    }
+  }
+}
+
+
+}  // namespace
+}  // namespace cert_trans
+
+
+int main(int argc, char** argv) {
+  cert_trans::test::InitTesting(argv[0], &argc, &argv, true);
+  return RUN_ALL_TESTS();
+}
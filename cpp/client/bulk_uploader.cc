@@ -0,0 +1,135 @@
+#include "client/bulk_uploader.h"
+
+#include <algorithm>
+#include <glog/logging.h>
+
+#include "log/cert.h"
+#include "util/executor.h"
+#include "util/task.h"
+
+using std::bind;
+using std::chrono::duration;
+using std::lock_guard;
+using std::make_shared;
+using std::mutex;
+using std::placeholders::_1;
+using std::shared_ptr;
+using std::string;
+using std::unique_lock;
+using std::unique_ptr;
+
+namespace cert_trans {
+
+
+struct BulkUploader::Chain {
+  string name;
+  unique_ptr<CertChain> chain;
+  ct::SignedCertificateTimestamp sct;
+  // How many times the log turned it away.
+  int failures;
+};
+
+
+BulkUploader::BulkUploader(AsyncLogClient* client, util::Executor* executor,
+                           bool precert, int max_in_flight, int max_retries,
+                           const duration<double>& retry_delay,
+                           const ResultCallback& result_cb)
+    : client_(CHECK_NOTNULL(client)),
+      executor_(CHECK_NOTNULL(executor)),
+      precert_(precert),
+      max_in_flight_(max_in_flight),
+      max_retries_(max_retries),
+      retry_delay_(retry_delay),
+      result_cb_(result_cb),
+      in_flight_(0),
+      finished_(0),
+      failed_(0),
+      retried_(0) {
+  CHECK_GT(max_in_flight_, 0);
+  CHECK_GE(max_retries_, 0);
+  CHECK(result_cb_);
+}
+
+
+BulkUploader::~BulkUploader() {
+  Wait();
+}
+
+
+void BulkUploader::Upload(const string& name, const string& pem_chain) {
+  const shared_ptr<Chain> chain(make_shared<Chain>());
+  chain->name = name;
+  chain->chain.reset(precert_ ? new PreCertChain(pem_chain)
+                              : new CertChain(pem_chain));
+  chain->failures = 0;
+  {
+    unique_lock<mutex> lock(lock_);
+    done_.wait(lock, [this]() { return in_flight_ < max_in_flight_; });
+    ++in_flight_;
+  }
+  Submit(chain);
+}
+
+
+int64_t BulkUploader::Wait() {
+  unique_lock<mutex> lock(lock_);
+  done_.wait(lock, [this]() { return in_flight_ == 0; });
+  LOG(INFO) << "Submitted " << finished_ << " chains, " << failed_
+            << " failed, after " << retried_ << " retries";
+  return failed_;
+}
+
+
+void BulkUploader::Submit(const shared_ptr<Chain>& chain) {
+  const AsyncLogClient::Callback done(
+      bind(&BulkUploader::SubmitDone, this, chain, _1));
+  if (precert_) {
+    client_->AddPreCertChain(static_cast<const PreCertChain&>(*chain->chain),
+                             &chain->sct, done);
+  } else {
+    client_->AddCertChain(*chain->chain, &chain->sct, done);
+  }
+}
+
+
+void BulkUploader::SubmitDone(const shared_ptr<Chain>& chain,
+                              AsyncLogClient::Status status) {
+  if (status == AsyncLogClient::UNAVAILABLE &&
+      chain->failures < max_retries_) {
+    const duration<double> delay(retry_delay_ *
+                                 (1 << std::min(chain->failures, 16)));
+    ++chain->failures;
+    VLOG(1) << "Log unavailable, submitting " << chain->name
+            << " again in " << delay.count() << "s";
+    {
+      lock_guard<mutex> lock(lock_);
+      ++retried_;
+    }
+    executor_->Delay(delay, new util::Task(
+                                [this, chain](util::Task* task) {
+                                  delete task;
+                                  Submit(chain);
+                                },
+                                executor_));
+    return;
+  }
+
+  LOG_IF(WARNING, status != AsyncLogClient::OK)
+      << "Submitting " << chain->name << " failed: " << status;
+  {
+    lock_guard<mutex> lock(result_lock_);
+    result_cb_(chain->name, status, chain->sct);
+  }
+  {
+    lock_guard<mutex> lock(lock_);
+    --in_flight_;
+    ++finished_;
+    if (status != AsyncLogClient::OK) {
+      ++failed_;
+    }
+  }
+  done_.notify_all();
+}
+
+
+}  // namespace cert_trans
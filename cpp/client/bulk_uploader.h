@@ -0,0 +1,86 @@
+#ifndef CERT_TRANS_CLIENT_BULK_UPLOADER_H_
+#define CERT_TRANS_CLIENT_BULK_UPLOADER_H_
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+
+#include "base/macros.h"
+#include "client/async_log_client.h"
+#include "proto/ct.pb.h"
+
+namespace util {
+class Executor;
+}  // namespace util
+
+namespace cert_trans {
+
+
+// Submits many chains to a log, with up to |max_in_flight| add-chain
+// or add-pre-chain requests at once. The chains the log turns away
+// with a 503 are submitted again after |retry_delay|, doubled with
+// each attempt, up to |max_retries| times; they count as in flight
+// in the meantime.
+class BulkUploader {
+ public:
+  // Called with the name of each chain, once it is done, and its SCT
+  // if |status| is OK. Called one at a time, in the order the chains
+  // are done.
+  typedef std::function<void(const std::string& name,
+                             AsyncLogClient::Status status,
+                             const ct::SignedCertificateTimestamp& sct)>
+      ResultCallback;
+
+  // Does not take ownership of |client| or |executor|, on which the
+  // retries are delayed.
+  BulkUploader(AsyncLogClient* client, util::Executor* executor,
+               bool precert, int max_in_flight, int max_retries,
+               const std::chrono::duration<double>& retry_delay,
+               const ResultCallback& result_cb);
+  // Waits for the chains in flight.
+  ~BulkUploader();
+
+  // Submits |pem_chain|, concatenated PEM certificates, first waiting
+  // for a request slot if they are all in use.
+  void Upload(const std::string& name, const std::string& pem_chain);
+
+  // Waits for all the chains submitted so far to be done, and returns
+  // how many of them failed.
+  int64_t Wait();
+
+ private:
+  struct Chain;
+
+  void Submit(const std::shared_ptr<Chain>& chain);
+  void SubmitDone(const std::shared_ptr<Chain>& chain,
+                  AsyncLogClient::Status status);
+
+  AsyncLogClient* const client_;
+  util::Executor* const executor_;
+  const bool precert_;
+  const int max_in_flight_;
+  const int max_retries_;
+  const std::chrono::duration<double> retry_delay_;
+
+  // Serialises the calls to |result_cb_|.
+  std::mutex result_lock_;
+  const ResultCallback result_cb_;
+
+  std::mutex lock_;
+  std::condition_variable done_;
+  int in_flight_;
+  int64_t finished_;
+  int64_t failed_;
+  int64_t retried_;
+
+  DISALLOW_COPY_AND_ASSIGN(BulkUploader);
+};
+
+
+}  // namespace cert_trans
+
+#endif  // CERT_TRANS_CLIENT_BULK_UPLOADER_H_
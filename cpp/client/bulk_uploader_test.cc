@@ -0,0 +1,151 @@
+#include "client/bulk_uploader.h"
+
+#include <functional>
+#include <gflags/gflags.h>
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include <map>
+#include <mutex>
+#include <string>
+
+#include "net/mock_url_fetcher.h"
+#include "proto/serializer.h"
+#include "util/testing.h"
+#include "util/thread_pool.h"
+#include "util/util.h"
+
+DECLARE_string(test_srcdir);
+
+namespace cert_trans {
+namespace {
+
+using std::bind;
+using std::chrono::milliseconds;
+using std::lock_guard;
+using std::map;
+using std::mutex;
+using std::placeholders::_1;
+using std::placeholders::_2;
+using std::placeholders::_3;
+using std::string;
+using testing::_;
+using testing::AnyNumber;
+using testing::Invoke;
+using util::Task;
+
+const char kLogUrl[] = "https://example.com";
+const char kCert[] = "test-cert.pem";
+const int64_t kTimestamp = 1234;
+
+
+class BulkUploaderTest : public ::testing::Test {
+ protected:
+  BulkUploaderTest()
+      : client_(&pool_, &fetcher_, kLogUrl),
+        requests_(0),
+        unavailable_left_(0) {
+    CHECK(util::ReadTextFile(FLAGS_test_srcdir + "/test/testdata/" + kCert,
+                             &pem_));
+    EXPECT_CALL(fetcher_, Fetch(_, _, _))
+        .Times(AnyNumber())
+        .WillRepeatedly(Invoke(
+            bind(&BulkUploaderTest::HandleAddChain, this, _1, _2, _3)));
+  }
+
+  // Answers with a 503 while |unavailable_left_| is positive.
+  void HandleAddChain(const UrlFetcher::Request& req,
+                      UrlFetcher::Response* resp, Task* task) {
+    EXPECT_EQ("/ct/v1/add-chain", req.url.Path());
+    {
+      lock_guard<mutex> lock(lock_);
+      ++requests_;
+      if (unavailable_left_ > 0) {
+        --unavailable_left_;
+        resp->status_code = 503;
+        task->Return();
+        return;
+      }
+    }
+
+    ct::DigitallySigned signature;
+    signature.set_hash_algorithm(ct::DigitallySigned::SHA256);
+    signature.set_sig_algorithm(ct::DigitallySigned::ECDSA);
+    signature.set_signature("signature");
+    string flat_signature;
+    CHECK_EQ(Serializer::OK,
+             Serializer::SerializeDigitallySigned(signature, &flat_signature));
+    resp->status_code = 200;
+    resp->body = "{\"sct_version\":0,\"id\":\"" + util::ToBase64("id") +
+                 "\",\"timestamp\":" + std::to_string(kTimestamp) +
+                 ",\"extensions\":\"\",\"signature\":\"" +
+                 util::ToBase64(flat_signature) + "\"}";
+    task->Return();
+  }
+
+  // Uploads |count| copies of the chain, and returns the number of
+  // failures.
+  int64_t Upload(int count, int max_retries) {
+    BulkUploader uploader(
+        &client_, &pool_, false /* precert */, 2, max_retries,
+        milliseconds(1),
+        [this](const string& name, AsyncLogClient::Status status,
+               const ct::SignedCertificateTimestamp& sct) {
+          results_[name] = status;
+          if (status == AsyncLogClient::OK) {
+            EXPECT_EQ(kTimestamp, sct.timestamp());
+          }
+        });
+    for (int i = 0; i < count; ++i) {
+      uploader.Upload(std::to_string(i), pem_);
+    }
+    return uploader.Wait();
+  }
+
+  ThreadPool pool_;
+  MockUrlFetcher fetcher_;
+  AsyncLogClient client_;
+  string pem_;
+  map<string, AsyncLogClient::Status> results_;
+
+  mutex lock_;
+  int requests_;
+  int unavailable_left_;
+};
+
+
+TEST_F(BulkUploaderTest, UploadsAll) {
+  EXPECT_EQ(0, Upload(10, 0));
+  EXPECT_EQ(10, requests_);
+  ASSERT_EQ(10U, results_.size());
+  for (const auto& result : results_) {
+    EXPECT_EQ(AsyncLogClient::OK, result.second) << result.first;
+  }
+}
+
+
+TEST_F(BulkUploaderTest, RetriesUnavailable) {
+  unavailable_left_ = 3;
+  EXPECT_EQ(0, Upload(2, 3));
+  EXPECT_EQ(5, requests_);
+  ASSERT_EQ(2U, results_.size());
+  EXPECT_EQ(AsyncLogClient::OK, results_["0"]);
+  EXPECT_EQ(AsyncLogClient::OK, results_["1"]);
+}
+
+
+TEST_F(BulkUploaderTest, GivesUpAfterRetries) {
+  unavailable_left_ = 100;
+  EXPECT_EQ(1, Upload(1, 2));
+  EXPECT_EQ(3, requests_);
+  EXPECT_EQ(AsyncLogClient::UNAVAILABLE, results_["0"]);
+}
+
+
+}  // namespace
+}  // namespace cert_trans
+
+
+int main(int argc, char** argv) {
+  cert_trans::test::InitTesting(argv[0], &argc, &argv, true);
+  return RUN_ALL_TESTS();
+}
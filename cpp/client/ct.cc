@@ -1,4 +1,7 @@
 /* -*- indent-tabs-mode: nil -*- */
+#include <algorithm>
+#include <chrono>
+#include <dirent.h>
 #include <event2/thread.h>
 #include <fcntl.h>
 #include <fstream>
@@ -19,7 +22,9 @@
 #include <stdio.h>
 #include <string>
 
+#include "client/bulk_uploader.h"
 #include "client/http_log_client.h"
+#include "client/log_scanner.h"
 #include "client/ssl_client.h"
 #include "log/cert.h"
 #include "log/cert_submission_handler.h"
@@ -35,7 +40,9 @@
 #include "proto/ct.pb.h"
 #include "proto/serializer.h"
 #include "util/init.h"
+#include "util/libevent_wrapper.h"
 #include "util/read_key.h"
+#include "util/thread_pool.h"
 
 DEFINE_string(ssl_client_trusted_cert_dir, "",
               "Trusted root certificates for the ssl client");
@@ -101,6 +108,56 @@ DEFINE_string(sth2, "", "File containing second STH");
 DEFINE_uint64(monitor_sleep_time_secs, 60,
               "Amount of time the monitor shall "
               "sleep between probing for a new STH.");
+DEFINE_int32(monitor_threads, 0,
+             "Number of threads the monitor hashes the tree with when "
+             "confirming it; on the calling thread only if 0.");
+DEFINE_string(scan_domain_regex, "",
+              "With the 'scan' command, only report the certificates with "
+              "a DNS name matching this POSIX extended regular expression, "
+              "ignoring case");
+DEFINE_string(scan_issuer, "",
+              "With the 'scan' command, only report the certificates whose "
+              "issuer name contains this string");
+DEFINE_bool(scan_precerts_only, false,
+            "With the 'scan' command, only report precertificates");
+DEFINE_int64(scan_first, 0, "First entry to scan with the 'scan' command");
+DEFINE_int64(scan_last, -1,
+             "Last entry to scan with the 'scan' command, or -1 for the "
+             "last entry of the current STH of the log");
+DEFINE_int32(scan_batch_size, 1000,
+             "Number of entries asked for in each get-entries request of "
+             "the 'scan' command");
+DEFINE_int32(scan_parallel_fetches, 8,
+             "Number of get-entries requests the 'scan' command has in "
+             "flight at once");
+DEFINE_int32(scan_matcher_threads, 0,
+             "Number of threads the 'scan' command matches the entries "
+             "with; one per CPU if 0");
+DEFINE_int32(scan_max_retries, 3,
+             "Number of times the 'scan' command retries a failed "
+             "get-entries request before giving up");
+DEFINE_int32(scan_progress_interval_seconds, 10,
+             "Interval between the progress reports of the 'scan' command");
+DEFINE_string(scan_output, "",
+              "File the 'scan' command writes the matching entries to, "
+              "one per line, rather than the standard output");
+DEFINE_string(bulk_upload_in, "",
+              "Chains the 'bulk_upload' command submits: a directory with "
+              "one chain of PEM certificates per file, or a file, or - for "
+              "the standard input, with chains separated by blank lines");
+DEFINE_int32(bulk_upload_max_in_flight, 64,
+             "Number of add-chain requests the 'bulk_upload' command has "
+             "in flight at once");
+DEFINE_int32(bulk_upload_max_retries, 5,
+             "Number of times the 'bulk_upload' command submits a chain "
+             "again when the log answers with a 503");
+DEFINE_int32(bulk_upload_retry_delay_ms, 500,
+             "Delay before the 'bulk_upload' command first submits a chain "
+             "again, doubled with each retry");
+DEFINE_string(bulk_upload_sct_out, "",
+              "File the 'bulk_upload' command writes the SCTs to, as each "
+              "chain is done, one per line with the name of its chain, "
+              "rather than the standard output");
 
 
 static const char kUsage[] =
@@ -108,6 +165,8 @@ static const char kUsage[] =
     "Known commands:\n"
     "connect - connect to an SSL server\n"
     "upload - upload a submission to a CT log server\n"
+    "bulk_upload - upload many submissions to a CT log server at once\n"
+    "              (see bulk_upload_* flags)\n"
     "certificate - make a superfluous proof certificate\n"
     "extension_data - convert an audit proof to TLS extension format\n"
     "configure_proof - write the proof in an X509v3 configuration file\n"
@@ -118,6 +177,7 @@ static const char kUsage[] =
     "                them as if they were retrieved via 'connect'\n"
     "get_roots - get roots from the log\n"
     "get_entries - get entries from the log\n"
+    "scan - scan entries of the log for certificates (see scan_* flags)\n"
     "sth - get the current STH from the log\n"
     "consistency - get and check consistency of two STHs\n"
     "monitor - use the monitor (see monitor_action flag)\n"
@@ -370,6 +430,98 @@ static int Upload() {
   return 0;
 }
 
+// Writes the SCT of the chain |name| to |output|, base64-encoded.
+static void WriteBulkUploadResult(std::ostream* output, const string& name,
+                                  AsyncLogClient::Status status,
+                                  const SignedCertificateTimestamp& sct) {
+  if (status != AsyncLogClient::OK) {
+    return;
+  }
+  string serialized_sct;
+  CHECK_EQ(Serializer::OK, Serializer::SerializeSCT(sct, &serialized_sct));
+  // Flushed each time, so that the SCTs of an interrupted upload are
+  // not lost.
+  *output << name << '\t' << util::ToBase64(serialized_sct) << std::endl;
+}
+
+
+// Submits the chains from --bulk_upload_in concurrently.
+// 0 - ok
+// 1 - some chains could not be submitted
+static int BulkUpload() {
+  CHECK_NE(FLAGS_ct_server, "");
+  CHECK_NE(FLAGS_bulk_upload_in, "");
+
+  std::ofstream file;
+  if (!FLAGS_bulk_upload_sct_out.empty()) {
+    file.open(FLAGS_bulk_upload_sct_out, std::ios::trunc);
+    CHECK(file.good()) << FLAGS_bulk_upload_sct_out;
+  }
+  std::ostream* const output(FLAGS_bulk_upload_sct_out.empty() ? &std::cout
+                                                               : &file);
+
+  const std::shared_ptr<cert_trans::libevent::Base> base(
+      std::make_shared<cert_trans::libevent::Base>());
+  cert_trans::libevent::EventPumpThread pump(base);
+  cert_trans::ThreadPool pool;
+  cert_trans::UrlFetcher fetcher(base.get(), &pool);
+  AsyncLogClient client(&pool, &fetcher, FLAGS_ct_server);
+  cert_trans::BulkUploader uploader(
+      &client, &pool, FLAGS_precert, FLAGS_bulk_upload_max_in_flight,
+      FLAGS_bulk_upload_max_retries,
+      std::chrono::milliseconds(FLAGS_bulk_upload_retry_delay_ms),
+      std::bind(&WriteBulkUploadResult, output, std::placeholders::_1,
+                std::placeholders::_2, std::placeholders::_3));
+
+  DIR* const dir(opendir(FLAGS_bulk_upload_in.c_str()));
+  if (dir) {
+    vector<string> names;
+    while (const dirent* const entry = readdir(dir)) {
+      if (entry->d_name[0] != '.') {
+        names.emplace_back(FLAGS_bulk_upload_in + "/" + entry->d_name);
+      }
+    }
+    closedir(dir);
+    std::sort(names.begin(), names.end());
+    for (const string& name : names) {
+      string pem;
+      PCHECK(util::ReadBinaryFile(name, &pem)) << "Could not read " << name;
+      uploader.Upload(name, pem);
+    }
+  } else {
+    std::ifstream in_file;
+    if (FLAGS_bulk_upload_in != "-") {
+      in_file.open(FLAGS_bulk_upload_in);
+      PCHECK(in_file.good()) << "Could not open " << FLAGS_bulk_upload_in;
+    }
+    std::istream* const input(FLAGS_bulk_upload_in == "-" ? &std::cin
+                                                          : &in_file);
+    // The chains are read as they are submitted, rather than all at
+    // once, and named after the line they start at.
+    string pem, line;
+    int line_number(0), first_line(1);
+    while (std::getline(*input, line)) {
+      ++line_number;
+      if (!line.empty()) {
+        pem.append(line).append("\n");
+        continue;
+      }
+      if (!pem.empty()) {
+        uploader.Upload(FLAGS_bulk_upload_in + ":" + std::to_string(first_line),
+                        pem);
+        pem.clear();
+      }
+      first_line = line_number + 1;
+    }
+    if (!pem.empty()) {
+      uploader.Upload(FLAGS_bulk_upload_in + ":" + std::to_string(first_line),
+                      pem);
+    }
+  }
+
+  return uploader.Wait() == 0 ? 0 : 1;
+}
+
 // FIXME: fix all the memory leaks in this code.
 static void MakeCert() {
   string sct;
@@ -882,6 +1034,93 @@ void GetEntries() {
   }
 }
 
+// Writes a line about a matching entry for the 'scan' command: its
+// index, type, subject and issuer names, and DNS names, separated by
+// tabs.
+static void WriteScanMatch(std::ostream* output, int64_t index,
+                           const AsyncLogClient::Entry& entry,
+                           const Cert& cert) {
+  *output << index << '\t'
+          << (entry.leaf.timestamped_entry().entry_type() ==
+                      ct::PRECERT_ENTRY
+                  ? "precert"
+                  : "x509");
+  if (!cert.IsLoaded()) {
+    *output << "\t\t\t" << std::endl;
+    return;
+  }
+
+  *output << '\t' << cert.PrintSubjectName() << '\t'
+          << cert.PrintIssuerName() << '\t';
+  vector<string> names;
+  if (cert.DnsNames(&names) == Cert::TRUE) {
+    for (size_t i = 0; i < names.size(); ++i) {
+      *output << (i > 0 ? "," : "") << names[i];
+    }
+  }
+  *output << std::endl;
+}
+
+// Scans the entries of the log for the certificates matching the
+// scan_* flags, fetching them in parallel.
+int Scan() {
+  CHECK_NE(FLAGS_ct_server, "");
+
+  int64_t last(FLAGS_scan_last);
+  if (last < 0) {
+    HTTPLogClient sth_client(FLAGS_ct_server);
+    ct::SignedTreeHead sth;
+    CHECK_EQ(AsyncLogClient::OK, sth_client.GetSTH(&sth));
+    last = sth.tree_size() - 1;
+  }
+
+  vector<unique_ptr<cert_trans::EntryMatcher>> matchers;
+  if (!FLAGS_scan_domain_regex.empty()) {
+    matchers.emplace_back(
+        new cert_trans::DomainRegexMatcher(FLAGS_scan_domain_regex));
+  }
+  if (!FLAGS_scan_issuer.empty()) {
+    matchers.emplace_back(new cert_trans::IssuerMatcher(FLAGS_scan_issuer));
+  }
+  if (FLAGS_scan_precerts_only) {
+    matchers.emplace_back(new cert_trans::PrecertMatcher);
+  }
+  const cert_trans::AllOfMatcher matcher(std::move(matchers));
+
+  std::ofstream file;
+  if (!FLAGS_scan_output.empty()) {
+    file.open(FLAGS_scan_output, std::ios::trunc);
+    CHECK(file.good()) << FLAGS_scan_output;
+  }
+  std::ostream* const output(FLAGS_scan_output.empty() ? &std::cout : &file);
+
+  const std::shared_ptr<cert_trans::libevent::Base> base(
+      std::make_shared<cert_trans::libevent::Base>());
+  cert_trans::libevent::EventPumpThread pump(base);
+  cert_trans::ThreadPool fetch_pool;
+  cert_trans::UrlFetcher fetcher(base.get(), &fetch_pool);
+  AsyncLogClient client(&fetch_pool, &fetcher, FLAGS_ct_server);
+  const unique_ptr<cert_trans::ThreadPool> match_pool(
+      FLAGS_scan_matcher_threads > 0
+          ? new cert_trans::ThreadPool(FLAGS_scan_matcher_threads)
+          : new cert_trans::ThreadPool);
+
+  cert_trans::LogScanner scanner(&client, match_pool.get(), &matcher,
+                                 FLAGS_scan_batch_size,
+                                 FLAGS_scan_parallel_fetches);
+  const util::Status status(scanner.Scan(
+      FLAGS_scan_first, last, FLAGS_scan_max_retries,
+      std::chrono::seconds(FLAGS_scan_progress_interval_seconds),
+      std::bind(&WriteScanMatch, output, std::placeholders::_1,
+                std::placeholders::_2, std::placeholders::_3)));
+  if (!status.ok()) {
+    LOG(ERROR) << "Scan failed: " << status;
+    return 1;
+  }
+
+  return 0;
+}
+
 int GetRoots() {
   HTTPLogClient client(FLAGS_ct_server);
 
@@ -951,6 +1190,11 @@ int Monitor() {
   HTTPLogClient client(FLAGS_ct_server);
   monitor::Monitor monitor(GetMonitorDBFromFlags(), GetLogVerifierFromFlags(),
                            &client, FLAGS_monitor_sleep_time_secs);
+  unique_ptr<cert_trans::ThreadPool> pool;
+  if (FLAGS_monitor_threads > 0) {
+    pool.reset(new cert_trans::ThreadPool(FLAGS_monitor_threads));
+    monitor.SetExecutor(pool.get(), FLAGS_monitor_threads);
+  }
 
   int ret = 0;
   if (FLAGS_monitor_action == "get_sth") {
@@ -1002,6 +1246,8 @@ int main(int argc, char** argv) {
       ret = 1;
   } else if (cmd == "upload") {
     ret = Upload();
+  } else if (cmd == "bulk_upload") {
+    ret = BulkUpload();
   } else if (cmd == "audit") {
     ret = Audit();
   } else if (cmd == "consistency") {
@@ -1020,6 +1266,8 @@ int main(int argc, char** argv) {
     WrapEmbedded();
   } else if (cmd == "get_entries") {
     GetEntries();
+  } else if (cmd == "scan") {
+    ret = Scan();
   } else if (cmd == "get_roots") {
     ret = GetRoots();
   } else if (cmd == "monitor") {
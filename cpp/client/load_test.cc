@@ -0,0 +1,495 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <functional>
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <stdint.h>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "base/notification.h"
+#include "client/async_log_client.h"
+#include "log/cert.h"
+#include "merkletree/serial_hasher.h"
+#include "merkletree/tree_hasher.h"
+#include "monitoring/counter.h"
+#include "monitoring/histogram.h"
+#include "net/url_fetcher.h"
+#include "proto/ct.pb.h"
+#include "proto/serializer.h"
+#include "util/init.h"
+#include "util/libevent_wrapper.h"
+#include "util/thread_pool.h"
+#include "util/util.h"
+
+DEFINE_string(ct_server, "http://127.0.0.1:8080", "URL of the log server");
+DEFINE_int32(duration_seconds, 60,
+             "How long to send requests for, not counting the setup and the "
+             "wait for the last replies.");
+DEFINE_int32(drain_seconds, 30,
+             "How long to wait for the replies to the requests still in "
+             "flight at the end of --duration_seconds.");
+DEFINE_double(get_sth_qps, 10, "Rate of get-sth requests per second.");
+DEFINE_double(get_entries_qps, 10,
+              "Rate of get-entries requests per second.");
+DEFINE_int32(get_entries_count, 32,
+             "Number of entries asked for by each get-entries request, from a "
+             "random start.");
+DEFINE_double(get_proof_qps, 10,
+              "Rate of get-proof-by-hash requests per second, for the leaves "
+              "of a sample of entries fetched at startup.");
+DEFINE_int32(proof_sample_entries, 256,
+             "Number of entries fetched at startup, from a random start, for "
+             "the get-proof-by-hash requests.");
+DEFINE_double(get_consistency_qps, 10,
+              "Rate of get-sth-consistency requests per second, from a random "
+              "tree size to the current one.");
+DEFINE_double(add_chain_qps, 0,
+              "Rate of add-chain requests per second, each submitting the "
+              "chain of --chain_file.");
+DEFINE_string(chain_file, "",
+              "Concatenated PEM certificates submitted by the add-chain "
+              "requests, leaf first.");
+DEFINE_double(add_pre_chain_qps, 0,
+              "Rate of add-pre-chain requests per second, each submitting the "
+              "chain of --pre_chain_file.");
+DEFINE_string(pre_chain_file, "",
+              "Concatenated PEM certificates submitted by the add-pre-chain "
+              "requests, precertificate first.");
+DEFINE_int32(max_outstanding, 10000,
+             "Requests due while this many are in flight are not sent, and "
+             "counted as dropped, so that an overloaded server does not make "
+             "the client run out of memory.");
+DEFINE_int32(fetch_threads, 4, "Number of threads running the callbacks.");
+
+namespace cert_trans {
+namespace {
+
+using std::chrono::duration_cast;
+using std::chrono::microseconds;
+using std::chrono::steady_clock;
+using std::string;
+using std::unique_ptr;
+using std::vector;
+
+typedef std::function<void(const AsyncLogClient::Callback&)> RequestCall;
+
+
+Histogram<string>* latency_us(Histogram<string>::New(
+    "load_test_latency_us", "endpoint",
+    "Time from when each request was due to its reply, in microseconds, "
+    "by endpoint."));
+
+Counter<string, string>* replies(Counter<string, string>::New(
+    "load_test_replies", "endpoint", "status",
+    "Number of replies, or of requests dropped, by endpoint and status."));
+
+
+const char* StatusName(AsyncLogClient::Status status) {
+  switch (status) {
+    case AsyncLogClient::OK:
+      return "OK";
+    case AsyncLogClient::CONNECT_FAILED:
+      return "CONNECT_FAILED";
+    case AsyncLogClient::BAD_RESPONSE:
+      return "BAD_RESPONSE";
+    case AsyncLogClient::INTERNAL_ERROR:
+      return "INTERNAL_ERROR";
+    case AsyncLogClient::UNKNOWN_ERROR:
+      return "UNKNOWN_ERROR";
+    case AsyncLogClient::UPLOAD_FAILED:
+      return "UPLOAD_FAILED";
+    case AsyncLogClient::INVALID_INPUT:
+      return "INVALID_INPUT";
+    case AsyncLogClient::UNAVAILABLE:
+      return "UNAVAILABLE";
+  }
+  return "UNKNOWN";
+}
+
+
+// Calls |call| and waits for it to be done, for the setup requests.
+AsyncLogClient::Status WaitFor(const RequestCall& call) {
+  Notification done;
+  AsyncLogClient::Status result(AsyncLogClient::UNKNOWN_ERROR);
+  call([&done, &result](AsyncLogClient::Status status) {
+    result = status;
+    done.Notify();
+  });
+  done.WaitForNotification();
+  return result;
+}
+
+
+string LeafHash(const TreeHasher& hasher, const ct::MerkleTreeLeaf& leaf) {
+  const ct::TimestampedEntry& entry(leaf.timestamped_entry());
+  string leaf_input;
+  Serializer::SerializeResult result;
+  if (entry.entry_type() == ct::X509_ENTRY) {
+    result = Serializer::SerializeV1CertSCTMerkleTreeLeaf(
+        entry.timestamp(), entry.signed_entry().x509(), entry.extensions(),
+        &leaf_input);
+  } else {
+    result = Serializer::SerializeV1PrecertSCTMerkleTreeLeaf(
+        entry.timestamp(), entry.signed_entry().precert().issuer_key_hash(),
+        entry.signed_entry().precert().tbs_certificate(), entry.extensions(),
+        &leaf_input);
+  }
+  CHECK_EQ(Serializer::OK, result);
+  return hasher.HashLeaf(leaf_input);
+}
+
+
+// The outputs of any of the requests, which live until its reply.
+struct RequestState {
+  ct::SignedTreeHead sth;
+  vector<AsyncLogClient::Entry> entries;
+  ct::MerkleAuditProof proof;
+  vector<string> consistency;
+  ct::SignedCertificateTimestamp sct;
+};
+
+
+// One kind of request, sent every |interval|. |send| is only called
+// by the scheduling thread, so that it can use LoadTest::random_
+// without locking.
+struct Endpoint {
+  Endpoint(const string& endpoint_name, double qps)
+      : name(endpoint_name),
+        interval(duration_cast<steady_clock::duration>(
+            std::chrono::duration<double>(1 / qps))),
+        sent(0) {
+  }
+
+  const string name;
+  const steady_clock::duration interval;
+  steady_clock::time_point next;
+  int64_t sent;
+  std::function<void(RequestState*, const AsyncLogClient::Callback&)> send;
+};
+
+
+class LoadTest {
+ public:
+  explicit LoadTest(AsyncLogClient* client)
+      : client_(client), outstanding_(0) {
+  }
+
+  void Setup();
+  void Run();
+  // Returns false if some requests were still in flight after
+  // --drain_seconds.
+  bool Drain();
+  void Report(double seconds) const;
+
+ private:
+  void AddEndpoint(const string& name, double qps,
+                   const std::function<void(RequestState*,
+                                            const AsyncLogClient::Callback&)>&
+                       send);
+  void Send(Endpoint* endpoint, steady_clock::time_point due);
+
+  AsyncLogClient* const client_;
+  std::mt19937 random_;
+  ct::SignedTreeHead sth_;
+  vector<string> leaf_hashes_;
+  unique_ptr<CertChain> chain_;
+  unique_ptr<PreCertChain> pre_chain_;
+  vector<unique_ptr<Endpoint>> endpoints_;
+  std::atomic<int> outstanding_;
+};
+
+
+void LoadTest::Setup() {
+  const AsyncLogClient::Status sth_status(
+      WaitFor([this](const AsyncLogClient::Callback& done) {
+        client_->GetSTH(&sth_, done);
+      }));
+  CHECK_EQ(AsyncLogClient::OK, sth_status)
+      << "get-sth failed: " << StatusName(sth_status);
+  const int64_t tree_size(sth_.tree_size());
+  LOG(INFO) << "tree size: " << tree_size;
+
+  if (FLAGS_get_proof_qps > 0) {
+    CHECK_GT(tree_size, 0) << "get-proof-by-hash needs a non-empty log";
+    CHECK_GT(FLAGS_proof_sample_entries, 0);
+    const int64_t count(
+        std::min<int64_t>(FLAGS_proof_sample_entries, tree_size));
+    const int64_t first(std::uniform_int_distribution<int64_t>(
+        0, tree_size - count)(random_));
+    vector<AsyncLogClient::Entry> entries;
+    const AsyncLogClient::Status status(
+        WaitFor([this, first, count, &entries](
+            const AsyncLogClient::Callback& done) {
+          client_->GetEntries(first, first + count - 1, &entries, done);
+        }));
+    CHECK_EQ(AsyncLogClient::OK, status)
+        << "get-entries failed: " << StatusName(status);
+    CHECK(!entries.empty());
+    const TreeHasher hasher(new Sha256Hasher);
+    for (const AsyncLogClient::Entry& entry : entries) {
+      leaf_hashes_.emplace_back(LeafHash(hasher, entry.leaf));
+    }
+    LOG(INFO) << "sampled " << leaf_hashes_.size() << " leaves from "
+              << first;
+  }
+
+  if (FLAGS_add_chain_qps > 0) {
+    string pem;
+    PCHECK(util::ReadBinaryFile(FLAGS_chain_file, &pem))
+        << "could not read --chain_file " << FLAGS_chain_file;
+    chain_.reset(new CertChain(pem));
+    CHECK(chain_->IsLoaded()) << "invalid chain in " << FLAGS_chain_file;
+  }
+  if (FLAGS_add_pre_chain_qps > 0) {
+    string pem;
+    PCHECK(util::ReadBinaryFile(FLAGS_pre_chain_file, &pem))
+        << "could not read --pre_chain_file " << FLAGS_pre_chain_file;
+    pre_chain_.reset(new PreCertChain(pem));
+    CHECK(pre_chain_->IsLoaded()) << "invalid chain in "
+                                  << FLAGS_pre_chain_file;
+  }
+
+  AddEndpoint("get-sth", FLAGS_get_sth_qps,
+              [this](RequestState* state,
+                     const AsyncLogClient::Callback& done) {
+                client_->GetSTH(&state->sth, done);
+              });
+  AddEndpoint("get-entries", FLAGS_get_entries_qps,
+              [this, tree_size](RequestState* state,
+                                const AsyncLogClient::Callback& done) {
+                const int64_t count(
+                    std::min<int64_t>(FLAGS_get_entries_count, tree_size));
+                const int64_t first(std::uniform_int_distribution<int64_t>(
+                    0, tree_size - count)(random_));
+                client_->GetEntries(first, first + count - 1,
+                                    &state->entries, done);
+              });
+  AddEndpoint("get-proof-by-hash", FLAGS_get_proof_qps,
+              [this](RequestState* state,
+                     const AsyncLogClient::Callback& done) {
+                const string& leaf_hash(
+                    leaf_hashes_[std::uniform_int_distribution<size_t>(
+                        0, leaf_hashes_.size() - 1)(random_)]);
+                client_->QueryInclusionProof(sth_, leaf_hash, &state->proof,
+                                             done);
+              });
+  AddEndpoint("get-sth-consistency", FLAGS_get_consistency_qps,
+              [this, tree_size](RequestState* state,
+                                const AsyncLogClient::Callback& done) {
+                const int64_t first(
+                    std::uniform_int_distribution<int64_t>(1, tree_size)(
+                        random_));
+                client_->GetSTHConsistency(first, tree_size,
+                                           &state->consistency, done);
+              });
+  AddEndpoint("add-chain", FLAGS_add_chain_qps,
+              [this](RequestState* state,
+                     const AsyncLogClient::Callback& done) {
+                client_->AddCertChain(*chain_, &state->sct, done);
+              });
+  AddEndpoint("add-pre-chain", FLAGS_add_pre_chain_qps,
+              [this](RequestState* state,
+                     const AsyncLogClient::Callback& done) {
+                client_->AddPreCertChain(*pre_chain_, &state->sct, done);
+              });
+  CHECK(!endpoints_.empty()) << "all the rates are 0";
+  if (tree_size == 0) {
+    for (const auto& endpoint : endpoints_) {
+      CHECK(endpoint->name != "get-entries" &&
+            endpoint->name != "get-sth-consistency")
+          << endpoint->name << " needs a non-empty log";
+    }
+  }
+}
+
+
+void LoadTest::AddEndpoint(
+    const string& name, double qps,
+    const std::function<void(RequestState*, const AsyncLogClient::Callback&)>&
+        send) {
+  CHECK_GE(qps, 0) << name;
+  if (qps == 0) {
+    return;
+  }
+  endpoints_.emplace_back(new Endpoint(name, qps));
+  endpoints_.back()->send = send;
+}
+
+
+// The requests are sent when they are due, whether or not the
+// previous ones have been answered, and their latency is measured
+// from when they were due rather than from when they were sent, so
+// that a slow server (or client) shows up in the latencies instead of
+// lowering the rate.
+void LoadTest::Run() {
+  const steady_clock::time_point start(steady_clock::now());
+  const steady_clock::time_point end(
+      start + std::chrono::seconds(FLAGS_duration_seconds));
+  for (const auto& endpoint : endpoints_) {
+    endpoint->next = start;
+  }
+
+  while (true) {
+    Endpoint* const endpoint(
+        std::min_element(endpoints_.begin(), endpoints_.end(),
+                         [](const unique_ptr<Endpoint>& a,
+                            const unique_ptr<Endpoint>& b) {
+                           return a->next < b->next;
+                         })
+            ->get());
+    const steady_clock::time_point due(endpoint->next);
+    if (due >= end) {
+      break;
+    }
+    std::this_thread::sleep_until(due);
+    Send(endpoint, due);
+    endpoint->next += endpoint->interval;
+  }
+}
+
+
+void LoadTest::Send(Endpoint* endpoint, steady_clock::time_point due) {
+  ++endpoint->sent;
+  if (outstanding_.load() >= FLAGS_max_outstanding) {
+    replies->Increment(endpoint->name, "DROPPED");
+    return;
+  }
+  ++outstanding_;
+
+  RequestState* const state(new RequestState);
+  const string& name(endpoint->name);
+  endpoint->send(state, [this, state, &name, due](
+                            AsyncLogClient::Status status) {
+    latency_us->Record(name, duration_cast<microseconds>(
+                                 steady_clock::now() - due).count());
+    replies->Increment(name, StatusName(status));
+    delete state;
+    --outstanding_;
+  });
+}
+
+
+bool LoadTest::Drain() {
+  const steady_clock::time_point deadline(
+      steady_clock::now() + std::chrono::seconds(FLAGS_drain_seconds));
+  while (outstanding_.load() > 0) {
+    if (steady_clock::now() >= deadline) {
+      LOG(WARNING) << outstanding_.load() << " requests still in flight";
+      return false;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  return true;
+}
+
+
+// The upper bound of the bucket of |distribution| that holds the
+// |quantile|, or -1 if it is in the last one, which has none.
+double Quantile(const Metric::Distribution& distribution, double quantile) {
+  const uint64_t count(distribution.Count());
+  const uint64_t rank(std::max<uint64_t>(1, std::ceil(quantile * count)));
+  uint64_t seen(0);
+  for (size_t i = 0; i < distribution.upper_bounds.size(); ++i) {
+    seen += distribution.counts[i];
+    if (seen >= rank) {
+      return distribution.upper_bounds[i];
+    }
+  }
+  return -1;
+}
+
+
+void LoadTest::Report(double seconds) const {
+  const auto counts(replies->CurrentValues());
+  std::cout << std::left << std::setw(22) << "endpoint" << std::right
+            << std::setw(10) << "sent" << std::setw(10) << "qps"
+            << std::setw(10) << "errors" << std::setw(10) << "p50 ms"
+            << std::setw(10) << "p90 ms" << std::setw(10) << "p99 ms"
+            << std::setw(10) << "p99.9 ms" << std::endl;
+  for (const auto& endpoint : endpoints_) {
+    const Metric::Distribution latencies(
+        latency_us->GetDistribution(endpoint->name));
+    int64_t errors(0);
+    for (const auto& it : counts) {
+      if (it.first[0] == endpoint->name && it.first[1] != "OK") {
+        errors += it.second.second;
+      }
+    }
+    std::cout << std::left << std::setw(22) << endpoint->name << std::right
+              << std::setw(10) << endpoint->sent << std::setw(10)
+              << std::fixed << std::setprecision(1)
+              << endpoint->sent / seconds << std::setw(10) << errors;
+    for (const double quantile : {0.5, 0.9, 0.99, 0.999}) {
+      const double bound(latencies.Count() > 0
+                             ? Quantile(latencies, quantile)
+                             : 0);
+      std::cout << std::setw(10);
+      if (bound < 0) {
+        std::cout << "inf";
+      } else {
+        std::cout << std::setprecision(2) << bound / 1000;
+      }
+    }
+    std::cout << std::endl;
+  }
+
+  // The replies other than OK, by status.
+  for (const auto& it : counts) {
+    if (it.first[1] != "OK") {
+      std::cout << it.first[0] << " " << it.first[1] << ": "
+                << it.second.second << std::endl;
+    }
+  }
+}
+
+
+}  // namespace
+}  // namespace cert_trans
+
+
+int main(int argc, char* argv[]) {
+  util::InitCT(&argc, &argv);
+
+  CHECK_GT(FLAGS_duration_seconds, 0);
+  CHECK_GE(FLAGS_drain_seconds, 0);
+  CHECK_GT(FLAGS_get_entries_count, 0);
+  CHECK_GT(FLAGS_max_outstanding, 0);
+  CHECK_GT(FLAGS_fetch_threads, 0);
+
+  const std::shared_ptr<cert_trans::libevent::Base> base(
+      std::make_shared<cert_trans::libevent::Base>());
+  cert_trans::libevent::EventPumpThread pump(base);
+  cert_trans::ThreadPool fetch_pool(FLAGS_fetch_threads);
+  cert_trans::UrlFetcher fetcher(base.get(), &fetch_pool);
+  cert_trans::AsyncLogClient client(&fetch_pool, &fetcher, FLAGS_ct_server);
+
+  cert_trans::LoadTest load_test(&client);
+  load_test.Setup();
+
+  const std::chrono::steady_clock::time_point start(
+      std::chrono::steady_clock::now());
+  load_test.Run();
+  const double seconds(
+      std::chrono::duration_cast<std::chrono::milliseconds>(
+          std::chrono::steady_clock::now() - start)
+          .count() /
+      1000.0);
+  const bool drained(load_test.Drain());
+  load_test.Report(seconds);
+
+  // The callbacks of the requests still in flight would use the
+  // client after it is destroyed.
+  if (!drained) {
+    _exit(1);
+  }
+  return 0;
+}
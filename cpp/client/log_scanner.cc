@@ -0,0 +1,281 @@
+#include "client/log_scanner.h"
+
+#include <algorithm>
+#include <glog/logging.h>
+
+#include "log/cert.h"
+#include "util/executor.h"
+
+using std::bind;
+using std::chrono::duration;
+using std::chrono::duration_cast;
+using std::chrono::milliseconds;
+using std::chrono::steady_clock;
+using std::lock_guard;
+using std::make_shared;
+using std::move;
+using std::mutex;
+using std::placeholders::_1;
+using std::shared_ptr;
+using std::string;
+using std::to_string;
+using std::unique_lock;
+using std::unique_ptr;
+using std::vector;
+
+namespace cert_trans {
+
+namespace {
+
+
+// Loads the certificate of |entry| in |cert|, or its precertificate.
+void LoadCert(const AsyncLogClient::Entry& entry, Cert* cert) {
+  const ct::TimestampedEntry& timestamped(entry.leaf.timestamped_entry());
+  if (timestamped.entry_type() == ct::X509_ENTRY) {
+    cert->LoadFromDerString(timestamped.signed_entry().x509());
+  } else if (timestamped.entry_type() == ct::PRECERT_ENTRY) {
+    cert->LoadFromDerString(entry.entry.precert_entry().pre_certificate());
+  }
+}
+
+
+}  // namespace
+
+
+DomainRegexMatcher::DomainRegexMatcher(const string& regex) {
+  const int error(
+      regcomp(&regex_, regex.c_str(), REG_EXTENDED | REG_ICASE | REG_NOSUB));
+  if (error != 0) {
+    char message[256];
+    regerror(error, &regex_, message, sizeof(message));
+    LOG(FATAL) << "invalid regular expression \"" << regex
+               << "\": " << message;
+  }
+}
+
+
+DomainRegexMatcher::~DomainRegexMatcher() {
+  regfree(&regex_);
+}
+
+
+bool DomainRegexMatcher::Matches(const AsyncLogClient::Entry&,
+                                 const Cert& cert) const {
+  vector<string> names;
+  if (!cert.IsLoaded() || cert.DnsNames(&names) != Cert::TRUE) {
+    return false;
+  }
+  for (const auto& name : names) {
+    if (regexec(&regex_, name.c_str(), 0, nullptr, 0) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+
+bool IssuerMatcher::Matches(const AsyncLogClient::Entry&,
+                            const Cert& cert) const {
+  return cert.IsLoaded() &&
+         cert.PrintIssuerName().find(issuer_) != string::npos;
+}
+
+
+bool PrecertMatcher::Matches(const AsyncLogClient::Entry& entry,
+                             const Cert&) const {
+  return entry.leaf.timestamped_entry().entry_type() == ct::PRECERT_ENTRY;
+}
+
+
+bool AllOfMatcher::Matches(const AsyncLogClient::Entry& entry,
+                           const Cert& cert) const {
+  for (const auto& matcher : matchers_) {
+    if (!matcher->Matches(entry, cert)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+
+LogScanner::LogScanner(AsyncLogClient* client, util::Executor* match_executor,
+                       const EntryMatcher* matcher, int batch_size,
+                       int parallel_fetches)
+    : client_(CHECK_NOTNULL(client)),
+      match_executor_(CHECK_NOTNULL(match_executor)),
+      matcher_(CHECK_NOTNULL(matcher)),
+      batch_size_(batch_size),
+      parallel_fetches_(parallel_fetches),
+      next_index_(0),
+      last_index_(-1),
+      max_retries_(0),
+      outstanding_(0),
+      scanned_(0),
+      matched_(0) {
+  CHECK_GT(batch_size_, 0);
+  CHECK_GT(parallel_fetches_, 0);
+}
+
+
+LogScanner::~LogScanner() {
+  lock_guard<mutex> lock(lock_);
+  CHECK_EQ(outstanding_, 0);
+}
+
+
+util::Status LogScanner::Scan(int64_t first, int64_t last, int max_retries,
+                              const duration<double>& progress_interval,
+                              const MatchCallback& match_cb) {
+  CHECK_GE(first, 0);
+  CHECK_GE(max_retries, 0);
+  {
+    lock_guard<mutex> lock(match_lock_);
+    match_cb_ = match_cb;
+  }
+
+  const steady_clock::time_point started(steady_clock::now());
+  {
+    lock_guard<mutex> lock(lock_);
+    CHECK_EQ(outstanding_, 0);
+    next_index_ = first;
+    last_index_ = last;
+    max_retries_ = max_retries;
+    retries_.clear();
+    status_ = util::Status::OK;
+    scanned_ = 0;
+    matched_ = 0;
+  }
+  StartFetches();
+
+  unique_lock<mutex> lock(lock_);
+  while (!done_.wait_for(lock, progress_interval,
+                         bind(&LogScanner::Finished, this))) {
+    LogProgress(started);
+  }
+  LogProgress(started);
+  return status_;
+}
+
+
+// Must be called with |lock_| held.
+bool LogScanner::Finished() const {
+  return outstanding_ == 0 &&
+         (!status_.ok() || (retries_.empty() && next_index_ > last_index_));
+}
+
+
+void LogScanner::StartFetches() {
+  vector<Range> ranges;
+  {
+    lock_guard<mutex> lock(lock_);
+    while (status_.ok() && outstanding_ < parallel_fetches_) {
+      if (!retries_.empty()) {
+        ranges.push_back(retries_.front());
+        retries_.pop_front();
+      } else if (next_index_ <= last_index_) {
+        const int64_t range_last(
+            std::min<int64_t>(next_index_ + batch_size_ - 1, last_index_));
+        ranges.push_back(Range{next_index_, range_last, 0});
+        next_index_ = range_last + 1;
+      } else {
+        break;
+      }
+      ++outstanding_;
+    }
+  }
+
+  for (const auto& range : ranges) {
+    const shared_ptr<vector<AsyncLogClient::Entry>> entries(
+        make_shared<vector<AsyncLogClient::Entry>>());
+    client_->GetEntries(range.first, range.last, entries.get(),
+                        bind(&LogScanner::FetchDone, this, range, entries,
+                             _1));
+  }
+}
+
+
+void LogScanner::FetchDone(
+    const Range& range,
+    const shared_ptr<vector<AsyncLogClient::Entry>>& entries,
+    AsyncLogClient::Status status) {
+  const size_t wanted(range.last - range.first + 1);
+  if (status != AsyncLogClient::OK || entries->empty()) {
+    LOG(WARNING) << "get-entries from " << range.first << " to " << range.last
+                 << " failed: " << status;
+    {
+      lock_guard<mutex> lock(lock_);
+      --outstanding_;
+      if (range.failures < max_retries_) {
+        retries_.push_back(Range{range.first, range.last, range.failures + 1});
+      } else if (status_.ok()) {
+        status_ = util::Status(util::error::UNAVAILABLE,
+                               "cannot fetch entries " +
+                                   to_string(range.first) + " to " +
+                                   to_string(range.last));
+      }
+    }
+    done_.notify_all();
+    StartFetches();
+    return;
+  }
+
+  // Logs may return fewer entries than asked for, the rest is fetched
+  // again.
+  if (entries->size() > wanted) {
+    entries->resize(wanted);
+  } else if (entries->size() < wanted) {
+    lock_guard<mutex> lock(lock_);
+    retries_.push_front(Range{range.first + static_cast<int64_t>(
+                                                entries->size()),
+                              range.last, 0});
+  }
+
+  match_executor_->Add(
+      bind(&LogScanner::MatchEntries, this, range.first, entries));
+}
+
+
+void LogScanner::MatchEntries(
+    int64_t first, const shared_ptr<vector<AsyncLogClient::Entry>>& entries) {
+  vector<int64_t> matches;
+  vector<unique_ptr<Cert>> certs;
+  for (size_t i = 0; i < entries->size(); ++i) {
+    unique_ptr<Cert> cert(new Cert);
+    LoadCert((*entries)[i], cert.get());
+    if (matcher_->Matches((*entries)[i], *cert)) {
+      matches.push_back(i);
+      certs.emplace_back(move(cert));
+    }
+  }
+
+  {
+    lock_guard<mutex> lock(match_lock_);
+    for (size_t i = 0; i < matches.size(); ++i) {
+      match_cb_(first + matches[i], (*entries)[matches[i]], *certs[i]);
+    }
+  }
+
+  {
+    lock_guard<mutex> lock(lock_);
+    --outstanding_;
+    scanned_ += entries->size();
+    matched_ += matches.size();
+  }
+  done_.notify_all();
+  StartFetches();
+}
+
+
+// Must be called with |lock_| held.
+void LogScanner::LogProgress(steady_clock::time_point started) const {
+  const double seconds(
+      duration_cast<milliseconds>(steady_clock::now() - started).count() /
+      1000.0);
+  LOG(INFO) << "Scanned " << scanned_ << " entries, up to index "
+            << next_index_ - 1 << " of " << last_index_ << ", at "
+            << (seconds > 0 ? static_cast<int64_t>(scanned_ / seconds) : 0)
+            << " entries/s, " << matched_ << " matches";
+}
+
+
+}  // namespace cert_trans
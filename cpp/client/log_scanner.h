@@ -0,0 +1,196 @@
+#ifndef CERT_TRANS_CLIENT_LOG_SCANNER_H_
+#define CERT_TRANS_CLIENT_LOG_SCANNER_H_
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <regex.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "base/macros.h"
+#include "client/async_log_client.h"
+#include "util/status.h"
+
+namespace util {
+class Executor;
+}  // namespace util
+
+namespace cert_trans {
+
+
+class Cert;
+
+
+// Picks the entries a LogScanner reports. Must be thread-safe.
+class EntryMatcher {
+ public:
+  virtual ~EntryMatcher() = default;
+
+  // |cert| is the certificate of |entry|, or the precertificate for
+  // precertificate entries, which is not loaded if it could not be
+  // parsed.
+  virtual bool Matches(const AsyncLogClient::Entry& entry,
+                       const Cert& cert) const = 0;
+
+ protected:
+  EntryMatcher() = default;
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(EntryMatcher);
+};
+
+
+// Matches the entries with a DNS name (see Cert::DnsNames()) matching
+// a POSIX extended regular expression, ignoring case.
+class DomainRegexMatcher : public EntryMatcher {
+ public:
+  explicit DomainRegexMatcher(const std::string& regex);
+  ~DomainRegexMatcher() override;
+
+  bool Matches(const AsyncLogClient::Entry& entry,
+               const Cert& cert) const override;
+
+ private:
+  regex_t regex_;
+
+  DISALLOW_COPY_AND_ASSIGN(DomainRegexMatcher);
+};
+
+
+// Matches the entries whose issuer name, as printed by
+// Cert::PrintIssuerName(), contains |issuer|.
+class IssuerMatcher : public EntryMatcher {
+ public:
+  explicit IssuerMatcher(const std::string& issuer) : issuer_(issuer) {
+  }
+
+  bool Matches(const AsyncLogClient::Entry& entry,
+               const Cert& cert) const override;
+
+ private:
+  const std::string issuer_;
+
+  DISALLOW_COPY_AND_ASSIGN(IssuerMatcher);
+};
+
+
+// Matches the precertificate entries.
+class PrecertMatcher : public EntryMatcher {
+ public:
+  PrecertMatcher() = default;
+
+  bool Matches(const AsyncLogClient::Entry& entry,
+               const Cert& cert) const override;
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(PrecertMatcher);
+};
+
+
+// Matches the entries that all of |matchers| match, so all of them
+// if there are none.
+class AllOfMatcher : public EntryMatcher {
+ public:
+  explicit AllOfMatcher(std::vector<std::unique_ptr<EntryMatcher>> matchers)
+      : matchers_(std::move(matchers)) {
+  }
+
+  bool Matches(const AsyncLogClient::Entry& entry,
+               const Cert& cert) const override;
+
+ private:
+  const std::vector<std::unique_ptr<EntryMatcher>> matchers_;
+
+  DISALLOW_COPY_AND_ASSIGN(AllOfMatcher);
+};
+
+
+// Scans a range of the entries of a log for those an EntryMatcher
+// picks. Ranges of |batch_size| entries are fetched with up to
+// |parallel_fetches| requests in flight, and matched on
+// |match_executor| while the next ones download; a fetch slot is only
+// given back once its entries are matched, so that a slow matcher
+// slows the fetching down rather than piling up entries.
+class LogScanner {
+ public:
+  // Called with each matching entry and its index, one at a time, but
+  // not necessarily in order.
+  typedef std::function<void(int64_t index, const AsyncLogClient::Entry&,
+                             const Cert& cert)> MatchCallback;
+
+  // Does not take ownership of |client|, |match_executor| or
+  // |matcher|.
+  LogScanner(AsyncLogClient* client, util::Executor* match_executor,
+             const EntryMatcher* matcher, int batch_size,
+             int parallel_fetches);
+  ~LogScanner();
+
+  // Scans the entries from |first| to |last| inclusively, passing
+  // those that match to |match_cb|, and returns once done. A range of
+  // entries that cannot be fetched is retried |max_retries| times,
+  // after which the scan stops with an error, having reported the
+  // matches in some of the other entries. Progress is logged every
+  // |progress_interval|.
+  util::Status Scan(int64_t first, int64_t last, int max_retries,
+                    const std::chrono::duration<double>& progress_interval,
+                    const MatchCallback& match_cb);
+
+ private:
+  struct Range {
+    int64_t first;
+    int64_t last;
+    // How many times fetching it failed.
+    int failures;
+  };
+
+  // Starts as many fetches as there are free slots and ranges to
+  // fetch.
+  void StartFetches();
+  void FetchDone(const Range& range,
+                 const std::shared_ptr<std::vector<AsyncLogClient::Entry>>&
+                     entries,
+                 AsyncLogClient::Status status);
+  void MatchEntries(
+      int64_t first,
+      const std::shared_ptr<std::vector<AsyncLogClient::Entry>>& entries);
+  // Whether there is nothing left to do, with |lock_| held.
+  bool Finished() const;
+  void LogProgress(std::chrono::steady_clock::time_point started) const;
+
+  AsyncLogClient* const client_;
+  util::Executor* const match_executor_;
+  const EntryMatcher* const matcher_;
+  const int batch_size_;
+  const int parallel_fetches_;
+
+  // Serialises the calls to |match_cb_|.
+  std::mutex match_lock_;
+  MatchCallback match_cb_;
+
+  mutable std::mutex lock_;
+  std::condition_variable done_;
+  // The next index that was not handed to a fetch yet, and the last
+  // index to scan.
+  int64_t next_index_;
+  int64_t last_index_;
+  int max_retries_;
+  // Ranges to fetch again, from failed or short replies.
+  std::deque<Range> retries_;
+  // Fetches in flight or being matched.
+  int outstanding_;
+  util::Status status_;
+  int64_t scanned_;
+  int64_t matched_;
+
+  DISALLOW_COPY_AND_ASSIGN(LogScanner);
+};
+
+
+}  // namespace cert_trans
+
+#endif  // CERT_TRANS_CLIENT_LOG_SCANNER_H_
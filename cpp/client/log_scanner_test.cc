@@ -0,0 +1,222 @@
+#include "client/log_scanner.h"
+
+#include <algorithm>
+#include <event2/buffer.h>
+#include <functional>
+#include <gflags/gflags.h>
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include <map>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+#include "log/cert.h"
+#include "net/mock_url_fetcher.h"
+#include "proto/serializer.h"
+#include "util/testing.h"
+#include "util/thread_pool.h"
+#include "util/util.h"
+
+DECLARE_string(test_srcdir);
+
+namespace cert_trans {
+namespace {
+
+using std::bind;
+using std::chrono::seconds;
+using std::lock_guard;
+using std::map;
+using std::mutex;
+using std::placeholders::_1;
+using std::placeholders::_2;
+using std::placeholders::_3;
+using std::placeholders::_4;
+using std::placeholders::_5;
+using std::string;
+using std::vector;
+using testing::_;
+using testing::AnyNumber;
+using testing::Invoke;
+using util::Task;
+
+const char kLogUrl[] = "https://example.com";
+// A certificate for "?.example.com", and one without DNS names.
+const char kNamedCert[] = "v2/redact_test7.pem";
+const char kUnnamedCert[] = "test-cert.pem";
+// Logs may return fewer entries than asked for.
+const int64_t kMaxEntriesPerReply = 3;
+
+
+string ReadCertDer(const string& name) {
+  string pem;
+  CHECK(util::ReadTextFile(FLAGS_test_srcdir + "/test/testdata/" + name,
+                           &pem));
+  const Cert cert(pem);
+  string der;
+  CHECK_EQ(Cert::TRUE, cert.DerEncoding(&der));
+  return der;
+}
+
+
+class LogScannerTest : public ::testing::Test {
+ protected:
+  LogScannerTest()
+      : client_(&fetch_pool_, &fetcher_, kLogUrl),
+        named_der_(ReadCertDer(kNamedCert)),
+        unnamed_der_(ReadCertDer(kUnnamedCert)),
+        failures_left_(0) {
+    EXPECT_CALL(fetcher_, FetchStreaming(_, _, _, _, _))
+        .Times(AnyNumber())
+        .WillRepeatedly(Invoke(bind(&LogScannerTest::HandleGetEntries, this,
+                                    _1, _2, _3, _4, _5)));
+  }
+
+  // The get-entries JSON of an entry for |der|, as an X.509 entry.
+  string EntryJson(const string& der) const {
+    ct::SignedCertificateTimestamp sct;
+    sct.set_version(ct::V1);
+    sct.set_timestamp(1234);
+    ct::LogEntry entry;
+    entry.set_type(ct::X509_ENTRY);
+    entry.mutable_x509_entry()->set_leaf_certificate(der);
+
+    string leaf_input, extra_data;
+    CHECK_EQ(Serializer::OK,
+             Serializer::SerializeSCTMerkleTreeLeaf(sct, entry, &leaf_input));
+    CHECK_EQ(Serializer::OK,
+             Serializer::SerializeX509Chain(entry.x509_entry(), &extra_data));
+    return "{\"leaf_input\":\"" + util::ToBase64(leaf_input) +
+           "\",\"extra_data\":\"" + util::ToBase64(extra_data) + "\"}";
+  }
+
+  // The even entries have DNS names, the odd ones not.
+  void HandleGetEntries(const UrlFetcher::Request& req,
+                        UrlFetcher::Response* resp,
+                        const UrlFetcher::HeadersCallback& headers_cb,
+                        const UrlFetcher::BodyCallback& body_cb, Task* task) {
+    long long start, end;
+    CHECK_EQ(2, sscanf(req.url.Query().c_str(), "start=%lld&end=%lld", &start,
+                       &end));
+    {
+      lock_guard<mutex> lock(lock_);
+      ++requests_[start];
+      if (failures_left_ > 0) {
+        --failures_left_;
+        resp->status_code = 503;
+        headers_cb();
+        task->Return();
+        return;
+      }
+    }
+
+    string body("{\"entries\":[");
+    for (int64_t i = start;
+         i <= std::min<int64_t>(end, start + kMaxEntriesPerReply - 1); ++i) {
+      body += string(i > start ? "," : "") +
+              EntryJson(i % 2 == 0 ? named_der_ : unnamed_der_);
+    }
+    body += "]}";
+
+    resp->status_code = 200;
+    headers_cb();
+    evbuffer* const chunk(CHECK_NOTNULL(evbuffer_new()));
+    CHECK_EQ(evbuffer_add(chunk, body.data(), body.size()), 0);
+    body_cb(chunk, []() {});
+    evbuffer_free(chunk);
+    task->Return();
+  }
+
+  util::Status Scan(const EntryMatcher* matcher, int64_t first, int64_t last,
+                    int max_retries, vector<int64_t>* matches) {
+    LogScanner scanner(&client_, &match_pool_, matcher, 5, 2);
+    const util::Status status(scanner.Scan(
+        first, last, max_retries, seconds(10),
+        [matches](int64_t index, const AsyncLogClient::Entry&,
+                  const Cert& cert) {
+          EXPECT_TRUE(cert.IsLoaded());
+          matches->push_back(index);
+        }));
+    std::sort(matches->begin(), matches->end());
+    return status;
+  }
+
+  ThreadPool fetch_pool_;
+  ThreadPool match_pool_;
+  MockUrlFetcher fetcher_;
+  AsyncLogClient client_;
+  const string named_der_;
+  const string unnamed_der_;
+
+  mutex lock_;
+  int failures_left_;
+  // The number of requests for each start index.
+  map<int64_t, int> requests_;
+};
+
+
+TEST_F(LogScannerTest, MatchesDomains) {
+  const DomainRegexMatcher matcher("^\\?\\.EXAMPLE\\.com$");
+  vector<int64_t> matches;
+  EXPECT_EQ(util::Status::OK, Scan(&matcher, 3, 14, 0, &matches));
+  EXPECT_EQ(vector<int64_t>({4, 6, 8, 10, 12, 14}), matches);
+}
+
+
+TEST_F(LogScannerTest, MatchesAll) {
+  const AllOfMatcher matcher{vector<std::unique_ptr<EntryMatcher>>()};
+  vector<int64_t> matches;
+  EXPECT_EQ(util::Status::OK, Scan(&matcher, 0, 9, 0, &matches));
+  EXPECT_EQ(vector<int64_t>({0, 1, 2, 3, 4, 5, 6, 7, 8, 9}), matches);
+}
+
+
+TEST_F(LogScannerTest, MatchesIssuerAndDomain) {
+  vector<std::unique_ptr<EntryMatcher>> matchers;
+  matchers.emplace_back(new IssuerMatcher("Certificate Transparency CA"));
+  matchers.emplace_back(new DomainRegexMatcher("example"));
+  const AllOfMatcher matcher(std::move(matchers));
+  vector<int64_t> matches;
+  EXPECT_EQ(util::Status::OK, Scan(&matcher, 0, 5, 0, &matches));
+  EXPECT_EQ(vector<int64_t>({0, 2, 4}), matches);
+
+  const PrecertMatcher precerts;
+  matches.clear();
+  EXPECT_EQ(util::Status::OK, Scan(&precerts, 0, 5, 0, &matches));
+  EXPECT_TRUE(matches.empty());
+}
+
+
+TEST_F(LogScannerTest, RetriesFailedFetches) {
+  failures_left_ = 2;
+  const PrecertMatcher matcher;
+  vector<int64_t> matches;
+  EXPECT_EQ(util::Status::OK, Scan(&matcher, 0, 9, 2, &matches));
+
+  int total(0);
+  for (const auto& it : requests_) {
+    total += it.second;
+  }
+  // Each range of 5 entries takes two replies, and two more requests
+  // failed.
+  EXPECT_EQ(6, total);
+}
+
+
+TEST_F(LogScannerTest, GivesUp) {
+  failures_left_ = 100;
+  const PrecertMatcher matcher;
+  vector<int64_t> matches;
+  EXPECT_EQ(util::error::UNAVAILABLE,
+            Scan(&matcher, 0, 9, 2, &matches).CanonicalCode());
+}
+
+
+}  // namespace
+}  // namespace cert_trans
+
+
+int main(int argc, char** argv) {
+  cert_trans::test::InitTesting(argv[0], &argc, &argv, true);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,357 @@
+// Reissues the requests captured by a log server with
+// --traffic_capture_file against another one (e.g. a test cluster),
+// with the same spacing, or scaled by --speed, and compares the
+// latencies of the two by endpoint.
+//
+// The captured latencies are those of the handlers, measured by the
+// server, while the replayed ones are measured by this client, from
+// when each request was due to its reply. To compare like with like,
+// capture the traffic of the target as well while it is replayed, and
+// pass that capture as --target_capture_file once done.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <stdint.h>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "monitoring/counter.h"
+#include "monitoring/histogram.h"
+#include "net/url.h"
+#include "net/url_fetcher.h"
+#include "server/traffic_capture.h"
+#include "util/init.h"
+#include "util/libevent_wrapper.h"
+#include "util/task.h"
+#include "util/thread_pool.h"
+#include "util/util.h"
+
+DEFINE_string(capture_file, "", "Capture of the requests to reissue.");
+DEFINE_string(target, "http://127.0.0.1:8080",
+              "URL of the log server to send the requests to.");
+DEFINE_double(speed, 1,
+              "How many times faster than they were captured to send the "
+              "requests.");
+DEFINE_string(add_chain_body_file, "",
+              "Body sent with the captured add-chain requests, whose bodies "
+              "are not captured; they are skipped if empty.");
+DEFINE_string(add_pre_chain_body_file, "",
+              "Likewise, for the add-pre-chain requests.");
+DEFINE_string(target_capture_file, "",
+              "Capture made by the target while the requests were replayed, "
+              "whose handler latencies are reported next to the original "
+              "ones.");
+DEFINE_int32(drain_seconds, 30,
+             "How long to wait for the replies to the requests still in "
+             "flight once they have all been sent.");
+DEFINE_int32(max_outstanding, 10000,
+             "Requests due while this many are in flight are not sent, and "
+             "counted as dropped.");
+DEFINE_int32(fetch_threads, 4, "Number of threads running the callbacks.");
+
+namespace cert_trans {
+namespace {
+
+using std::chrono::duration_cast;
+using std::chrono::microseconds;
+using std::chrono::steady_clock;
+using std::map;
+using std::string;
+using std::unique_ptr;
+using std::vector;
+
+
+Histogram<string>* captured_latency_us(Histogram<string>::New(
+    "replay_traffic_captured_latency_us", "endpoint",
+    "Handler latency of the captured requests, in microseconds, by "
+    "endpoint."));
+
+Histogram<string>* target_latency_us(Histogram<string>::New(
+    "replay_traffic_target_latency_us", "endpoint",
+    "Handler latency of the replayed requests captured by the target, in "
+    "microseconds, by endpoint."));
+
+Histogram<string>* replayed_latency_us(Histogram<string>::New(
+    "replay_traffic_replayed_latency_us", "endpoint",
+    "Time from when each replayed request was due to its reply, in "
+    "microseconds, by endpoint."));
+
+Counter<string, string>* replies(Counter<string, string>::New(
+    "replay_traffic_replies", "endpoint", "status",
+    "Number of replies by endpoint and HTTP status, or of requests not "
+    "sent, by reason."));
+
+
+// The last component of the path of |uri|, e.g. "get-sth".
+string EndpointName(const string& uri) {
+  const string path(uri.substr(0, uri.find('?')));
+  return path.substr(path.rfind('/') + 1);
+}
+
+
+// Reads the requests of the capture in |path| (which must exist),
+// oldest first, and records their latencies in |latencies|.
+vector<CapturedRequest> ReadCapture(const string& path,
+                                    Histogram<string>* latencies) {
+  std::ifstream in(path.c_str());
+  PCHECK(in) << "could not read " << path;
+  vector<CapturedRequest> requests;
+  string line;
+  int64_t invalid(0);
+  while (std::getline(in, line)) {
+    CapturedRequest request;
+    if (!ParseCapturedRequest(line, &request)) {
+      ++invalid;
+      continue;
+    }
+    latencies->Record(EndpointName(request.uri), request.latency_us);
+    requests.emplace_back(std::move(request));
+  }
+  LOG_IF(WARNING, invalid > 0) << "skipped " << invalid
+                               << " invalid lines in " << path;
+  // The requests are written out in the order they finish.
+  std::stable_sort(requests.begin(), requests.end(),
+                   [](const CapturedRequest& a, const CapturedRequest& b) {
+                     return a.time_us < b.time_us;
+                   });
+  return requests;
+}
+
+
+class Replay {
+ public:
+  Replay(UrlFetcher* fetcher, ThreadPool* pool)
+      : fetcher_(fetcher), pool_(pool), outstanding_(0) {
+  }
+
+  void SetBody(const string& endpoint, const string& body_file);
+
+  // Sends |requests|, spaced out as they were captured (divided by
+  // --speed).
+  void Run(const vector<CapturedRequest>& requests);
+  // Returns false if some requests were still in flight after
+  // --drain_seconds.
+  bool Drain();
+
+ private:
+  void Send(const CapturedRequest& request, steady_clock::time_point due);
+
+  UrlFetcher* const fetcher_;
+  ThreadPool* const pool_;
+  // The bodies of the POST requests, by endpoint.
+  map<string, string> bodies_;
+  std::atomic<int> outstanding_;
+};
+
+
+void Replay::SetBody(const string& endpoint, const string& body_file) {
+  if (body_file.empty()) {
+    return;
+  }
+  PCHECK(util::ReadBinaryFile(body_file, &bodies_[endpoint]))
+      << "could not read " << body_file;
+}
+
+
+// As in load_test, the latency of a request is measured from when it
+// was due, so that a slow target shows up in the latencies instead of
+// stretching the replay.
+void Replay::Run(const vector<CapturedRequest>& requests) {
+  if (requests.empty()) {
+    return;
+  }
+  const steady_clock::time_point start(steady_clock::now());
+  const int64_t first_us(requests.front().time_us);
+  for (const CapturedRequest& request : requests) {
+    const steady_clock::time_point due(
+        start + duration_cast<steady_clock::duration>(microseconds(
+                    static_cast<int64_t>((request.time_us - first_us) /
+                                         FLAGS_speed))));
+    std::this_thread::sleep_until(due);
+    Send(request, due);
+  }
+}
+
+
+void Replay::Send(const CapturedRequest& request,
+                  steady_clock::time_point due) {
+  const string name(EndpointName(request.uri));
+  UrlFetcher::Request req((URL(FLAGS_target + request.uri)));
+  if (request.method == "POST") {
+    const map<string, string>::const_iterator body(bodies_.find(name));
+    if (body == bodies_.end()) {
+      replies->Increment(name, "SKIPPED");
+      return;
+    }
+    req.verb = UrlFetcher::Verb::POST;
+    req.body = body->second;
+  } else if (request.method != "GET") {
+    replies->Increment(name, "SKIPPED");
+    return;
+  }
+
+  if (outstanding_.load() >= FLAGS_max_outstanding) {
+    replies->Increment(name, "DROPPED");
+    return;
+  }
+  ++outstanding_;
+
+  UrlFetcher::Response* const resp(new UrlFetcher::Response);
+  fetcher_->Fetch(req, resp,
+                  new util::Task(
+                      [this, resp, name, due](util::Task* task) {
+                        replayed_latency_us->Record(
+                            name, duration_cast<microseconds>(
+                                      steady_clock::now() - due).count());
+                        replies->Increment(
+                            name, task->status().ok()
+                                      ? std::to_string(resp->status_code)
+                                      : "FAILED");
+                        delete resp;
+                        delete task;
+                        --outstanding_;
+                      },
+                      pool_));
+}
+
+
+bool Replay::Drain() {
+  const steady_clock::time_point deadline(
+      steady_clock::now() + std::chrono::seconds(FLAGS_drain_seconds));
+  while (outstanding_.load() > 0) {
+    if (steady_clock::now() >= deadline) {
+      LOG(WARNING) << outstanding_.load() << " requests still in flight";
+      return false;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  return true;
+}
+
+
+// The upper bound of the bucket of |distribution| that holds the
+// |quantile|, or -1 if it is in the last one, which has none.
+double Quantile(const Metric::Distribution& distribution, double quantile) {
+  const uint64_t count(distribution.Count());
+  const uint64_t rank(std::max<uint64_t>(1, std::ceil(quantile * count)));
+  uint64_t seen(0);
+  for (size_t i = 0; i < distribution.upper_bounds.size(); ++i) {
+    seen += distribution.counts[i];
+    if (seen >= rank) {
+      return distribution.upper_bounds[i];
+    }
+  }
+  return -1;
+}
+
+
+void PrintQuantiles(const Metric::Distribution& latencies) {
+  for (const double quantile : {0.5, 0.9, 0.99}) {
+    const double bound(latencies.Count() > 0 ? Quantile(latencies, quantile)
+                                             : 0);
+    std::cout << std::setw(9);
+    if (bound < 0) {
+      std::cout << "inf";
+    } else {
+      std::cout << std::fixed << std::setprecision(2) << bound / 1000;
+    }
+  }
+}
+
+
+void Report(const vector<CapturedRequest>& requests, bool have_target) {
+  map<string, int64_t> captured;
+  for (const CapturedRequest& request : requests) {
+    ++captured[EndpointName(request.uri)];
+  }
+  const auto counts(replies->CurrentValues());
+
+  std::cout << std::left << std::setw(22) << "endpoint" << std::right
+            << std::setw(10) << "captured" << std::setw(10) << "errors"
+            << std::setw(27) << "captured p50/p90/p99 ms" << std::setw(27)
+            << "replayed p50/p90/p99 ms";
+  if (have_target) {
+    std::cout << std::setw(27) << "target p50/p90/p99 ms";
+  }
+  std::cout << std::endl;
+  for (const auto& endpoint : captured) {
+    int64_t errors(0);
+    for (const auto& it : counts) {
+      if (it.first[0] == endpoint.first && it.first[1] != "200") {
+        errors += it.second.second;
+      }
+    }
+    std::cout << std::left << std::setw(22) << endpoint.first << std::right
+              << std::setw(10) << endpoint.second << std::setw(10) << errors;
+    PrintQuantiles(captured_latency_us->GetDistribution(endpoint.first));
+    PrintQuantiles(replayed_latency_us->GetDistribution(endpoint.first));
+    if (have_target) {
+      PrintQuantiles(target_latency_us->GetDistribution(endpoint.first));
+    }
+    std::cout << std::endl;
+  }
+
+  // The replies other than 200, and the requests not sent, by status.
+  for (const auto& it : counts) {
+    if (it.first[1] != "200") {
+      std::cout << it.first[0] << " " << it.first[1] << ": "
+                << it.second.second << std::endl;
+    }
+  }
+}
+
+
+}  // namespace
+}  // namespace cert_trans
+
+
+int main(int argc, char* argv[]) {
+  util::InitCT(&argc, &argv);
+
+  CHECK(!FLAGS_capture_file.empty()) << "--capture_file is required";
+  CHECK_GT(FLAGS_speed, 0);
+  CHECK_GE(FLAGS_drain_seconds, 0);
+  CHECK_GT(FLAGS_max_outstanding, 0);
+  CHECK_GT(FLAGS_fetch_threads, 0);
+
+  const std::vector<cert_trans::CapturedRequest> requests(
+      cert_trans::ReadCapture(FLAGS_capture_file,
+                              cert_trans::captured_latency_us));
+  LOG(INFO) << "replaying " << requests.size() << " requests";
+
+  const std::shared_ptr<cert_trans::libevent::Base> base(
+      std::make_shared<cert_trans::libevent::Base>());
+  cert_trans::libevent::EventPumpThread pump(base);
+  cert_trans::ThreadPool fetch_pool(FLAGS_fetch_threads);
+  cert_trans::UrlFetcher fetcher(base.get(), &fetch_pool);
+
+  cert_trans::Replay replay(&fetcher, &fetch_pool);
+  replay.SetBody("add-chain", FLAGS_add_chain_body_file);
+  replay.SetBody("add-pre-chain", FLAGS_add_pre_chain_body_file);
+  replay.Run(requests);
+  const bool drained(replay.Drain());
+
+  if (!FLAGS_target_capture_file.empty()) {
+    cert_trans::ReadCapture(FLAGS_target_capture_file,
+                            cert_trans::target_latency_us);
+  }
+  cert_trans::Report(requests, !FLAGS_target_capture_file.empty());
+
+  // The callbacks of the requests still in flight would use the
+  // fetcher after it is destroyed.
+  if (!drained) {
+    _exit(1);
+  }
+  return 0;
+}
@@ -1,9 +1,14 @@
 #include "client/ssl_client.h"
 
+#include <gflags/gflags.h>
 #include <glog/logging.h>
+#include <list>
+#include <mutex>
 #include <openssl/bio.h>
 #include <openssl/ssl.h>
 #include <openssl/x509.h>
+#include <unordered_map>
+#include <utility>
 
 #include "client/client.h"
 #include "log/cert.h"
@@ -19,10 +24,68 @@ using ct::LogEntry;
 using ct::SSLClientCTData;
 using ct::SignedCertificateTimestamp;
 using ct::SignedCertificateTimestampList;
+using std::lock_guard;
+using std::list;
+using std::mutex;
+using std::shared_ptr;
 using std::string;
+using std::unordered_map;
+
+DEFINE_int32(ssl_client_sct_cache_entries, 4096,
+             "number of verified SCTs kept in memory, so that those "
+             "received again in later handshakes are not verified again");
 
 const uint16_t CT_EXTENSION_TYPE = 18;
 
+namespace {
+
+
+// The SCTs verified by all the clients, by the key ID of their log, the
+// digest of the SCT (which covers its signature) and the digest of the
+// Merkle tree leaf it signs, mapped to the leaf hash. Only good SCTs
+// are remembered, and their timestamps stay in the past.
+class VerifiedSCTCache {
+ public:
+  static VerifiedSCTCache* Instance() {
+    static VerifiedSCTCache* const cache(new VerifiedSCTCache);
+    return cache;
+  }
+
+  bool Lookup(const string& key, string* merkle_leaf_hash) {
+    lock_guard<mutex> lock(lock_);
+    const auto it(entries_.find(key));
+    if (it == entries_.end())
+      return false;
+    lru_.splice(lru_.begin(), lru_, it->second.second);
+    *merkle_leaf_hash = it->second.first;
+    return true;
+  }
+
+  void Insert(const string& key, const string& merkle_leaf_hash) {
+    const size_t max_entries(FLAGS_ssl_client_sct_cache_entries);
+    lock_guard<mutex> lock(lock_);
+    if (entries_.find(key) != entries_.end())
+      return;
+    while (!entries_.empty() && entries_.size() >= max_entries) {
+      entries_.erase(lru_.back());
+      lru_.pop_back();
+    }
+    lru_.push_front(key);
+    entries_.emplace(key, std::make_pair(merkle_leaf_hash, lru_.begin()));
+  }
+
+ private:
+  VerifiedSCTCache() = default;
+
+  mutex lock_;
+  // Most recently used first.
+  list<string> lru_;
+  unordered_map<string, std::pair<string, list<string>::iterator>> entries_;
+};
+
+
+}  // namespace
+
 // static
 int SSLClient::ExtensionCallback(SSL*, unsigned ext_type,
                                  const unsigned char* in, size_t inlen, int*,
@@ -61,10 +124,16 @@ int SSLClient::ExtensionCallback(SSL*, unsigned ext_type,
 // TODO(ekasper): handle Cert::Status errors.
 SSLClient::SSLClient(const string& server, uint16_t port, const string& ca_dir,
                      LogVerifier* verifier)
+    : SSLClient(server, port, ca_dir, shared_ptr<LogVerifier>(verifier)) {
+}
+
+SSLClient::SSLClient(const string& server, uint16_t port, const string& ca_dir,
+                     const shared_ptr<LogVerifier>& verifier)
     : client_(server, port),
       ctx_(NULL),
       ssl_(NULL),
-      verify_args_(verifier),
+      verifier_(CHECK_NOTNULL(verifier)),
+      verify_args_(verifier_.get()),
       connected_(false) {
   ctx_ = SSL_CTX_new(TLSv1_client_method());
   CHECK_NOTNULL(ctx_);
@@ -95,7 +164,6 @@ SSLClient::~SSLClient() {
   Disconnect();
   if (ctx_ != NULL)
     SSL_CTX_free(ctx_);
-  delete verify_args_.verifier;
 }
 
 bool SSLClient::Connected() const {
@@ -135,12 +203,32 @@ LogVerifier::VerifyResult SSLClient::VerifySCT(const string& token,
   if (Deserializer::DeserializeSCT(token, &local_sct) != Deserializer::OK)
     return LogVerifier::INVALID_FORMAT;
 
+  // The signature covers the Merkle tree leaf, so that is what makes
+  // the same SCT bytes good for one certificate but not another.
+  string serialized_leaf;
+  if (Serializer::SerializeSCTMerkleTreeLeaf(local_sct,
+                                             data->reconstructed_entry(),
+                                             &serialized_leaf) !=
+      Serializer::OK)
+    return LogVerifier::INVALID_FORMAT;
+  const bool use_cache(FLAGS_ssl_client_sct_cache_entries > 0);
+  const string cache_key(verifier->KeyID() +
+                         Sha256Hasher::Sha256Digest(token) +
+                         Sha256Hasher::Sha256Digest(serialized_leaf));
+
   string merkle_leaf;
-  LogVerifier::VerifyResult result =
-      verifier->VerifySignedCertificateTimestamp(data->reconstructed_entry(),
-                                                 local_sct, &merkle_leaf);
-  if (result != LogVerifier::VERIFY_OK)
-    return result;
+  if (!use_cache ||
+      !VerifiedSCTCache::Instance()->Lookup(cache_key, &merkle_leaf)) {
+    LogVerifier::VerifyResult result =
+        verifier->VerifySignedCertificateTimestamp(data->reconstructed_entry(),
+                                                   local_sct, &merkle_leaf);
+    if (result != LogVerifier::VERIFY_OK)
+      return result;
+    if (use_cache)
+      VerifiedSCTCache::Instance()->Insert(cache_key, merkle_leaf);
+  } else {
+    VLOG(1) << "SCT already verified";
+  }
   SSLClientCTData::SCTInfo* sct_info = data->add_attached_sct_info();
   sct_info->set_merkle_leaf_hash(merkle_leaf);
   sct_info->mutable_sct()->CopyFrom(local_sct);
@@ -224,8 +312,6 @@ int SSLClient::VerifyCallback(X509_STORE_CTX* ctx, void* arg) {
       args->ct_data.set_certificate_sha256_hash(
           Sha256Hasher::Sha256Digest(Serializer::LeafCertificate(entry)));
       // Only writes the checkpoint if verification succeeds.
-      // Note: an optimized client could only verify the signature if it's
-      // a certificate it hasn't seen before.
       SignedCertificateTimestampList sct_list;
       if (Deserializer::DeserializeSCTList(serialized_scts, &sct_list) !=
           Deserializer::OK) {
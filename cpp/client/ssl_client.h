@@ -2,6 +2,7 @@
 #ifndef SSL_CLIENT_H
 #define SSL_CLIENT_H
 
+#include <memory>
 #include <openssl/ssl.h>
 #include <openssl/x509.h>
 
@@ -20,6 +21,12 @@ class SSLClient {
   // TODO(ekasper): implement a proper multi-log auditor.
   SSLClient(const std::string& server, uint16_t port,
             const std::string& ca_dir, LogVerifier* verifier);
+  // Same as above, but with a verifier which can be shared with other
+  // clients (of other servers, for instance), so that the log key is
+  // only parsed once.
+  SSLClient(const std::string& server, uint16_t port,
+            const std::string& ca_dir,
+            const std::shared_ptr<LogVerifier>& verifier);
 
   ~SSLClient();
 
@@ -44,7 +51,10 @@ class SSLClient {
 
   void GetSSLClientCTData(ct::SSLClientCTData* data) const;
 
-  // Need a static wrapper for the callback.
+  // Need a static wrapper for the callback. The SCTs verified are
+  // remembered, up to --ssl_client_sct_cache_entries of them for all
+  // the clients, so that those received again in later handshakes are
+  // not verified again.
   static LogVerifier::VerifyResult VerifySCT(const std::string& token,
                                              LogVerifier* verifier,
                                              ct::SSLClientCTData* data);
@@ -81,7 +91,7 @@ class SSLClient {
           ct_data() {
     }
 
-    // The verifier for checking log proofs.
+    // The verifier for checking log proofs, owned by the client.
     LogVerifier* verifier;
     // SCT verification result.
     bool sct_verified;
@@ -93,6 +103,7 @@ class SSLClient {
     ct::SSLClientCTData ct_data;
   };
 
+  const std::shared_ptr<LogVerifier> verifier_;
   VerifyCallbackArgs verify_args_;
   bool connected_;
 
@@ -1,5 +1,6 @@
 #include "fetcher/continuous_fetcher.h"
 
+#include <cstdlib>
 #include <gflags/gflags.h>
 #include <glog/logging.h>
 
@@ -7,7 +8,7 @@
 #include "fetcher/peer_group.h"
 
 using std::bind;
-using std::chrono::seconds;
+using std::chrono::duration;
 using std::lock_guard;
 using std::map;
 using std::move;
@@ -20,12 +21,26 @@ using std::unique_ptr;
 using util::Executor;
 using util::Task;
 
-DEFINE_int32(delay_between_fetches_seconds, 30, "delay between fetches");
+DEFINE_int32(delay_between_fetches_seconds, 30,
+             "delay between fetches, give or take a quarter, when no peer "
+             "reports new entries");
 
 namespace cert_trans {
 
 namespace {
 
+// Spread of the delay between fetches, so that many mirrors started
+// together do not poll in lockstep.
+const double kFetchDelayJitter = 0.25;
+
+
+duration<double> FetchDelay() {
+  const double jitter(kFetchDelayJitter *
+                      (2.0 * std::rand() / RAND_MAX - 1));
+  return duration<double>(FLAGS_delay_between_fetches_seconds *
+                          (1 + jitter));
+}
+
 
 class ContinuousFetcherImpl : public ContinuousFetcher {
  public:
@@ -34,6 +49,7 @@ class ContinuousFetcherImpl : public ContinuousFetcher {
 
   void AddPeer(const string& node_id, const shared_ptr<Peer>& peer) override;
   void RemovePeer(const string& node_id);
+  void NewEntriesAvailable() override;
 
  private:
   void StartFetch(const unique_lock<mutex>& lock);
@@ -49,6 +65,9 @@ class ContinuousFetcherImpl : public ContinuousFetcher {
   map<string, shared_ptr<Peer>> peers_;
 
   bool restart_fetch_;
+  // Whether new entries became available during the current fetch,
+  // which only goes up to the tree size the peers had when it started.
+  bool fetch_again_;
   unique_ptr<Task> fetch_task_;
 
   DISALLOW_COPY_AND_ASSIGN(ContinuousFetcherImpl);
@@ -63,7 +82,8 @@ ContinuousFetcherImpl::ContinuousFetcherImpl(libevent::Base* base,
       executor_(CHECK_NOTNULL(executor)),
       db_(CHECK_NOTNULL(db)),
       fetch_scts_(fetch_scts),
-      restart_fetch_(false) {
+      restart_fetch_(false),
+      fetch_again_(false) {
 }
 
 
@@ -103,11 +123,25 @@ void ContinuousFetcherImpl::RemovePeer(const string& node_id) {
 }
 
 
+void ContinuousFetcherImpl::NewEntriesAvailable() {
+  unique_lock<mutex> lock(lock_);
+
+  // Unlike a change of peers, the current fetch stays useful, so it
+  // is left to finish before starting the next one.
+  if (fetch_task_) {
+    fetch_again_ = true;
+  } else {
+    StartFetch(lock);
+  }
+}
+
+
 void ContinuousFetcherImpl::StartFetch(const unique_lock<mutex>& lock) {
   CHECK(lock.owns_lock());
   CHECK(!fetch_task_);
 
   restart_fetch_ = false;
+  fetch_again_ = false;
 
   unique_ptr<PeerGroup> peer_group(new PeerGroup(fetch_scts_));
   for (const auto& peer : peers_) {
@@ -130,11 +164,11 @@ void ContinuousFetcherImpl::FetchDone(Task* task) {
   lock_guard<mutex> lock(lock_);
   fetch_task_.reset();
 
-  if (restart_fetch_) {
+  if (restart_fetch_ || fetch_again_) {
     executor_->Add(
         bind(&ContinuousFetcherImpl::FetchDelayDone, this, nullptr));
   } else {
-    base_->Delay(seconds(FLAGS_delay_between_fetches_seconds),
+    base_->Delay(FetchDelay(),
                  new Task(bind(&ContinuousFetcherImpl::FetchDelayDone, this,
                                _1),
                           executor_));
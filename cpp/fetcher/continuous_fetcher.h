@@ -31,6 +31,11 @@ class ContinuousFetcher {
 
   virtual void RemovePeer(const std::string& node_id) = 0;
 
+  // Tells the fetcher that a peer has grown its tree, so that the new
+  // entries are fetched right away, rather than on the next periodic
+  // fetch.
+  virtual void NewEntriesAvailable() = 0;
+
  protected:
   ContinuousFetcher() = default;
 
@@ -0,0 +1,197 @@
+#include "fetcher/fetch_controller.h"
+
+#include <algorithm>
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+#include "monitoring/latency.h"
+#include "monitoring/monitoring.h"
+
+using std::chrono::duration;
+using std::chrono::milliseconds;
+using std::chrono::steady_clock;
+using std::lock_guard;
+using std::max;
+using std::min;
+using std::mutex;
+using std::string;
+
+DEFINE_int32(fetcher_concurrent_fetches, 2,
+             "number of concurrent fetch requests to each peer to start "
+             "with");
+DEFINE_int32(fetcher_max_concurrent_fetches, 16,
+             "maximum number of concurrent fetch requests to each peer");
+DEFINE_int32(fetcher_batch_size, 1000,
+             "maximum number of entries to fetch per request");
+
+namespace cert_trans {
+namespace {
+
+
+static Gauge<string>* fetcher_concurrent_fetches(
+    Gauge<string>::New("fetcher_concurrent_fetches", "peer",
+                       "Number of concurrent fetch requests allowed to a "
+                       "peer."));
+static Gauge<string>* fetcher_batch_size(
+    Gauge<string>::New("fetcher_batch_size", "peer",
+                       "Number of entries requested from a peer per fetch "
+                       "request."));
+static Counter<string, string>* fetcher_fetches(
+    Counter<string, string>::New("fetcher_fetches", "peer", "result",
+                                 "Number of fetch requests to a peer, by "
+                                 "result (ok, truncated or failed)."));
+static Gauge<string>* fetcher_fetches_in_flight(
+    Gauge<string>::New("fetcher_fetches_in_flight", "peer",
+                       "Number of fetch requests in flight to a peer."));
+static Counter<string>* fetcher_entries_fetched(
+    Counter<string>::New("fetcher_entries_fetched", "peer",
+                         "Number of entries received from a peer."));
+static Latency<milliseconds, string> fetcher_fetch_latency_ms(
+    "fetcher_fetch_latency_ms", "peer",
+    "Total latency of the successful fetch requests to a peer, in "
+    "milliseconds.");
+
+// Requests taking this many times longer per entry than the baseline
+// mean that the peer is overloaded.
+const double kCongestedLatencyFactor = 2;
+// How much the baseline drifts up on each request.
+const double kBaselineDrift = 1.0 / 64;
+// Weight of the latest request in the moving average of the latency
+// per entry.
+const double kLatencyWeight = 0.1;
+
+
+}  // namespace
+
+
+FetchController::FetchController(const string& peer)
+    : peer_(peer),
+      concurrent_fetches_(FLAGS_fetcher_concurrent_fetches),
+      batch_size_(FLAGS_fetcher_batch_size),
+      in_flight_(0),
+      baseline_seconds_per_entry_(0),
+      average_seconds_per_entry_(0) {
+  CHECK_GT(FLAGS_fetcher_concurrent_fetches, 0);
+  CHECK_GE(FLAGS_fetcher_max_concurrent_fetches,
+           FLAGS_fetcher_concurrent_fetches);
+  CHECK_GT(FLAGS_fetcher_batch_size, 0);
+  lock_guard<mutex> lock(lock_);
+  UpdateMetrics();
+}
+
+
+int FetchController::concurrent_fetches() const {
+  lock_guard<mutex> lock(lock_);
+  return static_cast<int>(concurrent_fetches_);
+}
+
+
+int64_t FetchController::batch_size() const {
+  lock_guard<mutex> lock(lock_);
+  return batch_size_;
+}
+
+
+double FetchController::seconds_per_entry() const {
+  lock_guard<mutex> lock(lock_);
+  return average_seconds_per_entry_;
+}
+
+
+bool FetchController::TryStart() {
+  lock_guard<mutex> lock(lock_);
+  if (in_flight_ >= static_cast<int>(concurrent_fetches_)) {
+    return false;
+  }
+  ++in_flight_;
+  UpdateMetrics();
+  return true;
+}
+
+
+void FetchController::Start() {
+  lock_guard<mutex> lock(lock_);
+  ++in_flight_;
+  UpdateMetrics();
+}
+
+
+void FetchController::Finished(bool ok, int64_t requested, int64_t received,
+                               steady_clock::duration latency) {
+  CHECK_GT(requested, 0);
+  const steady_clock::time_point now(steady_clock::now());
+  lock_guard<mutex> lock(lock_);
+  CHECK_GT(in_flight_, 0);
+  --in_flight_;
+
+  if (!ok || received <= 0) {
+    fetcher_fetches->Increment(peer_, "failed");
+    Decrease(0.5, now, latency);
+    UpdateMetrics();
+    return;
+  }
+
+  if (received < requested) {
+    fetcher_fetches->Increment(peer_, "truncated");
+    // The peer caps its responses there, asking for more only costs
+    // it time.
+    batch_size_ = received;
+  } else {
+    fetcher_fetches->Increment(peer_, "ok");
+    batch_size_ = min<int64_t>(
+        FLAGS_fetcher_batch_size,
+        batch_size_ + max(1, FLAGS_fetcher_batch_size / 16));
+  }
+
+  fetcher_entries_fetched->IncrementBy(peer_, received);
+  fetcher_fetch_latency_ms.RecordLatency(peer_, latency);
+
+  const double seconds_per_entry(duration<double>(latency).count() /
+                                 received);
+  if (baseline_seconds_per_entry_ <= 0 ||
+      seconds_per_entry < baseline_seconds_per_entry_) {
+    baseline_seconds_per_entry_ = seconds_per_entry;
+  } else {
+    baseline_seconds_per_entry_ *= 1 + kBaselineDrift;
+  }
+  average_seconds_per_entry_ =
+      average_seconds_per_entry_ <= 0
+          ? seconds_per_entry
+          : (1 - kLatencyWeight) * average_seconds_per_entry_ +
+                kLatencyWeight * seconds_per_entry;
+
+  if (seconds_per_entry >
+      kCongestedLatencyFactor * baseline_seconds_per_entry_) {
+    Decrease(0.75, now, latency);
+  } else {
+    // About one more per round of concurrent_fetches_ requests.
+    concurrent_fetches_ =
+        min<double>(FLAGS_fetcher_max_concurrent_fetches,
+                    concurrent_fetches_ + 1 / concurrent_fetches_);
+  }
+  UpdateMetrics();
+}
+
+
+void FetchController::Decrease(double factor, steady_clock::time_point now,
+                               steady_clock::duration latency) {
+  // The requests that started before the last decrease do not know
+  // about it yet.
+  if (last_decrease_ != steady_clock::time_point() &&
+      now - last_decrease_ < latency) {
+    return;
+  }
+  last_decrease_ = now;
+  concurrent_fetches_ = max(1.0, concurrent_fetches_ * factor);
+}
+
+
+void FetchController::UpdateMetrics() {
+  fetcher_concurrent_fetches->Set(peer_,
+                                  static_cast<int>(concurrent_fetches_));
+  fetcher_batch_size->Set(peer_, batch_size_);
+  fetcher_fetches_in_flight->Set(peer_, in_flight_);
+}
+
+
+}  // namespace cert_trans
@@ -0,0 +1,80 @@
+#ifndef CERT_TRANS_FETCHER_FETCH_CONTROLLER_H_
+#define CERT_TRANS_FETCHER_FETCH_CONTROLLER_H_
+
+#include <chrono>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+
+#include "base/macros.h"
+
+namespace cert_trans {
+
+
+// Decides how many get-entries requests to have in flight to one
+// peer, and how many entries to ask for in each, from how the
+// previous ones went, in the manner of TCP congestion control
+// (additive increase, multiplicative decrease):
+//
+//  - The number of requests grows by about one for each round of
+//    requests that succeed, and is halved when one fails (such as
+//    when the peer throttles us), or cut by a quarter when requests
+//    take much longer per entry than they used to.
+//
+//  - When the peer returns fewer entries than asked for, as logs cap
+//    the size of their responses, the next requests ask for that
+//    many, and grow back slowly after complete responses.
+//
+// The chosen values are exported as the "fetcher_concurrent_fetches"
+// and "fetcher_batch_size" gauges. Thread-safe.
+class FetchController {
+ public:
+  // |peer| labels the metrics.
+  explicit FetchController(const std::string& peer);
+
+  int concurrent_fetches() const;
+  int64_t batch_size() const;
+  // Moving average of the latency per entry of the successful
+  // fetches, 0 until there is one.
+  double seconds_per_entry() const;
+
+  // Whether a fetch can be started without going over
+  // concurrent_fetches(). If so, it is counted as in flight, and
+  // Finished() must be called when it is done.
+  bool TryStart();
+
+  // Same, whether it goes over or not.
+  void Start();
+
+  // Reports the outcome of a fetch started with TryStart() or Start()
+  // for |requested| entries, |received| of them having come back (0 if
+  // it failed), after |latency|.
+  void Finished(bool ok, int64_t requested, int64_t received,
+                std::chrono::steady_clock::duration latency);
+
+ private:
+  void Decrease(double factor, std::chrono::steady_clock::time_point now,
+                std::chrono::steady_clock::duration latency);
+  void UpdateMetrics();
+
+  const std::string peer_;
+
+  mutable std::mutex lock_;
+  double concurrent_fetches_;
+  int64_t batch_size_;
+  int in_flight_;
+  // The lowest latency per entry seen lately, which drifts up slowly
+  // so that it follows the peer getting slower for good.
+  double baseline_seconds_per_entry_;
+  double average_seconds_per_entry_;
+  // Decreases are at most once per round of requests, all the
+  // requests in flight in a congested period reporting it.
+  std::chrono::steady_clock::time_point last_decrease_;
+
+  DISALLOW_COPY_AND_ASSIGN(FetchController);
+};
+
+
+}  // namespace cert_trans
+
+#endif  // CERT_TRANS_FETCHER_FETCH_CONTROLLER_H_
@@ -0,0 +1,154 @@
+#include "fetcher/fetch_controller.h"
+
+#include <gflags/gflags.h>
+#include <gtest/gtest.h>
+
+#include "util/testing.h"
+
+DECLARE_int32(fetcher_batch_size);
+DECLARE_int32(fetcher_concurrent_fetches);
+DECLARE_int32(fetcher_max_concurrent_fetches);
+
+namespace cert_trans {
+namespace {
+
+using std::chrono::milliseconds;
+using std::chrono::seconds;
+
+
+class FetchControllerTest : public ::testing::Test {
+ protected:
+  FetchControllerTest() : controller_("log.example.com:443") {
+  }
+
+  // Does a round of as many fetches as allowed, all of them getting
+  // |received| of the |requested| entries after |latency|.
+  void Round(bool ok, int64_t requested, int64_t received,
+             milliseconds latency) {
+    int started(0);
+    while (controller_.TryStart()) {
+      ++started;
+    }
+    ASSERT_GT(started, 0);
+    for (int i = 0; i < started; ++i) {
+      controller_.Finished(ok, requested, received, latency);
+    }
+  }
+
+  FetchController controller_;
+};
+
+
+TEST_F(FetchControllerTest, StartsFromFlags) {
+  EXPECT_EQ(FLAGS_fetcher_concurrent_fetches, controller_.concurrent_fetches());
+  EXPECT_EQ(FLAGS_fetcher_batch_size, controller_.batch_size());
+}
+
+
+TEST_F(FetchControllerTest, LimitsFetchesInFlight) {
+  ASSERT_EQ(2, controller_.concurrent_fetches());
+  EXPECT_TRUE(controller_.TryStart());
+  EXPECT_TRUE(controller_.TryStart());
+  EXPECT_FALSE(controller_.TryStart());
+
+  controller_.Finished(true, 1000, 1000, milliseconds(100));
+  EXPECT_TRUE(controller_.TryStart());
+}
+
+
+TEST_F(FetchControllerTest, GrowsByAboutOnePerRound) {
+  for (int i = 0; i < 4; ++i) {
+    Round(true, 1000, 1000, milliseconds(100));
+  }
+  EXPECT_LE(5, controller_.concurrent_fetches());
+  EXPECT_GE(6, controller_.concurrent_fetches());
+
+  for (int i = 0; i < 100; ++i) {
+    Round(true, 1000, 1000, milliseconds(100));
+  }
+  EXPECT_EQ(FLAGS_fetcher_max_concurrent_fetches,
+            controller_.concurrent_fetches());
+}
+
+
+TEST_F(FetchControllerTest, HalvesOnceOnErrors) {
+  for (int i = 0; i < 6; ++i) {
+    Round(true, 1000, 1000, milliseconds(100));
+  }
+  const int before(controller_.concurrent_fetches());
+  ASSERT_LE(6, before);
+
+  // All the fetches in flight failing is one decrease.
+  Round(false, 1000, 0, seconds(10));
+  EXPECT_EQ(before / 2, controller_.concurrent_fetches());
+  EXPECT_EQ(FLAGS_fetcher_batch_size, controller_.batch_size());
+}
+
+
+TEST_F(FetchControllerTest, NeverGoesBelowOne) {
+  for (int i = 0; i < 4; ++i) {
+    Round(false, 1000, 0, milliseconds(0));
+  }
+  EXPECT_EQ(1, controller_.concurrent_fetches());
+}
+
+
+TEST_F(FetchControllerTest, BacksOffWhenSlower) {
+  for (int i = 0; i < 6; ++i) {
+    Round(true, 1000, 1000, milliseconds(100));
+  }
+  const int before(controller_.concurrent_fetches());
+  ASSERT_LE(6, before);
+
+  // Five times slower per entry than before, by a quarter once.
+  Round(true, 1000, 1000, milliseconds(500));
+  EXPECT_GT(before, controller_.concurrent_fetches());
+  EXPECT_LE(before * 3 / 4, controller_.concurrent_fetches());
+}
+
+
+TEST_F(FetchControllerTest, AveragesLatencyPerEntry) {
+  EXPECT_EQ(0, controller_.seconds_per_entry());
+  ASSERT_TRUE(controller_.TryStart());
+  controller_.Finished(true, 1000, 1000, milliseconds(100));
+  EXPECT_DOUBLE_EQ(0.0001, controller_.seconds_per_entry());
+
+  // Failures do not count.
+  ASSERT_TRUE(controller_.TryStart());
+  controller_.Finished(false, 1000, 0, seconds(10));
+  EXPECT_DOUBLE_EQ(0.0001, controller_.seconds_per_entry());
+
+  for (int i = 0; i < 100; ++i) {
+    Round(true, 1000, 1000, milliseconds(200));
+  }
+  EXPECT_NEAR(0.0002, controller_.seconds_per_entry(), 0.000001);
+}
+
+
+TEST_F(FetchControllerTest, FollowsTruncation) {
+  ASSERT_TRUE(controller_.TryStart());
+  controller_.Finished(true, 1000, 256, milliseconds(100));
+  EXPECT_EQ(256, controller_.batch_size());
+  // Not a sign of congestion.
+  EXPECT_EQ(2, controller_.concurrent_fetches());
+
+  // Grows back slowly, up to the flag.
+  ASSERT_TRUE(controller_.TryStart());
+  controller_.Finished(true, 256, 256, milliseconds(100));
+  EXPECT_EQ(256 + FLAGS_fetcher_batch_size / 16, controller_.batch_size());
+  for (int i = 0; i < 20; ++i) {
+    Round(true, controller_.batch_size(), controller_.batch_size(),
+          milliseconds(100));
+  }
+  EXPECT_EQ(FLAGS_fetcher_batch_size, controller_.batch_size());
+}
+
+
+}  // namespace
+}  // namespace cert_trans
+
+
+int main(int argc, char** argv) {
+  cert_trans::test::InitTesting(argv[0], &argc, &argv, true);
+  return RUN_ALL_TESTS();
+}
@@ -1,20 +1,37 @@
 #include "fetcher/fetcher.h"
 
+#include <algorithm>
 #include <gflags/gflags.h>
 #include <glog/logging.h>
+#include <iterator>
+#include <map>
 #include <memory>
 #include <mutex>
+#include <set>
 
 #include "base/macros.h"
+#include "monitoring/latency.h"
+#include "monitoring/monitoring.h"
 
 using cert_trans::AsyncLogClient;
+using cert_trans::Counter;
+using cert_trans::Gauge;
+using cert_trans::Latency;
 using cert_trans::LoggedCertificate;
 using cert_trans::PeerGroup;
+using std::back_inserter;
 using std::bind;
+using std::chrono::duration;
+using std::chrono::milliseconds;
+using std::chrono::steady_clock;
 using std::lock_guard;
+using std::map;
+using std::max;
+using std::min;
 using std::move;
 using std::mutex;
 using std::placeholders::_1;
+using std::set;
 using std::unique_lock;
 using std::unique_ptr;
 using std::vector;
@@ -22,30 +39,246 @@ using util::Status;
 using util::Task;
 using util::TaskHold;
 
-DEFINE_int32(fetcher_concurrent_fetches, 2,
-             "number of concurrent fetch requests");
-DEFINE_int32(fetcher_batch_size, 1000,
-             "maximum number of entries to fetch per request");
+DEFINE_int32(fetcher_write_batch_size, 10000,
+             "maximum number of entries to write to the database at once");
+DEFINE_int32(fetcher_max_queued_writes, 100000,
+             "number of fetched entries waiting to be written to the "
+             "database past which no more fetches are started");
+DEFINE_int32(fetcher_convert_chunk_size, 128,
+             "number of fetched entries to convert and hash per executor "
+             "callback");
 
 namespace {
 
 
+Gauge<>* fetcher_ranges_in_flight =
+    Gauge<>::New("fetcher_ranges_in_flight",
+                 "Number of ranges of entries being fetched.");
+Gauge<>* fetcher_queued_write_entries =
+    Gauge<>::New("fetcher_queued_write_entries",
+                 "Number of fetched entries waiting to be written to the "
+                 "database.");
+Counter<>* fetcher_entries_written =
+    Counter<>::New("fetcher_entries_written",
+                   "Number of fetched entries written to the database.");
+Latency<milliseconds> fetcher_db_write_latency_ms(
+    "fetcher_db_write_latency_ms",
+    "Total latency of the database writes of fetched entries, in "
+    "milliseconds.");
+Gauge<>* fetcher_remaining_entries =
+    Gauge<>::New("fetcher_remaining_entries",
+                 "Number of entries the peers have that are not in the "
+                 "database yet.");
+Gauge<>* fetcher_eta_seconds =
+    Gauge<>::New("fetcher_eta_seconds",
+                 "Estimated number of seconds until the database has all "
+                 "the entries of the peers, at the rate they were written "
+                 "since the fetching started, or -1 if not known.");
+
+
 struct Range {
   enum State {
     HAVE,
     FETCHING,
+    // Fetched, and waiting for the writer.
+    WRITING,
     WANT,
   };
 
-  Range(State state, int64_t size, unique_ptr<Range>&& next = nullptr)
-      : state_(state), size_(size), next_(move(next)) {
-    CHECK(state_ == HAVE || state_ == FETCHING || state_ == WANT);
+  Range(State state, int64_t size) : state_(state), size_(size) {
+    CHECK(state_ == HAVE || state_ == FETCHING || state_ == WRITING ||
+          state_ == WANT);
     CHECK_GT(size_, 0);
   };
 
   State state_;
   int64_t size_;
-  unique_ptr<Range> next_;
+};
+
+
+// The contiguous ranges of entries left to deal with, by the index of
+// their first entry. Adjacent HAVE or WANT ranges are merged, while
+// the others keep their index until their state changes, so that the
+// fetches can refer to their range by it. Updates take O(log n), and
+// the WANT ranges are indexed separately, so that finding the next
+// one to fetch does not walk past those being fetched or written.
+class RangeMap {
+ public:
+  RangeMap() : fetching_(0) {
+  }
+
+  bool empty() const {
+    return ranges_.empty();
+  }
+
+  // The index of the first range, and the range itself.
+  int64_t start() const {
+    CHECK(!ranges_.empty());
+    return ranges_.begin()->first;
+  }
+  const Range& front() const {
+    CHECK(!ranges_.empty());
+    return ranges_.begin()->second;
+  }
+
+  const Range& at(int64_t index) const {
+    const auto it(ranges_.find(index));
+    CHECK(it != ranges_.end()) << index;
+    return it->second;
+  }
+
+  // The number of FETCHING ranges.
+  int fetching() const {
+    return fetching_;
+  }
+
+  // The index of the first WANT range starting at or after |index|,
+  // or -1 if there are none.
+  int64_t NextWanted(int64_t index) const {
+    const auto it(wanted_.lower_bound(index));
+    return it == wanted_.end() ? -1 : *it;
+  }
+
+  // |index| must be right after the last range, if there are any.
+  void Append(int64_t index, const Range& range) {
+    CHECK(ranges_.empty() || ranges_.rbegin()->first +
+                                     ranges_.rbegin()->second.size_ ==
+                                 index);
+    Add(index, range);
+    Coalesce(index);
+  }
+
+  void PopFront() {
+    CHECK(!ranges_.empty());
+    Remove(ranges_.begin());
+  }
+
+  void SetState(int64_t index, Range::State state) {
+    const auto it(ranges_.find(index));
+    CHECK(it != ranges_.end()) << index;
+    const Range range(state, it->second.size_);
+    Remove(it);
+    Add(index, range);
+    Coalesce(index);
+  }
+
+  // Splits the range at |index| after its first |size| entries, the
+  // rest getting the same state.
+  void Split(int64_t index, int64_t size) {
+    const auto it(ranges_.find(index));
+    CHECK(it != ranges_.end()) << index;
+    CHECK_GT(size, 0);
+    CHECK_LT(size, it->second.size_);
+    const Range rest(it->second.state_, it->second.size_ - size);
+    it->second.size_ = size;
+    Add(index + size, rest);
+  }
+
+ private:
+  void Add(int64_t index, const Range& range) {
+    CHECK(ranges_.emplace(index, range).second) << index;
+    if (range.state_ == Range::WANT) {
+      wanted_.insert(index);
+    } else if (range.state_ == Range::FETCHING) {
+      ++fetching_;
+    }
+  }
+
+  void Remove(map<int64_t, Range>::iterator it) {
+    if (it->second.state_ == Range::WANT) {
+      wanted_.erase(it->first);
+    } else if (it->second.state_ == Range::FETCHING) {
+      --fetching_;
+    }
+    ranges_.erase(it);
+  }
+
+  // Merges the range at |index| with its neighbours, if they are all
+  // HAVE or all WANT.
+  void Coalesce(int64_t index) {
+    auto it(ranges_.find(index));
+    const Range::State state(it->second.state_);
+    if (state != Range::HAVE && state != Range::WANT) {
+      return;
+    }
+
+    const auto next(std::next(it));
+    if (next != ranges_.end() && next->second.state_ == state) {
+      it->second.size_ += next->second.size_;
+      Remove(next);
+    }
+    if (it != ranges_.begin()) {
+      const auto prev(std::prev(it));
+      if (prev->second.state_ == state) {
+        prev->second.size_ += it->second.size_;
+        Remove(it);
+      }
+    }
+  }
+
+  map<int64_t, Range> ranges_;
+  // The indexes of the WANT ranges.
+  set<int64_t> wanted_;
+  int fetching_;
+
+  DISALLOW_COPY_AND_ASSIGN(RangeMap);
+};
+
+
+// Entries fetched for a Range, being converted to LoggedCertificate
+// in chunks, possibly concurrently.
+struct Conversion {
+  Conversion(int64_t index, const vector<AsyncLogClient::Entry>* entries,
+             Task* range_task)
+      : index_(index),
+        entries_(entries),
+        range_task_(range_task),
+        certs_(entries->size()),
+        converted_(entries->size()),
+        chunks_left_(0) {
+  }
+
+  const int64_t index_;
+  const vector<AsyncLogClient::Entry>* const entries_;
+  Task* const range_task_;
+  // Each chunk writes to its own part.
+  vector<LoggedCertificate> certs_;
+
+  mutex lock_;
+  // The entries before the first one that could not be converted.
+  size_t converted_;
+  int chunks_left_;
+};
+
+
+bool ConvertEntry(const AsyncLogClient::Entry& entry, int64_t sequence_number,
+                  LoggedCertificate* cert) {
+  if (!cert->CopyFromClientLogEntry(entry)) {
+    LOG(WARNING) << "could not convert entry to a LoggedCertificate";
+    return false;
+  }
+  if (entry.sct) {
+    *cert->mutable_sct() = *entry.sct;
+  }
+  if (!cert->CacheLeafHash()) {
+    LOG(WARNING) << "could not compute the leaf hash of an entry";
+    return false;
+  }
+  cert->set_sequence_number(sequence_number);
+  return true;
+}
+
+
+// Entries fetched for a Range, waiting to be written to the database.
+struct QueuedWrite {
+  // The index of the range.
+  int64_t index;
+  Task* range_task;
+  // The number of entries received, and how many of them made it into
+  // |certs|, the writer moving them out.
+  size_t received;
+  size_t converted;
+  vector<LoggedCertificate> certs;
 };
 
 
@@ -54,19 +287,32 @@ struct FetchState {
              unique_ptr<PeerGroup>&& peer_group, Task* task);
 
   void WalkEntries();
-  void FetchRange(const unique_lock<mutex>& lock, Range* current,
-                  int64_t index, Task* range_task);
-  void WriteToDatabase(int64_t index, Range* range,
+  void FetchRange(const unique_lock<mutex>& lock, int64_t index,
+                  Task* range_task);
+  void WriteToDatabase(int64_t index,
                        const vector<AsyncLogClient::Entry>* retval,
                        Task* range_task, Task* fetch_task);
+  void ConvertEntries(Conversion* conversion, size_t begin, size_t end);
+  void WriteQueued();
+  // Must be called with |lock_| held.
+  void UpdateMetrics();
 
   Database<LoggedCertificate>* const db_;
   const unique_ptr<PeerGroup> peer_group_;
   Task* const task_;
 
   mutex lock_;
-  int64_t start_;
-  unique_ptr<Range> entries_;
+  RangeMap ranges_;
+  // By index. A single writer at a time takes runs of contiguous
+  // entries from the front, so that the database sees its writes in
+  // order and in large batches, however the fetches complete.
+  map<int64_t, QueuedWrite> queued_writes_;
+  int64_t queued_entries_;
+  bool writing_;
+  // When the fetching started, and the number of entries written
+  // since, for the ETA.
+  const steady_clock::time_point started_;
+  int64_t written_entries_;
 
  private:
   DISALLOW_COPY_AND_ASSIGN(FetchState);
@@ -78,20 +324,25 @@ FetchState::FetchState(Database<LoggedCertificate>* db,
     : db_(CHECK_NOTNULL(db)),
       peer_group_(move(peer_group)),
       task_(CHECK_NOTNULL(task)),
-      start_(db_->TreeSize()) {
+      queued_entries_(0),
+      writing_(false),
+      started_(steady_clock::now()),
+      written_entries_(0) {
   // TODO(pphaneuf): Might be better to get that as a parameter?
   const int64_t remote_tree_size(peer_group_->TreeSize());
-  CHECK_GE(start_, 0);
+  const int64_t start(db_->TreeSize());
+  CHECK_GE(start, 0);
+  CHECK_GT(FLAGS_fetcher_convert_chunk_size, 0);
 
   // Nothing to do...
-  if (remote_tree_size <= start_) {
-    VLOG(1) << "nothing to do: we have " << start_ << " entries, remote has "
+  if (remote_tree_size <= start) {
+    VLOG(1) << "nothing to do: we have " << start << " entries, remote has "
             << remote_tree_size;
     task_->Return();
     return;
   }
 
-  entries_.reset(new Range(Range::WANT, remote_tree_size - start_));
+  ranges_.Append(start, Range(Range::WANT, remote_tree_size - start));
 
   WalkEntries();
 }
@@ -116,104 +367,79 @@ void FetchState::WalkEntries() {
 
   // Prune fetched and unavailable sequences at the beginning.
   const int64_t remote_tree_size(peer_group_->TreeSize());
-  while (entries_ &&
-         (entries_->state_ == Range::HAVE ||
-          (entries_->state_ == Range::WANT && remote_tree_size < start_))) {
-    VLOG(1) << "pruning " << entries_->size_ << " at offset " << start_;
-    start_ += entries_->size_;
-    entries_ = move(entries_->next_);
+  while (!ranges_.empty() &&
+         (ranges_.front().state_ == Range::HAVE ||
+          (ranges_.front().state_ == Range::WANT &&
+           remote_tree_size < ranges_.start()))) {
+    VLOG(1) << "pruning " << ranges_.front().size_ << " at offset "
+            << ranges_.start();
+    ranges_.PopFront();
   }
 
   // Are we done?
-  if (!entries_) {
+  if (ranges_.empty()) {
     task_->Return();
     return;
   }
 
-  int64_t index(start_);
-  int num_fetch(0);
-  for (Range* current = entries_.get(); current;
-       index += current->size_, current = current->next_.get()) {
-    // Coalesce with the next Range, if possible.
-    if (current->state_ != Range::FETCHING) {
-      while (current->next_ && current->next_->state_ == current->state_) {
-        current->size_ += current->next_->size_;
-        current->next_ = move(current->next_->next_);
-      }
+  // As decided by the FetchController of each peer.
+  const int concurrent_fetches(peer_group_->ConcurrentFetches());
+  const int64_t batch_size(peer_group_->BatchSize());
+  for (int64_t index = ranges_.NextWanted(ranges_.start());
+       index >= 0 && ranges_.fetching() < concurrent_fetches;
+       index = ranges_.NextWanted(index)) {
+    // Do not start a fetch if we think our peer group does not have
+    // it.
+    if (index >= remote_tree_size) {
+      break;
     }
 
-    switch (current->state_) {
-      case Range::HAVE:
-        VLOG(2) << "at offset " << index << ", we have " << current->size_
-                << " entries";
-        break;
-
-      case Range::FETCHING:
-        VLOG(2) << "at offset " << index << ", fetching " << current->size_
-                << " entries";
-        ++num_fetch;
-        break;
-
-      case Range::WANT:
-        VLOG(2) << "at offset " << index << ", we want " << current->size_
-                << " entries";
-
-        // Do not start a fetch if we think our peer group does not
-        // have it.
-        if (index >= remote_tree_size) {
-          break;
-        }
-
-        // If the range is bigger than the maximum batch size, split it.
-        if (current->size_ > FLAGS_fetcher_batch_size) {
-          current->next_.reset(
-              new Range(Range::WANT, current->size_ - FLAGS_fetcher_batch_size,
-                        move(current->next_)));
-          current->size_ = FLAGS_fetcher_batch_size;
-        }
-
-        FetchRange(lock, current, index,
-                   task_->AddChild(bind(&FetchState::WalkEntries, this)));
-        ++num_fetch;
-
-        break;
+    // Let the writer catch up, it will walk the entries again when it
+    // does.
+    if (queued_entries_ >= FLAGS_fetcher_max_queued_writes) {
+      break;
     }
 
-    if (num_fetch >= FLAGS_fetcher_concurrent_fetches ||
-        index >= remote_tree_size) {
-      break;
+    // If the range is bigger than the maximum batch size, split it.
+    if (ranges_.at(index).size_ > batch_size) {
+      ranges_.Split(index, batch_size);
     }
+
+    FetchRange(lock, index,
+               task_->AddChild(bind(&FetchState::WalkEntries, this)));
   }
+  UpdateMetrics();
 }
 
 
-void FetchState::FetchRange(const unique_lock<mutex>& lock, Range* current,
-                            int64_t index, Task* range_task) {
+void FetchState::FetchRange(const unique_lock<mutex>& lock, int64_t index,
+                            Task* range_task) {
   CHECK(lock.owns_lock());
-  const int64_t end_index(index + current->size_ - 1);
+  const int64_t end_index(index + ranges_.at(index).size_ - 1);
   VLOG(1) << "fetching from offset " << index << " to " << end_index;
 
   vector<AsyncLogClient::Entry>* const retval(
       new vector<AsyncLogClient::Entry>);
   range_task->DeleteWhenDone(retval);
 
-  current->state_ = Range::FETCHING;
+  ranges_.SetState(index, Range::FETCHING);
 
   peer_group_->FetchEntries(index, end_index, retval,
                             range_task->AddChild(
                                 bind(&FetchState::WriteToDatabase, this, index,
-                                     current, retval, range_task, _1)));
+                                     retval, range_task, _1)));
 }
 
 
-void FetchState::WriteToDatabase(int64_t index, Range* range,
+void FetchState::WriteToDatabase(int64_t index,
                                  const vector<AsyncLogClient::Entry>* retval,
                                  Task* range_task, Task* fetch_task) {
   if (!fetch_task->status().ok()) {
     LOG(INFO) << "error fetching entries at index " << index << ": "
               << fetch_task->status();
     lock_guard<mutex> lock(lock_);
-    range->state_ = Range::WANT;
+    ranges_.SetState(index, Range::WANT);
+    UpdateMetrics();
     range_task->Return(fetch_task->status());
     return;
   }
@@ -221,54 +447,166 @@ void FetchState::WriteToDatabase(int64_t index, Range* range,
   CHECK_GT(retval->size(), 0);
 
   VLOG(1) << "received " << retval->size() << " entries at offset " << index;
-  int64_t processed(0);
-  for (const auto& entry : *retval) {
-    LoggedCertificate cert;
-    if (!cert.CopyFromClientLogEntry(entry)) {
-      LOG(WARNING) << "could not convert entry to a LoggedCertificate";
-      break;
-    }
-    if (entry.sct) {
-      *cert.mutable_sct() = *entry.sct;
+  // Parsing and hashing the entries is spread over the executor, so
+  // that a large range is not converted by a single thread, the last
+  // chunk to finish handing the range to the writer.
+  Conversion* const conversion(
+      new Conversion(index, retval, range_task));
+  range_task->DeleteWhenDone(conversion);
+  const size_t chunk_size(FLAGS_fetcher_convert_chunk_size);
+  conversion->chunks_left_ = (retval->size() + chunk_size - 1) / chunk_size;
+  for (size_t begin = chunk_size; begin < retval->size();
+       begin += chunk_size) {
+    task_->executor()->Add(
+        bind(&FetchState::ConvertEntries, this, conversion, begin,
+             min(retval->size(), begin + chunk_size)));
+  }
+  ConvertEntries(conversion, 0, min(retval->size(), chunk_size));
+}
+
+
+void FetchState::ConvertEntries(Conversion* conversion, size_t begin,
+                                size_t end) {
+  size_t i(begin);
+  while (i < end &&
+         ConvertEntry((*conversion->entries_)[i], conversion->index_ + i,
+                      &conversion->certs_[i])) {
+    ++i;
+  }
+
+  {
+    lock_guard<mutex> lock(conversion->lock_);
+    if (i < end) {
+      conversion->converted_ = min(conversion->converted_, i);
     }
-    cert.set_sequence_number(index++);
-    if (db_->CreateSequencedEntry(cert) == Database<LoggedCertificate>::OK) {
-      ++processed;
-    } else {
-      LOG(WARNING) << "could not insert entry into the database:\n"
-                   << cert.DebugString();
-      break;
+    if (--conversion->chunks_left_ > 0) {
+      return;
     }
   }
 
+  vector<LoggedCertificate>& certs(conversion->certs_);
+  certs.resize(conversion->converted_);
+  const int64_t index(conversion->index_);
   {
     lock_guard<mutex> lock(lock_);
-    // TODO(pphaneuf): If we have problems fetching entries, to what
-    // point should we retry? Or should we just return on the task
-    // with an error?
-    if (processed > 0) {
-      // If we don't receive everything, split up the range.
-      if (range->size_ > processed) {
-        range->next_.reset(new Range(Range::WANT, range->size_ - processed,
-                                     move(range->next_)));
-        range->size_ = processed;
+    ranges_.SetState(index, Range::WRITING);
+    queued_entries_ += certs.size();
+    QueuedWrite& queued(queued_writes_[index]);
+    queued.index = index;
+    queued.range_task = conversion->range_task_;
+    queued.received = conversion->entries_->size();
+    queued.converted = certs.size();
+    queued.certs = move(certs);
+    UpdateMetrics();
+    if (writing_) {
+      return;
+    }
+    writing_ = true;
+  }
+
+  // The hold keeps us around until the writer is done, the range
+  // tasks it returns being all that might be left.
+  task_->AddHold();
+  task_->executor()->Add(bind(&FetchState::WriteQueued, this));
+}
+
+
+void FetchState::WriteQueued() {
+  unique_lock<mutex> lock(lock_);
+  CHECK(writing_);
+  while (!queued_writes_.empty()) {
+    // Take the run of contiguous entries at the front.
+    vector<QueuedWrite> run;
+    vector<LoggedCertificate> certs;
+    auto it(queued_writes_.begin());
+    int64_t next_index(it->first);
+    while (it != queued_writes_.end() && it->first == next_index &&
+           (run.empty() ||
+            certs.size() + it->second.converted <=
+                static_cast<size_t>(FLAGS_fetcher_write_batch_size))) {
+      QueuedWrite& queued(it->second);
+      next_index += queued.converted;
+      move(queued.certs.begin(), queued.certs.end(), back_inserter(certs));
+      run.emplace_back(move(queued));
+      it = queued_writes_.erase(it);
+      // The entries that could not be converted leave a gap.
+      if (run.back().converted < run.back().received) {
+        break;
+      }
+    }
+    lock.unlock();
+
+    size_t written(0);
+    if (!certs.empty()) {
+      const steady_clock::time_point write_started(steady_clock::now());
+      if (db_->CreateSequencedEntries(certs, &written) !=
+          Database<LoggedCertificate>::OK) {
+        LOG(WARNING) << "could not insert entry into the database:\n"
+                     << certs[written].DebugString();
       }
+      fetcher_db_write_latency_ms.RecordLatency(steady_clock::now() -
+                                                write_started);
+      fetcher_entries_written->IncrementBy(written);
+    }
+
+    bool failed(false);
+    lock.lock();
+    written_entries_ += written;
+    for (const QueuedWrite& queued : run) {
+      const int64_t processed(min(written, queued.converted));
+      written -= processed;
+      queued_entries_ -= queued.converted;
+      // TODO(pphaneuf): If we have problems fetching entries, to what
+      // point should we retry? Or should we just return on the task
+      // with an error?
+      if (processed > 0) {
+        // If we don't receive everything, split up the range.
+        if (ranges_.at(queued.index).size_ > processed) {
+          ranges_.Split(queued.index, processed);
+          ranges_.SetState(queued.index + processed, Range::WANT);
+        }
 
-      range->state_ = Range::HAVE;
-    } else {
-      range->state_ = Range::WANT;
+        ranges_.SetState(queued.index, Range::HAVE);
+      } else {
+        ranges_.SetState(queued.index, Range::WANT);
+      }
+
+      // We couldn't insert everything that we received into the
+      // database, this is fairly serious, return an error for the
+      // overall operation and let the higher level deal with it.
+      failed = failed || static_cast<size_t>(processed) < queued.received;
     }
-  }
+    UpdateMetrics();
+    lock.unlock();
 
-  if (static_cast<uint64_t>(processed) < retval->size()) {
-    // We couldn't insert everything that we received into the
-    // database, this is fairly serious, return an error for the
-    // overall operation and let the higher level deal with it.
-    task_->Return(Status(util::error::INTERNAL,
-                         "could not write some entries to the database"));
+    if (failed) {
+      task_->Return(Status(util::error::INTERNAL,
+                           "could not write some entries to the database"));
+    }
+    for (const QueuedWrite& queued : run) {
+      queued.range_task->Return();
+    }
+    lock.lock();
   }
+  writing_ = false;
+  lock.unlock();
+
+  task_->RemoveHold();
+}
+
+
+void FetchState::UpdateMetrics() {
+  fetcher_ranges_in_flight->Set(ranges_.fetching());
+  fetcher_queued_write_entries->Set(queued_entries_);
 
-  range_task->Return();
+  const int64_t remaining(
+      max<int64_t>(0, peer_group_->TreeSize() - db_->TreeSize()));
+  fetcher_remaining_entries->Set(remaining);
+  const double seconds(
+      duration<double>(steady_clock::now() - started_).count());
+  fetcher_eta_seconds->Set(written_entries_ > 0 && seconds > 0
+                               ? remaining / (written_entries_ / seconds)
+                               : -1);
 }
 
 
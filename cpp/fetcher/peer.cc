@@ -1,14 +1,18 @@
 #include "fetcher/peer.h"
 
 #include <glog/logging.h>
+#include <string>
 
+using std::to_string;
 using std::unique_ptr;
 
 namespace cert_trans {
 
 
-Peer::Peer(unique_ptr<AsyncLogClient>&& client) : client_(move(client)) {
-  CHECK_NOTNULL(client_.get());
+Peer::Peer(unique_ptr<AsyncLogClient>&& client)
+    : client_(move(client)),
+      fetch_controller_(CHECK_NOTNULL(client_.get())->server_url().Host() +
+                        ":" + to_string(client_->server_url().Port())) {
 }
 
 
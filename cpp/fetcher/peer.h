@@ -5,6 +5,7 @@
 
 #include "base/macros.h"
 #include "client/async_log_client.h"
+#include "fetcher/fetch_controller.h"
 
 namespace cert_trans {
 
@@ -19,6 +20,11 @@ class Peer {
     return *client_;
   }
 
+  // How to fetch entries from this peer.
+  FetchController& fetch_controller() {
+    return fetch_controller_;
+  }
+
   // Returns -1 if we do not know yet.
   virtual int64_t TreeSize() const = 0;
 
@@ -26,6 +32,8 @@ class Peer {
   const std::unique_ptr<AsyncLogClient> client_;
 
  private:
+  FetchController fetch_controller_;
+
   DISALLOW_COPY_AND_ASSIGN(Peer);
 };
 
@@ -1,23 +1,78 @@
 #include "fetcher/peer_group.h"
 
+#include <algorithm>
+#include <gflags/gflags.h>
 #include <glog/logging.h>
 
+#include "monitoring/monitoring.h"
+
+using std::chrono::duration;
+using std::chrono::steady_clock;
 using std::lock_guard;
+using std::make_shared;
 using std::max;
+using std::min;
 using std::mutex;
+using std::pair;
 using std::placeholders::_1;
 using std::shared_ptr;
 using std::vector;
 using util::Status;
 using util::Task;
 
+DEFINE_double(fetcher_hedge_latency_factor, 3,
+              "if not 0, a fetch taking this many times longer than the "
+              "average latency per entry of its peer is also sent to the "
+              "fastest other peer that can take it, the first answer "
+              "winning");
+
 namespace cert_trans {
 
 namespace {
 
 
-void GetEntriesDone(AsyncLogClient::Status client_status,
-                    const vector<AsyncLogClient::Entry>* entries, Task* task) {
+Counter<>* fetcher_hedged_fetches =
+    Counter<>::New("fetcher_hedged_fetches",
+                   "Number of fetches also sent to a second peer because "
+                   "the first was slow to answer.");
+
+
+// A fetch, possibly sent to two peers. Shared by the callbacks, as the
+// slower half of a hedged fetch can finish after the task has
+// returned.
+struct Fetch {
+  Fetch(bool fetch_scts, int64_t start_index, int64_t end_index,
+        vector<AsyncLogClient::Entry>* entries, Task* task)
+      : fetch_scts_(fetch_scts),
+        start_index_(start_index),
+        end_index_(end_index),
+        entries_(entries),
+        task_(task),
+        outstanding_(0),
+        answered_(false) {
+  }
+
+  const bool fetch_scts_;
+  const int64_t start_index_;
+  const int64_t end_index_;
+  vector<AsyncLogClient::Entry>* const entries_;
+  Task* const task_;
+
+  mutex lock_;
+  int outstanding_;
+  bool answered_;
+  // When hedged, each half fetches into its own, and the one
+  // answering swaps it into |entries_|.
+  vector<AsyncLogClient::Entry> primary_entries_;
+  vector<AsyncLogClient::Entry> hedge_entries_;
+};
+
+
+void GetEntriesDone(const shared_ptr<Peer>& peer, int64_t requested,
+                    steady_clock::time_point started,
+                    const shared_ptr<Fetch>& fetch,
+                    vector<AsyncLogClient::Entry>* entries,
+                    AsyncLogClient::Status client_status) {
   Status status;
 
   switch (client_status) {
@@ -36,7 +91,65 @@ void GetEntriesDone(AsyncLogClient::Status client_status,
         Status(util::error::INTERNAL, "log server did not return any entries");
   }
 
-  task->Return(status);
+  peer->fetch_controller().Finished(status.ok(), requested,
+                                    status.ok() ? entries->size() : 0,
+                                    steady_clock::now() - started);
+
+  {
+    lock_guard<mutex> lock(fetch->lock_);
+    --fetch->outstanding_;
+    // Let the other half of a hedged fetch answer, if this one
+    // failed.
+    if (fetch->answered_ || (!status.ok() && fetch->outstanding_ > 0)) {
+      return;
+    }
+    fetch->answered_ = true;
+    if (entries != fetch->entries_) {
+      fetch->entries_->swap(*entries);
+    }
+  }
+
+  fetch->task_->Return(status);
+}
+
+
+void StartGetEntries(const shared_ptr<Peer>& peer,
+                     const shared_ptr<Fetch>& fetch,
+                     vector<AsyncLogClient::Entry>* entries) {
+  {
+    lock_guard<mutex> lock(fetch->lock_);
+    ++fetch->outstanding_;
+  }
+  const AsyncLogClient::Callback done(
+      bind(GetEntriesDone, peer, fetch->end_index_ - fetch->start_index_ + 1,
+           steady_clock::now(), fetch, entries, _1));
+  if (fetch->fetch_scts_) {
+    peer->client().GetEntriesAndSCTs(fetch->start_index_, fetch->end_index_,
+                                     entries, done);
+  } else {
+    peer->client().GetEntries(fetch->start_index_, fetch->end_index_, entries,
+                              done);
+  }
+}
+
+
+void MaybeStartHedge(const shared_ptr<Peer>& peer,
+                     const shared_ptr<Fetch>& fetch, Task* delay_task) {
+  bool answered;
+  {
+    lock_guard<mutex> lock(fetch->lock_);
+    answered = fetch->answered_;
+  }
+  // Only if the peer has a fetch to spare, which is mostly near the
+  // end of a catch-up, when the fetches in flight are few.
+  if (delay_task->status().ok() && !answered &&
+      peer->fetch_controller().TryStart()) {
+    VLOG(1) << "hedging fetch from offset " << fetch->start_index_ << " to "
+            << fetch->end_index_;
+    fetcher_hedged_fetches->Increment();
+    StartGetEntries(peer, fetch, &fetch->hedge_entries_);
+  }
+  delete delay_task;
 }
 
 
@@ -66,13 +179,35 @@ int64_t PeerGroup::TreeSize() const {
 }
 
 
+int PeerGroup::ConcurrentFetches() const {
+  lock_guard<mutex> lock(lock_);
+  int concurrent_fetches(0);
+  for (const auto& peer : peers_) {
+    concurrent_fetches += peer.first->fetch_controller().concurrent_fetches();
+  }
+  return max(1, concurrent_fetches);
+}
+
+
+int64_t PeerGroup::BatchSize() const {
+  lock_guard<mutex> lock(lock_);
+  int64_t batch_size(1);
+  for (const auto& peer : peers_) {
+    batch_size = max(batch_size, peer.first->fetch_controller().batch_size());
+  }
+  return batch_size;
+}
+
+
 void PeerGroup::FetchEntries(int64_t start_index, int64_t end_index,
                              vector<AsyncLogClient::Entry>* entries,
                              Task* task) {
   CHECK_GE(start_index, 0);
   CHECK_GE(end_index, start_index);
+  CHECK_NOTNULL(entries);
 
-  const shared_ptr<Peer> peer(PickPeer(end_index + 1));
+  shared_ptr<Peer> hedge_peer;
+  const shared_ptr<Peer> peer(PickPeer(end_index + 1, &hedge_peer));
   if (!peer) {
     task->Return(Status(util::error::UNAVAILABLE,
                         "requested entries not available in the peer group"));
@@ -80,41 +215,80 @@ void PeerGroup::FetchEntries(int64_t start_index, int64_t end_index,
   }
 
   // TODO(pphaneuf): Handle the case where we have no peer more cleanly.
-  if (fetch_scts_) {
-    peer->client().GetEntriesAndSCTs(start_index, end_index,
-                                     CHECK_NOTNULL(entries),
-                                     bind(GetEntriesDone, _1, entries, task));
-  } else {
-    peer->client().GetEntries(start_index, end_index, CHECK_NOTNULL(entries),
-                              bind(GetEntriesDone, _1, entries, task));
+  // PickPeer() counted the fetch with the controller.
+  end_index = min(end_index,
+                  start_index + peer->fetch_controller().batch_size() - 1);
+  const duration<double> hedge_delay(
+      FLAGS_fetcher_hedge_latency_factor *
+      peer->fetch_controller().seconds_per_entry() *
+      (end_index - start_index + 1));
+  const shared_ptr<Fetch> fetch(make_shared<Fetch>(
+      fetch_scts_, start_index, end_index, entries, task));
+  if (!hedge_peer || hedge_delay.count() <= 0) {
+    StartGetEntries(peer, fetch, entries);
+    return;
   }
+
+  StartGetEntries(peer, fetch, &fetch->primary_entries_);
+  task->executor()->Delay(hedge_delay,
+                          new Task(bind(MaybeStartHedge, hedge_peer, fetch, _1),
+                                   task->executor()));
 }
 
 
-shared_ptr<Peer> PeerGroup::PickPeer(const int64_t needed_size) const {
+shared_ptr<Peer> PeerGroup::PickPeer(const int64_t needed_size,
+                                     shared_ptr<Peer>* hedge_peer) const {
   lock_guard<mutex> lock(lock_);
 
-  // TODO(pphaneuf): We should pick peers a bit more cleverly, to
-  // spread the load somewhat.
   int64_t group_tree_size(-1);
-  vector<shared_ptr<Peer>> capable_peers;
+  // With the latency per entry of each, the peers not measured yet
+  // coming first, so that they get measured.
+  vector<pair<double, shared_ptr<Peer>>> capable_peers;
   for (const auto& peer : peers_) {
     const int64_t tree_size(peer.first->TreeSize());
     group_tree_size = max(group_tree_size, tree_size);
     if (tree_size >= needed_size) {
-      capable_peers.push_back(peer.first);
+      capable_peers.emplace_back(
+          peer.first->fetch_controller().seconds_per_entry(), peer.first);
     }
   }
 
-  if (!capable_peers.empty()) {
-    return capable_peers[std::rand() % capable_peers.size()];
+  if (capable_peers.empty()) {
+    LOG(INFO) << "requested a peer with " << needed_size
+              << " entries but the peer group only has " << group_tree_size
+              << " entries";
+    return nullptr;
+  }
+
+  // Stripe the fetches over the peers, the faster ones first, as far
+  // as each of them can take more, and across all of them, at random,
+  // past that.
+  std::sort(capable_peers.begin(), capable_peers.end(),
+            [](const pair<double, shared_ptr<Peer>>& a,
+               const pair<double, shared_ptr<Peer>>& b) {
+              return a.first < b.first;
+            });
+  shared_ptr<Peer> picked;
+  for (const auto& peer : capable_peers) {
+    if (peer.second->fetch_controller().TryStart()) {
+      picked = peer.second;
+      break;
+    }
+  }
+  if (!picked) {
+    picked = capable_peers[std::rand() % capable_peers.size()].second;
+    picked->fetch_controller().Start();
   }
 
-  LOG(INFO) << "requested a peer with " << needed_size
-            << " entries but the peer group only has " << group_tree_size
-            << " entries";
+  // Slow fetches are sent again to the fastest other peer.
+  for (const auto& peer : capable_peers) {
+    if (peer.second != picked) {
+      *hedge_peer = peer.second;
+      break;
+    }
+  }
 
-  return nullptr;
+  return picked;
 }
 
 
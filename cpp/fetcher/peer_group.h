@@ -30,6 +30,15 @@ class PeerGroup {
   // Returns the highest tree size of the peer group.
   int64_t TreeSize() const;
 
+  // How many fetches to have in flight, and how many entries to ask
+  // for in each, altogether, as per the FetchController of each peer.
+  int ConcurrentFetches() const;
+  int64_t BatchSize() const;
+
+  // Fetches at most the BatchSize() of the peer it picks, which may
+  // be less than asked for. The faster peers are picked first, and a
+  // fetch that is slow to answer is also sent to another peer, as per
+  // --fetcher_hedge_latency_factor.
   void FetchEntries(int64_t start_offset, int64_t end_offset,
                     std::vector<AsyncLogClient::Entry>* entries,
                     util::Task* task);
@@ -40,7 +49,11 @@ class PeerGroup {
     // unhealthy peers.
   };
 
-  std::shared_ptr<Peer> PickPeer(const int64_t needed_size) const;
+  // Counts the fetch with the FetchController of the peer returned,
+  // and sets |*hedge_peer| to the one to send it to as well if it is
+  // slow, if there is one.
+  std::shared_ptr<Peer> PickPeer(const int64_t needed_size,
+                                 std::shared_ptr<Peer>* hedge_peer) const;
 
   mutable std::mutex lock_;
   const bool fetch_scts_;
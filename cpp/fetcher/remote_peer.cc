@@ -28,6 +28,11 @@ namespace cert_trans {
 DEFINE_int32(remote_peer_sth_refresh_interval_seconds, 10,
              "Number of seconds between checks for updated STHs from the "
              "remote peer.");
+DEFINE_int32(remote_peer_max_requests, 17,
+             "Maximum number of requests in flight to the remote peer, or 0 "
+             "for no limit. Fetching entries gets one less, so that the STH "
+             "checks never wait behind it; keep this above "
+             "--fetcher_max_concurrent_fetches.");
 
 Counter<string>* invalid_sths_received =
     Counter<string>::New("remote_peer_invalid_sths_received", "reason",
@@ -108,6 +113,7 @@ void RemotePeer::Impl::DoneGetSTH(
                    << result;
     }
 
+    bool accepted(false);
     if (sth_provisionally_valid) {
       lock_guard<mutex> lock(lock_);
 
@@ -119,11 +125,15 @@ void RemotePeer::Impl::DoneGetSTH(
       } else if (!sth_ || new_sth->timestamp() > sth_->timestamp()) {
         // This STH is good, we'll take it.
         sth_ = new_sth;
-        if (on_new_sth_) {
-          on_new_sth_(*sth_);
-        }
+        accepted = true;
       }
     }
+
+    // Outside of the lock, as the callback might well want to know
+    // our TreeSize().
+    if (accepted && on_new_sth_) {
+      on_new_sth_(*new_sth);
+    }
   } else {
     LOG(WARNING) << "Problem fetching STH, got error " << status
                  << " from AsyncLogClient";
@@ -145,6 +155,8 @@ RemotePeer::RemotePeer(
   TaskHold hold(task);
   task->DeleteWhenDone(impl_);
 
+  client_->SetMaxRequests(FLAGS_remote_peer_max_requests);
+
   impl_->FetchSTH();
 }
 
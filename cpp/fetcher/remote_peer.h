@@ -15,7 +15,8 @@ class RemotePeer : public Peer {
   // The "task" will return when the object is fully destroyed
   // (destroying this object starts the asynchronous destruction).
   // |on_new_sth| will be called for each new STH that this object sees from
-  // the target log.
+  // the target log, once TreeSize() returns its size, so that fetching
+  // can start right away.
   RemotePeer(std::unique_ptr<AsyncLogClient>&& client,
              std::unique_ptr<LogVerifier>&& verifier,
              const std::function<void(const ct::SignedTreeHead&)>& on_new_sth,
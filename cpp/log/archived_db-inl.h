@@ -0,0 +1,368 @@
+#ifndef CERT_TRANS_LOG_ARCHIVED_DB_INL_H_
+#define CERT_TRANS_LOG_ARCHIVED_DB_INL_H_
+
+#include "log/archived_db.h"
+
+#include <algorithm>
+#include <dirent.h>
+#include <errno.h>
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "log/entry_archive.h"
+#include "log/prefetching_iterator.h"
+
+DEFINE_int32(archive_entries_per_block, 64,
+             "number of entries compressed together in archives; looking up "
+             "an archived entry decompresses its whole block");
+DEFINE_int32(archive_dictionary_samples, 16,
+             "number of entries of each range sampled to build the "
+             "compression dictionary of its archive");
+
+namespace {
+
+const char kArchivePrefix[] = "archive-";
+const size_t kArchiveIndexDigits = 16;
+
+}  // namespace
+
+
+template <class Logged>
+class ArchivedDB<Logged>::Iterator : public Database<Logged>::Iterator {
+ public:
+  // If |bulk|, the archives and the database are read as for
+  // ScanEntriesBulk().
+  Iterator(const ArchivedDB<Logged>* db, int64_t start_index, bool bulk)
+      : db_(CHECK_NOTNULL(db)),
+        bulk_(bulk),
+        next_index_(start_index),
+        pos_(0) {
+    CHECK_GE(next_index_, 0);
+  }
+
+  bool GetNextEntry(Logged* entry) override {
+    CHECK_NOTNULL(entry);
+    if (!it_ && pos_ == block_.size()) {
+      block_.clear();
+      pos_ = 0;
+      const std::shared_ptr<const cert_trans::EntryArchive> archive(
+          db_->FindArchive(next_index_));
+      if (archive && bulk_) {
+        archive->ReadBlockBulk(next_index_, &block_);
+      } else if (archive) {
+        archive->ReadBlock(next_index_, &block_);
+      } else {
+        // Past the archives, and the entries stay in the database
+        // when they are archived, so the rest can be read from there.
+        it_ = bulk_ ? db_->db_->ScanEntriesBulk(next_index_)
+                    : db_->db_->ScanEntries(next_index_);
+      }
+    }
+
+    if (it_) {
+      return it_->GetNextEntry(entry);
+    }
+
+    CHECK(entry->ParseFromDatabase(block_[pos_++]));
+    entry->set_sequence_number(next_index_++);
+    return true;
+  }
+
+ private:
+  const ArchivedDB<Logged>* const db_;
+  const bool bulk_;
+  int64_t next_index_;
+  // The entries from |next_index_| on, from an archive.
+  std::vector<std::string> block_;
+  size_t pos_;
+  // Once past the archives.
+  std::unique_ptr<typename Database<Logged>::Iterator> it_;
+};
+
+
+template <class Logged>
+ArchivedDB<Logged>::ArchivedDB(Database<Logged>* db, const std::string& dir,
+                               int64_t range_size)
+    : db_(CHECK_NOTNULL(db)), dir_(dir), range_size_(range_size) {
+  CHECK_GT(range_size_, 0);
+  if (mkdir(dir_.c_str(), 0700) != 0) {
+    CHECK_EQ(errno, EEXIST) << dir_ << ": " << strerror(errno);
+  }
+
+  DIR* const d(opendir(dir_.c_str()));
+  CHECK_NOTNULL(d);
+  std::vector<std::string> names;
+  while (struct dirent* const entry = readdir(d)) {
+    const std::string name(entry->d_name);
+    if (name.compare(0, strlen(kArchivePrefix), kArchivePrefix) != 0) {
+      continue;
+    }
+    if (name.size() != strlen(kArchivePrefix) + kArchiveIndexDigits) {
+      // Left over by a crash while sealing.
+      LOG(WARNING) << "Removing incomplete archive " << dir_ << "/" << name;
+      CHECK_EQ(unlink((dir_ + "/" + name).c_str()), 0) << strerror(errno);
+      continue;
+    }
+    names.push_back(name);
+  }
+  CHECK_EQ(closedir(d), 0);
+
+  // The indices are zero-padded, so these sort in order.
+  std::sort(names.begin(), names.end());
+  for (const auto& name : names) {
+    archives_.emplace_back(new cert_trans::EntryArchive(dir_ + "/" + name));
+    CHECK_EQ(archives_.back()->first_index(),
+             archives_.size() > 1 ? archives_[archives_.size() - 2]->end_index()
+                                  : 0)
+        << "archives in " << dir_ << " are not contiguous at " << name;
+  }
+
+  LOG(INFO) << "Opened " << archives_.size() << " archives in " << dir_
+            << ", with " << ArchivedSize() << " entries";
+}
+
+
+template <class Logged>
+ArchivedDB<Logged>::~ArchivedDB() {
+}
+
+
+template <class Logged>
+int ArchivedDB<Logged>::SealRanges(int64_t keep_entries) {
+  CHECK_GE(keep_entries, 0);
+  std::lock_guard<std::mutex> seal_lock(seal_lock_);
+  int sealed(0);
+  for (int64_t first(ArchivedSize());
+       first + range_size_ + keep_entries <= db_->TreeSize();
+       first = ArchivedSize()) {
+    SealRange(first);
+    ++sealed;
+  }
+  return sealed;
+}
+
+
+template <class Logged>
+int64_t ArchivedDB<Logged>::ArchivedSize() const {
+  std::lock_guard<std::mutex> lock(lock_);
+  return archives_.empty() ? 0 : archives_.back()->end_index();
+}
+
+
+template <class Logged>
+typename Database<Logged>::WriteResult
+ArchivedDB<Logged>::CreateSequencedEntry_(const Logged& logged) {
+  return db_->CreateSequencedEntry(logged);
+}
+
+
+template <class Logged>
+typename Database<Logged>::WriteResult
+ArchivedDB<Logged>::CreateSequencedEntries_(const std::vector<Logged>& logged,
+                                            size_t* written) {
+  return db_->CreateSequencedEntries(logged, written);
+}
+
+
+template <class Logged>
+typename Database<Logged>::LookupResult ArchivedDB<Logged>::LookupByHash(
+    const std::string& hash, Logged* result) const {
+  return db_->LookupByHash(hash, result);
+}
+
+
+template <class Logged>
+typename Database<Logged>::LookupResult ArchivedDB<Logged>::LookupByIndex(
+    int64_t sequence_number, Logged* result) const {
+  CHECK_GE(sequence_number, 0);
+  const std::shared_ptr<const cert_trans::EntryArchive> archive(
+      FindArchive(sequence_number));
+  if (!archive) {
+    return db_->LookupByIndex(sequence_number, result);
+  }
+
+  if (result) {
+    std::string data;
+    archive->Lookup(sequence_number, &data);
+    CHECK(result->ParseFromDatabase(data));
+    result->set_sequence_number(sequence_number);
+  }
+  return this->LOOKUP_OK;
+}
+
+
+template <class Logged>
+std::unique_ptr<typename Database<Logged>::Iterator>
+ArchivedDB<Logged>::ScanEntries(int64_t start_index) const {
+  return std::unique_ptr<Iterator>(new Iterator(this, start_index, false));
+}
+
+
+template <class Logged>
+std::unique_ptr<typename Database<Logged>::Iterator>
+ArchivedDB<Logged>::ScanEntriesBulk(int64_t start_index) const {
+  return std::unique_ptr<Iterator>(new Iterator(this, start_index, true));
+}
+
+
+template <class Logged>
+typename Database<Logged>::WriteResult ArchivedDB<Logged>::WriteTreeHead_(
+    const ct::SignedTreeHead& sth) {
+  return db_->WriteTreeHead(sth);
+}
+
+
+template <class Logged>
+typename Database<Logged>::LookupResult ArchivedDB<Logged>::LatestTreeHead(
+    ct::SignedTreeHead* result) const {
+  return db_->LatestTreeHead(result);
+}
+
+
+template <class Logged>
+typename Database<Logged>::LookupResult
+ArchivedDB<Logged>::LookupTreeHeadByTimestamp(
+    uint64_t timestamp, ct::SignedTreeHead* result) const {
+  return db_->LookupTreeHeadByTimestamp(timestamp, result);
+}
+
+
+template <class Logged>
+void ArchivedDB<Logged>::ScanTreeHeadsBySize(
+    int64_t start_size, int64_t end_size,
+    std::vector<ct::SignedTreeHead>* result) const {
+  db_->ScanTreeHeadsBySize(start_size, end_size, result);
+}
+
+
+template <class Logged>
+int64_t ArchivedDB<Logged>::TreeSize() const {
+  return db_->TreeSize();
+}
+
+
+template <class Logged>
+void ArchivedDB<Logged>::AddNotifySTHCallback(
+    const typename Database<Logged>::NotifySTHCallback* callback) {
+  db_->AddNotifySTHCallback(callback);
+}
+
+
+template <class Logged>
+void ArchivedDB<Logged>::RemoveNotifySTHCallback(
+    const typename Database<Logged>::NotifySTHCallback* callback) {
+  db_->RemoveNotifySTHCallback(callback);
+}
+
+
+template <class Logged>
+void ArchivedDB<Logged>::InitializeNode(const std::string& node_id) {
+  db_->InitializeNode(node_id);
+}
+
+
+template <class Logged>
+typename Database<Logged>::LookupResult ArchivedDB<Logged>::NodeId(
+    std::string* node_id) {
+  return db_->NodeId(node_id);
+}
+
+
+template <class Logged>
+typename Database<Logged>::LookupResult ArchivedDB<Logged>::SearchEntries(
+    const std::string& search_key, int64_t start_index, size_t max_results,
+    std::vector<int64_t>* result) const {
+  return db_->SearchEntries(search_key, start_index, max_results, result);
+}
+
+
+template <class Logged>
+void ArchivedDB<Logged>::BeginBulkLoad() {
+  db_->BeginBulkLoad();
+}
+
+
+template <class Logged>
+void ArchivedDB<Logged>::EndBulkLoad() {
+  db_->EndBulkLoad();
+}
+
+
+template <class Logged>
+std::string ArchivedDB<Logged>::ArchivePath(int64_t first_index) const {
+  const std::string number(std::to_string(first_index));
+  return dir_ + "/" + kArchivePrefix +
+         std::string(kArchiveIndexDigits -
+                         std::min(kArchiveIndexDigits, number.size()),
+                     '0') +
+         number;
+}
+
+
+template <class Logged>
+std::shared_ptr<const cert_trans::EntryArchive>
+ArchivedDB<Logged>::FindArchive(int64_t index) const {
+  std::lock_guard<std::mutex> lock(lock_);
+  if (archives_.empty() || index >= archives_.back()->end_index()) {
+    return nullptr;
+  }
+  const auto it(std::upper_bound(
+      archives_.begin(), archives_.end(), index,
+      [](int64_t index,
+         const std::shared_ptr<const cert_trans::EntryArchive>& archive) {
+        return index < archive->first_index();
+      }));
+  CHECK(it != archives_.begin());
+  return *(it - 1);
+}
+
+
+// This must be called with "seal_lock_" held.
+template <class Logged>
+void ArchivedDB<Logged>::SealRange(int64_t first_index) {
+  CHECK_GT(FLAGS_archive_entries_per_block, 0);
+  CHECK_GE(FLAGS_archive_dictionary_samples, 0);
+  const int64_t end_index(first_index + range_size_);
+  LOG(INFO) << "Archiving entries " << first_index << " to " << end_index - 1;
+
+  // The dictionary has to be ready before the first block is
+  // compressed, so the range is sampled before it is read through.
+  std::vector<std::string> samples;
+  for (int i = 0; i < FLAGS_archive_dictionary_samples; ++i) {
+    Logged logged;
+    CHECK_EQ(db_->LookupByIndex(first_index +
+                                    i * range_size_ /
+                                        FLAGS_archive_dictionary_samples,
+                                &logged),
+             this->LOOKUP_OK);
+    samples.emplace_back();
+    CHECK(logged.SerializeForDatabase(&samples.back()));
+  }
+
+  const std::string path(ArchivePath(first_index));
+  cert_trans::EntryArchiveWriter writer(
+      path, first_index, FLAGS_archive_entries_per_block,
+      cert_trans::EntryArchive::BuildDictionary(samples));
+  const std::unique_ptr<typename Database<Logged>::Iterator> it(
+      ScanEntriesPrefetching<Logged>(db_.get(), first_index, range_size_));
+  for (int64_t i = first_index; i < end_index; ++i) {
+    Logged logged;
+    CHECK(it->GetNextEntry(&logged)) << "missing entry " << i;
+    CHECK_EQ(logged.sequence_number(), i);
+    std::string data;
+    CHECK(logged.SerializeForDatabase(&data));
+    writer.Add(data);
+  }
+  writer.Finish();
+
+  std::shared_ptr<const cert_trans::EntryArchive> archive(
+      new cert_trans::EntryArchive(path));
+  std::lock_guard<std::mutex> lock(lock_);
+  archives_.push_back(archive);
+}
+
+
+#endif  // CERT_TRANS_LOG_ARCHIVED_DB_INL_H_
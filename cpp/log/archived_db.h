@@ -0,0 +1,130 @@
+#ifndef CERT_TRANS_LOG_ARCHIVED_DB_H_
+#define CERT_TRANS_LOG_ARCHIVED_DB_H_
+
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "base/macros.h"
+#include "log/database.h"
+#include "proto/ct.pb.h"
+
+namespace cert_trans {
+class EntryArchive;
+}  // namespace cert_trans
+
+
+// A database that seals the older entries of another database into
+// compressed, immutable cert_trans::EntryArchive files, one per range
+// of entries, and serves the lookups by index and the scans of those
+// entries from the archives. Everything else, including lookups by
+// hash, goes to the wrapped database.
+//
+// The archives are kept in a directory, as:
+//
+// <dir>/archive-NNNNNNNNNNNNNNNN - The entries from index N on.
+//
+// Ranges are only sealed once all their entries are in the tree, and
+// archives are never changed once written, so they can be read
+// without holding a lock.
+//
+// The entries stay in the wrapped database as well, as the Database
+// interface has no way to remove them; they are no longer read from
+// there, so they stay out of its caches.
+template <class Logged>
+class ArchivedDB : public Database<Logged> {
+ public:
+  // Takes ownership of |db|. The ranges are of |range_size| entries.
+  ArchivedDB(Database<Logged>* db, const std::string& dir,
+             int64_t range_size);
+  ~ArchivedDB();
+
+  // Seals every range of entries that ends at least |keep_entries|
+  // before the tree size into an archive, and returns how many were
+  // sealed. This can take a while, but is safe to call concurrently
+  // with anything else.
+  int SealRanges(int64_t keep_entries);
+
+  // The number of entries in archives, from index 0.
+  int64_t ArchivedSize() const;
+
+  // Implement abstract functions, see database.h for comments.
+  typename Database<Logged>::WriteResult CreateSequencedEntry_(
+      const Logged& logged) override;
+
+  typename Database<Logged>::WriteResult CreateSequencedEntries_(
+      const std::vector<Logged>& logged, size_t* written) override;
+
+  typename Database<Logged>::LookupResult LookupByHash(
+      const std::string& hash, Logged* result) const override;
+
+  typename Database<Logged>::LookupResult LookupByIndex(
+      int64_t sequence_number, Logged* result) const override;
+
+  std::unique_ptr<typename Database<Logged>::Iterator> ScanEntries(
+      int64_t start_index) const override;
+
+  std::unique_ptr<typename Database<Logged>::Iterator> ScanEntriesBulk(
+      int64_t start_index) const override;
+
+  typename Database<Logged>::WriteResult WriteTreeHead_(
+      const ct::SignedTreeHead& sth) override;
+
+  typename Database<Logged>::LookupResult LatestTreeHead(
+      ct::SignedTreeHead* result) const override;
+
+  typename Database<Logged>::LookupResult LookupTreeHeadByTimestamp(
+      uint64_t timestamp, ct::SignedTreeHead* result) const override;
+
+  void ScanTreeHeadsBySize(
+      int64_t start_size, int64_t end_size,
+      std::vector<ct::SignedTreeHead>* result) const override;
+
+  int64_t TreeSize() const override;
+
+  void AddNotifySTHCallback(
+      const typename Database<Logged>::NotifySTHCallback* callback) override;
+
+  void RemoveNotifySTHCallback(
+      const typename Database<Logged>::NotifySTHCallback* callback) override;
+
+  void InitializeNode(const std::string& node_id) override;
+
+  typename Database<Logged>::LookupResult NodeId(
+      std::string* node_id) override;
+
+  typename Database<Logged>::LookupResult SearchEntries(
+      const std::string& search_key, int64_t start_index, size_t max_results,
+      std::vector<int64_t>* result) const override;
+
+  void BeginBulkLoad() override;
+  void EndBulkLoad() override;
+
+ private:
+  class Iterator;
+
+  std::string ArchivePath(int64_t first_index) const;
+  // Returns the archive with the entry at |index|, or nullptr if it
+  // has not been archived.
+  std::shared_ptr<const cert_trans::EntryArchive> FindArchive(
+      int64_t index) const;
+  void SealRange(int64_t first_index);
+
+  const std::unique_ptr<Database<Logged>> db_;
+  const std::string dir_;
+  const int64_t range_size_;
+
+  // Held while sealing, so that only one range is sealed at a time.
+  std::mutex seal_lock_;
+
+  mutable std::mutex lock_;
+  // In order, contiguous from index 0.
+  std::vector<std::shared_ptr<const cert_trans::EntryArchive>> archives_;
+
+  DISALLOW_COPY_AND_ASSIGN(ArchivedDB);
+};
+
+
+#endif  // CERT_TRANS_LOG_ARCHIVED_DB_H_
@@ -0,0 +1,4 @@
+#include "log/archived_db-inl.h"
+#include "log/logged_certificate.h"
+
+template class ArchivedDB<cert_trans::LoggedCertificate>;
@@ -0,0 +1,145 @@
+#include "log/archived_db.h"
+
+#include <gtest/gtest.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "log/logged_certificate.h"
+#include "log/sqlite_db.h"
+#include "log/test_signer.h"
+#include "util/test_db.h"
+#include "util/testing.h"
+
+namespace {
+
+using cert_trans::LoggedCertificate;
+using std::string;
+using std::unique_ptr;
+using std::vector;
+
+typedef Database<LoggedCertificate> DB;
+
+const int64_t kRangeSize = 10;
+
+
+class ArchivedDBTest : public ::testing::Test {
+ protected:
+  ArchivedDBTest() : db_(OpenDB()) {
+  }
+
+  ArchivedDB<LoggedCertificate>* OpenDB() {
+    return new ArchivedDB<LoggedCertificate>(
+        new SQLiteDB<LoggedCertificate>(tmp_.TmpStorageDir() + "/sqlite"),
+        tmp_.TmpStorageDir() + "/archives", kRangeSize);
+  }
+
+  void AddEntries(int count) {
+    for (int i = 0; i < count; ++i) {
+      logged_.emplace_back();
+      test_signer_.CreateUnique(&logged_.back());
+      logged_.back().set_sequence_number(logged_.size() - 1);
+      ASSERT_EQ(DB::OK, db_->CreateSequencedEntry(logged_.back()));
+    }
+  }
+
+  void ExpectAllEntries(const DB* db) {
+    for (const auto& logged : logged_) {
+      LoggedCertificate lookup;
+      EXPECT_EQ(DB::LOOKUP_OK,
+                db->LookupByIndex(logged.sequence_number(), &lookup));
+      TestSigner::TestEqualLoggedCerts(logged, lookup);
+      EXPECT_EQ(DB::LOOKUP_OK, db->LookupByHash(logged.Hash(), &lookup));
+      TestSigner::TestEqualLoggedCerts(logged, lookup);
+    }
+  }
+
+  TmpStorage tmp_;
+  TestSigner test_signer_;
+  unique_ptr<ArchivedDB<LoggedCertificate>> db_;
+  vector<LoggedCertificate> logged_;
+};
+
+
+TEST_F(ArchivedDBTest, SealsCompleteRanges) {
+  AddEntries(25);
+  EXPECT_EQ(0, db_->ArchivedSize());
+
+  // The last 3 entries are kept out, so only the first two ranges
+  // can be sealed.
+  EXPECT_EQ(2, db_->SealRanges(3));
+  EXPECT_EQ(2 * kRangeSize, db_->ArchivedSize());
+  EXPECT_EQ(0, db_->SealRanges(3));
+  EXPECT_EQ(25, db_->TreeSize());
+
+  ExpectAllEntries(db_.get());
+  LoggedCertificate lookup;
+  EXPECT_EQ(DB::NOT_FOUND, db_->LookupByIndex(25, &lookup));
+}
+
+
+TEST_F(ArchivedDBTest, ScansAcrossArchives) {
+  AddEntries(25);
+  EXPECT_EQ(2, db_->SealRanges(0));
+
+  // From the middle of the first archive, on to the database.
+  const unique_ptr<DB::Iterator> it(db_->ScanEntries(5));
+  for (size_t i = 5; i < logged_.size(); ++i) {
+    LoggedCertificate entry;
+    ASSERT_TRUE(it->GetNextEntry(&entry));
+    TestSigner::TestEqualLoggedCerts(logged_[i], entry);
+  }
+  LoggedCertificate entry;
+  EXPECT_FALSE(it->GetNextEntry(&entry));
+
+  // Entries added later are found too.
+  AddEntries(1);
+  ASSERT_TRUE(it->GetNextEntry(&entry));
+  TestSigner::TestEqualLoggedCerts(logged_.back(), entry);
+}
+
+
+TEST_F(ArchivedDBTest, BulkScansAcrossArchives) {
+  AddEntries(25);
+  EXPECT_EQ(2, db_->SealRanges(0));
+
+  const unique_ptr<DB::Iterator> it(db_->ScanEntriesBulk(5));
+  for (size_t i = 5; i < logged_.size(); ++i) {
+    LoggedCertificate entry;
+    ASSERT_TRUE(it->GetNextEntry(&entry));
+    TestSigner::TestEqualLoggedCerts(logged_[i], entry);
+  }
+  LoggedCertificate entry;
+  EXPECT_FALSE(it->GetNextEntry(&entry));
+}
+
+
+TEST_F(ArchivedDBTest, Resume) {
+  AddEntries(15);
+  EXPECT_EQ(1, db_->SealRanges(0));
+  // Commits the batched entries, so that SQLite still has them when
+  // reopened.
+  ct::SignedTreeHead sth;
+  test_signer_.CreateUnique(&sth);
+  EXPECT_EQ(DB::OK, db_->WriteTreeHead(sth));
+
+  db_.reset();
+  db_.reset(OpenDB());
+  EXPECT_EQ(kRangeSize, db_->ArchivedSize());
+  ExpectAllEntries(db_.get());
+
+  // Carries on sealing after the existing archives.
+  AddEntries(5);
+  EXPECT_EQ(1, db_->SealRanges(0));
+  EXPECT_EQ(2 * kRangeSize, db_->ArchivedSize());
+  ExpectAllEntries(db_.get());
+}
+
+
+}  // namespace
+
+
+int main(int argc, char** argv) {
+  cert_trans::test::InitTesting(argv[0], &argc, &argv, true);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,434 @@
+#include <algorithm>
+#include <chrono>
+#include <ftw.h>
+#include <functional>
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <sys/stat.h>
+#include <vector>
+
+#include "config.h"
+#include "log/database.h"
+#include "log/file_db.h"
+#include "log/file_storage.h"
+#include "log/leveldb_db.h"
+#include "log/logged_certificate.h"
+#ifdef HAVE_ROCKSDB
+#include "log/rocksdb_db.h"
+#endif
+#include "log/segment_storage.h"
+#include "log/sqlite_db.h"
+#include "proto/ct.pb.h"
+#include "util/init.h"
+
+DEFINE_string(dir, "",
+              "Directory in which to create the databases, which must exist; "
+              "each one is created in its own subdirectory, and removed "
+              "afterwards unless --keep_databases is set.");
+DEFINE_bool(keep_databases, false,
+            "Leave the databases in --dir after benchmarking them.");
+DEFINE_string(backends, "file,segment,sqlite,leveldb",
+              "comma-separated backends to benchmark, among file, segment, "
+              "sqlite, leveldb and rocksdb");
+DEFINE_string(sizes, "1000000",
+              "comma-separated numbers of entries to fill each database "
+              "with, e.g. 1000000,10000000,100000000; mind the disk space, as "
+              "entries are a few kB each");
+DEFINE_int32(leaf_size, 1500, "size of the leaf certificates, in bytes");
+DEFINE_int32(chain_length, 2,
+             "number of intermediate certificates in each chain, which all "
+             "the entries share, as in a real log");
+DEFINE_int32(chain_cert_size, 1200,
+             "size of the intermediate certificates, in bytes");
+DEFINE_int32(write_batch_size, 1000,
+             "number of entries per CreateSequencedEntries() call");
+DEFINE_bool(bulk_load, false,
+            "Wrap the ingestion in BeginBulkLoad() and EndBulkLoad().");
+DEFINE_int32(lookups, 100000,
+             "number of random lookups by index, and by hash, to time");
+DEFINE_int32(scan_batch_size, 1000,
+             "number of entries per GetNextEntries() call when scanning");
+DEFINE_int32(tree_heads, 1000, "number of WriteTreeHead() calls to time");
+DEFINE_int32(cert_storage_depth, 3,
+             "subdirectory depth of the certificates of the file backend");
+DEFINE_int32(tree_storage_depth, 8,
+             "subdirectory depth of the tree heads of the file backend");
+DEFINE_int32(cert_segment_size_mb, 64,
+             "size of the segment files of the segment backend, in MiB");
+
+namespace cert_trans {
+namespace {
+
+using std::chrono::duration;
+using std::chrono::steady_clock;
+using std::string;
+using std::unique_ptr;
+using std::vector;
+
+typedef Database<LoggedCertificate> DB;
+
+// The entries take their certificates from this much random data.
+const size_t kRandomPoolBytes = 1 << 20;
+
+
+vector<int64_t> ParseSizes(const string& sizes) {
+  vector<int64_t> result;
+  std::istringstream in(sizes);
+  string size;
+  while (std::getline(in, size, ',')) {
+    char* end;
+    const long long value(strtoll(size.c_str(), &end, 10));
+    CHECK(!size.empty() && *end == '\0' && value > 0)
+        << "invalid size: " << size;
+    result.push_back(value);
+  }
+  return result;
+}
+
+
+vector<string> ParseBackends(const string& backends) {
+  vector<string> result;
+  std::istringstream in(backends);
+  string backend;
+  while (std::getline(in, backend, ',')) {
+#ifdef HAVE_ROCKSDB
+    const bool have_rocksdb(true);
+#else
+    const bool have_rocksdb(false);
+#endif
+    CHECK(backend == "file" || backend == "segment" || backend == "sqlite" ||
+          backend == "leveldb" || (backend == "rocksdb" && have_rocksdb))
+        << "unknown or unsupported backend: " << backend;
+    result.push_back(backend);
+  }
+  return result;
+}
+
+
+void MakeDirectory(const string& path) {
+  PCHECK(mkdir(path.c_str(), 0700) == 0) << "could not create " << path;
+}
+
+
+// Opens the database of |backend| in |dir|, creating it if needed.
+DB* OpenDatabase(const string& backend, const string& dir) {
+  if (backend == "sqlite") {
+    return new SQLiteDB<LoggedCertificate>(dir + "/sqlite.db");
+  }
+  if (backend == "leveldb") {
+    return new LevelDB<LoggedCertificate>(dir + "/leveldb");
+  }
+#ifdef HAVE_ROCKSDB
+  if (backend == "rocksdb") {
+    return new RocksDB<LoggedCertificate>(dir + "/rocksdb");
+  }
+#endif
+  KeyValueStorage* cert_storage;
+  if (backend == "segment") {
+    cert_storage = new SegmentStorage(
+        dir + "/certs", static_cast<off_t>(FLAGS_cert_segment_size_mb) << 20);
+  } else {
+    CHECK_EQ("file", backend);
+    cert_storage = new FileStorage(dir + "/certs", FLAGS_cert_storage_depth);
+  }
+  return new FileDB<LoggedCertificate>(
+      cert_storage, new FileStorage(dir + "/tree", FLAGS_tree_storage_depth),
+      new FileStorage(dir + "/meta", 0));
+}
+
+
+void CreateDatabaseDirectory(const string& backend, const string& dir) {
+  MakeDirectory(dir);
+  if (backend == "file" || backend == "segment") {
+    if (backend == "file") {
+      MakeDirectory(dir + "/certs");
+    }
+    MakeDirectory(dir + "/tree");
+    MakeDirectory(dir + "/meta");
+  }
+}
+
+
+int64_t disk_usage_bytes;
+
+int AddDiskUsage(const char*, const struct stat* st, int, struct FTW*) {
+  disk_usage_bytes += static_cast<int64_t>(st->st_blocks) * 512;
+  return 0;
+}
+
+
+int RemoveFile(const char* path, const struct stat*, int, struct FTW*) {
+  PCHECK(remove(path) == 0) << "could not remove " << path;
+  return 0;
+}
+
+
+// The space taken on disk by the files under |dir|.
+int64_t DiskUsage(const string& dir) {
+  disk_usage_bytes = 0;
+  CHECK_EQ(0, nftw(dir.c_str(), AddDiskUsage, 64, FTW_PHYS));
+  return disk_usage_bytes;
+}
+
+
+void RemoveDirectory(const string& dir) {
+  CHECK_EQ(0, nftw(dir.c_str(), RemoveFile, 64, FTW_DEPTH | FTW_PHYS));
+}
+
+
+// Makes realistic entries out of a pool of random bytes, the same
+// ones for the same sequence number, so that the hashes to look up
+// can be computed again rather than kept.
+class EntryMaker {
+ public:
+  EntryMaker() : pool_(kRandomPoolBytes, '\0') {
+    std::mt19937 random;
+    for (char& c : pool_) {
+      c = std::uniform_int_distribution<int>(0, 255)(random);
+    }
+    CHECK_LT(static_cast<size_t>(FLAGS_leaf_size), pool_.size());
+    CHECK_LT(static_cast<size_t>(FLAGS_chain_cert_size), pool_.size());
+    for (int i = 0; i < FLAGS_chain_length; ++i) {
+      chain_.push_back(Slice(i + 1, FLAGS_chain_cert_size));
+    }
+  }
+
+  void Make(int64_t sequence_number, LoggedCertificate* logged) const {
+    *logged = LoggedCertificate();
+    logged->set_sequence_number(sequence_number);
+
+    ct::LogEntry* const entry(logged->mutable_entry());
+    entry->set_type(ct::X509_ENTRY);
+    // The sequence number in front keeps the leaves, and so their
+    // hashes, unique.
+    string leaf(std::to_string(sequence_number) + "/");
+    leaf.append(Slice(sequence_number, FLAGS_leaf_size - leaf.size()));
+    entry->mutable_x509_entry()->set_leaf_certificate(leaf);
+    for (const string& cert : chain_) {
+      entry->mutable_x509_entry()->add_certificate_chain(cert);
+    }
+
+    ct::SignedCertificateTimestamp* const sct(logged->mutable_sct());
+    sct->set_version(ct::V1);
+    sct->mutable_id()->set_key_id(Slice(0, 32));
+    sct->set_timestamp(1400000000000 + sequence_number);
+    sct->mutable_signature()->set_hash_algorithm(ct::DigitallySigned::SHA256);
+    sct->mutable_signature()->set_sig_algorithm(ct::DigitallySigned::ECDSA);
+    sct->mutable_signature()->set_signature(Slice(sequence_number + 7, 72));
+  }
+
+  string Hash(int64_t sequence_number) const {
+    LoggedCertificate logged;
+    Make(sequence_number, &logged);
+    return logged.Hash();
+  }
+
+ private:
+  // |size| bytes of the pool, from an offset that depends on |n|.
+  string Slice(int64_t n, size_t size) const {
+    const size_t offset((static_cast<uint64_t>(n) * 7919) %
+                        (pool_.size() - size));
+    return pool_.substr(offset, size);
+  }
+
+  string pool_;
+  vector<string> chain_;
+};
+
+
+void Report(const string& backend, int64_t size, const string& metric,
+            double value, const string& unit) {
+  std::cout << std::left << std::setw(10) << backend << std::right
+            << std::setw(12) << size << "  " << std::left << std::setw(24)
+            << metric << std::right << std::setw(14) << std::fixed
+            << std::setprecision(1) << value << " " << unit << std::endl;
+}
+
+
+double Seconds(steady_clock::duration elapsed) {
+  return duration<double>(elapsed).count();
+}
+
+
+void Ingest(DB* db, const EntryMaker& maker, const string& backend,
+            int64_t size) {
+  steady_clock::duration elapsed(steady_clock::duration::zero());
+  int64_t bytes(0);
+  vector<LoggedCertificate> batch;
+  string record;
+  steady_clock::time_point start(steady_clock::now());
+  if (FLAGS_bulk_load) {
+    db->BeginBulkLoad();
+  }
+  elapsed += steady_clock::now() - start;
+  for (int64_t next = 0; next < size;) {
+    // Only the writes are timed, not making the entries.
+    batch.resize(std::min<int64_t>(FLAGS_write_batch_size, size - next));
+    for (LoggedCertificate& logged : batch) {
+      maker.Make(next++, &logged);
+      CHECK(logged.SerializeForDatabase(&record));
+      bytes += record.size();
+    }
+    size_t written;
+    start = steady_clock::now();
+    CHECK_EQ(DB::OK, db->CreateSequencedEntries(batch, &written));
+    elapsed += steady_clock::now() - start;
+    CHECK_EQ(batch.size(), written);
+  }
+  start = steady_clock::now();
+  if (FLAGS_bulk_load) {
+    db->EndBulkLoad();
+  }
+  elapsed += steady_clock::now() - start;
+
+  const double seconds(Seconds(elapsed));
+  Report(backend, size, "ingest", size / seconds, "entries/s");
+  Report(backend, size, "ingest_bytes", bytes / seconds / (1 << 20),
+         "MiB/s");
+}
+
+
+void LookUp(const DB* db, const EntryMaker& maker, const string& backend,
+            int64_t size) {
+  std::mt19937 random;
+  vector<int64_t> indices(FLAGS_lookups);
+  for (int64_t& index : indices) {
+    index = std::uniform_int_distribution<int64_t>(0, size - 1)(random);
+  }
+  vector<string> hashes;
+  for (const int64_t index : indices) {
+    hashes.emplace_back(maker.Hash(index));
+  }
+
+  LoggedCertificate logged;
+  steady_clock::time_point start(steady_clock::now());
+  for (const int64_t index : indices) {
+    CHECK_EQ(DB::LOOKUP_OK, db->LookupByIndex(index, &logged));
+  }
+  Report(backend, size, "lookup_by_index",
+         indices.size() / Seconds(steady_clock::now() - start), "lookups/s");
+
+  start = steady_clock::now();
+  for (const string& hash : hashes) {
+    CHECK_EQ(DB::LOOKUP_OK, db->LookupByHash(hash, &logged));
+  }
+  Report(backend, size, "lookup_by_hash",
+         hashes.size() / Seconds(steady_clock::now() - start), "lookups/s");
+}
+
+
+void Scan(const DB* db, const string& backend, int64_t size) {
+  const steady_clock::time_point start(steady_clock::now());
+  const unique_ptr<DB::Iterator> it(db->ScanEntries(0));
+  vector<LoggedCertificate> entries;
+  int64_t count(0);
+  while (true) {
+    entries.clear();
+    const size_t read(it->GetNextEntries(FLAGS_scan_batch_size, &entries));
+    if (read == 0) {
+      break;
+    }
+    count += read;
+  }
+  const double seconds(Seconds(steady_clock::now() - start));
+  CHECK_EQ(size, count);
+  Report(backend, size, "scan", count / seconds, "entries/s");
+}
+
+
+void WriteTreeHeads(DB* db, const string& backend, int64_t size) {
+  ct::SignedTreeHead sth;
+  sth.set_version(ct::V1);
+  sth.mutable_id()->set_key_id(string(32, 'k'));
+  sth.set_tree_size(size);
+  sth.set_sha256_root_hash(string(32, 'r'));
+  sth.mutable_signature()->set_hash_algorithm(ct::DigitallySigned::SHA256);
+  sth.mutable_signature()->set_sig_algorithm(ct::DigitallySigned::ECDSA);
+  sth.mutable_signature()->set_signature(string(72, 's'));
+
+  vector<double> latencies;
+  for (int i = 0; i < FLAGS_tree_heads; ++i) {
+    // After the timestamps of all the entries.
+    sth.set_timestamp(1500000000000 + i);
+    const steady_clock::time_point start(steady_clock::now());
+    CHECK_EQ(DB::OK, db->WriteTreeHead(sth));
+    latencies.push_back(Seconds(steady_clock::now() - start) * 1e6);
+  }
+  std::sort(latencies.begin(), latencies.end());
+  Report(backend, size, "write_tree_head_p50",
+         latencies[latencies.size() / 2], "us");
+  Report(backend, size, "write_tree_head_p99",
+         latencies[latencies.size() * 99 / 100], "us");
+  Report(backend, size, "write_tree_head_max", latencies.back(), "us");
+}
+
+
+void RunBackend(const EntryMaker& maker, const string& backend,
+                int64_t size) {
+  const string dir(FLAGS_dir + "/" + backend + "-" + std::to_string(size));
+  CreateDatabaseDirectory(backend, dir);
+
+  {
+    const unique_ptr<DB> db(OpenDatabase(backend, dir));
+    Ingest(db.get(), maker, backend, size);
+  }
+
+  // Reopening measures how long a server takes to start with this
+  // much data, though the files are likely still in the page cache.
+  const steady_clock::time_point start(steady_clock::now());
+  const unique_ptr<DB> db(OpenDatabase(backend, dir));
+  CHECK_EQ(size, db->TreeSize());
+  Report(backend, size, "open",
+         Seconds(steady_clock::now() - start) * 1000, "ms");
+
+  LookUp(db.get(), maker, backend, size);
+  Scan(db.get(), backend, size);
+  if (FLAGS_tree_heads > 0) {
+    WriteTreeHeads(db.get(), backend, size);
+  }
+  Report(backend, size, "disk_usage",
+         static_cast<double>(DiskUsage(dir)) / (1 << 20), "MiB");
+
+  if (!FLAGS_keep_databases) {
+    RemoveDirectory(dir);
+  }
+}
+
+
+}  // namespace
+}  // namespace cert_trans
+
+
+int main(int argc, char* argv[]) {
+  util::InitCT(&argc, &argv);
+
+  CHECK(!FLAGS_dir.empty()) << "--dir is required";
+  CHECK_GT(FLAGS_leaf_size, 32);
+  CHECK_GE(FLAGS_chain_length, 0);
+  CHECK_GT(FLAGS_chain_cert_size, 0);
+  CHECK_GT(FLAGS_write_batch_size, 0);
+  CHECK_GT(FLAGS_lookups, 0);
+  CHECK_GT(FLAGS_scan_batch_size, 0);
+  CHECK_GE(FLAGS_tree_heads, 0);
+  const std::vector<std::string> backends(
+      cert_trans::ParseBackends(FLAGS_backends));
+  const std::vector<int64_t> sizes(cert_trans::ParseSizes(FLAGS_sizes));
+
+  const cert_trans::EntryMaker maker;
+  for (const int64_t size : sizes) {
+    for (const std::string& backend : backends) {
+      cert_trans::RunBackend(maker, backend, size);
+    }
+  }
+
+  return 0;
+}
@@ -0,0 +1,316 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <event2/thread.h>
+#include <functional>
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "log/etcd_consistent_store.h"
+#include "log/logged_certificate.h"
+#include "net/url_fetcher.h"
+#include "proto/ct.pb.h"
+#include "util/etcd.h"
+#include "util/fake_etcd.h"
+#include "util/libevent_wrapper.h"
+#include "util/masterelection.h"
+#include "util/status.h"
+#include "util/sync_task.h"
+#include "util/thread_pool.h"
+#include "util/util.h"
+
+namespace libevent = cert_trans::libevent;
+
+using cert_trans::EntryHandle;
+using cert_trans::EtcdClient;
+using cert_trans::EtcdConsistentStore;
+using cert_trans::FakeEtcdClient;
+using cert_trans::LoggedCertificate;
+using cert_trans::MasterElection;
+using cert_trans::ThreadPool;
+using cert_trans::UrlFetcher;
+using std::chrono::duration;
+using std::chrono::steady_clock;
+using std::lock_guard;
+using std::make_shared;
+using std::milli;
+using std::mutex;
+using std::shared_ptr;
+using std::string;
+using std::thread;
+using std::to_string;
+using std::unique_ptr;
+using std::vector;
+using util::Status;
+using util::StatusOr;
+using util::SyncTask;
+
+DEFINE_string(etcd_servers, "",
+              "comma-separated list of etcd servers (host:port) to run "
+              "against; an in-process FakeEtcdClient is used if empty");
+DEFINE_string(root, "/bench_etcd_consistent_store",
+              "etcd directory to put the stores in; each run uses a new "
+              "subdirectory of it, which is left behind");
+DEFINE_string(backlog_sizes, "100,1000,10000",
+              "comma-separated numbers of pending entries to sequence in "
+              "each round");
+DEFINE_string(entry_sizes, "100,2000",
+              "comma-separated sizes of the leaf certificates, in bytes");
+DEFINE_int32(rounds, 3, "number of rounds to run for each configuration");
+DEFINE_int32(num_threads, 16,
+             "number of threads adding pending entries concurrently");
+
+namespace {
+
+
+vector<int> ParseSizes(const string& sizes) {
+  vector<int> result;
+  std::istringstream in(sizes);
+  string size;
+  while (std::getline(in, size, ',')) {
+    char* end;
+    const long value(strtol(size.c_str(), &end, 10));
+    CHECK(!size.empty() && *end == '\0' && value > 0) << "invalid size: "
+                                                       << size;
+    result.push_back(value);
+  }
+  return result;
+}
+
+
+// The latencies of the calls to one method, in milliseconds.
+class Latencies {
+ public:
+  Latencies() : total_ms_(0) {
+  }
+
+  void Add(double ms) {
+    lock_guard<mutex> lock(lock_);
+    samples_.push_back(ms);
+  }
+
+  // Adds the time spent doing all the calls since the last one, which
+  // can overlap.
+  void AddElapsed(double ms) {
+    lock_guard<mutex> lock(lock_);
+    total_ms_ += ms;
+  }
+
+  void Report(const string& name, int backlog_size, int entry_size) {
+    lock_guard<mutex> lock(lock_);
+    CHECK(!samples_.empty());
+    std::sort(samples_.begin(), samples_.end());
+    std::cout << std::left << std::setw(24) << name << std::right
+              << std::setw(10) << backlog_size << std::setw(8) << entry_size
+              << std::setw(10) << samples_.size() << std::fixed
+              << std::setprecision(1) << std::setw(12)
+              << samples_.size() * 1000 / total_ms_ << std::setprecision(2)
+              << std::setw(10) << Percentile(50) << std::setw(10)
+              << Percentile(90) << std::setw(10) << Percentile(99)
+              << std::setw(10) << samples_.back() << std::endl;
+  }
+
+ private:
+  double Percentile(int percentile) const {
+    const size_t index(std::min(samples_.size() - 1,
+                                samples_.size() * percentile / 100));
+    return samples_[index];
+  }
+
+  mutex lock_;
+  vector<double> samples_;
+  double total_ms_;
+};
+
+
+double MillisecondsSince(const steady_clock::time_point& start) {
+  return duration<double, milli>(steady_clock::now() - start).count();
+}
+
+
+class Benchmark {
+ public:
+  Benchmark(const shared_ptr<libevent::Base>& base, ThreadPool* pool,
+            EtcdClient* client, int backlog_size, int entry_size)
+      : client_(client),
+        root_(FLAGS_root + "/" + to_string(util::TimeInMilliseconds()) +
+              "-" + to_string(backlog_size) + "-" + to_string(entry_size)),
+        backlog_size_(backlog_size),
+        entry_size_(entry_size),
+        election_(base, client_, root_ + "/election", "bench"),
+        store_(base.get(), pool, client_, &election_, root_, "bench"),
+        tree_size_(0) {
+    election_.StartElection();
+    CHECK(election_.WaitToBecomeMaster());
+
+    EtcdClient::Response resp;
+    SyncTask task(base.get());
+    client_->Create(root_ + "/sequence_mapping", "", &resp, task.task());
+    task.Wait();
+    CHECK_EQ(Status::OK, task.status());
+  }
+
+  ~Benchmark() {
+    election_.StopElection();
+  }
+
+  void RunRound(int round) {
+    AddPendingEntries(round);
+
+    vector<EntryHandle<LoggedCertificate>> pending;
+    Time(&get_pending_entries_, [this, &pending]() {
+      CHECK_EQ(Status::OK, store_.GetPendingEntries(&pending));
+    });
+    CHECK_EQ(static_cast<size_t>(backlog_size_), pending.size());
+
+    Time(&update_sequence_mapping_, [this, &pending]() {
+      EntryHandle<ct::SequenceMapping> mapping;
+      CHECK_EQ(Status::OK, store_.GetSequenceMapping(&mapping));
+      // The entries cleaned up in the previous round are dropped, as
+      // the tree signer does.
+      mapping.MutableEntry()->clear_mapping();
+      for (const auto& entry : pending) {
+        ct::SequenceMapping::Mapping* const m(
+            mapping.MutableEntry()->add_mapping());
+        m->set_entry_hash(entry.Entry().Hash());
+        m->set_sequence_number(tree_size_++);
+      }
+      CHECK_EQ(Status::OK, store_.UpdateSequenceMapping(&mapping));
+    });
+
+    ct::SignedTreeHead sth;
+    sth.set_timestamp(util::TimeInMilliseconds());
+    sth.set_tree_size(tree_size_);
+    Time(&set_serving_sth_, [this, &sth]() {
+      CHECK_EQ(Status::OK, store_.SetServingSTH(sth));
+    });
+
+    Time(&cleanup_old_entries_, [this]() {
+      const StatusOr<int64_t> cleaned(store_.CleanupOldEntries());
+      CHECK_EQ(Status::OK, cleaned.status());
+      CHECK_EQ(backlog_size_, cleaned.ValueOrDie());
+    });
+  }
+
+  void Report() {
+    add_pending_entry_.Report("add_pending_entry", backlog_size_,
+                              entry_size_);
+    get_pending_entries_.Report("get_pending_entries", backlog_size_,
+                                entry_size_);
+    update_sequence_mapping_.Report("update_sequence_mapping", backlog_size_,
+                                    entry_size_);
+    set_serving_sth_.Report("set_serving_sth", backlog_size_, entry_size_);
+    cleanup_old_entries_.Report("cleanup_old_entries", backlog_size_,
+                                entry_size_);
+  }
+
+ private:
+  void Time(Latencies* latencies, const std::function<void()>& op) {
+    const steady_clock::time_point start(steady_clock::now());
+    op();
+    const double ms(MillisecondsSince(start));
+    latencies->Add(ms);
+    latencies->AddElapsed(ms);
+  }
+
+  void AddPendingEntries(int round) {
+    std::atomic<int> next(0);
+    const steady_clock::time_point start(steady_clock::now());
+    vector<thread> threads;
+    for (int i = 0; i < FLAGS_num_threads; ++i) {
+      threads.emplace_back([this, round, &next]() {
+        for (int n = next++; n < backlog_size_; n = next++) {
+          LoggedCertificate cert(MakeCert(round, n));
+          const steady_clock::time_point add_start(steady_clock::now());
+          const Status status(store_.AddPendingEntry(&cert));
+          add_pending_entry_.Add(MillisecondsSince(add_start));
+          CHECK_EQ(Status::OK, status);
+        }
+      });
+    }
+    for (auto& t : threads) {
+      t.join();
+    }
+    add_pending_entry_.AddElapsed(MillisecondsSince(start));
+  }
+
+  LoggedCertificate MakeCert(int round, int n) const {
+    string leaf(to_string(round) + "/" + to_string(n) + "/");
+    leaf.resize(std::max<size_t>(leaf.size(), entry_size_), 'x');
+
+    LoggedCertificate cert;
+    cert.mutable_sct()->set_timestamp(util::TimeInMilliseconds());
+    cert.mutable_entry()->set_type(ct::X509_ENTRY);
+    cert.mutable_entry()->mutable_x509_entry()->set_leaf_certificate(leaf);
+    return cert;
+  }
+
+  EtcdClient* const client_;
+  const string root_;
+  const int backlog_size_;
+  const int entry_size_;
+  MasterElection election_;
+  EtcdConsistentStore<LoggedCertificate> store_;
+  int64_t tree_size_;
+
+  Latencies add_pending_entry_;
+  Latencies get_pending_entries_;
+  Latencies update_sequence_mapping_;
+  Latencies set_serving_sth_;
+  Latencies cleanup_old_entries_;
+};
+
+
+}  // namespace
+
+
+int main(int argc, char* argv[]) {
+  google::ParseCommandLineFlags(&argc, &argv, true);
+  google::InitGoogleLogging(argv[0]);
+  evthread_use_pthreads();
+
+  CHECK_GT(FLAGS_rounds, 0);
+  CHECK_GT(FLAGS_num_threads, 0);
+  const vector<int> backlog_sizes(ParseSizes(FLAGS_backlog_sizes));
+  const vector<int> entry_sizes(ParseSizes(FLAGS_entry_sizes));
+
+  const shared_ptr<libevent::Base> event_base(make_shared<libevent::Base>());
+  libevent::EventPumpThread pump(event_base);
+  ThreadPool pool;
+  UrlFetcher fetcher(event_base.get(), &pool);
+  const unique_ptr<EtcdClient> etcd(
+      FLAGS_etcd_servers.empty()
+          ? new FakeEtcdClient(event_base.get())
+          : new EtcdClient(&pool, &fetcher,
+                           cert_trans::SplitHosts(FLAGS_etcd_servers)));
+
+  std::cout << std::left << std::setw(24) << "benchmark" << std::right
+            << std::setw(10) << "backlog" << std::setw(8) << "size"
+            << std::setw(10) << "ops" << std::setw(12) << "ops/s"
+            << std::setw(10) << "p50 ms" << std::setw(10) << "p90 ms"
+            << std::setw(10) << "p99 ms" << std::setw(10) << "max ms"
+            << std::endl;
+
+  for (const int backlog_size : backlog_sizes) {
+    for (const int entry_size : entry_sizes) {
+      Benchmark benchmark(event_base, &pool, etcd.get(), backlog_size,
+                          entry_size);
+      for (int round = 0; round < FLAGS_rounds; ++round) {
+        benchmark.RunRound(round);
+      }
+      benchmark.Report();
+    }
+  }
+
+  return 0;
+}
@@ -0,0 +1,190 @@
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <iomanip>
+#include <iostream>
+#include <openssl/bn.h>
+#include <openssl/ec.h>
+#include <openssl/evp.h>
+#include <openssl/obj_mac.h>
+#include <openssl/rsa.h>
+#include <stdint.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "log/log_signer.h"
+#include "proto/ct.pb.h"
+#include "util/util.h"
+
+using ct::LogEntry;
+using ct::SignedCertificateTimestamp;
+using std::function;
+using std::string;
+using std::thread;
+using std::vector;
+
+DEFINE_int32(min_time_ms, 1000,
+             "minimum time to spend running each benchmark, in milliseconds");
+DEFINE_int32(num_threads, 0,
+             "number of threads to sign on concurrently, in addition to a "
+             "single thread; the number of cores if 0");
+DEFINE_int32(batch_size, 64,
+             "number of SCTs signed in each call to the batch API");
+DEFINE_int32(rsa_bits, 2048, "size of the RSA key to benchmark, in bits");
+DEFINE_int32(leaf_size, 1500,
+             "size of the leaf certificates to sign SCTs for, in bytes");
+
+namespace {
+
+
+EVP_PKEY* NewECKey() {
+  EC_KEY* const ec(
+      CHECK_NOTNULL(EC_KEY_new_by_curve_name(NID_X9_62_prime256v1)));
+  // The key ID is computed over the public key with the named curve.
+  EC_KEY_set_asn1_flag(ec, OPENSSL_EC_NAMED_CURVE);
+  CHECK_EQ(1, EC_KEY_generate_key(ec));
+  EVP_PKEY* const pkey(CHECK_NOTNULL(EVP_PKEY_new()));
+  CHECK_EQ(1, EVP_PKEY_assign_EC_KEY(pkey, ec));
+  return pkey;
+}
+
+
+EVP_PKEY* NewRSAKey() {
+  RSA* const rsa(CHECK_NOTNULL(RSA_new()));
+  BIGNUM* const exponent(CHECK_NOTNULL(BN_new()));
+  CHECK_EQ(1, BN_set_word(exponent, RSA_F4));
+  CHECK_EQ(1, RSA_generate_key_ex(rsa, FLAGS_rsa_bits, exponent, NULL));
+  BN_free(exponent);
+  EVP_PKEY* const pkey(CHECK_NOTNULL(EVP_PKEY_new()));
+  CHECK_EQ(1, EVP_PKEY_assign_RSA(pkey, rsa));
+  return pkey;
+}
+
+
+LogEntry MakeEntry(int n) {
+  string leaf(std::to_string(n) + "/");
+  leaf.resize(FLAGS_leaf_size, 'x');
+  LogEntry entry;
+  entry.set_type(ct::X509_ENTRY);
+  entry.mutable_x509_entry()->set_leaf_certificate(leaf);
+  return entry;
+}
+
+
+SignedCertificateTimestamp MakeSCT() {
+  SignedCertificateTimestamp sct;
+  sct.set_version(ct::V1);
+  sct.set_timestamp(util::TimeInMilliseconds());
+  return sct;
+}
+
+
+// Runs |sign| on |num_threads| threads, which signs SCTs for the
+// entries in the given batch and returns how many, until it has
+// taken at least --min_time_ms. Returns the number of SCTs signed per
+// second, by all the threads together.
+double Measure(int num_threads,
+               const function<int(const vector<LogEntry>&)>& sign) {
+  const std::chrono::milliseconds min_time(FLAGS_min_time_ms);
+  std::atomic<uint64_t> total(0);
+  const std::chrono::steady_clock::time_point start(
+      std::chrono::steady_clock::now());
+  vector<thread> threads;
+  for (int i = 0; i < num_threads; ++i) {
+    threads.emplace_back([i, min_time, start, &sign, &total]() {
+      vector<LogEntry> entries;
+      for (int n = 0; n < FLAGS_batch_size; ++n) {
+        entries.push_back(MakeEntry(i * FLAGS_batch_size + n));
+      }
+      uint64_t signed_scts(0);
+      while (std::chrono::steady_clock::now() - start < min_time) {
+        signed_scts += sign(entries);
+      }
+      total += signed_scts;
+    });
+  }
+  for (auto& t : threads) {
+    t.join();
+  }
+  const std::chrono::duration<double> elapsed(
+      std::chrono::steady_clock::now() - start);
+  return total / elapsed.count();
+}
+
+
+void Report(const string& name, const string& key, int num_threads,
+            double scts_per_second) {
+  std::cout << std::left << std::setw(32) << name << std::setw(12) << key
+            << std::right << std::setw(8) << num_threads << std::fixed
+            << std::setprecision(0) << std::setw(14) << scts_per_second
+            << std::setw(14) << scts_per_second / num_threads << std::endl;
+}
+
+
+void RunBenchmarks(const string& key, EVP_PKEY* pkey,
+                   const vector<int>& thread_counts) {
+  const LogSigner signer(pkey);
+
+  for (const int num_threads : thread_counts) {
+    Report("sign_certificate_timestamp", key, num_threads,
+           Measure(num_threads, [&signer](const vector<LogEntry>& entries) {
+             for (const LogEntry& entry : entries) {
+               SignedCertificateTimestamp sct(MakeSCT());
+               CHECK_EQ(LogSigner::OK,
+                        signer.SignCertificateTimestamp(entry, &sct));
+             }
+             return static_cast<int>(entries.size());
+           }));
+
+    Report("sign_certificate_timestamps", key, num_threads,
+           Measure(num_threads, [&signer](const vector<LogEntry>& entries) {
+             vector<SignedCertificateTimestamp> scts(entries.size(),
+                                                     MakeSCT());
+             vector<const LogEntry*> entry_ptrs;
+             vector<SignedCertificateTimestamp*> sct_ptrs;
+             for (size_t i = 0; i < entries.size(); ++i) {
+               entry_ptrs.push_back(&entries[i]);
+               sct_ptrs.push_back(&scts[i]);
+             }
+             CHECK_EQ(LogSigner::OK,
+                      signer.SignCertificateTimestamps(entry_ptrs, sct_ptrs));
+             return static_cast<int>(entries.size());
+           }));
+  }
+}
+
+
+}  // namespace
+
+
+int main(int argc, char* argv[]) {
+  google::ParseCommandLineFlags(&argc, &argv, true);
+  google::InitGoogleLogging(argv[0]);
+  OpenSSL_add_all_algorithms();
+
+  CHECK_GT(FLAGS_min_time_ms, 0);
+  CHECK_GT(FLAGS_batch_size, 0);
+  CHECK_GT(FLAGS_leaf_size, 0);
+  vector<int> thread_counts{1};
+  const int num_threads(FLAGS_num_threads > 0
+                            ? FLAGS_num_threads
+                            : std::thread::hardware_concurrency());
+  if (num_threads > 1) {
+    thread_counts.push_back(num_threads);
+  }
+
+  std::cout << std::left << std::setw(32) << "benchmark" << std::setw(12)
+            << "key" << std::right << std::setw(8) << "threads"
+            << std::setw(14) << "scts/s" << std::setw(14) << "scts/s/core"
+            << std::endl;
+
+  // The LogSigners take ownership of the keys.
+  RunBenchmarks("ecdsa-p256", NewECKey(), thread_counts);
+  RunBenchmarks("rsa-" + std::to_string(FLAGS_rsa_bits), NewRSAKey(),
+                thread_counts);
+
+  return 0;
+}
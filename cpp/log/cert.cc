@@ -19,6 +19,7 @@
 #include <time.h>
 #include <vector>
 
+using std::shared_ptr;
 using std::string;
 using std::vector;
 using std::unique_ptr;
@@ -102,6 +103,7 @@ Cert* Cert::Clone() const {
 
 
 Cert::Status Cert::LoadFromDerString(const string& der_string) {
+  ClearEncodings();
   if (x509_ != NULL) {
     X509_free(x509_);
     x509_ = NULL;
@@ -119,6 +121,7 @@ Cert::Status Cert::LoadFromDerString(const string& der_string) {
 
 
 Cert::Status Cert::LoadFromDerBio(BIO* bio_in) {
+  ClearEncodings();
   if (x509_) {
     // TODO(AlCutter): Use custom deallocator
     X509_free(x509_);
@@ -244,6 +247,12 @@ Cert::Status Cert::HasExtension(int extension_nid) const {
     return ERROR;
   }
 
+  string der;
+  CtExtensionView view;
+  const int count = FindCtExtension(extension_nid, &der, &view);
+  if (count >= 0)
+    return count > 0 ? TRUE : FALSE;
+
   int ignored;
   return ExtensionIndex(extension_nid, &ignored);
 }
@@ -255,6 +264,12 @@ Cert::Status Cert::HasCriticalExtension(int extension_nid) const {
     return ERROR;
   }
 
+  string der;
+  CtExtensionView view;
+  const int count = FindCtExtension(extension_nid, &der, &view);
+  if (count >= 0)
+    return count > 0 && view.critical ? TRUE : FALSE;
+
   X509_EXTENSION* ext;
   Status status = GetExtension(extension_nid, &ext);
   if (status != TRUE)
@@ -379,6 +394,8 @@ Cert::Status Cert::DerEncoding(string* result) const {
     LOG(ERROR) << "Cert not loaded";
     return ERROR;
   }
+  if (GetEncoding(&Encodings::der, result))
+    return TRUE;
 
   unsigned char* der_buf = NULL;
   int der_length = i2d_X509(x509_, &der_buf);
@@ -393,6 +410,7 @@ Cert::Status Cert::DerEncoding(string* result) const {
 
   result->assign(reinterpret_cast<char*>(der_buf), der_length);
   OPENSSL_free(der_buf);
+  SetEncoding(&Encodings::der, *result);
   return TRUE;
 }
 
@@ -426,6 +444,8 @@ Cert::Status Cert::Sha256Digest(string* result) const {
     LOG(ERROR) << "Cert not loaded";
     return ERROR;
   }
+  if (GetEncoding(&Encodings::sha256_digest, result))
+    return TRUE;
 
   unsigned char digest[EVP_MAX_MD_SIZE];
   unsigned int len;
@@ -438,6 +458,7 @@ Cert::Status Cert::Sha256Digest(string* result) const {
   }
 
   result->assign(reinterpret_cast<char*>(digest), len);
+  SetEncoding(&Encodings::sha256_digest, *result);
   return TRUE;
 }
 
@@ -447,6 +468,8 @@ Cert::Status Cert::DerEncodedTbsCertificate(string* result) const {
     LOG(ERROR) << "Cert not loaded";
     return ERROR;
   }
+  if (GetEncoding(&Encodings::der_tbs, result))
+    return TRUE;
 
   unsigned char* der_buf = NULL;
   int der_length = i2d_re_X509_tbs(x509_, &der_buf);
@@ -459,6 +482,7 @@ Cert::Status Cert::DerEncodedTbsCertificate(string* result) const {
   }
   result->assign(reinterpret_cast<char*>(der_buf), der_length);
   OPENSSL_free(der_buf);
+  SetEncoding(&Encodings::der_tbs, *result);
   return TRUE;
 }
 
@@ -468,7 +492,13 @@ Cert::Status Cert::DerEncodedSubjectName(string* result) const {
     LOG(ERROR) << "Cert not loaded";
     return ERROR;
   }
-  return DerEncodedName(X509_get_subject_name(x509_), result);
+  if (GetEncoding(&Encodings::der_subject_name, result))
+    return TRUE;
+
+  const Status status(DerEncodedName(X509_get_subject_name(x509_), result));
+  if (status == TRUE)
+    SetEncoding(&Encodings::der_subject_name, *result);
+  return status;
 }
 
 
@@ -477,7 +507,13 @@ Cert::Status Cert::DerEncodedIssuerName(string* result) const {
     LOG(ERROR) << "Cert not loaded";
     return ERROR;
   }
-  return DerEncodedName(X509_get_issuer_name(x509_), result);
+  if (GetEncoding(&Encodings::der_issuer_name, result))
+    return TRUE;
+
+  const Status status(DerEncodedName(X509_get_issuer_name(x509_), result));
+  if (status == TRUE)
+    SetEncoding(&Encodings::der_issuer_name, *result);
+  return status;
 }
 
 
@@ -498,11 +534,59 @@ Cert::Status Cert::DerEncodedName(X509_NAME* name, string* result) {
 }
 
 
+Cert::Status Cert::DnsNames(vector<string>* result) const {
+  if (!IsLoaded()) {
+    LOG(ERROR) << "Cert not loaded";
+    return ERROR;
+  }
+  CHECK_NOTNULL(result)->clear();
+
+  X509_NAME* const subject(X509_get_subject_name(x509_));
+  if (subject) {
+    for (int pos = X509_NAME_get_index_by_NID(subject, NID_commonName, -1);
+         pos >= 0;
+         pos = X509_NAME_get_index_by_NID(subject, NID_commonName, pos)) {
+      Status status;
+      result->push_back(ASN1ToStringAndCheckForNulls(
+          X509_NAME_ENTRY_get_data(X509_NAME_get_entry(subject, pos)), "CN",
+          &status));
+      if (status != TRUE) {
+        return FALSE;
+      }
+    }
+  }
+
+  STACK_OF(GENERAL_NAME)* const subject_alt_names(
+      static_cast<STACK_OF(GENERAL_NAME)*>(
+          X509_get_ext_d2i(x509_, NID_subject_alt_name, NULL, NULL)));
+  if (!subject_alt_names) {
+    return TRUE;
+  }
+
+  Status status(TRUE);
+  for (int i = 0; i < sk_GENERAL_NAME_num(subject_alt_names); ++i) {
+    GENERAL_NAME* const name(sk_GENERAL_NAME_value(subject_alt_names, i));
+    if (name->type == GEN_DNS) {
+      result->push_back(
+          ASN1ToStringAndCheckForNulls(name->d.dNSName, "DNS name", &status));
+      if (status != TRUE) {
+        status = FALSE;
+        break;
+      }
+    }
+  }
+  sk_GENERAL_NAME_pop_free(subject_alt_names, GENERAL_NAME_free);
+  return status;
+}
+
+
 Cert::Status Cert::PublicKeySha256Digest(string* result) const {
   if (!IsLoaded()) {
     LOG(ERROR) << "Cert not loaded";
     return ERROR;
   }
+  if (GetEncoding(&Encodings::public_key_sha256_digest, result))
+    return TRUE;
 
   unsigned char digest[EVP_MAX_MD_SIZE];
   unsigned int len;
@@ -514,6 +598,7 @@ Cert::Status Cert::PublicKeySha256Digest(string* result) const {
     return FALSE;
   }
   result->assign(reinterpret_cast<char*>(digest), len);
+  SetEncoding(&Encodings::public_key_sha256_digest, *result);
   return TRUE;
 }
 
@@ -523,6 +608,8 @@ Cert::Status Cert::SPKISha256Digest(string* result) const {
     LOG(ERROR) << "Cert not loaded";
     return ERROR;
   }
+  if (GetEncoding(&Encodings::spki_sha256_digest, result))
+    return TRUE;
 
   unsigned char* der_buf = NULL;
   int der_length = i2d_X509_PUBKEY(X509_get_X509_PUBKEY(x509_), &der_buf);
@@ -539,10 +626,32 @@ Cert::Status Cert::SPKISha256Digest(string* result) const {
 
   result->assign(sha256_digest);
   OPENSSL_free(der_buf);
+  SetEncoding(&Encodings::spki_sha256_digest, *result);
   return TRUE;
 }
 
 
+bool Cert::GetEncoding(string Encodings::*field, string* result) const {
+  std::lock_guard<std::mutex> lock(encodings_lock_);
+  if ((encodings_.*field).empty())
+    return false;
+  result->assign(encodings_.*field);
+  return true;
+}
+
+
+void Cert::SetEncoding(string Encodings::*field, const string& value) const {
+  std::lock_guard<std::mutex> lock(encodings_lock_);
+  encodings_.*field = value;
+}
+
+
+void Cert::ClearEncodings() {
+  std::lock_guard<std::mutex> lock(encodings_lock_);
+  encodings_ = Encodings();
+}
+
+
 Cert::Status Cert::OctetStringExtensionData(int extension_nid,
                                             string* result) const {
   if (!IsLoaded()) {
@@ -550,6 +659,20 @@ Cert::Status Cert::OctetStringExtensionData(int extension_nid,
     return ERROR;
   }
 
+  // Repeated or unusual extensions are left to OpenSSL, which reports
+  // them as corrupt.
+  string der;
+  CtExtensionView view;
+  const int count = FindCtExtension(extension_nid, &der, &view);
+  if (count == 0)
+    return FALSE;
+  const unsigned char* data;
+  size_t length;
+  if (count == 1 && CtExtensionOctetString(view, &data, &length)) {
+    result->assign(reinterpret_cast<const char*>(data), length);
+    return TRUE;
+  }
+
   void* ext_data;
   Status status = ExtensionStructure(extension_nid, &ext_data);
   if (status != TRUE)
@@ -564,6 +687,16 @@ Cert::Status Cert::OctetStringExtensionData(int extension_nid,
 }
 
 
+int Cert::FindCtExtension(int extension_nid, string* der,
+                          CtExtensionView* view) const {
+  if (!IsCtExtension(extension_nid) || DerEncoding(der) != TRUE)
+    return -1;
+  return cert_trans::FindCtExtension(
+      reinterpret_cast<const unsigned char*>(der->data()), der->size(),
+      extension_nid, view);
+}
+
+
 Cert::Status Cert::ExtensionIndex(int extension_nid,
                                   int* extension_index) const {
   int index = X509_get_ext_by_NID(x509_, extension_nid, -1);
@@ -1153,6 +1286,272 @@ Cert::Status TbsCertificate::ExtensionIndex(int extension_nid,
 }
 
 
+namespace {
+
+// The contents of the DER encodings of the OIDs of the extensions that
+// PrecertTbsDerEncoding edits: the poison (kPoisonOID) and the
+// Authority Key Identifier.
+const char kPoisonOIDDer[] = "\x2b\x06\x01\x04\x01\xd6\x79\x02\x04\x03";
+const char kAuthorityKeyIdOIDDer[] = "\x55\x1d\x23";
+
+const unsigned char kDerBooleanTag = 0x01;
+const unsigned char kDerOctetStringTag = 0x04;
+const unsigned char kDerOidTag = 0x06;
+const unsigned char kDerSequenceTag = 0x30;
+// The tags of the [0] EXPLICIT version and [3] EXPLICIT extensions of
+// a TBSCertificate.
+const unsigned char kDerTbsVersionTag = 0xa0;
+const unsigned char kDerTbsExtensionsTag = 0xa3;
+
+
+// An element of a DER encoding, as offsets into it.
+struct DerElement {
+  unsigned char tag;
+  size_t start;
+  size_t contents;
+  size_t end;
+};
+
+
+string DerElementBytes(const string& der, const DerElement& element) {
+  return der.substr(element.start, element.end - element.start);
+}
+
+
+// Reads the element starting at |offset| in |der|, which must end by
+// |end|. Only handles low tag numbers and definite lengths in their
+// shortest form, as DER requires.
+bool ReadDerElement(const string& der, size_t offset, size_t end,
+                    DerElement* element) {
+  if (end - offset < 2)
+    return false;
+  element->tag = der[offset];
+  element->start = offset;
+  // High tag numbers.
+  if ((element->tag & 0x1f) == 0x1f)
+    return false;
+
+  size_t length = static_cast<unsigned char>(der[offset + 1]);
+  offset += 2;
+  if (length & 0x80) {
+    const size_t num_bytes(length & 0x7f);
+    // Rules out indefinite lengths, and ones that cannot be in memory.
+    if (num_bytes == 0 || num_bytes > 4 || end - offset < num_bytes ||
+        der[offset] == 0)
+      return false;
+    length = 0;
+    for (size_t i = 0; i < num_bytes; ++i)
+      length = (length << 8) | static_cast<unsigned char>(der[offset++]);
+    if (length < 0x80)
+      return false;
+  }
+
+  if (end - offset < length)
+    return false;
+  element->contents = offset;
+  element->end = offset + length;
+  return true;
+}
+
+
+// Reads all the elements in the contents of |parent|.
+bool ReadDerChildren(const string& der, const DerElement& parent,
+                     vector<DerElement>* children) {
+  children->clear();
+  for (size_t offset = parent.contents; offset < parent.end;) {
+    DerElement child;
+    if (!ReadDerElement(der, offset, parent.end, &child))
+      return false;
+    children->push_back(child);
+    offset = child.end;
+  }
+  return true;
+}
+
+
+void AppendDerElement(unsigned char tag, const string& contents,
+                      string* result) {
+  result->push_back(tag);
+  const size_t length(contents.size());
+  if (length < 0x80) {
+    result->push_back(static_cast<char>(length));
+  } else {
+    int num_bytes = 0;
+    for (size_t l = length; l > 0; l >>= 8)
+      ++num_bytes;
+    result->push_back(static_cast<char>(0x80 | num_bytes));
+    for (int i = num_bytes - 1; i >= 0; --i)
+      result->push_back(static_cast<char>(length >> (8 * i)));
+  }
+  result->append(contents);
+}
+
+
+// The fields of a DER-encoded TBSCertificate.
+struct DerTbs {
+  vector<DerElement> fields;
+  size_t issuer;
+  // The index in |fields| of the extensions, or -1 if there are none.
+  int extensions;
+  // The fields of each of the extensions.
+  vector<vector<DerElement>> extension_list;
+};
+
+
+bool ParseDerTbs(const string& der, DerTbs* tbs) {
+  DerElement top;
+  if (!ReadDerElement(der, 0, der.size(), &top) ||
+      top.tag != kDerSequenceTag || top.end != der.size() ||
+      !ReadDerChildren(der, top, &tbs->fields))
+    return false;
+
+  // The version is optional, then come the serial number and the
+  // signature algorithm, followed by the issuer, validity, subject
+  // and public key.
+  tbs->issuer = !tbs->fields.empty() &&
+                        tbs->fields[0].tag == kDerTbsVersionTag
+                    ? 3
+                    : 2;
+  if (tbs->fields.size() < tbs->issuer + 4 ||
+      tbs->fields[tbs->issuer].tag != kDerSequenceTag)
+    return false;
+
+  tbs->extensions = -1;
+  tbs->extension_list.clear();
+  if (tbs->fields.back().tag != kDerTbsExtensionsTag)
+    return true;
+  tbs->extensions = tbs->fields.size() - 1;
+
+  vector<DerElement> wrapper;
+  if (!ReadDerChildren(der, tbs->fields.back(), &wrapper) ||
+      wrapper.size() != 1 || wrapper[0].tag != kDerSequenceTag)
+    return false;
+  vector<DerElement> extensions;
+  if (!ReadDerChildren(der, wrapper[0], &extensions))
+    return false;
+  for (const DerElement& extension : extensions) {
+    vector<DerElement> fields;
+    // The OID, the optional critical flag, and the value.
+    if (extension.tag != kDerSequenceTag ||
+        !ReadDerChildren(der, extension, &fields) || fields.size() < 2 ||
+        fields.size() > 3 || fields.front().tag != kDerOidTag ||
+        (fields.size() == 3 && fields[1].tag != kDerBooleanTag) ||
+        fields.back().tag != kDerOctetStringTag)
+      return false;
+    tbs->extension_list.push_back(fields);
+  }
+  return true;
+}
+
+
+// Returns the index in |tbs.extension_list| of the first extension
+// with the OID whose DER encoding has the contents |oid|, or -1, and
+// sets |count| to how many there are, if not NULL.
+int FindDerExtension(const string& der, const DerTbs& tbs, const char* oid,
+                     int* count) {
+  int index = -1;
+  int found = 0;
+  for (size_t i = 0; i < tbs.extension_list.size(); ++i) {
+    const DerElement& ext_oid(tbs.extension_list[i].front());
+    if (der.compare(ext_oid.contents, ext_oid.end - ext_oid.contents, oid) ==
+        0) {
+      if (index < 0)
+        index = i;
+      ++found;
+    }
+  }
+  if (count != NULL)
+    *count = found;
+  return index;
+}
+
+}  // namespace
+
+
+Cert::Status PrecertTbsDerEncoding(const Cert& precert, const Cert* issuer,
+                                   string* result) {
+  // Starts from the encoding OpenSSL re-encodes, as TbsCertificate
+  // would.
+  string der;
+  Cert::Status status = precert.DerEncodedTbsCertificate(&der);
+  if (status != Cert::TRUE)
+    return status;
+
+  DerTbs tbs;
+  if (!ParseDerTbs(der, &tbs)) {
+    VLOG(1) << "Unable to parse the DER encoding of the precert TBS";
+    return Cert::FALSE;
+  }
+
+  int poison_count;
+  const int poison = FindDerExtension(der, tbs, kPoisonOIDDer, &poison_count);
+  // OpenSSL would leave an empty list of extensions, rather than none.
+  if (poison_count != 1 || tbs.extension_list.size() < 2)
+    return Cert::FALSE;
+
+  string issuer_name;
+  string authority_key_id;
+  const int aki = FindDerExtension(der, tbs, kAuthorityKeyIdOIDDer, NULL);
+  if (issuer != NULL) {
+    status = issuer->DerEncodedIssuerName(&issuer_name);
+    if (status != Cert::TRUE)
+      return status;
+
+    if (aki >= 0) {
+      string issuer_der;
+      status = issuer->DerEncodedTbsCertificate(&issuer_der);
+      if (status != Cert::TRUE)
+        return status;
+      DerTbs issuer_tbs;
+      if (!ParseDerTbs(issuer_der, &issuer_tbs))
+        return Cert::FALSE;
+      const int issuer_aki = FindDerExtension(issuer_der, issuer_tbs,
+                                              kAuthorityKeyIdOIDDer, NULL);
+      // TbsCertificate::CopyIssuerFrom reports the error.
+      if (issuer_aki < 0)
+        return Cert::FALSE;
+      authority_key_id = DerElementBytes(
+          issuer_der, issuer_tbs.extension_list[issuer_aki].back());
+    }
+  }
+
+  string extensions;
+  for (size_t i = 0; i < tbs.extension_list.size(); ++i) {
+    const vector<DerElement>& fields(tbs.extension_list[i]);
+    if (static_cast<int>(i) == poison)
+      continue;
+    string extension;
+    for (size_t j = 0; j < fields.size(); ++j) {
+      // Keeps the critical flag of the precert's own extension.
+      if (issuer != NULL && static_cast<int>(i) == aki &&
+          j == fields.size() - 1) {
+        extension.append(authority_key_id);
+      } else {
+        extension.append(DerElementBytes(der, fields[j]));
+      }
+    }
+    AppendDerElement(kDerSequenceTag, extension, &extensions);
+  }
+
+  string contents;
+  for (size_t i = 0; i < tbs.fields.size(); ++i) {
+    if (issuer != NULL && i == tbs.issuer) {
+      contents.append(issuer_name);
+    } else if (static_cast<int>(i) == tbs.extensions) {
+      string wrapper;
+      AppendDerElement(kDerSequenceTag, extensions, &wrapper);
+      AppendDerElement(kDerTbsExtensionsTag, wrapper, &contents);
+    } else {
+      contents.append(DerElementBytes(der, tbs.fields[i]));
+    }
+  }
+
+  result->clear();
+  AppendDerElement(kDerSequenceTag, contents, result);
+  return Cert::TRUE;
+}
+
+
 CertChain::CertChain(const string& pem_string) {
   // A read-only BIO.
   BIO* const bio_in(BIO_new_mem_buf(const_cast<char*>(pem_string.data()),
@@ -1164,8 +1563,7 @@ CertChain::CertChain(const string& pem_string) {
 
   X509* x509 = NULL;
   while ((x509 = PEM_read_bio_X509(bio_in, NULL, NULL, NULL)) != NULL) {
-    Cert* cert = new Cert(x509);
-    chain_.push_back(cert);
+    chain_.emplace_back(new Cert(x509));
   }
 
   BIO_free(bio_in);
@@ -1191,6 +1589,16 @@ Cert::Status CertChain::AddCert(Cert* cert) {
       delete cert;
     return Cert::ERROR;
   }
+  chain_.emplace_back(cert);
+  return Cert::TRUE;
+}
+
+
+Cert::Status CertChain::AddCert(const shared_ptr<const Cert>& cert) {
+  if (cert == NULL || !cert->IsLoaded()) {
+    LOG(ERROR) << "Attempting to add an invalid cert";
+    return Cert::ERROR;
+  }
   chain_.push_back(cert);
   return Cert::TRUE;
 }
@@ -1201,7 +1609,6 @@ Cert::Status CertChain::RemoveCert() {
     LOG(ERROR) << "Chain is not loaded";
     return Cert::ERROR;
   }
-  delete chain_.back();
   chain_.pop_back();
   return Cert::TRUE;
 }
@@ -1250,10 +1657,9 @@ Cert::Status CertChain::IsValidCaIssuerChainMaybeLegacyRoot() const {
   }
 
   Cert::Status status;
-  for (vector<Cert*>::const_iterator it = chain_.begin();
-       it + 1 < chain_.end(); ++it) {
-    Cert* subject = *it;
-    Cert* issuer = *(it + 1);
+  for (auto it = chain_.begin(); it + 1 < chain_.end(); ++it) {
+    const Cert* subject = it->get();
+    const Cert* issuer = (it + 1)->get();
 
     // The root cert may not have CA:True
     status = issuer->IsSelfSigned();
@@ -1281,10 +1687,9 @@ Cert::Status CertChain::IsValidSignatureChain() const {
   }
 
   Cert::Status status;
-  for (vector<Cert*>::const_iterator it = chain_.begin();
-       it + 1 < chain_.end(); ++it) {
-    Cert* subject = *it;
-    Cert* issuer = *(it + 1);
+  for (auto it = chain_.begin(); it + 1 < chain_.end(); ++it) {
+    const Cert* subject = it->get();
+    const Cert* issuer = (it + 1)->get();
     status = subject->IsSignedBy(*issuer);
     if (status != Cert::TRUE)
       return status;
@@ -1294,9 +1699,6 @@ Cert::Status CertChain::IsValidSignatureChain() const {
 
 
 void CertChain::ClearChain() {
-  vector<Cert*>::const_iterator it;
-  for (it = chain_.begin(); it < chain_.end(); ++it)
-    delete *it;
   chain_.clear();
 }
 
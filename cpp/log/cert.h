@@ -3,6 +3,8 @@
 #define CERT_H
 #include <gtest/gtest_prod.h>
 #include <openssl/asn1.h>
+#include <memory>
+#include <mutex>
 #include <openssl/x509.h>
 #include <string>
 #include <vector>
@@ -11,6 +13,8 @@
 
 namespace cert_trans {
 
+struct CtExtensionView;
+
 // Tests if a hostname contains any redactions ('?' elements). If it does
 // not then there is no need to apply the validation below
 bool IsRedactedHost(const std::string& hostname);
@@ -172,6 +176,14 @@ class Cert {
   // Returns ERROR if the cert is not loaded.
   Status SPKISha256Digest(std::string* result) const;
 
+  // Sets the DNS names of the cert in |result|: the common names of
+  // its subject, followed by the DNS names of its subjectAltName
+  // extension, if it has one.
+  // Returns TRUE if the names could be read.
+  // Returns FALSE if a name contains a NUL character.
+  // Returns ERROR if the cert is not loaded.
+  Status DnsNames(std::vector<std::string>* result) const;
+
   // Fetch data from an extension if encoded as an ASN1_OCTET_STRING.
   // Useful for handling custom extensions registered with X509V3_EXT_add.
   // Returns true if the extension is present and the data could be decoded.
@@ -208,17 +220,48 @@ class Cert {
   FRIEND_TEST(CtExtensionsTest, TestEmbeddedSCTExtension);
   FRIEND_TEST(CtExtensionsTest, TestPoisonExtension);
   FRIEND_TEST(CtExtensionsTest, TestPrecertSigning);
+  FRIEND_TEST(CtExtensionsTest, FindCtExtensionOctetString);
 
  private:
   Status ExtensionIndex(int extension_nid, int* extension_index) const;
   Status GetExtension(int extension_nid, X509_EXTENSION** ext) const;
   Status ExtensionStructure(int extension_nid, void** ext_struct) const;
+  // Looks for the CT extension |extension_nid| in the DER encoding,
+  // which is set in |der| for |view| to point into, as
+  // FindCtExtension() does. Returns -1 if the caller should ask OpenSSL
+  // instead.
+  int FindCtExtension(int extension_nid, std::string* der,
+                      CtExtensionView* view) const;
   bool ValidateRedactionSubjectAltNameAndCN(int* dns_alt_name_count,
                                             Status* status) const;
   static std::string PrintName(X509_NAME* name);
   static std::string PrintTime(ASN1_TIME* when);
   static Status DerEncodedName(X509_NAME* name, std::string* result);
+
+  // The encodings and digests that have been computed, so that the
+  // submission path, which asks for the same ones several times, does
+  // not re-encode the certificate each time. They are only valid for
+  // the current |x509_|, and are empty until computed.
+  struct Encodings {
+    std::string der;
+    std::string sha256_digest;
+    std::string der_tbs;
+    std::string der_subject_name;
+    std::string der_issuer_name;
+    std::string public_key_sha256_digest;
+    std::string spki_sha256_digest;
+  };
+  // Sets |result| to the |field| of |encodings_| and returns true if
+  // it has been computed.
+  bool GetEncoding(std::string Encodings::*field, std::string* result) const;
+  void SetEncoding(std::string Encodings::*field,
+                   const std::string& value) const;
+  void ClearEncodings();
+
   X509* x509_;
+  // Certs are shared between threads, e.g. in the trusted store.
+  mutable std::mutex encodings_lock_;
+  mutable Encodings encodings_;
 
   DISALLOW_COPY_AND_ASSIGN(Cert);
 };
@@ -271,6 +314,19 @@ class TbsCertificate {
   DISALLOW_COPY_AND_ASSIGN(TbsCertificate);
 };
 
+// Sets |result| to the DER-encoded TBS of |precert| with the poison
+// extension deleted and, if |issuer| is not NULL, the issuer copied from
+// it, the same as TbsCertificate with DeleteExtension and CopyIssuerFrom
+// would. It edits the DER encoding of the TBS instead of copying the
+// whole OpenSSL structure, which is much cheaper.
+// Returns TRUE if the encoding succeeded.
+// Returns FALSE if the certificates are not in a form this handles, such
+// as when the poison extension is missing or duplicated; TbsCertificate
+// should be used instead, and reports the actual error, if any.
+// Returns ERROR if either cert is not loaded.
+Cert::Status PrecertTbsDerEncoding(const Cert& precert, const Cert* issuer,
+                                   std::string* result);
+
 class CertChain {
  public:
   CertChain() = default;
@@ -288,6 +344,10 @@ class CertChain {
   // Else returns ERROR.
   Cert::Status AddCert(Cert* cert);
 
+  // Same as above, but shares the cert (e.g. with an InternedCertCache
+  // and the other chains it is added to) instead of owning it.
+  Cert::Status AddCert(const std::shared_ptr<const Cert>& cert);
+
   // Remove a cert from the end of the chain.
   // If successful, returns TRUE.
   // If the chain is empty, returns ERROR.
@@ -312,17 +372,17 @@ class CertChain {
   Cert const* LeafCert() const {
     if (!IsLoaded())
       return NULL;
-    return chain_.front();
+    return chain_.front().get();
   }
 
   Cert const* CertAt(size_t position) const {
-    return chain_.size() <= position ? NULL : chain_[position];
+    return chain_.size() <= position ? NULL : chain_[position].get();
   }
 
   Cert const* LastCert() const {
     if (!IsLoaded())
       return NULL;
-    return chain_.back();
+    return chain_.back().get();
   }
 
   // Returns TRUE if the issuer of each cert is the subject of the
@@ -341,7 +401,7 @@ class CertChain {
 
  private:
   void ClearChain();
-  std::vector<Cert*> chain_;
+  std::vector<std::shared_ptr<const Cert>> chain_;
 
   DISALLOW_COPY_AND_ASSIGN(CertChain);
 };
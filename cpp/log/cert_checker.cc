@@ -1,6 +1,7 @@
 /* -*- indent-tabs-mode: nil -*- */
 #include "log/cert_checker.h"
 
+#include <gflags/gflags.h>
 #include <glog/logging.h>
 #include <memory>
 #include <openssl/asn1.h>
@@ -18,12 +19,18 @@
 #include "util/openssl_util.h"  // for LOG_OPENSSL_ERRORS
 #include "util/util.h"
 
+using std::make_shared;
+using std::shared_ptr;
 using std::string;
 using std::unique_ptr;
 using std::vector;
 using util::ClearOpenSSLErrors;
 using util::Status;
 
+DEFINE_int32(cert_checker_signature_cache_entries, 16384,
+             "number of verified certificate signatures kept in memory, so "
+             "that chains sharing them are not verified again");
+
 namespace cert_trans {
 
 namespace {
@@ -49,26 +56,35 @@ Status GetVerifyError(CertChecker::CertVerifyResult result) {
 
 }  // namespace
 
+CertChecker::CertChecker() : trusted_(make_shared<TrustStore>()) {
+}
+
 CertChecker::~CertChecker() {
-  ClearAllTrustedCertificates();
 }
 
-bool CertChecker::LoadTrustedCertificates(const string& cert_file) {
+BIO* CertChecker::OpenTrustedCertificateFile(const string& cert_file) {
   // A read-only BIO.
   BIO* bio_in = BIO_new(BIO_s_file());
   if (bio_in == NULL) {
     LOG_OPENSSL_ERRORS(ERROR);
-    return false;
+    return NULL;
   }
 
   if (BIO_read_filename(bio_in, cert_file.c_str()) <= 0) {
     BIO_free(bio_in);
     LOG(ERROR) << "Failed to open file " << cert_file << " for reading";
     LOG_OPENSSL_ERRORS(ERROR);
-    return false;
+    return NULL;
   }
+  return bio_in;
+}
+
+bool CertChecker::LoadTrustedCertificates(const string& cert_file) {
+  BIO* bio_in = OpenTrustedCertificateFile(cert_file);
+  if (bio_in == NULL)
+    return false;
 
-  return LoadTrustedCertificatesFromBIO(bio_in);
+  return LoadTrustedCertificatesFromBIO(bio_in, false);
 }
 
 bool CertChecker::LoadTrustedCertificates(const vector<string>& trusted_certs) {
@@ -86,25 +102,39 @@ bool CertChecker::LoadTrustedCertificates(const vector<string>& trusted_certs) {
     return false;
   }
 
-  return LoadTrustedCertificatesFromBIO(bio_in);
+  return LoadTrustedCertificatesFromBIO(bio_in, false);
 }
 
-bool CertChecker::LoadTrustedCertificatesFromBIO(BIO* bio_in) {
+bool CertChecker::ReloadTrustedCertificates(const string& cert_file) {
+  BIO* bio_in = OpenTrustedCertificateFile(cert_file);
+  if (bio_in == NULL)
+    return false;
+
+  return LoadTrustedCertificatesFromBIO(bio_in, true);
+}
+
+bool CertChecker::LoadTrustedCertificatesFromBIO(BIO* bio_in, bool replace) {
   CHECK(bio_in != NULL);
-  std::vector<std::pair<string, Cert*> > certs_to_add;
+  std::lock_guard<std::mutex> lock(trusted_update_lock_);
+  // The new store starts as a copy of the current one, unless it
+  // replaces it, and is only published once it is complete.
+  const shared_ptr<TrustStore> store(
+      replace ? make_shared<TrustStore>()
+              : make_shared<TrustStore>(*TrustedStore()));
   bool error = false;
-  // certs_to_add may be empty if no new certs were added, so keep track of
-  // successfully parsed cert count separately.
+  // No new certs may be added if they are all trusted already, so keep
+  // track of successfully parsed cert count separately.
   size_t cert_count = 0;
+  size_t new_certs = 0;
 
   while (!error) {
     X509* x509 = PEM_read_bio_X509(bio_in, NULL, NULL, NULL);
     if (x509 != NULL) {
       // TODO(ekasper): check that the issuing CA cert is temporally valid
       // and at least warn if it isn't.
-      unique_ptr<Cert> cert(new Cert(x509));
+      shared_ptr<const Cert> cert(new Cert(x509));
       string subject_name;
-      CertVerifyResult is_trusted = IsTrusted(*cert, &subject_name);
+      CertVerifyResult is_trusted = IsTrusted(*store, *cert, &subject_name);
       if (is_trusted != OK && is_trusted != ROOT_NOT_IN_LOCAL_STORE) {
         error = true;
         break;
@@ -112,7 +142,10 @@ bool CertChecker::LoadTrustedCertificatesFromBIO(BIO* bio_in) {
 
       ++cert_count;
       if (is_trusted != OK) {
-        certs_to_add.push_back(make_pair(subject_name, cert.release()));
+        store->by_subject.emplace(subject_name, cert.get());
+        store->subject_index.emplace(subject_name, cert.get());
+        store->certs.emplace_back(std::move(cert));
+        ++new_certs;
       }
     } else {
       // See if we reached the end of the file.
@@ -133,28 +166,40 @@ bool CertChecker::LoadTrustedCertificatesFromBIO(BIO* bio_in) {
 
   BIO_free(bio_in);
 
-  if (error || !cert_count) {
-    while (!certs_to_add.empty()) {
-      delete certs_to_add.back().second;
-      certs_to_add.pop_back();
-    }
+  if (error || !cert_count)
     return false;
-  }
 
-  size_t new_certs = certs_to_add.size();
-  while (!certs_to_add.empty()) {
-    trusted_.insert(certs_to_add.back());
-    certs_to_add.pop_back();
+  std::atomic_store(&trusted_, shared_ptr<const TrustStore>(store));
+  if (replace) {
+    LOG(INFO) << "Replaced the trusted store with " << new_certs
+              << " certificate(s)";
+  } else {
+    LOG(INFO) << "Added " << new_certs
+              << " new certificate(s) to trusted store";
   }
-  LOG(INFO) << "Added " << new_certs << " new certificate(s) to trusted store";
   return true;
 }
 
 void CertChecker::ClearAllTrustedCertificates() {
-  std::multimap<string, const Cert*>::iterator it = trusted_.begin();
-  for (; it != trusted_.end(); ++it)
-    delete it->second;
-  trusted_.clear();
+  std::lock_guard<std::mutex> lock(trusted_update_lock_);
+  std::atomic_store(&trusted_,
+                    shared_ptr<const TrustStore>(make_shared<TrustStore>()));
+}
+
+shared_ptr<const std::multimap<string, const Cert*>>
+CertChecker::GetTrustedCertificates() const {
+  const shared_ptr<const TrustStore> store(TrustedStore());
+  // Shares the ownership of the whole store.
+  return shared_ptr<const std::multimap<string, const Cert*>>(
+      store, &store->by_subject);
+}
+
+size_t CertChecker::NumTrustedCertificates() const {
+  return TrustedStore()->certs.size();
+}
+
+shared_ptr<const CertChecker::TrustStore> CertChecker::TrustedStore() const {
+  return std::atomic_load(&trusted_);
 }
 
 Status CertChecker::CheckCertChain(CertChain* chain) const {
@@ -190,7 +235,7 @@ Status CertChecker::CheckIssuerChain(CertChain* chain) const {
     return Status(util::error::INTERNAL, "failed to check issuer chain");
   }
 
-  status = chain->IsValidSignatureChain();
+  status = IsValidSignatureChain(*chain);
   if (status == Cert::UNSUPPORTED_ALGORITHM) {
     // UNSUPPORTED_ALGORITHM can happen when a weak algorithm (such as MD2)
     // is intentionally not accepted in which case it's correct to say that
@@ -259,24 +304,33 @@ Status CertChecker::CheckPreCertChain(PreCertChain* chain,
     return Status(util::error::INTERNAL, "internal error");
   }
   // A well-formed chain always has a precert.
-  TbsCertificate tbs(*chain->PreCert());
-  if (!tbs.IsLoaded() ||
-      tbs.DeleteExtension(cert_trans::NID_ctPoison) != Cert::TRUE)
-    return Status(util::error::INTERNAL, "internal error");
-
   // If the issuing cert is the special Precert Signing Certificate,
   // replace the issuer with the one that will sign the final cert.
-  // Should always succeed as we've already verified that the chain
-  // is well-formed.
-  if (uses_pre_issuer == Cert::TRUE &&
-      tbs.CopyIssuerFrom(*chain->PrecertIssuingCert()) != Cert::TRUE)
+  const Cert* const issuer(
+      uses_pre_issuer == Cert::TRUE ? chain->PrecertIssuingCert() : NULL);
+  string der_tbs;
+  const Cert::Status edited(
+      PrecertTbsDerEncoding(*chain->PreCert(), issuer, &der_tbs));
+  if (edited == Cert::ERROR)
     return Status(util::error::INTERNAL, "internal error");
 
+  // Falls back to re-encoding a copy of the precert, which handles
+  // every case the DER encoding cannot simply be edited in.
+  if (edited != Cert::TRUE) {
+    TbsCertificate tbs(*chain->PreCert());
+    if (!tbs.IsLoaded() ||
+        tbs.DeleteExtension(cert_trans::NID_ctPoison) != Cert::TRUE)
+      return Status(util::error::INTERNAL, "internal error");
 
-  string der_tbs;
-  if (tbs.DerEncoding(&der_tbs) != Cert::TRUE)
-    return Status(util::error::INTERNAL,
-                  "could not DER-encode tbs certificate");
+    // Should always succeed as we've already verified that the chain
+    // is well-formed.
+    if (issuer != NULL && tbs.CopyIssuerFrom(*issuer) != Cert::TRUE)
+      return Status(util::error::INTERNAL, "internal error");
+
+    if (tbs.DerEncoding(&der_tbs) != Cert::TRUE)
+      return Status(util::error::INTERNAL,
+                    "could not DER-encode tbs certificate");
+  }
 
   issuer_key_hash->assign(key_hash);
   tbs_certificate->assign(der_tbs);
@@ -291,14 +345,15 @@ CertChecker::CertVerifyResult CertChecker::GetTrustedCa(
     return INTERNAL_ERROR;
   }
 
-  // Look up issuer from the trusted store.
-  if (trusted_.empty()) {
+  // Look up issuer from the trusted store, the same one throughout.
+  const shared_ptr<const TrustStore> store(TrustedStore());
+  if (store->certs.empty()) {
     LOG(WARNING) << "No trusted certificates loaded";
     return ROOT_NOT_IN_LOCAL_STORE;
   }
 
   string subject_name;
-  CertVerifyResult is_trusted = IsTrusted(*subject, &subject_name);
+  CertVerifyResult is_trusted = IsTrusted(*store, *subject, &subject_name);
   // Either an error, or OK, meaning the last cert is in our trusted store.
   // Note the trusted cert need not necessarily be self-signed.
   if (is_trusted != ROOT_NOT_IN_LOCAL_STORE)
@@ -316,17 +371,13 @@ CertChecker::CertVerifyResult CertChecker::GetTrustedCa(
     return ROOT_NOT_IN_LOCAL_STORE;
   }
 
-  std::pair<std::multimap<string, const Cert*>::const_iterator,
-            std::multimap<string, const Cert*>::const_iterator> issuer_range =
-      trusted_.equal_range(issuer_name);
+  const auto issuer_range(store->subject_index.equal_range(issuer_name));
 
   const Cert* issuer = NULL;
-  for (std::multimap<string, const Cert*>::const_iterator it =
-           issuer_range.first;
-       it != issuer_range.second; ++it) {
+  for (auto it = issuer_range.first; it != issuer_range.second; ++it) {
     const Cert* issuer_cand = it->second;
 
-    Cert::Status ok = subject->IsSignedBy(*issuer_cand);
+    Cert::Status ok = IsSignedBy(*subject, *issuer_cand);
     if (ok == Cert::UNSUPPORTED_ALGORITHM) {
       // If the cert's algorithm is unsupported, then there's no point
       // continuing: it's unconditionally invalid.
@@ -356,8 +407,66 @@ CertChecker::CertVerifyResult CertChecker::GetTrustedCa(
   return OK;
 }
 
-CertChecker::CertVerifyResult CertChecker::IsTrusted(
-    const Cert& cert, string* subject_name) const {
+Cert::Status CertChecker::IsValidSignatureChain(
+    const CertChain& chain) const {
+  if (!chain.IsLoaded()) {
+    LOG(ERROR) << "Chain is not loaded";
+    return Cert::ERROR;
+  }
+
+  for (size_t i = 0; i + 1 < chain.Length(); ++i) {
+    const Cert::Status status(
+        IsSignedBy(*chain.CertAt(i), *chain.CertAt(i + 1)));
+    if (status != Cert::TRUE)
+      return status;
+  }
+  return Cert::TRUE;
+}
+
+Cert::Status CertChecker::IsSignedBy(const Cert& subject,
+                                     const Cert& issuer) const {
+  if (FLAGS_cert_checker_signature_cache_entries <= 0)
+    return subject.IsSignedBy(issuer);
+
+  // The digest of the whole subject covers its signature too, and
+  // only good signatures are remembered.
+  string issuer_key_digest, subject_digest;
+  if (issuer.SPKISha256Digest(&issuer_key_digest) != Cert::TRUE ||
+      subject.Sha256Digest(&subject_digest) != Cert::TRUE)
+    return subject.IsSignedBy(issuer);
+  const string key(issuer_key_digest + subject_digest);
+
+  {
+    std::lock_guard<std::mutex> lock(signatures_lock_);
+    const auto it(signatures_.find(key));
+    if (it != signatures_.end()) {
+      signatures_lru_.splice(signatures_lru_.begin(), signatures_lru_,
+                             it->second);
+      return Cert::TRUE;
+    }
+  }
+
+  const Cert::Status status(subject.IsSignedBy(issuer));
+  if (status != Cert::TRUE)
+    return status;
+
+  std::lock_guard<std::mutex> lock(signatures_lock_);
+  if (signatures_.find(key) != signatures_.end())
+    return status;
+  const size_t max_entries(FLAGS_cert_checker_signature_cache_entries);
+  while (signatures_.size() >= max_entries) {
+    signatures_.erase(signatures_lru_.back());
+    signatures_lru_.pop_back();
+  }
+  signatures_lru_.push_front(key);
+  signatures_.emplace(key, signatures_lru_.begin());
+  return status;
+}
+
+/* static */
+CertChecker::CertVerifyResult CertChecker::IsTrusted(const TrustStore& store,
+                                                     const Cert& cert,
+                                                     string* subject_name) {
   string cert_name;
   Cert::Status status = cert.DerEncodedSubjectName(&cert_name);
   if (status == Cert::ERROR)
@@ -367,12 +476,8 @@ CertChecker::CertVerifyResult CertChecker::IsTrusted(
 
   *subject_name = cert_name;
 
-  std::pair<std::multimap<string, const Cert*>::const_iterator,
-            std::multimap<string, const Cert*>::const_iterator> cand_range =
-      trusted_.equal_range(cert_name);
-  for (std::multimap<string, const Cert*>::const_iterator it =
-           cand_range.first;
-       it != cand_range.second; ++it) {
+  const auto cand_range(store.subject_index.equal_range(cert_name));
+  for (auto it = cand_range.first; it != cand_range.second; ++it) {
     const Cert* cand = it->second;
     if (cert.IsIdenticalTo(*cand)) {
       return OK;
@@ -4,8 +4,12 @@
 
 #include <openssl/x509.h>
 
+#include <list>
 #include <map>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 #include "base/macros.h"
@@ -28,7 +32,7 @@ class PreCertChain;
 // (2) we get some spam protection.
 class CertChecker {
  public:
-  CertChecker() = default;
+  CertChecker();
 
   virtual ~CertChecker();
 
@@ -55,16 +59,21 @@ class CertChecker {
   virtual bool LoadTrustedCertificates(
       const std::vector<std::string>& trusted_certs);
 
+  // Replace all the trusted certificates with the ones in
+  // |trusted_cert_file|, if it can be loaded as above. Otherwise,
+  // returns false and keeps the current ones. The chains being checked
+  // meanwhile are checked against either set, never a mix of the two.
+  virtual bool ReloadTrustedCertificates(const std::string& trusted_cert_file);
+
   virtual void ClearAllTrustedCertificates();
 
-  virtual const std::multimap<std::string, const Cert*>&
-  GetTrustedCertificates() const {
-    return trusted_;
-  }
+  // A map by the DER encoding of the subject name. It is never
+  // modified, and keeps the certificates alive, even if the trusted
+  // certificates are changed meanwhile.
+  virtual std::shared_ptr<const std::multimap<std::string, const Cert*>>
+  GetTrustedCertificates() const;
 
-  virtual size_t NumTrustedCertificates() const {
-    return trusted_.size();
-  }
+  virtual size_t NumTrustedCertificates() const;
 
   // Check that:
   // (1) Each certificate is correctly signed by the next one in the chain; and
@@ -93,23 +102,52 @@ class CertChecker {
 
  private:
   util::Status CheckIssuerChain(CertChain* chain) const;
+  // Like CertChain::IsValidSignatureChain(), but through IsSignedBy().
+  Cert::Status IsValidSignatureChain(const CertChain& chain) const;
+  // Like Cert::IsSignedBy(), but remembers the signatures it verified,
+  // as most chains share the same few intermediates.
+  Cert::Status IsSignedBy(const Cert& subject, const Cert& issuer) const;
+  // A set of trusted certificates. It is never modified once it is in
+  // |trusted_|, so that it can be read without locking, and is
+  // replaced as a whole instead.
+  struct TrustStore {
+    // Owns the certificates, which can be shared with the previous and
+    // next stores.
+    std::vector<std::shared_ptr<const Cert>> certs;
+    // By the DER encoding of the subject name, in order.
+    std::multimap<std::string, const Cert*> by_subject;
+    // The same, hashed, for the lookups.
+    std::unordered_multimap<std::string, const Cert*> subject_index;
+  };
+
+  std::shared_ptr<const TrustStore> TrustedStore() const;
+
   // Look issuer up from the trusted store, and verify signature.
   CertVerifyResult GetTrustedCa(CertChain* chain) const;
 
   // Returns OK if the cert is trusted, ROOT_NOT_IN_LOCAL_STORE if it's not,
   // INVALID_CERTIFICATE_CHAIN if something is wrong with the cert, and
   // INTERNAL_ERROR if something terrible happened.
-  CertVerifyResult IsTrusted(const Cert& cert,
-                             std::string* subject_name) const;
+  static CertVerifyResult IsTrusted(const TrustStore& store, const Cert& cert,
+                                    std::string* subject_name);
+
+  // Serializes the changes to |trusted_|, the readers do not need it.
+  std::mutex trusted_update_lock_;
+  // Only accessed through std::atomic_load() and std::atomic_store().
+  std::shared_ptr<const TrustStore> trusted_;
 
-  // A map by the DER encoding of the subject name.
-  // All code manipulating this container must ensure contained elements are
-  // deallocated appropriately.
-  std::multimap<std::string, const Cert*> trusted_;
+  mutable std::mutex signatures_lock_;
+  // The SHA256 digests of the SPKI of the issuer and of the subject
+  // of verified signatures, most recently used first.
+  mutable std::list<std::string> signatures_lru_;
+  mutable std::unordered_map<std::string, std::list<std::string>::iterator>
+      signatures_;
 
   // Helper for LoadTrustedCertificates, whether reading from file or memory.
-  // Takes ownership of bio_in and frees it.
-  bool LoadTrustedCertificatesFromBIO(BIO* bio_in);
+  // Takes ownership of bio_in and frees it. Adds to the current trusted
+  // certificates, or replaces them if |replace| is true.
+  bool LoadTrustedCertificatesFromBIO(BIO* bio_in, bool replace);
+  static BIO* OpenTrustedCertificateFile(const std::string& cert_file);
 
   DISALLOW_COPY_AND_ASSIGN(CertChecker);
 };
@@ -194,6 +194,35 @@ TEST_F(CertCheckerTest, LoadTrustedCertificatesCorruptedFile) {
   EXPECT_EQ(0U, checker_.NumTrustedCertificates());
 }
 
+TEST_F(CertCheckerTest, ReloadTrustedCertificates) {
+  EXPECT_TRUE(checker_.LoadTrustedCertificates(cert_dir_ + "/" + kCaCert));
+  const auto before(checker_.GetTrustedCertificates());
+  ASSERT_EQ(1U, before->size());
+
+  EXPECT_TRUE(checker_.ReloadTrustedCertificates(cert_dir_ + "/" +
+                                                 kIntermediateCert));
+  EXPECT_EQ(1U, checker_.NumTrustedCertificates());
+  // The previous roots are still there for whoever was using them.
+  ASSERT_EQ(1U, before->size());
+  EXPECT_FALSE(before->begin()->second->IsIdenticalTo(
+      *checker_.GetTrustedCertificates()->begin()->second));
+
+  CertChain chain(leaf_pem_);
+  ASSERT_TRUE(chain.IsLoaded());
+  EXPECT_EQ(util::error::FAILED_PRECONDITION,
+            checker_.CheckCertChain(&chain).CanonicalCode());
+
+  // A file which cannot be loaded leaves the roots as they are.
+  EXPECT_FALSE(
+      checker_.ReloadTrustedCertificates(cert_dir_ + "/" + kCorrupted));
+  EXPECT_EQ(1U, checker_.NumTrustedCertificates());
+  EXPECT_TRUE(checker_.ReloadTrustedCertificates(cert_dir_ + "/" + kCaCert));
+
+  CertChain chain2(leaf_pem_);
+  ASSERT_TRUE(chain2.IsLoaded());
+  EXPECT_OK(checker_.CheckCertChain(&chain2));
+}
+
 TEST_F(CertCheckerTest, Certificate) {
   CertChain chain(leaf_pem_);
   ASSERT_TRUE(chain.IsLoaded());
@@ -257,6 +286,22 @@ TEST_F(CertCheckerTest, Intermediates) {
               StatusIs(util::error::INVALID_ARGUMENT));
 }
 
+TEST_F(CertCheckerTest, RepeatedIntermediates) {
+  EXPECT_TRUE(checker_.LoadTrustedCertificates(cert_dir_ + "/" + kCaCert));
+  for (int i = 0; i < 2; ++i) {
+    CertChain chain(chain_leaf_pem_ + intermediate_pem_);
+    ASSERT_TRUE(chain.IsLoaded());
+    EXPECT_OK(checker_.CheckCertChain(&chain));
+    EXPECT_EQ(3U, chain.Length());
+  }
+
+  // Invalid chains through the same intermediate are still rejected.
+  CertChain invalid(leaf_pem_ + intermediate_pem_);
+  ASSERT_TRUE(invalid.IsLoaded());
+  EXPECT_THAT(checker_.CheckCertChain(&invalid),
+              StatusIs(util::error::INVALID_ARGUMENT));
+}
+
 TEST_F(CertCheckerTest, PreCert) {
   const string chain_pem = precert_pem_ + ca_pem_;
   PreCertChain chain(chain_pem);
@@ -13,8 +13,10 @@
 using cert_trans::Cert;
 using cert_trans::CertChain;
 using cert_trans::PreCertChain;
+using cert_trans::PrecertTbsDerEncoding;
 using cert_trans::TbsCertificate;
 using std::string;
+using std::vector;
 
 // TODO(ekasper): add test certs with intermediates.
 // Valid certificates.
@@ -27,6 +29,9 @@ static const char kLeafWithIntermediateCert[] = "test-intermediate-cert.pem";
 static const char kCaPreCert[] = "ca-pre-cert.pem";
 // Issued by ca-cert.pem
 static const char kPreCert[] = "test-embedded-pre-cert.pem";
+// Issued by ca-pre-cert.pem
+static const char kPreCertWithPreCa[] =
+    "test-embedded-with-preca-pre-cert.pem";
 // CA with no basic constraints and an MD2 signature.
 static const char kLegacyCaCert[] = "test-no-bc-ca-cert.pem";
 
@@ -187,6 +192,7 @@ class CertTest : public ::testing::Test {
   string ca_pem_;
   string ca_precert_pem_;
   string precert_pem_;
+  string precert_with_preca_pem_;
   string leaf_with_intermediate_pem_;
   string legacy_ca_pem_;
 
@@ -222,6 +228,8 @@ class CertTest : public ::testing::Test {
     CHECK(util::ReadTextFile(cert_dir + "/" + kCaCert, &ca_pem_));
     CHECK(util::ReadTextFile(cert_dir + "/" + kCaPreCert, &ca_precert_pem_));
     CHECK(util::ReadTextFile(cert_dir + "/" + kPreCert, &precert_pem_));
+    CHECK(util::ReadTextFile(cert_dir + "/" + kPreCertWithPreCa,
+                             &precert_with_preca_pem_));
     CHECK(util::ReadTextFile(cert_dir + "/" + kLeafWithIntermediateCert,
                              &leaf_with_intermediate_pem_));
     CHECK(util::ReadTextFile(cert_dir + "/" + kLegacyCaCert, &legacy_ca_pem_));
@@ -317,6 +325,36 @@ TEST_F(CertTest, LoadInvalidFromDer) {
   EXPECT_FALSE(second.IsLoaded());
 }
 
+TEST_F(CertTest, EncodingsAreRemembered) {
+  Cert cert(leaf_pem_);
+  string der, digest, subject, spki_digest;
+  ASSERT_EQ(Cert::TRUE, cert.DerEncoding(&der));
+  ASSERT_EQ(Cert::TRUE, cert.Sha256Digest(&digest));
+  ASSERT_EQ(Cert::TRUE, cert.DerEncodedSubjectName(&subject));
+  ASSERT_EQ(Cert::TRUE, cert.SPKISha256Digest(&spki_digest));
+
+  string again;
+  EXPECT_EQ(Cert::TRUE, cert.DerEncoding(&again));
+  EXPECT_EQ(der, again);
+  EXPECT_EQ(Cert::TRUE, cert.Sha256Digest(&again));
+  EXPECT_EQ(digest, again);
+
+  // Loading another certificate forgets them.
+  Cert ca(ca_pem_);
+  string ca_der, ca_subject, ca_spki_digest;
+  ASSERT_EQ(Cert::TRUE, ca.DerEncoding(&ca_der));
+  ASSERT_EQ(Cert::TRUE, ca.DerEncodedSubjectName(&ca_subject));
+  ASSERT_EQ(Cert::TRUE, ca.SPKISha256Digest(&ca_spki_digest));
+  ASSERT_EQ(Cert::TRUE, cert.LoadFromDerString(ca_der));
+  EXPECT_EQ(Cert::TRUE, cert.DerEncoding(&again));
+  EXPECT_EQ(ca_der, again);
+  EXPECT_EQ(Cert::TRUE, cert.DerEncodedSubjectName(&again));
+  EXPECT_EQ(ca_subject, again);
+  EXPECT_EQ(Cert::TRUE, cert.SPKISha256Digest(&again));
+  EXPECT_EQ(ca_spki_digest, again);
+  EXPECT_NE(spki_digest, again);
+}
+
 TEST_F(CertTest, PrintSubjectName) {
   Cert leaf(leaf_pem_);
   EXPECT_EQ("C=GB, O=Certificate Transparency, ST=Wales, L=Erw Wen",
@@ -329,6 +367,20 @@ TEST_F(CertTest, PrintIssuerName) {
             leaf.PrintIssuerName());
 }
 
+TEST_F(CertTest, DnsNames) {
+  vector<string> names;
+  Cert common_name_only(v2_wildcard_test5_pem_);
+  EXPECT_EQ(Cert::TRUE, common_name_only.DnsNames(&names));
+  EXPECT_EQ(vector<string>({"?.?.example.com"}), names);
+
+  Cert with_alt_names(v2_wildcard_test7_pem_);
+  EXPECT_EQ(Cert::TRUE, with_alt_names.DnsNames(&names));
+  EXPECT_EQ(vector<string>({"?.example.com", "?.example.com"}), names);
+
+  Cert unloaded;
+  EXPECT_EQ(Cert::ERROR, unloaded.DnsNames(&names));
+}
+
 TEST_F(CertTest, PrintNotBefore) {
   Cert leaf(leaf_pem_);
   EXPECT_EQ("Jun  1 00:00:00 2012 GMT", leaf.PrintNotBefore());
@@ -638,6 +690,46 @@ TEST_F(TbsCertificateTest, CopyIssuer) {
   EXPECT_EQ(der_before2, der_after2);
 }
 
+// Checks that PrecertTbsDerEncoding gives the same TBS as
+// TbsCertificate.
+void ExpectSamePrecertTbs(const Cert& precert, const Cert* issuer) {
+  TbsCertificate tbs(precert);
+  string expected;
+  ASSERT_EQ(Cert::TRUE, tbs.DeleteExtension(cert_trans::NID_ctPoison));
+  if (issuer != NULL)
+    ASSERT_EQ(Cert::TRUE, tbs.CopyIssuerFrom(*issuer));
+  ASSERT_EQ(Cert::TRUE, tbs.DerEncoding(&expected));
+
+  string edited;
+  EXPECT_EQ(Cert::TRUE, PrecertTbsDerEncoding(precert, issuer, &edited));
+  EXPECT_EQ(expected, edited);
+}
+
+TEST_F(TbsCertificateTest, PrecertTbsDerEncoding) {
+  Cert pre(precert_pem_);
+  ExpectSamePrecertTbs(pre, NULL);
+}
+
+TEST_F(TbsCertificateTest, PrecertTbsDerEncodingCopiesIssuer) {
+  Cert pre(precert_with_preca_pem_);
+  Cert ca_pre(ca_precert_pem_);
+  ExpectSamePrecertTbs(pre, &ca_pre);
+
+  // With a different issuer and Authority KeyID.
+  Cert pre2(precert_pem_);
+  Cert different(leaf_with_intermediate_pem_);
+  ExpectSamePrecertTbs(pre2, &different);
+}
+
+TEST_F(TbsCertificateTest, PrecertTbsDerEncodingWithoutPoison) {
+  Cert leaf(leaf_pem_);
+  string der;
+  EXPECT_EQ(Cert::FALSE, PrecertTbsDerEncoding(leaf, NULL, &der));
+
+  Cert not_loaded;
+  EXPECT_EQ(Cert::ERROR, PrecertTbsDerEncoding(not_loaded, NULL, &der));
+}
+
 TEST_F(CertChainTest, LoadValid) {
   // A single certificate.
   CertChain chain(leaf_pem_);
@@ -3,14 +3,18 @@
 
 #include "log/cluster_state_controller.h"
 
+#include <algorithm>
 #include <functional>
 #include <stdint.h>
 
 #include "fetcher/peer.h"
 #include "log/database.h"
 #include "log/etcd_consistent_store.h"
+#include "log/log_signer.h"
 #include "monitoring/monitoring.h"
+#include "net/url_fetcher.h"
 #include "proto/ct.pb.h"
+#include "util/util.h"
 
 
 namespace cert_trans {
@@ -24,6 +28,16 @@ Gauge<>* serving_tree_timestamp =
     Gauge<>::New("serving_tree_timestamp",
                  "Timestamp of the current serving STH");
 
+Histogram<>* local_sth_serving_delay_ms(Histogram<>::New(
+    "local_sth_serving_delay_ms",
+    "Time from this node signing an STH for a larger tree than the serving "
+    "one to the cluster serving one at least that large, in milliseconds."));
+
+// How many of the STHs this node signed are kept until they are
+// served, for local_sth_serving_delay_ms, after which the oldest are
+// dropped.
+const size_t kMaxUnservedSTHs = 1024;
+
 
 std::unique_ptr<AsyncLogClient> BuildAsyncLogClient(
     const std::shared_ptr<libevent::Base>& base, UrlFetcher* fetcher,
@@ -39,6 +53,26 @@ std::unique_ptr<AsyncLogClient> BuildAsyncLogClient(
 }
 
 
+bool SameAddress(const ct::ClusterNodeState& a,
+                 const ct::ClusterNodeState& b) {
+  return a.hostname() == b.hostname() && a.log_port() == b.log_port();
+}
+
+
+void GossipDone(UrlFetcher::Response* resp, util::Task* task) {
+  std::unique_ptr<UrlFetcher::Response> resp_deleter(CHECK_NOTNULL(resp));
+  std::unique_ptr<util::Task> task_deleter(CHECK_NOTNULL(task));
+
+  // The node will hear of the STH from another one, or from the
+  // consistent store.
+  VLOG_IF(1, !task->status().ok()) << "Couldn't gossip node state: "
+                                   << task->status();
+  VLOG_IF(1, task->status().ok() && resp->status_code != 200)
+      << "Gossiped node state not taken: " << resp->status_code << " "
+      << resp->body;
+}
+
+
 }  // namespace
 
 
@@ -90,15 +124,20 @@ ClusterStateController<Logged>::ClusterStateController(
     UrlFetcher* url_fetcher, Database<Logged>* database,
     ConsistentStore<Logged>* store, MasterElection* election,
     ContinuousFetcher* fetcher)
-    : base_(base),
+    : executor_(CHECK_NOTNULL(executor)),
+      base_(base),
       url_fetcher_(CHECK_NOTNULL(url_fetcher)),
       database_(CHECK_NOTNULL(database)),
       store_(CHECK_NOTNULL(store)),
       election_(CHECK_NOTNULL(election)),
       fetcher_(CHECK_NOTNULL(fetcher)),
-      watch_config_task_(CHECK_NOTNULL(executor)),
+      watch_config_task_(executor),
       watch_node_states_task_(CHECK_NOTNULL(executor)),
       watch_serving_sth_task_(CHECK_NOTNULL(executor)),
+      mutex_("cluster_state_controller"),
+      gossip_verifier_(nullptr),
+      gossip_fanout_(0),
+      gossip_random_(std::random_device()()),
       exiting_(false),
       update_required_(false),
       cluster_serving_sth_update_thread_(
@@ -126,7 +165,7 @@ ClusterStateController<Logged>::~ClusterStateController() {
   watch_node_states_task_.Cancel();
   watch_serving_sth_task_.Cancel();
   {
-    std::lock_guard<std::mutex> lock(mutex_);
+    std::lock_guard<Mutex> lock(mutex_);
     exiting_ = true;
   }
   update_required_cv_.notify_all();
@@ -140,7 +179,7 @@ ClusterStateController<Logged>::~ClusterStateController() {
 template <class Logged>
 void ClusterStateController<Logged>::NewTreeHead(
     const ct::SignedTreeHead& sth) {
-  std::unique_lock<std::mutex> lock(mutex_);
+  std::unique_lock<Mutex> lock(mutex_);
   ct::SignedTreeHead db_sth;
   const typename Database<Logged>::LookupResult result(
       database_->LatestTreeHead(&db_sth));
@@ -161,7 +200,25 @@ void ClusterStateController<Logged>::NewTreeHead(
     CHECK_GE(sth.timestamp(), local_node_state_.newest_sth().timestamp());
   }
   local_node_state_.mutable_newest_sth()->CopyFrom(sth);
-  PushLocalNodeState(lock);
+  if (!actual_serving_sth_ ||
+      sth.tree_size() > actual_serving_sth_->tree_size()) {
+    unserved_sths_.emplace(sth.tree_size(), sth.timestamp());
+    if (unserved_sths_.size() > kMaxUnservedSTHs) {
+      unserved_sths_.erase(unserved_sths_.begin());
+    }
+  }
+  const std::shared_ptr<ClusterPeer> self(gossip_verifier_ ? FindSelf(lock)
+                                                            : nullptr);
+  if (self) {
+    // The consistent store gets it with the next RefreshNodeState().
+    ct::ClusterNodeState new_state(self->state());
+    new_state.mutable_newest_sth()->CopyFrom(sth);
+    UpdatePeerState(lock, self.get(), new_state);
+    Gossip(lock, new_state);
+    CalculateServingSTH(lock);
+  } else {
+    PushLocalNodeState(lock);
+  }
 
   ct::SignedTreeHead sth_to_write;
   if (write_sth) {
@@ -186,7 +243,7 @@ void ClusterStateController<Logged>::NewTreeHead(
 template <class Logged>
 util::StatusOr<ct::SignedTreeHead>
 ClusterStateController<Logged>::GetCalculatedServingSTH() const {
-  std::lock_guard<std::mutex> lock(mutex_);
+  std::lock_guard<Mutex> lock(mutex_);
   if (!calculated_serving_sth_) {
     return util::StatusOr<ct::SignedTreeHead>(
         util::Status(util::error::NOT_FOUND, "No calculated STH"));
@@ -199,7 +256,7 @@ template <class Logged>
 void ClusterStateController<Logged>::GetLocalNodeState(
     ct::ClusterNodeState* state) const {
   CHECK_NOTNULL(state);
-  std::lock_guard<std::mutex> lock(mutex_);
+  std::lock_guard<Mutex> lock(mutex_);
   *state = local_node_state_;
 }
 
@@ -207,7 +264,7 @@ void ClusterStateController<Logged>::GetLocalNodeState(
 template <class Logged>
 void ClusterStateController<Logged>::SetNodeHostPort(const std::string& host,
                                                      const uint16_t port) {
-  std::unique_lock<std::mutex> lock(mutex_);
+  std::unique_lock<Mutex> lock(mutex_);
   local_node_state_.set_hostname(host);
   local_node_state_.set_log_port(port);
   PushLocalNodeState(lock);
@@ -216,14 +273,14 @@ void ClusterStateController<Logged>::SetNodeHostPort(const std::string& host,
 
 template <class Logged>
 void ClusterStateController<Logged>::RefreshNodeState() {
-  std::unique_lock<std::mutex> lock(mutex_);
+  std::unique_lock<Mutex> lock(mutex_);
   PushLocalNodeState(lock);
 }
 
 
 template <class Logged>
 bool ClusterStateController<Logged>::NodeIsStale() const {
-  std::lock_guard<std::mutex> lock(mutex_);
+  std::lock_guard<Mutex> lock(mutex_);
   if (!actual_serving_sth_) {
     return true;
   }
@@ -234,7 +291,7 @@ bool ClusterStateController<Logged>::NodeIsStale() const {
 template <class Logged>
 std::vector<ct::ClusterNodeState>
 ClusterStateController<Logged>::GetFreshNodes() const {
-  std::lock_guard<std::mutex> lock(mutex_);
+  std::lock_guard<Mutex> lock(mutex_);
   if (!actual_serving_sth_) {
     LOG(WARNING) << "Cluster has no ServingSTH, all nodes are stale.";
     return {};
@@ -256,9 +313,61 @@ ClusterStateController<Logged>::GetFreshNodes() const {
 }
 
 
+template <class Logged>
+void ClusterStateController<Logged>::EnableGossip(
+    const LogSigVerifier* verifier, const std::string& path, int fanout) {
+  CHECK_NOTNULL(verifier);
+  CHECK(!path.empty() && path.front() == '/') << path;
+  CHECK_LT(0, fanout);
+  std::lock_guard<Mutex> lock(mutex_);
+  gossip_verifier_ = verifier;
+  gossip_path_ = path;
+  gossip_fanout_ = fanout;
+}
+
+
+template <class Logged>
+util::Status ClusterStateController<Logged>::ReceiveGossip(
+    const ct::ClusterNodeState& state) {
+  std::unique_lock<Mutex> lock(mutex_);
+  if (!gossip_verifier_) {
+    return util::Status(util::error::FAILED_PRECONDITION,
+                        "Gossip is disabled.");
+  }
+  if (!state.has_newest_sth()) {
+    return util::Status(util::error::INVALID_ARGUMENT, "No STH.");
+  }
+  // The nodes join the cluster through the consistent store.
+  const std::shared_ptr<ClusterPeer> peer(FindPeer(lock, state.node_id()));
+  if (!peer) {
+    return util::Status(util::error::NOT_FOUND, "Unknown node.");
+  }
+
+  ct::ClusterNodeState new_state(peer->state());
+  if (new_state.has_newest_sth() &&
+      state.newest_sth().timestamp() <= new_state.newest_sth().timestamp()) {
+    // Already heard of, and passed on.
+    return util::Status::OK;
+  }
+  if (gossip_verifier_->VerifySTHSignature(state.newest_sth()) !=
+      LogSigVerifier::OK) {
+    return util::Status(util::error::INVALID_ARGUMENT,
+                        "Invalid STH signature.");
+  }
+
+  // Only the STH is signed, the rest of the state is as the
+  // consistent store has it.
+  new_state.mutable_newest_sth()->CopyFrom(state.newest_sth());
+  UpdatePeerState(lock, peer.get(), new_state);
+  Gossip(lock, new_state);
+  CalculateServingSTH(lock);
+  return util::Status::OK;
+}
+
+
 template <class Logged>
 void ClusterStateController<Logged>::PushLocalNodeState(
-    const std::unique_lock<std::mutex>& lock) {
+    const std::unique_lock<Mutex>& lock) {
   CHECK(lock.owns_lock());
 
   const util::Status status(store_->SetClusterNodeState(local_node_state_));
@@ -266,32 +375,133 @@ void ClusterStateController<Logged>::PushLocalNodeState(
 }
 
 
+template <class Logged>
+std::shared_ptr<typename ClusterStateController<Logged>::ClusterPeer>
+ClusterStateController<Logged>::FindPeer(const std::unique_lock<Mutex>& lock,
+                                         const std::string& node_id) const {
+  CHECK(lock.owns_lock());
+  if (node_id.empty()) {
+    return nullptr;
+  }
+  for (const auto& node : all_peers_) {
+    if (node.second->state().node_id() == node_id) {
+      return node.second;
+    }
+  }
+  return nullptr;
+}
+
+
+template <class Logged>
+std::shared_ptr<typename ClusterStateController<Logged>::ClusterPeer>
+ClusterStateController<Logged>::FindSelf(
+    const std::unique_lock<Mutex>& lock) const {
+  CHECK(lock.owns_lock());
+  for (const auto& node : all_peers_) {
+    if (SameAddress(node.second->state(), local_node_state_)) {
+      return node.second;
+    }
+  }
+  return nullptr;
+}
+
+
+template <class Logged>
+void ClusterStateController<Logged>::UpdatePeerState(
+    const std::unique_lock<Mutex>& lock, ClusterPeer* peer,
+    const ct::ClusterNodeState& new_state) {
+  CHECK(lock.owns_lock());
+  const ct::ClusterNodeState old_state(peer->state());
+  AddNodeSTH(lock, new_state);
+  RemoveNodeSTH(lock, old_state);
+  peer->UpdateClusterNodeState(new_state);
+  // The node states are watched, or gossiped, so this hears about
+  // newly sequenced entries as soon as their STH is written, without
+  // waiting for the fetcher to poll.
+  if (new_state.newest_sth().tree_size() >
+      old_state.newest_sth().tree_size()) {
+    fetcher_->NewEntriesAvailable();
+  }
+}
+
+
+template <class Logged>
+void ClusterStateController<Logged>::Gossip(
+    const std::unique_lock<Mutex>& lock, const ct::ClusterNodeState& state) {
+  CHECK(lock.owns_lock());
+  std::vector<std::pair<std::string, int>> targets;
+  for (const auto& node : all_peers_) {
+    const ct::ClusterNodeState peer_state(node.second->state());
+    if (peer_state.node_id() != state.node_id() &&
+        !SameAddress(peer_state, local_node_state_)) {
+      targets.emplace_back(peer_state.hostname(), peer_state.log_port());
+    }
+  }
+  std::shuffle(targets.begin(), targets.end(), gossip_random_);
+  if (targets.size() > static_cast<size_t>(gossip_fanout_)) {
+    targets.resize(gossip_fanout_);
+  }
+
+  std::string flat_state;
+  CHECK(state.SerializeToString(&flat_state));
+  for (const auto& target : targets) {
+    UrlFetcher::Request req(URL("http://" + target.first + ":" +
+                                std::to_string(target.second) +
+                                gossip_path_));
+    req.verb = UrlFetcher::Verb::POST;
+    req.body = flat_state;
+    UrlFetcher::Response* const resp(new UrlFetcher::Response);
+    url_fetcher_->Fetch(req, resp,
+                        new util::Task(std::bind(&GossipDone, resp,
+                                                 std::placeholders::_1),
+                                       executor_));
+  }
+}
+
+
 template <class Logged>
 void ClusterStateController<Logged>::OnClusterStateUpdated(
     const std::vector<Update<ct::ClusterNodeState>>& updates) {
-  std::unique_lock<std::mutex> lock(mutex_);
+  std::unique_lock<Mutex> lock(mutex_);
+  bool changed(false);
   for (const auto& update : updates) {
     const std::string& node_id(update.handle_.Key());
     if (update.exists_) {
       auto it(all_peers_.find(node_id));
+      ct::ClusterNodeState new_state(update.handle_.Entry());
+      // Nodes that gossip write their newest STH to the consistent
+      // store after sending it to the others.
+      if (gossip_verifier_ && it != all_peers_.end() &&
+          SameAddress(it->second->state(), new_state) &&
+          it->second->state().newest_sth().timestamp() >
+              new_state.newest_sth().timestamp()) {
+        new_state.mutable_newest_sth()->CopyFrom(
+            it->second->state().newest_sth());
+      }
+      // A node rewriting the same state only extended its TTL.
+      if (it != all_peers_.end() &&
+          it->second->state().SerializeAsString() ==
+              new_state.SerializeAsString()) {
+        continue;
+      }
+      changed = true;
       VLOG_IF(1, it == all_peers_.end()) << "Node joined: " << node_id;
 
       // If the host or port change, remove the ClusterPeer, so that
       // we re-create it.
       if (it != all_peers_.end() &&
-          it->second->GetHostPort() !=
-              std::make_pair(update.handle_.Entry().hostname(),
-                             update.handle_.Entry().log_port())) {
+          !SameAddress(it->second->state(), new_state)) {
+        RemoveNodeSTH(lock, it->second->state());
         all_peers_.erase(it);
         it = all_peers_.end();
       }
 
       if (it != all_peers_.end()) {
-        it->second->UpdateClusterNodeState(update.handle_.Entry());
+        UpdatePeerState(lock, it->second.get(), new_state);
       } else {
+        AddNodeSTH(lock, new_state);
         const std::shared_ptr<ClusterPeer> peer(
-            std::make_shared<ClusterPeer>(base_, url_fetcher_,
-                                          update.handle_.Entry()));
+            std::make_shared<ClusterPeer>(base_, url_fetcher_, new_state));
         // TODO(pphaneuf): all_peers_ and fetcher_ both maintain a
         // list of cluster members, this should be split off into its
         // own class, and share an instance between the interested
@@ -301,19 +511,25 @@ void ClusterStateController<Logged>::OnClusterStateUpdated(
       }
     } else {
       VLOG(1) << "Node left: " << node_id;
-      CHECK_EQ(1, all_peers_.erase(node_id));
+      const auto it(all_peers_.find(node_id));
+      CHECK(it != all_peers_.end()) << node_id;
+      RemoveNodeSTH(lock, it->second->state());
+      all_peers_.erase(it);
       fetcher_->RemovePeer(node_id);
+      changed = true;
     }
   }
 
-  CalculateServingSTH(lock);
+  if (changed) {
+    CalculateServingSTH(lock);
+  }
 }
 
 
 template <class Logged>
 void ClusterStateController<Logged>::OnClusterConfigUpdated(
     const Update<ct::ClusterConfig>& update) {
-  std::unique_lock<std::mutex> lock(mutex_);
+  std::unique_lock<Mutex> lock(mutex_);
   if (!update.exists_) {
     LOG(WARNING) << "No ClusterConfig exists.";
     return;
@@ -329,10 +545,25 @@ void ClusterStateController<Logged>::OnClusterConfigUpdated(
 }
 
 
+template <class Logged>
+void ClusterStateController<Logged>::RecordServedSTHs(
+    const std::unique_lock<Mutex>& lock) {
+  CHECK(lock.owns_lock());
+  CHECK(actual_serving_sth_);
+  const uint64_t now(util::TimeInMilliseconds());
+  while (!unserved_sths_.empty() &&
+         unserved_sths_.begin()->first <= actual_serving_sth_->tree_size()) {
+    const uint64_t signed_at(unserved_sths_.begin()->second);
+    local_sth_serving_delay_ms->Record(now > signed_at ? now - signed_at : 0);
+    unserved_sths_.erase(unserved_sths_.begin());
+  }
+}
+
+
 template <class Logged>
 void ClusterStateController<Logged>::OnServingSthUpdated(
     const Update<ct::SignedTreeHead>& update) {
-  std::unique_lock<std::mutex> lock(mutex_);
+  std::unique_lock<Mutex> lock(mutex_);
   bool write_sth(true);
 
   if (!update.exists_) {
@@ -352,6 +583,7 @@ void ClusterStateController<Logged>::OnServingSthUpdated(
               << actual_serving_sth_->ShortDebugString();
     serving_tree_size->Set(actual_serving_sth_->tree_size());
     serving_tree_timestamp->Set(actual_serving_sth_->timestamp());
+    RecordServedSTHs(lock);
 
     // Double check this STH is newer than, or idential to, what we have in
     // the database. (It definitely should be!)
@@ -409,34 +641,64 @@ void ClusterStateController<Logged>::OnServingSthUpdated(
 
 
 template <class Logged>
-void ClusterStateController<Logged>::CalculateServingSTH(
-    const std::unique_lock<std::mutex>& lock) {
-  VLOG(1) << "Calculating new ServingSTH...";
+void ClusterStateController<Logged>::AddNodeSTH(
+    const std::unique_lock<Mutex>& lock,
+    const ct::ClusterNodeState& state) {
   CHECK(lock.owns_lock());
+  if (!state.has_newest_sth()) {
+    return;
+  }
+  const int64_t tree_size(state.newest_sth().tree_size());
+  CHECK_LE(0, tree_size);
+  const int64_t timestamp(state.newest_sth().timestamp());
+  CHECK_LE(0, timestamp);
+
+  ++num_nodes_by_sth_size_[tree_size];
+  const auto it(sths_by_size_[tree_size]
+                    .emplace(timestamp,
+                             NodesWithSTH{state.newest_sth(), 0})
+                    .first);
+  ++it->second.num_nodes;
+}
 
-  // First, create a mapping of tree size to number of nodes at that size, and
-  // a mapping of the newst STH for any given size:
-  std::map<int64_t, ct::SignedTreeHead> sth_by_size;
-  std::map<int64_t, int> num_nodes_by_sth_size;
-  for (const auto& node : all_peers_) {
-    const ct::ClusterNodeState node_state(node.second->state());
-    if (node_state.has_newest_sth()) {
-      const int64_t tree_size(node_state.newest_sth().tree_size());
-      CHECK_LE(0, tree_size);
-      const int64_t timestamp(node_state.newest_sth().timestamp());
-      CHECK_LE(0, timestamp);
-
-      num_nodes_by_sth_size[tree_size]++;
-
-      // Default timestamp (first call in here) will be 0
-      if (node_state.newest_sth().timestamp() >
-          sth_by_size[tree_size].timestamp()) {
-        sth_by_size[tree_size] = node_state.newest_sth();
-      }
+
+template <class Logged>
+void ClusterStateController<Logged>::RemoveNodeSTH(
+    const std::unique_lock<Mutex>& lock,
+    const ct::ClusterNodeState& state) {
+  CHECK(lock.owns_lock());
+  if (!state.has_newest_sth()) {
+    return;
+  }
+  const int64_t tree_size(state.newest_sth().tree_size());
+  const int64_t timestamp(state.newest_sth().timestamp());
+
+  const auto num_nodes(num_nodes_by_sth_size_.find(tree_size));
+  CHECK(num_nodes != num_nodes_by_sth_size_.end());
+  if (--num_nodes->second == 0) {
+    num_nodes_by_sth_size_.erase(num_nodes);
+  }
+
+  const auto sths(sths_by_size_.find(tree_size));
+  CHECK(sths != sths_by_size_.end());
+  const auto it(sths->second.find(timestamp));
+  CHECK(it != sths->second.end());
+  if (--it->second.num_nodes == 0) {
+    sths->second.erase(it);
+    if (sths->second.empty()) {
+      sths_by_size_.erase(sths);
     }
   }
+}
+
+
+template <class Logged>
+void ClusterStateController<Logged>::CalculateServingSTH(
+    const std::unique_lock<Mutex>& lock) {
+  VLOG(1) << "Calculating new ServingSTH...";
+  CHECK(lock.owns_lock());
 
-  // Next calculate the newest STH we've seen which satisfies the following
+  // Calculate the newest STH we've seen which satisfies the following
   // criteria:
   //   - at least minimum_serving_nodes have an STH at least as large
   //   - at least minimum_serving_fraction have an STH at least as large
@@ -451,8 +713,8 @@ void ClusterStateController<Logged>::CalculateServingSTH(
   // Work backwards (from largest STH size) until we see that there's enough
   // coverage (according to the criteria above) to serve an STH (or determine
   // that there are insufficient nodes to serve anything.)
-  for (auto it = num_nodes_by_sth_size.rbegin();
-       it != num_nodes_by_sth_size.rend() && it->first >= current_tree_size;
+  for (auto it = num_nodes_by_sth_size_.rbegin();
+       it != num_nodes_by_sth_size_.rend() && it->first >= current_tree_size;
        ++it) {
     // num_nodes_seen keeps track of the number of nodes we've seen so far (and
     // since we're working from larger to smaller size STH, they should all be
@@ -462,7 +724,9 @@ void ClusterStateController<Logged>::CalculateServingSTH(
                                   all_peers_.size());
     if (serving_fraction >= cluster_config_.minimum_serving_fraction() &&
         num_nodes_seen >= cluster_config_.minimum_serving_nodes()) {
-      const ct::SignedTreeHead& candidate_sth(sth_by_size[it->first]);
+      // The newest STH at this size.
+      const ct::SignedTreeHead& candidate_sth(
+          sths_by_size_.at(it->first).rbegin()->second.sth);
 
       // This STH isn't a viable candidate unless its timestamp is strictly
       // newer than any current serving STH:
@@ -478,8 +742,7 @@ void ClusterStateController<Logged>::CalculateServingSTH(
 
       LOG(INFO) << "Can serve @" << it->first << " with " << num_nodes_seen
                 << " nodes (" << (serving_fraction * 100) << "% of cluster)";
-      calculated_serving_sth_.reset(
-          new ct::SignedTreeHead(sth_by_size[it->first]));
+      calculated_serving_sth_.reset(new ct::SignedTreeHead(candidate_sth));
       // Push this STH out to the cluster if we're master:
       if (election_->IsMaster()) {
         VLOG(1) << "Pushing new STH out to cluster";
@@ -506,7 +769,7 @@ template <class Logged>
 void ClusterStateController<Logged>::ClusterServingSTHUpdater() {
   while (true) {
     VLOG(1) << "ClusterServingSTHUpdater going again.";
-    std::unique_lock<std::mutex> lock(mutex_);
+    std::unique_lock<Mutex> lock(mutex_);
     update_required_cv_.wait(lock, [this]() {
       return update_required_ || exiting_;
     });
@@ -6,10 +6,12 @@
 #include <map>
 #include <memory>
 #include <queue>
+#include <random>
 #include <string>
 
 #include "fetcher/continuous_fetcher.h"
 #include "log/etcd_consistent_store.h"
+#include "monitoring/instrumented_mutex.h"
 #include "proto/ct.pb.h"
 #include "util/libevent_wrapper.h"
 #include "util/masterelection.h"
@@ -17,6 +19,7 @@
 
 template <class Logged>
 class Database;
+class LogSigVerifier;
 
 namespace cert_trans {
 
@@ -69,11 +72,51 @@ class ClusterStateController {
   // returned list regardless of its freshness.
   std::vector<ct::ClusterNodeState> GetFreshNodes() const;
 
+  // Has this node send its new STHs straight to up to |fanout| other
+  // nodes, at |path| on their log port, which pass on the ones they
+  // had not heard of in the same way. They are then only written to
+  // the consistent store by RefreshNodeState(), so that its watchers
+  // do not hear of every STH of every node. The gossiped STHs are
+  // checked with |verifier|, which must outlive this instance. The
+  // nodes still join and leave the cluster through the consistent
+  // store.
+  void EnableGossip(const LogSigVerifier* verifier, const std::string& path,
+                    int fanout);
+
+  // Takes the newest STH of |state|, gossiped by another node, if it
+  // is newer than the one known for that node, and passes it on.
+  util::Status ReceiveGossip(const ct::ClusterNodeState& state);
+
  private:
+  typedef InstrumentedMutex<> Mutex;
+
   class ClusterPeer;
 
+  // The nodes which have a given newest STH.
+  struct NodesWithSTH {
+    ct::SignedTreeHead sth;
+    int num_nodes;
+  };
+
   // Updates the representation of *this* node's state in the consistent store.
-  void PushLocalNodeState(const std::unique_lock<std::mutex>& lock);
+  void PushLocalNodeState(const std::unique_lock<Mutex>& lock);
+
+  // Returns the node in |all_peers_| with |node_id|, or the one with
+  // the address of this node, or null if there is none.
+  std::shared_ptr<ClusterPeer> FindPeer(const std::unique_lock<Mutex>& lock,
+                                        const std::string& node_id) const;
+  std::shared_ptr<ClusterPeer> FindSelf(
+      const std::unique_lock<Mutex>& lock) const;
+
+  // Replaces the state of |peer|, one of |all_peers_|, with
+  // |new_state|, keeping the indexes up to date.
+  void UpdatePeerState(const std::unique_lock<Mutex>& lock, ClusterPeer* peer,
+                       const ct::ClusterNodeState& new_state);
+
+  // Sends |state| to up to |gossip_fanout_| nodes, other than this one
+  // and the one it is the state of.
+  void Gossip(const std::unique_lock<Mutex>& lock,
+              const ct::ClusterNodeState& state);
 
   // Entry point for the watcher callback.
   // Called whenever a node changes its node state.
@@ -88,20 +131,31 @@ class ClusterStateController {
   // Called whenever the ClusterConfig is changed.
   void OnServingSthUpdated(const Update<ct::SignedTreeHead>& update);
 
+  // Records how long the STHs in |unserved_sths_| that the serving STH
+  // now covers took to be served, and forgets them.
+  void RecordServedSTHs(const std::unique_lock<Mutex>& lock);
+
+  // Add or remove the newest STH of |state| to or from the indexes
+  // used by CalculateServingSTH().
+  void AddNodeSTH(const std::unique_lock<Mutex>& lock,
+                  const ct::ClusterNodeState& state);
+  void RemoveNodeSTH(const std::unique_lock<Mutex>& lock,
+                     const ct::ClusterNodeState& state);
+
   // Calculates the STH which should be served by the cluster, given the
   // current state of the nodes.
   // If this node is the cluster master then the calculated serving STH is
   // pushed out to the consistent store.
-  void CalculateServingSTH(const std::unique_lock<std::mutex>& lock);
+  void CalculateServingSTH(const std::unique_lock<Mutex>& lock);
 
   // Determines whether this node should be participating in the election based
   // on the current node's state.
-  void DetermineElectionParticipation(
-      const std::unique_lock<std::mutex>& lock);
+  void DetermineElectionParticipation(const std::unique_lock<Mutex>& lock);
 
   // Thread entry point for ServingSTH updater thread.
   void ClusterServingSTHUpdater();
 
+  util::Executor* const executor_;        // Not owned by us
   const std::shared_ptr<libevent::Base> base_;
   UrlFetcher* const url_fetcher_;         // Not owned by us
   Database<Logged>* const database_;      // Not owned by us
@@ -113,14 +167,27 @@ class ClusterStateController {
   util::SyncTask watch_serving_sth_task_;
   ct::ClusterConfig cluster_config_;
 
-  mutable std::mutex mutex_;  // covers the members below:
+  mutable Mutex mutex_;  // covers the members below:
   ct::ClusterNodeState local_node_state_;
+  // The timestamps of the first STHs this node signed at each tree
+  // size not served yet, by tree size.
+  std::map<int64_t, uint64_t> unserved_sths_;
   std::map<std::string, const std::shared_ptr<ClusterPeer>> all_peers_;
+  // The newest STHs of the nodes in |all_peers_|, by tree size and
+  // then timestamp, and the number of nodes at each tree size, kept
+  // up to date as their states change.
+  std::map<int64_t, std::map<int64_t, NodesWithSTH>> sths_by_size_;
+  std::map<int64_t, int> num_nodes_by_sth_size_;
   std::unique_ptr<ct::SignedTreeHead> calculated_serving_sth_;
   std::unique_ptr<ct::SignedTreeHead> actual_serving_sth_;
+  // Set by EnableGossip(), null if the nodes do not gossip.
+  const LogSigVerifier* gossip_verifier_;
+  std::string gossip_path_;
+  int gossip_fanout_;
+  std::mt19937 gossip_random_;
   bool exiting_;
   bool update_required_;
-  std::condition_variable update_required_cv_;
+  std::condition_variable_any update_required_cv_;
   std::thread cluster_serving_sth_update_thread_;
 
   friend class ClusterStateControllerTest;
@@ -8,6 +8,7 @@
 #include "log/cluster_state_controller-inl.h"
 #include "log/logged_certificate.h"
 #include "log/test_db.h"
+#include "log/test_signer.h"
 #include "net/mock_url_fetcher.h"
 #include "proto/ct.pb.h"
 #include "util/fake_etcd.h"
@@ -23,8 +24,10 @@ using ct::SignedTreeHead;
 using std::make_shared;
 using std::shared_ptr;
 using std::string;
+using std::unique_ptr;
 using std::vector;
 using testing::AnyNumber;
+using testing::Invoke;
 using testing::NiceMock;
 using testing::Return;
 using testing::_;
@@ -68,6 +71,7 @@ class ClusterStateControllerTest : public ::testing::Test {
     // this test, but this isn't what we're testing here, so just
     // ignore them.
     EXPECT_CALL(fetcher_, AddPeer(_, _)).Times(AnyNumber());
+    EXPECT_CALL(fetcher_, NewEntriesAvailable()).Times(AnyNumber());
 
     // Set default cluster config:
     ct::ClusterConfig default_config;
@@ -106,8 +110,14 @@ class ClusterStateControllerTest : public ::testing::Test {
   // TODO: This should probably return a util::StatusOr<ClusterNodeState>
   // rather than failing a CHECK if absent.
   ct::ClusterNodeState GetNodeStateView(const string& node_id) {
-    auto it(controller_.all_peers_.find("/nodes/" + node_id));
-    CHECK(it != controller_.all_peers_.end());
+    return GetNodeStateView(controller_, node_id);
+  }
+
+  static ct::ClusterNodeState GetNodeStateView(
+      const ClusterStateController<LoggedCertificate>& controller,
+      const string& node_id) {
+    auto it(controller.all_peers_.find("/nodes/" + node_id));
+    CHECK(it != controller.all_peers_.end());
     return it->second->state();
   }
 
@@ -529,6 +539,23 @@ TEST_F(ClusterStateControllerTest, TestNodeHostPort) {
 }
 
 
+TEST_F(ClusterStateControllerTest, TestFetchesWhenPeerTreeGrows) {
+  store2_->SetClusterNodeState(cns200_);
+  sleep(1);
+
+  // Only growing the tree wakes up the fetcher.
+  EXPECT_CALL(fetcher_, NewEntriesAvailable()).Times(1);
+  ClusterNodeState grown(cns200_);
+  grown.mutable_newest_sth()->CopyFrom(sth300_);
+  store2_->SetClusterNodeState(grown);
+  sleep(1);
+
+  // Rewriting the same state doesn't.
+  store2_->SetClusterNodeState(grown);
+  sleep(1);
+}
+
+
 TEST_F(ClusterStateControllerTest, TestStoresServingSthInDatabase) {
   SignedTreeHead sth;
   sth.set_timestamp(10000);
@@ -545,6 +572,34 @@ TEST_F(ClusterStateControllerTest, TestStoresServingSthInDatabase) {
 }
 
 
+TEST_F(ClusterStateControllerTest, TestRecordsServingDelay) {
+  const uint64_t before(local_sth_serving_delay_ms->GetDistribution().Count());
+  SignedTreeHead sth;
+  sth.set_timestamp(util::TimeInMilliseconds());
+  sth.set_tree_size(5);
+  controller_.NewTreeHead(sth);
+  // Not a new tree size, so not counted again.
+  sth.set_timestamp(sth.timestamp() + 1);
+  controller_.NewTreeHead(sth);
+  sth.set_timestamp(sth.timestamp() + 1);
+  sth.set_tree_size(10);
+  controller_.NewTreeHead(sth);
+
+  SignedTreeHead serving_sth;
+  serving_sth.set_timestamp(sth.timestamp());
+  serving_sth.set_tree_size(7);
+  store1_->SetServingSTH(serving_sth);
+  sleep(1);
+  EXPECT_EQ(before + 1, local_sth_serving_delay_ms->GetDistribution().Count());
+
+  serving_sth.set_timestamp(serving_sth.timestamp() + 1);
+  serving_sth.set_tree_size(10);
+  store1_->SetServingSTH(serving_sth);
+  sleep(1);
+  EXPECT_EQ(before + 2, local_sth_serving_delay_ms->GetDistribution().Count());
+}
+
+
 TEST_F(ClusterStateControllerTest, TestWaitsToStoreSTHInDatabaseWhenStale) {
   SignedTreeHead sth1;
   sth1.set_timestamp(10000);
@@ -671,6 +726,57 @@ TEST_F(ClusterStateControllerTest, TestGetFreshNodes) {
 }
 
 
+TEST_F(ClusterStateControllerTest, TestGossipsNewTreeHeads) {
+  const unique_ptr<LogSigner> signer(TestSigner::DefaultLogSigner());
+  const unique_ptr<LogSigVerifier> verifier(
+      TestSigner::DefaultLogSigVerifier());
+  ClusterStateController<LoggedCertificate> c2(&pool_, base_, &url_fetcher_,
+                                               test_db_.db(), store2_.get(),
+                                               &election2_, &fetcher_);
+  controller_.EnableGossip(verifier.get(), "/gossip", 2);
+  c2.EnableGossip(verifier.get(), "/gossip", 2);
+  c2.SetNodeHostPort(kNodeId2, 9001);
+  sleep(1);
+
+  UrlFetcher::Request gossip;
+  EXPECT_CALL(url_fetcher_, Fetch(_, _, _))
+      .WillOnce(Invoke([&gossip](const UrlFetcher::Request& req,
+                                 UrlFetcher::Response* resp,
+                                 util::Task* task) {
+        gossip = req;
+        resp->status_code = 200;
+        task->Return();
+      }));
+  SignedTreeHead sth(sth100_);
+  ASSERT_EQ(LogSigner::OK, signer->SignTreeHead(&sth));
+  controller_.NewTreeHead(sth);
+  sleep(1);
+
+  // The STH went to the other node, rather than to etcd.
+  EXPECT_EQ(UrlFetcher::Verb::POST, gossip.verb);
+  EXPECT_EQ(kNodeId2, gossip.url.Host());
+  EXPECT_EQ("/gossip", gossip.url.Path());
+  EXPECT_FALSE(GetNodeStateView(c2, kNodeId1).has_newest_sth());
+  EXPECT_EQ(sth.DebugString(),
+            GetNodeStateView(kNodeId1).newest_sth().DebugString());
+
+  ClusterNodeState state;
+  ASSERT_TRUE(state.ParseFromString(gossip.body));
+  EXPECT_EQ(kNodeId1, state.node_id());
+  EXPECT_TRUE(c2.ReceiveGossip(state).ok());
+  EXPECT_EQ(sth.DebugString(),
+            GetNodeStateView(c2, kNodeId1).newest_sth().DebugString());
+
+  // Forged STHs are turned away.
+  state.mutable_newest_sth()->set_timestamp(sth.timestamp() + 1);
+  EXPECT_EQ(util::error::INVALID_ARGUMENT,
+            c2.ReceiveGossip(state).CanonicalCode());
+  // As are the nodes which have not joined through etcd.
+  state.set_node_id(kNodeId3);
+  EXPECT_EQ(util::error::NOT_FOUND, c2.ReceiveGossip(state).CanonicalCode());
+}
+
+
 }  // namespace cert_trans
 
 
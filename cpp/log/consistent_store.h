@@ -125,12 +125,63 @@ class ConsistentStore {
 
   virtual util::Status AddPendingEntry(Logged* entry) = 0;
 
+  // Like AddPendingEntry(), but returns through |task| rather than
+  // blocking. |entry| is updated the same way, and must remain valid
+  // until |task| is done.
+  virtual void AddPendingEntryAsync(Logged* entry, util::Task* task) = 0;
+
   virtual util::Status GetPendingEntryForHash(
       const std::string& hash, EntryHandle<Logged>* entry) const = 0;
 
+  // Like GetPendingEntryForHash(), but returns through |task|, which
+  // lets the stores which can avoid blocking the calling thread.
+  // |entry| must remain valid until |task| is done.
+  virtual void GetPendingEntryForHashAsync(const std::string& hash,
+                                           EntryHandle<Logged>* entry,
+                                           util::Task* task) const {
+    task->Return(GetPendingEntryForHash(hash, entry));
+  }
+
   virtual util::Status GetPendingEntries(
       std::vector<EntryHandle<Logged>>* entries) const = 0;
 
+  // Like GetPendingEntries(), but only returns the stubs of the
+  // entries (see Logged::ClearBody()), so that a large backlog can be
+  // listed without holding all of it in memory. Their bodies can be
+  // put back, a few at a time, with RestorePendingEntryBodies().
+  virtual util::Status GetPendingEntryStubs(
+      std::vector<EntryHandle<Logged>>* entries) const {
+    const util::Status status(GetPendingEntries(entries));
+    if (!status.ok()) {
+      return status;
+    }
+    for (auto& entry : *entries) {
+      entry.MutableEntry()->ClearBody();
+    }
+    return util::Status::OK;
+  }
+
+  // Puts back the bodies of the pending entries in |entries| which are
+  // stubs.
+  virtual util::Status RestorePendingEntryBodies(
+      const std::vector<Logged*>& entries) const {
+    for (Logged* const entry : entries) {
+      if (entry->HasBody()) {
+        continue;
+      }
+      EntryHandle<Logged> full;
+      const util::Status status(GetPendingEntryForHash(entry->Hash(), &full));
+      if (!status.ok()) {
+        return status;
+      }
+      if (!entry->RestoreBody(full.Entry())) {
+        return util::Status(util::error::FAILED_PRECONDITION,
+                            "pending entry has no body");
+      }
+    }
+    return util::Status::OK;
+  }
+
   virtual util::Status GetSequenceMapping(
       EntryHandle<ct::SequenceMapping>* entry) const = 0;
 
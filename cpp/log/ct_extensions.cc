@@ -57,6 +57,18 @@ static const char kNameConstraintNologIntermediateLN[] =
 
 static const char kASN1NullValue[] = "NULL";
 
+// The contents of the DER encoding of the CT OIDs, but for their last
+// arc: 1.3.6.1.4.1.11129.2.4.
+static const unsigned char kCtOIDPrefixDer[] = {0x2b, 0x06, 0x01, 0x04, 0x01,
+                                                0xd6, 0x79, 0x02, 0x04};
+
+static const unsigned char kDerBooleanTag = 0x01;
+static const unsigned char kDerOctetStringTag = 0x04;
+static const unsigned char kDerOidTag = 0x06;
+static const unsigned char kDerSequenceTag = 0x30;
+// The [3] EXPLICIT extensions of a TBSCertificate.
+static const unsigned char kDerTbsExtensionsTag = 0xa3;
+
 // String conversion for an ASN1 NULL
 static char* ASN1NullToString(X509V3_EXT_METHOD*, ASN1_NULL* asn1_null) {
   if (asn1_null == NULL)
@@ -149,6 +161,150 @@ static X509V3_EXT_METHOD ct_name_constraint_nolog_intermediate_ca_method = {
     NULL  // usr_data
 };
 
+// An element of a DER encoding.
+struct DerElement {
+  unsigned char tag;
+  const unsigned char* contents;
+  const unsigned char* end;
+};
+
+// Reads the element at |*pos|, which must end by |end|, and moves
+// |*pos| past it. Only handles low tag numbers and definite lengths in
+// their shortest form, as DER requires.
+static bool ReadDerElement(const unsigned char** pos, const unsigned char* end,
+                           DerElement* element) {
+  const unsigned char* p = *pos;
+  if (end - p < 2)
+    return false;
+  element->tag = *p++;
+  // High tag numbers.
+  if ((element->tag & 0x1f) == 0x1f)
+    return false;
+
+  size_t length = *p++;
+  if (length & 0x80) {
+    const size_t num_bytes = length & 0x7f;
+    // Rules out indefinite lengths, and ones that cannot be in memory.
+    if (num_bytes == 0 || num_bytes > 4 ||
+        static_cast<size_t>(end - p) < num_bytes || *p == 0)
+      return false;
+    length = 0;
+    for (size_t i = 0; i < num_bytes; ++i)
+      length = (length << 8) | *p++;
+    if (length < 0x80)
+      return false;
+  }
+
+  if (static_cast<size_t>(end - p) < length)
+    return false;
+  element->contents = p;
+  element->end = p + length;
+  *pos = element->end;
+  return true;
+}
+
+// Returns the last arc of the OID of the CT extension |nid|, or -1.
+static int CtExtensionArc(int nid) {
+  if (nid == NID_undef)
+    return -1;
+  if (nid == NID_ctSignedCertificateTimestampList)
+    return 1;
+  if (nid == NID_ctEmbeddedSignedCertificateTimestampList)
+    return 2;
+  if (nid == NID_ctPoison)
+    return 3;
+  if (nid == NID_ctPrecertificateRedactedLabelCount)
+    return 6;
+  if (nid == NID_ctNameConstraintNologIntermediateCa)
+    return 7;
+  return -1;
+}
+
+bool IsCtExtension(int nid) {
+  return CtExtensionArc(nid) >= 0;
+}
+
+int FindCtExtension(const unsigned char* der, size_t length, int nid,
+                    CtExtensionView* view) {
+  const int arc = CtExtensionArc(nid);
+  if (arc < 0)
+    return -1;
+
+  const unsigned char* pos = der;
+  DerElement cert;
+  if (!ReadDerElement(&pos, der + length, &cert) ||
+      cert.tag != kDerSequenceTag)
+    return -1;
+  pos = cert.contents;
+  DerElement tbs;
+  if (!ReadDerElement(&pos, cert.end, &tbs) || tbs.tag != kDerSequenceTag)
+    return -1;
+
+  // The extensions, if any, are the last field of the TBSCertificate.
+  DerElement field;
+  field.tag = 0;
+  for (pos = tbs.contents; pos < tbs.end;) {
+    if (!ReadDerElement(&pos, tbs.end, &field))
+      return -1;
+  }
+  if (field.tag != kDerTbsExtensionsTag)
+    return 0;
+
+  pos = field.contents;
+  DerElement extensions;
+  if (!ReadDerElement(&pos, field.end, &extensions) ||
+      extensions.tag != kDerSequenceTag || pos != field.end)
+    return -1;
+
+  int count = 0;
+  for (pos = extensions.contents; pos < extensions.end;) {
+    // The OID, the optional critical flag, and the value.
+    DerElement extension, oid, next;
+    if (!ReadDerElement(&pos, extensions.end, &extension) ||
+        extension.tag != kDerSequenceTag)
+      return -1;
+    const unsigned char* p = extension.contents;
+    if (!ReadDerElement(&p, extension.end, &oid) || oid.tag != kDerOidTag ||
+        !ReadDerElement(&p, extension.end, &next))
+      return -1;
+    bool critical = false;
+    if (next.tag == kDerBooleanTag) {
+      if (next.end - next.contents != 1)
+        return -1;
+      critical = *next.contents != 0;
+      if (!ReadDerElement(&p, extension.end, &next))
+        return -1;
+    }
+    if (next.tag != kDerOctetStringTag || p != extension.end)
+      return -1;
+
+    const size_t oid_length = oid.end - oid.contents;
+    if (oid_length != sizeof(kCtOIDPrefixDer) + 1 ||
+        memcmp(oid.contents, kCtOIDPrefixDer, sizeof(kCtOIDPrefixDer)) != 0 ||
+        oid.contents[sizeof(kCtOIDPrefixDer)] != arc)
+      continue;
+    if (count++ == 0 && view != NULL) {
+      view->critical = critical;
+      view->value = next.contents;
+      view->value_length = next.end - next.contents;
+    }
+  }
+  return count;
+}
+
+bool CtExtensionOctetString(const CtExtensionView& extension,
+                            const unsigned char** data, size_t* length) {
+  const unsigned char* pos = extension.value;
+  const unsigned char* const end = extension.value + extension.value_length;
+  DerElement octet;
+  if (!ReadDerElement(&pos, end, &octet) ||
+      octet.tag != kDerOctetStringTag || pos != end)
+    return false;
+  *data = octet.contents;
+  *length = octet.end - octet.contents;
+  return true;
+}
+
 void LoadCtExtensions() {
   // V1 Certificate Extensions
 
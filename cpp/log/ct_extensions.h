@@ -2,6 +2,7 @@
 #define CT_EXTENSIONS_H
 
 #include <openssl/asn1t.h>
+#include <stddef.h>
 
 namespace cert_trans {
 
@@ -40,6 +41,35 @@ extern const char kPrecertificateSigningOID[];
 // Name constrained intermediate CA may not be logged
 extern const char kNameConstraintNologIntermediateOID[];
 
+// An extension found by FindCtExtension(), pointing into the DER
+// encoding it was found in.
+struct CtExtensionView {
+  bool critical;
+  // The contents of the extnValue OCTET STRING.
+  const unsigned char* value;
+  size_t value_length;
+};
+
+// Scans the DER encoding of a certificate for the extension with the
+// CT-specific |nid|, such as NID_ctPoison, without having OpenSSL
+// decode the certificate or the extension. Returns how many times it
+// occurs, and sets |view| to the first one, if there is one and |view|
+// is not NULL. Returns -1 if |nid| is not one of the CT extensions, or
+// the certificate is not in a form this handles, in which case the
+// caller should fall back to OpenSSL.
+int FindCtExtension(const unsigned char* der, size_t length, int nid,
+                    CtExtensionView* view);
+
+// Returns whether |nid| is one of the CT extensions FindCtExtension()
+// looks for.
+bool IsCtExtension(int nid);
+
+// Sets |data| and |length| to the contents of the OCTET STRING that
+// the value of |extension| is, as it is for the SCT list extensions.
+// Returns false if the value is not exactly one DER OCTET STRING.
+bool CtExtensionOctetString(const CtExtensionView& extension,
+                            const unsigned char** data, size_t* length);
+
 }  // namespace cert_trans
 
 #endif  // CT_EXTENSIONS_H
@@ -178,6 +178,61 @@ TEST_F(CtExtensionsTest, TestPrecertSigning) {
                             cert_trans::NID_ctPrecertificateSigning));
 }
 
+TEST_F(CtExtensionsTest, FindCtExtension) {
+  string der;
+  ASSERT_EQ(Cert::TRUE, Cert(poison_cert_).DerEncoding(&der));
+  const unsigned char* const data(
+      reinterpret_cast<const unsigned char*>(der.data()));
+
+  CtExtensionView view;
+  ASSERT_EQ(1, FindCtExtension(data, der.size(), NID_ctPoison, &view));
+  EXPECT_TRUE(view.critical);
+  EXPECT_EQ(string("\x05\x00", 2),
+            string(reinterpret_cast<const char*>(view.value),
+                   view.value_length));
+  EXPECT_EQ(0, FindCtExtension(data, der.size(),
+                               NID_ctEmbeddedSignedCertificateTimestampList,
+                               &view));
+  // Not one of the CT extensions.
+  EXPECT_EQ(-1, FindCtExtension(data, der.size(),
+                                NID_authority_key_identifier, &view));
+  EXPECT_EQ(-1, FindCtExtension(data, der.size() - 1, NID_ctPoison, &view));
+}
+
+TEST_F(CtExtensionsTest, FindCtExtensionOctetString) {
+  Cert embedded_sct_cert(embedded_sct_cert_);
+  string der;
+  ASSERT_EQ(Cert::TRUE, embedded_sct_cert.DerEncoding(&der));
+
+  CtExtensionView view;
+  ASSERT_EQ(1, FindCtExtension(reinterpret_cast<const unsigned char*>(
+                                   der.data()),
+                               der.size(),
+                               NID_ctEmbeddedSignedCertificateTimestampList,
+                               &view));
+  EXPECT_FALSE(view.critical);
+  const unsigned char* data;
+  size_t length;
+  ASSERT_TRUE(CtExtensionOctetString(view, &data, &length));
+
+  // The same as OpenSSL decodes.
+  ASN1_OCTET_STRING* const octet(static_cast<ASN1_OCTET_STRING*>(
+      X509_get_ext_d2i(embedded_sct_cert.x509_,
+                       NID_ctEmbeddedSignedCertificateTimestampList, NULL,
+                       NULL)));
+  ASSERT_TRUE(octet != NULL);
+  EXPECT_EQ(string(reinterpret_cast<const char*>(octet->data), octet->length),
+            string(reinterpret_cast<const char*>(data), length));
+  ASN1_OCTET_STRING_free(octet);
+
+  // The poison is a NULL rather than an OCTET STRING.
+  ASSERT_EQ(Cert::TRUE, Cert(poison_cert_).DerEncoding(&der));
+  ASSERT_EQ(1, FindCtExtension(reinterpret_cast<const unsigned char*>(
+                                   der.data()),
+                               der.size(), NID_ctPoison, &view));
+  EXPECT_FALSE(CtExtensionOctetString(view, &data, &length));
+}
+
 }  // namespace cert_trans
 
 int main(int argc, char** argv) {
@@ -1,5 +1,23 @@
 #include "log/database.h"
 
+DEFINE_bool(database_cache_serializations, false,
+            "store the leaf and extra data serializations of new entries "
+            "along with them, so that they are not recomputed when served");
+DEFINE_int32(database_prefetch_entries, 1000,
+             "number of entries read ahead at a time on a background thread "
+             "when going through many entries of the database, or 0 to not "
+             "read ahead");
+DEFINE_int64(database_bulk_scan_entries, 100000,
+             "scans through at least this many entries of the database "
+             "read ahead and keep the entries out of the caches, so that "
+             "they do not evict those being served, or 0 to never do so");
+DEFINE_bool(database_search_index, false,
+            "index the entries by the DNS names and issuer key of their "
+            "certificates, for the search-entries requests. Supported by "
+            "the LevelDB and RocksDB databases, which index the entries "
+            "they already have when opened with this set for the first "
+            "time");
+
 namespace cert_trans {
 
 
@@ -3,14 +3,20 @@
 #define DATABASE_H
 
 #include <functional>
+#include <gflags/gflags.h>
 #include <glog/logging.h>
 #include <memory>
+#include <mutex>
 #include <set>
 #include <stdint.h>
+#include <vector>
 
 #include "base/macros.h"
 #include "proto/ct.pb.h"
 
+DECLARE_bool(database_cache_serializations);
+DECLARE_bool(database_search_index);
+
 // The |Logged| class needs to provide this interface:
 // class Logged {
 //  public:
@@ -36,11 +42,40 @@
 //   // hash) for storage/retrieval from the database
 //   bool SerializeForDatabase(std::string *dst) const;
 //   bool ParseFromDatabase(const std::string &src);
+//   bool ParseFromDatabase(const char *data, size_t size);
+//
+//   // Serialization of the whole entry, for the databases that do not
+//   // keep the sequence number and hash apart, and reading those two
+//   // back from it, if possible without parsing all of it. Parsing
+//   // also takes what SerializeToString() wrote, which they stored
+//   // before, and SameStoredEntry() compares entries in either format.
+//   bool SerializeForStorage(std::string *dst) const;
+//   bool ParseFromStorage(const std::string &src);
+//   bool ParseFromStorage(const char *data, size_t size);
+//   static bool ReadStorageKey(const char *data, size_t size,
+//                              int64_t *sequence_number, std::string *hash);
+//   static bool SameStoredEntry(const std::string &a, const std::string &b);
+//
+//   // The keys the entry can be found under with SearchEntries(), by
+//   // the databases which index them.
+//   void SearchKeys(std::vector<std::string> *keys) const;
 //
 //   // Serialization for inclusion in the tree (i.e. this is what
 //   // clients would hash over).
 //   bool SerializeForLeaf(std::string *dst) const;
 //
+//   // The Merkle tree leaf hash of the above, which can be kept with
+//   // the contents rather than computed every time.
+//   bool LeafHash(std::string *dst) const;
+//
+//   // Keep the serialization for the leaf (and any other derived
+//   // serializations) with the contents, for them to be stored
+//   // alongside it.
+//   bool CacheSerializations();
+//
+//   // Exchange the contents with |other|.
+//   void Swap(Logged* other);
+//
 //   // Debugging.
 //   std::string DebugString() const;
 //
@@ -77,6 +112,23 @@ class ReadOnlyDatabase {
     // otherwise return false.
     virtual bool GetNextEntry(Logged* entry) = 0;
 
+    // Appends up to |max_entries| of the next entries to |*entries|,
+    // stopping early where GetNextEntry() would return false, and
+    // returns how many were appended.
+    virtual size_t GetNextEntries(size_t max_entries,
+                                  std::vector<Logged>* entries) {
+      CHECK_NOTNULL(entries);
+      size_t count(0);
+      for (; count < max_entries; ++count) {
+        entries->emplace_back();
+        if (!GetNextEntry(&entries->back())) {
+          entries->pop_back();
+          break;
+        }
+      }
+      return count;
+    }
+
    private:
     DISALLOW_COPY_AND_ASSIGN(Iterator);
   };
@@ -95,9 +147,55 @@ class ReadOnlyDatabase {
   // Return the tree head with the freshest timestamp.
   virtual LookupResult LatestTreeHead(ct::SignedTreeHead* result) const = 0;
 
+  // Look up the tree head with |timestamp|.
+  virtual LookupResult LookupTreeHeadByTimestamp(
+      uint64_t timestamp, ct::SignedTreeHead* result) const = 0;
+
+  // Append to |*result|, in order of tree size, the freshest tree
+  // head of each tree size from |start_size| up to, but not
+  // including, |end_size|, for the sizes that have one.
+  virtual void ScanTreeHeadsBySize(
+      int64_t start_size, int64_t end_size,
+      std::vector<ct::SignedTreeHead>* result) const = 0;
+
+  // Look up the freshest tree head of |tree_size|.
+  LookupResult LookupTreeHeadBySize(int64_t tree_size,
+                                    ct::SignedTreeHead* result) const {
+    std::vector<ct::SignedTreeHead> tree_heads;
+    ScanTreeHeadsBySize(tree_size, tree_size + 1, &tree_heads);
+    if (tree_heads.empty()) {
+      return NOT_FOUND;
+    }
+    CHECK_NOTNULL(result)->Swap(&tree_heads.front());
+    return LOOKUP_OK;
+  }
+
   // Scan the entries, starting with the given index.
   virtual std::unique_ptr<Iterator> ScanEntries(int64_t start_index) const = 0;
 
+  // Like ScanEntries(), for a sweep through a large range of entries,
+  // such as an export or the rebuild of a tree, which should not push
+  // the entries being served out of the caches. Implementations read
+  // ahead, and keep what they read out of their caches and of the
+  // page cache, where they can. The default implementation is
+  // ScanEntries().
+  virtual std::unique_ptr<Iterator> ScanEntriesBulk(
+      int64_t start_index) const {
+    return ScanEntries(start_index);
+  }
+
+  // Append to |*result|, in order, the sequence numbers from
+  // |start_index| on of up to |max_results| entries with |search_key|
+  // among their Logged::SearchKeys(), and return LOOKUP_OK. Return
+  // NOT_FOUND if the entries are not indexed by search key, which
+  // they are only with --database_search_index, and by some
+  // implementations. The default implementation returns NOT_FOUND.
+  virtual LookupResult SearchEntries(const std::string& search_key,
+                                     int64_t start_index, size_t max_results,
+                                     std::vector<int64_t>* result) const {
+    return NOT_FOUND;
+  }
+
   // Return the number of entries of contiguous entries (what could be
   // put in a signed tree head). This can be greater than the tree
   // size returned by LatestTreeHead.
@@ -144,14 +242,43 @@ class Database : public ReadOnlyDatabase<Logged> {
     MISSING_TREE_HEAD_TIMESTAMP,
   };
 
-  virtual ~Database() = default;
+  typedef std::function<void(const Logged&)> NotifyEntryCallback;
+
+  virtual ~Database() {
+    CHECK(entry_callbacks_.empty());
+  }
 
   // Attempt to create a new entry with the status LOGGED.
   // Fail if an entry with this hash already exists.
   WriteResult CreateSequencedEntry(const Logged& logged) {
     CHECK(logged.has_sequence_number());
     CHECK_GE(logged.sequence_number(), 0);
-    return CreateSequencedEntry_(logged);
+    if (FLAGS_database_cache_serializations) {
+      Logged cached(logged);
+      CHECK(cached.CacheSerializations());
+      return CreateAndNotify(cached);
+    }
+    return CreateAndNotify(logged);
+  }
+
+  // Same as CreateSequencedEntry(), for several entries at once, in
+  // order, which some implementations write in a single batch. Stops
+  // at the first entry that cannot be created, and sets |*written| to
+  // the number of entries before it.
+  WriteResult CreateSequencedEntries(const std::vector<Logged>& logged,
+                                     size_t* written) {
+    for (const Logged& entry : logged) {
+      CHECK(entry.has_sequence_number());
+      CHECK_GE(entry.sequence_number(), 0);
+    }
+    if (FLAGS_database_cache_serializations) {
+      std::vector<Logged> cached(logged);
+      for (Logged& entry : cached) {
+        CHECK(entry.CacheSerializations());
+      }
+      return CreateAllAndNotify(cached, CHECK_NOTNULL(written));
+    }
+    return CreateAllAndNotify(logged, CHECK_NOTNULL(written));
   }
 
   // Attempt to write a tree head. Fails only if a tree head with this
@@ -163,6 +290,36 @@ class Database : public ReadOnlyDatabase<Logged> {
     return WriteTreeHead_(sth);
   }
 
+  // Add/remove a callback to be called with every entry created by
+  // CreateSequencedEntry() or CreateSequencedEntries(), from the
+  // thread that created it. The pointer is used as a key, so it should
+  // be the same in matching add/remove calls.
+  //
+  // As a sanity check, all callbacks must be removed before the
+  // database instance is destroyed.
+  void AddNotifyEntryCallback(const NotifyEntryCallback* callback) {
+    std::lock_guard<std::mutex> lock(entry_callbacks_mutex_);
+    CHECK(entry_callbacks_.insert(callback).second);
+  }
+
+  void RemoveNotifyEntryCallback(const NotifyEntryCallback* callback) {
+    std::lock_guard<std::mutex> lock(entry_callbacks_mutex_);
+    CHECK_EQ(entry_callbacks_.erase(callback), 1U);
+  }
+
+  // Tells the database that a large number of entries is about to be
+  // created, in order, as when loading a snapshot of a log. Until
+  // EndBulkLoad() is called, implementations may trade durability
+  // and lookups by hash for write speed, and build what they skipped
+  // once at the end. A bulk load interrupted by a crash is finished
+  // when the database is next opened. The default implementations do
+  // nothing.
+  virtual void BeginBulkLoad() {
+  }
+
+  virtual void EndBulkLoad() {
+  }
+
  protected:
   Database() = default;
 
@@ -171,7 +328,46 @@ class Database : public ReadOnlyDatabase<Logged> {
   virtual WriteResult CreateSequencedEntry_(const Logged& logged) = 0;
   virtual WriteResult WriteTreeHead_(const ct::SignedTreeHead& sth) = 0;
 
+  // The default implementation creates the entries one at a time.
+  virtual WriteResult CreateSequencedEntries_(
+      const std::vector<Logged>& logged, size_t* written) {
+    for (*written = 0; *written < logged.size(); ++*written) {
+      const WriteResult result(CreateSequencedEntry_(logged[*written]));
+      if (result != OK) {
+        return result;
+      }
+    }
+    return OK;
+  }
+
  private:
+  WriteResult CreateAndNotify(const Logged& logged) {
+    const WriteResult result(CreateSequencedEntry_(logged));
+    if (result == OK) {
+      std::lock_guard<std::mutex> lock(entry_callbacks_mutex_);
+      for (const NotifyEntryCallback* callback : entry_callbacks_) {
+        (*callback)(logged);
+      }
+    }
+    return result;
+  }
+
+  WriteResult CreateAllAndNotify(const std::vector<Logged>& logged,
+                                 size_t* written) {
+    const WriteResult result(CreateSequencedEntries_(logged, written));
+    CHECK_LE(*written, logged.size());
+    std::lock_guard<std::mutex> lock(entry_callbacks_mutex_);
+    for (size_t i = 0; i < *written; ++i) {
+      for (const NotifyEntryCallback* callback : entry_callbacks_) {
+        (*callback)(logged[i]);
+      }
+    }
+    return result;
+  }
+
+  std::mutex entry_callbacks_mutex_;
+  std::set<const NotifyEntryCallback*> entry_callbacks_;
+
   DISALLOW_COPY_AND_ASSIGN(Database);
 };
 
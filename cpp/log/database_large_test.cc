@@ -1,11 +1,14 @@
 /* -*- indent-tabs-mode: nil -*- */
+#include <algorithm>
 #include <gflags/gflags.h>
 #include <glog/logging.h>
 #include <gtest/gtest.h>
+#include <memory>
 #include <set>
 #include <stdlib.h>
 #include <string>
 #include <sys/resource.h>
+#include <vector>
 
 #include "log/database.h"
 #include "log/file_db.h"
@@ -23,6 +26,9 @@ DEFINE_int32(database_size, 100,
              "choosing this, as the database will fill up your disk (entries "
              "are a few kB each). Maximum is limited to 1 000 000. Also note "
              "that SQLite may be very slow with small batch sizes.");
+DEFINE_int32(scan_batch_size, 1000,
+             "Number of entries to get per GetNextEntries() call when "
+             "scanning the test database.");
 
 namespace {
 
@@ -58,6 +64,37 @@ class LargeDBTest : public ::testing::Test {
     return num;
   }
 
+  int ScanOneByOne(int num) {
+    const std::unique_ptr<typename DB::Iterator> it(
+        this->db()->ScanEntries(0));
+    LoggedCertificate cert;
+    int count(0);
+    while (count < num && it->GetNextEntry(&cert)) {
+      EXPECT_EQ(count, cert.sequence_number());
+      ++count;
+    }
+    return count;
+  }
+
+  int ScanInBatches(int num) {
+    const std::unique_ptr<typename DB::Iterator> it(
+        this->db()->ScanEntries(0));
+    std::vector<LoggedCertificate> certs;
+    int count(0);
+    while (count < num) {
+      certs.clear();
+      if (it->GetNextEntries(std::min(FLAGS_scan_batch_size, num - count),
+                             &certs) == 0) {
+        break;
+      }
+      for (const auto& cert : certs) {
+        EXPECT_EQ(count, cert.sequence_number());
+        ++count;
+      }
+    }
+    return count;
+  }
+
   T* db() const {
     return test_db_.db();
   }
@@ -107,6 +144,32 @@ TYPED_TEST(LargeDBTest, Benchmark) {
   FLAGS_minloglevel = original_log_level;
 }
 
+TYPED_TEST(LargeDBTest, ScanBenchmark) {
+  CHECK_GT(FLAGS_scan_batch_size, 0);
+  this->FillDatabase(FLAGS_database_size);
+  int original_log_level = FLAGS_minloglevel;
+
+  uint64_t realtime_before(util::TimeInMilliseconds());
+  CHECK_EQ(FLAGS_database_size, this->ScanOneByOne(FLAGS_database_size));
+  uint64_t realtime_after(util::TimeInMilliseconds());
+
+  FLAGS_minloglevel = 0;
+  LOG(INFO) << "Real time spent scanning " << FLAGS_database_size
+            << " entries, one at a time: " << realtime_after - realtime_before
+            << " ms";
+  FLAGS_minloglevel = original_log_level;
+
+  realtime_before = util::TimeInMilliseconds();
+  CHECK_EQ(FLAGS_database_size, this->ScanInBatches(FLAGS_database_size));
+  realtime_after = util::TimeInMilliseconds();
+
+  FLAGS_minloglevel = 0;
+  LOG(INFO) << "Real time spent scanning " << FLAGS_database_size
+            << " entries, " << FLAGS_scan_batch_size
+            << " at a time: " << realtime_after - realtime_before << " ms";
+  FLAGS_minloglevel = original_log_level;
+}
+
 }  // namespace
 
 int main(int argc, char** argv) {
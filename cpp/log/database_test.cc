@@ -1,13 +1,22 @@
 /* -*- indent-tabs-mode: nil -*- */
+#include <atomic>
 #include <gtest/gtest.h>
+#include <memory>
 #include <set>
 #include <string>
+#include <thread>
+#include <vector>
 
 #include "log/database.h"
 #include "log/file_db.h"
 #include "log/file_storage.h"
 #include "log/leveldb_db.h"
 #include "log/logged_certificate.h"
+#include "log/prefetching_iterator.h"
+#include "log/search_keys.h"
+#ifdef HAVE_ROCKSDB
+#include "log/rocksdb_db.h"
+#endif
 #include "log/sqlite_db.h"
 #include "log/test_db.h"
 #include "log/test_signer.h"
@@ -18,10 +27,12 @@
 
 namespace {
 
+using cert_trans::IssuerSearchKey;
 using cert_trans::LoggedCertificate;
 using ct::SignedTreeHead;
 using std::string;
 using std::unique_ptr;
+using std::vector;
 
 
 template <class T>
@@ -43,6 +54,9 @@ class DBTest : public ::testing::Test {
 
 typedef testing::Types<FileDB<cert_trans::LoggedCertificate>,
                        SQLiteDB<cert_trans::LoggedCertificate>,
+#ifdef HAVE_ROCKSDB
+                       RocksDB<cert_trans::LoggedCertificate>,
+#endif
                        LevelDB<cert_trans::LoggedCertificate>> Databases;
 
 typedef Database<cert_trans::LoggedCertificate> DB;
@@ -171,6 +185,130 @@ TYPED_TEST(DBTest, CreateSequencedDuplicateSequenceNumber) {
 }
 
 
+TYPED_TEST(DBTest, CreateSequencedEntries) {
+  std::vector<LoggedCertificate> logged_certs(3);
+  for (size_t i = 0; i < logged_certs.size(); ++i) {
+    this->test_signer_.CreateUnique(&logged_certs[i]);
+    logged_certs[i].set_sequence_number(i);
+  }
+
+  size_t written;
+  EXPECT_EQ(DB::OK, this->db()->CreateSequencedEntries(logged_certs, &written));
+  EXPECT_EQ(3U, written);
+  EXPECT_EQ(3, this->db()->TreeSize());
+
+  for (const LoggedCertificate& logged_cert : logged_certs) {
+    LoggedCertificate lookup_cert;
+    EXPECT_EQ(DB::LOOKUP_OK,
+              this->db()->LookupByIndex(logged_cert.sequence_number(),
+                                        &lookup_cert));
+    TestSigner::TestEqualLoggedCerts(logged_cert, lookup_cert);
+
+    lookup_cert.Clear();
+    EXPECT_EQ(DB::LOOKUP_OK,
+              this->db()->LookupByHash(logged_cert.Hash(), &lookup_cert));
+    TestSigner::TestEqualLoggedCerts(logged_cert, lookup_cert);
+  }
+
+  // Writing the same entries again is fine.
+  EXPECT_EQ(DB::OK, this->db()->CreateSequencedEntries(logged_certs, &written));
+  EXPECT_EQ(3U, written);
+  EXPECT_EQ(3, this->db()->TreeSize());
+}
+
+
+TYPED_TEST(DBTest, CreateSequencedEntriesStopsAtDuplicateSequenceNumber) {
+  LoggedCertificate logged_cert;
+  this->test_signer_.CreateUnique(&logged_cert);
+  logged_cert.set_sequence_number(1);
+  EXPECT_EQ(DB::OK, this->db()->CreateSequencedEntry(logged_cert));
+
+  std::vector<LoggedCertificate> logged_certs(3);
+  for (size_t i = 0; i < logged_certs.size(); ++i) {
+    this->test_signer_.CreateUnique(&logged_certs[i]);
+    logged_certs[i].set_sequence_number(i);
+  }
+
+  size_t written;
+  EXPECT_EQ(DB::SEQUENCE_NUMBER_ALREADY_IN_USE,
+            this->db()->CreateSequencedEntries(logged_certs, &written));
+  EXPECT_EQ(1U, written);
+  EXPECT_EQ(2, this->db()->TreeSize());
+
+  // The entries before the duplicate were written, and none after.
+  LoggedCertificate lookup_cert;
+  EXPECT_EQ(DB::LOOKUP_OK, this->db()->LookupByIndex(0, &lookup_cert));
+  TestSigner::TestEqualLoggedCerts(logged_certs[0], lookup_cert);
+  lookup_cert.Clear();
+  EXPECT_EQ(DB::LOOKUP_OK, this->db()->LookupByIndex(1, &lookup_cert));
+  TestSigner::TestEqualLoggedCerts(logged_cert, lookup_cert);
+  EXPECT_EQ(DB::NOT_FOUND, this->db()->LookupByIndex(2, &lookup_cert));
+}
+
+
+TYPED_TEST(DBTest, BulkLoad) {
+  LoggedCertificate existing_cert;
+  this->test_signer_.CreateUnique(&existing_cert);
+  existing_cert.set_sequence_number(0);
+  EXPECT_EQ(DB::OK, this->db()->CreateSequencedEntry(existing_cert));
+
+  std::vector<LoggedCertificate> logged_certs(3);
+  for (size_t i = 0; i < logged_certs.size(); ++i) {
+    this->test_signer_.CreateUnique(&logged_certs[i]);
+    logged_certs[i].set_sequence_number(i + 1);
+  }
+
+  this->db()->BeginBulkLoad();
+  size_t written;
+  EXPECT_EQ(DB::OK, this->db()->CreateSequencedEntries(logged_certs, &written));
+  EXPECT_EQ(3U, written);
+  // Entries already there are still checked for.
+  LoggedCertificate duplicate_cert;
+  this->test_signer_.CreateUnique(&duplicate_cert);
+  duplicate_cert.set_sequence_number(2);
+  EXPECT_EQ(DB::SEQUENCE_NUMBER_ALREADY_IN_USE,
+            this->db()->CreateSequencedEntry(duplicate_cert));
+  this->db()->EndBulkLoad();
+  EXPECT_EQ(4, this->db()->TreeSize());
+
+  logged_certs.push_back(existing_cert);
+  for (const LoggedCertificate& logged_cert : logged_certs) {
+    LoggedCertificate lookup_cert;
+    EXPECT_EQ(DB::LOOKUP_OK,
+              this->db()->LookupByHash(logged_cert.Hash(), &lookup_cert));
+    TestSigner::TestEqualLoggedCerts(logged_cert, lookup_cert);
+  }
+}
+
+
+TYPED_TEST(DBTest, BulkLoadInterrupted) {
+  std::vector<LoggedCertificate> logged_certs(3);
+  for (size_t i = 0; i < logged_certs.size(); ++i) {
+    this->test_signer_.CreateUnique(&logged_certs[i]);
+    logged_certs[i].set_sequence_number(i);
+  }
+
+  this->db()->BeginBulkLoad();
+  size_t written;
+  EXPECT_EQ(DB::OK, this->db()->CreateSequencedEntries(logged_certs, &written));
+  // Commits the batched entries, so that SQLite still has them when
+  // reopened.
+  SignedTreeHead sth;
+  this->test_signer_.CreateUnique(&sth);
+  EXPECT_EQ(DB::OK, this->db()->WriteTreeHead(sth));
+
+  // Reopening the database finishes the bulk load.
+  const unique_ptr<DB> db2(this->test_db_.SecondDB());
+  EXPECT_EQ(3, db2->TreeSize());
+  for (const LoggedCertificate& logged_cert : logged_certs) {
+    LoggedCertificate lookup_cert;
+    EXPECT_EQ(DB::LOOKUP_OK,
+              db2->LookupByHash(logged_cert.Hash(), &lookup_cert));
+    TestSigner::TestEqualLoggedCerts(logged_cert, lookup_cert);
+  }
+}
+
+
 TYPED_TEST(DBTest, TreeSize) {
   LoggedCertificate logged_cert;
 
@@ -241,6 +379,101 @@ TYPED_TEST(DBTest, LookupBySequenceNumber) {
 }
 
 
+TYPED_TEST(DBTest, CacheSerializations) {
+  LoggedCertificate logged_cert, lookup_cert;
+  this->test_signer_.CreateUnique(&logged_cert);
+
+  FLAGS_database_cache_serializations = true;
+  EXPECT_EQ(DB::OK, this->db()->CreateSequencedEntry(logged_cert));
+  FLAGS_database_cache_serializations = false;
+
+  string leaf_input, extra_data;
+  ASSERT_TRUE(logged_cert.SerializeForLeaf(&leaf_input));
+  ASSERT_TRUE(logged_cert.SerializeExtraData(&extra_data));
+
+  EXPECT_EQ(DB::LOOKUP_OK,
+            this->db()->LookupByIndex(logged_cert.sequence_number(),
+                                      &lookup_cert));
+  TestSigner::TestEqualLoggedCerts(logged_cert, lookup_cert);
+  EXPECT_EQ(leaf_input, lookup_cert.contents().leaf_input());
+  EXPECT_EQ(extra_data, lookup_cert.contents().extra_data());
+
+  lookup_cert.Clear();
+  unique_ptr<Database<LoggedCertificate>::Iterator> it(
+      this->db()->ScanEntries(0));
+  ASSERT_TRUE(it->GetNextEntry(&lookup_cert));
+  string lookup_leaf_input, lookup_extra_data;
+  EXPECT_TRUE(lookup_cert.SerializeForLeaf(&lookup_leaf_input));
+  EXPECT_TRUE(lookup_cert.SerializeExtraData(&lookup_extra_data));
+  EXPECT_EQ(leaf_input, lookup_leaf_input);
+  EXPECT_EQ(extra_data, lookup_extra_data);
+  EXPECT_FALSE(it->GetNextEntry(&lookup_cert));
+}
+
+
+TYPED_TEST(DBTest, SearchEntries) {
+  // Precertificates, whose issuer key is in the entry.
+  LoggedCertificate logged_certs[4];
+  for (int i = 0; i < 4; ++i) {
+    this->test_signer_.CreateUnique(&logged_certs[i]);
+    logged_certs[i].set_sequence_number(i);
+    logged_certs[i].mutable_entry()->set_type(ct::PRECERT_ENTRY);
+    logged_certs[i]
+        .mutable_entry()
+        ->mutable_precert_entry()
+        ->mutable_pre_cert()
+        ->set_issuer_key_hash(i == 1 ? "issuer B" : "issuer A");
+  }
+  const string key_a(IssuerSearchKey("issuer A"));
+  const string key_b(IssuerSearchKey("issuer B"));
+
+  EXPECT_EQ(DB::OK, this->db()->CreateSequencedEntry(logged_certs[0]));
+  vector<int64_t> indices;
+  EXPECT_EQ(DB::NOT_FOUND, this->db()->SearchEntries(key_a, 0, 10, &indices));
+
+  // The entries already there are indexed when the database is opened.
+  FLAGS_database_search_index = true;
+  unique_ptr<DB> db2(this->test_db_.SecondDB());
+  FLAGS_database_search_index = false;
+  if (db2->SearchEntries(key_a, 0, 10, &indices) == DB::NOT_FOUND) {
+    // Not supported by this database.
+    return;
+  }
+  EXPECT_EQ(vector<int64_t>({0}), indices);
+
+  EXPECT_EQ(DB::OK, db2->CreateSequencedEntry(logged_certs[1]));
+  EXPECT_EQ(DB::OK, db2->CreateSequencedEntry(logged_certs[2]));
+  indices.clear();
+  EXPECT_EQ(DB::LOOKUP_OK, db2->SearchEntries(key_a, 0, 10, &indices));
+  EXPECT_EQ(vector<int64_t>({0, 2}), indices);
+  indices.clear();
+  EXPECT_EQ(DB::LOOKUP_OK, db2->SearchEntries(key_a, 1, 10, &indices));
+  EXPECT_EQ(vector<int64_t>({2}), indices);
+  indices.clear();
+  EXPECT_EQ(DB::LOOKUP_OK, db2->SearchEntries(key_a, 0, 1, &indices));
+  EXPECT_EQ(vector<int64_t>({0}), indices);
+  indices.clear();
+  EXPECT_EQ(DB::LOOKUP_OK, db2->SearchEntries(key_b, 0, 10, &indices));
+  EXPECT_EQ(vector<int64_t>({1}), indices);
+  indices.clear();
+  EXPECT_EQ(DB::LOOKUP_OK,
+            db2->SearchEntries(IssuerSearchKey("issuer"), 0, 10, &indices));
+  EXPECT_TRUE(indices.empty());
+
+  // Entries written without the index are indexed once it is back.
+  db2.reset();
+  db2.reset(this->test_db_.SecondDB());
+  EXPECT_EQ(DB::OK, db2->CreateSequencedEntry(logged_certs[3]));
+  db2.reset();
+  FLAGS_database_search_index = true;
+  db2.reset(this->test_db_.SecondDB());
+  FLAGS_database_search_index = false;
+  indices.clear();
+  EXPECT_EQ(DB::LOOKUP_OK, db2->SearchEntries(key_a, 0, 10, &indices));
+  EXPECT_EQ(vector<int64_t>({0, 2, 3}), indices);
+}
+
+
 TYPED_TEST(DBTest, WriteTreeHead) {
   SignedTreeHead sth, lookup_sth;
   this->test_signer_.CreateUnique(&sth);
@@ -283,6 +516,50 @@ TYPED_TEST(DBTest, WriteTreeHeadNewerTimestamp) {
 }
 
 
+TYPED_TEST(DBTest, ReadsWhileWriting) {
+  const int kNumEntries(50);
+  std::atomic<bool> done(false);
+  // The tree size and the latest tree head only ever move forward, and
+  // the entries below the tree size can be read.
+  std::thread reader([this, &done]() {
+    int64_t last_size(0);
+    uint64_t last_timestamp(0);
+    while (!done) {
+      const int64_t size(this->db()->TreeSize());
+      EXPECT_LE(last_size, size);
+      if (size > 0) {
+        EXPECT_EQ(DB::LOOKUP_OK, this->db()->LookupByIndex(size - 1, NULL));
+      }
+      last_size = size;
+      SignedTreeHead sth;
+      if (this->db()->LatestTreeHead(&sth) == DB::LOOKUP_OK) {
+        EXPECT_LE(last_timestamp, sth.timestamp());
+        last_timestamp = sth.timestamp();
+      }
+    }
+  });
+
+  SignedTreeHead sth;
+  this->test_signer_.CreateUnique(&sth);
+  for (int i = 0; i < kNumEntries; ++i) {
+    LoggedCertificate logged;
+    this->test_signer_.CreateUnique(&logged);
+    logged.set_sequence_number(i);
+    EXPECT_EQ(DB::OK, this->db()->CreateSequencedEntry(logged));
+    sth.set_timestamp(sth.timestamp() + 1);
+    sth.set_tree_size(i + 1);
+    EXPECT_EQ(DB::OK, this->db()->WriteTreeHead(sth));
+  }
+  done = true;
+  reader.join();
+
+  EXPECT_EQ(kNumEntries, this->db()->TreeSize());
+  SignedTreeHead lookup_sth;
+  EXPECT_EQ(DB::LOOKUP_OK, this->db()->LatestTreeHead(&lookup_sth));
+  TestSigner::TestEqualTreeHeads(sth, lookup_sth);
+}
+
+
 TYPED_TEST(DBTest, WriteTreeHeadOlderTimestamp) {
   SignedTreeHead sth, sth2, lookup_sth;
   this->test_signer_.CreateUnique(&sth);
@@ -298,6 +575,50 @@ TYPED_TEST(DBTest, WriteTreeHeadOlderTimestamp) {
 }
 
 
+TYPED_TEST(DBTest, LookupTreeHeads) {
+  // Two tree heads of size 10, the newer written first, and one of
+  // size 20.
+  SignedTreeHead sth10_new, sth10_old, sth20, lookup_sth;
+  this->test_signer_.CreateUnique(&sth10_new);
+  this->test_signer_.CreateUnique(&sth10_old);
+  this->test_signer_.CreateUnique(&sth20);
+  sth10_new.set_tree_size(10);
+  sth10_old.set_tree_size(10);
+  sth10_old.set_timestamp(sth10_new.timestamp() - 1000);
+  sth20.set_tree_size(20);
+  sth20.set_timestamp(sth10_new.timestamp() + 1000);
+  EXPECT_EQ(DB::OK, this->db()->WriteTreeHead(sth10_new));
+  EXPECT_EQ(DB::OK, this->db()->WriteTreeHead(sth10_old));
+  EXPECT_EQ(DB::OK, this->db()->WriteTreeHead(sth20));
+
+  EXPECT_EQ(DB::LOOKUP_OK, this->db()->LookupTreeHeadByTimestamp(
+                               sth10_old.timestamp(), &lookup_sth));
+  TestSigner::TestEqualTreeHeads(sth10_old, lookup_sth);
+  EXPECT_EQ(DB::NOT_FOUND, this->db()->LookupTreeHeadByTimestamp(
+                               sth20.timestamp() + 1, &lookup_sth));
+
+  EXPECT_EQ(DB::LOOKUP_OK, this->db()->LookupTreeHeadBySize(10, &lookup_sth));
+  TestSigner::TestEqualTreeHeads(sth10_new, lookup_sth);
+  EXPECT_EQ(DB::NOT_FOUND, this->db()->LookupTreeHeadBySize(15, &lookup_sth));
+
+  vector<SignedTreeHead> sths;
+  this->db()->ScanTreeHeadsBySize(0, 20, &sths);
+  ASSERT_EQ(1U, sths.size());
+  TestSigner::TestEqualTreeHeads(sth10_new, sths[0]);
+  this->db()->ScanTreeHeadsBySize(11, 100, &sths);
+  ASSERT_EQ(2U, sths.size());
+  TestSigner::TestEqualTreeHeads(sth20, sths[1]);
+
+  // Also once the database is opened again.
+  std::unique_ptr<DB> db2(this->test_db_.SecondDB());
+  sths.clear();
+  db2->ScanTreeHeadsBySize(0, 100, &sths);
+  ASSERT_EQ(2U, sths.size());
+  TestSigner::TestEqualTreeHeads(sth10_new, sths[0]);
+  TestSigner::TestEqualTreeHeads(sth20, sths[1]);
+}
+
+
 TYPED_TEST(DBTest, Resume) {
   LoggedCertificate logged_cert, logged_cert2, lookup_cert, lookup_cert2;
   const int64_t kSeq1(129);
@@ -428,6 +749,117 @@ TYPED_TEST(DBTest, Iterator) {
 }
 
 
+TYPED_TEST(DBTest, IteratorGetNextEntries) {
+  vector<LoggedCertificate> logged(5);
+  for (size_t i = 0; i < logged.size(); ++i) {
+    this->test_signer_.CreateUnique(&logged[i]);
+    logged[i].set_sequence_number(i);
+    ASSERT_EQ(DB::OK, this->db()->CreateSequencedEntry(logged[i]));
+  }
+
+  unique_ptr<Database<LoggedCertificate>::Iterator> it(
+      this->db()->ScanEntries(1));
+  vector<LoggedCertificate> entries;
+  EXPECT_EQ(2U, it->GetNextEntries(2, &entries));
+  // Stops at the end, and appends to what is there.
+  EXPECT_EQ(2U, it->GetNextEntries(10, &entries));
+  EXPECT_EQ(0U, it->GetNextEntries(10, &entries));
+  ASSERT_EQ(4U, entries.size());
+  for (size_t i = 0; i < entries.size(); ++i) {
+    TestSigner::TestEqualLoggedCerts(logged[i + 1], entries[i]);
+  }
+}
+
+
+TYPED_TEST(DBTest, IteratorGetNextEntriesSkipsGaps) {
+  const vector<int64_t> sequence_numbers{0, 1, 3, 7, 8};
+  vector<LoggedCertificate> logged(sequence_numbers.size());
+  for (size_t i = 0; i < logged.size(); ++i) {
+    this->test_signer_.CreateUnique(&logged[i]);
+    logged[i].set_sequence_number(sequence_numbers[i]);
+    ASSERT_EQ(DB::OK, this->db()->CreateSequencedEntry(logged[i]));
+  }
+
+  unique_ptr<Database<LoggedCertificate>::Iterator> it(
+      this->db()->ScanEntries(1));
+  vector<LoggedCertificate> entries;
+  EXPECT_EQ(3U, it->GetNextEntries(3, &entries));
+  EXPECT_EQ(1U, it->GetNextEntries(10, &entries));
+  EXPECT_EQ(0U, it->GetNextEntries(10, &entries));
+  ASSERT_EQ(4U, entries.size());
+  for (size_t i = 0; i < entries.size(); ++i) {
+    TestSigner::TestEqualLoggedCerts(logged[i + 1], entries[i]);
+  }
+}
+
+
+TYPED_TEST(DBTest, ScanEntriesBulk) {
+  const vector<int64_t> sequence_numbers{0, 1, 2, 5, 6};
+  vector<LoggedCertificate> logged(sequence_numbers.size());
+  for (size_t i = 0; i < logged.size(); ++i) {
+    this->test_signer_.CreateUnique(&logged[i]);
+    logged[i].set_sequence_number(sequence_numbers[i]);
+    ASSERT_EQ(DB::OK, this->db()->CreateSequencedEntry(logged[i]));
+  }
+
+  // The same entries as ScanEntries(), one or several at a time.
+  unique_ptr<Database<LoggedCertificate>::Iterator> it(
+      this->db()->ScanEntriesBulk(1));
+  LoggedCertificate entry;
+  ASSERT_TRUE(it->GetNextEntry(&entry));
+  TestSigner::TestEqualLoggedCerts(logged[1], entry);
+  vector<LoggedCertificate> entries;
+  EXPECT_EQ(3U, it->GetNextEntries(10, &entries));
+  ASSERT_EQ(3U, entries.size());
+  for (size_t i = 0; i < entries.size(); ++i) {
+    TestSigner::TestEqualLoggedCerts(logged[i + 2], entries[i]);
+  }
+  EXPECT_FALSE(it->GetNextEntry(&entry));
+}
+
+
+TYPED_TEST(DBTest, PrefetchingIterator) {
+  vector<LoggedCertificate> logged(20);
+  for (size_t i = 0; i < logged.size(); ++i) {
+    this->test_signer_.CreateUnique(&logged[i]);
+    logged[i].set_sequence_number(i);
+    ASSERT_EQ(DB::OK, this->db()->CreateSequencedEntry(logged[i]));
+  }
+
+  // Reads ahead in blocks of 3, up to the 10th entry, and then as the
+  // entries are asked for.
+  PrefetchingIterator<LoggedCertificate> it(this->db()->ScanEntries(2), 3, 10);
+  LoggedCertificate it_cert;
+  for (size_t i = 2; i < 6; ++i) {
+    ASSERT_TRUE(it.GetNextEntry(&it_cert));
+    TestSigner::TestEqualLoggedCerts(logged[i], it_cert);
+  }
+  vector<LoggedCertificate> entries;
+  EXPECT_EQ(14U, it.GetNextEntries(100, &entries));
+  for (size_t i = 0; i < entries.size(); ++i) {
+    TestSigner::TestEqualLoggedCerts(logged[i + 6], entries[i]);
+  }
+  EXPECT_FALSE(it.GetNextEntry(&it_cert));
+}
+
+
+TYPED_TEST(DBTest, PrefetchingIteratorStopsEarly) {
+  vector<LoggedCertificate> logged(10);
+  for (size_t i = 0; i < logged.size(); ++i) {
+    this->test_signer_.CreateUnique(&logged[i]);
+    logged[i].set_sequence_number(i);
+    ASSERT_EQ(DB::OK, this->db()->CreateSequencedEntry(logged[i]));
+  }
+
+  // Destroyed while reading ahead.
+  PrefetchingIterator<LoggedCertificate> it(this->db()->ScanEntries(0), 2,
+                                            100);
+  LoggedCertificate it_cert;
+  ASSERT_TRUE(it.GetNextEntry(&it_cert));
+  TestSigner::TestEqualLoggedCerts(logged[0], it_cert);
+}
+
+
 }  // namespace
 
 
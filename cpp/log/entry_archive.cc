@@ -0,0 +1,332 @@
+#include "log/entry_archive.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <glog/logging.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+using std::string;
+using std::vector;
+
+namespace cert_trans {
+namespace {
+
+
+const char kMagic[] = "CTARCHV1";
+const size_t kMagicLength = 8;
+// first_index, num_entries, entries_per_block, dictionary_length, crc
+// and the magic.
+const size_t kTrailerLength = 8 + 4 + 4 + 4 + 4 + kMagicLength;
+const size_t kBlockIndexEntryLength = 8 + 4 + 4;
+// The largest dictionary zlib can make use of, the size of its window.
+const size_t kMaxDictionaryLength = 32 * 1024;
+
+
+void PutUint32(uint32_t value, string* out) {
+  for (int i = 3; i >= 0; --i) {
+    out->push_back(static_cast<char>((value >> (8 * i)) & 0xff));
+  }
+}
+
+
+void PutUint64(uint64_t value, string* out) {
+  PutUint32(value >> 32, out);
+  PutUint32(value & 0xffffffff, out);
+}
+
+
+uint32_t GetUint32(const char* in) {
+  uint32_t value(0);
+  for (int i = 0; i < 4; ++i) {
+    value = (value << 8) | static_cast<uint8_t>(in[i]);
+  }
+  return value;
+}
+
+
+uint64_t GetUint64(const char* in) {
+  return (static_cast<uint64_t>(GetUint32(in)) << 32) | GetUint32(in + 4);
+}
+
+
+uint32_t Crc32(const string& data) {
+  return crc32(crc32(0, Z_NULL, 0), reinterpret_cast<const Bytef*>(data.data()),
+               data.size());
+}
+
+
+// Fills |*data| from |fd| at |offset|.
+void ReadAt(int fd, off_t offset, string* data, const string& path) {
+  for (size_t done = 0; done < data->size();) {
+    const ssize_t bytes(
+        pread(fd, &(*data)[done], data->size() - done, offset + done));
+    if (bytes < 0 && errno == EINTR) {
+      continue;
+    }
+    CHECK_GT(bytes, 0) << path << ": " << (bytes < 0 ? strerror(errno)
+                                                      : "unexpected EOF");
+    done += bytes;
+  }
+}
+
+
+}  // namespace
+
+
+EntryArchive::EntryArchive(const string& path)
+    : path_(path), fd_(open(path_.c_str(), O_RDONLY)) {
+  CHECK_GE(fd_, 0) << path_ << ": " << strerror(errno);
+  struct stat st;
+  CHECK_EQ(fstat(fd_, &st), 0) << path_ << ": " << strerror(errno);
+  CHECK_GE(static_cast<size_t>(st.st_size), kTrailerLength)
+      << path_ << ": too short to be an archive";
+
+  string trailer(kTrailerLength, '\0');
+  ReadAt(fd_, st.st_size - kTrailerLength, &trailer, path_);
+  CHECK_EQ(trailer.substr(kTrailerLength - kMagicLength), kMagic)
+      << path_ << ": not an archive";
+  first_index_ = GetUint64(trailer.data());
+  num_entries_ = GetUint32(trailer.data() + 8);
+  entries_per_block_ = GetUint32(trailer.data() + 12);
+  const uint32_t dictionary_length(GetUint32(trailer.data() + 16));
+  const uint32_t crc(GetUint32(trailer.data() + 20));
+  CHECK_GT(entries_per_block_, 0U) << path_;
+
+  const size_t num_blocks((num_entries_ + entries_per_block_ - 1) /
+                          entries_per_block_);
+  const size_t footer_length(dictionary_length +
+                             num_blocks * kBlockIndexEntryLength);
+  CHECK_GE(static_cast<size_t>(st.st_size), footer_length + kTrailerLength)
+      << path_ << ": truncated";
+  string footer(footer_length, '\0');
+  ReadAt(fd_, st.st_size - kTrailerLength - footer_length, &footer, path_);
+  CHECK_EQ(crc, Crc32(footer + trailer.substr(0, 20)))
+      << path_ << ": corrupt index";
+
+  dictionary_ = footer.substr(0, dictionary_length);
+  blocks_.resize(num_blocks);
+  const char* entry(footer.data() + dictionary_length);
+  for (Block& block : blocks_) {
+    block.offset = GetUint64(entry);
+    block.compressed_length = GetUint32(entry + 8);
+    block.length = GetUint32(entry + 12);
+    entry += kBlockIndexEntryLength;
+  }
+}
+
+
+EntryArchive::~EntryArchive() {
+  CHECK_EQ(close(fd_), 0);
+}
+
+
+// static
+string EntryArchive::BuildDictionary(const vector<string>& samples) {
+  // Whole samples, rather than the beginning of each, so that the
+  // strings at their end, like the chain, are in there too.
+  string dictionary;
+  for (const auto& sample : samples) {
+    if (dictionary.size() + sample.size() <= kMaxDictionaryLength) {
+      dictionary.append(sample);
+    }
+  }
+  return dictionary;
+}
+
+
+void EntryArchive::Lookup(int64_t index, string* entry) const {
+  CHECK_NOTNULL(entry);
+  vector<string> entries;
+  ReadBlock(index, &entries);
+  // ReadBlock() starts at |index|.
+  entry->swap(entries.front());
+}
+
+
+void EntryArchive::ReadBlock(int64_t index, vector<string>* entries) const {
+  CHECK_NOTNULL(entries);
+  CHECK_GE(index, first_index_);
+  CHECK_LT(index, end_index());
+  const size_t block((index - first_index_) / entries_per_block_);
+  const size_t skip((index - first_index_) % entries_per_block_);
+
+  const string data(Decompress(block));
+  size_t pos(0);
+  for (size_t i = 0; pos < data.size(); ++i) {
+    CHECK_LE(pos + 4, data.size()) << path_ << ": corrupt block " << block;
+    const uint32_t length(GetUint32(data.data() + pos));
+    pos += 4;
+    CHECK_LE(pos + length, data.size()) << path_ << ": corrupt block "
+                                        << block;
+    if (i >= skip) {
+      entries->emplace_back(data, pos, length);
+    }
+    pos += length;
+  }
+}
+
+
+void EntryArchive::ReadBlockBulk(int64_t index,
+                                 vector<string>* entries) const {
+  CHECK_GE(index, first_index_);
+  CHECK_LT(index, end_index());
+  const size_t block((index - first_index_) / entries_per_block_);
+
+  // These are only hints, so it does not matter if they fail.
+  if (block + 1 < blocks_.size()) {
+    const Block& next(blocks_[block + 1]);
+    posix_fadvise(fd_, next.offset, next.compressed_length,
+                  POSIX_FADV_WILLNEED);
+  }
+  ReadBlock(index, entries);
+  const Block& current(blocks_[block]);
+  posix_fadvise(fd_, current.offset, current.compressed_length,
+                POSIX_FADV_DONTNEED);
+}
+
+
+string EntryArchive::Decompress(size_t block) const {
+  CHECK_LT(block, blocks_.size());
+  const Block& location(blocks_[block]);
+  string compressed(location.compressed_length, '\0');
+  ReadAt(fd_, location.offset, &compressed, path_);
+
+  string data(location.length, '\0');
+  z_stream stream;
+  memset(&stream, 0, sizeof(stream));
+  CHECK_EQ(Z_OK, inflateInit(&stream));
+  stream.next_in = reinterpret_cast<Bytef*>(&compressed[0]);
+  stream.avail_in = compressed.size();
+  stream.next_out = reinterpret_cast<Bytef*>(&data[0]);
+  stream.avail_out = data.size();
+  int ret(inflate(&stream, Z_FINISH));
+  if (ret == Z_NEED_DICT) {
+    CHECK_EQ(Z_OK, inflateSetDictionary(
+                       &stream,
+                       reinterpret_cast<const Bytef*>(dictionary_.data()),
+                       dictionary_.size()));
+    ret = inflate(&stream, Z_FINISH);
+  }
+  CHECK_EQ(Z_STREAM_END, ret) << path_ << ": corrupt block " << block;
+  CHECK_EQ(stream.total_out, location.length) << path_ << ": corrupt block "
+                                              << block;
+  CHECK_EQ(Z_OK, inflateEnd(&stream));
+
+  return data;
+}
+
+
+EntryArchiveWriter::EntryArchiveWriter(const string& path,
+                                       int64_t first_index,
+                                       uint32_t entries_per_block,
+                                       const string& dictionary)
+    : path_(path),
+      tmp_path_(path + ".tmp"),
+      first_index_(first_index),
+      entries_per_block_(entries_per_block),
+      dictionary_(dictionary),
+      fd_(open(tmp_path_.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600)),
+      offset_(0),
+      num_entries_(0),
+      block_entries_(0),
+      finished_(false) {
+  CHECK_GE(first_index_, 0);
+  CHECK_GT(entries_per_block_, 0U);
+  CHECK_LE(dictionary_.size(), kMaxDictionaryLength);
+  CHECK_GE(fd_, 0) << tmp_path_ << ": " << strerror(errno);
+}
+
+
+EntryArchiveWriter::~EntryArchiveWriter() {
+  if (!finished_) {
+    CHECK_EQ(close(fd_), 0);
+    CHECK_EQ(unlink(tmp_path_.c_str()), 0) << tmp_path_ << ": "
+                                           << strerror(errno);
+  }
+}
+
+
+void EntryArchiveWriter::Add(const string& entry) {
+  CHECK(!finished_);
+  CHECK_LT(num_entries_, UINT32_MAX);
+  PutUint32(entry.size(), &block_);
+  block_.append(entry);
+  ++num_entries_;
+  if (++block_entries_ == entries_per_block_) {
+    FlushBlock();
+  }
+}
+
+
+void EntryArchiveWriter::Finish() {
+  CHECK(!finished_);
+  if (block_entries_ > 0) {
+    FlushBlock();
+  }
+
+  string footer(dictionary_);
+  footer.append(index_);
+  string trailer;
+  PutUint64(first_index_, &trailer);
+  PutUint32(num_entries_, &trailer);
+  PutUint32(entries_per_block_, &trailer);
+  PutUint32(dictionary_.size(), &trailer);
+  PutUint32(Crc32(footer + trailer), &trailer);
+  trailer.append(kMagic, kMagicLength);
+  Write(footer);
+  Write(trailer);
+
+  CHECK_EQ(fsync(fd_), 0) << tmp_path_ << ": " << strerror(errno);
+  CHECK_EQ(close(fd_), 0) << tmp_path_ << ": " << strerror(errno);
+  CHECK_EQ(rename(tmp_path_.c_str(), path_.c_str()), 0)
+      << tmp_path_ << ": " << strerror(errno);
+  finished_ = true;
+}
+
+
+void EntryArchiveWriter::FlushBlock() {
+  z_stream stream;
+  memset(&stream, 0, sizeof(stream));
+  CHECK_EQ(Z_OK, deflateInit(&stream, Z_BEST_COMPRESSION));
+  if (!dictionary_.empty()) {
+    CHECK_EQ(Z_OK, deflateSetDictionary(
+                       &stream,
+                       reinterpret_cast<const Bytef*>(dictionary_.data()),
+                       dictionary_.size()));
+  }
+  string compressed(deflateBound(&stream, block_.size()), '\0');
+  stream.next_in = reinterpret_cast<Bytef*>(&block_[0]);
+  stream.avail_in = block_.size();
+  stream.next_out = reinterpret_cast<Bytef*>(&compressed[0]);
+  stream.avail_out = compressed.size();
+  CHECK_EQ(Z_STREAM_END, deflate(&stream, Z_FINISH));
+  compressed.resize(stream.total_out);
+  CHECK_EQ(Z_OK, deflateEnd(&stream));
+
+  PutUint64(offset_, &index_);
+  PutUint32(compressed.size(), &index_);
+  PutUint32(block_.size(), &index_);
+  Write(compressed);
+
+  block_.clear();
+  block_entries_ = 0;
+}
+
+
+void EntryArchiveWriter::Write(const string& data) {
+  for (size_t done = 0; done < data.size();) {
+    const ssize_t bytes(write(fd_, data.data() + done, data.size() - done));
+    if (bytes < 0 && errno == EINTR) {
+      continue;
+    }
+    CHECK_GT(bytes, 0) << tmp_path_ << ": " << strerror(errno);
+    done += bytes;
+  }
+  offset_ += data.size();
+}
+
+
+}  // namespace cert_trans
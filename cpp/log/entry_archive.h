@@ -0,0 +1,134 @@
+#ifndef CERT_TRANS_LOG_ENTRY_ARCHIVE_H_
+#define CERT_TRANS_LOG_ENTRY_ARCHIVE_H_
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "base/macros.h"
+
+namespace cert_trans {
+
+
+// An immutable file holding a contiguous range of serialized log
+// entries, compressed with zlib in blocks of a few entries, so that
+// one can be read without decompressing the whole range. All the
+// blocks are compressed with the same preset dictionary, built from a
+// sample of the entries, which lets even small blocks refer to the
+// strings that most entries have in common (issuer names, extensions,
+// intermediate certificates).
+//
+// The file is laid out as:
+//
+//   blocks      - each a zlib stream of, for each of its entries, a
+//                 uint32 length followed by the entry.
+//   dictionary
+//   block index - for each block, a uint64 offset, a uint32
+//                 compressed length and a uint32 uncompressed length.
+//   trailer     - uint64 first_index, uint32 num_entries,
+//                 uint32 entries_per_block, uint32 dictionary_length,
+//                 uint32 CRC-32 of the dictionary, block index and
+//                 the preceding trailer fields, then the magic
+//                 "CTARCHV1".
+//
+// with the integers in big-endian order.
+//
+// EntryArchive aborts upon any filesystem error, or if the file is
+// corrupt. This class is threadsafe.
+class EntryArchive {
+ public:
+  // Opens the archive at |path|.
+  explicit EntryArchive(const std::string& path);
+  ~EntryArchive();
+
+  // Returns a dictionary for compressing entries like |samples|, of
+  // at most the 32 KiB that zlib can use.
+  static std::string BuildDictionary(const std::vector<std::string>& samples);
+
+  // The range of indices of the entries, from first_index() up to,
+  // but not including, end_index().
+  int64_t first_index() const {
+    return first_index_;
+  }
+
+  int64_t end_index() const {
+    return first_index_ + num_entries_;
+  }
+
+  // Sets |*entry| to the entry at |index|, which must be in the
+  // archive.
+  void Lookup(int64_t index, std::string* entry) const;
+
+  // Appends the entries from |index|, which must be in the archive,
+  // to the end of the block it is in.
+  void ReadBlock(int64_t index, std::vector<std::string>* entries) const;
+
+  // Like ReadBlock(), for a sweep through the archive: asks for the
+  // next block to be read ahead, and drops this one from the page
+  // cache once it is read.
+  void ReadBlockBulk(int64_t index, std::vector<std::string>* entries) const;
+
+ private:
+  struct Block {
+    uint64_t offset;
+    uint32_t compressed_length;
+    uint32_t length;
+  };
+
+  // Returns the decompressed contents of |block|.
+  std::string Decompress(size_t block) const;
+
+  const std::string path_;
+  int fd_;
+  int64_t first_index_;
+  uint32_t num_entries_;
+  uint32_t entries_per_block_;
+  std::string dictionary_;
+  std::vector<Block> blocks_;
+
+  DISALLOW_COPY_AND_ASSIGN(EntryArchive);
+};
+
+
+// Writes an EntryArchive. The entries are added in order, and the
+// archive only appears at its path once it is finished, so that a
+// crash cannot leave an incomplete one behind.
+class EntryArchiveWriter {
+ public:
+  // The first entry added will have index |first_index|.
+  EntryArchiveWriter(const std::string& path, int64_t first_index,
+                     uint32_t entries_per_block,
+                     const std::string& dictionary);
+  // Removes the temporary file if Finish() was not called.
+  ~EntryArchiveWriter();
+
+  void Add(const std::string& entry);
+
+  // Writes the index, syncs the archive and renames it into place.
+  void Finish();
+
+ private:
+  // Compresses |block_| and writes it out.
+  void FlushBlock();
+  void Write(const std::string& data);
+
+  const std::string path_;
+  const std::string tmp_path_;
+  const int64_t first_index_;
+  const uint32_t entries_per_block_;
+  const std::string dictionary_;
+  int fd_;
+  uint64_t offset_;
+  uint32_t num_entries_;
+  std::string block_;
+  uint32_t block_entries_;
+  std::string index_;
+  bool finished_;
+
+  DISALLOW_COPY_AND_ASSIGN(EntryArchiveWriter);
+};
+
+
+}  // namespace cert_trans
+
+#endif  // CERT_TRANS_LOG_ENTRY_ARCHIVE_H_
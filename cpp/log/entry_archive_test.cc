@@ -0,0 +1,148 @@
+#include "log/entry_archive.h"
+
+#include <fcntl.h>
+#include <gtest/gtest.h>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+#include "util/test_db.h"
+#include "util/testing.h"
+
+namespace cert_trans {
+namespace {
+
+using std::string;
+using std::vector;
+
+const int64_t kFirstIndex = 1000;
+const uint32_t kEntriesPerBlock = 4;
+
+
+// Entries with a long part in common, like certificates from the same
+// issuer, and a part of their own.
+vector<string> MakeEntries(int count) {
+  // Not very compressible on its own, like a public key.
+  string common;
+  uint32_t state(1);
+  for (int i = 0; i < 2000; ++i) {
+    state = state * 1103515245 + 12345;
+    common.push_back(static_cast<char>(state >> 24));
+  }
+  vector<string> entries;
+  for (int i = 0; i < count; ++i) {
+    entries.push_back(common + "entry " + std::to_string(i));
+  }
+  return entries;
+}
+
+
+off_t FileSize(const string& path) {
+  struct stat st;
+  CHECK_EQ(stat(path.c_str(), &st), 0) << path;
+  return st.st_size;
+}
+
+
+class EntryArchiveTest : public ::testing::Test {
+ protected:
+  EntryArchiveTest() : path_(tmp_.TmpStorageDir() + "/archive") {
+  }
+
+  void WriteArchive(const vector<string>& entries,
+                    const string& dictionary) {
+    EntryArchiveWriter writer(path_, kFirstIndex, kEntriesPerBlock,
+                              dictionary);
+    for (const auto& entry : entries) {
+      writer.Add(entry);
+    }
+    writer.Finish();
+  }
+
+  TmpStorage tmp_;
+  const string path_;
+};
+
+typedef EntryArchiveTest EntryArchiveDeathTest;
+
+
+TEST_F(EntryArchiveTest, Lookup) {
+  const vector<string> entries(MakeEntries(10));
+  WriteArchive(entries, EntryArchive::BuildDictionary(entries));
+
+  const EntryArchive archive(path_);
+  EXPECT_EQ(kFirstIndex, archive.first_index());
+  EXPECT_EQ(kFirstIndex + 10, archive.end_index());
+  for (size_t i = 0; i < entries.size(); ++i) {
+    string entry;
+    archive.Lookup(kFirstIndex + i, &entry);
+    EXPECT_EQ(entries[i], entry);
+  }
+}
+
+
+TEST_F(EntryArchiveTest, ReadBlock) {
+  const vector<string> entries(MakeEntries(10));
+  WriteArchive(entries, "");
+
+  const EntryArchive archive(path_);
+  vector<string> block;
+  // From the middle of the second block to its end.
+  archive.ReadBlock(kFirstIndex + 5, &block);
+  EXPECT_EQ(vector<string>(entries.begin() + 5, entries.begin() + 8), block);
+
+  // The last block is short.
+  block.clear();
+  archive.ReadBlock(kFirstIndex + 8, &block);
+  EXPECT_EQ(vector<string>(entries.begin() + 8, entries.end()), block);
+
+  // Reading in bulk gives the same entries.
+  block.clear();
+  archive.ReadBlockBulk(kFirstIndex + 5, &block);
+  EXPECT_EQ(vector<string>(entries.begin() + 5, entries.begin() + 8), block);
+}
+
+
+TEST_F(EntryArchiveTest, DictionaryHelpsSmallBlocks) {
+  const vector<string> entries(MakeEntries(20));
+  WriteArchive(entries, "");
+  const off_t without_dictionary(FileSize(path_));
+
+  WriteArchive(entries, EntryArchive::BuildDictionary({entries[0]}));
+  // The dictionary itself is stored once, but saves repeating the
+  // common part in every block.
+  EXPECT_LT(FileSize(path_), without_dictionary);
+}
+
+
+TEST_F(EntryArchiveTest, OnlyAppearsWhenFinished) {
+  {
+    EntryArchiveWriter writer(path_, kFirstIndex, kEntriesPerBlock, "");
+    writer.Add("unicorn");
+    EXPECT_NE(0, access(path_.c_str(), F_OK));
+  }
+  EXPECT_NE(0, access(path_.c_str(), F_OK));
+  EXPECT_NE(0, access((path_ + ".tmp").c_str(), F_OK));
+}
+
+
+TEST_F(EntryArchiveDeathTest, DetectsCorruption) {
+  WriteArchive(MakeEntries(10), "");
+  const int fd(open(path_.c_str(), O_WRONLY));
+  CHECK_GE(fd, 0);
+  CHECK_EQ(pwrite(fd, "X", 1, FileSize(path_) - 20), 1);
+  CHECK_EQ(close(fd), 0);
+
+  EXPECT_DEATH(EntryArchive archive(path_), "corrupt index");
+}
+
+
+}  // namespace
+}  // namespace cert_trans
+
+
+int main(int argc, char** argv) {
+  cert_trans::test::InitTesting(argv[0], &argc, &argv, true);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,284 @@
+#include "log/entry_journal.h"
+
+#include <algorithm>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <glog/logging.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "util/util.h"
+
+using std::lock_guard;
+using std::mutex;
+using std::pair;
+using std::string;
+using std::unique_lock;
+using std::vector;
+
+namespace cert_trans {
+namespace {
+
+
+const size_t kHeaderLength = 8;
+const size_t kFileNumberDigits = 8;
+const char kFilePrefix[] = "journal-";
+
+
+uint32_t Crc32(const char* data, size_t length) {
+  return crc32(crc32(0, Z_NULL, 0), reinterpret_cast<const Bytef*>(data),
+               length);
+}
+
+
+void PutUint32(uint32_t value, char* out) {
+  for (int i = 3; i >= 0; --i) {
+    out[i] = static_cast<char>(value & 0xff);
+    value >>= 8;
+  }
+}
+
+
+uint32_t GetUint32(const char* in) {
+  uint32_t value(0);
+  for (int i = 0; i < 4; ++i) {
+    value = (value << 8) | static_cast<uint8_t>(in[i]);
+  }
+  return value;
+}
+
+
+// Returns the lowest number of the journal files in |dir|, or -1 if
+// there are none.
+int64_t FirstFileIndex(const string& dir) {
+  DIR* const d(CHECK_NOTNULL(opendir(dir.c_str())));
+  int64_t first(-1);
+  struct dirent* entry;
+  while ((entry = readdir(d)) != NULL) {
+    if (strncmp(entry->d_name, kFilePrefix, strlen(kFilePrefix)) != 0) {
+      continue;
+    }
+    const int64_t index(
+        strtoll(entry->d_name + strlen(kFilePrefix), NULL, 10));
+    if (first < 0 || index < first) {
+      first = index;
+    }
+  }
+  closedir(d);
+  return first;
+}
+
+
+}  // namespace
+
+
+EntryJournal::EntryJournal(const string& dir, off_t max_file_size)
+    : dir_(dir),
+      max_file_size_(max_file_size),
+      fd_(-1),
+      file_size_(0),
+      next_number_(0),
+      synced_number_(-1),
+      syncing_(false) {
+  CHECK_GT(max_file_size_, 0);
+  if (mkdir(dir_.c_str(), 0700) != 0) {
+    CHECK_EQ(errno, EEXIST) << dir_ << ": " << strerror(errno);
+  }
+
+  // The files older than the first one still there have been
+  // released, and the others follow it without gaps.
+  const int64_t first(FirstFileIndex(dir_));
+  for (int64_t index = first; index >= 0; ++index) {
+    const string path(FilePath(index));
+    if (access(path.c_str(), F_OK) != 0) {
+      CHECK_EQ(errno, ENOENT) << path << ": " << strerror(errno);
+      break;
+    }
+
+    off_t size;
+    file_size_ = ReadFile(path, &size);
+    if (file_size_ < size) {
+      // Only the last file can have been cut short by a crash, since
+      // a new one is only started once the current one is synced.
+      CHECK_EQ(access(FilePath(index + 1).c_str(), F_OK), -1)
+          << path << " is corrupt at offset " << file_size_
+          << ", but is not the last journal file";
+      LOG(WARNING) << path << ": discarding " << size - file_size_
+                   << " bytes of incomplete or corrupt records at offset "
+                   << file_size_;
+      CHECK_EQ(truncate(path.c_str(), file_size_), 0) << path << ": "
+                                                      << strerror(errno);
+    }
+    files_.push_back(File{static_cast<size_t>(index), next_number_ - 1});
+  }
+  synced_number_ = next_number_ - 1;
+
+  if (files_.empty()) {
+    OpenNextFile();
+  } else {
+    const string path(FilePath(files_.back().index));
+    fd_ = open(path.c_str(), O_WRONLY | O_APPEND);
+    CHECK_GE(fd_, 0) << path << ": " << strerror(errno);
+  }
+
+  if (!records_.empty()) {
+    LOG(INFO) << dir_ << ": " << records_.size()
+              << " records left in the journal";
+  }
+}
+
+
+EntryJournal::~EntryJournal() {
+  CHECK_EQ(close(fd_), 0);
+}
+
+
+int64_t EntryJournal::Append(const string& data) {
+  CHECK_LE(data.size(), UINT32_MAX);
+  string record(kHeaderLength, '\0');
+  record.reserve(kHeaderLength + data.size());
+  PutUint32(data.size(), &record[4]);
+  record.append(data);
+  PutUint32(Crc32(record.data() + 4, record.size() - 4), &record[0]);
+
+  unique_lock<mutex> lock(lock_);
+  // Files are only closed once all their records are synced, so that
+  // syncing the current one is always enough.
+  if (file_size_ >= max_file_size_ && !syncing_ &&
+      synced_number_ == next_number_ - 1) {
+    OpenNextFile();
+  }
+
+  // Written all at once, so that a crash can only leave the last
+  // record incomplete.
+  for (size_t done = 0; done < record.size();) {
+    const ssize_t bytes(
+        write(fd_, record.data() + done, record.size() - done));
+    if (bytes < 0 && errno == EINTR) {
+      continue;
+    }
+    CHECK_GT(bytes, 0) << "writing to " << dir_ << ": " << strerror(errno);
+    done += bytes;
+  }
+  file_size_ += record.size();
+  const int64_t number(next_number_++);
+  files_.back().last_number = number;
+  records_.emplace_back(number, data);
+
+  // Whoever syncs covers all the records written so far, so that the
+  // callers which came in meanwhile only wait for the next one.
+  while (synced_number_ < number) {
+    if (syncing_) {
+      synced_.wait(lock);
+      continue;
+    }
+    syncing_ = true;
+    const int fd(fd_);
+    const int64_t written(next_number_ - 1);
+    lock.unlock();
+    CHECK_EQ(fdatasync(fd), 0) << "syncing " << dir_ << ": "
+                               << strerror(errno);
+    lock.lock();
+    syncing_ = false;
+    synced_number_ = written;
+    synced_.notify_all();
+  }
+
+  return number;
+}
+
+
+void EntryJournal::Read(int64_t first_number, size_t max_records,
+                        vector<pair<int64_t, string>>* records) const {
+  CHECK_NOTNULL(records);
+  lock_guard<mutex> lock(lock_);
+  if (records_.empty() || first_number > synced_number_) {
+    return;
+  }
+  // The numbers of the records in memory have no gaps.
+  size_t i(std::max<int64_t>(first_number - records_.front().first, 0));
+  for (; i < records_.size() && records_[i].first <= synced_number_ &&
+         max_records > 0;
+       ++i, --max_records) {
+    records->push_back(records_[i]);
+  }
+}
+
+
+void EntryJournal::Release(int64_t number) {
+  lock_guard<mutex> lock(lock_);
+  while (!records_.empty() && records_.front().first <= number) {
+    records_.pop_front();
+  }
+  while (files_.size() > 1 && files_.front().last_number <= number) {
+    const string path(FilePath(files_.front().index));
+    CHECK_EQ(unlink(path.c_str()), 0) << path << ": " << strerror(errno);
+    files_.pop_front();
+  }
+}
+
+
+size_t EntryJournal::NumRecords() const {
+  lock_guard<mutex> lock(lock_);
+  return records_.size();
+}
+
+
+string EntryJournal::FilePath(size_t index) const {
+  const string number(std::to_string(index));
+  return dir_ + "/" + kFilePrefix +
+         string(kFileNumberDigits -
+                    std::min(kFileNumberDigits, number.size()),
+                '0') +
+         number;
+}
+
+
+off_t EntryJournal::ReadFile(const string& path, off_t* file_size) {
+  string contents;
+  CHECK(util::ReadBinaryFile(path, &contents)) << path;
+  *file_size = contents.size();
+
+  size_t offset(0);
+  while (contents.size() - offset >= kHeaderLength) {
+    const char* const header(contents.data() + offset);
+    const uint64_t size(kHeaderLength + GetUint32(header + 4));
+    if (contents.size() - offset < size ||
+        Crc32(header + 4, size - 4) != GetUint32(header)) {
+      break;
+    }
+
+    records_.emplace_back(next_number_++,
+                          contents.substr(offset + kHeaderLength,
+                                          size - kHeaderLength));
+    offset += size;
+  }
+
+  return offset;
+}
+
+
+void EntryJournal::OpenNextFile() {
+  if (fd_ >= 0) {
+    CHECK_EQ(close(fd_), 0);
+  }
+  const size_t index(files_.empty() ? 0 : files_.back().index + 1);
+  const string path(FilePath(index));
+  fd_ = open(path.c_str(), O_WRONLY | O_APPEND | O_CREAT, 0600);
+  CHECK_GE(fd_, 0) << path << ": " << strerror(errno);
+  files_.push_back(File{index, next_number_ - 1});
+  file_size_ = 0;
+
+  // The new file itself has to survive a crash, not only its records.
+  const int dir_fd(open(dir_.c_str(), O_RDONLY));
+  CHECK_GE(dir_fd, 0) << dir_ << ": " << strerror(errno);
+  CHECK_EQ(fsync(dir_fd), 0) << dir_ << ": " << strerror(errno);
+  CHECK_EQ(close(dir_fd), 0);
+}
+
+
+}  // namespace cert_trans
@@ -0,0 +1,108 @@
+#ifndef CERT_TRANS_LOG_ENTRY_JOURNAL_H_
+#define CERT_TRANS_LOG_ENTRY_JOURNAL_H_
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <sys/types.h>
+#include <utility>
+#include <vector>
+
+#include "base/macros.h"
+
+namespace cert_trans {
+
+
+// A write-ahead journal of records, kept on local disk until they are
+// known to be stored somewhere else, such as the consistent store.
+//
+// <dir>/journal-NNNNNNNN - The records, in the order they were
+//                          appended. A new file is started when the
+//                          current one reaches the maximum size.
+//
+// Each record is:
+//
+//   uint32 crc         - CRC-32 of the rest of the record.
+//   uint32 data_length
+//   data
+//
+// with the integers in big-endian order, like in SegmentStorage.
+//
+// Records are numbered from zero in the order they are appended, and
+// Append() only returns once its record is on disk. They are also
+// kept in memory to be read back, until they are released. Once all
+// the records of a file other than the current one are released, it
+// is deleted.
+//
+// The records still in the journal when it is opened are read back,
+// and numbered from zero again. If the last one is incomplete or
+// corrupt, because of a crash while it was being written, the file is
+// truncated before it.
+//
+// EntryJournal aborts upon any filesystem error. This class is
+// threadsafe.
+class EntryJournal {
+ public:
+  // Starts a new file when the current one is |max_file_size| bytes
+  // or more.
+  EntryJournal(const std::string& dir, off_t max_file_size);
+  ~EntryJournal();
+
+  // Appends |record|, and returns its number once it has been synced
+  // to disk. Concurrent calls share their fdatasync().
+  int64_t Append(const std::string& record);
+
+  // Appends to |records| up to |max_records| of the records synced to
+  // disk and not released yet, with their numbers, starting at
+  // |first_number|.
+  void Read(int64_t first_number, size_t max_records,
+            std::vector<std::pair<int64_t, std::string>>* records) const;
+
+  // Releases the records numbered up to |number| included.
+  void Release(int64_t number);
+
+  // The number of records not released yet.
+  size_t NumRecords() const;
+
+ private:
+  struct File {
+    size_t index;
+    // The number of the last record in the file, or of the one before
+    // the file if it has none.
+    int64_t last_number;
+  };
+
+  std::string FilePath(size_t index) const;
+  // Reads the records of the file at |path| into "records_", and
+  // returns the length of the valid records at its beginning. Its
+  // whole length is put in |file_size|.
+  off_t ReadFile(const std::string& path, off_t* file_size);
+  // Closes the current file and starts the one after it. This must be
+  // called with "lock_" held.
+  void OpenNextFile();
+
+  const std::string dir_;
+  const off_t max_file_size_;
+
+  mutable std::mutex lock_;
+  std::condition_variable synced_;
+  // The files of the journal, oldest first. Only the last one is open
+  // and written to.
+  std::deque<File> files_;
+  int fd_;
+  off_t file_size_;
+  int64_t next_number_;
+  int64_t synced_number_;
+  bool syncing_;
+  // The records not released yet, in order.
+  std::deque<std::pair<int64_t, std::string>> records_;
+
+  DISALLOW_COPY_AND_ASSIGN(EntryJournal);
+};
+
+
+}  // namespace cert_trans
+
+#endif  // CERT_TRANS_LOG_ENTRY_JOURNAL_H_
@@ -0,0 +1,146 @@
+#include "log/entry_journal.h"
+
+#include <gtest/gtest.h>
+#include <memory>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+#include "util/test_db.h"
+#include "util/testing.h"
+
+namespace cert_trans {
+namespace {
+
+using std::pair;
+using std::string;
+using std::unique_ptr;
+using std::vector;
+
+const off_t kMaxFileSize = 100;
+
+
+class EntryJournalTest : public ::testing::Test {
+ protected:
+  EntryJournalTest()
+      : dir_(tmp_.TmpStorageDir() + "/journal"), journal_(OpenJournal()) {
+  }
+
+  EntryJournal* OpenJournal() {
+    return new EntryJournal(dir_, kMaxFileSize);
+  }
+
+  vector<pair<int64_t, string>> ReadAll() {
+    vector<pair<int64_t, string>> records;
+    journal_->Read(0, journal_->NumRecords(), &records);
+    return records;
+  }
+
+  TmpStorage tmp_;
+  const string dir_;
+  unique_ptr<EntryJournal> journal_;
+};
+
+
+TEST_F(EntryJournalTest, AppendAndRead) {
+  EXPECT_EQ(0, journal_->Append("one"));
+  EXPECT_EQ(1, journal_->Append("two"));
+  EXPECT_EQ(2, journal_->Append("three"));
+  EXPECT_EQ(3U, journal_->NumRecords());
+
+  vector<pair<int64_t, string>> records;
+  journal_->Read(1, 10, &records);
+  ASSERT_EQ(2U, records.size());
+  EXPECT_EQ(1, records[0].first);
+  EXPECT_EQ("two", records[0].second);
+  EXPECT_EQ(2, records[1].first);
+  EXPECT_EQ("three", records[1].second);
+
+  records.clear();
+  journal_->Read(0, 1, &records);
+  ASSERT_EQ(1U, records.size());
+  EXPECT_EQ("one", records[0].second);
+}
+
+
+TEST_F(EntryJournalTest, Release) {
+  journal_->Append("one");
+  journal_->Append("two");
+  journal_->Release(0);
+  EXPECT_EQ(1U, journal_->NumRecords());
+
+  vector<pair<int64_t, string>> records;
+  journal_->Read(0, 10, &records);
+  ASSERT_EQ(1U, records.size());
+  EXPECT_EQ(1, records[0].first);
+  EXPECT_EQ("two", records[0].second);
+}
+
+
+TEST_F(EntryJournalTest, RecoversRecordsNotReleased) {
+  journal_->Append("one");
+  journal_->Append("two");
+  journal_->Append("three");
+  journal_->Release(0);
+
+  journal_.reset(OpenJournal());
+  // Only whole files are deleted, so released records can come back.
+  const vector<pair<int64_t, string>> records(ReadAll());
+  ASSERT_LE(2U, records.size());
+  EXPECT_EQ("two", records[records.size() - 2].second);
+  EXPECT_EQ("three", records.back().second);
+
+  // Carries on after them.
+  EXPECT_EQ(static_cast<int64_t>(records.size()), journal_->Append("four"));
+}
+
+
+TEST_F(EntryJournalTest, DeletesReleasedFiles) {
+  const string record(kMaxFileSize, 'x');
+  for (int i = 0; i < 5; ++i) {
+    journal_->Append(record);
+  }
+  EXPECT_EQ(0, access((dir_ + "/journal-00000000").c_str(), F_OK));
+
+  journal_->Release(3);
+  EXPECT_NE(0, access((dir_ + "/journal-00000000").c_str(), F_OK));
+
+  journal_.reset(OpenJournal());
+  const vector<pair<int64_t, string>> records(ReadAll());
+  ASSERT_EQ(1U, records.size());
+  EXPECT_EQ(record, records[0].second);
+}
+
+
+TEST_F(EntryJournalTest, DiscardsIncompleteRecord) {
+  journal_->Append("one");
+  journal_->Append("two");
+  journal_.reset();
+
+  const string path(dir_ + "/journal-00000000");
+  struct stat st;
+  ASSERT_EQ(0, stat(path.c_str(), &st));
+  ASSERT_EQ(0, truncate(path.c_str(), st.st_size - 1));
+
+  journal_.reset(OpenJournal());
+  const vector<pair<int64_t, string>> records(ReadAll());
+  ASSERT_EQ(1U, records.size());
+  EXPECT_EQ("one", records[0].second);
+
+  // New records are appended after the valid ones.
+  journal_->Append("three");
+  journal_.reset(OpenJournal());
+  EXPECT_EQ(2U, ReadAll().size());
+}
+
+
+}  // namespace
+}  // namespace cert_trans
+
+
+int main(int argc, char** argv) {
+  cert_trans::test::InitTesting(argv[0], &argc, &argv, true);
+  return RUN_ALL_TESTS();
+}
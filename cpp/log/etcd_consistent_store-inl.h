@@ -4,11 +4,14 @@
 #include <chrono>
 #include <gflags/gflags.h>
 #include <glog/logging.h>
+#include <iomanip>
+#include <sstream>
 #include <unordered_map>
 #include <vector>
 
 #include "base/notification.h"
 #include "log/etcd_consistent_store.h"
+#include "log/key_value_storage.h"
 #include "log/logged_certificate.h"
 #include "monitoring/event_metric.h"
 #include "monitoring/latency.h"
@@ -16,12 +19,25 @@
 #include "util/etcd_delete.h"
 #include "util/executor.h"
 #include "util/masterelection.h"
+#include "util/trace.h"
 #include "util/util.h"
 
 DECLARE_int32(etcd_stats_collection_interval_seconds);
 
 DECLARE_int32(node_state_ttl_seconds);
 
+DECLARE_int32(etcd_pending_entry_batch_delay_ms);
+
+DECLARE_int32(etcd_pending_entry_batch_size);
+
+DECLARE_int32(etcd_pending_entry_shard_digits);
+
+DECLARE_bool(etcd_refresh_node_state);
+
+DECLARE_int32(etcd_sequence_mapping_chunk_size);
+
+DECLARE_bool(etcd_watch_pending_entries);
+
 namespace cert_trans {
 namespace {
 
@@ -29,6 +45,7 @@ namespace {
 const char kClusterConfigFile[] = "/cluster_config";
 const char kEntriesDir[] = "/entries/";
 const char kSequenceFile[] = "/sequence_mapping";
+const char kSequenceChunksDir[] = "/sequence_mapping_chunks/";
 const char kServingSthFile[] = "/serving_sth";
 const char kNodesDir[] = "/nodes/";
 
@@ -51,6 +68,12 @@ static Counter<std::string>* etcd_rejected_requests =
                               "Total number of requests rejected due to "
                               "overload, broken down by request type.");
 
+static Gauge<std::string>* etcd_snapshot_age_seconds =
+    Gauge<std::string>::New("etcd_snapshot_age_seconds", "type",
+                            "Seconds since each snapshot kept up to date by "
+                            "an etcd watch last changed, by type, as of the "
+                            "latest etcd stats fetch.");
+
 static Latency<std::chrono::milliseconds, std::string> etcd_latency_by_op_ms(
     "etcd_latency_by_op_ms", "operation",
     "Etcd latency in ms broken down by operation.");
@@ -112,18 +135,36 @@ template <class Logged>
 EtcdConsistentStore<Logged>::EtcdConsistentStore(
     libevent::Base* base, util::Executor* executor, EtcdClient* client,
     const MasterElection* election, const std::string& root,
-    const std::string& node_id)
+    const std::string& node_id, KeyValueStorage* entry_bodies)
     : client_(CHECK_NOTNULL(client)),
       base_(CHECK_NOTNULL(base)),
       executor_(CHECK_NOTNULL(executor)),
+      entry_bodies_(entry_bodies),
       election_(CHECK_NOTNULL(election)),
       root_(root),
       node_id_(node_id),
       serving_sth_watch_task_(CHECK_NOTNULL(executor)),
       cluster_config_watch_task_(CHECK_NOTNULL(executor)),
+      pending_entries_watch_task_(executor),
       etcd_stats_task_(executor_),
+      pending_writes_task_(executor_),
+      mutex_("etcd_consistent_store"),
       received_initial_sth_(false),
-      exiting_(false) {
+      exiting_(false),
+      serving_sth_updated_ms_(0),
+      cluster_config_updated_ms_(0),
+      num_etcd_entries_(0),
+      node_state_written_ms_(0),
+      pending_writes_flush_scheduled_(false),
+      known_pending_entries_heap_bytes_(0),
+      known_pending_entries_memory_("etcd_known_pending_entries"),
+      sequence_mapping_handle_(-1),
+      sequence_mapping_is_legacy_(false),
+      sequence_mapping_memory_("etcd_sequence_mapping") {
+  CHECK_GE(FLAGS_etcd_pending_entry_shard_digits, 0);
+  CHECK_LE(FLAGS_etcd_pending_entry_shard_digits, 4);
+  CHECK_GT(FLAGS_etcd_sequence_mapping_chunk_size, 0);
+
   // Set up watches on things we're interested in...
   WatchServingSTH(
       std::bind(&EtcdConsistentStore<Logged>::OnEtcdServingSTHUpdated, this,
@@ -133,13 +174,22 @@ EtcdConsistentStore<Logged>::EtcdConsistentStore(
       std::bind(&EtcdConsistentStore<Logged>::OnClusterConfigUpdated, this,
                 std::placeholders::_1),
       cluster_config_watch_task_.task());
+  if (FLAGS_etcd_watch_pending_entries) {
+    client_->Watch(
+        GetFullPath(kEntriesDir),
+        std::bind(&EtcdConsistentStore<Logged>::OnPendingEntriesUpdated, this,
+                  std::placeholders::_1),
+        pending_entries_watch_task_.task());
+  } else {
+    pending_entries_watch_task_.task()->Return();
+  }
 
   StartEtcdStatsFetch();
 
   // And wait for the initial updates to come back so that we've got a
   // view on the current state before proceding...
   {
-    std::unique_lock<std::mutex> lock(mutex_);
+    std::unique_lock<Mutex> lock(mutex_);
     serving_sth_cv_.wait(lock, [this]() { return received_initial_sth_; });
   }
 }
@@ -150,15 +200,20 @@ EtcdConsistentStore<Logged>::~EtcdConsistentStore() {
   VLOG(1) << "Cancelling watch tasks.";
   serving_sth_watch_task_.Cancel();
   cluster_config_watch_task_.Cancel();
+  pending_entries_watch_task_.Cancel();
   VLOG(1) << "Waiting for watch tasks to return.";
   serving_sth_watch_task_.Wait();
   cluster_config_watch_task_.Wait();
+  pending_entries_watch_task_.Wait();
   VLOG(1) << "Cancelling stats task.";
   etcd_stats_task_.Cancel();
   etcd_stats_task_.Wait();
+  VLOG(1) << "Cancelling pending entry writes.";
+  pending_writes_task_.task()->Return(util::Status::CANCELLED);
+  pending_writes_task_.Wait();
   VLOG(1) << "Joining cleanup thread";
   {
-    std::lock_guard<std::mutex> lock(mutex_);
+    std::lock_guard<Mutex> lock(mutex_);
     exiting_ = true;
   }
   serving_sth_cv_.notify_all();
@@ -185,18 +240,20 @@ EtcdConsistentStore<Logged>::NextAvailableSequenceNumber() const {
            1;
   }
 
-  if (!serving_sth_) {
+  const std::shared_ptr<const ct::SignedTreeHead> serving_sth(
+      std::atomic_load(&serving_sth_snapshot_));
+  if (!serving_sth) {
     LOG(WARNING) << "Log has no Serving STH [new log?], returning 0";
     return 0;
   }
 
-  return serving_sth_->Entry().tree_size();
+  return serving_sth->tree_size();
 }
 
 
 template <class Logged>
 void EtcdConsistentStore<Logged>::WaitForServingSTHVersion(
-    std::unique_lock<std::mutex>* lock, const int version) {
+    std::unique_lock<Mutex>* lock, const int version) {
   VLOG(1) << "Waiting for ServingSTH version " << version;
   serving_sth_cv_.wait(*lock, [this, version]() {
     VLOG(1) << "Want version " << version << ", have: "
@@ -214,7 +271,7 @@ util::Status EtcdConsistentStore<Logged>::SetServingSTH(
       etcd_latency_by_op_ms.GetScopedLatency("set_serving_sth"));
 
   const std::string full_path(GetFullPath(kServingSthFile));
-  std::unique_lock<std::mutex> lock(mutex_);
+  std::unique_lock<Mutex> lock(mutex_);
 
   // The watcher should have already populated serving_sth_ if etcd had one.
   if (!serving_sth_) {
@@ -256,9 +313,10 @@ util::Status EtcdConsistentStore<Logged>::SetServingSTH(
 template <class Logged>
 util::StatusOr<ct::SignedTreeHead> EtcdConsistentStore<Logged>::GetServingSTH()
     const {
-  std::lock_guard<std::mutex> lock(mutex_);
-  if (serving_sth_) {
-    return serving_sth_->Entry();
+  const std::shared_ptr<const ct::SignedTreeHead> serving_sth(
+      std::atomic_load(&serving_sth_snapshot_));
+  if (serving_sth) {
+    return *serving_sth;
   } else {
     return util::Status(util::error::NOT_FOUND, "No current Serving STH.");
   }
@@ -285,52 +343,291 @@ bool LeafEntriesMatch(const Logged& a, const Logged& b) {
 
 template <class Logged>
 util::Status EtcdConsistentStore<Logged>::AddPendingEntry(Logged* entry) {
-  ScopedLatency scoped_latency(
-      etcd_latency_by_op_ms.GetScopedLatency("add_pending_entry"));
+  util::SyncTask task(executor_);
+  AddPendingEntryAsync(entry, task.task());
+  task.Wait();
+  return task.status();
+}
+
 
+template <class Logged>
+void EtcdConsistentStore<Logged>::AddPendingEntryAsync(Logged* entry,
+                                                       util::Task* task) {
   CHECK_NOTNULL(entry);
+  CHECK_NOTNULL(task);
   CHECK(!entry->has_sequence_number());
 
-  util::Status status(MaybeReject("add_pending_entry"));
+  const util::Status status(MaybeReject("add_pending_entry"));
   if (!status.ok()) {
-    return status;
+    task->Return(status);
+    return;
+  }
+  task->DeleteWhenDone(new ScopedLatency(
+      etcd_latency_by_op_ms.GetScopedLatency("add_pending_entry")));
+  task->DeleteWhenDone(new util::TraceSpan("etcd.add_pending_entry"));
+
+  if (FLAGS_etcd_watch_pending_entries) {
+    std::lock_guard<std::mutex> lock(known_pending_entries_lock_);
+    const auto it(known_pending_entries_.find(GetEntryPath(*entry)));
+    if (it != known_pending_entries_.end()) {
+      // The hash covers the leaf, so this is the same certificate,
+      // possibly with another chain.
+      *entry->mutable_sct() = it->second;
+      task->Return(util::Status(util::error::ALREADY_EXISTS,
+                                "Pending entry already exists."));
+      return;
+    }
   }
 
-  const std::string full_path(GetEntryPath(*entry));
-  EntryHandle<Logged> handle(full_path, *entry);
-  status = CreateEntry(&handle);
-  if (status.CanonicalCode() == util::error::FAILED_PRECONDITION) {
-    // Entry with that hash already exists.
-    EntryHandle<Logged> preexisting_entry;
-    status = GetEntry(full_path, &preexisting_entry);
-    if (!status.ok()) {
-      LOG(ERROR) << "Couldn't create or fetch " << full_path << " : "
-                 << status;
-      return status;
+  bool flush_now(false);
+  bool schedule_flush(false);
+  {
+    std::lock_guard<std::mutex> lock(pending_writes_lock_);
+    pending_writes_.emplace_back(entry, task);
+    if (pending_writes_.size() >=
+        static_cast<size_t>(FLAGS_etcd_pending_entry_batch_size)) {
+      flush_now = true;
+    } else if (!pending_writes_flush_scheduled_) {
+      pending_writes_flush_scheduled_ = true;
+      schedule_flush = true;
     }
+  }
 
-    // Check the leaf certs are the same (we might be seeing the same cert
-    // submitted with a different chain.)
-    CHECK(LeafEntriesMatch(preexisting_entry.Entry(), *entry));
-    *entry->mutable_sct() = preexisting_entry.Entry().sct();
-    return util::Status(util::error::ALREADY_EXISTS,
-                        "Pending entry already exists.");
+  if (flush_now) {
+    FlushPendingWrites();
+  } else if (schedule_flush) {
+    base_->Delay(
+        std::chrono::milliseconds(FLAGS_etcd_pending_entry_batch_delay_ms),
+        pending_writes_task_.task()->AddChild(
+            std::bind(&EtcdConsistentStore<Logged>::FlushPendingWrites,
+                      this)));
+  }
+}
+
+
+template <class Logged>
+void EtcdConsistentStore<Logged>::FlushPendingWrites() {
+  std::vector<std::pair<Logged*, util::Task*>> writes;
+  {
+    std::lock_guard<std::mutex> lock(pending_writes_lock_);
+    writes.swap(pending_writes_);
+    pending_writes_flush_scheduled_ = false;
+  }
+  if (writes.empty()) {
+    // Already flushed, as the batch filled up.
+    return;
+  }
+
+  VLOG(1) << "Writing " << writes.size() << " pending entries";
+  const bool exiting(!pending_writes_task_.task()->IsActive());
+  for (const auto& write : writes) {
+    if (exiting) {
+      write.second->Return(util::Status::CANCELLED);
+    } else {
+      // The client pipelines these over its connections, rather than
+      // waiting for each to return before sending the next.
+      WritePendingEntry(write.first, write.second);
+    }
   }
-  return status;
+}
+
+
+template <class Logged>
+void EtcdConsistentStore<Logged>::WritePendingEntry(Logged* entry,
+                                                    util::Task* task) {
+  std::string flat_entry;
+  CHECK(entry->SerializeToString(&flat_entry));
+  if (entry_bodies_) {
+    // If it is there already, this is a duplicate, and either it is in
+    // etcd too, or it is being added by whoever stored it.
+    const util::Status status(
+        entry_bodies_->CreateEntry(util::HexString(entry->Hash()),
+                                   flat_entry));
+    if (!status.ok() &&
+        status.CanonicalCode() != util::error::ALREADY_EXISTS) {
+      LOG(WARNING) << "Couldn't store the body of " << GetEntryPath(*entry)
+                   << ": " << status;
+      task->Return(status);
+      return;
+    }
+    Logged stub(*entry);
+    stub.ClearBody();
+    CHECK(stub.SerializeToString(&flat_entry));
+  }
+  EtcdClient::Response* const resp(new EtcdClient::Response);
+  task->DeleteWhenDone(resp);
+  client_->Create(GetEntryPath(*entry), util::ToBase64(flat_entry), resp,
+                  task->AddChild(std::bind(
+                      &EtcdConsistentStore<Logged>::PendingEntryCreated, this,
+                      entry, task, std::placeholders::_1)));
+}
+
+
+template <class Logged>
+void EtcdConsistentStore<Logged>::PendingEntryCreated(
+    Logged* entry, util::Task* task, util::Task* create_task) {
+  if (create_task->status().CanonicalCode() !=
+      util::error::FAILED_PRECONDITION) {
+    task->Return(create_task->status());
+    return;
+  }
+
+  // Entry with that hash already exists.
+  EtcdClient::GetResponse* const get_resp(new EtcdClient::GetResponse);
+  task->DeleteWhenDone(get_resp);
+  client_->Get(GetEntryPath(*entry), get_resp,
+               task->AddChild(std::bind(
+                   &EtcdConsistentStore<Logged>::ExistingPendingEntryFetched,
+                   this, entry, get_resp, task, std::placeholders::_1)));
+}
+
+
+template <class Logged>
+void EtcdConsistentStore<Logged>::ExistingPendingEntryFetched(
+    Logged* entry, EtcdClient::GetResponse* resp, util::Task* task,
+    util::Task* get_task) {
+  if (!get_task->status().ok()) {
+    LOG(ERROR) << "Couldn't create or fetch " << GetEntryPath(*entry)
+               << " : " << get_task->status();
+    task->Return(get_task->status());
+    return;
+  }
+  Logged preexisting_entry;
+  CHECK(preexisting_entry.ParseFromString(
+      util::FromBase64(resp->node.value_.c_str())));
+  const util::Status status(RestoreEntryBody(&preexisting_entry));
+  if (!status.ok()) {
+    task->Return(status);
+    return;
+  }
+
+  // Check the leaf certs are the same (we might be seeing the same cert
+  // submitted with a different chain.)
+  CHECK(LeafEntriesMatch(preexisting_entry, *entry));
+  *entry->mutable_sct() = preexisting_entry.sct();
+  task->Return(util::Status(util::error::ALREADY_EXISTS,
+                            "Pending entry already exists."));
 }
 
 template <class Logged>
 util::Status EtcdConsistentStore<Logged>::GetPendingEntryForHash(
     const std::string& hash, EntryHandle<Logged>* entry) const {
-  ScopedLatency scoped_latency(
-      etcd_latency_by_op_ms.GetScopedLatency("get_pending_entry_for_hash"));
+  util::SyncTask task(executor_);
+  GetPendingEntryForHashAsync(hash, entry, task.task());
+  task.Wait();
+  return task.status();
+}
 
-  util::Status status(GetEntry(GetEntryPath(hash), entry));
-  if (status.ok()) {
-    CHECK(!entry->Entry().has_sequence_number());
+
+template <class Logged>
+void EtcdConsistentStore<Logged>::GetPendingEntryForHashAsync(
+    const std::string& hash, EntryHandle<Logged>* entry,
+    util::Task* task) const {
+  CHECK_NOTNULL(entry);
+  CHECK_NOTNULL(task);
+  task->DeleteWhenDone(new ScopedLatency(
+      etcd_latency_by_op_ms.GetScopedLatency("get_pending_entry_for_hash")));
+
+  const std::string path(GetEntryPath(hash));
+  EtcdClient::GetResponse* const resp(new EtcdClient::GetResponse);
+  task->DeleteWhenDone(resp);
+  client_->Get(path, resp, task->AddChild([this, path, entry, resp,
+                                           task](util::Task* get_task) {
+    if (!get_task->status().ok()) {
+      task->Return(get_task->status());
+      return;
+    }
+    Logged logged;
+    CHECK(logged.ParseFromString(util::FromBase64(resp->node.value_.c_str())));
+    CHECK(!logged.has_sequence_number());
+    entry->Set(path, logged, resp->node.modified_index_);
+    task->Return(RestoreEntryBody(entry->MutableEntry()));
+  }));
+}
+
+
+// static
+template <class Logged>
+void EtcdConsistentStore<Logged>::ParsePendingEntriesDir(
+    const EtcdClient::Node& dir, bool stubs,
+    std::vector<std::string>* subdirs,
+    std::vector<EntryHandle<Logged>>* entries) {
+  for (const auto& node : dir.nodes_) {
+    if (node.is_dir_) {
+      subdirs->emplace_back(node.key_);
+      continue;
+    }
+    Logged entry;
+    CHECK(entry.ParseFromString(util::FromBase64(node.value_.c_str())));
+    CHECK(!entry.has_sequence_number());
+    if (stubs) {
+      entry.ClearBody();
+    }
+    entries->emplace_back(
+        EntryHandle<Logged>(node.key_, entry, node.modified_index_));
   }
+}
 
-  return status;
+
+template <class Logged>
+util::Status EtcdConsistentStore<Logged>::ListPendingEntries(
+    bool stubs, std::vector<EntryHandle<Logged>>* entries) const {
+  CHECK_NOTNULL(entries);
+  CHECK_EQ(0, entries->size());
+  const std::string dir(GetFullPath(kEntriesDir));
+  EtcdClient::GetResponse resp;
+  {
+    util::SyncTask task(executor_);
+    client_->Get(dir, &resp, task.task());
+    task.Wait();
+    if (!task.status().ok()) {
+      return task.status();
+    }
+  }
+  if (!resp.node.is_dir_) {
+    return util::Status(util::error::FAILED_PRECONDITION,
+                        "node is not a directory: " + dir);
+  }
+
+  // Entries written before the shard directories were used are still
+  // directly in the entries directory.
+  std::vector<std::string> shards;
+  ParsePendingEntriesDir(resp.node, stubs, &shards, entries);
+
+  // The shards are fetched all at once, rather than as one huge
+  // response.
+  std::vector<EtcdClient::GetResponse> shard_resps(shards.size());
+  std::vector<std::unique_ptr<util::SyncTask>> shard_tasks;
+  for (size_t i = 0; i < shards.size(); ++i) {
+    shard_tasks.emplace_back(new util::SyncTask(executor_));
+    client_->Get(shards[i], &shard_resps[i], shard_tasks.back()->task());
+  }
+  util::Status status;
+  for (size_t i = 0; i < shards.size(); ++i) {
+    shard_tasks[i]->Wait();
+    if (!shard_tasks[i]->status().ok()) {
+      // One of the others has failed already, or the shard has been
+      // removed since it was listed.
+      if (status.ok() &&
+          shard_tasks[i]->status().CanonicalCode() != util::error::NOT_FOUND) {
+        status = shard_tasks[i]->status();
+      }
+      continue;
+    }
+    std::vector<std::string> subdirs;
+    ParsePendingEntriesDir(shard_resps[i].node, stubs, &subdirs, entries);
+    // The response is not needed anymore, and can be large.
+    shard_resps[i] = EtcdClient::GetResponse();
+    LOG_IF(WARNING, !subdirs.empty()) << "ignoring directories in "
+                                      << shards[i];
+  }
+  if (!status.ok()) {
+    entries->clear();
+    return status;
+  }
+
+  etcd_total_entries->Set("entries", entries->size());
+  return util::Status::OK;
 }
 
 
@@ -340,17 +637,88 @@ util::Status EtcdConsistentStore<Logged>::GetPendingEntries(
   ScopedLatency scoped_latency(
       etcd_latency_by_op_ms.GetScopedLatency("get_pending_entries"));
 
-  util::Status status(GetAllEntriesInDir(GetFullPath(kEntriesDir), entries));
-  if (status.ok()) {
-    for (const auto& entry : *entries) {
-      CHECK(!entry.Entry().has_sequence_number());
+  util::Status status(ListPendingEntries(false /* stubs */, entries));
+  for (auto& entry : *entries) {
+    if (!status.ok()) {
+      break;
     }
+    status = RestoreEntryBody(entry.MutableEntry());
+  }
+  if (!status.ok()) {
+    entries->clear();
   }
-  etcd_total_entries->Set("entries", entries->size());
   return status;
 }
 
 
+template <class Logged>
+util::Status EtcdConsistentStore<Logged>::GetPendingEntryStubs(
+    std::vector<EntryHandle<Logged>>* entries) const {
+  ScopedLatency scoped_latency(
+      etcd_latency_by_op_ms.GetScopedLatency("get_pending_entry_stubs"));
+
+  return ListPendingEntries(true /* stubs */, entries);
+}
+
+
+template <class Logged>
+util::Status EtcdConsistentStore<Logged>::RestorePendingEntryBodies(
+    const std::vector<Logged*>& entries) const {
+  ScopedLatency scoped_latency(
+      etcd_latency_by_op_ms.GetScopedLatency("restore_pending_entry_bodies"));
+
+  if (entry_bodies_) {
+    for (Logged* const entry : entries) {
+      const util::Status status(RestoreEntryBody(entry));
+      if (!status.ok()) {
+        return status;
+      }
+    }
+    return util::Status::OK;
+  }
+
+  const size_t batch_size(
+      std::max(1, FLAGS_etcd_pending_entry_batch_size));
+  for (size_t start = 0; start < entries.size(); start += batch_size) {
+    const size_t end(std::min(entries.size(), start + batch_size));
+    std::vector<EtcdClient::GetResponse> resps(end - start);
+    std::vector<std::unique_ptr<util::SyncTask>> tasks;
+    for (size_t i = start; i < end; ++i) {
+      tasks.emplace_back(new util::SyncTask(executor_));
+      if (entries[i]->HasBody()) {
+        tasks.back()->task()->Return();
+        continue;
+      }
+      client_->Get(GetEntryPath(entries[i]->Hash()), &resps[i - start],
+                   tasks.back()->task());
+    }
+    util::Status status;
+    for (size_t i = start; i < end; ++i) {
+      tasks[i - start]->Wait();
+      if (!status.ok() || entries[i]->HasBody()) {
+        continue;
+      }
+      status = tasks[i - start]->status();
+      if (!status.ok()) {
+        continue;
+      }
+      Logged body;
+      CHECK(body.ParseFromString(
+          util::FromBase64(resps[i - start].node.value_.c_str())));
+      if (!entries[i]->RestoreBody(body)) {
+        status = util::Status(util::error::FAILED_PRECONDITION,
+                              "no body for pending entry " +
+                                  util::HexString(entries[i]->Hash()));
+      }
+    }
+    if (!status.ok()) {
+      return status;
+    }
+  }
+  return util::Status::OK;
+}
+
+
 template <class Logged>
 bool LessBySequenceNumber(const EntryHandle<Logged>& lhs,
                           const EntryHandle<Logged>& rhs) {
@@ -366,14 +734,66 @@ util::Status EtcdConsistentStore<Logged>::GetSequenceMapping(
   ScopedLatency scoped_latency(
       etcd_latency_by_op_ms.GetScopedLatency("get_sequence_mapping"));
 
-  util::Status status(GetEntry(GetFullPath(kSequenceFile), sequence_mapping));
-  if (!status.ok()) {
-    return status;
+  // All the chunks are read at once, so they are consistent.
+  util::SyncTask task(executor_);
+  EtcdClient::GetResponse resp;
+  client_->Get(GetFullPath(kSequenceChunksDir), &resp, task.task());
+  task.Wait();
+  if (!task.status().ok() &&
+      task.status().CanonicalCode() != util::error::NOT_FOUND) {
+    return task.status();
+  }
+
+  std::map<int64_t, EntryHandle<ct::SequenceMapping>> chunks;
+  int64_t handle(-1);
+  if (task.status().ok()) {
+    if (!resp.node.is_dir_) {
+      return util::Status(util::error::FAILED_PRECONDITION,
+                          "sequence mapping chunks are not a directory");
+    }
+    for (const auto& node : resp.node.nodes_) {
+      ct::SequenceMapping chunk;
+      CHECK(chunk.ParseFromString(util::FromBase64(node.value_.c_str())));
+      const int64_t first(
+          std::stoll(node.key_.substr(node.key_.rfind('/') + 1)));
+      CHECK(chunks.emplace(first, EntryHandle<ct::SequenceMapping>(
+                                      node.key_, chunk, node.modified_index_))
+                .second);
+      handle = std::max(handle, node.modified_index_);
+    }
+  }
+
+  const bool is_legacy(chunks.empty());
+  if (is_legacy) {
+    // Not split in chunks yet.
+    const util::Status status(
+        GetEntry(GetFullPath(kSequenceFile), sequence_mapping));
+    if (!status.ok()) {
+      return status;
+    }
+    handle = sequence_mapping->Handle();
+  } else {
+    ct::SequenceMapping mapping;
+    for (const auto& chunk : chunks) {
+      mapping.mutable_mapping()->MergeFrom(chunk.second.Entry().mapping());
+    }
+    sequence_mapping->Set(GetFullPath(kSequenceChunksDir), mapping, handle);
   }
   CheckMappingIsOrdered(sequence_mapping->Entry());
   CheckMappingIsContiguousWithServingTree(sequence_mapping->Entry());
   etcd_total_entries->Set("sequenced",
                           sequence_mapping->Entry().mapping_size());
+
+  // Every update writes at least one chunk, so a higher handle is a
+  // later version. A lower one was read while an update was under
+  // way.
+  std::unique_lock<std::mutex> lock(sequence_mapping_lock_);
+  if (handle > sequence_mapping_handle_) {
+    sequence_mapping_chunks_.swap(chunks);
+    sequence_mapping_handle_ = handle;
+    sequence_mapping_is_legacy_ = is_legacy;
+    UpdateSequenceMappingMemory(lock);
+  }
   return util::Status::OK;
 }
 
@@ -387,7 +807,138 @@ util::Status EtcdConsistentStore<Logged>::UpdateSequenceMapping(
   CHECK(entry->HasHandle());
   CheckMappingIsOrdered(entry->Entry());
   CheckMappingIsContiguousWithServingTree(entry->Entry());
-  return UpdateEntry(entry);
+
+  std::unique_lock<std::mutex> lock(sequence_mapping_lock_);
+  if (entry->Handle() != sequence_mapping_handle_) {
+    return util::Status(util::error::FAILED_PRECONDITION,
+                        "sequence mapping changed since it was read");
+  }
+  const util::Status status(WriteSequenceMappingChunks(lock, entry));
+  if (!status.ok()) {
+    // Some of the chunks might have been written, the next update
+    // has to start from a fresh read.
+    sequence_mapping_chunks_.clear();
+    sequence_mapping_handle_ = -1;
+  }
+  UpdateSequenceMappingMemory(lock);
+  return status;
+}
+
+
+template <class Logged>
+util::Status EtcdConsistentStore<Logged>::WriteSequenceMappingChunks(
+    const std::unique_lock<std::mutex>& lock,
+    EntryHandle<ct::SequenceMapping>* entry) {
+  CHECK(lock.owns_lock());
+  const int64_t chunk_size(FLAGS_etcd_sequence_mapping_chunk_size);
+  std::map<int64_t, ct::SequenceMapping> new_chunks;
+  for (const auto& mapping : entry->Entry().mapping()) {
+    *new_chunks[mapping.sequence_number() / chunk_size * chunk_size]
+         .add_mapping() = mapping;
+  }
+
+  // The last chunk is written first, with compare-and-swap, even if
+  // it did not change, so that concurrent updates conflict on it
+  // before anything else is written. It is kept when it empties, to
+  // carry on serving that purpose, unless later chunks replace it.
+  std::map<int64_t, EntryHandle<ct::SequenceMapping>>& old_chunks(
+      sequence_mapping_chunks_);
+  const bool has_tail(!old_chunks.empty());
+  const int64_t tail(has_tail ? old_chunks.rbegin()->first : 0);
+  if (new_chunks.empty() || new_chunks.rbegin()->first <= tail) {
+    new_chunks[tail];
+  }
+
+  std::vector<int64_t> order;
+  if (has_tail) {
+    order.push_back(tail);
+  }
+  for (auto it(has_tail ? new_chunks.upper_bound(tail) : new_chunks.begin());
+       it != new_chunks.end(); ++it) {
+    order.push_back(it->first);
+  }
+  // Below the last chunk are only mappings already covered by the
+  // serving STH, which can be removed in any order.
+  for (const auto& chunk : old_chunks) {
+    if (chunk.first != tail) {
+      order.push_back(chunk.first);
+    }
+  }
+  for (const auto& chunk : new_chunks) {
+    if (chunk.first < tail && old_chunks.count(chunk.first) == 0) {
+      order.push_back(chunk.first);
+    }
+  }
+
+  for (const int64_t first : order) {
+    const auto new_it(new_chunks.find(first));
+    const auto old_it(old_chunks.find(first));
+    util::Status status;
+    if (new_it == new_chunks.end()) {
+      status = DeleteEntry(&old_it->second);
+      if (status.ok()) {
+        old_chunks.erase(old_it);
+      }
+    } else if (old_it == old_chunks.end()) {
+      EntryHandle<ct::SequenceMapping> chunk(
+          GetSequenceMappingChunkPath(first), new_it->second);
+      status = CreateEntry(&chunk);
+      if (status.ok()) {
+        old_chunks.emplace(first, std::move(chunk));
+      }
+    } else if (first == tail ||
+               old_it->second.Entry().SerializeAsString() !=
+                   new_it->second.SerializeAsString()) {
+      *old_it->second.MutableEntry() = new_it->second;
+      status = UpdateEntry(&old_it->second);
+    }
+    if (!status.ok()) {
+      VLOG(1) << "Couldn't write sequence mapping chunk " << first << ": "
+              << status;
+      // A chunk which is gone is a conflict with another writer, as
+      // is one which is there already, or not the one we read (these
+      // fail with FAILED_PRECONDITION).
+      if (status.CanonicalCode() == util::error::NOT_FOUND) {
+        return util::Status(util::error::FAILED_PRECONDITION,
+                            status.error_message());
+      }
+      return status;
+    }
+  }
+
+  if (sequence_mapping_is_legacy_) {
+    EntryHandle<ct::SequenceMapping> legacy(GetFullPath(kSequenceFile),
+                                            ct::SequenceMapping(),
+                                            sequence_mapping_handle_);
+    const util::Status status(DeleteEntry(&legacy));
+    if (!status.ok()) {
+      LOG(WARNING) << "Couldn't delete the unchunked sequence mapping: "
+                   << status;
+      return status;
+    }
+    sequence_mapping_is_legacy_ = false;
+  }
+
+  int64_t handle(-1);
+  for (const auto& chunk : old_chunks) {
+    handle = std::max<int64_t>(handle, chunk.second.Handle());
+  }
+  sequence_mapping_handle_ = handle;
+  entry->Set(GetFullPath(kSequenceChunksDir), entry->Entry(), handle);
+  etcd_total_entries->Set("sequenced", entry->Entry().mapping_size());
+  return util::Status::OK;
+}
+
+
+template <class Logged>
+void EtcdConsistentStore<Logged>::UpdateSequenceMappingMemory(
+    const std::unique_lock<std::mutex>& lock) const {
+  CHECK(lock.owns_lock());
+  size_t bytes(OrderedContainerBytes(sequence_mapping_chunks_, 0));
+  for (const auto& chunk : sequence_mapping_chunks_) {
+    bytes += chunk.second.Entry().SpaceUsed() - sizeof(ct::SequenceMapping);
+  }
+  sequence_mapping_memory_.Set(bytes);
 }
 
 
@@ -397,6 +948,13 @@ EtcdConsistentStore<Logged>::GetClusterNodeState() const {
   ScopedLatency scoped_latency(
       etcd_latency_by_op_ms.GetScopedLatency("get_cluster_node_state"));
 
+  // Nobody else writes it, so once we have, we know what it is.
+  const std::shared_ptr<const ct::ClusterNodeState> node_state(
+      std::atomic_load(&node_state_));
+  if (node_state) {
+    return *node_state;
+  }
+
   EntryHandle<ct::ClusterNodeState> handle;
   util::Status status(GetEntry(GetNodePath(node_id_), &handle));
   if (!status.ok()) {
@@ -416,9 +974,46 @@ util::Status EtcdConsistentStore<Logged>::SetClusterNodeState(
   // nobody else is updating our cluster state.
   ct::ClusterNodeState local_state(state);
   local_state.set_node_id(node_id_);
-  EntryHandle<ct::ClusterNodeState> entry(GetNodePath(node_id_), local_state);
   const std::chrono::seconds ttl(FLAGS_node_state_ttl_seconds);
-  return ForceSetEntryWithTTL(ttl, &entry);
+
+  const std::shared_ptr<const ct::ClusterNodeState> last_state(
+      std::atomic_load(&node_state_));
+  if (last_state &&
+      last_state->SerializeAsString() == local_state.SerializeAsString()) {
+    // Nothing changed, only the TTL needs extending, and not before a
+    // third of it has run out.
+    const int64_t now_ms(util::TimeInMilliseconds());
+    if (now_ms - node_state_written_ms_ <
+        std::chrono::milliseconds(ttl).count() / 3) {
+      return util::Status::OK;
+    }
+    if (FLAGS_etcd_refresh_node_state) {
+      util::SyncTask task(executor_);
+      EtcdClient::Response resp;
+      client_->RefreshTTL(GetNodePath(node_id_), ttl, &resp, task.task());
+      task.Wait();
+      if (task.status().ok()) {
+        node_state_written_ms_ = now_ms;
+      }
+      // If our state expired in the meantime, it has to be written
+      // again.
+      if (task.status().CanonicalCode() != util::error::NOT_FOUND) {
+        return task.status();
+      }
+    }
+  }
+
+  EntryHandle<ct::ClusterNodeState> entry(GetNodePath(node_id_), local_state);
+  const int64_t write_ms(util::TimeInMilliseconds());
+  const util::Status status(ForceSetEntryWithTTL(ttl, &entry));
+  if (status.ok()) {
+    std::lock_guard<Mutex> lock(mutex_);
+    std::atomic_store(&node_state_,
+                      std::shared_ptr<const ct::ClusterNodeState>(
+                          new ct::ClusterNodeState(local_state)));
+    node_state_written_ms_ = write_ms;
+  }
+  return status;
 }
 
 
@@ -677,6 +1272,32 @@ util::Status EtcdConsistentStore<Logged>::DeleteEntry(EntryHandle<T>* entry) {
 }
 
 
+template <class Logged>
+util::Status EtcdConsistentStore<Logged>::RestoreEntryBody(
+    Logged* entry) const {
+  if (entry->HasBody()) {
+    return util::Status::OK;
+  }
+  if (!entry_bodies_) {
+    return util::Status(util::error::FAILED_PRECONDITION,
+                        "no storage for the bodies of pending entries");
+  }
+
+  const std::string key(util::HexString(entry->contents().body_hash()));
+  std::string flat_body;
+  const util::Status status(entry_bodies_->LookupEntry(key, &flat_body));
+  if (!status.ok()) {
+    LOG(WARNING) << "Couldn't look up the body of pending entry " << key
+                 << ": " << status;
+    return status;
+  }
+  Logged body;
+  CHECK(body.ParseFromString(flat_body)) << key;
+  CHECK(entry->RestoreBody(body)) << key;
+  return util::Status::OK;
+}
+
+
 template <class Logged>
 std::string EtcdConsistentStore<Logged>::GetEntryPath(
     const Logged& entry) const {
@@ -687,7 +1308,13 @@ std::string EtcdConsistentStore<Logged>::GetEntryPath(
 template <class Logged>
 std::string EtcdConsistentStore<Logged>::GetEntryPath(
     const std::string& hash) const {
-  return GetFullPath(std::string(kEntriesDir) + util::HexString(hash));
+  const std::string hex_hash(util::HexString(hash));
+  if (FLAGS_etcd_pending_entry_shard_digits <= 0) {
+    return GetFullPath(std::string(kEntriesDir) + hex_hash);
+  }
+  return GetFullPath(std::string(kEntriesDir) +
+                     hex_hash.substr(0, FLAGS_etcd_pending_entry_shard_digits) +
+                     "/" + hex_hash);
 }
 
 
@@ -698,6 +1325,16 @@ std::string EtcdConsistentStore<Logged>::GetNodePath(
 }
 
 
+template <class Logged>
+std::string EtcdConsistentStore<Logged>::GetSequenceMappingChunkPath(
+    int64_t first_sequence_number) const {
+  // Padded, so that the chunks sort in order.
+  std::ostringstream name;
+  name << std::setfill('0') << std::setw(20) << first_sequence_number;
+  return GetFullPath(std::string(kSequenceChunksDir) + name.str());
+}
+
+
 template <class Logged>
 std::string EtcdConsistentStore<Logged>::GetFullPath(
     const std::string& key) const {
@@ -710,9 +1347,10 @@ std::string EtcdConsistentStore<Logged>::GetFullPath(
 template <class Logged>
 void EtcdConsistentStore<Logged>::CheckMappingIsContiguousWithServingTree(
     const ct::SequenceMapping& mapping) const {
-  std::lock_guard<std::mutex> lock(mutex_);
-  if (serving_sth_ && mapping.mapping_size() > 0) {
-    const uint64_t tree_size(serving_sth_->Entry().tree_size());
+  const std::shared_ptr<const ct::SignedTreeHead> serving_sth(
+      std::atomic_load(&serving_sth_snapshot_));
+  if (serving_sth && mapping.mapping_size() > 0) {
+    const uint64_t tree_size(serving_sth->tree_size());
     // The mapping must not have a gap between its lowest mapping and the
     // serving tree
     const uint64_t lowest_sequence_number(
@@ -753,7 +1391,7 @@ Update<T> EtcdConsistentStore<Logged>::TypedUpdateFromNode(
 
 template <class Logged>
 void EtcdConsistentStore<Logged>::UpdateLocalServingSTH(
-    const std::unique_lock<std::mutex>& lock,
+    const std::unique_lock<Mutex>& lock,
     const EntryHandle<ct::SignedTreeHead>& handle) {
   CHECK(lock.owns_lock());
   CHECK(!serving_sth_ ||
@@ -761,13 +1399,17 @@ void EtcdConsistentStore<Logged>::UpdateLocalServingSTH(
 
   VLOG(1) << "Updating serving_sth_ to: " << handle.Entry().DebugString();
   serving_sth_.reset(new EntryHandle<ct::SignedTreeHead>(handle));
+  std::atomic_store(&serving_sth_snapshot_,
+                    std::shared_ptr<const ct::SignedTreeHead>(
+                        new ct::SignedTreeHead(handle.Entry())));
+  serving_sth_updated_ms_ = util::TimeInMilliseconds();
 }
 
 
 template <class Logged>
 void EtcdConsistentStore<Logged>::OnEtcdServingSTHUpdated(
     const Update<ct::SignedTreeHead>& update) {
-  std::unique_lock<std::mutex> lock(mutex_);
+  std::unique_lock<Mutex> lock(mutex_);
 
   if (update.exists_) {
     VLOG(1) << "Got ServingSTH version " << update.handle_.Handle() << ": "
@@ -777,6 +1419,9 @@ void EtcdConsistentStore<Logged>::OnEtcdServingSTHUpdated(
     LOG(WARNING) << "ServingSTH non-existent/deleted.";
     // TODO(alcutter): What to do here?
     serving_sth_.reset();
+    std::atomic_store(&serving_sth_snapshot_,
+                      std::shared_ptr<const ct::SignedTreeHead>());
+    serving_sth_updated_ms_ = util::TimeInMilliseconds();
   }
   received_initial_sth_ = true;
   lock.unlock();
@@ -790,8 +1435,11 @@ void EtcdConsistentStore<Logged>::OnClusterConfigUpdated(
   if (update.exists_) {
     VLOG(1) << "Got ClusterConfig version " << update.handle_.Handle() << ": "
             << update.handle_.Entry().DebugString();
-    std::lock_guard<std::mutex> lock(mutex_);
-    cluster_config_.reset(new ct::ClusterConfig(update.handle_.Entry()));
+    std::lock_guard<Mutex> lock(mutex_);
+    std::atomic_store(&cluster_config_,
+                      std::shared_ptr<const ct::ClusterConfig>(
+                          new ct::ClusterConfig(update.handle_.Entry())));
+    cluster_config_updated_ms_ = util::TimeInMilliseconds();
   } else {
     LOG(WARNING) << "ClusterConfig non-existent/deleted.";
     // TODO(alcutter): What to do here?
@@ -810,14 +1458,13 @@ util::StatusOr<int64_t> EtcdConsistentStore<Logged>::CleanupOldEntries() {
   }
 
   // Figure out where we're cleaning up to...
-  std::unique_lock<std::mutex> lock(mutex_);
-  if (!serving_sth_) {
+  const std::shared_ptr<const ct::SignedTreeHead> serving_sth(
+      std::atomic_load(&serving_sth_snapshot_));
+  if (!serving_sth) {
     LOG(INFO) << "No current serving_sth, nothing to do.";
     return 0;
   }
-  const int64_t clean_up_to_sequence_number(
-      serving_sth_->Entry().tree_size() - 1);
-  lock.unlock();
+  const int64_t clean_up_to_sequence_number(serving_sth->tree_size() - 1);
 
   LOG(INFO) << "Cleaning old entries up to and including sequence number: "
             << clean_up_to_sequence_number;
@@ -853,6 +1500,45 @@ util::StatusOr<int64_t> EtcdConsistentStore<Logged>::CleanupOldEntries() {
 }
 
 
+template <class Logged>
+void EtcdConsistentStore<Logged>::OnPendingEntriesUpdated(
+    const std::vector<EtcdClient::Node>& updates) {
+  std::lock_guard<std::mutex> lock(known_pending_entries_lock_);
+  for (const auto& node : updates) {
+    if (node.is_dir_) {
+      continue;
+    }
+    const auto it(known_pending_entries_.find(node.key_));
+    if (it != known_pending_entries_.end()) {
+      known_pending_entries_heap_bytes_ -=
+          StringHeapBytes(it->first.size()) + it->second.SpaceUsed() -
+          sizeof(it->second);
+      known_pending_entries_.erase(it);
+    }
+    if (node.deleted_) {
+      continue;
+    }
+
+    Logged entry;
+    if (!entry.ParseFromString(util::FromBase64(node.value_.c_str())) ||
+        GetEntryPath(entry) != node.key_) {
+      // Left for AddPendingEntryAsync() to find in etcd, and complain
+      // about.
+      LOG(WARNING) << "Unexpected pending entry " << node.key_;
+      continue;
+    }
+    const auto inserted(
+        known_pending_entries_.emplace(node.key_, entry.sct()));
+    known_pending_entries_heap_bytes_ +=
+        StringHeapBytes(inserted.first->first.size()) +
+        inserted.first->second.SpaceUsed() - sizeof(inserted.first->second);
+  }
+  known_pending_entries_memory_.Set(
+      UnorderedContainerBytes(known_pending_entries_, 0) +
+      known_pending_entries_heap_bytes_);
+}
+
+
 template <class Logged>
 void EtcdConsistentStore<Logged>::StartEtcdStatsFetch() {
   if (etcd_stats_task_.task()->CancelRequested()) {
@@ -881,11 +1567,8 @@ void EtcdConsistentStore<Logged>::EtcdStatsFetchDone(
     const util::StatusOr<int64_t> num_entries(
         CalculateNumEtcdEntries(response->stats));
     if (num_entries.ok()) {
-      {
-        std::lock_guard<std::mutex> lock(mutex_);
-        num_etcd_entries_ = num_entries.ValueOrDie();
-      }
-      etcd_total_entries->Set("all", num_etcd_entries_);
+      num_etcd_entries_ = num_entries.ValueOrDie();
+      etcd_total_entries->Set("all", num_entries.ValueOrDie());
     } else {
       VLOG(1) << "Failed to calculate num_entries: " << num_entries.status();
     }
@@ -893,6 +1576,16 @@ void EtcdConsistentStore<Logged>::EtcdStatsFetchDone(
     LOG(WARNING) << "Etcd stats fetch failed: " << task->status();
   }
 
+  const int64_t now_ms(util::TimeInMilliseconds());
+  if (serving_sth_updated_ms_ > 0) {
+    etcd_snapshot_age_seconds->Set("serving_sth",
+                                   (now_ms - serving_sth_updated_ms_) / 1000);
+  }
+  if (cluster_config_updated_ms_ > 0) {
+    etcd_snapshot_age_seconds->Set(
+        "cluster_config", (now_ms - cluster_config_updated_ms_) / 1000);
+  }
+
   base_->Delay(
       std::chrono::seconds(FLAGS_etcd_stats_collection_interval_seconds),
       etcd_stats_task_.task()->AddChild(
@@ -908,17 +1601,16 @@ void EtcdConsistentStore<Logged>::EtcdStatsFetchDone(
 template <class Logged>
 util::Status EtcdConsistentStore<Logged>::MaybeReject(
     const std::string& type) const {
-  std::unique_lock<std::mutex> lock(mutex_);
-
-  if (!cluster_config_) {
+  const std::shared_ptr<const ct::ClusterConfig> cluster_config(
+      std::atomic_load(&cluster_config_));
+  if (!cluster_config) {
     // No config, whatever.
     return util::Status::OK;
   }
 
   const int64_t etcd_size(num_etcd_entries_);
   const int64_t reject_threshold(
-      cluster_config_->etcd_reject_add_pending_threshold());
-  lock.unlock();
+      cluster_config->etcd_reject_add_pending_threshold());
 
   if (etcd_size >= reject_threshold) {
     etcd_rejected_requests->Increment(type);
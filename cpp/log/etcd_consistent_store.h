@@ -1,13 +1,21 @@
 #ifndef CERT_TRANS_LOG_ETCD_CONSISTENT_STORE_H_
 #define CERT_TRANS_LOG_ETCD_CONSISTENT_STORE_H_
 
+#include <atomic>
+#include <condition_variable>
+#include <map>
 #include <memory>
 #include <mutex>
 #include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
 #include "base/macros.h"
 #include "log/consistent_store.h"
+#include "monitoring/instrumented_mutex.h"
+#include "monitoring/memory_gauge.h"
 #include "proto/ct.pb.h"
 #include "util/etcd.h"
 #include "util/libevent_wrapper.h"
@@ -16,6 +24,7 @@
 
 namespace cert_trans {
 
+class KeyValueStorage;
 class MasterElection;
 
 
@@ -25,9 +34,16 @@ class EtcdConsistentStore : public ConsistentStore<Logged> {
   // No change of ownership for |client|, |executor| must continue to be valid
   // at least as long as this object is, and should not be the libevent::Base
   // used by |client|.
+  //
+  // If |entry_bodies| is not NULL, only a stub of each pending entry
+  // is kept in etcd, with its SCT, and the rest is stored there,
+  // keyed by the hex hash of the entry. It must then be shared by all
+  // the nodes of the cluster, and outlive this object. The bodies of
+  // sequenced entries are left in it once their stubs are cleaned up.
   EtcdConsistentStore(libevent::Base* base, util::Executor* executor,
                       EtcdClient* client, const MasterElection* election,
-                      const std::string& root, const std::string& node_id);
+                      const std::string& root, const std::string& node_id,
+                      KeyValueStorage* entry_bodies = nullptr);
 
   virtual ~EtcdConsistentStore();
 
@@ -39,12 +55,36 @@ class EtcdConsistentStore : public ConsistentStore<Logged> {
 
   util::Status AddPendingEntry(Logged* entry) override;
 
+  // The new entries are gathered for
+  // --etcd_pending_entry_batch_delay_ms (or until there are
+  // --etcd_pending_entry_batch_size of them), and then written all at
+  // once, with concurrent requests.
+  void AddPendingEntryAsync(Logged* entry, util::Task* task) override;
+
   util::Status GetPendingEntryForHash(
       const std::string& hash, EntryHandle<Logged>* entry) const override;
 
+  void GetPendingEntryForHashAsync(const std::string& hash,
+                                   EntryHandle<Logged>* entry,
+                                   util::Task* task) const override;
+
   util::Status GetPendingEntries(
       std::vector<EntryHandle<Logged>>* entries) const override;
 
+  // The stubs are made as the listing is parsed, so that only one copy
+  // of the whole entries is held at a time, that of the response.
+  util::Status GetPendingEntryStubs(
+      std::vector<EntryHandle<Logged>>* entries) const override;
+
+  // Without |entry_bodies_|, the entries are fetched again, up to
+  // --etcd_pending_entry_batch_size of them at once.
+  util::Status RestorePendingEntryBodies(
+      const std::vector<Logged*>& entries) const override;
+
+  // The sequence mapping is split in chunks of
+  // --etcd_sequence_mapping_chunk_size sequence numbers, each under
+  // its own key, and these only write the chunks which changed. The
+  // handle of the mapping is the highest of those of its chunks.
   util::Status GetSequenceMapping(
       EntryHandle<ct::SequenceMapping>* entry) const override;
 
@@ -53,6 +93,9 @@ class EtcdConsistentStore : public ConsistentStore<Logged> {
 
   util::StatusOr<ct::ClusterNodeState> GetClusterNodeState() const override;
 
+  // An unchanged state is not written again until a third of
+  // --node_state_ttl_seconds has passed, and then only has its TTL
+  // refreshed if --etcd_refresh_node_state is set.
   util::Status SetClusterNodeState(const ct::ClusterNodeState& state) override;
 
   void WatchServingSTH(
@@ -74,7 +117,9 @@ class EtcdConsistentStore : public ConsistentStore<Logged> {
   util::StatusOr<int64_t> CleanupOldEntries() override;
 
  private:
-  void WaitForServingSTHVersion(std::unique_lock<std::mutex>* lock,
+  typedef InstrumentedMutex<> Mutex;
+
+  void WaitForServingSTHVersion(std::unique_lock<Mutex>* lock,
                                 const int version);
 
   template <class T>
@@ -100,12 +145,41 @@ class EtcdConsistentStore : public ConsistentStore<Logged> {
   template <class T>
   util::Status DeleteEntry(EntryHandle<T>* entry);
 
+  // Appends the entries found in |dir| to |entries|, only their stubs
+  // if |stubs| is set, and the keys of its subdirectories to
+  // |subdirs|.
+  static void ParsePendingEntriesDir(
+      const EtcdClient::Node& dir, bool stubs,
+      std::vector<std::string>* subdirs,
+      std::vector<EntryHandle<Logged>>* entries);
+
+  // Lists the pending entries for GetPendingEntries() and
+  // GetPendingEntryStubs(), without restoring their bodies.
+  util::Status ListPendingEntries(
+      bool stubs, std::vector<EntryHandle<Logged>>* entries) const;
+
+  // Puts back the body of |entry| from |entry_bodies_|, if only its
+  // stub was kept in etcd.
+  util::Status RestoreEntryBody(Logged* entry) const;
+
   std::string GetEntryPath(const Logged& entry) const;
 
   std::string GetEntryPath(const std::string& hash) const;
 
   std::string GetNodePath(const std::string& node_id) const;
 
+  std::string GetSequenceMappingChunkPath(int64_t first_sequence_number) const;
+
+  // Writes the chunks of |entry| which differ from those in
+  // |sequence_mapping_chunks_|, with compare-and-swap.
+  util::Status WriteSequenceMappingChunks(
+      const std::unique_lock<std::mutex>& lock,
+      EntryHandle<ct::SequenceMapping>* entry);
+
+  // Reports the memory used by |sequence_mapping_chunks_|.
+  void UpdateSequenceMappingMemory(
+      const std::unique_lock<std::mutex>& lock) const;
+
   std::string GetFullPath(const std::string& key) const;
 
   void CheckMappingIsContiguousWithServingTree(
@@ -133,13 +207,26 @@ class EtcdConsistentStore : public ConsistentStore<Logged> {
   template <class T>
   static Update<T> TypedUpdateFromNode(const EtcdClient::Node& node);
 
-  void UpdateLocalServingSTH(const std::unique_lock<std::mutex>& lock,
+  void UpdateLocalServingSTH(const std::unique_lock<Mutex>& lock,
                              const EntryHandle<ct::SignedTreeHead>& handle);
 
   void OnEtcdServingSTHUpdated(const Update<ct::SignedTreeHead>& update);
 
   void OnClusterConfigUpdated(const Update<ct::ClusterConfig>& update);
 
+  // Keeps |known_pending_entries_| up to date with the watch of the
+  // entries directory.
+  void OnPendingEntriesUpdated(const std::vector<EtcdClient::Node>& updates);
+
+  // Writes the pending entries gathered by AddPendingEntryAsync().
+  void FlushPendingWrites();
+  void WritePendingEntry(Logged* entry, util::Task* task);
+  void PendingEntryCreated(Logged* entry, util::Task* task,
+                           util::Task* create_task);
+  void ExistingPendingEntryFetched(Logged* entry,
+                                   EtcdClient::GetResponse* resp,
+                                   util::Task* task, util::Task* get_task);
+
   void StartEtcdStatsFetch();
   void EtcdStatsFetchDone(EtcdClient::StatsResponse* response,
                           util::Task* task);
@@ -149,20 +236,69 @@ class EtcdConsistentStore : public ConsistentStore<Logged> {
   EtcdClient* const client_;  // We don't own this.
   libevent::Base* base_;                  // We don't own this.
   util::Executor* const executor_;        // We don't own this.
+  KeyValueStorage* const entry_bodies_;   // We don't own this.
   const MasterElection* const election_;  // We don't own this.
   const std::string root_;
   const std::string node_id_;
-  std::condition_variable serving_sth_cv_;
+  std::condition_variable_any serving_sth_cv_;
   util::SyncTask serving_sth_watch_task_;
   util::SyncTask cluster_config_watch_task_;
+  util::SyncTask pending_entries_watch_task_;
   util::SyncTask etcd_stats_task_;
+  util::SyncTask pending_writes_task_;
 
-  mutable std::mutex mutex_;
+  mutable Mutex mutex_;
   bool received_initial_sth_;
   std::unique_ptr<EntryHandle<ct::SignedTreeHead>> serving_sth_;
-  std::unique_ptr<ct::ClusterConfig> cluster_config_;
   bool exiting_;
-  int64_t num_etcd_entries_;
+
+  // Snapshots kept up to date by the watches (or, for the state of
+  // this node, by SetClusterNodeState()), which the getters read with
+  // std::atomic_load() rather than under |mutex_|. Writers still hold
+  // |mutex_|, to keep them in order.
+  std::shared_ptr<const ct::SignedTreeHead> serving_sth_snapshot_;
+  std::shared_ptr<const ct::ClusterConfig> cluster_config_;
+  std::shared_ptr<const ct::ClusterNodeState> node_state_;
+  // When the serving STH and cluster config snapshots last changed,
+  // in milliseconds since the epoch.
+  std::atomic<int64_t> serving_sth_updated_ms_;
+  std::atomic<int64_t> cluster_config_updated_ms_;
+  std::atomic<int64_t> num_etcd_entries_;
+  // When |node_state_| was last written or had its TTL refreshed, in
+  // milliseconds since the epoch.
+  std::atomic<int64_t> node_state_written_ms_;
+
+  std::mutex pending_writes_lock_;
+  // The entries waiting to be written by FlushPendingWrites(), with
+  // the tasks to return once they are.
+  std::vector<std::pair<Logged*, util::Task*>> pending_writes_;
+  bool pending_writes_flush_scheduled_;
+
+  // The SCTs of the pending entries seen by the watch of the entries
+  // directory, keyed by their path, with which AddPendingEntryAsync()
+  // answers duplicates without asking etcd. Only the entries created
+  // since the watch started are there if the pending entries are
+  // sharded, as its initial read does not go into subdirectories; the
+  // others are still found by asking etcd.
+  std::mutex known_pending_entries_lock_;
+  std::unordered_map<std::string, ct::SignedCertificateTimestamp>
+      known_pending_entries_;
+  // What the entries of |known_pending_entries_| own out of line.
+  size_t known_pending_entries_heap_bytes_;
+  MemoryGauge known_pending_entries_memory_;
+
+  // The chunks of the sequence mapping as last read or written, keyed
+  // by the first sequence number they can hold, with the handle of
+  // the whole, which UpdateSequenceMapping() must be given. If
+  // |sequence_mapping_is_legacy_|, the mapping was read from the
+  // single key it used to be kept under, which the next update
+  // replaces with chunks.
+  mutable std::mutex sequence_mapping_lock_;
+  mutable std::map<int64_t, EntryHandle<ct::SequenceMapping>>
+      sequence_mapping_chunks_;
+  mutable int64_t sequence_mapping_handle_;
+  mutable bool sequence_mapping_is_legacy_;
+  mutable MemoryGauge sequence_mapping_memory_;
 
   friend class EtcdConsistentStoreTest;
   template <class T>
@@ -7,6 +7,30 @@ DEFINE_int32(etcd_stats_collection_interval_seconds, 2,
              "Number of seconds between fetches of etcd stats.");
 DEFINE_int32(node_state_ttl_seconds, 60,
              "TTL in seconds on the node state files.");
+DEFINE_int32(etcd_pending_entry_batch_delay_ms, 2,
+             "Number of milliseconds during which new pending entries are "
+             "gathered, to be written to etcd together.");
+DEFINE_int32(etcd_pending_entry_batch_size, 256,
+             "Maximum number of new pending entries gathered to be written "
+             "to etcd together.");
+DEFINE_int32(etcd_pending_entry_shard_digits, 0,
+             "Number of leading hex digits of their hash used to spread the "
+             "pending entries over subdirectories of the entries directory, "
+             "which are then fetched in parallel. With 0, they are all kept "
+             "in the entries directory itself.");
+DEFINE_int32(etcd_sequence_mapping_chunk_size, 10000,
+             "Number of sequence numbers covered by each of the chunks the "
+             "sequence mapping is split into in etcd. Sequencing only "
+             "rewrites the last ones, so this bounds the size of those "
+             "writes.");
+DEFINE_bool(etcd_refresh_node_state, false,
+            "Refresh the TTL of this node's state in etcd when it has not "
+            "changed, rather than writing it again and waking up the "
+            "watchers of every node. Needs etcd 2.3 or later.");
+DEFINE_bool(etcd_watch_pending_entries, true,
+            "Watch the pending entries in etcd, to keep a local index of "
+            "their SCTs with which duplicate submissions are answered "
+            "without asking etcd.");
 
 namespace cert_trans {
 template class EtcdConsistentStore<LoggedCertificate>;
@@ -12,18 +12,23 @@
 #include <unordered_map>
 #include <unordered_set>
 
+#include "log/file_storage.h"
 #include "log/logged_certificate.h"
 #include "proto/ct.pb.h"
 #include "util/fake_etcd.h"
 #include "util/libevent_wrapper.h"
 #include "util/mock_masterelection.h"
 #include "util/status_test_util.h"
+#include "util/test_db.h"
 #include "util/testing.h"
 #include "util/thread_pool.h"
 #include "util/util.h"
 
 DECLARE_int32(node_state_ttl_seconds);
 DECLARE_int32(etcd_stats_collection_interval_seconds);
+DECLARE_int32(etcd_pending_entry_batch_size);
+DECLARE_int32(etcd_pending_entry_shard_digits);
+DECLARE_int32(etcd_sequence_mapping_chunk_size);
 
 namespace cert_trans {
 
@@ -52,6 +57,7 @@ using testing::Contains;
 using testing::Pair;
 using testing::Return;
 using testing::SetArgumentPointee;
+using testing::UnorderedElementsAreArray;
 using util::Status;
 using util::StatusOr;
 using util::SyncTask;
@@ -183,6 +189,15 @@ class EtcdConsistentStoreTest : public ::testing::Test {
     Deserialize(resp.node.value_, thing);
   }
 
+  int64_t ModifiedIndex(const string& key) {
+    EtcdClient::GetResponse resp;
+    SyncTask task(base_.get());
+    client_.Get(key, &resp, task.task());
+    task.Wait();
+    CHECK_EQ(Status::OK, task.status()) << key;
+    return resp.node.modified_index_;
+  }
+
   template <class T>
   string Serialize(const T& t) {
     string flat;
@@ -209,6 +224,28 @@ class EtcdConsistentStoreTest : public ::testing::Test {
     return store_->num_etcd_entries_;
   }
 
+  // Waits for the watch of the pending entries to tell the store that
+  // the entry at |path| is there or not, as |known|.
+  void WaitForKnownPendingEntry(const string& path, bool known) {
+    for (int i = 0; i < 500; ++i) {
+      {
+        std::lock_guard<std::mutex> lock(store_->known_pending_entries_lock_);
+        if ((store_->known_pending_entries_.count(path) > 0) == known) {
+          return;
+        }
+      }
+      std::this_thread::sleep_for(milliseconds(10));
+    }
+    FAIL() << "pending entry " << path << " still "
+           << (known ? "unknown" : "known");
+  }
+
+  void AddKnownPendingEntry(const string& path,
+                            const ct::SignedCertificateTimestamp& sct) {
+    std::lock_guard<std::mutex> lock(store_->known_pending_entries_lock_);
+    store_->known_pending_entries_[path] = sct;
+  }
+
 
   shared_ptr<libevent::Base> base_;
   ThreadPool executor_;
@@ -337,6 +374,107 @@ TEST_F(EtcdConsistentStoreTest,
 }
 
 
+TEST_F(EtcdConsistentStoreTest, TestWatchesPendingEntries) {
+  LoggedCertificate cert(DefaultCert());
+  const string kPath(string(kRoot) + "/entries/" +
+                     util::HexString(cert.Hash()));
+  InsertEntry(kPath, cert);
+  WaitForKnownPendingEntry(kPath, true);
+
+  SyncTask task(base_.get());
+  client_.ForceDelete(kPath, task.task());
+  task.Wait();
+  ASSERT_EQ(Status::OK, task.status());
+  WaitForKnownPendingEntry(kPath, false);
+}
+
+
+TEST_F(EtcdConsistentStoreTest, TestAddPendingEntryAnswersKnownLocally) {
+  LoggedCertificate cert(DefaultCert());
+  const string kPath(string(kRoot) + "/entries/" +
+                     util::HexString(cert.Hash()));
+  // Only known locally, so asking etcd would create it instead.
+  ct::SignedCertificateTimestamp sct(cert.sct());
+  sct.set_timestamp(55555);
+  AddKnownPendingEntry(kPath, sct);
+
+  EXPECT_THAT(store_->AddPendingEntry(&cert),
+              StatusIs(util::error::ALREADY_EXISTS));
+  EXPECT_EQ(55555U, cert.timestamp());
+  EtcdClient::GetResponse resp;
+  SyncTask task(base_.get());
+  client_.Get(kPath, &resp, task.task());
+  task.Wait();
+  EXPECT_EQ(util::error::NOT_FOUND, task.status().CanonicalCode());
+}
+
+
+TEST_F(EtcdConsistentStoreTest, TestAddPendingEntryAsyncWritesBatch) {
+  // Some are written as the batch fills up, the others once the delay
+  // is over.
+  FLAGS_etcd_pending_entry_batch_size = 4;
+  vector<LoggedCertificate> certs;
+  for (int i = 0; i < 10; ++i) {
+    certs.emplace_back(MakeCert(kTimestamp + i, "leaf" + std::to_string(i)));
+  }
+  vector<unique_ptr<SyncTask>> tasks;
+  for (auto& cert : certs) {
+    tasks.emplace_back(new SyncTask(&executor_));
+    store_->AddPendingEntryAsync(&cert, tasks.back()->task());
+  }
+
+  for (size_t i = 0; i < certs.size(); ++i) {
+    tasks[i]->Wait();
+    EXPECT_EQ(Status::OK, tasks[i]->status());
+    EntryHandle<LoggedCertificate> handle;
+    EXPECT_EQ(Status::OK,
+              store_->GetPendingEntryForHash(certs[i].Hash(), &handle));
+  }
+}
+
+
+TEST_F(EtcdConsistentStoreTest, TestAddPendingEntryStoresBodyApart) {
+  TmpStorage tmp;
+  FileStorage bodies(tmp.TmpStorageDir(), 0);
+  store_.reset(new EtcdConsistentStore<LoggedCertificate>(
+      base_.get(), &executor_, &client_, &election_, kRoot, kNodeId,
+      &bodies));
+
+  LoggedCertificate cert(DefaultCert());
+  ASSERT_EQ(Status::OK, store_->AddPendingEntry(&cert));
+
+  // Only the SCT is in etcd.
+  EtcdClient::GetResponse resp;
+  SyncTask task(base_.get());
+  client_.Get(string(kRoot) + "/entries/" + util::HexString(cert.Hash()),
+              &resp, task.task());
+  task.Wait();
+  ASSERT_EQ(Status::OK, task.status());
+  LoggedCertificate stub;
+  ASSERT_TRUE(stub.ParseFromString(util::FromBase64(resp.node.value_.c_str())));
+  EXPECT_FALSE(stub.HasBody());
+  EXPECT_EQ(cert.timestamp(), stub.timestamp());
+
+  EntryHandle<LoggedCertificate> handle;
+  EXPECT_EQ(Status::OK, store_->GetPendingEntryForHash(cert.Hash(), &handle));
+  EXPECT_EQ(cert, handle.Entry());
+  vector<EntryHandle<LoggedCertificate>> entries;
+  EXPECT_EQ(Status::OK, store_->GetPendingEntries(&entries));
+  ASSERT_EQ(1U, entries.size());
+  EXPECT_EQ(cert, entries[0].Entry());
+
+  // Duplicates still get the SCT of the first.
+  LoggedCertificate other_cert(DefaultCert());
+  other_cert.mutable_sct()->set_timestamp(55555);
+  EXPECT_THAT(store_->AddPendingEntry(&other_cert),
+              StatusIs(util::error::ALREADY_EXISTS));
+  EXPECT_EQ(cert.timestamp(), other_cert.timestamp());
+
+  // Before |bodies| goes away.
+  store_.reset();
+}
+
+
 TEST_F(EtcdConsistentStoreDeathTest,
        TestAddPendingEntryForExistingNonIdenticalEntry) {
   LoggedCertificate cert(DefaultCert());
@@ -401,6 +539,74 @@ TEST_F(EtcdConsistentStoreTest, TestGetPendingEntries) {
 }
 
 
+TEST_F(EtcdConsistentStoreTest, TestGetPendingEntriesFromShards) {
+  // An entry from before the shards were used.
+  const LoggedCertificate old(MakeCert(123, "old"));
+  InsertEntry(string(kRoot) + "/entries/" + util::HexString(old.Hash()), old);
+
+  FLAGS_etcd_pending_entry_shard_digits = 1;
+  vector<LoggedCertificate> certs;
+  for (int i = 0; i < 20; ++i) {
+    certs.emplace_back(MakeCert(kTimestamp + i, "leaf" + std::to_string(i)));
+    ASSERT_EQ(Status::OK, store_->AddPendingEntry(&certs.back()));
+  }
+
+  const string hex_hash(util::HexString(certs[0].Hash()));
+  EtcdClient::GetResponse resp;
+  SyncTask task(base_.get());
+  client_.Get(string(kRoot) + "/entries/" + hex_hash.substr(0, 1) + "/" +
+                  hex_hash,
+              &resp, task.task());
+  task.Wait();
+  EXPECT_EQ(Status::OK, task.status());
+  EntryHandle<LoggedCertificate> handle;
+  EXPECT_EQ(Status::OK,
+            store_->GetPendingEntryForHash(certs[0].Hash(), &handle));
+  EXPECT_EQ(certs[0], handle.Entry());
+
+  vector<EntryHandle<LoggedCertificate>> entries;
+  const Status status(store_->GetPendingEntries(&entries));
+  FLAGS_etcd_pending_entry_shard_digits = 0;
+  EXPECT_TRUE(status.ok()) << status;
+  vector<LoggedCertificate> found;
+  for (const auto& e : entries) {
+    found.push_back(e.Entry());
+  }
+  certs.push_back(old);
+  EXPECT_THAT(found, UnorderedElementsAreArray(certs));
+}
+
+
+TEST_F(EtcdConsistentStoreTest, TestGetPendingEntryStubsAndRestoreBodies) {
+  vector<LoggedCertificate> certs;
+  for (int i = 0; i < 5; ++i) {
+    certs.emplace_back(MakeCert(kTimestamp + i, "leaf" + std::to_string(i)));
+    ASSERT_EQ(Status::OK, store_->AddPendingEntry(&certs.back()));
+  }
+
+  vector<EntryHandle<LoggedCertificate>> entries;
+  EXPECT_EQ(Status::OK, store_->GetPendingEntryStubs(&entries));
+  ASSERT_EQ(certs.size(), entries.size());
+  vector<LoggedCertificate*> stubs;
+  for (auto& e : entries) {
+    EXPECT_FALSE(e.Entry().HasBody());
+    stubs.push_back(e.MutableEntry());
+  }
+
+  // The bodies are fetched a few at a time.
+  const int32_t batch_size(FLAGS_etcd_pending_entry_batch_size);
+  FLAGS_etcd_pending_entry_batch_size = 2;
+  const Status status(store_->RestorePendingEntryBodies(stubs));
+  FLAGS_etcd_pending_entry_batch_size = batch_size;
+  EXPECT_EQ(Status::OK, status);
+  vector<LoggedCertificate> found;
+  for (const auto& e : entries) {
+    found.push_back(e.Entry());
+  }
+  EXPECT_THAT(found, UnorderedElementsAreArray(certs));
+}
+
+
 TEST_F(EtcdConsistentStoreDeathTest,
        TestGetPendingEntriesBarfsWithSequencedEntry) {
   const string kPath(string(kRoot) + "/entries/");
@@ -481,6 +687,66 @@ TEST_F(EtcdConsistentStoreTest, TestUpdateSequenceMapping) {
 }
 
 
+TEST_F(EtcdConsistentStoreTest, TestUpdateSequenceMappingWritesChangedChunks) {
+  FLAGS_etcd_sequence_mapping_chunk_size = 2;
+  for (int seq = 0; seq < 5; ++seq) {
+    AddSequenceMapping(seq, "hash" + std::to_string(seq));
+  }
+
+  // The unchunked mapping was replaced.
+  {
+    EtcdClient::GetResponse resp;
+    SyncTask task(base_.get());
+    client_.Get(string("/root/sequence_mapping"), &resp, task.task());
+    task.Wait();
+    EXPECT_THAT(task.status(), StatusIs(util::error::NOT_FOUND));
+  }
+
+  const string chunks_dir("/root/sequence_mapping_chunks/");
+  const vector<string> chunks{chunks_dir + "00000000000000000000",
+                              chunks_dir + "00000000000000000002",
+                              chunks_dir + "00000000000000000004"};
+  vector<int64_t> indices;
+  for (const string& chunk : chunks) {
+    indices.push_back(ModifiedIndex(chunk));
+  }
+
+  AddSequenceMapping(5, "hash5");
+  EXPECT_EQ(indices[0], ModifiedIndex(chunks[0]));
+  EXPECT_EQ(indices[1], ModifiedIndex(chunks[1]));
+  EXPECT_LT(indices[2], ModifiedIndex(chunks[2]));
+
+  EntryHandle<SequenceMapping> mapping;
+  EXPECT_EQ(Status::OK, store_->GetSequenceMapping(&mapping));
+  ASSERT_EQ(6, mapping.Entry().mapping_size());
+  for (int seq = 0; seq < 6; ++seq) {
+    EXPECT_EQ(seq, mapping.Entry().mapping(seq).sequence_number());
+    EXPECT_EQ("hash" + std::to_string(seq),
+              mapping.Entry().mapping(seq).entry_hash());
+  }
+
+  FLAGS_etcd_sequence_mapping_chunk_size = 10000;
+}
+
+
+TEST_F(EtcdConsistentStoreTest, TestUpdateSequenceMappingFailsIfChanged) {
+  EntryHandle<SequenceMapping> stale;
+  EXPECT_EQ(Status::OK, store_->GetSequenceMapping(&stale));
+  AddSequenceMapping(0, "zero");
+
+  SequenceMapping::Mapping* m(stale.MutableEntry()->add_mapping());
+  m->set_sequence_number(0);
+  m->set_entry_hash("other");
+  EXPECT_THAT(store_->UpdateSequenceMapping(&stale),
+              StatusIs(util::error::FAILED_PRECONDITION));
+
+  EntryHandle<SequenceMapping> mapping;
+  EXPECT_EQ(Status::OK, store_->GetSequenceMapping(&mapping));
+  ASSERT_EQ(1, mapping.Entry().mapping_size());
+  EXPECT_EQ("zero", mapping.Entry().mapping(0).entry_hash());
+}
+
+
 TEST_F(EtcdConsistentStoreDeathTest,
        TestUpdateSequenceMappingBarfsWithOutOfOrderSequenceNumber) {
   EntryHandle<SequenceMapping> mapping;
@@ -555,6 +821,44 @@ TEST_F(EtcdConsistentStoreTest, TestSetClusterNodeStateHasTTL) {
 }
 
 
+TEST_F(EtcdConsistentStoreTest, TestSetClusterNodeStateSkipsUnchanged) {
+  FLAGS_node_state_ttl_seconds = 60;
+  const string kPath(string(kRoot) + "/nodes/" + kNodeId);
+
+  ct::ClusterNodeState state;
+  state.set_node_id(kNodeId);
+  EXPECT_OK(store_->SetClusterNodeState(state));
+  const int64_t index(ModifiedIndex(kPath));
+
+  // Well within its TTL, so not written again.
+  EXPECT_OK(store_->SetClusterNodeState(state));
+  EXPECT_EQ(index, ModifiedIndex(kPath));
+
+  state.mutable_newest_sth()->set_tree_size(42);
+  EXPECT_OK(store_->SetClusterNodeState(state));
+  EXPECT_LT(index, ModifiedIndex(kPath));
+}
+
+
+TEST_F(EtcdConsistentStoreTest, TestGetClusterNodeStateKeepsOwnState) {
+  FLAGS_node_state_ttl_seconds = 1;
+  EXPECT_THAT(store_->GetClusterNodeState().status(),
+              StatusIs(util::error::NOT_FOUND));
+
+  ct::ClusterNodeState state;
+  state.set_node_id(kNodeId);
+  state.mutable_newest_sth()->set_tree_size(42);
+  util::Status status(store_->SetClusterNodeState(state));
+  EXPECT_TRUE(status.ok()) << status;
+
+  // Still known once it has expired from etcd.
+  sleep(2);
+  const StatusOr<ct::ClusterNodeState> got(store_->GetClusterNodeState());
+  ASSERT_TRUE(got.ok()) << got.status();
+  EXPECT_EQ(42, got.ValueOrDie().newest_sth().tree_size());
+}
+
+
 TEST_F(EtcdConsistentStoreTest, WatchServingSTH) {
   Notification notify;
 
@@ -4,14 +4,16 @@
 
 #include "log/file_db.h"
 
+#include <gflags/gflags.h>
 #include <glog/logging.h>
 #include <map>
+#include <mutex>
 #include <set>
 #include <stdint.h>
 #include <string>
 #include <vector>
 
-#include "log/file_storage.h"
+#include "log/key_value_storage.h"
 #include "proto/ct.pb.h"
 #include "proto/serializer.h"
 #include "monitoring/monitoring.h"
@@ -19,6 +21,13 @@
 #include "util/util.h"
 
 
+DEFINE_int32(filedb_index_threads, 8,
+             "number of threads reading the entries of a file database "
+             "to build its index when it is opened");
+DEFINE_int32(filedb_read_threads, 8,
+             "number of threads reading the entries of a batch from a "
+             "file database at once, when scanning it");
+
 namespace {
 
 
@@ -47,16 +56,35 @@ template <class Logged>
 const size_t FileDB<Logged>::kTimestampBytesIndexed = 6;
 
 
+// static
+template <class Logged>
+std::string FileDB<Logged>::EntryKey(int64_t sequence_number) {
+  return FormatSequenceNumber(sequence_number);
+}
+
+
 template <class Logged>
 class FileDB<Logged>::Iterator : public Database<Logged>::Iterator {
  public:
-  Iterator(const FileDB<Logged>* db, int64_t start_index)
-      : db_(CHECK_NOTNULL(db)), next_index_(start_index) {
+  // Unless |fill_cache|, the files read are dropped from the page
+  // cache.
+  Iterator(const FileDB<Logged>* db, int64_t start_index, bool fill_cache)
+      : db_(CHECK_NOTNULL(db)),
+        fill_cache_(fill_cache),
+        next_index_(start_index) {
     CHECK_GE(next_index_, 0);
   }
 
   bool GetNextEntry(Logged* entry) override {
     CHECK_NOTNULL(entry);
+    if (!fill_cache_) {
+      std::vector<Logged> entries;
+      if (GetNextEntries(1, &entries) == 0) {
+        return false;
+      }
+      entry->Swap(&entries.front());
+      return true;
+    }
     {
       std::lock_guard<std::mutex> lock(db_->lock_);
       if (next_index_ >= db_->contiguous_size_) {
@@ -76,20 +104,65 @@ class FileDB<Logged>::Iterator : public Database<Logged>::Iterator {
     return true;
   }
 
+  // Reads the entries of the batch in parallel, rather than one at a
+  // time.
+  size_t GetNextEntries(size_t max_entries,
+                        std::vector<Logged>* entries) override {
+    CHECK_NOTNULL(entries);
+    std::vector<int64_t> indices;
+    {
+      std::lock_guard<std::mutex> lock(db_->lock_);
+      auto sparse_it(db_->sparse_entries_.end());
+      while (indices.size() < max_entries) {
+        if (next_index_ >= db_->contiguous_size_) {
+          if (sparse_it == db_->sparse_entries_.end()) {
+            sparse_it = db_->sparse_entries_.lower_bound(next_index_);
+          }
+          if (sparse_it == db_->sparse_entries_.end()) {
+            break;
+          }
+          next_index_ = *sparse_it++;
+        }
+        indices.push_back(next_index_++);
+      }
+    }
+
+    std::vector<std::string> keys;
+    keys.reserve(indices.size());
+    for (const int64_t index : indices) {
+      keys.emplace_back(FormatSequenceNumber(index));
+    }
+    std::vector<std::string> data;
+    const std::vector<util::Status> statuses(
+        db_->cert_storage_->LookupEntries(keys, &data,
+                                          FLAGS_filedb_read_threads,
+                                          fill_cache_));
+
+    for (size_t i = 0; i < indices.size(); ++i) {
+      CHECK_EQ(statuses[i], util::Status::OK);
+      entries->emplace_back();
+      CHECK(entries->back().ParseFromStorage(data[i]));
+      CHECK_EQ(entries->back().sequence_number(), indices[i]);
+    }
+    return indices.size();
+  }
+
  private:
   const FileDB<Logged>* const db_;
+  const bool fill_cache_;
   int64_t next_index_;
 };
 
 
 template <class Logged>
-FileDB<Logged>::FileDB(cert_trans::FileStorage* cert_storage,
-                       cert_trans::FileStorage* tree_storage,
-                       cert_trans::FileStorage* meta_storage)
+FileDB<Logged>::FileDB(cert_trans::KeyValueStorage* cert_storage,
+                       cert_trans::KeyValueStorage* tree_storage,
+                       cert_trans::KeyValueStorage* meta_storage)
     : cert_storage_(CHECK_NOTNULL(cert_storage)),
       tree_storage_(CHECK_NOTNULL(tree_storage)),
       meta_storage_(CHECK_NOTNULL(meta_storage)),
       contiguous_size_(0),
+      index_memory_("file_db_index"),
       latest_tree_timestamp_(0) {
   cert_trans::ScopedLatency latency(latency_by_op_ms.GetScopedLatency("open"));
   BuildIndex();
@@ -110,7 +183,7 @@ typename Database<Logged>::WriteResult FileDB<Logged>::CreateSequencedEntry_(
       latency_by_op_ms.GetScopedLatency("create_sequenced_entry"));
 
   std::string data;
-  CHECK(logged.SerializeToString(&data));
+  CHECK(logged.SerializeForStorage(&data));
 
   const std::string seq_str(FormatSequenceNumber(logged.sequence_number()));
 
@@ -122,7 +195,7 @@ typename Database<Logged>::WriteResult FileDB<Logged>::CreateSequencedEntry_(
     std::string existing_data;
     status = cert_storage_->LookupEntry(seq_str, &existing_data);
     CHECK_EQ(status, util::Status::OK);
-    if (existing_data == data) {
+    if (Logged::SameStoredEntry(existing_data, data)) {
       return this->OK;
     }
     return this->SEQUENCE_NUMBER_ALREADY_IN_USE;
@@ -157,7 +230,7 @@ typename Database<Logged>::LookupResult FileDB<Logged>::LookupByHash(
   CHECK_EQ(status, util::Status::OK);
 
   Logged logged;
-  CHECK(logged.ParseFromString(cert_data));
+  CHECK(logged.ParseFromStorage(cert_data));
   CHECK_EQ(logged.Hash(), hash);
 
   if (result) {
@@ -182,7 +255,7 @@ typename Database<Logged>::LookupResult FileDB<Logged>::LookupByIndex(
     return this->NOT_FOUND;
   }
   if (result) {
-    CHECK(result->ParseFromString(cert_data));
+    CHECK(result->ParseFromStorage(cert_data));
     CHECK_EQ(result->sequence_number(), sequence_number);
   }
   return this->LOOKUP_OK;
@@ -192,7 +265,14 @@ typename Database<Logged>::LookupResult FileDB<Logged>::LookupByIndex(
 template <class Logged>
 std::unique_ptr<typename Database<Logged>::Iterator>
 FileDB<Logged>::ScanEntries(int64_t start_index) const {
-  return std::unique_ptr<Iterator>(new Iterator(this, start_index));
+  return std::unique_ptr<Iterator>(new Iterator(this, start_index, true));
+}
+
+
+template <class Logged>
+std::unique_ptr<typename Database<Logged>::Iterator>
+FileDB<Logged>::ScanEntriesBulk(int64_t start_index) const {
+  return std::unique_ptr<Iterator>(new Iterator(this, start_index, false));
 }
 
 
@@ -228,6 +308,7 @@ typename Database<Logged>::WriteResult FileDB<Logged>::WriteTreeHead_(
     latest_tree_timestamp_ = sth.timestamp();
     latest_timestamp_key_ = timestamp_key;
   }
+  InsertTreeHeadMapping(sth);
 
   lock.unlock();
   callbacks_.Call(sth);
@@ -247,6 +328,41 @@ typename Database<Logged>::LookupResult FileDB<Logged>::LatestTreeHead(
 }
 
 
+template <class Logged>
+typename Database<Logged>::LookupResult
+FileDB<Logged>::LookupTreeHeadByTimestamp(uint64_t timestamp,
+                                          ct::SignedTreeHead* result) const {
+  cert_trans::ScopedLatency latency(
+      latency_by_op_ms.GetScopedLatency("lookup_tree_head_by_timestamp"));
+  std::lock_guard<std::mutex> lock(lock_);
+
+  return LookupTreeHeadNoLock(
+      Serializer::SerializeUint(timestamp, FileDB::kTimestampBytesIndexed),
+      result);
+}
+
+
+template <class Logged>
+void FileDB<Logged>::ScanTreeHeadsBySize(
+    int64_t start_size, int64_t end_size,
+    std::vector<ct::SignedTreeHead>* result) const {
+  CHECK_NOTNULL(result);
+  cert_trans::ScopedLatency latency(
+      latency_by_op_ms.GetScopedLatency("scan_tree_heads_by_size"));
+  std::lock_guard<std::mutex> lock(lock_);
+
+  for (auto it(tree_timestamp_by_size_.lower_bound(start_size));
+       it != tree_timestamp_by_size_.end() && it->first < end_size; ++it) {
+    result->emplace_back();
+    CHECK_EQ(this->LOOKUP_OK,
+             LookupTreeHeadNoLock(
+                 Serializer::SerializeUint(it->second,
+                                           FileDB::kTimestampBytesIndexed),
+                 &result->back()));
+  }
+}
+
+
 template <class Logged>
 int64_t FileDB<Logged>::TreeSize() const {
   cert_trans::ScopedLatency latency(
@@ -315,10 +431,10 @@ void FileDB<Logged>::BuildIndex() {
   // this should not be necessarily, but just to be sure...
   std::lock_guard<std::mutex> lock(lock_);
 
-  const std::set<std::string> sequence_numbers(cert_storage_->Scan());
-  id_by_hash_.reserve(sequence_numbers.size());
-
-  for (const auto& seq_path : sequence_numbers) {
+  // The entries are read and parsed by several threads, which only
+  // need to take |index_lock| to add each one to the index.
+  std::mutex index_lock;
+  const auto index_entry([this, &index_lock](const std::string& seq_path) {
     const int64_t seq(ParseSequenceNumber(seq_path));
     std::string cert_data;
     // Read the data; tolerate no errors.
@@ -326,17 +442,19 @@ void FileDB<Logged>::BuildIndex() {
              util::Status::OK)
         << "Failed to read entry with sequence number " << seq;
 
-    Logged logged;
-    CHECK(logged.ParseFromString(cert_data))
+    // Only the header of the entry is read, if it has one.
+    int64_t stored_seq;
+    std::string hash;
+    CHECK(Logged::ReadStorageKey(cert_data.data(), cert_data.size(),
+                                 &stored_seq, &hash))
         << "Failed to parse entry with sequence number " << seq;
-    CHECK(logged.has_sequence_number())
-        << "sequence_number() is unset for for entry with sequence number "
-        << seq;
-    CHECK_EQ(logged.sequence_number(), seq)
-        << "Entry has a negative sequence_number(): " << seq;
+    CHECK_EQ(stored_seq, seq)
+        << "Entry has an unexpected sequence_number(): " << seq;
 
-    InsertEntryMapping(logged.sequence_number(), logged.Hash());
-  }
+    std::lock_guard<std::mutex> index_guard(index_lock);
+    InsertEntryMapping(stored_seq, hash);
+  });
+  cert_storage_->ScanEach(index_entry, FLAGS_filedb_index_threads);
 
   // Now read the STH entries.
   std::set<std::string> sth_timestamps = tree_storage_->Scan();
@@ -347,6 +465,11 @@ void FileDB<Logged>::BuildIndex() {
                  latest_timestamp_key_, FileDB::kTimestampBytesIndexed,
                  &latest_tree_timestamp_));
   }
+  for (const std::string& timestamp_key : sth_timestamps) {
+    ct::SignedTreeHead sth;
+    CHECK_EQ(this->LOOKUP_OK, LookupTreeHeadNoLock(timestamp_key, &sth));
+    InsertTreeHeadMapping(sth);
+  }
 }
 
 
@@ -368,6 +491,30 @@ typename Database<Logged>::LookupResult FileDB<Logged>::LatestTreeHeadNoLock(
 }
 
 
+template <class Logged>
+typename Database<Logged>::LookupResult FileDB<Logged>::LookupTreeHeadNoLock(
+    const std::string& timestamp_key, ct::SignedTreeHead* result) const {
+  std::string tree_data;
+  const util::Status status(
+      tree_storage_->LookupEntry(timestamp_key, &tree_data));
+  if (status.CanonicalCode() == util::error::NOT_FOUND) {
+    return this->NOT_FOUND;
+  }
+  CHECK_EQ(status, util::Status::OK);
+
+  CHECK(result->ParseFromString(tree_data));
+  return this->LOOKUP_OK;
+}
+
+
+// This must be called with "lock_" held.
+template <class Logged>
+void FileDB<Logged>::InsertTreeHeadMapping(const ct::SignedTreeHead& sth) {
+  uint64_t& timestamp(tree_timestamp_by_size_[sth.tree_size()]);
+  timestamp = std::max<uint64_t>(timestamp, sth.timestamp());
+}
+
+
 // This must be called with "lock_" held.
 template <class Logged>
 void FileDB<Logged>::InsertEntryMapping(int64_t sequence_number,
@@ -390,6 +537,11 @@ void FileDB<Logged>::InsertEntryMapping(int64_t sequence_number,
     CHECK(sparse_entries_.insert(sequence_number).second)
         << "sequence number " << sequence_number << " already assigned.";
   }
+
+  index_memory_.Set(
+      cert_trans::UnorderedContainerBytes(
+          id_by_hash_, cert_trans::StringHeapBytes(hash.size())) +
+      cert_trans::OrderedContainerBytes(sparse_entries_, 0));
 }
 
 
@@ -12,11 +12,12 @@
 
 #include "base/macros.h"
 #include "log/database.h"
+#include "monitoring/memory_gauge.h"
 #include "proto/ct.pb.h"
 #include "util/statusor.h"
 
 namespace cert_trans {
-class FileStorage;
+class KeyValueStorage;
 }
 
 // Database interface that stores certificates and tree head
@@ -28,20 +29,26 @@ class FileDB : public Database<Logged> {
   // and builds an in-memory index.
   // Writes to the underlying FileStorage are atomic (assuming underlying
   // file system operations such as 'rename' are atomic) which should
-  // guarantee full recoverability from crashes/power failures.
+  // guarantee full recoverability from crashes/power failures. The
+  // certificates can also be kept in a SegmentStorage, which appends
+  // them to large files instead.
   // The tree head database uses 6-byte primary keys corresponding to the
   // 6 lower bytes of the (unique) timestamp, so the storage depth of
   // the FileDB should be set up accordingly. For example, a storage depth
   // of 8 buckets tree head updates within about 1 minute
   // (timestamps xxxxxxxx0000 - xxxxxxxxFFFF) to the same directory.
   // Takes ownership of |cert_storage|, |tree_storage|, and |meta_storage|.
-  FileDB(cert_trans::FileStorage* cert_storage,
-         cert_trans::FileStorage* tree_storage,
-         cert_trans::FileStorage* meta_storage);
+  FileDB(cert_trans::KeyValueStorage* cert_storage,
+         cert_trans::KeyValueStorage* tree_storage,
+         cert_trans::KeyValueStorage* meta_storage);
   ~FileDB();
 
   static const size_t kTimestampBytesIndexed;
 
+  // The key of the entry |sequence_number| in |cert_storage|, e.g. to
+  // find its record with SegmentStorage::LookupRecords().
+  static std::string EntryKey(int64_t sequence_number);
+
   // Implement abstract functions, see database.h for comments.
   typename Database<Logged>::WriteResult CreateSequencedEntry_(
       const Logged& logged) override;
@@ -55,12 +62,22 @@ class FileDB : public Database<Logged> {
   std::unique_ptr<typename Database<Logged>::Iterator> ScanEntries(
       int64_t start_index) const override;
 
+  std::unique_ptr<typename Database<Logged>::Iterator> ScanEntriesBulk(
+      int64_t start_index) const override;
+
   typename Database<Logged>::WriteResult WriteTreeHead_(
       const ct::SignedTreeHead& sth) override;
 
   typename Database<Logged>::LookupResult LatestTreeHead(
       ct::SignedTreeHead* result) const override;
 
+  typename Database<Logged>::LookupResult LookupTreeHeadByTimestamp(
+      uint64_t timestamp, ct::SignedTreeHead* result) const override;
+
+  void ScanTreeHeadsBySize(
+      int64_t start_size, int64_t end_size,
+      std::vector<ct::SignedTreeHead>* result) const override;
+
   int64_t TreeSize() const override;
 
   void AddNotifySTHCallback(
@@ -80,15 +97,16 @@ class FileDB : public Database<Logged> {
   void BuildIndex();
   typename Database<Logged>::LookupResult LatestTreeHeadNoLock(
       ct::SignedTreeHead* result) const;
+  typename Database<Logged>::LookupResult LookupTreeHeadNoLock(
+      const std::string& timestamp_key, ct::SignedTreeHead* result) const;
+  void InsertTreeHeadMapping(const ct::SignedTreeHead& sth);
   void InsertEntryMapping(int64_t sequence_number, const std::string& hash);
 
-  const std::unique_ptr<cert_trans::FileStorage> cert_storage_;
-  // Store all tree heads, but currently only support looking up the latest
-  // one.
-  // Other necessary lookup indices (by tree size, by timestamp range?) TBD.
-  const std::unique_ptr<cert_trans::FileStorage> tree_storage_;
+  const std::unique_ptr<cert_trans::KeyValueStorage> cert_storage_;
+  // All the tree heads, keyed by timestamp.
+  const std::unique_ptr<cert_trans::KeyValueStorage> tree_storage_;
 
-  const std::unique_ptr<cert_trans::FileStorage> meta_storage_;
+  const std::unique_ptr<cert_trans::KeyValueStorage> meta_storage_;
 
   mutable std::mutex lock_;
 
@@ -99,10 +117,14 @@ class FileDB : public Database<Logged> {
   // can happen while it is being fetched). When entries here become
   // contiguous with the head of the tree they'll be removed.
   std::set<int64_t> sparse_entries_;
+  // Reports the memory used by |id_by_hash_| and |sparse_entries_|.
+  cert_trans::MemoryGauge index_memory_;
 
   uint64_t latest_tree_timestamp_;
   // The same as a string;
   std::string latest_timestamp_key_;
+  // The timestamp of the freshest tree head of each tree size.
+  std::map<int64_t, uint64_t> tree_timestamp_by_size_;
   cert_trans::DatabaseNotifierHelper callbacks_;
 
   DISALLOW_COPY_AND_ASSIGN(FileDB);
@@ -1,21 +1,28 @@
 /* -*- indent-tabs-mode: nil -*- */
 #include "log/file_storage.h"
 
+#include <algorithm>
+#include <atomic>
 #include <cstdlib>
 #include <dirent.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <glog/logging.h>
 #include <set>
 #include <string>
 #include <sys/stat.h>
+#include <thread>
 #include <unistd.h>
+#include <vector>
 
 #include "log/filesystem_ops.h"
 #include "util/util.h"
 
 using cert_trans::BasicFilesystemOps;
 using cert_trans::FilesystemOps;
+using std::function;
 using std::string;
+using std::vector;
 
 namespace cert_trans {
 
@@ -52,11 +59,43 @@ FileStorage::~FileStorage() {
 
 std::set<string> FileStorage::Scan() const {
   std::set<string> storage_keys;
-  ScanDir(storage_dir_, storage_depth_, &storage_keys);
+  ScanDir(storage_dir_, storage_depth_,
+          [&storage_keys](const string& key) { storage_keys.insert(key); });
   return storage_keys;
 }
 
 
+void FileStorage::ScanEach(const function<void(const string&)>& callback,
+                           int num_threads) const {
+  CHECK_GT(num_threads, 0);
+  if (storage_depth_ == 0) {
+    ScanFiles(storage_dir_, callback);
+    return;
+  }
+
+  // One task per top-level directory, which the threads take in
+  // turn.
+  const vector<string> shards(ListDir(storage_dir_));
+  std::atomic<size_t> next_shard(0);
+  const auto scan_shards([this, &callback, &shards, &next_shard]() {
+    for (size_t i = next_shard++; i < shards.size(); i = next_shard++) {
+      ScanDir(storage_dir_ + "/" + shards[i], storage_depth_ - 1, callback);
+    }
+  });
+
+  vector<std::thread> threads;
+  const size_t num_workers(
+      std::min(static_cast<size_t>(num_threads), shards.size()));
+  for (size_t i = 1; i < num_workers; ++i) {
+    threads.emplace_back(scan_shards);
+  }
+  scan_shards();
+  for (auto& thread : threads) {
+    thread.join();
+  }
+}
+
+
 util::Status FileStorage::CreateEntry(const string& key, const string& data) {
   if (LookupEntry(key, NULL).ok()) {
     return util::Status(util::error::ALREADY_EXISTS,
@@ -80,16 +119,52 @@ util::Status FileStorage::UpdateEntry(const string& key, const string& data) {
 util::Status FileStorage::LookupEntry(const string& key,
                                       string* result) const {
   string data_file = StoragePath(key);
-  if (!FileExists(data_file)) {
+  // Only check for the file when the data is not wanted, otherwise
+  // trying to open it tells us as much.
+  if (result ? !ReadFileIfExists(data_file, result, true)
+             : !FileExists(data_file)) {
     return util::Status(util::error::NOT_FOUND, "entry not found: " + key);
   }
-  if (result) {
-    CHECK(util::ReadBinaryFile(data_file, result));
-  }
   return util::Status::OK;
 }
 
 
+vector<util::Status> FileStorage::LookupEntries(const vector<string>& keys,
+                                                vector<string>* results,
+                                                int num_threads,
+                                                bool fill_cache) const {
+  CHECK_GT(num_threads, 0);
+  CHECK_NOTNULL(results)->assign(keys.size(), string());
+  vector<util::Status> statuses(keys.size());
+
+  // The threads take the keys in turn, so that a slow read does not
+  // hold up the others.
+  std::atomic<size_t> next_key(0);
+  const auto lookup_keys([this, &keys, results, fill_cache, &statuses,
+                          &next_key]() {
+    for (size_t i = next_key++; i < keys.size(); i = next_key++) {
+      if (!ReadFileIfExists(StoragePath(keys[i]), &(*results)[i],
+                            fill_cache)) {
+        statuses[i] = util::Status(util::error::NOT_FOUND,
+                                   "entry not found: " + keys[i]);
+      }
+    }
+  });
+
+  vector<std::thread> threads;
+  const size_t num_workers(
+      std::min(static_cast<size_t>(num_threads), keys.size()));
+  for (size_t i = 1; i < num_workers; ++i) {
+    threads.emplace_back(lookup_keys);
+  }
+  lookup_keys();
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  return statuses;
+}
+
+
 string FileStorage::StoragePathBasename(const string& hex) const {
   if (hex.length() <= static_cast<uint>(storage_depth_))
     return "-";
@@ -150,36 +225,47 @@ void FileStorage::WriteStorageEntry(const string& key, const string& data) {
 
 
 void FileStorage::ScanFiles(const string& dir_path,
-                            std::set<string>* keys) const {
+                            const function<void(const string&)>& callback)
+    const {
   DIR* dir = CHECK_NOTNULL(opendir(dir_path.c_str()));
   struct dirent* entry;
   while ((entry = readdir(dir)) != NULL) {
     if (entry->d_name[0] == '.')
       continue;
-    keys->insert(StorageKey(dir_path + "/" + entry->d_name));
+    callback(StorageKey(dir_path + "/" + entry->d_name));
   }
   closedir(dir);
 }
 
 
 void FileStorage::ScanDir(const string& dir_path, int depth,
-                          std::set<string>* keys) const {
+                          const function<void(const string&)>& callback)
+    const {
   CHECK_GE(depth, 0);
   if (depth > 0) {
-    // Parse subdirectories. (TODO: make opendir part of filesystemop).
-    DIR* dir = CHECK_NOTNULL(opendir(dir_path.c_str()));
-    struct dirent* entry;
-    std::set<string> result;
-    while ((entry = readdir(dir)) != NULL) {
-      if (entry->d_name[0] == '.')
-        continue;
-      ScanDir(dir_path + "/" + entry->d_name, depth - 1, keys);
+    // Parse subdirectories.
+    for (const auto& name : ListDir(dir_path)) {
+      ScanDir(dir_path + "/" + name, depth - 1, callback);
     }
-    closedir(dir);
   } else {
     // depth == 0; parse files.
-    ScanFiles(dir_path, keys);
+    ScanFiles(dir_path, callback);
+  }
+}
+
+
+vector<string> FileStorage::ListDir(const string& dir_path) const {
+  // TODO: make opendir part of filesystemop.
+  DIR* dir = CHECK_NOTNULL(opendir(dir_path.c_str()));
+  vector<string> names;
+  struct dirent* entry;
+  while ((entry = readdir(dir)) != NULL) {
+    if (entry->d_name[0] == '.')
+      continue;
+    names.push_back(entry->d_name);
   }
+  closedir(dir);
+  return names;
 }
 
 
@@ -193,6 +279,36 @@ bool FileStorage::FileExists(const string& file_path) const {
 }
 
 
+bool FileStorage::ReadFileIfExists(const string& file_path, string* data,
+                                   bool fill_cache) const {
+  const int fd(file_op_->open(file_path, O_RDONLY | O_CLOEXEC));
+  if (fd < 0) {
+    CHECK_EQ(errno, ENOENT);
+    return false;
+  }
+
+  struct stat st;
+  CHECK_EQ(fstat(fd, &st), 0);
+  data->resize(st.st_size);
+  size_t done(0);
+  while (done < data->size()) {
+    const ssize_t got(read(fd, &(*data)[done], data->size() - done));
+    if (got < 0 && errno == EINTR) {
+      continue;
+    }
+    // Entries are replaced by renaming, never truncated in place.
+    CHECK_GT(got, 0);
+    done += got;
+  }
+  if (!fill_cache) {
+    // Only a hint, so it does not matter if it fails.
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+  }
+  CHECK_EQ(close(fd), 0);
+  return true;
+}
+
+
 void FileStorage::AtomicWriteBinaryFile(const string& file_path,
                                         const string& data) {
   const string tmp_file(
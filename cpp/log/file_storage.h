@@ -1,12 +1,15 @@
 #ifndef CERT_TRANS_LOG_FILE_STORAGE_H_
 #define CERT_TRANS_LOG_FILE_STORAGE_H_
 
+#include <functional>
 #include <memory>
 #include <set>
 #include <stdint.h>
 #include <string>
+#include <vector>
 
 #include "base/macros.h"
+#include "log/key_value_storage.h"
 #include "util/status.h"
 
 namespace cert_trans {
@@ -42,26 +45,37 @@ class FilesystemOps;
 //
 // FileStorage aborts upon any FilesystemOps error. This class is
 // threadsafe.
-class FileStorage {
+class FileStorage : public KeyValueStorage {
  public:
   // Default constructor, uses BasicFilesystemOps.
   FileStorage(const std::string& file_base, int storage_depth);
   // Takes ownership of the FilesystemOps.
   FileStorage(const std::string& file_base, int storage_depth,
               cert_trans::FilesystemOps* file_op);
-  ~FileStorage();
+  ~FileStorage() override;
 
-  // Scan the entire database and return the list of keys.
-  std::set<std::string> Scan() const;
+  // Implement abstract functions, see key_value_storage.h for
+  // comments. ScanEach() walks the top-level directories in parallel,
+  // and LookupEntries() reads the files of a batch in parallel, and
+  // drops them from the page cache unless |fill_cache|.
+  std::set<std::string> Scan() const override;
 
-  // Write (key, data) unless an entry matching |key| already exists.
-  util::Status CreateEntry(const std::string& key, const std::string& data);
+  void ScanEach(const std::function<void(const std::string&)>& callback,
+                int num_threads) const override;
 
-  // Update an existing entry; fail if it doesn't already exist.
-  util::Status UpdateEntry(const std::string& key, const std::string& data);
+  util::Status CreateEntry(const std::string& key,
+                           const std::string& data) override;
 
-  // Lookup entry based on key.
-  util::Status LookupEntry(const std::string& key, std::string* result) const;
+  util::Status UpdateEntry(const std::string& key,
+                           const std::string& data) override;
+
+  util::Status LookupEntry(const std::string& key,
+                           std::string* result) const override;
+
+  std::vector<util::Status> LookupEntries(
+      const std::vector<std::string>& keys,
+      std::vector<std::string>* results, int num_threads,
+      bool fill_cache) const override;
 
  private:
   std::string StoragePathBasename(const std::string& hex) const;
@@ -71,12 +85,20 @@ class FileStorage {
   // Write or overwrite.
   void WriteStorageEntry(const std::string& key, const std::string& data);
   void ScanFiles(const std::string& dir_path,
-                 std::set<std::string>* keys) const;
+                 const std::function<void(const std::string&)>& callback)
+      const;
   void ScanDir(const std::string& dir_path, int depth,
-               std::set<std::string>* keys) const;
+               const std::function<void(const std::string&)>& callback)
+      const;
+  // The names of the entries in |dir_path|, other than dot files.
+  std::vector<std::string> ListDir(const std::string& dir_path) const;
 
   // The following methods abort upon any error.
   bool FileExists(const std::string& file_path) const;
+  // Reads |file_path| into |*data| with a single open() and read(),
+  // returning false if it does not exist.
+  bool ReadFileIfExists(const std::string& file_path, std::string* data,
+                        bool fill_cache) const;
   void AtomicWriteBinaryFile(const std::string& file_path,
                              const std::string& data);
   // Create directory, unless it already exists.
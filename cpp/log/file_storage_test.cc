@@ -1,11 +1,13 @@
 #include <gtest/gtest.h>
 #include <errno.h>
 #include <iostream>
+#include <mutex>
 #include <set>
 #include <stdio.h>
 #include <string>
 #include <sys/stat.h>
 #include <unistd.h>
+#include <vector>
 
 #include "log/file_storage.h"
 #include "log/filesystem_ops.h"
@@ -73,6 +75,57 @@ TEST_F(BasicFileStorageTest, Scan) {
   EXPECT_EQ(keys, scan_keys);
 }
 
+TEST_F(BasicFileStorageTest, ScanEach) {
+  std::set<string> keys;
+  for (int i = 0; i < 100; ++i) {
+    const string key(std::to_string(100000 + i * 7919));
+    EXPECT_EQ(util::Status::OK, fs()->CreateEntry(key, "value"));
+    keys.insert(key);
+  }
+
+  for (int num_threads : {1, 4, 32}) {
+    std::mutex lock;
+    std::set<string> scan_keys;
+    fs()->ScanEach(
+        [&lock, &scan_keys](const string& key) {
+          std::lock_guard<std::mutex> guard(lock);
+          EXPECT_TRUE(scan_keys.insert(key).second) << key;
+        },
+        num_threads);
+    EXPECT_EQ(keys, scan_keys) << num_threads;
+  }
+}
+
+TEST_F(BasicFileStorageTest, LookupEntries) {
+  std::vector<string> keys;
+  for (int i = 0; i < 100; ++i) {
+    const string key(std::to_string(100000 + i * 7919));
+    // Leave every tenth entry out.
+    if (i % 10 != 0) {
+      EXPECT_EQ(util::Status::OK, fs()->CreateEntry(key, "value" + key));
+    }
+    keys.push_back(key);
+  }
+
+  for (int num_threads : {1, 4, 200}) {
+    for (bool fill_cache : {true, false}) {
+      std::vector<string> results;
+      const std::vector<util::Status> statuses(
+          fs()->LookupEntries(keys, &results, num_threads, fill_cache));
+      ASSERT_EQ(keys.size(), statuses.size()) << num_threads;
+      ASSERT_EQ(keys.size(), results.size()) << num_threads;
+      for (size_t i = 0; i < keys.size(); ++i) {
+        if (i % 10 == 0) {
+          EXPECT_EQ(util::error::NOT_FOUND, statuses[i].CanonicalCode());
+        } else {
+          EXPECT_EQ(util::Status::OK, statuses[i]);
+          EXPECT_EQ("value" + keys[i], results[i]);
+        }
+      }
+    }
+  }
+}
+
 TEST_F(BasicFileStorageTest, CreateDuplicate) {
   string key("1234xyzw", 8);
   string value("unicorn", 7);
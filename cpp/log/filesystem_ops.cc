@@ -1,6 +1,7 @@
 #include "log/filesystem_ops.h"
 
 #include <errno.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <sys/stat.h>
 #include <unistd.h>
@@ -29,6 +30,11 @@ int BasicFilesystemOps::access(const std::string& path, int amode) {
 }
 
 
+int BasicFilesystemOps::open(const std::string& path, int flags) {
+  return ::open(path.c_str(), flags);
+}
+
+
 FailingFilesystemOps::FailingFilesystemOps(int fail_point)
     : op_count_(0), fail_point_(fail_point) {
 }
@@ -71,4 +77,13 @@ int FailingFilesystemOps::access(const std::string& path, int amode) {
 }
 
 
+int FailingFilesystemOps::open(const std::string& path, int flags) {
+  if (fail_point_ == op_count_++) {
+    errno = EIO;
+    return -1;
+  }
+  return BasicFilesystemOps::open(path, flags);
+}
+
+
 }  // namespace cert_trans
@@ -20,6 +20,8 @@ class FilesystemOps {
   virtual int rename(const std::string& old_name,
                      const std::string& new_name) = 0;
   virtual int access(const std::string& path, int amode) = 0;
+  // Returns a file descriptor, or -1 with |errno| set.
+  virtual int open(const std::string& path, int flags) = 0;
 
  protected:
   FilesystemOps() = default;
@@ -38,6 +40,7 @@ class BasicFilesystemOps : public FilesystemOps {
   int rename(const std::string& old_name,
              const std::string& new_name) override;
   int access(const std::string& path, int amode) override;
+  int open(const std::string& path, int flags) override;
 };
 
 
@@ -55,6 +58,7 @@ class FailingFilesystemOps : public BasicFilesystemOps {
   int rename(const std::string& old_name,
              const std::string& new_name) override;
   int access(const std::string& path, int amode) override;
+  int open(const std::string& path, int flags) override;
 
  private:
   int op_count_;
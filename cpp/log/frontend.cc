@@ -9,6 +9,8 @@
 #include "monitoring/event_metric.h"
 #include "proto/ct.pb.h"
 #include "util/status.h"
+#include "util/task.h"
+#include "util/trace.h"
 
 using cert_trans::CertChain;
 using cert_trans::PreCertChain;
@@ -56,6 +58,22 @@ Status Frontend::QueueProcessedEntry(Status pre_status, const LogEntry& entry,
   return UpdateStats(entry.type(), signer_->QueueEntry(entry, sct));
 }
 
+void Frontend::QueueProcessedEntry(Status pre_status, const LogEntry& entry,
+                                   SignedCertificateTimestamp* sct,
+                                   util::Task* task) {
+  if (!pre_status.ok()) {
+    task->Return(UpdateStats(entry.type(), pre_status));
+    return;
+  }
+
+  // Step 2. Submit to database.
+  const ct::LogEntryType type(entry.type());
+  signer_->QueueEntry(entry, sct,
+                      task->AddChild([type, task](util::Task* child_task) {
+                        task->Return(UpdateStats(type, child_task->status()));
+                      }));
+}
+
 Status Frontend::QueueX509Entry(CertChain* chain,
                                 SignedCertificateTimestamp* sct) {
   LogEntry entry;
@@ -73,3 +91,31 @@ Status Frontend::QueuePreCertEntry(PreCertChain* chain,
   return QueueProcessedEntry(handler_->ProcessPreCertSubmission(chain, &entry),
                              entry, sct);
 }
+
+void Frontend::QueueX509Entry(CertChain* chain,
+                              SignedCertificateTimestamp* sct,
+                              util::Task* task) {
+  LogEntry entry;
+  // Make sure the correct statistics get updated in case of error.
+  entry.set_type(ct::X509_ENTRY);
+  Status status;
+  {
+    util::ScopedTraceSpan span("frontend.process_submission");
+    status = handler_->ProcessX509Submission(chain, &entry);
+  }
+  QueueProcessedEntry(status, entry, sct, task);
+}
+
+void Frontend::QueuePreCertEntry(PreCertChain* chain,
+                                 SignedCertificateTimestamp* sct,
+                                 util::Task* task) {
+  LogEntry entry;
+  // Make sure the correct statistics get updated in case of error.
+  entry.set_type(ct::PRECERT_ENTRY);
+  Status status;
+  {
+    util::ScopedTraceSpan span("frontend.process_submission");
+    status = handler_->ProcessPreCertSubmission(chain, &entry);
+  }
+  QueueProcessedEntry(status, entry, sct, task);
+}
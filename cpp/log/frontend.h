@@ -14,6 +14,7 @@ class FrontendSigner;
 
 namespace util {
 class Status;
+class Task;
 }  // namespace util
 
 // Frontend for accepting new submissions.
@@ -29,7 +30,17 @@ class Frontend {
   util::Status QueuePreCertEntry(cert_trans::PreCertChain* chain,
                                  ct::SignedCertificateTimestamp* sct);
 
-  const std::multimap<std::string, const cert_trans::Cert*>& GetRoots() const {
+  // Same as above, but once the chain is checked, return through
+  // |task| rather than blocking until the entry is queued. |sct| must
+  // remain valid until |task| is done.
+  void QueueX509Entry(cert_trans::CertChain* chain,
+                      ct::SignedCertificateTimestamp* sct, util::Task* task);
+  void QueuePreCertEntry(cert_trans::PreCertChain* chain,
+                         ct::SignedCertificateTimestamp* sct,
+                         util::Task* task);
+
+  std::shared_ptr<const std::multimap<std::string, const cert_trans::Cert*>>
+  GetRoots() const {
     return handler_->GetRoots();
   }
 
@@ -40,6 +51,9 @@ class Frontend {
   util::Status QueueProcessedEntry(util::Status pre_status,
                                    const ct::LogEntry& entry,
                                    ct::SignedCertificateTimestamp* sct);
+  void QueueProcessedEntry(util::Status pre_status, const ct::LogEntry& entry,
+                           ct::SignedCertificateTimestamp* sct,
+                           util::Task* task);
 
   DISALLOW_COPY_AND_ASSIGN(Frontend);
 };
@@ -1,38 +1,134 @@
 /* -*- indent-tabs-mode: nil -*- */
 #include "log/frontend_signer.h"
 
+#include <algorithm>
+#include <chrono>
+#include <gflags/gflags.h>
 #include <glog/logging.h>
 
 #include "log/database.h"
 #include "log/log_signer.h"
 #include "merkletree/serial_hasher.h"
+#include "monitoring/monitoring.h"
 #include "proto/ct.pb.h"
 #include "proto/serializer.h"
 #include "util/status.h"
+#include "util/task.h"
+#include "util/trace.h"
 #include "util/util.h"
 
 
 using cert_trans::ConsistentStore;
+using cert_trans::Counter;
 using cert_trans::LoggedCertificate;
 using ct::LogEntry;
 using ct::SignedCertificateTimestamp;
+using std::chrono::steady_clock;
+using std::lock_guard;
+using std::mutex;
 using std::string;
 using util::Status;
 
+DEFINE_int32(frontend_recent_entries, 65536,
+             "number of recently submitted entries whose SCT is kept in "
+             "memory, to answer resubmissions without going to the "
+             "database or the consistent store");
+DEFINE_int32(frontend_recent_entries_shards, 16,
+             "number of independently locked shards that the recently "
+             "submitted entries are spread over");
+
+namespace {
+
+
+Counter<>* frontend_recent_duplicates(
+    Counter<>::New("frontend_recent_duplicates",
+                   "Number of resubmitted entries answered from the recently "
+                   "submitted entries in memory."));
+
+}  // namespace
+
 FrontendSigner::FrontendSigner(Database<cert_trans::LoggedCertificate>* db,
                                ConsistentStore<LoggedCertificate>* store,
                                LogSigner* signer)
     : db_(CHECK_NOTNULL(db)),
       store_(CHECK_NOTNULL(store)),
       signer_(CHECK_NOTNULL(signer)) {
+  CHECK_GT(FLAGS_frontend_recent_entries_shards, 0);
+  for (int i = 0; i < FLAGS_frontend_recent_entries_shards; ++i) {
+    recent_.emplace_back(new RecentShard);
+  }
 }
 
 Status FrontendSigner::QueueEntry(const LogEntry& entry,
                                   SignedCertificateTimestamp* sct) {
+  cert_trans::LoggedCertificate new_logged;
+  const Status status(NewEntry(entry, &new_logged, sct));
+  if (!status.ok()) {
+    return status;
+  }
+  // The submission handler has already verified the format of this
+  // entry, so this should never fail.
+  CHECK_EQ(LogSigner::OK,
+           signer_->SignCertificateTimestamp(entry,
+                                             new_logged.mutable_sct()));
+
+  return FinishEntry(store_->AddPendingEntry(&new_logged), new_logged, sct);
+}
+
+
+void FrontendSigner::QueueEntry(const LogEntry& entry,
+                                SignedCertificateTimestamp* sct,
+                                util::Task* task) {
+  CHECK_NOTNULL(task);
+  cert_trans::LoggedCertificate* const new_logged(
+      new cert_trans::LoggedCertificate);
+  task->DeleteWhenDone(new_logged);
+  const Status status(NewEntry(entry, new_logged, sct));
+  if (!status.ok()) {
+    task->Return(status);
+    return;
+  }
+
+  // The child tasks run their callbacks in the trace context of this
+  // call, under which the spans of both steps are recorded.
+  const steady_clock::time_point sign_start(steady_clock::now());
+  signer_->SignCertificateTimestamp(
+      new_logged->entry(), new_logged->mutable_sct(),
+      task->AddChild([this, new_logged, sct, task,
+                      sign_start](util::Task* sign_task) {
+        util::TraceSpan::Record("signer.sign", util::TraceContext::Current(),
+                                sign_start);
+        if (!sign_task->status().ok()) {
+          task->Return(sign_task->status());
+          return;
+        }
+        const steady_clock::time_point store_start(steady_clock::now());
+        store_->AddPendingEntryAsync(
+            new_logged, task->AddChild([this, new_logged, sct, task,
+                                        store_start](util::Task* child_task) {
+              util::TraceSpan::Record("signer.store",
+                                      util::TraceContext::Current(),
+                                      store_start);
+              task->Return(
+                  FinishEntry(child_task->status(), *new_logged, sct));
+            }));
+      }));
+}
+
+
+Status FrontendSigner::NewEntry(const LogEntry& entry,
+                                cert_trans::LoggedCertificate* new_logged,
+                                SignedCertificateTimestamp* sct) const {
   const string sha256_hash(
       Sha256Hasher::Sha256Digest(Serializer::LeafCertificate(entry)));
   CHECK(!sha256_hash.empty());
 
+  if (LookupRecent(sha256_hash, sct)) {
+    frontend_recent_duplicates->Increment();
+    return Status(util::error::ALREADY_EXISTS,
+                  "entry already exists in Database");
+  }
+
   // Check if the entry already exists in the local DB (i.e. it's been
   // integrated into the tree.)
   // This isn't foolproof; it could be that the local node doesn't yet have
@@ -45,6 +141,7 @@ Status FrontendSigner::QueueEntry(const LogEntry& entry,
 
   if (db_result == Database<cert_trans::LoggedCertificate>::LOOKUP_OK) {
     // If we did find a local copy, return the previously issued SCT.
+    AddRecent(sha256_hash, logged.sct());
     if (sct != nullptr) {
       *sct = logged.sct();
     }
@@ -54,34 +151,85 @@ Status FrontendSigner::QueueEntry(const LogEntry& entry,
   CHECK_EQ(Database<cert_trans::LoggedCertificate>::NOT_FOUND, db_result);
 
   // Dont have the cert locally, so create an SCT and store it and the cert.
-  SignedCertificateTimestamp local_sct;
-  TimestampAndSign(entry, &local_sct);
+  Timestamp(new_logged->mutable_sct());
+  new_logged->mutable_entry()->CopyFrom(entry);
+  CHECK_EQ(new_logged->Hash(), sha256_hash);
+  // Computed once here, and kept with the entry all the way to the
+  // tree.
+  CHECK(new_logged->CacheLeafHash());
+
+  return Status::OK;
+}
 
-  cert_trans::LoggedCertificate new_logged;
-  new_logged.mutable_sct()->CopyFrom(local_sct);
-  new_logged.mutable_entry()->CopyFrom(entry);
-  CHECK_EQ(new_logged.Hash(), sha256_hash);
 
+Status FrontendSigner::FinishEntry(
+    const Status& status, const cert_trans::LoggedCertificate& new_logged,
+    SignedCertificateTimestamp* sct) const {
   // If this cert has already been added (but not yet integrated into the
-  // tree), then this call will update new_logged.sct with the previously
+  // tree), then the store has updated new_logged.sct with the previously
   // issued one.
-  util::Status status(store_->AddPendingEntry(&new_logged));
-  CHECK_EQ(new_logged.Hash(), sha256_hash);
-
   if (sct != nullptr) {
     *sct = new_logged.sct();
   }
 
+  if (status.ok() || status.CanonicalCode() == util::error::ALREADY_EXISTS) {
+    AddRecent(new_logged.Hash(), new_logged.sct());
+  }
+
   return status;
 }
 
 
-void FrontendSigner::TimestampAndSign(const LogEntry& entry,
-                                      SignedCertificateTimestamp* sct) const {
+FrontendSigner::RecentShard* FrontendSigner::ShardFor(
+    const string& sha256_hash) const {
+  // The hashes are uniformly distributed already.
+  return recent_[static_cast<unsigned char>(sha256_hash[0]) % recent_.size()]
+      .get();
+}
+
+
+bool FrontendSigner::LookupRecent(const string& sha256_hash,
+                                  SignedCertificateTimestamp* sct) const {
+  RecentShard* const shard(ShardFor(sha256_hash));
+  lock_guard<mutex> lock(shard->lock);
+  const auto it(shard->scts.find(sha256_hash));
+  if (it == shard->scts.end()) {
+    return false;
+  }
+  shard->lru.splice(shard->lru.begin(), shard->lru, it->second.second);
+  if (sct != nullptr) {
+    *sct = it->second.first;
+  }
+  return true;
+}
+
+
+void FrontendSigner::AddRecent(const string& sha256_hash,
+                               const SignedCertificateTimestamp& sct) const {
+  const size_t max_entries(
+      std::max(FLAGS_frontend_recent_entries, 0) / recent_.size());
+  if (max_entries == 0) {
+    return;
+  }
+
+  RecentShard* const shard(ShardFor(sha256_hash));
+  lock_guard<mutex> lock(shard->lock);
+  const auto it(shard->scts.find(sha256_hash));
+  if (it != shard->scts.end()) {
+    shard->lru.splice(shard->lru.begin(), shard->lru, it->second.second);
+    return;
+  }
+  while (shard->scts.size() >= max_entries) {
+    shard->scts.erase(shard->lru.back());
+    shard->lru.pop_back();
+  }
+  shard->lru.push_front(sha256_hash);
+  shard->scts.emplace(sha256_hash, std::make_pair(sct, shard->lru.begin()));
+}
+
+
+void FrontendSigner::Timestamp(SignedCertificateTimestamp* sct) const {
   sct->set_version(ct::V1);
-  sct->set_timestamp(util::TimeInMilliseconds());
+  sct->set_timestamp(util::NonDecreasingTimeInMilliseconds());
   sct->clear_extensions();
-  // The submission handler has already verified the format of this entry,
-  // so this should never fail.
-  CHECK_EQ(LogSigner::OK, signer_->SignCertificateTimestamp(entry, sct));
 }
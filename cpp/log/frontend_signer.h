@@ -1,8 +1,14 @@
 #ifndef FRONTEND_SIGNER_H
 #define FRONTEND_SIGNER_H
 
+#include <list>
+#include <memory>
+#include <mutex>
 #include <stdint.h>
 #include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 
 #include "base/macros.h"
 #include "log/consistent_store.h"
@@ -14,6 +20,7 @@ class LogSigner;
 
 namespace util {
 class Status;
+class Task;
 }  // namespace util
 
 
@@ -32,13 +39,46 @@ class FrontendSigner {
   util::Status QueueEntry(const ct::LogEntry& entry,
                           ct::SignedCertificateTimestamp* sct);
 
+  // Same as above, but returns the status through |task| rather than
+  // blocking on the signer or the consistent store. |sct| must remain
+  // valid until |task| is done.
+  void QueueEntry(const ct::LogEntry& entry,
+                  ct::SignedCertificateTimestamp* sct, util::Task* task);
+
  private:
-  void TimestampAndSign(const ct::LogEntry& entry,
+  // Returns OK with |new_logged| set to the entry to add to the
+  // consistent store, with a timestamped SCT still to be signed, or
+  // ALREADY_EXISTS with |sct| set if it is in the database already.
+  util::Status NewEntry(const ct::LogEntry& entry,
+                        cert_trans::LoggedCertificate* new_logged,
                         ct::SignedCertificateTimestamp* sct) const;
+  util::Status FinishEntry(const util::Status& status,
+                           const cert_trans::LoggedCertificate& new_logged,
+                           ct::SignedCertificateTimestamp* sct) const;
+  void Timestamp(ct::SignedCertificateTimestamp* sct) const;
+
+  // The SCTs recently issued or handed out again, by leaf hash, so
+  // that resubmissions are answered without looking further. They are
+  // spread over shards, to keep the submissions from contending on a
+  // single lock.
+  struct RecentShard {
+    std::mutex lock;
+    // Hashes, most recently used first.
+    std::list<std::string> lru;
+    std::unordered_map<std::string,
+                       std::pair<ct::SignedCertificateTimestamp,
+                                 std::list<std::string>::iterator>> scts;
+  };
+  RecentShard* ShardFor(const std::string& sha256_hash) const;
+  bool LookupRecent(const std::string& sha256_hash,
+                    ct::SignedCertificateTimestamp* sct) const;
+  void AddRecent(const std::string& sha256_hash,
+                 const ct::SignedCertificateTimestamp& sct) const;
 
   Database<cert_trans::LoggedCertificate>* const db_;
   cert_trans::ConsistentStore<cert_trans::LoggedCertificate>* const store_;
   LogSigner* const signer_;
+  std::vector<std::unique_ptr<RecentShard>> recent_;
 
   DISALLOW_COPY_AND_ASSIGN(FrontendSigner);
 };
@@ -9,6 +9,7 @@
 #include "log/frontend_signer.h"
 #include "log/log_verifier.h"
 #include "log/logged_certificate.h"
+#include "log/mock_consistent_store.h"
 #include "log/sqlite_db.h"
 #include "log/test_db.h"
 #include "log/test_signer.h"
@@ -34,6 +35,7 @@ using cert_trans::EntryHandle;
 using cert_trans::EtcdConsistentStore;
 using cert_trans::FakeEtcdClient;
 using cert_trans::LoggedCertificate;
+using cert_trans::MockConsistentStore;
 using cert_trans::MockMasterElection;
 using cert_trans::ThreadPool;
 using ct::LogEntry;
@@ -44,6 +46,7 @@ using std::string;
 using std::vector;
 using testing::_;
 using testing::NiceMock;
+using testing::Return;
 using util::testing::StatusIs;
 
 typedef Database<LoggedCertificate> DB;
@@ -163,6 +166,21 @@ TYPED_TEST(FrontendSignerTest, LogDuplicates) {
   EXPECT_EQ(sct0.timestamp(), sct1.timestamp());
 }
 
+TYPED_TEST(FrontendSignerTest, LogDuplicatesFromMemory) {
+  MockConsistentStore<LoggedCertificate> store;
+  FS frontend(this->db(), &store, TestSigner::DefaultLogSigner());
+  EXPECT_CALL(store, AddPendingEntry(_)).WillOnce(Return(util::Status::OK));
+
+  LogEntry entry;
+  this->test_signer_.CreateUnique(&entry);
+  SignedCertificateTimestamp sct0, sct1;
+  EXPECT_OK(frontend.QueueEntry(entry, &sct0));
+  // Answered without going to the store again.
+  EXPECT_THAT(frontend.QueueEntry(entry, &sct1),
+              StatusIs(util::error::ALREADY_EXISTS, _));
+  EXPECT_EQ(sct0.timestamp(), sct1.timestamp());
+}
+
 TYPED_TEST(FrontendSignerTest, LogDuplicatesDifferentChain) {
   LogEntry entry0, entry1;
   this->test_signer_.CreateUnique(&entry0);
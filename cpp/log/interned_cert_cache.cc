@@ -0,0 +1,81 @@
+#include "log/interned_cert_cache.h"
+
+#include "merkletree/serial_hasher.h"
+#include "monitoring/monitoring.h"
+
+using std::lock_guard;
+using std::make_pair;
+using std::mutex;
+using std::shared_ptr;
+using std::string;
+
+namespace cert_trans {
+namespace {
+
+
+Counter<string>* interned_cert_cache_lookups(Counter<string>::New(
+    "interned_cert_cache_lookups", "result",
+    "Number of certs looked up in the interned cert cache, by whether they "
+    "were found, parsed or invalid."));
+
+
+}  // namespace
+
+
+InternedCertCache::InternedCertCache(size_t max_certs)
+    : max_certs_(max_certs) {
+}
+
+
+shared_ptr<const Cert> InternedCertCache::Get(const string& der) {
+  const string digest(Sha256Hasher::Sha256Digest(der));
+  {
+    lock_guard<mutex> lock(lock_);
+    const auto it(certs_.find(digest));
+    if (it != certs_.end()) {
+      lru_.splice(lru_.begin(), lru_, it->second.second);
+      interned_cert_cache_lookups->Increment("hit");
+      return it->second.first;
+    }
+  }
+
+  // Parsed without holding the lock, at the cost of parsing the same
+  // cert more than once when it is first seen by several threads at
+  // once; the first one inserted wins.
+  shared_ptr<Cert> cert(std::make_shared<Cert>());
+  if (cert->LoadFromDerString(der) != Cert::TRUE) {
+    interned_cert_cache_lookups->Increment("invalid");
+    return nullptr;
+  }
+  interned_cert_cache_lookups->Increment("miss");
+  if (max_certs_ == 0) {
+    return cert;
+  }
+  // OpenSSL fills in its cache of the extensions of an X509 the first
+  // time they are needed (e.g. by X509_check_issued), which is not
+  // safe to do from several threads at once, so do it before sharing.
+  cert->IsSelfSigned();
+
+  lock_guard<mutex> lock(lock_);
+  const auto it(certs_.find(digest));
+  if (it != certs_.end()) {
+    lru_.splice(lru_.begin(), lru_, it->second.second);
+    return it->second.first;
+  }
+  while (certs_.size() >= max_certs_) {
+    certs_.erase(lru_.back());
+    lru_.pop_back();
+  }
+  lru_.push_front(digest);
+  certs_.emplace(digest, make_pair(cert, lru_.begin()));
+  return cert;
+}
+
+
+size_t InternedCertCache::size() const {
+  lock_guard<mutex> lock(lock_);
+  return certs_.size();
+}
+
+
+}  // namespace cert_trans
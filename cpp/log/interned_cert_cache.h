@@ -0,0 +1,51 @@
+#ifndef CERT_TRANS_LOG_INTERNED_CERT_CACHE_H_
+#define CERT_TRANS_LOG_INTERNED_CERT_CACHE_H_
+
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "base/macros.h"
+#include "log/cert.h"
+
+namespace cert_trans {
+
+
+// The certs parsed from the DER encodings it has seen most recently,
+// by the SHA-256 digest of the encoding, so that those submitted over
+// and over (i.e. the intermediates) are parsed once. The certs are
+// shared with the chains they are added to, and stay alive for as long
+// as one of them does, even once evicted. Thread-safe.
+class InternedCertCache {
+ public:
+  // Keeps up to |max_certs| certs, or none if it is zero.
+  explicit InternedCertCache(size_t max_certs);
+
+  // Returns the cert parsed from |der|, which is shared with the other
+  // callers that passed the same encoding, or NULL if it could not be
+  // parsed. The certs that could not be parsed are not kept.
+  std::shared_ptr<const Cert> Get(const std::string& der);
+
+  size_t size() const;
+
+ private:
+  typedef std::list<std::string> LruList;
+
+  const size_t max_certs_;
+
+  mutable std::mutex lock_;
+  // The digests, most recently used first.
+  LruList lru_;
+  std::unordered_map<std::string,
+                     std::pair<std::shared_ptr<const Cert>, LruList::iterator>>
+      certs_;
+
+  DISALLOW_COPY_AND_ASSIGN(InternedCertCache);
+};
+
+
+}  // namespace cert_trans
+
+#endif  // CERT_TRANS_LOG_INTERNED_CERT_CACHE_H_
@@ -0,0 +1,127 @@
+#include "log/interned_cert_cache.h"
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+#include <memory>
+#include <openssl/err.h>
+#include <openssl/evp.h>
+#include <string>
+
+#include "log/cert.h"
+#include "util/testing.h"
+#include "util/util.h"
+
+namespace cert_trans {
+namespace {
+
+using std::shared_ptr;
+using std::string;
+
+const char kCaCert[] = "ca-cert.pem";
+const char kIntermediateCert[] = "intermediate-cert.pem";
+const char kLeafCert[] = "test-cert.pem";
+
+
+string ReadDer(const string& name) {
+  const string path(FLAGS_test_srcdir + "/test/testdata/" + name);
+  string pem;
+  CHECK(util::ReadTextFile(path, &pem)) << "Could not read " << path
+                                        << ". Wrong --test_srcdir?";
+  string der;
+  CHECK_EQ(Cert::TRUE, Cert(pem).DerEncoding(&der));
+  return der;
+}
+
+
+class InternedCertCacheTest : public ::testing::Test {
+ protected:
+  InternedCertCacheTest()
+      : ca_der_(ReadDer(kCaCert)),
+        intermediate_der_(ReadDer(kIntermediateCert)),
+        leaf_der_(ReadDer(kLeafCert)) {
+  }
+
+  const string ca_der_;
+  const string intermediate_der_;
+  const string leaf_der_;
+};
+
+
+TEST_F(InternedCertCacheTest, SharesTheCerts) {
+  InternedCertCache cache(10);
+  const shared_ptr<const Cert> ca(cache.Get(ca_der_));
+  ASSERT_TRUE(ca != nullptr);
+  EXPECT_TRUE(ca->IsLoaded());
+  const shared_ptr<const Cert> intermediate(cache.Get(intermediate_der_));
+  ASSERT_TRUE(intermediate != nullptr);
+  EXPECT_NE(ca, intermediate);
+  EXPECT_EQ(ca, cache.Get(ca_der_));
+  EXPECT_EQ(intermediate, cache.Get(intermediate_der_));
+  EXPECT_EQ(2U, cache.size());
+
+  string der;
+  ASSERT_EQ(Cert::TRUE, ca->DerEncoding(&der));
+  EXPECT_EQ(ca_der_, der);
+}
+
+
+TEST_F(InternedCertCacheTest, DoesNotKeepInvalidCerts) {
+  InternedCertCache cache(10);
+  EXPECT_EQ(nullptr, cache.Get("bogus"));
+  EXPECT_EQ(nullptr, cache.Get(ca_der_.substr(2)));
+  EXPECT_EQ(0U, cache.size());
+}
+
+
+TEST_F(InternedCertCacheTest, EvictsTheLeastRecentlyUsed) {
+  InternedCertCache cache(2);
+  const shared_ptr<const Cert> ca(cache.Get(ca_der_));
+  const shared_ptr<const Cert> intermediate(cache.Get(intermediate_der_));
+  // Makes the intermediate the least recently used.
+  EXPECT_EQ(ca, cache.Get(ca_der_));
+  const shared_ptr<const Cert> leaf(cache.Get(leaf_der_));
+  EXPECT_EQ(2U, cache.size());
+  EXPECT_EQ(ca, cache.Get(ca_der_));
+  EXPECT_EQ(leaf, cache.Get(leaf_der_));
+
+  // Parsed again, while the evicted one is still usable.
+  const shared_ptr<const Cert> reparsed(cache.Get(intermediate_der_));
+  EXPECT_NE(intermediate, reparsed);
+  EXPECT_TRUE(intermediate->IsIdenticalTo(*reparsed));
+}
+
+
+TEST_F(InternedCertCacheTest, KeepsNothingIfEmpty) {
+  InternedCertCache cache(0);
+  const shared_ptr<const Cert> ca(cache.Get(ca_der_));
+  ASSERT_TRUE(ca != nullptr);
+  EXPECT_NE(ca, cache.Get(ca_der_));
+  EXPECT_EQ(0U, cache.size());
+}
+
+
+TEST_F(InternedCertCacheTest, CertsOutliveTheCache) {
+  CertChain chain;
+  {
+    InternedCertCache cache(10);
+    ASSERT_EQ(Cert::TRUE, chain.AddCert(cache.Get(leaf_der_)));
+    ASSERT_EQ(Cert::TRUE, chain.AddCert(cache.Get(ca_der_)));
+  }
+  ASSERT_EQ(2U, chain.Length());
+  EXPECT_EQ(Cert::TRUE, chain.IsValidSignatureChain());
+  EXPECT_EQ(Cert::TRUE, chain.RemoveCert());
+  EXPECT_EQ(1U, chain.Length());
+}
+
+
+}  // namespace
+}  // namespace cert_trans
+
+
+int main(int argc, char** argv) {
+  cert_trans::test::InitTesting(argv[0], &argc, &argv, true);
+  OpenSSL_add_all_algorithms();
+  ERR_load_crypto_strings();
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,290 @@
+#ifndef CERT_TRANS_LOG_INTERNED_CHAIN_DB_INL_H_
+#define CERT_TRANS_LOG_INTERNED_CHAIN_DB_INL_H_
+
+#include "log/interned_chain_db.h"
+
+#include <functional>
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+#include "log/key_value_storage.h"
+#include "util/status.h"
+
+DEFINE_int32(intermediate_cache_entries, 4096,
+             "number of chain certificates kept in memory to put the "
+             "chains of entries back as they are read");
+
+
+template <class Logged>
+class InternedChainDB<Logged>::Iterator
+    : public Database<Logged>::Iterator {
+ public:
+  // If |bulk|, the database is scanned with ScanEntriesBulk().
+  Iterator(const InternedChainDB<Logged>* db, int64_t start_index, bool bulk)
+      : db_(CHECK_NOTNULL(db)),
+        it_(bulk ? db_->db_->ScanEntriesBulk(start_index)
+                 : db_->db_->ScanEntries(start_index)) {
+  }
+
+  bool GetNextEntry(Logged* entry) override {
+    if (!it_->GetNextEntry(entry)) {
+      return false;
+    }
+    db_->Restore(entry);
+    return true;
+  }
+
+  size_t GetNextEntries(size_t max_entries,
+                        std::vector<Logged>* entries) override {
+    CHECK_NOTNULL(entries);
+    const size_t first(entries->size());
+    const size_t count(it_->GetNextEntries(max_entries, entries));
+    for (size_t i = first; i < entries->size(); ++i) {
+      db_->Restore(&(*entries)[i]);
+    }
+    return count;
+  }
+
+ private:
+  const InternedChainDB<Logged>* const db_;
+  const std::unique_ptr<typename Database<Logged>::Iterator> it_;
+};
+
+
+template <class Logged>
+InternedChainDB<Logged>::InternedChainDB(Database<Logged>* db,
+                                         cert_trans::KeyValueStorage* certs)
+    : db_(CHECK_NOTNULL(db)), certs_(CHECK_NOTNULL(certs)) {
+}
+
+
+template <class Logged>
+InternedChainDB<Logged>::~InternedChainDB() {
+}
+
+
+template <class Logged>
+typename Database<Logged>::WriteResult
+InternedChainDB<Logged>::CreateSequencedEntry_(const Logged& logged) {
+  return db_->CreateSequencedEntry(Intern(logged));
+}
+
+
+template <class Logged>
+typename Database<Logged>::WriteResult
+InternedChainDB<Logged>::CreateSequencedEntries_(
+    const std::vector<Logged>& logged, size_t* written) {
+  std::vector<Logged> interned;
+  interned.reserve(logged.size());
+  for (const Logged& entry : logged) {
+    interned.emplace_back(Intern(entry));
+  }
+  return db_->CreateSequencedEntries(interned, written);
+}
+
+
+template <class Logged>
+typename Database<Logged>::LookupResult InternedChainDB<Logged>::LookupByHash(
+    const std::string& hash, Logged* result) const {
+  const typename Database<Logged>::LookupResult ret(
+      db_->LookupByHash(hash, result));
+  if (ret == this->LOOKUP_OK && result) {
+    Restore(result);
+  }
+  return ret;
+}
+
+
+template <class Logged>
+typename Database<Logged>::LookupResult InternedChainDB<Logged>::LookupByIndex(
+    int64_t sequence_number, Logged* result) const {
+  const typename Database<Logged>::LookupResult ret(
+      db_->LookupByIndex(sequence_number, result));
+  if (ret == this->LOOKUP_OK && result) {
+    Restore(result);
+  }
+  return ret;
+}
+
+
+template <class Logged>
+std::unique_ptr<typename Database<Logged>::Iterator>
+InternedChainDB<Logged>::ScanEntries(int64_t start_index) const {
+  return std::unique_ptr<Iterator>(new Iterator(this, start_index, false));
+}
+
+
+template <class Logged>
+std::unique_ptr<typename Database<Logged>::Iterator>
+InternedChainDB<Logged>::ScanEntriesBulk(int64_t start_index) const {
+  return std::unique_ptr<Iterator>(new Iterator(this, start_index, true));
+}
+
+
+template <class Logged>
+typename Database<Logged>::WriteResult InternedChainDB<Logged>::WriteTreeHead_(
+    const ct::SignedTreeHead& sth) {
+  return db_->WriteTreeHead(sth);
+}
+
+
+template <class Logged>
+typename Database<Logged>::LookupResult
+InternedChainDB<Logged>::LatestTreeHead(ct::SignedTreeHead* result) const {
+  return db_->LatestTreeHead(result);
+}
+
+
+template <class Logged>
+typename Database<Logged>::LookupResult
+InternedChainDB<Logged>::LookupTreeHeadByTimestamp(
+    uint64_t timestamp, ct::SignedTreeHead* result) const {
+  return db_->LookupTreeHeadByTimestamp(timestamp, result);
+}
+
+
+template <class Logged>
+void InternedChainDB<Logged>::ScanTreeHeadsBySize(
+    int64_t start_size, int64_t end_size,
+    std::vector<ct::SignedTreeHead>* result) const {
+  db_->ScanTreeHeadsBySize(start_size, end_size, result);
+}
+
+
+template <class Logged>
+int64_t InternedChainDB<Logged>::TreeSize() const {
+  return db_->TreeSize();
+}
+
+
+template <class Logged>
+void InternedChainDB<Logged>::AddNotifySTHCallback(
+    const typename Database<Logged>::NotifySTHCallback* callback) {
+  db_->AddNotifySTHCallback(callback);
+}
+
+
+template <class Logged>
+void InternedChainDB<Logged>::RemoveNotifySTHCallback(
+    const typename Database<Logged>::NotifySTHCallback* callback) {
+  db_->RemoveNotifySTHCallback(callback);
+}
+
+
+template <class Logged>
+void InternedChainDB<Logged>::InitializeNode(const std::string& node_id) {
+  db_->InitializeNode(node_id);
+}
+
+
+template <class Logged>
+typename Database<Logged>::LookupResult InternedChainDB<Logged>::NodeId(
+    std::string* node_id) {
+  return db_->NodeId(node_id);
+}
+
+
+template <class Logged>
+typename Database<Logged>::LookupResult InternedChainDB<Logged>::SearchEntries(
+    const std::string& search_key, int64_t start_index, size_t max_results,
+    std::vector<int64_t>* result) const {
+  return db_->SearchEntries(search_key, start_index, max_results, result);
+}
+
+
+template <class Logged>
+void InternedChainDB<Logged>::BeginBulkLoad() {
+  db_->BeginBulkLoad();
+}
+
+
+template <class Logged>
+void InternedChainDB<Logged>::EndBulkLoad() {
+  db_->EndBulkLoad();
+}
+
+
+template <class Logged>
+Logged InternedChainDB<Logged>::Intern(const Logged& logged) {
+  Logged interned(logged);
+  std::vector<std::pair<std::string, std::string>> chain;
+  interned.InternChain(&chain);
+
+  for (const auto& cert : chain) {
+    {
+      std::lock_guard<std::mutex> lock(cache_lock_);
+      if (cache_.find(cert.first) != cache_.end()) {
+        // Only cached once stored.
+        continue;
+      }
+    }
+
+    // The certificates have to be stored before the entries using
+    // them, for those to be readable as soon as they are written.
+    const util::Status status(certs_->CreateEntry(cert.first, cert.second));
+    CHECK(status.ok() || status.CanonicalCode() == util::error::ALREADY_EXISTS)
+        << "storing a chain certificate: " << status;
+    std::lock_guard<std::mutex> lock(cache_lock_);
+    CacheCert(cert.first, cert.second);
+  }
+
+  return interned;
+}
+
+
+template <class Logged>
+void InternedChainDB<Logged>::Restore(Logged* logged) const {
+  CHECK(logged->RestoreChain(
+      std::bind(&InternedChainDB<Logged>::LookupCert, this,
+                std::placeholders::_1, std::placeholders::_2)))
+      << "missing chain certificates for entry " << logged->sequence_number();
+}
+
+
+template <class Logged>
+bool InternedChainDB<Logged>::LookupCert(const std::string& digest,
+                                         std::string* cert) const {
+  {
+    std::lock_guard<std::mutex> lock(cache_lock_);
+    const auto it(cache_.find(digest));
+    if (it != cache_.end()) {
+      lru_.splice(lru_.begin(), lru_, it->second.second);
+      *cert = it->second.first;
+      return true;
+    }
+  }
+
+  const util::Status status(certs_->LookupEntry(digest, cert));
+  if (!status.ok()) {
+    LOG(WARNING) << "looking up a chain certificate: " << status;
+    return false;
+  }
+  std::lock_guard<std::mutex> lock(cache_lock_);
+  CacheCert(digest, *cert);
+  return true;
+}
+
+
+template <class Logged>
+void InternedChainDB<Logged>::CacheCert(const std::string& digest,
+                                        const std::string& cert) const {
+  const auto it(cache_.find(digest));
+  if (it != cache_.end()) {
+    lru_.splice(lru_.begin(), lru_, it->second.second);
+    return;
+  }
+  if (FLAGS_intermediate_cache_entries <= 0) {
+    return;
+  }
+
+  const size_t max_entries(FLAGS_intermediate_cache_entries);
+  while (cache_.size() >= max_entries) {
+    cache_.erase(lru_.back());
+    lru_.pop_back();
+  }
+  lru_.push_front(digest);
+  cache_.emplace(digest, std::make_pair(cert, lru_.begin()));
+}
+
+
+#endif  // CERT_TRANS_LOG_INTERNED_CHAIN_DB_INL_H_
@@ -0,0 +1,128 @@
+#ifndef CERT_TRANS_LOG_INTERNED_CHAIN_DB_H_
+#define CERT_TRANS_LOG_INTERNED_CHAIN_DB_H_
+
+#include <list>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "base/macros.h"
+#include "log/database.h"
+#include "proto/ct.pb.h"
+
+namespace cert_trans {
+class KeyValueStorage;
+}  // namespace cert_trans
+
+
+// A database that keeps the certificates of the chains of the entries
+// of another database apart, once each, in a KeyValueStorage keyed by
+// their SHA-256 digest, and only their digests in the entries. Almost
+// every chain is made of the same few hundred intermediates, so this
+// saves storing them over and over.
+//
+// The chains are put back as the entries are read, from a cache of
+// the most recently used certificates. Entries stored without
+// interning their chain are read as they are, so this can be put in
+// front of an existing database.
+//
+// On top of what database.h requires, the |Logged| class needs to
+// provide:
+//
+//   void InternChain(
+//       std::vector<std::pair<std::string, std::string>>* chain);
+//   bool RestoreChain(
+//       const std::function<bool(const std::string& digest,
+//                                std::string* cert)>& lookup);
+//
+// See logged_certificate.h.
+template <class Logged>
+class InternedChainDB : public Database<Logged> {
+ public:
+  // Takes ownership of |db| and |certs|.
+  InternedChainDB(Database<Logged>* db, cert_trans::KeyValueStorage* certs);
+  ~InternedChainDB();
+
+  // Implement abstract functions, see database.h for comments.
+  typename Database<Logged>::WriteResult CreateSequencedEntry_(
+      const Logged& logged) override;
+
+  typename Database<Logged>::WriteResult CreateSequencedEntries_(
+      const std::vector<Logged>& logged, size_t* written) override;
+
+  typename Database<Logged>::LookupResult LookupByHash(
+      const std::string& hash, Logged* result) const override;
+
+  typename Database<Logged>::LookupResult LookupByIndex(
+      int64_t sequence_number, Logged* result) const override;
+
+  std::unique_ptr<typename Database<Logged>::Iterator> ScanEntries(
+      int64_t start_index) const override;
+
+  std::unique_ptr<typename Database<Logged>::Iterator> ScanEntriesBulk(
+      int64_t start_index) const override;
+
+  typename Database<Logged>::WriteResult WriteTreeHead_(
+      const ct::SignedTreeHead& sth) override;
+
+  typename Database<Logged>::LookupResult LatestTreeHead(
+      ct::SignedTreeHead* result) const override;
+
+  typename Database<Logged>::LookupResult LookupTreeHeadByTimestamp(
+      uint64_t timestamp, ct::SignedTreeHead* result) const override;
+
+  void ScanTreeHeadsBySize(
+      int64_t start_size, int64_t end_size,
+      std::vector<ct::SignedTreeHead>* result) const override;
+
+  int64_t TreeSize() const override;
+
+  void AddNotifySTHCallback(
+      const typename Database<Logged>::NotifySTHCallback* callback) override;
+
+  void RemoveNotifySTHCallback(
+      const typename Database<Logged>::NotifySTHCallback* callback) override;
+
+  void InitializeNode(const std::string& node_id) override;
+
+  typename Database<Logged>::LookupResult NodeId(
+      std::string* node_id) override;
+
+  typename Database<Logged>::LookupResult SearchEntries(
+      const std::string& search_key, int64_t start_index, size_t max_results,
+      std::vector<int64_t>* result) const override;
+
+  void BeginBulkLoad() override;
+  void EndBulkLoad() override;
+
+ private:
+  class Iterator;
+
+  // Returns a copy of |logged| with its chain interned, after storing
+  // the certificates of the chain.
+  Logged Intern(const Logged& logged);
+  void Restore(Logged* logged) const;
+  bool LookupCert(const std::string& digest, std::string* cert) const;
+  // Adds |cert| to the cache, or moves it to the front if it is
+  // already there. This must be called with "cache_lock_" held.
+  void CacheCert(const std::string& digest, const std::string& cert) const;
+
+  const std::unique_ptr<Database<Logged>> db_;
+  const std::unique_ptr<cert_trans::KeyValueStorage> certs_;
+
+  mutable std::mutex cache_lock_;
+  // Digests, most recently used first.
+  mutable std::list<std::string> lru_;
+  mutable std::unordered_map<
+      std::string, std::pair<std::string, std::list<std::string>::iterator>>
+      cache_;
+
+  DISALLOW_COPY_AND_ASSIGN(InternedChainDB);
+};
+
+
+#endif  // CERT_TRANS_LOG_INTERNED_CHAIN_DB_H_
@@ -0,0 +1,4 @@
+#include "log/interned_chain_db-inl.h"
+#include "log/logged_certificate.h"
+
+template class InternedChainDB<cert_trans::LoggedCertificate>;
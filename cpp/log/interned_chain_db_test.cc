@@ -0,0 +1,120 @@
+#include "log/interned_chain_db.h"
+
+#include <gtest/gtest.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "log/file_storage.h"
+#include "log/logged_certificate.h"
+#include "log/sqlite_db.h"
+#include "log/test_signer.h"
+#include "util/test_db.h"
+#include "util/testing.h"
+#include "util/util.h"
+
+namespace {
+
+using cert_trans::FileStorage;
+using cert_trans::LoggedCertificate;
+using std::string;
+using std::unique_ptr;
+using std::vector;
+
+typedef Database<LoggedCertificate> DB;
+
+
+class InternedChainDBTest : public ::testing::Test {
+ protected:
+  InternedChainDBTest()
+      : sqlite_(new SQLiteDB<LoggedCertificate>(tmp_.TmpStorageDir() +
+                                                "/sqlite")),
+        certs_(new FileStorage(tmp_.TmpStorageDir(), 0)),
+        db_(new InternedChainDB<LoggedCertificate>(sqlite_, certs_)),
+        intermediate_(util::RandomString(512, 1024)),
+        root_(util::RandomString(512, 1024)) {
+  }
+
+  // Adds |count| X.509 entries, all with the same chain.
+  void AddEntries(int count) {
+    for (int i = 0; i < count; ++i) {
+      logged_.emplace_back();
+      LoggedCertificate* const logged(&logged_.back());
+      test_signer_.CreateUnique(logged);
+      logged->set_sequence_number(logged_.size() - 1);
+      logged->mutable_entry()->set_type(ct::X509_ENTRY);
+      logged->mutable_entry()->clear_precert_entry();
+      ct::X509ChainEntry* const x509(
+          logged->mutable_entry()->mutable_x509_entry());
+      x509->set_leaf_certificate(util::RandomString(512, 1024));
+      x509->clear_certificate_chain();
+      x509->add_certificate_chain(intermediate_);
+      x509->add_certificate_chain(root_);
+      ASSERT_EQ(DB::OK, db_->CreateSequencedEntry(*logged));
+    }
+  }
+
+  TmpStorage tmp_;
+  TestSigner test_signer_;
+  // Owned by |db_|.
+  SQLiteDB<LoggedCertificate>* const sqlite_;
+  FileStorage* const certs_;
+  const unique_ptr<InternedChainDB<LoggedCertificate>> db_;
+  const string intermediate_;
+  const string root_;
+  vector<LoggedCertificate> logged_;
+};
+
+
+TEST_F(InternedChainDBTest, StoresChainOnce) {
+  AddEntries(3);
+
+  EXPECT_EQ(2U, certs_->Scan().size());
+  LoggedCertificate stored;
+  ASSERT_EQ(DB::LOOKUP_OK, sqlite_->LookupByIndex(0, &stored));
+  EXPECT_TRUE(stored.contents().chain_interned());
+  ASSERT_EQ(2, stored.entry().x509_entry().certificate_chain_size());
+  EXPECT_EQ(32U, stored.entry().x509_entry().certificate_chain(0).size());
+}
+
+
+TEST_F(InternedChainDBTest, RestoresChain) {
+  AddEntries(3);
+
+  for (const auto& logged : logged_) {
+    LoggedCertificate lookup;
+    EXPECT_EQ(DB::LOOKUP_OK,
+              db_->LookupByIndex(logged.sequence_number(), &lookup));
+    TestSigner::TestEqualLoggedCerts(logged, lookup);
+    EXPECT_EQ(DB::LOOKUP_OK, db_->LookupByHash(logged.Hash(), &lookup));
+    TestSigner::TestEqualLoggedCerts(logged, lookup);
+  }
+
+  const unique_ptr<DB::Iterator> it(db_->ScanEntries(1));
+  vector<LoggedCertificate> entries;
+  EXPECT_EQ(2U, it->GetNextEntries(10, &entries));
+  ASSERT_EQ(2U, entries.size());
+  TestSigner::TestEqualLoggedCerts(logged_[1], entries[0]);
+  TestSigner::TestEqualLoggedCerts(logged_[2], entries[1]);
+}
+
+
+TEST_F(InternedChainDBTest, ReadsEntriesStoredAsTheyWere) {
+  LoggedCertificate logged;
+  test_signer_.CreateUnique(&logged);
+  logged.set_sequence_number(0);
+  ASSERT_EQ(DB::OK, sqlite_->CreateSequencedEntry(logged));
+
+  LoggedCertificate lookup;
+  EXPECT_EQ(DB::LOOKUP_OK, db_->LookupByIndex(0, &lookup));
+  TestSigner::TestEqualLoggedCerts(logged, lookup);
+}
+
+
+}  // namespace
+
+
+int main(int argc, char** argv) {
+  cert_trans::test::InitTesting(argv[0], &argc, &argv, true);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,342 @@
+#ifndef CERT_TRANS_LOG_JOURNALED_CONSISTENT_STORE_INL_H_
+#define CERT_TRANS_LOG_JOURNALED_CONSISTENT_STORE_INL_H_
+
+#include "log/journaled_consistent_store.h"
+
+#include <chrono>
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <memory>
+
+#include "monitoring/monitoring.h"
+#include "util/sync_task.h"
+#include "util/util.h"
+
+DECLARE_int32(pending_entry_journal_max_entries);
+
+DECLARE_int32(pending_entry_journal_batch_size);
+
+DECLARE_int32(pending_entry_journal_retry_delay_ms);
+
+DECLARE_int32(pending_entry_journal_file_size_mb);
+
+namespace cert_trans {
+namespace {
+
+
+Gauge<>* journaled_pending_entries =
+    Gauge<>::New("journaled_pending_entries",
+                 "Number of pending entries in the local journal which are "
+                 "not in the consistent store yet.");
+
+Counter<>* journaled_entry_conflicts =
+    Counter<>::New("journaled_entry_conflicts",
+                   "Number of journaled pending entries found in the "
+                   "consistent store with a different SCT.");
+
+
+}  // namespace
+
+
+template <class Logged>
+JournaledConsistentStore<Logged>::JournaledConsistentStore(
+    util::Executor* executor, ConsistentStore<Logged>* peer,
+    const std::string& journal_dir)
+    : executor_(CHECK_NOTNULL(executor)),
+      peer_(CHECK_NOTNULL(peer)),
+      journal_(journal_dir,
+               static_cast<off_t>(FLAGS_pending_entry_journal_file_size_mb)
+                   << 20),
+      exiting_(false) {
+  CHECK_LT(0, FLAGS_pending_entry_journal_max_entries);
+  CHECK_LT(0, FLAGS_pending_entry_journal_batch_size);
+
+  // The entries left from before a restart.
+  std::vector<std::pair<int64_t, std::string>> records;
+  journal_.Read(0, journal_.NumRecords(), &records);
+  for (const auto& record : records) {
+    JournaledEntry journaled;
+    CHECK(journaled.entry.ParseFromString(record.second));
+    journaled.synced = true;
+    const std::string hash(journaled.entry.Hash());
+    entries_.emplace(hash, std::move(journaled));
+  }
+  journaled_pending_entries->Set(entries_.size());
+
+  replicator_ =
+      std::thread(&JournaledConsistentStore<Logged>::ReplicatorLoop, this);
+}
+
+
+template <class Logged>
+JournaledConsistentStore<Logged>::~JournaledConsistentStore() {
+  {
+    std::lock_guard<std::mutex> lock(lock_);
+    exiting_ = true;
+  }
+  synced_cv_.notify_all();
+  replicator_.join();
+}
+
+
+template <class Logged>
+size_t JournaledConsistentStore<Logged>::NumJournaledEntries() const {
+  std::lock_guard<std::mutex> lock(lock_);
+  return entries_.size();
+}
+
+
+template <class Logged>
+util::Status JournaledConsistentStore<Logged>::AddPendingEntry(Logged* entry) {
+  CHECK_NOTNULL(entry);
+  CHECK(!entry->has_sequence_number());
+  const std::string hash(entry->Hash());
+
+  {
+    std::unique_lock<std::mutex> lock(lock_);
+    // Until it is synced, an earlier submission of the same entry
+    // could still be lost, so its SCT cannot be handed out yet.
+    synced_cv_.wait(lock, [this, &hash]() {
+      const auto it(entries_.find(hash));
+      return it == entries_.end() || it->second.synced;
+    });
+    const auto it(entries_.find(hash));
+    if (it != entries_.end()) {
+      *entry->mutable_sct() = it->second.entry.sct();
+      return util::Status(util::error::ALREADY_EXISTS,
+                          "Pending entry already exists.");
+    }
+
+    if (entries_.size() >=
+        static_cast<size_t>(FLAGS_pending_entry_journal_max_entries)) {
+      lock.unlock();
+      VLOG(1) << "journal full, writing the entry to the consistent store";
+      return peer_->AddPendingEntry(entry);
+    }
+    entries_.emplace(hash, JournaledEntry{*entry, false});
+  }
+
+  // Entries are commonly submitted again once they have left the
+  // journal, and have to get the SCT they were first given. When the
+  // peer cannot be reached, the entry is journaled anyway.
+  EntryHandle<Logged> existing;
+  const util::Status status(peer_->GetPendingEntryForHash(hash, &existing));
+  return FinishAddPendingEntry(entry, hash, status, existing);
+}
+
+
+template <class Logged>
+void JournaledConsistentStore<Logged>::AddPendingEntryAsync(Logged* entry,
+                                                            util::Task* task) {
+  CHECK_NOTNULL(entry);
+  CHECK_NOTNULL(task);
+  CHECK(!entry->has_sequence_number());
+  const std::string hash(entry->Hash());
+
+  {
+    std::unique_lock<std::mutex> lock(lock_);
+    const auto it(entries_.find(hash));
+    if (it != entries_.end() && !it->second.synced) {
+      // Like in AddPendingEntry(), but tried again later rather than
+      // blocking this thread until then.
+      settled_callbacks_[hash].emplace_back(
+          [this, entry, task]() { AddPendingEntryAsync(entry, task); });
+      return;
+    }
+    if (it != entries_.end()) {
+      *entry->mutable_sct() = it->second.entry.sct();
+      task->Return(util::Status(util::error::ALREADY_EXISTS,
+                                "Pending entry already exists."));
+      return;
+    }
+
+    if (entries_.size() >=
+        static_cast<size_t>(FLAGS_pending_entry_journal_max_entries)) {
+      lock.unlock();
+      VLOG(1) << "journal full, writing the entry to the consistent store";
+      peer_->AddPendingEntryAsync(entry, task);
+      return;
+    }
+    entries_.emplace(hash, JournaledEntry{*entry, false});
+  }
+
+  EntryHandle<Logged>* const existing(new EntryHandle<Logged>);
+  task->DeleteWhenDone(existing);
+  peer_->GetPendingEntryForHashAsync(
+      hash, existing, task->AddChild([this, entry, hash, existing,
+                                      task](util::Task* lookup_task) {
+        task->Return(FinishAddPendingEntry(entry, hash, lookup_task->status(),
+                                           *existing));
+      }));
+}
+
+
+template <class Logged>
+util::Status JournaledConsistentStore<Logged>::FinishAddPendingEntry(
+    Logged* entry, const std::string& hash, const util::Status& lookup_status,
+    const EntryHandle<Logged>& existing) {
+  if (lookup_status.ok()) {
+    {
+      std::lock_guard<std::mutex> lock(lock_);
+      entries_.erase(hash);
+    }
+    SubmissionSettled(hash);
+    *entry->mutable_sct() = existing.Entry().sct();
+    return util::Status(util::error::ALREADY_EXISTS,
+                        "Pending entry already exists.");
+  }
+  if (lookup_status.CanonicalCode() != util::error::NOT_FOUND) {
+    VLOG(1) << "looking up the entry in the consistent store: "
+            << lookup_status;
+  }
+
+  std::string flat_entry;
+  CHECK(entry->SerializeToString(&flat_entry));
+  journal_.Append(flat_entry);
+
+  {
+    std::lock_guard<std::mutex> lock(lock_);
+    // The replicator may already have written it to the peer.
+    const auto it(entries_.find(hash));
+    if (it != entries_.end()) {
+      it->second.synced = true;
+    }
+    journaled_pending_entries->Set(entries_.size());
+  }
+  SubmissionSettled(hash);
+
+  return util::Status::OK;
+}
+
+
+template <class Logged>
+void JournaledConsistentStore<Logged>::SubmissionSettled(
+    const std::string& hash) {
+  std::vector<std::function<void()>> callbacks;
+  {
+    std::lock_guard<std::mutex> lock(lock_);
+    const auto it(settled_callbacks_.find(hash));
+    if (it != settled_callbacks_.end()) {
+      callbacks.swap(it->second);
+      settled_callbacks_.erase(it);
+    }
+  }
+  synced_cv_.notify_all();
+
+  for (const auto& cb : callbacks) {
+    executor_->Add(cb);
+  }
+}
+
+
+template <class Logged>
+util::Status JournaledConsistentStore<Logged>::GetPendingEntryForHash(
+    const std::string& hash, EntryHandle<Logged>* entry) const {
+  CHECK_NOTNULL(entry);
+  const util::Status status(peer_->GetPendingEntryForHash(hash, entry));
+  if (status.CanonicalCode() != util::error::NOT_FOUND) {
+    return status;
+  }
+
+  std::lock_guard<std::mutex> lock(lock_);
+  const auto it(entries_.find(hash));
+  if (it == entries_.end() || !it->second.synced) {
+    return status;
+  }
+  *entry->MutableEntry() = it->second.entry;
+  return util::Status::OK;
+}
+
+
+template <class Logged>
+void JournaledConsistentStore<Logged>::ReplicatorLoop() {
+  int64_t next_number(0);
+  std::unique_lock<std::mutex> lock(lock_);
+  while (true) {
+    std::vector<std::pair<int64_t, std::string>> records;
+    synced_cv_.wait(lock, [this, next_number, &records]() {
+      records.clear();
+      journal_.Read(next_number, FLAGS_pending_entry_journal_batch_size,
+                    &records);
+      return exiting_ || !records.empty();
+    });
+    if (exiting_) {
+      // Whatever is left stays in the journal for the next time.
+      return;
+    }
+
+    std::vector<Logged> entries(records.size());
+    for (size_t i = 0; i < records.size(); ++i) {
+      CHECK(entries[i].ParseFromString(records[i].second));
+    }
+
+    lock.unlock();
+    const size_t stored(Replicate(entries));
+    lock.lock();
+
+    if (stored > 0) {
+      journal_.Release(records[stored - 1].first);
+      next_number = records[stored - 1].first + 1;
+      for (size_t i = 0; i < stored; ++i) {
+        entries_.erase(entries[i].Hash());
+      }
+      journaled_pending_entries->Set(entries_.size());
+      synced_cv_.notify_all();
+    }
+
+    if (stored < records.size()) {
+      // Carried on from the first entry which could not be stored, to
+      // keep them in order.
+      synced_cv_.wait_for(
+          lock,
+          std::chrono::milliseconds(FLAGS_pending_entry_journal_retry_delay_ms),
+          [this]() { return exiting_; });
+    }
+  }
+}
+
+
+template <class Logged>
+size_t JournaledConsistentStore<Logged>::Replicate(
+    const std::vector<Logged>& entries) {
+  // Written all at once, so that they can be batched by the peer.
+  std::vector<Logged> written(entries);
+  std::vector<std::unique_ptr<util::SyncTask>> tasks;
+  for (Logged& entry : written) {
+    tasks.emplace_back(new util::SyncTask(executor_));
+    peer_->AddPendingEntryAsync(&entry, tasks.back()->task());
+  }
+
+  size_t stored(0);
+  for (size_t i = 0; i < tasks.size(); ++i) {
+    tasks[i]->Wait();
+    if (stored < i) {
+      // An earlier entry failed, this one will be written again.
+      continue;
+    }
+
+    const util::Status status(tasks[i]->status());
+    if (status.CanonicalCode() == util::error::ALREADY_EXISTS) {
+      if (written[i].sct().SerializeAsString() !=
+          entries[i].sct().SerializeAsString()) {
+        LOG(ERROR) << "Journaled entry " << util::ToBase64(entries[i].Hash())
+                   << " was already in the consistent store with a "
+                   << "different SCT";
+        journaled_entry_conflicts->Increment();
+      }
+    } else if (!status.ok()) {
+      LOG(WARNING) << "Couldn't write journaled entries to the consistent "
+                   << "store: " << status;
+      continue;
+    }
+    ++stored;
+  }
+
+  return stored;
+}
+
+
+}  // namespace cert_trans
+
+
+#endif  // CERT_TRANS_LOG_JOURNALED_CONSISTENT_STORE_INL_H_
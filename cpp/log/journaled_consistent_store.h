@@ -0,0 +1,185 @@
+#ifndef CERT_TRANS_LOG_JOURNALED_CONSISTENT_STORE_H_
+#define CERT_TRANS_LOG_JOURNALED_CONSISTENT_STORE_H_
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "log/consistent_store.h"
+#include "log/entry_journal.h"
+
+namespace util {
+class Executor;
+}  // namespace util
+
+namespace cert_trans {
+
+
+// A wrapper around a ConsistentStore, which writes new pending entries
+// to a journal on local disk and acknowledges them as soon as they are
+// synced there, rather than once they are stored in the peer. They are
+// then written to the peer in the background, in the order they were
+// journaled, retrying for as long as the peer fails. This lets the
+// frontends keep accepting submissions through short outages of etcd.
+//
+// Entries still in the journal when this is constructed, from before a
+// restart, are written to the peer again, which is harmless for the
+// ones which made it there already. An entry submitted again while its
+// first submission is still in the journal gets the same SCT, but the
+// journal is local to a node, so an entry submitted to several nodes
+// while it is not in the peer yet can get different SCTs. These
+// conflicts are logged and counted when they are found.
+//
+// When too many entries are waiting in the journal, new ones are
+// written to the peer directly instead.
+//
+// All the other methods are passed through to the peer.
+template <class Logged>
+class JournaledConsistentStore : public ConsistentStore<Logged> {
+ public:
+  // Does not take ownership of |executor| or |peer|.
+  JournaledConsistentStore(util::Executor* executor,
+                           ConsistentStore<Logged>* peer,
+                           const std::string& journal_dir);
+
+  ~JournaledConsistentStore() override;
+
+  // The number of entries in the journal not written to the peer yet.
+  size_t NumJournaledEntries() const;
+
+  util::Status AddPendingEntry(Logged* entry) override;
+
+  // Does not block while an earlier submission of the same entry is
+  // being journaled, nor while looking the entry up in the peer, but
+  // does while |entry| is synced to the journal.
+  void AddPendingEntryAsync(Logged* entry, util::Task* task) override;
+
+  // Also finds the entries which are only in the journal so far,
+  // without a handle.
+  util::Status GetPendingEntryForHash(
+      const std::string& hash, EntryHandle<Logged>* entry) const override;
+
+  util::StatusOr<int64_t> NextAvailableSequenceNumber() const override {
+    return peer_->NextAvailableSequenceNumber();
+  }
+
+  util::Status SetServingSTH(const ct::SignedTreeHead& new_sth) override {
+    return peer_->SetServingSTH(new_sth);
+  }
+
+  util::StatusOr<ct::SignedTreeHead> GetServingSTH() const override {
+    return peer_->GetServingSTH();
+  }
+
+  util::Status GetPendingEntries(
+      std::vector<EntryHandle<Logged>>* entries) const override {
+    return peer_->GetPendingEntries(entries);
+  }
+
+  util::Status GetPendingEntryStubs(
+      std::vector<EntryHandle<Logged>>* entries) const override {
+    return peer_->GetPendingEntryStubs(entries);
+  }
+
+  util::Status RestorePendingEntryBodies(
+      const std::vector<Logged*>& entries) const override {
+    return peer_->RestorePendingEntryBodies(entries);
+  }
+
+  util::Status GetSequenceMapping(
+      EntryHandle<ct::SequenceMapping>* entry) const override {
+    return peer_->GetSequenceMapping(entry);
+  }
+
+  util::Status UpdateSequenceMapping(
+      EntryHandle<ct::SequenceMapping>* entry) override {
+    return peer_->UpdateSequenceMapping(entry);
+  }
+
+  util::StatusOr<ct::ClusterNodeState> GetClusterNodeState() const override {
+    return peer_->GetClusterNodeState();
+  }
+
+  util::Status SetClusterNodeState(
+      const ct::ClusterNodeState& state) override {
+    return peer_->SetClusterNodeState(state);
+  }
+
+  void WatchServingSTH(
+      const typename ConsistentStore<Logged>::ServingSTHCallback& cb,
+      util::Task* task) override {
+    return peer_->WatchServingSTH(cb, task);
+  }
+
+  void WatchClusterNodeStates(
+      const typename ConsistentStore<Logged>::ClusterNodeStateCallback& cb,
+      util::Task* task) override {
+    return peer_->WatchClusterNodeStates(cb, task);
+  }
+
+  void WatchClusterConfig(
+      const typename ConsistentStore<Logged>::ClusterConfigCallback& cb,
+      util::Task* task) override {
+    return peer_->WatchClusterConfig(cb, task);
+  }
+
+  util::Status SetClusterConfig(const ct::ClusterConfig& config) override {
+    return peer_->SetClusterConfig(config);
+  }
+
+  util::StatusOr<int64_t> CleanupOldEntries() override {
+    return peer_->CleanupOldEntries();
+  }
+
+ private:
+  struct JournaledEntry {
+    Logged entry;
+    // Whether |entry| is synced to the journal yet.
+    bool synced;
+  };
+
+  // The end of AddPendingEntry() and AddPendingEntryAsync(), once
+  // |entry| is in |entries_| and was looked up in the peer, with
+  // |lookup_status|.
+  util::Status FinishAddPendingEntry(Logged* entry, const std::string& hash,
+                                     const util::Status& lookup_status,
+                                     const EntryHandle<Logged>& existing);
+  // Wakes up the submissions of |hash| waiting for the previous one to
+  // be synced (or dropped).
+  void SubmissionSettled(const std::string& hash);
+
+  // Writes the entries from the journal to the peer, until we are
+  // destroyed.
+  void ReplicatorLoop();
+  // Writes |entries| to the peer, and returns how many of them, from
+  // the first one, were stored.
+  size_t Replicate(const std::vector<Logged>& entries);
+
+  util::Executor* const executor_;
+  ConsistentStore<Logged>* const peer_;
+  EntryJournal journal_;
+
+  mutable std::mutex lock_;
+  std::condition_variable synced_cv_;
+  // The entries in the journal not written to the peer yet, by hash.
+  std::unordered_map<std::string, JournaledEntry> entries_;
+  // The calls to AddPendingEntryAsync() to make again once the entry
+  // of that hash is synced, by hash.
+  std::unordered_map<std::string, std::vector<std::function<void()>>>
+      settled_callbacks_;
+  bool exiting_;
+  std::thread replicator_;
+
+  DISALLOW_COPY_AND_ASSIGN(JournaledConsistentStore);
+};
+
+
+}  // namespace cert_trans
+
+#endif  // CERT_TRANS_LOG_JOURNALED_CONSISTENT_STORE_H_
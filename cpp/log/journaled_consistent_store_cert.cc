@@ -0,0 +1,21 @@
+#include "log/journaled_consistent_store-inl.h"
+#include "log/logged_certificate.h"
+
+DEFINE_int32(pending_entry_journal_max_entries, 100000,
+             "Maximum number of pending entries waiting in the local journal "
+             "to be written to the consistent store. Beyond that, new "
+             "entries are written to the consistent store directly.");
+DEFINE_int32(pending_entry_journal_batch_size, 256,
+             "Maximum number of journaled pending entries written to the "
+             "consistent store together.");
+DEFINE_int32(pending_entry_journal_retry_delay_ms, 1000,
+             "Number of milliseconds to wait before writing journaled "
+             "pending entries to the consistent store again after a "
+             "failure.");
+DEFINE_int32(pending_entry_journal_file_size_mb, 64,
+             "Size in megabytes at which a new pending entry journal file "
+             "is started.");
+
+namespace cert_trans {
+template class JournaledConsistentStore<LoggedCertificate>;
+}  // namespace cert_trans
@@ -0,0 +1,240 @@
+#include "log/journaled_consistent_store-inl.h"
+
+#include <chrono>
+#include <gflags/gflags.h>
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "base/notification.h"
+#include "log/logged_certificate.h"
+#include "log/mock_consistent_store.h"
+#include "util/status.h"
+#include "util/status_test_util.h"
+#include "util/sync_task.h"
+#include "util/test_db.h"
+#include "util/testing.h"
+#include "util/thread_pool.h"
+
+DECLARE_int32(pending_entry_journal_retry_delay_ms);
+
+namespace cert_trans {
+
+using std::lock_guard;
+using std::mutex;
+using std::string;
+using std::unique_ptr;
+using std::vector;
+using testing::_;
+using testing::Invoke;
+using testing::NiceMock;
+using testing::Return;
+using util::Status;
+
+
+class JournaledConsistentStoreTest : public ::testing::Test {
+ public:
+  JournaledConsistentStoreTest()
+      : journal_dir_(tmp_.TmpStorageDir() + "/journal"),
+        etcd_available_(true) {
+    FLAGS_pending_entry_journal_retry_delay_ms = 10;
+    ON_CALL(peer_, GetPendingEntryForHash(_, _))
+        .WillByDefault(
+            Return(Status(util::error::NOT_FOUND, "Entry not found.")));
+    ON_CALL(peer_, AddPendingEntryAsync(_, _))
+        .WillByDefault(
+            Invoke(this, &JournaledConsistentStoreTest::AddToPeer));
+    OpenStore();
+  }
+
+ protected:
+  void OpenStore() {
+    store_.reset();
+    store_.reset(new JournaledConsistentStore<LoggedCertificate>(
+        &pool_, &peer_, journal_dir_));
+  }
+
+  void AddToPeer(LoggedCertificate* entry, util::Task* task) {
+    lock_guard<mutex> lock(lock_);
+    if (!etcd_available_) {
+      task->Return(Status(util::error::UNAVAILABLE, "etcd is down"));
+      return;
+    }
+    for (const auto& stored : stored_) {
+      if (stored.Hash() == entry->Hash()) {
+        *entry->mutable_sct() = stored.sct();
+        task->Return(Status(util::error::ALREADY_EXISTS, "already there"));
+        return;
+      }
+    }
+    stored_.push_back(*entry);
+    task->Return(Status::OK);
+  }
+
+  void SetEtcdAvailable(bool available) {
+    lock_guard<mutex> lock(lock_);
+    etcd_available_ = available;
+  }
+
+  vector<LoggedCertificate> Stored() {
+    lock_guard<mutex> lock(lock_);
+    return stored_;
+  }
+
+  LoggedCertificate MakeCert(int timestamp, const string& body) {
+    LoggedCertificate cert;
+    cert.mutable_sct()->set_timestamp(timestamp);
+    cert.mutable_entry()->set_type(ct::X509_ENTRY);
+    cert.mutable_entry()->mutable_x509_entry()->set_leaf_certificate(body);
+    return cert;
+  }
+
+  void ExpectStored(const vector<LoggedCertificate>& entries) {
+    const vector<LoggedCertificate> stored(Stored());
+    ASSERT_EQ(entries.size(), stored.size());
+    for (size_t i = 0; i < entries.size(); ++i) {
+      EXPECT_EQ(entries[i].Hash(), stored[i].Hash());
+      EXPECT_EQ(entries[i].timestamp(), stored[i].timestamp());
+    }
+  }
+
+  void WaitForReplication() {
+    while (store_->NumJournaledEntries() > 0) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+  }
+
+  TmpStorage tmp_;
+  const string journal_dir_;
+  ThreadPool pool_;
+  NiceMock<MockConsistentStore<LoggedCertificate>> peer_;
+  unique_ptr<JournaledConsistentStore<LoggedCertificate>> store_;
+
+  mutex lock_;
+  bool etcd_available_;
+  vector<LoggedCertificate> stored_;
+};
+
+
+TEST_F(JournaledConsistentStoreTest, WritesEntriesToPeerInOrder) {
+  vector<LoggedCertificate> entries;
+  for (int i = 0; i < 5; ++i) {
+    entries.push_back(MakeCert(1000 + i, "leaf" + std::to_string(i)));
+    EXPECT_OK(store_->AddPendingEntry(&entries.back()));
+  }
+  WaitForReplication();
+  ExpectStored(entries);
+}
+
+
+TEST_F(JournaledConsistentStoreTest, AcknowledgesWhilePeerIsDown) {
+  SetEtcdAvailable(false);
+  LoggedCertificate entry(MakeCert(1000, "leaf"));
+  EXPECT_OK(store_->AddPendingEntry(&entry));
+  EXPECT_EQ(1U, store_->NumJournaledEntries());
+
+  // Found through the journal in the meantime.
+  EntryHandle<LoggedCertificate> handle;
+  EXPECT_OK(store_->GetPendingEntryForHash(entry.Hash(), &handle));
+  EXPECT_FALSE(handle.HasHandle());
+  EXPECT_EQ(entry.timestamp(), handle.Entry().timestamp());
+
+  SetEtcdAvailable(true);
+  WaitForReplication();
+  ExpectStored({entry});
+}
+
+
+TEST_F(JournaledConsistentStoreTest, DuplicateGetsSameSCT) {
+  SetEtcdAvailable(false);
+  LoggedCertificate entry(MakeCert(1000, "leaf"));
+  EXPECT_OK(store_->AddPendingEntry(&entry));
+
+  LoggedCertificate duplicate(MakeCert(2000, "leaf"));
+  EXPECT_EQ(util::error::ALREADY_EXISTS,
+            store_->AddPendingEntry(&duplicate).CanonicalCode());
+  EXPECT_EQ(entry.timestamp(), duplicate.timestamp());
+}
+
+
+TEST_F(JournaledConsistentStoreTest, AsyncDuplicateDoesNotBlock) {
+  Notification lookup_started;
+  Notification finish_lookup;
+  EXPECT_CALL(peer_, GetPendingEntryForHash(_, _))
+      .WillOnce(Invoke([&lookup_started, &finish_lookup](
+          const string&, EntryHandle<LoggedCertificate>*) {
+        lookup_started.Notify();
+        finish_lookup.WaitForNotification();
+        return Status(util::error::NOT_FOUND, "Entry not found.");
+      }));
+
+  LoggedCertificate entry(MakeCert(1000, "leaf"));
+  util::SyncTask task(&pool_);
+  // The lookup of the mock peer blocks, so this one is made on a
+  // thread of its own.
+  std::thread first([this, &entry, &task]() {
+    store_->AddPendingEntryAsync(&entry, task.task());
+  });
+  lookup_started.WaitForNotification();
+
+  // Waits for the first submission without blocking this thread.
+  LoggedCertificate duplicate(MakeCert(2000, "leaf"));
+  util::SyncTask duplicate_task(&pool_);
+  store_->AddPendingEntryAsync(&duplicate, duplicate_task.task());
+  EXPECT_FALSE(duplicate_task.IsDone());
+
+  finish_lookup.Notify();
+  first.join();
+  task.Wait();
+  duplicate_task.Wait();
+  EXPECT_OK(task.status());
+  EXPECT_EQ(util::error::ALREADY_EXISTS,
+            duplicate_task.status().CanonicalCode());
+  EXPECT_EQ(entry.timestamp(), duplicate.timestamp());
+}
+
+
+TEST_F(JournaledConsistentStoreTest, ResubmissionGetsSCTFromPeer) {
+  const LoggedCertificate entry(MakeCert(1000, "leaf"));
+  EXPECT_CALL(peer_, GetPendingEntryForHash(entry.Hash(), _))
+      .WillOnce(Invoke([&entry](const string&,
+                                EntryHandle<LoggedCertificate>* handle) {
+        *handle->MutableEntry() = entry;
+        return Status::OK;
+      }));
+
+  LoggedCertificate resubmitted(MakeCert(2000, "leaf"));
+  EXPECT_EQ(util::error::ALREADY_EXISTS,
+            store_->AddPendingEntry(&resubmitted).CanonicalCode());
+  EXPECT_EQ(entry.timestamp(), resubmitted.timestamp());
+  EXPECT_EQ(0U, store_->NumJournaledEntries());
+}
+
+
+TEST_F(JournaledConsistentStoreTest, ReplaysJournalOnRestart) {
+  SetEtcdAvailable(false);
+  vector<LoggedCertificate> entries;
+  for (int i = 0; i < 3; ++i) {
+    entries.push_back(MakeCert(1000 + i, "leaf" + std::to_string(i)));
+    EXPECT_OK(store_->AddPendingEntry(&entries.back()));
+  }
+
+  store_.reset();
+  SetEtcdAvailable(true);
+  OpenStore();
+  WaitForReplication();
+  ExpectStored(entries);
+}
+
+
+}  // namespace cert_trans
+
+
+int main(int argc, char** argv) {
+  cert_trans::test::InitTesting(argv[0], &argc, &argv, true);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,69 @@
+#ifndef CERT_TRANS_LOG_KEY_VALUE_STORAGE_H_
+#define CERT_TRANS_LOG_KEY_VALUE_STORAGE_H_
+
+#include <functional>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "util/status.h"
+
+namespace cert_trans {
+
+
+// A store of (key, data) entries, on which FileDB keeps its data.
+// Implementations must be threadsafe.
+class KeyValueStorage {
+ public:
+  virtual ~KeyValueStorage() = default;
+
+  // Scan the entire database and return the list of keys.
+  virtual std::set<std::string> Scan() const = 0;
+
+  // Scan the entire database, calling |callback| with each key as it
+  // is found rather than collecting them all first. Up to
+  // |num_threads| threads can be used, so |callback| can be called
+  // concurrently, and in no particular order.
+  virtual void ScanEach(
+      const std::function<void(const std::string&)>& callback,
+      int num_threads) const = 0;
+
+  // Write (key, data) unless an entry matching |key| already exists.
+  virtual util::Status CreateEntry(const std::string& key,
+                                   const std::string& data) = 0;
+
+  // Update an existing entry; fail if it doesn't already exist.
+  virtual util::Status UpdateEntry(const std::string& key,
+                                   const std::string& data) = 0;
+
+  // Lookup entry based on key.
+  virtual util::Status LookupEntry(const std::string& key,
+                                   std::string* result) const = 0;
+
+  // Lookup the entries of |keys|, setting (*results)[i] to the data of
+  // keys[i], and return the status of each lookup. Up to
+  // |num_threads| threads can be used, so that the reads of a batch
+  // overlap. Unless |fill_cache|, the data is not expected to be read
+  // again soon, and implementations should avoid caching it. The
+  // default implementation looks them up one at a time.
+  virtual std::vector<util::Status> LookupEntries(
+      const std::vector<std::string>& keys,
+      std::vector<std::string>* results, int num_threads,
+      bool fill_cache) const {
+    results->assign(keys.size(), std::string());
+    std::vector<util::Status> statuses;
+    statuses.reserve(keys.size());
+    for (size_t i = 0; i < keys.size(); ++i) {
+      statuses.emplace_back(LookupEntry(keys[i], &(*results)[i]));
+    }
+    return statuses;
+  }
+
+ protected:
+  KeyValueStorage() = default;
+};
+
+
+}  // namespace cert_trans
+
+#endif  // CERT_TRANS_LOG_KEY_VALUE_STORAGE_H_
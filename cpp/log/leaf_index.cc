@@ -0,0 +1,138 @@
+#include "log/leaf_index.h"
+
+#include <algorithm>
+#include <glog/logging.h>
+#include <string.h>
+
+#include "merkletree/merkle_tree.h"
+
+using std::string;
+
+namespace cert_trans {
+namespace {
+
+
+// Enough for a trillion leaves.
+const int kIndexBits = 40;
+const uint64_t kIndexMask = (static_cast<uint64_t>(1) << kIndexBits) - 1;
+const size_t kMinCapacity = 1024;
+// The first bytes of the hash pick the slot, and the next ones make
+// the tag.
+const size_t kPositionSize = sizeof(uint64_t);
+const size_t kTagSize = (64 - kIndexBits) / 8;
+
+
+// Leaf hashes are cryptographic hashes, so any of their bits is as
+// good as another.
+size_t Position(const string& leaf_hash) {
+  uint64_t position;
+  memcpy(&position, leaf_hash.data(), kPositionSize);
+  return position;
+}
+
+
+uint64_t Tag(const string& leaf_hash) {
+  uint64_t tag(0);
+  for (size_t i = 0; i < kTagSize; ++i) {
+    tag = (tag << 8) |
+          static_cast<unsigned char>(leaf_hash[kPositionSize + i]);
+  }
+  return tag << kIndexBits;
+}
+
+
+bool IsFull(size_t size, size_t capacity) {
+  return size * 4 >= capacity * 3;
+}
+
+
+}  // namespace
+
+
+LeafIndex::LeafIndex() : size_(0) {
+}
+
+
+void LeafIndex::Reserve(const MerkleTree& tree, size_t count) {
+  size_t capacity(std::max(kMinCapacity, slots_.size()));
+  while (IsFull(count, capacity)) {
+    capacity *= 2;
+  }
+  if (capacity > slots_.size()) {
+    Rehash(tree, capacity);
+  }
+}
+
+
+void LeafIndex::Add(const MerkleTree& tree, int64_t index) {
+  CHECK_GE(index, 0);
+  CHECK_LT(static_cast<uint64_t>(index), kIndexMask);
+  const string leaf_hash(tree.LeafHash(index + 1));
+  CHECK_GE(leaf_hash.size(), kPositionSize + kTagSize);
+
+  if (slots_.empty() || IsFull(size_ + 1, slots_.size())) {
+    Reserve(tree, size_ + 1);
+  }
+  if (Insert(tree, leaf_hash, Tag(leaf_hash) | (index + 1))) {
+    ++size_;
+  }
+}
+
+
+int64_t LeafIndex::Find(const MerkleTree& tree,
+                        const string& leaf_hash) const {
+  if (slots_.empty() || leaf_hash.size() != tree.NodeSize() ||
+      leaf_hash.size() < kPositionSize + kTagSize) {
+    return -1;
+  }
+
+  const uint64_t tag(Tag(leaf_hash));
+  const size_t mask(slots_.size() - 1);
+  for (size_t i = Position(leaf_hash) & mask; slots_[i] != 0;
+       i = (i + 1) & mask) {
+    if ((slots_[i] & ~kIndexMask) == tag) {
+      const uint64_t leaf(slots_[i] & kIndexMask);
+      if (tree.LeafHash(leaf) == leaf_hash) {
+        return leaf - 1;
+      }
+    }
+  }
+  return -1;
+}
+
+
+void LeafIndex::Clear() {
+  std::vector<uint64_t>().swap(slots_);
+  size_ = 0;
+}
+
+
+void LeafIndex::Rehash(const MerkleTree& tree, size_t capacity) {
+  CHECK_EQ(capacity & (capacity - 1), 0U) << "not a power of two";
+  std::vector<uint64_t> old_slots(capacity, 0);
+  old_slots.swap(slots_);
+  for (const uint64_t slot : old_slots) {
+    if (slot != 0) {
+      Insert(tree, tree.LeafHash(slot & kIndexMask), slot);
+    }
+  }
+}
+
+
+bool LeafIndex::Insert(const MerkleTree& tree, const string& leaf_hash,
+                       uint64_t slot) {
+  const uint64_t tag(slot & ~kIndexMask);
+  const size_t mask(slots_.size() - 1);
+  size_t i(Position(leaf_hash) & mask);
+  for (; slots_[i] != 0; i = (i + 1) & mask) {
+    if ((slots_[i] & ~kIndexMask) == tag &&
+        tree.LeafHash(slots_[i] & kIndexMask) == leaf_hash) {
+      return false;
+    }
+  }
+  slots_[i] = slot;
+  return true;
+}
+
+
+}  // namespace cert_trans
@@ -0,0 +1,116 @@
+#include <gtest/gtest.h>
+#include <stdint.h>
+#include <string>
+
+#include "log/leaf_index.h"
+#include "merkletree/merkle_tree.h"
+#include "merkletree/serial_hasher.h"
+#include "util/testing.h"
+
+namespace {
+
+using cert_trans::LeafIndex;
+using std::string;
+
+
+class LeafIndexTest : public ::testing::Test {
+ protected:
+  LeafIndexTest() : tree_(new Sha256Hasher) {
+  }
+
+  // Adds |count| leaves with distinct hashes to |tree_| and
+  // |index_|.
+  void AddLeaves(size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+      AddLeafHash(tree_.LeafHash(std::to_string(tree_.LeafCount())));
+    }
+  }
+
+  void AddLeafHash(const string& leaf_hash) {
+    index_.Add(tree_, tree_.AddLeafHash(leaf_hash) - 1);
+  }
+
+  MerkleTree tree_;
+  LeafIndex index_;
+};
+
+
+TEST_F(LeafIndexTest, Empty) {
+  EXPECT_EQ(0U, index_.size());
+  EXPECT_EQ(-1, index_.Find(tree_, tree_.LeafHash("foo")));
+}
+
+
+TEST_F(LeafIndexTest, FindsEveryLeaf) {
+  // Enough to grow the table a few times.
+  const size_t kLeaves(10000);
+  AddLeaves(kLeaves);
+  EXPECT_EQ(kLeaves, index_.size());
+  for (size_t i = 0; i < kLeaves; ++i) {
+    EXPECT_EQ(static_cast<int64_t>(i),
+              index_.Find(tree_, tree_.LeafHash(i + 1)));
+  }
+  EXPECT_EQ(-1, index_.Find(tree_, tree_.LeafHash("not a leaf")));
+  EXPECT_GE(22 * kLeaves, index_.MemoryUsage());
+}
+
+
+TEST_F(LeafIndexTest, Reserve) {
+  index_.Reserve(tree_, 5000);
+  const size_t memory(index_.MemoryUsage());
+  AddLeaves(5000);
+  EXPECT_EQ(memory, index_.MemoryUsage());
+}
+
+
+TEST_F(LeafIndexTest, KeepsFirstDuplicate) {
+  AddLeaves(10);
+  AddLeafHash(tree_.LeafHash(4));
+  AddLeaves(2000);
+  AddLeafHash(tree_.LeafHash(4));
+  EXPECT_EQ(2010U, index_.size());
+  EXPECT_EQ(3, index_.Find(tree_, tree_.LeafHash(4)));
+}
+
+
+TEST_F(LeafIndexTest, SameTag) {
+  // Hashes that only differ after the bits kept in the table.
+  string leaf_hash(32, 'x');
+  for (int i = 0; i < 100; ++i) {
+    leaf_hash[31] = static_cast<char>(i);
+    AddLeafHash(leaf_hash);
+  }
+  AddLeaves(2000);
+  for (int i = 0; i < 100; ++i) {
+    leaf_hash[31] = static_cast<char>(i);
+    EXPECT_EQ(i, index_.Find(tree_, leaf_hash));
+  }
+  leaf_hash[31] = static_cast<char>(100);
+  EXPECT_EQ(-1, index_.Find(tree_, leaf_hash));
+}
+
+
+TEST_F(LeafIndexTest, WrongSize) {
+  AddLeaves(10);
+  EXPECT_EQ(-1, index_.Find(tree_, ""));
+  EXPECT_EQ(-1, index_.Find(tree_, tree_.LeafHash(1).substr(0, 16)));
+  EXPECT_EQ(-1, index_.Find(tree_, tree_.LeafHash(1) + "x"));
+}
+
+
+TEST_F(LeafIndexTest, Clear) {
+  AddLeaves(10);
+  index_.Clear();
+  EXPECT_EQ(0U, index_.size());
+  EXPECT_EQ(0U, index_.MemoryUsage());
+  EXPECT_EQ(-1, index_.Find(tree_, tree_.LeafHash(1)));
+}
+
+
+}  // namespace
+
+
+int main(int argc, char** argv) {
+  cert_trans::test::InitTesting(argv[0], &argc, &argv, true);
+  return RUN_ALL_TESTS();
+}
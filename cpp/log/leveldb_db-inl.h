@@ -8,6 +8,8 @@
 #include <map>
 #include <stdint.h>
 #include <string>
+#include <utility>
+#include <vector>
 
 #include "proto/ct.pb.h"
 #include "proto/serializer.h"
@@ -29,10 +31,28 @@ static cert_trans::Latency<std::chrono::milliseconds, std::string>
 
 
 const char kMetaNodeIdKey[] = "metadata";
+const char kMetaContiguousSizeKey[] = "contiguous_size";
+// Where the entries not yet in the hash index start, while a bulk
+// load is in progress.
+const char kMetaBulkLoadStartKey[] = "bulk_load_start";
+// Present once the entries written before --database_search_index
+// was set are indexed by search key.
+const char kMetaSearchIndexedKey[] = "search_indexed";
 const char kEntryPrefix[] = "entry-";
+const char kHashPrefix[] = "hash-";
 const char kTreeHeadPrefix[] = "sth-";
+// The entries are indexed by search key with empty values, under
+// keys which sort by search key, then by sequence number.
+const char kSearchPrefix[] = "search-";
+// The tree heads are also indexed by tree size, with empty values
+// under keys which sort by tree size, then by timestamp.
+const char kTreeSizePrefix[] = "sth_size-";
 const char kMetaPrefix[] = "meta-";
 
+// The number of entries indexed per write batch when building the
+// hash index of a database that does not have one yet.
+const size_t kIndexBatchSize = 10000;
+
 
 #ifdef HAVE_LEVELDB_FILTER_POLICY_H
 std::unique_ptr<const leveldb::FilterPolicy> BuildFilterPolicy() {
@@ -77,14 +97,31 @@ int64_t KeyToIndex(leveldb::Slice key) {
 }
 
 
+// |timestamp_key| is the key of the tree head, without its prefix.
+std::string TreeSizeKey(int64_t tree_size, const std::string& timestamp_key) {
+  CHECK_GE(tree_size, 0);
+  return kTreeSizePrefix + Serializer::SerializeUint<uint64_t>(tree_size) +
+         timestamp_key;
+}
+
+
+// The keys of the entries with |search_key| start with this. Search
+// keys cannot contain a NUL, but an issuer key hash could.
+std::string SearchKeyPrefix(const std::string& search_key) {
+  return kSearchPrefix + search_key + '\0';
+}
+
+
 }  // namespace
 
 
 template <class Logged>
 class LevelDB<Logged>::Iterator : public Database<Logged>::Iterator {
  public:
-  Iterator(const LevelDB<Logged>* db, int64_t start_index)
-      : it_(CHECK_NOTNULL(db)->db_->NewIterator(leveldb::ReadOptions())) {
+  // Unless |fill_cache|, the blocks read are not kept in the block
+  // cache.
+  Iterator(const LevelDB<Logged>* db, int64_t start_index, bool fill_cache)
+      : it_(CHECK_NOTNULL(db)->db_->NewIterator(ReadOptions(fill_cache))) {
     CHECK(it_);
     it_->Seek(IndexToKey(start_index));
   }
@@ -95,7 +132,7 @@ class LevelDB<Logged>::Iterator : public Database<Logged>::Iterator {
     }
 
     const int64_t seq(KeyToIndex(it_->key()));
-    CHECK(entry->ParseFromArray(it_->value().data(), it_->value().size()))
+    CHECK(entry->ParseFromStorage(it_->value().data(), it_->value().size()))
         << "failed to parse entry for key " << it_->key().ToString();
     CHECK(entry->has_sequence_number())
         << "no sequence number for entry with expected sequence number "
@@ -108,6 +145,12 @@ class LevelDB<Logged>::Iterator : public Database<Logged>::Iterator {
   }
 
  private:
+  static leveldb::ReadOptions ReadOptions(bool fill_cache) {
+    leveldb::ReadOptions options;
+    options.fill_cache = fill_cache;
+    return options;
+  }
+
   const std::unique_ptr<leveldb::Iterator> it_;
 };
 
@@ -118,11 +161,14 @@ const size_t LevelDB<Logged>::kTimestampBytesIndexed = 6;
 
 template <class Logged>
 LevelDB<Logged>::LevelDB(const std::string& dbfile)
-    :
+    : lock_("leveldb"),
 #ifdef HAVE_LEVELDB_FILTER_POLICY_H
       filter_policy_(BuildFilterPolicy()),
 #endif
       contiguous_size_(0),
+      sparse_entries_memory_("leveldb_sparse_entries"),
+      search_index_(FLAGS_database_search_index),
+      bulk_load_start_(-1),
       latest_tree_timestamp_(0) {
   LOG(INFO) << "Opening " << dbfile;
   cert_trans::ScopedLatency latency(latency_by_op_ms.GetScopedLatency("open"));
@@ -154,31 +200,25 @@ typename Database<Logged>::WriteResult LevelDB<Logged>::CreateSequencedEntry_(
   cert_trans::ScopedLatency latency(
       latency_by_op_ms.GetScopedLatency("create_sequenced_entry"));
 
-  std::unique_lock<std::mutex> lock(lock_);
+  size_t written;
+  return WriteEntries({&logged}, &written);
+}
 
-  std::string data;
-  CHECK(logged.SerializeToString(&data));
 
-  const std::string key(IndexToKey(logged.sequence_number()));
+template <class Logged>
+typename Database<Logged>::WriteResult
+LevelDB<Logged>::CreateSequencedEntries_(const std::vector<Logged>& logged,
+                                         size_t* written) {
+  cert_trans::ScopedLatency latency(
+      latency_by_op_ms.GetScopedLatency("create_sequenced_entries"));
 
-  std::string existing_data;
-  leveldb::Status status(
-      db_->Get(leveldb::ReadOptions(), key, &existing_data));
-  if (status.IsNotFound()) {
-    status = db_->Put(leveldb::WriteOptions(), key, data);
-    CHECK(status.ok()) << "Failed to write sequenced entry (seq: "
-                       << logged.sequence_number()
-                       << "): " << status.ToString();
-  } else {
-    if (existing_data == data) {
-      return this->OK;
-    }
-    return this->SEQUENCE_NUMBER_ALREADY_IN_USE;
+  std::vector<const Logged*> entries;
+  entries.reserve(logged.size());
+  for (const Logged& entry : logged) {
+    entries.push_back(&entry);
   }
 
-  InsertEntryMapping(logged.sequence_number(), logged.Hash());
-
-  return this->OK;
+  return WriteEntries(entries, written);
 }
 
 
@@ -188,16 +228,19 @@ typename Database<Logged>::LookupResult LevelDB<Logged>::LookupByHash(
   cert_trans::ScopedLatency latency(
       latency_by_op_ms.GetScopedLatency("lookup_by_hash"));
 
-  std::unique_lock<std::mutex> lock(lock_);
-
-  auto i(id_by_hash_.find(hash));
-  if (i == id_by_hash_.end()) {
+  // The entry is written in the same batch as its hash, so there is
+  // no need to lock anything between the two reads.
+  std::string key;
+  leveldb::Status status(
+      db_->Get(leveldb::ReadOptions(), kHashPrefix + hash, &key));
+  if (status.IsNotFound()) {
     return this->NOT_FOUND;
   }
+  CHECK(status.ok()) << "Failed to get index of hash(" << util::HexString(hash)
+                     << "): " << status.ToString();
 
   std::string cert_data;
-  const leveldb::Status status(
-      db_->Get(leveldb::ReadOptions(), IndexToKey(i->second), &cert_data));
+  status = db_->Get(leveldb::ReadOptions(), key, &cert_data);
   if (status.IsNotFound()) {
     return this->NOT_FOUND;
   }
@@ -205,7 +248,7 @@ typename Database<Logged>::LookupResult LevelDB<Logged>::LookupByHash(
                      << "): " << status.ToString();
 
   Logged logged;
-  CHECK(logged.ParseFromString(cert_data));
+  CHECK(logged.ParseFromStorage(cert_data));
   CHECK_EQ(logged.Hash(), hash);
 
   if (result) {
@@ -233,7 +276,7 @@ typename Database<Logged>::LookupResult LevelDB<Logged>::LookupByIndex(
                      << sequence_number;
 
   if (result) {
-    CHECK(result->ParseFromString(cert_data));
+    CHECK(result->ParseFromStorage(cert_data));
     CHECK_EQ(result->sequence_number(), sequence_number);
   }
 
@@ -244,7 +287,54 @@ typename Database<Logged>::LookupResult LevelDB<Logged>::LookupByIndex(
 template <class Logged>
 std::unique_ptr<typename Database<Logged>::Iterator>
 LevelDB<Logged>::ScanEntries(int64_t start_index) const {
-  return std::unique_ptr<Iterator>(new Iterator(this, start_index));
+  return std::unique_ptr<Iterator>(new Iterator(this, start_index, true));
+}
+
+
+template <class Logged>
+std::unique_ptr<typename Database<Logged>::Iterator>
+LevelDB<Logged>::ScanEntriesBulk(int64_t start_index) const {
+  // LevelDB has no read-ahead option, but this keeps the sweep from
+  // evicting the hot blocks.
+  return std::unique_ptr<Iterator>(new Iterator(this, start_index, false));
+}
+
+
+template <class Logged>
+typename Database<Logged>::LookupResult LevelDB<Logged>::SearchEntries(
+    const std::string& search_key, int64_t start_index, size_t max_results,
+    std::vector<int64_t>* result) const {
+  CHECK_GE(start_index, 0);
+  CHECK_NOTNULL(result);
+  if (!search_index_) {
+    return this->NOT_FOUND;
+  }
+  cert_trans::ScopedLatency latency(
+      latency_by_op_ms.GetScopedLatency("search_entries"));
+
+  const std::string prefix(SearchKeyPrefix(search_key));
+  std::unique_ptr<leveldb::Iterator> it(
+      db_->NewIterator(leveldb::ReadOptions()));
+  for (it->Seek(prefix + Serializer::SerializeUint<uint64_t>(start_index));
+       result->size() < max_results && it->Valid() &&
+       it->key().starts_with(prefix);
+       it->Next()) {
+    // Skip those of a longer search key starting with this one.
+    if (it->key().size() != prefix.size() + sizeof(uint64_t)) {
+      continue;
+    }
+    uint64_t seq;
+    CHECK_EQ(Deserializer::OK,
+             Deserializer::DeserializeUint<uint64_t>(
+                 std::string(it->key().data() + prefix.size(),
+                             sizeof(seq)),
+                 sizeof(seq), &seq));
+    result->push_back(seq);
+  }
+  CHECK(it->status().ok()) << "Failed to search entries: "
+                           << it->status().ToString();
+
+  return this->LOOKUP_OK;
 }
 
 
@@ -262,7 +352,7 @@ typename Database<Logged>::WriteResult LevelDB<Logged>::WriteTreeHead_(
   std::string data;
   CHECK(sth.SerializeToString(&data));
 
-  std::unique_lock<std::mutex> lock(lock_);
+  std::unique_lock<Mutex> lock(lock_);
   std::string existing_data;
   leveldb::Status status(db_->Get(leveldb::ReadOptions(),
                                   kTreeHeadPrefix + timestamp_key,
@@ -274,15 +364,20 @@ typename Database<Logged>::WriteResult LevelDB<Logged>::WriteTreeHead_(
     return this->DUPLICATE_TREE_HEAD_TIMESTAMP;
   }
 
+  leveldb::WriteBatch batch;
+  batch.Put(kTreeHeadPrefix + timestamp_key, data);
+  batch.Put(TreeSizeKey(sth.tree_size(), timestamp_key), leveldb::Slice());
   leveldb::WriteOptions opts;
   opts.sync = true;
-  status = db_->Put(opts, kTreeHeadPrefix + timestamp_key, data);
+  status = db_->Write(opts, &batch);
   CHECK(status.ok()) << "Failed to write tree head (" << timestamp_key
                      << "): " << status.ToString();
 
   if (sth.timestamp() > latest_tree_timestamp_) {
     latest_tree_timestamp_ = sth.timestamp();
-    latest_timestamp_key_ = timestamp_key;
+    std::atomic_store(&latest_tree_head_,
+                      std::shared_ptr<const ct::SignedTreeHead>(
+                          new ct::SignedTreeHead(sth)));
   }
 
   lock.unlock();
@@ -297,9 +392,84 @@ typename Database<Logged>::LookupResult LevelDB<Logged>::LatestTreeHead(
     ct::SignedTreeHead* result) const {
   cert_trans::ScopedLatency latency(
       latency_by_op_ms.GetScopedLatency("latest_tree_head"));
-  std::lock_guard<std::mutex> lock(lock_);
+  const std::shared_ptr<const ct::SignedTreeHead> sth(
+      std::atomic_load(&latest_tree_head_));
+  if (!sth) {
+    return this->NOT_FOUND;
+  }
 
-  return LatestTreeHeadNoLock(result);
+  CHECK_NOTNULL(result)->CopyFrom(*sth);
+  return this->LOOKUP_OK;
+}
+
+
+template <class Logged>
+typename Database<Logged>::LookupResult
+LevelDB<Logged>::LookupTreeHeadByTimestamp(uint64_t timestamp,
+                                           ct::SignedTreeHead* result) const {
+  CHECK_NOTNULL(result);
+  cert_trans::ScopedLatency latency(
+      latency_by_op_ms.GetScopedLatency("lookup_tree_head_by_timestamp"));
+
+  std::string tree_data;
+  const leveldb::Status status(
+      db_->Get(leveldb::ReadOptions(),
+               kTreeHeadPrefix +
+                   Serializer::SerializeUint(timestamp,
+                                             LevelDB::kTimestampBytesIndexed),
+               &tree_data));
+  if (status.IsNotFound()) {
+    return this->NOT_FOUND;
+  }
+  CHECK(status.ok()) << "Failed to read tree head: " << status.ToString();
+
+  CHECK(result->ParseFromString(tree_data));
+  return this->LOOKUP_OK;
+}
+
+
+template <class Logged>
+void LevelDB<Logged>::ScanTreeHeadsBySize(
+    int64_t start_size, int64_t end_size,
+    std::vector<ct::SignedTreeHead>* result) const {
+  CHECK_GE(start_size, 0);
+  CHECK_NOTNULL(result);
+  cert_trans::ScopedLatency latency(
+      latency_by_op_ms.GetScopedLatency("scan_tree_heads_by_size"));
+  if (end_size <= start_size) {
+    return;
+  }
+
+  // The last index key of each tree size is that of its freshest
+  // tree head.
+  const size_t prefix_size(strlen(kTreeSizePrefix));
+  const std::string end_key(TreeSizeKey(end_size, ""));
+  std::vector<std::string> timestamp_keys;
+  std::string last_size;
+  std::unique_ptr<leveldb::Iterator> it(
+      db_->NewIterator(leveldb::ReadOptions()));
+  it->Seek(TreeSizeKey(start_size, ""));
+  for (; it->Valid() && it->key().compare(end_key) < 0; it->Next()) {
+    const std::string key(it->key().ToString());
+    const std::string size(key.substr(prefix_size, sizeof(uint64_t)));
+    if (timestamp_keys.empty() || size != last_size) {
+      timestamp_keys.emplace_back();
+      last_size = size;
+    }
+    timestamp_keys.back() = key.substr(prefix_size + sizeof(uint64_t));
+  }
+  CHECK(it->status().ok()) << "Failed to scan tree sizes: "
+                           << it->status().ToString();
+
+  for (const std::string& timestamp_key : timestamp_keys) {
+    std::string tree_data;
+    const leveldb::Status status(db_->Get(leveldb::ReadOptions(),
+                                          kTreeHeadPrefix + timestamp_key,
+                                          &tree_data));
+    CHECK(status.ok()) << "Failed to read tree head: " << status.ToString();
+    result->emplace_back();
+    CHECK(result->back().ParseFromString(tree_data));
+  }
 }
 
 
@@ -307,8 +477,6 @@ template <class Logged>
 int64_t LevelDB<Logged>::TreeSize() const {
   cert_trans::ScopedLatency latency(
       latency_by_op_ms.GetScopedLatency("tree_size"));
-  std::lock_guard<std::mutex> lock(lock_);
-
   return contiguous_size_;
 }
 
@@ -316,14 +484,15 @@ int64_t LevelDB<Logged>::TreeSize() const {
 template <class Logged>
 void LevelDB<Logged>::AddNotifySTHCallback(
     const typename Database<Logged>::NotifySTHCallback* callback) {
-  std::unique_lock<std::mutex> lock(lock_);
+  std::unique_lock<Mutex> lock(lock_);
 
   callbacks_.Add(callback);
 
-  ct::SignedTreeHead sth;
-  if (LatestTreeHeadNoLock(&sth) == this->LOOKUP_OK) {
+  const std::shared_ptr<const ct::SignedTreeHead> sth(
+      std::atomic_load(&latest_tree_head_));
+  if (sth) {
     lock.unlock();
-    (*callback)(sth);
+    (*callback)(*sth);
   }
 }
 
@@ -331,7 +500,7 @@ void LevelDB<Logged>::AddNotifySTHCallback(
 template <class Logged>
 void LevelDB<Logged>::RemoveNotifySTHCallback(
     const typename Database<Logged>::NotifySTHCallback* callback) {
-  std::lock_guard<std::mutex> lock(lock_);
+  std::lock_guard<Mutex> lock(lock_);
 
   callbacks_.Remove(callback);
 }
@@ -342,7 +511,7 @@ void LevelDB<Logged>::InitializeNode(const std::string& node_id) {
   CHECK(!node_id.empty());
   cert_trans::ScopedLatency latency(
       latency_by_op_ms.GetScopedLatency("initialize_node"));
-  std::unique_lock<std::mutex> lock(lock_);
+  std::unique_lock<Mutex> lock(lock_);
   std::string existing_id;
   leveldb::Status status(db_->Get(leveldb::ReadOptions(),
                                   std::string(kMetaPrefix) + kMetaNodeIdKey,
@@ -370,77 +539,376 @@ typename Database<Logged>::LookupResult LevelDB<Logged>::NodeId(
 }
 
 
+template <class Logged>
+void LevelDB<Logged>::BeginBulkLoad() {
+  std::lock_guard<Mutex> lock(lock_);
+  if (bulk_load_start_ >= 0) {
+    return;
+  }
+
+  // Persisted before any entry is written without its hash, so that
+  // a crash leaves a record of which ones to index.
+  bulk_load_start_ = contiguous_size_;
+  const leveldb::Status status(
+      db_->Put(leveldb::WriteOptions(),
+               std::string(kMetaPrefix) + kMetaBulkLoadStartKey,
+               Serializer::SerializeUint<uint64_t>(bulk_load_start_)));
+  CHECK(status.ok()) << "Failed to start bulk load: " << status.ToString();
+  LOG(INFO) << "Bulk loading entries from " << bulk_load_start_;
+}
+
+
+template <class Logged>
+void LevelDB<Logged>::EndBulkLoad() {
+  cert_trans::ScopedLatency latency(
+      latency_by_op_ms.GetScopedLatency("end_bulk_load"));
+  std::lock_guard<Mutex> lock(lock_);
+  if (bulk_load_start_ >= 0) {
+    FinishBulkLoad();
+  }
+}
+
+
 template <class Logged>
 void LevelDB<Logged>::BuildIndex() {
   cert_trans::ScopedLatency latency(
       latency_by_op_ms.GetScopedLatency("build_index"));
   // Technically, this should only be called from the constructor, so
   // this should not be necessarily, but just to be sure...
-  std::lock_guard<std::mutex> lock(lock_);
+  std::lock_guard<Mutex> lock(lock_);
 
   leveldb::ReadOptions options;
   options.fill_cache = false;
   std::unique_ptr<leveldb::Iterator> it(db_->NewIterator(options));
   CHECK(it);
-  it->Seek(kEntryPrefix);
 
-  for (; it->Valid() && it->key().starts_with(kEntryPrefix); it->Next()) {
-    const int64_t seq(KeyToIndex(it->key()));
-    Logged logged;
-    CHECK(logged.ParseFromString(it->value().ToString()))
-        << "Failed to parse entry with sequence number " << seq;
-    CHECK(logged.has_sequence_number())
-        << "No sequence number for entry with sequence number " << seq;
-    CHECK_EQ(logged.sequence_number(), seq)
-        << "Entry has unexpected sequence_number: " << seq;
+  // The entries before the persisted tree size are all there, so only
+  // those after it need to be looked at. Databases written before the
+  // hash index existed do not have it, and are indexed from scratch.
+  std::string size_data;
+  const leveldb::Status status(
+      db_->Get(leveldb::ReadOptions(),
+               std::string(kMetaPrefix) + kMetaContiguousSizeKey, &size_data));
+  if (status.ok()) {
+    uint64_t size;
+    CHECK_EQ(Deserializer::OK,
+             Deserializer::DeserializeUint<uint64_t>(size_data, sizeof(size),
+                                                     &size));
+    contiguous_size_ = size;
+    it->Seek(IndexToKey(contiguous_size_));
+  } else {
+    CHECK(status.IsNotFound()) << "Failed to read tree size: "
+                               << status.ToString();
+    LOG(INFO) << "Building hash index";
+    IndexHashes(it.get(), 0);
+    it->Seek(kEntryPrefix);
+  }
 
-    InsertEntryMapping(logged.sequence_number(), logged.Hash());
+  for (; it->Valid() && it->key().starts_with(kEntryPrefix); it->Next()) {
+    InsertSequenceNumber(KeyToIndex(it->key()));
+  }
+  WriteContiguousSize();
+
+  // Finish a bulk load that was interrupted, so that lookups by hash
+  // find all the entries.
+  std::string bulk_load_data;
+  const leveldb::Status bulk_load_status(
+      db_->Get(leveldb::ReadOptions(),
+               std::string(kMetaPrefix) + kMetaBulkLoadStartKey,
+               &bulk_load_data));
+  if (bulk_load_status.ok()) {
+    uint64_t start;
+    CHECK_EQ(Deserializer::OK,
+             Deserializer::DeserializeUint<uint64_t>(bulk_load_data,
+                                                     sizeof(start), &start));
+    bulk_load_start_ = start;
+    LOG(WARNING) << "Finishing bulk load interrupted at "
+                 << contiguous_size_;
+    FinishBulkLoad();
+  } else {
+    CHECK(bulk_load_status.IsNotFound()) << "Failed to read bulk load start: "
+                                         << bulk_load_status.ToString();
   }
 
+  BuildSearchIndex();
+
   // Now read the STH entries.
+  std::string latest_timestamp_key;
   it->Seek(kTreeHeadPrefix);
   for (; it->Valid() && it->key().starts_with(kTreeHeadPrefix); it->Next()) {
     leveldb::Slice key_slice(it->key());
     key_slice.remove_prefix(strlen(kTreeHeadPrefix));
-    latest_timestamp_key_ = key_slice.ToString();
+    latest_timestamp_key = key_slice.ToString();
+  }
+  if (!latest_timestamp_key.empty()) {
     CHECK_EQ(Deserializer::OK,
              Deserializer::DeserializeUint<uint64_t>(
-                 latest_timestamp_key_, LevelDB::kTimestampBytesIndexed,
+                 latest_timestamp_key, LevelDB::kTimestampBytesIndexed,
                  &latest_tree_timestamp_));
+    std::string tree_data;
+    const leveldb::Status status(db_->Get(leveldb::ReadOptions(),
+                                          kTreeHeadPrefix +
+                                              latest_timestamp_key,
+                                          &tree_data));
+    CHECK(status.ok()) << "Failed to read latest tree head: "
+                       << status.ToString();
+    std::shared_ptr<ct::SignedTreeHead> sth(new ct::SignedTreeHead);
+    CHECK(sth->ParseFromString(tree_data));
+    CHECK_EQ(sth->timestamp(), latest_tree_timestamp_);
+    std::atomic_store(&latest_tree_head_,
+                      std::shared_ptr<const ct::SignedTreeHead>(sth));
+  }
+  if (latest_tree_timestamp_ > 0) {
+    it->Seek(kTreeSizePrefix);
+    if (!it->Valid() || !it->key().starts_with(kTreeSizePrefix)) {
+      IndexTreeHeads();
+    }
   }
 }
 
 
 template <class Logged>
-typename Database<Logged>::LookupResult LevelDB<Logged>::LatestTreeHeadNoLock(
-    ct::SignedTreeHead* result) const {
-  if (latest_tree_timestamp_ == 0) {
-    return this->NOT_FOUND;
+void LevelDB<Logged>::IndexTreeHeads() {
+  LOG(INFO) << "Indexing the tree heads by tree size";
+  // There are not that many of them, index them in a single batch, so
+  // that an interrupted indexing starts over.
+  leveldb::WriteBatch batch;
+  std::unique_ptr<leveldb::Iterator> it(
+      db_->NewIterator(leveldb::ReadOptions()));
+  for (it->Seek(kTreeHeadPrefix);
+       it->Valid() && it->key().starts_with(kTreeHeadPrefix); it->Next()) {
+    ct::SignedTreeHead sth;
+    CHECK(sth.ParseFromArray(it->value().data(), it->value().size()));
+    leveldb::Slice timestamp_key(it->key());
+    timestamp_key.remove_prefix(strlen(kTreeHeadPrefix));
+    batch.Put(TreeSizeKey(sth.tree_size(), timestamp_key.ToString()),
+              leveldb::Slice());
   }
+  CHECK(it->status().ok()) << "Failed to scan tree heads: "
+                           << it->status().ToString();
 
-  std::string tree_data;
-  leveldb::Status status(db_->Get(leveldb::ReadOptions(),
-                                  kTreeHeadPrefix + latest_timestamp_key_,
-                                  &tree_data));
-  CHECK(status.ok()) << "Failed to read latest tree head: "
-                     << status.ToString();
+  leveldb::WriteOptions opts;
+  opts.sync = true;
+  const leveldb::Status status(db_->Write(opts, &batch));
+  CHECK(status.ok()) << "Failed to index tree heads: " << status.ToString();
+}
 
-  CHECK(result->ParseFromString(tree_data));
-  CHECK_EQ(result->timestamp(), latest_tree_timestamp_);
 
-  return this->LOOKUP_OK;
+template <class Logged>
+typename Database<Logged>::WriteResult LevelDB<Logged>::WriteEntries(
+    const std::vector<const Logged*>& logged, size_t* written) {
+  std::lock_guard<Mutex> lock(lock_);
+
+  // The new entries and their hashes are all written in one batch, so
+  // entries earlier in it have to be checked for as well.
+  leveldb::WriteBatch batch;
+  std::map<std::string, std::string> batched;
+  std::map<std::string, int64_t> batched_hashes;
+  std::vector<int64_t> created;
+  typename Database<Logged>::WriteResult result(this->OK);
+  for (*written = 0; *written < logged.size(); ++*written) {
+    const Logged& entry(*logged[*written]);
+    std::string data;
+    CHECK(entry.SerializeForStorage(&data));
+
+    const std::string key(IndexToKey(entry.sequence_number()));
+
+    // While bulk loading, the entries that are not in the database
+    // are known without reading it, and their hashes are indexed
+    // once the load is done.
+    const bool bulk_new(bulk_load_start_ >= 0 &&
+                        entry.sequence_number() >= contiguous_size_ &&
+                        sparse_entries_.count(entry.sequence_number()) == 0);
+    const auto it(batched.find(key));
+    std::string existing_data;
+    if (it != batched.end()) {
+      existing_data = it->second;
+    } else if (bulk_new ||
+               db_->Get(leveldb::ReadOptions(), key, &existing_data)
+                   .IsNotFound()) {
+      if (bulk_load_start_ < 0) {
+        IndexHash(entry.Hash(), entry.sequence_number(), &batched_hashes,
+                  &batch);
+      }
+      if (search_index_) {
+        IndexSearchKeys(entry, &batch);
+      }
+      batch.Put(key, data);
+      batched.emplace(key, std::move(data));
+      created.push_back(entry.sequence_number());
+      continue;
+    }
+
+    if (!Logged::SameStoredEntry(existing_data, data)) {
+      result = this->SEQUENCE_NUMBER_ALREADY_IN_USE;
+      break;
+    }
+  }
+
+  if (!created.empty()) {
+    const leveldb::Status status(db_->Write(leveldb::WriteOptions(), &batch));
+    CHECK(status.ok()) << "Failed to write " << created.size()
+                       << " sequenced entries: " << status.ToString();
+  }
+
+  const int64_t old_size(contiguous_size_);
+  for (const int64_t sequence_number : created) {
+    InsertSequenceNumber(sequence_number);
+  }
+  if (contiguous_size_ != old_size) {
+    WriteContiguousSize();
+  }
+
+  return result;
+}
+
+
+// This must be called with "lock_" held.
+template <class Logged>
+void LevelDB<Logged>::IndexHash(const std::string& hash,
+                                int64_t sequence_number,
+                                std::map<std::string, int64_t>* batched,
+                                leveldb::WriteBatch* batch) const {
+  // If the same entry is logged more than once, keep track of the
+  // one with the lowest sequence number.
+  const auto it(batched->find(hash));
+  if (it != batched->end()) {
+    if (it->second <= sequence_number) {
+      return;
+    }
+  } else {
+    std::string existing_key;
+    const leveldb::Status status(
+        db_->Get(leveldb::ReadOptions(), kHashPrefix + hash, &existing_key));
+    if (status.ok() && KeyToIndex(existing_key) <= sequence_number) {
+      return;
+    }
+    CHECK(status.ok() || status.IsNotFound())
+        << "Failed to get index of hash(" << util::HexString(hash)
+        << "): " << status.ToString();
+  }
+
+  (*batched)[hash] = sequence_number;
+  batch->Put(kHashPrefix + hash, IndexToKey(sequence_number));
+}
+
+
+// This must be called with "lock_" held.
+template <class Logged>
+void LevelDB<Logged>::IndexHashes(leveldb::Iterator* it, int64_t start_index) {
+  leveldb::WriteBatch batch;
+  std::map<std::string, int64_t> batched;
+  int64_t count(0);
+  for (it->Seek(IndexToKey(start_index));
+       it->Valid() && it->key().starts_with(kEntryPrefix); it->Next()) {
+    const int64_t seq(KeyToIndex(it->key()));
+    // Only the header of the entry is read, if it has one.
+    int64_t stored_seq;
+    std::string hash;
+    CHECK(Logged::ReadStorageKey(it->value().data(), it->value().size(),
+                                 &stored_seq, &hash))
+        << "Failed to parse entry with sequence number " << seq;
+    CHECK_EQ(stored_seq, seq)
+        << "Entry has unexpected sequence_number: " << seq;
+
+    IndexHash(hash, seq, &batched, &batch);
+    if (++count % kIndexBatchSize == 0) {
+      CHECK(db_->Write(leveldb::WriteOptions(), &batch).ok());
+      batch.Clear();
+      batched.clear();
+    }
+  }
+  CHECK(db_->Write(leveldb::WriteOptions(), &batch).ok());
+  LOG(INFO) << "Indexed the hashes of " << count << " entries";
+}
+
+
+template <class Logged>
+void LevelDB<Logged>::IndexSearchKeys(const Logged& entry,
+                                      leveldb::WriteBatch* batch) const {
+  std::vector<std::string> search_keys;
+  entry.SearchKeys(&search_keys);
+  const std::string seq_key(
+      Serializer::SerializeUint<uint64_t>(entry.sequence_number()));
+  for (const std::string& search_key : search_keys) {
+    batch->Put(SearchKeyPrefix(search_key) + seq_key, leveldb::Slice());
+  }
 }
 
 
 // This must be called with "lock_" held.
 template <class Logged>
-void LevelDB<Logged>::InsertEntryMapping(int64_t sequence_number,
-                                         const std::string& hash) {
-  if (!id_by_hash_.insert(std::make_pair(hash, sequence_number)).second) {
-    // This is a duplicate hash under a new sequence number.
-    // Make sure we track the entry with the lowest sequence number:
-    id_by_hash_[hash] = std::min(id_by_hash_[hash], sequence_number);
+void LevelDB<Logged>::BuildSearchIndex() {
+  const std::string meta_key(std::string(kMetaPrefix) +
+                             kMetaSearchIndexedKey);
+  if (!search_index_) {
+    // The entries written from now on are not indexed, so they will
+    // have to be if the flag is set again.
+    const leveldb::Status status(
+        db_->Delete(leveldb::WriteOptions(), meta_key));
+    CHECK(status.ok()) << "Failed to clear search index marker: "
+                       << status.ToString();
+    return;
   }
+
+  std::string unused;
+  const leveldb::Status status(
+      db_->Get(leveldb::ReadOptions(), meta_key, &unused));
+  if (status.ok()) {
+    return;
+  }
+  CHECK(status.IsNotFound()) << "Failed to read search index marker: "
+                             << status.ToString();
+
+  LOG(INFO) << "Building search index";
+  leveldb::ReadOptions options;
+  options.fill_cache = false;
+  std::unique_ptr<leveldb::Iterator> it(db_->NewIterator(options));
+  leveldb::WriteBatch batch;
+  int64_t count(0);
+  for (it->Seek(kEntryPrefix);
+       it->Valid() && it->key().starts_with(kEntryPrefix); it->Next()) {
+    Logged entry;
+    CHECK(entry.ParseFromStorage(it->value().data(), it->value().size()))
+        << "Failed to parse entry for key " << it->key().ToString();
+    IndexSearchKeys(entry, &batch);
+    if (++count % kIndexBatchSize == 0) {
+      CHECK(db_->Write(leveldb::WriteOptions(), &batch).ok());
+      batch.Clear();
+    }
+  }
+  CHECK(it->status().ok()) << "Failed to scan entries: "
+                           << it->status().ToString();
+  batch.Put(meta_key, leveldb::Slice());
+  leveldb::WriteOptions opts;
+  opts.sync = true;
+  CHECK(db_->Write(opts, &batch).ok());
+  LOG(INFO) << "Indexed the search keys of " << count << " entries";
+}
+
+
+// This must be called with "lock_" held.
+template <class Logged>
+void LevelDB<Logged>::FinishBulkLoad() {
+  CHECK_GE(bulk_load_start_, 0);
+  leveldb::ReadOptions options;
+  options.fill_cache = false;
+  std::unique_ptr<leveldb::Iterator> it(db_->NewIterator(options));
+  CHECK(it);
+  IndexHashes(it.get(), bulk_load_start_);
+
+  const leveldb::Status status(
+      db_->Delete(leveldb::WriteOptions(),
+                  std::string(kMetaPrefix) + kMetaBulkLoadStartKey));
+  CHECK(status.ok()) << "Failed to end bulk load: " << status.ToString();
+  bulk_load_start_ = -1;
+}
+
+
+// This must be called with "lock_" held.
+template <class Logged>
+void LevelDB<Logged>::InsertSequenceNumber(int64_t sequence_number) {
+  const size_t num_sparse_entries(sparse_entries_.size());
   if (sequence_number == contiguous_size_) {
     ++contiguous_size_;
     for (auto i = sparse_entries_.find(contiguous_size_);
@@ -453,6 +921,25 @@ void LevelDB<Logged>::InsertEntryMapping(int64_t sequence_number,
     CHECK(sparse_entries_.insert(sequence_number).second)
         << "sequence number " << sequence_number << " already assigned.";
   }
+
+  if (sparse_entries_.size() != num_sparse_entries) {
+    sparse_entries_memory_.Set(
+        cert_trans::OrderedContainerBytes(sparse_entries_, 0));
+  }
+}
+
+
+// This must be called with "lock_" held.
+template <class Logged>
+void LevelDB<Logged>::WriteContiguousSize() {
+  // This is written after the entries, so that it is never ahead of
+  // them. If it is behind, the entries after it are found again when
+  // opening the database.
+  const leveldb::Status status(
+      db_->Put(leveldb::WriteOptions(),
+               std::string(kMetaPrefix) + kMetaContiguousSizeKey,
+               Serializer::SerializeUint<uint64_t>(contiguous_size_)));
+  CHECK(status.ok()) << "Failed to write tree size: " << status.ToString();
 }
 
 
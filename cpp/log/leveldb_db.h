@@ -3,20 +3,24 @@
 
 #include "config.h"
 
+#include <atomic>
 #include <leveldb/db.h>
 #ifdef HAVE_LEVELDB_FILTER_POLICY_H
 #include <leveldb/filter_policy.h>
 #endif
+#include <leveldb/write_batch.h>
 #include <map>
 #include <memory>
 #include <mutex>
 #include <set>
 #include <stdint.h>
-#include <unordered_map>
+#include <string>
 #include <vector>
 
 #include "base/macros.h"
 #include "log/database.h"
+#include "monitoring/instrumented_mutex.h"
+#include "monitoring/memory_gauge.h"
 #include "proto/ct.pb.h"
 #include "util/statusor.h"
 
@@ -36,6 +40,9 @@ class LevelDB : public Database<Logged> {
   typename Database<Logged>::WriteResult CreateSequencedEntry_(
       const Logged& logged) override;
 
+  typename Database<Logged>::WriteResult CreateSequencedEntries_(
+      const std::vector<Logged>& logged, size_t* written) override;
+
   typename Database<Logged>::LookupResult LookupByHash(
       const std::string& hash, Logged* result) const override;
 
@@ -45,12 +52,22 @@ class LevelDB : public Database<Logged> {
   std::unique_ptr<typename Database<Logged>::Iterator> ScanEntries(
       int64_t start_index) const override;
 
+  std::unique_ptr<typename Database<Logged>::Iterator> ScanEntriesBulk(
+      int64_t start_index) const override;
+
   typename Database<Logged>::WriteResult WriteTreeHead_(
       const ct::SignedTreeHead& sth) override;
 
   typename Database<Logged>::LookupResult LatestTreeHead(
       ct::SignedTreeHead* result) const override;
 
+  typename Database<Logged>::LookupResult LookupTreeHeadByTimestamp(
+      uint64_t timestamp, ct::SignedTreeHead* result) const override;
+
+  void ScanTreeHeadsBySize(
+      int64_t start_size, int64_t end_size,
+      std::vector<ct::SignedTreeHead>* result) const override;
+
   int64_t TreeSize() const override;
 
   void AddNotifySTHCallback(
@@ -64,15 +81,48 @@ class LevelDB : public Database<Logged> {
   typename Database<Logged>::LookupResult NodeId(
       std::string* node_id) override;
 
+  typename Database<Logged>::LookupResult SearchEntries(
+      const std::string& search_key, int64_t start_index, size_t max_results,
+      std::vector<int64_t>* result) const override;
+
+  // While bulk loading, the hashes of the new entries are not
+  // indexed, and they are not looked for before being written.
+  void BeginBulkLoad() override;
+  void EndBulkLoad() override;
+
  private:
   class Iterator;
+  typedef cert_trans::InstrumentedMutex<> Mutex;
 
   void BuildIndex();
-  typename Database<Logged>::LookupResult LatestTreeHeadNoLock(
-      ct::SignedTreeHead* result) const;
-  void InsertEntryMapping(int64_t sequence_number, const std::string& hash);
-
-  mutable std::mutex lock_;
+  // Indexes the tree heads by tree size, if the database was written
+  // before they were.
+  void IndexTreeHeads();
+  typename Database<Logged>::WriteResult WriteEntries(
+      const std::vector<const Logged*>& logged, size_t* written);
+  // Adds the hash of the entry at |sequence_number| to |batch|, unless
+  // an entry with a lower sequence number has the same hash, either in
+  // the database or in |batched|.
+  void IndexHash(const std::string& hash, int64_t sequence_number,
+                 std::map<std::string, int64_t>* batched,
+                 leveldb::WriteBatch* batch) const;
+  // Indexes the hashes of the entries from |start_index| on, using
+  // |it| to read them.
+  void IndexHashes(leveldb::Iterator* it, int64_t start_index);
+  // Adds the search keys of |entry| to |batch|.
+  void IndexSearchKeys(const Logged& entry, leveldb::WriteBatch* batch) const;
+  // Indexes the search keys of all the entries, unless they already
+  // are.
+  void BuildSearchIndex();
+  // Indexes the hashes of the entries written since BeginBulkLoad().
+  void FinishBulkLoad();
+  void InsertSequenceNumber(int64_t sequence_number);
+  void WriteContiguousSize();
+
+  // Only taken by the writers: leveldb::DB can be read concurrently,
+  // and what the readers need of the state below is published in
+  // atomics.
+  mutable Mutex lock_;
 #ifdef HAVE_LEVELDB_FILTER_POLICY_H
   // filter_policy_ must be valid for at least as long as db_ is, so
   // keep this order.
@@ -80,16 +130,29 @@ class LevelDB : public Database<Logged> {
 #endif
   std::unique_ptr<leveldb::DB> db_;
 
-  int64_t contiguous_size_;
-  std::unordered_map<std::string, int64_t> id_by_hash_;
+  // The hash of every entry is also stored in the database, mapped to
+  // the key of the entry, so that only this has to be read when the
+  // database is opened. Only updated with |lock_| held, after the
+  // entries are written.
+  std::atomic<int64_t> contiguous_size_;
 
   // This is a mapping of the non-contiguous entries of the log (which
   // can happen while it is being fetched). When entries here become
   // contiguous with the beginning of the tree, they are removed.
   std::set<int64_t> sparse_entries_;
+  cert_trans::MemoryGauge sparse_entries_memory_;
+
+  // Whether the entries are indexed by search key, from
+  // --database_search_index when the database is opened.
+  const bool search_index_;
+
+  // The tree size when the current bulk load started, or -1.
+  int64_t bulk_load_start_;
 
   uint64_t latest_tree_timestamp_;
-  std::string latest_timestamp_key_;
+  // Only accessed through std::atomic_load() and std::atomic_store(),
+  // the latter with |lock_| held. Null until there is a tree head.
+  std::shared_ptr<const ct::SignedTreeHead> latest_tree_head_;
   cert_trans::DatabaseNotifierHelper callbacks_;
 
   DISALLOW_COPY_AND_ASSIGN(LevelDB);
@@ -4,8 +4,10 @@
 
 #include "log/log_lookup.h"
 
+#include <algorithm>
+#include <functional>
+#include <gflags/gflags.h>
 #include <glog/logging.h>
-#include <map>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string>
@@ -13,96 +15,460 @@
 #include <vector>
 
 #include "base/time_support.h"
+#include "log/prefetching_iterator.h"
+#include "merkletree/compact_merkle_tree.h"
 #include "merkletree/merkle_tree.h"
 #include "merkletree/serial_hasher.h"
 #include "proto/ct.pb.h"
 #include "proto/serializer.h"
+#include "util/status.h"
 
+DECLARE_int32(log_lookup_max_offered_leaf_hashes);
+DECLARE_int32(log_lookup_precomputed_consistency_proofs);
+DECLARE_int32(log_lookup_update_batch_size);
+DECLARE_int32(merkle_tree_cached_snapshots);
+DECLARE_int32(merkle_tree_min_stored_level);
+DECLARE_string(merkle_tree_checkpoint_dir);
 
 static const int kCtimeBufSize = 26;
 
 
 template <class Logged>
 LogLookup<Logged>::LogLookup(ReadOnlyDatabase<Logged>* db)
-    : db_(CHECK_NOTNULL(db)),
-      cert_tree_(new Sha256Hasher),
+    : lock_("log_lookup"),
+      db_(CHECK_NOTNULL(db)),
+      cert_tree_(new MerkleTree(new Sha256Hasher)),
+      tree_memory_("log_lookup_tree"),
+      leaf_index_memory_("log_lookup_leaf_index"),
+      checkpoint_unverified_(false),
       latest_tree_head_(),
-      update_from_sth_cb_(std::bind(&LogLookup<Logged>::UpdateFromSTH, this,
+      stopping_(false),
+      has_pending_sth_(false),
+      num_notified_(0),
+      num_taken_(0),
+      num_ingested_(0),
+      offered_first_(0),
+      update_from_sth_cb_(std::bind(&LogLookup<Logged>::EnqueueSTH, this,
                                     std::placeholders::_1)) {
+  CHECK_GE(FLAGS_merkle_tree_cached_snapshots, 0);
+  CHECK_GE(FLAGS_merkle_tree_min_stored_level, 1);
+  CHECK_GT(FLAGS_log_lookup_update_batch_size, 0);
+  CHECK_GE(FLAGS_log_lookup_max_offered_leaf_hashes, 0);
+  CHECK_GE(FLAGS_log_lookup_precomputed_consistency_proofs, 0);
+  cert_tree_->SetSnapshotCacheSize(FLAGS_merkle_tree_cached_snapshots);
+  cert_tree_->SetMinStoredLevel(FLAGS_merkle_tree_min_stored_level);
+  if (!FLAGS_merkle_tree_checkpoint_dir.empty()) {
+    LoadCheckpoint();
+  }
+  // The database gives us its latest STH right away, ingest it before
+  // returning so that the lookups can be served as soon as we are
+  // constructed.
   db_->AddNotifySTHCallback(&update_from_sth_cb_);
+  UpdateFromPendingSTH();
+  updater_ = std::thread(&LogLookup<Logged>::UpdaterLoop, this);
 }
 
 
 template <class Logged>
 LogLookup<Logged>::~LogLookup() {
   db_->RemoveNotifySTHCallback(&update_from_sth_cb_);
+  {
+    std::lock_guard<std::mutex> lock(pending_lock_);
+    stopping_ = true;
+  }
+  pending_cv_.notify_all();
+  updater_.join();
+}
+
+
+template <class Logged>
+void LogLookup<Logged>::WaitForUpdates() {
+  std::unique_lock<std::mutex> lock(pending_lock_);
+  const uint64_t num_notified(num_notified_);
+  ingested_cv_.wait(lock, [this, num_notified]() {
+    return num_ingested_ >= num_notified;
+  });
+}
+
+
+template <class Logged>
+void LogLookup<Logged>::OfferLeafHashes(
+    int64_t first, const std::vector<std::string>& leaf_hashes) {
+  CHECK_GE(first, 0);
+  std::lock_guard<std::mutex> lock(offered_lock_);
+  if (first !=
+      offered_first_ + static_cast<int64_t>(offered_leaf_hashes_.size())) {
+    // Not following the ones we have, such as after the signer was
+    // restarted from an older tree, start over from these.
+    offered_leaf_hashes_.clear();
+    offered_first_ = first;
+  }
+  if (offered_leaf_hashes_.size() + leaf_hashes.size() >
+      static_cast<size_t>(FLAGS_log_lookup_max_offered_leaf_hashes)) {
+    // They are not being ingested, don't let them pile up.
+    VLOG(1) << "Dropping " << offered_leaf_hashes_.size()
+            << " offered leaf hashes";
+    offered_leaf_hashes_.clear();
+    offered_first_ = first + leaf_hashes.size();
+    return;
+  }
+  offered_leaf_hashes_.insert(offered_leaf_hashes_.end(), leaf_hashes.begin(),
+                              leaf_hashes.end());
+}
+
+
+template <class Logged>
+int64_t LogLookup<Logged>::TakeOfferedLeafHashes(
+    int64_t first, int64_t end, std::vector<std::string>* leaf_hashes) {
+  std::lock_guard<std::mutex> lock(offered_lock_);
+  // Those of the entries we have already are no use anymore.
+  while (offered_first_ < first && !offered_leaf_hashes_.empty()) {
+    offered_leaf_hashes_.pop_front();
+    ++offered_first_;
+  }
+  if (offered_first_ != first) {
+    return first;
+  }
+  while (offered_first_ < end && !offered_leaf_hashes_.empty()) {
+    leaf_hashes->emplace_back(std::move(offered_leaf_hashes_.front()));
+    offered_leaf_hashes_.pop_front();
+    ++offered_first_;
+  }
+  return offered_first_;
+}
+
+
+template <class Logged>
+void LogLookup<Logged>::EnqueueSTH(const ct::SignedTreeHead& sth) {
+  {
+    std::lock_guard<std::mutex> lock(pending_lock_);
+    // Only the most recent STH matters, the updater will read all the
+    // entries up to it anyway.
+    pending_sth_.CopyFrom(sth);
+    has_pending_sth_ = true;
+    ++num_notified_;
+  }
+  pending_cv_.notify_all();
+}
+
+
+template <class Logged>
+bool LogLookup<Logged>::TakePendingSTH(ct::SignedTreeHead* sth) {
+  std::lock_guard<std::mutex> lock(pending_lock_);
+  if (!has_pending_sth_) {
+    return false;
+  }
+  sth->Swap(&pending_sth_);
+  has_pending_sth_ = false;
+  num_taken_ = num_notified_;
+  return true;
+}
+
+
+template <class Logged>
+void LogLookup<Logged>::UpdateFromPendingSTH() {
+  ct::SignedTreeHead sth;
+  if (!TakePendingSTH(&sth)) {
+    return;
+  }
+  UpdateFromSTH(&sth);
+
+  {
+    std::lock_guard<std::mutex> lock(pending_lock_);
+    num_ingested_ = num_taken_;
+  }
+  ingested_cv_.notify_all();
 }
 
 
 template <class Logged>
-void LogLookup<Logged>::UpdateFromSTH(const ct::SignedTreeHead& sth) {
-  std::lock_guard<std::mutex> lock(lock_);
+void LogLookup<Logged>::UpdaterLoop() {
+  std::unique_lock<std::mutex> lock(pending_lock_);
+  while (true) {
+    pending_cv_.wait(lock,
+                     [this]() { return stopping_ || has_pending_sth_; });
+    if (stopping_) {
+      return;
+    }
+    lock.unlock();
+    UpdateFromPendingSTH();
+    lock.lock();
+  }
+}
 
-  CHECK_EQ(ct::V1, sth.version())
+
+template <class Logged>
+void LogLookup<Logged>::UpdateFromSTH(ct::SignedTreeHead* sth) {
+  std::lock_guard<std::mutex> update_lock(update_lock_);
+
+  CHECK_EQ(ct::V1, sth->version())
       << "Tree head signed with an unknown version";
 
-  if (sth.timestamp() == latest_tree_head_.timestamp())
+  if (sth->timestamp() == latest_tree_head_.timestamp())
     return;
 
-  CHECK_LE(0, sth.tree_size());
-  if (sth.timestamp() <= latest_tree_head_.timestamp() ||
-      static_cast<uint64_t>(sth.tree_size()) < cert_tree_.LeafCount()) {
+  CHECK_LE(0, sth->tree_size());
+  if (checkpoint_unverified_ &&
+      static_cast<uint64_t>(sth->tree_size()) < cert_tree_->LeafCount()) {
+    LOG(WARNING) << "Merkle tree checkpoint has " << cert_tree_->LeafCount()
+                 << " entries, but the database STH only has "
+                 << sth->tree_size() << ", discarding the checkpoint.";
+    ResetTree();
+  }
+  if (sth->timestamp() <= latest_tree_head_.timestamp() ||
+      static_cast<uint64_t>(sth->tree_size()) < cert_tree_->LeafCount()) {
     LOG(WARNING) << "Database replied with an STH that is older than ours: "
                  << "Our STH:\n" << latest_tree_head_.DebugString()
-                 << "Database STH:\n" << sth.DebugString();
+                 << "Database STH:\n" << sth->DebugString();
     return;
   }
 
+  // Going to the database and hashing the leaves is the slow part, do
+  // it before taking |lock_|, so that lookups can go on meanwhile. In
+  // between batches, move on to a newer STH if one came in.
+  const size_t old_size(cert_tree_->LeafCount());
+  std::vector<std::string> leaf_hashes;
+  ct::SignedTreeHead newer_sth;
+  while (old_size + leaf_hashes.size() <
+         static_cast<uint64_t>(sth->tree_size())) {
+    ReadLeafHashes(sth->tree_size(), FLAGS_log_lookup_update_batch_size,
+                   &leaf_hashes);
+    if (TakePendingSTH(&newer_sth) &&
+        newer_sth.version() == sth->version() &&
+        newer_sth.timestamp() > sth->timestamp() &&
+        newer_sth.tree_size() >= sth->tree_size()) {
+      sth->Swap(&newer_sth);
+    }
+  }
+  if (checkpoint_unverified_) {
+    checkpoint_unverified_ = false;
+    if (!ExtendsTo(leaf_hashes, *sth)) {
+      LOG(ERROR) << "Merkle tree checkpoint does not match the database, "
+                 << "rebuilding the tree from scratch.";
+      ResetTree();
+      leaf_hashes.clear();
+      ReadLeafHashes(sth->tree_size(), sth->tree_size(), &leaf_hashes);
+    }
+  }
+
+  {
+    std::lock_guard<Lock> lock(lock_);
+    AppendLeafHashes(leaf_hashes);
+    // This also brings the whole tree up to date, which lookups rely
+    // on to only read it.
+    CHECK_EQ(cert_tree_->CurrentRoot(), sth->sha256_root_hash())
+        << "Computed root hash and stored STH root hash do not match";
+    // Most proof requests are against the latest few STHs, so keep
+    // their right edge around.
+    cert_tree_->CacheSnapshot(sth->tree_size());
+    latest_tree_head_.CopyFrom(*sth);
+  }
+  UpdateMemoryGauges();
+  PrecomputeConsistencyProofs(sth->tree_size());
+  LOG(INFO) << "Found " << sth->tree_size() - old_size << " new log entries";
+
+  const time_t last_update(static_cast<time_t>(
+      sth->timestamp() / cert_trans::kNumMillisPerSecond));
+  char buf[kCtimeBufSize];
+  LOG(INFO) << "Tree successfully updated at " << ctime_r(&last_update, buf);
+
+  // Checkpointing only reads the tree, so it does not need |lock_|
+  // either.
+  if (!FLAGS_merkle_tree_checkpoint_dir.empty()) {
+    const util::Status status(
+        cert_tree_->WriteCheckpoint(FLAGS_merkle_tree_checkpoint_dir));
+    LOG_IF(WARNING, !status.ok()) << "Failed to checkpoint the Merkle tree: "
+                                  << status;
+  }
+}
+
+
+template <class Logged>
+std::vector<std::string> LogLookup<Logged>::ConsistencyProof(size_t first,
+                                                             size_t second) {
+  {
+    std::lock_guard<std::mutex> lock(consistency_lock_);
+    const auto it(consistency_proofs_.find(
+        std::make_pair(static_cast<int64_t>(first),
+                       static_cast<int64_t>(second))));
+    if (it != consistency_proofs_.end()) {
+      return it->second;
+    }
+  }
+  ReaderLock lock(&lock_);
+  return cert_tree_->SnapshotConsistency(first, second);
+}
+
+
+template <class Logged>
+void LogLookup<Logged>::PrecomputeConsistencyProofs(int64_t tree_size) {
+  const size_t max_sizes(FLAGS_log_lookup_precomputed_consistency_proofs);
+  std::vector<int64_t> firsts;
+  {
+    std::lock_guard<std::mutex> lock(consistency_lock_);
+    if (!recent_tree_sizes_.empty() &&
+        recent_tree_sizes_.back() == tree_size) {
+      // A newer STH of the same size, nothing new to prove.
+      return;
+    }
+    firsts.assign(recent_tree_sizes_.begin(), recent_tree_sizes_.end());
+  }
+
+  // Only the updates modify the tree, so holding |update_lock_| is
+  // enough to read it, as for the lookups under |lock_|.
+  std::map<std::pair<int64_t, int64_t>, std::vector<std::string>> proofs;
+  if (max_sizes > 0) {
+    for (const int64_t first : firsts) {
+      if (first > 0 && first < tree_size) {
+        proofs.emplace(std::make_pair(first, tree_size),
+                       cert_tree_->SnapshotConsistency(first, tree_size));
+      }
+    }
+  }
+
+  std::lock_guard<std::mutex> lock(consistency_lock_);
+  consistency_proofs_.insert(proofs.begin(), proofs.end());
+  recent_tree_sizes_.push_back(tree_size);
+  // The newest tree size is not the first of any proof yet, but is
+  // the second of the ones just computed, so |max_sizes| of them are
+  // kept besides it.
+  while (recent_tree_sizes_.size() > max_sizes + 1) {
+    const int64_t evicted(recent_tree_sizes_.front());
+    recent_tree_sizes_.pop_front();
+    for (auto it = consistency_proofs_.begin();
+         it != consistency_proofs_.end();) {
+      if (it->first.first == evicted || it->first.second == evicted) {
+        it = consistency_proofs_.erase(it);
+      } else {
+        ++it;
+      }
+    }
+  }
+}
+
+
+template <class Logged>
+void LogLookup<Logged>::ReadLeafHashes(int64_t tree_size, int64_t max_entries,
+                                       std::vector<std::string>* leaf_hashes) {
   // Record the new hashes: append all of them, die on any error.
-  // TODO(ekasper): make tree signer write leaves out to the database,
-  // so that we don't have to read the entries in.
-  std::string leaf_hash;
-  auto it(db_->ScanEntries(cert_tree_.LeafCount()));
-  for (int64_t sequence_number = cert_tree_.LeafCount();
-       sequence_number < sth.tree_size(); ++sequence_number) {
+  const int64_t first(cert_tree_->LeafCount() + leaf_hashes->size());
+  const int64_t last(std::min(tree_size, first + max_entries));
+  leaf_hashes->reserve(leaf_hashes->size() + last - first);
+  // The signer of this node may have handed them over already.
+  const int64_t unread(TakeOfferedLeafHashes(first, last, leaf_hashes));
+  if (unread == last) {
+    return;
+  }
+  auto it(ScanEntriesPrefetching(db_, unread, last - unread));
+  for (int64_t sequence_number = unread; sequence_number < last;
+       ++sequence_number) {
     Logged logged;
     // TODO(ekasper): perhaps some of these errors can/should be
     // handled more gracefully. E.g. we could retry a failed update
     // a number of times -- but until we know under which conditions
     // the database might fail (database busy?), just die.
     CHECK(it->GetNextEntry(&logged))
-        << "Latest STH has " << sth.tree_size() << "entries but we failed to "
+        << "Latest STH has " << tree_size << "entries but we failed to "
         << "retrieve entry number " << sequence_number;
     CHECK(logged.has_sequence_number())
         << "Logged entry has no sequence number";
     CHECK_EQ(sequence_number, logged.sequence_number());
 
-    leaf_hash = LeafHash(logged);
-    // TODO(ekasper): plug in the log public key so that we can verify the STH.
-    CHECK_EQ(sequence_number + 1, cert_tree_.AddLeafHash(leaf_hash));
+    leaf_hashes->emplace_back(LeafHash(logged));
+  }
+}
+
+
+template <class Logged>
+bool LogLookup<Logged>::ExtendsTo(const std::vector<std::string>& leaf_hashes,
+                                  const ct::SignedTreeHead& sth) {
+  // Only the right edge of the tree is needed for this, so do it in a
+  // compact tree rather than touching |cert_tree_|.
+  CompactMerkleTree tree(*cert_tree_, new Sha256Hasher);
+  for (const auto& leaf_hash : leaf_hashes) {
+    tree.AddLeafHash(leaf_hash);
+  }
+  return tree.CurrentRoot() == sth.sha256_root_hash();
+}
+
+
+template <class Logged>
+void LogLookup<Logged>::AppendLeafHashes(
+    const std::vector<std::string>& leaf_hashes) {
+  int64_t sequence_number(cert_tree_->LeafCount());
+  // TODO(ekasper): plug in the log public key so that we can verify the STH.
+  CHECK_EQ(static_cast<size_t>(sequence_number) + leaf_hashes.size(),
+           cert_tree_->AddLeafHashes(leaf_hashes));
+  leaf_index_.Reserve(*cert_tree_, cert_tree_->LeafCount());
+  for (; sequence_number < static_cast<int64_t>(cert_tree_->LeafCount());
+       ++sequence_number) {
     // Duplicate leaves shouldn't really happen but are not a problem either:
     // we just return the Merkle proof of the first occurrence.
-    leaf_index_.insert(
-        std::pair<std::string, int64_t>(leaf_hash, sequence_number));
+    leaf_index_.Add(*cert_tree_, sequence_number);
   }
-  CHECK_EQ(cert_tree_.CurrentRoot(), sth.sha256_root_hash())
-      << "Computed root hash and stored STH root hash do not match";
-  LOG(INFO) << "Found " << sth.tree_size() - latest_tree_head_.tree_size()
-            << " new log entries";
-  latest_tree_head_.CopyFrom(sth);
+}
 
-  const time_t last_update(static_cast<time_t>(
-      latest_tree_head_.timestamp() / cert_trans::kNumMillisPerSecond));
-  char buf[kCtimeBufSize];
-  LOG(INFO) << "Tree successfully updated at " << ctime_r(&last_update, buf);
+
+template <class Logged>
+void LogLookup<Logged>::LoadCheckpoint() {
+  const util::Status status(
+      cert_tree_->LoadCheckpoint(FLAGS_merkle_tree_checkpoint_dir));
+  if (!status.ok()) {
+    LOG(WARNING) << "Could not load the Merkle tree checkpoint, it will be "
+                 << "rebuilt from the database: " << status;
+    return;
+  }
+
+  // The checkpoint is usually of the tree of an STH in the database,
+  // against which it can be checked right away.
+  ct::SignedTreeHead sth;
+  if (db_->LookupTreeHeadBySize(cert_tree_->LeafCount(), &sth) ==
+      ReadOnlyDatabase<Logged>::LOOKUP_OK) {
+    if (cert_tree_->CurrentRoot() != sth.sha256_root_hash()) {
+      LOG(ERROR) << "Merkle tree checkpoint does not match the STH of its "
+                 << "size, rebuilding the tree from scratch.";
+      ResetTree();
+      return;
+    }
+    VLOG(1) << "Merkle tree checkpoint matches the STH of its size.";
+  }
+
+  // The leaf hashes are all in the tree already, no need to go to
+  // the database for them.
+  leaf_index_.Reserve(*cert_tree_, cert_tree_->LeafCount());
+  for (size_t leaf = 0; leaf < cert_tree_->LeafCount(); ++leaf) {
+    leaf_index_.Add(*cert_tree_, leaf);
+  }
+  checkpoint_unverified_ = true;
+  UpdateMemoryGauges();
+  LOG(INFO) << "Loaded " << cert_tree_->LeafCount() << " entries from the "
+            << "Merkle tree checkpoint.";
+}
+
+
+template <class Logged>
+void LogLookup<Logged>::UpdateMemoryGauges() {
+  tree_memory_.Set(cert_tree_->MemoryUsage());
+  leaf_index_memory_.Set(leaf_index_.MemoryUsage());
+}
+
+
+template <class Logged>
+void LogLookup<Logged>::ResetTree() {
+  std::lock_guard<Lock> lock(lock_);
+  cert_tree_.reset(new MerkleTree(new Sha256Hasher));
+  cert_tree_->SetSnapshotCacheSize(FLAGS_merkle_tree_cached_snapshots);
+  cert_tree_->SetMinStoredLevel(FLAGS_merkle_tree_min_stored_level);
+  leaf_index_.Clear();
+  checkpoint_unverified_ = false;
 }
 
 
 template <class Logged>
 typename LogLookup<Logged>::LookupResult LogLookup<Logged>::GetIndex(
     const std::string& merkle_leaf_hash, int64_t* index) {
-  std::unique_lock<std::mutex> lock(lock_);
-  const int64_t myindex(GetIndexInternal(lock, merkle_leaf_hash));
+  ReaderLock lock(&lock_);
+  const int64_t myindex(GetIndexInternal(merkle_leaf_hash));
 
   if (myindex < 0) {
     return NOT_FOUND;
@@ -113,28 +479,65 @@ typename LogLookup<Logged>::LookupResult LogLookup<Logged>::GetIndex(
 }
 
 
+template <class Logged>
+typename LogLookup<Logged>::LookupResult LogLookup<Logged>::LeafHashAtIndex(
+    int64_t index, std::string* leaf_hash) const {
+  ReaderLock lock(&lock_);
+  if (index < 0 || static_cast<size_t>(index) >= cert_tree_->LeafCount()) {
+    return NOT_FOUND;
+  }
+
+  *leaf_hash = cert_tree_->LeafHash(index + 1);
+  return OK;
+}
+
+
+template <class Logged>
+typename LogLookup<Logged>::LookupResult LogLookup<Logged>::SearchEntries(
+    const std::string& search_key, int64_t start_index, size_t max_results,
+    std::vector<int64_t>* indices) const {
+  CHECK_NOTNULL(indices)->clear();
+  int64_t tree_size;
+  {
+    ReaderLock lock(&lock_);
+    tree_size = cert_tree_->LeafCount();
+  }
+
+  if (db_->SearchEntries(search_key, start_index, max_results, indices) !=
+      ReadOnlyDatabase<Logged>::LOOKUP_OK) {
+    return NOT_FOUND;
+  }
+  // The entries not yet in the tree cannot be proven to be in the
+  // log, so they are left out. The indices are in order.
+  while (!indices->empty() && indices->back() >= tree_size) {
+    indices->pop_back();
+  }
+  return OK;
+}
+
+
 // Look up by SHA256-hash of the certificate.
 template <class Logged>
 typename LogLookup<Logged>::LookupResult LogLookup<Logged>::AuditProof(
     const std::string& merkle_leaf_hash, ct::MerkleAuditProof* proof) {
-  std::unique_lock<std::mutex> lock(lock_);
+  ReaderLock lock(&lock_);
 
-  const int64_t leaf_index(GetIndexInternal(lock, merkle_leaf_hash));
+  const int64_t leaf_index(GetIndexInternal(merkle_leaf_hash));
   if (leaf_index < 0) {
     return NOT_FOUND;
   }
 
   CHECK_GE(leaf_index, 0);
   proof->set_version(ct::V1);
-  proof->set_tree_size(cert_tree_.LeafCount());
+  proof->set_tree_size(cert_tree_->LeafCount());
   proof->set_timestamp(latest_tree_head_.timestamp());
   proof->set_leaf_index(leaf_index);
 
   proof->clear_path_node();
-  std::vector<std::string> audit_path =
-      cert_tree_.PathToCurrentRoot(leaf_index + 1);
-  for (size_t i = 0; i < audit_path.size(); ++i)
-    proof->add_path_node(audit_path[i]);
+  std::string audit_path;
+  const size_t path_size(cert_tree_->PathToRootAtSnapshot(
+      leaf_index + 1, cert_tree_->LeafCount(), &audit_path));
+  AddPathNodes(audit_path, path_size, proof);
 
   proof->mutable_id()->CopyFrom(latest_tree_head_.id());
   proof->mutable_tree_head_signature()->CopyFrom(
@@ -146,15 +549,15 @@ typename LogLookup<Logged>::LookupResult LogLookup<Logged>::AuditProof(
 template <class Logged>
 typename LogLookup<Logged>::LookupResult LogLookup<Logged>::AuditProof(
     int64_t leaf_index, size_t tree_size, ct::ShortMerkleAuditProof* proof) {
-  std::lock_guard<std::mutex> lock(lock_);
+  ReaderLock lock(&lock_);
 
   proof->set_leaf_index(leaf_index);
 
   proof->clear_path_node();
-  std::vector<std::string> audit_path =
-      cert_tree_.PathToRootAtSnapshot(leaf_index + 1, tree_size);
-  for (size_t i = 0; i < audit_path.size(); ++i)
-    proof->add_path_node(audit_path[i]);
+  std::string audit_path;
+  const size_t path_size(
+      cert_tree_->PathToRootAtSnapshot(leaf_index + 1, tree_size, &audit_path));
+  AddPathNodes(audit_path, path_size, proof);
 
   return OK;
 }
@@ -174,44 +577,85 @@ typename LogLookup<Logged>::LookupResult LogLookup<Logged>::AuditProof(
 }
 
 
+template <class Logged>
+typename LogLookup<Logged>::LookupResult LogLookup<Logged>::AuditProofs(
+    const std::vector<int64_t>& leaf_indices, size_t tree_size,
+    std::vector<ct::ShortMerkleAuditProof>* proofs) {
+  proofs->clear();
+  std::vector<size_t> leaves;
+  leaves.reserve(leaf_indices.size());
+  for (std::vector<int64_t>::const_iterator it = leaf_indices.begin();
+       it != leaf_indices.end(); ++it) {
+    if (*it < 0 || static_cast<size_t>(*it) >= tree_size)
+      return NOT_FOUND;
+    leaves.push_back(*it + 1);
+  }
+
+  std::string audit_paths;
+  std::vector<size_t> path_sizes;
+  size_t node_size;
+  {
+    ReaderLock lock(&lock_);
+    if (tree_size > cert_tree_->LeafCount())
+      return NOT_FOUND;
+    cert_tree_->PathsToRootAtSnapshot(leaves, tree_size, &audit_paths,
+                                      &path_sizes);
+    node_size = cert_tree_->NodeSize();
+  }
+  CHECK_EQ(leaf_indices.size(), path_sizes.size());
+
+  const char* node(audit_paths.data());
+  proofs->resize(leaf_indices.size());
+  for (size_t i = 0; i < leaf_indices.size(); ++i) {
+    ct::ShortMerkleAuditProof* const proof(&(*proofs)[i]);
+    proof->set_leaf_index(leaf_indices[i]);
+    proof->mutable_path_node()->Reserve(path_sizes[i]);
+    for (size_t j = 0; j < path_sizes[i]; ++j, node += node_size)
+      proof->add_path_node(node, node_size);
+  }
+  CHECK_EQ(audit_paths.data() + audit_paths.size(), node);
+
+  return OK;
+}
+
+
 template <class Logged>
 std::string LogLookup<Logged>::RootAtSnapshot(size_t tree_size) {
-  std::lock_guard<std::mutex> lock(lock_);
-  return cert_tree_.RootAtSnapshot(tree_size);
+  ReaderLock lock(&lock_);
+  return cert_tree_->RootAtSnapshot(tree_size);
 }
 
 
 template <class Logged>
 std::string LogLookup<Logged>::LeafHash(const Logged& logged) const {
-  std::string serialized_leaf;
-  CHECK(logged.SerializeForLeaf(&serialized_leaf));
-  // We do not need to take the lock for this call into cert_tree_, as
-  // this is merely a const forwarder (to another const, thread-safe
-  // method).
-  return cert_tree_.LeafHash(serialized_leaf);
+  std::string leaf_hash;
+  CHECK(logged.LeafHash(&leaf_hash));
+  return leaf_hash;
 }
 
 template <class Logged>
 std::unique_ptr<CompactMerkleTree> LogLookup<Logged>::GetCompactMerkleTree(
     SerialHasher* hasher) {
-  std::lock_guard<std::mutex> lock(lock_);
+  ReaderLock lock(&lock_);
   return std::unique_ptr<CompactMerkleTree>(
-      new CompactMerkleTree(cert_tree_, hasher));
+      new CompactMerkleTree(*cert_tree_, hasher));
+}
+
+template <class Logged>
+template <class Proof>
+void LogLookup<Logged>::AddPathNodes(const std::string& nodes, size_t count,
+                                     Proof* proof) const {
+  const size_t node_size(cert_tree_->NodeSize());
+  CHECK_EQ(nodes.size(), count * node_size);
+  proof->mutable_path_node()->Reserve(count);
+  for (size_t i = 0; i < count; ++i)
+    proof->add_path_node(nodes.data() + i * node_size, node_size);
 }
 
 template <class Logged>
 int64_t LogLookup<Logged>::GetIndexInternal(
-    const std::unique_lock<std::mutex>& lock,
     const std::string& merkle_leaf_hash) const {
-  CHECK(lock.owns_lock());
-
-  const std::map<std::string, int64_t>::const_iterator it(
-      leaf_index_.find(merkle_leaf_hash));
-  if (it == leaf_index_.end())
-    return -1;
-
-  CHECK_GE(it->second, 0);
-  return it->second;
+  return leaf_index_.Find(*cert_tree_, merkle_leaf_hash);
 }
 
 
@@ -2,23 +2,61 @@
 #ifndef LOG_LOOKUP_H
 #define LOG_LOOKUP_H
 
+#include <memory>
+#include <condition_variable>
+#include <deque>
 #include <map>
 #include <mutex>
 #include <stdint.h>
 #include <string>
+#include <thread>
+#include <vector>
 
 #include "base/macros.h"
+#include "base/rw_mutex.h"
 #include "log/database.h"
+#include "log/leaf_index.h"
 #include "merkletree/compact_merkle_tree.h"
 #include "merkletree/merkle_tree.h"
+#include "monitoring/instrumented_mutex.h"
+#include "monitoring/memory_gauge.h"
 #include "proto/ct.pb.h"
 
 // Lookups into the database. Read-only, so could also be a mirror.
 // Keeps the entire Merkle Tree in memory to serve audit proofs.
+//
+// If --merkle_tree_checkpoint_dir is set, the tree is checkpointed
+// there after every update, and reopened from there on startup, so
+// that only the entries added since the last checkpoint have to be
+// read from the database and hashed. With --merkle_tree_min_stored_level,
+// the lower levels of the tree are not kept, but rehashed from the leaf
+// hashes (mapped from the checkpoint, if any) as proofs need them.
+//
+// Lookups only need to hold the lock shared, so they never wait for
+// each other. Updates read and hash the new entries without it, and
+// only hold it exclusively to add them to the tree and publish the
+// new STH.
+//
+// Except for the STH the database has when the lookup is created,
+// which is ingested by the constructor, new STHs are ingested by a
+// background thread, so that the writer of an STH does not wait for
+// its entries to be read and hashed. A burst of new STHs is ingested
+// in one go, and only the most recent of them is published.
+//
+// On the node running the tree signer, the signer hands over the leaf
+// hashes it computed with OfferLeafHashes(), so that the entries it
+// signed do not have to be read back from the database and hashed a
+// second time when their STH is ingested.
+//
+// Most consistency proofs asked for are between recent STHs, so as
+// each STH is ingested, the proofs to it from the previous
+// --log_lookup_precomputed_consistency_proofs STHs are computed, and
+// served without taking the lock.
 template <class Logged>
 class LogLookup {
  public:
-  // The constructor loads the content from the database.
+  // The constructor loads the content from the checkpoint (if any)
+  // and the database.
   explicit LogLookup(ReadOnlyDatabase<Logged>* db);
   ~LogLookup();
 
@@ -29,6 +67,18 @@ class LogLookup {
 
   LookupResult GetIndex(const std::string& merkle_leaf_hash, int64_t* index);
 
+  // The Merkle leaf hash of the entry at |index|, from the in-memory
+  // tree, so without reading the database.
+  LookupResult LeafHashAtIndex(int64_t index, std::string* leaf_hash) const;
+
+  // Sets |indices| to those, from |start_index| on, of up to
+  // |max_results| entries of the current tree with |search_key| (see
+  // log/search_keys.h). Returns NOT_FOUND if the database does not
+  // index its entries by search key.
+  LookupResult SearchEntries(const std::string& search_key,
+                             int64_t start_index, size_t max_results,
+                             std::vector<int64_t>* indices) const;
+
   // Look up by hash of the logged item.
   // TODO(pphaneuf): Looking up an audit proof without a tree size is
   // unreliable in the case of multiple CT servers (some might be
@@ -44,17 +94,30 @@ class LogLookup {
   LookupResult AuditProof(const std::string& merkle_leaf_hash,
                           size_t tree_size, ct::ShortMerkleAuditProof* proof);
 
+  // Look up by indices of the logged items and tree_size, replacing
+  // the contents of |proofs| with one proof per index, in the same
+  // order. The proofs share the work of rehashing the right edge of a
+  // past tree, so this is much cheaper than separate lookups. Returns
+  // NOT_FOUND if any of the indices is not in the tree of |tree_size|.
+  LookupResult AuditProofs(const std::vector<int64_t>& leaf_indices,
+                           size_t tree_size,
+                           std::vector<ct::ShortMerkleAuditProof>* proofs);
+
   // Get a consitency proof between two tree heads
-  std::vector<std::string> ConsistencyProof(size_t first, size_t second) {
-    std::lock_guard<std::mutex> lock(lock_);
-    return cert_tree_.SnapshotConsistency(first, second);
-  }
+  std::vector<std::string> ConsistencyProof(size_t first, size_t second);
 
-  const ct::SignedTreeHead& GetSTH() const {
-    std::lock_guard<std::mutex> lock(lock_);
+  ct::SignedTreeHead GetSTH() const {
+    ReaderLock lock(&lock_);
     return latest_tree_head_;
   }
 
+  // The timestamp of GetSTH(), without copying it, to tell whether it
+  // changed: an STH with the same timestamp as ours is never taken.
+  uint64_t GetSTHTimestamp() const {
+    ReaderLock lock(&lock_);
+    return latest_tree_head_.timestamp();
+  }
+
   std::string RootAtSnapshot(size_t tree_size);
 
   std::string LeafHash(const Logged& logged) const;
@@ -64,23 +127,124 @@ class LogLookup {
   std::unique_ptr<CompactMerkleTree> GetCompactMerkleTree(
       SerialHasher* hasher);
 
- private:
-  void UpdateFromSTH(const ct::SignedTreeHead& sth);
-  int64_t GetIndexInternal(const std::unique_lock<std::mutex>& lock,
-                           const std::string& merkle_leaf_hash) const;
+  // Blocks until the STHs that the database notified us of so far
+  // have been ingested (or rejected).
+  void WaitForUpdates();
+
+  // Hands over |leaf_hashes|, those of the entries from |first| on,
+  // to be used instead of reading these entries from the database
+  // once an STH covering them is ingested. They are still checked
+  // against the root hash of that STH. At most
+  // --log_lookup_max_offered_leaf_hashes are kept: if they are offered
+  // faster than they are ingested, the entries are read from the
+  // database as usual.
+  void OfferLeafHashes(int64_t first,
+                       const std::vector<std::string>& leaf_hashes);
 
-  mutable std::mutex lock_;
+ private:
+  typedef cert_trans::InstrumentedMutex<cert_trans::RwMutex> Lock;
+  typedef cert_trans::BasicReaderLock<Lock> ReaderLock;
+
+  // Called by the database with new STHs, queues them for the updater.
+  void EnqueueSTH(const ct::SignedTreeHead& sth);
+  // Takes the queued STH, if there is one.
+  bool TakePendingSTH(ct::SignedTreeHead* sth);
+  // Ingests the queued STH, if there is one.
+  void UpdateFromPendingSTH();
+  // Runs UpdateFromPendingSTH() as STHs get queued, until the lookup
+  // is destroyed.
+  void UpdaterLoop();
+  // Brings the tree up to |sth|, or to newer STHs that are queued
+  // while reading the entries, which then replace |sth|.
+  void UpdateFromSTH(ct::SignedTreeHead* sth);
+  // Reads up to |max_entries| entries from the database that come
+  // after those in |cert_tree_| and |leaf_hashes|, and below
+  // |tree_size|, and appends their leaf hashes to |leaf_hashes|,
+  // taking the offered ones rather than reading them where possible.
+  // Only needs |update_lock_|.
+  void ReadLeafHashes(int64_t tree_size, int64_t max_entries,
+                      std::vector<std::string>* leaf_hashes);
+  // Appends the offered leaf hashes of the entries from |first| on,
+  // and below |end|, to |leaf_hashes|, and returns the index of the
+  // entry after the last one appended.
+  int64_t TakeOfferedLeafHashes(int64_t first, int64_t end,
+                                std::vector<std::string>* leaf_hashes);
+  // Whether appending |leaf_hashes| to |cert_tree_| gets it to the
+  // root hash of |sth|. Only needs |update_lock_|.
+  bool ExtendsTo(const std::vector<std::string>& leaf_hashes,
+                 const ct::SignedTreeHead& sth);
+  // Appends |leaf_hashes| to |cert_tree_| and |leaf_index_|. Needs
+  // |lock_| held exclusively.
+  void AppendLeafHashes(const std::vector<std::string>& leaf_hashes);
+  // Load the tree from --merkle_tree_checkpoint_dir, if possible.
+  void LoadCheckpoint();
+  // Forget about all the entries.
+  void ResetTree();
+  // Reports the memory used by |cert_tree_| and |leaf_index_|. Only
+  // needs |update_lock_|.
+  void UpdateMemoryGauges();
+  // Computes the consistency proofs to the newly ingested |tree_size|
+  // from the recent tree sizes, and drops those to the older ones.
+  // Only needs |update_lock_|.
+  void PrecomputeConsistencyProofs(int64_t tree_size);
+  // Needs |lock_| held, shared is enough.
+  int64_t GetIndexInternal(const std::string& merkle_leaf_hash) const;
+  // Copies |count| back-to-back nodes from |nodes| into the path of
+  // |proof|.
+  template <class Proof>
+  void AddPathNodes(const std::string& nodes, size_t count,
+                    Proof* proof) const;
+
+  // Held shared by the lookups, and exclusively to modify the tree,
+  // the index and the STH.
+  mutable Lock lock_;
+  // Serializes the updates. As they are the only ones modifying the
+  // state, holding this is enough to read it.
+  std::mutex update_lock_;
   // We keep a hash -> index mapping in memory so that we can quickly serve
   // Merkle proofs without having to query the database at all.
-  // Note that 32 bytes is an overkill and we can optimize this to use
-  // a shorter prefix (possibly with a multimap).
-  std::map<std::string, int64_t> leaf_index_;
+  cert_trans::LeafIndex leaf_index_;
 
   ReadOnlyDatabase<Logged>* const db_;
-  MerkleTree cert_tree_;
+  std::unique_ptr<MerkleTree> cert_tree_;
+  cert_trans::MemoryGauge tree_memory_;
+  cert_trans::MemoryGauge leaf_index_memory_;
+  // True if |cert_tree_| was loaded from a checkpoint, and has not
+  // been checked against an STH from the database yet.
+  bool checkpoint_unverified_;
   ct::SignedTreeHead latest_tree_head_;
 
+  // Protects the fields below, which queue the new STHs for
+  // |updater_|.
+  std::mutex pending_lock_;
+  std::condition_variable pending_cv_;
+  bool stopping_;
+  bool has_pending_sth_;
+  ct::SignedTreeHead pending_sth_;
+  // How many STHs were notified, how many of them were taken from
+  // the queue, and how many of those have been ingested, for
+  // WaitForUpdates().
+  uint64_t num_notified_;
+  uint64_t num_taken_;
+  uint64_t num_ingested_;
+  std::condition_variable ingested_cv_;
+
+  // Protects the leaf hashes handed over by OfferLeafHashes(), those
+  // of the entries from |offered_first_| on.
+  std::mutex offered_lock_;
+  int64_t offered_first_;
+  std::deque<std::string> offered_leaf_hashes_;
+
+  // The tree sizes of the most recent STHs, oldest first, and the
+  // consistency proofs between them, by their first and second tree
+  // sizes, guarded by |consistency_lock_| rather than |lock_|.
+  std::mutex consistency_lock_;
+  std::deque<int64_t> recent_tree_sizes_;
+  std::map<std::pair<int64_t, int64_t>, std::vector<std::string>>
+      consistency_proofs_;
+
   const typename Database<Logged>::NotifySTHCallback update_from_sth_cb_;
+  std::thread updater_;
 
   DISALLOW_COPY_AND_ASSIGN(LogLookup);
 };
@@ -1,4 +1,35 @@
+#include <gflags/gflags.h>
+
 #include "log/log_lookup-inl.h"
 #include "log/logged_certificate.h"
 
+DEFINE_int32(log_lookup_update_batch_size, 10000,
+             "number of new entries to read from the database at a time "
+             "when updating the in-memory Merkle tree; newer STHs are "
+             "picked up in between batches");
+DEFINE_int32(log_lookup_max_offered_leaf_hashes, 1000000,
+             "maximum number of leaf hashes handed over by the tree signer "
+             "to keep until the STH covering them is ingested; past that, "
+             "the entries are read from the database instead");
+DEFINE_int32(log_lookup_precomputed_consistency_proofs, 4,
+             "number of previous STHs from which to compute the "
+             "consistency proof to each new STH as it is ingested, so that "
+             "these common requests are served without taking the lock of "
+             "the in-memory Merkle tree");
+DEFINE_string(merkle_tree_checkpoint_dir, "",
+              "directory in which to checkpoint the in-memory Merkle tree, "
+              "so that it does not have to be rebuilt from the database on "
+              "startup; if empty, the tree is not checkpointed");
+DEFINE_int32(merkle_tree_cached_snapshots, 8,
+             "number of recent STH tree sizes for which to cache the right "
+             "edge of the Merkle tree, so that proofs against them need no "
+             "rehashing");
+DEFINE_int32(merkle_tree_min_stored_level, 1,
+             "lowest interior level of the in-memory Merkle tree to keep; "
+             "the nodes below it are rehashed from the leaf hashes when "
+             "proofs need them, which saves most of the memory used by the "
+             "interior nodes at the cost of up to about "
+             "2^merkle_tree_min_stored_level hashes per proof. Changing it "
+             "invalidates the --merkle_tree_checkpoint_dir checkpoint");
+
 template class LogLookup<cert_trans::LoggedCertificate>;
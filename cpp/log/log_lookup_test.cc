@@ -2,6 +2,7 @@
 #include <gtest/gtest.h>
 #include <memory>
 #include <string>
+#include <vector>
 
 #include "log/etcd_consistent_store.h"
 #include "log/file_db.h"
@@ -14,6 +15,7 @@
 #include "log/test_db.h"
 #include "log/test_signer.h"
 #include "log/tree_signer.h"
+#include "merkletree/merkle_tree.h"
 #include "merkletree/merkle_verifier.h"
 #include "merkletree/serial_hasher.h"
 #include "util/fake_etcd.h"
@@ -164,6 +166,21 @@ TYPED_TEST(LogLookupTest, NotFound) {
 }
 
 
+TYPED_TEST(LogLookupTest, LeafHashAtIndex) {
+  LoggedCertificate logged_cert;
+  this->test_signer_.CreateUnique(&logged_cert);
+  this->CreateSequencedEntry(&logged_cert, 0);
+  this->UpdateTree();
+
+  LL lookup(this->db());
+  string leaf_hash;
+  EXPECT_EQ(LL::OK, lookup.LeafHashAtIndex(0, &leaf_hash));
+  EXPECT_EQ(lookup.LeafHash(logged_cert), leaf_hash);
+  EXPECT_EQ(LL::NOT_FOUND, lookup.LeafHashAtIndex(1, &leaf_hash));
+  EXPECT_EQ(LL::NOT_FOUND, lookup.LeafHashAtIndex(-1, &leaf_hash));
+}
+
+
 TYPED_TEST(LogLookupTest, Update) {
   LL lookup(this->db());
   LoggedCertificate logged_cert;
@@ -172,12 +189,101 @@ TYPED_TEST(LogLookupTest, Update) {
 
   MerkleAuditProof proof;
   this->UpdateTree();
+  lookup.WaitForUpdates();
 
   // Look the new entry up.
   EXPECT_EQ(LL::OK, lookup.AuditProof(logged_cert.merkle_leaf_hash(), &proof));
 }
 
 
+// New STHs are ingested in the background, possibly several at once.
+TYPED_TEST(LogLookupTest, UpdateMany) {
+  LL lookup(this->db());
+  LoggedCertificate logged_certs[8];
+  for (int i = 0; i < 8; ++i) {
+    this->test_signer_.CreateUnique(&logged_certs[i]);
+    this->CreateSequencedEntry(&logged_certs[i], i);
+    this->UpdateTree();
+  }
+  lookup.WaitForUpdates();
+
+  EXPECT_EQ(this->tree_signer_.LatestSTH().DebugString(),
+            lookup.GetSTH().DebugString());
+  MerkleAuditProof proof;
+  for (int i = 0; i < 8; ++i) {
+    EXPECT_EQ(LL::OK,
+              lookup.AuditProof(logged_certs[i].merkle_leaf_hash(), &proof));
+    EXPECT_EQ(LogVerifier::VERIFY_OK,
+              this->verifier_.VerifyMerkleAuditProof(logged_certs[i].entry(),
+                                                     logged_certs[i].sct(),
+                                                     proof));
+  }
+}
+
+
+// The leaf hashes handed over by the signer are used instead of the
+// entries, which are not even in the database here.
+TYPED_TEST(LogLookupTest, UsesOfferedLeafHashes) {
+  LL lookup(this->db());
+  std::vector<string> leaf_hashes;
+  CompactMerkleTree tree(new Sha256Hasher);
+  for (int i = 0; i < 3; ++i) {
+    LoggedCertificate logged_cert;
+    this->test_signer_.CreateUnique(&logged_cert);
+    leaf_hashes.emplace_back(lookup.LeafHash(logged_cert));
+    tree.AddLeafHash(leaf_hashes.back());
+  }
+  lookup.OfferLeafHashes(0, leaf_hashes);
+
+  ct::SignedTreeHead sth;
+  sth.set_version(ct::V1);
+  sth.set_timestamp(util::TimeInMilliseconds());
+  sth.set_tree_size(tree.LeafCount());
+  sth.set_sha256_root_hash(tree.CurrentRoot());
+  EXPECT_EQ(DB::OK, this->db()->WriteTreeHead(sth));
+  lookup.WaitForUpdates();
+
+  EXPECT_EQ(3, lookup.GetSTH().tree_size());
+  for (int i = 0; i < 3; ++i) {
+    string leaf_hash;
+    EXPECT_EQ(LL::OK, lookup.LeafHashAtIndex(i, &leaf_hash));
+    EXPECT_EQ(leaf_hashes[i], leaf_hash);
+  }
+}
+
+
+// The consistency proofs between the recent STHs, which are computed
+// as they are ingested, are the same as those computed on demand.
+TYPED_TEST(LogLookupTest, ConsistencyProofs) {
+  LL lookup(this->db());
+  MerkleTree tree(new Sha256Hasher);
+  const uint64_t timestamp(util::TimeInMilliseconds());
+  for (int size = 1; size <= 7; ++size) {
+    LoggedCertificate logged_cert;
+    this->test_signer_.CreateUnique(&logged_cert);
+    const string leaf_hash(lookup.LeafHash(logged_cert));
+    tree.AddLeafHash(leaf_hash);
+    lookup.OfferLeafHashes(size - 1, std::vector<string>(1, leaf_hash));
+
+    ct::SignedTreeHead sth;
+    sth.set_version(ct::V1);
+    sth.set_timestamp(timestamp + size);
+    sth.set_tree_size(size);
+    sth.set_sha256_root_hash(tree.CurrentRoot());
+    EXPECT_EQ(DB::OK, this->db()->WriteTreeHead(sth));
+    lookup.WaitForUpdates();
+  }
+
+  for (size_t first = 0; first <= 7; ++first) {
+    for (size_t second = first; second <= 7; ++second) {
+      EXPECT_EQ(tree.SnapshotConsistency(first, second),
+                lookup.ConsistencyProof(first, second))
+          << first << " " << second;
+    }
+  }
+}
+
+
 // Verify that the audit proof constructed is correct (assuming the signer
 // operates correctly). TODO(ekasper): KAT tests.
 TYPED_TEST(LogLookupTest, Verify) {
@@ -223,6 +329,37 @@ TYPED_TEST(LogLookupTest, VerifyWithPath) {
 }
 
 
+
+TYPED_TEST(LogLookupTest, AuditProofs) {
+  LoggedCertificate logged_certs[13];
+  for (int i = 0; i < 13; ++i) {
+    this->test_signer_.CreateUnique(&logged_certs[i]);
+    this->CreateSequencedEntry(&logged_certs[i], i);
+  }
+
+  this->UpdateTree();
+
+  LL lookup(this->db());
+  std::vector<ct::ShortMerkleAuditProof> proofs;
+
+  // The current tree, and a past one that has to be rehashed.
+  for (size_t tree_size : {13, 6}) {
+    std::vector<int64_t> indices;
+    for (size_t i = 0; i < tree_size; ++i)
+      indices.push_back((i * 5) % tree_size);
+    EXPECT_EQ(LL::OK, lookup.AuditProofs(indices, tree_size, &proofs));
+    ASSERT_EQ(indices.size(), proofs.size());
+    for (size_t i = 0; i < indices.size(); ++i) {
+      ct::ShortMerkleAuditProof proof;
+      EXPECT_EQ(LL::OK, lookup.AuditProof(indices[i], tree_size, &proof));
+      EXPECT_EQ(proof.DebugString(), proofs[i].DebugString());
+    }
+  }
+
+  EXPECT_EQ(LL::NOT_FOUND, lookup.AuditProofs({0, 6}, 6, &proofs));
+  EXPECT_EQ(LL::NOT_FOUND, lookup.AuditProofs({0}, 14, &proofs));
+}
+
 }  // namespace
 
 
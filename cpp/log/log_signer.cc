@@ -5,10 +5,13 @@
 #include <openssl/evp.h>
 #include <openssl/opensslv.h>
 #include <stdint.h>
+#include <utility>
 
 #include "merkletree/serial_hasher.h"
 #include "proto/ct.pb.h"
 #include "proto/serializer.h"
+#include "util/status.h"
+#include "util/task.h"
 #include "util/util.h"
 
 using cert_trans::Verifier;
@@ -18,6 +21,9 @@ using ct::LogEntryType;
 using ct::SignedCertificateTimestamp;
 using ct::SignedTreeHead;
 using std::string;
+using std::unique_ptr;
+using std::vector;
+using util::Status;
 
 #if OPENSSL_VERSION_NUMBER < 0x10000000
 #error "Need OpenSSL >= 1.0.0"
@@ -44,9 +50,43 @@ LogSigVerifier::VerifyResult ConvertStatus(const Verifier::Status status) {
 LogSigner::LogSigner(EVP_PKEY* pkey) : cert_trans::Signer(pkey) {
 }
 
+LogSigner::LogSigner(unique_ptr<cert_trans::Signer> backend)
+    : backend_(std::move(backend)) {
+  CHECK(backend_);
+}
+
 LogSigner::~LogSigner() {
 }
 
+string LogSigner::KeyID() const {
+  if (backend_)
+    return backend_->KeyID();
+  return cert_trans::Signer::KeyID();
+}
+
+void LogSigner::Sign(const string& data, DigitallySigned* signature) const {
+  if (backend_)
+    backend_->Sign(data, signature);
+  else
+    cert_trans::Signer::Sign(data, signature);
+}
+
+void LogSigner::SignBatch(const vector<string>& data,
+                          const vector<DigitallySigned*>& signatures) const {
+  if (backend_)
+    backend_->SignBatch(data, signatures);
+  else
+    cert_trans::Signer::SignBatch(data, signatures);
+}
+
+void LogSigner::SignAsync(const string& data, DigitallySigned* signature,
+                          util::Task* task) const {
+  if (backend_)
+    backend_->SignAsync(data, signature, task);
+  else
+    cert_trans::Signer::SignAsync(data, signature, task);
+}
+
 LogSigner::SignResult LogSigner::SignV1CertificateTimestamp(
     uint64_t timestamp, const string& leaf_certificate,
     const string& extensions, string* result) const {
@@ -104,6 +144,52 @@ LogSigner::SignResult LogSigner::SignCertificateTimestamp(
   return OK;
 }
 
+void LogSigner::SignCertificateTimestamp(const LogEntry& entry,
+                                         SignedCertificateTimestamp* sct,
+                                         util::Task* task) const {
+  CHECK(sct->has_timestamp())
+      << "Attempt to sign an SCT with a missing timestamp";
+
+  string serialized_input;
+  Serializer::SerializeResult res =
+      Serializer::SerializeSCTSignatureInput(*sct, entry, &serialized_input);
+
+  if (res != Serializer::OK) {
+    task->Return(Status(util::error::INVALID_ARGUMENT,
+                        "cannot serialize the SCT signature input"));
+    return;
+  }
+  SignAsync(serialized_input, sct->mutable_signature(),
+            task->AddChild([this, sct, task](util::Task* child_task) {
+              if (child_task->status().ok())
+                sct->mutable_id()->set_key_id(KeyID());
+              task->Return(child_task->status());
+            }));
+}
+
+LogSigner::SignResult LogSigner::SignCertificateTimestamps(
+    const vector<const LogEntry*>& entries,
+    const vector<SignedCertificateTimestamp*>& scts) const {
+  CHECK_EQ(entries.size(), scts.size());
+  vector<string> serialized_inputs(entries.size());
+  vector<DigitallySigned*> signatures(entries.size());
+  for (size_t i = 0; i < entries.size(); ++i) {
+    CHECK(scts[i]->has_timestamp())
+        << "Attempt to sign an SCT with a missing timestamp";
+    Serializer::SerializeResult res =
+        Serializer::SerializeSCTSignatureInput(*scts[i], *entries[i],
+                                               &serialized_inputs[i]);
+    if (res != Serializer::OK)
+      return GetSerializeError(res);
+    signatures[i] = scts[i]->mutable_signature();
+  }
+
+  SignBatch(serialized_inputs, signatures);
+  for (SignedCertificateTimestamp* sct : scts)
+    sct->mutable_id()->set_key_id(KeyID());
+  return OK;
+}
+
 LogSigner::SignResult LogSigner::SignV1TreeHead(uint64_t timestamp,
                                                 int64_t tree_size,
                                                 const string& root_hash,
@@ -3,7 +3,9 @@
 
 #include <openssl/evp.h>
 #include <openssl/x509.h>  // for i2d_PUBKEY
+#include <memory>
 #include <stdint.h>
+#include <vector>
 
 #include "log/signer.h"
 #include "log/verifier.h"
@@ -13,8 +15,24 @@
 class LogSigner : public cert_trans::Signer {
  public:
   explicit LogSigner(EVP_PKEY* pkey);
+  // Signs with |backend| rather than with a local key, e.g. to keep
+  // the key in an HSM or with a remote signing service. Takes
+  // ownership of |backend|.
+  explicit LogSigner(std::unique_ptr<cert_trans::Signer> backend);
   virtual ~LogSigner();
 
+  std::string KeyID() const override;
+
+  void Sign(const std::string& data,
+            ct::DigitallySigned* signature) const override;
+
+  void SignBatch(
+      const std::vector<std::string>& data,
+      const std::vector<ct::DigitallySigned*>& signatures) const override;
+
+  void SignAsync(const std::string& data, ct::DigitallySigned* signature,
+                 util::Task* task) const override;
+
   enum SignResult {
     OK,
     INVALID_ENTRY_TYPE,
@@ -46,6 +64,21 @@ class LogSigner : public cert_trans::Signer {
   SignResult SignCertificateTimestamp(
       const ct::LogEntry& entry, ct::SignedCertificateTimestamp* sct) const;
 
+  // Same as above, but signs with SignAsync(), and returns through
+  // |task|, with INVALID_ARGUMENT if |entry| cannot be serialized.
+  // |sct| must remain valid until |task| is done.
+  void SignCertificateTimestamp(const ct::LogEntry& entry,
+                                ct::SignedCertificateTimestamp* sct,
+                                util::Task* task) const;
+
+  // Same as calling SignCertificateTimestamp() for each of |entries|
+  // and the corresponding |scts|, but in a single SignBatch(). If an
+  // entry cannot be serialized, returns its error without signing
+  // anything.
+  SignResult SignCertificateTimestamps(
+      const std::vector<const ct::LogEntry*>& entries,
+      const std::vector<ct::SignedCertificateTimestamp*>& scts) const;
+
   SignResult SignV1TreeHead(uint64_t timestamp, int64_t tree_size,
                             const std::string& root_hash,
                             std::string* result) const;
@@ -54,6 +87,9 @@ class LogSigner : public cert_trans::Signer {
 
  private:
   static SignResult GetSerializeError(Serializer::SerializeResult result);
+
+  // If set, does the signing instead of the local key.
+  const std::unique_ptr<cert_trans::Signer> backend_;
 };
 
 class LogSigVerifier : public cert_trans::Verifier {
@@ -1,14 +1,19 @@
 /* -*- indent-tabs-mode: nil -*- */
 #include <glog/logging.h>
 #include <gtest/gtest.h>
+#include <memory>
 #include <stdint.h>
 #include <string>
+#include <vector>
 
 #include "log/log_signer.h"
 #include "log/test_signer.h"
 #include "proto/ct.pb.h"
 #include "proto/serializer.h"
+#include "util/status.h"
+#include "util/sync_task.h"
 #include "util/testing.h"
+#include "util/thread_pool.h"
 #include "util/util.h"
 
 namespace {
@@ -18,12 +23,45 @@ using ct::SignedCertificateTimestamp;
 using ct::DigitallySigned;
 using ct::SignedTreeHead;
 using std::string;
+using std::unique_ptr;
+using std::vector;
+using util::Status;
+using util::SyncTask;
 
 // A slightly shorter notation for constructing hex strings from binary blobs.
 string H(const string& byte_string) {
   return util::HexString(byte_string);
 }
 
+// A signing backend which signs with |signer| on another thread, the
+// way one holding its key remotely would return later.
+class ThreadPoolSigner : public cert_trans::Signer {
+ public:
+  ThreadPoolSigner(cert_trans::Signer* signer, cert_trans::ThreadPool* pool)
+      : signer_(signer), pool_(pool) {
+  }
+
+  string KeyID() const override {
+    return signer_->KeyID();
+  }
+
+  void Sign(const string& data, DigitallySigned* signature) const override {
+    signer_->Sign(data, signature);
+  }
+
+  void SignAsync(const string& data, DigitallySigned* signature,
+                 util::Task* task) const override {
+    pool_->Add([this, data, signature, task]() {
+      signer_->Sign(data, signature);
+      task->Return(Status::OK);
+    });
+  }
+
+ private:
+  const unique_ptr<cert_trans::Signer> signer_;
+  cert_trans::ThreadPool* const pool_;
+};
+
 class LogSignerTest : public ::testing::Test {
  protected:
   LogSignerTest() : signer_(NULL), verifier_(NULL) {
@@ -151,6 +189,54 @@ TEST_F(LogSignerTest, SignAndVerifyCertSCT) {
                 default_sct.extensions(), serialized_sig));
 }
 
+TEST_F(LogSignerTest, SignAndVerifyCertSCTBatch) {
+  vector<LogEntry> entries(3);
+  vector<SignedCertificateTimestamp> scts(entries.size());
+  vector<const LogEntry*> entry_ptrs;
+  vector<SignedCertificateTimestamp*> sct_ptrs;
+  for (size_t i = 0; i < entries.size(); ++i) {
+    test_signer_.CreateUnique(&entries[i]);
+    TestSigner::SetDefaults(&scts[i]);
+    scts[i].clear_signature();
+    entry_ptrs.push_back(&entries[i]);
+    sct_ptrs.push_back(&scts[i]);
+  }
+
+  EXPECT_EQ(LogSigner::OK,
+            signer_->SignCertificateTimestamps(entry_ptrs, sct_ptrs));
+  for (size_t i = 0; i < entries.size(); ++i) {
+    EXPECT_EQ(signer_->KeyID(), scts[i].id().key_id());
+    EXPECT_EQ(LogSigVerifier::OK,
+              verifier_->VerifySCTSignature(entries[i], scts[i]));
+  }
+}
+
+TEST_F(LogSignerTest, SignAndVerifyCertSCTWithBackend) {
+  cert_trans::ThreadPool pool(1);
+  const LogSigner signer(unique_ptr<cert_trans::Signer>(
+      new ThreadPoolSigner(TestSigner::DefaultSigner(), &pool)));
+  EXPECT_EQ(signer_->KeyID(), signer.KeyID());
+
+  LogEntry entry;
+  test_signer_.CreateUnique(&entry);
+  SignedCertificateTimestamp sct;
+  TestSigner::SetDefaults(&sct);
+  sct.clear_signature();
+  sct.clear_id();
+
+  EXPECT_EQ(LogSigner::OK, signer.SignCertificateTimestamp(entry, &sct));
+  EXPECT_EQ(LogSigVerifier::OK, verifier_->VerifySCTSignature(entry, sct));
+
+  sct.clear_signature();
+  sct.clear_id();
+  SyncTask task(&pool);
+  signer.SignCertificateTimestamp(entry, &sct, task.task());
+  task.Wait();
+  EXPECT_EQ(Status::OK, task.status());
+  EXPECT_EQ(signer_->KeyID(), sct.id().key_id());
+  EXPECT_EQ(LogSigVerifier::OK, verifier_->VerifySCTSignature(entry, sct));
+}
+
 TEST_F(LogSignerTest, SignAndVerifyPrecertSCT) {
   LogEntry default_entry;
   TestSigner::SetPrecertDefaults(&default_entry);
@@ -1,13 +1,17 @@
 #include "log/log_verifier.h"
 
+#include <algorithm>
+#include <atomic>
 #include <glog/logging.h>
 #include <stdint.h>
 
+#include "base/notification.h"
 #include "log/cert_submission_handler.h"
 #include "log/log_signer.h"
 #include "merkletree/merkle_verifier.h"
 #include "proto/ct.pb.h"
 #include "proto/serializer.h"
+#include "util/executor.h"
 #include "util/util.h"
 
 using ct::LogEntry;
@@ -15,6 +19,7 @@ using ct::MerkleAuditProof;
 using ct::SignedCertificateTimestamp;
 using ct::SignedTreeHead;
 using std::string;
+using std::vector;
 
 LogVerifier::LogVerifier(LogSigVerifier* sig_verifier,
                          MerkleVerifier* merkle_verifier)
@@ -55,6 +60,21 @@ LogVerifier::VerifyResult LogVerifier::VerifySignedCertificateTimestamp(
                                           merkle_leaf_hash);
 }
 
+vector<LogVerifier::VerifyResult>
+LogVerifier::VerifySignedCertificateTimestamps(
+    const vector<const LogEntry*>& entries,
+    const vector<const SignedCertificateTimestamp*>& scts,
+    util::Executor* executor, size_t num_tasks) const {
+  CHECK_EQ(entries.size(), scts.size());
+  // The same upper bound for all the entries.
+  const uint64_t end_range(util::TimeInMilliseconds() + 1000);
+  return VerifyInParallel(entries.size(), executor, num_tasks,
+                          [this, &entries, &scts, end_range](size_t i) {
+                            return VerifySignedCertificateTimestamp(
+                                *entries[i], *scts[i], 0, end_range);
+                          });
+}
+
 LogVerifier::VerifyResult LogVerifier::VerifySignedTreeHead(
     const SignedTreeHead& sth, uint64_t begin_range,
     uint64_t end_range) const {
@@ -112,6 +132,51 @@ LogVerifier::VerifyResult LogVerifier::VerifyMerkleAuditProof(
   return VERIFY_OK;
 }
 
+vector<LogVerifier::VerifyResult> LogVerifier::VerifyMerkleAuditProofs(
+    const vector<const LogEntry*>& entries,
+    const vector<const SignedCertificateTimestamp*>& scts,
+    const vector<const MerkleAuditProof*>& proofs, util::Executor* executor,
+    size_t num_tasks) const {
+  CHECK_EQ(entries.size(), scts.size());
+  CHECK_EQ(entries.size(), proofs.size());
+  return VerifyInParallel(entries.size(), executor, num_tasks,
+                          [this, &entries, &scts, &proofs](size_t i) {
+                            return VerifyMerkleAuditProof(*entries[i],
+                                                          *scts[i],
+                                                          *proofs[i]);
+                          });
+}
+
+/* static */
+vector<LogVerifier::VerifyResult> LogVerifier::VerifyInParallel(
+    size_t count, util::Executor* executor, size_t num_tasks,
+    const std::function<VerifyResult(size_t index)>& verify) {
+  CHECK_NOTNULL(executor);
+  CHECK_GT(num_tasks, 0U);
+  vector<VerifyResult> results(count, VERIFY_OK);
+  if (count == 0)
+    return results;
+
+  num_tasks = std::min(num_tasks, count);
+  const size_t per_task((count + num_tasks - 1) / num_tasks);
+  // Each closure writes to its own range of |results|, so they need no
+  // locking.
+  std::atomic<size_t> remaining(num_tasks);
+  cert_trans::Notification done;
+  for (size_t task = 0; task < num_tasks; ++task) {
+    const size_t begin(std::min(count, task * per_task));
+    const size_t end(std::min(count, begin + per_task));
+    executor->Add([begin, end, &verify, &results, &remaining, &done]() {
+      for (size_t i = begin; i < end; ++i)
+        results[i] = verify(i);
+      if (--remaining == 0)
+        done.Notify();
+    });
+  }
+  done.WaitForNotification();
+  return results;
+}
+
 /* static */
 bool LogVerifier::IsBetween(uint64_t timestamp, uint64_t earliest,
                             uint64_t latest) {
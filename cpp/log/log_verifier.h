@@ -2,8 +2,11 @@
 #ifndef LOG_VERIFIER_H
 #define LOG_VERIFIER_H
 
+#include <functional>
 #include <glog/logging.h>
 #include <stdint.h>
+#include <string>
+#include <vector>
 
 #include "base/macros.h"
 #include "log/log_signer.h"
@@ -11,8 +14,11 @@
 
 class MerkleVerifier;
 
+namespace util {
+class Executor;
+}  // namespace util
+
 // A verifier for verifying signed statements of the log.
-// TODO(ekasper): unit tests.
 class LogVerifier {
  public:
   LogVerifier(LogSigVerifier* sig_verifier, MerkleVerifier* tree_verifier);
@@ -85,6 +91,16 @@ class LogVerifier {
     return VerifySignedCertificateTimestamp(entry, sct, NULL);
   }
 
+  // Same as calling VerifySignedCertificateTimestamp() for each of
+  // |entries| and the corresponding |scts|, but with the work split
+  // into up to |num_tasks| closures run on |executor|, for auditing a
+  // large number of entries. The results are in the same order as
+  // |entries|. Blocks until they are all verified.
+  std::vector<VerifyResult> VerifySignedCertificateTimestamps(
+      const std::vector<const ct::LogEntry*>& entries,
+      const std::vector<const ct::SignedCertificateTimestamp*>& scts,
+      util::Executor* executor, size_t num_tasks) const;
+
   // Verify that the timestamp is in the given range,
   // and the signature is valid.
   // Timestamps are given in milliseconds, since January 1, 1970,
@@ -105,6 +121,15 @@ class LogVerifier {
       const ct::LogEntry& entry, const ct::SignedCertificateTimestamp& sct,
       const ct::MerkleAuditProof& merkle_proof) const;
 
+  // Same as calling VerifyMerkleAuditProof() for each of |entries| and
+  // the corresponding |scts| and |proofs|, split over |executor| the
+  // same way as VerifySignedCertificateTimestamps().
+  std::vector<VerifyResult> VerifyMerkleAuditProofs(
+      const std::vector<const ct::LogEntry*>& entries,
+      const std::vector<const ct::SignedCertificateTimestamp*>& scts,
+      const std::vector<const ct::MerkleAuditProof*>& proofs,
+      util::Executor* executor, size_t num_tasks) const;
+
   bool VerifyConsistency(const ct::SignedTreeHead& sth1,
                          const ct::SignedTreeHead& sth2,
                          const std::vector<std::string>& proof) const;
@@ -116,6 +141,13 @@ class LogVerifier {
   static bool IsBetween(uint64_t timestamp, uint64_t earliest,
                         uint64_t latest);
 
+  // Calls |verify| for each index below |count|, split into up to
+  // |num_tasks| closures on |executor|, and returns the results in
+  // order.
+  static std::vector<VerifyResult> VerifyInParallel(
+      size_t count, util::Executor* executor, size_t num_tasks,
+      const std::function<VerifyResult(size_t index)>& verify);
+
   DISALLOW_COPY_AND_ASSIGN(LogVerifier);
 };
 #endif
@@ -0,0 +1,141 @@
+/* -*- indent-tabs-mode: nil -*- */
+#include "log/log_verifier.h"
+
+#include <gtest/gtest.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "log/log_signer.h"
+#include "log/test_signer.h"
+#include "merkletree/merkle_tree.h"
+#include "merkletree/merkle_verifier.h"
+#include "merkletree/serial_hasher.h"
+#include "proto/ct.pb.h"
+#include "proto/serializer.h"
+#include "util/testing.h"
+#include "util/thread_pool.h"
+#include "util/util.h"
+
+namespace {
+
+using cert_trans::ThreadPool;
+using ct::LogEntry;
+using ct::MerkleAuditProof;
+using ct::SignedCertificateTimestamp;
+using ct::SignedTreeHead;
+using std::string;
+using std::unique_ptr;
+using std::vector;
+
+const size_t kNumEntries = 20;
+
+
+class LogVerifierTest : public ::testing::Test {
+ protected:
+  LogVerifierTest()
+      : signer_(TestSigner::DefaultLogSigner()),
+        verifier_(TestSigner::DefaultLogSigVerifier(),
+                  new MerkleVerifier(new Sha256Hasher)),
+        pool_(4),
+        entries_(kNumEntries),
+        scts_(kNumEntries) {
+    for (size_t i = 0; i < kNumEntries; ++i) {
+      test_signer_.CreateUnique(&entries_[i]);
+      scts_[i].set_version(ct::V1);
+      scts_[i].set_timestamp(util::TimeInMilliseconds());
+      CHECK_EQ(LogSigner::OK,
+               signer_->SignCertificateTimestamp(entries_[i], &scts_[i]));
+      entry_ptrs_.push_back(&entries_[i]);
+      sct_ptrs_.push_back(&scts_[i]);
+    }
+  }
+
+  const unique_ptr<LogSigner> signer_;
+  LogVerifier verifier_;
+  TestSigner test_signer_;
+  ThreadPool pool_;
+  vector<LogEntry> entries_;
+  vector<SignedCertificateTimestamp> scts_;
+  vector<const LogEntry*> entry_ptrs_;
+  vector<const SignedCertificateTimestamp*> sct_ptrs_;
+};
+
+
+TEST_F(LogVerifierTest, VerifySCTsInOrder) {
+  // Break a few of them, which must be reported at the same index.
+  scts_[3].mutable_signature()->mutable_signature()->append("x");
+  scts_[11].set_timestamp(util::TimeInMilliseconds() + 3600 * 1000);
+
+  for (const size_t num_tasks : {1, 3, 64}) {
+    const vector<LogVerifier::VerifyResult> results(
+        verifier_.VerifySignedCertificateTimestamps(entry_ptrs_, sct_ptrs_,
+                                                    &pool_, num_tasks));
+    ASSERT_EQ(kNumEntries, results.size());
+    for (size_t i = 0; i < kNumEntries; ++i) {
+      EXPECT_EQ(verifier_.VerifySignedCertificateTimestamp(entries_[i],
+                                                           scts_[i]),
+                results[i])
+          << i;
+    }
+    EXPECT_EQ(LogVerifier::INVALID_SIGNATURE, results[3]);
+    EXPECT_EQ(LogVerifier::INVALID_TIMESTAMP, results[11]);
+    EXPECT_EQ(LogVerifier::VERIFY_OK, results[kNumEntries - 1]);
+  }
+
+  EXPECT_TRUE(verifier_.VerifySignedCertificateTimestamps({}, {}, &pool_, 4)
+                  .empty());
+}
+
+
+TEST_F(LogVerifierTest, VerifyAuditProofsInOrder) {
+  MerkleTree tree(new Sha256Hasher);
+  for (size_t i = 0; i < kNumEntries; ++i) {
+    string leaf;
+    CHECK_EQ(Serializer::OK, Serializer::SerializeSCTMerkleTreeLeaf(
+                                 scts_[i], entries_[i], &leaf));
+    tree.AddLeaf(leaf);
+  }
+
+  SignedTreeHead sth;
+  sth.set_version(ct::V1);
+  sth.set_timestamp(util::TimeInMilliseconds());
+  sth.set_tree_size(tree.LeafCount());
+  sth.set_sha256_root_hash(tree.CurrentRoot());
+  CHECK_EQ(LogSigner::OK, signer_->SignTreeHead(&sth));
+
+  vector<MerkleAuditProof> proofs(kNumEntries);
+  vector<const MerkleAuditProof*> proof_ptrs;
+  for (size_t i = 0; i < kNumEntries; ++i) {
+    proofs[i].set_version(ct::V1);
+    proofs[i].mutable_id()->CopyFrom(sth.id());
+    proofs[i].set_tree_size(sth.tree_size());
+    proofs[i].set_timestamp(sth.timestamp());
+    proofs[i].mutable_tree_head_signature()->CopyFrom(sth.signature());
+    proofs[i].set_leaf_index(i);
+    for (const string& node : tree.PathToCurrentRoot(i + 1))
+      proofs[i].add_path_node(node);
+    proof_ptrs.push_back(&proofs[i]);
+  }
+  // Swap two of the paths, which then do not lead to the signed root.
+  proofs[5].mutable_path_node()->SwapElements(0, 1);
+
+  const vector<LogVerifier::VerifyResult> results(
+      verifier_.VerifyMerkleAuditProofs(entry_ptrs_, sct_ptrs_, proof_ptrs,
+                                        &pool_, 4));
+  ASSERT_EQ(kNumEntries, results.size());
+  for (size_t i = 0; i < kNumEntries; ++i) {
+    EXPECT_EQ(i == 5 ? LogVerifier::INVALID_SIGNATURE : LogVerifier::VERIFY_OK,
+              results[i])
+        << i;
+  }
+}
+
+
+}  // namespace
+
+
+int main(int argc, char** argv) {
+  cert_trans::test::InitTesting(argv[0], &argc, &argv, true);
+  return RUN_ALL_TESTS();
+}
@@ -1,10 +1,453 @@
 #include "log/logged_certificate.h"
 
+#include <limits.h>
+#include <stdint.h>
+#include <utility>
+
+#include "log/search_keys.h"
+#include "merkletree/tree_hasher.h"
+
 using ct::LogEntry;
+using ct::LoggedCertificatePB;
 using ct::PreCert;
 using ct::SignedCertificateTimestamp;
+using std::function;
+using std::pair;
+using std::string;
+using std::vector;
 
 namespace cert_trans {
+namespace {
+
+
+// The chain of |entry|, or NULL if it has none.
+google::protobuf::RepeatedPtrField<string>* MutableChain(LogEntry* entry) {
+  if (entry->type() == ct::X509_ENTRY && entry->has_x509_entry()) {
+    return entry->mutable_x509_entry()->mutable_certificate_chain();
+  }
+  if (entry->type() == ct::PRECERT_ENTRY && entry->has_precert_entry()) {
+    return entry->mutable_precert_entry()->mutable_precertificate_chain();
+  }
+  return NULL;
+}
+
+
+bool HasLeafCertificate(const LogEntry& entry) {
+  switch (entry.type()) {
+    case ct::X509_ENTRY:
+      return entry.x509_entry().has_leaf_certificate();
+    case ct::PRECERT_ENTRY:
+      return entry.precert_entry().pre_cert().has_tbs_certificate();
+    default:
+      return false;
+  }
+}
+
+
+// The records written by SerializeRecord() start with a 0 byte, which
+// no serialized protobuf does (it would be a field number of 0), so
+// that the entries stored before them can be told apart. Then come:
+//
+//   version              1 byte
+//   flags                1 byte
+//   sequence number      8 bytes
+//   SCT timestamp        8 bytes
+//   Hash()               32 bytes
+//   leaf hash            32 bytes
+//   lengths              4 bytes each, of the leaf input, extra data,
+//                        SCT and rest, which follow in that order
+//
+// The SCT is a serialized protobuf, and the rest is the entry, or only
+// its contents, serialized without the fields that are elsewhere in the
+// record. Integers are big-endian, and fields that are not set are
+// zeroes.
+const char kRecordVersion = 1;
+const size_t kRecordFlagsOffset = 2;
+const size_t kRecordSequenceNumberOffset = 3;
+const size_t kRecordTimestampOffset = 11;
+const size_t kRecordHashOffset = 19;
+const size_t kRecordLeafHashOffset = 51;
+const size_t kRecordLengthsOffset = 83;
+const size_t kRecordHeaderLength = 99;
+const size_t kHashLength = 32;
+
+enum RecordFlags {
+  kHasSequenceNumber = 1 << 0,
+  kHasHash = 1 << 1,
+  kHasLeafHash = 1 << 2,
+  kHasLeafInput = 1 << 3,
+  kHasExtraData = 1 << 4,
+  kHasSCT = 1 << 5,
+  // The rest is a LoggedCertificatePB, rather than its contents.
+  kWholeEntry = 1 << 6,
+};
+
+
+bool IsRecord(const char* data, size_t size) {
+  return size > 0 && data[0] == '\0';
+}
+
+
+// Checks the header of a record, and sets |lengths| to those of its
+// four parts.
+bool ReadRecordHeader(const char* data, size_t size, size_t lengths[4]) {
+  if (size < kRecordHeaderLength || data[1] != kRecordVersion) {
+    return false;
+  }
+  size_t total(kRecordHeaderLength);
+  for (int i = 0; i < 4; ++i) {
+    lengths[i] = 0;
+    for (int j = 0; j < 4; ++j) {
+      lengths[i] = (lengths[i] << 8) |
+                   static_cast<unsigned char>(
+                       data[kRecordLengthsOffset + i * 4 + j]);
+    }
+    total += lengths[i];
+  }
+  return total == size;
+}
+
+
+uint64_t ReadUint64(const char* data) {
+  uint64_t value(0);
+  for (int i = 0; i < 8; ++i) {
+    value = (value << 8) | static_cast<unsigned char>(data[i]);
+  }
+  return value;
+}
+
+
+void AppendUint(uint64_t value, size_t bytes, string* dst) {
+  dst->append(Serializer::SerializeUint(value, bytes));
+}
+
+
+}  // namespace
+
+
+LoggedCertificate::LoggedCertificate(const LoggedCertificate& other)
+    : LoggedCertificatePB(other) {
+  std::lock_guard<std::mutex> lock(other.hash_mutex_);
+  hash_ = other.hash_;
+}
+
+
+LoggedCertificate& LoggedCertificate::operator=(
+    const LoggedCertificate& other) {
+  if (this == &other) {
+    return *this;
+  }
+  LoggedCertificatePB::operator=(other);
+  string hash;
+  {
+    std::lock_guard<std::mutex> lock(other.hash_mutex_);
+    hash = other.hash_;
+  }
+  std::lock_guard<std::mutex> lock(hash_mutex_);
+  hash_.swap(hash);
+  return *this;
+}
+
+
+string LoggedCertificate::Hash() const {
+  std::lock_guard<std::mutex> lock(hash_mutex_);
+  if (hash_.empty()) {
+    hash_ = HasBody() ? Sha256Hasher::Sha256Digest(
+                            Serializer::LeafCertificate(entry()))
+                      : contents().body_hash();
+  }
+  return hash_;
+}
+
+
+bool LoggedCertificate::ParseFromDatabase(const char* data, size_t size) {
+  CHECK_LE(size, static_cast<size_t>(INT_MAX));
+  if (IsRecord(data, size)) {
+    return ParseRecord(data, size);
+  }
+  return mutable_contents()->ParseFromArray(data, size);
+}
+
+
+bool LoggedCertificate::ParseFromStorage(const char* data, size_t size) {
+  CHECK_LE(size, static_cast<size_t>(INT_MAX));
+  if (IsRecord(data, size)) {
+    return ParseRecord(data, size);
+  }
+  return ParseFromArray(data, size);
+}
+
+
+// static
+bool LoggedCertificate::ReadStorageKey(const char* data, size_t size,
+                                       int64_t* sequence_number,
+                                       string* hash) {
+  size_t lengths[4];
+  if (IsRecord(data, size)) {
+    const int flags(data[kRecordFlagsOffset]);
+    if (!ReadRecordHeader(data, size, lengths) ||
+        !(flags & kHasSequenceNumber) || !(flags & kHasHash)) {
+      return false;
+    }
+    *sequence_number = ReadUint64(data + kRecordSequenceNumberOffset);
+    hash->assign(data + kRecordHashOffset, kHashLength);
+    return true;
+  }
+
+  LoggedCertificate logged;
+  if (!logged.ParseFromStorage(data, size) || !logged.has_sequence_number()) {
+    return false;
+  }
+  *sequence_number = logged.sequence_number();
+  *hash = logged.Hash();
+  return true;
+}
+
+
+// static
+bool LoggedCertificate::SameStoredEntry(const string& a, const string& b) {
+  if (a == b) {
+    return true;
+  }
+  LoggedCertificate logged_a, logged_b;
+  return logged_a.ParseFromStorage(a) && logged_b.ParseFromStorage(b) &&
+         logged_a == logged_b;
+}
+
+
+bool LoggedCertificate::SerializeRecord(bool whole_entry, string* dst) const {
+  LoggedCertificatePB rest;
+  LoggedCertificatePB::Contents* const rest_contents(rest.mutable_contents());
+  if (whole_entry && has_merkle_leaf_hash()) {
+    rest.set_merkle_leaf_hash(merkle_leaf_hash());
+  }
+  if (contents().has_entry()) {
+    *rest_contents->mutable_entry() = entry();
+  }
+  if (contents().has_chain_interned()) {
+    rest_contents->set_chain_interned(contents().chain_interned());
+  }
+  if (contents().has_body_hash()) {
+    rest_contents->set_body_hash(contents().body_hash());
+  }
+  const bool leaf_hash_in_header(contents().has_leaf_hash() &&
+                                 contents().leaf_hash().size() == kHashLength);
+  if (contents().has_leaf_hash() && !leaf_hash_in_header) {
+    rest_contents->set_leaf_hash(contents().leaf_hash());
+  }
+
+  string flat_sct, flat_rest;
+  if ((contents().has_sct() && !sct().SerializeToString(&flat_sct)) ||
+      !(whole_entry ? rest.SerializeToString(&flat_rest)
+                    : rest_contents->SerializeToString(&flat_rest))) {
+    return false;
+  }
+  const string& leaf_input(contents().leaf_input());
+  const string& extra_data(contents().extra_data());
+  const string* const parts[] = {&leaf_input, &extra_data, &flat_sct,
+                                 &flat_rest};
+  for (const string* part : parts) {
+    CHECK_LE(part->size(), static_cast<size_t>(UINT32_MAX));
+  }
+
+  const bool has_hash(!HasBody() || HasLeafCertificate(entry()));
+  const int flags(
+      (whole_entry && has_sequence_number() ? kHasSequenceNumber : 0) |
+      (has_hash ? kHasHash : 0) | (leaf_hash_in_header ? kHasLeafHash : 0) |
+      (contents().has_leaf_input() ? kHasLeafInput : 0) |
+      (contents().has_extra_data() ? kHasExtraData : 0) |
+      (contents().has_sct() ? kHasSCT : 0) | (whole_entry ? kWholeEntry : 0));
+
+  dst->clear();
+  dst->reserve(kRecordHeaderLength + leaf_input.size() + extra_data.size() +
+               flat_sct.size() + flat_rest.size());
+  dst->push_back('\0');
+  dst->push_back(kRecordVersion);
+  dst->push_back(static_cast<char>(flags));
+  AppendUint(flags & kHasSequenceNumber ? sequence_number() : 0, 8, dst);
+  AppendUint(sct().timestamp(), 8, dst);
+  if (has_hash) {
+    const string hash(Hash());
+    CHECK_EQ(kHashLength, hash.size());
+    dst->append(hash);
+  } else {
+    dst->append(kHashLength, '\0');
+  }
+  if (leaf_hash_in_header) {
+    dst->append(contents().leaf_hash());
+  } else {
+    dst->append(kHashLength, '\0');
+  }
+  CHECK_EQ(kRecordLengthsOffset, dst->size());
+  for (const string* part : parts) {
+    AppendUint(part->size(), 4, dst);
+  }
+  for (const string* part : parts) {
+    dst->append(*part);
+  }
+  return true;
+}
+
+
+bool LoggedCertificate::ParseRecord(const char* data, size_t size) {
+  size_t lengths[4];
+  if (!ReadRecordHeader(data, size, lengths)) {
+    return false;
+  }
+  const int flags(data[kRecordFlagsOffset]);
+  const char* const leaf_input(data + kRecordHeaderLength);
+  const char* const extra_data(leaf_input + lengths[0]);
+  const char* const flat_sct(extra_data + lengths[1]);
+  const char* const flat_rest(flat_sct + lengths[2]);
+
+  if (flags & kWholeEntry) {
+    if (!ParseFromArray(flat_rest, lengths[3])) {
+      return false;
+    }
+    if (flags & kHasSequenceNumber) {
+      set_sequence_number(ReadUint64(data + kRecordSequenceNumberOffset));
+    }
+  } else if (!mutable_contents()->ParseFromArray(flat_rest, lengths[3])) {
+    return false;
+  }
+
+  LoggedCertificatePB::Contents* const contents(mutable_contents());
+  if ((flags & kHasSCT) &&
+      !contents->mutable_sct()->ParseFromArray(flat_sct, lengths[2])) {
+    return false;
+  }
+  if (flags & kHasLeafInput) {
+    contents->set_leaf_input(leaf_input, lengths[0]);
+  }
+  if (flags & kHasExtraData) {
+    contents->set_extra_data(extra_data, lengths[1]);
+  }
+  if (flags & kHasLeafHash) {
+    contents->set_leaf_hash(data + kRecordLeafHashOffset, kHashLength);
+  }
+  // Saves hashing the entry again.
+  if (flags & kHasHash) {
+    std::lock_guard<std::mutex> lock(hash_mutex_);
+    hash_.assign(data + kRecordHashOffset, kHashLength);
+  }
+  return true;
+}
+
+
+bool LoggedCertificate::LeafHash(string* dst) const {
+  if (contents().has_leaf_hash()) {
+    *dst = contents().leaf_hash();
+    return true;
+  }
+  string buffer;
+  const string* const leaf_input(LeafInput(&buffer));
+  if (!leaf_input) {
+    return false;
+  }
+  *dst = TreeHasher(new Sha256Hasher).HashLeaf(*leaf_input);
+  return true;
+}
+
+
+bool LoggedCertificate::CacheLeafHash() {
+  mutable_contents()->clear_leaf_hash();
+  string leaf_hash;
+  if (!LeafHash(&leaf_hash)) {
+    return false;
+  }
+  mutable_contents()->set_leaf_hash(leaf_hash);
+  return true;
+}
+
+
+void LoggedCertificate::SearchKeys(vector<string>* keys) const {
+  // The chain is only there as digests if it is interned, so the
+  // issuer key of a certificate is then left out.
+  EntrySearchKeys(entry(), keys);
+}
+
+
+void LoggedCertificate::InternChain(vector<pair<string, string>>* chain) {
+  CHECK_NOTNULL(chain);
+  google::protobuf::RepeatedPtrField<string>* const certs(
+      MutableChain(mutable_entry()));
+  if (contents().chain_interned() || !certs || certs->size() == 0) {
+    return;
+  }
+
+  for (string& cert : *certs) {
+    string digest(Sha256Hasher::Sha256Digest(cert));
+    chain->emplace_back(digest, std::move(cert));
+    cert.swap(digest);
+  }
+  mutable_contents()->clear_extra_data();
+  mutable_contents()->set_chain_interned(true);
+}
+
+
+void LoggedCertificate::ClearBody() {
+  if (!HasBody()) {
+    return;
+  }
+  const string hash(Hash());
+  mutable_contents()->clear_entry();
+  mutable_contents()->clear_leaf_input();
+  mutable_contents()->clear_extra_data();
+  mutable_contents()->clear_chain_interned();
+  mutable_contents()->set_body_hash(hash);
+}
+
+
+bool LoggedCertificate::RestoreBody(const LoggedCertificate& body) {
+  CHECK(!HasBody());
+  if (!body.HasBody() || body.Hash() != contents().body_hash()) {
+    return false;
+  }
+
+  LoggedCertificatePB::Contents stub;
+  stub.Swap(mutable_contents());
+  *mutable_contents() = body.contents();
+  if (sct().SerializeAsString() != stub.sct().SerializeAsString()) {
+    // The leaf is serialized with its SCT.
+    mutable_contents()->clear_leaf_input();
+    mutable_sct()->Swap(stub.mutable_sct());
+  }
+  if (stub.has_leaf_hash()) {
+    mutable_contents()->set_leaf_hash(stub.leaf_hash());
+  } else {
+    mutable_contents()->clear_leaf_hash();
+  }
+  return true;
+}
+
+
+bool LoggedCertificate::RestoreChain(
+    const function<bool(const string& digest, string* cert)>& lookup) {
+  google::protobuf::RepeatedPtrField<string>* const digests(
+      MutableChain(mutable_entry()));
+  if (!contents().chain_interned() || !digests) {
+    return true;
+  }
+
+  for (string& digest : *digests) {
+    string cert;
+    if (!lookup(digest, &cert)) {
+      return false;
+    }
+    digest.swap(cert);
+  }
+  mutable_contents()->clear_chain_interned();
+  // The extra data is cached along with the leaf input, put it back
+  // as it was.
+  if (contents().has_leaf_input()) {
+    string extra_data;
+    if (!SerializeExtraData(&extra_data)) {
+      return false;
+    }
+    mutable_contents()->set_extra_data(extra_data);
+  }
+  return true;
+}
 
 
 bool LoggedCertificate::CopyFromClientLogEntry(
@@ -3,7 +3,13 @@
 #ifndef LOGGED_CERTIFICATE_H
 #define LOGGED_CERTIFICATE_H
 
+#include <functional>
 #include <glog/logging.h>
+#include <limits.h>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
 
 #include "client/async_log_client.h"
 #include "merkletree/serial_hasher.h"
@@ -15,9 +21,17 @@ namespace cert_trans {
 
 class LoggedCertificate : public ct::LoggedCertificatePB {
  public:
-  std::string Hash() const {
-    return Sha256Hasher::Sha256Digest(Serializer::LeafCertificate(entry()));
-  }
+  LoggedCertificate() = default;
+  LoggedCertificate(const LoggedCertificate& other);
+  LoggedCertificate& operator=(const LoggedCertificate& other);
+
+  // The SHA-256 digest of the leaf certificate, which identifies the
+  // entry (for a stub left by ClearBody(), that of the body it had).
+  // It is computed once, and kept until the entry is changed through
+  // mutable_entry(), mutable_contents(), clear_contents(), Swap() or
+  // the ParseFrom*() methods below, which must be the only ways the
+  // entry is changed.
+  std::string Hash() const;
 
   uint64_t timestamp() const {
     return sct().timestamp();
@@ -28,7 +42,8 @@ class LoggedCertificate : public ct::LoggedCertificatePB {
   }
 
   ct::SignedCertificateTimestamp* mutable_sct() {
-    return mutable_contents()->mutable_sct();
+    // The SCT is not part of Hash().
+    return LoggedCertificatePB::mutable_contents()->mutable_sct();
   }
 
   const ct::LogEntry& entry() const {
@@ -39,20 +54,115 @@ class LoggedCertificate : public ct::LoggedCertificatePB {
     return mutable_contents()->mutable_entry();
   }
 
+  ct::LoggedCertificatePB::Contents* mutable_contents() {
+    ClearCachedHash();
+    return LoggedCertificatePB::mutable_contents();
+  }
+
+  void clear_contents() {
+    ClearCachedHash();
+    LoggedCertificatePB::clear_contents();
+  }
+
+  bool ParseFromString(const std::string& data) {
+    ClearCachedHash();
+    return LoggedCertificatePB::ParseFromString(data);
+  }
+
+  bool ParseFromArray(const void* data, int size) {
+    ClearCachedHash();
+    return LoggedCertificatePB::ParseFromArray(data, size);
+  }
+
+  void Swap(LoggedCertificate* other) {
+    ClearCachedHash();
+    other->ClearCachedHash();
+    LoggedCertificatePB::Swap(other);
+  }
+
+  // The contents, as a record like those of SerializeForStorage(),
+  // without the sequence number.
   bool SerializeForDatabase(std::string* dst) const {
-    return contents().SerializeToString(dst);
+    return SerializeRecord(false, dst);
   }
 
   bool ParseFromDatabase(const std::string& src) {
-    return mutable_contents()->ParseFromString(src);
+    return ParseFromDatabase(src.data(), src.size());
+  }
+
+  // Parses straight from a buffer owned by the database, rather than
+  // from a copy of it. Also takes the serialized contents, as they
+  // were stored before records were.
+  bool ParseFromDatabase(const char* data, size_t size);
+
+  // The whole entry, as the databases store it: a record with the
+  // sequence number, timestamp, Hash() and leaf hash in a fixed-size
+  // header, followed by the leaf input, extra data, SCT and the rest
+  // of the entry, for those to be read without parsing all of it.
+  bool SerializeForStorage(std::string* dst) const {
+    return SerializeRecord(true, dst);
+  }
+
+  bool ParseFromStorage(const std::string& src) {
+    return ParseFromStorage(src.data(), src.size());
   }
 
+  // Parses what SerializeForStorage() wrote, or what
+  // SerializeToString() did, as entries were stored before records.
+  bool ParseFromStorage(const char* data, size_t size);
+
+  // Reads the sequence number and Hash() of an entry stored with
+  // SerializeForStorage(), only from the header of its record if it
+  // has one. Returns false if it does not parse or has no sequence
+  // number.
+  static bool ReadStorageKey(const char* data, size_t size,
+                             int64_t* sequence_number, std::string* hash);
+
+  // Whether |a| and |b|, each stored with SerializeForStorage() or
+  // from before records, are the same entry.
+  static bool SameStoredEntry(const std::string& a, const std::string& b);
+
   bool SerializeForLeaf(std::string* dst) const {
+    if (contents().has_leaf_input()) {
+      *dst = contents().leaf_input();
+      return true;
+    }
     return Serializer::SerializeSCTMerkleTreeLeaf(sct(), entry(), dst) ==
            Serializer::OK;
   }
 
+  // The result of SerializeForLeaf(), without copying it if it is
+  // cached in the contents, or else serialized into |buffer|. Returns
+  // NULL if it cannot be serialized.
+  const std::string* LeafInput(std::string* buffer) const {
+    if (contents().has_leaf_input()) {
+      return &contents().leaf_input();
+    }
+    return SerializeForLeaf(buffer) ? buffer : NULL;
+  }
+
+  // The Merkle tree leaf hash of the entry, as stored by
+  // CacheLeafHash(), or else computed from SerializeForLeaf().
+  bool LeafHash(std::string* dst) const;
+
+  // Stores the leaf hash in the contents, so that it is kept with the
+  // entry through the consistent store and the database, and the
+  // signer and lookups do not have to serialize and hash the entry
+  // again. The SCT and the entry must not be modified afterwards.
+  bool CacheLeafHash();
+
+  // Sets |keys| to those the entry is indexed under for searches, see
+  // EntrySearchKeys().
+  void SearchKeys(std::vector<std::string>* keys) const;
+
   bool SerializeExtraData(std::string* dst) const {
+    if (contents().has_extra_data()) {
+      *dst = contents().extra_data();
+      return true;
+    }
+    // Only the digests of the chain are here.
+    if (contents().chain_interned())
+      return false;
     if (entry().type() == ct::X509_ENTRY)
       return Serializer::SerializeX509Chain(entry().x509_entry(), dst) ==
              Serializer::OK;
@@ -61,6 +171,60 @@ class LoggedCertificate : public ct::LoggedCertificatePB {
                                                     dst) == Serializer::OK;
   }
 
+  // Like LeafInput(), for SerializeExtraData().
+  const std::string* ExtraData(std::string* buffer) const {
+    if (contents().has_extra_data()) {
+      return &contents().extra_data();
+    }
+    return SerializeExtraData(buffer) ? buffer : NULL;
+  }
+
+  // Stores the results of SerializeForLeaf() and SerializeExtraData()
+  // in the contents, so that they are kept in the database and do not
+  // have to be recomputed every time the entry is served. The SCT and
+  // the entry must not be modified afterwards. If the chain is
+  // interned, only the leaf is stored, and RestoreChain() puts the
+  // extra data back.
+  bool CacheSerializations() {
+    std::string leaf_input, extra_data;
+    if (!SerializeForLeaf(&leaf_input))
+      return false;
+    if (!contents().chain_interned() && !SerializeExtraData(&extra_data))
+      return false;
+    LoggedCertificatePB::mutable_contents()->set_leaf_input(leaf_input);
+    if (!contents().chain_interned())
+      LoggedCertificatePB::mutable_contents()->set_extra_data(extra_data);
+    return true;
+  }
+
+  // Replaces each certificate of the chain with its SHA-256 digest,
+  // and appends the (digest, certificate) pairs to |chain|, for the
+  // certificates to be stored apart from the entry. The cached extra
+  // data, which includes the chain, is dropped. Does nothing if the
+  // chain is empty or already interned.
+  void InternChain(
+      std::vector<std::pair<std::string, std::string>>* chain);
+
+  // Undoes InternChain(), getting each certificate from its digest
+  // with |lookup|. Returns false if |lookup| does. Does nothing if the
+  // chain is not interned.
+  bool RestoreChain(const std::function<bool(const std::string& digest,
+                                             std::string* cert)>& lookup);
+
+  // Replaces this entry with a stub of its SCT and cached leaf hash,
+  // keeping its Hash() instead of the rest, for the entry to be stored
+  // apart. Does nothing if it is a stub already.
+  void ClearBody();
+
+  bool HasBody() const {
+    return !contents().has_body_hash();
+  }
+
+  // Undoes ClearBody(), from |body|, a copy of the entry from before.
+  // The SCT of the stub is kept, in case |body| was stored with
+  // another SCT. Returns false if |body| is not the same entry.
+  bool RestoreBody(const LoggedCertificate& body);
+
   // Note that this method will not fully populate the SCT.
   bool CopyFromClientLogEntry(const AsyncLogClient::Entry& entry);
 
@@ -114,6 +278,20 @@ class LoggedCertificate : public ct::LoggedCertificatePB {
       }
     }
   }
+
+ private:
+  bool SerializeRecord(bool whole_entry, std::string* dst) const;
+  bool ParseRecord(const char* data, size_t size);
+
+  void ClearCachedHash() {
+    std::lock_guard<std::mutex> lock(hash_mutex_);
+    hash_.clear();
+  }
+
+  // The result of Hash(), or empty if it has not been computed since
+  // the entry was last changed.
+  mutable std::mutex hash_mutex_;
+  mutable std::string hash_;
 };
 
 
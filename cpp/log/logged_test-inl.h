@@ -96,6 +96,172 @@ TYPED_TEST(LoggedTest, DifferentMerkleSerialization) {
   EXPECT_NE(s1, s2);
 }
 
+TYPED_TEST(LoggedTest, CachedSerializationsArePreserved) {
+  TypeParam l1;
+  l1.RandomForTest();
+
+  std::string s1;
+  EXPECT_TRUE(l1.SerializeForLeaf(&s1));
+
+  TypeParam l2(l1);
+  EXPECT_TRUE(l2.CacheSerializations());
+  // Caching again is harmless.
+  EXPECT_TRUE(l2.CacheSerializations());
+
+  std::string d2;
+  EXPECT_TRUE(l2.SerializeForDatabase(&d2));
+
+  TypeParam l3;
+  EXPECT_TRUE(l3.ParseFromDatabase(d2));
+
+  std::string s3;
+  EXPECT_TRUE(l3.SerializeForLeaf(&s3));
+  EXPECT_EQ(s1, s3);
+  EXPECT_EQ(l1.Hash(), l3.Hash());
+}
+
+TYPED_TEST(LoggedTest, CachedLeafHashIsPreserved) {
+  TypeParam l1;
+  l1.RandomForTest();
+
+  std::string h1;
+  EXPECT_TRUE(l1.LeafHash(&h1));
+
+  TypeParam l2(l1);
+  EXPECT_TRUE(l2.CacheLeafHash());
+
+  std::string d2;
+  EXPECT_TRUE(l2.SerializeForDatabase(&d2));
+
+  TypeParam l3;
+  EXPECT_TRUE(l3.ParseFromDatabase(d2));
+
+  std::string h3;
+  EXPECT_TRUE(l3.LeafHash(&h3));
+  EXPECT_EQ(h1, h3);
+}
+
+TYPED_TEST(LoggedTest, BodyIsRestored) {
+  TypeParam l1;
+  l1.RandomForTest();
+  EXPECT_TRUE(l1.CacheLeafHash());
+
+  TypeParam stub(l1);
+  stub.ClearBody();
+  EXPECT_FALSE(stub.HasBody());
+  EXPECT_FALSE(stub.contents().has_entry());
+  EXPECT_EQ(l1.timestamp(), stub.timestamp());
+
+  TypeParam other;
+  other.RandomForTest();
+  EXPECT_FALSE(stub.RestoreBody(other));
+
+  EXPECT_TRUE(stub.RestoreBody(l1));
+  EXPECT_TRUE(stub.HasBody());
+  EXPECT_EQ(l1.Hash(), stub.Hash());
+  std::string h1, h2;
+  EXPECT_TRUE(l1.LeafHash(&h1));
+  EXPECT_TRUE(stub.LeafHash(&h2));
+  EXPECT_EQ(h1, h2);
+}
+
+TYPED_TEST(LoggedTest, HashFollowsChanges) {
+  TypeParam l1, l2;
+  l1.RandomForTest();
+  l2.RandomForTest();
+  const std::string h1(l1.Hash());
+  const std::string h2(l2.Hash());
+  EXPECT_NE(h1, h2);
+
+  TypeParam copy(l1);
+  EXPECT_EQ(h1, copy.Hash());
+  copy = l2;
+  EXPECT_EQ(h2, copy.Hash());
+
+  std::string s1;
+  EXPECT_TRUE(l1.SerializeToString(&s1));
+  EXPECT_TRUE(copy.ParseFromString(s1));
+  EXPECT_EQ(h1, copy.Hash());
+
+  copy.Swap(&l2);
+  EXPECT_EQ(h2, copy.Hash());
+  EXPECT_EQ(h1, l2.Hash());
+
+  *copy.mutable_entry() = l1.entry();
+  EXPECT_EQ(h1, copy.Hash());
+  copy.mutable_sct()->set_timestamp(l1.timestamp() + 1);
+  EXPECT_EQ(h1, copy.Hash());
+
+  TypeParam stub(l1);
+  stub.ClearBody();
+  EXPECT_EQ(h1, stub.Hash());
+}
+
+TYPED_TEST(LoggedTest, StorageRoundTrip) {
+  TypeParam l1;
+  l1.RandomForTest();
+  l1.set_sequence_number(42);
+  std::string s1;
+  EXPECT_TRUE(l1.SerializeForStorage(&s1));
+
+  TypeParam l2;
+  EXPECT_TRUE(l2.ParseFromStorage(s1));
+  EXPECT_EQ(l1, l2);
+
+  // With all the fields the record keeps apart.
+  EXPECT_TRUE(l1.CacheLeafHash());
+  EXPECT_TRUE(l1.CacheSerializations());
+  EXPECT_TRUE(l1.SerializeForStorage(&s1));
+  EXPECT_TRUE(l2.ParseFromStorage(s1));
+  EXPECT_EQ(l1, l2);
+  EXPECT_EQ(l1.Hash(), l2.Hash());
+
+  int64_t seq;
+  std::string hash;
+  EXPECT_TRUE(TypeParam::ReadStorageKey(s1.data(), s1.size(), &seq, &hash));
+  EXPECT_EQ(42, seq);
+  EXPECT_EQ(l1.Hash(), hash);
+
+  s1.resize(s1.size() - 1);
+  EXPECT_FALSE(l2.ParseFromStorage(s1));
+}
+
+TYPED_TEST(LoggedTest, ReadsEntriesStoredBeforeRecords) {
+  TypeParam l1;
+  l1.RandomForTest();
+  l1.set_sequence_number(42);
+  EXPECT_TRUE(l1.CacheSerializations());
+  std::string old_format, record;
+  EXPECT_TRUE(l1.SerializeToString(&old_format));
+  EXPECT_TRUE(l1.SerializeForStorage(&record));
+  EXPECT_NE(old_format, record);
+
+  TypeParam l2;
+  EXPECT_TRUE(l2.ParseFromStorage(old_format));
+  EXPECT_EQ(l1, l2);
+
+  int64_t seq;
+  std::string hash;
+  EXPECT_TRUE(TypeParam::ReadStorageKey(old_format.data(), old_format.size(),
+                                        &seq, &hash));
+  EXPECT_EQ(42, seq);
+  EXPECT_EQ(l1.Hash(), hash);
+
+  EXPECT_TRUE(TypeParam::SameStoredEntry(old_format, record));
+  TypeParam other;
+  other.RandomForTest();
+  other.set_sequence_number(42);
+  EXPECT_TRUE(other.SerializeForStorage(&record));
+  EXPECT_FALSE(TypeParam::SameStoredEntry(old_format, record));
+
+  std::string old_contents;
+  EXPECT_TRUE(l1.contents().SerializeToString(&old_contents));
+  TypeParam l3;
+  EXPECT_TRUE(l3.ParseFromDatabase(old_contents));
+  EXPECT_EQ(l1.contents().SerializeAsString(),
+            l3.contents().SerializeAsString());
+}
+
 int main(int argc, char** argv) {
   cert_trans::test::InitTesting(argv[0], &argc, &argv, true);
   srand(time(NULL));
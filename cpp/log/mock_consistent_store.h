@@ -18,6 +18,8 @@ class MockConsistentStore : public ConsistentStore<Logged> {
 
   MOCK_METHOD1_T(AddPendingEntry, util::Status(Logged* entry));
 
+  MOCK_METHOD2_T(AddPendingEntryAsync, void(Logged* entry, util::Task* task));
+
   MOCK_CONST_METHOD2_T(GetPendingEntryForHash,
                        util::Status(const std::string& hash,
                                     EntryHandle<Logged>* entry));
@@ -0,0 +1,211 @@
+#ifndef CERT_TRANS_LOG_PREFETCHING_ITERATOR_H_
+#define CERT_TRANS_LOG_PREFETCHING_ITERATOR_H_
+
+#include <algorithm>
+#include <condition_variable>
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <thread>
+#include <vector>
+
+#include "base/macros.h"
+#include "log/database.h"
+
+DECLARE_int64(database_bulk_scan_entries);
+DECLARE_int32(database_prefetch_entries);
+
+
+// Wraps a database iterator, to read the next block of entries from
+// it on a background thread while the current one is being used.
+// This is for callers that go through long ranges of entries, and do
+// some work on each one, like hashing it.
+//
+// At most |limit| entries are read ahead, after which the entries are
+// read from the wrapped iterator when they are asked for, as they
+// would be without the wrapper. This is also done once the wrapped
+// iterator has run out of entries, so that it gets asked again each
+// time, as it would without the wrapper.
+template <class Logged>
+class PrefetchingIterator : public ReadOnlyDatabase<Logged>::Iterator {
+ public:
+  typedef typename ReadOnlyDatabase<Logged>::Iterator Iterator;
+
+  PrefetchingIterator(std::unique_ptr<Iterator> it, size_t block_size,
+                      int64_t limit);
+  ~PrefetchingIterator() override;
+
+  bool GetNextEntry(Logged* entry) override;
+
+  size_t GetNextEntries(size_t max_entries,
+                        std::vector<Logged>* entries) override;
+
+ private:
+  // Runs on |thread_|.
+  void Prefetch();
+  // Makes the next block of entries current, and returns false if it
+  // is empty.
+  bool NextBlock();
+
+  const std::unique_ptr<Iterator> it_;
+  const size_t block_size_;
+  const int64_t limit_;
+
+  std::mutex lock_;
+  std::condition_variable cond_;
+  // The block read by |thread_|, if |next_ready_|.
+  std::vector<Logged> next_block_;
+  bool next_ready_;
+  // Set with the last block |thread_| reads.
+  bool prefetch_done_;
+  bool stopping_;
+
+  // The block being used, from |current_pos_|. Only used by the
+  // caller's thread.
+  std::vector<Logged> current_;
+  size_t current_pos_;
+
+  std::thread thread_;
+
+  DISALLOW_COPY_AND_ASSIGN(PrefetchingIterator);
+};
+
+
+// Returns an iterator scanning |db| from |start_index|, which reads
+// up to |limit| entries ahead in the background, in blocks of
+// --database_prefetch_entries, or does not if that flag is 0. Scans
+// of at least --database_bulk_scan_entries use ScanEntriesBulk().
+template <class Logged>
+std::unique_ptr<typename ReadOnlyDatabase<Logged>::Iterator>
+ScanEntriesPrefetching(const ReadOnlyDatabase<Logged>* db,
+                       int64_t start_index, int64_t limit) {
+  const bool bulk(FLAGS_database_bulk_scan_entries > 0 &&
+                  limit >= FLAGS_database_bulk_scan_entries);
+  std::unique_ptr<typename ReadOnlyDatabase<Logged>::Iterator> it(
+      bulk ? db->ScanEntriesBulk(start_index) : db->ScanEntries(start_index));
+  // Not worth a thread if it would only read one block.
+  if (FLAGS_database_prefetch_entries <= 0 ||
+      limit <= FLAGS_database_prefetch_entries) {
+    return it;
+  }
+  return std::unique_ptr<typename ReadOnlyDatabase<Logged>::Iterator>(
+      new PrefetchingIterator<Logged>(std::move(it),
+                                      FLAGS_database_prefetch_entries, limit));
+}
+
+
+template <class Logged>
+PrefetchingIterator<Logged>::PrefetchingIterator(std::unique_ptr<Iterator> it,
+                                                 size_t block_size,
+                                                 int64_t limit)
+    : it_(CHECK_NOTNULL(it.release())),
+      block_size_(block_size),
+      limit_(limit),
+      next_ready_(false),
+      prefetch_done_(false),
+      stopping_(false),
+      current_pos_(0) {
+  CHECK_GT(block_size_, 0U);
+  CHECK_GE(limit_, 0);
+  thread_ = std::thread(&PrefetchingIterator<Logged>::Prefetch, this);
+}
+
+
+template <class Logged>
+PrefetchingIterator<Logged>::~PrefetchingIterator() {
+  {
+    std::lock_guard<std::mutex> lock(lock_);
+    stopping_ = true;
+  }
+  cond_.notify_all();
+  if (thread_.joinable()) {
+    thread_.join();
+  }
+}
+
+
+template <class Logged>
+bool PrefetchingIterator<Logged>::GetNextEntry(Logged* entry) {
+  CHECK_NOTNULL(entry);
+  if (current_pos_ == current_.size() && !NextBlock()) {
+    return false;
+  }
+  entry->Swap(&current_[current_pos_++]);
+  return true;
+}
+
+
+template <class Logged>
+size_t PrefetchingIterator<Logged>::GetNextEntries(
+    size_t max_entries, std::vector<Logged>* entries) {
+  CHECK_NOTNULL(entries);
+  size_t count(0);
+  for (; count < max_entries; ++count) {
+    if (current_pos_ == current_.size() && !NextBlock()) {
+      break;
+    }
+    entries->emplace_back();
+    entries->back().Swap(&current_[current_pos_++]);
+  }
+  return count;
+}
+
+
+template <class Logged>
+void PrefetchingIterator<Logged>::Prefetch() {
+  for (int64_t read(0);;) {
+    std::vector<Logged> block;
+    const size_t wanted(std::min<int64_t>(block_size_, limit_ - read));
+    const size_t count(it_->GetNextEntries(wanted, &block));
+    read += count;
+    const bool last(count < wanted || read >= limit_);
+
+    std::unique_lock<std::mutex> lock(lock_);
+    cond_.wait(lock, [this]() { return !next_ready_ || stopping_; });
+    if (stopping_) {
+      return;
+    }
+    next_block_.swap(block);
+    next_ready_ = true;
+    prefetch_done_ = last;
+    lock.unlock();
+    cond_.notify_all();
+
+    if (last) {
+      return;
+    }
+  }
+}
+
+
+template <class Logged>
+bool PrefetchingIterator<Logged>::NextBlock() {
+  current_.clear();
+  current_pos_ = 0;
+
+  if (!thread_.joinable()) {
+    // Done reading ahead, so only read what is asked for.
+    return it_->GetNextEntries(1, &current_) > 0;
+  }
+
+  std::unique_lock<std::mutex> lock(lock_);
+  cond_.wait(lock, [this]() { return next_ready_; });
+  current_.swap(next_block_);
+  next_ready_ = false;
+  const bool done(prefetch_done_);
+  lock.unlock();
+  cond_.notify_all();
+
+  if (done) {
+    thread_.join();
+    if (current_.empty()) {
+      return NextBlock();
+    }
+  }
+  return !current_.empty();
+}
+
+
+#endif  // CERT_TRANS_LOG_PREFETCHING_ITERATOR_H_
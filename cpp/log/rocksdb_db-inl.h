@@ -0,0 +1,826 @@
+#ifndef CERT_TRANS_LOG_ROCKSDB_DB_INL_H_
+#define CERT_TRANS_LOG_ROCKSDB_DB_INL_H_
+
+#include "log/rocksdb_db.h"
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <map>
+#include <rocksdb/cache.h>
+#include <rocksdb/filter_policy.h>
+#include <rocksdb/options.h>
+#include <rocksdb/rate_limiter.h>
+#include <rocksdb/table.h>
+#include <stdint.h>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "proto/ct.pb.h"
+#include "proto/serializer.h"
+#include "monitoring/monitoring.h"
+#include "monitoring/latency.h"
+#include "util/util.h"
+
+DEFINE_int32(rocksdb_max_open_files, 0,
+             "number of open files that can be used by rocksdb");
+DEFINE_int32(rocksdb_bloom_filter_bits_per_key, 10,
+             "number of bits per key of the rocksdb bloom filters, or 0 to "
+             "not use any");
+DEFINE_int32(rocksdb_block_cache_mb, 512,
+             "size of the rocksdb block cache, shared by all the column "
+             "families, in megabytes");
+DEFINE_int32(rocksdb_background_threads, 4,
+             "number of threads rocksdb uses for flushes and compactions");
+DEFINE_int32(rocksdb_compaction_rate_limit_mb, 0,
+             "limit on the rate at which rocksdb writes to disk for flushes "
+             "and compactions, in megabytes per second, or 0 for no limit");
+DEFINE_int32(rocksdb_bulk_readahead_kb, 2048,
+             "size of the reads ahead done by rocksdb when scanning through "
+             "a large range of entries, in kilobytes");
+
+namespace {
+
+
+static cert_trans::Latency<std::chrono::milliseconds, std::string>
+    rocksdb_latency_by_op_ms("rocksdb_latency_by_operation_ms", "operation",
+                             "Database latency in ms broken out by "
+                             "operation.");
+
+
+const char kEntriesColumnFamily[] = "entries";
+const char kHashesColumnFamily[] = "hashes";
+const char kTreeHeadsColumnFamily[] = "tree_heads";
+const char kTreeHeadSizesColumnFamily[] = "tree_head_sizes";
+const char kSearchKeysColumnFamily[] = "search_keys";
+
+const char kNodeIdKey[] = "node_id";
+const char kContiguousSizeKey[] = "contiguous_size";
+// Present once the entries written before --database_search_index
+// was set are indexed by search key.
+const char kSearchIndexedKey[] = "search_indexed";
+
+// The number of entries indexed per write batch when building the
+// search index of a database that does not have one yet.
+const size_t kSearchIndexBatchSize = 10000;
+
+
+// The entries are keyed by their big-endian sequence number, so that
+// they sort in order.
+std::string SequenceNumberToKey(int64_t sequence_number) {
+  CHECK_GE(sequence_number, 0);
+  return Serializer::SerializeUint<uint64_t>(sequence_number);
+}
+
+
+int64_t KeyToSequenceNumber(const rocksdb::Slice& key) {
+  uint64_t sequence_number;
+  CHECK_EQ(Deserializer::OK,
+           Deserializer::DeserializeUint<uint64_t>(key.ToString(),
+                                                   sizeof(sequence_number),
+                                                   &sequence_number));
+  return sequence_number;
+}
+
+
+// The keys of the entries with |search_key| start with this. Search
+// keys cannot contain a NUL, but an issuer key hash could.
+std::string SearchKeyStart(const std::string& search_key) {
+  return search_key + '\0';
+}
+
+
+rocksdb::Options BuildOptions() {
+  rocksdb::Options options;
+  options.create_if_missing = true;
+  options.create_missing_column_families = true;
+  if (FLAGS_rocksdb_max_open_files > 0) {
+    options.max_open_files = FLAGS_rocksdb_max_open_files;
+  }
+
+  CHECK_GT(FLAGS_rocksdb_background_threads, 0);
+  options.IncreaseParallelism(FLAGS_rocksdb_background_threads);
+  options.OptimizeLevelStyleCompaction();
+  if (FLAGS_rocksdb_compaction_rate_limit_mb > 0) {
+    options.rate_limiter.reset(rocksdb::NewGenericRateLimiter(
+        static_cast<int64_t>(FLAGS_rocksdb_compaction_rate_limit_mb) << 20));
+  }
+
+  rocksdb::BlockBasedTableOptions table_options;
+  CHECK_GE(FLAGS_rocksdb_block_cache_mb, 0);
+  table_options.block_cache = rocksdb::NewLRUCache(
+      static_cast<size_t>(FLAGS_rocksdb_block_cache_mb) << 20);
+  if (FLAGS_rocksdb_bloom_filter_bits_per_key > 0) {
+    table_options.filter_policy.reset(rocksdb::NewBloomFilterPolicy(
+        FLAGS_rocksdb_bloom_filter_bits_per_key));
+  }
+  options.table_factory.reset(
+      rocksdb::NewBlockBasedTableFactory(table_options));
+
+  return options;
+}
+
+
+}  // namespace
+
+
+template <class Logged>
+class RocksDB<Logged>::Iterator : public Database<Logged>::Iterator {
+ public:
+  // If |bulk|, the blocks read are not kept in the block cache, and
+  // the files are read ahead.
+  Iterator(const RocksDB<Logged>* db, int64_t start_index, bool bulk)
+      : it_(CHECK_NOTNULL(db)->db_->NewIterator(ReadOptions(bulk),
+                                                db->entries_)) {
+    CHECK(it_);
+    it_->Seek(SequenceNumberToKey(start_index));
+  }
+
+  bool GetNextEntry(Logged* entry) override {
+    if (!it_->Valid()) {
+      return false;
+    }
+
+    const int64_t seq(KeyToSequenceNumber(it_->key()));
+    CHECK(entry->ParseFromStorage(it_->value().data(), it_->value().size()))
+        << "failed to parse entry for sequence number " << seq;
+    CHECK(entry->has_sequence_number())
+        << "no sequence number for entry with expected sequence number "
+        << seq;
+    CHECK_EQ(entry->sequence_number(), seq) << "unexpected sequence_number";
+
+    it_->Next();
+
+    return true;
+  }
+
+ private:
+  static rocksdb::ReadOptions ReadOptions(bool bulk) {
+    rocksdb::ReadOptions options;
+    if (bulk) {
+      options.fill_cache = false;
+      options.readahead_size =
+          static_cast<size_t>(FLAGS_rocksdb_bulk_readahead_kb) << 10;
+    }
+    return options;
+  }
+
+  const std::unique_ptr<rocksdb::Iterator> it_;
+};
+
+
+template <class Logged>
+const size_t RocksDB<Logged>::kTimestampBytesIndexed = 6;
+
+
+template <class Logged>
+RocksDB<Logged>::RocksDB(const std::string& dbfile)
+    : meta_(nullptr),
+      entries_(nullptr),
+      hashes_(nullptr),
+      tree_heads_(nullptr),
+      tree_head_sizes_(nullptr),
+      search_keys_(nullptr),
+      search_index_(FLAGS_database_search_index),
+      contiguous_size_(0),
+      sparse_entries_memory_("rocksdb_sparse_entries"),
+      latest_tree_timestamp_(0) {
+  LOG(INFO) << "Opening " << dbfile;
+  cert_trans::ScopedLatency latency(
+      rocksdb_latency_by_op_ms.GetScopedLatency("open"));
+
+  const rocksdb::Options options(BuildOptions());
+  std::vector<rocksdb::ColumnFamilyDescriptor> families;
+  for (const std::string& name :
+       {rocksdb::kDefaultColumnFamilyName, std::string(kEntriesColumnFamily),
+        std::string(kHashesColumnFamily),
+        std::string(kTreeHeadsColumnFamily),
+        std::string(kTreeHeadSizesColumnFamily),
+        std::string(kSearchKeysColumnFamily)}) {
+    families.emplace_back(name, rocksdb::ColumnFamilyOptions(options));
+  }
+
+  std::vector<rocksdb::ColumnFamilyHandle*> handles;
+  rocksdb::DB* db;
+  const rocksdb::Status status(rocksdb::DB::Open(
+      rocksdb::DBOptions(options), dbfile, families, &handles, &db));
+  CHECK(status.ok()) << status.ToString();
+  CHECK_EQ(families.size(), handles.size());
+  db_.reset(db);
+  meta_ = handles[0];
+  entries_ = handles[1];
+  hashes_ = handles[2];
+  tree_heads_ = handles[3];
+  tree_head_sizes_ = handles[4];
+  search_keys_ = handles[5];
+
+  BuildIndex();
+}
+
+
+template <class Logged>
+RocksDB<Logged>::~RocksDB() {
+  for (rocksdb::ColumnFamilyHandle* handle :
+       {meta_, entries_, hashes_, tree_heads_, tree_head_sizes_,
+        search_keys_}) {
+    delete handle;
+  }
+}
+
+
+template <class Logged>
+typename Database<Logged>::WriteResult RocksDB<Logged>::CreateSequencedEntry_(
+    const Logged& logged) {
+  CHECK(logged.has_sequence_number());
+  CHECK_GE(logged.sequence_number(), 0);
+  cert_trans::ScopedLatency latency(
+      rocksdb_latency_by_op_ms.GetScopedLatency("create_sequenced_entry"));
+
+  size_t written;
+  return WriteEntries({&logged}, &written);
+}
+
+
+template <class Logged>
+typename Database<Logged>::WriteResult
+RocksDB<Logged>::CreateSequencedEntries_(const std::vector<Logged>& logged,
+                                         size_t* written) {
+  cert_trans::ScopedLatency latency(
+      rocksdb_latency_by_op_ms.GetScopedLatency("create_sequenced_entries"));
+
+  std::vector<const Logged*> entries;
+  entries.reserve(logged.size());
+  for (const Logged& entry : logged) {
+    entries.push_back(&entry);
+  }
+
+  return WriteEntries(entries, written);
+}
+
+
+template <class Logged>
+typename Database<Logged>::LookupResult RocksDB<Logged>::LookupByHash(
+    const std::string& hash, Logged* result) const {
+  cert_trans::ScopedLatency latency(
+      rocksdb_latency_by_op_ms.GetScopedLatency("lookup_by_hash"));
+
+  // The entry is written in the same batch as its hash, so there is
+  // no need to lock anything between the two reads.
+  std::string key;
+  rocksdb::Status status(
+      db_->Get(rocksdb::ReadOptions(), hashes_, hash, &key));
+  if (status.IsNotFound()) {
+    return this->NOT_FOUND;
+  }
+  CHECK(status.ok()) << "Failed to get index of hash(" << util::HexString(hash)
+                     << "): " << status.ToString();
+
+  // Pinned rather than copied out of the block cache.
+  rocksdb::PinnableSlice cert_data;
+  status = db_->Get(rocksdb::ReadOptions(), entries_, key, &cert_data);
+  CHECK(status.ok()) << "Failed to get entry by hash(" << util::HexString(hash)
+                     << "): " << status.ToString();
+
+  Logged logged;
+  CHECK(logged.ParseFromStorage(cert_data.data(), cert_data.size()));
+  CHECK_EQ(logged.Hash(), hash);
+
+  if (result) {
+    logged.Swap(result);
+  }
+
+  return this->LOOKUP_OK;
+}
+
+
+template <class Logged>
+typename Database<Logged>::LookupResult RocksDB<Logged>::LookupByIndex(
+    int64_t sequence_number, Logged* result) const {
+  CHECK_GE(sequence_number, 0);
+  cert_trans::ScopedLatency latency(
+      rocksdb_latency_by_op_ms.GetScopedLatency("lookup_by_index"));
+
+  rocksdb::PinnableSlice cert_data;
+  const rocksdb::Status status(
+      db_->Get(rocksdb::ReadOptions(), entries_,
+               SequenceNumberToKey(sequence_number), &cert_data));
+  if (status.IsNotFound()) {
+    return this->NOT_FOUND;
+  }
+  CHECK(status.ok()) << "Failed to get entry for sequence number "
+                     << sequence_number << ": " << status.ToString();
+
+  if (result) {
+    CHECK(result->ParseFromStorage(cert_data.data(), cert_data.size()));
+    CHECK_EQ(result->sequence_number(), sequence_number);
+  }
+
+  return this->LOOKUP_OK;
+}
+
+
+template <class Logged>
+std::unique_ptr<typename Database<Logged>::Iterator>
+RocksDB<Logged>::ScanEntries(int64_t start_index) const {
+  return std::unique_ptr<Iterator>(new Iterator(this, start_index, false));
+}
+
+
+template <class Logged>
+std::unique_ptr<typename Database<Logged>::Iterator>
+RocksDB<Logged>::ScanEntriesBulk(int64_t start_index) const {
+  return std::unique_ptr<Iterator>(new Iterator(this, start_index, true));
+}
+
+
+template <class Logged>
+typename Database<Logged>::WriteResult RocksDB<Logged>::WriteTreeHead_(
+    const ct::SignedTreeHead& sth) {
+  CHECK_GE(sth.tree_size(), 0);
+  cert_trans::ScopedLatency latency(
+      rocksdb_latency_by_op_ms.GetScopedLatency("write_tree_head"));
+
+  // 6 bytes are good enough for some 9000 years.
+  const std::string timestamp_key(
+      Serializer::SerializeUint(sth.timestamp(),
+                                RocksDB::kTimestampBytesIndexed));
+  std::string data;
+  CHECK(sth.SerializeToString(&data));
+
+  std::unique_lock<std::mutex> lock(lock_);
+  std::string existing_data;
+  rocksdb::Status status(db_->Get(rocksdb::ReadOptions(), tree_heads_,
+                                  timestamp_key, &existing_data));
+  if (status.ok()) {
+    if (existing_data == data) {
+      return this->OK;
+    }
+    return this->DUPLICATE_TREE_HEAD_TIMESTAMP;
+  }
+
+  rocksdb::WriteBatch batch;
+  batch.Put(tree_heads_, timestamp_key, data);
+  batch.Put(tree_head_sizes_,
+            SequenceNumberToKey(sth.tree_size()) + timestamp_key,
+            rocksdb::Slice());
+  rocksdb::WriteOptions opts;
+  opts.sync = true;
+  status = db_->Write(opts, &batch);
+  CHECK(status.ok()) << "Failed to write tree head (" << timestamp_key
+                     << "): " << status.ToString();
+
+  if (sth.timestamp() > latest_tree_timestamp_) {
+    latest_tree_timestamp_ = sth.timestamp();
+    latest_timestamp_key_ = timestamp_key;
+  }
+
+  lock.unlock();
+  callbacks_.Call(sth);
+
+  return this->OK;
+}
+
+
+template <class Logged>
+typename Database<Logged>::LookupResult RocksDB<Logged>::LatestTreeHead(
+    ct::SignedTreeHead* result) const {
+  cert_trans::ScopedLatency latency(
+      rocksdb_latency_by_op_ms.GetScopedLatency("latest_tree_head"));
+  std::lock_guard<std::mutex> lock(lock_);
+
+  return LatestTreeHeadNoLock(result);
+}
+
+
+template <class Logged>
+typename Database<Logged>::LookupResult
+RocksDB<Logged>::LookupTreeHeadByTimestamp(uint64_t timestamp,
+                                           ct::SignedTreeHead* result) const {
+  CHECK_NOTNULL(result);
+  cert_trans::ScopedLatency latency(rocksdb_latency_by_op_ms.GetScopedLatency(
+      "lookup_tree_head_by_timestamp"));
+
+  std::string tree_data;
+  const rocksdb::Status status(
+      db_->Get(rocksdb::ReadOptions(), tree_heads_,
+               Serializer::SerializeUint(timestamp,
+                                         RocksDB::kTimestampBytesIndexed),
+               &tree_data));
+  if (status.IsNotFound()) {
+    return this->NOT_FOUND;
+  }
+  CHECK(status.ok()) << "Failed to read tree head: " << status.ToString();
+
+  CHECK(result->ParseFromString(tree_data));
+  return this->LOOKUP_OK;
+}
+
+
+template <class Logged>
+void RocksDB<Logged>::ScanTreeHeadsBySize(
+    int64_t start_size, int64_t end_size,
+    std::vector<ct::SignedTreeHead>* result) const {
+  CHECK_GE(start_size, 0);
+  CHECK_NOTNULL(result);
+  cert_trans::ScopedLatency latency(
+      rocksdb_latency_by_op_ms.GetScopedLatency("scan_tree_heads_by_size"));
+  if (end_size <= start_size) {
+    return;
+  }
+
+  // The last index key of each tree size is that of its freshest
+  // tree head.
+  const std::string end_key(SequenceNumberToKey(end_size));
+  std::vector<std::string> timestamp_keys;
+  std::string last_size;
+  std::unique_ptr<rocksdb::Iterator> it(
+      db_->NewIterator(rocksdb::ReadOptions(), tree_head_sizes_));
+  CHECK(it);
+  it->Seek(SequenceNumberToKey(start_size));
+  for (; it->Valid() && it->key().compare(end_key) < 0; it->Next()) {
+    const std::string key(it->key().ToString());
+    const std::string size(key.substr(0, sizeof(uint64_t)));
+    if (timestamp_keys.empty() || size != last_size) {
+      timestamp_keys.emplace_back();
+      last_size = size;
+    }
+    timestamp_keys.back() = key.substr(sizeof(uint64_t));
+  }
+  CHECK(it->status().ok()) << "Failed to scan tree sizes: "
+                           << it->status().ToString();
+
+  for (const std::string& timestamp_key : timestamp_keys) {
+    std::string tree_data;
+    const rocksdb::Status status(db_->Get(rocksdb::ReadOptions(), tree_heads_,
+                                          timestamp_key, &tree_data));
+    CHECK(status.ok()) << "Failed to read tree head: " << status.ToString();
+    result->emplace_back();
+    CHECK(result->back().ParseFromString(tree_data));
+  }
+}
+
+
+template <class Logged>
+int64_t RocksDB<Logged>::TreeSize() const {
+  cert_trans::ScopedLatency latency(
+      rocksdb_latency_by_op_ms.GetScopedLatency("tree_size"));
+  std::lock_guard<std::mutex> lock(lock_);
+
+  return contiguous_size_;
+}
+
+
+template <class Logged>
+void RocksDB<Logged>::AddNotifySTHCallback(
+    const typename Database<Logged>::NotifySTHCallback* callback) {
+  std::unique_lock<std::mutex> lock(lock_);
+
+  callbacks_.Add(callback);
+
+  ct::SignedTreeHead sth;
+  if (LatestTreeHeadNoLock(&sth) == this->LOOKUP_OK) {
+    lock.unlock();
+    (*callback)(sth);
+  }
+}
+
+
+template <class Logged>
+void RocksDB<Logged>::RemoveNotifySTHCallback(
+    const typename Database<Logged>::NotifySTHCallback* callback) {
+  std::lock_guard<std::mutex> lock(lock_);
+
+  callbacks_.Remove(callback);
+}
+
+
+template <class Logged>
+void RocksDB<Logged>::InitializeNode(const std::string& node_id) {
+  CHECK(!node_id.empty());
+  cert_trans::ScopedLatency latency(
+      rocksdb_latency_by_op_ms.GetScopedLatency("initialize_node"));
+  std::unique_lock<std::mutex> lock(lock_);
+  std::string existing_id;
+  rocksdb::Status status(
+      db_->Get(rocksdb::ReadOptions(), meta_, kNodeIdKey, &existing_id));
+  if (!status.IsNotFound()) {
+    LOG(FATAL) << "Attempting to initialize DB beloging to node with node_id: "
+               << existing_id;
+  }
+  status = db_->Put(rocksdb::WriteOptions(), meta_, kNodeIdKey, node_id);
+  CHECK(status.ok()) << "Failed to store NodeId: " << status.ToString();
+}
+
+
+template <class Logged>
+typename Database<Logged>::LookupResult RocksDB<Logged>::NodeId(
+    std::string* node_id) {
+  CHECK_NOTNULL(node_id);
+  if (!db_->Get(rocksdb::ReadOptions(), meta_, kNodeIdKey, node_id).ok()) {
+    return this->NOT_FOUND;
+  }
+  return this->LOOKUP_OK;
+}
+
+
+template <class Logged>
+typename Database<Logged>::LookupResult RocksDB<Logged>::SearchEntries(
+    const std::string& search_key, int64_t start_index, size_t max_results,
+    std::vector<int64_t>* result) const {
+  CHECK_GE(start_index, 0);
+  CHECK_NOTNULL(result);
+  if (!search_index_) {
+    return this->NOT_FOUND;
+  }
+  cert_trans::ScopedLatency latency(
+      rocksdb_latency_by_op_ms.GetScopedLatency("search_entries"));
+
+  const std::string start(SearchKeyStart(search_key));
+  std::unique_ptr<rocksdb::Iterator> it(
+      db_->NewIterator(rocksdb::ReadOptions(), search_keys_));
+  CHECK(it);
+  for (it->Seek(start + SequenceNumberToKey(start_index));
+       result->size() < max_results && it->Valid() &&
+       it->key().starts_with(start);
+       it->Next()) {
+    // Skip those of a longer search key starting with this one.
+    if (it->key().size() != start.size() + sizeof(uint64_t)) {
+      continue;
+    }
+    rocksdb::Slice key(it->key());
+    key.remove_prefix(start.size());
+    result->push_back(KeyToSequenceNumber(key));
+  }
+  CHECK(it->status().ok()) << "Failed to search entries: "
+                           << it->status().ToString();
+
+  return this->LOOKUP_OK;
+}
+
+
+template <class Logged>
+void RocksDB<Logged>::BuildIndex() {
+  cert_trans::ScopedLatency latency(
+      rocksdb_latency_by_op_ms.GetScopedLatency("build_index"));
+  // Technically, this should only be called from the constructor, so
+  // this should not be necessarily, but just to be sure...
+  std::lock_guard<std::mutex> lock(lock_);
+
+  std::string size_data;
+  const rocksdb::Status status(db_->Get(rocksdb::ReadOptions(), meta_,
+                                        kContiguousSizeKey, &size_data));
+  if (status.ok()) {
+    contiguous_size_ = KeyToSequenceNumber(size_data);
+  } else {
+    CHECK(status.IsNotFound()) << "Failed to read tree size: "
+                               << status.ToString();
+  }
+
+  // The entries before the persisted tree size are all there, so only
+  // those after it need to be looked at.
+  rocksdb::ReadOptions options;
+  options.fill_cache = false;
+  std::unique_ptr<rocksdb::Iterator> it(db_->NewIterator(options, entries_));
+  CHECK(it);
+  for (it->Seek(SequenceNumberToKey(contiguous_size_)); it->Valid();
+       it->Next()) {
+    InsertSequenceNumber(KeyToSequenceNumber(it->key()));
+  }
+
+  BuildSearchIndex();
+
+  // Now read the STH entries.
+  it.reset(db_->NewIterator(options, tree_heads_));
+  CHECK(it);
+  it->SeekToLast();
+  if (it->Valid()) {
+    latest_timestamp_key_ = it->key().ToString();
+    CHECK_EQ(Deserializer::OK,
+             Deserializer::DeserializeUint<uint64_t>(
+                 latest_timestamp_key_, RocksDB::kTimestampBytesIndexed,
+                 &latest_tree_timestamp_));
+
+    it.reset(db_->NewIterator(options, tree_head_sizes_));
+    CHECK(it);
+    it->SeekToFirst();
+    if (!it->Valid()) {
+      IndexTreeHeads();
+    }
+  }
+}
+
+
+template <class Logged>
+void RocksDB<Logged>::IndexTreeHeads() {
+  LOG(INFO) << "Indexing the tree heads by tree size";
+  // There are not that many of them, index them in a single batch, so
+  // that an interrupted indexing starts over.
+  rocksdb::WriteBatch batch;
+  rocksdb::ReadOptions options;
+  options.fill_cache = false;
+  std::unique_ptr<rocksdb::Iterator> it(
+      db_->NewIterator(options, tree_heads_));
+  CHECK(it);
+  for (it->SeekToFirst(); it->Valid(); it->Next()) {
+    ct::SignedTreeHead sth;
+    CHECK(sth.ParseFromArray(it->value().data(), it->value().size()));
+    batch.Put(tree_head_sizes_,
+              SequenceNumberToKey(sth.tree_size()) + it->key().ToString(),
+              rocksdb::Slice());
+  }
+  CHECK(it->status().ok()) << "Failed to scan tree heads: "
+                           << it->status().ToString();
+
+  rocksdb::WriteOptions opts;
+  opts.sync = true;
+  const rocksdb::Status status(db_->Write(opts, &batch));
+  CHECK(status.ok()) << "Failed to index tree heads: " << status.ToString();
+}
+
+
+template <class Logged>
+typename Database<Logged>::LookupResult RocksDB<Logged>::LatestTreeHeadNoLock(
+    ct::SignedTreeHead* result) const {
+  if (latest_tree_timestamp_ == 0) {
+    return this->NOT_FOUND;
+  }
+
+  std::string tree_data;
+  const rocksdb::Status status(db_->Get(rocksdb::ReadOptions(), tree_heads_,
+                                        latest_timestamp_key_, &tree_data));
+  CHECK(status.ok()) << "Failed to read latest tree head: "
+                     << status.ToString();
+
+  CHECK(result->ParseFromString(tree_data));
+  CHECK_EQ(result->timestamp(), latest_tree_timestamp_);
+
+  return this->LOOKUP_OK;
+}
+
+
+template <class Logged>
+typename Database<Logged>::WriteResult RocksDB<Logged>::WriteEntries(
+    const std::vector<const Logged*>& logged, size_t* written) {
+  std::lock_guard<std::mutex> lock(lock_);
+
+  // The new entries, their hashes and the new tree size are all
+  // written in one batch, so entries earlier in it have to be checked
+  // for as well.
+  rocksdb::WriteBatch batch;
+  std::map<std::string, std::string> batched;
+  std::map<std::string, int64_t> batched_hashes;
+  const int64_t old_size(contiguous_size_);
+  typename Database<Logged>::WriteResult result(this->OK);
+  for (*written = 0; *written < logged.size(); ++*written) {
+    const Logged& entry(*logged[*written]);
+    std::string data;
+    CHECK(entry.SerializeForStorage(&data));
+
+    const std::string key(SequenceNumberToKey(entry.sequence_number()));
+
+    const auto it(batched.find(key));
+    std::string existing_data;
+    if (it != batched.end()) {
+      existing_data = it->second;
+    } else if (db_->Get(rocksdb::ReadOptions(), entries_, key, &existing_data)
+                   .IsNotFound()) {
+      // If the same entry is logged more than once, keep track of the
+      // one with the lowest sequence number.
+      const std::string hash(entry.Hash());
+      bool index_hash(true);
+      const auto hash_it(batched_hashes.find(hash));
+      if (hash_it != batched_hashes.end()) {
+        index_hash = hash_it->second > entry.sequence_number();
+      } else {
+        std::string existing_key;
+        if (db_->Get(rocksdb::ReadOptions(), hashes_, hash, &existing_key)
+                .ok()) {
+          index_hash =
+              KeyToSequenceNumber(existing_key) > entry.sequence_number();
+        }
+      }
+      if (index_hash) {
+        batch.Put(hashes_, hash, key);
+        batched_hashes[hash] = entry.sequence_number();
+      }
+
+      if (search_index_) {
+        IndexSearchKeys(entry, &batch);
+      }
+      batch.Put(entries_, key, data);
+      batched.emplace(key, std::move(data));
+      InsertSequenceNumber(entry.sequence_number());
+      continue;
+    }
+
+    if (!Logged::SameStoredEntry(existing_data, data)) {
+      result = this->SEQUENCE_NUMBER_ALREADY_IN_USE;
+      break;
+    }
+  }
+
+  if (contiguous_size_ != old_size) {
+    batch.Put(meta_, kContiguousSizeKey,
+              SequenceNumberToKey(contiguous_size_));
+  }
+
+  if (!batched.empty()) {
+    const rocksdb::Status status(db_->Write(rocksdb::WriteOptions(), &batch));
+    CHECK(status.ok()) << "Failed to write " << batched.size()
+                       << " sequenced entries: " << status.ToString();
+  }
+
+  return result;
+}
+
+
+// This must be called with "lock_" held.
+template <class Logged>
+void RocksDB<Logged>::InsertSequenceNumber(int64_t sequence_number) {
+  const size_t num_sparse_entries(sparse_entries_.size());
+  if (sequence_number == contiguous_size_) {
+    ++contiguous_size_;
+    for (auto i = sparse_entries_.find(contiguous_size_);
+         i != sparse_entries_.end() && *i == contiguous_size_;) {
+      ++contiguous_size_;
+      i = sparse_entries_.erase(i);
+    }
+  } else {
+    // It's not contiguous, put it with the other sparse entries.
+    CHECK(sparse_entries_.insert(sequence_number).second)
+        << "sequence number " << sequence_number << " already assigned.";
+  }
+
+  if (sparse_entries_.size() != num_sparse_entries) {
+    sparse_entries_memory_.Set(
+        cert_trans::OrderedContainerBytes(sparse_entries_, 0));
+  }
+}
+
+
+template <class Logged>
+void RocksDB<Logged>::IndexSearchKeys(const Logged& entry,
+                                      rocksdb::WriteBatch* batch) const {
+  std::vector<std::string> search_keys;
+  entry.SearchKeys(&search_keys);
+  const std::string seq_key(SequenceNumberToKey(entry.sequence_number()));
+  for (const std::string& search_key : search_keys) {
+    batch->Put(search_keys_, SearchKeyStart(search_key) + seq_key,
+               rocksdb::Slice());
+  }
+}
+
+
+// This must be called with "lock_" held.
+template <class Logged>
+void RocksDB<Logged>::BuildSearchIndex() {
+  if (!search_index_) {
+    // The entries written from now on are not indexed, so they will
+    // have to be if the flag is set again.
+    const rocksdb::Status status(
+        db_->Delete(rocksdb::WriteOptions(), meta_, kSearchIndexedKey));
+    CHECK(status.ok()) << "Failed to clear search index marker: "
+                       << status.ToString();
+    return;
+  }
+
+  std::string unused;
+  const rocksdb::Status status(
+      db_->Get(rocksdb::ReadOptions(), meta_, kSearchIndexedKey, &unused));
+  if (status.ok()) {
+    return;
+  }
+  CHECK(status.IsNotFound()) << "Failed to read search index marker: "
+                             << status.ToString();
+
+  LOG(INFO) << "Building search index";
+  rocksdb::ReadOptions options;
+  options.fill_cache = false;
+  options.readahead_size =
+      static_cast<size_t>(FLAGS_rocksdb_bulk_readahead_kb) << 10;
+  std::unique_ptr<rocksdb::Iterator> it(db_->NewIterator(options, entries_));
+  CHECK(it);
+  rocksdb::WriteBatch batch;
+  int64_t count(0);
+  for (it->SeekToFirst(); it->Valid(); it->Next()) {
+    Logged entry;
+    CHECK(entry.ParseFromStorage(it->value().data(), it->value().size()))
+        << "Failed to parse entry for sequence number "
+        << KeyToSequenceNumber(it->key());
+    IndexSearchKeys(entry, &batch);
+    if (++count % kSearchIndexBatchSize == 0) {
+      CHECK(db_->Write(rocksdb::WriteOptions(), &batch).ok());
+      batch.Clear();
+    }
+  }
+  CHECK(it->status().ok()) << "Failed to scan entries: "
+                           << it->status().ToString();
+  batch.Put(meta_, kSearchIndexedKey, rocksdb::Slice());
+  rocksdb::WriteOptions opts;
+  opts.sync = true;
+  CHECK(db_->Write(opts, &batch).ok());
+  LOG(INFO) << "Indexed the search keys of " << count << " entries";
+}
+
+
+#endif  // CERT_TRANS_LOG_ROCKSDB_DB_INL_H_
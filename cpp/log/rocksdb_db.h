@@ -0,0 +1,132 @@
+#ifndef CERT_TRANS_LOG_ROCKSDB_DB_H_
+#define CERT_TRANS_LOG_ROCKSDB_DB_H_
+
+#include <memory>
+#include <mutex>
+#include <rocksdb/db.h>
+#include <rocksdb/write_batch.h>
+#include <set>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "base/macros.h"
+#include "log/database.h"
+#include "monitoring/memory_gauge.h"
+#include "proto/ct.pb.h"
+
+
+// A database kept in RocksDB, with the entries, the index of their
+// hashes, the tree heads, the index of their tree sizes and the index
+// of the entries by search key each in their own column family, so
+// that they can be compacted and cached separately.
+template <class Logged>
+class RocksDB : public Database<Logged> {
+ public:
+  static const size_t kTimestampBytesIndexed;
+
+  explicit RocksDB(const std::string& dbfile);
+  ~RocksDB();
+
+  // Implement abstract functions, see database.h for comments.
+  typename Database<Logged>::WriteResult CreateSequencedEntry_(
+      const Logged& logged) override;
+
+  typename Database<Logged>::WriteResult CreateSequencedEntries_(
+      const std::vector<Logged>& logged, size_t* written) override;
+
+  typename Database<Logged>::LookupResult LookupByHash(
+      const std::string& hash, Logged* result) const override;
+
+  typename Database<Logged>::LookupResult LookupByIndex(
+      int64_t sequence_number, Logged* result) const override;
+
+  std::unique_ptr<typename Database<Logged>::Iterator> ScanEntries(
+      int64_t start_index) const override;
+
+  std::unique_ptr<typename Database<Logged>::Iterator> ScanEntriesBulk(
+      int64_t start_index) const override;
+
+  typename Database<Logged>::WriteResult WriteTreeHead_(
+      const ct::SignedTreeHead& sth) override;
+
+  typename Database<Logged>::LookupResult LatestTreeHead(
+      ct::SignedTreeHead* result) const override;
+
+  typename Database<Logged>::LookupResult LookupTreeHeadByTimestamp(
+      uint64_t timestamp, ct::SignedTreeHead* result) const override;
+
+  void ScanTreeHeadsBySize(
+      int64_t start_size, int64_t end_size,
+      std::vector<ct::SignedTreeHead>* result) const override;
+
+  int64_t TreeSize() const override;
+
+  void AddNotifySTHCallback(
+      const typename Database<Logged>::NotifySTHCallback* callback) override;
+
+  void RemoveNotifySTHCallback(
+      const typename Database<Logged>::NotifySTHCallback* callback) override;
+
+  void InitializeNode(const std::string& node_id) override;
+
+  typename Database<Logged>::LookupResult NodeId(
+      std::string* node_id) override;
+
+  typename Database<Logged>::LookupResult SearchEntries(
+      const std::string& search_key, int64_t start_index, size_t max_results,
+      std::vector<int64_t>* result) const override;
+
+ private:
+  class Iterator;
+
+  void BuildIndex();
+  // Indexes the tree heads by tree size, if the database was written
+  // before they were.
+  void IndexTreeHeads();
+  typename Database<Logged>::LookupResult LatestTreeHeadNoLock(
+      ct::SignedTreeHead* result) const;
+  typename Database<Logged>::WriteResult WriteEntries(
+      const std::vector<const Logged*>& logged, size_t* written);
+  void InsertSequenceNumber(int64_t sequence_number);
+  // Adds the search keys of |entry| to |batch|.
+  void IndexSearchKeys(const Logged& entry, rocksdb::WriteBatch* batch) const;
+  // Indexes the search keys of all the entries, unless they already
+  // are.
+  void BuildSearchIndex();
+
+  mutable std::mutex lock_;
+  std::unique_ptr<rocksdb::DB> db_;
+  // These belong to db_, and are deleted before it.
+  rocksdb::ColumnFamilyHandle* meta_;
+  rocksdb::ColumnFamilyHandle* entries_;
+  rocksdb::ColumnFamilyHandle* hashes_;
+  rocksdb::ColumnFamilyHandle* tree_heads_;
+  // Empty values, under keys which sort by tree size, then by the
+  // key of the tree head.
+  rocksdb::ColumnFamilyHandle* tree_head_sizes_;
+  // Empty values, under keys which sort by search key, then by
+  // sequence number.
+  rocksdb::ColumnFamilyHandle* search_keys_;
+
+  // Whether the entries are indexed by search key, from
+  // --database_search_index when the database is opened.
+  const bool search_index_;
+
+  int64_t contiguous_size_;
+
+  // This is a mapping of the non-contiguous entries of the log (which
+  // can happen while it is being fetched). When entries here become
+  // contiguous with the beginning of the tree, they are removed.
+  std::set<int64_t> sparse_entries_;
+  cert_trans::MemoryGauge sparse_entries_memory_;
+
+  uint64_t latest_tree_timestamp_;
+  std::string latest_timestamp_key_;
+  cert_trans::DatabaseNotifierHelper callbacks_;
+
+  DISALLOW_COPY_AND_ASSIGN(RocksDB);
+};
+
+
+#endif  // CERT_TRANS_LOG_ROCKSDB_DB_H_
@@ -0,0 +1,4 @@
+#include "log/logged_certificate.h"
+#include "log/rocksdb_db-inl.h"
+
+template class RocksDB<cert_trans::LoggedCertificate>;
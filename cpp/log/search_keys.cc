@@ -0,0 +1,147 @@
+#include "log/search_keys.h"
+
+#include <algorithm>
+#include <ctype.h>
+#include <glog/logging.h>
+#include <set>
+
+#include "log/cert.h"
+
+using std::set;
+using std::string;
+using std::vector;
+
+namespace cert_trans {
+namespace {
+
+
+const char kDomainPrefix[] = "dns:";
+const char kIssuerPrefix[] = "issuer:";
+
+
+// Sets |labels| to those of |domain|, lowercased, in reverse order,
+// without the wildcard and redacted ones, nor those to their left.
+// Returns false if |domain| is not a DNS name.
+bool ReversedLabels(const string& domain, vector<string>* labels) {
+  labels->clear();
+  string name(domain);
+  if (!name.empty() && name.back() == '.') {
+    name.pop_back();
+  }
+
+  size_t start(0);
+  while (start <= name.size()) {
+    size_t end(name.find('.', start));
+    if (end == string::npos) {
+      end = name.size();
+    }
+    string label(name, start, end - start);
+    start = end + 1;
+
+    if (label == "*" || label == "?") {
+      labels->clear();
+      continue;
+    }
+    if (label.empty()) {
+      return false;
+    }
+    for (char& c : label) {
+      if (!isalnum(static_cast<unsigned char>(c)) && c != '-' && c != '_') {
+        return false;
+      }
+      c = tolower(static_cast<unsigned char>(c));
+    }
+    labels->push_back(label);
+  }
+
+  std::reverse(labels->begin(), labels->end());
+  return true;
+}
+
+
+// The domain key of the first |count| of |labels|.
+string JoinLabels(const vector<string>& labels, size_t count) {
+  string key(kDomainPrefix);
+  for (size_t i = 0; i < count; ++i) {
+    if (i > 0) {
+      key += '.';
+    }
+    key += labels[i];
+  }
+  return key;
+}
+
+
+// Adds the keys of the DNS names of the certificate |der|, and of
+// their parent domains, to |keys|.
+void AddDomainKeys(const string& der, set<string>* keys) {
+  Cert cert;
+  if (cert.LoadFromDerString(der) != Cert::TRUE) {
+    return;
+  }
+  // If a name cannot be read, those before it are still indexed.
+  vector<string> names;
+  if (cert.DnsNames(&names) == Cert::ERROR) {
+    return;
+  }
+  for (const string& name : names) {
+    vector<string> labels;
+    if (!ReversedLabels(name, &labels)) {
+      continue;
+    }
+    for (size_t count = 2; count <= labels.size(); ++count) {
+      keys->insert(JoinLabels(labels, count));
+    }
+  }
+}
+
+
+}  // namespace
+
+
+string DomainSearchKey(const string& domain) {
+  vector<string> labels;
+  if (!ReversedLabels(domain, &labels) || labels.size() < 2) {
+    return "";
+  }
+  return JoinLabels(labels, labels.size());
+}
+
+
+string IssuerSearchKey(const string& issuer_key_hash) {
+  return kIssuerPrefix + issuer_key_hash;
+}
+
+
+void EntrySearchKeys(const ct::LogEntry& entry, vector<string>* keys) {
+  CHECK_NOTNULL(keys)->clear();
+  set<string> unique_keys;
+  switch (entry.type()) {
+    case ct::X509_ENTRY: {
+      AddDomainKeys(entry.x509_entry().leaf_certificate(), &unique_keys);
+      // The chains stored apart from the entries are not there.
+      Cert issuer;
+      string issuer_key_hash;
+      if (entry.x509_entry().certificate_chain_size() > 0 &&
+          issuer.LoadFromDerString(entry.x509_entry().certificate_chain(0)) ==
+              Cert::TRUE &&
+          issuer.SPKISha256Digest(&issuer_key_hash) == Cert::TRUE) {
+        unique_keys.insert(IssuerSearchKey(issuer_key_hash));
+      }
+      break;
+    }
+    case ct::PRECERT_ENTRY:
+      AddDomainKeys(entry.precert_entry().pre_certificate(), &unique_keys);
+      if (entry.precert_entry().pre_cert().has_issuer_key_hash()) {
+        unique_keys.insert(IssuerSearchKey(
+            entry.precert_entry().pre_cert().issuer_key_hash()));
+      }
+      break;
+    default:
+      break;
+  }
+  keys->assign(unique_keys.begin(), unique_keys.end());
+}
+
+
+}  // namespace cert_trans
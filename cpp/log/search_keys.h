@@ -0,0 +1,39 @@
+#ifndef CERT_TRANS_LOG_SEARCH_KEYS_H_
+#define CERT_TRANS_LOG_SEARCH_KEYS_H_
+
+#include <string>
+#include <vector>
+
+#include "proto/ct.pb.h"
+
+namespace cert_trans {
+
+
+// The keys under which the databases index the entries, if
+// --database_search_index is set, so that monitors can find the
+// certificates of a domain, or from an issuer, without downloading
+// the whole log.
+
+// The key of the entries with a certificate for |domain| or for any
+// of its subdomains, or an empty string if |domain| is not a DNS name
+// of at least two labels. Wildcard ("*") and redacted ("?") labels
+// are left out, with those to their left, and the others are
+// lowercased and reversed ("com.example.www"), so that the keys of a
+// domain sort together.
+std::string DomainSearchKey(const std::string& domain);
+
+// The key of the entries with a certificate issued by the key whose
+// subjectPublicKeyInfo has the SHA-256 digest |issuer_key_hash|.
+std::string IssuerSearchKey(const std::string& issuer_key_hash);
+
+// Sets |keys|, sorted, to the keys of |entry|: the domain keys of the
+// DNS names of its certificate and of their parent domains, and its
+// issuer key, if the certificate of its issuer is in its chain or if
+// it is a precertificate. What cannot be parsed is left out.
+void EntrySearchKeys(const ct::LogEntry& entry,
+                     std::vector<std::string>* keys);
+
+
+}  // namespace cert_trans
+
+#endif  // CERT_TRANS_LOG_SEARCH_KEYS_H_
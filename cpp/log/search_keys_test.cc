@@ -0,0 +1,125 @@
+#include "log/search_keys.h"
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+#include <openssl/evp.h>
+#include <string>
+#include <vector>
+
+#include "log/cert.h"
+#include "log/ct_extensions.h"
+#include "util/testing.h"
+#include "util/util.h"
+
+DECLARE_string(test_srcdir);
+
+namespace cert_trans {
+namespace {
+
+using std::string;
+using std::vector;
+
+// Issued by kCaCert, without any DNS name.
+const char kLeafCert[] = "test-cert.pem";
+const char kCaCert[] = "ca-cert.pem";
+// For ?.example.com.
+const char kRedactedCert[] = "v2/redact_test7.pem";
+
+
+string ReadDer(const string& name) {
+  string pem;
+  CHECK(util::ReadTextFile(FLAGS_test_srcdir + "/test/testdata/" + name,
+                           &pem))
+      << "Could not read test data from " << name
+      << ". Wrong --test_srcdir?";
+  const Cert cert(pem);
+  string der;
+  CHECK_EQ(Cert::TRUE, cert.DerEncoding(&der));
+  return der;
+}
+
+
+string SPKIDigest(const string& der) {
+  Cert cert;
+  CHECK_EQ(Cert::TRUE, cert.LoadFromDerString(der));
+  string digest;
+  CHECK_EQ(Cert::TRUE, cert.SPKISha256Digest(&digest));
+  return digest;
+}
+
+
+TEST(SearchKeysTest, DomainSearchKey) {
+  EXPECT_EQ("dns:com.example.www", DomainSearchKey("www.Example.COM"));
+  EXPECT_EQ("dns:com.example", DomainSearchKey("example.com."));
+  EXPECT_EQ("dns:com.example", DomainSearchKey("*.example.com"));
+  EXPECT_EQ("dns:com.example", DomainSearchKey("top.?.example.com"));
+  EXPECT_EQ("", DomainSearchKey("com"));
+  EXPECT_EQ("", DomainSearchKey("*.com"));
+  EXPECT_EQ("", DomainSearchKey("example..com"));
+  EXPECT_EQ("", DomainSearchKey("exa mple.com"));
+  EXPECT_EQ("", DomainSearchKey(""));
+}
+
+
+TEST(SearchKeysTest, IssuerSearchKey) {
+  EXPECT_EQ("issuer:hash", IssuerSearchKey("hash"));
+  EXPECT_NE(IssuerSearchKey("example.com"), DomainSearchKey("example.com"));
+}
+
+
+TEST(SearchKeysTest, X509Entry) {
+  ct::LogEntry entry;
+  entry.set_type(ct::X509_ENTRY);
+  entry.mutable_x509_entry()->set_leaf_certificate(ReadDer(kRedactedCert));
+
+  vector<string> keys;
+  EntrySearchKeys(entry, &keys);
+  EXPECT_EQ(vector<string>({"dns:com.example"}), keys);
+
+  // The issuer key is only known from the chain.
+  const string ca_der(ReadDer(kCaCert));
+  entry.mutable_x509_entry()->set_leaf_certificate(ReadDer(kLeafCert));
+  entry.mutable_x509_entry()->add_certificate_chain(ca_der);
+  EntrySearchKeys(entry, &keys);
+  EXPECT_EQ(vector<string>({IssuerSearchKey(SPKIDigest(ca_der))}), keys);
+}
+
+
+TEST(SearchKeysTest, PrecertEntry) {
+  ct::LogEntry entry;
+  entry.set_type(ct::PRECERT_ENTRY);
+  entry.mutable_precert_entry()->set_pre_certificate(ReadDer(kRedactedCert));
+  entry.mutable_precert_entry()->mutable_pre_cert()->set_issuer_key_hash(
+      "issuer key hash");
+
+  vector<string> keys;
+  EntrySearchKeys(entry, &keys);
+  EXPECT_EQ(vector<string>({"dns:com.example",
+                            IssuerSearchKey("issuer key hash")}),
+            keys);
+}
+
+
+TEST(SearchKeysTest, UnparsableEntry) {
+  ct::LogEntry entry;
+  entry.set_type(ct::X509_ENTRY);
+  entry.mutable_x509_entry()->set_leaf_certificate("not a certificate");
+  entry.mutable_x509_entry()->add_certificate_chain("nor is this");
+
+  vector<string> keys(1, "stale");
+  EntrySearchKeys(entry, &keys);
+  EXPECT_TRUE(keys.empty());
+}
+
+
+}  // namespace
+}  // namespace cert_trans
+
+
+int main(int argc, char** argv) {
+  cert_trans::test::InitTesting(argv[0], &argc, &argv, true);
+  OpenSSL_add_all_algorithms();
+  cert_trans::LoadCtExtensions();
+  return RUN_ALL_TESTS();
+}
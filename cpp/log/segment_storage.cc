@@ -0,0 +1,326 @@
+#include "log/segment_storage.h"
+
+#include <algorithm>
+#include <array>
+#include <errno.h>
+#include <fcntl.h>
+#include <glog/logging.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "util/util.h"
+
+using std::function;
+using std::lock_guard;
+using std::mutex;
+using std::set;
+using std::string;
+using std::vector;
+
+namespace cert_trans {
+namespace {
+
+
+const size_t kHeaderLength = SegmentStorage::kRecordHeaderLength;
+const size_t kSegmentNumberDigits = 8;
+
+
+// The CRC-32 of zlib and PNG, a byte at a time.
+uint32_t Crc32(const char* data, size_t length) {
+  static const std::array<uint32_t, 256> table([]() {
+    std::array<uint32_t, 256> table;
+    for (uint32_t i = 0; i < table.size(); ++i) {
+      uint32_t crc(i);
+      for (int bit = 0; bit < 8; ++bit) {
+        crc = (crc & 1) ? (crc >> 1) ^ 0xedb88320 : crc >> 1;
+      }
+      table[i] = crc;
+    }
+    return table;
+  }());
+
+  uint32_t crc(0xffffffff);
+  for (size_t i = 0; i < length; ++i) {
+    crc = table[(crc ^ static_cast<uint8_t>(data[i])) & 0xff] ^ (crc >> 8);
+  }
+  return crc ^ 0xffffffff;
+}
+
+
+void PutUint32(uint32_t value, char* out) {
+  for (int i = 3; i >= 0; --i) {
+    out[i] = static_cast<char>(value & 0xff);
+    value >>= 8;
+  }
+}
+
+
+uint32_t GetUint32(const char* in) {
+  uint32_t value(0);
+  for (int i = 0; i < 4; ++i) {
+    value = (value << 8) | static_cast<uint8_t>(in[i]);
+  }
+  return value;
+}
+
+
+}  // namespace
+
+
+SegmentStorage::SegmentStorage(const string& dir, off_t max_segment_size)
+    : dir_(dir), max_segment_size_(max_segment_size), segment_size_(0) {
+  CHECK_GT(max_segment_size_, 0);
+  if (mkdir(dir_.c_str(), 0700) != 0) {
+    CHECK_EQ(errno, EEXIST) << dir_ << ": " << strerror(errno);
+  }
+
+  // The segments are numbered from zero.
+  while (true) {
+    const string path(SegmentPath(segment_fds_.size()));
+    const int fd(open(path.c_str(), O_RDWR | O_APPEND));
+    if (fd < 0) {
+      CHECK_EQ(errno, ENOENT) << path << ": " << strerror(errno);
+      break;
+    }
+    segment_fds_.push_back(fd);
+
+    const off_t size(lseek(fd, 0, SEEK_END));
+    CHECK_GE(size, 0) << path << ": " << strerror(errno);
+    segment_size_ = IndexSegment(path, fd);
+    if (segment_size_ < size) {
+      // Only the last segment can have been cut short by a crash.
+      CHECK_EQ(access(SegmentPath(segment_fds_.size()).c_str(), F_OK), -1)
+          << path << " is corrupt at offset " << segment_size_
+          << ", but is not the last segment";
+      LOG(WARNING) << path << ": discarding " << size - segment_size_
+                   << " bytes of incomplete or corrupt records at offset "
+                   << segment_size_;
+      CHECK_EQ(ftruncate(fd, segment_size_), 0) << path << ": "
+                                                 << strerror(errno);
+    }
+  }
+
+  if (segment_fds_.empty()) {
+    OpenNextSegment();
+  }
+}
+
+
+SegmentStorage::~SegmentStorage() {
+  for (const int fd : segment_fds_) {
+    CHECK_EQ(close(fd), 0);
+  }
+}
+
+
+set<string> SegmentStorage::Scan() const {
+  lock_guard<mutex> lock(lock_);
+  set<string> keys;
+  for (const auto& entry : index_) {
+    keys.insert(entry.first);
+  }
+  return keys;
+}
+
+
+void SegmentStorage::ScanEach(const function<void(const string&)>& callback,
+                              int /*num_threads*/) const {
+  // The callback usually looks up the entry, which needs the lock.
+  vector<string> keys;
+  {
+    lock_guard<mutex> lock(lock_);
+    keys.reserve(index_.size());
+    for (const auto& entry : index_) {
+      keys.push_back(entry.first);
+    }
+  }
+
+  for (const auto& key : keys) {
+    callback(key);
+  }
+}
+
+
+util::Status SegmentStorage::CreateEntry(const string& key,
+                                         const string& data) {
+  lock_guard<mutex> lock(lock_);
+  if (index_.find(key) != index_.end()) {
+    return util::Status(util::error::ALREADY_EXISTS,
+                        "entry already exists: " + key);
+  }
+  AppendRecord(key, data);
+  return util::Status::OK;
+}
+
+
+util::Status SegmentStorage::UpdateEntry(const string& key,
+                                         const string& data) {
+  lock_guard<mutex> lock(lock_);
+  if (index_.find(key) == index_.end()) {
+    return util::Status(util::error::NOT_FOUND,
+                        "tried to update non-existent entry: " + key);
+  }
+  AppendRecord(key, data);
+  return util::Status::OK;
+}
+
+
+util::Status SegmentStorage::LookupEntry(const string& key,
+                                         string* result) const {
+  Location location;
+  {
+    lock_guard<mutex> lock(lock_);
+    const auto it(index_.find(key));
+    if (it == index_.end()) {
+      return util::Status(util::error::NOT_FOUND, "entry not found: " + key);
+    }
+    location = it->second;
+  }
+
+  if (result) {
+    // Records are never moved once written, so they can be read
+    // without the lock.
+    string record(location.size, '\0');
+    for (size_t done = 0; done < record.size();) {
+      const ssize_t bytes(pread(location.fd, &record[done],
+                                record.size() - done, location.offset + done));
+      if (bytes < 0 && errno == EINTR) {
+        continue;
+      }
+      CHECK_GT(bytes, 0) << "reading entry " << key << ": " << strerror(errno);
+      done += bytes;
+    }
+    CHECK_EQ(Crc32(record.data() + 4, record.size() - 4),
+             GetUint32(record.data()))
+        << "corrupt record for entry " << key;
+    result->assign(record, kHeaderLength + key.size(), string::npos);
+  }
+
+  return util::Status::OK;
+}
+
+
+util::Status SegmentStorage::LookupRecords(const vector<string>& keys,
+                                           vector<Extent>* extents) const {
+  lock_guard<mutex> lock(lock_);
+  for (const string& key : keys) {
+    const auto it(index_.find(key));
+    if (it == index_.end()) {
+      return util::Status(util::error::NOT_FOUND, "entry not found: " + key);
+    }
+    const Location& location(it->second);
+    if (!extents->empty() && extents->back().fd == location.fd &&
+        extents->back().offset + static_cast<off_t>(extents->back().length) ==
+            location.offset) {
+      extents->back().length += location.size;
+    } else {
+      extents->push_back(Extent{location.fd, location.offset, location.size});
+    }
+  }
+  return util::Status::OK;
+}
+
+
+// static
+SegmentStorage::RecordStatus SegmentStorage::ReadRecord(const char* data,
+                                                        size_t size,
+                                                        size_t* record_size,
+                                                        string* key,
+                                                        string* value) {
+  if (size < kHeaderLength) {
+    return RECORD_INCOMPLETE;
+  }
+  const uint64_t key_length(GetUint32(data + 4));
+  const uint64_t data_length(GetUint32(data + 8));
+  const uint64_t length(kHeaderLength + key_length + data_length);
+  if (size < length) {
+    return RECORD_INCOMPLETE;
+  }
+  if (Crc32(data + 4, length - 4) != GetUint32(data)) {
+    return RECORD_CORRUPT;
+  }
+  *record_size = length;
+  key->assign(data + kHeaderLength, key_length);
+  if (value) {
+    value->assign(data + kHeaderLength + key_length, data_length);
+  }
+  return RECORD_OK;
+}
+
+
+string SegmentStorage::SegmentPath(size_t segment) const {
+  const string number(std::to_string(segment));
+  return dir_ + "/segment-" +
+         string(kSegmentNumberDigits -
+                    std::min(kSegmentNumberDigits, number.size()),
+                '0') +
+         number;
+}
+
+
+off_t SegmentStorage::IndexSegment(const string& path, int fd) {
+  string segment;
+  CHECK(util::ReadBinaryFile(path, &segment)) << path;
+
+  size_t offset(0);
+  size_t size;
+  string key;
+  while (ReadRecord(segment.data() + offset, segment.size() - offset, &size,
+                    &key, nullptr) == RECORD_OK) {
+    Location& location(index_[key]);
+    location.fd = fd;
+    location.offset = offset;
+    location.size = size;
+    offset += size;
+  }
+
+  return offset;
+}
+
+
+void SegmentStorage::AppendRecord(const string& key, const string& data) {
+  if (segment_size_ >= max_segment_size_) {
+    OpenNextSegment();
+  }
+
+  const uint64_t size(kHeaderLength + key.size() + data.size());
+  CHECK_LE(size, UINT32_MAX) << "entry too large: " << key;
+  string record(kHeaderLength, '\0');
+  record.reserve(size);
+  PutUint32(key.size(), &record[4]);
+  PutUint32(data.size(), &record[8]);
+  record.append(key);
+  record.append(data);
+  PutUint32(Crc32(record.data() + 4, record.size() - 4), &record[0]);
+
+  // Written all at once, so that a crash can only leave the last
+  // record incomplete.
+  const int fd(segment_fds_.back());
+  for (size_t done = 0; done < record.size();) {
+    const ssize_t bytes(write(fd, record.data() + done, record.size() - done));
+    if (bytes < 0 && errno == EINTR) {
+      continue;
+    }
+    CHECK_GT(bytes, 0) << "writing entry " << key << ": " << strerror(errno);
+    done += bytes;
+  }
+
+  Location& location(index_[key]);
+  location.fd = fd;
+  location.offset = segment_size_;
+  location.size = size;
+  segment_size_ += size;
+}
+
+
+void SegmentStorage::OpenNextSegment() {
+  const string path(SegmentPath(segment_fds_.size()));
+  const int fd(open(path.c_str(), O_RDWR | O_APPEND | O_CREAT, 0600));
+  CHECK_GE(fd, 0) << path << ": " << strerror(errno);
+  segment_fds_.push_back(fd);
+  segment_size_ = 0;
+}
+
+
+}  // namespace cert_trans
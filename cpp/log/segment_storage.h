@@ -0,0 +1,144 @@
+#ifndef CERT_TRANS_LOG_SEGMENT_STORAGE_H_
+#define CERT_TRANS_LOG_SEGMENT_STORAGE_H_
+
+#include <functional>
+#include <mutex>
+#include <set>
+#include <stdint.h>
+#include <string>
+#include <sys/types.h>
+#include <unordered_map>
+#include <vector>
+
+#include "base/macros.h"
+#include "log/key_value_storage.h"
+#include "util/status.h"
+
+namespace cert_trans {
+
+
+// A filesystem-based database for (key, data) entries, which appends
+// them to a few large files rather than writing one file per entry
+// like FileStorage does. This saves a file and several system calls
+// per entry, and keeps entries written one after the other next to
+// each other on disk.
+//
+// <dir>/segment-NNNNNNNN - The entries, in the order they were
+//                          written. A new segment is started when
+//                          the current one reaches the maximum size.
+//
+// Each entry is a record of:
+//
+//   uint32 crc        - CRC-32 of the rest of the record.
+//   uint32 key_length
+//   uint32 data_length
+//   key
+//   data
+//
+// with the integers in big-endian order. Updating an entry appends a
+// new record, which replaces the earlier one.
+//
+// The segments are read through when the storage is opened, to build
+// an in-memory index of where each entry is. If the last record of
+// the last segment is incomplete or corrupt, because of a crash while
+// it was being written, the segment is truncated before it.
+//
+// SegmentStorage aborts upon any filesystem error. This class is
+// threadsafe.
+class SegmentStorage : public KeyValueStorage {
+ public:
+  // A range of bytes of one of the segments.
+  struct Extent {
+    int fd;
+    off_t offset;
+    size_t length;
+  };
+
+  // The length of the header of a record. One of zeros is never
+  // valid, as its CRC would not match.
+  static const size_t kRecordHeaderLength = 12;
+
+  // What ReadRecord() found.
+  enum RecordStatus {
+    RECORD_OK,
+    // |size| bytes are not enough to tell.
+    RECORD_INCOMPLETE,
+    RECORD_CORRUPT,
+  };
+
+  // Starts a new segment when the current one is |max_segment_size|
+  // bytes or more.
+  SegmentStorage(const std::string& dir, off_t max_segment_size);
+  ~SegmentStorage() override;
+
+  // Implement abstract functions, see key_value_storage.h for
+  // comments. ScanEach() only scans the in-memory index, in the
+  // calling thread.
+  std::set<std::string> Scan() const override;
+
+  void ScanEach(const std::function<void(const std::string&)>& callback,
+                int num_threads) const override;
+
+  util::Status CreateEntry(const std::string& key,
+                           const std::string& data) override;
+
+  util::Status UpdateEntry(const std::string& key,
+                           const std::string& data) override;
+
+  util::Status LookupEntry(const std::string& key,
+                           std::string* result) const override;
+
+  // Appends to |extents| where the records of |keys| are, in order,
+  // merging those that follow one another in a segment, as entries
+  // written one after the other do, so that they can be sent as they
+  // are (e.g. with sendfile()) rather than read and copied. Returns
+  // NOT_FOUND at the first key that is not there, with the extents of
+  // the ones before it. The file descriptors stay open for as long as
+  // the storage.
+  util::Status LookupRecords(const std::vector<std::string>& keys,
+                             std::vector<Extent>* extents) const;
+
+  // Reads the record at the start of the |size| bytes at |data|, such
+  // as those of the extents of LookupRecords(), checking its CRC. If
+  // it is RECORD_OK, sets |*record_size| to its length, and |*key| and
+  // |*value| (unless NULL) to its contents.
+  static RecordStatus ReadRecord(const char* data, size_t size,
+                                 size_t* record_size, std::string* key,
+                                 std::string* value);
+
+ private:
+  // Where the record of an entry is.
+  struct Location {
+    int fd;
+    off_t offset;
+    uint32_t size;
+  };
+
+  std::string SegmentPath(size_t segment) const;
+  // Reads the records of a segment into the index, and returns the
+  // length of the valid records at its beginning.
+  off_t IndexSegment(const std::string& path, int fd);
+  // Appends a record for (key, data) to the current segment. This
+  // must be called with "lock_" held.
+  void AppendRecord(const std::string& key, const std::string& data);
+  // Opens, creating it if needed, the segment after the last one.
+  // This must be called with "lock_" held.
+  void OpenNextSegment();
+
+  const std::string dir_;
+  const off_t max_segment_size_;
+
+  mutable std::mutex lock_;
+  // The file descriptors of the segments, in order. Only the last one
+  // is written to.
+  std::vector<int> segment_fds_;
+  off_t segment_size_;
+  std::unordered_map<std::string, Location> index_;
+
+  DISALLOW_COPY_AND_ASSIGN(SegmentStorage);
+};
+
+
+}  // namespace cert_trans
+
+#endif  // CERT_TRANS_LOG_SEGMENT_STORAGE_H_
@@ -0,0 +1,239 @@
+#include "log/segment_storage.h"
+
+#include <fcntl.h>
+#include <gtest/gtest.h>
+#include <memory>
+#include <set>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+#include "util/test_db.h"
+#include "util/testing.h"
+#include "util/util.h"
+
+namespace cert_trans {
+namespace {
+
+using std::string;
+using std::unique_ptr;
+using std::vector;
+
+const off_t kMaxSegmentSize = 1 << 20;
+
+
+class SegmentStorageTest : public ::testing::Test {
+ protected:
+  SegmentStorageTest()
+      : dir_(tmp_.TmpStorageDir() + "/segments"),
+        storage_(new SegmentStorage(dir_, kMaxSegmentSize)) {
+  }
+
+  // Closes the storage and opens it again.
+  void Reopen(off_t max_segment_size) {
+    storage_.reset();
+    storage_.reset(new SegmentStorage(dir_, max_segment_size));
+  }
+
+  off_t FileSize(const string& path) const {
+    struct stat st;
+    CHECK_EQ(stat(path.c_str(), &st), 0) << path;
+    return st.st_size;
+  }
+
+  TmpStorage tmp_;
+  const string dir_;
+  unique_ptr<SegmentStorage> storage_;
+};
+
+
+TEST_F(SegmentStorageTest, CreateAndLookup) {
+  EXPECT_EQ(util::error::NOT_FOUND,
+            storage_->LookupEntry("1234", NULL).CanonicalCode());
+
+  EXPECT_EQ(util::Status::OK, storage_->CreateEntry("1234", "unicorn"));
+  EXPECT_EQ(util::Status::OK, storage_->CreateEntry("1245", "Alice"));
+  EXPECT_EQ(util::error::ALREADY_EXISTS,
+            storage_->CreateEntry("1234", "Bob").CanonicalCode());
+
+  string result;
+  EXPECT_EQ(util::Status::OK, storage_->LookupEntry("1234", &result));
+  EXPECT_EQ("unicorn", result);
+  EXPECT_EQ(util::Status::OK, storage_->LookupEntry("1245", &result));
+  EXPECT_EQ("Alice", result);
+  EXPECT_EQ(std::set<string>({"1234", "1245"}), storage_->Scan());
+}
+
+
+TEST_F(SegmentStorageTest, Update) {
+  EXPECT_EQ(util::error::NOT_FOUND,
+            storage_->UpdateEntry("1234", "unicorn").CanonicalCode());
+  EXPECT_EQ(util::Status::OK, storage_->CreateEntry("1234", "unicorn"));
+  EXPECT_EQ(util::Status::OK, storage_->UpdateEntry("1234", "Alice"));
+
+  string result;
+  EXPECT_EQ(util::Status::OK, storage_->LookupEntry("1234", &result));
+  EXPECT_EQ("Alice", result);
+
+  // The later record wins when the segment is read back.
+  Reopen(kMaxSegmentSize);
+  EXPECT_EQ(util::Status::OK, storage_->LookupEntry("1234", &result));
+  EXPECT_EQ("Alice", result);
+}
+
+
+TEST_F(SegmentStorageTest, Resume) {
+  // Small segments, so that there are several.
+  Reopen(100);
+  std::set<string> keys;
+  for (int i = 0; i < 50; ++i) {
+    const string key(std::to_string(i));
+    EXPECT_EQ(util::Status::OK, storage_->CreateEntry(key, "value " + key));
+    keys.insert(key);
+  }
+  EXPECT_EQ(0, access((dir_ + "/segment-00000005").c_str(), F_OK));
+
+  Reopen(100);
+  EXPECT_EQ(keys, storage_->Scan());
+  std::set<string> scanned;
+  storage_->ScanEach([&scanned](const string& key) { scanned.insert(key); },
+                     4);
+  EXPECT_EQ(keys, scanned);
+  for (const auto& key : keys) {
+    string result;
+    EXPECT_EQ(util::Status::OK, storage_->LookupEntry(key, &result));
+    EXPECT_EQ("value " + key, result);
+  }
+}
+
+
+TEST_F(SegmentStorageTest, TruncatesIncompleteRecord) {
+  EXPECT_EQ(util::Status::OK, storage_->CreateEntry("1234", "unicorn"));
+  const string segment(dir_ + "/segment-00000000");
+  const off_t size(FileSize(segment));
+  EXPECT_EQ(util::Status::OK, storage_->CreateEntry("1245", "Alice"));
+
+  // As if the second record was being written when the log crashed.
+  storage_.reset();
+  CHECK_EQ(truncate(segment.c_str(), FileSize(segment) - 1), 0);
+
+  Reopen(kMaxSegmentSize);
+  EXPECT_EQ(size, FileSize(segment));
+  EXPECT_EQ(std::set<string>({"1234"}), storage_->Scan());
+
+  // It can be written again, and is then read back whole.
+  EXPECT_EQ(util::Status::OK, storage_->CreateEntry("1245", "Alice"));
+  Reopen(kMaxSegmentSize);
+  string result;
+  EXPECT_EQ(util::Status::OK, storage_->LookupEntry("1245", &result));
+  EXPECT_EQ("Alice", result);
+}
+
+
+TEST_F(SegmentStorageTest, TruncatesCorruptRecord) {
+  EXPECT_EQ(util::Status::OK, storage_->CreateEntry("1234", "unicorn"));
+  const string segment(dir_ + "/segment-00000000");
+  const off_t size(FileSize(segment));
+  EXPECT_EQ(util::Status::OK, storage_->CreateEntry("1245", "Alice"));
+
+  storage_.reset();
+  const int fd(open(segment.c_str(), O_WRONLY));
+  CHECK_GE(fd, 0);
+  CHECK_EQ(pwrite(fd, "X", 1, FileSize(segment) - 1), 1);
+  CHECK_EQ(close(fd), 0);
+
+  Reopen(kMaxSegmentSize);
+  EXPECT_EQ(size, FileSize(segment));
+  EXPECT_EQ(util::error::NOT_FOUND,
+            storage_->LookupEntry("1245", NULL).CanonicalCode());
+}
+
+
+TEST_F(SegmentStorageTest, LookupRecords) {
+  for (int i = 0; i < 4; ++i) {
+    const string key(std::to_string(i));
+    EXPECT_EQ(util::Status::OK, storage_->CreateEntry(key, "value " + key));
+  }
+  EXPECT_EQ(util::Status::OK, storage_->UpdateEntry("3", "updated"));
+
+  vector<SegmentStorage::Extent> extents;
+  EXPECT_EQ(util::Status::OK,
+            storage_->LookupRecords({"0", "1", "2", "3"}, &extents));
+  string records;
+  for (const auto& extent : extents) {
+    string data(extent.length, '\0');
+    CHECK_EQ(pread(extent.fd, &data[0], data.size(), extent.offset),
+             static_cast<ssize_t>(data.size()));
+    records += data;
+  }
+  // The first three records follow one another, while the updated
+  // one comes after its old record.
+  ASSERT_EQ(2U, extents.size());
+  EXPECT_EQ(extents[0].fd, extents[1].fd);
+  EXPECT_EQ(0, extents[0].offset);
+  EXPECT_LT(static_cast<off_t>(extents[0].length), extents[1].offset);
+
+  size_t pos(0);
+  for (const string expected : {"value 0", "value 1", "value 2", "updated"}) {
+    size_t size;
+    string key;
+    string value;
+    ASSERT_EQ(SegmentStorage::RECORD_OK,
+              SegmentStorage::ReadRecord(records.data() + pos,
+                                         records.size() - pos, &size, &key,
+                                         &value));
+    EXPECT_EQ(expected, value);
+    pos += size;
+  }
+  EXPECT_EQ(records.size(), pos);
+
+  extents.clear();
+  EXPECT_EQ(util::error::NOT_FOUND,
+            storage_->LookupRecords({"2", "3", "4"}, &extents)
+                .CanonicalCode());
+  EXPECT_FALSE(extents.empty());
+}
+
+
+TEST_F(SegmentStorageTest, ReadRecord) {
+  EXPECT_EQ(util::Status::OK, storage_->CreateEntry("1234", "unicorn"));
+  vector<SegmentStorage::Extent> extents;
+  EXPECT_EQ(util::Status::OK, storage_->LookupRecords({"1234"}, &extents));
+  ASSERT_EQ(1U, extents.size());
+  string record(extents[0].length, '\0');
+  CHECK_EQ(pread(extents[0].fd, &record[0], record.size(), extents[0].offset),
+           static_cast<ssize_t>(record.size()));
+
+  size_t size;
+  string key;
+  EXPECT_EQ(SegmentStorage::RECORD_OK,
+            SegmentStorage::ReadRecord(record.data(), record.size(), &size,
+                                       &key, NULL));
+  EXPECT_EQ(record.size(), size);
+  EXPECT_EQ("1234", key);
+  EXPECT_EQ(SegmentStorage::RECORD_INCOMPLETE,
+            SegmentStorage::ReadRecord(record.data(), record.size() - 1,
+                                       &size, &key, NULL));
+  EXPECT_EQ(SegmentStorage::RECORD_INCOMPLETE,
+            SegmentStorage::ReadRecord(record.data(), 3, &size, &key, NULL));
+
+  record[record.size() - 1] ^= 1;
+  EXPECT_EQ(SegmentStorage::RECORD_CORRUPT,
+            SegmentStorage::ReadRecord(record.data(), record.size(), &size,
+                                       &key, NULL));
+  const string zeros(SegmentStorage::kRecordHeaderLength, '\0');
+  EXPECT_EQ(SegmentStorage::RECORD_CORRUPT,
+            SegmentStorage::ReadRecord(zeros.data(), zeros.size(), &size,
+                                       &key, NULL));
+}
+
+
+}  // namespace
+}  // namespace cert_trans
+
+
+int main(int argc, char** argv) {
+  cert_trans::test::InitTesting(argv[0], &argc, &argv, true);
+  return RUN_ALL_TESTS();
+}
@@ -4,10 +4,13 @@
 #include <glog/logging.h>
 #include <openssl/evp.h>
 #include <openssl/opensslv.h>
+#include <openssl/sha.h>
 #include <stdint.h>
 
 #include "log/verifier.h"
 #include "proto/ct.pb.h"
+#include "util/status.h"
+#include "util/task.h"
 #include "util/util.h"
 
 #if OPENSSL_VERSION_NUMBER < 0x10000000
@@ -35,6 +38,8 @@ Signer::Signer(EVP_PKEY* pkey) : pkey_(CHECK_NOTNULL(pkey)) {
 }
 
 Signer::~Signer() {
+  for (EVP_PKEY_CTX* ctx : contexts_)
+    EVP_PKEY_CTX_free(ctx);
   EVP_PKEY_free(pkey_);
 }
 
@@ -46,7 +51,29 @@ void Signer::Sign(const std::string& data,
                   ct::DigitallySigned* signature) const {
   signature->set_hash_algorithm(hash_algo_);
   signature->set_sig_algorithm(sig_algo_);
-  signature->set_signature(RawSign(data));
+  EVP_PKEY_CTX* const ctx(TakeContext());
+  signature->set_signature(RawSign(ctx, data));
+  ReturnContext(ctx);
+}
+
+void Signer::SignBatch(
+    const std::vector<std::string>& data,
+    const std::vector<ct::DigitallySigned*>& signatures) const {
+  CHECK_EQ(data.size(), signatures.size());
+  EVP_PKEY_CTX* const ctx(TakeContext());
+  for (size_t i = 0; i < data.size(); ++i) {
+    signatures[i]->set_hash_algorithm(hash_algo_);
+    signatures[i]->set_sig_algorithm(sig_algo_);
+    signatures[i]->set_signature(RawSign(ctx, data[i]));
+  }
+  ReturnContext(ctx);
+}
+
+void Signer::SignAsync(const std::string& data,
+                       ct::DigitallySigned* signature,
+                       util::Task* task) const {
+  Sign(data, signature);
+  task->Return(util::Status::OK);
 }
 
 Signer::Signer()
@@ -55,22 +82,42 @@ Signer::Signer()
       sig_algo_(ct::DigitallySigned::ANONYMOUS) {
 }
 
-std::string Signer::RawSign(const std::string& data) const {
-  EVP_MD_CTX ctx;
-  EVP_MD_CTX_init(&ctx);
-  // NOTE: this syntax for setting the hash function requires OpenSSL >= 1.0.0.
-  CHECK_EQ(1, EVP_SignInit(&ctx, EVP_sha256()));
-  CHECK_EQ(1, EVP_SignUpdate(&ctx, data.data(), data.size()));
-  unsigned int sig_size = EVP_PKEY_size(pkey_);
-  unsigned char* sig = new unsigned char[sig_size];
-
-  CHECK_EQ(1, EVP_SignFinal(&ctx, sig, &sig_size, pkey_));
+// Same as EVP_SignFinal() with SHA256, but with |ctx| rather than
+// setting up a new EVP_PKEY_CTX every time.
+std::string Signer::RawSign(EVP_PKEY_CTX* ctx,
+                            const std::string& data) const {
+  unsigned char digest[SHA256_DIGEST_LENGTH];
+  SHA256(reinterpret_cast<const unsigned char*>(data.data()), data.size(),
+         digest);
 
-  EVP_MD_CTX_cleanup(&ctx);
-  std::string ret(reinterpret_cast<char*>(sig), sig_size);
+  size_t sig_size = EVP_PKEY_size(pkey_);
+  std::string ret(sig_size, '\0');
+  CHECK_EQ(1, EVP_PKEY_sign(ctx, reinterpret_cast<unsigned char*>(&ret[0]),
+                            &sig_size, digest, sizeof(digest)));
 
-  delete[] sig;
+  ret.resize(sig_size);
   return ret;
 }
 
+EVP_PKEY_CTX* Signer::TakeContext() const {
+  {
+    std::lock_guard<std::mutex> lock(contexts_lock_);
+    if (!contexts_.empty()) {
+      EVP_PKEY_CTX* const ctx(contexts_.back());
+      contexts_.pop_back();
+      return ctx;
+    }
+  }
+
+  EVP_PKEY_CTX* const ctx(CHECK_NOTNULL(EVP_PKEY_CTX_new(pkey_, NULL)));
+  CHECK_EQ(1, EVP_PKEY_sign_init(ctx));
+  CHECK_LT(0, EVP_PKEY_CTX_set_signature_md(ctx, EVP_sha256()));
+  return ctx;
+}
+
+void Signer::ReturnContext(EVP_PKEY_CTX* ctx) const {
+  std::lock_guard<std::mutex> lock(contexts_lock_);
+  contexts_.push_back(ctx);
+}
+
 }  // namespace cert_trans
@@ -3,13 +3,19 @@
 #ifndef SRC_LOG_SIGNER_H_
 #define SRC_LOG_SIGNER_H_
 
+#include <mutex>
 #include <openssl/evp.h>
 #include <openssl/x509.h>  // for i2d_PUBKEY
 #include <stdint.h>
+#include <vector>
 
 #include "base/macros.h"
 #include "proto/ct.pb.h"
 
+namespace util {
+class Task;
+}  // namespace util
+
 namespace cert_trans {
 
 class Signer {
@@ -22,18 +28,42 @@ class Signer {
   virtual void Sign(const std::string& data,
                     ct::DigitallySigned* signature) const;
 
+  // Same as calling Sign() for each of |data| and the corresponding
+  // |signatures|, but with the same signing context throughout.
+  virtual void SignBatch(
+      const std::vector<std::string>& data,
+      const std::vector<ct::DigitallySigned*>& signatures) const;
+
+  // Same as Sign(), but returns through |task| rather than blocking,
+  // for signers whose key is held elsewhere (e.g. in an HSM, or by a
+  // remote signing service), so that their latency does not tie up
+  // the calling thread. |data| is not needed once this returns, but
+  // |signature| must remain valid until |task| is done. This one signs
+  // with the local key before returning.
+  virtual void SignAsync(const std::string& data,
+                         ct::DigitallySigned* signature,
+                         util::Task* task) const;
+
  protected:
   // A constructor for mocking.
   Signer();
 
  private:
-  std::string RawSign(const std::string& data) const;
+  std::string RawSign(EVP_PKEY_CTX* ctx, const std::string& data) const;
+
+  // Signing contexts are set up for |pkey_| once, and kept for the
+  // next signature.
+  EVP_PKEY_CTX* TakeContext() const;
+  void ReturnContext(EVP_PKEY_CTX* ctx) const;
 
   EVP_PKEY* pkey_;
   ct::DigitallySigned::HashAlgorithm hash_algo_;
   ct::DigitallySigned::SignatureAlgorithm sig_algo_;
   std::string key_id_;
 
+  mutable std::mutex contexts_lock_;
+  mutable std::vector<EVP_PKEY_CTX*> contexts_;
+
   DISALLOW_COPY_AND_ASSIGN(Signer);
 };
 
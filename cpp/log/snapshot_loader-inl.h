@@ -0,0 +1,284 @@
+#ifndef CERT_TRANS_LOG_SNAPSHOT_LOADER_INL_H_
+#define CERT_TRANS_LOG_SNAPSHOT_LOADER_INL_H_
+
+#include "log/snapshot_loader.h"
+
+#include <algorithm>
+#include <dirent.h>
+#include <errno.h>
+#include <fstream>
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "log/entry_archive.h"
+#include "merkletree/compact_merkle_tree.h"
+#include "merkletree/serial_hasher.h"
+
+DEFINE_int32(snapshot_load_batch_size, 10000,
+             "number of entries written to the database at once when "
+             "loading a snapshot");
+
+namespace {
+
+const char kSnapshotTreeHeadName[] = "sth";
+const char kSnapshotArchivePrefix[] = "archive-";
+const char kSnapshotCheckpointPrefix[] = "checkpoint-";
+const size_t kSnapshotIndexDigits = 16;
+
+
+std::string SnapshotIndexName(const std::string& prefix, int64_t index) {
+  const std::string number(std::to_string(index));
+  return prefix +
+         std::string(kSnapshotIndexDigits -
+                         std::min(kSnapshotIndexDigits, number.size()),
+                     '0') +
+         number;
+}
+
+
+// Returns the names in |dir| made of |prefix| and an index, sorted by
+// index.
+std::vector<std::string> ListSnapshotIndexNames(const std::string& dir,
+                                                const std::string& prefix) {
+  std::vector<std::string> names;
+  DIR* const d(opendir(dir.c_str()));
+  if (!d) {
+    return names;
+  }
+  while (struct dirent* const entry = readdir(d)) {
+    const std::string name(entry->d_name);
+    // Files still being written have a suffix.
+    if (name.size() == prefix.size() + kSnapshotIndexDigits &&
+        name.compare(0, prefix.size(), prefix) == 0) {
+      names.push_back(name);
+    }
+  }
+  CHECK_EQ(closedir(d), 0);
+
+  // The indices are zero-padded, so these sort in order.
+  std::sort(names.begin(), names.end());
+  return names;
+}
+
+
+}  // namespace
+
+
+template <class Logged>
+SnapshotLoader<Logged>::SnapshotLoader(const std::string& dir,
+                                       const std::string& checkpoint_dir,
+                                       Database<Logged>* db)
+    : dir_(dir), checkpoint_dir_(checkpoint_dir), db_(CHECK_NOTNULL(db)) {
+  if (mkdir(checkpoint_dir_.c_str(), 0700) != 0) {
+    CHECK_EQ(errno, EEXIST) << checkpoint_dir_ << ": " << strerror(errno);
+  }
+}
+
+
+template <class Logged>
+SnapshotLoader<Logged>::~SnapshotLoader() {
+}
+
+
+template <class Logged>
+util::Status SnapshotLoader<Logged>::ReadTreeHead(
+    ct::SignedTreeHead* sth) const {
+  CHECK_NOTNULL(sth);
+  const std::string path(dir_ + "/" + kSnapshotTreeHeadName);
+  std::ifstream input(path);
+  if (!input) {
+    return util::Status(util::error::NOT_FOUND, "cannot open " + path);
+  }
+  if (!sth->ParseFromIstream(&input)) {
+    return util::Status(util::error::INVALID_ARGUMENT,
+                        "cannot parse tree head in " + path);
+  }
+  return util::Status::OK;
+}
+
+
+template <class Logged>
+util::Status SnapshotLoader<Logged>::Load(const ct::SignedTreeHead& sth) {
+  CHECK_GE(sth.tree_size(), 0);
+  CompactMerkleTree tree(new Sha256Hasher);
+  RestoreCheckpoint(std::min<int64_t>(sth.tree_size(), db_->TreeSize()),
+                    &tree);
+
+  if (static_cast<int64_t>(tree.LeafCount()) < sth.tree_size()) {
+    std::vector<std::unique_ptr<cert_trans::EntryArchive>> archives;
+    util::Status status(OpenArchives(&archives));
+    if (!status.ok()) {
+      return status;
+    }
+
+    LOG(INFO) << "Loading entries " << tree.LeafCount() << " to "
+              << sth.tree_size() - 1 << " from " << dir_;
+    db_->BeginBulkLoad();
+    std::vector<Logged> entries;
+    std::vector<std::string> block;
+    for (const auto& archive : archives) {
+      int64_t index(tree.LeafCount());
+      const int64_t end_index(
+          std::min<int64_t>(archive->end_index(), sth.tree_size()));
+      if (index >= end_index) {
+        continue;
+      }
+
+      while (index < end_index) {
+        block.clear();
+        archive->ReadBlock(index, &block);
+        for (size_t i = 0; i < block.size() && index < end_index; ++i) {
+          entries.emplace_back();
+          Logged* const entry(&entries.back());
+          if (!entry->ParseFromDatabase(block[i])) {
+            db_->EndBulkLoad();
+            return util::Status(util::error::DATA_LOSS,
+                                "cannot parse entry " + std::to_string(index));
+          }
+          entry->set_sequence_number(index++);
+
+          std::string leaf_hash;
+          CHECK(entry->LeafHash(&leaf_hash));
+          tree.AddLeafHash(leaf_hash);
+        }
+
+        if (entries.size() >=
+            static_cast<size_t>(FLAGS_snapshot_load_batch_size)) {
+          status = WriteEntries(&entries);
+          if (!status.ok()) {
+            db_->EndBulkLoad();
+            return status;
+          }
+        }
+      }
+
+      status = WriteEntries(&entries);
+      if (!status.ok()) {
+        db_->EndBulkLoad();
+        return status;
+      }
+      WriteCheckpoint(tree);
+      LOG(INFO) << "Loaded " << index << " entries";
+    }
+    db_->EndBulkLoad();
+  }
+
+  if (static_cast<int64_t>(tree.LeafCount()) < sth.tree_size()) {
+    return util::Status(util::error::FAILED_PRECONDITION,
+                        "snapshot only has " +
+                            std::to_string(tree.LeafCount()) + " entries");
+  }
+  if (tree.CurrentRoot() != sth.sha256_root_hash()) {
+    return util::Status(util::error::DATA_LOSS,
+                        "entries do not match the root hash of the snapshot");
+  }
+
+  return util::Status::OK;
+}
+
+
+template <class Logged>
+util::Status SnapshotLoader<Logged>::OpenArchives(
+    std::vector<std::unique_ptr<cert_trans::EntryArchive>>* archives) const {
+  CHECK_NOTNULL(archives);
+  for (const auto& name :
+       ListSnapshotIndexNames(dir_, kSnapshotArchivePrefix)) {
+    archives->emplace_back(new cert_trans::EntryArchive(dir_ + "/" + name));
+    const int64_t expected_first(
+        archives->size() > 1 ? (*archives)[archives->size() - 2]->end_index()
+                             : 0);
+    if (archives->back()->first_index() != expected_first) {
+      return util::Status(util::error::FAILED_PRECONDITION,
+                          "archives in " + dir_ + " are not contiguous at " +
+                              name);
+    }
+  }
+  return util::Status::OK;
+}
+
+
+template <class Logged>
+void SnapshotLoader<Logged>::RestoreCheckpoint(int64_t max_size,
+                                               CompactMerkleTree* tree) const {
+  CHECK_NOTNULL(tree);
+  const std::vector<std::string> names(
+      ListSnapshotIndexNames(checkpoint_dir_, kSnapshotCheckpointPrefix));
+  for (auto it = names.rbegin(); it != names.rend(); ++it) {
+    std::ifstream input(checkpoint_dir_ + "/" + *it);
+    ct::CompactMerkleTreeCheckpoint checkpoint;
+    if (!checkpoint.ParseFromIstream(&input)) {
+      LOG(WARNING) << "Ignoring unreadable checkpoint " << *it;
+      continue;
+    }
+    if (checkpoint.tree_size() > max_size) {
+      continue;
+    }
+
+    const std::vector<std::string> frontier(checkpoint.node().begin(),
+                                            checkpoint.node().end());
+    const util::Status status(tree->Restore(checkpoint.tree_size(), frontier));
+    if (!status.ok()) {
+      LOG(WARNING) << "Ignoring invalid checkpoint " << *it << ": " << status;
+      continue;
+    }
+    LOG(INFO) << "Resuming from checkpoint of " << checkpoint.tree_size()
+              << " entries";
+    return;
+  }
+}
+
+
+template <class Logged>
+void SnapshotLoader<Logged>::WriteCheckpoint(
+    const CompactMerkleTree& tree) const {
+  ct::CompactMerkleTreeCheckpoint checkpoint;
+  checkpoint.set_tree_size(tree.LeafCount());
+  for (const auto& node : tree.Frontier()) {
+    checkpoint.add_node(node);
+  }
+
+  const std::string path(CheckpointPath(tree.LeafCount()));
+  const std::string tmp_path(path + ".tmp");
+  {
+    std::ofstream output(tmp_path, std::ios::trunc);
+    CHECK(checkpoint.SerializeToOstream(&output)) << tmp_path;
+  }
+  CHECK_EQ(rename(tmp_path.c_str(), path.c_str()), 0) << path << ": "
+                                                      << strerror(errno);
+}
+
+
+template <class Logged>
+std::string SnapshotLoader<Logged>::CheckpointPath(int64_t tree_size) const {
+  return checkpoint_dir_ + "/" +
+         SnapshotIndexName(kSnapshotCheckpointPrefix, tree_size);
+}
+
+
+template <class Logged>
+util::Status SnapshotLoader<Logged>::WriteEntries(
+    std::vector<Logged>* entries) {
+  if (entries->empty()) {
+    return util::Status::OK;
+  }
+
+  size_t written;
+  const typename Database<Logged>::WriteResult result(
+      db_->CreateSequencedEntries(*entries, &written));
+  if (result != Database<Logged>::OK) {
+    return util::Status(util::error::FAILED_PRECONDITION,
+                        "cannot write entry " +
+                            std::to_string(
+                                (*entries)[written].sequence_number()) +
+                            ", error " + std::to_string(result));
+  }
+  CHECK_EQ(written, entries->size());
+  entries->clear();
+  return util::Status::OK;
+}
+
+
+#endif  // CERT_TRANS_LOG_SNAPSHOT_LOADER_INL_H_
@@ -0,0 +1,87 @@
+#ifndef CERT_TRANS_LOG_SNAPSHOT_LOADER_H_
+#define CERT_TRANS_LOG_SNAPSHOT_LOADER_H_
+
+#include <memory>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "base/macros.h"
+#include "log/database.h"
+#include "proto/ct.pb.h"
+#include "util/status.h"
+
+class CompactMerkleTree;
+
+namespace cert_trans {
+class EntryArchive;
+}  // namespace cert_trans
+
+
+// Loads a snapshot of a log into a database, to bootstrap a mirror
+// much faster than by fetching the entries from the log. A snapshot
+// is a directory of:
+//
+// <dir>/sth                      - The tree head of the log, as a
+//                                  serialized ct::SignedTreeHead.
+// <dir>/archive-NNNNNNNNNNNNNNNN - cert_trans::EntryArchive files of
+//                                  the entries from index N on, as
+//                                  ArchivedDB writes them.
+//
+// The archives have to hold the entries of the tree head, from index
+// 0. They are written in order, with the database in bulk load mode
+// (see Database::BeginBulkLoad()), and their leaf hashes added to a
+// CompactMerkleTree, whose root has to match that of the tree head.
+//
+// After each archive, the state of that tree is saved in a checkpoint
+// directory, as:
+//
+// <checkpoint_dir>/checkpoint-NNNNNNNNNNNNNNNN - The tree of the first
+//                                                N entries.
+//
+// each a serialized ct::CompactMerkleTreeCheckpoint.
+//
+// An interrupted load carries on from the last checkpoint that the
+// database has all the entries of, rather than from the beginning.
+// Entries written in bulk load mode are not necessarily durable, so
+// this might not be the last one written.
+template <class Logged>
+class SnapshotLoader {
+ public:
+  // Does not take ownership of |db|.
+  SnapshotLoader(const std::string& dir, const std::string& checkpoint_dir,
+                 Database<Logged>* db);
+  ~SnapshotLoader();
+
+  // Reads the tree head of the snapshot. Its signature is not
+  // verified.
+  util::Status ReadTreeHead(ct::SignedTreeHead* sth) const;
+
+  // Loads the entries of |sth|, which must be the tree head of the
+  // snapshot, into the database. This returns quickly if a previous
+  // load already finished. If the entries do not match |sth|,
+  // the database holds entries that are not those of the log, and
+  // should be discarded.
+  util::Status Load(const ct::SignedTreeHead& sth);
+
+ private:
+  // Opens the archives of the snapshot, in order.
+  util::Status OpenArchives(
+      std::vector<std::unique_ptr<cert_trans::EntryArchive>>* archives) const;
+  // Restores |*tree| from the last checkpoint of at most |max_size|
+  // entries, if there is one.
+  void RestoreCheckpoint(int64_t max_size, CompactMerkleTree* tree) const;
+  void WriteCheckpoint(const CompactMerkleTree& tree) const;
+  std::string CheckpointPath(int64_t tree_size) const;
+  // Writes |*entries| to the database, and clears it.
+  util::Status WriteEntries(std::vector<Logged>* entries);
+
+  const std::string dir_;
+  const std::string checkpoint_dir_;
+  Database<Logged>* const db_;
+
+  DISALLOW_COPY_AND_ASSIGN(SnapshotLoader);
+};
+
+
+#endif  // CERT_TRANS_LOG_SNAPSHOT_LOADER_H_
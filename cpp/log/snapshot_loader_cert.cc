@@ -0,0 +1,4 @@
+#include "log/logged_certificate.h"
+#include "log/snapshot_loader-inl.h"
+
+template class SnapshotLoader<cert_trans::LoggedCertificate>;
@@ -0,0 +1,175 @@
+#include "log/snapshot_loader.h"
+
+#include <algorithm>
+#include <fstream>
+#include <gtest/gtest.h>
+#include <memory>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+#include "log/entry_archive.h"
+#include "log/logged_certificate.h"
+#include "log/sqlite_db.h"
+#include "log/test_signer.h"
+#include "merkletree/compact_merkle_tree.h"
+#include "merkletree/serial_hasher.h"
+#include "util/test_db.h"
+#include "util/testing.h"
+
+namespace {
+
+using cert_trans::EntryArchiveWriter;
+using cert_trans::LoggedCertificate;
+using std::string;
+using std::unique_ptr;
+using std::vector;
+using util::Status;
+
+typedef Database<LoggedCertificate> DB;
+
+const int64_t kRangeSize = 10;
+const uint32_t kEntriesPerBlock = 4;
+
+
+class SnapshotLoaderTest : public ::testing::Test {
+ protected:
+  SnapshotLoaderTest()
+      : snapshot_dir_(tmp_.TmpStorageDir() + "/snapshot"),
+        checkpoint_dir_(tmp_.TmpStorageDir() + "/checkpoints"),
+        db_(new SQLiteDB<LoggedCertificate>(tmp_.TmpStorageDir() +
+                                            "/sqlite")) {
+    CHECK_EQ(mkdir(snapshot_dir_.c_str(), 0700), 0);
+  }
+
+  // Writes a snapshot of |count| entries, in archives of kRangeSize
+  // entries, with a tree head of the first |tree_size| of them.
+  void WriteSnapshot(int count, int64_t tree_size) {
+    for (int i = 0; i < count; ++i) {
+      logged_.emplace_back();
+      test_signer_.CreateUnique(&logged_.back());
+      logged_.back().set_sequence_number(i);
+    }
+
+    for (int64_t first = 0; first < count; first += kRangeSize) {
+      const string number(std::to_string(first));
+      EntryArchiveWriter writer(snapshot_dir_ + "/archive-" +
+                                    string(16 - number.size(), '0') + number,
+                                first, kEntriesPerBlock, "");
+      for (int64_t i = first; i < std::min<int64_t>(first + kRangeSize, count);
+           ++i) {
+        string data;
+        CHECK(logged_[i].SerializeForDatabase(&data));
+        writer.Add(data);
+      }
+      writer.Finish();
+    }
+
+    CompactMerkleTree tree(new Sha256Hasher);
+    for (int64_t i = 0; i < tree_size; ++i) {
+      string leaf;
+      CHECK(logged_[i].SerializeForLeaf(&leaf));
+      tree.AddLeaf(leaf);
+    }
+    test_signer_.CreateUnique(&sth_);
+    sth_.set_tree_size(tree_size);
+    sth_.set_sha256_root_hash(tree.CurrentRoot());
+    std::ofstream output(snapshot_dir_ + "/sth");
+    CHECK(sth_.SerializeToOstream(&output));
+  }
+
+  Status Load() {
+    SnapshotLoader<LoggedCertificate> loader(snapshot_dir_, checkpoint_dir_,
+                                             db_.get());
+    ct::SignedTreeHead sth;
+    const Status status(loader.ReadTreeHead(&sth));
+    if (!status.ok()) {
+      return status;
+    }
+    TestSigner::TestEqualTreeHeads(sth_, sth);
+    return loader.Load(sth);
+  }
+
+  void ExpectEntries(int64_t tree_size) {
+    EXPECT_EQ(tree_size, db_->TreeSize());
+    for (int64_t i = 0; i < tree_size; ++i) {
+      LoggedCertificate lookup;
+      EXPECT_EQ(DB::LOOKUP_OK, db_->LookupByIndex(i, &lookup));
+      TestSigner::TestEqualLoggedCerts(logged_[i], lookup);
+      EXPECT_EQ(DB::LOOKUP_OK, db_->LookupByHash(logged_[i].Hash(), &lookup));
+      TestSigner::TestEqualLoggedCerts(logged_[i], lookup);
+    }
+  }
+
+  TmpStorage tmp_;
+  TestSigner test_signer_;
+  const string snapshot_dir_;
+  const string checkpoint_dir_;
+  unique_ptr<DB> db_;
+  vector<LoggedCertificate> logged_;
+  ct::SignedTreeHead sth_;
+};
+
+
+TEST_F(SnapshotLoaderTest, LoadsEntries) {
+  WriteSnapshot(25, 25);
+  EXPECT_EQ(Status::OK, Load());
+  ExpectEntries(25);
+}
+
+
+TEST_F(SnapshotLoaderTest, LoadsUpToTreeHead) {
+  WriteSnapshot(25, 13);
+  EXPECT_EQ(Status::OK, Load());
+  ExpectEntries(13);
+  LoggedCertificate lookup;
+  EXPECT_EQ(DB::NOT_FOUND, db_->LookupByIndex(13, &lookup));
+}
+
+
+TEST_F(SnapshotLoaderTest, ResumesFromCheckpoint) {
+  WriteSnapshot(25, 25);
+  EXPECT_EQ(Status::OK, Load());
+
+  // The entries are not read again once loaded.
+  CHECK_EQ(unlink((snapshot_dir_ + "/archive-0000000000000000").c_str()), 0);
+  EXPECT_EQ(Status::OK, Load());
+  ExpectEntries(25);
+}
+
+
+TEST_F(SnapshotLoaderTest, MissingEntries) {
+  WriteSnapshot(25, 25);
+  sth_.set_tree_size(30);
+  std::ofstream output(snapshot_dir_ + "/sth");
+  CHECK(sth_.SerializeToOstream(&output));
+  output.close();
+
+  EXPECT_EQ(util::error::FAILED_PRECONDITION, Load().CanonicalCode());
+}
+
+
+TEST_F(SnapshotLoaderTest, WrongRootHash) {
+  WriteSnapshot(25, 25);
+  sth_.set_sha256_root_hash(string(32, 'x'));
+  std::ofstream output(snapshot_dir_ + "/sth");
+  CHECK(sth_.SerializeToOstream(&output));
+  output.close();
+
+  EXPECT_EQ(util::error::DATA_LOSS, Load().CanonicalCode());
+}
+
+
+TEST_F(SnapshotLoaderTest, NoTreeHead) {
+  EXPECT_EQ(util::error::NOT_FOUND, Load().CanonicalCode());
+}
+
+
+}  // namespace
+
+
+int main(int argc, char** argv) {
+  cert_trans::test::InitTesting(argv[0], &argc, &argv, true);
+  return RUN_ALL_TESTS();
+}
@@ -7,6 +7,7 @@
 #include <gflags/gflags.h>
 #include <glog/logging.h>
 #include <sqlite3.h>
+#include <strings.h>
 
 #include "log/sqlite_statement.h"
 #include "monitoring/monitoring.h"
@@ -18,10 +19,8 @@
 // (https://www.sqlite.org/pragma.html) for a description of the various
 // values available and the implications they have.
 
-// TODO(pphaneuf): For now, just a flag, but ideally, when adding a
-// new node, it would do an initial load of its local database with
-// "synchronous" set to OFF, then put it back before starting normal
-// operation.
+// During a bulk load, "synchronous" is set to OFF regardless, and put
+// back afterwards.
 DEFINE_string(sqlite_synchronous_mode, "FULL",
               "Which SQLite synchronous option to use, see SQLite pragma "
               "documentation for details.");
@@ -38,6 +37,10 @@ DEFINE_bool(sqlite_batch_into_transactions, true,
             "scenes.");
 DEFINE_int32(sqlite_transaction_batch_size, 400,
              "Max number of operations to batch into one transaction.");
+DEFINE_int32(sqlite_read_connections, 4,
+             "Number of read-only connections to do lookups with, so that "
+             "they do not wait for writes. Only used when the journal mode "
+             "is WAL.");
 
 
 namespace {
@@ -48,6 +51,19 @@ static cert_trans::Latency<std::chrono::milliseconds, std::string>
                      "Database latency in ms broken out by operation");
 
 
+// The number of operations batched into one transaction during a bulk
+// load, where nothing waits on them to be committed.
+const int64_t kBulkLoadTransactionSize = 100000;
+
+
+void SetSynchronousMode(sqlite3* db, const std::string& mode) {
+  std::ostringstream oss;
+  oss << "PRAGMA synchronous = " << mode;
+  sqlite::Statement statement(db, oss.str().c_str());
+  CHECK_EQ(SQLITE_DONE, statement.Step());
+}
+
+
 sqlite3* SQLiteOpen(const std::string& dbfile) {
   cert_trans::ScopedLatency scoped_latency(
       latency_by_op_ms.GetScopedLatency("open"));
@@ -92,9 +108,85 @@ sqlite3* SQLiteOpen(const std::string& dbfile) {
 }
 
 
+sqlite3* SQLiteOpenReadOnly(const std::string& dbfile) {
+  sqlite3* retval;
+  CHECK_EQ(SQLITE_OK, sqlite3_open_v2(dbfile.c_str(), &retval,
+                                      SQLITE_OPEN_READONLY, nullptr))
+      << dbfile;
+  return retval;
+}
+
+
 }  // namespace
 
 
+template <class Logged>
+struct SQLiteDB<Logged>::Reader {
+  explicit Reader(const std::string& dbfile)
+      : db(SQLiteOpenReadOnly(dbfile)),
+        statements(new sqlite::StatementCache(db)) {
+  }
+
+  ~Reader() {
+    // The statements have to be finalized before closing.
+    statements.reset();
+    CHECK_EQ(SQLITE_OK, sqlite3_close(db));
+  }
+
+  sqlite3* const db;
+  std::unique_ptr<sqlite::StatementCache> statements;
+};
+
+
+// Gives a connection to read with: a read-only one if there is one
+// free, and |db_| has no uncommitted writes, which it would not see,
+// or otherwise |db_| itself, with |lock_| held.
+template <class Logged>
+class SQLiteDB<Logged>::ReadAccess {
+ public:
+  explicit ReadAccess(const SQLiteDB<Logged>* db)
+      : db_(CHECK_NOTNULL(db)),
+        lock_(db_->lock_),
+        reader_(nullptr),
+        tree_size_(db_->tree_size_) {
+    if (!db_->uncommitted_writes_) {
+      reader_ = db_->AcquireReader();
+      if (reader_) {
+        lock_.unlock();
+      }
+    }
+  }
+
+  ~ReadAccess() {
+    if (reader_) {
+      db_->ReleaseReader(reader_);
+    }
+  }
+
+  sqlite::StatementCache* statements() const {
+    return reader_ ? reader_->statements.get() : db_->statements_.get();
+  }
+
+  // Whether |lock_| is held, and so |tree_size_| can be updated.
+  bool locked() const {
+    return lock_.owns_lock();
+  }
+
+  // The value of |tree_size_| when this was created.
+  int64_t tree_size() const {
+    return tree_size_;
+  }
+
+ private:
+  const SQLiteDB<Logged>* const db_;
+  std::unique_lock<std::mutex> lock_;
+  Reader* reader_;
+  const int64_t tree_size_;
+
+  DISALLOW_COPY_AND_ASSIGN(ReadAccess);
+};
+
+
 template <class Logged>
 class SQLiteDB<Logged>::Iterator : public Database<Logged>::Iterator {
  public:
@@ -105,14 +197,15 @@ class SQLiteDB<Logged>::Iterator : public Database<Logged>::Iterator {
 
   bool GetNextEntry(Logged* entry) override {
     CHECK_NOTNULL(entry);
-    std::unique_lock<std::mutex> lock(db_->lock_);
-    if (next_index_ < db_->tree_size_) {
-      CHECK_EQ(db_->LookupByIndex(lock, next_index_, entry), db_->LOOKUP_OK);
+    const ReadAccess access(db_);
+    if (next_index_ < access.tree_size()) {
+      CHECK_EQ(db_->LookupByIndex(access, next_index_, entry),
+               db_->LOOKUP_OK);
       ++next_index_;
       return true;
     }
 
-    const bool retval(db_->LookupNextIndex(lock, next_index_, entry) ==
+    const bool retval(db_->LookupNextIndex(access, next_index_, entry) ==
                       db_->LOOKUP_OK);
     if (retval) {
       next_index_ = entry->sequence_number() + 1;
@@ -121,6 +214,54 @@ class SQLiteDB<Logged>::Iterator : public Database<Logged>::Iterator {
     return retval;
   }
 
+  // Reads the entries with a single range query, rather than one
+  // query per entry.
+  size_t GetNextEntries(size_t max_entries,
+                        std::vector<Logged>* entries) override {
+    CHECK_NOTNULL(entries);
+    if (max_entries == 0) {
+      return 0;
+    }
+
+    const ReadAccess access(db_);
+    sqlite::CachedStatement statement(access.statements(),
+                                      "SELECT entry, hash, sequence "
+                                      "FROM leaves WHERE sequence >= ? "
+                                      "ORDER BY sequence LIMIT ?");
+    statement->BindUInt64(0, next_index_);
+    statement->BindUInt64(1, max_entries);
+
+    size_t count(0);
+    int ret;
+    while ((ret = statement->Step()) == SQLITE_ROW) {
+      entries->emplace_back();
+      Logged* const entry(&entries->back());
+
+      size_t size;
+      const char* const data(statement->GetBlobData(0, &size));
+      CHECK(entry->ParseFromDatabase(data, size));
+
+      std::string hash;
+      statement->GetBlob(1, &hash);
+      CHECK_EQ(entry->Hash(), hash);
+
+      entry->set_sequence_number(statement->GetUInt64(2));
+      // Entries below the tree size cannot be missing.
+      CHECK(next_index_ >= access.tree_size() ||
+            entry->sequence_number() == next_index_)
+          << "missing entry " << next_index_;
+      if (access.locked() && entry->sequence_number() == db_->tree_size_) {
+        ++db_->tree_size_;
+      }
+
+      next_index_ = entry->sequence_number() + 1;
+      ++count;
+    }
+    CHECK_EQ(SQLITE_DONE, ret);
+
+    return count;
+  }
+
  private:
   const SQLiteDB<Logged>* const db_;
   int64_t next_index_;
@@ -130,23 +271,38 @@ class SQLiteDB<Logged>::Iterator : public Database<Logged>::Iterator {
 template <class Logged>
 SQLiteDB<Logged>::SQLiteDB(const std::string& dbfile)
     : db_(SQLiteOpen(dbfile)),
+      statements_(new sqlite::StatementCache(db_)),
       tree_size_(0),
       transaction_size_(0),
-      in_transaction_(false) {
+      in_transaction_(false),
+      uncommitted_writes_(false),
+      bulk_load_(false) {
   std::unique_lock<std::mutex> lock(lock_);
-  {
-    std::ostringstream oss;
-    oss << "PRAGMA synchronous = " << FLAGS_sqlite_synchronous_mode;
-    sqlite::Statement statement(db_, oss.str().c_str());
-    CHECK_EQ(SQLITE_DONE, statement.Step());
-    LOG(WARNING) << "SQLite \"synchronous\" pragma set to "
-                 << FLAGS_sqlite_synchronous_mode;
-    if (FLAGS_sqlite_batch_into_transactions) {
-      LOG(WARNING) << "SQLite running with batched transactions, you should "
-                   << "set sqlite_synchronous_mode = FULL !";
-    }
+  SetSynchronousMode(db_, FLAGS_sqlite_synchronous_mode);
+  LOG(WARNING) << "SQLite \"synchronous\" pragma set to "
+               << FLAGS_sqlite_synchronous_mode;
+  if (FLAGS_sqlite_batch_into_transactions) {
+    LOG(WARNING) << "SQLite running with batched transactions, you should "
+                 << "set sqlite_synchronous_mode = FULL !";
   }
 
+  // The hash index is dropped during a bulk load, put it back if one
+  // was interrupted.
+  CHECK_EQ(SQLITE_OK, sqlite3_exec(db_,
+                                   "CREATE INDEX IF NOT EXISTS "
+                                   "leaves_hash_idx ON leaves(hash)",
+                                   nullptr, nullptr, nullptr));
+
+  // The freshest tree head of a tree size is the one with the largest
+  // timestamp in this index.
+  CHECK_EQ(SQLITE_OK, sqlite3_exec(db_,
+                                   "CREATE TABLE IF NOT EXISTS "
+                                   "tree_sizes(tree_size INTEGER, "
+                                   "timestamp INTEGER, "
+                                   "PRIMARY KEY(tree_size, timestamp))",
+                                   nullptr, nullptr, nullptr));
+  IndexTreeHeads(lock);
+
   {
     std::ostringstream oss;
     oss << "PRAGMA journal_mode = " << FLAGS_sqlite_journal_mode;
@@ -165,12 +321,25 @@ SQLiteDB<Logged>::SQLiteDB(const std::string& dbfile)
     CHECK_EQ(SQLITE_DONE, statement.Step());
   }
 
+  // In WAL mode, readers do not block the writer, nor the other way
+  // around.
+  if (strcasecmp(FLAGS_sqlite_journal_mode.c_str(), "WAL") == 0) {
+    for (int i = 0; i < FLAGS_sqlite_read_connections; ++i) {
+      readers_.emplace_back(new Reader(dbfile));
+      free_readers_.push_back(readers_.back().get());
+    }
+  }
+
   BeginTransaction(lock);
 }
 
 
 template <class Logged>
 SQLiteDB<Logged>::~SQLiteDB() {
+  CHECK_EQ(readers_.size(), free_readers_.size());
+  readers_.clear();
+  // The statements have to be finalized before closing.
+  statements_.reset();
   CHECK_EQ(SQLITE_OK, sqlite3_close(db_));
 }
 
@@ -182,31 +351,74 @@ typename Database<Logged>::WriteResult SQLiteDB<Logged>::CreateSequencedEntry_(
       latency_by_op_ms.GetScopedLatency("create_sequenced_entry"));
   std::unique_lock<std::mutex> lock(lock_);
 
+  return CreateSequencedEntryNoLock(lock, logged);
+}
+
+
+template <class Logged>
+typename Database<Logged>::WriteResult
+SQLiteDB<Logged>::CreateSequencedEntries_(const std::vector<Logged>& logged,
+                                          size_t* written) {
+  cert_trans::ScopedLatency latency(
+      latency_by_op_ms.GetScopedLatency("create_sequenced_entries"));
+  std::unique_lock<std::mutex> lock(lock_);
+
+  // If writes are not already batched into transactions, at least
+  // write these ones in a single one.
+  const bool own_transaction(!in_transaction_);
+  if (own_transaction) {
+    sqlite::CachedStatement s(statements_.get(), "BEGIN TRANSACTION");
+    CHECK_EQ(SQLITE_DONE, s->Step());
+  }
+
+  WriteResult result(this->OK);
+  for (*written = 0; *written < logged.size(); ++*written) {
+    result = CreateSequencedEntryNoLock(lock, logged[*written]);
+    if (result != this->OK) {
+      break;
+    }
+  }
+
+  if (own_transaction) {
+    sqlite::CachedStatement s(statements_.get(), "END TRANSACTION");
+    CHECK_EQ(SQLITE_DONE, s->Step());
+  }
+
+  return result;
+}
+
+
+template <class Logged>
+typename Database<Logged>::WriteResult
+SQLiteDB<Logged>::CreateSequencedEntryNoLock(
+    const std::unique_lock<std::mutex>& lock, const Logged& logged) {
+  CHECK(lock.owns_lock());
   MaybeStartNewTransaction(lock);
 
-  sqlite::Statement statement(db_,
-                              "INSERT INTO leaves(hash, entry, sequence) "
-                              "VALUES(?, ?, ?)");
+  sqlite::CachedStatement statement(statements_.get(),
+                                    "INSERT INTO leaves(hash, entry, sequence) "
+                                    "VALUES(?, ?, ?)");
   const std::string hash(logged.Hash());
-  statement.BindBlob(0, hash);
+  statement->BindBlob(0, hash);
 
   std::string data;
   CHECK(logged.SerializeForDatabase(&data));
-  statement.BindBlob(1, data);
+  statement->BindBlob(1, data);
 
   CHECK(logged.has_sequence_number());
-  statement.BindUInt64(2, logged.sequence_number());
+  statement->BindUInt64(2, logged.sequence_number());
 
-  int ret = statement.Step();
+  int ret = statement->Step();
   if (ret == SQLITE_CONSTRAINT) {
     // Check whether we're trying to store a hash/sequence pair which already
     // exists - if it's identical we'll return OK as it could be the fetcher.
-    sqlite::Statement s2(
-        db_, "SELECT sequence, hash FROM leaves WHERE sequence = ?");
-    s2.BindUInt64(0, logged.sequence_number());
-    if (s2.Step() == SQLITE_ROW) {
+    sqlite::CachedStatement s2(
+        statements_.get(),
+        "SELECT sequence, hash FROM leaves WHERE sequence = ?");
+    s2->BindUInt64(0, logged.sequence_number());
+    if (s2->Step() == SQLITE_ROW) {
       std::string existing_hash;
-      s2.GetBlob(1, &existing_hash);
+      s2->GetBlob(1, &existing_hash);
 
       if (logged.sequence_number() == tree_size_) {
         ++tree_size_;
@@ -219,6 +431,7 @@ typename Database<Logged>::WriteResult SQLiteDB<Logged>::CreateSequencedEntry_(
     return this->SEQUENCE_NUMBER_ALREADY_IN_USE;
   }
   CHECK_EQ(SQLITE_DONE, ret);
+  uncommitted_writes_ = in_transaction_;
 
   if (logged.sequence_number() == tree_size_) {
     ++tree_size_;
@@ -235,29 +448,29 @@ typename Database<Logged>::LookupResult SQLiteDB<Logged>::LookupByHash(
   cert_trans::ScopedLatency latency(
       latency_by_op_ms.GetScopedLatency("lookup_by_hash"));
 
-  std::lock_guard<std::mutex> lock(lock_);
+  const ReadAccess access(this);
 
-  sqlite::Statement statement(db_,
-                              "SELECT entry, sequence FROM leaves "
-                              "WHERE hash = ? ORDER BY sequence LIMIT 1");
+  sqlite::CachedStatement statement(access.statements(),
+                                    "SELECT entry, sequence FROM leaves "
+                                    "WHERE hash = ? ORDER BY sequence LIMIT 1");
 
-  statement.BindBlob(0, hash);
+  statement->BindBlob(0, hash);
 
-  int ret = statement.Step();
+  int ret = statement->Step();
   if (ret == SQLITE_DONE) {
     return this->NOT_FOUND;
   }
   CHECK_EQ(SQLITE_ROW, ret);
 
-  std::string data;
-  statement.GetBlob(0, &data);
-  CHECK(result->ParseFromDatabase(data));
+  size_t size;
+  const char* const data(statement->GetBlobData(0, &size));
+  CHECK(result->ParseFromDatabase(data, size));
 
-  if (statement.GetType(1) == SQLITE_NULL) {
+  if (statement->GetType(1) == SQLITE_NULL) {
     result->clear_sequence_number();
   } else {
-    result->set_sequence_number(statement.GetUInt64(1));
-    if (result->sequence_number() == tree_size_) {
+    result->set_sequence_number(statement->GetUInt64(1));
+    if (access.locked() && result->sequence_number() == tree_size_) {
       ++tree_size_;
     }
   }
@@ -271,39 +484,37 @@ typename Database<Logged>::LookupResult SQLiteDB<Logged>::LookupByIndex(
     int64_t sequence_number, Logged* result) const {
   cert_trans::ScopedLatency latency(
       latency_by_op_ms.GetScopedLatency("lookup_by_index"));
-  std::unique_lock<std::mutex> lock(lock_);
+  const ReadAccess access(this);
 
-  return LookupByIndex(lock, sequence_number, result);
+  return LookupByIndex(access, sequence_number, result);
 }
 
 
 template <class Logged>
 typename Database<Logged>::LookupResult SQLiteDB<Logged>::LookupByIndex(
-    const std::unique_lock<std::mutex>& lock, int64_t sequence_number,
-    Logged* result) const {
-  CHECK(lock.owns_lock());
+    const ReadAccess& access, int64_t sequence_number, Logged* result) const {
   CHECK_GE(sequence_number, 0);
   CHECK_NOTNULL(result);
-  sqlite::Statement statement(db_,
-                              "SELECT entry, hash FROM leaves "
-                              "WHERE sequence = ?");
-  statement.BindUInt64(0, sequence_number);
-  int ret = statement.Step();
+  sqlite::CachedStatement statement(access.statements(),
+                                    "SELECT entry, hash FROM leaves "
+                                    "WHERE sequence = ?");
+  statement->BindUInt64(0, sequence_number);
+  int ret = statement->Step();
   if (ret == SQLITE_DONE) {
     return this->NOT_FOUND;
   }
 
-  std::string data;
-  statement.GetBlob(0, &data);
-  CHECK(result->ParseFromDatabase(data));
+  size_t size;
+  const char* const data(statement->GetBlobData(0, &size));
+  CHECK(result->ParseFromDatabase(data, size));
 
   std::string hash;
-  statement.GetBlob(1, &hash);
+  statement->GetBlob(1, &hash);
 
   CHECK_EQ(result->Hash(), hash);
 
   result->set_sequence_number(sequence_number);
-  if (result->sequence_number() == tree_size_) {
+  if (access.locked() && result->sequence_number() == tree_size_) {
     ++tree_size_;
   }
 
@@ -313,30 +524,29 @@ typename Database<Logged>::LookupResult SQLiteDB<Logged>::LookupByIndex(
 
 template <class Logged>
 typename Database<Logged>::LookupResult SQLiteDB<Logged>::LookupNextIndex(
-    const std::unique_lock<std::mutex>& lock, int64_t sequence_number,
-    Logged* result) const {
-  CHECK(lock.owns_lock());
+    const ReadAccess& access, int64_t sequence_number, Logged* result) const {
   CHECK_GE(sequence_number, 0);
   CHECK_NOTNULL(result);
-  sqlite::Statement statement(db_,
-                              "SELECT entry, hash, sequence FROM leaves "
-                              "WHERE sequence >= ? ORDER BY sequence");
-  statement.BindUInt64(0, sequence_number);
-  if (statement.Step() == SQLITE_DONE) {
+  sqlite::CachedStatement statement(access.statements(),
+                                    "SELECT entry, hash, sequence FROM leaves "
+                                    "WHERE sequence >= ? ORDER BY sequence "
+                                    "LIMIT 1");
+  statement->BindUInt64(0, sequence_number);
+  if (statement->Step() == SQLITE_DONE) {
     return this->NOT_FOUND;
   }
 
-  std::string data;
-  statement.GetBlob(0, &data);
-  CHECK(result->ParseFromDatabase(data));
+  size_t size;
+  const char* const data(statement->GetBlobData(0, &size));
+  CHECK(result->ParseFromDatabase(data, size));
 
   std::string hash;
-  statement.GetBlob(1, &hash);
+  statement->GetBlob(1, &hash);
 
   CHECK_EQ(result->Hash(), hash);
 
-  result->set_sequence_number(statement.GetUInt64(2));
-  if (result->sequence_number() == tree_size_) {
+  result->set_sequence_number(statement->GetUInt64(2));
+  if (access.locked() && result->sequence_number() == tree_size_) {
     ++tree_size_;
   }
 
@@ -358,24 +568,24 @@ typename Database<Logged>::WriteResult SQLiteDB<Logged>::WriteTreeHead_(
       latency_by_op_ms.GetScopedLatency("write_tree_head"));
   std::unique_lock<std::mutex> lock(lock_);
 
-  sqlite::Statement statement(db_,
-                              "INSERT INTO trees(timestamp, sth) "
-                              "VALUES(?, ?)");
-  statement.BindUInt64(0, sth.timestamp());
+  sqlite::CachedStatement statement(statements_.get(),
+                                    "INSERT INTO trees(timestamp, sth) "
+                                    "VALUES(?, ?)");
+  statement->BindUInt64(0, sth.timestamp());
 
   std::string sth_data;
   CHECK(sth.SerializeToString(&sth_data));
-  statement.BindBlob(1, sth_data);
+  statement->BindBlob(1, sth_data);
 
-  int r2 = statement.Step();
+  int r2 = statement->Step();
   if (r2 == SQLITE_CONSTRAINT) {
-    sqlite::Statement s2(db_,
-                         "SELECT timestamp,sth FROM trees "
-                         "WHERE timestamp = ?");
-    s2.BindUInt64(0, sth.timestamp());
-    CHECK_EQ(SQLITE_ROW, s2.Step());
+    sqlite::CachedStatement s2(statements_.get(),
+                               "SELECT timestamp,sth FROM trees "
+                               "WHERE timestamp = ?");
+    s2->BindUInt64(0, sth.timestamp());
+    CHECK_EQ(SQLITE_ROW, s2->Step());
     std::string existing_sth_data;
-    s2.GetBlob(1, &existing_sth_data);
+    s2->GetBlob(1, &existing_sth_data);
     if (existing_sth_data == sth_data) {
       LOG(WARNING) << "Attempted to store indentical STH in DB.";
       return this->OK;
@@ -384,6 +594,13 @@ typename Database<Logged>::WriteResult SQLiteDB<Logged>::WriteTreeHead_(
   }
   CHECK_EQ(SQLITE_DONE, r2);
 
+  sqlite::CachedStatement size_statement(statements_.get(),
+                                         "INSERT INTO tree_sizes(tree_size, "
+                                         "timestamp) VALUES(?, ?)");
+  size_statement->BindUInt64(0, sth.tree_size());
+  size_statement->BindUInt64(1, sth.timestamp());
+  CHECK_EQ(SQLITE_DONE, size_statement->Step());
+
   EndTransaction(lock);
   BeginTransaction(lock);
 
@@ -401,9 +618,70 @@ typename Database<Logged>::LookupResult SQLiteDB<Logged>::LatestTreeHead(
     ct::SignedTreeHead* result) const {
   cert_trans::ScopedLatency latency(
       latency_by_op_ms.GetScopedLatency("latest_tree_head"));
-  std::unique_lock<std::mutex> lock(lock_);
+  const ReadAccess access(this);
 
-  return LatestTreeHeadNoLock(lock, result);
+  return LatestTreeHeadNoLock(access, result);
+}
+
+
+template <class Logged>
+typename Database<Logged>::LookupResult
+SQLiteDB<Logged>::LookupTreeHeadByTimestamp(uint64_t timestamp,
+                                            ct::SignedTreeHead* result) const {
+  CHECK_NOTNULL(result);
+  cert_trans::ScopedLatency latency(
+      latency_by_op_ms.GetScopedLatency("lookup_tree_head_by_timestamp"));
+  const ReadAccess access(this);
+
+  sqlite::CachedStatement statement(access.statements(),
+                                    "SELECT sth FROM trees WHERE "
+                                    "timestamp = ?");
+  statement->BindUInt64(0, timestamp);
+
+  const int ret(statement->Step());
+  if (ret == SQLITE_DONE) {
+    return this->NOT_FOUND;
+  }
+  CHECK_EQ(SQLITE_ROW, ret);
+
+  std::string sth;
+  statement->GetBlob(0, &sth);
+  CHECK(result->ParseFromString(sth));
+
+  return this->LOOKUP_OK;
+}
+
+
+template <class Logged>
+void SQLiteDB<Logged>::ScanTreeHeadsBySize(
+    int64_t start_size, int64_t end_size,
+    std::vector<ct::SignedTreeHead>* result) const {
+  CHECK_GE(start_size, 0);
+  CHECK_NOTNULL(result);
+  cert_trans::ScopedLatency latency(
+      latency_by_op_ms.GetScopedLatency("scan_tree_heads_by_size"));
+  if (end_size <= start_size) {
+    return;
+  }
+  const ReadAccess access(this);
+
+  sqlite::CachedStatement statement(
+      access.statements(),
+      "SELECT trees.sth FROM (SELECT tree_size, MAX(timestamp) AS latest "
+      "FROM tree_sizes WHERE tree_size >= ? AND tree_size < ? "
+      "GROUP BY tree_size) JOIN trees ON trees.timestamp = latest "
+      "ORDER BY tree_size");
+  statement->BindUInt64(0, start_size);
+  statement->BindUInt64(1, end_size);
+
+  int ret;
+  while ((ret = statement->Step()) == SQLITE_ROW) {
+    std::string sth;
+    statement->GetBlob(0, &sth);
+    result->emplace_back();
+    CHECK(result->back().ParseFromString(sth));
+  }
+  CHECK_EQ(SQLITE_DONE, ret);
 }
 
 
@@ -414,21 +692,21 @@ int64_t SQLiteDB<Logged>::TreeSize() const {
   std::unique_lock<std::mutex> lock(lock_);
 
   CHECK_GE(tree_size_, 0);
-  sqlite::Statement statement(
-      db_,
+  sqlite::CachedStatement statement(
+      statements_.get(),
       "SELECT sequence FROM leaves WHERE sequence >= ? ORDER BY sequence");
-  statement.BindUInt64(0, tree_size_);
+  statement->BindUInt64(0, tree_size_);
 
-  int ret(statement.Step());
+  int ret(statement->Step());
   while (ret == SQLITE_ROW) {
-    const sqlite3_uint64 sequence(statement.GetUInt64(0));
+    const sqlite3_uint64 sequence(statement->GetUInt64(0));
 
     if (sequence != static_cast<uint64_t>(tree_size_)) {
       return tree_size_;
     }
 
     ++tree_size_;
-    ret = statement.Step();
+    ret = statement->Step();
   }
   CHECK_EQ(SQLITE_DONE, ret);
 
@@ -439,15 +717,15 @@ int64_t SQLiteDB<Logged>::TreeSize() const {
 template <class Logged>
 void SQLiteDB<Logged>::AddNotifySTHCallback(
     const typename Database<Logged>::NotifySTHCallback* callback) {
-  std::unique_lock<std::mutex> lock(lock_);
-
-  callbacks_.Add(callback);
+  {
+    std::lock_guard<std::mutex> lock(lock_);
+    callbacks_.Add(callback);
+  }
 
+  // Do not call the callback while holding the lock, as they might
+  // want to perform some lookups.
   ct::SignedTreeHead sth;
-  if (LatestTreeHeadNoLock(lock, &sth) == this->LOOKUP_OK) {
-    // Do not call the callback while holding the lock, as they might
-    // want to perform some lookups.
-    lock.unlock();
+  if (LatestTreeHeadNoLock(ReadAccess(this), &sth) == this->LOOKUP_OK) {
     (*callback)(sth);
   }
 }
@@ -478,6 +756,7 @@ void SQLiteDB<Logged>::InitializeNode(const std::string& node_id) {
 
   const int result(statement.Step());
   CHECK_EQ(SQLITE_DONE, result);
+  uncommitted_writes_ = in_transaction_;
 }
 
 
@@ -511,16 +790,98 @@ typename Database<Logged>::LookupResult SQLiteDB<Logged>::NodeId(
 }
 
 
+template <class Logged>
+void SQLiteDB<Logged>::IndexTreeHeads(
+    const std::unique_lock<std::mutex>& lock) {
+  CHECK(lock.owns_lock());
+  CHECK(!in_transaction_);
+  {
+    sqlite::Statement counts(db_,
+                             "SELECT (SELECT COUNT(*) FROM tree_sizes), "
+                             "(SELECT COUNT(*) FROM trees)");
+    CHECK_EQ(SQLITE_ROW, counts.Step());
+    if (counts.GetUInt64(0) == counts.GetUInt64(1)) {
+      return;
+    }
+  }
+
+  LOG(INFO) << "Indexing the tree heads by tree size";
+  CHECK_EQ(SQLITE_OK, sqlite3_exec(db_, "BEGIN TRANSACTION", nullptr, nullptr,
+                                   nullptr));
+  CHECK_EQ(SQLITE_OK, sqlite3_exec(db_, "DELETE FROM tree_sizes", nullptr,
+                                   nullptr, nullptr));
+  {
+    sqlite::Statement trees(db_, "SELECT sth FROM trees");
+    sqlite::Statement insert(db_,
+                             "INSERT INTO tree_sizes(tree_size, timestamp) "
+                             "VALUES(?, ?)");
+    int ret;
+    while ((ret = trees.Step()) == SQLITE_ROW) {
+      std::string data;
+      trees.GetBlob(0, &data);
+      ct::SignedTreeHead sth;
+      CHECK(sth.ParseFromString(data));
+      insert.BindUInt64(0, sth.tree_size());
+      insert.BindUInt64(1, sth.timestamp());
+      CHECK_EQ(SQLITE_DONE, insert.Step());
+      insert.Reset();
+    }
+    CHECK_EQ(SQLITE_DONE, ret);
+  }
+  CHECK_EQ(SQLITE_OK, sqlite3_exec(db_, "END TRANSACTION", nullptr, nullptr,
+                                   nullptr));
+}
+
+
+template <class Logged>
+void SQLiteDB<Logged>::BeginBulkLoad() {
+  std::unique_lock<std::mutex> lock(lock_);
+  if (bulk_load_) {
+    return;
+  }
+
+  EndTransaction(lock);
+  // Inserting into the table alone, and indexing it at the end in
+  // one go, is much faster than keeping the index up to date.
+  SetSynchronousMode(db_, "OFF");
+  CHECK_EQ(SQLITE_OK, sqlite3_exec(db_, "DROP INDEX IF EXISTS leaves_hash_idx",
+                                   nullptr, nullptr, nullptr));
+  bulk_load_ = true;
+  BeginTransaction(lock);
+}
+
+
+template <class Logged>
+void SQLiteDB<Logged>::EndBulkLoad() {
+  cert_trans::ScopedLatency latency(
+      latency_by_op_ms.GetScopedLatency("end_bulk_load"));
+  std::unique_lock<std::mutex> lock(lock_);
+  if (!bulk_load_) {
+    return;
+  }
+
+  EndTransaction(lock);
+  LOG(INFO) << "Building hash index";
+  CHECK_EQ(SQLITE_OK, sqlite3_exec(db_,
+                                   "CREATE INDEX IF NOT EXISTS "
+                                   "leaves_hash_idx ON leaves(hash)",
+                                   nullptr, nullptr, nullptr));
+  SetSynchronousMode(db_, FLAGS_sqlite_synchronous_mode);
+  bulk_load_ = false;
+  BeginTransaction(lock);
+}
+
+
 template <class Logged>
 void SQLiteDB<Logged>::BeginTransaction(
     const std::unique_lock<std::mutex>& lock) {
   CHECK(lock.owns_lock());
-  if (FLAGS_sqlite_batch_into_transactions) {
+  if (FLAGS_sqlite_batch_into_transactions || bulk_load_) {
     CHECK_EQ(0, transaction_size_);
     CHECK(!in_transaction_);
     VLOG(1) << "Beginning new transaction.";
-    sqlite::Statement s(db_, "BEGIN TRANSACTION");
-    CHECK_EQ(SQLITE_DONE, s.Step());
+    sqlite::CachedStatement s(statements_.get(), "BEGIN TRANSACTION");
+    CHECK_EQ(SQLITE_DONE, s->Step());
     in_transaction_ = true;
   }
 }
@@ -530,21 +891,22 @@ template <class Logged>
 void SQLiteDB<Logged>::EndTransaction(
     const std::unique_lock<std::mutex>& lock) {
   CHECK(lock.owns_lock());
-  if (FLAGS_sqlite_batch_into_transactions) {
-    CHECK(in_transaction_);
+  if (in_transaction_) {
     VLOG(1) << "Committing transaction.";
     {
-      sqlite::Statement s(db_, "END TRANSACTION");
-      CHECK_EQ(SQLITE_DONE, s.Step());
+      sqlite::CachedStatement s(statements_.get(), "END TRANSACTION");
+      CHECK_EQ(SQLITE_DONE, s->Step());
     }
     {
-      sqlite::Statement s(db_, "PRAGMA wal_checkpoint(TRUNCATE)");
-      CHECK_EQ(SQLITE_ROW, s.Step());
-      CHECK_EQ(SQLITE_DONE, s.Step());
+      sqlite::CachedStatement s(statements_.get(),
+                                "PRAGMA wal_checkpoint(TRUNCATE)");
+      CHECK_EQ(SQLITE_ROW, s->Step());
+      CHECK_EQ(SQLITE_DONE, s->Step());
     }
 
     transaction_size_ = 0;
     in_transaction_ = false;
+    uncommitted_writes_ = false;
   }
 }
 
@@ -553,8 +915,11 @@ template <class Logged>
 void SQLiteDB<Logged>::MaybeStartNewTransaction(
     const std::unique_lock<std::mutex>& lock) {
   CHECK(lock.owns_lock());
-  if (FLAGS_sqlite_batch_into_transactions &&
-      transaction_size_ >= FLAGS_sqlite_transaction_batch_size) {
+  if (!in_transaction_) {
+    return;
+  }
+  if (transaction_size_ >= (bulk_load_ ? kBulkLoadTransactionSize
+                                       : FLAGS_sqlite_transaction_batch_size)) {
     VLOG(1) << "Rolling over into new transaction.";
     EndTransaction(lock);
     BeginTransaction(lock);
@@ -565,45 +930,62 @@ void SQLiteDB<Logged>::MaybeStartNewTransaction(
 
 template <class Logged>
 void SQLiteDB<Logged>::ForceNotifySTH() {
-  std::unique_lock<std::mutex> lock(lock_);
-
   ct::SignedTreeHead sth;
+  // The lock is only held by the ReadAccess while the tree head is
+  // read, not while calling the callbacks, as they might want to
+  // perform some lookups.
   const typename Database<Logged>::LookupResult db_result =
-      this->LatestTreeHeadNoLock(lock, &sth);
+      this->LatestTreeHeadNoLock(ReadAccess(this), &sth);
   if (db_result == Database<Logged>::NOT_FOUND) {
     return;
   }
 
   CHECK(db_result == Database<Logged>::LOOKUP_OK);
 
-  // Do not call the callbacks while holding the lock, as they might
-  // want to perform some lookups.
-  lock.unlock();
   callbacks_.Call(sth);
 }
 
 
 template <class Logged>
 typename Database<Logged>::LookupResult SQLiteDB<Logged>::LatestTreeHeadNoLock(
-    const std::unique_lock<std::mutex>& lock,
-    ct::SignedTreeHead* result) const {
-  CHECK(lock.owns_lock());
-  sqlite::Statement statement(db_,
-                              "SELECT sth FROM trees WHERE timestamp IN "
-                              "(SELECT MAX(timestamp) FROM trees)");
+    const ReadAccess& access, ct::SignedTreeHead* result) const {
+  // This walks the index of the timestamps from its end.
+  sqlite::CachedStatement statement(access.statements(),
+                                    "SELECT sth FROM trees "
+                                    "ORDER BY timestamp DESC LIMIT 1");
 
-  int ret = statement.Step();
+  int ret = statement->Step();
   if (ret == SQLITE_DONE) {
     return this->NOT_FOUND;
   }
   CHECK_EQ(SQLITE_ROW, ret);
 
   std::string sth;
-  statement.GetBlob(0, &sth);
+  statement->GetBlob(0, &sth);
   CHECK(result->ParseFromString(sth));
 
   return this->LOOKUP_OK;
 }
 
 
+template <class Logged>
+typename SQLiteDB<Logged>::Reader* SQLiteDB<Logged>::AcquireReader() const {
+  std::lock_guard<std::mutex> lock(readers_lock_);
+  if (free_readers_.empty()) {
+    return nullptr;
+  }
+  Reader* const reader(free_readers_.back());
+  free_readers_.pop_back();
+  return reader;
+}
+
+
+template <class Logged>
+void SQLiteDB<Logged>::ReleaseReader(Reader* reader) const {
+  CHECK_NOTNULL(reader);
+  std::lock_guard<std::mutex> lock(readers_lock_);
+  free_readers_.push_back(reader);
+}
+
+
 #endif  // CERT_TRANS_LOG_SQLITE_DB_INL_H_
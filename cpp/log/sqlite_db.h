@@ -2,14 +2,20 @@
 #ifndef SQLITE_DB_H
 #define SQLITE_DB_H
 
+#include <memory>
 #include <mutex>
 #include <string>
+#include <vector>
 
 #include "base/macros.h"
 #include "log/database.h"
 
 struct sqlite3;
 
+namespace sqlite {
+class StatementCache;
+}  // namespace sqlite
+
 template <class Logged>
 class SQLiteDB : public Database<Logged> {
  public:
@@ -22,6 +28,9 @@ class SQLiteDB : public Database<Logged> {
 
   WriteResult CreateSequencedEntry_(const Logged& logged) override;
 
+  WriteResult CreateSequencedEntries_(const std::vector<Logged>& logged,
+                                      size_t* written) override;
+
   LookupResult LookupByHash(const std::string& hash,
                             Logged* result) const override;
 
@@ -35,6 +44,13 @@ class SQLiteDB : public Database<Logged> {
 
   LookupResult LatestTreeHead(ct::SignedTreeHead* result) const override;
 
+  LookupResult LookupTreeHeadByTimestamp(
+      uint64_t timestamp, ct::SignedTreeHead* result) const override;
+
+  void ScanTreeHeadsBySize(
+      int64_t start_size, int64_t end_size,
+      std::vector<ct::SignedTreeHead>* result) const override;
+
   int64_t TreeSize() const override;
 
   void AddNotifySTHCallback(
@@ -46,6 +62,12 @@ class SQLiteDB : public Database<Logged> {
   void InitializeNode(const std::string& node_id) override;
   LookupResult NodeId(std::string* node_id) override;
 
+  // While bulk loading, "synchronous" is OFF, writes are batched into
+  // large transactions, and the hash index is dropped, to be rebuilt
+  // in one go by EndBulkLoad().
+  void BeginBulkLoad() override;
+  void EndBulkLoad() override;
+
   // Force an STH notification. This is needed only for ct-dns-server,
   // which shares a SQLite database with ct-server, but needs to
   // refresh itself occasionally.
@@ -53,17 +75,24 @@ class SQLiteDB : public Database<Logged> {
 
  private:
   class Iterator;
+  class ReadAccess;
+  struct Reader;
 
-  LookupResult LookupByIndex(const std::unique_lock<std::mutex>& lock,
-                             int64_t sequence_number, Logged* result) const;
+  LookupResult LookupByIndex(const ReadAccess& access, int64_t sequence_number,
+                             Logged* result) const;
   // This finds the next entry with a sequence number equal or greater
   // to the one specified.
-  LookupResult LookupNextIndex(const std::unique_lock<std::mutex>& lock,
+  LookupResult LookupNextIndex(const ReadAccess& access,
                                int64_t sequence_number, Logged* result) const;
-  LookupResult LatestTreeHeadNoLock(const std::unique_lock<std::mutex>& lock,
+  WriteResult CreateSequencedEntryNoLock(
+      const std::unique_lock<std::mutex>& lock, const Logged& logged);
+  LookupResult LatestTreeHeadNoLock(const ReadAccess& access,
                                     ct::SignedTreeHead* result) const;
   LookupResult NodeId(const std::unique_lock<std::mutex>& lock,
                       std::string* node_id);
+  // Indexes the tree heads by tree size, if the database was written
+  // before they were.
+  void IndexTreeHeads(const std::unique_lock<std::mutex>& lock);
 
   void BeginTransaction(const std::unique_lock<std::mutex>& lock);
 
@@ -71,14 +100,31 @@ class SQLiteDB : public Database<Logged> {
 
   void MaybeStartNewTransaction(const std::unique_lock<std::mutex>& lock);
 
+  // Returns a read-only connection that is not in use, or nullptr if
+  // there is none.
+  Reader* AcquireReader() const;
+  void ReleaseReader(Reader* reader) const;
+
   mutable std::mutex lock_;
   sqlite3* const db_;
+  // The prepared statements of |db_|, used with |lock_| held.
+  std::unique_ptr<sqlite::StatementCache> statements_;
   // This is marked mutable, as it is a lazily updated cache updated
   // from some of the getters.
   mutable int64_t tree_size_;
   cert_trans::DatabaseNotifierHelper callbacks_;
   int64_t transaction_size_;
   bool in_transaction_;
+  // Whether the current transaction has writes, which the read-only
+  // connections cannot see until it is committed.
+  bool uncommitted_writes_;
+  bool bulk_load_;
+
+  // Read-only connections, which can be used concurrently with |db_|
+  // in WAL mode.
+  std::vector<std::unique_ptr<Reader>> readers_;
+  mutable std::mutex readers_lock_;
+  mutable std::vector<Reader*> free_readers_;
 
   DISALLOW_COPY_AND_ASSIGN(SQLiteDB);
 };
@@ -4,8 +4,10 @@
 #define SQLITE_STATEMENT_H
 
 #include <glog/logging.h>
+#include <memory>
 #include <sqlite3.h>
 #include <string>
+#include <unordered_map>
 
 #include "base/macros.h"
 
@@ -48,6 +50,15 @@ class Statement {
                   sqlite3_column_bytes(stmt_, column));
   }
 
+  // Returns the blob in |column| without copying it, and sets |*size|
+  // to its length. It is only valid until the next Step() or Reset().
+  const char* GetBlobData(unsigned column, size_t* size) {
+    const void* data = sqlite3_column_blob(stmt_, column);
+    CHECK_NOTNULL(data);
+    *CHECK_NOTNULL(size) = sqlite3_column_bytes(stmt_, column);
+    return static_cast<const char*>(data);
+  }
+
   sqlite3_uint64 GetUInt64(unsigned column) {
     return sqlite3_column_int64(stmt_, column);
   }
@@ -60,12 +71,69 @@ class Statement {
     return sqlite3_step(stmt_);
   }
 
+  // Makes the statement ready to be bound and stepped through again.
+  void Reset() {
+    // Returns the error of the last Step(), if there was one.
+    const int ret(sqlite3_reset(stmt_));
+    CHECK(ret == SQLITE_OK || ret == SQLITE_CONSTRAINT);
+    CHECK_EQ(SQLITE_OK, sqlite3_clear_bindings(stmt_));
+  }
+
  private:
   sqlite3_stmt* stmt_;
 
   DISALLOW_COPY_AND_ASSIGN(Statement);
 };
 
+
+// The statements prepared on a connection, kept to be used again
+// rather than prepared each time. Not thread-safe, like the
+// connection itself.
+class StatementCache {
+ public:
+  explicit StatementCache(sqlite3* db) : db_(CHECK_NOTNULL(db)) {
+  }
+
+  // Returns the statement for |sql|, preparing it the first time.
+  Statement* Get(const char* sql) {
+    std::unique_ptr<Statement>& statement(statements_[sql]);
+    if (!statement) {
+      statement.reset(new Statement(db_, sql));
+    }
+    return statement.get();
+  }
+
+ private:
+  sqlite3* const db_;
+  std::unordered_map<std::string, std::unique_ptr<Statement>> statements_;
+
+  DISALLOW_COPY_AND_ASSIGN(StatementCache);
+};
+
+
+// A statement from a StatementCache, which is reset when this goes
+// out of scope, so that the next user gets it ready to use. Only one
+// of these can be used at a time for a given statement.
+class CachedStatement {
+ public:
+  CachedStatement(StatementCache* cache, const char* sql)
+      : statement_(CHECK_NOTNULL(cache)->Get(sql)) {
+  }
+
+  ~CachedStatement() {
+    statement_->Reset();
+  }
+
+  Statement* operator->() const {
+    return statement_;
+  }
+
+ private:
+  Statement* const statement_;
+
+  DISALLOW_COPY_AND_ASSIGN(CachedStatement);
+};
+
 }  // namespace sqlite
 
 #endif  // SQLITE_STATEMENT_H
@@ -46,16 +46,36 @@ class StrictConsistentStore : public ConsistentStore<Logged> {
     return peer_->AddPendingEntry(entry);
   }
 
+  void AddPendingEntryAsync(Logged* entry, util::Task* task) override {
+    return peer_->AddPendingEntryAsync(entry, task);
+  }
+
   util::Status GetPendingEntryForHash(
       const std::string& hash, EntryHandle<Logged>* entry) const override {
     return peer_->GetPendingEntryForHash(hash, entry);
   }
 
+  void GetPendingEntryForHashAsync(const std::string& hash,
+                                   EntryHandle<Logged>* entry,
+                                   util::Task* task) const override {
+    return peer_->GetPendingEntryForHashAsync(hash, entry, task);
+  }
+
   util::Status GetPendingEntries(
       std::vector<EntryHandle<Logged>>* entries) const override {
     return peer_->GetPendingEntries(entries);
   }
 
+  util::Status GetPendingEntryStubs(
+      std::vector<EntryHandle<Logged>>* entries) const override {
+    return peer_->GetPendingEntryStubs(entries);
+  }
+
+  util::Status RestorePendingEntryBodies(
+      const std::vector<Logged*>& entries) const override {
+    return peer_->RestorePendingEntryBodies(entries);
+  }
+
   util::Status GetSequenceMapping(
       EntryHandle<ct::SequenceMapping>* entry) const override {
     return peer_->GetSequenceMapping(entry);
@@ -10,6 +10,9 @@
 #include "log/file_storage.h"
 #include "log/leveldb_db.h"
 #include "log/logged_certificate.h"
+#ifdef HAVE_ROCKSDB
+#include "log/rocksdb_db.h"
+#endif
 #include "log/sqlite_db.h"
 
 static const unsigned kCertStorageDepth = 3;
@@ -71,6 +74,24 @@ TestDB<LevelDB<cert_trans::LoggedCertificate> >::SecondDB() {
                                                     "/leveldb");
 }
 
+#ifdef HAVE_ROCKSDB
+template <>
+void TestDB<RocksDB<cert_trans::LoggedCertificate> >::Setup() {
+  db_.reset(new RocksDB<cert_trans::LoggedCertificate>(tmp_.TmpStorageDir() +
+                                                       "/rocksdb"));
+}
+
+template <>
+RocksDB<cert_trans::LoggedCertificate>*
+TestDB<RocksDB<cert_trans::LoggedCertificate> >::SecondDB() {
+  // Like LevelDB, RocksDB won't allow the same DB to be opened
+  // concurrently.
+  db_.reset();
+  return new RocksDB<cert_trans::LoggedCertificate>(tmp_.TmpStorageDir() +
+                                                    "/rocksdb");
+}
+#endif
+
 // Not a Database; we just use the same template for setup.
 template <>
 void TestDB<cert_trans::FileStorage>::Setup() {
@@ -6,17 +6,25 @@
 
 #include <algorithm>
 #include <chrono>
+#include <gflags/gflags.h>
 #include <glog/logging.h>
+#include <iterator>
 #include <set>
 #include <stdint.h>
 #include <unordered_map>
+#include <vector>
 
 #include "log/database.h"
 #include "log/log_signer.h"
+#include "log/prefetching_iterator.h"
+#include "monitoring/monitoring.h"
 #include "proto/serializer.h"
 #include "util/status.h"
+#include "util/trace.h"
 #include "util/util.h"
 
+DECLARE_int32(sequencing_batch_size);
+
 
 namespace cert_trans {
 
@@ -24,6 +32,12 @@ namespace cert_trans {
 namespace {
 
 
+Histogram<>* signer_merge_delay_ms(Histogram<>::New(
+    "signer_merge_delay_ms",
+    "Time from the SCT of each entry to the first STH signed by this node "
+    "that includes it, in milliseconds."));
+
+
 bool LessThanBySequence(const ct::SequenceMapping::Mapping& lhs,
                         const ct::SequenceMapping::Mapping& rhs) {
   CHECK(lhs.has_sequence_number());
@@ -63,13 +77,16 @@ template <class Logged>
 TreeSigner<Logged>::TreeSigner(
     const std::chrono::duration<double>& guard_window, Database<Logged>* db,
     std::unique_ptr<CompactMerkleTree>&& merkle_tree,
-    cert_trans::ConsistentStore<Logged>* consistent_store, LogSigner* signer)
+    cert_trans::ConsistentStore<Logged>* consistent_store, LogSigner* signer,
+    const LeafHashesCallback& leaf_hashes_cb)
     : guard_window_(guard_window),
       db_(db),
       consistent_store_(consistent_store),
       signer_(signer),
+      leaf_hashes_cb_(leaf_hashes_cb),
       cert_tree_(std::move(merkle_tree)),
-      latest_tree_head_() {
+      latest_tree_head_(),
+      mapping_cached_(false) {
   CHECK(cert_tree_);
   // Try to get any STH previously published by this node.
   const util::StatusOr<ct::ClusterNodeState> node_state(
@@ -84,6 +101,32 @@ TreeSigner<Logged>::TreeSigner(
 }
 
 
+// static
+template <class Logged>
+std::unique_ptr<CompactMerkleTree> TreeSigner<Logged>::RestoreTree(
+    const ct::SignedTreeHead& sth, SerialHasher* hasher) {
+  std::unique_ptr<CompactMerkleTree> tree(new CompactMerkleTree(hasher));
+  if (!sth.has_compact_tree() ||
+      sth.compact_tree().tree_size() != sth.tree_size()) {
+    return nullptr;
+  }
+
+  const std::vector<std::string> frontier(sth.compact_tree().node().begin(),
+                                          sth.compact_tree().node().end());
+  const util::Status status(tree->Restore(sth.tree_size(), frontier));
+  if (!status.ok()) {
+    LOG(WARNING) << "Invalid tree checkpoint in STH: " << status;
+    return nullptr;
+  }
+  if (tree->CurrentRoot() != sth.sha256_root_hash()) {
+    LOG(WARNING) << "Tree checkpoint does not match the STH root hash";
+    return nullptr;
+  }
+
+  return tree;
+}
+
+
 template <class Logged>
 uint64_t TreeSigner<Logged>::LastUpdateTime() const {
   return latest_tree_head_.timestamp();
@@ -92,42 +135,48 @@ uint64_t TreeSigner<Logged>::LastUpdateTime() const {
 
 template <class Logged>
 util::Status TreeSigner<Logged>::SequenceNewEntries() {
+  const util::ScopedTraceContext trace(util::TraceContext::NewRoot());
+  const util::ScopedTraceSpan span("signer.sequence_new_entries");
   const std::chrono::system_clock::time_point now(
       std::chrono::system_clock::now());
-  util::StatusOr<int64_t> status_or_sequence_number(
-      consistent_store_->NextAvailableSequenceNumber());
-  if (!status_or_sequence_number.ok()) {
-    return status_or_sequence_number.status();
-  }
-  int64_t next_sequence_number(status_or_sequence_number.ValueOrDie());
-  CHECK_GE(next_sequence_number, 0);
-  VLOG(1) << "Next available sequence number: " << next_sequence_number;
 
-  EntryHandle<ct::SequenceMapping> mapping;
-  util::Status status(consistent_store_->GetSequenceMapping(&mapping));
-  if (!status.ok()) {
-    return status;
+  // The mapping is only read back from the consistent store if it
+  // might have been changed by someone else since we last wrote it.
+  const bool was_cached(mapping_cached_);
+  if (!mapping_cached_) {
+    const util::Status status(
+        consistent_store_->GetSequenceMapping(&mapping_));
+    if (!status.ok()) {
+      return status;
+    }
+    IndexSequenceMapping();
   }
-
-  // Hashes which are already sequenced.
-  std::unordered_map<std::string, std::pair<int64_t, bool /*present*/>>
-      sequenced_hashes;
-  for (const auto& m : mapping.Entry().mapping()) {
-    // Go home clang-format, you're drunk.
-    CHECK(
-        sequenced_hashes.insert(
-                             std::make_pair(m.entry_hash(),
-                                            std::make_pair(m.sequence_number(),
-                                                           false))).second);
+  const google::protobuf::RepeatedPtrField<ct::SequenceMapping_Mapping>&
+      mappings(mapping_.Entry().mapping());
+
+  int64_t next_sequence_number;
+  if (mappings.size() > 0) {
+    next_sequence_number =
+        mappings.Get(mappings.size() - 1).sequence_number() + 1;
+  } else {
+    const util::StatusOr<int64_t> status_or_sequence_number(
+        consistent_store_->NextAvailableSequenceNumber());
+    if (!status_or_sequence_number.ok()) {
+      return status_or_sequence_number.status();
+    }
+    next_sequence_number = status_or_sequence_number.ValueOrDie();
   }
+  CHECK_GE(next_sequence_number, 0);
+  VLOG(1) << "Next available sequence number: " << next_sequence_number;
 
+  // Only the stubs of the entries are listed, their bodies are fetched
+  // as they are written to the database, a batch at a time.
   std::vector<cert_trans::EntryHandle<Logged>> pending_entries;
-  status = consistent_store_->GetPendingEntries(&pending_entries);
+  util::Status status(
+      consistent_store_->GetPendingEntryStubs(&pending_entries));
   if (!status.ok()) {
     return status;
   }
-  std::sort(pending_entries.begin(), pending_entries.end(),
-            PendingEntriesOrder<Logged>());
 
   VLOG(1) << "Sequencing " << pending_entries.size() << " entr"
           << (pending_entries.size() == 1 ? "y" : "ies");
@@ -139,9 +188,11 @@ util::Status TreeSigner<Logged>::SequenceNewEntries() {
   //    gain one.
   // 3) mappings whose corresponding PendingEntry no longer exists will be
   //    removed from the sequence mapping file.
-  google::protobuf::RepeatedPtrField<ct::SequenceMapping_Mapping> new_mapping;
-  std::map<int64_t, const Logged*> seq_to_entry;
-  int num_sequenced(0);
+  //
+  // Whether each of the existing mappings still has its PendingEntry.
+  std::vector<bool> present(mappings.size(), false);
+  std::vector<cert_trans::EntryHandle<Logged>*> unsequenced;
+  std::map<int64_t, Logged*> seq_to_entry;
   for (auto& pending_entry : pending_entries) {
     const std::string& pending_hash(pending_entry.Entry().Hash());
     const std::chrono::system_clock::time_point cert_time(
@@ -151,34 +202,30 @@ util::Status TreeSigner<Logged>::SequenceNewEntries() {
               << util::ToBase64(pending_entry.Entry().Hash());
       continue;
     }
-    const auto seq_it(sequenced_hashes.find(pending_hash));
-    ct::SequenceMapping::Mapping* const seq_mapping(new_mapping.Add());
-
-    if (seq_it == sequenced_hashes.end()) {
-      // Need to sequence this one.
-      VLOG(1) << util::ToBase64(pending_hash) << " = " << next_sequence_number;
-
-      // Record the sequence -> hash mapping
-      seq_mapping->set_sequence_number(next_sequence_number);
-      seq_mapping->set_entry_hash(pending_entry.Entry().Hash());
-      pending_entry.MutableEntry()->set_sequence_number(next_sequence_number);
-      ++num_sequenced;
-      ++next_sequence_number;
-    } else {
-      VLOG(1) << "Previously sequenced " << util::ToBase64(pending_hash)
-              << " = " << seq_it->second.first;
-      CHECK(!seq_it->second.second /*present*/)
-          << "Saw same sequenced cert twice.";
-      CHECK(!pending_entry.Entry().has_sequence_number());
-      seq_it->second.second = true;  // present
-
-      seq_mapping->set_entry_hash(seq_it->first);
-      seq_mapping->set_sequence_number(seq_it->second.first);
-      pending_entry.MutableEntry()->set_sequence_number(seq_it->second.first);
+    const auto seq_it(sequenced_hashes_.find(pending_hash));
+    if (seq_it == sequenced_hashes_.end()) {
+      unsequenced.push_back(&pending_entry);
+      continue;
     }
-    CHECK(seq_to_entry.insert(std::make_pair(
-                                  pending_entry.Entry().sequence_number(),
-                                  pending_entry.MutableEntry())).second);
+
+    VLOG(1) << "Previously sequenced " << util::ToBase64(pending_hash)
+            << " = " << seq_it->second;
+    // The mappings are ordered by sequence number.
+    ct::SequenceMapping::Mapping key;
+    key.set_sequence_number(seq_it->second);
+    const auto m_it(std::lower_bound(mappings.begin(), mappings.end(), key,
+                                     LessThanBySequence));
+    CHECK(m_it != mappings.end());
+    CHECK_EQ(m_it->sequence_number(), seq_it->second);
+    const size_t index(m_it - mappings.begin());
+    CHECK(!present[index]) << "Saw same sequenced cert twice.";
+    CHECK(!pending_entry.Entry().has_sequence_number());
+    present[index] = true;
+
+    pending_entry.MutableEntry()->set_sequence_number(seq_it->second);
+    CHECK(seq_to_entry.insert(std::make_pair(seq_it->second,
+                                             pending_entry.MutableEntry()))
+              .second);
   }
 
   const util::StatusOr<ct::SignedTreeHead> serving_sth(
@@ -188,65 +235,227 @@ util::Status TreeSigner<Logged>::SequenceNewEntries() {
     return serving_sth.status();
   }
 
-  // Sanity check: make sure no hashes above the serving_sth level vanished:
+  // Sanity check: make sure no hashes above the serving_sth level vanished,
+  // and keep the mappings of those that did not vanish, in order.
   const uint64_t serving_tree_size(serving_sth.ValueOrDie().tree_size());
-  for (const auto& s : sequenced_hashes) {
-    if (!s.second.second /*present*/) {
+  google::protobuf::RepeatedPtrField<ct::SequenceMapping_Mapping> new_mapping;
+  new_mapping.Reserve(mappings.size() + unsequenced.size());
+  std::vector<std::string> removed_hashes;
+  for (int i = 0; i < mappings.size(); ++i) {
+    if (present[i]) {
+      *new_mapping.Add() = mappings.Get(i);
+    } else {
       // if it disappeared, check it's underwater:
-      CHECK_LT(s.second.first, serving_tree_size);
+      CHECK_LT(mappings.Get(i).sequence_number(), serving_tree_size);
+      removed_hashes.push_back(mappings.Get(i).entry_hash());
     }
   }
 
-  if (new_mapping.size() > 0) {
-    sort(new_mapping.begin(), new_mapping.end(), LessThanBySequence);
-    CHECK_LE(new_mapping.Get(0).sequence_number(), serving_tree_size);
+  // Only the entries that were not sequenced before need ordering, the
+  // others keep their sequence numbers, which are all lower.
+  std::sort(unsequenced.begin(), unsequenced.end(),
+            [](const cert_trans::EntryHandle<Logged>* x,
+               const cert_trans::EntryHandle<Logged>* y) {
+              return PendingEntriesOrder<Logged>()(*x, *y);
+            });
+  // Update the mapping proto with the mappings we keep.
+  mapping_.MutableEntry()->mutable_mapping()->Swap(&new_mapping);
+
+  // The new entries are sequenced --sequencing_batch_size at a time,
+  // each batch written to the consistent store, and then to our local
+  // DB, before the next one is started, so that the bodies of only
+  // one batch are held at once.
+  const size_t batch_size(FLAGS_sequencing_batch_size > 0
+                              ? FLAGS_sequencing_batch_size
+                              : std::max<size_t>(unsequenced.size(), 1));
+  size_t next(0);
+  do {
+    const size_t end(std::min(unsequenced.size(), next + batch_size));
+    for (size_t i = next; i < end; ++i) {
+      cert_trans::EntryHandle<Logged>* const pending_entry(unsequenced[i]);
+      // Need to sequence this one.
+      VLOG(1) << util::ToBase64(pending_entry->Entry().Hash()) << " = "
+              << next_sequence_number;
+
+      // Record the sequence -> hash mapping
+      ct::SequenceMapping::Mapping* const seq_mapping(
+          mapping_.MutableEntry()->add_mapping());
+      seq_mapping->set_sequence_number(next_sequence_number);
+      seq_mapping->set_entry_hash(pending_entry->Entry().Hash());
+      pending_entry->MutableEntry()->set_sequence_number(
+          next_sequence_number);
+      CHECK(seq_to_entry.insert(std::make_pair(next_sequence_number,
+                                               pending_entry->MutableEntry()))
+                .second);
+      ++next_sequence_number;
+    }
+
+    if (mappings.size() > 0) {
+      CHECK_LE(mappings.Get(0).sequence_number(), serving_tree_size);
+    }
+
+    // Store updated sequence->hash mappings in the consistent store
+    status = consistent_store_->UpdateSequenceMapping(&mapping_);
+    if (!status.ok()) {
+      mapping_cached_ = false;
+      if (next == 0 && was_cached &&
+          status.CanonicalCode() == util::error::FAILED_PRECONDITION) {
+        // Someone else changed the mapping since we last wrote it,
+        // start over from theirs.
+        VLOG(1) << "Sequence mapping changed, reading it again: " << status;
+        return SequenceNewEntries();
+      }
+      return status;
+    }
+    if (next == 0) {
+      for (const auto& hash : removed_hashes) {
+        CHECK_EQ(sequenced_hashes_.erase(hash), 1U);
+      }
+    }
+    for (size_t i = next; i < end; ++i) {
+      const Logged& entry(unsequenced[i]->Entry());
+      CHECK(sequenced_hashes_.insert(std::make_pair(entry.Hash(),
+                                                    entry.sequence_number()))
+                .second);
+    }
+
+    // Now add the sequenced entries to our local DB so that the local
+    // signer can incorporate them.
+    status = WriteSequencedEntries(seq_to_entry);
+    if (!status.ok()) {
+      return status;
+    }
+    next = end;
+  } while (next < unsequenced.size());
+
+  VLOG(1) << "Sequenced " << unsequenced.size() << " entries.";
+
+  return util::Status::OK;
+}
+
+
+template <class Logged>
+util::Status TreeSigner<Logged>::WriteSequencedEntries(
+    const std::map<int64_t, Logged*>& seq_to_entry) {
+  const size_t batch_size(FLAGS_sequencing_batch_size > 0
+                              ? FLAGS_sequencing_batch_size
+                              : std::max<size_t>(seq_to_entry.size(), 1));
+  auto it(seq_to_entry.find(db_->TreeSize()));
+  while (it != seq_to_entry.end()) {
+    std::vector<Logged*> stubs;
+    for (; it != seq_to_entry.end() && stubs.size() < batch_size; ++it) {
+      VLOG(1) << "Adding to local DB: " << it->first;
+      CHECK_EQ(it->first, it->second->sequence_number());
+      stubs.push_back(it->second);
+    }
+    const util::Status status(
+        consistent_store_->RestorePendingEntryBodies(stubs));
+    if (!status.ok()) {
+      return status;
+    }
+
+    std::vector<Logged> new_entries;
+    new_entries.reserve(stubs.size());
+    for (Logged* const stub : stubs) {
+      new_entries.push_back(*stub);
+      stub->ClearBody();
+    }
+    size_t written;
+    CHECK_EQ(Database<Logged>::OK,
+             db_->CreateSequencedEntries(new_entries, &written));
+
+    {
+      std::lock_guard<std::mutex> lock(sequenced_lock_);
+      // Past that, UpdateTree() reads them back from the database
+      // rather than having them all held here.
+      if (sequenced_.size() < batch_size) {
+        sequenced_.insert(sequenced_.end(),
+                          std::make_move_iterator(new_entries.begin()),
+                          std::make_move_iterator(new_entries.end()));
+      }
+    }
+    sequenced_cv_.notify_all();
   }
 
-  // Update the mapping proto with our new mappings
-  mapping.MutableEntry()->mutable_mapping()->Swap(&new_mapping);
+  return util::Status::OK;
+}
 
-  // Store updated sequence->hash mappings in the consistent store
-  status = consistent_store_->UpdateSequenceMapping(&mapping);
+
+template <class Logged>
+util::Status TreeSigner<Logged>::PrefetchSequenceMapping() {
+  EntryHandle<ct::SequenceMapping> mapping;
+  const util::Status status(consistent_store_->GetSequenceMapping(&mapping));
   if (!status.ok()) {
     return status;
   }
-
-  // Now add the sequenced entries to our local DB so that the local signer can
-  // incorporate them.
-  for (auto it(seq_to_entry.find(db_->TreeSize())); it != seq_to_entry.end();
-       ++it) {
-    VLOG(1) << "Adding to local DB: " << it->first;
-    CHECK_EQ(it->first, it->second->sequence_number());
-    CHECK_EQ(Database<Logged>::OK, db_->CreateSequencedEntry(*(it->second)));
+  // Indexing a large mapping is not free, skip it if it didn't change.
+  if (mapping_cached_ && mapping.HasHandle() && mapping_.HasHandle() &&
+      mapping.Handle() == mapping_.Handle()) {
+    return util::Status::OK;
   }
+  mapping_ = std::move(mapping);
+  IndexSequenceMapping();
+  return util::Status::OK;
+}
 
-  VLOG(1) << "Sequenced " << num_sequenced << " entries.";
 
-  return util::Status::OK;
+template <class Logged>
+void TreeSigner<Logged>::IndexSequenceMapping() {
+  sequenced_hashes_.clear();
+  for (const auto& m : mapping_.Entry().mapping()) {
+    CHECK(sequenced_hashes_.insert(std::make_pair(m.entry_hash(),
+                                                  m.sequence_number()))
+              .second);
+  }
+  mapping_cached_ = true;
 }
 
 
 // DB_ERROR: the database is inconsistent with our inner self.
 // However, if the database itself is giving inconsistent answers, or failing
 // reads/writes, then we die.
+template <class Logged>
+bool TreeSigner<Logged>::WaitForSequencedEntries(
+    const std::chrono::steady_clock::time_point& deadline) {
+  std::unique_lock<std::mutex> lock(sequenced_lock_);
+  return sequenced_cv_.wait_until(lock, deadline,
+                                  [this]() { return !sequenced_.empty(); });
+}
+
+
 template <class Logged>
 typename TreeSigner<Logged>::UpdateResult TreeSigner<Logged>::UpdateTree() {
+  const util::ScopedTraceContext trace(util::TraceContext::NewRoot());
+  const util::ScopedTraceSpan span("signer.update_tree");
   // Try to make local timestamps unique, but there's always a chance that
   // multiple nodes in the cluster may make STHs with the same timestamp.
   // That'll get handled by the Serving STH selection code.
   uint64_t min_timestamp = LastUpdateTime() + 1;
-
-  // Add any newly sequenced entries from our local DB.
-  auto it(db_->ScanEntries(cert_tree_->LeafCount()));
-  for (int64_t i(cert_tree_->LeafCount());; ++i) {
-    Logged logged;
-    if (!it->GetNextEntry(&logged) || logged.sequence_number() != i) {
-      break;
+  const int64_t first_new(cert_tree_->LeafCount());
+  std::vector<std::string> leaf_hashes;
+
+  // Add the entries we sequenced ourselves, which are in our local DB
+  // already, without reading them back.
+  std::vector<Logged> sequenced;
+  {
+    std::lock_guard<std::mutex> lock(sequenced_lock_);
+    sequenced.swap(sequenced_);
+  }
+  for (const Logged& logged : sequenced) {
+    AppendFromDatabase(logged.sequence_number(), &min_timestamp,
+                       &leaf_hashes);
+    if (logged.sequence_number() != cert_tree_->LeafCount()) {
+      // Either in the tree already, or after a gap in the database,
+      // to be read from there once the gap is filled.
+      continue;
     }
-    CHECK_EQ(logged.sequence_number(), i);
-    AppendToTree(logged);
+    AppendToTree(logged, &leaf_hashes);
     min_timestamp = std::max(min_timestamp, logged.sct().timestamp());
   }
+
+  // Add any other newly sequenced entries from our local DB, such as
+  // those sequenced by other nodes.
+  AppendFromDatabase(db_->TreeSize(), &min_timestamp, &leaf_hashes);
   int64_t next_seq(cert_tree_->LeafCount());
   CHECK_GE(next_seq, 0);
 
@@ -254,22 +463,33 @@ typename TreeSigner<Logged>::UpdateResult TreeSigner<Logged>::UpdateTree() {
   // a matching sequence number in the database (at least assuming overwriting
   // the sequence number is not allowed).
   ct::SignedTreeHead new_sth;
-  TimestampAndSign(min_timestamp, &new_sth);
+  {
+    const util::ScopedTraceSpan sign_span("signer.sign_tree_head");
+    TimestampAndSign(min_timestamp, &new_sth);
+  }
+  HistogramCell* const merge_delay(signer_merge_delay_ms->GetCell());
+  for (const uint64_t sct_timestamp : appended_timestamps_) {
+    merge_delay->Record(new_sth.timestamp() - sct_timestamp);
+  }
+  appended_timestamps_.clear();
 
   // We don't actually store this STH anywhere durable yet, but rather let the
   // caller decide what to do with it.  (In practice, this will mean that it's
   // pushed out to this node's ClusterNodeState so that it becomes a candidate
   // for the cluster-wide Serving STH.)
   latest_tree_head_.CopyFrom(new_sth);
+
+  if (leaf_hashes_cb_ && !leaf_hashes.empty()) {
+    leaf_hashes_cb_(first_new, leaf_hashes);
+  }
   return OK;
 }
 
 
 template <class Logged>
 bool TreeSigner<Logged>::Append(const Logged& logged) {
-  // Serialize for inclusion in the tree.
-  std::string serialized_leaf;
-  CHECK(logged.SerializeForLeaf(&serialized_leaf));
+  std::string leaf_hash;
+  CHECK(logged.LeafHash(&leaf_hash));
 
   CHECK_EQ(logged.sequence_number(), cert_tree_->LeafCount());
   // Commit the sequence number of this certificate locally
@@ -284,19 +504,43 @@ bool TreeSigner<Logged>::Append(const Logged& logged) {
   }
 
   // Update in-memory tree.
-  cert_tree_->AddLeaf(serialized_leaf);
+  cert_tree_->AddLeafHash(leaf_hash);
   return true;
 }
 
 
 template <class Logged>
-void TreeSigner<Logged>::AppendToTree(const Logged& logged) {
-  // Serialize for inclusion in the tree.
-  std::string serialized_leaf;
-  CHECK(logged.SerializeForLeaf(&serialized_leaf));
+void TreeSigner<Logged>::AppendToTree(const Logged& logged,
+                                      std::vector<std::string>* leaf_hashes) {
+  // Usually computed by the frontend already.
+  std::string leaf_hash;
+  CHECK(logged.LeafHash(&leaf_hash));
 
   // Update in-memory tree.
-  cert_tree_->AddLeaf(serialized_leaf);
+  cert_tree_->AddLeafHash(leaf_hash);
+  leaf_hashes->emplace_back(std::move(leaf_hash));
+  appended_timestamps_.push_back(logged.sct().timestamp());
+}
+
+
+template <class Logged>
+void TreeSigner<Logged>::AppendFromDatabase(
+    int64_t end, uint64_t* min_timestamp,
+    std::vector<std::string>* leaf_hashes) {
+  const int64_t start(cert_tree_->LeafCount());
+  if (end <= start) {
+    return;
+  }
+
+  auto it(ScanEntriesPrefetching(db_, start, end - start));
+  for (int64_t i(start); i < end; ++i) {
+    Logged logged;
+    if (!it->GetNextEntry(&logged) || logged.sequence_number() != i) {
+      break;
+    }
+    AppendToTree(logged, leaf_hashes);
+    *min_timestamp = std::max(*min_timestamp, logged.sct().timestamp());
+  }
 }
 
 
@@ -305,7 +549,7 @@ void TreeSigner<Logged>::TimestampAndSign(uint64_t min_timestamp,
                                           ct::SignedTreeHead* sth) {
   sth->set_version(ct::V1);
   sth->set_sha256_root_hash(cert_tree_->CurrentRoot());
-  uint64_t timestamp = util::TimeInMilliseconds();
+  uint64_t timestamp = util::NonDecreasingTimeInMilliseconds();
   if (timestamp < min_timestamp)
     // TODO(ekasper): shouldn't really happen if everyone's clocks are in sync;
     // log a warning if the skew is over some threshold?
@@ -316,6 +560,13 @@ void TreeSigner<Logged>::TimestampAndSign(uint64_t min_timestamp,
   if (ret != LogSigner::OK)
     // Make this one a hard fail. There is really no excuse for it.
     abort();
+
+  ct::CompactMerkleTreeCheckpoint* const checkpoint(
+      sth->mutable_compact_tree());
+  checkpoint->set_tree_size(cert_tree_->LeafCount());
+  for (const auto& node : cert_tree_->Frontier()) {
+    checkpoint->add_node(node);
+  }
 }
 
 
@@ -2,7 +2,15 @@
 #define TREE_SIGNER_H
 
 #include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
 
 #include "log/cluster_state_controller.h"
 #include "log/consistent_store.h"
@@ -17,6 +25,7 @@ class Status;
 template <class Logged>
 class Database;
 class LogSigner;
+class SerialHasher;
 
 
 namespace cert_trans {
@@ -31,13 +40,21 @@ namespace cert_trans {
 template <class Logged>
 class TreeSigner {
  public:
+  // Called by UpdateTree() with the leaf hashes of the entries it
+  // added to the tree, from |first| on, such as to hand them over to
+  // the LogLookup of this node (see LogLookup::OfferLeafHashes()).
+  typedef std::function<void(int64_t first,
+                             const std::vector<std::string>& leaf_hashes)>
+      LeafHashesCallback;
+
   // No transfer of ownership for params other than merkle_tree whose contents
   // is moved into this object.
   TreeSigner(const std::chrono::duration<double>& guard_window,
              Database<Logged>* db,
              std::unique_ptr<CompactMerkleTree>&& merkle_tree,
              cert_trans::ConsistentStore<Logged>* consistent_store,
-             LogSigner* signer);
+             LogSigner* signer,
+             const LeafHashesCallback& leaf_hashes_cb = LeafHashesCallback());
 
   enum UpdateResult {
     OK,
@@ -47,33 +64,92 @@ class TreeSigner {
     INSUFFICIENT_DATA,
   };
 
+  // Restores the tree |sth| was signed for, from the checkpoint that
+  // the signer stored in it, so that a signer can resume from |sth|
+  // without rebuilding the tree from all the entries. Returns nullptr
+  // if |sth| has no (valid) checkpoint.
+  // Takes ownership of |hasher|.
+  static std::unique_ptr<CompactMerkleTree> RestoreTree(
+      const ct::SignedTreeHead& sth, SerialHasher* hasher);
+
   // Latest Tree Head timestamp;
   uint64_t LastUpdateTime() const;
 
+  // The entries it sequences are also handed over to UpdateTree()
+  // directly, so that it does not have to read them back from the
+  // database.
   util::Status SequenceNewEntries();
 
+  // Reads the sequence mapping into the cache SequenceNewEntries()
+  // uses, if it changed since it was last read. Meant to be called
+  // periodically by standby nodes, so that they can start sequencing
+  // right away once they become master. Must not be called
+  // concurrently with SequenceNewEntries().
+  util::Status PrefetchSequenceMapping();
+
+  // Waits until SequenceNewEntries() has sequenced entries that are
+  // not in the tree yet, or until |deadline|. Returns whether there
+  // are such entries.
+  bool WaitForSequencedEntries(
+      const std::chrono::steady_clock::time_point& deadline);
+
   // Simplest update mechanism: take all pending entries and append
   // (in random order) to the tree. Checks that the update it writes
   // to the database is consistent with the latest STH.
   UpdateResult UpdateTree();
 
   // Latest Tree Head (does not build a new tree, just retrieves the
-  // result of the most recent build).
+  // result of the most recent build). It has a checkpoint of the tree,
+  // see RestoreTree().
   const ct::SignedTreeHead& LatestSTH() const {
     return latest_tree_head_;
   }
 
  private:
   bool Append(const Logged& logged);
-  void AppendToTree(const Logged& logged_cert);
+  // Also appends the leaf hash of |logged_cert| to |leaf_hashes|.
+  void AppendToTree(const Logged& logged_cert,
+                    std::vector<std::string>* leaf_hashes);
+  // Appends the entries from the database, from the end of the tree
+  // up to |end| or the first one missing, and raises |*min_timestamp|
+  // to their timestamps.
+  void AppendFromDatabase(int64_t end, uint64_t* min_timestamp,
+                          std::vector<std::string>* leaf_hashes);
   void TimestampAndSign(uint64_t min_timestamp, ct::SignedTreeHead* sth);
+  // Indexes the hashes in |mapping_|, and marks it as cached.
+  void IndexSequenceMapping();
+  // Writes the entries of |seq_to_entry| from the end of our local DB
+  // on, to it and to |sequenced_|, putting back the bodies of a batch
+  // of these stubs at a time, and clearing them again once written.
+  util::Status WriteSequencedEntries(
+      const std::map<int64_t, Logged*>& seq_to_entry);
 
   const std::chrono::duration<double> guard_window_;
   Database<Logged>* const db_;
   cert_trans::ConsistentStore<Logged>* const consistent_store_;
   LogSigner* const signer_;
+  const LeafHashesCallback leaf_hashes_cb_;
   const std::unique_ptr<CompactMerkleTree> cert_tree_;
   ct::SignedTreeHead latest_tree_head_;
+  // The SCT timestamps of the entries added to |cert_tree_| since the
+  // last STH was signed, for the merge delay metric. Only used by
+  // UpdateTree().
+  std::vector<uint64_t> appended_timestamps_;
+
+  // The sequence mapping as last written by SequenceNewEntries(), and
+  // the sequence numbers of the hashes in it, so that the mapping
+  // does not have to be read and indexed again every time. If someone
+  // else changes the mapping in the meantime, our update fails, and
+  // it is read again.
+  bool mapping_cached_;
+  EntryHandle<ct::SequenceMapping> mapping_;
+  std::unordered_map<std::string, int64_t> sequenced_hashes_;
+
+  std::mutex sequenced_lock_;
+  std::condition_variable sequenced_cv_;
+  // Entries written to the database by SequenceNewEntries(), in order,
+  // for UpdateTree() to take.
+  std::vector<Logged> sequenced_;
 
   template <class T>
   friend class TreeSignerTest;
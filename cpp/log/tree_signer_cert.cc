@@ -1,6 +1,10 @@
 #include "log/logged_certificate.h"
 #include "log/tree_signer-inl.h"
 
+DEFINE_int32(sequencing_batch_size, 10000,
+             "Maximum number of new entries to sequence, and to hold the "
+             "bodies of, at a time. 0 for no limit.");
+
 namespace cert_trans {
 template class TreeSigner<cert_trans::LoggedCertificate>;
 }  // namespace cert_trans
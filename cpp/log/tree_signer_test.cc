@@ -1,6 +1,7 @@
 /* -*- indent-tabs-mode: nil -*- */
 #include <gtest/gtest.h>
 #include <memory>
+#include <set>
 #include <stdint.h>
 #include <string>
 
@@ -22,6 +23,8 @@
 #include "util/thread_pool.h"
 #include "util/util.h"
 
+DECLARE_int32(sequencing_batch_size);
+
 namespace cert_trans {
 
 using cert_trans::EntryHandle;
@@ -278,6 +281,60 @@ TYPED_TEST(TreeSignerTest, ResumePartialSign) {
 }
 
 
+TYPED_TEST(TreeSignerTest, ResumeFromCheckpoint) {
+  for (int64_t seq = 0; seq < 5; ++seq) {
+    LoggedCertificate logged_cert;
+    this->test_signer_.CreateUnique(&logged_cert);
+    this->AddSequencedEntry(&logged_cert, seq);
+  }
+  EXPECT_EQ(TS::OK, this->tree_signer_->UpdateTree());
+  const SignedTreeHead sth(this->tree_signer_->LatestSTH());
+  EXPECT_EQ(5, sth.compact_tree().tree_size());
+  // The checkpoint does not get in the way of the signature.
+  EXPECT_EQ(LogVerifier::VERIFY_OK,
+            this->verifier_->VerifySignedTreeHead(sth));
+
+  unique_ptr<CompactMerkleTree> tree(TS::RestoreTree(sth, new Sha256Hasher));
+  ASSERT_TRUE(tree);
+  EXPECT_EQ(5U, tree->LeafCount());
+  EXPECT_EQ(sth.sha256_root_hash(), tree->CurrentRoot());
+  TS signer2(std::chrono::duration<double>(0), this->db(), move(tree),
+             this->store_.get(), TestSigner::DefaultLogSigner());
+
+  for (int64_t seq = 5; seq < 8; ++seq) {
+    LoggedCertificate logged_cert;
+    this->test_signer_.CreateUnique(&logged_cert);
+    this->AddSequencedEntry(&logged_cert, seq);
+  }
+  EXPECT_EQ(TS::OK, this->tree_signer_->UpdateTree());
+  EXPECT_EQ(TS::OK, signer2.UpdateTree());
+  EXPECT_EQ(8, signer2.LatestSTH().tree_size());
+  EXPECT_EQ(this->tree_signer_->LatestSTH().sha256_root_hash(),
+            signer2.LatestSTH().sha256_root_hash());
+}
+
+
+TYPED_TEST(TreeSignerTest, RestoreTreeNeedsValidCheckpoint) {
+  LoggedCertificate logged_cert;
+  this->test_signer_.CreateUnique(&logged_cert);
+  this->AddSequencedEntry(&logged_cert, 0);
+  EXPECT_EQ(TS::OK, this->tree_signer_->UpdateTree());
+  const SignedTreeHead sth(this->tree_signer_->LatestSTH());
+
+  SignedTreeHead no_checkpoint(sth);
+  no_checkpoint.clear_compact_tree();
+  EXPECT_FALSE(TS::RestoreTree(no_checkpoint, new Sha256Hasher));
+
+  SignedTreeHead wrong_size(sth);
+  wrong_size.mutable_compact_tree()->set_tree_size(2);
+  EXPECT_FALSE(TS::RestoreTree(wrong_size, new Sha256Hasher));
+
+  SignedTreeHead wrong_root(sth);
+  wrong_root.set_sha256_root_hash(string(32, 'x'));
+  EXPECT_FALSE(TS::RestoreTree(wrong_root, new Sha256Hasher));
+}
+
+
 TYPED_TEST(TreeSignerTest, SignEmpty) {
   EXPECT_EQ(TS::OK, this->tree_signer_->UpdateTree());
 
@@ -327,6 +384,122 @@ TYPED_TEST(TreeSignerTest, SequenceNewEntriesCleansUpOldSequenceMappings) {
 }
 
 
+TYPED_TEST(TreeSignerTest, SequenceNewEntriesAfterMappingChangedElsewhere) {
+  LoggedCertificate logged_cert;
+  this->test_signer_.CreateUnique(&logged_cert);
+  this->AddPendingEntry(&logged_cert);
+  EXPECT_EQ(util::Status::OK, this->tree_signer_->SequenceNewEntries());
+
+  // Behind the back of the signer, which has the previous mapping
+  // cached.
+  LoggedCertificate logged_cert2;
+  this->test_signer_.CreateUnique(&logged_cert2);
+  this->AddSequencedEntry(&logged_cert2, 1);
+
+  LoggedCertificate logged_cert3;
+  this->test_signer_.CreateUnique(&logged_cert3);
+  this->AddPendingEntry(&logged_cert3);
+  EXPECT_EQ(util::Status::OK, this->tree_signer_->SequenceNewEntries());
+
+  EntryHandle<SequenceMapping> mapping;
+  CHECK_EQ(Status::OK, this->store_->GetSequenceMapping(&mapping));
+  ASSERT_EQ(3, mapping.Entry().mapping_size());
+  EXPECT_EQ(logged_cert.Hash(), mapping.Entry().mapping(0).entry_hash());
+  EXPECT_EQ(logged_cert2.Hash(), mapping.Entry().mapping(1).entry_hash());
+  EXPECT_EQ(logged_cert3.Hash(), mapping.Entry().mapping(2).entry_hash());
+  EXPECT_EQ(2, mapping.Entry().mapping(2).sequence_number());
+}
+
+
+TYPED_TEST(TreeSignerTest, PrefetchSequenceMapping) {
+  EXPECT_EQ(util::Status::OK, this->tree_signer_->PrefetchSequenceMapping());
+
+  // Sequenced by another master, while we are a standby.
+  LoggedCertificate logged_cert;
+  this->test_signer_.CreateUnique(&logged_cert);
+  this->AddSequencedEntry(&logged_cert, 0);
+  EXPECT_EQ(util::Status::OK, this->tree_signer_->PrefetchSequenceMapping());
+  // Nothing changed since.
+  EXPECT_EQ(util::Status::OK, this->tree_signer_->PrefetchSequenceMapping());
+
+  LoggedCertificate logged_cert2;
+  this->test_signer_.CreateUnique(&logged_cert2);
+  this->AddPendingEntry(&logged_cert2);
+  EXPECT_EQ(util::Status::OK, this->tree_signer_->SequenceNewEntries());
+
+  EntryHandle<SequenceMapping> mapping;
+  CHECK_EQ(Status::OK, this->store_->GetSequenceMapping(&mapping));
+  ASSERT_EQ(2, mapping.Entry().mapping_size());
+  EXPECT_EQ(logged_cert.Hash(), mapping.Entry().mapping(0).entry_hash());
+  EXPECT_EQ(logged_cert2.Hash(), mapping.Entry().mapping(1).entry_hash());
+  EXPECT_EQ(1, mapping.Entry().mapping(1).sequence_number());
+}
+
+
+TYPED_TEST(TreeSignerTest, SequencedEntriesAreHandedToUpdateTree) {
+  EXPECT_FALSE(this->tree_signer_->WaitForSequencedEntries(
+      std::chrono::steady_clock::now() + std::chrono::milliseconds(10)));
+
+  LoggedCertificate logged_cert;
+  this->test_signer_.CreateUnique(&logged_cert);
+  this->AddPendingEntry(&logged_cert);
+  EXPECT_EQ(util::Status::OK, this->tree_signer_->SequenceNewEntries());
+  EXPECT_TRUE(this->tree_signer_->WaitForSequencedEntries(
+      std::chrono::steady_clock::now()));
+
+  EXPECT_EQ(TS::OK, this->tree_signer_->UpdateTree());
+  EXPECT_EQ(1U, this->tree_signer_->LatestSTH().tree_size());
+  EXPECT_FALSE(this->tree_signer_->WaitForSequencedEntries(
+      std::chrono::steady_clock::now()));
+}
+
+
+TYPED_TEST(TreeSignerTest, RecordsMergeDelay) {
+  const uint64_t before(signer_merge_delay_ms->GetDistribution().Count());
+  for (int i = 0; i < 2; ++i) {
+    LoggedCertificate logged_cert;
+    this->test_signer_.CreateUnique(&logged_cert);
+    this->AddPendingEntry(&logged_cert);
+  }
+  EXPECT_EQ(util::Status::OK, this->tree_signer_->SequenceNewEntries());
+  EXPECT_EQ(TS::OK, this->tree_signer_->UpdateTree());
+  EXPECT_EQ(before + 2, signer_merge_delay_ms->GetDistribution().Count());
+
+  // Once per entry, not per STH.
+  EXPECT_EQ(TS::OK, this->tree_signer_->UpdateTree());
+  EXPECT_EQ(before + 2, signer_merge_delay_ms->GetDistribution().Count());
+}
+
+
+TYPED_TEST(TreeSignerTest, SequenceNewEntriesInBatches) {
+  const int32_t batch_size(FLAGS_sequencing_batch_size);
+  FLAGS_sequencing_batch_size = 2;
+  vector<LoggedCertificate> logged_certs(5);
+  for (auto& logged_cert : logged_certs) {
+    this->test_signer_.CreateUnique(&logged_cert);
+    this->AddPendingEntry(&logged_cert);
+  }
+  const util::Status status(this->tree_signer_->SequenceNewEntries());
+  FLAGS_sequencing_batch_size = batch_size;
+  EXPECT_EQ(util::Status::OK, status);
+
+  EntryHandle<SequenceMapping> mapping;
+  CHECK_EQ(Status::OK, this->store_->GetSequenceMapping(&mapping));
+  ASSERT_EQ(logged_certs.size(), mapping.Entry().mapping_size());
+  std::set<string> hashes;
+  for (int i = 0; i < mapping.Entry().mapping_size(); ++i) {
+    EXPECT_EQ(i, mapping.Entry().mapping(i).sequence_number());
+    hashes.insert(mapping.Entry().mapping(i).entry_hash());
+  }
+  for (const auto& logged_cert : logged_certs) {
+    EXPECT_EQ(1U, hashes.count(logged_cert.Hash()));
+  }
+
+  EXPECT_EQ(TS::OK, this->tree_signer_->UpdateTree());
+  EXPECT_EQ(logged_certs.size(), this->tree_signer_->LatestSTH().tree_size());
+}
+
+
 }  // namespace cert_trans
 
 
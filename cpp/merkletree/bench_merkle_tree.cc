@@ -0,0 +1,381 @@
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <random>
+#include <sstream>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include "merkletree/compact_merkle_tree.h"
+#include "merkletree/fixed_compact_merkle_tree.h"
+#include "merkletree/merkle_tree.h"
+#include "merkletree/merkle_verifier.h"
+#include "merkletree/serial_hasher.h"
+#include "util/thread_pool.h"
+
+using cert_trans::ThreadPool;
+using std::function;
+using std::string;
+using std::unique_ptr;
+using std::vector;
+
+DEFINE_string(tree_sizes, "1000,10000,100000,1000000",
+              "comma-separated tree sizes to run the benchmarks with, in "
+              "leaves (a billion leaves takes about 64GB of memory)");
+DEFINE_string(benchmarks, "",
+              "comma-separated names of the benchmarks to run; all of them "
+              "if empty");
+DEFINE_int32(min_time_ms, 500,
+             "minimum time to spend running each benchmark, in milliseconds");
+DEFINE_int32(hashing_threads, 0,
+             "number of threads to hash large tree updates on; they are "
+             "hashed in the calling thread if 0");
+
+namespace {
+
+
+std::atomic<uint64_t> num_allocations(0);
+
+
+// A leaf hash for |index|: the benchmarks do not care about the
+// leaves themselves, so do not spend time hashing them.
+string FakeLeafHash(uint64_t index) {
+  string hash(Sha256Hasher::kDigestSize, '\0');
+  memcpy(&hash[0], &index, sizeof(index));
+  return hash;
+}
+
+
+vector<uint64_t> ParseSizes(const string& sizes) {
+  vector<uint64_t> result;
+  std::istringstream in(sizes);
+  string size;
+  while (std::getline(in, size, ',')) {
+    char* end;
+    const unsigned long long value(strtoull(size.c_str(), &end, 10));
+    CHECK(!size.empty() && *end == '\0' && value > 0)
+        << "invalid tree size: " << size;
+    result.push_back(value);
+  }
+  return result;
+}
+
+
+bool ShouldRun(const string& name) {
+  if (FLAGS_benchmarks.empty()) {
+    return true;
+  }
+  const string benchmarks("," + FLAGS_benchmarks + ",");
+  return benchmarks.find("," + name + ",") != string::npos;
+}
+
+
+uint64_t ResidentBytes() {
+  // The second field of /proc/self/statm is the resident set size, in
+  // pages.
+  FILE* const statm(fopen("/proc/self/statm", "r"));
+  if (!statm) {
+    return 0;
+  }
+  unsigned long size, resident;
+  const int fields(fscanf(statm, "%lu %lu", &size, &resident));
+  fclose(statm);
+  return fields == 2 ? resident * sysconf(_SC_PAGESIZE) : 0;
+}
+
+
+std::chrono::nanoseconds MinTime() {
+  return std::chrono::milliseconds(FLAGS_min_time_ms);
+}
+
+
+struct Result {
+  Result() : ops(0), nanoseconds(0), allocations(0) {
+  }
+
+  uint64_t ops;
+  uint64_t nanoseconds;
+  uint64_t allocations;
+};
+
+
+void Report(const string& name, uint64_t tree_size, const Result& result) {
+  CHECK_GT(result.ops, 0U);
+  std::cout << std::left << std::setw(40) << name << std::right
+            << std::setw(12) << tree_size << std::setw(14) << std::fixed
+            << std::setprecision(1)
+            << static_cast<double>(result.nanoseconds) / result.ops
+            << std::setw(14) << std::setprecision(2)
+            << static_cast<double>(result.allocations) / result.ops
+            << std::setw(16) << ResidentBytes() << std::endl;
+}
+
+
+// Calls |run|, which does |ops_per_run| operations and returns how
+// long the part of it to measure took, until it has taken at least
+// --min_time_ms altogether.
+Result Measure(uint64_t ops_per_run,
+               const function<std::chrono::nanoseconds()>& run) {
+  const std::chrono::nanoseconds min_time(MinTime());
+  Result result;
+  std::chrono::nanoseconds elapsed(0);
+  do {
+    const uint64_t allocations(num_allocations);
+    elapsed += run();
+    result.allocations += num_allocations - allocations;
+    result.ops += ops_per_run;
+  } while (elapsed < min_time);
+  result.nanoseconds = elapsed.count();
+  return result;
+}
+
+
+// Same as above, for benchmarks where every operation takes about the
+// same time: calls |op| with increasing operation numbers, in batches
+// that grow until they are long enough to time accurately.
+Result MeasureOps(const function<void(uint64_t)>& op) {
+  const std::chrono::nanoseconds min_time(MinTime());
+  Result result;
+  std::chrono::nanoseconds elapsed(0);
+  for (uint64_t batch = 1; elapsed < min_time; batch *= 2) {
+    const uint64_t allocations(num_allocations);
+    const std::chrono::steady_clock::time_point start(
+        std::chrono::steady_clock::now());
+    for (uint64_t i = 0; i < batch; ++i) {
+      op(result.ops + i);
+    }
+    elapsed += std::chrono::steady_clock::now() - start;
+    result.allocations += num_allocations - allocations;
+    result.ops += batch;
+  }
+  result.nanoseconds = elapsed.count();
+  return result;
+}
+
+
+class MerkleTreeBenchmark {
+ public:
+  explicit MerkleTreeBenchmark(uint64_t tree_size)
+      : tree_size_(tree_size), random_(tree_size) {
+    if (FLAGS_hashing_threads > 0) {
+      pool_.reset(new ThreadPool(FLAGS_hashing_threads));
+    }
+  }
+
+  void Run() {
+    RunBuild("merkle_tree_add_leaf_hash", false);
+    RunBuild("merkle_tree_current_root", true);
+    RunCompactAddLeaf();
+    RunFixedCompactAddLeaf();
+
+    if (!ShouldRun("merkle_tree_path_to_current_root") &&
+        !ShouldRun("merkle_tree_path_to_root_at_snapshot") &&
+        !ShouldRun("merkle_tree_snapshot_consistency") &&
+        !ShouldRun("merkle_verifier_verify_path")) {
+      return;
+    }
+    // The remaining benchmarks share a fully evaluated tree.
+    unique_ptr<MerkleTree> tree(NewTree());
+    for (uint64_t i = 0; i < tree_size_; ++i) {
+      tree->AddLeafHash(FakeLeafHash(i));
+    }
+    tree->CurrentRoot();
+    RunPaths(tree.get());
+    RunConsistency(tree.get());
+    RunVerifyPath(tree.get());
+  }
+
+ private:
+  unique_ptr<MerkleTree> NewTree() {
+    unique_ptr<MerkleTree> tree(new MerkleTree(new Sha256Hasher));
+    if (pool_) {
+      tree->SetExecutor(pool_.get(), FLAGS_hashing_threads);
+    }
+    return tree;
+  }
+
+  // Appending leaves one by one is measured per leaf, computing the
+  // root of the new leaves (which is when the interior nodes are
+  // hashed) per call.
+  void RunBuild(const string& name, bool root) {
+    if (!ShouldRun(name)) {
+      return;
+    }
+    const Result result(
+        Measure(root ? 1 : tree_size_, [this, root]() {
+          unique_ptr<MerkleTree> tree(NewTree());
+          std::chrono::steady_clock::time_point start(
+              std::chrono::steady_clock::now());
+          for (uint64_t i = 0; i < tree_size_; ++i) {
+            tree->AddLeafHash(FakeLeafHash(i));
+          }
+          if (root) {
+            start = std::chrono::steady_clock::now();
+            tree->CurrentRoot();
+          }
+          return std::chrono::steady_clock::now() - start;
+        }));
+    Report(name, tree_size_, result);
+  }
+
+  void RunCompactAddLeaf() {
+    if (!ShouldRun("compact_merkle_tree_add_leaf")) {
+      return;
+    }
+    // Unlike MerkleTree, the compact tree hashes as it goes, so this
+    // includes the interior nodes.
+    const string leaf(64, 'x');
+    const Result result(Measure(tree_size_, [this, &leaf]() {
+      CompactMerkleTree tree(new Sha256Hasher);
+      const std::chrono::steady_clock::time_point start(
+          std::chrono::steady_clock::now());
+      for (uint64_t i = 0; i < tree_size_; ++i) {
+        tree.AddLeaf(leaf);
+      }
+      tree.CurrentRoot();
+      return std::chrono::steady_clock::now() - start;
+    }));
+    Report("compact_merkle_tree_add_leaf", tree_size_, result);
+  }
+
+  void RunFixedCompactAddLeaf() {
+    if (!ShouldRun("fixed_compact_merkle_tree_add_leaf")) {
+      return;
+    }
+    const string leaf(64, 'x');
+    const Result result(Measure(tree_size_, [this, &leaf]() {
+      cert_trans::Sha256CompactMerkleTree tree;
+      const std::chrono::steady_clock::time_point start(
+          std::chrono::steady_clock::now());
+      for (uint64_t i = 0; i < tree_size_; ++i) {
+        tree.AddLeaf(leaf);
+      }
+      tree.Root();
+      return std::chrono::steady_clock::now() - start;
+    }));
+    Report("fixed_compact_merkle_tree_add_leaf", tree_size_, result);
+  }
+
+  void RunPaths(MerkleTree* tree) {
+    if (ShouldRun("merkle_tree_path_to_current_root")) {
+      Report("merkle_tree_path_to_current_root", tree_size_,
+             MeasureOps([this, tree](uint64_t) {
+               tree->PathToCurrentRoot(RandomLeaf(tree_size_));
+             }));
+    }
+    // Past snapshots have to be partly rehashed.
+    if (ShouldRun("merkle_tree_path_to_root_at_snapshot")) {
+      Report("merkle_tree_path_to_root_at_snapshot", tree_size_,
+             MeasureOps([this, tree](uint64_t) {
+               const uint64_t snapshot(RandomLeaf(tree_size_));
+               tree->PathToRootAtSnapshot(RandomLeaf(snapshot), snapshot);
+             }));
+    }
+  }
+
+  void RunConsistency(MerkleTree* tree) {
+    if (!ShouldRun("merkle_tree_snapshot_consistency") || tree_size_ < 2) {
+      return;
+    }
+    Report("merkle_tree_snapshot_consistency", tree_size_,
+           MeasureOps([this, tree](uint64_t) {
+             tree->SnapshotConsistency(RandomLeaf(tree_size_ - 1),
+                                       tree_size_);
+           }));
+  }
+
+  void RunVerifyPath(MerkleTree* tree) {
+    if (!ShouldRun("merkle_verifier_verify_path")) {
+      return;
+    }
+    // The leaves here are real ones, so that the paths verify.
+    const size_t kNumPaths(1024);
+    const uint64_t verify_size(std::min<uint64_t>(tree_size_, 1 << 16));
+    MerkleTree verify_tree(new Sha256Hasher);
+    for (uint64_t i = 0; i < verify_size; ++i) {
+      verify_tree.AddLeaf(std::to_string(i));
+    }
+    vector<uint64_t> leaves;
+    vector<vector<string>> paths;
+    for (size_t i = 0; i < kNumPaths; ++i) {
+      leaves.push_back(RandomLeaf(verify_size));
+      paths.push_back(verify_tree.PathToCurrentRoot(leaves.back()));
+    }
+    // The verifier only depends on the tree size, so pad the paths of
+    // the small tree up to that of the real one.
+    const size_t extra_nodes(tree->PathToCurrentRoot(tree_size_).size() -
+                             verify_tree.PathToCurrentRoot(verify_size).size());
+    const string root(verify_tree.CurrentRoot());
+    MerkleVerifier verifier(new Sha256Hasher);
+    Report("merkle_verifier_verify_path", tree_size_,
+           MeasureOps([&](uint64_t op) {
+             const size_t i(op % kNumPaths);
+             CHECK(verifier.VerifyPath(leaves[i], verify_size, paths[i], root,
+                                       std::to_string(leaves[i] - 1)));
+             // Account for the hashing a path in the larger tree
+             // would take.
+             string node(root);
+             for (size_t j = 0; j < extra_nodes; ++j) {
+               node = verifier.LeafHash(node);
+             }
+           }));
+  }
+
+  // A random leaf index, from 1 to |count|.
+  uint64_t RandomLeaf(uint64_t count) {
+    return std::uniform_int_distribution<uint64_t>(1, count)(random_);
+  }
+
+  const uint64_t tree_size_;
+  std::mt19937_64 random_;
+  unique_ptr<ThreadPool> pool_;
+};
+
+
+}  // namespace
+
+
+// Count the allocations, to report them per operation.
+void* operator new(size_t size) {
+  ++num_allocations;
+  void* const ptr(malloc(size == 0 ? 1 : size));
+  if (!ptr) {
+    abort();
+  }
+  return ptr;
+}
+
+
+void operator delete(void* ptr) noexcept {
+  free(ptr);
+}
+
+
+int main(int argc, char* argv[]) {
+  google::ParseCommandLineFlags(&argc, &argv, true);
+  google::InitGoogleLogging(argv[0]);
+
+  CHECK_GT(FLAGS_min_time_ms, 0);
+  CHECK_GE(FLAGS_hashing_threads, 0);
+
+  std::cout << std::left << std::setw(40) << "benchmark" << std::right
+            << std::setw(12) << "leaves" << std::setw(14) << "ns/op"
+            << std::setw(14) << "allocs/op" << std::setw(16) << "rss_bytes"
+            << std::endl;
+  for (const uint64_t tree_size : ParseSizes(FLAGS_tree_sizes)) {
+    MerkleTreeBenchmark(tree_size).Run();
+  }
+
+  return 0;
+}
@@ -3,12 +3,14 @@
 #include <glog/logging.h>
 #include <stddef.h>
 #include <string>
+#include <utility>
 #include <vector>
 
 #include "merkletree/merkle_tree_math.h"
 
 using cert_trans::MerkleTreeInterface;
 using std::string;
+using util::Status;
 
 CompactMerkleTree::CompactMerkleTree(SerialHasher* hasher)
     : MerkleTreeInterface(),
@@ -122,23 +124,90 @@ size_t CompactMerkleTree::AddLeafHash(const string& hash) {
   return leaf_count_;
 }
 
+Status CompactMerkleTree::AddSubtreeHash(size_t level, const string& hash) {
+  if (hash.size() != NodeSize()) {
+    return Status(util::error::INVALID_ARGUMENT, "invalid subtree hash");
+  }
+  const size_t width(level < 64 ? static_cast<size_t>(1) << level : 0);
+  if (width == 0 || leaf_count_ % width != 0) {
+    return Status(util::error::INVALID_ARGUMENT,
+                  "subtree is not aligned with the tree");
+  }
+  // As the leaf count is a multiple of the subtree size, all the
+  // levels below it are empty, and the subtree root goes in at its
+  // level as if its leaves had been added one at a time.
+  PushBack(level, hash);
+  leaf_count_ += width;
+  level_count_ = LevelCountFor(leaf_count_);
+  return Status::OK;
+}
+
 string CompactMerkleTree::CurrentRoot() {
   UpdateRoot();
   return root_;
 }
 
+std::vector<string> CompactMerkleTree::Frontier() const {
+  std::vector<string> frontier;
+  // Leave out the empty levels at the top, if any.
+  for (size_t level = 0; level < tree_.size(); ++level) {
+    if (!tree_[level].empty()) {
+      frontier.resize(level + 1);
+      frontier[level] = tree_[level];
+    }
+  }
+  return frontier;
+}
+
+Status CompactMerkleTree::Restore(size_t leaf_count,
+                                  const std::vector<string>& frontier) {
+  if (leaf_count_ != 0) {
+    return Status(util::error::FAILED_PRECONDITION,
+                  "cannot restore into a non-empty tree");
+  }
+
+  // There is a lone left node at each level for which the leaf count
+  // has a bit set.
+  size_t size(leaf_count);
+  size_t level(0);
+  for (; size != 0; size >>= 1, ++level) {
+    const string node(level < frontier.size() ? frontier[level] : string());
+    if ((size & 1) != 0 && node.size() != NodeSize()) {
+      return Status(util::error::INVALID_ARGUMENT,
+                    "missing or invalid frontier node");
+    }
+    if ((size & 1) == 0 && !node.empty()) {
+      return Status(util::error::INVALID_ARGUMENT,
+                    "unexpected frontier node");
+    }
+  }
+  if (level < frontier.size()) {
+    return Status(util::error::INVALID_ARGUMENT, "too many frontier nodes");
+  }
+
+  tree_.assign(frontier.begin(), frontier.end());
+  leaf_count_ = leaf_count;
+  level_count_ = LevelCountFor(leaf_count);
+  leaves_processed_ = 0;
+  UpdateRoot();
+  return Status::OK;
+}
+
 void CompactMerkleTree::PushBack(size_t level, string node) {
   CHECK_EQ(node.size(), treehasher_.DigestSize());
   if (tree_.size() <= level) {
-    // First node at a new level.
-    tree_.push_back(node);
+    // First node at a new level (the levels below can be skipped when
+    // adding a subtree).
+    tree_.resize(level + 1);
+    tree_[level] = std::move(node);
   } else if (tree_[level].empty()) {
     // Lone left sibling.
     tree_[level] = node;
   } else {
     // Left sibling waiting: hash together and propagate up.
-    PushBack(level + 1, treehasher_.HashChildren(tree_[level], node));
+    treehasher_.HashChildren(tree_[level], node, &node);
     tree_[level].clear();
+    PushBack(level + 1, std::move(node));
   }
 }
 
@@ -154,10 +223,22 @@ void CompactMerkleTree::UpdateRoot() {
       if (right_sibling.empty())
         right_sibling = tree_[level];
       else
-        right_sibling = treehasher_.HashChildren(tree_[level], right_sibling);
+        treehasher_.HashChildren(tree_[level], right_sibling, &right_sibling);
     }
   }
 
   root_ = right_sibling;
   leaves_processed_ = LeafCount();
 }
+
+// A tree with n > 0 leaves has ceil(log2(n)) + 1 levels.
+size_t CompactMerkleTree::LevelCountFor(size_t leaf_count) {
+  if (leaf_count == 0) {
+    return 0;
+  }
+  size_t level_count(1);
+  for (size_t size = leaf_count - 1; size != 0; size >>= 1) {
+    ++level_count;
+  }
+  return level_count;
+}
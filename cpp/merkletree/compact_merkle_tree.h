@@ -8,6 +8,7 @@
 #include "merkletree/merkle_tree_interface.h"
 #include "merkletree/merkle_tree.h"
 #include "merkletree/tree_hasher.h"
+#include "util/status.h"
 
 class SerialHasher;
 
@@ -78,6 +79,14 @@ class CompactMerkleTree : public cert_trans::MerkleTreeInterface {
   // @param hash leaf hash
   virtual size_t AddLeafHash(const std::string& hash);
 
+  // Appends a complete subtree of 2^|level| leaves, given its root
+  // |hash| (such as MerkleTree::SubtreeRoot(level, index)), in
+  // O(LevelCount()) rather than one leaf at a time. It is the
+  // caller's responsibility to ensure that the hash is correct. The
+  // subtree must be aligned: LeafCount() must be a multiple of its
+  // size, so that it is also a subtree of this tree.
+  util::Status AddSubtreeHash(size_t level, const std::string& hash);
+
   // Get the current root of the tree.
   // Update the root to reflect the current shape of the tree,
   // and return the tree digest.
@@ -86,11 +95,24 @@ class CompactMerkleTree : public cert_trans::MerkleTreeInterface {
   // (and hence, no root).
   virtual std::string CurrentRoot();
 
+  // The nodes needed to keep adding leaves to the tree, bottom up:
+  // the lone left node at each level, or an empty string for the
+  // levels that have none. There are at most LevelCount() of them, so
+  // this makes for a small checkpoint of the tree.
+  std::vector<std::string> Frontier() const;
+
+  // Restores a tree with |leaf_count| leaves from its Frontier(). The
+  // tree must be empty.
+  util::Status Restore(size_t leaf_count,
+                       const std::vector<std::string>& frontier);
+
  private:
   // Append a node to the level.
   void PushBack(size_t level, std::string node);
 
   void UpdateRoot();
+  // The level count of a tree with |leaf_count| leaves.
+  static size_t LevelCountFor(size_t leaf_count);
   // Since the tree is append-only to the right, at any given point in time,
   // at each level, all nodes that have a right sibling are fixed and will
   // no longer change. Thus we store, for each level i, only the last lone
@@ -0,0 +1,209 @@
+#ifndef CERT_TRANS_MERKLETREE_FIXED_COMPACT_MERKLE_TREE_H_
+#define CERT_TRANS_MERKLETREE_FIXED_COMPACT_MERKLE_TREE_H_
+
+#include <array>
+#include <glog/logging.h>
+#include <openssl/sha.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+
+#include "base/macros.h"
+#include "merkletree/merkle_tree_interface.h"
+#include "util/status.h"
+
+namespace cert_trans {
+
+
+// The RFC 6962 tree hashes, with SHA-256, as a hashing policy for
+// FixedCompactMerkleTree. A policy provides the size of its digests
+// as kDigestSize, and these functions, which write kDigestSize bytes
+// to |digest|, which may overlap their input. They are all inline,
+// so that they compile down to the calls to the hash function.
+struct Sha256TreeHashing {
+  static const size_t kDigestSize = 32;
+
+  static void HashEmpty(char* digest) {
+    SHA256_CTX ctx;
+    SHA256_Init(&ctx);
+    SHA256_Final(reinterpret_cast<unsigned char*>(digest), &ctx);
+  }
+
+  static void HashLeaf(const char* data, size_t length, char* digest) {
+    const unsigned char prefix(0);
+    SHA256_CTX ctx;
+    SHA256_Init(&ctx);
+    SHA256_Update(&ctx, &prefix, 1);
+    SHA256_Update(&ctx, data, length);
+    SHA256_Final(reinterpret_cast<unsigned char*>(digest), &ctx);
+  }
+
+  static void HashChildren(const char* left, const char* right,
+                           char* digest) {
+    const unsigned char prefix(1);
+    SHA256_CTX ctx;
+    SHA256_Init(&ctx);
+    SHA256_Update(&ctx, &prefix, 1);
+    SHA256_Update(&ctx, left, kDigestSize);
+    SHA256_Update(&ctx, right, kDigestSize);
+    SHA256_Final(reinterpret_cast<unsigned char*>(digest), &ctx);
+  }
+};
+
+
+// Like CompactMerkleTree, but with the hash function and the size of
+// the nodes fixed at compile time by |Hashing| (see
+// Sha256TreeHashing), rather than through a SerialHasher. The nodes
+// are fixed-size arrays kept in the tree itself, so that adding a
+// leaf allocates nothing and makes no virtual calls.
+//
+// The MerkleTreeInterface methods take and return nodes as strings,
+// for existing users; AddLeafNode(), AddSubtreeNode() and Root() are
+// the faster equivalents.
+//
+// This class is thread-compatible, but not thread-safe.
+template <class Hashing>
+class FixedCompactMerkleTree : public MerkleTreeInterface {
+ public:
+  static const size_t kNodeSize = Hashing::kDigestSize;
+  typedef std::array<char, Hashing::kDigestSize> Node;
+
+  FixedCompactMerkleTree() : leaf_count_(0), root_valid_(false) {
+  }
+
+  size_t NodeSize() const override {
+    return kNodeSize;
+  }
+
+  size_t LeafCount() const override {
+    return leaf_count_;
+  }
+
+  std::string LeafHash(const std::string& data) const override {
+    Node hash;
+    Hashing::HashLeaf(data.data(), data.size(), hash.data());
+    return std::string(hash.data(), kNodeSize);
+  }
+
+  size_t LevelCount() const override {
+    if (leaf_count_ == 0) {
+      return 0;
+    }
+    size_t level_count(1);
+    for (uint64_t size = leaf_count_ - 1; size != 0; size >>= 1) {
+      ++level_count;
+    }
+    return level_count;
+  }
+
+  size_t AddLeaf(const std::string& data) override {
+    Node hash;
+    Hashing::HashLeaf(data.data(), data.size(), hash.data());
+    AddLeafNode(hash);
+    return leaf_count_;
+  }
+
+  size_t AddLeafHash(const std::string& hash) override {
+    CHECK_EQ(hash.size(), static_cast<size_t>(kNodeSize));
+    Node node;
+    memcpy(node.data(), hash.data(), kNodeSize);
+    AddLeafNode(node);
+    return leaf_count_;
+  }
+
+  std::string CurrentRoot() override {
+    const Node& root(Root());
+    return std::string(root.data(), kNodeSize);
+  }
+
+  void AddLeafNode(const Node& hash) {
+    AddSubtreeNode(0, hash);
+  }
+
+  // Like CompactMerkleTree::AddSubtreeHash(): appends a complete
+  // subtree of 2^|level| leaves, given its root, which must be
+  // aligned with the tree (LeafCount() must be a multiple of its
+  // size).
+  util::Status AddSubtreeHash(size_t level, const std::string& hash) {
+    if (hash.size() != kNodeSize) {
+      return util::Status(util::error::INVALID_ARGUMENT,
+                          "invalid subtree hash");
+    }
+    Node node;
+    memcpy(node.data(), hash.data(), kNodeSize);
+    return AddSubtreeNode(level, node);
+  }
+
+  util::Status AddSubtreeNode(size_t level, const Node& hash) {
+    const uint64_t width(level < 64 ? static_cast<uint64_t>(1) << level
+                                    : 0);
+    if (width == 0 || leaf_count_ % width != 0) {
+      return util::Status(util::error::INVALID_ARGUMENT,
+                          "subtree is not aligned with the tree");
+    }
+    // Adding |width| to the leaf count carries through the levels
+    // whose bit is set, each of which has a lone left node to hash
+    // with.
+    Node node(hash);
+    for (; (leaf_count_ >> level) & 1; ++level) {
+      Hashing::HashChildren(frontier_[level].data(), node.data(),
+                            node.data());
+    }
+    frontier_[level] = node;
+    leaf_count_ += width;
+    root_valid_ = false;
+    return util::Status::OK;
+  }
+
+  // The root of the tree, or the hash of an empty string if it has
+  // no leaves. The reference is valid until the tree is changed.
+  const Node& Root() {
+    if (root_valid_) {
+      return root_;
+    }
+    if (leaf_count_ == 0) {
+      Hashing::HashEmpty(root_.data());
+    } else {
+      // The lone left nodes, bottom up, each pulled up as the right
+      // sibling of the next.
+      bool first(true);
+      for (size_t level = 0; (leaf_count_ >> level) != 0; ++level) {
+        if (((leaf_count_ >> level) & 1) == 0) {
+          continue;
+        }
+        if (first) {
+          root_ = frontier_[level];
+          first = false;
+        } else {
+          Hashing::HashChildren(frontier_[level].data(), root_.data(),
+                                root_.data());
+        }
+      }
+    }
+    root_valid_ = true;
+    return root_;
+  }
+
+ private:
+  // The lone left node at each level whose bit is set in
+  // |leaf_count_| (the others are unused), as in CompactMerkleTree.
+  std::array<Node, 64> frontier_;
+  uint64_t leaf_count_;
+  Node root_;
+  bool root_valid_;
+
+  DISALLOW_COPY_AND_ASSIGN(FixedCompactMerkleTree);
+};
+
+
+template <class Hashing>
+const size_t FixedCompactMerkleTree<Hashing>::kNodeSize;
+
+
+typedef FixedCompactMerkleTree<Sha256TreeHashing> Sha256CompactMerkleTree;
+
+
+}  // namespace cert_trans
+
+#endif  // CERT_TRANS_MERKLETREE_FIXED_COMPACT_MERKLE_TREE_H_
@@ -1,20 +1,177 @@
 #include "merkletree/merkle_tree.h"
 
+#include <algorithm>
+#include <atomic>
+#include <errno.h>
+#include <fcntl.h>
+#include <fstream>
 #include <glog/logging.h>
+#include <iterator>
 #include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
 #include <string>
+#include <sys/stat.h>
+#include <unistd.h>
 #include <vector>
 
+#include "base/notification.h"
 #include "merkletree/merkle_tree_math.h"
+#include "util/executor.h"
 
 using cert_trans::MerkleTreeInterface;
+using cert_trans::Notification;
 using std::string;
+using std::to_string;
+using util::Status;
+
+namespace {
+
+
+// Checkpoint header layout: the magic string, then the node size and
+// the tree size as 64-bit little-endian integers, then the last node
+// of every stored level that is not complete yet (lowest level first),
+// then the root. Trees which do not store every level use the second
+// magic string, followed by their lowest stored interior level after
+// the tree size.
+const char kCheckpointMagic[] = "CTMTCKP1";
+const char kTieredCheckpointMagic[] = "CTMTCKP2";
+const size_t kCheckpointMagicSize = sizeof(kCheckpointMagic) - 1;
+// Below this many pairs of nodes, hashing a level in parallel is not
+// worth the synchronization.
+const size_t kMinParallelPairs = 4096;
+// How many parents to hash at once when updating a level.
+const size_t kHashBatchSize = 256;
+// How much to buffer when writing out a level.
+const size_t kCheckpointWriteBufferSize = 1 << 20;
+
+
+string CheckpointHeaderPath(const string& dir) {
+  return dir + "/header";
+}
+
+
+string CheckpointLevelPath(const string& dir, size_t level) {
+  return dir + "/level-" + to_string(level);
+}
+
+
+void AppendUint64(uint64_t value, string* out) {
+  for (int i = 0; i < 8; ++i) {
+    out->push_back(static_cast<char>(value >> (8 * i)));
+  }
+}
+
+
+uint64_t ReadUint64(const char* in) {
+  uint64_t value(0);
+  for (int i = 7; i >= 0; --i) {
+    value = (value << 8) | static_cast<unsigned char>(in[i]);
+  }
+  return value;
+}
+
+
+// Number of levels of a tree with |tree_size| leaves.
+size_t LevelCountForSize(size_t tree_size) {
+  if (tree_size == 0) {
+    return 0;
+  }
+  size_t levels(1);
+  while ((static_cast<size_t>(1) << (levels - 1)) < tree_size) {
+    ++levels;
+  }
+  return levels;
+}
+
+
+Status ErrnoStatus(const string& what, const string& path) {
+  return Status(util::error::INTERNAL,
+                what + " " + path + ": " + strerror(errno));
+}
+
+
+Status WriteFully(int fd, const char* data, size_t size, off_t offset,
+                  const string& path) {
+  while (size > 0) {
+    const ssize_t written(pwrite(fd, data, size, offset));
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return ErrnoStatus("cannot write", path);
+    }
+    data += written;
+    size -= written;
+    offset += written;
+  }
+  return Status::OK;
+}
+
+
+Status WriteFileAtomically(const string& path, const string& data) {
+  const string tmp_path(path + ".tmp");
+  const int fd(open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644));
+  if (fd < 0) {
+    return ErrnoStatus("cannot create", tmp_path);
+  }
+  Status status(WriteFully(fd, data.data(), data.size(), 0, tmp_path));
+  if (status.ok() && fsync(fd) < 0) {
+    status = ErrnoStatus("cannot sync", tmp_path);
+  }
+  close(fd);
+  if (status.ok() && rename(tmp_path.c_str(), path.c_str()) < 0) {
+    status = ErrnoStatus("cannot rename", tmp_path);
+  }
+  return status;
+}
+
+
+bool ReadWholeFile(const string& path, string* contents) {
+  std::ifstream in(path.c_str(), std::ios::in | std::ios::binary);
+  if (!in) {
+    return false;
+  }
+  contents->assign((std::istreambuf_iterator<char>(in)),
+                   std::istreambuf_iterator<char>());
+  return !in.bad();
+}
+
+
+Status SyncDirectory(const string& dir) {
+  const int fd(open(dir.c_str(), O_RDONLY));
+  if (fd < 0) {
+    return ErrnoStatus("cannot open", dir);
+  }
+  const int ret(fsync(fd));
+  close(fd);
+  return ret < 0 ? ErrnoStatus("cannot sync", dir) : Status::OK;
+}
+
+
+// Splits |count| back-to-back nodes of |node_size| bytes into a vector.
+std::vector<string> SplitNodes(const string& nodes, size_t count,
+                               size_t node_size) {
+  CHECK_EQ(nodes.size(), count * node_size);
+  std::vector<string> ret;
+  ret.reserve(count);
+  for (size_t i = 0; i < count; ++i)
+    ret.emplace_back(nodes.data() + i * node_size, node_size);
+  return ret;
+}
+
+
+}  // namespace
 
 MerkleTree::MerkleTree(SerialHasher* hasher)
     : MerkleTreeInterface(),
       treehasher_(hasher),
+      executor_(NULL),
       leaves_processed_(0),
-      level_count_(0) {
+      level_count_(0),
+      min_stored_level_(1),
+      snapshot_cache_size_(0) {
 }
 
 MerkleTree::~MerkleTree() {
@@ -41,6 +198,38 @@ size_t MerkleTree::AddLeafHash(const string& hash) {
   return leaf_count;
 }
 
+size_t MerkleTree::AddLeafHashes(const std::vector<string>& hashes) {
+  if (hashes.empty())
+    return LeafCount();
+  if (LazyLevelCount() == 0) {
+    AddLevel();
+    // The first leaf hash is also the first root.
+    leaves_processed_ = 1;
+  }
+  for (const auto& hash : hashes) {
+    PushBack(0, hash);
+  }
+  // As in AddLeafHash(), a k-level tree can hold 2^{k-1} leaves.
+  const size_t leaf_count(LeafCount());
+  while (level_count_ == 0 ||
+         leaf_count > (static_cast<size_t>(1) << (level_count_ - 1))) {
+    ++level_count_;
+  }
+  return leaf_count;
+}
+
+void MerkleTree::SetExecutor(util::Executor* executor, size_t num_tasks) {
+  executor_ = executor;
+  task_hashers_.clear();
+  if (!executor_) {
+    return;
+  }
+  CHECK_GT(num_tasks, 0U);
+  for (size_t i = 0; i < num_tasks; ++i) {
+    task_hashers_.emplace_back(treehasher_.Clone());
+  }
+}
+
 string MerkleTree::CurrentRoot() {
   return RootAtSnapshot(LeafCount());
 }
@@ -63,19 +252,66 @@ std::vector<string> MerkleTree::PathToCurrentRoot(size_t leaf) {
 
 std::vector<string> MerkleTree::PathToRootAtSnapshot(size_t leaf,
                                                      size_t snapshot) {
-  std::vector<string> path;
+  string path;
+  const size_t count(PathToRootAtSnapshot(leaf, snapshot, &path));
+  return SplitNodes(path, count, NodeSize());
+}
+
+size_t MerkleTree::PathToRootAtSnapshot(size_t leaf, size_t snapshot,
+                                        string* path) {
   size_t leaf_count = LeafCount();
   if (leaf > snapshot || snapshot > leaf_count || leaf == 0)
-    return path;
-  return PathFromNodeToRootAtSnapshot(leaf - 1, 0, snapshot);
+    return 0;
+  return PathFromNodeToRootAtSnapshot(leaf - 1, 0, snapshot, NULL, path);
+}
+
+void MerkleTree::PathsToRootAtSnapshot(const std::vector<size_t>& leaves,
+                                       size_t snapshot, string* paths,
+                                       std::vector<size_t>* counts) {
+  if (snapshot == 0 || snapshot > LeafCount()) {
+    counts->resize(counts->size() + leaves.size(), 0);
+    return;
+  }
+  if (snapshot > leaves_processed_) {
+    // Bring the tree sufficiently up to date.
+    UpdateToSnapshot(snapshot);
+  }
+
+  // The last nodes of the levels of the current snapshot are in the
+  // tree already, those of a past one are rehashed only once here.
+  string edge;
+  if (snapshot < leaves_processed_) {
+    const std::map<size_t, string>::const_iterator cached(
+        snapshot_edges_.find(snapshot));
+    edge = cached != snapshot_edges_.end() ? cached->second
+                                           : ComputeSnapshotEdge(snapshot);
+  }
+
+  counts->reserve(counts->size() + leaves.size());
+  for (std::vector<size_t>::const_iterator it = leaves.begin();
+       it != leaves.end(); ++it) {
+    if (*it == 0 || *it > snapshot) {
+      counts->push_back(0);
+      continue;
+    }
+    counts->push_back(PathFromNodeToRootAtSnapshot(*it - 1, 0, snapshot,
+                                                   edge.empty() ? NULL : &edge,
+                                                   paths));
+  }
 }
 
 std::vector<string> MerkleTree::SnapshotConsistency(size_t snapshot1,
                                                     size_t snapshot2) {
-  std::vector<string> proof;
+  string proof;
+  const size_t count(SnapshotConsistency(snapshot1, snapshot2, &proof));
+  return SplitNodes(proof, count, NodeSize());
+}
+
+size_t MerkleTree::SnapshotConsistency(size_t snapshot1, size_t snapshot2,
+                                       string* proof) {
   size_t leaf_count = LeafCount();
   if (snapshot1 == 0 || snapshot1 >= snapshot2 || snapshot2 > leaf_count)
-    return proof;
+    return 0;
 
   size_t level = 0;
   // Rightmost node in snapshot1.
@@ -93,13 +329,51 @@ std::vector<string> MerkleTree::SnapshotConsistency(size_t snapshot1,
   }
 
   // Record the node, unless we already reached the root of snapshot1.
-  if (node)
-    proof.push_back(Node(level, node));
+  size_t count(0);
+  if (node) {
+    string scratch;
+    proof->append(ReadNode(level, node, &scratch), NodeSize());
+    ++count;
+  }
 
   // Now record the path from this node to the root of snapshot2.
-  std::vector<string> path =
-      PathFromNodeToRootAtSnapshot(node, level, snapshot2);
-  proof.insert(proof.end(), path.begin(), path.end());
+  return count +
+         PathFromNodeToRootAtSnapshot(node, level, snapshot2, NULL, proof);
+}
+
+string MerkleTree::SubtreeRoot(size_t level, size_t index) {
+  if (level >= sizeof(size_t) * 8 || index >= (LeafCount() >> level))
+    return string();
+  if (((index + 1) << level) > leaves_processed_)
+    UpdateToSnapshot(LeafCount());
+  string scratch;
+  return string(ReadNode(level, index, &scratch), NodeSize());
+}
+
+std::vector<string> MerkleTree::RangeProofAtSnapshot(size_t begin, size_t end,
+                                                     size_t snapshot) {
+  std::vector<string> proof;
+  if (begin >= end || end > snapshot || snapshot > LeafCount())
+    return proof;
+  if (snapshot > leaves_processed_)
+    UpdateToSnapshot(snapshot);
+
+  // The subtrees to the left are given by the bits of |begin|, from
+  // the largest.
+  size_t node(0);
+  string scratch;
+  for (size_t level = LevelCountForSize(begin); level-- > 0;) {
+    if ((begin >> level) & 1) {
+      proof.emplace_back(ReadNode(level, node >> level, &scratch), NodeSize());
+      node += static_cast<size_t>(1) << level;
+    }
+  }
+  // Those to the right grow, then shrink as they near the end.
+  for (node = end; node < snapshot;) {
+    const size_t level(MerkleTreeMath::LargestSubtreeLevel(node, snapshot));
+    proof.emplace_back(ReadNode(level, node >> level, &scratch), NodeSize());
+    node += static_cast<size_t>(1) << level;
+  }
   return proof;
 }
 
@@ -107,7 +381,7 @@ string MerkleTree::UpdateToSnapshot(size_t snapshot) {
   if (snapshot == 0)
     return treehasher_.HashEmpty();
   if (snapshot == 1)
-    return Node(0, 0);
+    return string(Node(0, 0), NodeSize());
   if (snapshot == leaves_processed_)
     return Root();
   CHECK_LE(snapshot, LeafCount());
@@ -120,6 +394,32 @@ string MerkleTree::UpdateToSnapshot(size_t snapshot) {
   // Index of the last node.
   size_t last_node = snapshot - 1;
 
+  if (min_stored_level_ > 1) {
+    // The levels in between are not stored: start from the lowest
+    // stored one, hashing its new nodes straight from the leaves.
+    const size_t top(LevelCountForSize(snapshot) - 1);
+    while (LazyLevelCount() <= std::min(top, min_stored_level_))
+      AddLevel();
+    if (top < min_stored_level_) {
+      // Only the leaves are stored yet, Root() hashes them.
+      leaves_processed_ = snapshot;
+      return Root();
+    }
+
+    level = min_stored_level_;
+    first_node >>= level;
+    last_node >>= level;
+    // The first node may cover only some of its leaves; replace it.
+    if (NodeCount(level) > first_node)
+      PopBack(level);
+    string parent(NodeSize(), '\0');
+    for (size_t index = first_node; index <= last_node; ++index) {
+      HashLeafRange(index << level, std::min((index + 1) << level, snapshot),
+                    &parent[0]);
+      PushBack(level, parent);
+    }
+  }
+
   // Process level-by-level until we converge to a single node.
   // (first_node, last_node) = (0, 0) means we have reached the root level.
   while (last_node) {
@@ -134,9 +434,12 @@ string MerkleTree::UpdateToSnapshot(size_t snapshot) {
 
     // Compute the parents of new nodes at the current level.
     // Start with a left sibling and parse an even number of nodes.
-    for (size_t j = first_node & ~1; j < last_node; j += 2) {
-      PushBack(level + 1,
-               treehasher_.HashChildren(Node(level, j), Node(level, j + 1)));
+    const size_t first_pair(first_node & ~1);
+    const size_t pair_count((last_node + 1 - first_pair) / 2);
+    if (executor_ && pair_count >= kMinParallelPairs) {
+      PushBackParentsInParallel(level, first_pair, pair_count);
+    } else {
+      PushBackParents(level, first_pair, pair_count);
     }
     // If the last node at the current level is a left sibling,
     // dummy-propagate it one level up.
@@ -152,20 +455,164 @@ string MerkleTree::UpdateToSnapshot(size_t snapshot) {
   return Root();
 }
 
+void MerkleTree::HashParents(const TreeHasher& hasher, size_t level,
+                             size_t first, size_t count, char* out) const {
+  const size_t node_size(NodeSize());
+  const cert_trans::NodeLevel& nodes(tree_[level]);
+  size_t j(first);
+  while (count > 0) {
+    // Hash as many pairs as are stored back-to-back in one go.
+    const size_t run(std::min(count, nodes.ContiguousCount(j) / 2));
+    if (run > 0) {
+      hasher.HashChildrenBatch(nodes.Node(j), run, out);
+    } else {
+      // The pair straddles two chunks.
+      hasher.HashChildren(nodes.Node(j), nodes.Node(j + 1), out);
+    }
+    const size_t done(std::max(run, static_cast<size_t>(1)));
+    j += 2 * done;
+    out += done * node_size;
+    count -= done;
+  }
+}
+
+void MerkleTree::PushBackParents(size_t level, size_t first, size_t count) {
+  const size_t node_size(NodeSize());
+  string parents(std::min(count, kHashBatchSize) * node_size, '\0');
+  while (count > 0) {
+    const size_t batch(std::min(count, kHashBatchSize));
+    HashParents(treehasher_, level, first, batch, &parents[0]);
+    for (size_t i = 0; i < batch; ++i) {
+      PushBack(level + 1, parents.data() + i * node_size);
+    }
+    first += 2 * batch;
+    count -= batch;
+  }
+}
+
+void MerkleTree::PushBackParentsInParallel(size_t level, size_t first,
+                                           size_t count) {
+  const size_t node_size(NodeSize());
+  const size_t num_tasks(std::min(task_hashers_.size(), count));
+  const size_t pairs_per_task((count + num_tasks - 1) / num_tasks);
+  // The tasks only read from |level|, and write their parents to
+  // disjoint ranges of |parents|, so they need no locking.
+  string parents(count * node_size, '\0');
+  char* const out(&parents[0]);
+  std::atomic<size_t> remaining(num_tasks);
+  Notification done;
+  for (size_t task = 0; task < num_tasks; ++task) {
+    const size_t begin(std::min(count, task * pairs_per_task));
+    const size_t end(std::min(count, begin + pairs_per_task));
+    const TreeHasher* const hasher(task_hashers_[task].get());
+    executor_->Add([this, level, first, begin, end, node_size, hasher, out,
+                    &remaining, &done]() {
+      HashParents(*hasher, level, first + 2 * begin, end - begin,
+                  out + begin * node_size);
+      if (--remaining == 0) {
+        done.Notify();
+      }
+    });
+  }
+  done.WaitForNotification();
+
+  for (size_t i = 0; i < count; ++i) {
+    PushBack(level + 1, parents.data() + i * node_size);
+  }
+}
+
+void MerkleTree::CacheSnapshot(size_t snapshot) {
+  if (snapshot_cache_size_ == 0 || snapshot == 0 || snapshot > LeafCount() ||
+      snapshot_edges_.count(snapshot) > 0)
+    return;
+  if (snapshot > leaves_processed_)
+    UpdateToSnapshot(snapshot);
+
+  while (cached_snapshots_.size() >= snapshot_cache_size_) {
+    snapshot_edges_.erase(cached_snapshots_.front());
+    cached_snapshots_.pop_front();
+  }
+  snapshot_edges_[snapshot] = ComputeSnapshotEdge(snapshot);
+  cached_snapshots_.push_back(snapshot);
+}
+
+void MerkleTree::SetSnapshotCacheSize(size_t size) {
+  snapshot_cache_size_ = size;
+  while (cached_snapshots_.size() > snapshot_cache_size_) {
+    snapshot_edges_.erase(cached_snapshots_.front());
+    cached_snapshots_.pop_front();
+  }
+}
+
+size_t MerkleTree::MemoryUsage() const {
+  size_t bytes(0);
+  for (const cert_trans::NodeLevel& level : tree_) {
+    bytes += level.MemoryUsage();
+  }
+  for (const auto& edge : snapshot_edges_) {
+    bytes += edge.second.capacity();
+  }
+  return bytes;
+}
+
+string MerkleTree::ComputeSnapshotEdge(size_t snapshot) {
+  CHECK_LE(snapshot, leaves_processed_);
+  const size_t node_size(NodeSize());
+  size_t level = 0;
+  size_t last_node = snapshot - 1;
+  string edge;
+  string scratch;
+
+  // As in RecomputePastSnapshot(), right children on the way up from
+  // the last leaf are complete, and the same as in the tree.
+  while (MerkleTreeMath::IsRightChild(last_node)) {
+    edge.append(ReadNode(level, last_node, &scratch), node_size);
+    last_node = MerkleTreeMath::Parent(last_node);
+    ++level;
+  }
+
+  string subtree_root(ReadNode(level, last_node, &scratch), node_size);
+  edge.append(subtree_root);
+  while (last_node) {
+    if (MerkleTreeMath::IsRightChild(last_node)) {
+      treehasher_.HashChildren(ReadNode(level, last_node - 1, &scratch),
+                               subtree_root.data(), &subtree_root[0]);
+    }
+    last_node = MerkleTreeMath::Parent(last_node);
+    ++level;
+    edge.append(subtree_root);
+  }
+
+  return edge;
+}
+
 string MerkleTree::RecomputePastSnapshot(size_t snapshot, size_t node_level,
                                          string* node) {
+  const std::map<size_t, string>::const_iterator cached(
+      snapshot_edges_.find(snapshot));
+  if (cached != snapshot_edges_.end()) {
+    const string& edge(cached->second);
+    const size_t node_size(NodeSize());
+    if (node && node_level < edge.size() / node_size)
+      node->assign(edge, node_level * node_size, node_size);
+    return edge.substr(edge.size() - node_size);
+  }
+
   size_t level = 0;
   // Index of the rightmost node at the current level for this snapshot.
   size_t last_node = snapshot - 1;
+  string scratch;
 
   if (snapshot == leaves_processed_) {
     // Nothing to recompute.
     if (node && LazyLevelCount() > node_level) {
       if (node_level > 0) {
-        node->assign(LastNode(node_level));
+        node->assign(ReadNode(node_level, NodeCount(node_level) - 1,
+                              &scratch),
+                     NodeSize());
       } else {
         // Leaf level: grab the last processed leaf.
-        node->assign(Node(node_level, last_node));
+        node->assign(Node(node_level, last_node), NodeSize());
       }
     }
     return Root();
@@ -176,7 +623,7 @@ string MerkleTree::RecomputePastSnapshot(size_t snapshot, size_t node_level,
   // Recompute nodes on the path of the last leaf.
   while (MerkleTreeMath::IsRightChild(last_node)) {
     if (node && node_level == level)
-      node->assign(Node(level, last_node));
+      node->assign(ReadNode(level, last_node, &scratch), NodeSize());
     // Left sibling and parent exist in the snapshot, and are equal to
     // those in the tree; no need to rehash, move one level up.
     last_node = MerkleTreeMath::Parent(last_node);
@@ -185,7 +632,7 @@ string MerkleTree::RecomputePastSnapshot(size_t snapshot, size_t node_level,
 
   // Now last_node is the index of a left sibling with no right sibling.
   // Record the node.
-  string subtree_root = Node(level, last_node);
+  string subtree_root(ReadNode(level, last_node, &scratch), NodeSize());
 
   if (node && node_level == level)
     node->assign(subtree_root);
@@ -193,8 +640,8 @@ string MerkleTree::RecomputePastSnapshot(size_t snapshot, size_t node_level,
   while (last_node) {
     if (MerkleTreeMath::IsRightChild(last_node)) {
       // Recompute the parent of tree_[level][last_node].
-      subtree_root =
-          treehasher_.HashChildren(Node(level, last_node - 1), subtree_root);
+      treehasher_.HashChildren(ReadNode(level, last_node - 1, &scratch),
+                               subtree_root.data(), &subtree_root[0]);
     }
     // Else the parent is a dummy copy of the current node; do nothing.
 
@@ -207,16 +654,16 @@ string MerkleTree::RecomputePastSnapshot(size_t snapshot, size_t node_level,
   return subtree_root;
 }
 
-std::vector<string> MerkleTree::PathFromNodeToRootAtSnapshot(size_t node,
-                                                             size_t level,
-                                                             size_t snapshot) {
-  std::vector<string> path;
+size_t MerkleTree::PathFromNodeToRootAtSnapshot(size_t node, size_t level,
+                                                size_t snapshot,
+                                                const string* edge,
+                                                string* path) {
   if (snapshot == 0)
-    return path;
+    return 0;
   // Index of the last node.
   size_t last_node = (snapshot - 1) >> level;
   if (level >= level_count_ || node > last_node || snapshot > LeafCount())
-    return path;
+    return 0;
 
   if (snapshot > leaves_processed_) {
     // Bring the tree sufficiently up to date.
@@ -224,18 +671,26 @@ std::vector<string> MerkleTree::PathFromNodeToRootAtSnapshot(size_t node,
   }
 
   // Move up, recording the sibling of the current node at each level.
+  size_t count(0);
+  string recompute_node;
+  string scratch;
   while (last_node) {
     size_t sibling = MerkleTreeMath::Sibling(node);
     if (sibling < last_node) {
       // The sibling is not the last node of the level in the snapshot
       // tree, so its value is correct in the tree.
-      path.push_back(Node(level, sibling));
+      path->append(ReadNode(level, sibling, &scratch), NodeSize());
+      ++count;
     } else if (sibling == last_node) {
       // The sibling is the last node of the level in the snapshot tree,
       // so we get its value for the snapshot. Get the root in the same pass.
-      string recompute_node;
-      RecomputePastSnapshot(snapshot, level, &recompute_node);
-      path.push_back(recompute_node);
+      if (edge) {
+        path->append(*edge, level * NodeSize(), NodeSize());
+      } else {
+        RecomputePastSnapshot(snapshot, level, &recompute_node);
+        path->append(recompute_node);
+      }
+      ++count;
     }
     // Else sibling > last_node so the sibling does not exist. Do nothing.
     // Continue moving up in the tree, ignoring dummy copies.
@@ -245,43 +700,279 @@ std::vector<string> MerkleTree::PathFromNodeToRootAtSnapshot(size_t node,
     ++level;
   };
 
-  return path;
+  return count;
+}
+
+const char* MerkleTree::Node(size_t level, size_t index) const {
+  CHECK(IsStoredLevel(level));
+  CHECK_GT(NodeCount(level), index);
+  return tree_[level].Node(index);
 }
 
-string MerkleTree::Node(size_t level, size_t index) const {
+const char* MerkleTree::ReadNode(size_t level, size_t index,
+                                 string* scratch) const {
+  if (IsStoredLevel(level))
+    return Node(level, index);
   CHECK_GT(NodeCount(level), index);
-  return tree_[level].substr(index * treehasher_.DigestSize(),
-                             treehasher_.DigestSize());
+  scratch->resize(NodeSize());
+  HashLeafRange(index << level,
+                std::min((index + 1) << level, leaves_processed_),
+                &(*scratch)[0]);
+  return scratch->data();
+}
+
+void MerkleTree::HashLeafRange(size_t begin, size_t end, char* out) const {
+  CHECK_LT(begin, end);
+  CHECK_LE(end, NodeCount(0));
+  const size_t node_size(NodeSize());
+  size_t count(end - begin);
+  if (count == 1) {
+    memcpy(out, tree_[0].Node(begin), node_size);
+    return;
+  }
+
+  // Hash the leaves pairwise, then their parents, and so on, copying
+  // up the last node of a level when it has no right sibling.
+  string nodes(((count + 1) / 2) * node_size, '\0');
+  HashParents(treehasher_, 0, begin, count / 2, &nodes[0]);
+  if (count % 2 != 0)
+    memcpy(&nodes[(count / 2) * node_size], tree_[0].Node(end - 1),
+           node_size);
+  count = (count + 1) / 2;
+  string parents;
+  while (count > 1) {
+    parents.resize(((count + 1) / 2) * node_size);
+    treehasher_.HashChildrenBatch(nodes.data(), count / 2, &parents[0]);
+    if (count % 2 != 0)
+      memcpy(&parents[(count / 2) * node_size],
+             nodes.data() + (count - 1) * node_size, node_size);
+    nodes.swap(parents);
+    count = (count + 1) / 2;
+  }
+  memcpy(out, nodes.data(), node_size);
 }
 
 string MerkleTree::Root() const {
-  CHECK_EQ(tree_.back().size(), treehasher_.DigestSize());
-  return tree_.back();
+  if (!IsStoredLevel(LazyLevelCount() - 1)) {
+    string root(NodeSize(), '\0');
+    HashLeafRange(0, leaves_processed_, &root[0]);
+    return root;
+  }
+  CHECK_EQ(tree_.back().NodeCount(), 1U);
+  return string(tree_.back().Node(0), NodeSize());
 }
 
 size_t MerkleTree::NodeCount(size_t level) const {
   CHECK_GT(LazyLevelCount(), level);
-  return tree_[level].size() / treehasher_.DigestSize();
+  if (!IsStoredLevel(level))
+    return ((leaves_processed_ - 1) >> level) + 1;
+  return tree_[level].NodeCount();
 }
 
-string MerkleTree::LastNode(size_t level) const {
+const char* MerkleTree::LastNode(size_t level) const {
   CHECK_GE(NodeCount(level), 1U);
-  return tree_[level].substr(tree_[level].size() - treehasher_.DigestSize());
+  return tree_[level].Node(tree_[level].NodeCount() - 1);
 }
 
 void MerkleTree::PopBack(size_t level) {
   CHECK_GE(NodeCount(level), 1U);
-  tree_[level].erase(tree_[level].size() - treehasher_.DigestSize());
+  tree_[level].PopBack();
 }
 
-void MerkleTree::PushBack(size_t level, string node) {
-  CHECK_EQ(node.size(), treehasher_.DigestSize());
+void MerkleTree::PushBack(size_t level, const char* node) {
   CHECK_GT(LazyLevelCount(), level);
-  tree_[level].append(node);
+  tree_[level].PushBack(node);
+}
+
+void MerkleTree::PushBack(size_t level, const string& node) {
+  CHECK_EQ(node.size(), treehasher_.DigestSize());
+  PushBack(level, node.data());
+}
+
+void MerkleTree::SetMinStoredLevel(size_t level) {
+  CHECK_GE(level, 1U);
+  CHECK_EQ(LeafCount(), 0U);
+  min_stored_level_ = level;
 }
 
 void MerkleTree::AddLevel() {
-  tree_.push_back(string());
+  tree_.emplace_back(treehasher_.DigestSize());
+}
+
+void MerkleTree::Clear() {
+  tree_.clear();
+  leaves_processed_ = 0;
+  level_count_ = 0;
+  snapshot_edges_.clear();
+  cached_snapshots_.clear();
+}
+
+Status MerkleTree::WriteCheckpoint(const string& dir) {
+  // Bring every level up to date.
+  const string root(CurrentRoot());
+  const size_t tree_size(LeafCount());
+  CHECK_EQ(LevelCountForSize(tree_size), LazyLevelCount());
+
+  if (mkdir(dir.c_str(), 0755) < 0 && errno != EEXIST) {
+    return ErrnoStatus("cannot create", dir);
+  }
+  if (dir != checkpoint_dir_) {
+    // We know nothing about what is in there.
+    checkpoint_dir_ = dir;
+    checkpointed_nodes_.clear();
+  }
+  checkpointed_nodes_.resize(LazyLevelCount(), 0);
+
+  string header(min_stored_level_ > 1 ? kTieredCheckpointMagic
+                                       : kCheckpointMagic,
+                kCheckpointMagicSize);
+  AppendUint64(NodeSize(), &header);
+  AppendUint64(tree_size, &header);
+  if (min_stored_level_ > 1)
+    AppendUint64(min_stored_level_, &header);
+  for (size_t level = 0; level < LazyLevelCount(); ++level) {
+    if (!IsStoredLevel(level))
+      continue;
+    // The nodes covering a full 2^level leaves will never change.
+    const size_t fixed(tree_size >> level);
+    const Status status(WriteCheckpointLevel(level, fixed));
+    if (!status.ok()) {
+      return status;
+    }
+    if (NodeCount(level) > fixed) {
+      CHECK_EQ(fixed + 1, NodeCount(level));
+      header.append(LastNode(level), NodeSize());
+    }
+  }
+  header.append(root);
+
+  const Status status(
+      WriteFileAtomically(CheckpointHeaderPath(dir), header));
+  if (!status.ok()) {
+    return status;
+  }
+  return SyncDirectory(dir);
+}
+
+Status MerkleTree::WriteCheckpointLevel(size_t level, size_t count) {
+  const string path(CheckpointLevelPath(checkpoint_dir_, level));
+  const int fd(open(path.c_str(), O_WRONLY | O_CREAT, 0644));
+  if (fd < 0) {
+    return ErrnoStatus("cannot open", path);
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) < 0) {
+    close(fd);
+    return ErrnoStatus("cannot stat", path);
+  }
+  // Only trust what we know we wrote (or loaded) ourselves; anything
+  // else (e.g. a torn write) gets overwritten.
+  size_t on_disk(std::min<size_t>(checkpointed_nodes_[level],
+                                  st.st_size / NodeSize()));
+  CHECK_GE(on_disk, tree_[level].MappedCount());
+  on_disk = std::min(on_disk, count);
+  if (static_cast<size_t>(st.st_size) != on_disk * NodeSize() &&
+      ftruncate(fd, on_disk * NodeSize()) < 0) {
+    close(fd);
+    return ErrnoStatus("cannot truncate", path);
+  }
+
+  Status status;
+  string buffer;
+  buffer.reserve(kCheckpointWriteBufferSize);
+  off_t offset(on_disk * NodeSize());
+  for (size_t i = on_disk; i < count && status.ok(); ++i) {
+    buffer.append(Node(level, i), NodeSize());
+    if (buffer.size() + NodeSize() > kCheckpointWriteBufferSize ||
+        i + 1 == count) {
+      status = WriteFully(fd, buffer.data(), buffer.size(), offset, path);
+      offset += buffer.size();
+      buffer.clear();
+    }
+  }
+  if (status.ok() && fdatasync(fd) < 0) {
+    status = ErrnoStatus("cannot sync", path);
+  }
+  close(fd);
+
+  if (status.ok()) {
+    checkpointed_nodes_[level] = count;
+  }
+  return status;
+}
+
+Status MerkleTree::LoadCheckpoint(const string& dir) {
+  if (LeafCount() != 0) {
+    return Status(util::error::FAILED_PRECONDITION,
+                  "cannot load a checkpoint into a non-empty tree");
+  }
+
+  string header;
+  if (!ReadWholeFile(CheckpointHeaderPath(dir), &header)) {
+    return Status(util::error::NOT_FOUND, "no checkpoint in " + dir);
+  }
+  const bool tiered(
+      header.compare(0, kCheckpointMagicSize, kTieredCheckpointMagic) == 0);
+  if (header.size() < kCheckpointMagicSize + (tiered ? 24 : 16) ||
+      (!tiered &&
+       header.compare(0, kCheckpointMagicSize, kCheckpointMagic) != 0)) {
+    return Status(util::error::DATA_LOSS, "invalid checkpoint header");
+  }
+  if (ReadUint64(header.data() + kCheckpointMagicSize) != NodeSize()) {
+    return Status(util::error::INVALID_ARGUMENT,
+                  "checkpoint was written with a different hasher");
+  }
+  const size_t tree_size(ReadUint64(header.data() + kCheckpointMagicSize + 8));
+  size_t pos(kCheckpointMagicSize + 16);
+  size_t min_stored_level(1);
+  if (tiered) {
+    min_stored_level = ReadUint64(header.data() + pos);
+    pos += 8;
+  }
+  if (min_stored_level != min_stored_level_) {
+    return Status(util::error::INVALID_ARGUMENT,
+                  "checkpoint was written with different stored levels");
+  }
+
+  const size_t levels(LevelCountForSize(tree_size));
+  std::vector<size_t> checkpointed_nodes(levels);
+  for (size_t level = 0; level < levels; ++level) {
+    AddLevel();
+    if (!IsStoredLevel(level))
+      continue;
+    const size_t fixed(tree_size >> level);
+    const Status status(
+        tree_[level].MapFile(CheckpointLevelPath(dir, level), fixed));
+    if (!status.ok()) {
+      Clear();
+      return status;
+    }
+    checkpointed_nodes[level] = fixed;
+    if ((fixed << level) != tree_size) {
+      if (pos + NodeSize() > header.size()) {
+        Clear();
+        return Status(util::error::DATA_LOSS, "truncated checkpoint header");
+      }
+      PushBack(level, header.data() + pos);
+      pos += NodeSize();
+    }
+  }
+  if (header.size() != pos + NodeSize()) {
+    Clear();
+    return Status(util::error::DATA_LOSS, "invalid checkpoint header size");
+  }
+
+  leaves_processed_ = tree_size;
+  level_count_ = levels;
+  if (tree_size > 0 && Root() != header.substr(pos)) {
+    Clear();
+    return Status(util::error::DATA_LOSS, "checkpoint root mismatch");
+  }
+
+  checkpoint_dir_ = dir;
+  checkpointed_nodes_.swap(checkpointed_nodes);
+  return Status::OK;
 }
 
 size_t MerkleTree::LazyLevelCount() const {
@@ -2,15 +2,24 @@
 #ifndef MERKLETREE_H
 #define MERKLETREE_H
 
+#include <deque>
+#include <map>
+#include <memory>
 #include <stddef.h>
 #include <string>
 #include <vector>
 
 #include "merkletree/merkle_tree_interface.h"
+#include "merkletree/node_level.h"
 #include "merkletree/tree_hasher.h"
+#include "util/status.h"
 
 class SerialHasher;
 
+namespace util {
+class Executor;
+}  // namespace util
+
 // Class for manipulating Merkle Hash Trees, as specified in the
 // Certificate Transparency specificationdoc/sunlight.xml
 // Implement binary Merkle Hash Trees, using an arbitrary hash function
@@ -19,7 +28,11 @@ class SerialHasher;
 // does domain separation for leaves and nodes, and thus ensures collision
 // resistance.
 //
-// This class is thread-compatible, but not thread-safe.
+// This class is thread-compatible, but not thread-safe. As an
+// exception, once the tree is up to date (CurrentRoot() was called
+// since the last leaf was added), the root, path and consistency
+// queries for snapshots up to LeafCount() only read it, and can be
+// made concurrently with each other (and with WriteCheckpoint()).
 class MerkleTree : public cert_trans::MerkleTreeInterface {
  public:
   // The constructor takes a pointer to some concrete hash function
@@ -42,7 +55,7 @@ class MerkleTree : public cert_trans::MerkleTreeInterface {
   std::string LeafHash(size_t leaf) const {
     if (leaf == 0 || leaf > LeafCount())
       return std::string();
-    return Node(0, leaf - 1);
+    return std::string(Node(0, leaf - 1), NodeSize());
   }
 
   // Return the leaf hash, but do not append the data to the tree.
@@ -80,6 +93,23 @@ class MerkleTree : public cert_trans::MerkleTreeInterface {
   // @param hash leaf hash
   virtual size_t AddLeafHash(const std::string& hash);
 
+  // Add all of |hashes| to the tree, in order, as if by calling
+  // AddLeafHash() on each of them.
+  //
+  // Returns the position of the last leaf added (i.e., the number of
+  // leaves in the tree after this update).
+  size_t AddLeafHashes(const std::vector<std::string>& hashes);
+
+  // Have the interior nodes computed by large updates hashed in
+  // parallel on |executor|: each level is then split into up to
+  // |num_tasks| ranges that are hashed concurrently, each with its own
+  // hasher. Passing NULL goes back to hashing everything in the
+  // calling thread. Does not take ownership of |executor|, which must
+  // outlive the tree (or be unset first). Since the calling thread
+  // blocks until the work is done, it must not be one of the threads
+  // of |executor|.
+  void SetExecutor(util::Executor* executor, size_t num_tasks);
+
   // Get the current root of the tree.
   // Update the root to reflect the current shape of the tree,
   // and return the tree digest.
@@ -121,6 +151,23 @@ class MerkleTree : public cert_trans::MerkleTreeInterface {
   // @param snapshot point in time (= number of leaves at that point)
   std::vector<std::string> PathToRootAtSnapshot(size_t leaf, size_t snapshot);
 
+  // Like PathToRootAtSnapshot() above, but appends the path nodes
+  // back-to-back (NodeSize() bytes each) to |path|, instead of
+  // allocating a string per node. |path| is not cleared first, so
+  // that callers can reuse its buffer.
+  //
+  // Returns the number of nodes appended.
+  size_t PathToRootAtSnapshot(size_t leaf, size_t snapshot, std::string* path);
+
+  // Like PathToRootAtSnapshot() above, for each of |leaves|: appends
+  // their paths back-to-back to |paths|, and the number of nodes of
+  // each path to |counts|. The nodes on the right edge of a past
+  // snapshot, which have to be rehashed unless it is cached, are only
+  // computed once for all of the paths.
+  void PathsToRootAtSnapshot(const std::vector<size_t>& leaves,
+                             size_t snapshot, std::string* paths,
+                             std::vector<size_t>* counts);
+
   // Get the Merkle consistency proof between two snapshots.
   // Returns a vector of node hashes, ordered according to levels.
   // Returns an empty vector if snapshot1 is 0, snapshot 1 >= snapshot2,
@@ -131,22 +178,132 @@ class MerkleTree : public cert_trans::MerkleTreeInterface {
   std::vector<std::string> SnapshotConsistency(size_t snapshot1,
                                                size_t snapshot2);
 
+  // Like SnapshotConsistency() above, but appends the proof nodes
+  // back-to-back (NodeSize() bytes each) to |proof|.
+  //
+  // Returns the number of nodes appended.
+  size_t SnapshotConsistency(size_t snapshot1, size_t snapshot2,
+                             std::string* proof);
+
+  // Get the root of the complete subtree of 2^level leaves that
+  // starts with leaf index << level (zero-based), e.g. a leaf hash for
+  // level 0. Subtree roots of contiguous ranges can be computed
+  // independently (and in parallel), and combined into the root of
+  // the whole range.
+  //
+  // Returns an empty string if the tree does not have all the leaves
+  // of the subtree yet.
+  std::string SubtreeRoot(size_t level, size_t index);
+
+  // Get a proof that the hashes of the leaves |begin| to |end| - 1
+  // (zero-based) are those in the tree at a snapshot, to check with
+  // MerkleVerifier::VerifyRange(). It is made of the roots of the
+  // largest complete subtrees that cover the leaves before |begin|,
+  // left to right, followed by those that cover the leaves from |end|
+  // to the end of the snapshot, left to right. This is at most 2 *
+  // LevelCount() nodes, however large the range.
+  //
+  // Returns an empty vector if the range is empty or extends past the
+  // snapshot, or the snapshot requested is in the future.
+  std::vector<std::string> RangeProofAtSnapshot(size_t begin, size_t end,
+                                                size_t snapshot);
+
+  // Remembers the right edge of the tree at |snapshot| (i.e. the last
+  // node of every level of the snapshot tree), so that later roots,
+  // paths and consistency proofs at that snapshot can be looked up
+  // rather than rehashed. Since the tree only grows, the cached nodes
+  // never go stale. Only the SetSnapshotCacheSize() most recently
+  // cached snapshots are kept.
+  void CacheSnapshot(size_t snapshot);
+
+  // Sets how many snapshots CacheSnapshot() keeps. 0 disables the
+  // cache (the default).
+  void SetSnapshotCacheSize(size_t size);
+
+  // Keeps only the leaves and the levels from |level| up in memory.
+  // The nodes of levels 1 to |level| - 1 are recomputed from the (at
+  // most 2^(|level| - 1)) leaves under them whenever a root, path or
+  // consistency proof needs them, which divides the memory used by the
+  // interior nodes by about 2^(|level| - 1) for up to about 2^|level|
+  // extra hashes per query. Together with a checkpoint, from which the
+  // leaves are memory-mapped, this leaves most of the tree to the page
+  // cache. 1 (the default) keeps every level. The tree must be empty.
+  void SetMinStoredLevel(size_t level);
+
+  // The memory used by the nodes of the tree and the cached
+  // snapshots, in bytes, not counting the nodes mapped from a
+  // checkpoint.
+  size_t MemoryUsage() const;
+
+  // Persists the tree to the directory |dir| (which is created if
+  // needed), so that it can later be reopened with LoadCheckpoint().
+  //
+  // The directory holds one append-only file per level, containing
+  // the nodes of that level that can no longer change, and a small
+  // header with the tree size, the root and the (at most one per
+  // level) nodes that may still change as leaves are added. Only the
+  // nodes added since the previous checkpoint to the same directory
+  // are written out. The header is replaced atomically, so a crash
+  // leaves the previous checkpoint intact. The levels that are not
+  // stored (see SetMinStoredLevel()) are not written either, so the
+  // leaf level file doubles as a compact file of the leaf hashes.
+  util::Status WriteCheckpoint(const std::string& dir);
+
+  // Loads the checkpoint in |dir| into this tree, which must be
+  // empty. The fixed nodes are memory-mapped rather than read in, so
+  // this is cheap even for very large trees. The caller is
+  // responsible for checking CurrentRoot() against a trusted root
+  // (e.g. the latest STH) before relying on the tree. The checkpoint
+  // must have been written with the same SetMinStoredLevel().
+  util::Status LoadCheckpoint(const std::string& dir);
+
  private:
   // Update to a given snapshot, return the root.
   std::string UpdateToSnapshot(size_t snapshot);
+  // Hash the |count| pairs of nodes at |level| starting with node
+  // |first| using |hasher|, writing the parents back-to-back to |out|.
+  void HashParents(const TreeHasher& hasher, size_t level, size_t first,
+                   size_t count, char* out) const;
+  // Hash the |count| pairs of nodes at |level| starting with node
+  // |first|, and append the parents to level |level| + 1.
+  void PushBackParents(size_t level, size_t first, size_t count);
+  // Like PushBackParents(), but splits the work on |executor_|.
+  void PushBackParentsInParallel(size_t level, size_t first, size_t count);
   // Return the root of a past snapshot.
   // If node is not NULL, additionally record the rightmost node
   // for the given snapshot and node_level.
   std::string RecomputePastSnapshot(size_t snapshot, size_t node_level,
                                     std::string* node);
+  // Compute the right edge of the tree at |snapshot|, lowest level
+  // first, for CacheSnapshot().
+  std::string ComputeSnapshotEdge(size_t snapshot);
   // Path from a node at a given level (both indexed starting with 0)
-  // to the root at a given snapshot.
-  std::vector<std::string> PathFromNodeToRootAtSnapshot(size_t node_index,
-                                                        size_t level,
-                                                        size_t snapshot);
+  // to the root at a given snapshot. The nodes are appended to |path|,
+  // and their number returned. If |edge| is not NULL, it is the right
+  // edge of the snapshot, as computed by ComputeSnapshotEdge().
+  size_t PathFromNodeToRootAtSnapshot(size_t node_index, size_t level,
+                                      size_t snapshot, const std::string* edge,
+                                      std::string* path);
   // Get the |index|-th node at level |level|. Indexing starts at 0;
   // caller is responsible for ensuring tree is sufficiently up to date.
-  std::string Node(size_t level, size_t index) const;
+  // The returned pointer is valid until the node is popped.
+  const char* Node(size_t level, size_t index) const;
+
+  // Like Node(), but also for the levels that are not stored, whose
+  // nodes are recomputed into |scratch|. The returned pointer is
+  // valid until the node is popped or |scratch| is modified.
+  const char* ReadNode(size_t level, size_t index,
+                       std::string* scratch) const;
+
+  // Hash the leaves |begin| to |end| - 1 (zero-based) into |out|, as
+  // the lazily evaluated tree would: |begin| must be the first leaf
+  // of a subtree of at least |end| - |begin| leaves.
+  void HashLeafRange(size_t begin, size_t end, char* out) const;
+
+  // Whether the nodes of |level| are kept in |tree_|.
+  bool IsStoredLevel(size_t level) const {
+    return level == 0 || level >= min_stored_level_;
+  }
 
   // Get the current root (of the lazily evaluated tree).
   // Caller is responsible for keeping track of the lazy evaluation status.
@@ -157,21 +314,31 @@ class MerkleTree : public cert_trans::MerkleTreeInterface {
   size_t NodeCount(size_t level) const;
 
   // Last node of the given level.
-  std::string LastNode(size_t level) const;
+  const char* LastNode(size_t level) const;
 
   // Pop the last node of the level.
   void PopBack(size_t level);
 
   // Append a node to the level.
-  void PushBack(size_t level, std::string node);
+  void PushBack(size_t level, const char* node);
+  void PushBack(size_t level, const std::string& node);
 
   // Start a new level.
   void AddLevel();
 
+  // Drop all the nodes, leaving an empty tree.
+  void Clear();
+
+  // Make the checkpoint file for |level| in |checkpoint_dir_| hold
+  // exactly its first |count| nodes.
+  util::Status WriteCheckpointLevel(size_t level, size_t count);
+
   // Current level count of the lazily evaluated tree.
   size_t LazyLevelCount() const;
   // A container for nodes, organized according to levels and sorted
   // left-to-right in each level. tree_[0] is the leaf level, etc.
+  // Each level stores its nodes in fixed-size chunks (see
+  // merkletree/node_level.h), so nodes can be referred to in place.
   // The hash of nodes tree_[i][j] and tree_[i][j+1] (j even) is stored
   // at tree_[i+1][j/2]. When tree_[i][j] is the last node of the level with
   // no right sibling, we store its dummy copy: tree_[i+1][j/2] = tree_[i][j].
@@ -201,12 +368,31 @@ class MerkleTree : public cert_trans::MerkleTreeInterface {
   // Since the tree is append-only from the right, at any given point in time,
   // at each level, all nodes computed so far, except possibly the last node,
   // are fixed and will no longer change.
-  std::vector<std::string> tree_;
+  //
+  // The levels that are not stored (see SetMinStoredLevel()) are left
+  // empty.
+  std::vector<cert_trans::NodeLevel> tree_;
   TreeHasher treehasher_;
+  // If set, used to hash large levels in parallel, with one hasher
+  // per task in |task_hashers_|.
+  util::Executor* executor_;
+  std::vector<std::unique_ptr<TreeHasher>> task_hashers_;
   // Number of leaves propagated up to the root,
   // to keep track of lazy evaluation.
   size_t leaves_processed_;
   // The "true" level count for a fully evaluated tree.
   size_t level_count_;
+  // The lowest interior level kept in |tree_|.
+  size_t min_stored_level_;
+  // The directory of the last checkpoint written or loaded, and how
+  // many nodes of each level it is known to hold.
+  std::string checkpoint_dir_;
+  std::vector<size_t> checkpointed_nodes_;
+  // The right edge of recently cached snapshots (see
+  // CacheSnapshot()), as back-to-back nodes, lowest level first, and
+  // the order in which they were cached.
+  size_t snapshot_cache_size_;
+  std::map<size_t, std::string> snapshot_edges_;
+  std::deque<size_t> cached_snapshots_;
 };
 #endif
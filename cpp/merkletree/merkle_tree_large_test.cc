@@ -1,5 +1,6 @@
 #include <glog/logging.h>
 #include <gtest/gtest.h>
+#include <memory>
 #include <stddef.h>
 #include <stdint.h>
 #include <string>
@@ -9,6 +10,7 @@
 #include "merkletree/merkle_tree.h"
 #include "merkletree/serial_hasher.h"
 #include "util/testing.h"
+#include "util/thread_pool.h"
 #include "util/util.h"
 
 namespace {
@@ -58,6 +60,43 @@ TEST_F(MerkleTreeLargeTest, BuildLargeTree) {
   }
 }
 
+// Time bringing a tree up to date from scratch with increasing
+// numbers of threads.
+TEST_F(MerkleTreeLargeTest, ParallelUpdateScaling) {
+  const size_t kTreeSize(4194304);
+  const int original_log_level = FLAGS_minloglevel;
+  MerkleTree leaves(new Sha256Hasher());
+  std::vector<string> hashes;
+  hashes.reserve(kTreeSize);
+  for (size_t i = 0; i < kTreeSize; ++i)
+    hashes.push_back(leaves.LeafHash(data_ + std::to_string(i)));
+
+  string expected_root;
+  for (size_t num_threads = 1; num_threads <= 16; num_threads *= 2) {
+    std::unique_ptr<cert_trans::ThreadPool> pool;
+    MerkleTree tree(new Sha256Hasher());
+    if (num_threads > 1) {
+      pool.reset(new cert_trans::ThreadPool(num_threads));
+      tree.SetExecutor(pool.get(), num_threads);
+    }
+    tree.AddLeafHashes(hashes);
+
+    const uint64_t time_before = util::TimeInMilliseconds();
+    const string root(tree.CurrentRoot());
+    const uint64_t time_after = util::TimeInMilliseconds();
+    if (expected_root.empty()) {
+      expected_root = root;
+    }
+    EXPECT_EQ(expected_root, root);
+
+    FLAGS_minloglevel = 0;
+    LOG(INFO) << "Hashed a tree with " << kTreeSize << " leaves using "
+              << num_threads << " threads in " << time_after - time_before
+              << " ms";
+    FLAGS_minloglevel = original_log_level;
+  }
+}
+
 }  // namespace
 
 int main(int argc, char** argv) {
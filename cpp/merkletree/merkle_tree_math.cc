@@ -27,3 +27,15 @@ bool MerkleTreeMath::IsRightChild(size_t leaf) {
 size_t MerkleTreeMath::Sibling(size_t leaf) {
   return IsRightChild(leaf) ? (leaf - 1) : (leaf + 1);
 }
+
+// static
+size_t MerkleTreeMath::LargestSubtreeLevel(size_t begin, size_t end) {
+  size_t level(0);
+  // Written so as not to overflow, even with |end| close to the
+  // largest size_t.
+  while (((begin >> level) & 1) == 0 && level + 1 < sizeof(size_t) * 8 &&
+         (end - begin) >> (level + 1) != 0) {
+    ++level;
+  }
+  return level;
+}
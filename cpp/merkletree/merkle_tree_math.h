@@ -16,6 +16,12 @@ class MerkleTreeMath {
   // Index of the node's (left or right) sibling in the same level.
   static size_t Sibling(size_t leaf);
 
+  // Level of the largest complete subtree that starts with leaf
+  // |begin| (zero-based) and has no leaf past |end| - 1, i.e. the
+  // largest k such that 2^k divides |begin| and |begin| + 2^k <= |end|.
+  // Requires |begin| < |end|.
+  static size_t LargestSubtreeLevel(size_t begin, size_t end);
+
  private:
   MerkleTreeMath();
 };
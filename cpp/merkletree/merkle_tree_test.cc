@@ -1,3 +1,5 @@
+#include <deque>
+#include <fstream>
 #include <glog/logging.h>
 #include <gtest/gtest.h>
 #include <stddef.h>
@@ -8,11 +10,13 @@
 #include <vector>
 
 #include "merkletree/compact_merkle_tree.h"
+#include "merkletree/fixed_compact_merkle_tree.h"
 #include "merkletree/merkle_tree.h"
 #include "merkletree/merkle_verifier.h"
 #include "merkletree/serial_hasher.h"
 #include "merkletree/tree_hasher.h"
 #include "util/testing.h"
+#include "util/thread_pool.h"
 #include "util/util.h"
 
 namespace {
@@ -192,6 +196,166 @@ TEST_F(CompactMerkleTreeTest, RootFuzz) {
   }
 }
 
+TEST_F(CompactMerkleTreeTest, FrontierFuzz) {
+  CompactMerkleTree tree(new Sha256Hasher());
+  for (size_t tree_size = 0; tree_size <= data_.size(); ++tree_size) {
+    CompactMerkleTree restored(new Sha256Hasher());
+    ASSERT_TRUE(restored.Restore(tree.LeafCount(), tree.Frontier()).ok());
+    EXPECT_EQ(tree.LeafCount(), restored.LeafCount());
+    EXPECT_EQ(tree.LevelCount(), restored.LevelCount());
+    EXPECT_EQ(tree.CurrentRoot(), restored.CurrentRoot());
+    EXPECT_GE(tree.LevelCount(), tree.Frontier().size());
+
+    // The restored tree can keep growing.
+    for (size_t j = tree_size; j < data_.size() && j < tree_size + 5; ++j) {
+      restored.AddLeaf(data_[j]);
+      EXPECT_EQ(restored.CurrentRoot(),
+                ReferenceMerkleTreeHash(data_.data(), j + 1, &tree_hasher_));
+    }
+
+    if (tree_size < data_.size()) {
+      tree.AddLeaf(data_[tree_size]);
+    }
+  }
+}
+
+TEST_F(CompactMerkleTreeTest, RestoreInvalidFrontier) {
+  CompactMerkleTree tree(new Sha256Hasher());
+  for (size_t i = 0; i < 6; ++i) {
+    tree.AddLeaf(data_[i]);
+  }
+  // 6 leaves: nodes at levels 1 and 2.
+  std::vector<string> frontier(tree.Frontier());
+  ASSERT_EQ(3U, frontier.size());
+
+  CompactMerkleTree restored(new Sha256Hasher());
+  EXPECT_FALSE(restored.Restore(7, frontier).ok());
+  EXPECT_FALSE(restored.Restore(5, frontier).ok());
+  EXPECT_FALSE(restored.Restore(2, frontier).ok());
+  frontier[1].resize(3);
+  EXPECT_FALSE(restored.Restore(6, frontier).ok());
+  EXPECT_EQ(0U, restored.LeafCount());
+
+  ASSERT_TRUE(restored.Restore(6, tree.Frontier()).ok());
+  EXPECT_FALSE(restored.Restore(6, tree.Frontier()).ok());
+}
+
+TEST_F(CompactMerkleTreeTest, AddSubtreeHashFuzz) {
+  MerkleTree reference(new Sha256Hasher());
+  for (size_t i = 0; i < data_.size(); ++i) {
+    reference.AddLeaf(data_[i]);
+  }
+  for (int round = 0; round < 50; ++round) {
+    CompactMerkleTree tree(new Sha256Hasher());
+    while (tree.LeafCount() < data_.size()) {
+      // The largest aligned subtree that fits, or a smaller one.
+      size_t level(0);
+      while ((tree.LeafCount() & ((2U << level) - 1)) == 0 &&
+             tree.LeafCount() + (2U << level) <= data_.size()) {
+        ++level;
+      }
+      level = rand() % (level + 1);
+      ASSERT_TRUE(
+          tree.AddSubtreeHash(level,
+                              reference.SubtreeRoot(level, tree.LeafCount() >>
+                                                               level))
+              .ok());
+      EXPECT_EQ(ReferenceMerkleTreeHash(data_.data(), tree.LeafCount(),
+                                        &tree_hasher_),
+                tree.CurrentRoot());
+      CompactMerkleTree one_by_one(new Sha256Hasher());
+      for (size_t i = 0; i < tree.LeafCount(); ++i) {
+        one_by_one.AddLeaf(data_[i]);
+      }
+      EXPECT_EQ(one_by_one.LevelCount(), tree.LevelCount());
+      EXPECT_EQ(one_by_one.Frontier(), tree.Frontier());
+    }
+  }
+}
+
+TEST_F(CompactMerkleTreeTest, AddSubtreeHashRejectsMisaligned) {
+  MerkleTree reference(new Sha256Hasher());
+  for (size_t i = 0; i < 8; ++i) {
+    reference.AddLeaf(data_[i]);
+  }
+  CompactMerkleTree tree(new Sha256Hasher());
+  tree.AddLeaf(data_[0]);
+  EXPECT_FALSE(tree.AddSubtreeHash(1, reference.SubtreeRoot(1, 0)).ok());
+  EXPECT_FALSE(tree.AddSubtreeHash(0, "too short").ok());
+  EXPECT_FALSE(tree.AddSubtreeHash(64, reference.SubtreeRoot(0, 1)).ok());
+  EXPECT_EQ(1U, tree.LeafCount());
+
+  ASSERT_TRUE(tree.AddSubtreeHash(0, reference.SubtreeRoot(0, 1)).ok());
+  ASSERT_TRUE(tree.AddSubtreeHash(1, reference.SubtreeRoot(1, 1)).ok());
+  EXPECT_EQ(4U, tree.LeafCount());
+  EXPECT_FALSE(tree.AddSubtreeHash(3, reference.SubtreeRoot(3, 0)).ok());
+  ASSERT_TRUE(tree.AddSubtreeHash(2, reference.SubtreeRoot(2, 1)).ok());
+  EXPECT_EQ(reference.CurrentRoot(), tree.CurrentRoot());
+}
+
+TEST_F(CompactMerkleTreeTest, FixedMatchesCompact) {
+  cert_trans::Sha256CompactMerkleTree fixed;
+  CompactMerkleTree tree(new Sha256Hasher());
+  EXPECT_EQ(tree.CurrentRoot(), fixed.CurrentRoot());
+  EXPECT_EQ(tree.NodeSize(), fixed.NodeSize());
+  EXPECT_EQ(tree.LeafHash(data_[0]), fixed.LeafHash(data_[0]));
+  for (size_t i = 0; i < data_.size(); ++i) {
+    if (i % 2 == 0) {
+      EXPECT_EQ(i + 1, fixed.AddLeaf(data_[i]));
+    } else {
+      EXPECT_EQ(i + 1, fixed.AddLeafHash(tree_hasher_.HashLeaf(data_[i])));
+    }
+    tree.AddLeaf(data_[i]);
+    EXPECT_EQ(tree.LeafCount(), fixed.LeafCount());
+    EXPECT_EQ(tree.LevelCount(), fixed.LevelCount());
+    if (rand() & 1) {
+      EXPECT_EQ(tree.CurrentRoot(), fixed.CurrentRoot());
+    }
+  }
+  EXPECT_EQ(ReferenceMerkleTreeHash(data_.data(), data_.size(),
+                                    &tree_hasher_),
+            fixed.CurrentRoot());
+}
+
+TEST_F(CompactMerkleTreeTest, FixedAddSubtreeHash) {
+  MerkleTree reference(new Sha256Hasher());
+  for (size_t i = 0; i < 8; ++i) {
+    reference.AddLeaf(data_[i]);
+  }
+  cert_trans::Sha256CompactMerkleTree tree;
+  tree.AddLeaf(data_[0]);
+  EXPECT_FALSE(tree.AddSubtreeHash(1, reference.SubtreeRoot(1, 0)).ok());
+  EXPECT_FALSE(tree.AddSubtreeHash(0, "too short").ok());
+  EXPECT_FALSE(tree.AddSubtreeHash(64, reference.SubtreeRoot(0, 1)).ok());
+  EXPECT_EQ(1U, tree.LeafCount());
+
+  ASSERT_TRUE(tree.AddSubtreeHash(0, reference.SubtreeRoot(0, 1)).ok());
+  ASSERT_TRUE(tree.AddSubtreeHash(1, reference.SubtreeRoot(1, 1)).ok());
+  ASSERT_TRUE(tree.AddSubtreeHash(2, reference.SubtreeRoot(2, 1)).ok());
+  EXPECT_EQ(8U, tree.LeafCount());
+  EXPECT_EQ(reference.CurrentRoot(), tree.CurrentRoot());
+}
+
+TEST_F(MerkleTreeTest, SubtreeRoots) {
+  MerkleTree tree(new Sha256Hasher());
+  for (size_t tree_size = 1; tree_size <= 70; ++tree_size) {
+    tree.AddLeaf(data_[tree_size - 1]);
+    for (size_t level = 0; level < 8; ++level) {
+      const size_t width(1 << level);
+      for (size_t index = 0; index * width < tree_size + width; ++index) {
+        if ((index + 1) * width > tree_size) {
+          EXPECT_EQ("", tree.SubtreeRoot(level, index));
+        } else {
+          EXPECT_EQ(ReferenceMerkleTreeHash(&data_[index * width], width,
+                                            &tree_hasher_),
+                    tree.SubtreeRoot(level, index));
+        }
+      }
+    }
+  }
+  EXPECT_EQ("", tree.SubtreeRoot(64, 0));
+}
+
 // Make random path queries and check against the reference implementation.
 TEST_F(MerkleTreeFuzzTest, PathFuzz) {
   for (size_t tree_size = 1; tree_size <= data_.size(); ++tree_size) {
@@ -213,6 +377,44 @@ TEST_F(MerkleTreeFuzzTest, PathFuzz) {
   }
 }
 
+// Get batches of paths, with and without a cached snapshot, and
+// check them against the reference implementation.
+TEST_F(MerkleTreeFuzzTest, PathsFuzz) {
+  for (size_t tree_size = 1; tree_size <= data_.size(); ++tree_size) {
+    MerkleTree tree(new Sha256Hasher());
+    tree.SetSnapshotCacheSize(1);
+    for (size_t j = 0; j < tree_size; ++j)
+      tree.AddLeaf(data_[j]);
+
+    for (size_t j = 0; j < 8; ++j) {
+      const size_t snapshot = rand() % (tree_size + 1);
+      if (j % 2)
+        tree.CacheSnapshot(snapshot);
+      // Leaves in the range 0... snapshot + 1, some of them invalid.
+      std::vector<size_t> leaves;
+      for (size_t k = 0; k < 8; ++k)
+        leaves.push_back(rand() % (snapshot + 2));
+
+      string paths;
+      std::vector<size_t> counts;
+      tree.PathsToRootAtSnapshot(leaves, snapshot, &paths, &counts);
+      ASSERT_EQ(leaves.size(), counts.size());
+      size_t offset(0);
+      for (size_t k = 0; k < leaves.size(); ++k) {
+        std::vector<string> path;
+        for (size_t n = 0; n < counts[k]; ++n) {
+          path.push_back(paths.substr(offset, tree.NodeSize()));
+          offset += tree.NodeSize();
+        }
+        EXPECT_EQ(ReferenceMerklePath(data_.data(), snapshot, leaves[k],
+                                      &tree_hasher_),
+                  path);
+      }
+      EXPECT_EQ(paths.size(), offset);
+    }
+  }
+}
+
 // Make random proof queries and check against the reference implementation.
 TEST_F(MerkleTreeFuzzTest, ConsistencyFuzz) {
   for (size_t tree_size = 1; tree_size <= data_.size(); ++tree_size) {
@@ -234,6 +436,128 @@ TEST_F(MerkleTreeFuzzTest, ConsistencyFuzz) {
   }
 }
 
+// Make random queries against cached snapshots and check against the
+// reference implementation.
+TEST_F(MerkleTreeFuzzTest, SnapshotCacheFuzz) {
+  for (size_t tree_size = 1; tree_size <= data_.size(); ++tree_size) {
+    MerkleTree tree(new Sha256Hasher());
+    tree.SetSnapshotCacheSize(4);
+    for (size_t j = 0; j < tree_size; ++j) {
+      tree.AddLeaf(data_[j]);
+      if (rand() % 8 == 0)
+        tree.CacheSnapshot(j + 1);
+    }
+
+    for (size_t j = 0; j < 8; ++j) {
+      const size_t snapshot2 = rand() % (tree_size + 1);
+      tree.CacheSnapshot(snapshot2);
+      const size_t snapshot1 = rand() % (snapshot2 + 1);
+      const size_t leaf = rand() % (snapshot2 + 1);
+      EXPECT_EQ(tree.RootAtSnapshot(snapshot2),
+                ReferenceMerkleTreeHash(data_.data(), snapshot2,
+                                        &tree_hasher_));
+      EXPECT_EQ(tree.PathToRootAtSnapshot(leaf, snapshot2),
+                ReferenceMerklePath(data_.data(), snapshot2, leaf,
+                                    &tree_hasher_));
+      EXPECT_EQ(tree.SnapshotConsistency(snapshot1, snapshot2),
+                ReferenceSnapshotConsistency(data_.data(), snapshot2,
+                                             snapshot1, &tree_hasher_, true));
+    }
+  }
+}
+
+// Grow a tree which only stores some of its levels, and make random
+// queries at every size against the reference implementation.
+TEST_F(MerkleTreeFuzzTest, MinStoredLevelFuzz) {
+  for (size_t min_stored_level = 2; min_stored_level <= 4;
+       ++min_stored_level) {
+    MerkleTree tree(new Sha256Hasher());
+    tree.SetMinStoredLevel(min_stored_level);
+    tree.SetSnapshotCacheSize(2);
+    for (size_t tree_size = 1; tree_size <= data_.size(); ++tree_size) {
+      tree.AddLeaf(data_[tree_size - 1]);
+      if (rand() % 4 == 0)
+        tree.CacheSnapshot(rand() % (tree_size + 1));
+
+      for (size_t j = 0; j < 4; ++j) {
+        const size_t snapshot2 = rand() % (tree_size + 1);
+        const size_t snapshot1 = rand() % (snapshot2 + 1);
+        const size_t leaf = rand() % (snapshot2 + 1);
+        EXPECT_EQ(ReferenceMerkleTreeHash(data_.data(), snapshot2,
+                                          &tree_hasher_),
+                  tree.RootAtSnapshot(snapshot2));
+        EXPECT_EQ(ReferenceMerklePath(data_.data(), snapshot2, leaf,
+                                      &tree_hasher_),
+                  tree.PathToRootAtSnapshot(leaf, snapshot2));
+        EXPECT_EQ(ReferenceSnapshotConsistency(data_.data(), snapshot2,
+                                               snapshot1, &tree_hasher_,
+                                               true),
+                  tree.SnapshotConsistency(snapshot1, snapshot2));
+      }
+      EXPECT_EQ(ReferenceMerkleTreeHash(data_.data(), tree_size,
+                                        &tree_hasher_),
+                tree.CurrentRoot());
+    }
+  }
+}
+
+// Add leaf hashes in random batches and check against adding them
+// one by one.
+TEST_F(MerkleTreeFuzzTest, AddLeafHashesFuzz) {
+  for (size_t tree_size = 0; tree_size <= data_.size(); ++tree_size) {
+    MerkleTree tree(new Sha256Hasher());
+    MerkleTree batched_tree(new Sha256Hasher());
+    std::vector<string> batch;
+    for (size_t j = 0; j < tree_size; ++j) {
+      tree.AddLeaf(data_[j]);
+      batch.push_back(tree.LeafHash(data_[j]));
+      if (rand() & 1) {
+        EXPECT_EQ(j + 1, batched_tree.AddLeafHashes(batch));
+        batch.clear();
+        EXPECT_EQ(tree.LevelCount(), batched_tree.LevelCount());
+        EXPECT_EQ(tree.CurrentRoot(), batched_tree.CurrentRoot());
+      }
+    }
+    EXPECT_EQ(tree_size, batched_tree.AddLeafHashes(batch));
+    EXPECT_EQ(tree.LevelCount(), batched_tree.LevelCount());
+    EXPECT_EQ(tree.CurrentRoot(), batched_tree.CurrentRoot());
+  }
+}
+
+// Build trees big enough to be hashed in parallel, and check them
+// against one hashed in a single thread.
+TEST_F(MerkleTreeFuzzTest, ParallelUpdate) {
+  cert_trans::ThreadPool pool(4);
+  MerkleTree tree(new Sha256Hasher());
+  MerkleTree parallel_tree(new Sha256Hasher());
+  parallel_tree.SetExecutor(&pool, 7);
+
+  std::vector<string> batch;
+  for (size_t i = 0; i < 4; ++i) {
+    const size_t batch_size(10000 + rand() % 10000);
+    for (size_t j = 0; j < batch_size; ++j)
+      batch.push_back(tree.LeafHash(string(1, j) + std::to_string(i)));
+    for (const auto& hash : batch)
+      tree.AddLeafHash(hash);
+    parallel_tree.AddLeafHashes(batch);
+    batch.clear();
+
+    EXPECT_EQ(tree.CurrentRoot(), parallel_tree.CurrentRoot());
+    const size_t leaf(rand() % tree.LeafCount() + 1);
+    EXPECT_EQ(tree.PathToCurrentRoot(leaf),
+              parallel_tree.PathToCurrentRoot(leaf));
+    const size_t snapshot(rand() % tree.LeafCount() + 1);
+    EXPECT_EQ(tree.SnapshotConsistency(snapshot, tree.LeafCount()),
+              parallel_tree.SnapshotConsistency(snapshot,
+                                                parallel_tree.LeafCount()));
+  }
+
+  parallel_tree.SetExecutor(NULL, 0);
+  parallel_tree.AddLeaf(data_[0]);
+  tree.AddLeaf(data_[0]);
+  EXPECT_EQ(tree.CurrentRoot(), parallel_tree.CurrentRoot());
+}
+
 // KNOWN ANSWER TESTS
 
 typedef struct {
@@ -577,6 +901,180 @@ TEST_F(MerkleTreeTest, AddLeafHash) {
   EXPECT_EQ(kHashValue, tree.LeafHash(index));
 }
 
+TEST_F(MerkleTreeTest, MemoryUsage) {
+  MerkleTree tree(new Sha256Hasher());
+  EXPECT_EQ(0U, tree.MemoryUsage());
+  tree.AddLeafHash("0123456789abcdef0123456789abcdef");
+  const size_t one_leaf(tree.MemoryUsage());
+  EXPECT_LT(0U, one_leaf);
+  tree.AddLeafHash("fedcba9876543210fedcba9876543210");
+  tree.CurrentRoot();
+  // The root level is new.
+  EXPECT_LT(one_leaf, tree.MemoryUsage());
+}
+
+TEST_F(MerkleTreeTest, MinStoredLevelMemoryUsage) {
+  MerkleTree tree(new Sha256Hasher());
+  MerkleTree tiered(new Sha256Hasher());
+  tiered.SetMinStoredLevel(6);
+  for (size_t i = 0; i < 1 << 16; ++i) {
+    tree.AddLeaf(data_[i % data_.size()]);
+    tiered.AddLeaf(data_[i % data_.size()]);
+  }
+  const size_t leaves_only(tiered.MemoryUsage());
+  EXPECT_EQ(tree.CurrentRoot(), tiered.CurrentRoot());
+  EXPECT_EQ(tree.SubtreeRoot(2, 5), tiered.SubtreeRoot(2, 5));
+  // A full tree has about as many interior nodes as leaves, this one
+  // about 1/32 of that (give or take the chunks they are allocated in).
+  EXPECT_GT(tree.MemoryUsage() - leaves_only,
+            4 * (tiered.MemoryUsage() - leaves_only));
+}
+
+// CHECKPOINT TESTS
+
+class MerkleTreeCheckpointTest : public MerkleTreeFuzzTest {
+ protected:
+  void SetUp() {
+    MerkleTreeFuzzTest::SetUp();
+    dir_ = util::CreateTemporaryDirectory("/tmp/merkle_tree_testXXXXXX");
+    ASSERT_FALSE(dir_.empty());
+  }
+
+  string dir_;
+};
+
+TEST_F(MerkleTreeCheckpointTest, EmptyTree) {
+  MerkleTree tree(new Sha256Hasher());
+  ASSERT_TRUE(tree.WriteCheckpoint(dir_).ok());
+
+  MerkleTree loaded(new Sha256Hasher());
+  ASSERT_TRUE(loaded.LoadCheckpoint(dir_).ok());
+  EXPECT_EQ(0U, loaded.LeafCount());
+  EXPECT_EQ(tree.CurrentRoot(), loaded.CurrentRoot());
+}
+
+TEST_F(MerkleTreeCheckpointTest, NoCheckpoint) {
+  MerkleTree tree(new Sha256Hasher());
+  EXPECT_EQ(util::error::NOT_FOUND,
+            tree.LoadCheckpoint(dir_ + "/missing").CanonicalCode());
+}
+
+TEST_F(MerkleTreeCheckpointTest, LoadIntoNonEmptyTree) {
+  MerkleTree tree(new Sha256Hasher());
+  tree.AddLeaf(data_[0]);
+  ASSERT_TRUE(tree.WriteCheckpoint(dir_).ok());
+  EXPECT_EQ(util::error::FAILED_PRECONDITION,
+            tree.LoadCheckpoint(dir_).CanonicalCode());
+}
+
+// Checkpoint every tree size, reload, and compare proofs and roots
+// with a tree built from scratch.
+TEST_F(MerkleTreeCheckpointTest, IncrementalCheckpoints) {
+  MerkleTree tree(new Sha256Hasher());
+  for (size_t tree_size = 1; tree_size <= data_.size(); ++tree_size) {
+    tree.AddLeaf(data_[tree_size - 1]);
+    // Skip some sizes, to write more than one node per level at once.
+    if (rand() & 1) {
+      continue;
+    }
+    ASSERT_TRUE(tree.WriteCheckpoint(dir_).ok());
+
+    MerkleTree loaded(new Sha256Hasher());
+    ASSERT_TRUE(loaded.LoadCheckpoint(dir_).ok());
+    ASSERT_EQ(tree_size, loaded.LeafCount());
+    EXPECT_EQ(tree.LevelCount(), loaded.LevelCount());
+    EXPECT_EQ(ReferenceMerkleTreeHash(data_.data(), tree_size, &tree_hasher_),
+              loaded.CurrentRoot());
+
+    const size_t snapshot(rand() % (tree_size + 1));
+    const size_t leaf(rand() % (snapshot + 1));
+    EXPECT_EQ(ReferenceMerklePath(data_.data(), snapshot, leaf,
+                                  &tree_hasher_),
+              loaded.PathToRootAtSnapshot(leaf, snapshot));
+  }
+}
+
+// A tree loaded from a checkpoint can keep growing, and be
+// checkpointed to the same directory again.
+TEST_F(MerkleTreeCheckpointTest, GrowLoadedTree) {
+  const size_t kInitialSize(37);
+  {
+    MerkleTree tree(new Sha256Hasher());
+    for (size_t i = 0; i < kInitialSize; ++i)
+      tree.AddLeaf(data_[i]);
+    ASSERT_TRUE(tree.WriteCheckpoint(dir_).ok());
+  }
+
+  MerkleTree loaded(new Sha256Hasher());
+  ASSERT_TRUE(loaded.LoadCheckpoint(dir_).ok());
+  for (size_t i = kInitialSize; i < data_.size(); ++i) {
+    loaded.AddLeaf(data_[i]);
+    EXPECT_EQ(ReferenceMerkleTreeHash(data_.data(), i + 1, &tree_hasher_),
+              loaded.CurrentRoot());
+  }
+  ASSERT_TRUE(loaded.WriteCheckpoint(dir_).ok());
+
+  MerkleTree reloaded(new Sha256Hasher());
+  ASSERT_TRUE(reloaded.LoadCheckpoint(dir_).ok());
+  EXPECT_EQ(data_.size(), reloaded.LeafCount());
+  EXPECT_EQ(ReferenceMerkleTreeHash(data_.data(), data_.size(),
+                                    &tree_hasher_),
+            reloaded.CurrentRoot());
+  EXPECT_EQ(ReferenceSnapshotConsistency(data_.data(), data_.size(),
+                                         kInitialSize, &tree_hasher_, true),
+            reloaded.SnapshotConsistency(kInitialSize, data_.size()));
+}
+
+TEST_F(MerkleTreeCheckpointTest, MinStoredLevel) {
+  const size_t kInitialSize(100);
+  {
+    MerkleTree tree(new Sha256Hasher());
+    tree.SetMinStoredLevel(3);
+    for (size_t i = 0; i < kInitialSize; ++i)
+      tree.AddLeaf(data_[i]);
+    ASSERT_TRUE(tree.WriteCheckpoint(dir_).ok());
+  }
+
+  MerkleTree untiered(new Sha256Hasher());
+  EXPECT_EQ(util::error::INVALID_ARGUMENT,
+            untiered.LoadCheckpoint(dir_).CanonicalCode());
+  EXPECT_EQ(0U, untiered.LeafCount());
+
+  MerkleTree loaded(new Sha256Hasher());
+  loaded.SetMinStoredLevel(3);
+  ASSERT_TRUE(loaded.LoadCheckpoint(dir_).ok());
+  for (size_t i = kInitialSize; i < data_.size(); ++i)
+    loaded.AddLeaf(data_[i]);
+  EXPECT_EQ(ReferenceMerkleTreeHash(data_.data(), data_.size(),
+                                    &tree_hasher_),
+            loaded.CurrentRoot());
+  EXPECT_EQ(ReferenceMerklePath(data_.data(), kInitialSize, 37,
+                                &tree_hasher_),
+            loaded.PathToRootAtSnapshot(37, kInitialSize));
+  EXPECT_EQ(ReferenceSnapshotConsistency(data_.data(), data_.size(),
+                                         kInitialSize, &tree_hasher_, true),
+            loaded.SnapshotConsistency(kInitialSize, data_.size()));
+}
+
+TEST_F(MerkleTreeCheckpointTest, CorruptHeader) {
+  MerkleTree tree(new Sha256Hasher());
+  for (size_t i = 0; i < 10; ++i)
+    tree.AddLeaf(data_[i]);
+  ASSERT_TRUE(tree.WriteCheckpoint(dir_).ok());
+
+  string header;
+  ASSERT_TRUE(util::ReadBinaryFile(dir_ + "/header", &header));
+  header.resize(header.size() - 1);
+  std::ofstream out(dir_ + "/header", std::ios::binary | std::ios::trunc);
+  out << header;
+  out.close();
+
+  MerkleTree loaded(new Sha256Hasher());
+  EXPECT_EQ(util::error::DATA_LOSS,
+            loaded.LoadCheckpoint(dir_).CanonicalCode());
+  EXPECT_EQ(0U, loaded.LeafCount());
+}
+
 TEST_F(CompactMerkleTreeTest, TestCloneEmptyTreeProducesWorkingTree) {
   MerkleTree tree(new Sha256Hasher);
   CompactMerkleTree compact(tree, new Sha256Hasher);
@@ -830,6 +1328,186 @@ TEST_F(MerkleVerifierTest, VerifyConsistencyProof) {
   }
 }
 
+// Check a batch of valid and broken paths against VerifyPath().
+TEST_F(MerkleVerifierTest, VerifyPathsMatchesVerifyPath) {
+  struct Path {
+    size_t leaf;
+    size_t tree_size;
+    std::vector<string> path;
+    string root;
+  };
+  // A deque, so that the proofs can point into it as it grows.
+  std::deque<Path> paths;
+  for (size_t tree_size = 1; tree_size <= 40; ++tree_size) {
+    const string root(
+        ReferenceMerkleTreeHash(data_.data(), tree_size, &tree_hasher_));
+    for (size_t leaf = 1; leaf <= tree_size; ++leaf) {
+      const std::vector<string> path(
+          ReferenceMerklePath(data_.data(), tree_size, leaf, &tree_hasher_));
+      paths.push_back(Path{leaf, tree_size, path, root});
+      // Wrong leaf index and tree size.
+      paths.push_back(Path{leaf + 1, tree_size, path, root});
+      paths.push_back(Path{leaf, tree_size + 1, path, root});
+      paths.push_back(Path{leaf - 1, tree_size, path, root});
+      if (path.empty())
+        continue;
+      // Modified, truncated and extended paths, and short nodes.
+      paths.push_back(Path{leaf, tree_size, path, root});
+      paths.back().path[rand() % path.size()][0] ^= 1;
+      paths.push_back(Path{leaf, tree_size, path, root});
+      paths.back().path.pop_back();
+      paths.push_back(Path{leaf, tree_size, path, root});
+      paths.back().path.push_back(path.back());
+      paths.push_back(Path{leaf, tree_size, path, root});
+      paths.back().path[rand() % path.size()].clear();
+    }
+  }
+
+  std::vector<MerkleVerifier::PathProof> proofs;
+  for (const Path& path : paths)
+    proofs.push_back(MerkleVerifier::PathProof{path.leaf, path.tree_size,
+                                               &path.path, &path.root,
+                                               &data_[(path.leaf + 255) %
+                                                      256]});
+  const std::vector<bool> results(verifier_.VerifyPaths(proofs));
+  ASSERT_EQ(proofs.size(), results.size());
+  size_t valid(0);
+  for (size_t i = 0; i < proofs.size(); ++i) {
+    EXPECT_EQ(verifier_.VerifyPath(proofs[i].leaf, proofs[i].tree_size,
+                                   *proofs[i].path, *proofs[i].root,
+                                   *proofs[i].data),
+              results[i])
+        << "proof " << i;
+    valid += results[i];
+  }
+  EXPECT_LE(40u * 41 / 2, valid);
+
+  // The scratch buffers are reused for smaller batches.
+  proofs.resize(3);
+  EXPECT_EQ(std::vector<bool>({true, false, false}),
+            verifier_.VerifyPaths(proofs));
+  EXPECT_TRUE(verifier_.VerifyPaths(
+                           std::vector<MerkleVerifier::PathProof>())
+                  .empty());
+}
+
+// Check a batch of valid and broken consistency proofs against
+// VerifyConsistency().
+TEST_F(MerkleVerifierTest, VerifyConsistenciesMatchesVerifyConsistency) {
+  struct Consistency {
+    size_t snapshot1;
+    size_t snapshot2;
+    string root1;
+    string root2;
+    std::vector<string> proof;
+  };
+  std::deque<Consistency> consistencies;
+  for (size_t tree_size = 0; tree_size <= 40; ++tree_size) {
+    const string root2(
+        ReferenceMerkleTreeHash(data_.data(), tree_size, &tree_hasher_));
+    for (size_t snapshot = 0; snapshot <= tree_size; ++snapshot) {
+      const string root1(
+          ReferenceMerkleTreeHash(data_.data(), snapshot, &tree_hasher_));
+      const std::vector<string> proof(ReferenceSnapshotConsistency(
+          data_.data(), tree_size, snapshot, &tree_hasher_, true));
+      consistencies.push_back(
+          Consistency{snapshot, tree_size, root1, root2, proof});
+      // Wrong snapshots and roots.
+      consistencies.push_back(
+          Consistency{snapshot + 1, tree_size, root1, root2, proof});
+      consistencies.push_back(
+          Consistency{snapshot, tree_size + 1, root1, root2, proof});
+      consistencies.push_back(
+          Consistency{snapshot, tree_size, root2, root1, proof});
+      consistencies.push_back(
+          Consistency{snapshot, tree_size, string(), root2, proof});
+      if (proof.empty())
+        continue;
+      // Modified, truncated and extended proofs, and short nodes.
+      consistencies.push_back(
+          Consistency{snapshot, tree_size, root1, root2, proof});
+      consistencies.back().proof[rand() % proof.size()][0] ^= 1;
+      consistencies.push_back(
+          Consistency{snapshot, tree_size, root1, root2, proof});
+      consistencies.back().proof.pop_back();
+      consistencies.push_back(
+          Consistency{snapshot, tree_size, root1, root2, proof});
+      consistencies.back().proof.push_back(proof.back());
+      consistencies.push_back(
+          Consistency{snapshot, tree_size, root1, root2, proof});
+      consistencies.back().proof[rand() % proof.size()].clear();
+    }
+  }
+
+  std::vector<MerkleVerifier::ConsistencyProof> proofs;
+  for (const Consistency& c : consistencies)
+    proofs.push_back(MerkleVerifier::ConsistencyProof{
+        c.snapshot1, c.snapshot2, &c.root1, &c.root2, &c.proof});
+  const std::vector<bool> results(verifier_.VerifyConsistencies(proofs));
+  ASSERT_EQ(proofs.size(), results.size());
+  size_t valid(0);
+  for (size_t i = 0; i < proofs.size(); ++i) {
+    EXPECT_EQ(verifier_.VerifyConsistency(proofs[i].snapshot1,
+                                          proofs[i].snapshot2,
+                                          *proofs[i].root1, *proofs[i].root2,
+                                          *proofs[i].proof),
+              results[i])
+        << "proof " << i;
+    valid += results[i];
+  }
+  EXPECT_LE(41u * 42 / 2, valid);
+}
+
+TEST_F(MerkleVerifierTest, VerifyRange) {
+  MerkleTree tree(new Sha256Hasher());
+  std::vector<string> leaf_hashes;
+  for (size_t i = 0; i < 70; ++i) {
+    tree.AddLeaf(data_[i]);
+    leaf_hashes.push_back(tree.LeafHash(i + 1));
+  }
+
+  for (size_t snapshot = 1; snapshot <= tree.LeafCount(); ++snapshot) {
+    const string root(tree.RootAtSnapshot(snapshot));
+    for (size_t begin = 0; begin < snapshot; ++begin) {
+      for (size_t end = begin + 1; end <= snapshot; end += 3) {
+        const std::vector<string> range(leaf_hashes.begin() + begin,
+                                        leaf_hashes.begin() + end);
+        std::vector<string> proof(
+            tree.RangeProofAtSnapshot(begin, end, snapshot));
+        EXPECT_GE(2 * tree.LevelCount(), proof.size());
+        EXPECT_TRUE(
+            verifier_.VerifyRange(begin, snapshot, range, proof, root));
+
+        // Wrong position.
+        EXPECT_FALSE(
+            verifier_.VerifyRange(begin + 1, snapshot, range, proof, root));
+        // Wrong leaves.
+        std::vector<string> wrong_range(range);
+        wrong_range.back() = leaf_hashes[end % snapshot == begin ? 69 : 0];
+        if (wrong_range != range) {
+          EXPECT_FALSE(
+              verifier_.VerifyRange(begin, snapshot, wrong_range, proof, root));
+        }
+        // Wrong proof.
+        if (!proof.empty()) {
+          proof.back()[0] ^= 1;
+          EXPECT_FALSE(
+              verifier_.VerifyRange(begin, snapshot, range, proof, root));
+          proof.pop_back();
+          EXPECT_FALSE(
+              verifier_.VerifyRange(begin, snapshot, range, proof, root));
+        }
+      }
+    }
+  }
+
+  EXPECT_TRUE(tree.RangeProofAtSnapshot(5, 5, 10).empty());
+  EXPECT_TRUE(tree.RangeProofAtSnapshot(5, 11, 10).empty());
+  EXPECT_TRUE(tree.RangeProofAtSnapshot(5, 6, 71).empty());
+  EXPECT_FALSE(verifier_.VerifyRange(0, 1, std::vector<string>(),
+                                     std::vector<string>(), string()));
+}
+
 #undef S
 #undef H
 
@@ -1,8 +1,13 @@
 #include "merkletree/merkle_verifier.h"
 
 #include <stddef.h>
+#include <string.h>
+#include <utility>
 #include <vector>
 
+#include "merkletree/merkle_tree_math.h"
+
+using std::pair;
 using std::string;
 
 MerkleVerifier::MerkleVerifier(SerialHasher* hasher) : treehasher_(hasher) {
@@ -46,9 +51,9 @@ string MerkleVerifier::RootFromPath(size_t leaf, size_t tree_size,
       // We've reached the end but we're not done yet.
       return string();
     if (IsRightChild(node))
-      node_hash = treehasher_.HashChildren(*it++, node_hash);
+      treehasher_.HashChildren(*it++, node_hash, &node_hash);
     else if (node < last_node)
-      node_hash = treehasher_.HashChildren(node_hash, *it++);
+      treehasher_.HashChildren(node_hash, *it++, &node_hash);
     // Else the sibling does not exist and the parent is a dummy copy.
     // Do nothing.
 
@@ -99,13 +104,13 @@ bool MerkleVerifier::VerifyConsistency(size_t snapshot1, size_t snapshot2,
       return false;
 
     if (IsRightChild(node)) {
-      node1_hash = treehasher_.HashChildren(*it, node1_hash);
-      node2_hash = treehasher_.HashChildren(*it, node2_hash);
+      treehasher_.HashChildren(*it, node1_hash, &node1_hash);
+      treehasher_.HashChildren(*it, node2_hash, &node2_hash);
       ++it;
     } else if (node < last_node)
       // The sibling only exists in the later tree. The parent in the
       // snapshot1 tree is a dummy copy.
-      node2_hash = treehasher_.HashChildren(node2_hash, *it++);
+      treehasher_.HashChildren(node2_hash, *it++, &node2_hash);
     // Else the sibling does not exist in either tree. Do nothing.
 
     node = Parent(node);
@@ -122,7 +127,7 @@ bool MerkleVerifier::VerifyConsistency(size_t snapshot1, size_t snapshot2,
       // We've reached the end but we're not done yet.
       return false;
 
-    node2_hash = treehasher_.HashChildren(node2_hash, *it++);
+    treehasher_.HashChildren(node2_hash, *it++, &node2_hash);
     last_node = Parent(last_node);
   }
 
@@ -130,6 +135,327 @@ bool MerkleVerifier::VerifyConsistency(size_t snapshot1, size_t snapshot2,
   return node2_hash == root2 && it == proof.end();
 }
 
+namespace {
+
+// How far along a proof is in VerifyPaths() and VerifyConsistencies().
+enum BatchStatus {
+  kWalking,
+  kValid,
+  kInvalid,
+};
+
+bool NodeEquals(const char* node, const string& hash, size_t digest_size) {
+  return hash.size() == digest_size &&
+         memcmp(node, hash.data(), digest_size) == 0;
+}
+
+}  // namespace
+
+std::vector<bool> MerkleVerifier::VerifyPaths(
+    const std::vector<PathProof>& proofs) {
+  const size_t digest_size(treehasher_.DigestSize());
+  std::vector<BatchStatus> status(proofs.size(), kWalking);
+  // The node being hashed up the tree for each proof, the last node
+  // of the tree at its level, and how much of the path has been used.
+  batch_nodes_.resize(proofs.size() * digest_size);
+  std::vector<size_t> node(proofs.size()), last_node(proofs.size());
+  std::vector<size_t> next(proofs.size(), 0);
+
+  size_t walking(0);
+  for (size_t i = 0; i < proofs.size(); ++i) {
+    const PathProof& proof(proofs[i]);
+    if (proof.leaf > proof.tree_size || proof.leaf == 0) {
+      // No valid path exists.
+      status[i] = kInvalid;
+      continue;
+    }
+    node[i] = proof.leaf - 1;
+    last_node[i] = proof.tree_size - 1;
+    treehasher_.HashLeaf(proof.data->data(), proof.data->size(),
+                         &batch_nodes_[i * digest_size]);
+    ++walking;
+  }
+
+  // Each round moves each proof up to its next hash, as RootFromPath()
+  // does, and then hashes all of those at once.
+  while (walking > 0) {
+    for (size_t i = 0; i < proofs.size(); ++i) {
+      if (status[i] != kWalking)
+        continue;
+      const std::vector<string>& path(*proofs[i].path);
+      char* const node_hash(&batch_nodes_[i * digest_size]);
+      while (true) {
+        if (last_node[i] == 0) {
+          // Check that we've reached the end, and the root.
+          status[i] = next[i] == path.size() &&
+                              NodeEquals(node_hash, *proofs[i].root,
+                                         digest_size)
+                          ? kValid
+                          : kInvalid;
+          break;
+        }
+        if (next[i] == path.size()) {
+          // We've reached the end but we're not done yet.
+          status[i] = kInvalid;
+          break;
+        }
+        const string& sibling(path[next[i]]);
+        const bool right(IsRightChild(node[i]));
+        const bool has_sibling(right || node[i] < last_node[i]);
+        if (has_sibling && sibling.size() != digest_size) {
+          status[i] = kInvalid;
+          break;
+        }
+        if (right)
+          QueueChildren(sibling.data(), node_hash, node_hash);
+        else if (has_sibling)
+          QueueChildren(node_hash, sibling.data(), node_hash);
+        // Else the sibling does not exist and the parent is a dummy
+        // copy.
+        if (has_sibling)
+          ++next[i];
+        node[i] = Parent(node[i]);
+        last_node[i] = Parent(last_node[i]);
+        if (has_sibling)
+          break;
+      }
+      if (status[i] != kWalking)
+        --walking;
+    }
+    HashQueuedChildren();
+  }
+
+  std::vector<bool> results(proofs.size());
+  for (size_t i = 0; i < proofs.size(); ++i)
+    results[i] = status[i] == kValid;
+  return results;
+}
+
+std::vector<bool> MerkleVerifier::VerifyConsistencies(
+    const std::vector<ConsistencyProof>& proofs) {
+  const size_t digest_size(treehasher_.DigestSize());
+  std::vector<BatchStatus> status(proofs.size(), kWalking);
+  // As in VerifyConsistency(): the node of each proof being hashed up
+  // the tree at |snapshot1| and at |snapshot2|, back-to-back, the
+  // node and the last node at the current level, how much of the
+  // proof has been used, and whether the first root was checked.
+  batch_nodes_.resize(proofs.size() * 2 * digest_size);
+  std::vector<size_t> node(proofs.size()), last_node(proofs.size());
+  std::vector<size_t> next(proofs.size(), 0);
+  std::vector<bool> root1_checked(proofs.size(), false);
+
+  size_t walking(0);
+  for (size_t i = 0; i < proofs.size(); ++i) {
+    const ConsistencyProof& p(proofs[i]);
+    const std::vector<string>& proof(*p.proof);
+    if (p.snapshot1 > p.snapshot2) {
+      // Can't go back in time.
+      status[i] = kInvalid;
+      continue;
+    }
+    if (p.snapshot1 == p.snapshot2) {
+      status[i] = *p.root1 == *p.root2 && proof.empty() ? kValid : kInvalid;
+      continue;
+    }
+    if (p.snapshot1 == 0) {
+      // Any snapshot greater than 0 is consistent with snapshot 0.
+      status[i] = proof.empty() ? kValid : kInvalid;
+      continue;
+    }
+    if (proof.empty()) {
+      status[i] = kInvalid;
+      continue;
+    }
+    node[i] = p.snapshot1 - 1;
+    last_node[i] = p.snapshot2 - 1;
+    // Move up until the first mutable node.
+    while (IsRightChild(node[i])) {
+      node[i] = Parent(node[i]);
+      last_node[i] = Parent(last_node[i]);
+    }
+    // If the tree at snapshot1 was balanced, there is nothing to
+    // verify for root1.
+    const string& start(node[i] ? proof[next[i]++] : *p.root1);
+    if (start.size() != digest_size) {
+      status[i] = kInvalid;
+      continue;
+    }
+    char* const node1_hash(&batch_nodes_[2 * i * digest_size]);
+    memcpy(node1_hash, start.data(), digest_size);
+    memcpy(node1_hash + digest_size, start.data(), digest_size);
+    ++walking;
+  }
+
+  while (walking > 0) {
+    for (size_t i = 0; i < proofs.size(); ++i) {
+      if (status[i] != kWalking)
+        continue;
+      const std::vector<string>& proof(*proofs[i].proof);
+      char* const node1_hash(&batch_nodes_[2 * i * digest_size]);
+      char* const node2_hash(node1_hash + digest_size);
+      while (true) {
+        if (next[i] == proof.size() && (node[i] || last_node[i])) {
+          // We've reached the end but we're not done yet.
+          status[i] = kInvalid;
+          break;
+        }
+        if (node[i]) {
+          const string& sibling(proof[next[i]]);
+          const bool right(IsRightChild(node[i]));
+          const bool has_sibling(right || node[i] < last_node[i]);
+          if (has_sibling && sibling.size() != digest_size) {
+            status[i] = kInvalid;
+            break;
+          }
+          if (right) {
+            QueueChildren(sibling.data(), node1_hash, node1_hash);
+            QueueChildren(sibling.data(), node2_hash, node2_hash);
+          } else if (has_sibling) {
+            // The sibling only exists in the later tree. The parent in
+            // the snapshot1 tree is a dummy copy.
+            QueueChildren(node2_hash, sibling.data(), node2_hash);
+          }
+          // Else the sibling does not exist in either tree.
+          if (has_sibling)
+            ++next[i];
+          node[i] = Parent(node[i]);
+          last_node[i] = Parent(last_node[i]);
+          if (has_sibling)
+            break;
+          continue;
+        }
+
+        // Verify the first root.
+        if (!root1_checked[i]) {
+          if (!NodeEquals(node1_hash, *proofs[i].root1, digest_size)) {
+            status[i] = kInvalid;
+            break;
+          }
+          root1_checked[i] = true;
+        }
+        if (last_node[i] == 0) {
+          // Verify the second root.
+          status[i] = next[i] == proof.size() &&
+                              NodeEquals(node2_hash, *proofs[i].root2,
+                                         digest_size)
+                          ? kValid
+                          : kInvalid;
+          break;
+        }
+        // Continue until the second root.
+        const string& sibling(proof[next[i]++]);
+        if (sibling.size() != digest_size) {
+          status[i] = kInvalid;
+          break;
+        }
+        QueueChildren(node2_hash, sibling.data(), node2_hash);
+        last_node[i] = Parent(last_node[i]);
+        break;
+      }
+      if (status[i] != kWalking)
+        --walking;
+    }
+    HashQueuedChildren();
+  }
+
+  std::vector<bool> results(proofs.size());
+  for (size_t i = 0; i < proofs.size(); ++i)
+    results[i] = status[i] == kValid;
+  return results;
+}
+
+void MerkleVerifier::QueueChildren(const char* left, const char* right,
+                                   char* parent) {
+  const size_t digest_size(treehasher_.DigestSize());
+  batch_children_.insert(batch_children_.end(), left, left + digest_size);
+  batch_children_.insert(batch_children_.end(), right, right + digest_size);
+  batch_destinations_.push_back(parent);
+}
+
+void MerkleVerifier::HashQueuedChildren() {
+  const size_t count(batch_destinations_.size());
+  if (count == 0)
+    return;
+  const size_t digest_size(treehasher_.DigestSize());
+  batch_parents_.resize(count * digest_size);
+  treehasher_.HashChildrenBatch(batch_children_.data(), count,
+                                batch_parents_.data());
+  for (size_t i = 0; i < count; ++i)
+    memcpy(batch_destinations_[i], &batch_parents_[i * digest_size],
+           digest_size);
+  batch_children_.clear();
+  batch_destinations_.clear();
+}
+
 string MerkleVerifier::LeafHash(const std::string& data) {
   return treehasher_.HashLeaf(data);
 }
+
+bool MerkleVerifier::VerifyRange(size_t begin, size_t tree_size,
+                                 const std::vector<string>& leaf_hashes,
+                                 const std::vector<string>& proof,
+                                 const string& root) {
+  const string range_root(
+      RootFromRangeProof(begin, tree_size, leaf_hashes, proof));
+  if (range_root.empty())
+    return false;
+  return range_root == root;
+}
+
+string MerkleVerifier::RootFromRangeProof(
+    size_t begin, size_t tree_size, const std::vector<string>& leaf_hashes,
+    const std::vector<string>& proof) {
+  const size_t end(begin + leaf_hashes.size());
+  if (leaf_hashes.empty() || end < begin || end > tree_size)
+    return string();
+
+  // Rebuild the tree left to right, as the largest complete subtrees
+  // covering the leaves so far, like a compact Merkle tree does.
+  std::vector<pair<size_t, string>> subtrees;
+  std::vector<string>::const_iterator it(proof.begin());
+  // The subtrees before |begin|, from the largest.
+  for (size_t level = sizeof(size_t) * 8; level-- > 0;) {
+    if ((begin >> level) & 1) {
+      if (it == proof.end())
+        return string();
+      if (!PushSubtree(level, *it++, &subtrees))
+        return string();
+    }
+  }
+  for (const string& leaf_hash : leaf_hashes) {
+    if (!PushSubtree(0, leaf_hash, &subtrees))
+      return string();
+  }
+  // The subtrees after the range.
+  for (size_t node = end; node < tree_size;) {
+    if (it == proof.end())
+      return string();
+    const size_t level(MerkleTreeMath::LargestSubtreeLevel(node, tree_size));
+    if (!PushSubtree(level, *it++, &subtrees))
+      return string();
+    node += static_cast<size_t>(1) << level;
+  }
+  if (it != proof.end())
+    return string();
+
+  // What is left are the subtrees given by the bits of |tree_size|,
+  // the smaller ones to the right of the larger ones.
+  string node_hash(subtrees.back().second);
+  for (size_t i = subtrees.size() - 1; i-- > 0;) {
+    treehasher_.HashChildren(subtrees[i].second, node_hash, &node_hash);
+  }
+  return node_hash;
+}
+
+bool MerkleVerifier::PushSubtree(size_t level, string node,
+                                 std::vector<pair<size_t, string>>* subtrees) {
+  if (node.size() != treehasher_.DigestSize())
+    return false;
+  while (!subtrees->empty() && subtrees->back().first == level) {
+    treehasher_.HashChildren(subtrees->back().second, node, &node);
+    subtrees->pop_back();
+    ++level;
+  }
+  subtrees->emplace_back(level, std::move(node));
+  return true;
+}
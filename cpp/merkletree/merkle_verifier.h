@@ -2,6 +2,8 @@
 #define MERKLEVERIFIER_H
 
 #include <stddef.h>
+#include <string>
+#include <utility>
 #include <vector>
 
 #include "merkletree/tree_hasher.h"
@@ -47,11 +49,81 @@ class MerkleVerifier {
                          const std::string& root1, const std::string& root2,
                          const std::vector<std::string>& proof);
 
+  // The arguments of a VerifyPath() call, for VerifyPaths(). What they
+  // point to must outlive the call.
+  struct PathProof {
+    size_t leaf;
+    size_t tree_size;
+    const std::vector<std::string>* path;
+    const std::string* root;
+    const std::string* data;
+  };
+
+  // The arguments of a VerifyConsistency() call, for
+  // VerifyConsistencies().
+  struct ConsistencyProof {
+    size_t snapshot1;
+    size_t snapshot2;
+    const std::string* root1;
+    const std::string* root2;
+    const std::vector<std::string>* proof;
+  };
+
+  // Return what VerifyPath() and VerifyConsistency() would for each
+  // of |proofs|, in order. The proofs are walked up the tree together,
+  // so that the interior nodes of all of them are hashed one level at
+  // a time with TreeHasher::HashChildrenBatch() (which uses the
+  // multi-buffer SHA-256 kernel where it can), into scratch buffers
+  // kept from one call to the next.
+  std::vector<bool> VerifyPaths(const std::vector<PathProof>& proofs);
+  std::vector<bool> VerifyConsistencies(
+      const std::vector<ConsistencyProof>& proofs);
+
+  // Verify that |leaf_hashes| are the hashes of the leaves |begin|
+  // (zero-based) to |begin| + leaf_hashes.size() - 1 of the tree with
+  // |tree_size| leaves and root |root|, given a range proof from
+  // MerkleTree::RangeProofAtSnapshot().
+  //
+  // Each range is checked on its own, so a large batch of fetched
+  // leaves can be split up and checked on several threads at once.
+  bool VerifyRange(size_t begin, size_t tree_size,
+                   const std::vector<std::string>& leaf_hashes,
+                   const std::vector<std::string>& proof,
+                   const std::string& root);
+
+  // Compute the root corresponding to a range proof (see
+  // VerifyRange()). Returns an empty string if the proof is not
+  // valid.
+  std::string RootFromRangeProof(size_t begin, size_t tree_size,
+                                 const std::vector<std::string>& leaf_hashes,
+                                 const std::vector<std::string>& proof);
+
   // Return the leaf hash corresponding to the leaf input.
   std::string LeafHash(const std::string& data);
 
  private:
+  // Adds the |node| covering 2^|level| leaves to the right of the
+  // |subtrees| (level and root) that cover the leaves before it, and
+  // merges those that have become siblings. Returns false if |node|
+  // is not a valid hash.
+  bool PushSubtree(size_t level, std::string node,
+                   std::vector<std::pair<size_t, std::string>>* subtrees);
+
+  // Queues the hashing of |left| and |right|, each DigestSize()
+  // bytes, into |parent|, which may be either of them, for
+  // HashQueuedChildren().
+  void QueueChildren(const char* left, const char* right, char* parent);
+  void HashQueuedChildren();
+
   TreeHasher treehasher_;
+
+  // Scratch buffers for VerifyPaths() and VerifyConsistencies(): the
+  // nodes being hashed up the tree for each proof, the children queued
+  // by QueueChildren() and their parents, and where the parents go.
+  std::vector<char> batch_nodes_;
+  std::vector<char> batch_children_;
+  std::vector<char> batch_parents_;
+  std::vector<char*> batch_destinations_;
 };
 
 #endif
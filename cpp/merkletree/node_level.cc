@@ -0,0 +1,83 @@
+#include "merkletree/node_level.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <glog/logging.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using std::string;
+using util::Status;
+
+namespace cert_trans {
+
+const size_t NodeLevel::kNodesPerChunk;
+
+
+NodeLevel::NodeLevel(size_t node_size)
+    : node_size_(node_size), node_count_(0), mapped_count_(0) {
+  CHECK_GT(node_size_, 0U);
+}
+
+
+void NodeLevel::PushBack(const char* node) {
+  const size_t index(node_count_ - mapped_count_);
+  if (index == chunks_.size() * kNodesPerChunk) {
+    chunks_.emplace_back(new char[kNodesPerChunk * node_size_]);
+  }
+  memcpy(chunks_[index / kNodesPerChunk].get() +
+             (index % kNodesPerChunk) * node_size_,
+         node, node_size_);
+  ++node_count_;
+}
+
+
+void NodeLevel::PopBack() {
+  CHECK_GT(node_count_, mapped_count_);
+  --node_count_;
+}
+
+
+Status NodeLevel::MapFile(const string& path, size_t count) {
+  CHECK_EQ(node_count_, 0U);
+  if (count == 0) {
+    return Status::OK;
+  }
+
+  const int fd(open(path.c_str(), O_RDONLY));
+  if (fd < 0) {
+    return Status(util::error::NOT_FOUND,
+                  "cannot open " + path + ": " + strerror(errno));
+  }
+
+  const size_t length(count * node_size_);
+  struct stat st;
+  if (fstat(fd, &st) < 0 || static_cast<size_t>(st.st_size) < length) {
+    close(fd);
+    return Status(util::error::DATA_LOSS, "file too short: " + path);
+  }
+
+  void* const addr(mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0));
+  // The mapping holds its own reference to the file.
+  close(fd);
+  if (addr == MAP_FAILED) {
+    return Status(util::error::INTERNAL,
+                  "cannot mmap " + path + ": " + strerror(errno));
+  }
+
+  mapped_.reset(static_cast<char*>(addr));
+  mapped_.get_deleter().length = length;
+  mapped_count_ = count;
+  node_count_ = count;
+  return Status::OK;
+}
+
+
+void NodeLevel::Unmapper::operator()(char* addr) const {
+  PCHECK(munmap(addr, length) == 0);
+}
+
+
+}  // namespace cert_trans
@@ -0,0 +1,111 @@
+#ifndef CERT_TRANS_MERKLETREE_NODE_LEVEL_H_
+#define CERT_TRANS_MERKLETREE_NODE_LEVEL_H_
+
+#include <algorithm>
+#include <memory>
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+#include "base/macros.h"
+#include "util/status.h"
+
+namespace cert_trans {
+
+// Append-only storage for the nodes of one level of a Merkle tree.
+//
+// All nodes have the same size, and are stored back-to-back in
+// fixed-size chunks. Growing the level never moves existing nodes, so
+// (unlike one big string per level) appending does not copy the
+// level, and pointers returned by Node() remain valid until that node
+// is popped.
+//
+// A prefix of the level can also be served straight out of a
+// read-only memory-mapped file (see MapFile()), so that a persisted
+// tree can be reopened without copying, or recomputing, its nodes.
+//
+// This class is thread-compatible, but not thread-safe.
+class NodeLevel {
+ public:
+  explicit NodeLevel(size_t node_size);
+  NodeLevel(NodeLevel&& other) = default;
+
+  size_t NodeSize() const {
+    return node_size_;
+  }
+
+  size_t NodeCount() const {
+    return node_count_;
+  }
+
+  // Returns a pointer to the NodeSize() bytes of the |index|-th node
+  // in the level. Indexing starts at 0; the caller is responsible for
+  // ensuring that |index| < NodeCount().
+  const char* Node(size_t index) const {
+    if (index < mapped_count_) {
+      return mapped_.get() + index * node_size_;
+    }
+    index -= mapped_count_;
+    return chunks_[index / kNodesPerChunk].get() +
+           (index % kNodesPerChunk) * node_size_;
+  }
+
+  // Returns how many nodes, starting with the |index|-th one, are
+  // stored back-to-back (so that they can be read as one run from
+  // Node(index)). Requires |index| < NodeCount().
+  size_t ContiguousCount(size_t index) const {
+    const size_t end(index < mapped_count_
+                         ? mapped_count_
+                         : index + kNodesPerChunk -
+                               (index - mapped_count_) % kNodesPerChunk);
+    return std::min(end, node_count_) - index;
+  }
+
+  // The memory allocated for the nodes, in bytes. Those mapped from
+  // a file are not counted, they are in the page cache.
+  size_t MemoryUsage() const {
+    return chunks_.size() * kNodesPerChunk * node_size_;
+  }
+
+  // Number of leading nodes served from a mapped file. These cannot
+  // be popped.
+  size_t MappedCount() const {
+    return mapped_count_;
+  }
+
+  // Appends a node of NodeSize() bytes, copied from |node|.
+  void PushBack(const char* node);
+
+  // Removes the last node. The underlying memory is kept around, as
+  // the tree usually pushes a replacement right away.
+  void PopBack();
+
+  // Maps the first |count| nodes stored back-to-back in the file at
+  // |path| read-only into memory, and makes them the first |count|
+  // nodes of this level. The level must be empty. The file must not
+  // be truncated below that size while the level is alive.
+  util::Status MapFile(const std::string& path, size_t count);
+
+ private:
+  struct Unmapper {
+    Unmapper() : length(0) {
+    }
+    void operator()(char* addr) const;
+    size_t length;
+  };
+
+  // Nodes per chunk; a power of two, so that Node() is cheap.
+  static const size_t kNodesPerChunk = 1024;
+
+  const size_t node_size_;
+  size_t node_count_;
+  std::unique_ptr<char, Unmapper> mapped_;
+  size_t mapped_count_;
+  std::vector<std::unique_ptr<char[]>> chunks_;
+
+  DISALLOW_COPY_AND_ASSIGN(NodeLevel);
+};
+
+}  // namespace cert_trans
+
+#endif  // CERT_TRANS_MERKLETREE_NODE_LEVEL_H_
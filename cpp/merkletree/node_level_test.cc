@@ -0,0 +1,99 @@
+#include <gtest/gtest.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+#include "merkletree/node_level.h"
+#include "util/testing.h"
+
+namespace {
+
+using cert_trans::NodeLevel;
+using std::string;
+using std::vector;
+
+const size_t kNodeSize = 32;
+
+string TestNode(size_t i) {
+  string node(kNodeSize, 'a');
+  node[0] = static_cast<char>(i);
+  node[1] = static_cast<char>(i >> 8);
+  node[2] = static_cast<char>(i >> 16);
+  return node;
+}
+
+
+TEST(NodeLevelTest, Empty) {
+  NodeLevel level(kNodeSize);
+  EXPECT_EQ(kNodeSize, level.NodeSize());
+  EXPECT_EQ(0U, level.NodeCount());
+}
+
+
+TEST(NodeLevelTest, PushBackAcrossChunks) {
+  NodeLevel level(kNodeSize);
+  // Enough nodes to span several chunks.
+  const size_t kNumNodes(5000);
+  for (size_t i = 0; i < kNumNodes; ++i) {
+    level.PushBack(TestNode(i).data());
+  }
+  ASSERT_EQ(kNumNodes, level.NodeCount());
+  for (size_t i = 0; i < kNumNodes; ++i) {
+    EXPECT_EQ(TestNode(i), string(level.Node(i), kNodeSize));
+  }
+}
+
+
+TEST(NodeLevelTest, NodesDoNotMove) {
+  NodeLevel level(kNodeSize);
+  level.PushBack(TestNode(0).data());
+  const char* const first(level.Node(0));
+  for (size_t i = 1; i < 5000; ++i) {
+    level.PushBack(TestNode(i).data());
+  }
+  EXPECT_EQ(first, level.Node(0));
+  EXPECT_EQ(TestNode(0), string(first, kNodeSize));
+}
+
+
+TEST(NodeLevelTest, PopBack) {
+  NodeLevel level(kNodeSize);
+  for (size_t i = 0; i < 1025; ++i) {
+    level.PushBack(TestNode(i).data());
+  }
+  level.PopBack();
+  level.PopBack();
+  ASSERT_EQ(1023U, level.NodeCount());
+  EXPECT_EQ(TestNode(1022), string(level.Node(1022), kNodeSize));
+
+  level.PushBack(TestNode(42).data());
+  level.PushBack(TestNode(43).data());
+  ASSERT_EQ(1025U, level.NodeCount());
+  EXPECT_EQ(TestNode(42), string(level.Node(1023), kNodeSize));
+  EXPECT_EQ(TestNode(43), string(level.Node(1024), kNodeSize));
+}
+
+
+
+TEST(NodeLevelTest, MemoryUsage) {
+  NodeLevel level(kNodeSize);
+  EXPECT_EQ(0U, level.MemoryUsage());
+  level.PushBack(TestNode(0).data());
+  const size_t chunk_bytes(level.MemoryUsage());
+  EXPECT_LE(kNodeSize, chunk_bytes);
+  // Nodes are allocated a chunk at a time.
+  level.PushBack(TestNode(1).data());
+  EXPECT_EQ(chunk_bytes, level.MemoryUsage());
+  for (size_t i = 2; i <= chunk_bytes / kNodeSize; ++i) {
+    level.PushBack(TestNode(i).data());
+  }
+  EXPECT_EQ(2 * chunk_bytes, level.MemoryUsage());
+}
+
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  cert_trans::test::InitTesting(argv[0], &argc, &argv, true);
+  return RUN_ALL_TESTS();
+}
@@ -7,6 +7,12 @@ using std::string;
 
 const size_t Sha256Hasher::kDigestSize = SHA256_DIGEST_LENGTH;
 
+string SerialHasher::Final() {
+  string digest(DigestSize(), '\0');
+  Final(&digest[0]);
+  return digest;
+}
+
 Sha256Hasher::Sha256Hasher() : initialized_(false) {
 }
 
@@ -15,21 +21,19 @@ void Sha256Hasher::Reset() {
   initialized_ = true;
 }
 
-void Sha256Hasher::Update(const std::string& data) {
+void Sha256Hasher::Update(const char* data, size_t length) {
   if (!initialized_)
     Reset();
 
-  SHA256_Update(&ctx_, data.data(), data.size());
+  SHA256_Update(&ctx_, data, length);
 }
 
-string Sha256Hasher::Final() {
+void Sha256Hasher::Final(char* digest) {
   if (!initialized_)
     Reset();
 
-  unsigned char hash[SHA256_DIGEST_LENGTH];
-  SHA256_Final(hash, &ctx_);
+  SHA256_Final(reinterpret_cast<unsigned char*>(digest), &ctx_);
   initialized_ = false;
-  return string(reinterpret_cast<char*>(hash), SHA256_DIGEST_LENGTH);
 }
 
 SerialHasher* Sha256Hasher::Create() const {
@@ -43,3 +47,12 @@ string Sha256Hasher::Sha256Digest(const string& data) {
   hasher.Update(data);
   return hasher.Final();
 }
+
+// static
+void Sha256Hasher::Sha256Digest(const char* data, size_t length,
+                                char* digest) {
+  Sha256Hasher hasher;
+  hasher.Reset();
+  hasher.Update(data, length);
+  hasher.Final(digest);
+}
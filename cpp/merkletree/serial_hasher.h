@@ -21,10 +21,19 @@ class SerialHasher {
   virtual void Reset() = 0;
 
   // Update the hash context with (binary) data.
-  virtual void Update(const std::string& data) = 0;
+  void Update(const std::string& data) {
+    Update(data.data(), data.size());
+  }
+
+  // Update the hash context with the |length| bytes at |data|.
+  virtual void Update(const char* data, size_t length) = 0;
 
   // Finalize the hash context and return the binary digest blob.
-  virtual std::string Final() = 0;
+  std::string Final();
+
+  // Finalize the hash context, and write the DigestSize() bytes of
+  // the digest to |digest|.
+  virtual void Final(char* digest) = 0;
 
   // A virtual constructor.  The caller gets ownership of the returned object.
   virtual SerialHasher* Create() const = 0;
@@ -33,27 +42,37 @@ class SerialHasher {
   DISALLOW_COPY_AND_ASSIGN(SerialHasher);
 };
 
-class Sha256Hasher : public SerialHasher {
+// This class is final, so that calls made through a Sha256Hasher
+// (rather than a SerialHasher) need not be virtual.
+class Sha256Hasher final : public SerialHasher {
  public:
+  static const size_t kDigestSize;
+
   Sha256Hasher();
 
   size_t DigestSize() const {
     return kDigestSize;
   }
 
+  using SerialHasher::Update;
+  using SerialHasher::Final;
+
   void Reset();
-  void Update(const std::string& data);
-  std::string Final();
+  void Update(const char* data, size_t length) override;
+  void Final(char* digest) override;
   SerialHasher* Create() const;
 
   // Create a new hasher and call Reset(), Update(), and Final().
   static std::string Sha256Digest(const std::string& data);
 
+  // Same as above, but writes the digest to |digest|, which must have
+  // room for kDigestSize bytes.
+  static void Sha256Digest(const char* data, size_t length, char* digest);
+
 
  private:
   SHA256_CTX ctx_;
   bool initialized_;
-  static const size_t kDigestSize;
 
   DISALLOW_COPY_AND_ASSIGN(Sha256Hasher);
 };
@@ -93,6 +93,23 @@ TYPED_TEST(SerialHasherTest, Update) {
   EXPECT_EQ(H(digest), H(output));
 }
 
+// The pointer-based calls must agree with the string-based ones.
+TYPED_TEST(SerialHasherTest, UpdateAndFinalWithBuffers) {
+  string input(kTestString, kTestStringLength);
+
+  this->hasher_->Reset();
+  this->hasher_->Update(input);
+  const string digest(this->hasher_->Final());
+
+  this->hasher_->Reset();
+  this->hasher_->Update(input.data(), kTestStringLength / 2);
+  this->hasher_->Update(input.data() + kTestStringLength / 2,
+                        kTestStringLength - kTestStringLength / 2);
+  string output(this->hasher_->DigestSize(), '\0');
+  this->hasher_->Final(&output[0]);
+  EXPECT_EQ(H(digest), H(output));
+}
+
 TYPED_TEST(SerialHasherTest, Create) {
   string input, output, digest;
 
@@ -117,6 +134,15 @@ TEST(Sha256Test, StaticDigest) {
   }
 }
 
+TEST(Sha256Test, StaticDigestWithBuffers) {
+  for (size_t i = 0; test_sha256[i].input != NULL; ++i) {
+    const string input(S(test_sha256[i].input, test_sha256[i].input_length));
+    string digest(Sha256Hasher::kDigestSize, '\0');
+    Sha256Hasher::Sha256Digest(input.data(), input.size(), &digest[0]);
+    EXPECT_STREQ(H(digest).c_str(), test_sha256[i].output);
+  }
+}
+
 #undef S
 #undef H
 
@@ -0,0 +1,248 @@
+#include "merkletree/sha256_nodes.h"
+
+#include <openssl/sha.h>
+#include <stdint.h>
+#include <string.h>
+
+// The multi-buffer kernels need vector extensions and runtime CPU
+// detection as found in GCC 5 and clang.
+#if defined(__x86_64__) && (defined(__clang__) || __GNUC__ >= 5)
+#define CT_SHA256_NODES_MULTI_BUFFER
+#endif
+
+namespace cert_trans {
+namespace {
+
+
+const unsigned char kNodePrefix(0x01);
+// The message for a node is the prefix and both children, so it
+// takes two 64-byte SHA-256 blocks once padded.
+const size_t kMessageSize = 1 + 2 * kSha256NodeSize;
+const size_t kPaddedMessageSize = 128;
+
+
+void HashNodesOpenSSL(const char* children, size_t count, char* parents) {
+  SHA256_CTX ctx;
+  for (size_t i = 0; i < count; ++i) {
+    SHA256_Init(&ctx);
+    SHA256_Update(&ctx, &kNodePrefix, 1);
+    SHA256_Update(&ctx, children + i * 2 * kSha256NodeSize,
+                  2 * kSha256NodeSize);
+    SHA256_Final(reinterpret_cast<unsigned char*>(parents) +
+                     i * kSha256NodeSize,
+                 &ctx);
+  }
+}
+
+
+#ifdef CT_SHA256_NODES_MULTI_BUFFER
+
+const uint32_t kRoundConstants[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+    0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+    0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+    0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+    0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+    0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+
+const uint32_t kInitialState[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372,
+                                   0xa54ff53a, 0x510e527f, 0x9b05688c,
+                                   0x1f83d9ab, 0x5be0cd19};
+
+// The multi-buffer kernel is written once with GCC vector extensions,
+// one node per 32-bit lane, and inlined into a wrapper per instruction
+// set so that it gets compiled for each of them.
+typedef uint32_t Lanes8 __attribute__((vector_size(32)));
+typedef uint32_t Lanes16 __attribute__((vector_size(64)));
+
+#define CT_ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+
+inline uint32_t LoadBigEndian32(const unsigned char* in) {
+  return (static_cast<uint32_t>(in[0]) << 24) |
+         (static_cast<uint32_t>(in[1]) << 16) |
+         (static_cast<uint32_t>(in[2]) << 8) | static_cast<uint32_t>(in[3]);
+}
+
+
+inline void StoreBigEndian32(uint32_t value, char* out) {
+  out[0] = static_cast<char>(value >> 24);
+  out[1] = static_cast<char>(value >> 16);
+  out[2] = static_cast<char>(value >> 8);
+  out[3] = static_cast<char>(value);
+}
+
+
+// Runs the SHA-256 compression function on one 64-byte block per
+// lane, given as the 16 message words of each lane.
+template <typename V>
+__attribute__((always_inline)) inline void Compress(V* state, const V* block) {
+  V w[16];
+  for (int t = 0; t < 16; ++t) {
+    w[t] = block[t];
+  }
+
+  V a(state[0]), b(state[1]), c(state[2]), d(state[3]);
+  V e(state[4]), f(state[5]), g(state[6]), h(state[7]);
+  for (int t = 0; t < 64; ++t) {
+    if (t >= 16) {
+      const V w15(w[(t - 15) & 15]);
+      const V w2(w[(t - 2) & 15]);
+      w[t & 15] += (CT_ROTR(w15, 7) ^ CT_ROTR(w15, 18) ^ (w15 >> 3)) +
+                   w[(t - 7) & 15] +
+                   (CT_ROTR(w2, 17) ^ CT_ROTR(w2, 19) ^ (w2 >> 10));
+    }
+    const V t1(h + (CT_ROTR(e, 6) ^ CT_ROTR(e, 11) ^ CT_ROTR(e, 25)) +
+               ((e & f) ^ (~e & g)) + kRoundConstants[t] + w[t & 15]);
+    const V t2((CT_ROTR(a, 2) ^ CT_ROTR(a, 13) ^ CT_ROTR(a, 22)) +
+               ((a & b) ^ (a & c) ^ (b & c)));
+    h = g;
+    g = f;
+    f = e;
+    e = d + t1;
+    d = c;
+    c = b;
+    b = a;
+    a = t1 + t2;
+  }
+
+  state[0] += a;
+  state[1] += b;
+  state[2] += c;
+  state[3] += d;
+  state[4] += e;
+  state[5] += f;
+  state[6] += g;
+  state[7] += h;
+}
+
+
+// Hashes as many nodes as |V| has lanes.
+template <typename V>
+__attribute__((always_inline)) inline void HashNodeLanes(const char* children,
+                                                         char* parents) {
+  const size_t kLanes(sizeof(V) / sizeof(uint32_t));
+  // The message words of both blocks, for all the lanes. Only the
+  // first block and the first word of the second one depend on the
+  // children, the rest is padding.
+  V words[32];
+  for (size_t lane = 0; lane < kLanes; ++lane) {
+    unsigned char message[kPaddedMessageSize];
+    message[0] = kNodePrefix;
+    memcpy(message + 1, children + lane * 2 * kSha256NodeSize,
+           2 * kSha256NodeSize);
+    message[kMessageSize] = 0x80;
+    memset(message + kMessageSize + 1, 0,
+           kPaddedMessageSize - kMessageSize - 1);
+    // The message length in bits, big-endian.
+    message[kPaddedMessageSize - 2] = (kMessageSize * 8) >> 8;
+    message[kPaddedMessageSize - 1] = (kMessageSize * 8) & 0xff;
+    for (int t = 0; t < 32; ++t) {
+      words[t][lane] = LoadBigEndian32(message + 4 * t);
+    }
+  }
+
+  V state[8];
+  for (int i = 0; i < 8; ++i) {
+    state[i] = V{} + kInitialState[i];
+  }
+  Compress(state, words);
+  Compress(state, words + 16);
+
+  for (size_t lane = 0; lane < kLanes; ++lane) {
+    for (int i = 0; i < 8; ++i) {
+      StoreBigEndian32(state[i][lane],
+                       parents + lane * kSha256NodeSize + 4 * i);
+    }
+  }
+}
+
+
+template <typename V>
+__attribute__((always_inline)) inline void HashNodesVector(
+    const char* children, size_t count, char* parents) {
+  const size_t kLanes(sizeof(V) / sizeof(uint32_t));
+  while (count >= kLanes) {
+    HashNodeLanes<V>(children, parents);
+    children += kLanes * 2 * kSha256NodeSize;
+    parents += kLanes * kSha256NodeSize;
+    count -= kLanes;
+  }
+  // Not enough left to fill the lanes.
+  HashNodesOpenSSL(children, count, parents);
+}
+
+
+__attribute__((target("avx2"))) void HashNodesAvx2(const char* children,
+                                                   size_t count,
+                                                   char* parents) {
+  HashNodesVector<Lanes8>(children, count, parents);
+}
+
+
+__attribute__((target("avx512f"))) void HashNodesAvx512(const char* children,
+                                                        size_t count,
+                                                        char* parents) {
+  HashNodesVector<Lanes16>(children, count, parents);
+}
+
+#undef CT_ROTR
+
+#endif  // CT_SHA256_NODES_MULTI_BUFFER
+
+
+typedef void (*HashNodesFunction)(const char*, size_t, char*);
+
+
+struct Implementation {
+  HashNodesFunction function;
+  const char* name;
+};
+
+
+// The AVX2 kernel is only about as fast as OpenSSL on CPUs with the
+// SHA extensions, but several times faster on those without.
+Implementation PickImplementation() {
+#ifdef CT_SHA256_NODES_MULTI_BUFFER
+  if (__builtin_cpu_supports("avx512f")) {
+    return Implementation{HashNodesAvx512, "avx512"};
+  }
+  if (__builtin_cpu_supports("avx2")) {
+    return Implementation{HashNodesAvx2, "avx2"};
+  }
+#endif
+  return Implementation{HashNodesOpenSSL, "openssl"};
+}
+
+
+const Implementation& GetImplementation() {
+  static const Implementation implementation(PickImplementation());
+  return implementation;
+}
+
+
+}  // namespace
+
+
+void Sha256HashNodes(const char* children, size_t count, char* parents) {
+  GetImplementation().function(children, count, parents);
+}
+
+
+void Sha256HashNodesOpenSSL(const char* children, size_t count,
+                            char* parents) {
+  HashNodesOpenSSL(children, count, parents);
+}
+
+
+const char* Sha256HashNodesImplementation() {
+  return GetImplementation().name;
+}
+
+
+}  // namespace cert_trans
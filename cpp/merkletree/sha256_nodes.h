@@ -0,0 +1,33 @@
+#ifndef CERT_TRANS_MERKLETREE_SHA256_NODES_H_
+#define CERT_TRANS_MERKLETREE_SHA256_NODES_H_
+
+#include <stddef.h>
+
+namespace cert_trans {
+
+
+// Size of a SHA-256 digest, and thus of a node in a SHA-256 tree.
+const size_t kSha256NodeSize = 32;
+
+// Computes the interior node hashes SHA-256(0x01 || left || right)
+// of |count| pairs of children. |children| holds the pairs
+// back-to-back (left child first, so 2 * kSha256NodeSize bytes per
+// pair), and the parents are written back-to-back to |parents|.
+//
+// Uses a multi-buffer kernel, hashing several nodes at once, when the
+// CPU supports one, and OpenSSL otherwise.
+void Sha256HashNodes(const char* children, size_t count, char* parents);
+
+// Same as Sha256HashNodes(), but always uses OpenSSL. Exposed for
+// testing and benchmarking.
+void Sha256HashNodesOpenSSL(const char* children, size_t count,
+                            char* parents);
+
+// The name of the implementation Sha256HashNodes() picked for this
+// CPU (e.g. "avx2" or "openssl").
+const char* Sha256HashNodesImplementation();
+
+
+}  // namespace cert_trans
+
+#endif  // CERT_TRANS_MERKLETREE_SHA256_NODES_H_
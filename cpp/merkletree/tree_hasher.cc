@@ -1,8 +1,10 @@
 #include "merkletree/tree_hasher.h"
 
 #include <glog/logging.h>
+#include <openssl/evp.h>
 
 #include "merkletree/serial_hasher.h"
+#include "merkletree/sha256_nodes.h"
 
 using std::lock_guard;
 using std::mutex;
@@ -21,23 +23,92 @@ std::string EmptyHash(SerialHasher* hasher) {
 }  // namespace
 
 TreeHasher::TreeHasher(SerialHasher* hasher)
-    : hasher_(CHECK_NOTNULL(hasher)), empty_hash_(EmptyHash(hasher_.get())) {
+    : hasher_(CHECK_NOTNULL(hasher)),
+      is_sha256_(dynamic_cast<Sha256Hasher*>(hasher) != nullptr),
+      empty_hash_(EmptyHash(hasher_.get())) {
+}
+
+TreeHasher* TreeHasher::Clone() const {
+  return new TreeHasher(hasher_->Create());
 }
 
 string TreeHasher::HashLeaf(const string& data) const {
-  lock_guard<mutex> lock(lock_);
-  hasher_->Reset();
-  hasher_->Update(string(1, kLeafPrefix));
-  hasher_->Update(data);
-  return hasher_->Final();
+  string digest(DigestSize(), '\0');
+  HashLeaf(data.data(), data.size(), &digest[0]);
+  return digest;
+}
+
+void TreeHasher::HashLeaf(const char* data, size_t length,
+                          char* digest) const {
+  Hash(kLeafPrefix, data, length, NULL, 0, digest);
 }
 
 string TreeHasher::HashChildren(const string& left_child,
                                 const string& right_child) const {
+  string parent;
+  HashChildren(left_child, right_child, &parent);
+  return parent;
+}
+
+void TreeHasher::HashChildren(const string& left_child,
+                              const string& right_child,
+                              string* parent) const {
+  const size_t digest_size(DigestSize());
+  if (parent == &left_child || parent == &right_child) {
+    // Hash into a temporary, so as not to resize a child while it is
+    // being read.
+    char digest[EVP_MAX_MD_SIZE];
+    CHECK_LE(digest_size, sizeof(digest));
+    Hash(kNodePrefix, left_child.data(), left_child.size(),
+         right_child.data(), right_child.size(), digest);
+    parent->assign(digest, digest_size);
+    return;
+  }
+  parent->resize(digest_size);
+  Hash(kNodePrefix, left_child.data(), left_child.size(), right_child.data(),
+       right_child.size(), &(*parent)[0]);
+}
+
+void TreeHasher::HashChildren(const char* left_child, const char* right_child,
+                              char* parent) const {
+  const size_t digest_size(DigestSize());
+  Hash(kNodePrefix, left_child, digest_size, right_child, digest_size,
+       parent);
+}
+
+void TreeHasher::HashChildrenBatch(const char* children, size_t count,
+                                   char* parents) const {
+  if (is_sha256_) {
+    cert_trans::Sha256HashNodes(children, count, parents);
+    return;
+  }
+
+  const size_t digest_size(DigestSize());
+  for (size_t i = 0; i < count; ++i) {
+    HashChildren(children + 2 * i * digest_size,
+                 children + (2 * i + 1) * digest_size,
+                 parents + i * digest_size);
+  }
+}
+
+void TreeHasher::Hash(char prefix, const char* data1, size_t length1,
+                      const char* data2, size_t length2, char* digest) const {
+  // The digest is only written out once all the input has been read,
+  // so it may overlap it.
+  if (is_sha256_) {
+    Sha256Hasher hasher;
+    hasher.Reset();
+    hasher.Update(&prefix, 1);
+    hasher.Update(data1, length1);
+    hasher.Update(data2, length2);
+    hasher.Final(digest);
+    return;
+  }
+
   lock_guard<mutex> lock(lock_);
   hasher_->Reset();
-  hasher_->Update(string(1, kNodePrefix));
-  hasher_->Update(left_child);
-  hasher_->Update(right_child);
-  return hasher_->Final();
+  hasher_->Update(&prefix, 1);
+  hasher_->Update(data1, length1);
+  hasher_->Update(data2, length2);
+  hasher_->Final(digest);
 }
@@ -14,6 +14,10 @@ class TreeHasher {
   // Takes ownership of the SerialHasher.
   TreeHasher(SerialHasher* hasher);
 
+  // Returns a new TreeHasher using a fresh instance of the same hash
+  // function. The caller gets ownership of the returned object.
+  TreeHasher* Clone() const;
+
   size_t DigestSize() const {
     return hasher_->DigestSize();
   }
@@ -24,15 +28,50 @@ class TreeHasher {
 
   std::string HashLeaf(const std::string& data) const;
 
+  // Same as above, but hashes the |length| bytes at |data|, and
+  // writes the DigestSize() bytes of the digest to |digest|.
+  void HashLeaf(const char* data, size_t length, char* digest) const;
+
   // Accepts arbitrary strings as children. When hashing digests, it
   // is the responsibility of the caller to ensure the inputs are of
   // correct size.
   std::string HashChildren(const std::string& left_child,
                            const std::string& right_child) const;
 
+  // Same as above, but stores the digest in |parent|, reusing its
+  // buffer. |parent| may point to one of the children.
+  void HashChildren(const std::string& left_child,
+                    const std::string& right_child,
+                    std::string* parent) const;
+
+  // Same as above, for children of DigestSize() bytes each. The
+  // DigestSize() bytes of the digest are written to |parent|, which
+  // may overlap the children.
+  void HashChildren(const char* left_child, const char* right_child,
+                    char* parent) const;
+
+  // Computes the parents of |count| pairs of children at once, as
+  // HashChildren() would. |children| holds the pairs back-to-back,
+  // left child first, each child being DigestSize() bytes; the
+  // parents are written back-to-back to |parents|.
+  //
+  // For SHA-256 this uses a multi-buffer kernel, hashing several
+  // nodes at once, when the CPU supports one.
+  void HashChildrenBatch(const char* children, size_t count,
+                         char* parents) const;
+
  private:
+  // Digests |prefix| followed by the |length1| bytes at |data1| and
+  // the |length2| bytes at |data2| into |digest|.
+  void Hash(char prefix, const char* data1, size_t length1,
+            const char* data2, size_t length2, char* digest) const;
+
   mutable std::mutex lock_;
   const std::unique_ptr<SerialHasher> hasher_;
+  // Whether |hasher_| is a Sha256Hasher. If so, the SHA-256 code is
+  // called directly, on a hasher on the stack, so that there is no
+  // need for virtual calls or for |lock_|.
+  const bool is_sha256_;
   // The pre-computed hash of an empty tree.
   const std::string empty_hash_;
 
@@ -1,4 +1,5 @@
 #include <gtest/gtest.h>
+#include <memory>
 #include <stddef.h>
 #include <string>
 
@@ -56,6 +57,34 @@ TestVector test_sha256 = {sha256_empty_hash, sha256_leaves, sha256_nodes};
 // The reverse
 #define H(t) util::HexString(t)
 
+// SHA-256 again, but hidden from TreeHasher, so that it does not
+// take the SHA-256 specific paths.
+class OpaqueSha256Hasher : public SerialHasher {
+ public:
+  size_t DigestSize() const {
+    return hasher_.DigestSize();
+  }
+
+  void Reset() {
+    hasher_.Reset();
+  }
+
+  void Update(const char* data, size_t length) {
+    hasher_.Update(data, length);
+  }
+
+  void Final(char* digest) {
+    hasher_.Final(digest);
+  }
+
+  SerialHasher* Create() const {
+    return new OpaqueSha256Hasher;
+  }
+
+ private:
+  Sha256Hasher hasher_;
+};
+
 template <class T>
 TestVector* TestVectors();
 
@@ -64,6 +93,11 @@ TestVector* TestVectors<Sha256Hasher>() {
   return &test_sha256;
 }
 
+template <>
+TestVector* TestVectors<OpaqueSha256Hasher>() {
+  return &test_sha256;
+}
+
 template <class T>
 class TreeHasherTest : public ::testing::Test {
  protected:
@@ -73,7 +107,7 @@ class TreeHasherTest : public ::testing::Test {
   }
 };
 
-typedef ::testing::Types<Sha256Hasher> Hashers;
+typedef ::testing::Types<Sha256Hasher, OpaqueSha256Hasher> Hashers;
 
 TYPED_TEST_CASE(TreeHasherTest, Hashers);
 
@@ -147,6 +181,37 @@ TYPED_TEST(TreeHasherTest, TestVectors) {
   }
 }
 
+// Batches of all sizes must hash the same as HashChildren() does
+// pair by pair, whether or not they fill up the multi-buffer lanes.
+TYPED_TEST(TreeHasherTest, HashChildrenBatch) {
+  const size_t digestsize = this->tree_hasher_.DigestSize();
+  for (size_t count = 0; count <= 40; ++count) {
+    string children;
+    for (size_t i = 0; i < 2 * count; ++i) {
+      children += this->tree_hasher_.HashLeaf(string(i + count, 'x'));
+    }
+
+    string parents(count * digestsize, '\0');
+    this->tree_hasher_.HashChildrenBatch(children.data(), count,
+                                         &parents[0]);
+    for (size_t i = 0; i < count; ++i) {
+      EXPECT_EQ(H(this->tree_hasher_.HashChildren(
+                    children.substr(2 * i * digestsize, digestsize),
+                    children.substr((2 * i + 1) * digestsize, digestsize))),
+                H(parents.substr(i * digestsize, digestsize)))
+          << "batch of " << count << ", pair " << i;
+    }
+  }
+}
+
+TYPED_TEST(TreeHasherTest, Clone) {
+  const std::unique_ptr<TreeHasher> clone(this->tree_hasher_.Clone());
+  EXPECT_EQ(this->tree_hasher_.DigestSize(), clone->DigestSize());
+  EXPECT_EQ(H(this->tree_hasher_.HashEmpty()), H(clone->HashEmpty()));
+  EXPECT_EQ(H(this->tree_hasher_.HashLeaf("leaf")),
+            H(clone->HashLeaf("leaf")));
+}
+
 #undef S
 #undef H
 
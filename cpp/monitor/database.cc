@@ -7,20 +7,67 @@ namespace monitor {
 
 Database::WriteResult Database::CreateEntry(
     const cert_trans::LoggedCertificate& logged) {
-  std::string leaf;
-  if (!logged.SerializeForLeaf(&leaf))
-    return this->SERIALIZE_FAILED;
+  std::string leaf_hash;
+  return CreateEntry(logged, &leaf_hash);
+}
+
+Database::WriteResult Database::CreateEntry(
+    const cert_trans::LoggedCertificate& logged, std::string* leaf_hash) {
+  EntryRow row;
+  const WriteResult result(MakeEntryRow(logged, &row));
+  if (result != WRITE_OK)
+    return result;
+
+  *leaf_hash = row.leaf_hash;
+  return CreateEntry_(row.leaf, row.leaf_hash, row.cert, row.cert_chain);
+}
+
+Database::WriteResult Database::CreateEntries(
+    const std::vector<cert_trans::LoggedCertificate>& entries,
+    std::vector<std::string>* leaf_hashes) {
+  std::vector<EntryRow> rows(entries.size());
+  for (size_t i = 0; i < entries.size(); ++i) {
+    const WriteResult result(MakeEntryRow(entries[i], &rows[i]));
+    if (result != WRITE_OK)
+      return result;
+  }
+
+  const WriteResult result(CreateEntries_(rows));
+  if (result != WRITE_OK)
+    return result;
+
+  for (const auto& row : rows) {
+    leaf_hashes->push_back(row.leaf_hash);
+  }
+  return WRITE_OK;
+}
+
+// static
+Database::WriteResult Database::MakeEntryRow(
+    const cert_trans::LoggedCertificate& logged, EntryRow* row) {
+  if (!logged.SerializeForLeaf(&row->leaf))
+    return SERIALIZE_FAILED;
 
   TreeHasher hasher(new Sha256Hasher);
-  std::string leaf_hash = hasher.HashLeaf(leaf);
+  row->leaf_hash = hasher.HashLeaf(row->leaf);
+
+  row->cert = Serializer::LeafCertificate(logged.entry());
 
-  std::string cert = Serializer::LeafCertificate(logged.entry());
+  if (!logged.SerializeExtraData(&row->cert_chain))
+    return SERIALIZE_FAILED;
 
-  std::string cert_chain;
-  if (!logged.SerializeExtraData(&cert_chain))
-    return this->SERIALIZE_FAILED;
+  return WRITE_OK;
+}
 
-  return CreateEntry_(leaf, leaf_hash, cert, cert_chain);
+Database::WriteResult Database::CreateEntries_(
+    const std::vector<EntryRow>& rows) {
+  for (const auto& row : rows) {
+    const WriteResult result(
+        CreateEntry_(row.leaf, row.leaf_hash, row.cert, row.cert_chain));
+    if (result != WRITE_OK)
+      return result;
+  }
+  return WRITE_OK;
 }
 
 Database::WriteResult Database::WriteSTH(const ct::SignedTreeHead& sth) {
@@ -39,4 +86,13 @@ Database::WriteResult Database::SetVerificationLevel(
   return SetVerificationLevel_(sth, verify_level);
 }
 
+Database::WriteResult Database::WriteTreeFrontier(
+    const ct::SignedTreeHead& sth, const std::vector<std::string>& frontier) {
+  CHECK(sth.has_timestamp());
+  if (frontier.empty())
+    return this->NOT_ALLOWED;
+
+  return WriteTreeFrontier_(sth.timestamp(), frontier);
+}
+
 }  // namespace monitor
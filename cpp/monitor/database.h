@@ -3,6 +3,8 @@
 
 #include <glog/logging.h>
 #include <stdint.h>
+#include <string>
+#include <vector>
 
 #include "base/macros.h"
 #include "log/logged_certificate.h"
@@ -73,6 +75,17 @@ class Database {
   // GetEntries().  The latter two contain all information from the
   // RFC compliant get-entries response from the log server.
   WriteResult CreateEntry(const cert_trans::LoggedCertificate& logged);
+  // Same, also setting |*leaf_hash| to the Merkle leaf hash of the
+  // entry.
+  WriteResult CreateEntry(const cert_trans::LoggedCertificate& logged,
+                          std::string* leaf_hash);
+  // Same for all of |entries|, in order, appending their leaf hashes
+  // to |*leaf_hashes|. The database writes them all at once if it
+  // can, which is much faster than one at a time; if it fails, it
+  // might have written some of them.
+  WriteResult CreateEntries(
+      const std::vector<cert_trans::LoggedCertificate>& entries,
+      std::vector<std::string>* leaf_hashes);
 
   virtual WriteResult WriteSTH(const ct::SignedTreeHead& sth);
 
@@ -92,18 +105,48 @@ class Database {
   virtual LookupResult LookupVerificationLevel(
       const ct::SignedTreeHead& sth, VerificationLevel* result) const = 0;
 
+  // Stores |frontier|, the CompactMerkleTree::Frontier() of the tree
+  // of the first sth.tree_size() entries, with the (written) |sth|,
+  // replacing any frontier it had.
+  virtual WriteResult WriteTreeFrontier(
+      const ct::SignedTreeHead& sth, const std::vector<std::string>& frontier);
+
+  // Lookup the largest TREE_CONFIRMED STH with a (non-empty) frontier,
+  // and that frontier.
+  virtual LookupResult LookupLatestTreeFrontier(
+      ct::SignedTreeHead* sth, std::vector<std::string>* frontier) const = 0;
+
+ protected:
+  // An entry, as it is written.
+  struct EntryRow {
+    std::string leaf;
+    std::string leaf_hash;
+    std::string cert;
+    std::string cert_chain;
+  };
+
  private:
+  // Serializes |logged| into |*row|.
+  static WriteResult MakeEntryRow(const cert_trans::LoggedCertificate& logged,
+                                  EntryRow* row);
+
   virtual WriteResult CreateEntry_(const std::string& leaf,
                                    const std::string& leaf_hash,
                                    const std::string& cert,
                                    const std::string& cert_chain) = 0;
 
+  // Writes the rows one at a time, unless overridden.
+  virtual WriteResult CreateEntries_(const std::vector<EntryRow>& rows);
+
   virtual WriteResult WriteSTH_(uint64_t timestamp, int64_t tree_size,
                                 const std::string& sth) = 0;
 
   virtual WriteResult SetVerificationLevel_(
       const ct::SignedTreeHead& sth, VerificationLevel verify_level) = 0;
 
+  virtual WriteResult WriteTreeFrontier_(
+      uint64_t timestamp, const std::vector<std::string>& frontier) = 0;
+
   DISALLOW_COPY_AND_ASSIGN(Database);
 };
 
@@ -2,6 +2,7 @@
 
 #include <gtest/gtest.h>
 #include <set>
+#include <vector>
 
 #include "log/test_signer.h"
 #include "monitor/test_db.h"
@@ -107,6 +108,38 @@ TYPED_TEST(DBTest, WriteEntryAndLookupHash) {
   EXPECT_EQ(leaf_hash, res);
 }
 
+TYPED_TEST(DBTest, WriteEntriesAndLookupHashes) {
+  std::vector<LoggedCertificate> entries(3);
+  for (auto& logged : entries) {
+    this->test_signer_.CreateUnique(&logged);
+  }
+
+  std::vector<string> leaf_hashes;
+  EXPECT_EQ(DB::WRITE_OK, this->db()->CreateEntries(entries, &leaf_hashes));
+  ASSERT_EQ(entries.size(), leaf_hashes.size());
+
+  TreeHasher hasher(new Sha256Hasher);
+  for (size_t i = 0; i < entries.size(); ++i) {
+    string leaf;
+    entries[i].SerializeForLeaf(&leaf);
+    EXPECT_EQ(hasher.HashLeaf(leaf), leaf_hashes[i]);
+
+    string res;
+    EXPECT_EQ(DB::LOOKUP_OK, this->db()->LookupHashByIndex(i + 1, &res));
+    EXPECT_EQ(leaf_hashes[i], res);
+  }
+
+  // Also within a transaction of the caller.
+  this->db()->BeginTransaction();
+  EXPECT_EQ(DB::WRITE_OK, this->db()->CreateEntries(entries, &leaf_hashes));
+  this->db()->EndTransaction();
+  ASSERT_EQ(2 * entries.size(), leaf_hashes.size());
+  string res;
+  EXPECT_EQ(DB::LOOKUP_OK,
+            this->db()->LookupHashByIndex(entries.size() + 1, &res));
+  EXPECT_EQ(leaf_hashes[0], res);
+}
+
 TYPED_TEST(DBTest, ModifyVerificationLevels) {
   SignedTreeHead sth;
   this->test_signer_.CreateUnique(&sth);
@@ -140,6 +173,43 @@ TYPED_TEST(DBTest, DenyUndefinedVerificationLevel) {
             this->db()->SetVerificationLevel(sth, DB::UNDEFINED));
 }
 
+TYPED_TEST(DBTest, WriteAndLookupTreeFrontiers) {
+  SignedTreeHead sth, sth2, lookup_sth;
+  this->test_signer_.CreateUnique(&sth);
+  this->test_signer_.CreateUnique(&sth2);
+  sth.set_tree_size(5);
+  sth2.set_tree_size(4);
+
+  EXPECT_EQ(DB::WRITE_OK, this->db()->WriteSTH(sth));
+  EXPECT_EQ(DB::WRITE_OK, this->db()->WriteSTH(sth2));
+
+  const std::vector<string> frontier{string(32, 'a'), "", string(32, 'b')};
+  const std::vector<string> frontier2{"", "", string(32, 'c')};
+  EXPECT_EQ(DB::WRITE_OK, this->db()->WriteTreeFrontier(sth, frontier));
+  EXPECT_EQ(DB::WRITE_OK, this->db()->WriteTreeFrontier(sth2, frontier2));
+  EXPECT_EQ(DB::NOT_ALLOWED,
+            this->db()->WriteTreeFrontier(sth2, std::vector<string>()));
+
+  // Only the frontiers of confirmed trees are looked up.
+  std::vector<string> lookup;
+  EXPECT_EQ(DB::NOT_FOUND,
+            this->db()->LookupLatestTreeFrontier(&lookup_sth, &lookup));
+
+  EXPECT_EQ(DB::WRITE_OK,
+            this->db()->SetVerificationLevel(sth2, DB::TREE_CONFIRMED));
+  EXPECT_EQ(DB::LOOKUP_OK,
+            this->db()->LookupLatestTreeFrontier(&lookup_sth, &lookup));
+  TestSigner::TestEqualTreeHeads(sth2, lookup_sth);
+  EXPECT_EQ(frontier2, lookup);
+
+  EXPECT_EQ(DB::WRITE_OK,
+            this->db()->SetVerificationLevel(sth, DB::TREE_CONFIRMED));
+  EXPECT_EQ(DB::LOOKUP_OK,
+            this->db()->LookupLatestTreeFrontier(&lookup_sth, &lookup));
+  TestSigner::TestEqualTreeHeads(sth, lookup_sth);
+  EXPECT_EQ(frontier, lookup);
+}
+
 }  // namespace
 
 int main(int argc, char** argv) {
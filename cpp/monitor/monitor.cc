@@ -1,22 +1,100 @@
 #include "monitor/monitor.h"
 
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
 #include "client/http_log_client.h"
 #include "log/log_verifier.h"
+#include "merkletree/compact_merkle_tree.h"
 #include "merkletree/merkle_tree.h"
+#include "merkletree/merkle_verifier.h"
 #include "monitor/database.h"
 
 using cert_trans::AsyncLogClient;
 using cert_trans::HTTPLogClient;
+using std::condition_variable;
+using std::deque;
+using std::lock_guard;
+using std::move;
+using std::mutex;
 using std::string;
+using std::unique_lock;
+using std::vector;
 
 namespace monitor {
 
+namespace {
+
+// How many downloaded batches of entries can wait to be stored.
+const size_t kMaxQueuedBatches = 4;
+
+// The batches of entries passed on by DownloadEntries().
+struct DownloadQueue {
+  DownloadQueue() : done(false), failed(false) {
+  }
+
+  mutex lock;
+  condition_variable changed;
+  deque<vector<AsyncLogClient::Entry>> batches;
+  // Set once the download is over, |failed| if it stopped early.
+  bool done;
+  bool failed;
+};
+
+void DownloadEntries(HTTPLogClient* client, int first, int last,
+                     DownloadQueue* queue) {
+  bool failed(false);
+  for (int next = first; next <= last;) {
+    // If the server does not impose a limit, all entries from next to
+    // last will be downloaded at once (could exceed memory).
+    vector<AsyncLogClient::Entry> entries;
+    const AsyncLogClient::Status error(
+        client->GetEntries(next, last, &entries));
+    if (error != AsyncLogClient::OK || entries.empty()) {
+      LOG(ERROR) << "HTTPLogClient returned with error " << error
+                 << " for the entries from " << next << " to " << last;
+      failed = true;
+      break;
+    }
+    next += entries.size();
+
+    unique_lock<mutex> lock(queue->lock);
+    queue->changed.wait(lock, [queue]() {
+      return queue->batches.size() < kMaxQueuedBatches;
+    });
+    queue->batches.emplace_back(move(entries));
+    queue->changed.notify_all();
+  }
+
+  lock_guard<mutex> lock(queue->lock);
+  queue->done = true;
+  queue->failed = failed;
+  queue->changed.notify_all();
+}
+
+}  // namespace
+
 Monitor::Monitor(Database* database, LogVerifier* log_verifier,
                  HTTPLogClient* client, uint64_t sleep_time_sec)
     : db_(CHECK_NOTNULL(database)),
       verifier_(CHECK_NOTNULL(log_verifier)),
       client_(CHECK_NOTNULL(client)),
-      sleep_time_(sleep_time_sec) {
+      sleep_time_(sleep_time_sec),
+      executor_(NULL),
+      num_tasks_(0),
+      tree_(new CompactMerkleTree(new Sha256Hasher)),
+      tree_restored_(false) {
+}
+
+Monitor::~Monitor() {
+}
+
+void Monitor::SetExecutor(util::Executor* executor, size_t num_tasks) {
+  executor_ = executor;
+  num_tasks_ = num_tasks;
 }
 
 Monitor::GetResult Monitor::GetSTH() {
@@ -151,34 +229,60 @@ Monitor::GetResult Monitor::GetEntries(int get_first, int get_last) {
   CHECK(get_first >= 0);
   CHECK(get_last >= get_first);
 
-  std::vector<AsyncLogClient::Entry> entries;
-  int dload_count = 0;
-  do {
-    // If the server does not impose a limit, all entries from get_first to
-    // get_last will be downloaded at once (could exceed memory).
-    AsyncLogClient::Status error =
-        client_->GetEntries(get_first + dload_count, get_last, &entries);
+  RestoreTree();
 
-    if (error != AsyncLogClient::OK) {
-      LOG(ERROR) << "HTTPLogClient returned with error " << error
-                 << ". No entries have been written to the database.";
-      return NETWORK_PROBLEM;
-    }
+  DownloadQueue queue;
+  std::thread downloader(&DownloadEntries, client_, get_first, get_last,
+                         &queue);
 
-    LOG(INFO) << "Writing entries from " << get_first + dload_count << " to "
-              << get_first + dload_count + entries.size();
-    dload_count += entries.size();
+  // The tree can follow the entries, if it has all those before them.
+  const bool extend_tree(static_cast<int64_t>(tree_->LeafCount()) ==
+                         get_first);
+  int stored = 0;
+  bool failed = false;
+  while (true) {
+    deque<vector<AsyncLogClient::Entry>> batches;
+    {
+      unique_lock<mutex> lock(queue.lock);
+      queue.changed.wait(lock, [&queue]() {
+        return !queue.batches.empty() || queue.done;
+      });
+      batches.swap(queue.batches);
+      failed = queue.failed;
+      queue.changed.notify_all();
+    }
+    if (batches.empty()) {
+      break;
+    }
 
-    db_->BeginTransaction();
-    for (size_t i = 0; i < entries.size(); i++) {
-      cert_trans::LoggedCertificate logged;
-      CHECK(logged.CopyFromClientLogEntry(entries.at(i)));
-      CHECK_EQ(db_->CreateEntry(logged), Database::WRITE_OK);
+    vector<cert_trans::LoggedCertificate> entries;
+    for (const auto& batch : batches) {
+      for (const auto& entry : batch) {
+        entries.emplace_back();
+        CHECK(entries.back().CopyFromClientLogEntry(entry));
+      }
+    }
+    batches.clear();
+    vector<string> leaf_hashes;
+    CHECK_EQ(db_->CreateEntries(entries, &leaf_hashes), Database::WRITE_OK);
+    if (extend_tree) {
+      for (const auto& leaf_hash : leaf_hashes) {
+        tree_->AddLeafHash(leaf_hash);
+      }
     }
-    entries.clear();
-    db_->EndTransaction();
+    const int count(entries.size());
 
-  } while (dload_count + get_first <= get_last);
+    LOG(INFO) << "Wrote entries from " << get_first + stored << " to "
+              << get_first + stored + count - 1;
+    stored += count;
+  }
+  downloader.join();
+
+  if (failed) {
+    LOG(ERROR) << "Only " << stored << " of the entries from " << get_first
+               << " to " << get_last << " have been written to the database.";
+    return NETWORK_PROBLEM;
+  }
   return OK;
 }
 
@@ -199,29 +303,59 @@ Monitor::ConfirmResult Monitor::ConfirmTreeInternal() {
 
 Monitor::ConfirmResult Monitor::ConfirmTreeInternal(
     const ct::SignedTreeHead& sth) {
-  MerkleTree mt(new Sha256Hasher);
-
   Database::VerificationLevel lvl;
   CHECK_EQ(db_->LookupVerificationLevel(sth, &lvl), Database::LOOKUP_OK);
   CHECK_EQ(lvl, Database::SIGNATURE_VERIFIED);
 
+  if (!CheckConsistency(sth)) {
+    CHECK_EQ(db_->SetVerificationLevel(sth,
+                                       Database::TREE_CONFIRMATION_FAILED),
+             Database::WRITE_OK);
+    return TREE_CONFIRMATION_FAILED;
+  }
+  RestoreTree();
+
   std::string hash;
+  std::string root;
 
-  LOG(INFO) << "Building tree...";
+  if (sth.tree_size() < static_cast<int64_t>(tree_->LeafCount()) ||
+      (tree_->LeafCount() == 0 && executor_)) {
+    // Older tree heads need the whole tree to be built, as does the
+    // first one when the hashing can be spread over the executor.
+    MerkleTree mt(new Sha256Hasher);
+    if (executor_)
+      mt.SetExecutor(executor_, num_tasks_);
 
-  for (int64_t current = 1; current <= sth.tree_size(); current++) {
-    CHECK_EQ(db_->LookupHashByIndex(current, &hash), Database::LOOKUP_OK);
-    mt.AddLeafHash(hash);
+    LOG(INFO) << "Building tree...";
+
+    for (int64_t current = 1; current <= sth.tree_size(); current++) {
+      CHECK_EQ(db_->LookupHashByIndex(current, &hash), Database::LOOKUP_OK);
+      mt.AddLeafHash(hash);
+    }
+    root = mt.CurrentRoot();
+    if (tree_->LeafCount() == 0) {
+      tree_.reset(new CompactMerkleTree(mt, new Sha256Hasher));
+    }
+  } else {
+    // Usually, GetEntries() has added all the entries already.
+    LOG(INFO) << "Extending tree from " << tree_->LeafCount() << " entries...";
+
+    for (int64_t current = tree_->LeafCount() + 1;
+         current <= sth.tree_size(); current++) {
+      CHECK_EQ(db_->LookupHashByIndex(current, &hash), Database::LOOKUP_OK);
+      tree_->AddLeafHash(hash);
+    }
+    root = tree_->CurrentRoot();
   }
 
   LOG(INFO) << "merkle tree_size and root_hash:";
-  LOG(INFO) << mt.LeafCount();
-  LOG(INFO) << util::ToBase64(mt.CurrentRoot());
+  LOG(INFO) << sth.tree_size();
+  LOG(INFO) << util::ToBase64(root);
   LOG(INFO) << "STH tree_size and root_hash:";
   LOG(INFO) << sth.tree_size();
   LOG(INFO) << util::ToBase64(sth.sha256_root_hash());
 
-  if (mt.CurrentRoot() != sth.sha256_root_hash()) {
+  if (root != sth.sha256_root_hash()) {
     LOG(ERROR) << "Tree confirmation failed - hashes mismatch.";
     CHECK_EQ(db_->SetVerificationLevel(sth,
                                        Database::TREE_CONFIRMATION_FAILED),
@@ -232,10 +366,67 @@ Monitor::ConfirmResult Monitor::ConfirmTreeInternal(
 
   CHECK_EQ(db_->SetVerificationLevel(sth, Database::TREE_CONFIRMED),
            Database::WRITE_OK);
+  // Later confirmations can start from this tree, even after a restart.
+  if (sth.tree_size() > 0 &&
+      static_cast<int64_t>(tree_->LeafCount()) == sth.tree_size()) {
+    CHECK_EQ(db_->WriteTreeFrontier(sth, tree_->Frontier()),
+             Database::WRITE_OK);
+  }
   LOG(INFO) << "Tree confirmed.";
   return TREE_CONFIRMED;
 }
 
+void Monitor::RestoreTree() {
+  if (tree_restored_ || tree_->LeafCount() != 0)
+    return;
+  tree_restored_ = true;
+
+  ct::SignedTreeHead sth;
+  std::vector<std::string> frontier;
+  if (db_->LookupLatestTreeFrontier(&sth, &frontier) != Database::LOOKUP_OK)
+    return;
+
+  const util::Status status(tree_->Restore(sth.tree_size(), frontier));
+  if (!status.ok() || tree_->CurrentRoot() != sth.sha256_root_hash()) {
+    LOG(WARNING) << "Ignoring the frontier of the tree of size "
+                 << sth.tree_size() << ": " << status;
+    tree_.reset(new CompactMerkleTree(new Sha256Hasher));
+    return;
+  }
+  LOG(INFO) << "Restored the tree of size " << sth.tree_size();
+}
+
+bool Monitor::CheckConsistency(const ct::SignedTreeHead& sth) {
+  ct::SignedTreeHead confirmed;
+  std::vector<std::string> frontier;
+  if (db_->LookupLatestTreeFrontier(&confirmed, &frontier) !=
+          Database::LOOKUP_OK ||
+      confirmed.tree_size() >= sth.tree_size()) {
+    return true;
+  }
+
+  std::vector<std::string> proof;
+  const AsyncLogClient::Status error(client_->GetSTHConsistency(
+      confirmed.tree_size(), sth.tree_size(), &proof));
+  if (error != AsyncLogClient::OK) {
+    // The root hash is still checked.
+    LOG(WARNING) << "HTTPLogClient returned with error " << error
+                 << " for the consistency proof from "
+                 << confirmed.tree_size() << " to " << sth.tree_size();
+    return true;
+  }
+
+  MerkleVerifier verifier(new Sha256Hasher);
+  if (!verifier.VerifyConsistency(confirmed.tree_size(), sth.tree_size(),
+                                  confirmed.sha256_root_hash(),
+                                  sth.sha256_root_hash(), proof)) {
+    LOG(ERROR) << "Tree confirmation failed - not consistent with the tree "
+               << "of size " << confirmed.tree_size() << ".";
+    return false;
+  }
+  return true;
+}
+
 Monitor::CheckResult Monitor::CheckSTHSanity(
     const ct::SignedTreeHead& old_sth, const ct::SignedTreeHead& new_sth) {
   // This serializing returns an empty String on failure which will lead to
@@ -1,12 +1,19 @@
 #ifndef MONITOR_H
 #define MONITOR_H
 
+#include <memory>
+#include <stddef.h>
 #include <stdint.h>
 
 #include "base/macros.h"
 
+class CompactMerkleTree;
 class LogVerifier;
 
+namespace util {
+class Executor;
+}  // namespace util
+
 namespace ct {
 class SignedTreeHead;
 }
@@ -41,11 +48,21 @@ class Monitor {
 
   Monitor(Database* database, LogVerifier* verifier,
           cert_trans::HTTPLogClient* client, uint64_t sleep_time_sec);
+  ~Monitor();
+
+  // Makes ConfirmTree() hash the tree with up to |num_tasks| closures
+  // on |executor| at a time, as MerkleTree::SetExecutor() does, when
+  // it has to hash all of it. Does not take ownership of |executor|.
+  void SetExecutor(util::Executor* executor, size_t num_tasks);
 
   GetResult GetSTH();
 
   VerifyResult VerifySTH(uint64_t timestamp);
 
+  // Downloads the entries from |get_first| to |get_last| and stores
+  // them, the next ones downloading while the previous ones are
+  // stored. What was downloaded by the time a transaction is started
+  // is stored in it.
   GetResult GetEntries(int get_first, int get_last);
 
   ConfirmResult ConfirmTree(uint64_t timestamp);
@@ -66,6 +83,15 @@ class Monitor {
   LogVerifier* const verifier_;
   cert_trans::HTTPLogClient* const client_;
   const uint64_t sleep_time_;
+  util::Executor* executor_;
+  size_t num_tasks_;
+  // The tree of the first entries of the database. GetEntries()
+  // extends it as it stores the entries that follow, so that
+  // ConfirmTree() only has to hash those it misses.
+  std::unique_ptr<CompactMerkleTree> tree_;
+  // Whether |tree_| was restored from the frontier of the latest
+  // confirmed tree in the database, if any.
+  bool tree_restored_;
 
   VerifyResult VerifySTHInternal();
   VerifyResult VerifySTHInternal(const ct::SignedTreeHead& sth);
@@ -73,6 +99,14 @@ class Monitor {
   ConfirmResult ConfirmTreeInternal();
   ConfirmResult ConfirmTreeInternal(const ct::SignedTreeHead& sth);
 
+  // Restores |tree_| from the database, once, while it is empty.
+  void RestoreTree();
+
+  // Checks that |sth| is consistent with the latest confirmed tree
+  // with a frontier in the database, with a consistency proof from the
+  // log. Only fails if the proof does not verify.
+  bool CheckConsistency(const ct::SignedTreeHead& sth);
+
   // Checks if two (subsequent) STHs are sane regarding timestamp and tree
   // size.
   // Prerequisite: Both STHs should have a valid signature and not be
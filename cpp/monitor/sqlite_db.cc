@@ -5,15 +5,53 @@
 
 #include "log/sqlite_statement.h"
 
+using sqlite::CachedStatement;
 using sqlite::Statement;
+using sqlite::StatementCache;
 using std::string;
+using std::vector;
 
 namespace monitor {
 
+namespace {
+
+// One row per non-empty level of the frontier of a confirmed tree.
+// Also created in databases written before it existed.
+const char kCreateFrontiers[] =
+    "CREATE TABLE IF NOT EXISTS frontiers("
+    "timestamp INTEGER, "
+    "level INTEGER, "
+    "node BLOB, "
+    "PRIMARY KEY(timestamp, level))";
+
+
+// With write-ahead logging, a transaction only needs the log to be
+// synced, and not even that with synchronous = NORMAL (a crash can
+// lose the last transactions, which are downloaded again, but not
+// corrupt the database).
+void SetUpConnection(sqlite3* db) {
+  Statement journal_mode(db, "PRAGMA journal_mode = WAL");
+  CHECK_EQ(SQLITE_ROW, journal_mode.Step());
+  string mode;
+  journal_mode.GetBlob(0, &mode);
+  CHECK_STRCASEEQ("wal", mode.c_str());
+  CHECK_EQ(SQLITE_DONE, journal_mode.Step());
+
+  CHECK_EQ(SQLITE_OK, sqlite3_exec(db, "PRAGMA synchronous = NORMAL", NULL,
+                                   NULL, NULL));
+}
+
+
+}  // namespace
+
 SQLiteDB::SQLiteDB(const string& dbfile) : db_(NULL) {
   int ret = sqlite3_open_v2(dbfile.c_str(), &db_, SQLITE_OPEN_READWRITE, NULL);
-  if (ret == SQLITE_OK)
+  if (ret == SQLITE_OK) {
+    SetUpConnection(db_);
+    CHECK_EQ(SQLITE_OK, sqlite3_exec(db_, kCreateFrontiers, NULL, NULL, NULL));
+    statements_.reset(new StatementCache(db_));
     return;
+  }
   CHECK_EQ(SQLITE_CANTOPEN, ret);
 
   // We have to close and reopen to avoid memory leaks.
@@ -23,6 +61,7 @@ SQLiteDB::SQLiteDB(const string& dbfile) : db_(NULL) {
   CHECK_EQ(SQLITE_OK,
            sqlite3_open_v2(dbfile.c_str(), &db_,
                            SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, NULL));
+  SetUpConnection(db_);
 
   // HINT: AUTOINCREMENT starts at 1
 
@@ -46,10 +85,15 @@ SQLiteDB::SQLiteDB(const string& dbfile) : db_(NULL) {
                                    "sth BLOB)",
                                    NULL, NULL, NULL));
 
+  CHECK_EQ(SQLITE_OK, sqlite3_exec(db_, kCreateFrontiers, NULL, NULL, NULL));
+  statements_.reset(new StatementCache(db_));
+
   LOG(INFO) << "New SQLite database created in " << dbfile;
 }
 
 SQLiteDB::~SQLiteDB() {
+  // The statements have to be finalized before the connection closes.
+  statements_.reset();
   CHECK_EQ(SQLITE_OK, sqlite3_close(db_));
 }
 
@@ -65,21 +109,43 @@ SQLiteDB::WriteResult SQLiteDB::CreateEntry_(const std::string& leaf,
                                              const std::string& leaf_hash,
                                              const std::string& cert,
                                              const std::string& cert_chain) {
-  Statement statement(db_,
-                      "INSERT INTO leaves(leaf, leaf_hash, cert, cert_chain) "
-                      "VALUES(?, ?, ?, ?)");
+  CachedStatement statement(statements_.get(),
+                            "INSERT INTO leaves(leaf, leaf_hash, cert, "
+                            "cert_chain) VALUES(?, ?, ?, ?)");
 
-  statement.BindBlob(0, leaf);
-  statement.BindBlob(1, leaf_hash);
-  statement.BindBlob(2, cert);
-  statement.BindBlob(3, cert_chain);
+  statement->BindBlob(0, leaf);
+  statement->BindBlob(1, leaf_hash);
+  statement->BindBlob(2, cert);
+  statement->BindBlob(3, cert_chain);
 
-  if (statement.Step() != SQLITE_DONE)
+  if (statement->Step() != SQLITE_DONE)
     return this->WRITE_FAILED;
 
   return this->WRITE_OK;
 }
 
+SQLiteDB::WriteResult SQLiteDB::CreateEntries_(const vector<EntryRow>& rows) {
+  // Within BeginTransaction() and EndTransaction(), the caller
+  // decides when to commit.
+  const bool own_transaction(sqlite3_get_autocommit(db_) != 0);
+  if (own_transaction)
+    BeginTransaction();
+
+  for (const auto& row : rows) {
+    const WriteResult result(
+        CreateEntry_(row.leaf, row.leaf_hash, row.cert, row.cert_chain));
+    if (result != this->WRITE_OK) {
+      if (own_transaction)
+        CHECK_EQ(SQLITE_OK, sqlite3_exec(db_, "ROLLBACK;", NULL, NULL, NULL));
+      return result;
+    }
+  }
+
+  if (own_transaction)
+    EndTransaction();
+  return this->WRITE_OK;
+}
+
 SQLiteDB::WriteResult SQLiteDB::WriteSTH_(uint64_t timestamp,
                                           int64_t tree_size,
                                           const std::string& sth) {
@@ -126,14 +192,15 @@ SQLiteDB::LookupResult SQLiteDB::LookupLatestWrittenSTH(
 
 SQLiteDB::LookupResult SQLiteDB::LookupHashByIndex(int64_t sequence_number,
                                                    std::string* result) const {
-  Statement statement(db_, "SELECT leaf_hash FROM leaves WHERE sequence = ?");
+  CachedStatement statement(statements_.get(),
+                            "SELECT leaf_hash FROM leaves WHERE sequence = ?");
 
-  statement.BindUInt64(0, sequence_number);
-  int ret = statement.Step();
+  statement->BindUInt64(0, sequence_number);
+  int ret = statement->Step();
   if (ret == SQLITE_DONE)
     return this->NOT_FOUND;
 
-  statement.GetBlob(0, result);
+  statement->GetBlob(0, result);
 
   return this->LOOKUP_OK;
 }
@@ -188,4 +255,60 @@ SQLiteDB::LookupResult SQLiteDB::LookupVerificationLevel(
   return this->LOOKUP_OK;
 }
 
+SQLiteDB::WriteResult SQLiteDB::WriteTreeFrontier_(
+    uint64_t timestamp, const vector<string>& frontier) {
+  Statement clear(db_, "DELETE FROM frontiers WHERE timestamp = ?");
+  clear.BindUInt64(0, timestamp);
+  if (clear.Step() != SQLITE_DONE)
+    return this->WRITE_FAILED;
+
+  for (size_t level = 0; level < frontier.size(); ++level) {
+    if (frontier[level].empty())
+      continue;
+
+    CachedStatement statement(statements_.get(),
+                              "INSERT INTO frontiers(timestamp, level, node) "
+                              "VALUES(?, ?, ?)");
+    statement->BindUInt64(0, timestamp);
+    statement->BindUInt64(1, level);
+    statement->BindBlob(2, frontier[level]);
+    if (statement->Step() != SQLITE_DONE)
+      return this->WRITE_FAILED;
+  }
+
+  return this->WRITE_OK;
+}
+
+SQLiteDB::LookupResult SQLiteDB::LookupLatestTreeFrontier(
+    ct::SignedTreeHead* sth, vector<string>* frontier) const {
+  Statement statement(db_,
+                      "SELECT sth, timestamp FROM trees WHERE valid = ? AND "
+                      "timestamp IN (SELECT timestamp FROM frontiers) "
+                      "ORDER BY tree_size DESC, timestamp DESC LIMIT 1");
+  statement.BindUInt64(0, this->TREE_CONFIRMED);
+
+  int ret = statement.Step();
+  if (ret == SQLITE_DONE)
+    return this->NOT_FOUND;
+  CHECK_EQ(SQLITE_ROW, ret);
+
+  string sth_data;
+  statement.GetBlob(0, &sth_data);
+  CHECK(sth->ParseFromString(sth_data));
+
+  Statement nodes(db_, "SELECT level, node FROM frontiers WHERE timestamp = ?");
+  nodes.BindUInt64(0, statement.GetUInt64(1));
+
+  frontier->clear();
+  while ((ret = nodes.Step()) == SQLITE_ROW) {
+    const uint64_t level(nodes.GetUInt64(0));
+    if (level >= frontier->size())
+      frontier->resize(level + 1);
+    nodes.GetBlob(1, &(*frontier)[level]);
+  }
+  CHECK_EQ(SQLITE_DONE, ret);
+
+  return this->LOOKUP_OK;
+}
+
 }  // namespace monitor
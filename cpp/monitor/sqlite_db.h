@@ -1,16 +1,24 @@
 #ifndef MONITOR_SQLITE_DB_H
 #define MONITOR_SQLITE_DB_H
 
+#include <memory>
 #include <stdint.h>
 #include <string>
+#include <vector>
 
 #include "base/macros.h"
 #include "monitor/database.h"
 
 struct sqlite3;
 
+namespace sqlite {
+class StatementCache;
+}  // namespace sqlite
+
 namespace monitor {
 
+// Uses SQLite in WAL mode, so that a batch of entries written in one
+// transaction (see CreateEntries()) costs a single sync.
 class SQLiteDB : public Database {
  public:
   explicit SQLiteDB(const std::string& dbfile);
@@ -21,6 +29,8 @@ class SQLiteDB : public Database {
   typedef Database::LookupResult LookupResult;
   typedef Database::VerificationLevel VerificationLevel;
 
+  // Entries are written in their own transaction by CreateEntries(),
+  // unless it is called between these.
   void BeginTransaction();
 
   void EndTransaction();
@@ -37,19 +47,28 @@ class SQLiteDB : public Database {
   virtual LookupResult LookupVerificationLevel(
       const ct::SignedTreeHead& sth, VerificationLevel* result) const;
 
+  virtual LookupResult LookupLatestTreeFrontier(
+      ct::SignedTreeHead* sth, std::vector<std::string>* frontier) const;
+
  private:
   virtual WriteResult CreateEntry_(const std::string& leaf,
                                    const std::string& leaf_hash,
                                    const std::string& cert,
                                    const std::string& cert_chain);
 
+  virtual WriteResult CreateEntries_(const std::vector<EntryRow>& rows);
+
   virtual WriteResult WriteSTH_(uint64_t timestamp, int64_t tree_size,
                                 const std::string& sth);
 
   virtual WriteResult SetVerificationLevel_(const ct::SignedTreeHead& sth,
                                             VerificationLevel verify_level);
 
+  virtual WriteResult WriteTreeFrontier_(
+      uint64_t timestamp, const std::vector<std::string>& frontier);
+
   sqlite3* db_;
+  std::unique_ptr<sqlite::StatementCache> statements_;
 
   DISALLOW_COPY_AND_ASSIGN(SQLiteDB);
 };
@@ -28,9 +28,16 @@ class Counter : public Metric {
 
   double Get(const LabelTypes&... labels) const;
 
+  // For callers which update the same |labels| often, and would
+  // rather not pay for looking them up each time. The cell is owned
+  // by this counter.
+  LabelledValueCell* GetCell(const LabelTypes&... labels);
+
   std::map<std::vector<std::string>, Metric::TimestampedValue> CurrentValues()
       const override;
 
+  void ForEachValue(const ValueCallback& value_cb) const override;
+
  private:
   Counter(const std::string& name,
           const typename NameType<LabelTypes>::name&... label_names,
@@ -81,6 +88,13 @@ double Counter<LabelTypes...>::Get(const LabelTypes&... labels) const {
 }
 
 
+template <class... LabelTypes>
+LabelledValueCell* Counter<LabelTypes...>::GetCell(
+    const LabelTypes&... labels) {
+  return values_.GetCell(labels...);
+}
+
+
 template <class... LabelTypes>
 std::map<std::vector<std::string>, Metric::TimestampedValue>
 Counter<LabelTypes...>::CurrentValues() const {
@@ -88,6 +102,12 @@ Counter<LabelTypes...>::CurrentValues() const {
 }
 
 
+template <class... LabelTypes>
+void Counter<LabelTypes...>::ForEachValue(const ValueCallback& value_cb) const {
+  values_.ForEachValue(value_cb);
+}
+
+
 }  // namespace cert_trans
 
 #endif  // CERT_TRANS_MONITORING_COUNTER_H_
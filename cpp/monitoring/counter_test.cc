@@ -4,6 +4,8 @@
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
 #include <memory>
+#include <thread>
+#include <vector>
 
 #include "util/testing.h"
 
@@ -91,6 +93,54 @@ TEST_F(CounterTest, TestCounterWithLabelsMultiValues) {
 }
 
 
+TEST_F(CounterTest, TestCounterCell) {
+  std::unique_ptr<Counter<std::string>> counter(
+      Counter<std::string>::New("name", "a string", "help"));
+  counter->IncrementBy("alpha", 2);
+  LabelledValueCell* const alpha(counter->GetCell("alpha"));
+  LabelledValueCell* const beta(counter->GetCell("beta"));
+  EXPECT_EQ(alpha, counter->GetCell("alpha"));
+  EXPECT_EQ(2, alpha->Get());
+  // Not reported until it is updated.
+  EXPECT_EQ(1, counter->CurrentValues().size());
+
+  alpha->Increment();
+  counter->Increment("alpha");
+  beta->IncrementBy(5);
+  EXPECT_EQ(4, counter->Get("alpha"));
+  EXPECT_EQ(4, alpha->Get());
+  EXPECT_EQ(5, counter->Get("beta"));
+
+  const std::map<vector<string>, Metric::TimestampedValue> values(
+      counter->CurrentValues());
+  ASSERT_EQ(2, values.size());
+  EXPECT_EQ(4, values.at(vector<string>{"alpha"}).second);
+  EXPECT_EQ(5, values.at(vector<string>{"beta"}).second);
+}
+
+
+TEST_F(CounterTest, TestCounterConcurrentIncrements) {
+  std::unique_ptr<Counter<std::string>> counter(
+      Counter<std::string>::New("name", "a string", "help"));
+  LabelledValueCell* const cell(counter->GetCell("alpha"));
+  vector<std::thread> threads;
+  for (int i = 0; i < 8; ++i) {
+    threads.emplace_back([&counter, cell]() {
+      for (int j = 0; j < 1000; ++j) {
+        cell->Increment();
+        counter->Increment("alpha");
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  EXPECT_EQ(16000, counter->Get("alpha"));
+  EXPECT_EQ(16000,
+            counter->CurrentValues().at(vector<string>{"alpha"}).second);
+}
+
+
 }  // namespace cert_trans
 
 
@@ -1,6 +1,7 @@
 #ifndef CERT_TRANS_MONITORING_EVENT_METRIC_H_
 #define CERT_TRANS_MONITORING_EVENT_METRIC_H_
 
+#include <glog/logging.h>
 #include <memory>
 #include <mutex>
 #include <string>
@@ -22,6 +23,29 @@ namespace cert_trans {
 template <class... LabelTypes>
 class EventMetric {
  public:
+  // The two values for one combination of labels, as returned by
+  // GetCells(). Unlike RecordEvent(), the sum and the count are not
+  // updated together atomically, so an export can see one without
+  // the other, which is then corrected by the next one.
+  class Cells {
+   public:
+    void RecordEvent(double amount) const {
+      total_->IncrementBy(amount);
+      count_->Increment();
+    }
+
+   private:
+    friend class EventMetric;
+
+    Cells(LabelledValueCell* total, LabelledValueCell* count)
+        : total_(CHECK_NOTNULL(total)), count_(CHECK_NOTNULL(count)) {
+    }
+
+    LabelledValueCell* total_;
+    LabelledValueCell* count_;
+  };
+
+
   EventMetric(const std::string& base_name,
               const typename NameType<LabelTypes>::name&... label_names,
               const std::string& help);
@@ -31,6 +55,9 @@ class EventMetric {
   // increments the "|base_name|_count" metric by 1.
   void RecordEvent(const LabelTypes&... labels, double amount);
 
+  // The returned cells stay valid for as long as this instance.
+  Cells GetCells(const LabelTypes&... labels);
+
  private:
   std::mutex mutex_;
   std::unique_ptr<Counter<LabelTypes...>> totals_;
@@ -61,6 +88,13 @@ void EventMetric<LabelTypes...>::RecordEvent(const LabelTypes&... labels,
 }
 
 
+template <class... LabelTypes>
+typename EventMetric<LabelTypes...>::Cells
+EventMetric<LabelTypes...>::GetCells(const LabelTypes&... labels) {
+  return Cells(totals_->GetCell(labels...), counts_->GetCell(labels...));
+}
+
+
 }  // namespace cert_trans
 
 
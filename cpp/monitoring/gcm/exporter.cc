@@ -1,8 +1,10 @@
 #include "monitoring/gcm/exporter.h"
 
+#include <cstring>
 #include <gflags/gflags.h>
 #include <glog/logging.h>
 #include <sstream>
+#include <zlib.h>
 
 #include "monitoring/monitoring.h"
 #include "monitoring/registry.h"
@@ -24,6 +26,19 @@ DEFINE_int32(google_compute_monitoring_credentials_refresh_interval_minutes,
              "GCM.");
 DEFINE_int32(google_compute_monitoring_retry_delay_seconds, 5,
              "Seconds between retrying failed GCM requests.");
+DEFINE_int32(google_compute_monitoring_max_timeseries_per_request, 200,
+             "Largest number of time series pushed to GCM in one request, "
+             "as allowed by its API.");
+DEFINE_int32(google_compute_monitoring_max_push_attempts, 3,
+             "Number of times a request pushing metric values to GCM is "
+             "attempted, before the values are sent with the next push "
+             "instead.");
+DEFINE_int32(google_compute_monitoring_resend_unchanged_seconds, 240,
+             "Seconds after which the value of a time series is pushed to "
+             "GCM again, even though it did not change, so that GCM keeps "
+             "showing it.");
+DEFINE_bool(google_compute_monitoring_gzip, true,
+            "Whether to gzip the requests pushing metric values to GCM.");
 
 
 namespace cert_trans {
@@ -33,13 +48,11 @@ using std::chrono::minutes;
 using std::chrono::seconds;
 using std::chrono::system_clock;
 using std::make_pair;
-using std::mutex;
 using std::ostringstream;
 using std::placeholders::_1;
 using std::string;
-using std::thread;
-using std::unique_lock;
 using std::unique_ptr;
+using std::vector;
 using util::Executor;
 using util::SyncTask;
 using util::Task;
@@ -56,6 +69,15 @@ Counter<>* num_gcm_token_fetch_failures =
     Counter<>::New("num_gcm_token_fetch_failures",
                    "Number of failures to fetch GCM auth token");
 
+Counter<>* num_gcm_dropped_batches =
+    Counter<>::New("num_gcm_dropped_batches",
+                   "Number of requests pushing metric data to GCM given up "
+                   "on after failing repeatedly.");
+
+Counter<>* num_gcm_pushed_timeseries =
+    Counter<>::New("num_gcm_pushed_timeseries",
+                   "Number of time series values pushed to GCM.");
+
 namespace {
 
 
@@ -71,6 +93,24 @@ inline std::string RFC3339Time(const system_clock::time_point& when) {
 }
 
 
+string Gzip(const string& data) {
+  z_stream stream;
+  memset(&stream, 0, sizeof(stream));
+  // The window bits, plus 16 for a gzip header rather than a zlib one.
+  CHECK_EQ(Z_OK, deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+                              15 + 16, 8, Z_DEFAULT_STRATEGY));
+  string compressed(deflateBound(&stream, data.size()), '\0');
+  stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+  stream.avail_in = data.size();
+  stream.next_out = reinterpret_cast<Bytef*>(&compressed[0]);
+  stream.avail_out = compressed.size();
+  CHECK_EQ(Z_STREAM_END, deflate(&stream, Z_FINISH));
+  compressed.resize(stream.total_out);
+  CHECK_EQ(Z_OK, deflateEnd(&stream));
+  return compressed;
+}
+
+
 }  // namespace
 
 
@@ -79,8 +119,7 @@ GCMExporter::GCMExporter(const string& instance_name, UrlFetcher* fetcher,
     : instance_name_(instance_name),
       fetcher_(CHECK_NOTNULL(fetcher)),
       executor_(CHECK_NOTNULL(executor)),
-      task_(executor_),
-      metrics_created_(false) {
+      task_(executor_) {
   executor_->Add(bind(&GCMExporter::PushMetrics, this));
 }
 
@@ -91,7 +130,19 @@ GCMExporter::~GCMExporter() {
 }
 
 
+bool GCMExporter::Cancelled() {
+  if (!task_.task()->CancelRequested()) {
+    return false;
+  }
+  task_.task()->Return(util::Status::CANCELLED);
+  return true;
+}
+
+
 void GCMExporter::RefreshCredentials() {
+  if (Cancelled()) {
+    return;
+  }
   VLOG(1) << "Refreshing GCM credentials...";
   UrlFetcher::Request req(
       (URL(FLAGS_google_compute_metadata_url + "/" +
@@ -147,72 +198,91 @@ void AddLabelDescription(const string& key, const string& desc,
 
 
 void GCMExporter::CreateMetrics() {
+  if (Cancelled()) {
+    return;
+  }
+
   const std::set<const Metric*> metrics(Registry::Instance()->GetMetrics());
-  for (auto& m : metrics) {
-    CHECK_NOTNULL(m);
+  const Metric* m(nullptr);
+  for (const Metric* metric : metrics) {
+    if (created_metrics_.count(CHECK_NOTNULL(metric)->Name()) == 0) {
+      m = metric;
+      break;
+    }
+  }
+  if (!m) {
+    VLOG(1) << "Metrics Created.";
+    PushMetrics();
+    return;
+  }
 
-    // See
-    // https://cloud.google.com/monitoring/v2beta2/metricDescriptors#resource
-    // for a description of the structure we're building here.
+  // See
+  // https://cloud.google.com/monitoring/v2beta2/metricDescriptors#resource
+  // for a description of the structure we're building here.
 
-    JsonArray labels;
-    AddLabelDescription("instance",
-                        "Instance from which the sample originates.", &labels);
-    for (const auto& label : m->LabelNames()) {
-      AddLabelDescription(label, label, &labels);
-    }
+  JsonArray labels;
+  AddLabelDescription("instance", "Instance from which the sample originates.",
+                      &labels);
+  for (const auto& label : m->LabelNames()) {
+    AddLabelDescription(label, label, &labels);
+  }
 
-    JsonObject desc;
-    switch (m->Type()) {
-      case Metric::COUNTER:
-        // only gauge type metrics are supported for custom metrics currently:
-        // https://cloud.google.com/monitoring/api/metrics#metric-types
-        desc.Add("metricType", "gauge");
-        break;
-      case Metric::GAUGE:
-        desc.Add("metricType", "gauge");
-        break;
-      default:
-        LOG(FATAL) << "Unknown type: " << m->Type();
-    }
-    desc.Add("valueType", "double");
-
-    JsonObject metric;
-    metric.Add("name", kCloudPrefix + m->Name());
-    metric.Add("description", m->Help());
-    metric.Add("labels", labels);
-    metric.Add("typeDescriptor", desc);
-
-    do {
-      UrlFetcher::Request req((URL(FLAGS_google_compute_monitoring_base_url +
-                                   "/metricDescriptors")));
-      req.verb = UrlFetcher::Verb::POST;
-      req.headers.insert(make_pair("Content-Type", "application/json"));
-      req.headers.insert(
-          make_pair("Authorization", "Bearer " + bearer_token_));
-      req.body = metric.ToString();
-
-      UrlFetcher::Response resp;
-      SyncTask task(executor_);
-      VLOG(1) << "Creating metric m.Name()...";
-      VLOG(2) << req.body;
-      fetcher_->Fetch(req, &resp, task.task());
-      task.Wait();
-      if (!task.status().ok() || resp.status_code != 200) {
-        LOG(WARNING) << "Failed to create/update metric metadata; status: "
-                     << task.status()
-                     << ", response_code: " << resp.status_code;
-        num_gcm_create_metric_failures->Increment();
-        // TODO(alcutter): consider breaking this up into separate child tasks.
-        sleep(FLAGS_google_compute_monitoring_retry_delay_seconds);
-        continue;
-      }
-      VLOG(1) << "Metrics Created.";
-      VLOG(2) << resp.body;
+  JsonObject desc;
+  switch (m->Type()) {
+    case Metric::COUNTER:
+      // only gauge type metrics are supported for custom metrics currently:
+      // https://cloud.google.com/monitoring/api/metrics#metric-types
+      desc.Add("metricType", "gauge");
+      break;
+    case Metric::GAUGE:
+      desc.Add("metricType", "gauge");
+      break;
+    case Metric::HISTOGRAM:
+      desc.Add("metricType", "gauge");
       break;
-    } while (true);
+    default:
+      LOG(FATAL) << "Unknown type: " << m->Type();
+  }
+  desc.Add("valueType",
+           m->Type() == Metric::HISTOGRAM ? "distribution" : "double");
+
+  JsonObject metric;
+  metric.Add("name", kCloudPrefix + m->Name());
+  metric.Add("description", m->Help());
+  metric.Add("labels", labels);
+  metric.Add("typeDescriptor", desc);
+
+  UrlFetcher::Request req(
+      (URL(FLAGS_google_compute_monitoring_base_url + "/metricDescriptors")));
+  req.verb = UrlFetcher::Verb::POST;
+  req.headers.insert(make_pair("Content-Type", "application/json"));
+  req.headers.insert(make_pair("Authorization", "Bearer " + bearer_token_));
+  req.body = metric.ToString();
+
+  UrlFetcher::Response* const resp(new UrlFetcher::Response);
+  VLOG(1) << "Creating metric " << m->Name() << "...";
+  VLOG(2) << req.body;
+  fetcher_->Fetch(req, resp,
+                  task_.task()->AddChild(bind(&GCMExporter::CreateMetricDone,
+                                              this, m->Name(), resp, _1)));
+}
+
+
+void GCMExporter::CreateMetricDone(const string& name,
+                                   UrlFetcher::Response* resp, Task* task) {
+  unique_ptr<UrlFetcher::Response> resp_deleter(resp);
+  if (!task->status().ok() || resp->status_code != 200) {
+    LOG(WARNING) << "Failed to create/update metric metadata; status: "
+                 << task->status() << ", response_code: " << resp->status_code;
+    num_gcm_create_metric_failures->Increment();
+    executor_->Delay(
+        seconds(FLAGS_google_compute_monitoring_retry_delay_seconds),
+        task_.task()->AddChild(bind(&GCMExporter::CreateMetrics, this)));
+    return;
   }
-  metrics_created_ = true;
+  VLOG(2) << resp->body;
+  created_metrics_.insert(name);
+  CreateMetrics();
 }
 
 
@@ -224,12 +294,68 @@ void AddLabel(const string& key, const string& value, JsonObject* labels) {
 }
 
 
+// Adds |distribution| to |point| as a "distributionValue", leaving out
+// the empty buckets.
+void AddDistribution(const Metric::Distribution& distribution,
+                     JsonObject* point) {
+  JsonObject value;
+  JsonArray buckets;
+  const size_t last(distribution.upper_bounds.size());
+  for (size_t i(0); i < last; ++i) {
+    if (distribution.counts[i] == 0) {
+      continue;
+    }
+    JsonObject bucket;
+    bucket.AddDouble("lowerBound",
+                     i > 0 ? distribution.upper_bounds[i - 1] : 0);
+    bucket.AddDouble("upperBound", distribution.upper_bounds[i]);
+    bucket.Add("count", static_cast<int64_t>(distribution.counts[i]));
+    buckets.Add(&bucket);
+  }
+  value.Add("buckets", buckets);
+  if (distribution.counts[last] > 0) {
+    JsonObject overflow;
+    overflow.AddDouble("lowerBound", distribution.upper_bounds[last - 1]);
+    overflow.Add("count", static_cast<int64_t>(distribution.counts[last]));
+    value.Add("overflowBucket", overflow);
+  }
+  CHECK_NOTNULL(point)->Add("distributionValue", value);
+}
+
+
+void AddTimeseries(const Metric& metric, const vector<string>& label_values,
+                   JsonObject* point, JsonArray* timeseries) {
+  JsonObject labels;
+  for (size_t i(0); i < label_values.size(); ++i) {
+    AddLabel(metric.LabelName(i), label_values[i], &labels);
+  }
+
+  JsonObject desc;
+  desc.Add("labels", labels);
+  desc.Add("metric", kCloudPrefix + metric.Name());
+
+  // According to
+  // https://cloud.google.com/monitoring/v2beta2/timeseries/write
+  // GAUGE types should have a zero size timerange here
+  // Which implies we need to use the current time rather than the time the
+  // value was set because there's a [short ~5m] horizon over which GCM
+  // won't accept samples.
+  const auto now(system_clock::now());
+  point->Add("start", RFC3339Time(now));
+  point->Add("end", RFC3339Time(now));
+
+  JsonObject ts;
+  ts.Add("timeseriesDesc", desc);
+  ts.Add("point", *point);
+  CHECK_NOTNULL(timeseries)->Add(&ts);
+}
+
+
 }  // namespace
 
 
 void GCMExporter::PushMetrics() {
-  if (task_.task()->CancelRequested()) {
-    task_.task()->Return(util::Status::CANCELLED);
+  if (Cancelled()) {
     return;
   }
 
@@ -242,83 +368,157 @@ void GCMExporter::PushMetrics() {
     return;
   }
 
-  if (!metrics_created_) {
-    CreateMetrics();
+  // Metrics can be added at any time, they are created (asynchronously,
+  // calling this method again once done) before their values are sent.
+  for (const Metric* m : Registry::Instance()->GetMetrics()) {
+    if (created_metrics_.count(CHECK_NOTNULL(m)->Name()) == 0) {
+      CreateMetrics();
+      return;
+    }
   }
 
-  // Build up the JSON write request into this object:
-  JsonObject metric_write;
-  metric_write.Add("kind", "cloudmonitoring#writeTimeseriesRequest");
+  BuildBatches();
+  SendNextBatch();
+}
 
-  JsonObject common_labels;
-  AddLabel("instance", instance_name_, &common_labels);
-  metric_write.Add("commonLabels", common_labels);
 
-  const std::set<const Metric*> metrics(Registry::Instance()->GetMetrics());
-  JsonArray timeseries;
-  for (auto& m : metrics) {
+void GCMExporter::BuildBatches() {
+  CHECK(batches_.empty());
+  CHECK_GT(FLAGS_google_compute_monitoring_max_timeseries_per_request, 0);
+  const system_clock::time_point now(system_clock::now());
+  const seconds resend_after(
+      FLAGS_google_compute_monitoring_resend_unchanged_seconds);
+
+  unique_ptr<JsonArray> timeseries;
+  Batch batch;
+  const auto finish_batch([this, &timeseries, &batch]() {
+    if (batch.series.empty()) {
+      return;
+    }
+    // Build up the JSON write request into this object:
+    JsonObject metric_write;
+    metric_write.Add("kind", "cloudmonitoring#writeTimeseriesRequest");
+    JsonObject common_labels;
+    AddLabel("instance", instance_name_, &common_labels);
+    metric_write.Add("commonLabels", common_labels);
+    metric_write.Add("timeseries", *timeseries);
+    batch.body = metric_write.ToString();
+    batches_.emplace_back(std::move(batch));
+    batch = Batch();
+    timeseries.reset();
+  });
+
+  // Adds the point of a series, if it changed since it was last sent.
+  const auto add_point([this, &now, &resend_after, &timeseries, &batch,
+                        &finish_batch](
+      const Metric& metric, const vector<string>& labels,
+      const system_clock::time_point& updated, JsonObject* point) {
+    SeriesKey key(metric.Name(), labels);
+    const auto it(sent_series_.find(key));
+    if (it != sent_series_.end() && it->second.updated == updated &&
+        now - it->second.sent < resend_after) {
+      return;
+    }
+    if (!timeseries) {
+      timeseries.reset(new JsonArray);
+    }
+    AddTimeseries(metric, labels, point, timeseries.get());
+    batch.series.emplace_back(std::move(key), updated);
+    if (batch.series.size() >=
+        static_cast<size_t>(
+            FLAGS_google_compute_monitoring_max_timeseries_per_request)) {
+      finish_batch();
+    }
+  });
+
+  for (const Metric* m : Registry::Instance()->GetMetrics()) {
     CHECK_NOTNULL(m);
-    for (auto& p : m->CurrentValues()) {
-      JsonObject labels;
-      for (size_t i(0); i < p.first.size(); ++i) {
-        AddLabel(m->LabelName(i), p.first[i], &labels);
-      }
+    if (m->Type() == Metric::HISTOGRAM) {
+      m->ForEachDistribution([m, &add_point](
+          const vector<string>& labels,
+          const Metric::TimestampedDistribution& value) {
+        JsonObject point;
+        AddDistribution(value.second, &point);
+        add_point(*m, labels, value.first, &point);
+      });
+      continue;
+    }
+    m->ForEachValue([m, &add_point](const vector<string>& labels,
+                                    const Metric::TimestampedValue& value) {
+      JsonObject point;
+      point.Add("doubleValue", value.second);
+      add_point(*m, labels, value.first, &point);
+    });
+  }
+  finish_batch();
+}
 
-      JsonObject desc;
-      desc.Add("labels", labels);
-      desc.Add("metric", kCloudPrefix + m->Name());
 
-      JsonObject ts;
-      ts.Add("timeseriesDesc", desc);
+void GCMExporter::SendNextBatch() {
+  if (Cancelled()) {
+    return;
+  }
 
-      JsonObject point;
-      // According to
-      // https://cloud.google.com/monitoring/v2beta2/timeseries/write
-      // GAUGE types should have a zero size timerange here
-      // Which implies we need to use the current time rather than the time the
-      // value was set because there's a [short ~5m] horizon over which GCM
-      // won't accept samples.
-      const auto now(system_clock::now());
-      point.Add("start", RFC3339Time(now));
-      point.Add("end", RFC3339Time(now));
-      point.Add("doubleValue", p.second.second);
-      ts.Add("point", point);
-
-      timeseries.Add(&ts);
-    }
+  if (batches_.empty()) {
+    executor_->Delay(
+        seconds(FLAGS_google_compute_monitoring_push_interval_seconds),
+        task_.task()->AddChild(bind(&GCMExporter::PushMetrics, this)));
+    return;
   }
-  metric_write.Add("timeseries", timeseries);
 
+  Batch* const batch(&batches_.front());
+  ++batch->attempts;
   UrlFetcher::Request req(
       (URL(FLAGS_google_compute_monitoring_base_url + "/timeseries:write")));
   req.verb = UrlFetcher::Verb::POST;
   req.headers.insert(make_pair("Content-Type", "application/json"));
   req.headers.insert(make_pair("Authorization", "Bearer " + bearer_token_));
-  req.body = metric_write.ToString();
+  if (FLAGS_google_compute_monitoring_gzip) {
+    req.headers.insert(make_pair("Content-Encoding", "gzip"));
+    req.body = Gzip(batch->body);
+  } else {
+    req.body = batch->body;
+  }
 
   UrlFetcher::Response* resp(new UrlFetcher::Response);
-  VLOG(1) << "Pushing metrics...";
-  VLOG(2) << req.body;
+  VLOG(1) << "Pushing " << batch->series.size() << " metric values...";
+  VLOG(2) << batch->body;
   fetcher_->Fetch(req, resp,
                   task_.task()->AddChild(
-                      bind(&GCMExporter::PushMetricsDone, this, resp, _1)));
+                      bind(&GCMExporter::SendBatchDone, this, resp, _1)));
 }
 
 
-void GCMExporter::PushMetricsDone(UrlFetcher::Response* resp, Task* task) {
+void GCMExporter::SendBatchDone(UrlFetcher::Response* resp, Task* task) {
   unique_ptr<UrlFetcher::Response> resp_deleter(resp);
+  CHECK(!batches_.empty());
+  Batch& batch(batches_.front());
   if (!task->status().ok() || resp->status_code != 200) {
     num_gcm_push_failures->Increment();
     LOG(WARNING) << "Failed to push metrics to GCM, status: " << task->status()
                  << ", reponse code: " << resp->status_code;
+    if (batch.attempts < FLAGS_google_compute_monitoring_max_push_attempts) {
+      executor_->Delay(
+          seconds(FLAGS_google_compute_monitoring_retry_delay_seconds),
+          task_.task()->AddChild(bind(&GCMExporter::SendNextBatch, this)));
+      return;
+    }
+    // Not recorded as sent, so that the next push sends their values
+    // again, however old they are by then.
+    num_gcm_dropped_batches->Increment();
   } else {
     VLOG(1) << "Metrics pushed.";
     VLOG(2) << resp->body;
+    const system_clock::time_point now(system_clock::now());
+    for (auto& series : batch.series) {
+      SentSeries& sent(sent_series_[std::move(series.first)]);
+      sent.updated = series.second;
+      sent.sent = now;
+    }
+    num_gcm_pushed_timeseries->IncrementBy(batch.series.size());
   }
-
-  executor_->Delay(
-      seconds(FLAGS_google_compute_monitoring_push_interval_seconds),
-      task_.task()->AddChild(bind(&GCMExporter::PushMetrics, this)));
+  batches_.pop_front();
+  SendNextBatch();
 }
 
 
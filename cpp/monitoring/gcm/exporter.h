@@ -2,10 +2,15 @@
 #define CERT_TRANS_MONITORING_GCM_EXPORTER_H_
 
 #include <chrono>
-#include <condition_variable>
+#include <deque>
+#include <map>
 #include <memory>
-#include <thread>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
 
+#include "base/macros.h"
 #include "net/url_fetcher.h"
 #include "util/executor.h"
 #include "util/sync_task.h"
@@ -13,6 +18,11 @@
 namespace cert_trans {
 
 
+// Pushes the metrics to Google Cloud Monitoring, entirely through
+// asynchronous fetches on |executor|. Each push only sends the time
+// series which changed since they were last sent (or have not been
+// sent for a while), in batches of a bounded size, and a batch is
+// retried a bounded number of times before being given up on.
 class GCMExporter {
  public:
   GCMExporter(const std::string& instance_name, UrlFetcher* fetcher,
@@ -20,23 +30,66 @@ class GCMExporter {
   ~GCMExporter();
 
  private:
+  // Identifies a time series: the name of the metric and the values
+  // of its labels.
+  typedef std::pair<std::string, std::vector<std::string>> SeriesKey;
+
+  struct SentSeries {
+    // The time of the update of the value that was sent.
+    std::chrono::system_clock::time_point updated;
+    std::chrono::system_clock::time_point sent;
+  };
+
+  // A timeseries:write request waiting to be sent.
+  struct Batch {
+    Batch() : attempts(0) {
+    }
+
+    std::string body;
+    // The series in |body|, with the time of the update of their
+    // values, which are recorded as sent once the request succeeds.
+    std::vector<std::pair<SeriesKey, std::chrono::system_clock::time_point>>
+        series;
+    int attempts;
+  };
+
+  // Returns true, after returning |task_|, if it was cancelled, in
+  // which case nothing else must be done.
+  bool Cancelled();
+
   void RefreshCredentials();
   void RefreshCredentialsDone(UrlFetcher::Response* resp, util::Task* task);
 
+  // Creates the descriptor of each metric that was not created yet,
+  // one after the other, and then calls PushMetrics().
   void CreateMetrics();
+  void CreateMetricDone(const std::string& name, UrlFetcher::Response* resp,
+                        util::Task* task);
 
   void PushMetrics();
-  void PushMetricsDone(UrlFetcher::Response* resp, util::Task* task);
+  // Builds the batches of the series to send into |batches_|.
+  void BuildBatches();
+  // Sends the first of |batches_|, if any, or waits until the next
+  // push otherwise.
+  void SendNextBatch();
+  void SendBatchDone(UrlFetcher::Response* resp, util::Task* task);
 
   const std::string instance_name_;
   UrlFetcher* const fetcher_;
   util::Executor* const executor_;
   util::SyncTask task_;
-  bool metrics_created_;
   std::chrono::system_clock::time_point token_refreshed_at_;
   std::string bearer_token_;
 
+  // Only used by the chain of callbacks started by the constructor,
+  // which run one at a time.
+  std::set<std::string> created_metrics_;
+  std::map<SeriesKey, SentSeries> sent_series_;
+  std::deque<Batch> batches_;
+
   friend class GCMExporterTest;
+
+  DISALLOW_COPY_AND_ASSIGN(GCMExporter);
 };
 
 
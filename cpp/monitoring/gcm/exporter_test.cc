@@ -1,11 +1,14 @@
 #include "monitoring/gcm/exporter.h"
 
+#include <cstring>
 #include <glog/logging.h>
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
 #include <memory>
+#include <zlib.h>
 
 #include "monitoring/monitoring.h"
+#include "monitoring/registry.h"
 #include "net/mock_url_fetcher.h"
 #include "util/json_wrapper.h"
 #include "util/testing.h"
@@ -16,6 +19,9 @@ DECLARE_string(google_compute_monitoring_base_url);
 DECLARE_int32(google_compute_monitoring_push_interval_seconds);
 DECLARE_string(google_compute_monitoring_service_account);
 DECLARE_int32(google_compute_monitoring_retry_delay_seconds);
+DECLARE_int32(google_compute_monitoring_max_timeseries_per_request);
+DECLARE_int32(google_compute_monitoring_resend_unchanged_seconds);
+DECLARE_bool(google_compute_monitoring_gzip);
 
 namespace cert_trans {
 
@@ -49,6 +55,7 @@ using testing::InSequence;
 using testing::Invoke;
 using testing::InvokeWithoutArgs;
 using testing::IsEmpty;
+using testing::Not;
 using util::Status;
 using util::SyncTask;
 using util::Task;
@@ -72,6 +79,22 @@ void HandleFetch(Status status, int status_code,
 }
 
 
+string Gunzip(const string& data) {
+  z_stream stream;
+  memset(&stream, 0, sizeof(stream));
+  CHECK_EQ(Z_OK, inflateInit2(&stream, 15 + 16));
+  string uncompressed(1 << 20, '\0');
+  stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+  stream.avail_in = data.size();
+  stream.next_out = reinterpret_cast<Bytef*>(&uncompressed[0]);
+  stream.avail_out = uncompressed.size();
+  CHECK_EQ(Z_STREAM_END, inflate(&stream, Z_FINISH));
+  uncompressed.resize(stream.total_out);
+  CHECK_EQ(Z_OK, inflateEnd(&stream));
+  return uncompressed;
+}
+
+
 }  // namespace
 
 
@@ -85,6 +108,11 @@ class GCMExporterTest : public ::testing::Test {
     FLAGS_google_compute_monitoring_push_interval_seconds = kPushInterval;
     FLAGS_google_compute_metadata_url = kMetadataUrl;
     FLAGS_google_compute_monitoring_service_account = kServiceAccount;
+    // Most tests look at the requests as they are, and expect every
+    // value to be pushed each time.
+    FLAGS_google_compute_monitoring_gzip = false;
+    FLAGS_google_compute_monitoring_resend_unchanged_seconds = 0;
+    FLAGS_google_compute_monitoring_max_timeseries_per_request = 200;
 
     ON_CALL(fetcher_, Fetch(_, _, _))
         .WillByDefault(Invoke(bind(&HandleFetch, util::Status::OK, 200,
@@ -100,6 +128,46 @@ class GCMExporterTest : public ::testing::Test {
     return e.token_refreshed_at_.time_since_epoch() > seconds(0);
   }
 
+  // Answers all the requests but the pushes successfully.
+  void ExpectSetupFetches() {
+    EXPECT_CALL(
+        fetcher_,
+        Fetch(IsUrlFetchRequest(
+                  UrlFetcher::Verb::GET,
+                  URL(string(kMetadataUrl) + "/" + kServiceAccount + "/token"),
+                  UrlFetcher::Headers{make_pair("Metadata-Flavor", "Google")},
+                  ""),
+              _, _))
+        .WillRepeatedly(
+            Invoke(bind(&HandleFetch, util::Status::OK, 200,
+                        UrlFetcher::Headers{}, kCredentialsJson, _1, _2, _3)));
+    EXPECT_CALL(fetcher_,
+                Fetch(IsUrlFetchRequest(
+                          UrlFetcher::Verb::POST, URL(metrics_url_),
+                          UrlFetcher::Headers{
+                              make_pair("Content-Type", "application/json"),
+                              make_pair("Authorization", "Bearer token")},
+                          _),
+                      _, _))
+        .WillRepeatedly(Invoke(bind(&HandleFetch, util::Status::OK, 200,
+                                    UrlFetcher::Headers{}, "", _1, _2, _3)));
+  }
+
+  // Expects a push of a body matching |body_matcher|, answered by
+  // |action|.
+  template <class Matcher, class Action>
+  void ExpectPush(const Matcher& body_matcher, const Action& action) {
+    EXPECT_CALL(fetcher_,
+                Fetch(IsUrlFetchRequest(
+                          UrlFetcher::Verb::POST, URL(push_url_),
+                          UrlFetcher::Headers{
+                              make_pair("Content-Type", "application/json"),
+                              make_pair("Authorization", "Bearer token")},
+                          body_matcher),
+                      _, _))
+        .WillOnce(action);
+  }
+
   const string metrics_url_;
   const string push_url_;
   ThreadPool pool_;
@@ -378,6 +446,88 @@ TEST_F(GCMExporterTest, TestRetriesWhenPushingMetricsFails) {
 }
 
 
+TEST_F(GCMExporterTest, TestOnlyPushesChangedValues) {
+  Registry::Instance()->ResetForTestingOnly();
+  FLAGS_google_compute_monitoring_resend_unchanged_seconds = 3600;
+  std::unique_ptr<Counter<>> one(Counter<>::New("one", "help1"));
+  one->Increment();
+  std::unique_ptr<Gauge<>> two(Gauge<>::New("two", "help2"));
+  two->Set(2);
+
+  SyncTask sync(&pool_);
+  ExpectSetupFetches();
+  {
+    InSequence s;
+    ExpectPush(AllOf(HasSubstr("one"), HasSubstr("two")),
+               DoAll(InvokeWithoutArgs([&one] { one->Increment(); }),
+                     Invoke(bind(&HandleFetch, util::Status::OK, 200,
+                                 UrlFetcher::Headers{}, "", _1, _2, _3))));
+    ExpectPush(AllOf(HasSubstr("one"), Not(HasSubstr("two"))),
+               DoAll(InvokeWithoutArgs([&sync] { sync.task()->Return(); }),
+                     Invoke(bind(&HandleFetch, util::Status::OK, 200,
+                                 UrlFetcher::Headers{}, "", _1, _2, _3))));
+  }
+  GCMExporter exporter("instance", &fetcher_, &pool_);
+  sync.Wait();
+}
+
+
+TEST_F(GCMExporterTest, TestSplitsPushesInBatches) {
+  Registry::Instance()->ResetForTestingOnly();
+  FLAGS_google_compute_monitoring_max_timeseries_per_request = 1;
+  std::unique_ptr<Counter<>> one(Counter<>::New("one", "help1"));
+  one->Increment();
+  std::unique_ptr<Gauge<>> two(Gauge<>::New("two", "help2"));
+  two->Set(2);
+
+  SyncTask sync(&pool_);
+  ExpectSetupFetches();
+  {
+    InSequence s;
+    ExpectPush(Not(AllOf(HasSubstr("one"), HasSubstr("two"))),
+               Invoke(bind(&HandleFetch, util::Status::OK, 200,
+                           UrlFetcher::Headers{}, "", _1, _2, _3)));
+    ExpectPush(Not(AllOf(HasSubstr("one"), HasSubstr("two"))),
+               DoAll(InvokeWithoutArgs([&sync] { sync.task()->Return(); }),
+                     Invoke(bind(&HandleFetch, util::Status::OK, 200,
+                                 UrlFetcher::Headers{}, "", _1, _2, _3))));
+  }
+  GCMExporter exporter("instance", &fetcher_, &pool_);
+  sync.Wait();
+}
+
+
+TEST_F(GCMExporterTest, TestGzipsPushes) {
+  Registry::Instance()->ResetForTestingOnly();
+  FLAGS_google_compute_monitoring_gzip = true;
+  std::unique_ptr<Counter<>> one(Counter<>::New("one", "help1"));
+  one->Increment();
+
+  SyncTask sync(&pool_);
+  ExpectSetupFetches();
+  EXPECT_CALL(fetcher_,
+              Fetch(IsUrlFetchRequest(
+                        UrlFetcher::Verb::POST, URL(push_url_),
+                        UrlFetcher::Headers{
+                            make_pair("Content-Type", "application/json"),
+                            make_pair("Authorization", "Bearer token"),
+                            make_pair("Content-Encoding", "gzip")},
+                        _),
+                    _, _))
+      .WillOnce(Invoke([&sync](const UrlFetcher::Request& req,
+                               UrlFetcher::Response* resp, Task* task) {
+        const string body(Gunzip(req.body));
+        EXPECT_TRUE(JsonObject(body).Ok()) << body;
+        EXPECT_THAT(body, HasSubstr("one"));
+        resp->status_code = 200;
+        sync.task()->Return();
+        task->Return();
+      }));
+  GCMExporter exporter("instance", &fetcher_, &pool_);
+  sync.Wait();
+}
+
+
 }  // namespace cert_trans
 
 
@@ -0,0 +1,125 @@
+#include "monitoring/histogram.h"
+
+#include <algorithm>
+#include <glog/logging.h>
+
+using std::chrono::system_clock;
+using std::memory_order_relaxed;
+using std::vector;
+
+namespace cert_trans {
+
+namespace {
+
+
+vector<double> MakeUpperBounds() {
+  vector<double> bounds;
+  bounds.reserve(HistogramCell::kNumBounds);
+  for (int exponent = 0; exponent < HistogramCell::kMaxExponent; ++exponent) {
+    const double power(static_cast<double>(1 << exponent));
+    for (int i = 0; i < HistogramCell::kSubBuckets; ++i) {
+      bounds.push_back(power + power * i / HistogramCell::kSubBuckets);
+    }
+  }
+  bounds.push_back(static_cast<double>(1 << HistogramCell::kMaxExponent));
+  CHECK_EQ(HistogramCell::kNumBounds, bounds.size());
+  return bounds;
+}
+
+
+}  // namespace
+
+
+const int HistogramCell::kSubBuckets;
+const int HistogramCell::kMaxExponent;
+const size_t HistogramCell::kNumBounds;
+const size_t HistogramCell::kNumBuckets;
+const size_t HistogramCell::kNumShards;
+
+
+uint64_t Metric::Distribution::Count() const {
+  uint64_t count(0);
+  for (const auto& bucket : counts) {
+    count += bucket;
+  }
+  return count;
+}
+
+
+void Metric::Distribution::Merge(const Distribution& other) {
+  if (counts.empty()) {
+    *this = other;
+    return;
+  }
+  CHECK(upper_bounds == other.upper_bounds);
+  for (size_t i = 0; i < counts.size(); ++i) {
+    counts[i] += other.counts[i];
+  }
+  sum += other.sum;
+}
+
+
+// static
+const vector<double>& HistogramCell::UpperBounds() {
+  static const vector<double>* const bounds(
+      new vector<double>(MakeUpperBounds()));
+  return *bounds;
+}
+
+
+HistogramCell::HistogramCell() : updated_since_read_(false), updated_(0) {
+  for (auto& shard : shards_) {
+    for (auto& count : shard.counts) {
+      count.store(0, memory_order_relaxed);
+    }
+    shard.sum.store(0, memory_order_relaxed);
+  }
+}
+
+
+void HistogramCell::Record(double value) {
+  const vector<double>& bounds(UpperBounds());
+  const size_t bucket(std::lower_bound(bounds.begin(), bounds.end(), value) -
+                      bounds.begin());
+
+  Shard& shard(shards_[ThreadShardIndex() % kNumShards]);
+  shard.counts[bucket].fetch_add(1, memory_order_relaxed);
+  double sum(shard.sum.load(memory_order_relaxed));
+  while (!shard.sum.compare_exchange_weak(sum, sum + value,
+                                          memory_order_relaxed)) {
+  }
+
+  // Only write the flag if needed, to keep its cache line shared.
+  if (!updated_since_read_.load(memory_order_relaxed)) {
+    updated_since_read_.store(true, memory_order_relaxed);
+  }
+}
+
+
+Metric::Distribution HistogramCell::GetDistribution() const {
+  Metric::Distribution distribution;
+  distribution.upper_bounds = UpperBounds();
+  distribution.counts.assign(kNumBuckets, 0);
+  for (const auto& shard : shards_) {
+    for (size_t i = 0; i < kNumBuckets; ++i) {
+      distribution.counts[i] += shard.counts[i].load(memory_order_relaxed);
+    }
+    distribution.sum += shard.sum.load(memory_order_relaxed);
+  }
+  return distribution;
+}
+
+
+Metric::TimestampedDistribution HistogramCell::GetTimestamped() const {
+  if (updated_since_read_.load(memory_order_relaxed) &&
+      updated_since_read_.exchange(false, memory_order_relaxed)) {
+    updated_.store(system_clock::now().time_since_epoch().count(),
+                   memory_order_relaxed);
+  }
+  return make_pair(system_clock::time_point(system_clock::duration(
+                       updated_.load(memory_order_relaxed))),
+                   GetDistribution());
+}
+
+
+}  // namespace cert_trans
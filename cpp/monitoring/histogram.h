@@ -0,0 +1,236 @@
+#ifndef CERT_TRANS_MONITORING_HISTOGRAM_H_
+#define CERT_TRANS_MONITORING_HISTOGRAM_H_
+
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include "base/macros.h"
+#include "monitoring/labelled_values.h"
+#include "monitoring/metric.h"
+
+namespace cert_trans {
+
+
+// The distribution of the values for one combination of labels, as
+// returned by Histogram<>::GetCell(). Thread-safe.
+//
+// The buckets are log-linear: each power of two from 1 to 2^24 is
+// split in kSubBuckets buckets of equal width, so that a quantile is
+// known within 1 / kSubBuckets of its value. Values up to 1 share the
+// first bucket, and those above 2^24 the last one. As for
+// LabelledValueCell, the counts are sharded between threads, and only
+// added up when read.
+class HistogramCell {
+ public:
+  static const int kSubBuckets = 4;
+  static const int kMaxExponent = 24;
+  // One bucket ends at each bound, plus the last one which has no
+  // upper bound.
+  static const size_t kNumBounds = kMaxExponent * kSubBuckets + 1;
+  static const size_t kNumBuckets = kNumBounds + 1;
+
+  // The inclusive upper bounds of the buckets.
+  static const std::vector<double>& UpperBounds();
+
+  void Record(double value);
+
+  Metric::Distribution GetDistribution() const;
+
+  // The time is that of the first read after the last update, as for
+  // LabelledValueCell::GetTimestamped().
+  Metric::TimestampedDistribution GetTimestamped() const;
+
+ private:
+  template <class... LabelTypes>
+  friend class Histogram;
+
+  static const size_t kNumShards = 4;
+
+  struct Shard {
+    std::atomic<uint64_t> counts[kNumBuckets];
+    std::atomic<double> sum;
+    // Keeps the next shard off the cache line of |sum|.
+    char padding[64];
+  };
+
+  HistogramCell();
+
+  Shard shards_[kNumShards];
+  mutable std::atomic<bool> updated_since_read_;
+  mutable std::atomic<std::chrono::system_clock::rep> updated_;
+
+  DISALLOW_COPY_AND_ASSIGN(HistogramCell);
+};
+
+
+// A metric for the distribution of some values (e.g. latencies),
+// exported with its buckets, so that quantiles can be computed.
+template <class... LabelTypes>
+class Histogram : public Metric {
+ public:
+  static Histogram<LabelTypes...>* New(
+      const std::string& name,
+      const typename NameType<LabelTypes>::name&... label_names,
+      const std::string& help);
+
+  void Record(const LabelTypes&... labels, double value);
+
+  // For callers which record values for the same |labels| often. The
+  // cell is owned by this histogram.
+  HistogramCell* GetCell(const LabelTypes&... labels);
+
+  Distribution GetDistribution(const LabelTypes&... labels) const;
+
+  // The number of values recorded for each combination of labels.
+  std::map<std::vector<std::string>, Metric::TimestampedValue> CurrentValues()
+      const override;
+
+  std::map<std::vector<std::string>, Metric::TimestampedDistribution>
+  CurrentDistributions() const override;
+
+  void ForEachValue(const ValueCallback& value_cb) const override;
+
+  // Only holds the lock while listing the cells, as
+  // LabelledValues<>::ForEachValue() does.
+  void ForEachDistribution(
+      const DistributionCallback& distribution_cb) const override;
+
+ private:
+  Histogram(const std::string& name,
+            const typename NameType<LabelTypes>::name&... label_names,
+            const std::string& help);
+
+  // Only held to look up (or add) the cells, which are never removed.
+  mutable std::mutex mutex_;
+  std::map<std::tuple<LabelTypes...>, std::unique_ptr<HistogramCell>> cells_;
+
+  DISALLOW_COPY_AND_ASSIGN(Histogram);
+};
+
+
+// static
+template <class... LabelTypes>
+Histogram<LabelTypes...>* Histogram<LabelTypes...>::New(
+    const std::string& name,
+    const typename NameType<LabelTypes>::name&... label_names,
+    const std::string& help) {
+  return new Histogram(name, label_names..., help);
+}
+
+
+template <class... LabelTypes>
+Histogram<LabelTypes...>::Histogram(
+    const std::string& name,
+    const typename NameType<LabelTypes>::name&... label_names,
+    const std::string& help)
+    : Metric(HISTOGRAM, name, {label_names...}, help) {
+}
+
+
+template <class... LabelTypes>
+void Histogram<LabelTypes...>::Record(const LabelTypes&... labels,
+                                      double value) {
+  GetCell(labels...)->Record(value);
+}
+
+
+template <class... LabelTypes>
+HistogramCell* Histogram<LabelTypes...>::GetCell(
+    const LabelTypes&... labels) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::unique_ptr<HistogramCell>& cell(
+      cells_[std::tuple<LabelTypes...>(labels...)]);
+  if (!cell) {
+    // Not reported until a value is recorded.
+    cell.reset(new HistogramCell);
+  }
+  return cell.get();
+}
+
+
+template <class... LabelTypes>
+Metric::Distribution Histogram<LabelTypes...>::GetDistribution(
+    const LabelTypes&... labels) const {
+  const HistogramCell* cell;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    const auto it(cells_.find(std::tuple<LabelTypes...>(labels...)));
+    if (it == cells_.end()) {
+      return HistogramCell().GetDistribution();
+    }
+    cell = it->second.get();
+  }
+  return cell->GetDistribution();
+}
+
+
+template <class... LabelTypes>
+std::map<std::vector<std::string>, Metric::TimestampedValue>
+Histogram<LabelTypes...>::CurrentValues() const {
+  std::map<std::vector<std::string>, Metric::TimestampedValue> ret;
+  ForEachValue([&ret](const std::vector<std::string>& labels,
+                      const Metric::TimestampedValue& value) {
+    ret[labels] = value;
+  });
+  return ret;
+}
+
+
+template <class... LabelTypes>
+std::map<std::vector<std::string>, Metric::TimestampedDistribution>
+Histogram<LabelTypes...>::CurrentDistributions() const {
+  std::map<std::vector<std::string>, Metric::TimestampedDistribution> ret;
+  ForEachDistribution([&ret](
+      const std::vector<std::string>& labels,
+      const Metric::TimestampedDistribution& distribution) {
+    ret[labels] = distribution;
+  });
+  return ret;
+}
+
+
+template <class... LabelTypes>
+void Histogram<LabelTypes...>::ForEachValue(
+    const ValueCallback& value_cb) const {
+  ForEachDistribution([&value_cb](
+      const std::vector<std::string>& labels,
+      const Metric::TimestampedDistribution& distribution) {
+    value_cb(labels,
+             make_pair(distribution.first, distribution.second.Count()));
+  });
+}
+
+
+template <class... LabelTypes>
+void Histogram<LabelTypes...>::ForEachDistribution(
+    const DistributionCallback& distribution_cb) const {
+  std::vector<std::pair<const std::tuple<LabelTypes...>*,
+                        const HistogramCell*>> cells;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    cells.reserve(cells_.size());
+    for (const auto& c : cells_) {
+      cells.emplace_back(&c.first, c.second.get());
+    }
+  }
+
+  for (const auto& c : cells) {
+    const Metric::TimestampedDistribution value(c.second->GetTimestamped());
+    // Cells without values do not exist yet, as far as the exporters
+    // are concerned.
+    if (value.first != std::chrono::system_clock::time_point()) {
+      distribution_cb(label_values(*c.first), value);
+    }
+  }
+}
+
+}  // namespace cert_trans
+
+#endif  // CERT_TRANS_MONITORING_HISTOGRAM_H_
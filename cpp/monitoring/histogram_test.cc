@@ -0,0 +1,101 @@
+#include "monitoring/monitoring.h"
+
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+#include <memory>
+#include <thread>
+
+#include "monitoring/latency.h"
+#include "util/testing.h"
+
+namespace cert_trans {
+
+using std::chrono::milliseconds;
+using std::string;
+using std::vector;
+
+
+TEST(HistogramTest, TestBuckets) {
+  std::unique_ptr<Histogram<>> histogram(Histogram<>::New("name", "help"));
+  for (double value : {0.5, 1.0, 1.1, 3.0, 100.0, 1e9}) {
+    histogram->Record(value);
+  }
+
+  const Metric::Distribution distribution(histogram->GetDistribution());
+  ASSERT_EQ(distribution.upper_bounds.size() + 1,
+            distribution.counts.size());
+  EXPECT_EQ(6, distribution.Count());
+  EXPECT_DOUBLE_EQ(1e9 + 105.6, distribution.sum);
+  // Values up to a bound are in its bucket.
+  EXPECT_EQ(1, distribution.upper_bounds[0]);
+  EXPECT_EQ(2, distribution.counts[0]);
+  EXPECT_EQ(1.25, distribution.upper_bounds[1]);
+  EXPECT_EQ(1, distribution.counts[1]);
+  EXPECT_EQ(1, distribution.counts.back());
+
+  // The buckets are at most a quarter of their lower bound wide.
+  for (size_t i = 1; i < distribution.upper_bounds.size(); ++i) {
+    EXPECT_LE(distribution.upper_bounds[i],
+              distribution.upper_bounds[i - 1] * 1.25);
+  }
+}
+
+
+TEST(HistogramTest, TestMerge) {
+  std::unique_ptr<Histogram<string>> histogram(
+      Histogram<string>::New("name", "a string", "help"));
+  histogram->Record("alpha", 2);
+  histogram->Record("beta", 2);
+  histogram->Record("beta", 10);
+
+  Metric::Distribution merged;
+  merged.Merge(histogram->GetDistribution("alpha"));
+  merged.Merge(histogram->GetDistribution("beta"));
+  EXPECT_EQ(3, merged.Count());
+  EXPECT_EQ(14, merged.sum);
+}
+
+
+TEST(HistogramTest, TestCurrentValues) {
+  std::unique_ptr<Histogram<string>> histogram(
+      Histogram<string>::New("name", "a string", "help"));
+  HistogramCell* const alpha(histogram->GetCell("alpha"));
+  EXPECT_EQ(alpha, histogram->GetCell("alpha"));
+  // Not reported until a value is recorded.
+  EXPECT_TRUE(histogram->CurrentDistributions().empty());
+
+  vector<std::thread> threads;
+  for (int i = 0; i < 8; ++i) {
+    threads.emplace_back([alpha]() {
+      for (int j = 0; j < 1000; ++j) {
+        alpha->Record(j);
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  const auto distributions(histogram->CurrentDistributions());
+  ASSERT_EQ(1, distributions.size());
+  EXPECT_EQ(8000,
+            distributions.at(vector<string>{"alpha"}).second.Count());
+  EXPECT_EQ(8000,
+            histogram->CurrentValues().at(vector<string>{"alpha"}).second);
+}
+
+
+TEST(HistogramTest, TestLatency) {
+  Latency<milliseconds, string> latency("name", "a string", "help");
+  latency.RecordLatency("alpha", milliseconds(3));
+  latency.GetCell("alpha").RecordLatency(milliseconds(5));
+}
+
+
+}  // namespace cert_trans
+
+
+int main(int argc, char** argv) {
+  cert_trans::test::InitTesting(argv[0], &argc, &argv, true);
+  return RUN_ALL_TESTS();
+}
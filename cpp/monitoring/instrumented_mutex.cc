@@ -0,0 +1,38 @@
+#include "monitoring/instrumented_mutex.h"
+
+using std::string;
+
+namespace cert_trans {
+namespace {
+
+
+Histogram<string>* LockWaitMicroseconds() {
+  static Histogram<string>* const histogram(Histogram<string>::New(
+      "lock_wait_us", "lock",
+      "Time spent waiting to acquire each named lock, in microseconds."));
+  return histogram;
+}
+
+
+Histogram<string>* LockHoldMicroseconds() {
+  static Histogram<string>* const histogram(Histogram<string>::New(
+      "lock_hold_us", "lock",
+      "Time each named lock was held exclusively, in microseconds."));
+  return histogram;
+}
+
+
+}  // namespace
+
+
+HistogramCell* LockWaitCell(const string& name) {
+  return LockWaitMicroseconds()->GetCell(name);
+}
+
+
+HistogramCell* LockHoldCell(const string& name) {
+  return LockHoldMicroseconds()->GetCell(name);
+}
+
+
+}  // namespace cert_trans
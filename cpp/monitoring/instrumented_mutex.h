@@ -0,0 +1,96 @@
+#ifndef CERT_TRANS_MONITORING_INSTRUMENTED_MUTEX_H_
+#define CERT_TRANS_MONITORING_INSTRUMENTED_MUTEX_H_
+
+#include <chrono>
+#include <mutex>
+#include <string>
+
+#include "base/macros.h"
+#include "monitoring/histogram.h"
+
+namespace cert_trans {
+
+
+// The cells of the "lock_wait_us" and "lock_hold_us" histograms for
+// the locks named |name|.
+HistogramCell* LockWaitCell(const std::string& name);
+HistogramCell* LockHoldCell(const std::string& name);
+
+
+// Wraps a |Mutex| (such as std::mutex or RwMutex), recording how long
+// it takes to acquire it and, when held exclusively, how long it is
+// held, in the histograms "lock_wait_us" and "lock_hold_us" labelled
+// with |name|. Instances with the same name share their histograms.
+//
+// Meets the Lockable requirements, so that std::lock_guard and
+// std::unique_lock can be used with it, and std::condition_variable_any
+// in place of std::condition_variable (the time spent waiting on it
+// does not count as held).
+template <class Mutex = std::mutex>
+class InstrumentedMutex {
+ public:
+  explicit InstrumentedMutex(const std::string& name)
+      : wait_(LockWaitCell(name)), hold_(LockHoldCell(name)) {
+  }
+
+  void lock() {
+    if (mutex_.try_lock()) {
+      locked_at_ = std::chrono::steady_clock::now();
+      wait_->Record(0);
+      return;
+    }
+    const std::chrono::steady_clock::time_point start(
+        std::chrono::steady_clock::now());
+    mutex_.lock();
+    locked_at_ = std::chrono::steady_clock::now();
+    RecordMicroseconds(wait_, locked_at_ - start);
+  }
+
+  bool try_lock() {
+    if (!mutex_.try_lock()) {
+      return false;
+    }
+    locked_at_ = std::chrono::steady_clock::now();
+    return true;
+  }
+
+  void unlock() {
+    const std::chrono::steady_clock::duration held(
+        std::chrono::steady_clock::now() - locked_at_);
+    mutex_.unlock();
+    RecordMicroseconds(hold_, held);
+  }
+
+  // Only the wait is recorded for shared holds, as there can be many
+  // at once.
+  void lock_shared() {
+    const std::chrono::steady_clock::time_point start(
+        std::chrono::steady_clock::now());
+    mutex_.lock_shared();
+    RecordMicroseconds(wait_, std::chrono::steady_clock::now() - start);
+  }
+
+  void unlock_shared() {
+    mutex_.unlock_shared();
+  }
+
+ private:
+  static void RecordMicroseconds(HistogramCell* cell,
+                                 std::chrono::steady_clock::duration d) {
+    cell->Record(
+        std::chrono::duration_cast<std::chrono::microseconds>(d).count());
+  }
+
+  Mutex mutex_;
+  HistogramCell* const wait_;
+  HistogramCell* const hold_;
+  // When |mutex_| was last acquired exclusively.
+  std::chrono::steady_clock::time_point locked_at_;
+
+  DISALLOW_COPY_AND_ASSIGN(InstrumentedMutex);
+};
+
+
+}  // namespace cert_trans
+
+#endif  // CERT_TRANS_MONITORING_INSTRUMENTED_MUTEX_H_
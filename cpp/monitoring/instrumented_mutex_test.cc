@@ -0,0 +1,74 @@
+#include "monitoring/instrumented_mutex.h"
+
+#include <condition_variable>
+#include <gtest/gtest.h>
+#include <thread>
+
+#include "base/notification.h"
+#include "base/rw_mutex.h"
+#include "util/testing.h"
+
+namespace cert_trans {
+namespace {
+
+using std::chrono::milliseconds;
+
+
+TEST(InstrumentedMutexTest, RecordsWaitAndHoldTimes) {
+  InstrumentedMutex<> mutex("test_lock");
+  Notification locked;
+  std::thread holder([&mutex, &locked]() {
+    std::lock_guard<InstrumentedMutex<>> lock(mutex);
+    locked.Notify();
+    std::this_thread::sleep_for(milliseconds(50));
+  });
+  locked.WaitForNotification();
+  { std::lock_guard<InstrumentedMutex<>> lock(mutex); }
+  holder.join();
+
+  const Metric::Distribution wait(
+      LockWaitCell("test_lock")->GetDistribution());
+  EXPECT_EQ(2U, wait.Count());
+  // Most of the 50ms were spent waiting by the second holder.
+  EXPECT_GE(wait.sum, 10000);
+  const Metric::Distribution hold(
+      LockHoldCell("test_lock")->GetDistribution());
+  EXPECT_EQ(2U, hold.Count());
+  EXPECT_GE(hold.sum, 50000);
+}
+
+
+TEST(InstrumentedMutexTest, WorksWithConditionVariables) {
+  InstrumentedMutex<> mutex("test_cv_lock");
+  std::condition_variable_any cv;
+  bool ready(false);
+  std::thread notifier([&mutex, &cv, &ready]() {
+    std::lock_guard<InstrumentedMutex<>> lock(mutex);
+    ready = true;
+    cv.notify_all();
+  });
+  {
+    std::unique_lock<InstrumentedMutex<>> lock(mutex);
+    cv.wait(lock, [&ready]() { return ready; });
+  }
+  notifier.join();
+  EXPECT_LE(2U, LockHoldCell("test_cv_lock")->GetDistribution().Count());
+}
+
+
+TEST(InstrumentedMutexTest, SharedHoldsRecordWaitOnly) {
+  InstrumentedMutex<RwMutex> mutex("test_rw_lock");
+  { BasicReaderLock<InstrumentedMutex<RwMutex>> lock(&mutex); }
+  EXPECT_EQ(1U, LockWaitCell("test_rw_lock")->GetDistribution().Count());
+  EXPECT_EQ(0U, LockHoldCell("test_rw_lock")->GetDistribution().Count());
+}
+
+
+}  // namespace
+}  // namespace cert_trans
+
+
+int main(int argc, char** argv) {
+  cert_trans::test::InitTesting(argv[0], &argc, &argv, true);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,36 @@
+#include "config.h"
+#include "monitoring/labelled_values.h"
+
+#include <stdint.h>
+
+namespace cert_trans {
+
+namespace {
+
+
+// Not a valid index, as there will never be that many threads.
+const size_t kNoShard = SIZE_MAX;
+
+std::atomic<size_t> next_shard(0);
+
+#ifdef HAVE_THREAD_LOCAL
+thread_local size_t thread_shard = kNoShard;
+#elif HAVE___THREAD
+__thread size_t thread_shard = kNoShard;
+#else
+#error No suitable thread local storage available
+#endif
+
+
+}  // namespace
+
+
+size_t ThreadShardIndex() {
+  if (thread_shard == kNoShard) {
+    thread_shard = next_shard.fetch_add(1, std::memory_order_relaxed);
+  }
+  return thread_shard;
+}
+
+
+}  // namespace cert_trans
@@ -1,16 +1,113 @@
 #ifndef CERT_TRANS_MONITORING_LABELLED_VALUES_H_
 #define CERT_TRANS_MONITORING_LABELLED_VALUES_H_
 
+#include <atomic>
 #include <chrono>
 #include <glog/logging.h>
 #include <map>
+#include <memory>
 #include <mutex>
+#include <tuple>
+#include <utility>
+#include <vector>
 
 #include "monitoring/metric.h"
 
 namespace cert_trans {
 
 
+// A number that stays the same for the calling thread, and differs
+// between threads started one after the other, for picking a shard.
+size_t ThreadShardIndex();
+
+
+// The value for one combination of labels, as returned by
+// LabelledValues<>::GetCell(), which can be updated without looking
+// up the labels or taking a lock. Thread-safe.
+//
+// The value is split in shards, each on its own cache line, so that
+// threads incrementing the same cell do not contend with each other;
+// they are only added up when read. Likewise, updates only flag the
+// cell, and the time of the update is taken when it is next read by
+// GetTimestamped().
+class LabelledValueCell {
+ public:
+  void Increment() {
+    IncrementBy(1);
+  }
+
+  void IncrementBy(double amount) {
+    std::atomic<double>& shard(
+        shards_[ThreadShardIndex() % kNumShards].value);
+    double value(shard.load(std::memory_order_relaxed));
+    while (!shard.compare_exchange_weak(value, value + amount,
+                                        std::memory_order_relaxed)) {
+    }
+    Touch();
+  }
+
+  // Increments concurrent with this may be lost.
+  void Set(double value) {
+    shards_[0].value.store(value, std::memory_order_relaxed);
+    for (size_t i = 1; i < kNumShards; ++i) {
+      shards_[i].value.store(0, std::memory_order_relaxed);
+    }
+    Touch();
+  }
+
+  double Get() const {
+    double value(0);
+    for (const auto& shard : shards_) {
+      value += shard.value.load(std::memory_order_relaxed);
+    }
+    return value;
+  }
+
+  Metric::TimestampedValue GetTimestamped() const {
+    if (updated_since_read_.load(std::memory_order_relaxed) &&
+        updated_since_read_.exchange(false, std::memory_order_relaxed)) {
+      updated_.store(
+          std::chrono::system_clock::now().time_since_epoch().count(),
+          std::memory_order_relaxed);
+    }
+    return make_pair(std::chrono::system_clock::time_point(
+                         std::chrono::system_clock::duration(
+                             updated_.load(std::memory_order_relaxed))),
+                     Get());
+  }
+
+ private:
+  template <class... LabelTypes>
+  friend class LabelledValues;
+
+  static const size_t kNumShards = 16;
+
+  struct Shard {
+    std::atomic<double> value;
+    char padding[64 - sizeof(std::atomic<double>)];
+  };
+
+  LabelledValueCell() : updated_since_read_(false), updated_(0) {
+    for (auto& shard : shards_) {
+      shard.value.store(0, std::memory_order_relaxed);
+    }
+  }
+
+  void Touch() {
+    // Only write the flag if needed, to keep its cache line shared.
+    if (!updated_since_read_.load(std::memory_order_relaxed)) {
+      updated_since_read_.store(true, std::memory_order_relaxed);
+    }
+  }
+
+  Shard shards_[kNumShards];
+  mutable std::atomic<bool> updated_since_read_;
+  mutable std::atomic<std::chrono::system_clock::rep> updated_;
+
+  DISALLOW_COPY_AND_ASSIGN(LabelledValueCell);
+};
+
+
 template <class... LabelTypes>
 class LabelledValues {
  public:
@@ -25,15 +122,25 @@ class LabelledValues {
 
   void IncrementBy(const LabelTypes&..., double value);
 
+  // The value for |labels|, which is then updated through the
+  // returned cell, as Set() and Increment() do after looking it up.
+  // The cell is owned by this instance.
+  LabelledValueCell* GetCell(const LabelTypes&... labels);
+
   std::map<std::vector<std::string>, Metric::TimestampedValue> CurrentValues()
       const;
 
+  // Only holds the lock while listing the cells, and not while reading
+  // them or calling |value_cb|.
+  void ForEachValue(const Metric::ValueCallback& value_cb) const;
+
  private:
   const std::string name_;
   const std::vector<std::string> label_names_;
+  // Only held to look up (or add) the cells, which are never removed.
   mutable std::mutex mutex_;
-  std::map<std::tuple<LabelTypes...>,
-           std::pair<std::chrono::system_clock::time_point, double>> values_;
+  std::map<std::tuple<LabelTypes...>, std::unique_ptr<LabelledValueCell>>
+      cells_;
 
   DISALLOW_COPY_AND_ASSIGN(LabelledValues);
 };
@@ -81,22 +188,23 @@ LabelledValues<LabelTypes...>::LabelledValues(
 
 template <class... LabelTypes>
 double LabelledValues<LabelTypes...>::Get(const LabelTypes&... labels) const {
-  std::lock_guard<std::mutex> lock(mutex_);
-  const std::tuple<LabelTypes...> key(labels...);
-  const auto it(values_.find(key));
-  if (it == values_.end()) {
-    return 0;
+  const LabelledValueCell* cell;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    const auto it(cells_.find(std::tuple<LabelTypes...>(labels...)));
+    if (it == cells_.end()) {
+      return 0;
+    }
+    cell = it->second.get();
   }
-  return it->second.second;
+  return cell->Get();
 }
 
 
 template <class... LabelTypes>
 void LabelledValues<LabelTypes...>::Set(const LabelTypes&... labels,
                                         double value) {
-  std::lock_guard<std::mutex> lock(mutex_);
-  values_[std::tuple<LabelTypes...>(labels...)] =
-      make_pair(std::chrono::system_clock::now(), value);
+  GetCell(labels...)->Set(value);
 }
 
 
@@ -109,31 +217,61 @@ void LabelledValues<LabelTypes...>::Increment(const LabelTypes&... labels) {
 template <class... LabelTypes>
 void LabelledValues<LabelTypes...>::IncrementBy(const LabelTypes&... labels,
                                                 double amount) {
+  GetCell(labels...)->IncrementBy(amount);
+}
+
+
+template <class... LabelTypes>
+LabelledValueCell* LabelledValues<LabelTypes...>::GetCell(
+    const LabelTypes&... labels) {
   std::lock_guard<std::mutex> lock(mutex_);
-  const std::tuple<LabelTypes...> key(labels...);
-  const auto it(values_.find(key));
-  if (it == values_.end()) {
-    values_[key] = make_pair(std::chrono::system_clock::now(), amount);
-    return;
+  std::unique_ptr<LabelledValueCell>& cell(
+      cells_[std::tuple<LabelTypes...>(labels...)]);
+  if (!cell) {
+    // Not reported until it is first updated.
+    cell.reset(new LabelledValueCell);
   }
-  values_[key] = make_pair(std::chrono::system_clock::now(),
-                           values_[key].second + amount);
+  return cell.get();
 }
 
 
 template <class... LabelTypes>
 std::map<std::vector<std::string>, Metric::TimestampedValue>
 LabelledValues<LabelTypes...>::CurrentValues() const {
-  std::lock_guard<std::mutex> lock(mutex_);
   std::map<std::vector<std::string>, Metric::TimestampedValue> ret;
-
-  for (const auto& v : values_) {
-    ret[label_values(v.first)] = v.second;
-  }
+  ForEachValue([&ret](const std::vector<std::string>& labels,
+                      const Metric::TimestampedValue& value) {
+    ret[labels] = value;
+  });
   return ret;
 }
 
 
+template <class... LabelTypes>
+void LabelledValues<LabelTypes...>::ForEachValue(
+    const Metric::ValueCallback& value_cb) const {
+  // The keys and cells stay where they are once added, so they can be
+  // read without the lock, which writers might need to add theirs.
+  std::vector<std::pair<const std::tuple<LabelTypes...>*,
+                        const LabelledValueCell*>> cells;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    cells.reserve(cells_.size());
+    for (const auto& c : cells_) {
+      cells.emplace_back(&c.first, c.second.get());
+    }
+  }
+
+  for (const auto& c : cells) {
+    const Metric::TimestampedValue value(c.second->GetTimestamped());
+    // Cells that were never updated do not exist yet, as far as the
+    // exporters are concerned.
+    if (value.first != std::chrono::system_clock::time_point()) {
+      value_cb(label_values(*c.first), value);
+    }
+  }
+}
+
 }  // namespace cert_trans
 
 #endif  // CERT_TRANS_MONITORING_LABELLED_VALUES_H_
@@ -1,11 +1,11 @@
 #ifndef CERT_TRANS_MONITORING_LATENCY_H_
 #define CERT_TRANS_MONITORING_LATENCY_H_
 
+#include <memory>
 #include <string>
 
 #include "base/macros.h"
-#include "monitoring/counter.h"
-#include "monitoring/event_metric.h"
+#include "monitoring/histogram.h"
 #include "monitoring/monitoring.h"
 
 namespace cert_trans {
@@ -14,10 +14,9 @@ class ScopedLatency;
 
 
 // A helper class for monitoring latency.
-// This class creates two Counter metrics, one called "|base_name|_overall_sum"
-// which contains the sum of all latencies broken down by labels, and another
-// called "|base_name|_count" which contains the number of latency measurements
-// taken, also broken down by labels.
+// This class creates a Histogram metric called |base_name|, which contains
+// the distribution of the latencies broken down by labels, exported with
+// their sum and count, so that both averages and quantiles can be computed.
 //
 // To actually measure latency, you can either call RecordLatency() directly
 // with a latency sample, or use the ScopedLatency() method to return an object
@@ -35,7 +34,7 @@ class ScopedLatency;
 // Example usage:
 //
 //   static Latency<std::chrono::milliseconds, std::string> latency_by_name(
-//      "latency_by_name", "name");
+//      "latency_by_name", "name", "help");
 //   ...
 //
 //   void DoStuffForName(const string& name) {
@@ -56,6 +55,23 @@ class ScopedLatency;
 template <class TimeUnit, class... LabelTypes>
 class Latency {
  public:
+  // Records the latencies for one combination of labels, without
+  // looking them up, as returned by GetCell().
+  class Cell {
+   public:
+    void RecordLatency(std::chrono::duration<double> latency) const {
+      cell_->Record(std::chrono::duration_cast<TimeUnit>(latency).count());
+    }
+
+   private:
+    friend class Latency;
+
+    explicit Cell(HistogramCell* cell) : cell_(CHECK_NOTNULL(cell)) {
+    }
+
+    HistogramCell* cell_;
+  };
+
   Latency(const std::string& base_name,
           const typename NameType<LabelTypes>::name&... label_names,
           const std::string& help);
@@ -65,8 +81,11 @@ class Latency {
 
   ScopedLatency GetScopedLatency(const LabelTypes&... labels);
 
+  // The returned cell stays valid for as long as this instance.
+  Cell GetCell(const LabelTypes&... labels);
+
  private:
-  EventMetric<LabelTypes...> metric_;
+  const std::unique_ptr<Histogram<LabelTypes...>> metric_;
 
   DISALLOW_COPY_AND_ASSIGN(Latency);
 };
@@ -105,15 +124,15 @@ Latency<TimeUnit, LabelTypes...>::Latency(
     const std::string& base_name,
     const typename NameType<LabelTypes>::name&... label_names,
     const std::string& help)
-    : metric_(base_name, label_names..., help) {
+    : metric_(Histogram<LabelTypes...>::New(base_name, label_names..., help)) {
 }
 
 
 template <class TimeUnit, class... LabelTypes>
 void Latency<TimeUnit, LabelTypes...>::RecordLatency(
     const LabelTypes&... labels, std::chrono::duration<double> latency) {
-  metric_.RecordEvent(labels...,
-                      std::chrono::duration_cast<TimeUnit>(latency).count());
+  metric_->Record(labels...,
+                  std::chrono::duration_cast<TimeUnit>(latency).count());
 }
 
 
@@ -126,6 +145,13 @@ ScopedLatency Latency<TimeUnit, LabelTypes...>::GetScopedLatency(
 }
 
 
+template <class TimeUnit, class... LabelTypes>
+typename Latency<TimeUnit, LabelTypes...>::Cell
+Latency<TimeUnit, LabelTypes...>::GetCell(const LabelTypes&... labels) {
+  return Cell(metric_->GetCell(labels...));
+}
+
+
 }  // namespace cert_trans
 
 
@@ -0,0 +1,70 @@
+#include "monitoring/memory_gauge.h"
+
+#include <map>
+#include <mutex>
+
+#include "monitoring/gauge.h"
+
+using std::lock_guard;
+using std::map;
+using std::mutex;
+using std::string;
+
+namespace cert_trans {
+namespace {
+
+
+Gauge<string>* MemoryBytes() {
+  static Gauge<string>* const gauge(Gauge<string>::New(
+      "memory_bytes", "subsystem",
+      "Estimated memory used by each subsystem, in bytes."));
+  return gauge;
+}
+
+
+mutex* TotalsLock() {
+  static mutex* const lock(new mutex);
+  return lock;
+}
+
+
+// The sums reported on the gauge, guarded by TotalsLock().
+map<string, int64_t>* Totals() {
+  static map<string, int64_t>* const totals(new map<string, int64_t>);
+  return totals;
+}
+
+
+}  // namespace
+
+
+MemoryGauge::MemoryGauge(const string& subsystem)
+    : subsystem_(subsystem), bytes_(0) {
+  // So that the subsystem shows up even before it uses anything.
+  Set(0);
+}
+
+
+MemoryGauge::~MemoryGauge() {
+  Set(0);
+}
+
+
+void MemoryGauge::Set(size_t bytes) {
+  lock_guard<mutex> lock(*TotalsLock());
+  int64_t* const total(&(*Totals())[subsystem_]);
+  *total += static_cast<int64_t>(bytes) - static_cast<int64_t>(bytes_);
+  bytes_ = bytes;
+  MemoryBytes()->Set(subsystem_, *total);
+}
+
+
+// static
+int64_t MemoryGauge::Total(const string& subsystem) {
+  lock_guard<mutex> lock(*TotalsLock());
+  const auto it(Totals()->find(subsystem));
+  return it == Totals()->end() ? 0 : it->second;
+}
+
+
+}  // namespace cert_trans
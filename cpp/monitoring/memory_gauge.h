@@ -0,0 +1,73 @@
+#ifndef CERT_TRANS_MONITORING_MEMORY_GAUGE_H_
+#define CERT_TRANS_MONITORING_MEMORY_GAUGE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+#include "base/macros.h"
+
+namespace cert_trans {
+
+
+// Reports the memory used by one instance of a subsystem (such as
+// the in-memory Merkle tree of a LogLookup), on the "memory_bytes"
+// gauge labelled with the name of the subsystem. The gauge has the
+// sum over all the live instances of the subsystem, so that the
+// memory of a node can be attributed even when it serves several
+// logs.
+//
+// This class is thread-safe.
+class MemoryGauge {
+ public:
+  explicit MemoryGauge(const std::string& subsystem);
+  // Takes back the memory this instance reported.
+  ~MemoryGauge();
+
+  // Reports that this instance now uses |bytes|.
+  void Set(size_t bytes);
+
+  // The memory reported by all the instances for |subsystem|.
+  static int64_t Total(const std::string& subsystem);
+
+ private:
+  const std::string subsystem_;
+  // Protected by the lock of the totals.
+  size_t bytes_;
+
+  DISALLOW_COPY_AND_ASSIGN(MemoryGauge);
+};
+
+
+// Rough estimates of the memory used by the standard containers, as
+// laid out by the usual 64-bit implementations, each element of which
+// also owns |heap_bytes| out of line (such as the contents of a
+// string too long to be stored in it).
+template <class Container>
+size_t OrderedContainerBytes(const Container& container, size_t heap_bytes) {
+  // A red-black tree node has three pointers and its color.
+  return container.size() * (sizeof(typename Container::value_type) +
+                             4 * sizeof(void*) + heap_bytes);
+}
+
+
+template <class Container>
+size_t UnorderedContainerBytes(const Container& container,
+                               size_t heap_bytes) {
+  // A node has a pointer to the next one and the cached hash.
+  return container.size() * (sizeof(typename Container::value_type) +
+                             2 * sizeof(void*) + heap_bytes) +
+         container.bucket_count() * sizeof(void*);
+}
+
+
+// The memory a string of |size| characters owns out of line.
+inline size_t StringHeapBytes(size_t size) {
+  // Up to 15 characters are stored in the string itself.
+  return size < 16 ? 0 : size + 1;
+}
+
+
+}  // namespace cert_trans
+
+#endif  // CERT_TRANS_MONITORING_MEMORY_GAUGE_H_
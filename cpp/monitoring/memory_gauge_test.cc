@@ -0,0 +1,69 @@
+#include "monitoring/memory_gauge.h"
+
+#include <gtest/gtest.h>
+#include <set>
+#include <string>
+#include <unordered_map>
+
+#include "util/testing.h"
+
+namespace cert_trans {
+namespace {
+
+using std::string;
+
+
+TEST(MemoryGaugeTest, SumsInstances) {
+  MemoryGauge first("test_sums");
+  EXPECT_EQ(0, MemoryGauge::Total("test_sums"));
+  first.Set(100);
+  {
+    MemoryGauge second("test_sums");
+    second.Set(50);
+    EXPECT_EQ(150, MemoryGauge::Total("test_sums"));
+    first.Set(10);
+    EXPECT_EQ(60, MemoryGauge::Total("test_sums"));
+  }
+  // The second one is gone.
+  EXPECT_EQ(10, MemoryGauge::Total("test_sums"));
+}
+
+
+TEST(MemoryGaugeTest, SubsystemsAreSeparate) {
+  MemoryGauge first("test_first");
+  MemoryGauge second("test_second");
+  first.Set(1);
+  second.Set(2);
+  EXPECT_EQ(1, MemoryGauge::Total("test_first"));
+  EXPECT_EQ(2, MemoryGauge::Total("test_second"));
+  EXPECT_EQ(0, MemoryGauge::Total("test_unknown"));
+}
+
+
+TEST(MemoryGaugeTest, ContainerEstimates) {
+  std::set<int64_t> ordered;
+  EXPECT_EQ(0U, OrderedContainerBytes(ordered, 0));
+  ordered.insert(1);
+  ordered.insert(2);
+  EXPECT_LT(2 * sizeof(int64_t), OrderedContainerBytes(ordered, 0));
+  EXPECT_EQ(OrderedContainerBytes(ordered, 0) + 2 * 33,
+            OrderedContainerBytes(ordered, 33));
+
+  std::unordered_map<string, int64_t> unordered;
+  unordered["a"] = 1;
+  EXPECT_LT(sizeof(std::pair<const string, int64_t>),
+            UnorderedContainerBytes(unordered, 0));
+
+  EXPECT_EQ(0U, StringHeapBytes(15));
+  EXPECT_EQ(33U, StringHeapBytes(32));
+}
+
+
+}  // namespace
+}  // namespace cert_trans
+
+
+int main(int argc, char** argv) {
+  cert_trans::test::InitTesting(argv[0], &argc, &argv, true);
+  return RUN_ALL_TESTS();
+}
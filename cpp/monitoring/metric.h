@@ -1,9 +1,12 @@
 #ifndef CERT_TRANS_MONITORING_METRIC_H_
 #define CERT_TRANS_MONITORING_METRIC_H_
 
+#include <chrono>
+#include <functional>
 #include <map>
 #include <ostream>
 #include <set>
+#include <stdint.h>
 #include <string>
 #include <vector>
 
@@ -27,9 +30,41 @@ class Metric {
   typedef std::pair<std::chrono::system_clock::time_point, double>
       TimestampedValue;
 
+  // The values recorded by a HISTOGRAM metric, for one combination of
+  // labels.
+  struct Distribution {
+    Distribution() : sum(0) {
+    }
+
+    // The number of values recorded.
+    uint64_t Count() const;
+
+    // Adds the values of |other|, which has the same buckets.
+    void Merge(const Distribution& other);
+
+    // The inclusive upper bounds of the buckets, in increasing order,
+    // but for the last bucket which has none.
+    std::vector<double> upper_bounds;
+    // The number of values in each bucket, one more than there are
+    // |upper_bounds|.
+    std::vector<uint64_t> counts;
+    double sum;
+  };
+
+  typedef std::pair<std::chrono::system_clock::time_point, Distribution>
+      TimestampedDistribution;
+
+  typedef std::function<void(const std::vector<std::string>& labels,
+                             const TimestampedValue& value)>
+      ValueCallback;
+  typedef std::function<void(const std::vector<std::string>& labels,
+                             const TimestampedDistribution& distribution)>
+      DistributionCallback;
+
   enum Type {
     COUNTER,
     GAUGE,
+    HISTOGRAM,
   };
 
   Type Type() const {
@@ -66,6 +101,31 @@ class Metric {
   virtual std::map<std::vector<std::string>, TimestampedValue> CurrentValues()
       const = 0;
 
+  // For HISTOGRAM metrics, the distribution for each combination of
+  // labels, whose counts CurrentValues() returns.
+  virtual std::map<std::vector<std::string>, TimestampedDistribution>
+  CurrentDistributions() const {
+    return std::map<std::vector<std::string>, TimestampedDistribution>();
+  }
+
+  // Calls |value_cb| with each of the values CurrentValues() returns,
+  // in no particular order, without copying them all first. The
+  // metric types override this to read their values without holding
+  // up updates meanwhile; |value_cb| must not update this metric.
+  virtual void ForEachValue(const ValueCallback& value_cb) const {
+    for (const auto& it : CurrentValues()) {
+      value_cb(it.first, it.second);
+    }
+  }
+
+  // As ForEachValue(), for the distributions of a HISTOGRAM metric.
+  virtual void ForEachDistribution(
+      const DistributionCallback& distribution_cb) const {
+    for (const auto& it : CurrentDistributions()) {
+      distribution_cb(it.first, it.second);
+    }
+  }
+
  protected:
   Metric(enum Type type, const std::string& name,
          const std::vector<std::string>& label_names, const std::string& help)
@@ -5,6 +5,7 @@
 
 #include "monitoring/counter.h"
 #include "monitoring/gauge.h"
+#include "monitoring/histogram.h"
 
 DECLARE_string(monitoring);
 
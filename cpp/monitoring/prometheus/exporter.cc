@@ -1,4 +1,10 @@
 #include "monitoring/prometheus/exporter.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <sstream>
+
 #include "monitoring/prometheus/metrics.pb.h"
 #include "monitoring/metric.h"
 #include "monitoring/registry.h"
@@ -6,6 +12,8 @@
 using std::chrono::duration_cast;
 using std::chrono::milliseconds;
 using std::map;
+using std::ostream;
+using std::ostringstream;
 using std::set;
 using std::string;
 using std::vector;
@@ -26,6 +34,35 @@ void AddLabelTypes(::io::prometheus::client::Metric* metric,
 }
 
 
+void PopulateHistograms(const Metric& metric,
+                        ::io::prometheus::client::MetricFamily* family) {
+  const vector<string>& label_names(metric.LabelNames());
+  metric.ForEachDistribution([family, &label_names](
+      const vector<string>& labels,
+      const Metric::TimestampedDistribution& value) {
+    io::prometheus::client::Metric* m(family->add_metric());
+    AddLabelTypes(m, label_names, labels);
+    m->set_timestamp_ms(
+        duration_cast<milliseconds>(value.first.time_since_epoch()).count());
+
+    const Metric::Distribution& distribution(value.second);
+    io::prometheus::client::Histogram* const histogram(
+        m->mutable_histogram());
+    uint64_t cumulative_count(0);
+    for (size_t i(0); i < distribution.upper_bounds.size(); ++i) {
+      cumulative_count += distribution.counts[i];
+      io::prometheus::client::Bucket* const bucket(histogram->add_bucket());
+      bucket->set_cumulative_count(cumulative_count);
+      bucket->set_upper_bound(distribution.upper_bounds[i]);
+    }
+    // The +Inf bucket is implied by the count.
+    histogram->set_sample_count(cumulative_count +
+                                distribution.counts.back());
+    histogram->set_sample_sum(distribution.sum);
+  });
+}
+
+
 ::io::prometheus::client::MetricFamily PopulateMetricFamily(
     const Metric& metric) {
   ::io::prometheus::client::MetricFamily family;
@@ -38,34 +75,162 @@ void AddLabelTypes(::io::prometheus::client::Metric* metric,
     case Metric::GAUGE:
       family.set_type(io::prometheus::client::MetricType::GAUGE);
       break;
+    case Metric::HISTOGRAM:
+      family.set_type(io::prometheus::client::MetricType::HISTOGRAM);
+      PopulateHistograms(metric, &family);
+      return family;
     default:
       LOG(FATAL) << "Unknown metric type: " << metric.Type();
   }
-  const map<vector<string>, Metric::TimestampedValue> values(
-      metric.CurrentValues());
-  const vector<string> label_names(metric.LabelNames());
-  for (auto it(values.begin()); it != values.end(); ++it) {
+  const vector<string>& label_names(metric.LabelNames());
+  metric.ForEachValue([&metric, &family, &label_names](
+      const vector<string>& labels, const Metric::TimestampedValue& value) {
     io::prometheus::client::Metric* m(family.add_metric());
-    AddLabelTypes(m, label_names, it->first);
+    AddLabelTypes(m, label_names, labels);
     m->set_timestamp_ms(
-        duration_cast<milliseconds>(it->second.first.time_since_epoch())
-            .count());
+        duration_cast<milliseconds>(value.first.time_since_epoch()).count());
     switch (metric.Type()) {
       case Metric::COUNTER:
-        m->mutable_counter()->set_value(it->second.second);
+        m->mutable_counter()->set_value(value.second);
         break;
       case Metric::GAUGE:
-        m->mutable_gauge()->set_value(it->second.second);
+        m->mutable_gauge()->set_value(value.second);
         break;
       default:
         LOG(FATAL) << "Unknown metric type: " << metric.Type();
     }
-  }
+  });
 
   return family;
 }
 
 
+// Escapes |value| for the text format: backslashes and newlines, and
+// also double quotes in label values.
+void WriteEscaped(const string& value, bool escape_quotes, ostream* os) {
+  for (const char c : value) {
+    switch (c) {
+      case '\\':
+        *os << "\\\\";
+        break;
+      case '\n':
+        *os << "\\n";
+        break;
+      case '"':
+        *os << (escape_quotes ? "\\\"" : "\"");
+        break;
+      default:
+        *os << c;
+    }
+  }
+}
+
+
+// Writes |value| with as many digits as needed to read it back, but
+// no more, so that counts stay integers.
+void WriteNumber(double value, ostream* os) {
+  if (std::isnan(value)) {
+    *os << "NaN";
+  } else if (std::isinf(value)) {
+    *os << (value > 0 ? "+Inf" : "-Inf");
+  } else {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%.15g", value);
+    if (strtod(buf, nullptr) != value) {
+      snprintf(buf, sizeof(buf), "%.17g", value);
+    }
+    *os << buf;
+  }
+}
+
+
+// Writes the {name="value",...} part of a sample, with the |extra|
+// label (e.g. le="0.5") if not empty.
+void WriteLabels(const vector<string>& names, const vector<string>& values,
+                 const string& extra, ostream* os) {
+  CHECK_EQ(names.size(), values.size());
+  if (names.empty() && extra.empty()) {
+    return;
+  }
+  *os << '{';
+  for (size_t i(0); i < names.size(); ++i) {
+    *os << (i > 0 ? "," : "") << names[i] << "=\"";
+    WriteEscaped(values[i], true, os);
+    *os << '"';
+  }
+  if (!extra.empty()) {
+    *os << (names.empty() ? "" : ",") << extra;
+  }
+  *os << '}';
+}
+
+
+void WriteSample(const string& name, const vector<string>& label_names,
+                 const vector<string>& labels, const string& extra_label,
+                 double value, int64_t timestamp_ms, ostream* os) {
+  *os << name;
+  WriteLabels(label_names, labels, extra_label, os);
+  *os << ' ';
+  WriteNumber(value, os);
+  *os << ' ' << timestamp_ms << '\n';
+}
+
+
+void WriteTextMetric(const Metric& metric, ostream* os) {
+  const string& name(metric.Name());
+  const vector<string>& label_names(metric.LabelNames());
+  *os << "# HELP " << name << ' ';
+  WriteEscaped(metric.Help(), false, os);
+  *os << "\n# TYPE " << name << ' ';
+
+  switch (metric.Type()) {
+    case Metric::COUNTER:
+    case Metric::GAUGE:
+      *os << (metric.Type() == Metric::COUNTER ? "counter" : "gauge")
+          << '\n';
+      metric.ForEachValue([os, &name, &label_names](
+          const vector<string>& labels, const Metric::TimestampedValue& value) {
+        WriteSample(name, label_names, labels, "", value.second,
+                    duration_cast<milliseconds>(
+                        value.first.time_since_epoch()).count(),
+                    os);
+      });
+      break;
+    case Metric::HISTOGRAM:
+      *os << "histogram\n";
+      metric.ForEachDistribution([os, &name, &label_names](
+          const vector<string>& labels,
+          const Metric::TimestampedDistribution& value) {
+        const Metric::Distribution& distribution(value.second);
+        const int64_t timestamp_ms(
+            duration_cast<milliseconds>(value.first.time_since_epoch())
+                .count());
+        ostringstream bound;
+        uint64_t cumulative_count(0);
+        for (size_t i(0); i < distribution.upper_bounds.size(); ++i) {
+          cumulative_count += distribution.counts[i];
+          bound.str("");
+          bound << "le=\"";
+          WriteNumber(distribution.upper_bounds[i], &bound);
+          bound << '"';
+          WriteSample(name + "_bucket", label_names, labels, bound.str(),
+                      cumulative_count, timestamp_ms, os);
+        }
+        cumulative_count += distribution.counts.back();
+        WriteSample(name + "_bucket", label_names, labels, "le=\"+Inf\"",
+                    cumulative_count, timestamp_ms, os);
+        WriteSample(name + "_sum", label_names, labels, "", distribution.sum,
+                    timestamp_ms, os);
+        WriteSample(name + "_count", label_names, labels, "",
+                    cumulative_count, timestamp_ms, os);
+      });
+      break;
+    default:
+      LOG(FATAL) << "Unknown metric type: " << metric.Type();
+  }
+}
+
+
 }  // namespace
 
 void ExportMetricsToPrometheus(std::ostream* os) {
@@ -79,6 +244,15 @@ void ExportMetricsToPrometheus(std::ostream* os) {
 }
 
 
+void ExportMetricsToPrometheusText(std::ostream* os) {
+  const set<const Metric*> metrics(Registry::Instance()->GetMetrics());
+
+  for (const auto* metric : metrics) {
+    WriteTextMetric(*metric, CHECK_NOTNULL(os));
+  }
+}
+
+
 void ExportMetricsToHtml(std::ostream* os) {
   const set<const Metric*> metrics(Registry::Instance()->GetMetrics());
   *os << "<html>\n"
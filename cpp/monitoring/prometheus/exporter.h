@@ -10,6 +10,11 @@ namespace cert_trans {
 void ExportMetricsToPrometheus(std::ostream* os);
 
 
+// Writes the metrics in the Prometheus text exposition format, reading
+// each one as it goes rather than building the whole reply first.
+void ExportMetricsToPrometheusText(std::ostream* os);
+
+
 void ExportMetricsToHtml(std::ostream* os);
 
 
@@ -0,0 +1,87 @@
+#include "monitoring/prometheus/exporter.h"
+
+#include <gtest/gtest.h>
+#include <memory>
+#include <sstream>
+#include <string>
+
+#include "monitoring/monitoring.h"
+#include "monitoring/registry.h"
+#include "util/testing.h"
+
+namespace cert_trans {
+
+using std::ostringstream;
+using std::string;
+using std::unique_ptr;
+
+
+class PrometheusExporterTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    Registry::Instance()->ResetForTestingOnly();
+  }
+
+  static string ExportText() {
+    ostringstream oss;
+    ExportMetricsToPrometheusText(&oss);
+    return oss.str();
+  }
+};
+
+
+TEST_F(PrometheusExporterTest, TestCounter) {
+  unique_ptr<Counter<string>> counter(
+      Counter<string>::New("requests", "path", "Requests\nserved."));
+  counter->IncrementBy("/a\"b", 1234567);
+
+  const string text(ExportText());
+  EXPECT_EQ(0U, text.find("# HELP requests Requests\\nserved.\n"
+                          "# TYPE requests counter\n"
+                          "requests{path=\"/a\\\"b\"} 1234567 "))
+      << text;
+}
+
+
+TEST_F(PrometheusExporterTest, TestGaugeWithoutValues) {
+  unique_ptr<Gauge<>> gauge(Gauge<>::New("temperature", "Degrees."));
+
+  EXPECT_EQ("# HELP temperature Degrees.\n# TYPE temperature gauge\n",
+            ExportText());
+  gauge->Set(0.1);
+  const string text(ExportText());
+  EXPECT_NE(string::npos, text.find("\ntemperature 0.1 ")) << text;
+}
+
+
+TEST_F(PrometheusExporterTest, TestHistogram) {
+  unique_ptr<Histogram<string>> histogram(
+      Histogram<string>::New("latency", "op", "Latency."));
+  histogram->Record("get", 1);
+  histogram->Record("get", 1.1);
+  histogram->Record("get", 1e9);
+
+  const string text(ExportText());
+  EXPECT_NE(string::npos, text.find("# TYPE latency histogram\n")) << text;
+  EXPECT_NE(string::npos, text.find("\nlatency_bucket{op=\"get\",le=\"1\"} 1 "))
+      << text;
+  EXPECT_NE(string::npos,
+            text.find("\nlatency_bucket{op=\"get\",le=\"1.25\"} 2 "))
+      << text;
+  EXPECT_NE(string::npos,
+            text.find("\nlatency_bucket{op=\"get\",le=\"+Inf\"} 3 "))
+      << text;
+  EXPECT_NE(string::npos, text.find("\nlatency_sum{op=\"get\"} 1000000002.1 "))
+      << text;
+  EXPECT_NE(string::npos, text.find("\nlatency_count{op=\"get\"} 3 "))
+      << text;
+}
+
+
+}  // namespace cert_trans
+
+
+int main(int argc, char** argv) {
+  cert_trans::test::InitTesting(argv[0], &argc, &argv, true);
+  return RUN_ALL_TESTS();
+}
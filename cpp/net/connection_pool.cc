@@ -5,6 +5,7 @@
 #include <gflags/gflags.h>
 #include <glog/logging.h>
 
+#include "monitoring/latency.h"
 #include "monitoring/monitoring.h"
 #include "util/openssl_util.h"
 
@@ -16,7 +17,9 @@ extern "C" {
 
 using std::bind;
 using std::chrono::duration_cast;
+using std::chrono::milliseconds;
 using std::chrono::seconds;
+using std::chrono::steady_clock;
 using std::chrono::system_clock;
 using std::lock_guard;
 using std::make_pair;
@@ -63,6 +66,16 @@ static Gauge<string>* connections_per_host_port(
                        "Number of cached connections port host:port"));
 
 
+static Latency<milliseconds, string> connection_pool_connect_latency_ms(
+    "connection_pool_connect_latency_ms", "host_port",
+    "Latency of establishing new TLS connections until their handshake "
+    "starts, in ms");
+static Latency<milliseconds, string> connection_pool_handshake_latency_ms(
+    "connection_pool_handshake_latency_ms", "handshake",
+    "Latency of the TLS handshakes of new connections in ms, broken down "
+    "by whether they were full or resumed a session");
+
+
 string HostPortString(const HostPortPair& pair) {
   return pair.first + ":" + to_string(pair.second);
 }
@@ -134,6 +147,34 @@ int ConnectionPool::Connection::SSLVerifyCallback(const int preverify_ok,
 }
 
 
+// static
+void ConnectionPool::Connection::SSLInfoCallback(const SSL* ssl, int where,
+                                                 int) {
+  CHECK_NOTNULL(ssl);
+  if (!(where & (SSL_CB_HANDSHAKE_START | SSL_CB_HANDSHAKE_DONE))) {
+    return;
+  }
+  ConnectionPool::Connection* const conn(
+      CHECK_NOTNULL(static_cast<ConnectionPool::Connection*>(
+          SSL_get_ex_data(ssl, GetSSLConnectionIndex()))));
+  const steady_clock::time_point now(steady_clock::now());
+
+  if (where & SSL_CB_HANDSHAKE_START) {
+    // Renegotiations start handshakes too, only count the first one.
+    if (conn->handshake_started_ == steady_clock::time_point()) {
+      conn->handshake_started_ = now;
+      connection_pool_connect_latency_ms.RecordLatency(
+          HostPortString(conn->other_end()), now - conn->created_);
+    }
+    return;
+  }
+
+  connection_pool_handshake_latency_ms.RecordLatency(
+      SSL_session_reused(const_cast<SSL*>(ssl)) ? "resumed" : "full",
+      now - conn->handshake_started_);
+}
+
+
 // static
 int ConnectionPool::Connection::GetSSLConnectionIndex() {
   static const int ssl_connection_index(
@@ -143,14 +184,23 @@ int ConnectionPool::Connection::GetSSLConnectionIndex() {
 
 
 ConnectionPool::Connection::Connection(evhtp_connection_t* conn,
-                                       HostPortPair&& other_end)
+                                       HostPortPair&& other_end,
+                                       SSL_SESSION* session)
     : conn_(CHECK_NOTNULL(conn)),
       other_end_(move(other_end)),
+      created_(steady_clock::now()),
       errored_(false) {
   if (conn_->ssl) {
     SSL_set_ex_data(conn_->ssl, GetSSLConnectionIndex(),
                     static_cast<void*>(this));
     SSL_set_tlsext_host_name(conn_->ssl, other_end_.first.c_str());
+    SSL_set_info_callback(conn_->ssl, &SSLInfoCallback);
+    if (session) {
+      CHECK_EQ(SSL_set_session(conn_->ssl, session), 1)
+          << DumpOpenSSLErrorStack();
+    }
+  } else {
+    CHECK(!session);
   }
 }
 
@@ -296,11 +346,15 @@ unique_ptr<ConnectionPool::Connection> ConnectionPool::Get(const URL& url) {
 
   if (it == conns_.end() || it->second.empty()) {
     VLOG(1) << "new evhtp_connection for " << key.first << ":" << key.second;
+    const bool https(url.Protocol() == "https");
+    const auto session(sessions_.find(key));
+    SSL_SESSION* const resume(
+        https && session != sessions_.end() ? session->second.get() : nullptr);
     unique_ptr<ConnectionPool::Connection> conn(new Connection(
-        url.Protocol() == "https"
+        https
             ? base_->HttpsConnectionNew(key.first, key.second, ssl_ctx_.get())
             : base_->HttpConnectionNew(key.first, key.second),
-        move(key)));
+        move(key), resume));
     struct timeval read_timeout = {FLAGS_connection_read_timeout_seconds,
                                    kZeroMillis};
     struct timeval write_timeout = {FLAGS_connection_write_timeout_seconds,
@@ -346,7 +400,19 @@ void ConnectionPool::Put(unique_ptr<ConnectionPool::Connection>&& conn) {
 
   const HostPortPair& key(conn->other_end());
   VLOG(1) << "returned Connection for " << key.first << ":" << key.second;
+  SSL* const ssl(conn->connection()->ssl);
+  SessionPtr session(ssl && SSL_is_init_finished(ssl) ? SSL_get1_session(ssl)
+                                                      : nullptr,
+                     SSL_SESSION_free);
   lock_guard<mutex> lock(lock_);
+  if (session) {
+    auto it(sessions_.find(key));
+    if (it == sessions_.end()) {
+      sessions_.emplace(key, move(session));
+    } else {
+      it->second = move(session);
+    }
+  }
   auto& entry(conns_[key]);
 
   CHECK_GE(FLAGS_url_fetcher_max_conn_per_host_port, 0);
@@ -1,6 +1,7 @@
 #ifndef CERT_TRANS_NET_CONNECTION_POOL_H_
 #define CERT_TRANS_NET_CONNECTION_POOL_H_
 
+#include <chrono>
 #include <deque>
 #include <map>
 #include <memory>
@@ -55,10 +56,14 @@ class ConnectionPool {
     static evhtp_res ConnectionErrorHook(evhtp_connection_t* conn,
                                          evhtp_error_flags errtype, void* arg);
     static int SSLVerifyCallback(int preverify_ok, X509_STORE_CTX* x509_ctx);
+    static void SSLInfoCallback(const SSL* ssl, int where, int ret);
 
     static int GetSSLConnectionIndex();
 
-    Connection(evhtp_connection_t* conn, HostPortPair&& other_end);
+    // If |session| is not NULL, it is offered to the server for
+    // resumption, instead of doing a full handshake.
+    Connection(evhtp_connection_t* conn, HostPortPair&& other_end,
+               SSL_SESSION* session);
 
     void SetErrored();
 
@@ -67,6 +72,9 @@ class ConnectionPool {
 
     std::unique_ptr<evhtp_connection_t, evhtp_connection_deleter> conn_;
     const HostPortPair other_end_;
+    // Only used on the event loop, by SSLInfoCallback().
+    const std::chrono::steady_clock::time_point created_;
+    std::chrono::steady_clock::time_point handshake_started_;
 
     mutable std::mutex lock_;
     bool errored_;
@@ -84,6 +92,7 @@ class ConnectionPool {
  private:
   typedef std::pair<std::chrono::system_clock::time_point,
                     std::unique_ptr<Connection>> TimestampedConnection;
+  typedef std::unique_ptr<SSL_SESSION, void (*)(SSL_SESSION*)> SessionPtr;
 
   static void RemoveDeadConnectionsFromDeque(
       const std::unique_lock<std::mutex>& lock,
@@ -97,6 +106,9 @@ class ConnectionPool {
   // We get and put connections from the back of the deque, and when
   // there are too many, we prune them from the front (LIFO).
   std::map<HostPortPair, std::deque<TimestampedConnection>> conns_;
+  // The latest TLS session negotiated with each host:port, so that new
+  // connections to it can resume it rather than do a full handshake.
+  std::map<HostPortPair, SessionPtr> sessions_;
   bool cleanup_scheduled_;
 
   std::unique_ptr<evhtp_ssl_ctx_t, void (*)(evhtp_ssl_ctx_t*)> ssl_ctx_;
@@ -12,6 +12,10 @@ class MockUrlFetcher : public UrlFetcher {
  public:
   MOCK_METHOD3(Fetch,
                void(const Request& req, Response* resp, util::Task* task));
+  MOCK_METHOD5(FetchStreaming,
+               void(const Request& req, Response* resp,
+                    const HeadersCallback& headers_cb,
+                    const BodyCallback& body_cb, util::Task* task));
 };
 
 
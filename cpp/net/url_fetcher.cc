@@ -2,19 +2,25 @@
 
 #include <evhtp.h>
 #include <event2/buffer.h>
+#include <event2/bufferevent.h>
 #include <event2/keyvalq_struct.h>
 #include <glog/logging.h>
 #include <htparse.h>
 
+#include "monitoring/latency.h"
 #include "net/connection_pool.h"
 #include "util/thread_pool.h"
 
 using cert_trans::internal::ConnectionPool;
 using std::bind;
+using std::chrono::milliseconds;
+using std::chrono::steady_clock;
 using std::endl;
 using std::make_pair;
+using std::make_shared;
 using std::move;
 using std::ostream;
+using std::shared_ptr;
 using std::string;
 using std::to_string;
 using std::unique_ptr;
@@ -41,6 +47,12 @@ struct UrlFetcher::Impl {
 namespace {
 
 
+static Latency<milliseconds> url_fetcher_wait_latency_ms(
+    "url_fetcher_wait_latency_ms",
+    "Latency between fetches being started and their request being sent, "
+    "waiting for a thread and a connection, in ms");
+
+
 htp_method VerbToCmdType(UrlFetcher::Verb verb) {
   switch (verb) {
     case UrlFetcher::Verb::GET:
@@ -64,25 +76,48 @@ struct State {
   State(libevent::Base* base, ConnectionPool* pool,
         const UrlFetcher::Request& request, UrlFetcher::Response* response,
         Task* task);
+  // For a streamed response.
+  State(libevent::Base* base, ConnectionPool* pool,
+        const UrlFetcher::Request& request, UrlFetcher::Response* response,
+        const UrlFetcher::HeadersCallback& headers_cb,
+        const UrlFetcher::BodyCallback& body_cb, Task* task);
 
   ~State() {
     CHECK(!conn_) << "request state object still had a connection at cleanup?";
   }
 
   void MakeRequest();
+  void Cancelled();
 
   // The following methods must only be called on the libevent
   // dispatch thread.
   void RunRequest();
+  void AbortRequest();
+  void HeadersReceived(evhtp_request_t* req);
+  void BodyReceived(evbuffer* chunk);
   void RequestDone(evhtp_request_t* req);
 
   libevent::Base* const base_;
   ConnectionPool* const pool_;
   const UrlFetcher::Request request_;
   UrlFetcher::Response* const response_;
+  const UrlFetcher::HeadersCallback headers_cb_;
+  const UrlFetcher::BodyCallback body_cb_;
   Task* const task_;
+  const steady_clock::time_point started_;
 
   unique_ptr<ConnectionPool::Connection> conn_;
+  // Whether the request was sent on |conn_|, only used on the event
+  // loop.
+  bool running_;
+
+  // For a streamed response: whether its headers were received yet,
+  // and the bufferevent it is read from (NULL once it has been read).
+  // The latter is shared with |resume_|, which |body_cb_| may keep
+  // after this is gone.
+  bool headers_received_;
+  const shared_ptr<bufferevent*> reading_bev_;
+  const std::function<void()> resume_;
 };
 
 
@@ -91,6 +126,31 @@ void RequestCallback(evhtp_request_t* req, void* userdata) {
 }
 
 
+evhtp_res HeadersHook(evhtp_request_t* req, evhtp_headers_t*,
+                      void* userdata) {
+  static_cast<State*>(CHECK_NOTNULL(userdata))->HeadersReceived(req);
+  return EVHTP_RES_OK;
+}
+
+
+evhtp_res BodyHook(evhtp_request_t*, evbuffer* chunk, void* userdata) {
+  static_cast<State*>(CHECK_NOTNULL(userdata))->BodyReceived(chunk);
+  return EVHTP_RES_OK;
+}
+
+
+// Resumes reading from |*bev| on the event loop of |base|, unless the
+// response it was reading is over.
+void ResumeReading(libevent::Base* base,
+                   const shared_ptr<bufferevent*>& bev) {
+  base->Add([bev]() {
+    if (*bev) {
+      bufferevent_enable(*bev, EV_READ);
+    }
+  });
+}
+
+
 UrlFetcher::Request NormaliseRequest(UrlFetcher::Request req) {
   if (req.url.Path().empty()) {
     req.url.SetPath("/");
@@ -107,11 +167,29 @@ UrlFetcher::Request NormaliseRequest(UrlFetcher::Request req) {
 State::State(libevent::Base* base, ConnectionPool* pool,
              const UrlFetcher::Request& request,
              UrlFetcher::Response* response, Task* task)
+    : State(base, pool, request, response, UrlFetcher::HeadersCallback(),
+            UrlFetcher::BodyCallback(), task) {
+}
+
+
+State::State(libevent::Base* base, ConnectionPool* pool,
+             const UrlFetcher::Request& request,
+             UrlFetcher::Response* response,
+             const UrlFetcher::HeadersCallback& headers_cb,
+             const UrlFetcher::BodyCallback& body_cb, Task* task)
     : base_(CHECK_NOTNULL(base)),
       pool_(CHECK_NOTNULL(pool)),
       request_(NormaliseRequest(request)),
       response_(CHECK_NOTNULL(response)),
-      task_(CHECK_NOTNULL(task)) {
+      headers_cb_(headers_cb),
+      body_cb_(body_cb),
+      task_(CHECK_NOTNULL(task)),
+      started_(steady_clock::now()),
+      running_(false),
+      headers_received_(false),
+      reading_bev_(make_shared<bufferevent*>(nullptr)),
+      resume_(bind(&ResumeReading, base_, reading_bev_)) {
+  CHECK_EQ(static_cast<bool>(headers_cb_), static_cast<bool>(body_cb_));
   if (request_.url.Protocol() != "http" &&
       request_.url.Protocol() != "https") {
     VLOG(1) << "unsupported protocol: " << request_.url.Protocol();
@@ -120,6 +198,7 @@ State::State(libevent::Base* base, ConnectionPool* pool,
                              request_.url.Protocol()));
     return;
   }
+  task_->WhenCancelled(bind(&State::Cancelled, this));
 }
 
 
@@ -130,10 +209,31 @@ void State::MakeRequest() {
 }
 
 
+void State::Cancelled() {
+  // Released once the request is aborted, on the event loop, where
+  // the connection is used.
+  task_->AddHold();
+  base_->Add(bind(&State::AbortRequest, this));
+}
+
+
 void State::RunRequest() {
   CHECK(libevent::Base::OnEventThread());
+  url_fetcher_wait_latency_ms.RecordLatency(steady_clock::now() - started_);
+  if (task_->CancelRequested()) {
+    pool_->Put(move(conn_));
+    task_->Return(Status::CANCELLED);
+    return;
+  }
+
   evhtp_request_t* const http_req(
       CHECK_NOTNULL(evhtp_request_new(&RequestCallback, this)));
+  if (body_cb_) {
+    evhtp_set_hook(&http_req->hooks, evhtp_hook_on_headers,
+                   reinterpret_cast<evhtp_hook>(&HeadersHook), this);
+    evhtp_set_hook(&http_req->hooks, evhtp_hook_on_read,
+                   reinterpret_cast<evhtp_hook>(&BodyHook), this);
+  }
   if (!request_.body.empty() &&
       request_.headers.find("Content-Length") == request_.headers.end()) {
     evhtp_headers_add_header(
@@ -180,6 +280,50 @@ void State::RunRequest() {
       return;
     }
   }
+
+  if (body_cb_) {
+    *reading_bev_ = conn_->connection()->bev;
+  }
+  running_ = true;
+}
+
+
+void State::AbortRequest() {
+  CHECK(libevent::Base::OnEventThread());
+  // If the request is still in flight, nothing else will be read from
+  // its connection, so it is closed, which also frees the request
+  // without calling RequestCallback().
+  if (running_ && conn_) {
+    VLOG(1) << "aborting request to " << request_.url.Host() << ":"
+            << request_.url.Port();
+    *reading_bev_ = nullptr;
+    conn_.reset();
+    task_->Return(Status::CANCELLED);
+  }
+  task_->RemoveHold();
+}
+
+
+void State::HeadersReceived(evhtp_request_t* req) {
+  CHECK(libevent::Base::OnEventThread());
+  response_->status_code = htparser_get_status(req->conn->parser);
+  response_->headers.clear();
+  for (evhtp_kv_s* ptr = req->headers_in->tqh_first; ptr;
+       ptr = ptr->next.tqe_next) {
+    response_->headers.insert(make_pair(ptr->key, ptr->val));
+  }
+  headers_received_ = true;
+  headers_cb_();
+}
+
+
+void State::BodyReceived(evbuffer* chunk) {
+  CHECK(libevent::Base::OnEventThread());
+  if (!body_cb_(chunk, resume_) && *reading_bev_) {
+    bufferevent_disable(*reading_bev_, EV_READ);
+  }
+  // Whatever is left would be kept in the buffer of the request.
+  evbuffer_drain(chunk, evbuffer_get_length(chunk));
 }
 
 
@@ -193,6 +337,11 @@ struct evhtp_request_deleter {
 void State::RequestDone(evhtp_request_t* req) {
   CHECK(libevent::Base::OnEventThread());
   CHECK(conn_);
+  if (*reading_bev_) {
+    // In case the last piece of the body paused the reading.
+    bufferevent_enable(*reading_bev_, EV_READ);
+    *reading_bev_ = nullptr;
+  }
   this->pool_->Put(move(conn_));
   unique_ptr<evhtp_request_t, evhtp_request_deleter> req_deleter(req);
 
@@ -208,8 +357,8 @@ void State::RequestDone(evhtp_request_t* req) {
     return;
   }
 
-  response_->status_code = req->status;
-  if (response_->status_code < 100) {
+  if (req->status < 100) {
+    response_->status_code = req->status;
     util::Status status;
     switch (response_->status_code) {
       case kTimeout:
@@ -233,6 +382,18 @@ void State::RequestDone(evhtp_request_t* req) {
     return;
   }
 
+  if (body_cb_) {
+    if (!headers_received_) {
+      HeadersReceived(req);
+    }
+    if (evbuffer_get_length(req->buffer_in) > 0) {
+      body_cb_(req->buffer_in, resume_);
+    }
+    task_->Return();
+    return;
+  }
+
+  response_->status_code = req->status;
   response_->headers.clear();
   for (evhtp_kv_s* ptr = req->headers_in->tqh_first; ptr;
        ptr = ptr->next.tqe_next) {
@@ -281,6 +442,20 @@ void UrlFetcher::Fetch(const Request& req, Response* resp, Task* task) {
 }
 
 
+void UrlFetcher::FetchStreaming(const Request& req, Response* resp,
+                                const HeadersCallback& headers_cb,
+                                const BodyCallback& body_cb, Task* task) {
+  CHECK(headers_cb);
+  CHECK(body_cb);
+  TaskHold hold(task);
+
+  State* const state(new State(impl_->base_, &impl_->pool_, req, resp,
+                               headers_cb, body_cb, task));
+  task->DeleteWhenDone(state);
+  impl_->thread_pool_->Add(bind(&State::MakeRequest, state));
+}
+
+
 ostream& operator<<(ostream& output, const UrlFetcher::Response& resp) {
   output << "status_code: " << resp.status_code << endl
          << "headers {" << endl;
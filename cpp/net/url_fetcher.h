@@ -2,6 +2,7 @@
 #define CERT_TRANS_NET_URL_FETCHER_H_
 
 #include <chrono>
+#include <functional>
 #include <map>
 #include <memory>
 #include <string>
@@ -12,6 +13,8 @@
 #include "util/compare.h"
 #include "util/task.h"
 
+struct evbuffer;
+
 namespace cert_trans {
 
 namespace libevent {
@@ -54,6 +57,19 @@ class UrlFetcher {
     std::string body;
   };
 
+  // Called once the status code and headers of a streamed response
+  // are in its Response.
+  typedef std::function<void()> HeadersCallback;
+
+  // Called with each piece of the body of a streamed response as it
+  // arrives, which must be taken out of |chunk|. If it returns false,
+  // reading the rest of the body is paused until |resume| is called,
+  // from any thread, although a few more pieces might still come in
+  // the meantime.
+  typedef std::function<bool(evbuffer* chunk,
+                             const std::function<void()>& resume)>
+      BodyCallback;
+
   UrlFetcher(libevent::Base* base, ThreadPool* thread_pool);
   virtual ~UrlFetcher();
 
@@ -63,6 +79,15 @@ class UrlFetcher {
   // Response::status_code.
   virtual void Fetch(const Request& req, Response* resp, util::Task* task);
 
+  // Same as Fetch(), but passes the body of the response to |body_cb|
+  // as it arrives instead of keeping it in |resp|, after calling
+  // |headers_cb|. The callbacks are called on the event loop. The
+  // task is done once the whole body was received, or the transfer
+  // failed, possibly after some of it was passed on.
+  virtual void FetchStreaming(const Request& req, Response* resp,
+                              const HeadersCallback& headers_cb,
+                              const BodyCallback& body_cb, util::Task* task);
+
  protected:
   UrlFetcher();
 
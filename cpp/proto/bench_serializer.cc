@@ -0,0 +1,224 @@
+#include <chrono>
+#include <functional>
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+
+#include "proto/ct.pb.h"
+#include "proto/serializer.h"
+
+using ct::DigitallySigned;
+using ct::LogEntry;
+using ct::MerkleTreeLeaf;
+using ct::PrecertChainEntry;
+using ct::SignedCertificateTimestamp;
+using ct::SignedCertificateTimestampList;
+using ct::X509ChainEntry;
+using std::function;
+using std::string;
+using std::vector;
+
+DEFINE_string(sizes, "1024,4096",
+              "comma-separated sizes of the certificates, in bytes");
+DEFINE_string(benchmarks, "",
+              "comma-separated names of the benchmarks to run; all of them "
+              "if empty");
+DEFINE_int32(min_time_ms, 500,
+             "minimum time to spend running each benchmark, in milliseconds");
+
+namespace {
+
+
+vector<size_t> ParseSizes(const string& sizes) {
+  vector<size_t> result;
+  std::istringstream in(sizes);
+  string size;
+  while (std::getline(in, size, ',')) {
+    char* end;
+    const unsigned long long value(strtoull(size.c_str(), &end, 10));
+    CHECK(!size.empty() && *end == '\0' && value > 0)
+        << "invalid size: " << size;
+    result.push_back(value);
+  }
+  return result;
+}
+
+
+bool ShouldRun(const string& name) {
+  if (FLAGS_benchmarks.empty()) {
+    return true;
+  }
+  const string benchmarks("," + FLAGS_benchmarks + ",");
+  return benchmarks.find("," + name + ",") != string::npos;
+}
+
+
+// Calls |op| in batches that grow until they are long enough to time
+// accurately, for at least --min_time_ms, and reports the time per
+// call.
+void Run(const string& name, size_t size, const function<void()>& op) {
+  if (!ShouldRun(name)) {
+    return;
+  }
+  const std::chrono::nanoseconds min_time(
+      (std::chrono::milliseconds(FLAGS_min_time_ms)));
+  uint64_t ops(0);
+  std::chrono::nanoseconds elapsed(0);
+  for (uint64_t batch = 1; elapsed < min_time; batch *= 2) {
+    const std::chrono::steady_clock::time_point start(
+        std::chrono::steady_clock::now());
+    for (uint64_t i = 0; i < batch; ++i) {
+      op();
+    }
+    elapsed += std::chrono::steady_clock::now() - start;
+    ops += batch;
+  }
+
+  std::cout << std::left << std::setw(28) << name << std::right
+            << std::setw(10) << size << std::setw(14) << std::fixed
+            << std::setprecision(1)
+            << static_cast<double>(elapsed.count()) / ops << std::endl;
+}
+
+
+string RandomBytes(std::mt19937* random, size_t size) {
+  string data(size, '\0');
+  for (char& c : data) {
+    c = std::uniform_int_distribution<int>(0, 255)(*random);
+  }
+  return data;
+}
+
+
+// The entries and SCTs are shaped like those of serializer_test.cc,
+// with certificates of |size| bytes.
+void RunSize(size_t size) {
+  std::mt19937 random;
+
+  SignedCertificateTimestamp sct;
+  sct.set_version(ct::V1);
+  sct.mutable_id()->set_key_id("iamapublickeyshatwofivesixdigest");
+  sct.set_timestamp(1234);
+  sct.mutable_signature()->set_hash_algorithm(DigitallySigned::SHA256);
+  sct.mutable_signature()->set_sig_algorithm(DigitallySigned::ECDSA);
+  sct.mutable_signature()->set_signature(RandomBytes(&random, 72));
+
+  SignedCertificateTimestampList sct_list;
+  for (int i = 0; i < 3; ++i) {
+    CHECK_EQ(Serializer::OK,
+             Serializer::SerializeSCT(sct, sct_list.add_sct_list()));
+  }
+
+  LogEntry cert_entry;
+  cert_entry.set_type(ct::X509_ENTRY);
+  cert_entry.mutable_x509_entry()->set_leaf_certificate(
+      RandomBytes(&random, size));
+  for (int i = 0; i < 2; ++i) {
+    cert_entry.mutable_x509_entry()->add_certificate_chain(
+        RandomBytes(&random, size));
+  }
+
+  LogEntry precert_entry;
+  precert_entry.set_type(ct::PRECERT_ENTRY);
+  PrecertChainEntry* const precert(precert_entry.mutable_precert_entry());
+  precert->mutable_pre_cert()->set_issuer_key_hash(RandomBytes(&random, 32));
+  precert->mutable_pre_cert()->set_tbs_certificate(
+      RandomBytes(&random, size));
+  precert->set_pre_certificate(RandomBytes(&random, size));
+  for (int i = 0; i < 2; ++i) {
+    precert->add_precertificate_chain(RandomBytes(&random, size));
+  }
+
+  string flat_sct, flat_sct_list, flat_leaf, flat_chain, flat_precert_chain;
+  CHECK_EQ(Serializer::OK, Serializer::SerializeSCT(sct, &flat_sct));
+  CHECK_EQ(Serializer::OK,
+           Serializer::SerializeSCTList(sct_list, &flat_sct_list));
+  CHECK_EQ(Serializer::OK,
+           Serializer::SerializeSCTMerkleTreeLeaf(sct, cert_entry,
+                                                  &flat_leaf));
+  CHECK_EQ(Serializer::OK,
+           Serializer::SerializeX509Chain(cert_entry.x509_entry(),
+                                          &flat_chain));
+  CHECK_EQ(Serializer::OK,
+           Serializer::SerializePrecertChainEntry(*precert,
+                                                  &flat_precert_chain));
+
+  string out;
+  Run("serialize_sct", size, [&]() {
+    CHECK_EQ(Serializer::OK, Serializer::SerializeSCT(sct, &out));
+  });
+  Run("serialize_sct_list", size, [&]() {
+    CHECK_EQ(Serializer::OK, Serializer::SerializeSCTList(sct_list, &out));
+  });
+  Run("serialize_signature_input", size, [&]() {
+    CHECK_EQ(Serializer::OK,
+             Serializer::SerializeSCTSignatureInput(sct, cert_entry, &out));
+  });
+  Run("serialize_precert_leaf", size, [&]() {
+    CHECK_EQ(Serializer::OK,
+             Serializer::SerializeSCTMerkleTreeLeaf(sct, precert_entry,
+                                                    &out));
+  });
+  Run("serialize_x509_chain", size, [&]() {
+    CHECK_EQ(Serializer::OK,
+             Serializer::SerializeX509Chain(cert_entry.x509_entry(), &out));
+  });
+  Run("serialize_precert_chain", size, [&]() {
+    CHECK_EQ(Serializer::OK,
+             Serializer::SerializePrecertChainEntry(*precert, &out));
+  });
+
+  Run("deserialize_sct", size, [&]() {
+    SignedCertificateTimestamp result;
+    CHECK_EQ(Deserializer::OK, Deserializer::DeserializeSCT(flat_sct,
+                                                            &result));
+  });
+  Run("deserialize_sct_list", size, [&]() {
+    SignedCertificateTimestampList result;
+    CHECK_EQ(Deserializer::OK,
+             Deserializer::DeserializeSCTList(flat_sct_list, &result));
+  });
+  Run("deserialize_leaf", size, [&]() {
+    MerkleTreeLeaf result;
+    CHECK_EQ(Deserializer::OK,
+             Deserializer::DeserializeMerkleTreeLeaf(flat_leaf, &result));
+  });
+  Run("deserialize_x509_chain", size, [&]() {
+    X509ChainEntry result;
+    CHECK_EQ(Deserializer::OK,
+             Deserializer::DeserializeX509Chain(flat_chain, &result));
+  });
+  Run("deserialize_precert_chain", size, [&]() {
+    PrecertChainEntry result;
+    CHECK_EQ(Deserializer::OK,
+             Deserializer::DeserializePrecertChainEntry(flat_precert_chain,
+                                                        &result));
+  });
+}
+
+
+}  // namespace
+
+
+int main(int argc, char* argv[]) {
+  google::ParseCommandLineFlags(&argc, &argv, true);
+  google::InitGoogleLogging(argv[0]);
+
+  CHECK_GT(FLAGS_min_time_ms, 0);
+
+  std::cout << std::left << std::setw(28) << "benchmark" << std::right
+            << std::setw(10) << "bytes" << std::setw(14) << "ns/op"
+            << std::endl;
+  for (const size_t size : ParseSizes(FLAGS_sizes)) {
+    RunSize(size);
+  }
+
+  return 0;
+}
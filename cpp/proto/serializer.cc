@@ -2,7 +2,6 @@
 #include "proto/serializer.h"
 
 #include <glog/logging.h>
-#include <math.h>
 #include <string>
 
 #include "proto/ct.pb.h"
@@ -40,7 +39,12 @@ const size_t Serializer::kTimestampLengthInBytes = 8;
 // Returns the number of bytes needed to store a value up to max_length.
 size_t Serializer::PrefixLength(size_t max_length) {
   CHECK_GT(max_length, 0U);
-  return ceil(log2(max_length) / float(8));
+  // The smallest number of bytes such that max_length <= 256^bytes,
+  // i.e. ceil(log2(max_length) / 8).
+  size_t bytes(0);
+  while (bytes < sizeof(max_length) && (max_length - 1) >> (bytes * 8) != 0)
+    ++bytes;
+  return bytes;
 }
 
 // static
@@ -82,14 +86,17 @@ Serializer::SerializeResult Serializer::SerializeV1CertSCTSignatureInput(
   res = CheckExtensionsFormat(extensions);
   if (res != OK)
     return res;
-  Serializer serializer;
+  Serializer serializer(kVersionLengthInBytes + kSignatureTypeLengthInBytes +
+                        kTimestampLengthInBytes + kLogEntryTypeLengthInBytes +
+                        VarBytesLength(certificate, kMaxCertificateLength) +
+                        VarBytesLength(extensions, kMaxExtensionsLength));
   serializer.WriteUint(ct::V1, kVersionLengthInBytes);
   serializer.WriteUint(ct::CERTIFICATE_TIMESTAMP, kSignatureTypeLengthInBytes);
   serializer.WriteUint(timestamp, kTimestampLengthInBytes);
   serializer.WriteUint(ct::X509_ENTRY, kLogEntryTypeLengthInBytes);
   serializer.WriteVarBytes(certificate, kMaxCertificateLength);
   serializer.WriteVarBytes(extensions, kMaxExtensionsLength);
-  result->assign(serializer.SerializedString());
+  result->swap(serializer.output_);
   return OK;
 }
 
@@ -106,7 +113,11 @@ Serializer::SerializeResult Serializer::SerializeV1PrecertSCTSignatureInput(
   res = CheckExtensionsFormat(extensions);
   if (res != OK)
     return res;
-  Serializer serializer;
+  Serializer serializer(kVersionLengthInBytes + kSignatureTypeLengthInBytes +
+                        kTimestampLengthInBytes + kLogEntryTypeLengthInBytes +
+                        issuer_key_hash.size() +
+                        VarBytesLength(tbs_certificate, kMaxCertificateLength) +
+                        VarBytesLength(extensions, kMaxExtensionsLength));
   serializer.WriteUint(ct::V1, kVersionLengthInBytes);
   serializer.WriteUint(ct::CERTIFICATE_TIMESTAMP, kSignatureTypeLengthInBytes);
   serializer.WriteUint(timestamp, kTimestampLengthInBytes);
@@ -114,7 +125,7 @@ Serializer::SerializeResult Serializer::SerializeV1PrecertSCTSignatureInput(
   serializer.WriteFixedBytes(issuer_key_hash);
   serializer.WriteVarBytes(tbs_certificate, kMaxCertificateLength);
   serializer.WriteVarBytes(extensions, kMaxExtensionsLength);
-  result->assign(serializer.SerializedString());
+  result->swap(serializer.output_);
   return OK;
 }
 
@@ -149,14 +160,17 @@ Serializer::SerializeResult Serializer::SerializeV1CertSCTMerkleTreeLeaf(
   res = CheckExtensionsFormat(extensions);
   if (res != OK)
     return res;
-  Serializer serializer;
+  Serializer serializer(kVersionLengthInBytes + kMerkleLeafTypeLengthInBytes +
+                        kTimestampLengthInBytes + kLogEntryTypeLengthInBytes +
+                        VarBytesLength(certificate, kMaxCertificateLength) +
+                        VarBytesLength(extensions, kMaxExtensionsLength));
   serializer.WriteUint(ct::V1, kVersionLengthInBytes);
   serializer.WriteUint(ct::TIMESTAMPED_ENTRY, kMerkleLeafTypeLengthInBytes);
   serializer.WriteUint(timestamp, kTimestampLengthInBytes);
   serializer.WriteUint(ct::X509_ENTRY, kLogEntryTypeLengthInBytes);
   serializer.WriteVarBytes(certificate, kMaxCertificateLength);
   serializer.WriteVarBytes(extensions, kMaxExtensionsLength);
-  result->assign(serializer.SerializedString());
+  result->swap(serializer.output_);
   return OK;
 }
 
@@ -173,7 +187,11 @@ Serializer::SerializeResult Serializer::SerializeV1PrecertSCTMerkleTreeLeaf(
   res = CheckExtensionsFormat(extensions);
   if (res != OK)
     return res;
-  Serializer serializer;
+  Serializer serializer(kVersionLengthInBytes + kMerkleLeafTypeLengthInBytes +
+                        kTimestampLengthInBytes + kLogEntryTypeLengthInBytes +
+                        issuer_key_hash.size() +
+                        VarBytesLength(tbs_certificate, kMaxCertificateLength) +
+                        VarBytesLength(extensions, kMaxExtensionsLength));
   serializer.WriteUint(ct::V1, kVersionLengthInBytes);
   serializer.WriteUint(ct::TIMESTAMPED_ENTRY, kMerkleLeafTypeLengthInBytes);
   serializer.WriteUint(timestamp, kTimestampLengthInBytes);
@@ -181,7 +199,7 @@ Serializer::SerializeResult Serializer::SerializeV1PrecertSCTMerkleTreeLeaf(
   serializer.WriteFixedBytes(issuer_key_hash);
   serializer.WriteVarBytes(tbs_certificate, kMaxCertificateLength);
   serializer.WriteVarBytes(extensions, kMaxExtensionsLength);
-  result->assign(serializer.SerializedString());
+  result->swap(serializer.output_);
   return OK;
 }
 
@@ -213,13 +231,14 @@ Serializer::SerializeResult Serializer::SerializeV1STHSignatureInput(
   CHECK_GE(tree_size, 0);
   if (root_hash.size() != 32)
     return INVALID_HASH_LENGTH;
-  Serializer serializer;
+  Serializer serializer(kVersionLengthInBytes + kSignatureTypeLengthInBytes +
+                        kTimestampLengthInBytes + 8 + root_hash.size());
   serializer.WriteUint(ct::V1, kVersionLengthInBytes);
   serializer.WriteUint(ct::TREE_HEAD, kSignatureTypeLengthInBytes);
   serializer.WriteUint(timestamp, kTimestampLengthInBytes);
   serializer.WriteUint(tree_size, 8);
   serializer.WriteFixedBytes(root_hash);
-  result->assign(serializer.SerializedString());
+  result->swap(serializer.output_);
   return OK;
 }
 
@@ -252,11 +271,15 @@ Serializer::SerializeResult Serializer::WriteSCT(
 // static
 Serializer::SerializeResult Serializer::SerializeSCT(
     const SignedCertificateTimestamp& sct, string* result) {
-  Serializer serializer;
+  Serializer serializer(
+      kVersionLengthInBytes + sct.id().key_id().size() +
+      kTimestampLengthInBytes +
+      VarBytesLength(sct.extensions(), kMaxExtensionsLength) +
+      DigitallySignedLength(sct.signature()));
   SerializeResult res = serializer.WriteSCT(sct);
   if (res != OK)
     return res;
-  result->assign(serializer.SerializedString());
+  result->swap(serializer.output_);
   return OK;
 }
 
@@ -293,12 +316,16 @@ Serializer::SerializeResult Serializer::SerializePrecertChainEntry(
 Serializer::SerializeResult Serializer::SerializePrecertChainEntry(
     const std::string& pre_certificate,
     const repeated_string& precertificate_chain, std::string* result) {
-  Serializer serializer;
   if (pre_certificate.size() > kMaxCertificateLength)
     return CERTIFICATE_TOO_LONG;
   if (pre_certificate.empty())
     return EMPTY_CERTIFICATE;
 
+  // The length of the list is 0 if it is too long, it is only a hint.
+  Serializer serializer(
+      VarBytesLength(pre_certificate, kMaxCertificateLength) +
+      SerializedListLength(precertificate_chain, kMaxCertificateLength,
+                           kMaxCertificateChainLength));
   serializer.WriteVarBytes(pre_certificate, kMaxCertificateLength);
 
   SerializeResult res =
@@ -306,18 +333,18 @@ Serializer::SerializeResult Serializer::SerializePrecertChainEntry(
                            kMaxCertificateChainLength);
   if (res != OK)
     return res;
-  result->assign(serializer.SerializedString());
+  result->swap(serializer.output_);
   return OK;
 }
 
 // static
 Serializer::SerializeResult Serializer::SerializeDigitallySigned(
     const DigitallySigned& sig, string* result) {
-  Serializer serializer;
+  Serializer serializer(DigitallySignedLength(sig));
   SerializeResult res = serializer.WriteDigitallySigned(sig);
   if (res != OK)
     return res;
-  result->assign(serializer.SerializedString());
+  result->swap(serializer.output_);
   return OK;
 }
 
@@ -343,10 +370,12 @@ Serializer::SerializeResult Serializer::SerializeV1SignedCertEntryWithType(
   SerializeResult res = CheckCertificateFormat(leaf_certificate);
   if (res != OK)
     return res;
-  Serializer serializer;
+  Serializer serializer(kLogEntryTypeLengthInBytes +
+                        VarBytesLength(leaf_certificate,
+                                       kMaxCertificateLength));
   serializer.WriteUint(ct::X509_ENTRY, kLogEntryTypeLengthInBytes);
   serializer.WriteVarBytes(leaf_certificate, kMaxCertificateLength);
-  result->assign(serializer.SerializedString());
+  result->swap(serializer.output_);
   return OK;
 }
 
@@ -360,11 +389,13 @@ Serializer::SerializeResult Serializer::SerializeV1SignedPrecertEntryWithType(
   res = CheckKeyHashFormat(issuer_key_hash);
   if (res != OK)
     return res;
-  Serializer serializer;
+  Serializer serializer(kLogEntryTypeLengthInBytes + issuer_key_hash.size() +
+                        VarBytesLength(tbs_certificate,
+                                       kMaxCertificateLength));
   serializer.WriteUint(ct::PRECERT_ENTRY, kLogEntryTypeLengthInBytes);
   serializer.WriteFixedBytes(issuer_key_hash);
   serializer.WriteVarBytes(tbs_certificate, kMaxCertificateLength);
-  result->assign(serializer.SerializedString());
+  result->swap(serializer.output_);
   return OK;
 }
 
@@ -404,12 +435,14 @@ size_t Serializer::SerializedListLength(const repeated_string& in,
 Serializer::SerializeResult Serializer::SerializeList(
     const repeated_string& in, size_t max_elem_length, size_t max_total_length,
     string* result) {
-  Serializer serializer;
+  // The length is 0 if the list is too long, it is only a hint.
+  Serializer serializer(
+      SerializedListLength(in, max_elem_length, max_total_length));
   SerializeResult res =
       serializer.WriteList(in, max_elem_length, max_total_length);
   if (res != OK)
     return res;
-  result->assign(serializer.SerializedString());
+  result->swap(serializer.output_);
   return OK;
 }
 
@@ -446,6 +479,12 @@ Serializer::SerializeResult Serializer::WriteDigitallySigned(
   return OK;
 }
 
+// static
+size_t Serializer::DigitallySignedLength(const DigitallySigned& sig) {
+  return kHashAlgorithmLengthInBytes + kSigAlgorithmLengthInBytes +
+         VarBytesLength(sig.signature(), kMaxSignatureLength);
+}
+
 Serializer::SerializeResult Serializer::CheckKeyHashFormat(
     const string& key_hash) {
   if (key_hash.size() != kKeyHashLengthInBytes)
@@ -521,7 +560,11 @@ Serializer::SerializeResult Serializer::CheckPrecertChainEntryFormat(
 }
 
 Deserializer::Deserializer(const string& input)
-    : current_pos_(input.data()), bytes_remaining_(input.size()) {
+    : Deserializer(input.data(), input.size()) {
+}
+
+Deserializer::Deserializer(const char* input, size_t size)
+    : current_pos_(input), bytes_remaining_(size) {
 }
 
 Deserializer::DeserializeResult Deserializer::ReadSCT(
@@ -540,8 +583,10 @@ Deserializer::DeserializeResult Deserializer::ReadSCT(
   if (!ReadUint(Serializer::kTimestampLengthInBytes, &timestamp))
     return INPUT_TOO_SHORT;
   sct->set_timestamp(timestamp);
-  string extensions;
-  if (!ReadVarBytes(Serializer::kMaxExtensionsLength, &extensions))
+  const char* extensions;
+  size_t extensions_length;
+  if (!ReadVarBytes(Serializer::kMaxExtensionsLength, &extensions,
+                    &extensions_length))
     // In theory, could also be an invalid length prefix, but not if
     // length limits follow byte boundaries.
     return INPUT_TOO_SHORT;
@@ -616,15 +661,23 @@ Deserializer::DeserializeResult Deserializer::DeserializePrecertChainEntry(
   return OK;
 }
 
-bool Deserializer::ReadFixedBytes(size_t bytes, string* result) {
+bool Deserializer::ReadFixedBytes(size_t bytes, const char** result) {
   if (bytes_remaining_ < bytes)
     return false;
-  result->assign(current_pos_, bytes);
+  *result = current_pos_;
   current_pos_ += bytes;
   bytes_remaining_ -= bytes;
   return true;
 }
 
+bool Deserializer::ReadFixedBytes(size_t bytes, string* result) {
+  const char* data;
+  if (!ReadFixedBytes(bytes, &data))
+    return false;
+  result->assign(data, bytes);
+  return true;
+}
+
 bool Deserializer::ReadLengthPrefix(size_t max_length, size_t* result) {
   size_t prefix_length = Serializer::PrefixLength(max_length);
   size_t length;
@@ -634,6 +687,12 @@ bool Deserializer::ReadLengthPrefix(size_t max_length, size_t* result) {
   return true;
 }
 
+bool Deserializer::ReadVarBytes(size_t max_length, const char** result,
+                                size_t* length) {
+  return ReadLengthPrefix(max_length, length) &&
+         ReadFixedBytes(*length, result);
+}
+
 bool Deserializer::ReadVarBytes(size_t max_length, string* result) {
   size_t length;
   if (!ReadLengthPrefix(max_length, &length))
@@ -658,22 +717,24 @@ Deserializer::DeserializeResult Deserializer::DeserializeList(
 Deserializer::DeserializeResult Deserializer::ReadList(size_t max_total_length,
                                                        size_t max_elem_length,
                                                        repeated_string* out) {
-  string serialized_list;
-  if (!ReadVarBytes(max_total_length, &serialized_list))
+  const char* serialized_list;
+  size_t list_length;
+  if (!ReadVarBytes(max_total_length, &serialized_list, &list_length))
     // TODO(ekasper): could also be a length that's too large, if
     // length limits don't follow byte boundaries.
     return INPUT_TOO_SHORT;
   if (!ReachedEnd())
     return INPUT_TOO_LONG;
 
-  Deserializer list_reader(serialized_list);
+  Deserializer list_reader(serialized_list, list_length);
   while (!list_reader.ReachedEnd()) {
-    string elem;
-    if (!list_reader.ReadVarBytes(max_elem_length, &elem))
+    const char* elem;
+    size_t elem_length;
+    if (!list_reader.ReadVarBytes(max_elem_length, &elem, &elem_length))
       return INVALID_LIST_ENCODING;
-    if (elem.empty())
+    if (elem_length == 0)
       return EMPTY_ELEM_IN_LIST;
-    *(out->Add()) = elem;
+    out->Add()->assign(elem, elem_length);
   }
   return OK;
 }
@@ -690,14 +751,16 @@ Deserializer::DeserializeResult Deserializer::ReadDigitallySigned(
   if (!DigitallySigned_SignatureAlgorithm_IsValid(sig_algo))
     return INVALID_SIGNATURE_ALGORITHM;
 
-  string sig_string;
-  if (!ReadVarBytes(Serializer::kMaxSignatureLength, &sig_string))
+  const char* signature;
+  size_t signature_length;
+  if (!ReadVarBytes(Serializer::kMaxSignatureLength, &signature,
+                    &signature_length))
     return INPUT_TOO_SHORT;
   sig->set_hash_algorithm(
       static_cast<DigitallySigned::HashAlgorithm>(hash_algo));
   sig->set_sig_algorithm(
       static_cast<DigitallySigned::SignatureAlgorithm>(sig_algo));
-  sig->set_signature(sig_string);
+  sig->set_signature(signature, signature_length);
   return OK;
 }
 
@@ -732,27 +795,23 @@ Deserializer::DeserializeResult Deserializer::ReadMerkleTreeLeaf(
   entry->set_entry_type(static_cast<ct::LogEntryType>(entry_type));
 
   if (entry_type == ct::X509_ENTRY) {
-    string x509;
-    if (!ReadVarBytes(Serializer::kMaxCertificateLength, &x509))
+    if (!ReadVarBytes(Serializer::kMaxCertificateLength,
+                      entry->mutable_signed_entry()->mutable_x509()))
       return INPUT_TOO_SHORT;
-    entry->mutable_signed_entry()->set_x509(x509);
   } else {
-    string issuer_key_hash;
-    if (!ReadFixedBytes(32, &issuer_key_hash))
+    ct::PreCert* const precert(
+        entry->mutable_signed_entry()->mutable_precert());
+    if (!ReadFixedBytes(Serializer::kKeyHashLengthInBytes,
+                        precert->mutable_issuer_key_hash()))
       return INPUT_TOO_SHORT;
-    entry->mutable_signed_entry()->mutable_precert()->set_issuer_key_hash(
-        issuer_key_hash);
-    string tbs_certificate;
-    if (!ReadVarBytes(Serializer::kMaxCertificateLength, &tbs_certificate))
+    if (!ReadVarBytes(Serializer::kMaxCertificateLength,
+                      precert->mutable_tbs_certificate()))
       return INPUT_TOO_SHORT;
-    entry->mutable_signed_entry()->mutable_precert()->set_tbs_certificate(
-        tbs_certificate);
   }
 
-  string extensions;
-  if (!ReadVarBytes(Serializer::kMaxExtensionsLength, &extensions))
+  if (!ReadVarBytes(Serializer::kMaxExtensionsLength,
+                    entry->mutable_extensions()))
     return INPUT_TOO_SHORT;
-  entry->set_extensions(extensions);
 
   return OK;
 }
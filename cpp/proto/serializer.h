@@ -127,7 +127,7 @@ class Serializer {
   // TODO(ekasper): tests for these!
   template <class T>
   static std::string SerializeUint(T in, size_t bytes = sizeof(T)) {
-    Serializer serializer;
+    Serializer serializer(bytes);
     serializer.WriteUint(in, bytes);
     return serializer.SerializedString();
   }
@@ -152,16 +152,23 @@ class Serializer {
   // This class is mostly a namespace for static methods, but a
   // temporary instance of it is made internally.
   // TODO(pphaneuf): Make this into normal functions in a namespace.
-  Serializer() {
+  // Its output is reserved up front, |size| being the length of the
+  // whole serialization, so that it is written without reallocating.
+  explicit Serializer(size_t size) {
+    output_.reserve(size);
   }
 
   template <class T>
   void WriteUint(T in, size_t bytes) {
     CHECK_LE(bytes, sizeof(in));
     CHECK(bytes == sizeof(in) || in >> (bytes * 8) == 0);
-    for (; bytes > 0; --bytes)
-      output_.push_back(((in & (static_cast<T>(0xff) << ((bytes - 1) * 8))) >>
-                         ((bytes - 1) * 8)));
+    uint64_t value(in);
+    char buf[sizeof(value)];
+    for (size_t i = bytes; i > 0; --i) {
+      buf[i - 1] = static_cast<char>(value & 0xff);
+      value >>= 8;
+    }
+    output_.append(buf, bytes);
   }
 
   // Fixed-length byte array.
@@ -172,6 +179,14 @@ class Serializer {
   // TODO(ekasper): could return a bool instead.
   void WriteVarBytes(const std::string& in, size_t max_length);
 
+  // Length of |in| serialized with WriteVarBytes().
+  static size_t VarBytesLength(const std::string& in, size_t max_length) {
+    return PrefixLength(max_length) + in.size();
+  }
+
+  // Length of |sig| serialized with WriteDigitallySigned().
+  static size_t DigitallySignedLength(const ct::DigitallySigned& sig);
+
   // Length of the serialized list (with length prefix).
   static size_t SerializedListLength(const repeated_string& in,
                                      size_t max_elem_length,
@@ -216,6 +231,7 @@ class Deserializer {
   // We do not make a copy, so input must remain valid.
   // FIXME: and so we should take a string *, not a string &.
   explicit Deserializer(const std::string& input);
+  Deserializer(const char* input, size_t size);
 
   enum DeserializeResult {
     OK,
@@ -285,10 +301,17 @@ class Deserializer {
     return true;
   }
 
+  // Points |*result| at the next |bytes| bytes of the input, rather
+  // than copying them.
+  bool ReadFixedBytes(size_t bytes, const char** result);
+
   bool ReadFixedBytes(size_t bytes, std::string* result);
 
   bool ReadLengthPrefix(size_t max_length, size_t* result);
 
+  // Like ReadFixedBytes(), points |*result| into the input.
+  bool ReadVarBytes(size_t max_length, const char** result, size_t* length);
+
   bool ReadVarBytes(size_t max_length, std::string* result);
 
   // FIXME(ekasper): for simplicity these reject if the list has empty
@@ -0,0 +1,411 @@
+#include <atomic>
+#include <chrono>
+#include <event2/thread.h>
+#include <functional>
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <openssl/bio.h>
+#include <openssl/ec.h>
+#include <openssl/evp.h>
+#include <openssl/obj_mac.h>
+#include <openssl/pem.h>
+#include <openssl/x509.h>
+#include <openssl/x509v3.h>
+#include <stdint.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "log/cert.h"
+#include "log/cert_checker.h"
+#include "log/cert_submission_handler.h"
+#include "log/ct_extensions.h"
+#include "log/etcd_consistent_store.h"
+#include "log/frontend.h"
+#include "log/frontend_signer.h"
+#include "log/leveldb_db.h"
+#include "log/log_signer.h"
+#include "log/logged_certificate.h"
+#include "log/test_signer.h"
+#include "proto/ct.pb.h"
+#include "server/chain_parser.h"
+#include "util/fake_etcd.h"
+#include "util/libevent_wrapper.h"
+#include "util/masterelection.h"
+#include "util/status.h"
+#include "util/thread_pool.h"
+#include "util/util.h"
+
+namespace libevent = cert_trans::libevent;
+
+using cert_trans::Cert;
+using cert_trans::CertChain;
+using cert_trans::CertChecker;
+using cert_trans::ChainParser;
+using cert_trans::EtcdConsistentStore;
+using cert_trans::FakeEtcdClient;
+using cert_trans::LoggedCertificate;
+using cert_trans::MasterElection;
+using cert_trans::PreCertChain;
+using cert_trans::ThreadPool;
+using ct::LogEntry;
+using ct::SignedCertificateTimestamp;
+using std::atomic;
+using std::chrono::duration;
+using std::chrono::nanoseconds;
+using std::chrono::steady_clock;
+using std::function;
+using std::make_shared;
+using std::milli;
+using std::shared_ptr;
+using std::string;
+using std::thread;
+using std::to_string;
+using std::unique_ptr;
+using std::vector;
+using util::Status;
+
+DEFINE_string(testdata_dir, "test/testdata",
+              "directory with the test certificates and keys, the chains "
+              "being issued by intermediate-cert.pem");
+DEFINE_string(leveldb_dir, "/tmp",
+              "directory to create the database in; each run uses a new "
+              "subdirectory of it, which is left behind");
+DEFINE_int32(num_chains, 2000,
+             "number of chains to submit in each benchmark; each one is "
+             "new, so that none is a duplicate");
+DEFINE_int32(num_threads, 0,
+             "number of threads to submit on concurrently, in addition to a "
+             "single thread; the number of cores if 0");
+
+namespace {
+
+
+const char kRootCert[] = "ca-cert.pem";
+const char kIntermediateCert[] = "intermediate-cert.pem";
+const char kIntermediateKey[] = "intermediate-key.pem";
+// The password of the keys in the test data.
+const char kKeyPassword[] = "password1";
+
+
+X509* ReadCert(const string& file) {
+  string pem;
+  CHECK(util::ReadTextFile(FLAGS_testdata_dir + "/" + file, &pem))
+      << "could not read " << file << ", wrong --testdata_dir?";
+  BIO* const bio(CHECK_NOTNULL(
+      BIO_new_mem_buf(const_cast<char*>(pem.data()), pem.size())));
+  X509* const x509(CHECK_NOTNULL(PEM_read_bio_X509(bio, NULL, NULL, NULL)));
+  BIO_free(bio);
+  return x509;
+}
+
+
+EVP_PKEY* ReadKey(const string& file) {
+  string pem;
+  CHECK(util::ReadTextFile(FLAGS_testdata_dir + "/" + file, &pem));
+  BIO* const bio(CHECK_NOTNULL(
+      BIO_new_mem_buf(const_cast<char*>(pem.data()), pem.size())));
+  EVP_PKEY* const pkey(CHECK_NOTNULL(PEM_read_bio_PrivateKey(
+      bio, NULL, NULL, const_cast<char*>(kKeyPassword))));
+  BIO_free(bio);
+  return pkey;
+}
+
+
+string DerEncoding(X509* x509) {
+  unsigned char* der(NULL);
+  const int length(i2d_X509(x509, &der));
+  CHECK_GT(length, 0);
+  const string result(reinterpret_cast<char*>(der), length);
+  OPENSSL_free(der);
+  return result;
+}
+
+
+// Makes the bodies of add-chain and add-pre-chain requests, each with
+// a new leaf issued by the intermediate from the test data.
+class ChainMaker {
+ public:
+  ChainMaker()
+      : issuer_(ReadCert(kIntermediateCert)),
+        issuer_key_(ReadKey(kIntermediateKey)),
+        issuer_base64_(util::ToBase64(DerEncoding(issuer_))),
+        leaf_key_(CHECK_NOTNULL(EVP_PKEY_new())),
+        serial_(util::TimeInMilliseconds()) {
+    EC_KEY* const ec(
+        CHECK_NOTNULL(EC_KEY_new_by_curve_name(NID_X9_62_prime256v1)));
+    CHECK_EQ(1, EC_KEY_generate_key(ec));
+    CHECK_EQ(1, EVP_PKEY_assign_EC_KEY(leaf_key_, ec));
+  }
+
+  ~ChainMaker() {
+    EVP_PKEY_free(leaf_key_);
+    EVP_PKEY_free(issuer_key_);
+    X509_free(issuer_);
+  }
+
+  vector<string> Make(int count, bool precert) {
+    vector<string> bodies;
+    for (int i = 0; i < count; ++i) {
+      bodies.push_back("{\"chain\":[\"" + util::ToBase64(MakeLeaf(precert)) +
+                       "\",\"" + issuer_base64_ + "\"]}");
+    }
+    return bodies;
+  }
+
+ private:
+  string MakeLeaf(bool precert) {
+    X509* const x509(CHECK_NOTNULL(X509_new()));
+    CHECK_EQ(1, X509_set_version(x509, 2));
+    CHECK_EQ(1, ASN1_INTEGER_set(X509_get_serialNumber(x509), ++serial_));
+    CHECK_NOTNULL(X509_gmtime_adj(X509_get_notBefore(x509), 0));
+    CHECK_NOTNULL(X509_gmtime_adj(X509_get_notAfter(x509), 86400 * 365));
+    const string common_name("leaf-" + to_string(serial_) + ".example.com");
+    CHECK_EQ(1, X509_NAME_add_entry_by_txt(
+                    X509_get_subject_name(x509), "CN", MBSTRING_ASC,
+                    reinterpret_cast<const unsigned char*>(
+                        common_name.c_str()),
+                    -1, -1, 0));
+    CHECK_EQ(1, X509_set_issuer_name(x509, X509_get_subject_name(issuer_)));
+    CHECK_EQ(1, X509_set_pubkey(x509, leaf_key_));
+
+    if (precert) {
+      // A critical extension holding an ASN.1 NULL.
+      ASN1_OCTET_STRING* const null(CHECK_NOTNULL(ASN1_OCTET_STRING_new()));
+      CHECK_EQ(1, ASN1_OCTET_STRING_set(
+                      null, reinterpret_cast<const unsigned char*>("\x05\x00"),
+                      2));
+      X509_EXTENSION* const poison(CHECK_NOTNULL(X509_EXTENSION_create_by_NID(
+          NULL, cert_trans::NID_ctPoison, 1, null)));
+      CHECK_EQ(1, X509_add_ext(x509, poison, -1));
+      X509_EXTENSION_free(poison);
+      ASN1_OCTET_STRING_free(null);
+    }
+
+    CHECK_GT(X509_sign(x509, issuer_key_, EVP_sha256()), 0);
+    const string der(DerEncoding(x509));
+    X509_free(x509);
+    return der;
+  }
+
+  X509* const issuer_;
+  EVP_PKEY* const issuer_key_;
+  const string issuer_base64_;
+  EVP_PKEY* const leaf_key_;
+  long serial_;
+};
+
+
+// Parses |body| the way the add-chain handler does.
+void ParseChain(const string& body, CertChain* chain) {
+  ChainParser parser([chain](const string& der) {
+    Cert* const cert(new Cert);
+    cert->LoadFromDerString(der);
+    CHECK_EQ(Cert::TRUE, chain->AddCert(cert));
+    return true;
+  });
+  CHECK_EQ(ChainParser::OK, parser.Feed(body.data(), body.size()));
+  CHECK_EQ(ChainParser::OK, parser.Finish());
+}
+
+
+// The total time spent in each stage of the submissions, by all the
+// threads.
+struct StageTimes {
+  StageTimes() : parse(0), check(0), sign(0), store(0) {
+  }
+
+  atomic<uint64_t> parse;
+  atomic<uint64_t> check;
+  atomic<uint64_t> sign;
+  atomic<uint64_t> store;
+};
+
+
+uint64_t NanosecondsSince(steady_clock::time_point* start) {
+  const steady_clock::time_point now(steady_clock::now());
+  const uint64_t elapsed(
+      std::chrono::duration_cast<nanoseconds>(now - *start).count());
+  *start = now;
+  return elapsed;
+}
+
+
+// Runs |submit| for each of |bodies| on |num_threads| threads, and
+// returns the number of submissions per second.
+double Measure(int num_threads, const vector<string>& bodies,
+               const function<void(const string&)>& submit) {
+  atomic<size_t> next(0);
+  const steady_clock::time_point start(steady_clock::now());
+  vector<thread> threads;
+  for (int i = 0; i < num_threads; ++i) {
+    threads.emplace_back([&bodies, &next, &submit]() {
+      for (size_t n = next++; n < bodies.size(); n = next++) {
+        submit(bodies[n]);
+      }
+    });
+  }
+  for (auto& t : threads) {
+    t.join();
+  }
+  return bodies.size() / duration<double>(steady_clock::now() - start).count();
+}
+
+
+class Benchmark {
+ public:
+  Benchmark(const shared_ptr<libevent::Base>& base, ThreadPool* pool)
+      : root_("/bench_frontend/" + to_string(util::TimeInMilliseconds())),
+        db_(util::CreateTemporaryDirectory(FLAGS_leveldb_dir +
+                                           "/bench_frontendXXXXXX")),
+        etcd_(base.get()),
+        election_(base, &etcd_, root_ + "/election", "bench"),
+        store_(base.get(), pool, &etcd_, &election_, root_, "bench"),
+        signer_(TestSigner::DefaultLogSigner()),
+        handler_(&checker_),
+        frontend_(new CertSubmissionHandler(&checker_),
+                  new FrontendSigner(&db_, &store_, signer_.get())) {
+    CHECK(checker_.LoadTrustedCertificates(FLAGS_testdata_dir + "/" +
+                                           kRootCert));
+    election_.StartElection();
+    CHECK(election_.WaitToBecomeMaster());
+  }
+
+  ~Benchmark() {
+    election_.StopElection();
+  }
+
+  void Run(const string& type, bool precert, int num_threads) {
+    const vector<string> stage_bodies(maker_.Make(FLAGS_num_chains, precert));
+    StageTimes times;
+    const double stage_rate(
+        Measure(num_threads, stage_bodies,
+                [this, precert, &times](const string& body) {
+                  SubmitByStage(body, precert, &times);
+                }));
+    Report("stages", type, num_threads, stage_rate, &times);
+
+    const vector<string> bodies(maker_.Make(FLAGS_num_chains, precert));
+    StageTimes frontend_times;
+    const double frontend_rate(
+        Measure(num_threads, bodies,
+                [this, precert, &frontend_times](const string& body) {
+                  SubmitToFrontend(body, precert, &frontend_times);
+                }));
+    Report("frontend", type, num_threads, frontend_rate, &frontend_times);
+  }
+
+ private:
+  // Goes through each stage that Frontend goes through in turn, so
+  // that they can be timed separately.
+  void SubmitByStage(const string& body, bool precert, StageTimes* times) {
+    steady_clock::time_point start(steady_clock::now());
+    unique_ptr<CertChain> chain(precert ? new PreCertChain : new CertChain);
+    ParseChain(body, chain.get());
+    times->parse += NanosecondsSince(&start);
+
+    LoggedCertificate logged;
+    CHECK_EQ(Status::OK,
+             precert ? handler_.ProcessPreCertSubmission(
+                           static_cast<PreCertChain*>(chain.get()),
+                           logged.mutable_entry())
+                     : handler_.ProcessX509Submission(
+                           chain.get(), logged.mutable_entry()));
+    times->check += NanosecondsSince(&start);
+
+    logged.mutable_sct()->set_timestamp(util::TimeInMilliseconds());
+    CHECK_EQ(LogSigner::OK, signer_->SignCertificateTimestamp(
+                                logged.entry(), logged.mutable_sct()));
+    times->sign += NanosecondsSince(&start);
+
+    CHECK_EQ(Status::OK, store_.AddPendingEntry(&logged));
+    times->store += NanosecondsSince(&start);
+  }
+
+  void SubmitToFrontend(const string& body, bool precert, StageTimes* times) {
+    steady_clock::time_point start(steady_clock::now());
+    unique_ptr<CertChain> chain(precert ? new PreCertChain : new CertChain);
+    ParseChain(body, chain.get());
+    times->parse += NanosecondsSince(&start);
+
+    SignedCertificateTimestamp sct;
+    CHECK_EQ(Status::OK,
+             precert ? frontend_.QueuePreCertEntry(
+                           static_cast<PreCertChain*>(chain.get()), &sct)
+                     : frontend_.QueueX509Entry(chain.get(), &sct));
+  }
+
+  // The frontend only has the time for parsing, the other stages
+  // happen within it.
+  void Report(const string& name, const string& type, int num_threads,
+              double scts_per_second, const StageTimes* times) const {
+    std::cout << std::left << std::setw(12) << name << std::setw(10) << type
+              << std::right << std::setw(8) << num_threads << std::fixed
+              << std::setprecision(0) << std::setw(12) << scts_per_second
+              << std::setprecision(3);
+    for (const atomic<uint64_t>* stage :
+         {&times->parse, &times->check, &times->sign, &times->store}) {
+      if (stage->load() > 0) {
+        std::cout << std::setw(12)
+                  << stage->load() / 1e6 / FLAGS_num_chains;
+      } else {
+        std::cout << std::setw(12) << "-";
+      }
+    }
+    std::cout << std::endl;
+  }
+
+  const string root_;
+  LevelDB<LoggedCertificate> db_;
+  FakeEtcdClient etcd_;
+  MasterElection election_;
+  EtcdConsistentStore<LoggedCertificate> store_;
+  const unique_ptr<LogSigner> signer_;
+  CertChecker checker_;
+  CertSubmissionHandler handler_;
+  Frontend frontend_;
+  ChainMaker maker_;
+};
+
+
+}  // namespace
+
+
+int main(int argc, char* argv[]) {
+  google::ParseCommandLineFlags(&argc, &argv, true);
+  google::InitGoogleLogging(argv[0]);
+  evthread_use_pthreads();
+  OpenSSL_add_all_algorithms();
+  cert_trans::LoadCtExtensions();
+
+  CHECK_GT(FLAGS_num_chains, 0);
+  vector<int> thread_counts{1};
+  const int num_threads(FLAGS_num_threads > 0
+                            ? FLAGS_num_threads
+                            : std::thread::hardware_concurrency());
+  if (num_threads > 1) {
+    thread_counts.push_back(num_threads);
+  }
+
+  const shared_ptr<libevent::Base> event_base(make_shared<libevent::Base>());
+  libevent::EventPumpThread pump(event_base);
+  ThreadPool pool;
+  Benchmark benchmark(event_base, &pool);
+
+  // The stages are the mean time spent in each, per submission.
+  std::cout << std::left << std::setw(12) << "benchmark" << std::setw(10)
+            << "type" << std::right << std::setw(8) << "threads"
+            << std::setw(12) << "scts/s" << std::setw(12) << "parse ms"
+            << std::setw(12) << "check ms" << std::setw(12) << "sign ms"
+            << std::setw(12) << "store ms" << std::endl;
+
+  for (const int threads : thread_counts) {
+    benchmark.Run("x509", false, threads);
+    benchmark.Run("precert", true, threads);
+  }
+
+  return 0;
+}
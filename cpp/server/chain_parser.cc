@@ -0,0 +1,242 @@
+#include "server/chain_parser.h"
+
+#include <glog/logging.h>
+
+using std::function;
+using std::string;
+
+namespace cert_trans {
+namespace {
+
+const char kChainKey[] = "chain";
+
+
+bool IsSpace(char c) {
+  return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+
+// Returns the value of the base64 character |c|, or -1 if it is not
+// one.
+int Base64Value(char c) {
+  if (c >= 'A' && c <= 'Z') {
+    return c - 'A';
+  }
+  if (c >= 'a' && c <= 'z') {
+    return c - 'a' + 26;
+  }
+  if (c >= '0' && c <= '9') {
+    return c - '0' + 52;
+  }
+  if (c == '+') {
+    return 62;
+  }
+  if (c == '/') {
+    return 63;
+  }
+  return -1;
+}
+
+
+}  // namespace
+
+
+ChainParser::ChainParser(const function<bool(const string& der)>& cert_cb)
+    : cert_cb_(cert_cb),
+      state_(BEFORE_OBJECT),
+      result_(OK),
+      group_(0),
+      group_size_(0),
+      padding_(0) {
+  CHECK(cert_cb_);
+}
+
+
+ChainParser::Result ChainParser::Feed(const char* data, size_t length) {
+  for (size_t i = 0; i < length && result_ == OK; ++i) {
+    result_ = Parse(data[i]);
+  }
+  return result_;
+}
+
+
+ChainParser::Result ChainParser::Finish() {
+  if (result_ == OK && state_ != DONE) {
+    result_ = INVALID;
+  }
+  return result_;
+}
+
+
+ChainParser::Result ChainParser::Parse(char c) {
+  switch (state_) {
+    case BEFORE_OBJECT:
+      if (IsSpace(c)) {
+        return OK;
+      }
+      if (c != '{') {
+        return UNHANDLED;
+      }
+      state_ = BEFORE_KEY;
+      return OK;
+
+    case BEFORE_KEY:
+      if (IsSpace(c)) {
+        return OK;
+      }
+      if (c != '"') {
+        return UNHANDLED;
+      }
+      state_ = IN_KEY;
+      return OK;
+
+    case IN_KEY:
+      if (c != '"') {
+        key_.push_back(c);
+        // Other members are left to the JSON parser.
+        return key_.size() < sizeof(kChainKey) ? OK : UNHANDLED;
+      }
+      if (key_ != kChainKey) {
+        return UNHANDLED;
+      }
+      state_ = BEFORE_COLON;
+      return OK;
+
+    case BEFORE_COLON:
+      if (IsSpace(c)) {
+        return OK;
+      }
+      if (c != ':') {
+        return INVALID;
+      }
+      state_ = BEFORE_ARRAY;
+      return OK;
+
+    case BEFORE_ARRAY:
+      if (IsSpace(c)) {
+        return OK;
+      }
+      if (c != '[') {
+        return INVALID;
+      }
+      state_ = BEFORE_CERT;
+      return OK;
+
+    case BEFORE_CERT:
+      if (IsSpace(c)) {
+        return OK;
+      }
+      if (c == ']') {
+        state_ = AFTER_ARRAY;
+        return OK;
+      }
+      if (c != '"') {
+        return INVALID;
+      }
+      state_ = IN_CERT;
+      return OK;
+
+    case IN_CERT:
+      if (c == '"') {
+        if (!FinishCert()) {
+          return result_ == OK ? INVALID : result_;
+        }
+        state_ = AFTER_CERT;
+        return OK;
+      }
+      if (c == '\\') {
+        state_ = IN_CERT_ESCAPE;
+        return OK;
+      }
+      return AddBase64(c) ? OK : INVALID;
+
+    case IN_CERT_ESCAPE:
+      // The only escape that can be in base64.
+      if (c != '/') {
+        return INVALID;
+      }
+      state_ = IN_CERT;
+      return AddBase64(c) ? OK : INVALID;
+
+    case AFTER_CERT:
+      if (IsSpace(c)) {
+        return OK;
+      }
+      if (c == ',') {
+        state_ = BEFORE_CERT;
+        return OK;
+      }
+      if (c == ']') {
+        state_ = AFTER_ARRAY;
+        return OK;
+      }
+      return INVALID;
+
+    case AFTER_ARRAY:
+      if (IsSpace(c)) {
+        return OK;
+      }
+      if (c == ',') {
+        // More members follow.
+        return UNHANDLED;
+      }
+      if (c != '}') {
+        return INVALID;
+      }
+      state_ = DONE;
+      return OK;
+
+    case DONE:
+      return IsSpace(c) ? OK : INVALID;
+  }
+  LOG(FATAL) << "unknown state " << state_;
+}
+
+
+bool ChainParser::AddBase64(char c) {
+  if (c == '=') {
+    // Padding is only allowed at the end of the last group.
+    if (group_size_ < 2) {
+      return false;
+    }
+    ++padding_;
+    group_ <<= 6;
+  } else {
+    const int value(Base64Value(c));
+    if (value < 0 || padding_ > 0) {
+      return false;
+    }
+    group_ = (group_ << 6) | value;
+  }
+
+  if (++group_size_ == 4) {
+    der_.push_back(static_cast<char>(group_ >> 16));
+    if (padding_ < 2) {
+      der_.push_back(static_cast<char>(group_ >> 8));
+    }
+    if (padding_ < 1) {
+      der_.push_back(static_cast<char>(group_));
+    }
+    group_ = 0;
+    group_size_ = 0;
+  }
+  return true;
+}
+
+
+bool ChainParser::FinishCert() {
+  if (group_size_ != 0 || der_.empty()) {
+    return false;
+  }
+  const bool valid(cert_cb_(der_));
+  // Keeps the buffer for the next one.
+  der_.clear();
+  padding_ = 0;
+  if (!valid) {
+    result_ = INVALID_CERT;
+  }
+  return valid;
+}
+
+
+}  // namespace cert_trans
@@ -0,0 +1,88 @@
+#ifndef CERT_TRANS_SERVER_CHAIN_PARSER_H_
+#define CERT_TRANS_SERVER_CHAIN_PARSER_H_
+
+#include <functional>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+#include "base/macros.h"
+
+namespace cert_trans {
+
+
+// Parses the body of an add-chain or add-pre-chain request, of the
+// form {"chain": ["<base64>", ...]}, as it is fed in pieces, so that
+// it can be read straight from the chunks of the request buffer. Each
+// certificate is decoded from base64 into the same buffer, and handed
+// to the callback, rather than going through a JSON object and
+// a string for each certificate.
+//
+// Only handles that exact form, with any whitespace and the "\/"
+// escape, as the clients send it. Anything else, such as other
+// members, is reported as UNHANDLED, so that the caller can fall back
+// to a complete JSON parser.
+class ChainParser {
+ public:
+  enum Result {
+    // The body is complete so far.
+    OK,
+    // Not an add-chain body this handles, but it may be valid JSON.
+    UNHANDLED,
+    // The body is not valid, or a certificate is not valid base64.
+    INVALID,
+    // The callback rejected a certificate.
+    INVALID_CERT,
+  };
+
+  // |cert_cb| is called with the DER encoding of each certificate, in
+  // order, and returns whether it is valid.
+  explicit ChainParser(
+      const std::function<bool(const std::string& der)>& cert_cb);
+
+  // Parses the next |length| bytes of the body. Once this does not
+  // return OK, it keeps returning the same result.
+  Result Feed(const char* data, size_t length);
+
+  // Returns OK if the body was complete, or the error otherwise.
+  Result Finish();
+
+ private:
+  enum State {
+    BEFORE_OBJECT,
+    BEFORE_KEY,
+    IN_KEY,
+    BEFORE_COLON,
+    BEFORE_ARRAY,
+    BEFORE_CERT,
+    IN_CERT,
+    IN_CERT_ESCAPE,
+    AFTER_CERT,
+    AFTER_ARRAY,
+    DONE,
+  };
+
+  Result Parse(char c);
+  // Adds the base64 character |c| to the certificate.
+  bool AddBase64(char c);
+  bool FinishCert();
+
+  const std::function<bool(const std::string& der)> cert_cb_;
+  State state_;
+  Result result_;
+  std::string key_;
+  // The certificate decoded so far, reused for each of them.
+  std::string der_;
+  // The base64 characters decoded so far from the current group of
+  // four, and how many of them are padding.
+  uint32_t group_;
+  int group_size_;
+  int padding_;
+
+  DISALLOW_COPY_AND_ASSIGN(ChainParser);
+};
+
+
+}  // namespace cert_trans
+
+#endif  // CERT_TRANS_SERVER_CHAIN_PARSER_H_
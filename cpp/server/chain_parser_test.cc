@@ -0,0 +1,146 @@
+#include "server/chain_parser.h"
+
+#include <gtest/gtest.h>
+#include <string>
+#include <vector>
+
+#include "util/testing.h"
+
+namespace cert_trans {
+namespace {
+
+using std::string;
+using std::vector;
+
+// "first" and "second!", in base64.
+const char kChain[] =
+    " {\n  \"chain\" : [ \"Zmlyc3Q=\", \"c2Vjb25kIQ==\" ]\n}\n";
+// Decodes to "\xff\xff".
+const char kEscapedChain[] = "{\"chain\":[\"\\/\\/8=\"]}";
+
+
+class ChainParserTest : public ::testing::Test {
+ protected:
+  ChainParserTest()
+      : valid_(true), parser_([this](const string& der) {
+          certs_.push_back(der);
+          return valid_;
+        }) {
+  }
+
+  ChainParser::Result Parse(const string& body) {
+    const ChainParser::Result result(parser_.Feed(body.data(), body.size()));
+    return result == ChainParser::OK ? parser_.Finish() : result;
+  }
+
+  bool valid_;
+  vector<string> certs_;
+  ChainParser parser_;
+};
+
+
+TEST_F(ChainParserTest, ParsesChain) {
+  EXPECT_EQ(ChainParser::OK, Parse(kChain));
+  ASSERT_EQ(2U, certs_.size());
+  EXPECT_EQ("first", certs_[0]);
+  EXPECT_EQ("second!", certs_[1]);
+}
+
+
+TEST_F(ChainParserTest, ParsesEscapedSlash) {
+  EXPECT_EQ(ChainParser::OK, Parse(kEscapedChain));
+  ASSERT_EQ(1U, certs_.size());
+  EXPECT_EQ("\xff\xff", certs_[0]);
+}
+
+
+TEST_F(ChainParserTest, ParsesEmptyChain) {
+  EXPECT_EQ(ChainParser::OK, Parse("{\"chain\":[]}"));
+  EXPECT_TRUE(certs_.empty());
+}
+
+
+TEST_F(ChainParserTest, ParsesInPieces) {
+  const string body(kChain);
+  for (size_t split = 0; split <= body.size(); ++split) {
+    vector<string> certs;
+    ChainParser parser([&certs](const string& der) {
+      certs.push_back(der);
+      return true;
+    });
+    EXPECT_EQ(ChainParser::OK, parser.Feed(body.data(), split));
+    EXPECT_EQ(ChainParser::OK,
+              parser.Feed(body.data() + split, body.size() - split));
+    EXPECT_EQ(ChainParser::OK, parser.Finish()) << "split at " << split;
+    ASSERT_EQ(2U, certs.size());
+    EXPECT_EQ("first", certs[0]);
+    EXPECT_EQ("second!", certs[1]);
+  }
+}
+
+
+TEST_F(ChainParserTest, LeavesOtherMembersUnhandled) {
+  EXPECT_EQ(ChainParser::UNHANDLED,
+            Parse("{\"foo\":1,\"chain\":[\"Zmlyc3Q=\"]}"));
+}
+
+
+TEST_F(ChainParserTest, LeavesLongerKeyUnhandled) {
+  EXPECT_EQ(ChainParser::UNHANDLED, Parse("{\"chains\":[]}"));
+}
+
+
+TEST_F(ChainParserTest, LeavesTrailingMembersUnhandled) {
+  EXPECT_EQ(ChainParser::UNHANDLED,
+            Parse("{\"chain\":[\"Zmlyc3Q=\"],\"foo\":1}"));
+}
+
+
+TEST_F(ChainParserTest, LeavesNonObjectUnhandled) {
+  EXPECT_EQ(ChainParser::UNHANDLED, Parse("[]"));
+}
+
+
+TEST_F(ChainParserTest, RejectsInvalidBase64) {
+  EXPECT_EQ(ChainParser::INVALID, Parse("{\"chain\":[\"Zm!yc3Q=\"]}"));
+}
+
+
+TEST_F(ChainParserTest, RejectsMisplacedPadding) {
+  EXPECT_EQ(ChainParser::INVALID, Parse("{\"chain\":[\"Zm==c3Q=\"]}"));
+}
+
+
+TEST_F(ChainParserTest, RejectsIncompleteGroup) {
+  EXPECT_EQ(ChainParser::INVALID, Parse("{\"chain\":[\"Zmlyc3\"]}"));
+}
+
+
+TEST_F(ChainParserTest, RejectsTruncatedBody) {
+  EXPECT_EQ(ChainParser::INVALID, Parse("{\"chain\":[\"Zmlyc3Q=\""));
+}
+
+
+TEST_F(ChainParserTest, RejectsTrailingGarbage) {
+  EXPECT_EQ(ChainParser::INVALID, Parse("{\"chain\":[]} x"));
+}
+
+
+TEST_F(ChainParserTest, ReportsRejectedCert) {
+  valid_ = false;
+  EXPECT_EQ(ChainParser::INVALID_CERT, Parse(kChain));
+  EXPECT_EQ(1U, certs_.size());
+  // Keeps returning the same result.
+  EXPECT_EQ(ChainParser::INVALID_CERT, parser_.Feed("{", 1));
+  EXPECT_EQ(ChainParser::INVALID_CERT, parser_.Finish());
+}
+
+
+}  // namespace
+}  // namespace cert_trans
+
+
+int main(int argc, char** argv) {
+  cert_trans::test::InitTesting(argv[0], &argc, &argv, true);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,764 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <openssl/ec.h>
+#include <openssl/evp.h>
+#include <openssl/obj_mac.h>
+#include <random>
+#include <stdint.h>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "log/cert_checker.h"
+#include "log/cluster_state_controller.h"
+#include "log/log_signer.h"
+#include "log/logged_certificate.h"
+#include "log/sqlite_db.h"
+#include "log/strict_consistent_store.h"
+#include "log/tree_signer.h"
+#include "merkletree/compact_merkle_tree.h"
+#include "merkletree/serial_hasher.h"
+#include "net/url_fetcher.h"
+#include "proto/ct.pb.h"
+#include "server/handler.h"
+#include "server/metrics.h"
+#include "server/server.h"
+#include "util/etcd.h"
+#include "util/fake_etcd.h"
+#include "util/init.h"
+#include "util/libevent_wrapper.h"
+#include "util/status.h"
+#include "util/sync_task.h"
+#include "util/task.h"
+#include "util/thread_pool.h"
+#include "util/util.h"
+
+DEFINE_int32(nodes, 3, "Number of log nodes to simulate.");
+DEFINE_int32(base_port, 18080,
+             "The nodes serve HTTP on localhost, on consecutive ports from "
+             "this one, so that they fetch entries from each other as real "
+             "nodes do.");
+DEFINE_string(db_dir, "",
+              "Existing directory in which each node creates its SQLite "
+              "database; it should be empty, as the nodes expect a new log.");
+DEFINE_int32(duration_seconds, 60, "How long to submit entries for.");
+DEFINE_double(qps, 100, "Rate of new entries, added to random nodes.");
+DEFINE_int32(leaf_size, 1500, "Size of the leaf certificates, in bytes.");
+DEFINE_int32(network_latency_ms, 0,
+             "Delay added to every request between nodes.");
+DEFINE_int32(etcd_latency_ms, 0, "Delay added to every etcd request.");
+DEFINE_int32(fail_node, -1,
+             "If not negative, the node to cut off from etcd and the other "
+             "nodes after --fail_after_seconds.");
+DEFINE_int32(fail_after_seconds, 20, "When to fail --fail_node.");
+DEFINE_int32(recover_after_seconds, 0,
+             "If not 0, when to reconnect --fail_node.");
+DEFINE_int32(sequencing_period_ms, 1000,
+             "How often the master sequences the pending entries.");
+DEFINE_int32(signing_period_ms, 1000, "How often each node signs its tree.");
+DEFINE_int32(cleanup_period_ms, 1000,
+             "How often the master cleans up the sequenced entries.");
+DEFINE_int32(poll_ms, 10,
+             "How often the tree sizes are sampled, which bounds the "
+             "precision of the delays reported.");
+DEFINE_int32(minimum_serving_nodes, 2,
+             "ClusterConfig::minimum_serving_nodes of the simulated cluster.");
+DEFINE_double(minimum_serving_fraction, 0.5,
+              "ClusterConfig::minimum_serving_fraction of the simulated "
+              "cluster.");
+DEFINE_int32(node_http_threads, 4,
+             "Number of threads handling the HTTP requests of each node.");
+
+namespace cert_trans {
+namespace {
+
+using std::bind;
+using std::chrono::duration;
+using std::chrono::milliseconds;
+using std::chrono::steady_clock;
+using std::function;
+using std::lock_guard;
+using std::mutex;
+using std::placeholders::_1;
+using std::placeholders::_2;
+using std::shared_ptr;
+using std::string;
+using std::thread;
+using std::unique_ptr;
+using std::vector;
+
+const char kEtcdRoot[] = "/root";
+
+
+// What stands between the nodes, and between them and etcd: delays
+// all their requests, and fails those of a node that is down, or to
+// it. The watches a node had set up before going down keep
+// delivering updates, which a partitioned node would not get.
+class Network {
+ public:
+  Network(libevent::Base* base, int num_nodes)
+      : base_(CHECK_NOTNULL(base)), down_(num_nodes) {
+    for (std::atomic<bool>& down : down_) {
+      down = false;
+    }
+  }
+
+  void SetDown(int node, bool down) {
+    down_.at(node) = down;
+  }
+
+  bool IsDown(int node) const {
+    return down_.at(node);
+  }
+
+  // The node serving on |port|, or -1 if there is none.
+  int NodeForPort(uint16_t port) const {
+    const int node(static_cast<int>(port) - FLAGS_base_port);
+    return node >= 0 && node < static_cast<int>(down_.size()) ? node : -1;
+  }
+
+  // Runs |request| after |latency_ms|, or fails |task| right away if
+  // it cannot get through.
+  void Send(bool can_send, int latency_ms, util::Task* task,
+            const function<void()>& request) {
+    if (!can_send) {
+      task->Return(util::Status(util::error::UNAVAILABLE, "node is down"));
+      return;
+    }
+    if (latency_ms <= 0) {
+      request();
+      return;
+    }
+    base_->Delay(milliseconds(latency_ms),
+                 new util::Task(
+                     [request](util::Task* delay) {
+                       unique_ptr<util::Task> delay_deleter(delay);
+                       request();
+                     },
+                     base_));
+  }
+
+ private:
+  libevent::Base* const base_;
+  vector<std::atomic<bool>> down_;
+
+  DISALLOW_COPY_AND_ASSIGN(Network);
+};
+
+
+// The etcd client of one node, which goes through the Network to the
+// etcd shared by all of them.
+class SimulatedEtcdClient : public EtcdClient {
+ public:
+  SimulatedEtcdClient(Network* network, int node, EtcdClient* etcd)
+      : network_(CHECK_NOTNULL(network)),
+        node_(node),
+        etcd_(CHECK_NOTNULL(etcd)) {
+  }
+
+  void Get(const Request& req, GetResponse* resp, util::Task* task) override {
+    Send(task, [=]() { etcd_->Get(req, resp, task); });
+  }
+
+  void Create(const string& key, const string& value, Response* resp,
+              util::Task* task) override {
+    Send(task, [=]() { etcd_->Create(key, value, resp, task); });
+  }
+
+  void CreateWithTTL(const string& key, const string& value,
+                     const std::chrono::seconds& ttl, Response* resp,
+                     util::Task* task) override {
+    Send(task, [=]() { etcd_->CreateWithTTL(key, value, ttl, resp, task); });
+  }
+
+  void Update(const string& key, const string& value,
+              const int64_t previous_index, Response* resp,
+              util::Task* task) override {
+    Send(task, [=]() {
+      etcd_->Update(key, value, previous_index, resp, task);
+    });
+  }
+
+  void UpdateWithTTL(const string& key, const string& value,
+                     const std::chrono::seconds& ttl,
+                     const int64_t previous_index, Response* resp,
+                     util::Task* task) override {
+    Send(task, [=]() {
+      etcd_->UpdateWithTTL(key, value, ttl, previous_index, resp, task);
+    });
+  }
+
+  void ForceSet(const string& key, const string& value, Response* resp,
+                util::Task* task) override {
+    Send(task, [=]() { etcd_->ForceSet(key, value, resp, task); });
+  }
+
+  void ForceSetWithTTL(const string& key, const string& value,
+                       const std::chrono::seconds& ttl, Response* resp,
+                       util::Task* task) override {
+    Send(task, [=]() { etcd_->ForceSetWithTTL(key, value, ttl, resp, task); });
+  }
+
+  void RefreshTTL(const string& key, const std::chrono::seconds& ttl,
+                  Response* resp, util::Task* task) override {
+    Send(task, [=]() { etcd_->RefreshTTL(key, ttl, resp, task); });
+  }
+
+  void Delete(const string& key, const int64_t current_index,
+              util::Task* task) override {
+    Send(task, [=]() { etcd_->Delete(key, current_index, task); });
+  }
+
+  void ForceDelete(const string& key, util::Task* task) override {
+    Send(task, [=]() { etcd_->ForceDelete(key, task); });
+  }
+
+  void GetStoreStats(StatsResponse* resp, util::Task* task) override {
+    Send(task, [=]() { etcd_->GetStoreStats(resp, task); });
+  }
+
+  void Watch(const string& key, const WatchCallback& cb,
+             util::Task* task) override {
+    Send(task, [=]() { etcd_->Watch(key, cb, task); });
+  }
+
+ private:
+  void Send(util::Task* task, const function<void()>& request) {
+    network_->Send(!network_->IsDown(node_), FLAGS_etcd_latency_ms, task,
+                   request);
+  }
+
+  Network* const network_;
+  const int node_;
+  EtcdClient* const etcd_;
+
+  DISALLOW_COPY_AND_ASSIGN(SimulatedEtcdClient);
+};
+
+
+// The UrlFetcher of one node, which goes through the Network when
+// fetching from another node.
+class SimulatedUrlFetcher : public UrlFetcher {
+ public:
+  SimulatedUrlFetcher(Network* network, int node, UrlFetcher* fetcher)
+      : network_(CHECK_NOTNULL(network)),
+        node_(node),
+        fetcher_(CHECK_NOTNULL(fetcher)) {
+  }
+
+  void Fetch(const Request& req, Response* resp, util::Task* task) override {
+    Send(req, task, [=]() { fetcher_->Fetch(req, resp, task); });
+  }
+
+  void FetchStreaming(const Request& req, Response* resp,
+                      const HeadersCallback& headers_cb,
+                      const BodyCallback& body_cb,
+                      util::Task* task) override {
+    Send(req, task, [=]() {
+      fetcher_->FetchStreaming(req, resp, headers_cb, body_cb, task);
+    });
+  }
+
+ private:
+  void Send(const Request& req, util::Task* task,
+            const function<void()>& request) {
+    const int peer(network_->NodeForPort(req.url.Port()));
+    if (peer < 0) {
+      request();
+      return;
+    }
+    network_->Send(!network_->IsDown(node_) && !network_->IsDown(peer),
+                   FLAGS_network_latency_ms, task, request);
+  }
+
+  Network* const network_;
+  const int node_;
+  UrlFetcher* const fetcher_;
+
+  DISALLOW_COPY_AND_ASSIGN(SimulatedUrlFetcher);
+};
+
+
+// The parts of a ct-server process, with the loops of its sequencer,
+// signer and cleanup threads.
+struct Node {
+  Node(int index, Network* network, EtcdClient* etcd, LogSigner* log_signer,
+       CertChecker* cert_checker);
+
+  // Runs |op| every |period| until |stopping| is set.
+  void Loop(const std::atomic<bool>* stopping, int period_ms,
+            const function<void()>& op);
+  void StartLoops(const std::atomic<bool>* stopping);
+  void JoinLoops();
+
+  const int index;
+  const unique_ptr<Database<LoggedCertificate>> db;
+  const shared_ptr<libevent::Base> base;
+  ThreadPool pool;
+  UrlFetcher real_fetcher;
+  SimulatedUrlFetcher fetcher;
+  SimulatedEtcdClient etcd;
+  unique_ptr<Server<LoggedCertificate>> server;
+  unique_ptr<TreeSigner<LoggedCertificate>> tree_signer;
+  vector<thread> loops;
+};
+
+
+Server<LoggedCertificate>::Options NodeOptions(int index) {
+  Server<LoggedCertificate>::Options options;
+  options.server = "127.0.0.1";
+  options.port = FLAGS_base_port + index;
+  options.etcd_root = kEtcdRoot;
+  options.num_http_server_threads = FLAGS_node_http_threads;
+  return options;
+}
+
+
+Node::Node(int node_index, Network* network, EtcdClient* shared_etcd,
+           LogSigner* log_signer, CertChecker* cert_checker)
+    : index(node_index),
+      db(new SQLiteDB<LoggedCertificate>(FLAGS_db_dir + "/node-" +
+                                         std::to_string(index) + ".db")),
+      base(std::make_shared<libevent::Base>()),
+      pool(4),
+      real_fetcher(base.get(), &pool),
+      fetcher(network, index, &real_fetcher),
+      etcd(network, index, shared_etcd),
+      server(new Server<LoggedCertificate>(NodeOptions(index), base, &pool,
+                                           db.get(), &etcd, &fetcher,
+                                           log_signer, cert_checker)) {
+  server->Initialise(false /* is_mirror */);
+  tree_signer.reset(new TreeSigner<LoggedCertificate>(
+      duration<double>(0), db.get(),
+      unique_ptr<CompactMerkleTree>(new CompactMerkleTree(new Sha256Hasher)),
+      server->consistent_store(), log_signer,
+      bind(&LogLookup<LoggedCertificate>::OfferLeafHashes,
+           server->log_lookup(), _1, _2)));
+}
+
+
+void Node::Loop(const std::atomic<bool>* stopping, int period_ms,
+                const function<void()>& op) {
+  while (!*stopping) {
+    op();
+    std::this_thread::sleep_for(milliseconds(period_ms));
+  }
+}
+
+
+void Node::StartLoops(const std::atomic<bool>* stopping) {
+  loops.emplace_back(&Node::Loop, this, stopping, FLAGS_sequencing_period_ms,
+                     [this]() {
+                       if (server->IsMaster()) {
+                         const util::Status status(
+                             tree_signer->SequenceNewEntries());
+                         LOG_IF(WARNING, !status.ok())
+                             << "node " << index
+                             << ": problem sequencing: " << status;
+                       }
+                     });
+  loops.emplace_back(&Node::Loop, this, stopping, FLAGS_signing_period_ms,
+                     [this]() {
+                       if (tree_signer->UpdateTree() ==
+                           TreeSigner<LoggedCertificate>::OK) {
+                         server->cluster_state_controller()->NewTreeHead(
+                             tree_signer->LatestSTH());
+                       }
+                     });
+  loops.emplace_back(&Node::Loop, this, stopping, FLAGS_cleanup_period_ms,
+                     [this]() {
+                       if (server->IsMaster()) {
+                         server->consistent_store()->CleanupOldEntries();
+                       }
+                     });
+}
+
+
+void Node::JoinLoops() {
+  for (thread& loop : loops) {
+    loop.join();
+  }
+}
+
+
+// Makes node 0 the master, and sets up the cluster in etcd as
+// "ct-clustertool initlog" does.
+void InitLog(Node* node, FakeEtcdClient* etcd, libevent::Base* base) {
+  node->server->election()->StartElection();
+  node->server->election()->WaitToBecomeMaster();
+
+  EtcdClient::Response resp;
+  util::SyncTask task(base);
+  etcd->Create(string(kEtcdRoot) + "/sequence_mapping", "", &resp,
+               task.task());
+  task.Wait();
+  CHECK_EQ(util::Status::OK, task.status());
+
+  CHECK_EQ(TreeSigner<LoggedCertificate>::OK,
+           node->tree_signer->UpdateTree());
+  CHECK_EQ(util::Status::OK, node->server->consistent_store()->SetServingSTH(
+                                 node->tree_signer->LatestSTH()));
+  ct::ClusterConfig config;
+  config.set_minimum_serving_nodes(FLAGS_minimum_serving_nodes);
+  config.set_minimum_serving_fraction(FLAGS_minimum_serving_fraction);
+  CHECK_EQ(util::Status::OK,
+           node->server->consistent_store()->SetClusterConfig(config));
+}
+
+
+EVP_PKEY* NewECKey() {
+  EC_KEY* const ec(
+      CHECK_NOTNULL(EC_KEY_new_by_curve_name(NID_X9_62_prime256v1)));
+  EC_KEY_set_asn1_flag(ec, OPENSSL_EC_NAMED_CURVE);
+  CHECK_EQ(1, EC_KEY_generate_key(ec));
+  EVP_PKEY* const pkey(CHECK_NOTNULL(EVP_PKEY_new()));
+  CHECK_EQ(1, EVP_PKEY_assign_EC_KEY(pkey, ec));
+  return pkey;
+}
+
+
+// Delays in milliseconds.
+class Delays {
+ public:
+  void Add(double ms) {
+    lock_guard<mutex> lock(lock_);
+    samples_.push_back(ms);
+  }
+
+  void Report(const string& name) {
+    lock_guard<mutex> lock(lock_);
+    std::cout << std::left << std::setw(28) << name << std::right
+              << std::setw(10) << samples_.size();
+    if (samples_.empty()) {
+      std::cout << std::endl;
+      return;
+    }
+    std::sort(samples_.begin(), samples_.end());
+    std::cout << std::fixed << std::setprecision(1);
+    for (const int percentile : {50, 90, 99}) {
+      std::cout << std::setw(10)
+                << samples_[std::min(samples_.size() - 1,
+                                     samples_.size() * percentile / 100)];
+    }
+    std::cout << std::setw(10) << samples_.back() << std::endl;
+  }
+
+ private:
+  mutex lock_;
+  vector<double> samples_;
+};
+
+
+// Samples the tree sizes of the nodes and the serving STH every
+// --poll_ms, to measure:
+//  - the merge delay, from the SCT timestamp of each entry to when a
+//    serving STH first includes it;
+//  - the replication lag, from when a node's database first reaches
+//    a size to when each of the others does.
+class Monitor {
+ public:
+  explicit Monitor(const vector<unique_ptr<Node>>* nodes, Network* network)
+      : nodes_(CHECK_NOTNULL(nodes)),
+        network_(CHECK_NOTNULL(network)),
+        stopping_(false),
+        serving_size_(0),
+        leading_size_(0),
+        behind_(nodes->size()),
+        thread_(&Monitor::Run, this) {
+  }
+
+  void Stop() {
+    stopping_ = true;
+    thread_.join();
+  }
+
+  void Report() {
+    std::cout << std::left << std::setw(28) << "delay" << std::right
+              << std::setw(10) << "samples" << std::setw(10) << "p50 ms"
+              << std::setw(10) << "p90 ms" << std::setw(10) << "p99 ms"
+              << std::setw(10) << "max ms" << std::endl;
+    merge_delays_.Report("merge_delay");
+    replication_lags_.Report("replication_lag");
+    std::cout << "serving tree size: " << serving_size_ << std::endl;
+    for (const auto& node : *nodes_) {
+      std::cout << "node " << node->index << " tree size: "
+                << node->db->TreeSize()
+                << (node->server->IsMaster() ? " (master)" : "")
+                << (network_->IsDown(node->index) ? " (down)" : "")
+                << std::endl;
+    }
+  }
+
+ private:
+  void Run() {
+    while (!stopping_) {
+      Poll();
+      std::this_thread::sleep_for(milliseconds(FLAGS_poll_ms));
+    }
+  }
+
+  void Poll() {
+    const steady_clock::time_point now(steady_clock::now());
+    const int64_t now_ms(util::TimeInMilliseconds());
+
+    int64_t leading_size(leading_size_);
+    for (const auto& node : *nodes_) {
+      leading_size = std::max(leading_size, node->db->TreeSize());
+    }
+    for (const auto& node : *nodes_) {
+      std::deque<std::pair<int64_t, steady_clock::time_point>>* const behind(
+          &behind_[node->index]);
+      const int64_t size(node->db->TreeSize());
+      while (!behind->empty() && behind->front().first <= size) {
+        replication_lags_.Add(
+            duration<double, std::milli>(now - behind->front().second)
+                .count());
+        behind->pop_front();
+      }
+      if (leading_size > leading_size_ && size < leading_size) {
+        behind->emplace_back(leading_size, now);
+      }
+    }
+    leading_size_ = leading_size;
+
+    for (const auto& node : *nodes_) {
+      if (network_->IsDown(node->index)) {
+        continue;
+      }
+      const util::StatusOr<ct::SignedTreeHead> sth(
+          node->server->consistent_store()->GetServingSTH());
+      if (!sth.ok() || sth.ValueOrDie().tree_size() <= serving_size_) {
+        break;
+      }
+      AddMergeDelays(sth.ValueOrDie().tree_size(), now_ms);
+      break;
+    }
+  }
+
+  // Records the merge delays of the entries up to |serving_size|,
+  // which were served at |now_ms|.
+  void AddMergeDelays(int64_t serving_size, int64_t now_ms) {
+    for (const auto& node : *nodes_) {
+      if (node->db->TreeSize() < serving_size) {
+        continue;
+      }
+      LoggedCertificate logged;
+      for (int64_t i = serving_size_; i < serving_size; ++i) {
+        CHECK_EQ(Database<LoggedCertificate>::LOOKUP_OK,
+                 node->db->LookupByIndex(i, &logged));
+        merge_delays_.Add(now_ms - static_cast<int64_t>(logged.timestamp()));
+      }
+      serving_size_ = serving_size;
+      return;
+    }
+  }
+
+  const vector<unique_ptr<Node>>* const nodes_;
+  Network* const network_;
+  std::atomic<bool> stopping_;
+  // Only used by |thread_| until Stop().
+  int64_t serving_size_;
+  int64_t leading_size_;
+  // For each node, the sizes it has yet to reach, with when the first
+  // node reached them.
+  vector<std::deque<std::pair<int64_t, steady_clock::time_point>>> behind_;
+  Delays merge_delays_;
+  Delays replication_lags_;
+  thread thread_;
+
+  DISALLOW_COPY_AND_ASSIGN(Monitor);
+};
+
+
+std::map<string, int64_t> EtcdStats(FakeEtcdClient* etcd,
+                                    libevent::Base* base) {
+  EtcdClient::StatsResponse resp;
+  util::SyncTask task(base);
+  etcd->GetStoreStats(&resp, task.task());
+  task.Wait();
+  CHECK_EQ(util::Status::OK, task.status());
+  return resp.stats;
+}
+
+
+void ReportEtcdStats(const std::map<string, int64_t>& before,
+                     const std::map<string, int64_t>& after, double seconds) {
+  int64_t total(0);
+  for (const auto& it : after) {
+    // Not counts of operations.
+    if (it.first == "watchers" || it.first == "expireCount") {
+      continue;
+    }
+    const auto previous(before.find(it.first));
+    const int64_t ops(it.second -
+                      (previous != before.end() ? previous->second : 0));
+    total += ops;
+    if (ops > 0) {
+      std::cout << "etcd " << std::left << std::setw(24) << it.first
+                << std::right << std::setw(12) << std::fixed
+                << std::setprecision(1) << ops / seconds << " ops/s"
+                << std::endl;
+    }
+  }
+  std::cout << "etcd " << std::left << std::setw(24) << "total" << std::right
+            << std::setw(12) << std::fixed << std::setprecision(1)
+            << total / seconds << " ops/s" << std::endl;
+}
+
+
+// Adds entries to the nodes that are up, at --qps for
+// --duration_seconds, failing and recovering --fail_node on the way.
+// Returns how many entries were accepted.
+int64_t Submit(const vector<unique_ptr<Node>>& nodes, Network* network) {
+  std::mt19937 random;
+  std::atomic<int64_t> accepted(0);
+  std::atomic<int64_t> outstanding(0);
+  ThreadPool callbacks(2);
+  const steady_clock::time_point start(steady_clock::now());
+  const steady_clock::time_point end(
+      start + std::chrono::seconds(FLAGS_duration_seconds));
+  const steady_clock::duration interval(
+      std::chrono::duration_cast<steady_clock::duration>(
+          duration<double>(1 / FLAGS_qps)));
+  bool failed(false);
+  bool recovered(false);
+  int64_t n(0);
+  for (steady_clock::time_point due(start); due < end; due += interval) {
+    std::this_thread::sleep_until(due);
+    const double elapsed_seconds(duration<double>(due - start).count());
+    if (FLAGS_fail_node >= 0 && !failed &&
+        elapsed_seconds >= FLAGS_fail_after_seconds) {
+      LOG(WARNING) << "failing node " << FLAGS_fail_node;
+      network->SetDown(FLAGS_fail_node, true);
+      failed = true;
+    }
+    if (failed && !recovered && FLAGS_recover_after_seconds > 0 &&
+        elapsed_seconds >= FLAGS_recover_after_seconds) {
+      LOG(WARNING) << "recovering node " << FLAGS_fail_node;
+      network->SetDown(FLAGS_fail_node, false);
+      recovered = true;
+    }
+
+    Node* const node(nodes[std::uniform_int_distribution<size_t>(
+        0, nodes.size() - 1)(random)].get());
+    if (network->IsDown(node->index)) {
+      continue;
+    }
+    string leaf("entry/" + std::to_string(n++) + "/");
+    leaf.resize(std::max<size_t>(leaf.size(), FLAGS_leaf_size), 'x');
+    LoggedCertificate* const cert(new LoggedCertificate);
+    cert->mutable_sct()->set_timestamp(util::TimeInMilliseconds());
+    cert->mutable_entry()->set_type(ct::X509_ENTRY);
+    cert->mutable_entry()->mutable_x509_entry()->set_leaf_certificate(leaf);
+    ++outstanding;
+    node->server->consistent_store()->AddPendingEntryAsync(
+        cert, new util::Task(
+                  [cert, &accepted, &outstanding](util::Task* task) {
+                    unique_ptr<util::Task> task_deleter(task);
+                    if (task->status().ok()) {
+                      ++accepted;
+                    }
+                    delete cert;
+                    --outstanding;
+                  },
+                  &callbacks));
+  }
+  while (outstanding > 0) {
+    std::this_thread::sleep_for(milliseconds(10));
+  }
+  return accepted;
+}
+
+
+}  // namespace
+}  // namespace cert_trans
+
+
+int main(int argc, char* argv[]) {
+  using cert_trans::Node;
+
+  util::InitCT(&argc, &argv);
+
+  CHECK(!FLAGS_db_dir.empty()) << "--db_dir is required";
+  CHECK_GT(FLAGS_nodes, 0);
+  CHECK_GT(FLAGS_base_port, 0);
+  CHECK_LT(FLAGS_base_port + FLAGS_nodes, 65536);
+  CHECK_GT(FLAGS_duration_seconds, 0);
+  CHECK_GT(FLAGS_qps, 0);
+  CHECK_LT(FLAGS_fail_node, FLAGS_nodes);
+  CHECK_GT(FLAGS_poll_ms, 0);
+  // A node that is cut off for a while must not exit, as it would in
+  // production.
+  FLAGS_watchdog_timeout_is_fatal = false;
+
+  cert_trans::Server<cert_trans::LoggedCertificate>::StaticInit();
+
+  // The etcd and the network delays have their own event loop.
+  const std::shared_ptr<cert_trans::libevent::Base> base(
+      std::make_shared<cert_trans::libevent::Base>());
+  cert_trans::libevent::EventPumpThread pump(base);
+  cert_trans::FakeEtcdClient etcd(base.get());
+  cert_trans::Network network(base.get(), FLAGS_nodes);
+
+  // All the nodes sign with the same key, as those of one log do.
+  LogSigner log_signer(cert_trans::NewECKey());
+  cert_trans::CertChecker checker;
+
+  std::vector<std::unique_ptr<Node>> nodes;
+  for (int i = 0; i < FLAGS_nodes; ++i) {
+    nodes.emplace_back(
+        new Node(i, &network, &etcd, &log_signer, &checker));
+    if (i == 0) {
+      cert_trans::InitLog(nodes[0].get(), &etcd, base.get());
+    }
+    nodes.back()->server->WaitForReplication();
+  }
+
+  std::atomic<bool> stopping(false);
+  for (const auto& node : nodes) {
+    node->StartLoops(&stopping);
+  }
+  cert_trans::Monitor monitor(&nodes, &network);
+
+  const std::map<std::string, int64_t> stats_before(
+      cert_trans::EtcdStats(&etcd, base.get()));
+  const std::chrono::steady_clock::time_point start(
+      std::chrono::steady_clock::now());
+  const int64_t accepted(cert_trans::Submit(nodes, &network));
+  // Leaves the cluster time to merge the last entries.
+  std::this_thread::sleep_for(
+      std::chrono::milliseconds(std::max(FLAGS_sequencing_period_ms,
+                                         FLAGS_signing_period_ms) *
+                                5));
+  const double seconds(std::chrono::duration<double>(
+                           std::chrono::steady_clock::now() - start)
+                           .count());
+  const std::map<std::string, int64_t> stats_after(
+      cert_trans::EtcdStats(&etcd, base.get()));
+
+  monitor.Stop();
+  stopping = true;
+  for (const auto& node : nodes) {
+    node->JoinLoops();
+  }
+
+  std::cout << "accepted " << accepted << " entries in " << std::fixed
+            << std::setprecision(1) << seconds << "s" << std::endl;
+  monitor.Report();
+  cert_trans::ReportEtcdStats(stats_before, stats_after, seconds);
+
+  // As for ct-clustertool, the watches of the nodes would not let
+  // them be destroyed.
+  _exit(0);
+}
@@ -1,9 +1,15 @@
+#include <atomic>
 #include <gflags/gflags.h>
 #include <iostream>
 #include <ldns/ldns.h>
+#include <mutex>
 #include <sstream>
 #include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
 
+#include "base/macros.h"
 #include "log/log_lookup.h"
 #include "log/logged_certificate.h"
 #include "log/sqlite_db.h"
@@ -15,12 +21,22 @@
 using cert_trans::LoggedCertificate;
 using ct::SignedTreeHead;
 using google::RegisterFlagValidator;
+using std::atomic;
+using std::lock_guard;
+using std::mutex;
 using std::string;
 using std::stringstream;
+using std::thread;
+using std::vector;
 
 DEFINE_int32(port, 0, "Server port");
 DEFINE_string(domain, "", "Domain");
 DEFINE_string(db, "", "Database for certificate and tree storage");
+DEFINE_int32(threads, 1,
+             "Number of threads answering queries, each with its own socket "
+             "on the port (with SO_REUSEPORT if more than 1)");
+DEFINE_int32(sth_refresh_seconds, 1,
+             "How often to check the database for a new STH");
 
 // Basic sanity checks on flag values.
 static bool ValidatePort(const char*, int32_t port) {
@@ -37,11 +53,139 @@ static bool NonEmptyString(const char*, const string& str) {
 static const bool domain_dummy =
     RegisterFlagValidator(&FLAGS_domain, &NonEmptyString);
 
+static bool ValidatePositive(const char*, int32_t value) {
+  return value > 0;
+}
+
+static const bool threads_dummy =
+    RegisterFlagValidator(&FLAGS_threads, &ValidatePositive);
+
+static const bool sth_refresh_dummy =
+    RegisterFlagValidator(&FLAGS_sth_refresh_seconds, &ValidatePositive);
+
+// Answers the questions, for all the threads. Only uses the
+// in-memory state of the LogLookup, so that the database is not
+// queried for each question, and remembers the answer for the
+// current STH. Thread-safe.
+class CTDNSResponder {
+ public:
+  explicit CTDNSResponder(LogLookup<LoggedCertificate>* lookup)
+      : lookup_(CHECK_NOTNULL(lookup)), sth_timestamp_(0) {
+  }
+
+  string Response(const string& question) {
+    if (question == "sth")
+      return STH();
+
+    size_t dot = question.find_last_of('.');
+    if (dot == string::npos)
+      return question + " not understood";
+
+    string head = question.substr(0, dot);
+    string tail = question.substr(dot + 1);
+    VLOG(1) << "head = " << head << ", tail = " << tail;
+    if (tail == "tree")
+      return Tree(head);
+    else if (tail == "hash")
+      return Hash(head);
+    else if (tail == "leafhash")
+      return LeafHash(head);
+
+    return question + " is the question.";
+  }
+
+ private:
+  string LeafHash(const string& index_str) const {
+    int index = atoi(index_str.c_str());
+    string leaf_hash;
+    if (lookup_->LeafHashAtIndex(index, &leaf_hash) != lookup_->OK)
+      return "No such index";
+    return util::ToBase64(leaf_hash);
+  }
+
+  string Hash(const string& hash) {
+    // FIXME: decode hash!
+    int64_t index;
+    if (lookup_->GetIndex(hash, &index) != lookup_->OK)
+      return "No such hash";
+
+    stringstream ss;
+    ss << index;
+    return ss.str();
+  }
+
+  string Tree(const string& question) {
+    size_t dot = question.find_first_of('.');
+    if (dot == string::npos)
+      return question + " not understood";
+
+    size_t dot2 = question.find_first_of('.', dot + 1);
+    if (dot2 == string::npos)
+      return question + " not understood";
+
+    string level = question.substr(0, dot);
+    string index = question.substr(dot + 1, dot2 - dot - 1);
+    string size = question.substr(dot2 + 1);
+
+    VLOG(1) << "level = " << level << ", index = " << index
+            << ", size = " << size;
+
+    ct::ShortMerkleAuditProof proof;
+    if (lookup_->AuditProof(atoi(index.c_str()), atoi(size.c_str()),
+                            &proof) != lookup_->OK)
+      return "Lookup of node " + index + "." + size + " failed";
+
+    int l = atoi(level.c_str());
+    if (l < 0 || l >= proof.path_node_size())
+      return "Level " + level + " is out of range";
+
+    string b64 = util::ToBase64(proof.path_node(l));
+    return b64;
+  }
+
+  string STH() {
+    // Only rebuilt when the lookup has a new STH.
+    const uint64_t timestamp(lookup_->GetSTHTimestamp());
+    {
+      lock_guard<mutex> lock(sth_lock_);
+      if (timestamp == sth_timestamp_ && !sth_answer_.empty())
+        return sth_answer_;
+    }
+
+    const SignedTreeHead sth(lookup_->GetSTH());
+
+    std::string signature;
+    CHECK_EQ(Serializer::SerializeDigitallySigned(sth.signature(), &signature),
+             Serializer::OK);
+
+    stringstream ss;
+    ss << sth.tree_size() << '.' << sth.timestamp() << '.'
+       << util::ToBase64(sth.sha256_root_hash()) << '.'
+       << util::ToBase64(signature);
+
+    lock_guard<mutex> lock(sth_lock_);
+    // Another thread could have been quicker with an even newer one.
+    if (sth.timestamp() >= sth_timestamp_) {
+      sth_timestamp_ = sth.timestamp();
+      sth_answer_ = ss.str();
+    }
+    return ss.str();
+  }
+
+  LogLookup<LoggedCertificate>* const lookup_;
+
+  mutex sth_lock_;
+  uint64_t sth_timestamp_;
+  string sth_answer_;
+
+  DISALLOW_COPY_AND_ASSIGN(CTDNSResponder);
+};
+
 class CTUDPDNSServer : public UDPServer {
  public:
-  CTUDPDNSServer(const string& domain, SQLiteDB<LoggedCertificate>* db,
+  CTUDPDNSServer(const string& domain, CTDNSResponder* responder,
                  EventLoop* loop, int fd)
-      : UDPServer(loop, fd), domain_(domain), lookup_(db), db_(db) {
+      : UDPServer(loop, fd), domain_(domain), responder_(responder) {
   }
 
   virtual void PacketRead(const sockaddr_in& from, const char* buf,
@@ -103,7 +247,7 @@ class CTUDPDNSServer : public UDPServer {
       ldns_buffer_free(dname);
       dname = NULL;
 
-      LOG(INFO) << "Question is TXT of " << owner_name;
+      VLOG(1) << "Question is TXT of " << owner_name;
 
       if (owner_name.length() <= domain_.length() ||
           owner_name.compare(owner_name.length() - domain_.length(),
@@ -112,7 +256,7 @@ class CTUDPDNSServer : public UDPServer {
         continue;
       }
 
-      std::string response = Response(
+      std::string response = responder_->Response(
           owner_name.substr(0, owner_name.length() - domain_.length() - 1));
 
       ldns_rr* answer = ldns_rr_new();
@@ -126,9 +270,11 @@ class CTUDPDNSServer : public UDPServer {
     }
     ldns_pkt_free(packet);
 
-    char* answer_str = ldns_pkt2str(answers);
-    LOG(INFO) << "Answer is " << answer_str;
-    free(answer_str);
+    if (VLOG_IS_ON(1)) {
+      char* answer_str = ldns_pkt2str(answers);
+      VLOG(1) << "Answer is " << answer_str;
+      free(answer_str);
+    }
 
     uint8_t* wire_answer;
     size_t answer_size;
@@ -142,97 +288,54 @@ class CTUDPDNSServer : public UDPServer {
   }
 
  private:
-  string Response(string question) {
-    if (question == "sth")
-      return STH();
+  const string domain_;
+  CTDNSResponder* const responder_;
+};
 
-    size_t dot = question.find_last_of('.');
-    if (dot == string::npos)
-      return question + " not understood";
 
-    string head = question.substr(0, dot);
-    string tail = question.substr(dot + 1);
-    LOG(INFO) << "head = " << head << ", tail = " << tail;
-    if (tail == "tree")
-      return Tree(head);
-    else if (tail == "hash")
-      return Hash(head);
-    else if (tail == "leafhash")
-      return LeafHash(head);
-
-    return question + " is the question.";
+// Checks the database for a new STH, for the LogLookup to ingest
+// (in the background).
+class STHRefresher : public RepeatedEvent {
+ public:
+  STHRefresher(EventLoop* loop, SQLiteDB<LoggedCertificate>* db)
+      : RepeatedEvent(FLAGS_sth_refresh_seconds), db_(db) {
+    loop->Add(this);
   }
 
-  string LeafHash(const string& index_str) const {
-    int index = atoi(index_str.c_str());
-    LoggedCertificate cert;
-    if (db_->LookupByIndex(index, &cert) != db_->LOOKUP_OK)
-      return "No such index";
-    return util::ToBase64(lookup_.LeafHash(cert));
+  std::string Description() {
+    return "STH refresh";
   }
 
-  string Hash(const string& hash) {
+  void Execute() {
     db_->ForceNotifySTH();
-
-    // FIXME: decode hash!
-    int64_t index;
-    if (lookup_.GetIndex(hash, &index) != lookup_.OK)
-      return "No such hash";
-
-    stringstream ss;
-    ss << index;
-    return ss.str();
   }
 
-  string Tree(const string& question) {
-    size_t dot = question.find_first_of('.');
-    if (dot == string::npos)
-      return question + " not understood";
-
-    size_t dot2 = question.find_first_of('.', dot + 1);
-    if (dot2 == string::npos)
-      return question + " not understood";
-
-    string level = question.substr(0, dot);
-    string index = question.substr(dot + 1, dot2 - dot - 1);
-    string size = question.substr(dot2 + 1);
-
-    LOG(INFO) << "level = " << level << ", index = " << index
-              << ", size = " << size;
-
-    ct::ShortMerkleAuditProof proof;
-    if (lookup_.AuditProof(atoi(index.c_str()), atoi(size.c_str()), &proof) !=
-        lookup_.OK)
-      return "Lookup of node " + index + "." + size + " failed";
+ private:
+  SQLiteDB<LoggedCertificate>* const db_;
+};
 
-    int l = atoi(level.c_str());
-    if (l < 0 || l >= proof.path_node_size())
-      return "Level " + level + " is out of range";
 
-    string b64 = util::ToBase64(proof.path_node(l));
-    return b64;
+// Stops the event loop of an additional thread once |stopping| is
+// set, checking every second.
+class StopWatcher : public RepeatedEvent {
+ public:
+  StopWatcher(EventLoop* loop, const atomic<bool>* stopping)
+      : RepeatedEvent(1), loop_(loop), stopping_(stopping) {
+    loop->Add(this);
   }
 
-  string STH() {
-    db_->ForceNotifySTH();
-
-    const SignedTreeHead& sth = lookup_.GetSTH();
-
-    std::string signature;
-    CHECK_EQ(Serializer::SerializeDigitallySigned(sth.signature(), &signature),
-             Serializer::OK);
-
-    stringstream ss;
-    ss << sth.tree_size() << '.' << sth.timestamp() << '.'
-       << util::ToBase64(sth.sha256_root_hash()) << '.'
-       << util::ToBase64(signature);
+  std::string Description() {
+    return "stop watcher";
+  }
 
-    return ss.str();
+  void Execute() {
+    if (*stopping_)
+      loop_->Stop();
   }
 
-  string domain_;
-  LogLookup<LoggedCertificate> lookup_;
-  SQLiteDB<LoggedCertificate>* const db_;
+ private:
+  EventLoop* const loop_;
+  const atomic<bool>* const stopping_;
 };
 
 class Keyboard : public Server {
@@ -272,15 +375,43 @@ int main(int argc, char* argv[]) {
   // populate it (which FileDB does not support).
   SQLiteDB<LoggedCertificate> db(FLAGS_db);
 
+  LogLookup<LoggedCertificate> lookup(&db);
+  CTDNSResponder responder(&lookup);
+
   EventLoop loop;
 
   // Mostly so we can have a clean exit for valgrind etc.
   Keyboard keyboard(&loop);
+  STHRefresher sth_refresher(&loop, &db);
 
+  // The first socket is served by this thread, the others by their
+  // own.
+  const bool reuse_port(FLAGS_threads > 1);
   int dns_fd;
-  CHECK(Services::InitServer(&dns_fd, FLAGS_port, NULL, SOCK_DGRAM));
-  CTUDPDNSServer dns(FLAGS_domain, &db, &loop, dns_fd);
+  CHECK(Services::InitServer(&dns_fd, FLAGS_port, NULL, SOCK_DGRAM,
+                             reuse_port));
+  CTUDPDNSServer dns(FLAGS_domain, &responder, &loop, dns_fd);
+
+  atomic<bool> stopping(false);
+  vector<thread> threads;
+  for (int i = 1; i < FLAGS_threads; ++i) {
+    int fd;
+    CHECK(Services::InitServer(&fd, FLAGS_port, NULL, SOCK_DGRAM, reuse_port));
+    threads.emplace_back([fd, &responder, &stopping]() {
+      EventLoop thread_loop;
+      StopWatcher stop_watcher(&thread_loop, &stopping);
+      CTUDPDNSServer thread_dns(FLAGS_domain, &responder, &thread_loop, fd);
+      thread_loop.Forever();
+      close(fd);
+    });
+  }
 
-  LOG(INFO) << "Server listening on port " << FLAGS_port;
+  LOG(INFO) << "Server listening on port " << FLAGS_port << " with "
+            << FLAGS_threads << " thread(s)";
   loop.Forever();
+
+  stopping = true;
+  for (thread& t : threads) {
+    t.join();
+  }
 }
@@ -13,8 +13,10 @@
 #include <openssl/crypto.h>
 #include <openssl/err.h>
 #include <signal.h>
+#include <sstream>
 #include <string>
 #include <unistd.h>
+#include <vector>
 
 
 #include "config.h"
@@ -29,6 +31,12 @@
 #include "log/file_db.h"
 #include "log/file_storage.h"
 #include "log/leveldb_db.h"
+#include "log/prefetching_iterator.h"
+#ifdef HAVE_ROCKSDB
+#include "log/rocksdb_db.h"
+#endif
+#include "log/segment_storage.h"
+#include "log/snapshot_loader.h"
 #include "log/sqlite_db.h"
 #include "log/strict_consistent_store.h"
 #include "merkletree/compact_merkle_tree.h"
@@ -41,6 +49,7 @@
 #include "server/metrics.h"
 #include "server/proxy.h"
 #include "server/server.h"
+#include "util/cpu_affinity.h"
 #include "util/etcd.h"
 #include "util/fake_etcd.h"
 #include "util/init.h"
@@ -53,6 +62,8 @@
 #include "util/util.h"
 #include "util/uuid.h"
 
+DECLARE_string(thread_pool_cpus);
+
 DEFINE_string(server, "localhost", "Server host");
 DEFINE_int32(port, 9999, "Server port");
 // TODO(alcutter): Just specify a root dir with a single flag.
@@ -63,6 +74,8 @@ DEFINE_string(sqlite_db, "",
               "SQLite database for certificate and tree storage");
 DEFINE_string(leveldb_db, "",
               "LevelDB database for certificate and tree storage");
+DEFINE_string(rocksdb_db, "",
+              "RocksDB database for certificate and tree storage");
 // TODO(ekasper): sanity-check these against the directory structure.
 DEFINE_int32(cert_storage_depth, 0,
              "Subdirectory depth for certificates; if the directory is not "
@@ -70,6 +83,11 @@ DEFINE_int32(cert_storage_depth, 0,
 DEFINE_int32(tree_storage_depth, 0,
              "Subdirectory depth for tree signatures; if the directory is not "
              "empty, must match the existing depth");
+DEFINE_int32(cert_segment_size_mb, 0,
+             "If not 0, certificates are appended to segment files of about "
+             "this many MiB in --cert_dir, instead of being written to a "
+             "file each; if the directory is not empty, must match how it "
+             "was written.");
 DEFINE_int32(log_stats_frequency_seconds, 3600,
              "Interval for logging summary statistics. Approximate: the "
              "server will log statistics if in the beginning of its select "
@@ -89,6 +107,33 @@ DEFINE_string(
     "PEM-encoded server public key file of the log we're mirroring.");
 DEFINE_int32(local_sth_update_frequency_seconds, 30,
              "Number of seconds between local checks for updated tree data.");
+DEFINE_string(bootstrap_snapshot_dir, "",
+              "Directory of a snapshot of the target log (see "
+              "log/snapshot_loader.h) to load into the database before "
+              "fetching from the target log, if the database is behind it.");
+DEFINE_string(bootstrap_checkpoint_dir, "",
+              "Directory where progress loading --bootstrap_snapshot_dir is "
+              "kept, so that an interrupted load can be resumed.");
+DEFINE_string(target_path_prefix, "",
+              "Prefix of the paths the log of --target_log_uri is served "
+              "under, such as \"/pilot\", if not at the root.");
+DEFINE_string(additional_target_logs, "",
+              "File listing other logs to mirror in this process, one per "
+              "line: the prefix of the paths it is served under, its URI, "
+              "the file of its public key, its database (of the same type "
+              "as that of --target_log_uri), and optionally the maximum "
+              "number of requests in flight to it, to favour some logs "
+              "over others (see --remote_peer_max_requests). They share "
+              "the thread pools and the connections of the main log, and "
+              "have their cluster state under --etcd_root followed by "
+              "their prefix.");
+DEFINE_bool(read_only_replica, false,
+            "If true, this is a read-only replica of the cluster serving "
+            "--target_log_uri, for adding read capacity to it: it takes no "
+            "part in its election and does not use etcd at all, but "
+            "fetches the entries and the tree heads from that URI, and "
+            "serves the tree heads once it has all their entries. Needs "
+            "--etcd_servers to be empty.");
 
 namespace libevent = cert_trans::libevent;
 
@@ -104,6 +149,7 @@ using cert_trans::FakeEtcdClient;
 using cert_trans::FileStorage;
 using cert_trans::HttpHandler;
 using cert_trans::JsonOutput;
+using cert_trans::KeyValueStorage;
 using cert_trans::Latency;
 using cert_trans::LoggedCertificate;
 using cert_trans::MasterElection;
@@ -112,6 +158,7 @@ using cert_trans::Proxy;
 using cert_trans::ReadPublicKey;
 using cert_trans::RemotePeer;
 using cert_trans::ScopedLatency;
+using cert_trans::SegmentStorage;
 using cert_trans::Server;
 using cert_trans::StrictConsistentStore;
 using cert_trans::SplitHosts;
@@ -128,6 +175,7 @@ using std::chrono::milliseconds;
 using std::chrono::seconds;
 using std::chrono::steady_clock;
 using std::function;
+using std::istringstream;
 using std::lock_guard;
 using std::make_pair;
 using std::make_shared;
@@ -138,6 +186,7 @@ using std::shared_ptr;
 using std::string;
 using std::thread;
 using std::unique_ptr;
+using std::vector;
 using util::HexString;
 using util::StatusOr;
 using util::SyncTask;
@@ -206,6 +255,9 @@ static const bool c_st_dummy =
     RegisterFlagValidator(&FLAGS_cert_storage_depth, &ValidateIsNonNegative);
 static const bool t_st_dummy =
     RegisterFlagValidator(&FLAGS_tree_storage_depth, &ValidateIsNonNegative);
+static const bool c_seg_dummy =
+    RegisterFlagValidator(&FLAGS_cert_segment_size_mb,
+                          &ValidateIsNonNegative);
 
 static bool ValidateIsPositive(const char* flagname, int value) {
   if (value <= 0) {
@@ -222,77 +274,216 @@ static const bool stats_dummy =
 static const bool follow_dummy =
     RegisterFlagValidator(&FLAGS_target_poll_frequency_seconds,
                           &ValidateIsPositive);
+
+
+// The number of roots at recent tree sizes that STHUpdater keeps, to
+// check tree heads from the target log that arrive after larger ones.
+const size_t kRecentRoots = 64;
+
+
+// Returns the root of the local tree at |tree_size|, which must be at
+// most the size of the local tree, from a tree head of that size
+// served already, or else by hashing the entries after those of the
+// serving tree. This is only needed for tree heads that are older
+// than the tree of the STHUpdater, and not in its recent roots.
+string LocalRootAtSize(const Database<LoggedCertificate>* db,
+                       LogLookup<LoggedCertificate>* log_lookup,
+                       int64_t tree_size) {
+  if (tree_size <= log_lookup->GetSTH().tree_size()) {
+    return log_lookup->RootAtSnapshot(tree_size);
+  }
+
+  // The tree heads in the database all matched the local tree.
+  SignedTreeHead served_sth;
+  if (db->LookupTreeHeadBySize(tree_size, &served_sth) ==
+      Database<LoggedCertificate>::LOOKUP_OK) {
+    return served_sth.sha256_root_hash();
+  }
+
+  const unique_ptr<CompactMerkleTree> tree(
+      log_lookup->GetCompactMerkleTree(new Sha256Hasher));
+  const unique_ptr<Database<LoggedCertificate>::Iterator> entries(
+      ScanEntriesPrefetching(db, tree->LeafCount(),
+                             tree_size - tree->LeafCount()));
+  LoggedCertificate entry;
+  while (static_cast<int64_t>(tree->LeafCount()) < tree_size) {
+    CHECK(entries->GetNextEntry(&entry));
+    CHECK_EQ(static_cast<int64_t>(tree->LeafCount()), entry.sequence_number());
+    string leaf_hash;
+    CHECK(entry.LeafHash(&leaf_hash));
+    tree->AddLeafHash(leaf_hash);
+  }
+  return tree->CurrentRoot();
+}
+
+
+// A log to mirror, from --additional_target_logs.
+struct TargetLog {
+  string path_prefix;
+  string uri;
+  string public_key;
+  string db;
+  // 0 for the default.
+  int max_requests;
+};
+
+
+vector<TargetLog> ReadTargetLogs(const string& file) {
+  string contents;
+  CHECK(util::ReadTextFile(file, &contents)) << "could not read " << file;
+
+  vector<TargetLog> logs;
+  istringstream lines(contents);
+  string line;
+  while (getline(lines, line)) {
+    if (line.empty() || line[0] == '#') {
+      continue;
+    }
+    istringstream fields(line);
+    TargetLog log;
+    CHECK(fields >> log.path_prefix >> log.uri >> log.public_key >> log.db)
+        << "invalid line in " << file << ": " << line;
+    if (!(fields >> log.max_requests)) {
+      log.max_requests = 0;
+    }
+    CHECK_EQ('/', log.path_prefix[0]) << "invalid path prefix: " << line;
+    CHECK_GE(log.max_requests, 0) << line;
+    logs.push_back(log);
+  }
+  return logs;
+}
+
+
+// Opens the database of a log from --additional_target_logs, of the
+// same type as that of the main log.
+Database<LoggedCertificate>* OpenDatabase(const string& path) {
+  if (!FLAGS_sqlite_db.empty()) {
+    return new SQLiteDB<LoggedCertificate>(path);
+  }
+  if (!FLAGS_leveldb_db.empty()) {
+    return new LevelDB<LoggedCertificate>(path);
+  }
+#ifdef HAVE_ROCKSDB
+  if (!FLAGS_rocksdb_db.empty()) {
+    return new RocksDB<LoggedCertificate>(path);
+  }
+#endif
+  LOG(FATAL) << "--additional_target_logs needs --sqlite_db, --leveldb_db "
+             << "or --rocksdb_db";
+  return nullptr;
+}
+
+
+// Sets up a simple single-node mirror environment for testing.
+void SetUpStandAlone(Server<LoggedCertificate>* server) {
+  // Put a sensible single-node config into FakeEtcd. For a real
+  // clustered log we'd expect a ClusterConfig already to be present
+  // within etcd as part of the provisioning of the log.
+  //
+  // TODO(alcutter): Note that we're currently broken wrt to restarting
+  // the log server when there's data in the log.  It's a temporary
+  // thing though, so fear ye not.
+  ct::ClusterConfig config;
+  config.set_minimum_serving_nodes(1);
+  config.set_minimum_serving_fraction(1);
+  LOG(INFO) << "Setting default single-node ClusterConfig:\n"
+            << config.DebugString();
+  server->consistent_store()->SetClusterConfig(config);
+
+  // Since we're a single node cluster, we'll settle that we're the
+  // master here, so that we can populate the initial STH
+  // (StrictConsistentStore won't allow us to do so unless we're master.)
+  server->election()->StartElection();
+  server->election()->WaitToBecomeMaster();
+}
+
+
 }  // namespace
 
 
-void STHUpdater(
-    Database<LoggedCertificate>* db,
-    ClusterStateController<LoggedCertificate>* cluster_state_controller,
-    mutex* queue_mutex, map<int64_t, ct::SignedTreeHead>* queue,
-    LogLookup<LoggedCertificate>* log_lookup, Task* task) {
+// Passes the tree heads of |queue| to |serve_sth| once the local tree
+// has caught up with them, and matches them.
+void STHUpdater(Database<LoggedCertificate>* db,
+                const function<void(const SignedTreeHead&)>& serve_sth,
+                mutex* queue_mutex, map<int64_t, ct::SignedTreeHead>* queue,
+                LogLookup<LoggedCertificate>* log_lookup, Task* task) {
   CHECK_NOTNULL(db);
-  CHECK_NOTNULL(cluster_state_controller);
+  CHECK(serve_sth);
   CHECK_NOTNULL(queue_mutex);
   CHECK_NOTNULL(queue);
   CHECK_NOTNULL(task);
   CHECK_NOTNULL(log_lookup);
 
+  // log_lookup doesn't yet have the data for the new STHs integrated (that
+  // happens via a callback when the WriteTreeHead() method is called on the
+  // DB), so we'll used a compact tree to pre-validate the STH roots.
+  //
+  // It starts from the current state of our serving tree, and is kept
+  // across iterations, only ever advancing up to the size of the
+  // latest STH checked, so that each entry is hashed once. Its roots
+  // at those sizes are kept, for STHs that arrive late.
+  const unique_ptr<CompactMerkleTree> tree(
+      log_lookup->GetCompactMerkleTree(new Sha256Hasher));
+  map<int64_t, string> recent_roots;
+
   while (true) {
     if (task->CancelRequested()) {
       task->Return(util::Status::CANCELLED);
+      return;
     }
 
     const int64_t local_size(db->TreeSize());
     latest_local_tree_size_gauge->Set(local_size);
 
-    // log_lookup doesn't yet have the data for the new STHs integrated (that
-    // happens via a callback when the WriteTreeHead() method is called on the
-    // DB), so we'll used a compact tree to pre-validate the STH roots.
-    //
-    // We'll start with one based on the current state of our serving tree and
-    // update it to the STH sizes we're checking.
-    unique_ptr<CompactMerkleTree> new_tree(
-        log_lookup->GetCompactMerkleTree(new Sha256Hasher));
-
     {
       lock_guard<mutex> lock(*queue_mutex);
-      unique_ptr<Database<LoggedCertificate>::Iterator> entries(
-          db->ScanEntries(new_tree->LeafCount()));
+      unique_ptr<Database<LoggedCertificate>::Iterator> entries;
       while (!queue->empty() &&
              queue->begin()->second.tree_size() <= local_size) {
-        const SignedTreeHead& next_sth(queue->begin()->second);
+        const SignedTreeHead next_sth(queue->begin()->second);
+        queue->erase(queue->begin());
 
-        // First, if necessary, catch our local compact tree up to the
-        // candidate STH size:
-        {
+        string local_root;
+        if (next_sth.tree_size() >=
+            static_cast<int64_t>(tree->LeafCount())) {
+          // Catch our compact tree up to the candidate STH size:
+          if (!entries) {
+            entries = ScanEntriesPrefetching(db, tree->LeafCount(),
+                                             local_size - tree->LeafCount());
+          }
           LoggedCertificate entry;
-          CHECK_LE(next_sth.tree_size(), local_size);
-          while (new_tree->LeafCount() < next_sth.tree_size()) {
+          while (static_cast<int64_t>(tree->LeafCount()) <
+                 next_sth.tree_size()) {
             CHECK(entries->GetNextEntry(&entry));
             CHECK(entry.has_sequence_number());
-            CHECK_EQ(new_tree->LeafCount(), entry.sequence_number());
-            string serialized_leaf;
-            CHECK(entry.SerializeForLeaf(&serialized_leaf));
+            CHECK_EQ(static_cast<int64_t>(tree->LeafCount()),
+                     entry.sequence_number());
+            string leaf_hash;
+            CHECK(entry.LeafHash(&leaf_hash));
             CHECK_EQ(entry.sequence_number() + 1,
-                     new_tree->AddLeaf(serialized_leaf));
+                     static_cast<int64_t>(tree->AddLeafHash(leaf_hash)));
           }
-        }
 
-        // If the candidate STH is historical, use the RootAtSnapshot() from
-        // our serving tree, otherwise use the root we just calculated with our
-        // compact tree.
-        const string local_root_at_snapshot(
-            next_sth.tree_size() > log_lookup->GetSTH().tree_size()
-                ? new_tree->CurrentRoot()
-                : log_lookup->RootAtSnapshot(next_sth.tree_size()));
+          local_root = tree->CurrentRoot();
+          recent_roots[next_sth.tree_size()] = local_root;
+          if (recent_roots.size() > kRecentRoots) {
+            recent_roots.erase(recent_roots.begin());
+          }
+        } else {
+          const auto it(recent_roots.find(next_sth.tree_size()));
+          local_root =
+              it != recent_roots.end()
+                  ? it->second
+                  : LocalRootAtSize(db, log_lookup, next_sth.tree_size());
+        }
 
-        if (next_sth.sha256_root_hash() != local_root_at_snapshot) {
+        if (next_sth.sha256_root_hash() != local_root) {
           LOG(WARNING) << "Received STH:\n" << next_sth.DebugString()
                        << " whose root:\n"
                        << HexString(next_sth.sha256_root_hash())
                        << "\ndoes not match that of local tree at "
                        << "corresponding snapshot:\n"
-                       << HexString(local_root_at_snapshot);
+                       << HexString(local_root);
           inconsistent_sths_received->Increment();
           // TODO(alcutter): We should probably write these bad STHs out to a
           // separate DB table for later analysis.
@@ -300,8 +491,7 @@ void STHUpdater(
         }
         LOG(INFO) << "Can serve new STH of size " << next_sth.tree_size()
                   << " locally";
-        cluster_state_controller->NewTreeHead(next_sth);
-        queue->erase(queue->begin());
+        serve_sth(next_sth);
       }
     }
 
@@ -311,6 +501,124 @@ void STHUpdater(
 }
 
 
+// Serves |sth| on a read-only replica, which has no cluster state to
+// agree on a serving tree head, by writing it straight to |db|, unless
+// it is older than the latest one there.
+void WriteReplicaTreeHead(Database<LoggedCertificate>* db,
+                          const SignedTreeHead& sth) {
+  SignedTreeHead db_sth;
+  if (db->LatestTreeHead(&db_sth) == Database<LoggedCertificate>::LOOKUP_OK &&
+      db_sth.timestamp() >= sth.timestamp()) {
+    return;
+  }
+  CHECK_EQ(Database<LoggedCertificate>::OK, db->WriteTreeHead(sth));
+}
+
+
+// Mirrors a target log into a database: its entries are fetched as
+// its tree heads grow, and the tree heads are served by a Server once
+// they match the local tree.
+class LogMirror {
+ public:
+  // Does not take ownership of anything.
+  LogMirror(Server<LoggedCertificate>* server,
+            Database<LoggedCertificate>* db, libevent::Base* event_base,
+            ThreadPool* pool, UrlFetcher* url_fetcher, Task* task)
+      : server_(CHECK_NOTNULL(server)),
+        db_(CHECK_NOTNULL(db)),
+        event_base_(CHECK_NOTNULL(event_base)),
+        pool_(CHECK_NOTNULL(pool)),
+        url_fetcher_(CHECK_NOTNULL(url_fetcher)),
+        task_(CHECK_NOTNULL(task)) {
+  }
+
+  ~LogMirror() {
+    if (sth_updater_) {
+      sth_updater_->join();
+    }
+  }
+
+  // Queues |sth| to be served once the local tree has caught up with
+  // it, and matches it. Returns false if a newer one of the same size
+  // is queued already.
+  bool QueueTreeHead(const SignedTreeHead& sth) {
+    lock_guard<mutex> lock(queue_mutex_);
+    const auto it(queue_.find(sth.tree_size()));
+    if (it != queue_.end() && sth.timestamp() < it->second.timestamp()) {
+      LOG(WARNING) << "Received older STH:\nHad:\n"
+                   << it->second.DebugString() << "\nGot:\n"
+                   << sth.DebugString();
+      return false;
+    }
+    queue_.insert(make_pair(sth.tree_size(), sth));
+    return true;
+  }
+
+  // Starts fetching from the log at |target_uri|, whose tree heads
+  // are signed with |pubkey|, taking ownership of it. If not 0,
+  // |max_requests| overrides --remote_peer_max_requests.
+  void StartFetching(const string& target_uri, EVP_PKEY* pubkey,
+                     int max_requests) {
+    CHECK(!fetcher_);
+    fetcher_ = ContinuousFetcher::New(event_base_, pool_, db_, false);
+
+    const shared_ptr<RemotePeer> peer(make_shared<RemotePeer>(
+        unique_ptr<AsyncLogClient>(
+            new AsyncLogClient(pool_, url_fetcher_, target_uri)),
+        unique_ptr<LogVerifier>(
+            new LogVerifier(new LogSigVerifier(pubkey),
+                            new MerkleVerifier(new Sha256Hasher))),
+        [this](const SignedTreeHead& sth) {
+          if (QueueTreeHead(sth)) {
+            // Start fetching the new entries now, rather than waiting
+            // for the next periodic fetch.
+            fetcher_->NewEntriesAvailable();
+          }
+        },
+        task_->AddChild([target_uri](Task*) {
+          LOG(INFO) << "RemotePeer for " << target_uri << " exited.";
+        })));
+    if (max_requests > 0) {
+      peer->client().SetMaxRequests(max_requests);
+    }
+    fetcher_->AddPeer("target", peer);
+  }
+
+  // Waits for the local database to catch up with the serving STH of
+  // the cluster, and starts serving the new tree heads, through the
+  // cluster unless |read_only_replica|.
+  void StartServing(bool read_only_replica) {
+    CHECK(!sth_updater_);
+    server_->WaitForReplication();
+    const function<void(const SignedTreeHead&)> serve_sth(
+        read_only_replica
+            ? function<void(const SignedTreeHead&)>(
+                  bind(&WriteReplicaTreeHead, db_, _1))
+            : bind(&ClusterStateController<LoggedCertificate>::NewTreeHead,
+                   server_->cluster_state_controller(), _1));
+    sth_updater_.reset(new thread(
+        &STHUpdater, db_, serve_sth, &queue_mutex_, &queue_,
+        server_->log_lookup(),
+        task_->AddChild([](Task*) { LOG(INFO) << "STHUpdater exited."; })));
+  }
+
+ private:
+  Server<LoggedCertificate>* const server_;
+  Database<LoggedCertificate>* const db_;
+  libevent::Base* const event_base_;
+  ThreadPool* const pool_;
+  UrlFetcher* const url_fetcher_;
+  Task* const task_;
+
+  mutex queue_mutex_;
+  map<int64_t, SignedTreeHead> queue_;
+  unique_ptr<ContinuousFetcher> fetcher_;
+  unique_ptr<thread> sth_updater_;
+
+  DISALLOW_COPY_AND_ASSIGN(LogMirror);
+};
+
+
 int main(int argc, char* argv[]) {
   // Ignore various signals whilst we start up.
   signal(SIGHUP, SIG_IGN);
@@ -319,34 +627,69 @@ int main(int argc, char* argv[]) {
 
   util::InitCT(&argc, &argv);
 
+  // The threads started from here on, and what this one allocates
+  // (such as the tree of the LogLookup, which the pool workers read),
+  // stay on the same CPUs, and so NUMA node, as the pool workers.
+  cert_trans::PinCurrentThread(FLAGS_thread_pool_cpus);
+
   Server<LoggedCertificate>::StaticInit();
 
   if (!FLAGS_sqlite_db.empty() + !FLAGS_leveldb_db.empty() +
+          !FLAGS_rocksdb_db.empty() +
           (!FLAGS_cert_dir.empty() | !FLAGS_tree_dir.empty()) !=
       1) {
     std::cerr << "Must only specify one database type.";
     exit(1);
   }
+#ifndef HAVE_ROCKSDB
+  CHECK(FLAGS_rocksdb_db.empty()) << "this binary was built without RocksDB "
+                                     "support";
+#endif
 
-  if (FLAGS_sqlite_db.empty() && FLAGS_leveldb_db.empty()) {
+  if (FLAGS_sqlite_db.empty() && FLAGS_leveldb_db.empty() &&
+      FLAGS_rocksdb_db.empty()) {
     CHECK_NE(FLAGS_cert_dir, FLAGS_tree_dir)
         << "Certificate directory and tree directory must differ";
   }
 
   Database<LoggedCertificate>* db;
+  // Where the entries are kept, if they are, as they are stored.
+  const SegmentStorage* entry_segments(nullptr);
 
   if (!FLAGS_sqlite_db.empty()) {
     db = new SQLiteDB<LoggedCertificate>(FLAGS_sqlite_db);
   } else if (!FLAGS_leveldb_db.empty()) {
     db = new LevelDB<LoggedCertificate>(FLAGS_leveldb_db);
+#ifdef HAVE_ROCKSDB
+  } else if (!FLAGS_rocksdb_db.empty()) {
+    db = new RocksDB<LoggedCertificate>(FLAGS_rocksdb_db);
+#endif
   } else {
+    KeyValueStorage* cert_storage;
+    if (FLAGS_cert_segment_size_mb > 0) {
+      SegmentStorage* const segments(new SegmentStorage(
+          FLAGS_cert_dir,
+          static_cast<off_t>(FLAGS_cert_segment_size_mb) << 20));
+      entry_segments = segments;
+      cert_storage = segments;
+    } else {
+      cert_storage = new FileStorage(FLAGS_cert_dir, FLAGS_cert_storage_depth);
+    }
     db = new FileDB<LoggedCertificate>(
-        new FileStorage(FLAGS_cert_dir, FLAGS_cert_storage_depth),
-        new FileStorage(FLAGS_tree_dir, FLAGS_tree_storage_depth),
+        cert_storage, new FileStorage(FLAGS_tree_dir, FLAGS_tree_storage_depth),
         new FileStorage(FLAGS_meta_dir, 0));
   }
 
+  const vector<TargetLog> additional_logs(
+      FLAGS_additional_target_logs.empty()
+          ? vector<TargetLog>()
+          : ReadTargetLogs(FLAGS_additional_target_logs));
+
+  // A read-only replica has its cluster state in memory, as in
+  // stand-alone mode, but never becomes a master of it.
   const bool stand_alone_mode(FLAGS_etcd_servers.empty());
+  CHECK(stand_alone_mode || !FLAGS_read_only_replica)
+      << "a read-only replica does not use --etcd_servers";
   const shared_ptr<libevent::Base> event_base(make_shared<libevent::Base>());
   ThreadPool internal_pool(8);
   UrlFetcher url_fetcher(event_base.get(), &internal_pool);
@@ -357,44 +700,51 @@ int main(int argc, char* argv[]) {
           : new EtcdClient(&internal_pool, &url_fetcher,
                            SplitHosts(FLAGS_etcd_servers)));
 
+  ThreadPool http_pool(FLAGS_num_http_server_threads);
   Server<LoggedCertificate>::Options options;
   options.server = FLAGS_server;
   options.port = FLAGS_port;
   options.etcd_root = FLAGS_etcd_root;
   options.num_http_server_threads = FLAGS_num_http_server_threads;
+  options.http_pool = &http_pool;
+  options.path_prefix = FLAGS_target_path_prefix;
+  options.read_only_replica = FLAGS_read_only_replica;
+  options.entry_segments = entry_segments;
 
   Server<LoggedCertificate> server(options, event_base, &internal_pool, db,
                                    etcd_client.get(), &url_fetcher, nullptr,
                                    nullptr);
   server.Initialise(true /* is_mirror */);
 
-  if (stand_alone_mode) {
-    // Set up a simple single-node mirror environment for testing.
-    //
-    // Put a sensible single-node config into FakeEtcd. For a real clustered
-    // log
-    // we'd expect a ClusterConfig already to be present within etcd as part of
-    // the provisioning of the log.
-    //
-    // TODO(alcutter): Note that we're currently broken wrt to restarting the
-    // log server when there's data in the log.  It's a temporary thing though,
-    // so fear ye not.
-    ct::ClusterConfig config;
-    config.set_minimum_serving_nodes(1);
-    config.set_minimum_serving_fraction(1);
-    LOG(INFO) << "Setting default single-node ClusterConfig:\n"
-              << config.DebugString();
-    server.consistent_store()->SetClusterConfig(config);
-
-    // Since we're a single node cluster, we'll settle that we're the
-    // master here, so that we can populate the initial STH
-    // (StrictConsistentStore won't allow us to do so unless we're master.)
-    server.election()->StartElection();
-    server.election()->WaitToBecomeMaster();
+  if (FLAGS_read_only_replica) {
+    LOG(INFO) << "Running as a read-only replica of " << FLAGS_target_log_uri;
+  } else if (stand_alone_mode) {
+    SetUpStandAlone(&server);
   } else {
     CHECK(!FLAGS_server.empty());
   }
 
+  // The other logs share the event loop, the thread pools and the
+  // UrlFetcher of the main one, and are served by its HTTP servers.
+  vector<unique_ptr<Database<LoggedCertificate>>> additional_dbs;
+  vector<unique_ptr<Server<LoggedCertificate>>> additional_servers;
+  for (const TargetLog& log : additional_logs) {
+    Server<LoggedCertificate>::Options log_options(options);
+    log_options.etcd_root = FLAGS_etcd_root + log.path_prefix;
+    log_options.path_prefix = log.path_prefix;
+    log_options.serve_http = false;
+    log_options.entry_segments = nullptr;
+    additional_dbs.emplace_back(OpenDatabase(log.db));
+    additional_servers.emplace_back(new Server<LoggedCertificate>(
+        log_options, event_base, &internal_pool, additional_dbs.back().get(),
+        etcd_client.get(), &url_fetcher, nullptr, nullptr));
+    additional_servers.back()->Initialise(true /* is_mirror */);
+    if (stand_alone_mode && !FLAGS_read_only_replica) {
+      SetUpStandAlone(additional_servers.back().get());
+    }
+    server.AddLog(additional_servers.back().get());
+  }
+
   CHECK(!FLAGS_target_public_key.empty());
   CHECK(!FLAGS_target_log_uri.empty());
 
@@ -405,46 +755,66 @@ int main(int argc, char* argv[]) {
   ThreadPool pool(16);
   SyncTask fetcher_task(&pool);
 
-  mutex queue_mutex;
-  map<int64_t, ct::SignedTreeHead> queue;
-
-  const function<void(const ct::SignedTreeHead&)> new_sth(
-      [&queue_mutex, &queue](const ct::SignedTreeHead& sth) {
-        lock_guard<mutex> lock(queue_mutex);
-        const auto it(queue.find(sth.tree_size()));
-        if (it != queue.end() && sth.timestamp() < it->second.timestamp()) {
-          LOG(WARNING) << "Received older STH:\nHad:\n"
-                       << it->second.DebugString() << "\nGot:\n"
-                       << sth.DebugString();
-          return;
-        }
-        queue.insert(make_pair(sth.tree_size(), sth));
-      });
-
-  const shared_ptr<RemotePeer> peer(make_shared<RemotePeer>(
-      unique_ptr<AsyncLogClient>(
-          new AsyncLogClient(&pool, &url_fetcher, FLAGS_target_log_uri)),
-      unique_ptr<LogVerifier>(
-          new LogVerifier(new LogSigVerifier(pubkey.ValueOrDie()),
-                          new MerkleVerifier(new Sha256Hasher))),
-      new_sth, fetcher_task.task()->AddChild(
-                   [](Task*) { LOG(INFO) << "RemotePeer exited."; })));
-  const unique_ptr<ContinuousFetcher> fetcher(
-      ContinuousFetcher::New(event_base.get(), &pool, db, false));
-  fetcher->AddPeer("target", peer);
-
-  server.WaitForReplication();
-
-  thread sth_updater(&STHUpdater, db, server.cluster_state_controller(),
-                     &queue_mutex, &queue, server.log_lookup(),
-                     fetcher_task.task()->AddChild(
-                         [](Task*) { LOG(INFO) << "STHUpdater exited."; }));
+  LogMirror mirror(&server, db, event_base.get(), &pool, &url_fetcher,
+                   fetcher_task.task());
+
+  if (!FLAGS_bootstrap_snapshot_dir.empty()) {
+    CHECK(!FLAGS_bootstrap_checkpoint_dir.empty())
+        << "--bootstrap_checkpoint_dir is needed to load a snapshot";
+    SnapshotLoader<LoggedCertificate> loader(FLAGS_bootstrap_snapshot_dir,
+                                             FLAGS_bootstrap_checkpoint_dir,
+                                             db);
+    SignedTreeHead sth;
+    util::Status status(loader.ReadTreeHead(&sth));
+    CHECK(status.ok()) << "Failed to read snapshot tree head: " << status;
+
+    const StatusOr<EVP_PKEY*> snapshot_pubkey(
+        ReadPublicKey(FLAGS_target_public_key));
+    CHECK(snapshot_pubkey.ok()) << snapshot_pubkey.status();
+    const LogVerifier verifier(
+        new LogSigVerifier(snapshot_pubkey.ValueOrDie()),
+        new MerkleVerifier(new Sha256Hasher));
+    const LogVerifier::VerifyResult result(verifier.VerifySignedTreeHead(sth));
+    CHECK_EQ(LogVerifier::VERIFY_OK, result)
+        << "Snapshot tree head does not verify: "
+        << LogVerifier::VerifyResultString(result);
+
+    status = loader.Load(sth);
+    CHECK(status.ok()) << "Failed to load snapshot: " << status;
+    LOG(INFO) << "Loaded snapshot of " << sth.tree_size() << " entries";
+
+    // Served once the STH updater has checked it against the local
+    // tree, as for the tree heads of the target log.
+    mirror.QueueTreeHead(sth);
+  }
+
+  mirror.StartFetching(FLAGS_target_log_uri, pubkey.ValueOrDie(), 0);
+
+  vector<unique_ptr<LogMirror>> additional_mirrors;
+  for (size_t i = 0; i < additional_logs.size(); ++i) {
+    const StatusOr<EVP_PKEY*> log_pubkey(
+        ReadPublicKey(additional_logs[i].public_key));
+    CHECK(log_pubkey.ok()) << "Failed to read the public key of "
+                           << additional_logs[i].uri << ": "
+                           << log_pubkey.status();
+    additional_mirrors.emplace_back(
+        new LogMirror(additional_servers[i].get(), additional_dbs[i].get(),
+                      event_base.get(), &pool, &url_fetcher,
+                      fetcher_task.task()));
+    additional_mirrors.back()->StartFetching(additional_logs[i].uri,
+                                             log_pubkey.ValueOrDie(),
+                                             additional_logs[i].max_requests);
+  }
+
+  mirror.StartServing(FLAGS_read_only_replica);
+  for (const auto& additional_mirror : additional_mirrors) {
+    additional_mirror->StartServing(FLAGS_read_only_replica);
+  }
 
   server.Run();
 
   fetcher_task.task()->Return();
   fetcher_task.Wait();
-  sth_updater.join();
 
   return 0;
 }
@@ -1,24 +1,34 @@
 /* -*- indent-tabs-mode: nil -*- */
 
+#include <algorithm>
 #include <event2/thread.h>
 #include <gflags/gflags.h>
 #include <iostream>
 #include <openssl/err.h>
 #include <signal.h>
+#include <sstream>
 #include <stdlib.h>
 #include <string>
+#include <sys/stat.h>
 #include <unistd.h>
+#include <vector>
 
 
 #include "config.h"
+#include "log/archived_db.h"
 #include "log/cert_checker.h"
 #include "log/cert_submission_handler.h"
 #include "log/cluster_state_controller.h"
 #include "log/etcd_consistent_store.h"
 #include "log/file_db.h"
 #include "log/file_storage.h"
+#include "log/interned_chain_db.h"
 #include "log/leveldb_db.h"
+#ifdef HAVE_ROCKSDB
+#include "log/rocksdb_db.h"
+#endif
 #include "log/log_signer.h"
+#include "log/segment_storage.h"
 #include "log/sqlite_db.h"
 #include "log/strict_consistent_store.h"
 #include "log/tree_signer.h"
@@ -28,6 +38,7 @@
 #include "server/handler.h"
 #include "server/metrics.h"
 #include "server/server.h"
+#include "util/cpu_affinity.h"
 #include "util/etcd.h"
 #include "util/fake_etcd.h"
 #include "util/init.h"
@@ -35,13 +46,20 @@
 #include "util/read_key.h"
 #include "util/status.h"
 #include "util/thread_pool.h"
+#include "util/util.h"
 #include "util/uuid.h"
 
+DECLARE_string(thread_pool_cpus);
+
 DEFINE_string(server, "localhost", "Server host");
 DEFINE_int32(port, 9999, "Server port");
 DEFINE_string(key, "", "PEM-encoded server private key file");
 DEFINE_string(trusted_cert_file, "",
               "File for trusted CA certificates, in concatenated PEM format");
+DEFINE_int32(trusted_cert_reload_frequency_seconds, 0,
+             "How often to check whether --trusted_cert_file has changed, "
+             "and replace the trusted CA certificates with its new contents "
+             "if so. Never if 0.");
 // TODO(alcutter): Just specify a root dir with a single flag.
 DEFINE_string(cert_dir, "", "Storage directory for certificates");
 DEFINE_string(tree_dir, "", "Storage directory for trees");
@@ -50,6 +68,8 @@ DEFINE_string(sqlite_db, "",
               "SQLite database for certificate and tree storage");
 DEFINE_string(leveldb_db, "",
               "LevelDB database for certificate and tree storage");
+DEFINE_string(rocksdb_db, "",
+              "RocksDB database for certificate and tree storage");
 // TODO(ekasper): sanity-check these against the directory structure.
 DEFINE_int32(cert_storage_depth, 0,
              "Subdirectory depth for certificates; if the directory is not "
@@ -57,6 +77,26 @@ DEFINE_int32(cert_storage_depth, 0,
 DEFINE_int32(tree_storage_depth, 0,
              "Subdirectory depth for tree signatures; if the directory is not "
              "empty, must match the existing depth");
+DEFINE_int32(cert_segment_size_mb, 0,
+             "If not 0, certificates are appended to segment files of about "
+             "this many MiB in --cert_dir, instead of being written to a "
+             "file each; if the directory is not empty, must match how it "
+             "was written.");
+DEFINE_string(intermediates_dir, "",
+              "If set, the certificates of the chains of entries are stored "
+              "once each in this directory, and the entries only refer to "
+              "them. Must stay set once entries were stored this way.");
+DEFINE_string(archive_dir, "",
+              "If set, completed ranges of older entries are sealed into "
+              "compressed archives in this directory, and read from there "
+              "rather than from the database.");
+DEFINE_int32(archive_range_entries, 1000000,
+             "Number of entries in each archive.");
+DEFINE_int32(archive_keep_entries, 4000000,
+             "Number of the most recent entries that are not archived.");
+DEFINE_int32(archive_frequency_seconds, 3600,
+             "How often to check for ranges of entries to archive. Must be "
+             "greater than 0.");
 DEFINE_int32(log_stats_frequency_seconds, 3600,
              "Interval for logging summary statistics. Approximate: the "
              "server will log statistics if in the beginning of its select "
@@ -74,14 +114,55 @@ DEFINE_int32(tree_signing_frequency_seconds, 600,
              "server select loop, at least this period has elapsed since the "
              "last signing. Set this well below the MMD to ensure we sign in "
              "a timely manner. Must be greater than 0.");
+DEFINE_bool(sign_when_sequenced, false,
+            "If true, a new signed tree head is also issued as soon as this "
+            "node has sequenced new entries, rather than only every "
+            "--tree_signing_frequency_seconds.");
+DEFINE_int32(tree_signing_target_entries, 0,
+             "If greater than 0, a new signed tree head is also issued as "
+             "soon as this many entries are waiting to be added to the "
+             "tree.");
+DEFINE_int32(tree_signing_max_merge_delay_seconds, 0,
+             "If greater than 0, a new signed tree head is also issued as "
+             "soon as the oldest entry waiting to be added to the tree was "
+             "timestamped this many seconds ago. Set this well below the "
+             "MMD.");
+DEFINE_int32(tree_signing_min_interval_seconds, 10,
+             "Minimum number of seconds between two signed tree heads issued "
+             "because of --tree_signing_target_entries or "
+             "--tree_signing_max_merge_delay_seconds. Must be greater than "
+             "0.");
 DEFINE_double(guard_window_seconds, 60,
               "Unsequenced entries newer than this "
               "number of seconds will not be sequenced.");
 DEFINE_string(etcd_servers, "",
               "Comma separated list of 'hostname:port' of the etcd server(s)");
 DEFINE_string(etcd_root, "/root", "Root of cluster entries in etcd.");
+DEFINE_string(pending_entry_body_dir, "",
+              "If set, the new entries are stored in this directory, which "
+              "must be shared by all the nodes of the cluster, and etcd only "
+              "keeps their SCT until they are sequenced. Must stay set while "
+              "entries stored this way are pending.");
+DEFINE_string(pending_entry_journal_dir, "",
+              "If set, new entries are acknowledged as soon as they are "
+              "synced to a journal in this local directory, and written to "
+              "etcd in the background, so that submissions are still "
+              "accepted while etcd is briefly unavailable.");
 DEFINE_int32(num_http_server_threads, 16,
              "Number of threads for servicing the incoming HTTP requests.");
+DEFINE_string(shards, "",
+              "File listing other logs to serve in this process, such as "
+              "the earlier temporal shards of this one, one per line: the "
+              "prefix of the paths it is served under, its database (of the "
+              "same type as that of this log), either the file of its "
+              "private key or \"frozen\" to serve it read-only, without "
+              "accepting submissions nor sequencing or signing, and "
+              "optionally the memory for its entry cache in megabytes (see "
+              "--entry_cache_size_mb). They share the HTTP servers, the "
+              "thread pools and the CA certificates of this log, and have "
+              "their cluster state under --etcd_root followed by their "
+              "prefix. --intermediates_dir and --archive_dir only apply to "
+              "this log.");
 DEFINE_bool(i_know_stand_alone_mode_can_lose_data, false,
             "Set this to allow stand-alone mode, even though it will lost "
             "submissions in the case of a crash.");
@@ -98,10 +179,12 @@ using cert_trans::EtcdConsistentStore;
 using cert_trans::FakeEtcdClient;
 using cert_trans::FileStorage;
 using cert_trans::HttpHandler;
+using cert_trans::KeyValueStorage;
 using cert_trans::Latency;
 using cert_trans::LoggedCertificate;
 using cert_trans::ReadPrivateKey;
 using cert_trans::ScopedLatency;
+using cert_trans::SegmentStorage;
 using cert_trans::Server;
 using cert_trans::SplitHosts;
 using cert_trans::ThreadPool;
@@ -118,13 +201,16 @@ using std::chrono::milliseconds;
 using std::chrono::seconds;
 using std::chrono::steady_clock;
 using std::function;
+using std::istringstream;
 using std::make_shared;
 using std::mutex;
 using std::placeholders::_1;
+using std::placeholders::_2;
 using std::shared_ptr;
 using std::string;
 using std::thread;
 using std::unique_ptr;
+using std::vector;
 
 
 namespace {
@@ -146,6 +232,19 @@ Counter<bool>* signer_total_runs =
                        "Total number of signer runs broken out by success.");
 Latency<milliseconds> signer_run_latency_ms("signer_run_latency_ms",
                                             "Total runtime of signer");
+Gauge<>* signer_backlog_entries =
+    Gauge<>::New("signer_backlog_entries",
+                 "Number of entries in the local database that are not in "
+                 "the latest locally generated STH yet.");
+Gauge<>* signer_merge_delay_ms =
+    Gauge<>::New("signer_merge_delay_ms",
+                 "Time between the timestamp of the oldest entry added by "
+                 "the latest locally generated STH and that of the STH.");
+
+Gauge<string>* startup_phase_duration_ms =
+    Gauge<string>::New("startup_phase_duration_ms", "phase",
+                       "How long each phase of the startup of the server "
+                       "took, \"total\" being until it was ready.");
 
 
 // Basic sanity checks on flag values.
@@ -199,6 +298,20 @@ static const bool c_st_dummy =
     RegisterFlagValidator(&FLAGS_cert_storage_depth, &ValidateIsNonNegative);
 static const bool t_st_dummy =
     RegisterFlagValidator(&FLAGS_tree_storage_depth, &ValidateIsNonNegative);
+static const bool c_seg_dummy =
+    RegisterFlagValidator(&FLAGS_cert_segment_size_mb,
+                          &ValidateIsNonNegative);
+
+static const bool a_keep_dummy =
+    RegisterFlagValidator(&FLAGS_archive_keep_entries,
+                          &ValidateIsNonNegative);
+
+static const bool s_target_dummy =
+    RegisterFlagValidator(&FLAGS_tree_signing_target_entries,
+                          &ValidateIsNonNegative);
+static const bool s_delay_dummy =
+    RegisterFlagValidator(&FLAGS_tree_signing_max_merge_delay_seconds,
+                          &ValidateIsNonNegative);
 
 static bool ValidateIsPositive(const char* flagname, int value) {
   if (value <= 0) {
@@ -216,6 +329,21 @@ static const bool sign_dummy =
     RegisterFlagValidator(&FLAGS_tree_signing_frequency_seconds,
                           &ValidateIsPositive);
 
+static const bool s_interval_dummy =
+    RegisterFlagValidator(&FLAGS_tree_signing_min_interval_seconds,
+                          &ValidateIsPositive);
+
+static const bool a_range_dummy =
+    RegisterFlagValidator(&FLAGS_archive_range_entries, &ValidateIsPositive);
+
+static const bool a_freq_dummy =
+    RegisterFlagValidator(&FLAGS_archive_frequency_seconds,
+                          &ValidateIsPositive);
+
+static const bool t_reload_dummy =
+    RegisterFlagValidator(&FLAGS_trusted_cert_reload_frequency_seconds,
+                          &ValidateIsNonNegative);
+
 void CleanUpEntries(ConsistentStore<LoggedCertificate>* store,
                     const function<bool()>& is_master) {
   CHECK_NOTNULL(store);
@@ -257,10 +385,14 @@ void SequenceEntries(TreeSigner<LoggedCertificate>* tree_signer,
   CHECK(is_master);
   const steady_clock::duration period(
       (seconds(FLAGS_sequencing_frequency_seconds)));
+  // How often a standby checks whether it became master, so that it
+  // takes over without waiting for the rest of the period.
+  const steady_clock::duration standby_poll_period(milliseconds(100));
   steady_clock::time_point target_run_time(steady_clock::now());
 
   while (true) {
-    if (is_master()) {
+    const bool master(is_master());
+    if (master) {
       const ScopedLatency sequencer_sequence_latency(
           sequencer_sequence_latency_ms.GetScopedLatency());
       util::Status status(tree_signer->SequenceNewEntries());
@@ -268,6 +400,41 @@ void SequenceEntries(TreeSigner<LoggedCertificate>* tree_signer,
         LOG(WARNING) << "Problem sequencing new entries: " << status;
       }
       sequencer_total_runs->Increment(status.ok());
+    } else {
+      // Keeps the mapping warm, for when we become master.
+      const util::Status status(tree_signer->PrefetchSequenceMapping());
+      if (!status.ok()) {
+        VLOG(1) << "Problem prefetching the sequence mapping: " << status;
+      }
+    }
+
+    const steady_clock::time_point now(steady_clock::now());
+    while (target_run_time <= now) {
+      target_run_time += period;
+    }
+
+    if (master) {
+      std::this_thread::sleep_for(target_run_time - now);
+    } else {
+      while (!is_master() && steady_clock::now() < target_run_time) {
+        std::this_thread::sleep_until(std::min(
+            steady_clock::now() + standby_poll_period, target_run_time));
+      }
+    }
+  }
+}
+
+void ArchiveEntries(ArchivedDB<LoggedCertificate>* db) {
+  CHECK_NOTNULL(db);
+  const steady_clock::duration period(
+      (seconds(FLAGS_archive_frequency_seconds)));
+  steady_clock::time_point target_run_time(steady_clock::now());
+
+  while (true) {
+    const int sealed(db->SealRanges(FLAGS_archive_keep_entries));
+    if (sealed > 0) {
+      LOG(INFO) << "Archived " << sealed << " ranges of entries, "
+                << db->ArchivedSize() << " entries are now archived.";
     }
 
     const steady_clock::time_point now(steady_clock::now());
@@ -279,26 +446,140 @@ void SequenceEntries(TreeSigner<LoggedCertificate>* tree_signer,
   }
 }
 
+// The modification time of |path|, or 0 if it cannot be read.
+time_t ModificationTime(const string& path) {
+  struct stat st;
+  if (stat(path.c_str(), &st) != 0) {
+    return 0;
+  }
+  return st.st_mtime;
+}
+
+void ReloadTrustedCertificates(CertChecker* checker) {
+  CHECK_NOTNULL(checker);
+  const steady_clock::duration period(
+      (seconds(FLAGS_trusted_cert_reload_frequency_seconds)));
+  time_t loaded_mtime(ModificationTime(FLAGS_trusted_cert_file));
+
+  while (true) {
+    std::this_thread::sleep_for(period);
+
+    const time_t mtime(ModificationTime(FLAGS_trusted_cert_file));
+    if (mtime == 0 || mtime == loaded_mtime) {
+      continue;
+    }
+    // The chains being checked meanwhile keep using the previous ones.
+    if (checker->ReloadTrustedCertificates(FLAGS_trusted_cert_file)) {
+      loaded_mtime = mtime;
+    } else {
+      LOG(WARNING) << "Could not reload CA certs from "
+                   << FLAGS_trusted_cert_file << ", keeping the "
+                   << checker->NumTrustedCertificates() << " loaded before";
+    }
+  }
+}
+
+// The timestamp of the entry at |index| in |db|, in milliseconds, or
+// 0 if there is no such entry.
+uint64_t EntryTimestamp(const Database<LoggedCertificate>* db,
+                        int64_t index) {
+  LoggedCertificate logged;
+  if (db->LookupByIndex(index, &logged) !=
+      Database<LoggedCertificate>::LOOKUP_OK) {
+    return 0;
+  }
+  return logged.timestamp();
+}
+
+// Whether enough entries have been waiting for long enough (as set
+// by --tree_signing_target_entries and
+// --tree_signing_max_merge_delay_seconds) for the tree to be signed
+// again. Also updates the backlog metric, if |update_metrics|.
+bool BacklogNeedsSigning(const TreeSigner<LoggedCertificate>* tree_signer,
+                         const Database<LoggedCertificate>* db,
+                         bool update_metrics) {
+  const int64_t tree_size(tree_signer->LatestSTH().tree_size());
+  const int64_t backlog(std::max<int64_t>(db->TreeSize() - tree_size, 0));
+  if (update_metrics) {
+    signer_backlog_entries->Set(backlog);
+  }
+  if (backlog == 0) {
+    return false;
+  }
+  if (FLAGS_sign_when_sequenced ||
+      (FLAGS_tree_signing_target_entries > 0 &&
+       backlog >= FLAGS_tree_signing_target_entries)) {
+    return true;
+  }
+  if (FLAGS_tree_signing_max_merge_delay_seconds > 0) {
+    const uint64_t oldest(EntryTimestamp(db, tree_size));
+    const uint64_t max_delay_ms(
+        static_cast<uint64_t>(FLAGS_tree_signing_max_merge_delay_seconds) *
+        1000);
+    return oldest > 0 && util::TimeInMilliseconds() >= oldest + max_delay_ms;
+  }
+  return false;
+}
+
+// Waits until |deadline|, or until the backlog needs signing, but not
+// before |earliest|.
+void WaitForBacklog(const TreeSigner<LoggedCertificate>* tree_signer,
+                    const Database<LoggedCertificate>* db,
+                    const steady_clock::time_point& earliest,
+                    const steady_clock::time_point& deadline,
+                    bool update_metrics) {
+  // The backlog only grows as the sequencer runs, checking it more
+  // often than this would be a waste.
+  const steady_clock::duration poll_period(seconds(1));
+  std::this_thread::sleep_until(std::min(earliest, deadline));
+  while (steady_clock::now() < deadline &&
+         !BacklogNeedsSigning(tree_signer, db, update_metrics)) {
+    std::this_thread::sleep_until(
+        std::min(steady_clock::now() + poll_period, deadline));
+  }
+}
+
+// Only updates the gauges if |update_metrics|, so that they are about
+// one log when several are served.
 void SignMerkleTree(TreeSigner<LoggedCertificate>* tree_signer,
+                    const Database<LoggedCertificate>* db,
                     ConsistentStore<LoggedCertificate>* store,
-                    ClusterStateController<LoggedCertificate>* controller) {
+                    ClusterStateController<LoggedCertificate>* controller,
+                    bool update_metrics) {
   CHECK_NOTNULL(tree_signer);
+  CHECK_NOTNULL(db);
   CHECK_NOTNULL(store);
   CHECK_NOTNULL(controller);
   const steady_clock::duration period(
       (seconds(FLAGS_tree_signing_frequency_seconds)));
+  const steady_clock::duration min_interval(
+      (seconds(FLAGS_tree_signing_min_interval_seconds)));
+  // Rather than signing only at a fixed period, also sign as soon as
+  // the backlog calls for it.
+  const bool adaptive(FLAGS_tree_signing_target_entries > 0 ||
+                      FLAGS_tree_signing_max_merge_delay_seconds > 0);
   steady_clock::time_point target_run_time(steady_clock::now());
 
   while (true) {
+    const steady_clock::time_point run_time(steady_clock::now());
     {
       ScopedLatency signer_run_latency(
           signer_run_latency_ms.GetScopedLatency());
+      const int64_t previous_tree_size(tree_signer->LatestSTH().tree_size());
       const TreeSigner<LoggedCertificate>::UpdateResult result(
           tree_signer->UpdateTree());
       switch (result) {
         case TreeSigner<LoggedCertificate>::OK: {
           const SignedTreeHead latest_sth(tree_signer->LatestSTH());
-          latest_local_tree_size_gauge->Set(latest_sth.tree_size());
+          if (update_metrics) {
+            latest_local_tree_size_gauge->Set(latest_sth.tree_size());
+          }
+          if (update_metrics && latest_sth.tree_size() > previous_tree_size) {
+            const uint64_t oldest(EntryTimestamp(db, previous_tree_size));
+            if (oldest > 0 && latest_sth.timestamp() >= oldest) {
+              signer_merge_delay_ms->Set(latest_sth.timestamp() - oldest);
+            }
+          }
           controller->NewTreeHead(latest_sth);
           signer_total_runs->Increment(true /* successful */);
           break;
@@ -317,8 +598,202 @@ void SignMerkleTree(TreeSigner<LoggedCertificate>* tree_signer,
     while (target_run_time <= now) {
       target_run_time += period;
     }
-    std::this_thread::sleep_for(target_run_time - now);
+    if (adaptive) {
+      WaitForBacklog(tree_signer, db, run_time + min_interval,
+                     target_run_time, update_metrics);
+    } else if (FLAGS_sign_when_sequenced) {
+      tree_signer->WaitForSequencedEntries(target_run_time);
+    } else {
+      std::this_thread::sleep_for(target_run_time - now);
+    }
+  }
+}
+
+// Runs the startup phase |name|, and records how long it took.
+void RunStartupPhase(const string& name, const function<void()>& phase) {
+  const steady_clock::time_point start(steady_clock::now());
+  phase();
+  const milliseconds elapsed(
+      duration_cast<milliseconds>(steady_clock::now() - start));
+  startup_phase_duration_ms->Set(name, elapsed.count());
+  LOG(INFO) << "Startup phase " << name << " took " << elapsed.count()
+            << " ms";
+}
+
+// Sets |*entry_segments| to the SegmentStorage the entries are kept
+// in, if they are, as they are stored, for the other nodes to get.
+Database<LoggedCertificate>* OpenDatabase(
+    const SegmentStorage** entry_segments) {
+  Database<LoggedCertificate>* db;
+  *entry_segments = nullptr;
+
+  if (!FLAGS_sqlite_db.empty()) {
+    db = new SQLiteDB<LoggedCertificate>(FLAGS_sqlite_db);
+  } else if (!FLAGS_leveldb_db.empty()) {
+    db = new LevelDB<LoggedCertificate>(FLAGS_leveldb_db);
+#ifdef HAVE_ROCKSDB
+  } else if (!FLAGS_rocksdb_db.empty()) {
+    db = new RocksDB<LoggedCertificate>(FLAGS_rocksdb_db);
+#endif
+  } else {
+    KeyValueStorage* cert_storage;
+    if (FLAGS_cert_segment_size_mb > 0) {
+      SegmentStorage* const segments(new SegmentStorage(
+          FLAGS_cert_dir,
+          static_cast<off_t>(FLAGS_cert_segment_size_mb) << 20));
+      // The records of interned entries lack their chains.
+      if (FLAGS_intermediates_dir.empty()) {
+        *entry_segments = segments;
+      }
+      cert_storage = segments;
+    } else {
+      cert_storage = new FileStorage(FLAGS_cert_dir, FLAGS_cert_storage_depth);
+    }
+    db = new FileDB<LoggedCertificate>(
+        cert_storage, new FileStorage(FLAGS_tree_dir, FLAGS_tree_storage_depth),
+        new FileStorage(FLAGS_meta_dir, 0));
+  }
+
+  if (!FLAGS_intermediates_dir.empty()) {
+    // Digests are random, spread them over 256 directories.
+    db = new InternedChainDB<LoggedCertificate>(
+        db, new FileStorage(FLAGS_intermediates_dir, 2));
   }
+
+  return db;
+}
+
+// The tree for the signer to start from. Rather than copying the
+// right edge of the full tree in |log_lookup|, use the checkpoint in
+// the latest STH in |db|, provided that we have all its entries.
+unique_ptr<CompactMerkleTree> SignerTree(
+    const Database<LoggedCertificate>* db,
+    LogLookup<LoggedCertificate>* log_lookup) {
+  SignedTreeHead sth;
+  if (db->LatestTreeHead(&sth) == Database<LoggedCertificate>::LOOKUP_OK &&
+      db->TreeSize() >= sth.tree_size()) {
+    unique_ptr<CompactMerkleTree> tree(
+        TreeSigner<LoggedCertificate>::RestoreTree(sth, new Sha256Hasher));
+    if (tree) {
+      LOG(INFO) << "Resuming signing from the tree checkpoint in the STH of "
+                << "size " << sth.tree_size();
+      return tree;
+    }
+  }
+  return log_lookup->GetCompactMerkleTree(new Sha256Hasher);
+}
+
+// A log from --shards.
+struct Shard {
+  string path_prefix;
+  string db;
+  // Empty if the shard is frozen.
+  string key;
+  // -1 for --entry_cache_size_mb.
+  int entry_cache_size_mb;
+};
+
+vector<Shard> ReadShards(const string& file) {
+  string contents;
+  CHECK(util::ReadTextFile(file, &contents)) << "could not read " << file;
+
+  vector<Shard> shards;
+  istringstream lines(contents);
+  string line;
+  while (getline(lines, line)) {
+    if (line.empty() || line[0] == '#') {
+      continue;
+    }
+    istringstream fields(line);
+    Shard shard;
+    CHECK(fields >> shard.path_prefix >> shard.db >> shard.key)
+        << "invalid line in " << file << ": " << line;
+    if (shard.key == "frozen") {
+      shard.key.clear();
+    }
+    if (!(fields >> shard.entry_cache_size_mb)) {
+      shard.entry_cache_size_mb = -1;
+    } else {
+      CHECK_GE(shard.entry_cache_size_mb, 0) << line;
+    }
+    CHECK_EQ('/', shard.path_prefix[0]) << "invalid path prefix: " << line;
+    shards.push_back(shard);
+  }
+  return shards;
+}
+
+// Opens the database of a shard, of the same type as that of the main
+// log.
+Database<LoggedCertificate>* OpenShardDatabase(const string& path) {
+  if (!FLAGS_sqlite_db.empty()) {
+    return new SQLiteDB<LoggedCertificate>(path);
+  }
+  if (!FLAGS_leveldb_db.empty()) {
+    return new LevelDB<LoggedCertificate>(path);
+  }
+#ifdef HAVE_ROCKSDB
+  if (!FLAGS_rocksdb_db.empty()) {
+    return new RocksDB<LoggedCertificate>(path);
+  }
+#endif
+  LOG(FATAL) << "--shards needs --sqlite_db, --leveldb_db or --rocksdb_db";
+  return nullptr;
+}
+
+// Sets up a simple single-node environment for the log of |server|,
+// whose cluster state is under |etcd_root|. The initial STH is issued
+// by |tree_signer|, or, if it is null as for a frozen shard, is the
+// latest one in |db|.
+void SetUpStandAlone(Server<LoggedCertificate>* server,
+                     const string& etcd_root, EtcdClient* etcd_client,
+                     libevent::Base* event_base,
+                     TreeSigner<LoggedCertificate>* tree_signer,
+                     const Database<LoggedCertificate>* db) {
+  // Put a sensible single-node config into FakeEtcd. For a real clustered
+  // log
+  // we'd expect a ClusterConfig already to be present within etcd as part of
+  // the provisioning of the log.
+  //
+  // TODO(alcutter): Note that we're currently broken wrt to restarting the
+  // log server when there's data in the log.  It's a temporary thing though,
+  // so fear ye not.
+  ct::ClusterConfig config;
+  config.set_minimum_serving_nodes(1);
+  config.set_minimum_serving_fraction(1);
+  LOG(INFO) << "Setting default single-node ClusterConfig:\n"
+            << config.DebugString();
+  server->consistent_store()->SetClusterConfig(config);
+
+  // Since we're a single node cluster, we'll settle that we're the
+  // master here, so that we can populate the initial STH
+  // (StrictConsistentStore won't allow us to do so unless we're master.)
+  server->election()->StartElection();
+  server->election()->WaitToBecomeMaster();
+
+  {
+    EtcdClient::Response resp;
+    util::SyncTask task(event_base);
+    etcd_client->Create(etcd_root + "/sequence_mapping", "", &resp,
+                        task.task());
+    task.Wait();
+    CHECK_EQ(util::Status::OK, task.status());
+  }
+
+  SignedTreeHead sth;
+  if (tree_signer) {
+    // Do an initial signing run to get the initial STH, again this is
+    // temporary until we re-populate FakeEtcd from the DB.
+    CHECK_EQ(tree_signer->UpdateTree(), TreeSigner<LoggedCertificate>::OK);
+    sth = tree_signer->LatestSTH();
+  } else {
+    CHECK_EQ(Database<LoggedCertificate>::LOOKUP_OK, db->LatestTreeHead(&sth))
+        << "a frozen shard needs a tree head";
+  }
+
+  // Need to boot-strap the Serving STH too because we consider it an error
+  // if it's not set, which in turn causes us to not attempt to become
+  // master:
+  server->consistent_store()->SetServingSTH(sth);
 }
 
 }  // namespace
@@ -332,40 +807,66 @@ int main(int argc, char* argv[]) {
 
   util::InitCT(&argc, &argv);
 
-  Server<LoggedCertificate>::StaticInit();
+  // The threads started from here on, and what this one allocates
+  // (such as the tree of the LogLookup, which the pool workers read),
+  // stay on the same CPUs, and so NUMA node, as the pool workers.
+  cert_trans::PinCurrentThread(FLAGS_thread_pool_cpus);
 
-  util::StatusOr<EVP_PKEY*> pkey(ReadPrivateKey(FLAGS_key));
-  CHECK_EQ(pkey.status(), util::Status::OK);
-  LogSigner log_signer(pkey.ValueOrDie());
-
-  CertChecker checker;
-  CHECK(checker.LoadTrustedCertificates(FLAGS_trusted_cert_file))
-      << "Could not load CA certs from " << FLAGS_trusted_cert_file;
+  Server<LoggedCertificate>::StaticInit();
+  const steady_clock::time_point startup_time(steady_clock::now());
 
   if (!FLAGS_sqlite_db.empty() + !FLAGS_leveldb_db.empty() +
+          !FLAGS_rocksdb_db.empty() +
           (!FLAGS_cert_dir.empty() | !FLAGS_tree_dir.empty()) !=
       1) {
     std::cerr << "Must only specify one database type.";
     exit(1);
   }
+#ifndef HAVE_ROCKSDB
+  CHECK(FLAGS_rocksdb_db.empty()) << "this binary was built without RocksDB "
+                                     "support";
+#endif
 
-  if (FLAGS_sqlite_db.empty() && FLAGS_leveldb_db.empty()) {
+  if (FLAGS_sqlite_db.empty() && FLAGS_leveldb_db.empty() &&
+      FLAGS_rocksdb_db.empty()) {
     CHECK_NE(FLAGS_cert_dir, FLAGS_tree_dir)
         << "Certificate directory and tree directory must differ";
   }
 
+  // Opening the database (which builds the index of a FileDB) and
+  // loading the keys and CA certificates are independent, and both
+  // can take a while, so they are done concurrently.
+  util::StatusOr<EVP_PKEY*> pkey;
+  // A second copy of the key, to check the STHs gossiped by the other
+  // nodes.
+  util::StatusOr<EVP_PKEY*> verifier_pkey;
+  CertChecker checker;
+  thread credentials_loader([&pkey, &verifier_pkey, &checker]() {
+    RunStartupPhase("load_credentials", [&pkey, &verifier_pkey, &checker]() {
+      pkey = ReadPrivateKey(FLAGS_key);
+      verifier_pkey = ReadPrivateKey(FLAGS_key);
+      CHECK(checker.LoadTrustedCertificates(FLAGS_trusted_cert_file))
+          << "Could not load CA certs from " << FLAGS_trusted_cert_file;
+    });
+  });
+
   Database<LoggedCertificate>* db;
+  ArchivedDB<LoggedCertificate>* archived_db(nullptr);
+  const SegmentStorage* entry_segments;
+  RunStartupPhase("open_database", [&db, &archived_db, &entry_segments]() {
+    db = OpenDatabase(&entry_segments);
+    if (!FLAGS_archive_dir.empty()) {
+      archived_db = new ArchivedDB<LoggedCertificate>(
+          db, FLAGS_archive_dir, FLAGS_archive_range_entries);
+      db = archived_db;
+    }
+  });
 
-  if (!FLAGS_sqlite_db.empty()) {
-    db = new SQLiteDB<LoggedCertificate>(FLAGS_sqlite_db);
-  } else if (!FLAGS_leveldb_db.empty()) {
-    db = new LevelDB<LoggedCertificate>(FLAGS_leveldb_db);
-  } else {
-    db = new FileDB<LoggedCertificate>(
-        new FileStorage(FLAGS_cert_dir, FLAGS_cert_storage_depth),
-        new FileStorage(FLAGS_tree_dir, FLAGS_tree_storage_depth),
-        new FileStorage(FLAGS_meta_dir, 0));
-  }
+  credentials_loader.join();
+  CHECK_EQ(pkey.status(), util::Status::OK);
+  LogSigner log_signer(pkey.ValueOrDie());
+  CHECK_EQ(verifier_pkey.status(), util::Status::OK);
+  LogSigVerifier log_verifier(verifier_pkey.ValueOrDie());
 
   shared_ptr<libevent::Base> event_base(make_shared<libevent::Base>());
   ThreadPool internal_pool(8);
@@ -385,77 +886,174 @@ int main(int argc, char* argv[]) {
           : new EtcdClient(&internal_pool, &url_fetcher,
                            SplitHosts(FLAGS_etcd_servers)));
 
+  ThreadPool http_pool(FLAGS_num_http_server_threads);
   Server<LoggedCertificate>::Options options;
   options.server = FLAGS_server;
   options.port = FLAGS_port;
   options.etcd_root = FLAGS_etcd_root;
+  options.pending_entry_body_dir = FLAGS_pending_entry_body_dir;
+  options.pending_entry_journal_dir = FLAGS_pending_entry_journal_dir;
   options.num_http_server_threads = FLAGS_num_http_server_threads;
+  options.http_pool = &http_pool;
+  // Bring up the HTTP servers right away, so that load balancers see
+  // a node that is starting up (503s, then proxying while it is
+  // stale), rather than one that is down, until SetReady().
+  options.start_unready = true;
+  options.gossip_verifier = &log_verifier;
+  options.entry_segments = entry_segments;
 
   Server<LoggedCertificate> server(options, event_base, &internal_pool, db,
                                    etcd_client.get(), &url_fetcher,
                                    &log_signer, &checker);
-  server.Initialise(false /* is_mirror */);
+  RunStartupPhase("build_tree", [&server]() {
+    // Builds the tree of the LogLookup from the database.
+    server.Initialise(false /* is_mirror */);
+  });
 
+  unique_ptr<CompactMerkleTree> signer_tree;
+  RunStartupPhase("build_signer_tree", [db, &server, &signer_tree]() {
+    signer_tree = SignerTree(db, server.log_lookup());
+  });
   TreeSigner<LoggedCertificate> tree_signer(
       std::chrono::duration<double>(FLAGS_guard_window_seconds), db,
-      server.log_lookup()->GetCompactMerkleTree(new Sha256Hasher),
-      server.consistent_store(), &log_signer);
+      std::move(signer_tree), server.consistent_store(), &log_signer,
+      // Saves the LogLookup reading back and hashing what we signed.
+      bind(&LogLookup<LoggedCertificate>::OfferLeafHashes,
+           server.log_lookup(), _1, _2));
 
   if (stand_alone_mode) {
-    // Set up a simple single-node environment.
-    //
-    // Put a sensible single-node config into FakeEtcd. For a real clustered
-    // log
-    // we'd expect a ClusterConfig already to be present within etcd as part of
-    // the provisioning of the log.
-    //
-    // TODO(alcutter): Note that we're currently broken wrt to restarting the
-    // log server when there's data in the log.  It's a temporary thing though,
-    // so fear ye not.
-    ct::ClusterConfig config;
-    config.set_minimum_serving_nodes(1);
-    config.set_minimum_serving_fraction(1);
-    LOG(INFO) << "Setting default single-node ClusterConfig:\n"
-              << config.DebugString();
-    server.consistent_store()->SetClusterConfig(config);
-
-    // Since we're a single node cluster, we'll settle that we're the
-    // master here, so that we can populate the initial STH
-    // (StrictConsistentStore won't allow us to do so unless we're master.)
-    server.election()->StartElection();
-    server.election()->WaitToBecomeMaster();
-
-    {
-      EtcdClient::Response resp;
-      util::SyncTask task(event_base.get());
-      etcd_client->Create("/root/sequence_mapping", "", &resp, task.task());
-      task.Wait();
-      CHECK_EQ(util::Status::OK, task.status());
-    }
-
-    // Do an initial signing run to get the initial STH, again this is
-    // temporary until we re-populate FakeEtcd from the DB.
-    CHECK_EQ(tree_signer.UpdateTree(), TreeSigner<LoggedCertificate>::OK);
-
-    // Need to boot-strap the Serving STH too because we consider it an error
-    // if it's not set, which in turn causes us to not attempt to become
-    // master:
-    server.consistent_store()->SetServingSTH(tree_signer.LatestSTH());
+    SetUpStandAlone(&server, FLAGS_etcd_root, etcd_client.get(),
+                    event_base.get(), &tree_signer, db);
   } else {
     CHECK(!FLAGS_server.empty());
   }
 
-  server.WaitForReplication();
+  // The shards share the event loop, the thread pools and the
+  // UrlFetcher of the main log, and are served by its HTTP servers.
+  // The frozen ones have no signer, so neither accept submissions nor
+  // run the sequencer, the cleanup or the tree signer.
+  const vector<Shard> shards(FLAGS_shards.empty() ? vector<Shard>()
+                                                  : ReadShards(FLAGS_shards));
+  vector<unique_ptr<Database<LoggedCertificate>>> shard_dbs;
+  vector<unique_ptr<LogSigner>> shard_log_signers;
+  vector<unique_ptr<Server<LoggedCertificate>>> shard_servers;
+  // Null for the frozen shards.
+  vector<unique_ptr<TreeSigner<LoggedCertificate>>> shard_tree_signers;
+  RunStartupPhase("load_shards", [&]() {
+    for (const Shard& shard : shards) {
+      Server<LoggedCertificate>::Options shard_options(options);
+      shard_options.etcd_root = FLAGS_etcd_root + shard.path_prefix;
+      shard_options.path_prefix = shard.path_prefix;
+      shard_options.serve_http = false;
+      shard_options.entry_cache_size_mb = shard.entry_cache_size_mb;
+      // The shards have keys of their own, and their nodes keep to
+      // etcd.
+      shard_options.gossip_verifier = nullptr;
+      shard_options.entry_segments = nullptr;
+      if (shard.key.empty()) {
+        // Nothing can be pending.
+        shard_options.pending_entry_body_dir.clear();
+        shard_options.pending_entry_journal_dir.clear();
+      }
+      shard_dbs.emplace_back(OpenShardDatabase(shard.db));
+      Database<LoggedCertificate>* const shard_db(shard_dbs.back().get());
+
+      LogSigner* shard_log_signer(nullptr);
+      if (!shard.key.empty()) {
+        const util::StatusOr<EVP_PKEY*> shard_pkey(ReadPrivateKey(shard.key));
+        CHECK(shard_pkey.ok()) << "Failed to read the private key of "
+                               << shard.path_prefix << ": "
+                               << shard_pkey.status();
+        shard_log_signers.emplace_back(
+            new LogSigner(shard_pkey.ValueOrDie()));
+        shard_log_signer = shard_log_signers.back().get();
+      }
+
+      shard_servers.emplace_back(new Server<LoggedCertificate>(
+          shard_options, event_base, &internal_pool, shard_db,
+          etcd_client.get(), &url_fetcher, shard_log_signer,
+          shard_log_signer ? &checker : nullptr));
+      Server<LoggedCertificate>* const shard_server(
+          shard_servers.back().get());
+      shard_server->Initialise(false /* is_mirror */);
+
+      TreeSigner<LoggedCertificate>* shard_tree_signer(nullptr);
+      if (shard_log_signer) {
+        shard_tree_signers.emplace_back(new TreeSigner<LoggedCertificate>(
+            std::chrono::duration<double>(FLAGS_guard_window_seconds),
+            shard_db, SignerTree(shard_db, shard_server->log_lookup()),
+            shard_server->consistent_store(), shard_log_signer,
+            bind(&LogLookup<LoggedCertificate>::OfferLeafHashes,
+                 shard_server->log_lookup(), _1, _2)));
+        shard_tree_signer = shard_tree_signers.back().get();
+      } else {
+        shard_tree_signers.emplace_back(nullptr);
+      }
+
+      if (stand_alone_mode) {
+        SetUpStandAlone(shard_server, shard_options.etcd_root,
+                        etcd_client.get(), event_base.get(),
+                        shard_tree_signer, shard_db);
+      }
+      server.AddLog(shard_server);
+      LOG(INFO) << "Serving " << (shard_log_signer ? "" : "frozen ")
+                << "shard " << shard.path_prefix << " of "
+                << shard_db->TreeSize() << " entries";
+    }
+  });
+
+  RunStartupPhase("wait_for_replication", [&server, &shard_servers]() {
+    server.WaitForReplication();
+    for (const auto& shard_server : shard_servers) {
+      shard_server->WaitForReplication();
+    }
+  });
 
-  // TODO(pphaneuf): We should be remaining in an "unhealthy state"
-  // (either not accepting any requests, or returning some internal
-  // server error) until we have an STH to serve.
   const function<bool()> is_master(
       bind(&Server<LoggedCertificate>::IsMaster, &server));
   thread sequencer(&SequenceEntries, &tree_signer, is_master);
   thread cleanup(&CleanUpEntries, server.consistent_store(), is_master);
-  thread signer(&SignMerkleTree, &tree_signer, server.consistent_store(),
-                server.cluster_state_controller());
+  thread signer(&SignMerkleTree, &tree_signer, db, server.consistent_store(),
+                server.cluster_state_controller(), true /* update_metrics */);
+  thread archiver;
+  if (archived_db) {
+    archiver = thread(&ArchiveEntries, archived_db);
+  }
+  thread trusted_cert_reloader;
+  if (FLAGS_trusted_cert_reload_frequency_seconds > 0) {
+    trusted_cert_reloader = thread(&ReloadTrustedCertificates, &checker);
+  }
+
+  vector<thread> shard_threads;
+  for (size_t i = 0; i < shard_servers.size(); ++i) {
+    TreeSigner<LoggedCertificate>* const shard_tree_signer(
+        shard_tree_signers[i].get());
+    if (!shard_tree_signer) {
+      continue;
+    }
+    Server<LoggedCertificate>* const shard_server(shard_servers[i].get());
+    const function<bool()> shard_is_master(
+        bind(&Server<LoggedCertificate>::IsMaster, shard_server));
+    shard_threads.emplace_back(&SequenceEntries, shard_tree_signer,
+                               shard_is_master);
+    shard_threads.emplace_back(&CleanUpEntries,
+                               shard_server->consistent_store(),
+                               shard_is_master);
+    shard_threads.emplace_back(&SignMerkleTree, shard_tree_signer,
+                               shard_dbs[i].get(),
+                               shard_server->consistent_store(),
+                               shard_server->cluster_state_controller(),
+                               false /* update_metrics */);
+  }
+
+  for (const auto& shard_server : shard_servers) {
+    shard_server->SetReady();
+  }
+  server.SetReady();
+  const milliseconds startup_duration(
+      duration_cast<milliseconds>(steady_clock::now() - startup_time));
+  startup_phase_duration_ms->Set("total", startup_duration.count());
+  LOG(INFO) << "Ready to serve after " << startup_duration.count() << " ms";
 
   server.Run();
 
@@ -0,0 +1,314 @@
+#include "server/entry_cache.h"
+
+#include <algorithm>
+#include <glog/logging.h>
+
+#include "log/logged_certificate.h"
+#include "log/prefetching_iterator.h"
+#include "monitoring/monitoring.h"
+#include "proto/serializer.h"
+#include "util/base64.h"
+
+using std::function;
+using std::lock_guard;
+using std::make_shared;
+using std::min;
+using std::mutex;
+using std::placeholders::_1;
+using std::shared_ptr;
+using std::string;
+using std::unique_ptr;
+using std::vector;
+
+namespace cert_trans {
+namespace {
+
+
+static Counter<bool>* entry_cache_lookups(
+    Counter<bool>::New("entry_cache_lookups", "hit",
+                       "Number of blocks of entries looked up in the "
+                       "get-entries cache, by whether they were cached."));
+static Counter<>* entry_cache_coalesced_reads(
+    Counter<>::New("entry_cache_coalesced_reads",
+                   "Number of blocks of entries that were being read from "
+                   "the database for another request when looked up."));
+static Gauge<>* entry_cache_bytes(
+    Gauge<>::New("entry_cache_bytes",
+                 "Memory used by the blocks in the get-entries cache."));
+
+
+const char kLeafInputJson[] = "{\"leaf_input\":\"";
+const char kExtraDataJson[] = "\",\"extra_data\":\"";
+const char kSCTJson[] = ",\"sct\":\"";
+
+
+// Appends |data| to |out| in base 64, without a temporary string.
+void AppendBase64(const string& data, string* out) {
+  const size_t offset(out->size());
+  out->resize(offset + util::Base64EncodedLength(data.size()));
+  util::Base64Encode(data.data(), data.size(), &(*out)[offset]);
+}
+
+
+// Renders each part straight into its reserved string, from the leaf
+// and extra data cached in the entry when they are.
+bool RenderEntry(const LoggedCertificate& logged, EntryCache::Entry* entry) {
+  string leaf_buffer;
+  string extra_data_buffer;
+  string sct_data;
+  const string* const leaf_input(logged.LeafInput(&leaf_buffer));
+  const string* const extra_data(logged.ExtraData(&extra_data_buffer));
+  if (!leaf_input || !extra_data ||
+      Serializer::SerializeSCT(logged.sct(), &sct_data) != Serializer::OK) {
+    LOG(WARNING) << "Failed to serialize entry @ "
+                 << logged.sequence_number() << ":\n"
+                 << logged.DebugString();
+    return false;
+  }
+
+  entry->json.clear();
+  entry->json.reserve(sizeof(kLeafInputJson) - 1 +
+                      util::Base64EncodedLength(leaf_input->size()) +
+                      sizeof(kExtraDataJson) - 1 +
+                      util::Base64EncodedLength(extra_data->size()) + 1);
+  entry->json.append(kLeafInputJson);
+  AppendBase64(*leaf_input, &entry->json);
+  entry->json.append(kExtraDataJson);
+  AppendBase64(*extra_data, &entry->json);
+  entry->json.push_back('"');
+
+  entry->sct_json.clear();
+  entry->sct_json.reserve(sizeof(kSCTJson) - 1 +
+                          util::Base64EncodedLength(sct_data.size()) + 1);
+  entry->sct_json.append(kSCTJson);
+  AppendBase64(sct_data, &entry->sct_json);
+  entry->sct_json.push_back('"');
+
+  entry->binary.clear();
+  entry->binary.reserve(3 + leaf_input->size() + 3 + extra_data->size() + 2 +
+                        sct_data.size());
+  entry->binary.append(Serializer::SerializeUint(leaf_input->size(), 3));
+  entry->binary.append(*leaf_input);
+  entry->binary.append(Serializer::SerializeUint(extra_data->size(), 3));
+  entry->binary.append(*extra_data);
+  entry->binary.append(Serializer::SerializeUint(sct_data.size(), 2));
+  entry->binary.append(sct_data);
+  return true;
+}
+
+
+}  // namespace
+
+
+struct EntryCache::Block {
+  Block(int64_t start, int64_t capacity)
+      : start(start),
+        entries(capacity),
+        size(0),
+        bytes(sizeof(Block) + capacity * sizeof(Entry)) {
+  }
+
+  const int64_t start;
+  // Only the first |size| entries are set, and those never change
+  // after that, so that they can be read without holding the lock.
+  vector<Entry> entries;
+
+  // These are guarded by EntryCache::mutex_.
+  int64_t size;
+  size_t bytes;
+  std::list<int64_t>::iterator lru;
+};
+
+
+EntryCache::EntryCache(Database<LoggedCertificate>* db, size_t max_bytes,
+                       int64_t block_size)
+    : db_(CHECK_NOTNULL(db)),
+      max_bytes_(max_bytes),
+      block_size_(block_size),
+      entry_callback_(std::bind(&EntryCache::EntryWritten, this, _1)),
+      bytes_(0),
+      memory_("entry_cache") {
+  CHECK_GT(block_size_, 0);
+  db_->AddNotifyEntryCallback(&entry_callback_);
+}
+
+
+EntryCache::~EntryCache() {
+  db_->RemoveNotifyEntryCallback(&entry_callback_);
+}
+
+
+bool EntryCache::ForEachEntry(int64_t start, int64_t end,
+                              const function<void(const Entry&)>& callback) {
+  int64_t next;
+  if (max_bytes_ == 0) {
+    return ReadEntries(start, end, start, end, callback, &next);
+  }
+
+  int64_t index(start);
+  int64_t coalesced_index(-1);
+  while (index <= end) {
+    const int64_t block_start(index - index % block_size_);
+    int64_t size;
+    const shared_ptr<const Block> block(Lookup(index, &size));
+    entry_cache_lookups->Increment(index < block_start + size);
+    if (index < block_start + size) {
+      const int64_t last(min(end, block_start + size - 1));
+      for (; index <= last; ++index) {
+        callback(block->entries[index - block_start]);
+      }
+      continue;
+    }
+
+    // Read the rest of the block, so that the entries around these
+    // can be served from the cache next time.
+    const int64_t block_end(block_start + block_size_ - 1);
+    const function<bool()> read([this, block_start, size, block_end, index,
+                                 end, &callback, &next]() {
+      return ReadEntries(block_start + size, block_end, index, end, callback,
+                         &next);
+    });
+    // If another request is reading the same block, waits for it and
+    // then looks it up again, unless that was already done for this
+    // entry, as the block might have been evicted since, or end before
+    // it.
+    bool coalesced(false);
+    const bool ok(index == coalesced_index
+                      ? read()
+                      : block_reads_.Do(block_start, read, &coalesced));
+    if (!ok) {
+      return false;
+    }
+    if (coalesced) {
+      entry_cache_coalesced_reads->Increment();
+      coalesced_index = index;
+      continue;
+    }
+    if (next <= block_end) {
+      // This is the end of what is in the database.
+      break;
+    }
+    index = next;
+  }
+
+  return true;
+}
+
+
+size_t EntryCache::CachedBytes() const {
+  lock_guard<mutex> lock(mutex_);
+  return bytes_;
+}
+
+
+shared_ptr<const EntryCache::Block> EntryCache::Lookup(int64_t index,
+                                                       int64_t* size) {
+  lock_guard<mutex> lock(mutex_);
+  const auto it(blocks_.find(index - index % block_size_));
+  if (it == blocks_.end()) {
+    *size = 0;
+    return nullptr;
+  }
+
+  lru_.splice(lru_.begin(), lru_, it->second->lru);
+  *size = it->second->size;
+  return it->second;
+}
+
+
+bool EntryCache::ReadEntries(int64_t first, int64_t last, int64_t start,
+                             int64_t end,
+                             const function<void(const Entry&)>& callback,
+                             int64_t* next) {
+  const unique_ptr<Database<LoggedCertificate>::Iterator> it(
+      ScanEntriesPrefetching(db_, first, last - first + 1));
+  // Read in blocks, which some databases can each get with one query.
+  const int64_t block_size(FLAGS_database_prefetch_entries > 0
+                               ? FLAGS_database_prefetch_entries
+                               : last - first + 1);
+  vector<LoggedCertificate> logged;
+  for (*next = first; *next <= last;) {
+    logged.clear();
+    if (it->GetNextEntries(min(block_size, last - *next + 1), &logged) == 0) {
+      break;
+    }
+
+    for (const auto& cert : logged) {
+      if (cert.sequence_number() != *next) {
+        return true;
+      }
+
+      Entry entry;
+      if (!RenderEntry(cert, &entry)) {
+        return false;
+      }
+      if (*next >= start && *next <= end) {
+        callback(entry);
+      }
+      Add(*next, &entry);
+      ++*next;
+    }
+  }
+
+  return true;
+}
+
+
+void EntryCache::Add(int64_t index, Entry* entry) {
+  if (max_bytes_ == 0) {
+    return;
+  }
+
+  const int64_t start(index - index % block_size_);
+  lock_guard<mutex> lock(mutex_);
+  auto it(blocks_.find(start));
+  if (it == blocks_.end()) {
+    // Blocks are only ever filled from their start.
+    if (index != start) {
+      return;
+    }
+    const shared_ptr<Block> block(make_shared<Block>(start, block_size_));
+    lru_.push_front(start);
+    block->lru = lru_.begin();
+    bytes_ += block->bytes;
+    it = blocks_.emplace(start, block).first;
+  }
+
+  Block* const block(it->second.get());
+  if (block->size != index - start) {
+    return;
+  }
+  const size_t entry_bytes(entry->json.size() + entry->sct_json.size() +
+                           entry->binary.size());
+  block->entries[block->size].json.swap(entry->json);
+  block->entries[block->size].sct_json.swap(entry->sct_json);
+  block->entries[block->size].binary.swap(entry->binary);
+  ++block->size;
+  block->bytes += entry_bytes;
+  bytes_ += entry_bytes;
+
+  while (bytes_ > max_bytes_ && !lru_.empty()) {
+    const auto evicted(blocks_.find(lru_.back()));
+    CHECK(evicted != blocks_.end());
+    bytes_ -= evicted->second->bytes;
+    blocks_.erase(evicted);
+    lru_.pop_back();
+  }
+  entry_cache_bytes->Set(bytes_);
+  memory_.Set(bytes_);
+}
+
+
+void EntryCache::EntryWritten(const LoggedCertificate& logged) {
+  if (max_bytes_ == 0) {
+    return;
+  }
+
+  Entry entry;
+  if (RenderEntry(logged, &entry)) {
+    Add(logged.sequence_number(), &entry);
+  }
+}
+
+
+}  // namespace cert_trans
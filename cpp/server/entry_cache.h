@@ -0,0 +1,114 @@
+#ifndef CERT_TRANS_SERVER_ENTRY_CACHE_H_
+#define CERT_TRANS_SERVER_ENTRY_CACHE_H_
+
+#include <functional>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "base/macros.h"
+#include "log/database.h"
+#include "monitoring/memory_gauge.h"
+#include "util/single_flight.h"
+
+namespace cert_trans {
+
+class LoggedCertificate;
+
+
+// Keeps the rendered get-entries replies of recently requested entries,
+// in both the JSON and the binary format, so that
+// they can be served again without reading them from the database and
+// serializing them. The entries are cached in blocks of consecutive
+// entries starting at a multiple of the block size, and the least
+// recently used blocks are evicted to stay within a memory budget.
+//
+// Entries are also added as they are written to the database, as
+// the newest entries are the most requested ones right after a new
+// STH is published. Thread-safe.
+class EntryCache {
+ public:
+  // An entry as it appears in a get-entries response.
+  struct Entry {
+    // The JSON object with the "leaf_input" and "extra_data" members,
+    // without its closing brace, so that "sct_json" can be added.
+    std::string json;
+    // The non-standard "sct" member, with its leading comma.
+    std::string sct_json;
+    // The leaf input, extra data and SCT, each TLS-encoded as an
+    // opaque vector with a 3-byte length (2-byte for the SCT), as
+    // they are sent to other log nodes asking for the binary format.
+    std::string binary;
+  };
+
+  // Does not take ownership of |db|, which must outlive this
+  // instance. Nothing is cached if |max_bytes| is 0.
+  EntryCache(Database<LoggedCertificate>* db, size_t max_bytes,
+             int64_t block_size);
+  ~EntryCache();
+
+  // Calls |callback| with the entries from |start| to |end|
+  // inclusive, in order, stopping early at the first one that is not
+  // in the database. Returns false if an entry could not be
+  // serialized, after calling |callback| with the ones before it.
+  bool ForEachEntry(int64_t start, int64_t end,
+                    const std::function<void(const Entry&)>& callback);
+
+  // The amount of memory used by the cached blocks.
+  size_t CachedBytes() const;
+
+  // The number of entries in a block.
+  int64_t BlockSize() const {
+    return block_size_;
+  }
+
+ private:
+  struct Block;
+
+  // Returns the block |index| is in, if it is cached, and the number
+  // of entries it has.
+  std::shared_ptr<const Block> Lookup(int64_t index, int64_t* size);
+
+  // Reads the entries from |first| to |last| from the database,
+  // caching them, and calls |callback| with those from |start| to
+  // |end|. Sets |*next| to the index of the first entry that was not
+  // read. Returns false if an entry could not be serialized.
+  bool ReadEntries(int64_t first, int64_t last, int64_t start, int64_t end,
+                   const std::function<void(const Entry&)>& callback,
+                   int64_t* next);
+
+  // Adds the entry at |index| to its block, if it is the next one
+  // that block is missing.
+  void Add(int64_t index, Entry* entry);
+
+  void EntryWritten(const LoggedCertificate& logged);
+
+  Database<LoggedCertificate>* const db_;
+  const size_t max_bytes_;
+  const int64_t block_size_;
+  const Database<LoggedCertificate>::NotifyEntryCallback entry_callback_;
+
+  // The reads of the blocks that are missing, so that the concurrent
+  // requests for the same one wait for it to be read rather than all
+  // reading it.
+  SingleFlight<int64_t, bool> block_reads_;
+
+  mutable std::mutex mutex_;
+  // The cached blocks, by the index of their first entry.
+  std::map<int64_t, std::shared_ptr<Block>> blocks_;
+  // The indices of the cached blocks, most recently used first.
+  std::list<int64_t> lru_;
+  size_t bytes_;
+  MemoryGauge memory_;
+
+  DISALLOW_COPY_AND_ASSIGN(EntryCache);
+};
+
+
+}  // namespace cert_trans
+
+#endif  // CERT_TRANS_SERVER_ENTRY_CACHE_H_
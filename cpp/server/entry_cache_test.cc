@@ -0,0 +1,175 @@
+#include "server/entry_cache.h"
+
+#include <gtest/gtest.h>
+#include <string>
+#include <vector>
+
+#include "log/file_db.h"
+#include "log/logged_certificate.h"
+#include "log/test_db.h"
+#include "log/test_signer.h"
+#include "proto/serializer.h"
+#include "util/testing.h"
+#include "util/util.h"
+
+namespace cert_trans {
+namespace {
+
+using std::string;
+using std::vector;
+
+
+class EntryCacheTest : public ::testing::Test {
+ protected:
+  FileDB<LoggedCertificate>* db() const {
+    return test_db_.db();
+  }
+
+  // Writes |count| new entries at the end of the log.
+  void AddEntries(int count) {
+    for (int i = 0; i < count; ++i) {
+      LoggedCertificate logged;
+      test_signer_.CreateUniqueFakeSignature(&logged);
+      logged.set_sequence_number(entries_.size());
+      ASSERT_EQ(Database<LoggedCertificate>::OK,
+                db()->CreateSequencedEntry(logged));
+      entries_.push_back(logged);
+    }
+  }
+
+  // The get-entries JSON of the entry at |index|, with its SCT.
+  string ExpectedJson(int64_t index) const {
+    const LoggedCertificate& logged(entries_[index]);
+    string leaf_input, extra_data, sct_data;
+    CHECK(logged.SerializeForLeaf(&leaf_input));
+    CHECK(logged.SerializeExtraData(&extra_data));
+    CHECK_EQ(Serializer::OK, Serializer::SerializeSCT(logged.sct(), &sct_data));
+    return "{\"leaf_input\":\"" + util::ToBase64(leaf_input) +
+           "\",\"extra_data\":\"" + util::ToBase64(extra_data) +
+           "\",\"sct\":\"" + util::ToBase64(sct_data) + "\"}";
+  }
+
+  // Checks that |cache| returns the entries from |start| to |end|,
+  // or to the last one there is.
+  void ExpectEntries(EntryCache* cache, int64_t start, int64_t end) {
+    vector<string> json;
+    EXPECT_TRUE(cache->ForEachEntry(start, end,
+                                    [&json](const EntryCache::Entry& entry) {
+                                      json.push_back(entry.json +
+                                                     entry.sct_json + "}");
+                                    }));
+
+    const int64_t last(std::min<int64_t>(end, entries_.size() - 1));
+    ASSERT_EQ(std::max<int64_t>(last - start + 1, 0), json.size());
+    for (int64_t i = start; i <= last; ++i) {
+      EXPECT_EQ(ExpectedJson(i), json[i - start]) << i;
+    }
+  }
+
+  TestDB<FileDB<LoggedCertificate>> test_db_;
+  TestSigner test_signer_;
+  vector<LoggedCertificate> entries_;
+};
+
+
+TEST_F(EntryCacheTest, ReadsEntries) {
+  AddEntries(10);
+  EntryCache cache(db(), 1 << 20, 4);
+
+  ExpectEntries(&cache, 0, 9);
+  ExpectEntries(&cache, 3, 6);
+  ExpectEntries(&cache, 9, 9);
+  // Again, from the cache this time.
+  ExpectEntries(&cache, 0, 9);
+  EXPECT_LT(0U, cache.CachedBytes());
+}
+
+
+TEST_F(EntryCacheTest, RendersBinaryFormat) {
+  AddEntries(3);
+  EntryCache cache(db(), 1 << 20, 4);
+
+  vector<string> binary;
+  EXPECT_TRUE(cache.ForEachEntry(0, 2,
+                                 [&binary](const EntryCache::Entry& entry) {
+                                   binary.push_back(entry.binary);
+                                 }));
+  ASSERT_EQ(3U, binary.size());
+  for (int i = 0; i < 3; ++i) {
+    string leaf_input, extra_data, sct_data;
+    CHECK(entries_[i].SerializeForLeaf(&leaf_input));
+    CHECK(entries_[i].SerializeExtraData(&extra_data));
+    CHECK_EQ(Serializer::OK,
+             Serializer::SerializeSCT(entries_[i].sct(), &sct_data));
+    EXPECT_EQ(Serializer::SerializeUint(leaf_input.size(), 3) + leaf_input +
+                  Serializer::SerializeUint(extra_data.size(), 3) +
+                  extra_data + Serializer::SerializeUint(sct_data.size(), 2) +
+                  sct_data,
+              binary[i])
+        << i;
+  }
+}
+
+
+TEST_F(EntryCacheTest, StopsAtLastEntry) {
+  AddEntries(6);
+  EntryCache cache(db(), 1 << 20, 4);
+
+  ExpectEntries(&cache, 2, 10);
+  ExpectEntries(&cache, 5, 10);
+  ExpectEntries(&cache, 6, 10);
+  ExpectEntries(&cache, 100, 110);
+}
+
+
+TEST_F(EntryCacheTest, CachesWrittenEntries) {
+  EntryCache cache(db(), 1 << 20, 4);
+  EXPECT_EQ(0U, cache.CachedBytes());
+
+  AddEntries(5);
+  const size_t bytes(cache.CachedBytes());
+  EXPECT_LT(0U, bytes);
+  ExpectEntries(&cache, 0, 4);
+  EXPECT_EQ(bytes, cache.CachedBytes());
+
+  // The last block is extended as more entries come in.
+  AddEntries(2);
+  EXPECT_LT(bytes, cache.CachedBytes());
+  ExpectEntries(&cache, 3, 10);
+}
+
+
+TEST_F(EntryCacheTest, EvictsLeastRecentlyUsed) {
+  AddEntries(20);
+  const size_t kMaxBytes(8 << 10);
+  EntryCache cache(db(), kMaxBytes, 2);
+
+  ExpectEntries(&cache, 0, 19);
+  EXPECT_GE(kMaxBytes, cache.CachedBytes());
+  ExpectEntries(&cache, 0, 19);
+  EXPECT_GE(kMaxBytes, cache.CachedBytes());
+
+  AddEntries(20);
+  EXPECT_GE(kMaxBytes, cache.CachedBytes());
+  ExpectEntries(&cache, 15, 39);
+}
+
+
+TEST_F(EntryCacheTest, Disabled) {
+  EntryCache cache(db(), 0, 4);
+
+  AddEntries(5);
+  ExpectEntries(&cache, 0, 4);
+  ExpectEntries(&cache, 1, 10);
+  EXPECT_EQ(0U, cache.CachedBytes());
+}
+
+
+}  // namespace
+}  // namespace cert_trans
+
+
+int main(int argc, char** argv) {
+  cert_trans::test::InitTesting(argv[0], &argc, &argv, true);
+  return RUN_ALL_TESTS();
+}
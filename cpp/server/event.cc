@@ -1,16 +1,62 @@
 /* -*- indent-tabs-mode: nil -*- */
+#include "config.h"
 #include "server/event.h"
 
+#include <algorithm>
+#include <errno.h>
 #include <limits.h>
 #include <openssl/evp.h>
 #include <openssl/pem.h>
+#include <string.h>
+#ifdef HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#endif
+
+namespace {
+
+// How many events are taken from epoll, and packets sent or received
+// by UDPServer, at once.
+const int kBatchSize = 32;
+
+#ifdef HAVE_THREAD_LOCAL
+thread_local time_t rough_time = 0;
+#elif HAVE___THREAD
+__thread time_t rough_time = 0;
+#else
+#error No suitable thread local storage available
+#endif
+
+int CreateEpoll() {
+#ifdef HAVE_SYS_EPOLL_H
+  const int epoll_fd(epoll_create1(EPOLL_CLOEXEC));
+  CHECK_GE(epoll_fd, 0) << strerror(errno);
+  return epoll_fd;
+#else
+  return -1;
+#endif
+}
 
-time_t Services::rough_time_;
+}  // namespace
+
+// static
+time_t Services::RoughTime() {
+  if (rough_time == 0)
+    rough_time = time(NULL);
+  return rough_time;
+}
+
+// static
+void Services::SetRoughTime() {
+  rough_time = 0;
+}
 
 FD::FD(EventLoop* loop, int fd, CanDelete deletable)
-    : fd_(fd), loop_(loop), wants_erase_(false), deletable_(deletable) {
+    : fd_(fd),
+      loop_(loop),
+      wants_erase_(false),
+      deletable_(deletable),
+      polled_events_(0) {
   DCHECK_GE(fd, 0);
-  CHECK_LT((unsigned)fd, FD_SETSIZE);
   loop->Add(this);
   Activity();
 }
@@ -25,6 +71,7 @@ void FD::Close() {
   wants_erase_ = true;
   shutdown(fd(), SHUT_RDWR);
   close(fd());
+  loop_->InterestChanged(this);
 }
 
 bool FD::WillAccept(int fd) {
@@ -54,6 +101,26 @@ void Listener::WriteIsAllowed() {
   DLOG(FATAL) << "WriteIsAllowed() called on a read-only Listener.";
 }
 
+EventLoop::EventLoop() : go_(true), epoll_fd_(CreateEpoll()) {
+}
+
+EventLoop::~EventLoop() {
+  if (epoll_fd_ >= 0)
+    close(epoll_fd_);
+}
+
+void EventLoop::Add(FD* fd) {
+  fds_.push_back(fd);
+  // Called from the constructor of |fd|, so what it wants is only
+  // known from the next iteration.
+  InterestChanged(fd);
+}
+
+void EventLoop::InterestChanged(FD* fd) {
+  if (epoll_fd_ >= 0)
+    changed_.push_back(fd);
+}
+
 time_t EventLoop::ProcessRepeatedEvents() {
   if (events_.empty())
     return INT_MAX;
@@ -66,8 +133,8 @@ time_t EventLoop::ProcessRepeatedEvents() {
     time_t trigger = event->Trigger();
     if (trigger <= now) {
       event->Execute();
-      LOG(INFO) << "Executed " << event->Description() << " with a delay of "
-                << difftime(now, trigger) << " seconds";
+      VLOG(1) << "Executed " << event->Description() << " with a delay of "
+              << difftime(now, trigger) << " seconds";
       event->Activity();
       trigger = event->Trigger();
       CHECK_GT(trigger, now);
@@ -84,6 +151,13 @@ void EventLoop::OneLoop() {
   // select - they will get ignored until select returns.
   CHECK_GT(select_timeout, 0);
 
+  if (epoll_fd_ >= 0)
+    EpollOnce(select_timeout);
+  else
+    SelectOnce(select_timeout);
+}
+
+void EventLoop::SelectOnce(time_t select_timeout) {
   fd_set readers, writers;
   int max = -1;
 
@@ -145,6 +219,91 @@ void EventLoop::OneLoop() {
   CHECK_LE(n, r);
 }
 
+#ifdef HAVE_SYS_EPOLL_H
+void EventLoop::EpollOnce(time_t timeout) {
+  UpdateChanged();
+
+  epoll_event ready[kBatchSize];
+  const int r = epoll_wait(epoll_fd_, ready, kBatchSize,
+                           std::min<time_t>(timeout, INT_MAX / 1000) * 1000);
+  if (r < 0) {
+    CHECK_EQ(errno, EINTR) << strerror(errno);
+    return;
+  }
+
+  Services::SetRoughTime();
+  for (int i = 0; i < r; ++i) {
+    FD* fd = static_cast<FD*>(ready[i].data.ptr);
+    // Closed by an earlier callback, it is only deleted by the next
+    // UpdateChanged().
+    if (fd->WantsErase())
+      continue;
+
+    const uint32_t events = ready[i].events;
+    if ((events & (EPOLLOUT | EPOLLERR | EPOLLHUP)) && fd->WantsWrite()) {
+      fd->WriteIsAllowed();
+      fd->Activity();
+    }
+
+    if (fd->WantsErase())
+      continue;
+
+    if ((events & (EPOLLIN | EPOLLERR | EPOLLHUP)) && fd->WantsRead()) {
+      fd->ReadIsAllowed();
+      fd->Activity();
+    }
+
+    changed_.push_back(fd);
+  }
+}
+
+void EventLoop::UpdateChanged() {
+  bool closed = false;
+  for (std::vector<FD*>::const_iterator it = changed_.begin();
+       it != changed_.end(); ++it) {
+    FD* fd = *it;
+    if (fd->WantsErase()) {
+      // Closing it took it out of the epoll set.
+      closed = true;
+      continue;
+    }
+
+    // Nothing is polled for when nothing is wanted, rather than only
+    // errors, which epoll would keep reporting.
+    const uint32_t events = (fd->WantsRead() ? EPOLLIN : 0) |
+                            (fd->WantsWrite() ? EPOLLOUT : 0);
+    if (events == fd->polled_events_)
+      continue;
+    epoll_event event;
+    memset(&event, 0, sizeof event);
+    event.events = events;
+    event.data.ptr = fd;
+    const int op = fd->polled_events_ == 0
+                       ? EPOLL_CTL_ADD
+                       : (events == 0 ? EPOLL_CTL_DEL : EPOLL_CTL_MOD);
+    CHECK_EQ(epoll_ctl(epoll_fd_, op, fd->fd(), &event), 0)
+        << "fd " << fd->fd() << ": " << strerror(errno);
+    fd->polled_events_ = events;
+  }
+  changed_.clear();
+
+  if (closed) {
+    for (std::deque<FD*>::iterator pfd = fds_.begin(); pfd != fds_.end();) {
+      if (!EraseCheck(&pfd))
+        ++pfd;
+    }
+  }
+}
+#else
+void EventLoop::EpollOnce(time_t) {
+  LOG(FATAL) << "built without epoll";
+}
+
+void EventLoop::UpdateChanged() {
+  LOG(FATAL) << "built without epoll";
+}
+#endif
+
 void EventLoop::Stop() {
   go_ = false;
 }
@@ -212,6 +371,36 @@ void Server::WriteIsAllowed() {
   wbuffer_.erase(0, n);
 }
 
+#ifdef HAVE_RECVMMSG
+void UDPServer::ReadIsAllowed() {
+  static const size_t kPacketSize = 2048;
+  char bufs[kBatchSize][kPacketSize];
+  sockaddr_in sas[kBatchSize];
+  iovec iovs[kBatchSize];
+  mmsghdr msgs[kBatchSize];
+  memset(msgs, 0, sizeof msgs);
+  for (int i = 0; i < kBatchSize; ++i) {
+    iovs[i].iov_base = bufs[i];
+    iovs[i].iov_len = kPacketSize;
+    msgs[i].msg_hdr.msg_name = &sas[i];
+    msgs[i].msg_hdr.msg_namelen = sizeof sas[i];
+    msgs[i].msg_hdr.msg_iov = &iovs[i];
+    msgs[i].msg_hdr.msg_iovlen = 1;
+  }
+
+  // At least one packet is waiting, but without blocking for more.
+  const int in = recvmmsg(fd(), msgs, kBatchSize, MSG_DONTWAIT, NULL);
+  if (in < 0) {
+    CHECK(errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+        << strerror(errno);
+    return;
+  }
+  for (int i = 0; i < in; ++i) {
+    CHECK_EQ(msgs[i].msg_hdr.msg_namelen, sizeof sas[i]);
+    PacketRead(sas[i], bufs[i], msgs[i].msg_len);
+  }
+}
+#else
 void UDPServer::ReadIsAllowed() {
   char buf[2048];
   struct sockaddr_in sa;
@@ -223,7 +412,38 @@ void UDPServer::ReadIsAllowed() {
   // LOG(INFO) << "UDP packet " << util::HexString(std::string(buf, in));
   PacketRead(sa, buf, in);
 }
+#endif
 
+#ifdef HAVE_SENDMMSG
+void UDPServer::WriteIsAllowed() {
+  CHECK(!write_queue_.empty());
+  const size_t count =
+      std::min(write_queue_.size(), static_cast<size_t>(kBatchSize));
+  iovec iovs[kBatchSize];
+  mmsghdr msgs[kBatchSize];
+  memset(msgs, 0, sizeof msgs);
+  for (size_t i = 0; i < count; ++i) {
+    WBuffer& wbuf = write_queue_[i];
+    iovs[i].iov_base = &wbuf.packet[0];
+    iovs[i].iov_len = wbuf.packet.length();
+    msgs[i].msg_hdr.msg_name = &wbuf.sa;
+    msgs[i].msg_hdr.msg_namelen = sizeof wbuf.sa;
+    msgs[i].msg_hdr.msg_iov = &iovs[i];
+    msgs[i].msg_hdr.msg_iovlen = 1;
+  }
+
+  const int out = sendmmsg(fd(), msgs, count, MSG_DONTWAIT);
+  if (out < 0) {
+    CHECK(errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+        << strerror(errno);
+    return;
+  }
+  for (int i = 0; i < out; ++i) {
+    CHECK_EQ(msgs[i].msg_len, write_queue_.front().packet.length());
+    write_queue_.pop_front();
+  }
+}
+#else
 void UDPServer::WriteIsAllowed() {
   CHECK(!write_queue_.empty());
   WBuffer wbuf = write_queue_.front();
@@ -233,6 +453,7 @@ void UDPServer::WriteIsAllowed() {
   CHECK_NE(out, -1);
   CHECK_EQ((size_t)out, wbuf.packet.length());
 }
+#endif
 
 void UDPServer::QueuePacket(const sockaddr_in& to, const char* buf,
                             size_t len) {
@@ -240,9 +461,11 @@ void UDPServer::QueuePacket(const sockaddr_in& to, const char* buf,
   wbuf.sa = to;
   wbuf.packet = std::string(buf, len);
   write_queue_.push_back(wbuf);
+  loop()->InterestChanged(this);
 }
 
-bool Services::InitServer(int* sock, int port, const char* ip, int type) {
+bool Services::InitServer(int* sock, int port, const char* ip, int type,
+                          bool reuse_port) {
   bool ret = false;
   struct sockaddr_in server;
   int s = -1;
@@ -265,6 +488,17 @@ bool Services::InitServer(int* sock, int port, const char* ip, int type) {
   {
     int j = 1;
     setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &j, sizeof j);
+    if (reuse_port) {
+#ifdef SO_REUSEPORT
+      if (setsockopt(s, SOL_SOCKET, SO_REUSEPORT, &j, sizeof j) == -1) {
+        perror("setsockopt(SO_REUSEPORT)");
+        goto err;
+      }
+#else
+      LOG(ERROR) << "SO_REUSEPORT is not supported on this platform";
+      goto err;
+#endif
+    }
   }
 
   if (bind(s, (struct sockaddr*)&server, sizeof(server)) == -1) {
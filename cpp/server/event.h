@@ -5,10 +5,12 @@
 #include <deque>
 #include <glog/logging.h>
 #include <netinet/in.h>
+#include <stdint.h>
 #include <string>
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <time.h>
+#include <vector>
 
 #include "base/macros.h"
 
@@ -16,26 +18,23 @@ class Services {
  public:
   // because time is expensive, for most tasks we can just use some
   // time sampled within this event handling loop. So, the main loop
-  // needs to call SetRoughTime() appropriately.
-  static time_t RoughTime() {
-    if (rough_time_ == 0)
-      rough_time_ = time(NULL);
-    return rough_time_;
-  }
+  // needs to call SetRoughTime() appropriately. The time is sampled
+  // for each thread, so that each can run its own event loop.
+  static time_t RoughTime();
 
-  static void SetRoughTime() {
-    rough_time_ = 0;
-  }
+  static void SetRoughTime();
 
-  static bool InitServer(int* sock, int port, const char* ip, int type);
+  // If |reuse_port|, several sockets can be bound to the same port
+  // (with SO_REUSEPORT), the kernel spreading the traffic between
+  // them.
+  static bool InitServer(int* sock, int port, const char* ip, int type,
+                         bool reuse_port = false);
 
  private:
   // This class is only used as a namespace, it should never be
   // instantiated.
   // TODO(pphaneuf): Make this into normal functions in a namespace.
   Services();
-
-  static time_t rough_time_;
 };
 
 class EventLoop;
@@ -87,11 +86,15 @@ class FD {
   bool WillAccept(int fd);
 
  private:
+  friend class EventLoop;
+
   int fd_;
   EventLoop* loop_;
   bool wants_erase_;
   CanDelete deletable_;
   time_t last_activity_;
+  // The events the EventLoop is polling for, with epoll.
+  uint32_t polled_events_;
 
   // Note that while you can set these low for test, they behave a
   // bit strangely when set low - for example, it is quite easy to
@@ -149,19 +152,27 @@ class RepeatedEvent {
   time_t last_activity_;
 };
 
+// Where epoll is available, the loop only hears about the FDs that
+// are ready, rather than scanning all of them with select() on each
+// iteration. It polls for what WantsRead() and WantsWrite() return
+// after each callback of an FD; InterestChanged() must be called when
+// they change otherwise.
 class EventLoop {
  public:
-  EventLoop() : go_(true) {
-  }
+  EventLoop();
+  ~EventLoop();
 
-  void Add(FD* fd) {
-    fds_.push_back(fd);
-  }
+  void Add(FD* fd);
 
   void Add(RepeatedEvent* event) {
     events_.push_back(event);
   }
 
+  // Tells the loop that WantsRead() or WantsWrite() of |fd| may have
+  // changed, or that it was closed, outside of its callbacks (such as
+  // when a packet is queued on it by another FD).
+  void InterestChanged(FD* fd);
+
   // Returns remaining time until the next alarm.
   time_t ProcessRepeatedEvents();
 
@@ -178,6 +189,12 @@ class EventLoop {
 
   static void Set(int fd, fd_set* fdset, int* max);
 
+  void SelectOnce(time_t timeout);
+  void EpollOnce(time_t timeout);
+  // Updates what is polled for the FDs in |changed_|, and deletes
+  // those that were closed.
+  void UpdateChanged();
+
   std::deque<FD*> fds_;
   std::vector<RepeatedEvent*> events_;
   // This should probably be set to 2 for anything but test (or 1 or 0).
@@ -187,6 +204,10 @@ class EventLoop {
   static const time_t kIdleTime = 20;
 
   bool go_;
+  // -1 if select() is used instead.
+  const int epoll_fd_;
+  // The FDs to update with epoll, as of the last iteration.
+  std::vector<FD*> changed_;
 
   DISALLOW_COPY_AND_ASSIGN(EventLoop);
 };
@@ -216,6 +237,7 @@ class Server : public FD {
 
   void Write(std::string str) {
     wbuffer_.append(str);
+    loop()->InterestChanged(this);
   }
 
  private:
@@ -245,7 +267,9 @@ class UDPServer : public FD {
   virtual void PacketRead(const sockaddr_in& from, const char* buf,
                           size_t len) = 0;
 
-  // Queue a packet for sending
+  // Queue a packet for sending. Where sendmmsg() is available, the
+  // packets queued are sent several at a time, and where recvmmsg()
+  // is, those waiting are read several at a time.
   void QueuePacket(const sockaddr_in& to, const char* buf, size_t len);
   void QueuePacket(const sockaddr_in& to, const unsigned char* buf,
                    size_t len) {
@@ -0,0 +1,78 @@
+#include "server/fair_queue.h"
+
+#include <glog/logging.h>
+
+using std::function;
+using std::lock_guard;
+using std::map;
+using std::mutex;
+using std::string;
+
+namespace cert_trans {
+
+
+FairQueue::FairQueue(const map<string, int>& weights)
+    : weights_(weights), size_(0) {
+  for (const auto& weight : weights_) {
+    CHECK_GT(weight.second, 0) << "invalid weight for " << weight.first;
+  }
+}
+
+
+void FairQueue::Push(const string& client, const function<void()>& closure) {
+  lock_guard<mutex> lock(lock_);
+  const auto it(clients_.find(client));
+  if (it != clients_.end()) {
+    it->second.closures.push_back(closure);
+  } else {
+    Client* const added(&clients_[client]);
+    added->closures.push_back(closure);
+    added->turns = Weight(client);
+    order_.push_back(client);
+  }
+  ++size_;
+}
+
+
+bool FairQueue::RunNext() {
+  function<void()> closure;
+  {
+    lock_guard<mutex> lock(lock_);
+    if (order_.empty()) {
+      return false;
+    }
+
+    const auto it(clients_.find(order_.front()));
+    CHECK(it != clients_.end());
+    Client* const client(&it->second);
+    closure.swap(client->closures.front());
+    client->closures.pop_front();
+    --size_;
+
+    if (client->closures.empty()) {
+      clients_.erase(it);
+      order_.pop_front();
+    } else if (--client->turns == 0) {
+      client->turns = Weight(it->first);
+      order_.splice(order_.end(), order_, order_.begin());
+    }
+  }
+
+  closure();
+  return true;
+}
+
+
+size_t FairQueue::Size() const {
+  lock_guard<mutex> lock(lock_);
+  return size_;
+}
+
+
+int FairQueue::Weight(const string& client) const {
+  const auto it(weights_.find(client));
+  return it != weights_.end() ? it->second : 1;
+}
+
+
+}  // namespace cert_trans
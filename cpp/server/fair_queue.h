@@ -0,0 +1,61 @@
+#ifndef CERT_TRANS_SERVER_FAIR_QUEUE_H_
+#define CERT_TRANS_SERVER_FAIR_QUEUE_H_
+
+#include <deque>
+#include <functional>
+#include <list>
+#include <map>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "base/macros.h"
+
+namespace cert_trans {
+
+
+// Queues closures on behalf of clients, and runs them in weighted
+// round-robin order between the clients that have some queued: a
+// client with a weight of 3 has up to 3 closures run for each one of
+// a client with a weight of 1. Each client's closures run in the order
+// they were queued, so that one queueing many of them only delays its
+// own. Thread-safe.
+class FairQueue {
+ public:
+  // |weights| are the weights of the clients, which must be positive;
+  // the others have a weight of 1.
+  explicit FairQueue(const std::map<std::string, int>& weights);
+
+  void Push(const std::string& client, const std::function<void()>& closure);
+
+  // Runs the next closure, on this thread, and returns true, or
+  // returns false if there are none queued.
+  bool RunNext();
+
+  size_t Size() const;
+
+ private:
+  struct Client {
+    std::deque<std::function<void()>> closures;
+    // How many more closures run before moving on to the next client.
+    int turns;
+  };
+
+  int Weight(const std::string& client) const;
+
+  const std::map<std::string, int> weights_;
+
+  mutable std::mutex lock_;
+  // The clients with closures queued, and the order they get their
+  // turns in, starting with the current one.
+  std::unordered_map<std::string, Client> clients_;
+  std::list<std::string> order_;
+  size_t size_;
+
+  DISALLOW_COPY_AND_ASSIGN(FairQueue);
+};
+
+
+}  // namespace cert_trans
+
+#endif  // CERT_TRANS_SERVER_FAIR_QUEUE_H_
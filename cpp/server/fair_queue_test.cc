@@ -0,0 +1,91 @@
+#include "server/fair_queue.h"
+
+#include <gtest/gtest.h>
+#include <map>
+#include <string>
+
+#include "util/testing.h"
+
+namespace cert_trans {
+namespace {
+
+using std::map;
+using std::string;
+
+
+class FairQueueTest : public ::testing::Test {
+ protected:
+  FairQueueTest() : queue_(map<string, int>{{"ca", 3}}) {
+  }
+
+  void Push(const string& client, int n) {
+    queue_.Push(client, [this, client, n]() {
+      run_ += client + std::to_string(n) + " ";
+    });
+  }
+
+  string RunAll() {
+    run_.clear();
+    while (queue_.RunNext()) {
+    }
+    return run_;
+  }
+
+  FairQueue queue_;
+  string run_;
+};
+
+
+TEST_F(FairQueueTest, Empty) {
+  EXPECT_FALSE(queue_.RunNext());
+  EXPECT_EQ(0U, queue_.Size());
+}
+
+
+TEST_F(FairQueueTest, RunsInOrder) {
+  Push("a", 1);
+  Push("a", 2);
+  Push("a", 3);
+  EXPECT_EQ(3U, queue_.Size());
+  EXPECT_EQ("a1 a2 a3 ", RunAll());
+  EXPECT_EQ(0U, queue_.Size());
+}
+
+
+TEST_F(FairQueueTest, AlternatesBetweenClients) {
+  for (int i = 1; i <= 4; ++i) {
+    Push("greedy", i);
+  }
+  Push("other", 1);
+  Push("other", 2);
+  EXPECT_EQ("greedy1 other1 greedy2 other2 greedy3 greedy4 ", RunAll());
+}
+
+
+TEST_F(FairQueueTest, FollowsWeights) {
+  for (int i = 1; i <= 4; ++i) {
+    Push("ca", i);
+    Push("crawler", i);
+  }
+  EXPECT_EQ("ca1 ca2 ca3 crawler1 ca4 crawler2 crawler3 crawler4 ",
+            RunAll());
+}
+
+
+TEST_F(FairQueueTest, ClientsThatComeBackStartAtTheEnd) {
+  Push("a", 1);
+  Push("b", 1);
+  EXPECT_TRUE(queue_.RunNext());
+  Push("a", 2);
+  EXPECT_EQ("b1 a2 ", RunAll());
+}
+
+
+}  // namespace
+}  // namespace cert_trans
+
+
+int main(int argc, char** argv) {
+  cert_trans::test::InitTesting(argv[0], &argc, &argv, true);
+  return RUN_ALL_TESTS();
+}
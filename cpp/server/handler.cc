@@ -10,46 +10,79 @@
 #include <map>
 #include <memory>
 #include <stdlib.h>
+#include <string.h>
 #include <utility>
 #include <vector>
 
 #include "log/cert.h"
 #include "log/cert_checker.h"
 #include "log/cluster_state_controller.h"
+#include "log/file_db.h"
 #include "log/frontend.h"
+#include "log/interned_cert_cache.h"
 #include "log/log_lookup.h"
 #include "log/logged_certificate.h"
+#include "log/search_keys.h"
+#include "log/segment_storage.h"
+#include "merkletree/serial_hasher.h"
 #include "monitoring/monitoring.h"
 #include "monitoring/latency.h"
+#include "proto/serializer.h"
+#include "server/chain_parser.h"
+#include "server/entry_cache.h"
+#include "server/fair_queue.h"
 #include "server/json_output.h"
 #include "server/proxy.h"
+#include "server/rate_limiter.h"
+#include "server/traffic_capture.h"
+#include "util/base64.h"
 #include "util/json_wrapper.h"
 #include "util/thread_pool.h"
+#include "util/util.h"
 
 namespace libevent = cert_trans::libevent;
 
+using cert_trans::CapturedRequest;
 using cert_trans::Cert;
 using cert_trans::CertChain;
 using cert_trans::CertChecker;
+using cert_trans::DomainSearchKey;
+using cert_trans::ChainParser;
+using cert_trans::ChunkedJsonReply;
 using cert_trans::Counter;
+using cert_trans::EntryCache;
+using cert_trans::FairQueue;
+using cert_trans::Gzip;
+using cert_trans::Gauge;
 using cert_trans::HttpHandler;
+using cert_trans::InternedCertCache;
+using cert_trans::IssuerSearchKey;
 using cert_trans::JsonOutput;
 using cert_trans::Latency;
 using cert_trans::LoggedCertificate;
 using cert_trans::Proxy;
 using cert_trans::ScopedLatency;
+using cert_trans::SegmentStorage;
+using cert_trans::TrafficCapture;
 using ct::ShortMerkleAuditProof;
 using ct::SignedCertificateTimestamp;
 using ct::SignedTreeHead;
 using std::bind;
+using std::chrono::duration_cast;
+using std::chrono::microseconds;
 using std::chrono::milliseconds;
 using std::chrono::seconds;
+using std::chrono::steady_clock;
+using std::chrono::system_clock;
 using std::function;
 using std::lock_guard;
 using std::make_pair;
 using std::make_shared;
+using std::map;
 using std::multimap;
+using std::move;
 using std::mutex;
+using std::pair;
 using std::placeholders::_1;
 using std::shared_ptr;
 using std::string;
@@ -57,29 +90,232 @@ using std::to_string;
 using std::unique_ptr;
 using std::vector;
 
+DEFINE_double(add_chain_client_burst, 20,
+              "number of add-chain and add-pre-chain requests each client "
+              "address can make in a burst, when limited by "
+              "--add_chain_client_rate");
+DEFINE_double(add_chain_client_rate, 0,
+              "number of add-chain and add-pre-chain requests each client "
+              "address can make per second on average, beyond which they "
+              "are rejected with a 503; not limited if 0");
+DEFINE_string(add_chain_client_weights, "",
+              "comma-separated client addresses and the weights their "
+              "add-chain and add-pre-chain requests are scheduled with, as "
+              "address=weight; the others have a weight of 1");
+DEFINE_int32(add_chain_max_in_flight, 1024,
+             "maximum number of add-chain and add-pre-chain requests being "
+             "checked, signed or stored at once, beyond which they are "
+             "rejected with a 503");
+DEFINE_int32(add_chain_max_queued, 256,
+             "maximum number of add-chain and add-pre-chain requests waiting "
+             "for their chain to be checked, beyond which they are rejected "
+             "with a 503");
+DEFINE_int32(add_chain_threads, 4,
+             "number of threads checking the chains of add-chain and "
+             "add-pre-chain requests; they are checked on the HTTP thread "
+             "pool if 0");
+DEFINE_int32(consistency_response_cache_size, 16,
+             "number of get-sth-consistency responses to keep pre-rendered");
+DEFINE_int32(get_entries_tile_size, 0,
+             "if not 0, get-entries replies end at the end of the tile of "
+             "that many entries their first entry is in, so that the "
+             "crawlers fetching every entry ask for whole tiles, which "
+             "caches in front of the log can keep");
+DEFINE_int32(gzipped_entries_cache_size, 64,
+             "number of gzipped get-entries responses of whole blocks of "
+             "entries to keep");
+DEFINE_int32(interned_cert_cache_size, 1024,
+             "number of the certs found past the leaf of the submitted "
+             "chains (i.e. the intermediates) kept parsed in memory and "
+             "shared by the chains they are in; 0 to parse them anew "
+             "every time");
+DEFINE_int32(max_add_chain_request_bytes, 1 << 20,
+             "maximum size of the body of an add-chain or add-pre-chain "
+             "request, beyond which it is rejected with a 413");
+DEFINE_int32(max_add_chains_request_bytes, 16 << 20,
+             "maximum size of the body of an add-chains request, beyond "
+             "which it is rejected with a 413");
+DEFINE_int32(max_chains_per_add_chains_request, 256,
+             "maximum number of chains in a single add-chains request");
 DEFINE_int32(max_leaf_entries_per_response, 1000,
              "maximum number of entries to put in the response of a "
              "get-entries request");
+DEFINE_int32(max_search_results, 1000,
+             "maximum number of entry indices to put in the response of a "
+             "search-entries request");
+DEFINE_int32(max_proofs_per_response, 1000,
+             "maximum number of hashes to look up in a single "
+             "get-proofs-by-hash request");
+DEFINE_string(pool_handlers,
+              "add-chains,get-proof-by-hash,get-sth-consistency",
+              "comma-separated names of the handlers to run on the HTTP "
+              "thread pool instead of the event thread");
+DEFINE_string(read_pool_handlers, "get-entries,get-proofs-by-hash",
+              "comma-separated names of the handlers to run on the read "
+              "thread pool, whose queue is bounded");
+DEFINE_int32(read_pool_max_queued, 64,
+             "maximum number of requests waiting for the read thread pool, "
+             "beyond which they are rejected with a 503");
+DEFINE_int32(read_pool_threads, 4,
+             "number of threads in the read thread pool; the read pool "
+             "handlers run on the HTTP thread pool if 0");
+DEFINE_int32(pool_queue_timeout_ms, 0,
+             "how long a request can wait for a thread pool before it is "
+             "answered with a 503 instead, in milliseconds; no limit if 0");
 DEFINE_int32(staleness_check_delay_secs, 5,
              "number of seconds between node staleness checks");
+DEFINE_string(traffic_capture_file, "",
+              "file to which to append the metadata of a sample of the "
+              "requests (time, method, URI, body digest and handler "
+              "latency), to be reissued with replay_traffic; no capture if "
+              "empty");
+DEFINE_int32(traffic_capture_one_in, 100,
+             "capture one in this many requests, when "
+             "--traffic_capture_file is set");
 
 namespace {
 
 
+// How much of a get-entries reply to buffer before sending it.
+const size_t kGetEntriesChunkSize = 1 << 16;
+
+// The content type of get-entries replies in the binary format, which
+// other log nodes ask for in their Accept header. See
+// EntryCache::Entry::binary for the encoding of each entry; the last
+// one is followed by 3 zero bytes, so that an incomplete reply can be
+// told apart.
+const char kBinaryEntriesContentType[] = "application/x-ct-entries";
+
+// The content type of get-entries replies made of the records of the
+// entries, as a SegmentStorage keeps them, which other log nodes ask
+// for too when they can parse them. The last one is followed by a
+// record header of zeros, which is never valid.
+const char kEntryRecordsContentType[] = "application/x-ct-entry-records";
+
+
+static Counter<string>* http_server_rejected_requests(
+    Counter<string>::New("http_server_rejected_requests", "path",
+                         "Number of requests rejected because too many were "
+                         "already waiting for the read thread pool."));
+static Counter<string, string>* http_server_abandoned_requests(
+    Counter<string, string>::New("http_server_abandoned_requests", "path",
+                                 "reason",
+                                 "Number of requests not handled after "
+                                 "waiting for a thread pool, because their "
+                                 "client went away or they timed out."));
+static Counter<string>* http_server_stale_local_requests(
+    Counter<string>::New("http_server_stale_local_requests", "path",
+                         "Number of requests answered locally while this "
+                         "node was stale, as they did not need a newer "
+                         "tree."));
+static Counter<string>* http_server_coalesced_requests(
+    Counter<string>::New("http_server_coalesced_requests", "path",
+                         "Number of requests answered with the response "
+                         "rendered for an identical one in flight."));
+static Counter<string>* add_chain_rejected_requests(
+    Counter<string>::New("add_chain_rejected_requests", "stage",
+                         "Number of add-chain and add-pre-chain requests "
+                         "rejected because a stage of the submission "
+                         "pipeline was full."));
+static Gauge<string>* add_chain_pipeline_requests(
+    Gauge<string>::New("add_chain_pipeline_requests", "stage",
+                       "Number of add-chain and add-pre-chain requests in "
+                       "each stage of the submission pipeline."));
+static Latency<milliseconds, string> add_chain_pipeline_latency_ms(
+    "add_chain_pipeline_latency_ms", "stage",
+    "Latency of the stages of the add-chain submission pipeline in ms");
 static Latency<milliseconds, string> http_server_request_latency_ms(
     "total_http_server_request_latency_ms", "path",
     "Total request latency in ms broken down by path");
 
 
+// The certs of the submitted chains other than their leaf, which are
+// mostly the same few intermediates.
+InternedCertCache* InternedChainCerts() {
+  static InternedCertCache* const cache(
+      new InternedCertCache(std::max(0, FLAGS_interned_cert_cache_size)));
+  return cache;
+}
+
+
+// Parses |der|, the cert at |position| in a submitted chain, returning
+// NULL if it is invalid. The leaf certs seldom come up again, so only
+// the others are interned.
+shared_ptr<const Cert> ParseChainCert(const string& der, size_t position) {
+  if (position > 0) {
+    return InternedChainCerts()->Get(der);
+  }
+  const shared_ptr<Cert> cert(make_shared<Cert>());
+  cert->LoadFromDerString(der);
+  if (!cert->IsLoaded()) {
+    return nullptr;
+  }
+  return cert;
+}
+
+
 bool ExtractChain(JsonOutput* output, evhttp_request* req, CertChain* chain) {
   if (evhttp_request_get_command(req) != EVHTTP_REQ_POST) {
     output->SendError(req, HTTP_BADMETHOD, "Method not allowed.");
     return false;
   }
 
+  evbuffer* const body(evhttp_request_get_input_buffer(req));
+  if (evbuffer_get_length(body) >
+      static_cast<size_t>(FLAGS_max_add_chain_request_bytes)) {
+    output->SendError(req, HTTP_ENTITYTOOLARGE, "Request too large.");
+    return false;
+  }
+
+  // Most requests are parsed straight from the chunks of the buffer,
+  // without copying them or building a JSON object.
+  vector<shared_ptr<const Cert>> certs;
+  ChainParser parser([&certs](const string& der) {
+    shared_ptr<const Cert> cert(ParseChainCert(der, certs.size()));
+    if (!cert) {
+      return false;
+    }
+    certs.emplace_back(move(cert));
+    return true;
+  });
+  const int num_chunks(evbuffer_peek(body, -1, NULL, NULL, 0));
+  vector<evbuffer_iovec> chunks(num_chunks);
+  CHECK_EQ(num_chunks,
+           evbuffer_peek(body, -1, NULL, chunks.data(), chunks.size()));
+  ChainParser::Result result(ChainParser::OK);
+  for (const evbuffer_iovec& chunk : chunks) {
+    result = parser.Feed(static_cast<const char*>(chunk.iov_base),
+                         chunk.iov_len);
+    if (result != ChainParser::OK) {
+      break;
+    }
+  }
+  if (result == ChainParser::OK) {
+    result = parser.Finish();
+  }
+
+  switch (result) {
+    case ChainParser::OK:
+      for (const shared_ptr<const Cert>& cert : certs) {
+        chain->AddCert(cert);
+      }
+      return true;
+    case ChainParser::INVALID:
+      output->SendError(req, HTTP_BADREQUEST,
+                        "Unable to parse provided JSON.");
+      return false;
+    case ChainParser::INVALID_CERT:
+      output->SendError(req, HTTP_BADREQUEST,
+                        "Unable to parse provided chain.");
+      return false;
+    case ChainParser::UNHANDLED:
+      // Falls back to the JSON parser below.
+      break;
+  }
+
   // TODO(pphaneuf): Should we check that Content-Type says
   // "application/json", as recommended by RFC4627?
-  JsonObject json_body(evhttp_request_get_input_buffer(req));
+  JsonObject json_body(body);
   if (!json_body.Ok() || !json_body.IsType(json_type_object)) {
     output->SendError(req, HTTP_BADREQUEST, "Unable to parse provided JSON.");
     return false;
@@ -101,89 +337,162 @@ bool ExtractChain(JsonOutput* output, evhttp_request* req, CertChain* chain) {
       return false;
     }
 
-    unique_ptr<Cert> cert(new Cert);
-    cert->LoadFromDerString(json_cert.FromBase64());
-    if (!cert->IsLoaded()) {
+    const shared_ptr<const Cert> cert(
+        ParseChainCert(json_cert.FromBase64(), i));
+    if (!cert) {
       output->SendError(req, HTTP_BADREQUEST,
                         "Unable to parse provided chain.");
       return false;
     }
 
-    chain->AddCert(cert.release());
+    chain->AddCert(cert);
   }
 
   return true;
 }
 
 
+// Appends |data| base64-encoded, as a JSON string, to |out|.
+void AppendBase64String(const string& data, string* out) {
+  const size_t start(out->size());
+  const size_t length(util::Base64EncodedLength(data.size()));
+  out->resize(start + length + 2);
+  (*out)[start] = '"';
+  util::Base64Encode(data.data(), data.size(), &(*out)[start + 1]);
+  (*out)[start + length + 1] = '"';
+}
+
+
+// Returns whether a chain was added, possibly before, or the HTTP
+// status of the error otherwise.
+bool AddChainSucceeded(const util::Status& add_status, int* response_code) {
+  if (add_status.ok() ||
+      add_status.CanonicalCode() == util::error::ALREADY_EXISTS) {
+    return true;
+  }
+  VLOG(1) << "error adding chain: " << add_status;
+  *response_code =
+      add_status.CanonicalCode() == util::error::RESOURCE_EXHAUSTED
+          ? HTTP_SERVUNAVAIL
+          : HTTP_BADREQUEST;
+  return false;
+}
+
+
+// Appends the JSON object |sct| is sent as to |body|.
+void AppendSCTJson(const SignedCertificateTimestamp& sct, string* body) {
+  string signature;
+  CHECK_EQ(Serializer::SerializeDigitallySigned(sct.signature(), &signature),
+           Serializer::OK);
+
+  // Written out directly, rather than by building a JSON object, as
+  // this is sent for every submission.
+  body->reserve(body->size() + 128 +
+                util::Base64EncodedLength(sct.id().key_id().size()) +
+                util::Base64EncodedLength(signature.size()));
+  body->append("{\"sct_version\":0,\"id\":");
+  AppendBase64String(sct.id().key_id(), body);
+  body->append(",\"timestamp\":");
+  body->append(to_string(sct.timestamp()));
+  body->append(",\"extensions\":\"\",\"signature\":");
+  AppendBase64String(signature, body);
+  body->append("}");
+}
+
+
 void AddChainReply(JsonOutput* output, evhttp_request* req,
                    const util::Status& add_status,
                    const SignedCertificateTimestamp& sct) {
-  if (!add_status.ok() &&
-      add_status.CanonicalCode() != util::error::ALREADY_EXISTS) {
-    VLOG(1) << "error adding chain: " << add_status;
-    const int response_code(add_status.CanonicalCode() ==
-                                    util::error::RESOURCE_EXHAUSTED
-                                ? HTTP_SERVUNAVAIL
-                                : HTTP_BADREQUEST);
+  int response_code;
+  if (!AddChainSucceeded(add_status, &response_code)) {
     return output->SendError(req, response_code, add_status.error_message());
   }
 
-  JsonObject json_reply;
-  json_reply.Add("sct_version", static_cast<int64_t>(0));
-  json_reply.AddBase64("id", sct.id().key_id());
-  json_reply.Add("timestamp", sct.timestamp());
-  json_reply.Add("extensions", "");
-  json_reply.Add("signature", sct.signature());
+  string body;
+  AppendSCTJson(sct, &body);
+  output->SendJsonReply(req, HTTP_OK, body);
+}
+
+
+// Loads the base64-encoded certificates of |json_chain| into |chain|.
+bool LoadChain(const JsonArray& json_chain, CertChain* chain) {
+  for (int i = 0; i < json_chain.Length(); ++i) {
+    JsonString json_cert(json_chain, i);
+    if (!json_cert.Ok()) {
+      return false;
+    }
+    const shared_ptr<const Cert> cert(
+        ParseChainCert(json_cert.FromBase64(), i));
+    if (!cert) {
+      return false;
+    }
+    chain->AddCert(cert);
+  }
+  return true;
+}
+
 
-  output->SendJsonReply(req, HTTP_OK, json_reply);
+// Adds the headers of a get-entries reply for entries of the serving
+// tree, which caches can keep forever.
+void AddImmutableHeaders(evhttp_request* req, const string& etag) {
+  evkeyvalq* const headers(evhttp_request_get_output_headers(req));
+  CHECK_EQ(evhttp_add_header(headers, "Cache-Control",
+                             "public, max-age=31536000, immutable"),
+           0);
+  CHECK_EQ(evhttp_add_header(headers, "ETag", etag.c_str()), 0);
+  CHECK_EQ(evhttp_add_header(headers, "Vary", "Accept, Accept-Encoding"), 0);
 }
 
 
-multimap<string, string> ParseQuery(evhttp_request* req) {
+// The parameters of a query, in order. There are only a few, which
+// are cheaper to scan than to put in a map.
+typedef vector<pair<string, string>> Query;
+
+
+Query ParseQuery(evhttp_request* req) {
   evkeyvalq keyval;
-  multimap<string, string> retval;
+  Query retval;
 
   // We return an empty result in case of a parsing error.
   if (evhttp_parse_query_str(evhttp_uri_get_query(
                                  evhttp_request_get_evhttp_uri(req)),
                              &keyval) == 0) {
     for (evkeyval* i = keyval.tqh_first; i; i = i->next.tqe_next) {
-      retval.insert(make_pair(i->key, i->value));
+      retval.emplace_back(i->key, i->value);
     }
+    evhttp_clear_headers(&keyval);
   }
 
   return retval;
 }
 
 
-bool GetParam(const multimap<string, string>& query, const string& param,
-              string* value) {
+bool GetParam(const Query& query, const string& param, string* value) {
   CHECK_NOTNULL(value);
 
-  multimap<string, string>::const_iterator it = query.find(param);
-  if (it == query.end()) {
-    return false;
+  const string* found(nullptr);
+  for (const auto& it : query) {
+    if (it.first == param) {
+      // Flag duplicate query parameters as invalid.
+      if (found) {
+        return false;
+      }
+      found = &it.second;
+    }
   }
 
-  const string possible_value(it->second);
-  ++it;
-
-  // Flag duplicate query parameters as invalid.
-  const bool retval(it == query.end() || it->first != param);
-  if (retval) {
-    *value = possible_value;
+  if (!found) {
+    return false;
   }
-
-  return retval;
+  *value = *found;
+  return true;
 }
 
 
 // Returns -1 on error, and on success too if the parameter contains
 // -1 (so it's advised to only use it when expecting unsigned
 // parameters).
-int64_t GetIntParam(const multimap<string, string>& query,
-                    const string& param) {
+int64_t GetIntParam(const Query& query, const string& param) {
   int retval(-1);
   string value;
   if (GetParam(query, param, &value)) {
@@ -205,7 +514,7 @@ int64_t GetIntParam(const multimap<string, string>& query,
 }
 
 
-bool GetBoolParam(const multimap<string, string>& query, const string& param) {
+bool GetBoolParam(const Query& query, const string& param) {
   string value;
   if (GetParam(query, param, &value)) {
     return (value == "true");
@@ -215,18 +524,163 @@ bool GetBoolParam(const multimap<string, string>& query, const string& param) {
 }
 
 
+// Returns whether |name| is in the comma-separated |list|.
+bool InList(const string& list, const string& name) {
+  return ("," + list + ",").find("," + name + ",") != string::npos;
+}
+
+
+// Parses the value of --add_chain_client_weights.
+map<string, int> ParseClientWeights(const string& list) {
+  map<string, int> weights;
+  size_t start(0);
+  while (start < list.size()) {
+    size_t end(list.find(',', start));
+    if (end == string::npos) {
+      end = list.size();
+    }
+    const string item(list.substr(start, end - start));
+    const size_t equals(item.rfind('='));
+    char* weight_end;
+    const long weight(equals == string::npos
+                          ? 0
+                          : strtol(item.c_str() + equals + 1, &weight_end,
+                                   10));
+    CHECK(weight > 0 && *weight_end == '\0')
+        << "invalid --add_chain_client_weights entry: " << item;
+    weights[item.substr(0, equals)] = weight;
+    start = end + 1;
+  }
+  return weights;
+}
+
+
+string ClientAddress(evhttp_request* req) {
+  char* address;
+  ev_uint16_t port;
+  evhttp_connection_get_peer(evhttp_request_get_connection(req), &address,
+                             &port);
+  // The requests received over HTTP/2 are forwarded from this host,
+  // with the address of their client.
+  if (strcmp(address, "127.0.0.1") == 0 || strcmp(address, "::1") == 0) {
+    const char* const forwarded_for(evhttp_find_header(
+        evhttp_request_get_input_headers(req), "X-Forwarded-For"));
+    if (forwarded_for) {
+      return forwarded_for;
+    }
+  }
+  return address;
+}
+
+
+// A request waiting for a thread pool, whose client is watched in the
+// meantime, so that it is not handled for nothing after the client
+// gave up.
+struct QueuedRequest {
+  explicit QueuedRequest(evhttp_request* r)
+      : req(r),
+        base(libevent::Base::ForRequest(r)),
+        queued(steady_clock::now()),
+        client_gone(false) {
+  }
+
+  evhttp_request* const req;
+  libevent::Base* const base;
+  const steady_clock::time_point queued;
+  std::atomic<bool> client_gone;
+};
+
+
+void QueuedClientClosed(evhttp_connection*, void* userdata) {
+  static_cast<QueuedRequest*>(userdata)->client_gone = true;
+}
+
+
+// Must be called on the event loop of |req|.
+QueuedRequest* QueueRequest(evhttp_request* req) {
+  QueuedRequest* const queued(new QueuedRequest(req));
+  evhttp_connection_set_closecb(evhttp_request_get_connection(req),
+                                &QueuedClientClosed, queued);
+  return queued;
+}
+
+
+// Called once |queued| is taken off the queue of a thread pool, and
+// deletes it. Returns whether its request should still be handled,
+// otherwise it was answered or freed.
+bool DequeueRequest(JsonOutput* output, const string& path,
+                    QueuedRequest* queued) {
+  evhttp_request* const req(queued->req);
+  const bool client_gone(queued->client_gone);
+  // This runs before any closure of the handler sending the reply.
+  queued->base->Add([queued, client_gone]() {
+    const unique_ptr<QueuedRequest> queued_deleter(queued);
+    evhttp_connection* const conn(
+        evhttp_request_get_connection(queued->req));
+    if (conn) {
+      evhttp_connection_set_closecb(conn, NULL, NULL);
+    }
+    if (client_gone) {
+      // The request was left to be freed by this.
+      evhttp_send_reply_end(queued->req);
+    }
+  });
+
+  if (client_gone) {
+    http_server_abandoned_requests->Increment(path, "client_gone");
+    return false;
+  }
+  if (FLAGS_pool_queue_timeout_ms > 0 &&
+      steady_clock::now() - queued->queued >=
+          milliseconds(FLAGS_pool_queue_timeout_ms)) {
+    http_server_abandoned_requests->Increment(path, "timeout");
+    output->SendError(req, HTTP_SERVUNAVAIL, "Request timed out.");
+    return false;
+  }
+  return true;
+}
+
+
 }  // namespace
 
 
+struct HttpHandler::BulkAddChain {
+  BulkAddChain(evhttp_request* req, size_t size,
+               const util::TraceContext& trace)
+      : req(req),
+        trace(trace),
+        queued(steady_clock::now()),
+        chains(size),
+        precert(size, false),
+        scts(size),
+        statuses(size),
+        remaining(0) {
+  }
+
+  evhttp_request* const req;
+  const util::TraceContext trace;
+  const steady_clock::time_point queued;
+  // NULL for those which could not be parsed, whose status is set
+  // already. The others are PreCertChains if |precert| is set.
+  vector<unique_ptr<CertChain>> chains;
+  vector<bool> precert;
+  vector<SignedCertificateTimestamp> scts;
+  vector<util::Status> statuses;
+  // The number of chains queued but not done yet.
+  std::atomic<int> remaining;
+};
+
+
 HttpHandler::HttpHandler(
     JsonOutput* output, LogLookup<LoggedCertificate>* log_lookup,
-    const ReadOnlyDatabase<LoggedCertificate>* db,
+    EntryCache* entry_cache,
     const ClusterStateController<LoggedCertificate>* controller,
     const CertChecker* cert_checker, Frontend* frontend, Proxy* proxy,
     ThreadPool* pool, libevent::Base* event_base)
     : output_(CHECK_NOTNULL(output)),
       log_lookup_(CHECK_NOTNULL(log_lookup)),
-      db_(CHECK_NOTNULL(db)),
+      entry_cache_(CHECK_NOTNULL(entry_cache)),
+      entry_segments_(nullptr),
       controller_(CHECK_NOTNULL(controller)),
       cert_checker_(cert_checker),
       frontend_(frontend),
@@ -234,7 +688,35 @@ HttpHandler::HttpHandler(
       pool_(CHECK_NOTNULL(pool)),
       event_base_(CHECK_NOTNULL(event_base)),
       task_(pool_),
-      node_is_stale_(controller_->NodeIsStale()) {
+      node_is_stale_(controller_->NodeIsStale()),
+      ready_(true),
+      read_only_replica_(false),
+      consistency_responses_bytes_(0),
+      gzipped_entries_bytes_(0),
+      consistency_responses_memory_("consistency_response_cache"),
+      gzipped_entries_memory_("gzipped_entries_cache"),
+      read_pool_queued_(0),
+      add_chain_in_flight_(0),
+      add_chain_queued_(0),
+      add_chain_queue_(
+          new FairQueue(ParseClientWeights(FLAGS_add_chain_client_weights))) {
+  CHECK_GE(FLAGS_read_pool_threads, 0);
+  if (FLAGS_read_pool_threads > 0) {
+    read_pool_.reset(new ThreadPool(FLAGS_read_pool_threads));
+  }
+  CHECK_GE(FLAGS_add_chain_threads, 0);
+  if (frontend_ && FLAGS_add_chain_threads > 0) {
+    add_chain_pool_.reset(new ThreadPool(FLAGS_add_chain_threads));
+  }
+  CHECK_GE(FLAGS_add_chain_client_rate, 0);
+  if (FLAGS_add_chain_client_rate > 0) {
+    add_chain_limiter_.reset(new RateLimiter(FLAGS_add_chain_client_rate,
+                                             FLAGS_add_chain_client_burst));
+  }
+  if (!FLAGS_traffic_capture_file.empty()) {
+    traffic_capture_.reset(new TrafficCapture(FLAGS_traffic_capture_file,
+                                              FLAGS_traffic_capture_one_in));
+  }
   event_base_->Delay(seconds(FLAGS_staleness_check_delay_secs),
                      task_.task()->AddChild(
                          bind(&HttpHandler::UpdateNodeStaleness, this)));
@@ -247,24 +729,81 @@ HttpHandler::~HttpHandler() {
 }
 
 
-void StatsHandlerInterceptor(const string& path,
-                             const libevent::HttpServer::HandlerCallback& cb,
-                             evhttp_request* req) {
-  ScopedLatency total_http_server_request_latency(
-      http_server_request_latency_ms.GetScopedLatency(path));
+// Fills in the metadata of |req|, except its latency. The body is
+// hashed where it lies, without draining it.
+void DescribeRequest(evhttp_request* req, CapturedRequest* captured) {
+  captured->time_us = duration_cast<microseconds>(
+                          system_clock::now().time_since_epoch())
+                          .count();
+  switch (evhttp_request_get_command(req)) {
+    case EVHTTP_REQ_GET:
+      captured->method = "GET";
+      break;
+    case EVHTTP_REQ_POST:
+      captured->method = "POST";
+      break;
+    default:
+      captured->method = "OTHER";
+  }
+  captured->uri = evhttp_request_get_uri(req);
+
+  evbuffer* const body(evhttp_request_get_input_buffer(req));
+  captured->body_size = evbuffer_get_length(body);
+  if (captured->body_size == 0) {
+    return;
+  }
+  const int num_chunks(evbuffer_peek(body, -1, NULL, NULL, 0));
+  vector<evbuffer_iovec> chunks(num_chunks);
+  CHECK_EQ(num_chunks,
+           evbuffer_peek(body, -1, NULL, chunks.data(), chunks.size()));
+  Sha256Hasher hasher;
+  hasher.Reset();
+  for (const evbuffer_iovec& chunk : chunks) {
+    hasher.Update(static_cast<const char*>(chunk.iov_base), chunk.iov_len);
+  }
+  captured->body_sha256 = hasher.Final();
+}
+
+
+// |latency| is looked up once, when the handler is added, rather
+// than for every request. |capture| is NULL if the requests are not
+// captured.
+void StatsHandlerInterceptor(
+    const Latency<milliseconds, string>::Cell& latency,
+    TrafficCapture* capture, const libevent::HttpServer::HandlerCallback& cb,
+    evhttp_request* req) {
+  // |req| may be gone once the handler returns.
+  CapturedRequest captured;
+  const bool sampled(capture && capture->Sample());
+  if (sampled) {
+    DescribeRequest(req, &captured);
+  }
 
+  const steady_clock::time_point start(steady_clock::now());
   cb(req);
+  const steady_clock::duration elapsed(steady_clock::now() - start);
+  latency.RecordLatency(elapsed);
+  if (sampled) {
+    captured.latency_us = duration_cast<microseconds>(elapsed).count();
+    capture->Record(captured);
+  }
 }
 
 
 void HttpHandler::ProxyInterceptor(
+    const string& path, const ServableWhenStale& servable_when_stale,
     const libevent::HttpServer::HandlerCallback& local_handler,
     evhttp_request* request) {
   VLOG(2) << "Running proxy interceptor...";
-  // TODO(alcutter): We can be a bit smarter about when to proxy off
-  // the request - being stale wrt to the current serving STH doesn't
-  // automatically mean we're unable to answer this request.
-  if (IsNodeStale()) {
+  // Being stale wrt to the current serving STH doesn't automatically
+  // mean we're unable to answer this request.
+  bool proxy(IsNodeStale());
+  if (proxy && servable_when_stale && servable_when_stale(request)) {
+    http_server_stale_local_requests->Increment(path);
+    proxy = false;
+  }
+
+  if (proxy) {
     // Can't do this on the libevent thread since it can block on the lock in
     // ClusterStatusController::GetFreshNodes().
     pool_->Add(bind(&Proxy::ProxyRequest, proxy_, request));
@@ -274,45 +813,146 @@ void HttpHandler::ProxyInterceptor(
 }
 
 
+void HttpHandler::RunHandler(
+    RunOn run_on, const string& path,
+    const libevent::HttpServer::HandlerCallback& handler,
+    evhttp_request* request) {
+  switch (run_on) {
+    case EVENT_THREAD:
+      return handler(request);
+
+    case HTTP_POOL: {
+      QueuedRequest* const queued(QueueRequest(request));
+      return pool_->Add([this, path, handler, request, queued]() {
+        if (DequeueRequest(output_, path, queued)) {
+          handler(request);
+        }
+      });
+    }
+
+    case READ_POOL: {
+      // Rather than letting the queue grow without bounds when the
+      // pool cannot keep up, tell clients to come back later.
+      if (read_pool_queued_.fetch_add(1) >= FLAGS_read_pool_max_queued) {
+        --read_pool_queued_;
+        http_server_rejected_requests->Increment(path);
+        return output_->SendError(request, HTTP_SERVUNAVAIL,
+                                  "Too many requests.");
+      }
+      QueuedRequest* const queued(QueueRequest(request));
+      return read_pool_->Add([this, path, handler, request, queued]() {
+        --read_pool_queued_;
+        if (DequeueRequest(output_, path, queued)) {
+          handler(request);
+        }
+      });
+    }
+  }
+  LOG(FATAL) << "unknown RunOn: " << run_on;
+}
+
+
 void HttpHandler::AddProxyWrappedHandler(
     libevent::HttpServer* server, const string& path,
-    const libevent::HttpServer::HandlerCallback& local_handler) {
+    const libevent::HttpServer::HandlerCallback& local_handler,
+    const ServableWhenStale& servable_when_stale) {
+  const string name(path.substr(path.rfind('/') + 1));
+  RunOn run_on(EVENT_THREAD);
+  if (InList(FLAGS_read_pool_handlers, name)) {
+    run_on = read_pool_ ? READ_POOL : HTTP_POOL;
+  } else if (InList(FLAGS_pool_handlers, name)) {
+    run_on = HTTP_POOL;
+  }
+
+  JsonOutput::RegisterPath(path);
   const libevent::HttpServer::HandlerCallback stats_handler(
-      bind(&StatsHandlerInterceptor, path, local_handler, _1));
+      bind(&StatsHandlerInterceptor,
+           http_server_request_latency_ms.GetCell(path),
+           traffic_capture_.get(), local_handler, _1));
+  const libevent::HttpServer::HandlerCallback run_handler(
+      bind(&HttpHandler::RunHandler, this, run_on, path, stats_handler, _1));
   CHECK(server->AddHandler(path, bind(&HttpHandler::ProxyInterceptor, this,
-                                      stats_handler, _1)));
+                                      path, servable_when_stale, run_handler,
+                                      _1)));
+}
+
+
+// The requests with invalid parameters are answered locally, with an
+// error, in the following.
+bool HttpHandler::EntriesServableWhenStale(evhttp_request* req) const {
+  const Query query(ParseQuery(req));
+  const int64_t start(GetIntParam(query, "start"));
+  const int64_t end(GetIntParam(query, "end"));
+  if (start < 0 || end < start) {
+    return true;
+  }
+  return std::min(end, start + FLAGS_max_leaf_entries_per_response) <
+         log_lookup_->GetSTH().tree_size();
+}
+
+
+bool HttpHandler::ProofServableWhenStale(evhttp_request* req) const {
+  const int64_t tree_size(GetIntParam(ParseQuery(req), "tree_size"));
+  return tree_size <= log_lookup_->GetSTH().tree_size();
+}
+
+
+bool HttpHandler::ConsistencyServableWhenStale(evhttp_request* req) const {
+  const int64_t second(GetIntParam(ParseQuery(req), "second"));
+  return second <= log_lookup_->GetSTH().tree_size();
 }
 
 
-void HttpHandler::Add(libevent::HttpServer* server) {
+void HttpHandler::Add(libevent::HttpServer* server, const string& prefix) {
   CHECK_NOTNULL(server);
-  // TODO(pphaneuf): An optional prefix might be nice?
-  // TODO(pphaneuf): Find out which methods are CPU intensive enough
-  // that they should be spun off to the thread pool.
-  AddProxyWrappedHandler(server, "/ct/v1/get-entries",
-                         bind(&HttpHandler::GetEntries, this, _1));
+  CHECK(prefix.empty() || (prefix.front() == '/' && prefix.back() != '/'))
+      << prefix;
+  // Which thread pool, if any, each handler runs on is set with
+  // --pool_handlers and --read_pool_handlers.
+  AddProxyWrappedHandler(server, prefix + "/ct/v1/get-entries",
+                         bind(&HttpHandler::GetEntries, this, _1),
+                         bind(&HttpHandler::EntriesServableWhenStale, this,
+                              _1));
   // TODO(alcutter): Support this for mirrors too
   if (cert_checker_) {
-    // Don't really need to proxy this one, but may as well just to keep
-    // everything tidy:
-    AddProxyWrappedHandler(server, "/ct/v1/get-roots",
-                           bind(&HttpHandler::GetRoots, this, _1));
-  }
-  AddProxyWrappedHandler(server, "/ct/v1/get-proof-by-hash",
-                         bind(&HttpHandler::GetProof, this, _1));
-  AddProxyWrappedHandler(server, "/ct/v1/get-sth",
-                         bind(&HttpHandler::GetSTH, this, _1));
-  AddProxyWrappedHandler(server, "/ct/v1/get-sth-consistency",
-                         bind(&HttpHandler::GetConsistency, this, _1));
+    // The roots do not depend on the tree, so this one is never
+    // proxied.
+    AddProxyWrappedHandler(server, prefix + "/ct/v1/get-roots",
+                           bind(&HttpHandler::GetRoots, this, _1),
+                           [](evhttp_request*) { return true; });
+  }
+  AddProxyWrappedHandler(server, prefix + "/ct/v1/get-proof-by-hash",
+                         bind(&HttpHandler::GetProof, this, _1),
+                         bind(&HttpHandler::ProofServableWhenStale, this,
+                              _1));
+  // Non-standard batch version of get-proof-by-hash, for verifiers
+  // checking many SCTs against the same tree. Its tree size is in the
+  // body, which can only be read once, so it is always proxied.
+  AddProxyWrappedHandler(server, prefix + "/ct/v1/get-proofs-by-hash",
+                         bind(&HttpHandler::GetProofs, this, _1), nullptr);
+  AddProxyWrappedHandler(server, prefix + "/ct/v1/get-sth",
+                         bind(&HttpHandler::GetSTH, this, _1), nullptr);
+  AddProxyWrappedHandler(server, prefix + "/ct/v1/get-sth-consistency",
+                         bind(&HttpHandler::GetConsistency, this, _1),
+                         bind(&HttpHandler::ConsistencyServableWhenStale,
+                              this, _1));
+  // Non-standard search of the entries, whose results are only
+  // complete on a node which is not stale, so it is always proxied.
+  AddProxyWrappedHandler(server, prefix + "/ct/v1/search-entries",
+                         bind(&HttpHandler::SearchEntries, this, _1),
+                         nullptr);
 
   if (frontend_) {
     // Proxy the add-* calls too, technically we could serve them, but a
     // more up-to-date node will have a better chance of handling dupes
     // correctly, rather than bloating the tree.
-    AddProxyWrappedHandler(server, "/ct/v1/add-chain",
-                           bind(&HttpHandler::AddChain, this, _1));
-    AddProxyWrappedHandler(server, "/ct/v1/add-pre-chain",
-                           bind(&HttpHandler::AddPreChain, this, _1));
+    AddProxyWrappedHandler(server, prefix + "/ct/v1/add-chain",
+                           bind(&HttpHandler::AddChain, this, _1), nullptr);
+    AddProxyWrappedHandler(server, prefix + "/ct/v1/add-pre-chain",
+                           bind(&HttpHandler::AddPreChain, this, _1),
+                           nullptr);
+    AddProxyWrappedHandler(server, prefix + "/ct/v1/add-chains",
+                           bind(&HttpHandler::AddChains, this, _1), nullptr);
   }
 }
 
@@ -323,7 +963,7 @@ void HttpHandler::GetEntries(evhttp_request* req) const {
   }
 
 
-  const multimap<string, string> query(ParseQuery(req));
+  const Query query(ParseQuery(req));
 
   const int64_t start(GetIntParam(query, "start"));
   if (start < 0) {
@@ -339,13 +979,32 @@ void HttpHandler::GetEntries(evhttp_request* req) const {
 
   // Limit the number of entries returned in a single request.
   end = std::min(end, start + FLAGS_max_leaf_entries_per_response);
+  if (FLAGS_get_entries_tile_size > 0) {
+    end = std::min(end, start - start % FLAGS_get_entries_tile_size +
+                            FLAGS_get_entries_tile_size - 1);
+  }
 
   // Sekrit parameter to indicate that SCTs should be included too.
   // This is non-standard, and is only used internally by other log nodes when
   // "following" nodes with more data.
   const bool include_scts(GetBoolParam(query, "include_scts"));
 
-  BlockingGetEntries(req, start, end, include_scts);
+  // The binary format always includes the SCTs, and is only for the
+  // same nodes.
+  const char* const accept(
+      evhttp_find_header(evhttp_request_get_input_headers(req), "Accept"));
+  const bool binary(include_scts && accept &&
+                    strstr(accept, kBinaryEntriesContentType) != nullptr);
+  // Nor are the records, which are only kept by some databases.
+  const bool records(include_scts && accept && entry_segments_ &&
+                     strstr(accept, kEntryRecordsContentType) != nullptr);
+
+  // Entries in the serving tree never change, so neither does the
+  // reply for them.
+  const bool immutable(end < log_lookup_->GetSTH().tree_size());
+
+  BlockingGetEntries(req, start, end, include_scts, binary, records,
+                     immutable);
 }
 
 
@@ -354,22 +1013,27 @@ void HttpHandler::GetRoots(evhttp_request* req) const {
     return output_->SendError(req, HTTP_BADMETHOD, "Method not allowed.");
   }
 
-  JsonArray roots;
-  multimap<string, const Cert*>::const_iterator it;
-  for (it = cert_checker_->GetTrustedCertificates().begin();
-       it != cert_checker_->GetTrustedCertificates().end(); ++it) {
-    string cert;
-    if (it->second->DerEncoding(&cert) != Cert::TRUE) {
-      LOG(ERROR) << "Cert encoding failed";
-      return output_->SendError(req, HTTP_INTERNAL, "Serialisation failed.");
-    }
-    roots.AddBase64(cert);
+  const shared_ptr<const RootsResponse> response(CurrentRootsResponse());
+  if (!response) {
+    return output_->SendError(req, HTTP_INTERNAL, "Serialisation failed.");
   }
 
-  JsonObject json_reply;
-  json_reply.Add("certificates", roots);
+  evkeyvalq* const headers(evhttp_request_get_output_headers(req));
+  CHECK_EQ(evhttp_add_header(headers, "ETag", response->etag.c_str()), 0);
+  CHECK_EQ(evhttp_add_header(headers, "Vary", "Accept-Encoding"), 0);
 
-  output_->SendJsonReply(req, HTTP_OK, json_reply);
+  const char* const if_none_match(evhttp_find_header(
+      evhttp_request_get_input_headers(req), "If-None-Match"));
+  if (if_none_match && response->etag == if_none_match) {
+    static const shared_ptr<const string> empty_body(make_shared<string>());
+    return output_->SendJsonReply(req, HTTP_NOTMODIFIED, empty_body);
+  }
+
+  if (JsonOutput::AcceptsGzip(req)) {
+    return output_->SendGzippedJsonReply(req, HTTP_OK, response->gzip_body);
+  }
+
+  output_->SendJsonReply(req, HTTP_OK, response->body);
 }
 
 
@@ -378,7 +1042,7 @@ void HttpHandler::GetProof(evhttp_request* req) const {
     return output_->SendError(req, HTTP_BADMETHOD, "Method not allowed.");
   }
 
-  const multimap<string, string> query(ParseQuery(req));
+  const Query query(ParseQuery(req));
 
   string b64_hash;
   if (!GetParam(query, "hash", &b64_hash)) {
@@ -418,33 +1082,110 @@ void HttpHandler::GetProof(evhttp_request* req) const {
 }
 
 
-void HttpHandler::GetSTH(evhttp_request* req) const {
-  if (evhttp_request_get_command(req) != EVHTTP_REQ_GET) {
+// Takes a JSON object with the "tree_size" to get the proofs for,
+// and the base64-encoded leaf "hashes" to get them for, and replies
+// with the "proofs" of those that are in the tree (others are left
+// out), in the same order, each with its "hash", "leaf_index" and
+// "audit_path".
+void HttpHandler::GetProofs(evhttp_request* req) const {
+  if (evhttp_request_get_command(req) != EVHTTP_REQ_POST) {
     return output_->SendError(req, HTTP_BADMETHOD, "Method not allowed.");
   }
 
-  const SignedTreeHead& sth(log_lookup_->GetSTH());
+  JsonObject json_body(evhttp_request_get_input_buffer(req));
+  if (!json_body.Ok() || !json_body.IsType(json_type_object)) {
+    return output_->SendError(req, HTTP_BADREQUEST,
+                              "Unable to parse provided JSON.");
+  }
 
-  VLOG(2) << "SignedTreeHead:\n" << sth.DebugString();
+  JsonInt json_tree_size(json_body, "tree_size");
+  if (!json_tree_size.Ok() || json_tree_size.Value() < 0 ||
+      json_tree_size.Value() > log_lookup_->GetSTH().tree_size()) {
+    return output_->SendError(req, HTTP_BADREQUEST,
+                              "Missing or invalid \"tree_size\" parameter.");
+  }
+  const int64_t tree_size(json_tree_size.Value());
 
-  JsonObject json_reply;
-  json_reply.Add("tree_size", sth.tree_size());
-  json_reply.Add("timestamp", sth.timestamp());
-  json_reply.AddBase64("sha256_root_hash", sth.sha256_root_hash());
-  json_reply.Add("tree_head_signature", sth.signature());
+  JsonArray json_hashes(json_body, "hashes");
+  if (!json_hashes.Ok() ||
+      json_hashes.Length() > FLAGS_max_proofs_per_response) {
+    return output_->SendError(req, HTTP_BADREQUEST,
+                              "Missing or invalid \"hashes\" parameter.");
+  }
 
-  VLOG(2) << "GetSTH:\n" << json_reply.DebugString();
+  vector<string> hashes;
+  vector<int64_t> leaf_indices;
+  for (int i = 0; i < json_hashes.Length(); ++i) {
+    JsonString json_hash(json_hashes, i);
+    const string hash(json_hash.Ok() ? json_hash.FromBase64() : string());
+    if (hash.empty()) {
+      return output_->SendError(req, HTTP_BADREQUEST,
+                                "Invalid \"hashes\" parameter.");
+    }
+
+    int64_t leaf_index;
+    if (log_lookup_->GetIndex(hash, &leaf_index) ==
+            LogLookup<LoggedCertificate>::OK &&
+        leaf_index < tree_size) {
+      hashes.push_back(hash);
+      leaf_indices.push_back(leaf_index);
+    }
+  }
+
+  vector<ShortMerkleAuditProof> proofs;
+  if (log_lookup_->AuditProofs(leaf_indices, tree_size, &proofs) !=
+      LogLookup<LoggedCertificate>::OK) {
+    return output_->SendError(req, HTTP_INTERNAL, "Couldn't get proofs.");
+  }
+
+  JsonArray json_proofs;
+  for (size_t i = 0; i < proofs.size(); ++i) {
+    JsonArray json_audit;
+    for (int j = 0; j < proofs[i].path_node_size(); ++j) {
+      json_audit.AddBase64(proofs[i].path_node(j));
+    }
+
+    JsonObject json_proof;
+    json_proof.AddBase64("hash", hashes[i]);
+    json_proof.Add("leaf_index", proofs[i].leaf_index());
+    json_proof.Add("audit_path", json_audit);
+    json_proofs.Add(&json_proof);
+  }
+
+  JsonObject json_reply;
+  json_reply.Add("proofs", json_proofs);
 
   output_->SendJsonReply(req, HTTP_OK, json_reply);
 }
 
 
+void HttpHandler::GetSTH(evhttp_request* req) const {
+  if (evhttp_request_get_command(req) != EVHTTP_REQ_GET) {
+    return output_->SendError(req, HTTP_BADMETHOD, "Method not allowed.");
+  }
+
+  const shared_ptr<const STHResponse> response(CurrentSTHResponse());
+  CHECK_EQ(evhttp_add_header(evhttp_request_get_output_headers(req), "ETag",
+                             response->etag.c_str()),
+           0);
+
+  const char* const if_none_match(evhttp_find_header(
+      evhttp_request_get_input_headers(req), "If-None-Match"));
+  if (if_none_match && response->etag == if_none_match) {
+    static const shared_ptr<const string> empty_body(make_shared<string>());
+    return output_->SendJsonReply(req, HTTP_NOTMODIFIED, empty_body);
+  }
+
+  output_->SendJsonReply(req, HTTP_OK, response->body);
+}
+
+
 void HttpHandler::GetConsistency(evhttp_request* req) const {
   if (evhttp_request_get_command(req) != EVHTTP_REQ_GET) {
     return output_->SendError(req, HTTP_BADMETHOD, "Method not allowed.");
   }
 
-  const multimap<string, string> query(ParseQuery(req));
+  const Query query(ParseQuery(req));
 
   const int64_t first(GetIntParam(query, "first"));
   if (first < 0) {
@@ -458,113 +1199,740 @@ void HttpHandler::GetConsistency(evhttp_request* req) const {
                               "Missing or invalid \"second\" parameter.");
   }
 
-  const vector<string> consistency(
-      log_lookup_->ConsistencyProof(first, second));
-  JsonArray json_cons;
-  for (vector<string>::const_iterator it = consistency.begin();
-       it != consistency.end(); ++it) {
-    json_cons.AddBase64(*it);
+  output_->SendJsonReply(req, HTTP_OK, ConsistencyResponse(first, second));
+}
+
+
+// Takes either a "domain", to find the entries with a certificate for
+// it or for any of its subdomains, or the base64-encoded SHA-256
+// digest of the subjectPublicKeyInfo of an issuer, as
+// "issuer_key_hash", and optionally the "start" index to search from.
+// Replies with the "indices" of the entries found, in order; if there
+// are more than --max_search_results of them, the search can go on
+// from after the last one.
+void HttpHandler::SearchEntries(evhttp_request* req) const {
+  if (evhttp_request_get_command(req) != EVHTTP_REQ_GET) {
+    return output_->SendError(req, HTTP_BADMETHOD, "Method not allowed.");
+  }
+
+  const Query query(ParseQuery(req));
+
+  string search_key;
+  string value;
+  if (GetParam(query, "domain", &value)) {
+    search_key = DomainSearchKey(value);
+    if (search_key.empty()) {
+      return output_->SendError(req, HTTP_BADREQUEST,
+                                "Invalid \"domain\" parameter.");
+    }
+  }
+  if (GetParam(query, "issuer_key_hash", &value)) {
+    const string issuer_key_hash(util::FromBase64(value.c_str()));
+    if (!search_key.empty() || issuer_key_hash.empty()) {
+      return output_->SendError(req, HTTP_BADREQUEST,
+                                "Invalid \"issuer_key_hash\" parameter.");
+    }
+    search_key = IssuerSearchKey(issuer_key_hash);
+  }
+  if (search_key.empty()) {
+    return output_->SendError(req, HTTP_BADREQUEST,
+                              "Missing \"domain\" or \"issuer_key_hash\" "
+                              "parameter.");
+  }
+
+  int64_t start(0);
+  if (GetParam(query, "start", &value)) {
+    start = GetIntParam(query, "start");
+    if (start < 0) {
+      return output_->SendError(req, HTTP_BADREQUEST,
+                                "Invalid \"start\" parameter.");
+    }
+  }
+
+  vector<int64_t> indices;
+  if (log_lookup_->SearchEntries(search_key, start, FLAGS_max_search_results,
+                                 &indices) !=
+      LogLookup<LoggedCertificate>::OK) {
+    return output_->SendError(req, HTTP_NOTIMPLEMENTED,
+                              "Entries are not indexed for search.");
+  }
+
+  JsonArray json_indices;
+  for (const int64_t index : indices) {
+    json_indices.Add(json_object_new_int64(index));
   }
 
   JsonObject json_reply;
-  json_reply.Add("consistency", json_cons);
+  json_reply.Add("indices", json_indices);
 
   output_->SendJsonReply(req, HTTP_OK, json_reply);
 }
 
 
+shared_ptr<const HttpHandler::STHResponse> HttpHandler::CurrentSTHResponse()
+    const {
+  const uint64_t timestamp(log_lookup_->GetSTHTimestamp());
+  {
+    lock_guard<mutex> lock(response_cache_mutex_);
+    if (sth_response_ && sth_response_->timestamp == timestamp) {
+      return sth_response_;
+    }
+  }
+
+  const SignedTreeHead sth(log_lookup_->GetSTH());
+
+  VLOG(2) << "SignedTreeHead:\n" << sth.DebugString();
+
+  JsonObject json_reply;
+  json_reply.Add("tree_size", sth.tree_size());
+  json_reply.Add("timestamp", sth.timestamp());
+  json_reply.AddBase64("sha256_root_hash", sth.sha256_root_hash());
+  json_reply.Add("tree_head_signature", sth.signature());
+
+  VLOG(2) << "GetSTH:\n" << json_reply.DebugString();
+
+  const shared_ptr<STHResponse> response(make_shared<STHResponse>());
+  response->timestamp = sth.timestamp();
+  response->tree_size = sth.tree_size();
+  response->etag = "\"" + to_string(sth.tree_size()) + "-" +
+                   to_string(sth.timestamp()) + "\"";
+  response->body = make_shared<string>(json_reply.ToString());
+
+  lock_guard<mutex> lock(response_cache_mutex_);
+  // Another request might have rendered a newer one meanwhile.
+  if (!sth_response_ || sth_response_->timestamp < response->timestamp) {
+    sth_response_ = response;
+  }
+  return response;
+}
+
+
+shared_ptr<const HttpHandler::RootsResponse>
+HttpHandler::CurrentRootsResponse() const {
+  const shared_ptr<const multimap<string, const Cert*>> trusted(
+      cert_checker_->GetTrustedCertificates());
+  {
+    lock_guard<mutex> lock(response_cache_mutex_);
+    if (roots_response_ && roots_response_->roots == trusted) {
+      return roots_response_;
+    }
+  }
+
+  JsonArray roots;
+  for (const auto& root : *trusted) {
+    string cert;
+    if (root.second->DerEncoding(&cert) != Cert::TRUE) {
+      LOG(ERROR) << "Cert encoding failed";
+      return nullptr;
+    }
+    roots.AddBase64(cert);
+  }
+
+  JsonObject json_reply;
+  json_reply.Add("certificates", roots);
+
+  const shared_ptr<RootsResponse> response(make_shared<RootsResponse>());
+  response->roots = trusted;
+  response->body = make_shared<string>(json_reply.ToString());
+  response->gzip_body = make_shared<string>(Gzip(*response->body));
+  const string digest(Sha256Hasher::Sha256Digest(*response->body));
+  response->etag = "\"" + util::HexString(digest.substr(0, 16)) + "\"";
+
+  lock_guard<mutex> lock(response_cache_mutex_);
+  // The trusted certificates might have been changed again meanwhile.
+  if (cert_checker_->GetTrustedCertificates() == trusted) {
+    roots_response_ = response;
+  }
+  return response;
+}
+
+
+shared_ptr<const string> HttpHandler::ConsistencyResponse(
+    int64_t first, int64_t second) const {
+  const std::pair<int64_t, int64_t> key(first, second);
+  {
+    lock_guard<mutex> lock(response_cache_mutex_);
+    const auto it(consistency_responses_.find(key));
+    if (it != consistency_responses_.end()) {
+      return it->second;
+    }
+  }
+
+  // Proofs to a tree size we do not have yet are empty, but will not
+  // be once we do, so those cannot be cached.
+  const bool cacheable(FLAGS_consistency_response_cache_size > 0 &&
+                       second <= CurrentSTHResponse()->tree_size);
+
+  const function<shared_ptr<const string>()> render([this, first, second]() {
+    const vector<string> consistency(
+        log_lookup_->ConsistencyProof(first, second));
+    JsonArray json_cons;
+    for (vector<string>::const_iterator it = consistency.begin();
+         it != consistency.end(); ++it) {
+      json_cons.AddBase64(*it);
+    }
+
+    JsonObject json_reply;
+    json_reply.Add("consistency", json_cons);
+    return make_shared<const string>(json_reply.ToString());
+  });
+
+  if (!cacheable) {
+    return render();
+  }
+
+  bool coalesced;
+  const shared_ptr<const string> body(
+      consistency_flights_.Do(key, render, &coalesced));
+  if (coalesced) {
+    http_server_coalesced_requests->Increment("/ct/v1/get-sth-consistency");
+    return body;
+  }
+
+  lock_guard<mutex> lock(response_cache_mutex_);
+  if (consistency_responses_.insert(make_pair(key, body)).second) {
+    cached_consistencies_.push_back(key);
+    consistency_responses_bytes_ += body->size();
+    while (cached_consistencies_.size() >
+           static_cast<size_t>(FLAGS_consistency_response_cache_size)) {
+      const auto evicted(
+          consistency_responses_.find(cached_consistencies_.front()));
+      consistency_responses_bytes_ -= evicted->second->size();
+      consistency_responses_.erase(evicted);
+      cached_consistencies_.pop_front();
+    }
+    consistency_responses_memory_.Set(consistency_responses_bytes_);
+  }
+  return body;
+}
+
+
 void HttpHandler::AddChain(evhttp_request* req) {
-  const shared_ptr<CertChain> chain(make_shared<CertChain>());
-  if (!ExtractChain(output_, req, chain.get())) {
+  if (!AllowAddChain(req)) {
     return;
   }
+  const util::TraceContext trace(util::TraceContext::NewRoot());
+  const shared_ptr<CertChain> chain(make_shared<CertChain>());
+  {
+    util::ScopedTraceContext scoped_trace(trace);
+    util::ScopedTraceSpan span("http.parse");
+    if (!ExtractChain(output_, req, chain.get())) {
+      return;
+    }
+  }
 
-  pool_->Add(bind(&HttpHandler::BlockingAddChain, this, req, chain));
+  QueueAddChain(req, bind(&HttpHandler::BlockingAddChain, this, req, chain,
+                          trace, steady_clock::now()));
 }
 
 
 void HttpHandler::AddPreChain(evhttp_request* req) {
+  if (!AllowAddChain(req)) {
+    return;
+  }
+  const util::TraceContext trace(util::TraceContext::NewRoot());
   const shared_ptr<PreCertChain> chain(make_shared<PreCertChain>());
-  if (!ExtractChain(output_, req, chain.get())) {
+  {
+    util::ScopedTraceContext scoped_trace(trace);
+    util::ScopedTraceSpan span("http.parse");
+    if (!ExtractChain(output_, req, chain.get())) {
+      return;
+    }
+  }
+
+  QueueAddChain(req, bind(&HttpHandler::BlockingAddPreChain, this, req,
+                          chain, trace, steady_clock::now()));
+}
+
+
+void HttpHandler::AddChains(evhttp_request* req) {
+  if (!AllowAddChain(req)) {
     return;
   }
+  if (evhttp_request_get_command(req) != EVHTTP_REQ_POST) {
+    return output_->SendError(req, HTTP_BADMETHOD, "Method not allowed.");
+  }
+  evbuffer* const body(evhttp_request_get_input_buffer(req));
+  if (evbuffer_get_length(body) >
+      static_cast<size_t>(FLAGS_max_add_chains_request_bytes)) {
+    return output_->SendError(req, HTTP_ENTITYTOOLARGE, "Request too large.");
+  }
+
+  const util::TraceContext trace(util::TraceContext::NewRoot());
+  shared_ptr<BulkAddChain> bulk;
+  {
+    util::ScopedTraceContext scoped_trace(trace);
+    util::ScopedTraceSpan span("http.parse");
+    JsonObject json_body(body);
+    if (!json_body.Ok() || !json_body.IsType(json_type_object)) {
+      return output_->SendError(req, HTTP_BADREQUEST,
+                                "Unable to parse provided JSON.");
+    }
+    JsonArray json_chains(json_body, "chains");
+    if (!json_chains.Ok() ||
+        json_chains.Length() > FLAGS_max_chains_per_add_chains_request) {
+      return output_->SendError(req, HTTP_BADREQUEST,
+                                "Missing or invalid \"chains\" parameter.");
+    }
+
+    // A chain that cannot be parsed only fails on its own, like it
+    // would have in its own add-chain request.
+    bulk = make_shared<BulkAddChain>(req, json_chains.Length(), trace);
+    for (int i = 0; i < json_chains.Length(); ++i) {
+      const JsonObject json_item(json_chains, i);
+      unique_ptr<CertChain> chain;
+      if (json_item.Ok()) {
+        const JsonBoolean json_precert(json_item, "precert");
+        bulk->precert[i] = json_precert.Ok() && json_precert.Value();
+        chain.reset(bulk->precert[i] ? new PreCertChain : new CertChain);
+        const JsonArray json_chain(json_item, "chain");
+        if (!json_chain.Ok() || !LoadChain(json_chain, chain.get())) {
+          chain.reset();
+        }
+      }
+      if (!chain) {
+        bulk->statuses[i] = util::Status(util::error::INVALID_ARGUMENT,
+                                         "Unable to parse provided chain.");
+        continue;
+      }
+      bulk->chains[i] = move(chain);
+    }
+  }
+
+  vector<function<void()>> checks;
+  for (size_t i = 0; i < bulk->chains.size(); ++i) {
+    if (bulk->chains[i]) {
+      checks.emplace_back(
+          bind(&HttpHandler::BlockingAddBulkChain, this, bulk, i));
+    }
+  }
+  if (checks.empty()) {
+    bulk->remaining = 1;
+    return AddBulkChainDone(bulk, 0, nullptr);
+  }
+  bulk->remaining = checks.size();
+  QueueAddChains(req, checks);
+}
+
 
-  pool_->Add(bind(&HttpHandler::BlockingAddPreChain, this, req, chain));
+void HttpHandler::QueueAddChain(evhttp_request* req,
+                                const function<void()>& check) {
+  QueueAddChains(req, vector<function<void()>>{check});
 }
 
 
-void HttpHandler::BlockingGetEntries(evhttp_request* req, int64_t start,
-                                     int64_t end, bool include_scts) const {
-  JsonArray json_entries;
-  auto it(db_->ScanEntries(start));
-  for (int64_t i = start; i <= end; ++i) {
-    LoggedCertificate cert;
+void HttpHandler::QueueAddChains(evhttp_request* req,
+                                 const vector<function<void()>>& checks) {
+  // Both stages of the pipeline are bounded, so that a flood of
+  // submissions is turned away, rather than growing the queues and
+  // the latency of everything else without bounds.
+  const int count(checks.size());
+  if (add_chain_in_flight_.fetch_add(count) + count >
+      FLAGS_add_chain_max_in_flight) {
+    add_chain_in_flight_ -= count;
+    add_chain_rejected_requests->Increment("store");
+    return output_->SendError(req, HTTP_SERVUNAVAIL, "Too many requests.");
+  }
+  if (add_chain_queued_.fetch_add(count) + count > FLAGS_add_chain_max_queued) {
+    add_chain_queued_ -= count;
+    add_chain_in_flight_ -= count;
+    add_chain_rejected_requests->Increment("check");
+    return output_->SendError(req, HTTP_SERVUNAVAIL, "Too many requests.");
+  }
+  UpdateAddChainGauges();
+
+  // Each client's chains are checked in turn, so that one submitting
+  // many of them only delays its own.
+  const string client(ClientAddress(req));
+  const function<void()> run_next([this]() {
+    CHECK(add_chain_queue_->RunNext());
+  });
+  for (const function<void()>& check : checks) {
+    add_chain_queue_->Push(client, check);
+    if (add_chain_pool_) {
+      add_chain_pool_->Add(run_next);
+    } else {
+      pool_->Add(run_next);
+    }
+  }
+}
 
-    if (!it->GetNextEntry(&cert) || cert.sequence_number() != i) {
-      break;
+
+bool HttpHandler::AllowAddChain(evhttp_request* req) {
+  // Checked before parsing the chain, the most expensive requests to
+  // turn away being the ones that were already parsed.
+  if (add_chain_limiter_ && !add_chain_limiter_->Allow(ClientAddress(req))) {
+    add_chain_rejected_requests->Increment("rate_limit");
+    output_->SendError(req, HTTP_SERVUNAVAIL, "Too many requests.");
+    return false;
+  }
+  return true;
+}
+
+
+void HttpHandler::UpdateAddChainGauges() const {
+  const int queued(add_chain_queued_.load());
+  add_chain_pipeline_requests->Set("check", queued);
+  add_chain_pipeline_requests->Set("store",
+                                   std::max(0, add_chain_in_flight_.load() - queued));
+}
+
+
+void HttpHandler::BlockingGetEntries(evhttp_request* req, int64_t start,
+                                     int64_t end, bool include_scts,
+                                     bool binary, bool records,
+                                     bool immutable) const {
+  // Whole blocks never change once they are all in the tree, so
+  // their compressed reply can be kept.
+  const int64_t block_size(entry_cache_->BlockSize());
+  const bool gzipped(!binary && !include_scts && start % block_size == 0 &&
+                     (end + 1) % block_size == 0 &&
+                     JsonOutput::AcceptsGzip(req));
+
+  string etag;
+  if (immutable) {
+    // Each representation of the range has its own strong ETag.
+    etag = "\"" + to_string(start) + "-" + to_string(end) +
+           (records ? "-records" : binary ? "-binary"
+                                          : include_scts ? "-scts" : "") +
+           (gzipped ? "-gzip" : "") + "\"";
+    const char* const if_none_match(evhttp_find_header(
+        evhttp_request_get_input_headers(req), "If-None-Match"));
+    if (if_none_match && etag == if_none_match) {
+      AddImmutableHeaders(req, etag);
+      static const shared_ptr<const string> empty_body(make_shared<string>());
+      return output_->SendJsonReply(req, HTTP_NOTMODIFIED, empty_body);
     }
+  }
+
+  if (gzipped) {
+    return BlockingGetGzippedEntries(req, start, end, etag);
+  }
+  if (records) {
+    return BlockingGetEntryRecords(req, start, end, etag);
+  }
 
-    string leaf_input;
-    string extra_data;
-    string sct_data;
-    if (!cert.SerializeForLeaf(&leaf_input) ||
-        !cert.SerializeExtraData(&extra_data) ||
-        (include_scts &&
-         Serializer::SerializeSCT(cert.sct(), &sct_data) != Serializer::OK)) {
-      LOG(WARNING) << "Failed to serialize entry @ " << i << ":\n"
-                   << cert.DebugString();
+  // The entries are written out as they are read. The reply is only
+  // started once the first one is serialized, as it cannot be turned
+  // into an error after that.
+  unique_ptr<ChunkedJsonReply> reply;
+  const bool ok(entry_cache_->ForEachEntry(
+      start, end, [this, req, include_scts, binary, &etag,
+                   &reply](const EntryCache::Entry& entry) {
+        if (reply && reply->abandoned()) {
+          // Nobody is reading what is left.
+          return;
+        }
+        if (!reply && !etag.empty()) {
+          AddImmutableHeaders(req, etag);
+        }
+        if (binary) {
+          if (!reply) {
+            reply = output_->StartChunkedReply(req, HTTP_OK,
+                                               kBinaryEntriesContentType);
+          }
+          reply->Append(entry.binary);
+        } else {
+          if (!reply) {
+            reply = output_->StartChunkedJsonReply(req, HTTP_OK);
+            reply->Append("{\"entries\":[");
+          } else {
+            reply->Append(",");
+          }
+          reply->Append(entry.json);
+          if (include_scts) {
+            // This is non-standard, and currently only used by other
+            // SuperDuper log nodes when "following" to fetch data from
+            // each other:
+            reply->Append(entry.sct_json);
+          }
+          reply->Append("}");
+        }
+
+        if (reply->BufferedLength() >= kGetEntriesChunkSize) {
+          reply->Flush();
+        }
+      }));
+
+  if (!ok) {
+    if (!reply) {
       return output_->SendError(req, HTTP_INTERNAL, "Serialization failed.");
     }
+    // Ending the reply here leaves it unterminated, so that the client
+    // knows it is incomplete.
+    return;
+  }
+
+  if (!reply) {
+    return output_->SendError(req, HTTP_BADREQUEST, "Entry not found.");
+  }
+
+  reply->Append(binary ? string(3, '\0') : string("]}"));
+  reply->End();
+}
+
+
+void HttpHandler::BlockingAddChain(
+    evhttp_request* req, const shared_ptr<CertChain>& chain,
+    const util::TraceContext& trace, const steady_clock::time_point& queued) {
+  add_chain_pipeline_latency_ms.RecordLatency("queue",
+                                              steady_clock::now() - queued);
+  util::TraceSpan::Record("http.queue", trace, queued);
+  // Only checking the chain blocks this thread, the reply is sent once
+  // the entry is signed and stored.
+  {
+    util::ScopedTraceContext scoped_trace(trace);
+    util::ScopedTraceSpan span("http.check");
+    ScopedLatency latency(
+        add_chain_pipeline_latency_ms.GetScopedLatency("check"));
+    SignedCertificateTimestamp* const sct(new SignedCertificateTimestamp);
+    CHECK_NOTNULL(frontend_)
+        ->QueueX509Entry(CHECK_NOTNULL(chain.get()), sct,
+                         new util::Task(bind(&HttpHandler::AddChainDone, this,
+                                             req, sct, trace, queued, _1),
+                                        pool_));
+  }
+  --add_chain_queued_;
+  UpdateAddChainGauges();
+}
+
+
+void HttpHandler::BlockingAddPreChain(
+    evhttp_request* req, const shared_ptr<PreCertChain>& chain,
+    const util::TraceContext& trace, const steady_clock::time_point& queued) {
+  add_chain_pipeline_latency_ms.RecordLatency("queue",
+                                              steady_clock::now() - queued);
+  util::TraceSpan::Record("http.queue", trace, queued);
+  {
+    util::ScopedTraceContext scoped_trace(trace);
+    util::ScopedTraceSpan span("http.check");
+    ScopedLatency latency(
+        add_chain_pipeline_latency_ms.GetScopedLatency("check"));
+    SignedCertificateTimestamp* const sct(new SignedCertificateTimestamp);
+    CHECK_NOTNULL(frontend_)
+        ->QueuePreCertEntry(CHECK_NOTNULL(chain.get()), sct,
+                            new util::Task(bind(&HttpHandler::AddChainDone,
+                                                this, req, sct, trace, queued,
+                                                _1),
+                                           pool_));
+  }
+  --add_chain_queued_;
+  UpdateAddChainGauges();
+}
+
+
+void HttpHandler::AddChainDone(evhttp_request* req,
+                               SignedCertificateTimestamp* sct,
+                               const util::TraceContext& trace,
+                               const steady_clock::time_point& queued,
+                               util::Task* task) {
+  const unique_ptr<SignedCertificateTimestamp> sct_deleter(sct);
+  const unique_ptr<util::Task> task_deleter(task);
+  add_chain_pipeline_latency_ms.RecordLatency("total",
+                                              steady_clock::now() - queued);
+  util::TraceSpan::Record("http.add_chain", trace, queued);
+  --add_chain_in_flight_;
+  UpdateAddChainGauges();
+  AddChainReply(output_, req, task->status(), *sct);
+}
+
+
+void HttpHandler::BlockingAddBulkChain(const shared_ptr<BulkAddChain>& bulk,
+                                       size_t index) {
+  add_chain_pipeline_latency_ms.RecordLatency(
+      "queue", steady_clock::now() - bulk->queued);
+  {
+    util::ScopedTraceContext scoped_trace(bulk->trace);
+    util::ScopedTraceSpan span("http.check");
+    ScopedLatency latency(
+        add_chain_pipeline_latency_ms.GetScopedLatency("check"));
+    util::Task* const task(new util::Task(
+        bind(&HttpHandler::AddBulkChainDone, this, bulk, index, _1), pool_));
+    CertChain* const chain(CHECK_NOTNULL(bulk->chains[index].get()));
+    if (bulk->precert[index]) {
+      CHECK_NOTNULL(frontend_)
+          ->QueuePreCertEntry(static_cast<PreCertChain*>(chain),
+                              &bulk->scts[index], task);
+    } else {
+      CHECK_NOTNULL(frontend_)
+          ->QueueX509Entry(chain, &bulk->scts[index], task);
+    }
+  }
+  --add_chain_queued_;
+  UpdateAddChainGauges();
+}
+
 
-    JsonObject json_entry;
-    json_entry.AddBase64("leaf_input", leaf_input);
-    json_entry.AddBase64("extra_data", extra_data);
+void HttpHandler::AddBulkChainDone(const shared_ptr<BulkAddChain>& bulk,
+                                   size_t index, util::Task* task) {
+  if (task) {
+    const unique_ptr<util::Task> task_deleter(task);
+    bulk->statuses[index] = task->status();
+    // The chain is not needed anymore.
+    bulk->chains[index].reset();
+    add_chain_pipeline_latency_ms.RecordLatency(
+        "total", steady_clock::now() - bulk->queued);
+    --add_chain_in_flight_;
+    UpdateAddChainGauges();
+  }
+  if (--bulk->remaining > 0) {
+    return;
+  }
 
-    if (include_scts) {
-      // This is non-standard, and currently only used by other SuperDuper log
-      // nodes when "following" to fetch data from each other:
-      json_entry.AddBase64("sct", sct_data);
+  util::TraceSpan::Record("http.add_chains", bulk->trace, bulk->queued);
+  // The SCTs are written out like add-chain replies, and the errors
+  // like add-chain errors, with their HTTP status.
+  string body("{\"results\":[");
+  for (size_t i = 0; i < bulk->statuses.size(); ++i) {
+    if (i > 0) {
+      body.append(",");
+    }
+    int response_code;
+    if (AddChainSucceeded(bulk->statuses[i], &response_code)) {
+      AppendSCTJson(bulk->scts[i], &body);
+      continue;
     }
+    JsonObject json_error;
+    json_error.Add("error_code", response_code);
+    json_error.Add("error_message", bulk->statuses[i].error_message());
+    body.append(json_error.ToJson());
+  }
+  body.append("]}");
+  output_->SendJsonReply(bulk->req, HTTP_OK, body);
+}
+
 
-    json_entries.Add(&json_entry);
+void HttpHandler::BlockingGetGzippedEntries(evhttp_request* req,
+                                            int64_t start, int64_t end,
+                                            const string& etag) const {
+  const std::pair<int64_t, int64_t> key(start, end);
+  {
+    lock_guard<mutex> lock(response_cache_mutex_);
+    const auto it(gzipped_entries_.find(key));
+    if (it != gzipped_entries_.end()) {
+      if (!etag.empty()) {
+        AddImmutableHeaders(req, etag);
+      }
+      return output_->SendGzippedJsonReply(req, HTTP_OK, it->second);
+    }
   }
 
-  if (json_entries.Length() < 1) {
+  const shared_ptr<string> body(make_shared<string>("{\"entries\":["));
+  int64_t num_entries(0);
+  const bool ok(entry_cache_->ForEachEntry(
+      start, end, [&body, &num_entries](const EntryCache::Entry& entry) {
+        if (num_entries++ > 0) {
+          body->append(",");
+        }
+        body->append(entry.json);
+        body->append("}");
+      }));
+  if (!ok) {
+    return output_->SendError(req, HTTP_INTERNAL, "Serialization failed.");
+  }
+  if (num_entries == 0) {
     return output_->SendError(req, HTTP_BADREQUEST, "Entry not found.");
   }
+  body->append("]}");
+
+  // The last block might not be complete yet.
+  const bool complete(num_entries == end - start + 1);
+  const function<void()> compress([this, req, key, body, complete, etag]() {
+    const function<shared_ptr<const string>()> gzip([body]() {
+      return make_shared<const string>(Gzip(*body));
+    });
+    // Only complete blocks are the same for all the requests for them.
+    bool coalesced(false);
+    const shared_ptr<const string> gzipped(
+        complete ? gzipped_entries_flights_.Do(key, gzip, &coalesced)
+                 : gzip());
+    if (coalesced) {
+      http_server_coalesced_requests->Increment("/ct/v1/get-entries");
+    } else if (complete) {
+      lock_guard<mutex> lock(response_cache_mutex_);
+      if (gzipped_entries_.insert(make_pair(key, gzipped)).second) {
+        cached_gzipped_entries_.push_back(key);
+        gzipped_entries_bytes_ += gzipped->size();
+        while (cached_gzipped_entries_.size() >
+               static_cast<size_t>(FLAGS_gzipped_entries_cache_size)) {
+          const auto evicted(
+              gzipped_entries_.find(cached_gzipped_entries_.front()));
+          gzipped_entries_bytes_ -= evicted->second->size();
+          gzipped_entries_.erase(evicted);
+          cached_gzipped_entries_.pop_front();
+        }
+        gzipped_entries_memory_.Set(gzipped_entries_bytes_);
+      }
+    }
+    if (!etag.empty()) {
+      AddImmutableHeaders(req, etag);
+    }
+    output_->SendGzippedJsonReply(req, HTTP_OK, gzipped);
+  });
 
-  JsonObject json_reply;
-  json_reply.Add("entries", json_entries);
-
-  output_->SendJsonReply(req, HTTP_OK, json_reply);
+  if (libevent::Base::ForRequest(req)->OnThisEventThread()) {
+    pool_->Add(compress);
+  } else {
+    compress();
+  }
 }
 
 
-void HttpHandler::BlockingAddChain(evhttp_request* req,
-                                   const shared_ptr<CertChain>& chain) const {
-  SignedCertificateTimestamp sct;
+void HttpHandler::BlockingGetEntryRecords(evhttp_request* req, int64_t start,
+                                          int64_t end,
+                                          const string& etag) const {
+  vector<string> keys;
+  keys.reserve(end - start + 1);
+  for (int64_t index = start; index <= end; ++index) {
+    keys.emplace_back(FileDB<LoggedCertificate>::EntryKey(index));
+  }
+  // Like EntryCache::ForEachEntry(), this stops at the first entry
+  // that is not in the database.
+  vector<SegmentStorage::Extent> extents;
+  entry_segments_->LookupRecords(keys, &extents);
+  if (extents.empty()) {
+    return output_->SendError(req, HTTP_BADREQUEST, "Entry not found.");
+  }
+
+  if (!etag.empty()) {
+    AddImmutableHeaders(req, etag);
+  }
+  const unique_ptr<ChunkedJsonReply> reply(
+      output_->StartChunkedReply(req, HTTP_OK, kEntryRecordsContentType));
+  for (const SegmentStorage::Extent& extent : extents) {
+    reply->AppendFileRange(extent.fd, extent.offset, extent.length);
+    // Flushing waits for the client to keep up, so that not all of
+    // the files are queued at once.
+    if (reply->BufferedLength() >= kGetEntriesChunkSize && !reply->Flush()) {
+      // Nobody is reading what is left.
+      return;
+    }
+  }
+  reply->Append(string(SegmentStorage::kRecordHeaderLength, '\0'));
+  reply->End();
+}
+
 
-  AddChainReply(output_, req,
-                CHECK_NOTNULL(frontend_)
-                    ->QueueX509Entry(CHECK_NOTNULL(chain.get()), &sct),
-                sct);
+void HttpHandler::ServeEntryRecords(const SegmentStorage* segments) {
+  entry_segments_ = CHECK_NOTNULL(segments);
 }
 
 
-void HttpHandler::BlockingAddPreChain(
-    evhttp_request* req, const shared_ptr<PreCertChain>& chain) const {
-  SignedCertificateTimestamp sct;
+void HttpHandler::SetReady(bool ready) {
+  lock_guard<mutex> lock(mutex_);
+  ready_ = ready;
+}
+
 
-  AddChainReply(output_, req,
-                CHECK_NOTNULL(frontend_)
-                    ->QueuePreCertEntry(CHECK_NOTNULL(chain.get()), &sct),
-                sct);
+void HttpHandler::SetReadOnlyReplica() {
+  lock_guard<mutex> lock(mutex_);
+  read_only_replica_ = true;
 }
 
 
 bool HttpHandler::IsNodeStale() const {
   lock_guard<mutex> lock(mutex_);
-  return node_is_stale_;
+  return (node_is_stale_ && !read_only_replica_) || !ready_;
 }
 
 
@@ -1,32 +1,50 @@
 #ifndef CERT_TRANS_SERVER_HANDLER_H_
 #define CERT_TRANS_SERVER_HANDLER_H_
 
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <map>
 #include <memory>
 #include <mutex>
 #include <stdint.h>
 #include <string>
+#include <utility>
+#include <vector>
 
+#include "monitoring/memory_gauge.h"
 #include "util/libevent_wrapper.h"
+#include "util/single_flight.h"
 #include "util/sync_task.h"
 #include "util/task.h"
+#include "util/trace.h"
 
 class Frontend;
 template <class T>
 class LogLookup;
-template <class T>
-class ReadOnlyDatabase;
+
+namespace ct {
+class SignedCertificateTimestamp;
+}  // namespace ct
 
 namespace cert_trans {
 
+class Cert;
 class CertChain;
 class CertChecker;
 template <class T>
 class ClusterStateController;
+class EntryCache;
+class FairQueue;
 class JsonOutput;
 class LoggedCertificate;
 class PreCertChain;
 class Proxy;
+class RateLimiter;
+class SegmentStorage;
 class ThreadPool;
+class TrafficCapture;
 
 
 class HttpHandler {
@@ -37,44 +55,180 @@ class HttpHandler {
   // requests.
   HttpHandler(JsonOutput* json_output,
               LogLookup<LoggedCertificate>* log_lookup,
-              const ReadOnlyDatabase<LoggedCertificate>* db,
+              EntryCache* entry_cache,
               const ClusterStateController<LoggedCertificate>* controller,
               const CertChecker* cert_checker, Frontend* frontend,
               Proxy* proxy, ThreadPool* pool, libevent::Base* event_base);
   ~HttpHandler();
 
-  void Add(libevent::HttpServer* server);
+  // Adds the handlers to |server|, their paths starting with
+  // |prefix|, which is empty or starts with a slash and does not end
+  // with one.
+  void Add(libevent::HttpServer* server, const std::string& prefix);
+
+  // Until this is called with true, this node is treated as stale, so
+  // that the requests it cannot answer from its local tree are proxied
+  // to other nodes, as while it catches up after a restart. Ready when
+  // constructed.
+  void SetReady(bool ready);
+
+  // For a read-only replica, which is not a member of the cluster and
+  // only serves the tree heads it has all the entries of: it is never
+  // stale, so the requests are answered locally once it is ready.
+  void SetReadOnlyReplica();
+
+  // Lets the other log nodes ask for the entries as the records
+  // |segments| keeps them in, for a FileDB that does not intern the
+  // chains, which are sent straight from its files rather than read
+  // and serialized. Must be called before Add().
+  void ServeEntryRecords(const SegmentStorage* segments);
 
  private:
+  // Where a handler runs.
+  enum RunOn {
+    EVENT_THREAD,
+    HTTP_POOL,
+    // Like HTTP_POOL, but on the dedicated read pool, rejecting
+    // requests if too many are waiting for it.
+    READ_POOL,
+  };
+
+  // Returns whether a request can be answered from the local tree
+  // even when this node is stale, if it does not need anything newer.
+  typedef std::function<bool(evhttp_request*)> ServableWhenStale;
+
   void ProxyInterceptor(
+      const std::string& path, const ServableWhenStale& servable_when_stale,
       const libevent::HttpServer::HandlerCallback& next_handler,
       evhttp_request* request);
 
+  void RunHandler(RunOn run_on, const std::string& path,
+                  const libevent::HttpServer::HandlerCallback& handler,
+                  evhttp_request* request);
+
+  // If |servable_when_stale| is empty, requests are always proxied
+  // while this node is stale.
   void AddProxyWrappedHandler(
       libevent::HttpServer* server, const std::string& path,
-      const libevent::HttpServer::HandlerCallback& local_handler);
+      const libevent::HttpServer::HandlerCallback& local_handler,
+      const ServableWhenStale& servable_when_stale);
+
+  bool EntriesServableWhenStale(evhttp_request* req) const;
+  bool ProofServableWhenStale(evhttp_request* req) const;
+  bool ConsistencyServableWhenStale(evhttp_request* req) const;
 
   void GetEntries(evhttp_request* req) const;
   void GetRoots(evhttp_request* req) const;
   void GetProof(evhttp_request* req) const;
+  void GetProofs(evhttp_request* req) const;
   void GetSTH(evhttp_request* req) const;
   void GetConsistency(evhttp_request* req) const;
+  // Non-standard lookup of the entries by domain or issuer key, for
+  // monitors that would otherwise download the whole log.
+  void SearchEntries(evhttp_request* req) const;
   void AddChain(evhttp_request* req);
   void AddPreChain(evhttp_request* req);
+  // Non-standard bulk version of add-chain and add-pre-chain, for CAs
+  // submitting many chains at once.
+  void AddChains(evhttp_request* req);
 
+  // |immutable| is whether the entries are all in the serving tree,
+  // for the reply to be sent with headers that let caches keep it.
   void BlockingGetEntries(evhttp_request* req, int64_t start, int64_t end,
-                          bool include_scts) const;
+                          bool include_scts, bool binary, bool records,
+                          bool immutable) const;
+  // Sends the entries from |start| to |end|, whole blocks of the entry
+  // cache, gzipped, compressing them on |pool_| rather than on the
+  // event thread, and only once if they are all in the tree. Sends the
+  // headers for an immutable reply with |etag|, unless it is empty.
+  void BlockingGetGzippedEntries(evhttp_request* req, int64_t start,
+                                 int64_t end, const std::string& etag) const;
+  // Sends the records of the entries from |start| to |end| from
+  // |entry_segments_|, with the headers for an immutable reply with
+  // |etag|, unless it is empty.
+  void BlockingGetEntryRecords(evhttp_request* req, int64_t start,
+                               int64_t end, const std::string& etag) const;
+  // Runs |check|, which checks the chain of an add-chain or
+  // add-pre-chain request and then queues it, on the add-chain pool,
+  // unless too many requests are already in the pipeline, in which
+  // case the request is rejected.
+  void QueueAddChain(evhttp_request* req, const std::function<void()>& check);
+  // Same as QueueAddChain(), for the chains of an add-chains request,
+  // which is accepted or rejected as a whole, each of its chains
+  // counting as a request.
+  void QueueAddChains(evhttp_request* req,
+                      const std::vector<std::function<void()>>& checks);
+  // Returns whether the client can make another add-chain or
+  // add-pre-chain request under --add_chain_client_rate, and rejects
+  // the request otherwise.
+  bool AllowAddChain(evhttp_request* req);
+  void UpdateAddChainGauges() const;
+  // |queued| is when the request was queued by QueueAddChain.
   void BlockingAddChain(evhttp_request* req,
-                        const std::shared_ptr<CertChain>& chain) const;
-  void BlockingAddPreChain(evhttp_request* req,
-                           const std::shared_ptr<PreCertChain>& chain) const;
+                        const std::shared_ptr<CertChain>& chain,
+                        const util::TraceContext& trace,
+                        const std::chrono::steady_clock::time_point& queued);
+  void BlockingAddPreChain(
+      evhttp_request* req, const std::shared_ptr<PreCertChain>& chain,
+      const util::TraceContext& trace,
+      const std::chrono::steady_clock::time_point& queued);
+  // Sends the reply to an add-chain or add-pre-chain request, and
+  // deletes |sct| and |task|.
+  void AddChainDone(evhttp_request* req, ct::SignedCertificateTimestamp* sct,
+                    const util::TraceContext& trace,
+                    const std::chrono::steady_clock::time_point& queued,
+                    util::Task* task);
+  // The chains of an add-chains request, and their results.
+  struct BulkAddChain;
+  // Checks and queues the chain at |index| of |bulk|.
+  void BlockingAddBulkChain(const std::shared_ptr<BulkAddChain>& bulk,
+                            size_t index);
+  // Records the result for the chain at |index| of |bulk|, and sends
+  // the reply once all of them are done. Deletes |task|.
+  void AddBulkChainDone(const std::shared_ptr<BulkAddChain>& bulk,
+                        size_t index, util::Task* task);
 
   bool IsNodeStale() const;
   void UpdateNodeStaleness();
 
+  // The get-sth response for an STH, rendered once and then sent to
+  // every request until the STH changes.
+  struct STHResponse {
+    uint64_t timestamp;
+    int64_t tree_size;
+    std::string etag;
+    std::shared_ptr<const std::string> body;
+  };
+
+  // Returns the get-sth response for the current STH, rendering it
+  // first if the STH changed.
+  std::shared_ptr<const STHResponse> CurrentSTHResponse() const;
+  // The get-roots response for a set of trusted certificates, rendered
+  // once, in full and gzipped, and then sent to every request until
+  // the certificates are changed.
+  struct RootsResponse {
+    // Keeps the certificates it was rendered for, so that they are
+    // not freed and replaced with others at the same address.
+    std::shared_ptr<const std::multimap<std::string, const Cert*>> roots;
+    std::string etag;
+    std::shared_ptr<const std::string> body;
+    std::shared_ptr<const std::string> gzip_body;
+  };
+
+  // Returns the get-roots response for the current trusted
+  // certificates, rendering it first if they changed, or NULL if one of
+  // them could not be encoded.
+  std::shared_ptr<const RootsResponse> CurrentRootsResponse() const;
+  // Returns the get-sth-consistency response between |first| and
+  // |second|, rendering it first if it is not cached.
+  std::shared_ptr<const std::string> ConsistencyResponse(int64_t first,
+                                                         int64_t second) const;
+
   JsonOutput* const output_;
   LogLookup<LoggedCertificate>* const log_lookup_;
-  const ReadOnlyDatabase<LoggedCertificate>* const db_;
+  EntryCache* const entry_cache_;
+  // Set by ServeEntryRecords(), if ever.
+  const SegmentStorage* entry_segments_;
   const ClusterStateController<LoggedCertificate>* const controller_;
   const CertChecker* const cert_checker_;
   Frontend* const frontend_;
@@ -85,6 +239,59 @@ class HttpHandler {
   util::SyncTask task_;
   mutable std::mutex mutex_;
   bool node_is_stale_;
+  bool ready_;
+  bool read_only_replica_;
+
+  // Protects the pre-rendered responses below.
+  mutable std::mutex response_cache_mutex_;
+  mutable std::shared_ptr<const STHResponse> sth_response_;
+  mutable std::shared_ptr<const RootsResponse> roots_response_;
+  // Consistency proofs between given tree sizes never change, so
+  // those are kept until they are among the oldest
+  // --consistency_response_cache_size ones.
+  mutable std::map<std::pair<int64_t, int64_t>,
+                   std::shared_ptr<const std::string> >
+      consistency_responses_;
+  mutable std::deque<std::pair<int64_t, int64_t> > cached_consistencies_;
+  // Likewise for the gzipped get-entries responses of whole blocks of
+  // entries, by their first and last entries, but keeping the
+  // --gzipped_entries_cache_size most recently added ones.
+  mutable std::map<std::pair<int64_t, int64_t>,
+                   std::shared_ptr<const std::string> >
+      gzipped_entries_;
+  mutable std::deque<std::pair<int64_t, int64_t> > cached_gzipped_entries_;
+  // The size of the responses in each of those caches.
+  mutable size_t consistency_responses_bytes_;
+  mutable size_t gzipped_entries_bytes_;
+  mutable MemoryGauge consistency_responses_memory_;
+  mutable MemoryGauge gzipped_entries_memory_;
+  // Render each of those only once when many requests for it come in
+  // at the same time.
+  mutable SingleFlight<std::pair<int64_t, int64_t>,
+                       std::shared_ptr<const std::string> >
+      consistency_flights_;
+  mutable SingleFlight<std::pair<int64_t, int64_t>,
+                       std::shared_ptr<const std::string> >
+      gzipped_entries_flights_;
+
+  // The number of requests waiting for |read_pool_|, which is NULL if
+  // the read pool handlers run on |pool_| instead.
+  std::atomic<int> read_pool_queued_;
+  std::unique_ptr<ThreadPool> read_pool_;
+
+  // The number of add-chain and add-pre-chain requests accepted but
+  // not answered yet, and how many of those are waiting for their
+  // chain to be checked, on |add_chain_pool_|, or on |pool_| if NULL.
+  std::atomic<int> add_chain_in_flight_;
+  std::atomic<int> add_chain_queued_;
+  // The chains waiting to be checked, by client address.
+  const std::unique_ptr<FairQueue> add_chain_queue_;
+  // NULL if clients are not rate limited.
+  std::unique_ptr<RateLimiter> add_chain_limiter_;
+  std::unique_ptr<ThreadPool> add_chain_pool_;
+
+  // NULL unless --traffic_capture_file is set.
+  std::unique_ptr<TrafficCapture> traffic_capture_;
 
   DISALLOW_COPY_AND_ASSIGN(HttpHandler);
 };
@@ -0,0 +1,564 @@
+#include "server/http2_server.h"
+
+#include <algorithm>
+#include <ctype.h>
+#include <errno.h>
+#include <event2/buffer.h>
+#include <event2/bufferevent.h>
+#include <event2/listener.h>
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <nghttp2/nghttp2.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <utility>
+#include <vector>
+
+#include "monitoring/monitoring.h"
+#include "net/url_fetcher.h"
+#include "util/libevent_wrapper.h"
+#include "util/task.h"
+
+using std::enable_shared_from_this;
+using std::make_pair;
+using std::make_shared;
+using std::map;
+using std::min;
+using std::pair;
+using std::shared_ptr;
+using std::string;
+using std::to_string;
+using std::unique_ptr;
+using std::vector;
+using std::weak_ptr;
+using util::Task;
+
+DEFINE_int32(http2_max_concurrent_streams, 100,
+             "Maximum number of streams an HTTP/2 client can have open at "
+             "once on a connection.");
+DEFINE_int32(http2_max_request_bytes, 1 << 20,
+             "Maximum size of the body of a request received over HTTP/2, "
+             "beyond which it is rejected with a 413.");
+
+namespace cert_trans {
+namespace {
+
+
+static Gauge<>* http2_server_connections(
+    Gauge<>::New("http2_server_connections",
+                 "Number of open HTTP/2 connections."));
+static Counter<>* http2_server_streams(
+    Counter<>::New("http2_server_streams",
+                   "Number of HTTP/2 streams forwarded to the HTTP "
+                   "handlers."));
+
+
+// Whether |name|, in lower case, is a header that only applies to a
+// single HTTP/1.1 connection, which HTTP/2 does not allow. The
+// Content-Length is left out as well, since it is set from the body
+// that is actually sent.
+bool IsHopByHopHeader(const string& name) {
+  return name == "connection" || name == "content-length" ||
+         name == "keep-alive" || name == "proxy-connection" ||
+         name == "te" || name == "transfer-encoding" || name == "upgrade";
+}
+
+
+string ToLower(string str) {
+  std::transform(str.begin(), str.end(), str.begin(), ::tolower);
+  return str;
+}
+
+
+nghttp2_nv MakeNv(const string& name, const string& value) {
+  nghttp2_nv nv;
+  nv.name = reinterpret_cast<uint8_t*>(const_cast<char*>(name.data()));
+  nv.value = reinterpret_cast<uint8_t*>(const_cast<char*>(value.data()));
+  nv.namelen = name.size();
+  nv.valuelen = value.size();
+  nv.flags = NGHTTP2_NV_FLAG_NONE;
+  return nv;
+}
+
+
+}  // namespace
+
+
+class Http2Server::Connection
+    : public enable_shared_from_this<Http2Server::Connection> {
+ public:
+  Connection(Http2Server* server, bufferevent* bev, const string& peer);
+  ~Connection();
+
+  void Start();
+
+ private:
+  struct Stream {
+    Stream()
+        : too_large(false),
+          response(make_shared<UrlFetcher::Response>()),
+          sent(0) {
+    }
+
+    string method;
+    string path;
+    string authority;
+    UrlFetcher::Headers headers;
+    string body;
+    bool too_large;
+    // Shared with the forwarded request, which can outlive the stream.
+    const shared_ptr<UrlFetcher::Response> response;
+    // How much of the body of |response| was sent.
+    size_t sent;
+  };
+
+  static void ReadCallback(bufferevent* bev, void* userdata);
+  static void WriteCallback(bufferevent* bev, void* userdata);
+  static void EventCallback(bufferevent* bev, short events, void* userdata);
+
+  static int OnBeginHeaders(nghttp2_session* session,
+                            const nghttp2_frame* frame, void* userdata);
+  static int OnHeader(nghttp2_session* session, const nghttp2_frame* frame,
+                      const uint8_t* name, size_t namelen,
+                      const uint8_t* value, size_t valuelen, uint8_t flags,
+                      void* userdata);
+  static int OnDataChunkRecv(nghttp2_session* session, uint8_t flags,
+                             int32_t stream_id, const uint8_t* data,
+                             size_t length, void* userdata);
+  static int OnFrameRecv(nghttp2_session* session, const nghttp2_frame* frame,
+                         void* userdata);
+  static int OnStreamClose(nghttp2_session* session, int32_t stream_id,
+                           uint32_t error_code, void* userdata);
+  static ssize_t ReadResponseBody(nghttp2_session* session, int32_t stream_id,
+                                  uint8_t* buf, size_t length,
+                                  uint32_t* data_flags,
+                                  nghttp2_data_source* source,
+                                  void* userdata);
+
+  Stream* FindStream(int32_t stream_id);
+  void Read();
+  // Writes out what the session has to send, and closes the
+  // connection once neither side has anything left to say.
+  void Flush();
+  void Close();
+  void Forward(int32_t stream_id, Stream* stream);
+  void ForwardDone(int32_t stream_id, const util::Status& status);
+  void Respond(int32_t stream_id, Stream* stream);
+
+  Http2Server* const server_;
+  bufferevent* const bev_;
+  const string peer_;
+  nghttp2_session* session_;
+  map<int32_t, unique_ptr<Stream>> streams_;
+
+  DISALLOW_COPY_AND_ASSIGN(Connection);
+};
+
+
+Http2Server::Connection::Connection(Http2Server* server, bufferevent* bev,
+                                    const string& peer)
+    : server_(CHECK_NOTNULL(server)),
+      bev_(CHECK_NOTNULL(bev)),
+      peer_(peer),
+      session_(nullptr) {
+}
+
+
+Http2Server::Connection::~Connection() {
+  nghttp2_session_del(session_);
+  bufferevent_free(bev_);
+}
+
+
+void Http2Server::Connection::Start() {
+  nghttp2_session_callbacks* callbacks;
+  CHECK_EQ(nghttp2_session_callbacks_new(&callbacks), 0);
+  nghttp2_session_callbacks_set_on_begin_headers_callback(callbacks,
+                                                          &OnBeginHeaders);
+  nghttp2_session_callbacks_set_on_header_callback(callbacks, &OnHeader);
+  nghttp2_session_callbacks_set_on_data_chunk_recv_callback(callbacks,
+                                                            &OnDataChunkRecv);
+  nghttp2_session_callbacks_set_on_frame_recv_callback(callbacks,
+                                                       &OnFrameRecv);
+  nghttp2_session_callbacks_set_on_stream_close_callback(callbacks,
+                                                         &OnStreamClose);
+  CHECK_EQ(nghttp2_session_server_new(&session_, callbacks, this), 0);
+  nghttp2_session_callbacks_del(callbacks);
+
+  const nghttp2_settings_entry settings[] = {
+      {NGHTTP2_SETTINGS_MAX_CONCURRENT_STREAMS,
+       static_cast<uint32_t>(FLAGS_http2_max_concurrent_streams)}};
+  CHECK_EQ(nghttp2_submit_settings(session_, NGHTTP2_FLAG_NONE, settings,
+                                   sizeof(settings) / sizeof(settings[0])),
+           0);
+
+  bufferevent_setcb(bev_, &ReadCallback, &WriteCallback, &EventCallback,
+                    this);
+  CHECK_EQ(bufferevent_enable(bev_, EV_READ | EV_WRITE), 0);
+  Flush();
+}
+
+
+// static
+void Http2Server::Connection::ReadCallback(bufferevent*, void* userdata) {
+  // Keeps this connection alive until the callback returns, in case
+  // it gets closed.
+  const shared_ptr<Connection> conn(
+      static_cast<Connection*>(userdata)->shared_from_this());
+  conn->Read();
+}
+
+
+// static
+void Http2Server::Connection::WriteCallback(bufferevent*, void* userdata) {
+  const shared_ptr<Connection> conn(
+      static_cast<Connection*>(userdata)->shared_from_this());
+  conn->Flush();
+}
+
+
+// static
+void Http2Server::Connection::EventCallback(bufferevent*, short events,
+                                            void* userdata) {
+  const shared_ptr<Connection> conn(
+      static_cast<Connection*>(userdata)->shared_from_this());
+  if (events & (BEV_EVENT_EOF | BEV_EVENT_ERROR | BEV_EVENT_TIMEOUT)) {
+    VLOG(1) << "HTTP/2 connection from " << conn->peer_ << " closed";
+    conn->Close();
+  }
+}
+
+
+// static
+int Http2Server::Connection::OnBeginHeaders(nghttp2_session*,
+                                            const nghttp2_frame* frame,
+                                            void* userdata) {
+  if (frame->hd.type == NGHTTP2_HEADERS &&
+      frame->headers.cat == NGHTTP2_HCAT_REQUEST) {
+    static_cast<Connection*>(userdata)
+        ->streams_[frame->hd.stream_id]
+        .reset(new Stream);
+  }
+  return 0;
+}
+
+
+// static
+int Http2Server::Connection::OnHeader(nghttp2_session*,
+                                      const nghttp2_frame* frame,
+                                      const uint8_t* name, size_t namelen,
+                                      const uint8_t* value, size_t valuelen,
+                                      uint8_t, void* userdata) {
+  Stream* const stream(
+      static_cast<Connection*>(userdata)->FindStream(frame->hd.stream_id));
+  if (!stream) {
+    return 0;
+  }
+
+  // nghttp2 has already checked that the names are in lower case.
+  const string header(reinterpret_cast<const char*>(name), namelen);
+  const string header_value(reinterpret_cast<const char*>(value), valuelen);
+  if (header == ":method") {
+    stream->method = header_value;
+  } else if (header == ":path") {
+    stream->path = header_value;
+  } else if (header == ":authority" || header == "host") {
+    stream->authority = header_value;
+  } else if (header[0] != ':' && !IsHopByHopHeader(header) &&
+             header != "x-forwarded-for") {
+    stream->headers.insert(make_pair(header, header_value));
+  }
+  return 0;
+}
+
+
+// static
+int Http2Server::Connection::OnDataChunkRecv(nghttp2_session*, uint8_t,
+                                             int32_t stream_id,
+                                             const uint8_t* data,
+                                             size_t length, void* userdata) {
+  Stream* const stream(
+      static_cast<Connection*>(userdata)->FindStream(stream_id));
+  if (!stream || stream->too_large) {
+    return 0;
+  }
+
+  if (stream->body.size() + length >
+      static_cast<size_t>(FLAGS_http2_max_request_bytes)) {
+    stream->too_large = true;
+    string().swap(stream->body);
+    return 0;
+  }
+  stream->body.append(reinterpret_cast<const char*>(data), length);
+  return 0;
+}
+
+
+// static
+int Http2Server::Connection::OnFrameRecv(nghttp2_session*,
+                                         const nghttp2_frame* frame,
+                                         void* userdata) {
+  if ((frame->hd.type != NGHTTP2_HEADERS && frame->hd.type != NGHTTP2_DATA) ||
+      !(frame->hd.flags & NGHTTP2_FLAG_END_STREAM)) {
+    return 0;
+  }
+
+  Connection* const conn(static_cast<Connection*>(userdata));
+  Stream* const stream(conn->FindStream(frame->hd.stream_id));
+  if (stream) {
+    conn->Forward(frame->hd.stream_id, stream);
+  }
+  return 0;
+}
+
+
+// static
+int Http2Server::Connection::OnStreamClose(nghttp2_session*,
+                                           int32_t stream_id, uint32_t,
+                                           void* userdata) {
+  static_cast<Connection*>(userdata)->streams_.erase(stream_id);
+  return 0;
+}
+
+
+// static
+ssize_t Http2Server::Connection::ReadResponseBody(
+    nghttp2_session*, int32_t, uint8_t* buf, size_t length,
+    uint32_t* data_flags, nghttp2_data_source* source, void*) {
+  Stream* const stream(static_cast<Stream*>(source->ptr));
+  const string& body(stream->response->body);
+  const size_t count(min(length, body.size() - stream->sent));
+  memcpy(buf, body.data() + stream->sent, count);
+  stream->sent += count;
+  if (stream->sent == body.size()) {
+    *data_flags |= NGHTTP2_DATA_FLAG_EOF;
+  }
+  return count;
+}
+
+
+Http2Server::Connection::Stream* Http2Server::Connection::FindStream(
+    int32_t stream_id) {
+  const auto it(streams_.find(stream_id));
+  return it == streams_.end() ? nullptr : it->second.get();
+}
+
+
+void Http2Server::Connection::Read() {
+  evbuffer* const input(bufferevent_get_input(bev_));
+  const size_t length(evbuffer_get_length(input));
+  const ssize_t consumed(
+      nghttp2_session_mem_recv(session_, evbuffer_pullup(input, -1), length));
+  if (consumed < 0) {
+    VLOG(1) << "HTTP/2 error from " << peer_ << ": "
+            << nghttp2_strerror(consumed);
+    return Close();
+  }
+  CHECK_EQ(evbuffer_drain(input, consumed), 0);
+  Flush();
+}
+
+
+void Http2Server::Connection::Flush() {
+  evbuffer* const output(bufferevent_get_output(bev_));
+  for (;;) {
+    const uint8_t* data;
+    const ssize_t length(nghttp2_session_mem_send(session_, &data));
+    if (length < 0) {
+      LOG(WARNING) << "HTTP/2 error for " << peer_ << ": "
+                   << nghttp2_strerror(length);
+      return Close();
+    }
+    if (length == 0) {
+      break;
+    }
+    CHECK_EQ(evbuffer_add(output, data, length), 0);
+  }
+
+  if (!nghttp2_session_want_read(session_) &&
+      !nghttp2_session_want_write(session_) &&
+      evbuffer_get_length(output) == 0) {
+    Close();
+  }
+}
+
+
+void Http2Server::Connection::Close() {
+  bufferevent_disable(bev_, EV_READ | EV_WRITE);
+  bufferevent_setcb(bev_, nullptr, nullptr, nullptr, nullptr);
+  server_->Closed(this);
+}
+
+
+void Http2Server::Connection::Forward(int32_t stream_id, Stream* stream) {
+  CHECK_NOTNULL(stream);
+  http2_server_streams->Increment();
+
+  UrlFetcher::Request request;
+  if (stream->method == "GET") {
+    request.verb = UrlFetcher::Verb::GET;
+  } else if (stream->method == "POST") {
+    request.verb = UrlFetcher::Verb::POST;
+  } else if (stream->method == "PUT") {
+    request.verb = UrlFetcher::Verb::PUT;
+  } else if (stream->method == "DELETE") {
+    request.verb = UrlFetcher::Verb::DELETE;
+  } else {
+    stream->response->status_code = 405;
+    return Respond(stream_id, stream);
+  }
+  if (stream->path.empty() || stream->path[0] != '/') {
+    stream->response->status_code = 400;
+    return Respond(stream_id, stream);
+  }
+  if (stream->too_large) {
+    stream->response->status_code = 413;
+    return Respond(stream_id, stream);
+  }
+
+  request.url = URL("http://127.0.0.1:" + to_string(server_->backend_port_) +
+                    stream->path);
+  request.headers.swap(stream->headers);
+  if (!stream->authority.empty()) {
+    request.headers.insert(make_pair("Host", stream->authority));
+  }
+  request.headers.insert(make_pair("X-Forwarded-For", peer_));
+  request.body.swap(stream->body);
+
+  const weak_ptr<Connection> weak_conn(shared_from_this());
+  const shared_ptr<UrlFetcher::Response> response(stream->response);
+  server_->fetcher_->Fetch(
+      request, response.get(),
+      new Task(
+          [weak_conn, stream_id, response](Task* task) {
+            const unique_ptr<Task> task_deleter(task);
+            const shared_ptr<Connection> conn(weak_conn.lock());
+            if (conn) {
+              conn->ForwardDone(stream_id, task->status());
+            }
+          },
+          server_->base_));
+}
+
+
+void Http2Server::Connection::ForwardDone(int32_t stream_id,
+                                          const util::Status& status) {
+  Stream* const stream(FindStream(stream_id));
+  if (!stream) {
+    // The client gave up on it.
+    return;
+  }
+
+  if (!status.ok()) {
+    LOG(WARNING) << "forwarding HTTP/2 request for " << stream->path
+                 << " failed: " << status;
+    stream->response->status_code = 502;
+    stream->response->headers.clear();
+    stream->response->body.clear();
+  }
+  Respond(stream_id, stream);
+  Flush();
+}
+
+
+void Http2Server::Connection::Respond(int32_t stream_id, Stream* stream) {
+  const UrlFetcher::Response& response(*stream->response);
+  vector<pair<string, string>> headers;
+  headers.emplace_back(":status", to_string(response.status_code));
+  for (const auto& header : response.headers) {
+    const string name(ToLower(header.first));
+    if (!IsHopByHopHeader(name)) {
+      headers.emplace_back(name, header.second);
+    }
+  }
+  headers.emplace_back("content-length", to_string(response.body.size()));
+
+  vector<nghttp2_nv> nva;
+  for (const auto& header : headers) {
+    nva.push_back(MakeNv(header.first, header.second));
+  }
+
+  nghttp2_data_provider body;
+  body.source.ptr = stream;
+  body.read_callback = &ReadResponseBody;
+  const int ret(nghttp2_submit_response(
+      session_, stream_id, nva.data(), nva.size(),
+      response.body.empty() ? nullptr : &body));
+  if (ret != 0) {
+    LOG(WARNING) << "could not respond to HTTP/2 stream: "
+                 << nghttp2_strerror(ret);
+  }
+}
+
+
+Http2Server::Http2Server(libevent::Base* base, UrlFetcher* fetcher,
+                         uint16_t backend_port)
+    : base_(CHECK_NOTNULL(base)),
+      fetcher_(CHECK_NOTNULL(fetcher)),
+      backend_port_(backend_port),
+      listener_(nullptr, &evconnlistener_free) {
+  CHECK_GT(backend_port_, 0);
+}
+
+
+Http2Server::~Http2Server() {
+  listener_.reset();
+  connections_.clear();
+  http2_server_connections->Set(0);
+}
+
+
+void Http2Server::Bind(const char* address, uint16_t port) {
+  CHECK(!listener_);
+  addrinfo hints;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = AI_PASSIVE;
+  addrinfo* addr;
+  // Same default address as libevent::HttpServer::Bind().
+  const int gai_ret(getaddrinfo(address ? address : "0.0.0.0",
+                                to_string(port).c_str(), &hints, &addr));
+  CHECK_EQ(gai_ret, 0) << gai_strerror(gai_ret);
+  listener_.reset(
+      base_->ListenerNew(addr->ai_addr, addr->ai_addrlen, &Accept, this));
+  freeaddrinfo(addr);
+  CHECK(listener_) << "could not listen for HTTP/2 on port " << port << ": "
+                   << strerror(errno);
+}
+
+
+// static
+void Http2Server::Accept(evconnlistener*, evutil_socket_t sock,
+                         sockaddr* address, int address_len,
+                         void* userdata) {
+  Http2Server* const server(static_cast<Http2Server*>(userdata));
+
+  char host[NI_MAXHOST];
+  if (getnameinfo(address, address_len, host, sizeof(host), nullptr, 0,
+                  NI_NUMERICHOST) != 0) {
+    host[0] = '\0';
+  }
+  // The frames are small and should go out as soon as they are ready.
+  const int on(1);
+  setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+  const shared_ptr<Connection> conn(
+      make_shared<Connection>(server, server->base_->BufferEventNew(sock),
+                              host));
+  server->connections_.insert(make_pair(conn.get(), conn));
+  http2_server_connections->Set(server->connections_.size());
+  conn->Start();
+}
+
+
+void Http2Server::Closed(Connection* conn) {
+  connections_.erase(conn);
+  http2_server_connections->Set(connections_.size());
+}
+
+
+}  // namespace cert_trans
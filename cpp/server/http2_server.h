@@ -0,0 +1,61 @@
+#ifndef CERT_TRANS_SERVER_HTTP2_SERVER_H_
+#define CERT_TRANS_SERVER_HTTP2_SERVER_H_
+
+#include <event2/util.h>
+#include <map>
+#include <memory>
+#include <stdint.h>
+#include <string>
+
+#include "base/macros.h"
+
+struct evconnlistener;
+struct sockaddr;
+
+namespace cert_trans {
+namespace libevent {
+class Base;
+}  // namespace libevent
+
+class UrlFetcher;
+
+
+// Accepts HTTP/2 connections, in cleartext with prior knowledge
+// ("h2c", as used behind a TLS-terminating load balancer), and
+// forwards each of their streams as an HTTP/1.1 request to the HTTP
+// server on |backend_port| of this host, so that they are answered by
+// the same handlers. Clients can then multiplex all their requests
+// over a single connection. The requests are forwarded with the
+// address of the client in their X-Forwarded-For header.
+class Http2Server {
+ public:
+  // Does not take ownership of its parameters, which must outlive
+  // this instance. The connections are handled on the event loop of
+  // |base|, until this instance is destroyed.
+  Http2Server(libevent::Base* base, UrlFetcher* fetcher,
+              uint16_t backend_port);
+  ~Http2Server();
+
+  void Bind(const char* address, uint16_t port);
+
+ private:
+  class Connection;
+
+  static void Accept(evconnlistener* listener, evutil_socket_t sock,
+                     sockaddr* address, int address_len, void* userdata);
+  void Closed(Connection* conn);
+
+  libevent::Base* const base_;
+  UrlFetcher* const fetcher_;
+  const uint16_t backend_port_;
+  std::unique_ptr<evconnlistener, void (*)(evconnlistener*)> listener_;
+  // Only used on the event loop of |base_|.
+  std::map<Connection*, std::shared_ptr<Connection>> connections_;
+
+  DISALLOW_COPY_AND_ASSIGN(Http2Server);
+};
+
+
+}  // namespace cert_trans
+
+#endif  // CERT_TRANS_SERVER_HTTP2_SERVER_H_
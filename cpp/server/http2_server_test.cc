@@ -0,0 +1,273 @@
+#include "server/http2_server.h"
+
+#include <arpa/inet.h>
+#include <glog/logging.h>
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include <map>
+#include <memory>
+#include <netinet/in.h>
+#include <nghttp2/nghttp2.h>
+#include <string.h>
+#include <string>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <vector>
+
+#include "net/mock_url_fetcher.h"
+#include "util/libevent_wrapper.h"
+#include "util/testing.h"
+
+namespace cert_trans {
+namespace {
+
+using std::make_pair;
+using std::make_shared;
+using std::map;
+using std::shared_ptr;
+using std::string;
+using std::to_string;
+using std::vector;
+using testing::_;
+using testing::AllOf;
+using testing::Contains;
+using testing::Invoke;
+using testing::Pair;
+using util::Task;
+
+const uint16_t kBackendPort = 8080;
+
+
+// Returns a port that nothing listens on, as far as we can tell.
+uint16_t UnusedPort() {
+  const int sock(socket(AF_INET, SOCK_STREAM, 0));
+  CHECK_GE(sock, 0);
+  sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  CHECK_EQ(bind(sock, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)), 0);
+  socklen_t len(sizeof(addr));
+  CHECK_EQ(getsockname(sock, reinterpret_cast<sockaddr*>(&addr), &len), 0);
+  close(sock);
+  return ntohs(addr.sin_port);
+}
+
+
+// A blocking HTTP/2 client, in cleartext with prior knowledge.
+class Http2Client {
+ public:
+  struct Response {
+    Response() : status(0) {
+    }
+
+    int status;
+    string body;
+  };
+
+  explicit Http2Client(uint16_t port)
+      : sock_(socket(AF_INET, SOCK_STREAM, 0)) {
+    CHECK_GE(sock_, 0);
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    CHECK_EQ(connect(sock_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)),
+             0);
+
+    nghttp2_session_callbacks* callbacks;
+    CHECK_EQ(nghttp2_session_callbacks_new(&callbacks), 0);
+    nghttp2_session_callbacks_set_on_header_callback(callbacks, &OnHeader);
+    nghttp2_session_callbacks_set_on_data_chunk_recv_callback(
+        callbacks, &OnDataChunkRecv);
+    nghttp2_session_callbacks_set_on_stream_close_callback(callbacks,
+                                                           &OnStreamClose);
+    CHECK_EQ(nghttp2_session_client_new(&session_, callbacks, this), 0);
+    nghttp2_session_callbacks_del(callbacks);
+    CHECK_EQ(nghttp2_submit_settings(session_, NGHTTP2_FLAG_NONE, nullptr, 0),
+             0);
+  }
+
+  ~Http2Client() {
+    nghttp2_session_del(session_);
+    close(sock_);
+  }
+
+  // Returns the ID of the stream of the request.
+  int32_t Submit(const string& method, const string& path) {
+    const string scheme("http");
+    const string authority("ct.example.com");
+    const vector<nghttp2_nv> nva{Nv(":method", method), Nv(":path", path),
+                                 Nv(":scheme", scheme),
+                                 Nv(":authority", authority)};
+    const int32_t stream_id(nghttp2_submit_request(
+        session_, nullptr, nva.data(), nva.size(), nullptr, nullptr));
+    CHECK_GT(stream_id, 0);
+    responses_[stream_id];
+    ++open_streams_;
+    return stream_id;
+  }
+
+  // Runs the session until all the requests are answered.
+  void Wait() {
+    while (open_streams_ > 0) {
+      const uint8_t* data;
+      ssize_t length;
+      while ((length = nghttp2_session_mem_send(session_, &data)) > 0) {
+        CHECK_EQ(write(sock_, data, length), length);
+      }
+      CHECK_EQ(length, 0);
+
+      uint8_t buf[4096];
+      const ssize_t got(read(sock_, buf, sizeof(buf)));
+      CHECK_GT(got, 0);
+      CHECK_EQ(nghttp2_session_mem_recv(session_, buf, got), got);
+    }
+  }
+
+  map<int32_t, Response> responses_;
+
+ private:
+  static nghttp2_nv Nv(const char* name, const string& value) {
+    nghttp2_nv nv;
+    nv.name = reinterpret_cast<uint8_t*>(const_cast<char*>(name));
+    nv.value = reinterpret_cast<uint8_t*>(const_cast<char*>(value.data()));
+    nv.namelen = strlen(name);
+    nv.valuelen = value.size();
+    nv.flags = NGHTTP2_NV_FLAG_NONE;
+    return nv;
+  }
+
+  static int OnHeader(nghttp2_session*, const nghttp2_frame* frame,
+                      const uint8_t* name, size_t namelen,
+                      const uint8_t* value, size_t valuelen, uint8_t,
+                      void* userdata) {
+    if (string(reinterpret_cast<const char*>(name), namelen) == ":status") {
+      static_cast<Http2Client*>(userdata)
+          ->responses_[frame->hd.stream_id]
+          .status =
+          stoi(string(reinterpret_cast<const char*>(value), valuelen));
+    }
+    return 0;
+  }
+
+  static int OnDataChunkRecv(nghttp2_session*, uint8_t, int32_t stream_id,
+                             const uint8_t* data, size_t length,
+                             void* userdata) {
+    static_cast<Http2Client*>(userdata)->responses_[stream_id].body.append(
+        reinterpret_cast<const char*>(data), length);
+    return 0;
+  }
+
+  static int OnStreamClose(nghttp2_session*, int32_t, uint32_t,
+                           void* userdata) {
+    --static_cast<Http2Client*>(userdata)->open_streams_;
+    return 0;
+  }
+
+  const int sock_;
+  nghttp2_session* session_;
+  int open_streams_ = 0;
+};
+
+
+void HandleFetch(int status, const string& body, const UrlFetcher::Request&,
+                 UrlFetcher::Response* resp, Task* task) {
+  resp->status_code = status;
+  resp->headers.insert(make_pair("Content-Type", "application/json"));
+  resp->headers.insert(make_pair("Connection", "keep-alive"));
+  resp->body = body;
+  task->Return();
+}
+
+
+class Http2ServerTest : public ::testing::Test {
+ protected:
+  Http2ServerTest()
+      : base_(make_shared<libevent::Base>()),
+        port_(UnusedPort()),
+        server_(base_.get(), &fetcher_, kBackendPort),
+        event_pump_(base_) {
+    server_.Bind("127.0.0.1", port_);
+  }
+
+  URL BackendURL(const string& path_query) {
+    return URL("http://127.0.0.1:" + to_string(kBackendPort) + path_query);
+  }
+
+  shared_ptr<libevent::Base> base_;
+  const uint16_t port_;
+  MockUrlFetcher fetcher_;
+  Http2Server server_;
+  libevent::EventPumpThread event_pump_;
+};
+
+
+TEST_F(Http2ServerTest, ForwardsRequest) {
+  EXPECT_CALL(fetcher_,
+              Fetch(IsUrlFetchRequest(
+                        UrlFetcher::Verb::GET,
+                        BackendURL("/ct/v1/get-entries?start=0&end=1"),
+                        AllOf(Contains(Pair("X-Forwarded-For", "127.0.0.1")),
+                              Contains(Pair("Host", "ct.example.com"))),
+                        ""),
+                    _, _))
+      .WillOnce(Invoke(std::bind(&HandleFetch, 200, "{\"entries\":[]}",
+                                 std::placeholders::_1, std::placeholders::_2,
+                                 std::placeholders::_3)));
+
+  Http2Client client(port_);
+  const int32_t stream_id(
+      client.Submit("GET", "/ct/v1/get-entries?start=0&end=1"));
+  client.Wait();
+  EXPECT_EQ(200, client.responses_[stream_id].status);
+  EXPECT_EQ("{\"entries\":[]}", client.responses_[stream_id].body);
+}
+
+
+TEST_F(Http2ServerTest, MultiplexesRequests) {
+  EXPECT_CALL(fetcher_, Fetch(IsUrlFetchRequest(UrlFetcher::Verb::GET,
+                                                BackendURL("/ct/v1/get-sth"),
+                                                _, ""),
+                              _, _))
+      .WillOnce(Invoke(std::bind(&HandleFetch, 200, "sth",
+                                 std::placeholders::_1, std::placeholders::_2,
+                                 std::placeholders::_3)));
+  EXPECT_CALL(fetcher_, Fetch(IsUrlFetchRequest(UrlFetcher::Verb::GET,
+                                                BackendURL("/ct/v1/get-roots"),
+                                                _, ""),
+                              _, _))
+      .WillOnce(Invoke(std::bind(&HandleFetch, 404, "",
+                                 std::placeholders::_1, std::placeholders::_2,
+                                 std::placeholders::_3)));
+
+  Http2Client client(port_);
+  const int32_t sth_id(client.Submit("GET", "/ct/v1/get-sth"));
+  const int32_t roots_id(client.Submit("GET", "/ct/v1/get-roots"));
+  client.Wait();
+  EXPECT_EQ(200, client.responses_[sth_id].status);
+  EXPECT_EQ("sth", client.responses_[sth_id].body);
+  EXPECT_EQ(404, client.responses_[roots_id].status);
+  EXPECT_EQ("", client.responses_[roots_id].body);
+}
+
+
+TEST_F(Http2ServerTest, RejectsUnsupportedMethod) {
+  EXPECT_CALL(fetcher_, Fetch(_, _, _)).Times(0);
+
+  Http2Client client(port_);
+  const int32_t stream_id(client.Submit("HEAD", "/ct/v1/get-sth"));
+  client.Wait();
+  EXPECT_EQ(405, client.responses_[stream_id].status);
+}
+
+
+}  // namespace
+}  // namespace cert_trans
+
+
+int main(int argc, char** argv) {
+  cert_trans::test::InitTesting(argv[0], &argc, &argv, true);
+  return RUN_ALL_TESTS();
+}
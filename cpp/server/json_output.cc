@@ -1,14 +1,30 @@
 #include "server/json_output.h"
 
+#include <atomic>
+#include <event2/buffer.h>
+#include <event2/bufferevent_ssl.h>
+#include <event2/http.h>
 #include <glog/logging.h>
+#include <memory>
+#include <mutex>
+#include <string.h>
 #include <string>
+#include <unistd.h>
+#include <zlib.h>
 
 #include "monitoring/monitoring.h"
 #include "monitoring/latency.h"
+#include "util/base64.h"
 #include "util/json_wrapper.h"
 #include "util/libevent_wrapper.h"
 
+using std::atomic;
+using std::function;
+using std::lock_guard;
+using std::mutex;
+using std::shared_ptr;
 using std::string;
+using std::unique_ptr;
 
 namespace cert_trans {
 namespace {
@@ -26,54 +42,219 @@ static Counter<string, int>* total_http_server_response_codes(
 
 static const char kJsonContentType[] = "application/json; charset=utf-8";
 
+const int kMinResponseCode = 100;
+const int kMaxResponseCode = 599;
 
-string LogRequest(evhttp_request* req, int http_status, int resp_body_length) {
-  evhttp_connection* conn = evhttp_request_get_connection(req);
-  char* peer_addr;
-  ev_uint16_t peer_port;
-  evhttp_connection_get_peer(conn, &peer_addr, &peer_port);
 
-  string http_verb;
+// The counter cells for a path given to JsonOutput::RegisterPath().
+struct RegisteredPath {
+  string path;
+  LabelledValueCell* requests = nullptr;
+  // Indexed by response code, minus kMinResponseCode, and filled in
+  // as the codes are first sent.
+  atomic<LabelledValueCell*> response_codes[kMaxResponseCode -
+                                            kMinResponseCode + 1] = {};
+};
+
+
+// Entries are only ever added, and are complete before
+// |num_registered_paths| is incremented to include them, so that they
+// can be read without a lock.
+RegisteredPath registered_paths[JsonOutput::kMaxRegisteredPaths];
+atomic<int> num_registered_paths(0);
+mutex registered_paths_lock;
+
+
+RegisteredPath* FindRegisteredPath(const char* path) {
+  const int num_paths(num_registered_paths.load(std::memory_order_acquire));
+  for (int i = 0; i < num_paths; ++i) {
+    if (strcmp(registered_paths[i].path.c_str(), path) == 0) {
+      return &registered_paths[i];
+    }
+  }
+  return nullptr;
+}
+
+
+void CountResponse(const char* path, int http_status) {
+  RegisteredPath* const registered(FindRegisteredPath(path));
+  if (!registered || http_status < kMinResponseCode ||
+      http_status > kMaxResponseCode) {
+    total_http_server_requests->Increment(path);
+    total_http_server_response_codes->Increment(path, http_status);
+    return;
+  }
+
+  registered->requests->Increment();
+  atomic<LabelledValueCell*>& code(
+      registered->response_codes[http_status - kMinResponseCode]);
+  LabelledValueCell* cell(code.load(std::memory_order_acquire));
+  if (!cell) {
+    // Racing threads get the same cell.
+    cell = total_http_server_response_codes->GetCell(registered->path,
+                                                     http_status);
+    code.store(cell, std::memory_order_release);
+  }
+  cell->Increment();
+}
+
+
+const char* HttpVerb(evhttp_request* req) {
   switch (evhttp_request_get_command(req)) {
     case EVHTTP_REQ_DELETE:
-      http_verb = "DELETE";
-      break;
+      return "DELETE";
     case EVHTTP_REQ_GET:
-      http_verb = "GET";
-      break;
+      return "GET";
     case EVHTTP_REQ_HEAD:
-      http_verb = "HEAD";
-      break;
+      return "HEAD";
     case EVHTTP_REQ_POST:
-      http_verb = "POST";
-      break;
+      return "POST";
     case EVHTTP_REQ_PUT:
-      http_verb = "PUT";
-      break;
+      return "PUT";
     default:
-      http_verb = "UNKNOWN";
-      break;
+      return "UNKNOWN";
   }
+}
+
 
-  const string path(evhttp_uri_get_path(evhttp_request_get_evhttp_uri(req)));
-  total_http_server_requests->Increment(path);
-  total_http_server_response_codes->Increment(path, http_status);
+// Counts the response, and returns the line to log for it, which is
+// only built if VLOG(1) is on, as it is for every response.
+string LogRequest(evhttp_request* req, int http_status, int resp_body_length) {
+  CountResponse(evhttp_uri_get_path(evhttp_request_get_evhttp_uri(req)),
+                http_status);
 
-  const string uri(evhttp_request_get_uri(req));
-  return string(peer_addr) + " \"" + http_verb + " " + uri + "\" " +
-         std::to_string(http_status) + " " + std::to_string(resp_body_length);
+  if (!VLOG_IS_ON(1)) {
+    return string();
+  }
+
+  evhttp_connection* conn = evhttp_request_get_connection(req);
+  char* peer_addr;
+  ev_uint16_t peer_port;
+  evhttp_connection_get_peer(conn, &peer_addr, &peer_port);
+
+  return string(peer_addr) + " \"" + HttpVerb(req) + " " +
+         evhttp_request_get_uri(req) + "\" " + std::to_string(http_status) +
+         " " + std::to_string(resp_body_length);
+}
+
+
+void ReleaseBody(const void* /*data*/, size_t /*length*/, void* body) {
+  delete static_cast<shared_ptr<const string>*>(body);
+}
+
+
+// Whether the reply to |req| is written as is to its socket, rather
+// than, say, encrypted by a TLS bufferevent, which needs the bytes in
+// memory.
+bool WritesToSocket(evhttp_request* req) {
+#ifdef HAVE_EVBUFFER_FILE_SEGMENT_NEW
+  evhttp_connection* const conn(evhttp_request_get_connection(req));
+  return conn &&
+         !bufferevent_openssl_get_ssl(evhttp_connection_get_bufferevent(conn));
+#else
+  // Only libevent 2.1 lets the HTTP server speak TLS.
+  return true;
+#endif
 }
 
 
 }  // namespace
 
 
-JsonOutput::JsonOutput(libevent::Base* base) : base_(CHECK_NOTNULL(base)) {
+// static
+void JsonOutput::RegisterPath(const string& path) {
+  lock_guard<mutex> lock(registered_paths_lock);
+  const int num_paths(num_registered_paths.load(std::memory_order_relaxed));
+  for (int i = 0; i < num_paths; ++i) {
+    if (registered_paths[i].path == path) {
+      return;
+    }
+  }
+  if (num_paths >= kMaxRegisteredPaths) {
+    LOG(WARNING) << "too many registered paths, not registering " << path;
+    return;
+  }
+
+  RegisteredPath* const registered(&registered_paths[num_paths]);
+  registered->path = path;
+  registered->requests = total_http_server_requests->GetCell(path);
+  num_registered_paths.store(num_paths + 1, std::memory_order_release);
+}
+
+
+string Gzip(const string& data) {
+  z_stream stream;
+  memset(&stream, 0, sizeof(stream));
+  // The window bits, plus 16 for a gzip header rather than a zlib one.
+  CHECK_EQ(Z_OK, deflateInit2(&stream, Z_BEST_COMPRESSION, Z_DEFLATED,
+                              15 + 16, 8, Z_DEFAULT_STRATEGY));
+  string compressed(deflateBound(&stream, data.size()), '\0');
+  stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+  stream.avail_in = data.size();
+  stream.next_out = reinterpret_cast<Bytef*>(&compressed[0]);
+  stream.avail_out = compressed.size();
+  CHECK_EQ(Z_STREAM_END, deflate(&stream, Z_FINISH));
+  compressed.resize(stream.total_out);
+  CHECK_EQ(Z_OK, deflateEnd(&stream));
+  return compressed;
 }
 
 
 void JsonOutput::SendJsonReply(evhttp_request* req, int http_status,
                                const JsonObject& json) {
+  // Copied once, straight from the buffer json-c serialized it into,
+  // which it keeps with the object.
+  const char* const body(json.ToString());
+  const size_t length(strlen(body));
+  CHECK_EQ(evbuffer_add(evhttp_request_get_output_buffer(req), body, length),
+           0);
+
+  SendReply(req, http_status, length);
+}
+
+
+void JsonOutput::SendJsonReply(evhttp_request* req, int http_status,
+                               const string& body) {
+  CHECK_EQ(evbuffer_add(evhttp_request_get_output_buffer(req), body.data(),
+                        body.size()),
+           0);
+
+  SendReply(req, http_status, body.size());
+}
+
+
+void JsonOutput::SendJsonReply(evhttp_request* req, int http_status,
+                               const shared_ptr<const string>& body) {
+  // The output buffer keeps its own reference to the body until it
+  // is done with it.
+  CHECK_EQ(evbuffer_add_reference(evhttp_request_get_output_buffer(req),
+                                  body->data(), body->size(), &ReleaseBody,
+                                  new shared_ptr<const string>(body)),
+           0);
+
+  SendReply(req, http_status, body->size());
+}
+
+
+// static
+bool JsonOutput::AcceptsGzip(evhttp_request* req) {
+  const char* const accept_encoding(evhttp_find_header(
+      evhttp_request_get_input_headers(req), "Accept-Encoding"));
+  return accept_encoding && strstr(accept_encoding, "gzip") != nullptr;
+}
+
+
+void JsonOutput::SendGzippedJsonReply(evhttp_request* req, int http_status,
+                                      const shared_ptr<const string>& body) {
+  CHECK_EQ(evhttp_add_header(evhttp_request_get_output_headers(req),
+                             "Content-Encoding", "gzip"),
+           0);
+  SendJsonReply(req, http_status, body);
+}
+
+
+void JsonOutput::SendReply(evhttp_request* req, int http_status,
+                           size_t body_length) {
   CHECK_EQ(evhttp_add_header(evhttp_request_get_output_headers(req),
                              "Content-Type", kJsonContentType),
            0);
@@ -82,20 +263,19 @@ void JsonOutput::SendJsonReply(evhttp_request* req, int http_status,
                                "Retry-After", "10"),
              0);
   }
-  const string resp_body(json.ToString());
-  CHECK_GT(evbuffer_add_printf(evhttp_request_get_output_buffer(req), "%s",
-                               resp_body.c_str()),
-           0);
 
-  const string logstr(LogRequest(req, http_status, resp_body.size()));
+  const string logstr(LogRequest(req, http_status, body_length));
   const auto send_reply([req, http_status, logstr]() {
     evhttp_send_reply(req, http_status, /*reason*/ NULL, /*databuf*/ NULL);
 
     VLOG(1) << logstr;
   });
 
-  if (!libevent::Base::OnEventThread()) {
-    base_->Add(send_reply);
+  // Requests can only be used on the thread of the event loop they
+  // came in on.
+  libevent::Base* const base(libevent::Base::ForRequest(req));
+  if (!base->OnThisEventThread()) {
+    base->Add(send_reply);
   } else {
     send_reply();
   }
@@ -112,4 +292,158 @@ void JsonOutput::SendError(evhttp_request* req, int http_status,
 }
 
 
+unique_ptr<ChunkedJsonReply> JsonOutput::StartChunkedJsonReply(
+    evhttp_request* req, int http_status) {
+  return StartChunkedReply(req, http_status, kJsonContentType);
+}
+
+
+unique_ptr<ChunkedJsonReply> JsonOutput::StartChunkedReply(
+    evhttp_request* req, int http_status, const string& content_type) {
+  return unique_ptr<ChunkedJsonReply>(
+      new ChunkedJsonReply(req, http_status, content_type));
+}
+
+
+ChunkedJsonReply::ChunkedJsonReply(evhttp_request* req, int http_status,
+                                   const string& content_type)
+    : base_(libevent::Base::ForRequest(CHECK_NOTNULL(req))),
+      req_(req),
+      http_status_(http_status),
+      flow_(std::make_shared<libevent::ReplyFlowControl>()),
+      sendfile_(WritesToSocket(req)),
+      chunk_(NewChunk()),
+      body_length_(0),
+      abandoned_(false) {
+  CHECK_EQ(evhttp_add_header(evhttp_request_get_output_headers(req_),
+                             "Content-Type", content_type.c_str()),
+           0);
+  const shared_ptr<libevent::ReplyFlowControl> flow(flow_);
+  RunOnEventThread([req, http_status, flow]() {
+    evhttp_send_reply_start(req, http_status, /*reason*/ NULL);
+    flow->Watch(req);
+  });
+}
+
+
+ChunkedJsonReply::~ChunkedJsonReply() {
+  if (chunk_) {
+    End();
+  }
+}
+
+
+void ChunkedJsonReply::Append(const string& json) {
+  CHECK_NOTNULL(chunk_);
+  CHECK_EQ(evbuffer_add(chunk_, json.data(), json.size()), 0);
+}
+
+
+void ChunkedJsonReply::AppendBase64String(const string& data) {
+  CHECK_NOTNULL(chunk_);
+  const size_t length(util::Base64EncodedLength(data.size()));
+  evbuffer_iovec space;
+  CHECK_EQ(evbuffer_reserve_space(chunk_, length + 2, &space, 1), 1);
+  char* const out(static_cast<char*>(space.iov_base));
+  out[0] = '"';
+  util::Base64Encode(data.data(), data.size(), out + 1);
+  out[length + 1] = '"';
+  space.iov_len = length + 2;
+  CHECK_EQ(evbuffer_commit_space(chunk_, &space, 1), 0);
+}
+
+
+void ChunkedJsonReply::AppendFileRange(int fd, off_t offset, size_t length) {
+  CHECK_NOTNULL(chunk_);
+  if (length == 0) {
+    return;
+  }
+#ifdef HAVE_EVBUFFER_FILE_SEGMENT_NEW
+  // Without EVBUF_FS_CLOSE_ON_FREE, |fd| is left open. The segment is
+  // only read into memory if |chunk_| is not marked as being written
+  // to a socket.
+  evbuffer_file_segment* const segment(
+      CHECK_NOTNULL(evbuffer_file_segment_new(fd, offset, length, 0)));
+  CHECK_EQ(evbuffer_add_file_segment(chunk_, segment, 0, length), 0);
+  // |chunk_| holds its own reference.
+  evbuffer_file_segment_free(segment);
+#else
+  // The buffer closes the file descriptor it is given.
+  const int dup_fd(dup(fd));
+  PCHECK(dup_fd >= 0) << "dup";
+  CHECK_EQ(evbuffer_add_file(chunk_, dup_fd, offset, length), 0);
+#endif
+}
+
+
+size_t ChunkedJsonReply::BufferedLength() const {
+  CHECK_NOTNULL(chunk_);
+  return evbuffer_get_length(chunk_);
+}
+
+
+bool ChunkedJsonReply::Flush() {
+  CHECK_NOTNULL(chunk_);
+  const size_t length(evbuffer_get_length(chunk_));
+  if (length == 0) {
+    return !abandoned_;
+  }
+  // The event loop cannot wait for itself.
+  if (!abandoned_ && !base_->OnThisEventThread() && !flow_->WaitForSpace()) {
+    abandoned_ = true;
+  }
+  if (abandoned_) {
+    CHECK_EQ(evbuffer_drain(chunk_, length), 0);
+    return false;
+  }
+
+  body_length_ += length;
+  flow_->Queued(length);
+  evhttp_request* const req(req_);
+  evbuffer* const chunk(chunk_);
+  const shared_ptr<libevent::ReplyFlowControl> flow(flow_);
+  RunOnEventThread([req, chunk, flow]() { flow->SendChunk(req, chunk); });
+  chunk_ = NewChunk();
+  return true;
+}
+
+
+void ChunkedJsonReply::End() {
+  Flush();
+  evbuffer_free(chunk_);
+  chunk_ = NULL;
+
+  evhttp_request* const req(req_);
+  const string logstr(LogRequest(req_, http_status_, body_length_));
+  const shared_ptr<libevent::ReplyFlowControl> flow(flow_);
+  RunOnEventThread([req, logstr, flow]() {
+    if (!flow->EndReply(req)) {
+      evhttp_send_reply_end(req);
+    }
+
+    VLOG(1) << logstr;
+  });
+}
+
+
+evbuffer* ChunkedJsonReply::NewChunk() const {
+  evbuffer* const chunk(CHECK_NOTNULL(evbuffer_new()));
+#ifdef HAVE_EVBUFFER_FILE_SEGMENT_NEW
+  if (sendfile_) {
+    CHECK_EQ(evbuffer_set_flags(chunk, EVBUFFER_FLAG_DRAINS_TO_FD), 0);
+  }
+#endif
+  return chunk;
+}
+
+
+void ChunkedJsonReply::RunOnEventThread(const function<void()>& closure) const {
+  if (!base_->OnThisEventThread()) {
+    base_->Add(closure);
+  } else {
+    closure();
+  }
+}
+
+
 }  // namespace cert_trans
@@ -1,37 +1,154 @@
 #ifndef CERT_TRANS_SERVER_JSON_OUTPUT_H_
 #define CERT_TRANS_SERVER_JSON_OUTPUT_H_
 
+#include <functional>
+#include <memory>
 #include <string>
+#include <sys/types.h>
 
 #include "base/macros.h"
 
+struct evbuffer;
 struct evhttp_request;
 class JsonObject;
 
 namespace cert_trans {
 namespace libevent {
 class Base;
+class ReplyFlowControl;
 }  // namespace libevent
 
+class ChunkedJsonReply;
+
+
+// Returns |data| compressed in the gzip format.
+std::string Gzip(const std::string& data);
+
 
 class JsonOutput {
  public:
-  JsonOutput(libevent::Base* base);
+  static const int kMaxRegisteredPaths = 32;
+
+  JsonOutput() = default;
 
   void SendJsonReply(evhttp_request* req, int http_status,
                      const JsonObject& json);
 
+  // Sends an already serialized JSON body, copied into the reply.
+  void SendJsonReply(evhttp_request* req, int http_status,
+                     const std::string& body);
+
+  // Sends an already serialized JSON body. The reply references
+  // |body| instead of copying it, so that a response rendered once
+  // can be sent to many requests.
+  void SendJsonReply(evhttp_request* req, int http_status,
+                     const std::shared_ptr<const std::string>& body);
+
+  // Looks up the request and response code counters for |path| once,
+  // so that replies to requests for it are counted without building
+  // a string or walking the counters, as the others are. Can be
+  // called from any thread, but at most kMaxRegisteredPaths paths are
+  // registered this way.
+  static void RegisterPath(const std::string& path);
+
+  // Returns whether the client of |req| accepts gzipped replies.
+  static bool AcceptsGzip(evhttp_request* req);
+
+  // Same as SendJsonReply(), for a body compressed with Gzip(), for a
+  // request that AcceptsGzip().
+  void SendGzippedJsonReply(evhttp_request* req, int http_status,
+                            const std::shared_ptr<const std::string>& body);
 
   void SendError(evhttp_request* req, int http_status,
                  const std::string& error_msg);
 
+  // Starts a reply whose JSON body is written and sent a piece at a
+  // time.
+  std::unique_ptr<ChunkedJsonReply> StartChunkedJsonReply(
+      evhttp_request* req, int http_status);
+
+  // Same, for a body that is not JSON, of type |content_type|.
+  std::unique_ptr<ChunkedJsonReply> StartChunkedReply(
+      evhttp_request* req, int http_status, const std::string& content_type);
+
  private:
-  libevent::Base* const base_;
+  // Sends the reply once its body is in the output buffer.
+  void SendReply(evhttp_request* req, int http_status, size_t body_length);
 
   DISALLOW_COPY_AND_ASSIGN(JsonOutput);
 };
 
 
+// A reply body sent with chunked transfer encoding, for replies too
+// large to build in memory all at once. The JSON text is written
+// straight into the buffer of the current chunk, which is sent when
+// Flush() is called. Not thread-safe, but can be used from any one
+// thread.
+//
+// When used from a thread other than the event loop of the request,
+// Flush() waits for the client to read enough of what was sent
+// before, as per libevent::ReplyFlowControl.
+class ChunkedJsonReply {
+ public:
+  // Ends the reply, if End() was not called.
+  ~ChunkedJsonReply();
+
+  // Appends JSON text, or the bytes of a non-JSON body, as is.
+  void Append(const std::string& json);
+
+  // Appends |data| base64-encoded, as a JSON string.
+  void AppendBase64String(const std::string& data);
+
+  // Appends |length| bytes of the file |fd| from |offset|, which are
+  // not read here but sent straight from the file, with sendfile()
+  // unless the connection is TLS. |fd| must stay open until the reply
+  // is done.
+  void AppendFileRange(int fd, off_t offset, size_t length);
+
+  // The number of bytes appended since the last Flush().
+  size_t BufferedLength() const;
+
+  // Sends what was appended so far. Returns false, dropping it, if
+  // the client went away or was too slow, in which case the rest of
+  // the reply need not be generated.
+  bool Flush();
+
+  // Whether Flush() returned false. The reply can still be ended.
+  bool abandoned() const {
+    return abandoned_;
+  }
+
+  // Flushes and ends the reply. Nothing can be appended after this.
+  void End();
+
+ private:
+  friend class JsonOutput;
+
+  ChunkedJsonReply(evhttp_request* req, int http_status,
+                   const std::string& content_type);
+
+  // Runs |closure| on the thread of the event loop |req_| was
+  // received on, which is the only one that can use it.
+  void RunOnEventThread(const std::function<void()>& closure) const;
+
+  // A buffer for the next chunk.
+  evbuffer* NewChunk() const;
+
+  libevent::Base* const base_;
+  evhttp_request* const req_;
+  const int http_status_;
+  const std::shared_ptr<libevent::ReplyFlowControl> flow_;
+  // Whether the chunks are written straight to the socket, so that the
+  // file ranges appended to them can be sent with sendfile().
+  const bool sendfile_;
+  evbuffer* chunk_;
+  size_t body_length_;
+  bool abandoned_;
+
+  DISALLOW_COPY_AND_ASSIGN(ChunkedJsonReply);
+};
+
+
 }  // namespace cert_trans
 
 
@@ -3,11 +3,15 @@
 #include <cstring>
 #include <event2/buffer.h>
 #include <event2/http.h>
-#include <sstream>
+#include <glog/logging.h>
+#include <ostream>
+#include <streambuf>
 
+#include "base/macros.h"
 #include "monitoring/prometheus/exporter.h"
+#include "util/trace.h"
 
-using std::ostringstream;
+using std::ostream;
 using std::strncmp;
 
 namespace cert_trans {
@@ -18,6 +22,44 @@ const char kPrometheusProtoContentType[] =
     "proto=io.prometheus.client.MetricFamily;encoding=delimited";
 const size_t kPrometheusProtoContentTypeLen =
     std::strlen(kPrometheusProtoContentType);
+const char kPrometheusTextContentType[] = "text/plain; version=0.0.4";
+
+
+// Appends what is written to it to an evbuffer, so that replies are
+// not built up in a string and then copied.
+class EvbufferStreambuf : public std::streambuf {
+ public:
+  explicit EvbufferStreambuf(evbuffer* buf) : buf_(CHECK_NOTNULL(buf)) {
+    setp(chunk_, chunk_ + sizeof(chunk_));
+  }
+
+  ~EvbufferStreambuf() {
+    sync();
+  }
+
+ protected:
+  int_type overflow(int_type c) override {
+    sync();
+    if (!traits_type::eq_int_type(c, traits_type::eof())) {
+      *pptr() = traits_type::to_char_type(c);
+      pbump(1);
+    }
+    return traits_type::not_eof(c);
+  }
+
+  int sync() override {
+    CHECK_EQ(0, evbuffer_add(buf_, pbase(), pptr() - pbase()));
+    setp(chunk_, chunk_ + sizeof(chunk_));
+    return 0;
+  }
+
+ private:
+  evbuffer* const buf_;
+  char chunk_[4096];
+
+  DISALLOW_COPY_AND_ASSIGN(EvbufferStreambuf);
+};
+
 
 }  // namespace
 
@@ -28,7 +70,8 @@ void ExportPrometheusMetrics(evhttp_request* req) {
                       /*databuf*/ nullptr);
     return;
   }
-  ostringstream oss;
+  EvbufferStreambuf buf(evhttp_request_get_output_buffer(req));
+  ostream os(&buf);
   const char* req_accept(
       evhttp_find_header(evhttp_request_get_input_headers(req), "Accept"));
   if (req_accept &&
@@ -36,15 +79,35 @@ void ExportPrometheusMetrics(evhttp_request* req) {
                    kPrometheusProtoContentTypeLen) == 0) {
     evhttp_add_header(evhttp_request_get_output_headers(req), "Content-Type",
                       kPrometheusProtoContentType);
-    ExportMetricsToPrometheus(&oss);
+    ExportMetricsToPrometheus(&os);
+  } else if (req_accept && std::strstr(req_accept, "text/plain")) {
+    // What Prometheus servers ask for, when they do not want protobufs.
+    evhttp_add_header(evhttp_request_get_output_headers(req), "Content-Type",
+                      kPrometheusTextContentType);
+    ExportMetricsToPrometheusText(&os);
   } else {
     evhttp_add_header(evhttp_request_get_output_headers(req), "Content-Type",
                       "text/html");
-    ExportMetricsToHtml(&oss);
+    ExportMetricsToHtml(&os);
   }
 
-  evbuffer_add(evhttp_request_get_output_buffer(req), oss.str().data(),
-               oss.str().size());
+  os.flush();
+  evhttp_send_reply(req, HTTP_OK, /*reason*/ nullptr, /*databuf*/ nullptr);
+}
+
+
+void ExportTraceEvents(evhttp_request* req) {
+  if (evhttp_request_get_command(req) != EVHTTP_REQ_GET) {
+    evhttp_send_reply(req, HTTP_BADMETHOD, /*reason*/ nullptr,
+                      /*databuf*/ nullptr);
+    return;
+  }
+  evhttp_add_header(evhttp_request_get_output_headers(req), "Content-Type",
+                    "application/json");
+  EvbufferStreambuf buf(evhttp_request_get_output_buffer(req));
+  ostream os(&buf);
+  util::ExportTraces(&os);
+  os.flush();
   evhttp_send_reply(req, HTTP_OK, /*reason*/ nullptr, /*databuf*/ nullptr);
 }
 
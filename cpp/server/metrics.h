@@ -8,6 +8,10 @@ namespace cert_trans {
 
 void ExportPrometheusMetrics(evhttp_request* req);
 
+// Replies with the recently recorded trace spans, which can be loaded
+// in chrome://tracing.
+void ExportTraceEvents(evhttp_request* req);
+
 
 }  // namespace cert_trans
 
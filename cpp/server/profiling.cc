@@ -0,0 +1,302 @@
+#include "config.h"
+#include "server/profiling.h"
+
+#include <chrono>
+#include <ctime>
+#include <event2/buffer.h>
+#include <event2/http.h>
+#include <event2/keyvalq_struct.h>
+#include <fstream>
+#include <functional>
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <sstream>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#ifdef HAVE_GPERFTOOLS
+#include <gperftools/profiler.h>
+#endif
+#if defined(HAVE_LIBTCMALLOC) && defined(HAVE_GPERFTOOLS_MALLOC_EXTENSION_H)
+#include <gperftools/malloc_extension.h>
+#define HAVE_HEAP_SAMPLE 1
+#endif
+
+#include "monitoring/monitoring.h"
+
+DEFINE_bool(profiling_endpoints, false,
+            "whether to serve CPU and heap profiles at /debug/pprof/");
+DEFINE_int32(profile_max_seconds, 120,
+             "longest CPU profile that can be asked for at "
+             "/debug/pprof/profile");
+DEFINE_string(background_profile_dir, "",
+              "if set, directory where a CPU profile is written every "
+              "--background_profile_interval_seconds");
+DEFINE_int32(background_profile_interval_seconds, 600,
+             "seconds between the starts of the background CPU profiles");
+DEFINE_int32(background_profile_seconds, 10,
+             "length of each background CPU profile, in seconds");
+
+using std::bind;
+using std::chrono::seconds;
+using std::ifstream;
+using std::ostringstream;
+using std::placeholders::_1;
+using std::shared_ptr;
+using std::string;
+using std::unique_ptr;
+
+namespace cert_trans {
+namespace {
+
+
+Counter<string>* profiles_taken(
+    Counter<string>::New("profiles_taken", "kind",
+                         "Number of profiles taken, by kind (cpu, heap, "
+                         "background)."));
+
+
+void SendReply(evhttp_request* req, int code, const string& content_type,
+               const string& body) {
+  evhttp_add_header(evhttp_request_get_output_headers(req), "Content-Type",
+                    content_type.c_str());
+  CHECK_EQ(0, evbuffer_add(evhttp_request_get_output_buffer(req), body.data(),
+                           body.size()));
+  evhttp_send_reply(req, code, /*reason*/ nullptr, /*databuf*/ nullptr);
+}
+
+
+void SendError(evhttp_request* req, int code, const string& message) {
+  SendReply(req, code, "text/plain", message + "\n");
+}
+
+
+// Returns the |seconds| query parameter of |req|, or |default_value|
+// if there is none, or -1 if it is not valid.
+int GetSecondsParam(evhttp_request* req, int default_value) {
+  const char* const query_str(
+      evhttp_uri_get_query(evhttp_request_get_evhttp_uri(req)));
+  if (!query_str) {
+    return default_value;
+  }
+  evkeyvalq query;
+  if (evhttp_parse_query_str(query_str, &query) != 0) {
+    return -1;
+  }
+  int retval(default_value);
+  const char* const value(evhttp_find_header(&query, "seconds"));
+  if (value) {
+    char* end;
+    const long num(strtol(value, &end, 10));
+    retval = (*value && !*end && num > 0 && num <= INT32_MAX) ? num : -1;
+  }
+  evhttp_clear_headers(&query);
+  return retval;
+}
+
+
+void ProfileClientClosed(evhttp_connection*, void* userdata) {
+  static_cast<std::atomic<bool>*>(userdata)->store(true);
+}
+
+
+bool ReadFile(const string& path, string* contents) {
+  ifstream in(path, std::ios::binary);
+  if (!in) {
+    return false;
+  }
+  ostringstream oss;
+  oss << in.rdbuf();
+  *CHECK_NOTNULL(contents) = oss.str();
+  return true;
+}
+
+
+}  // namespace
+
+
+// A CPU profile being taken for a request, whose client is watched
+// in the meantime, as it might give up.
+struct Profiler::PendingProfile {
+  PendingProfile(evhttp_request* r, const string& p)
+      : req(r), path(p), client_gone(false) {
+  }
+
+  evhttp_request* const req;
+  const string path;
+  std::atomic<bool> client_gone;
+};
+
+
+Profiler::Profiler(const shared_ptr<libevent::Base>& base)
+    : base_(CHECK_NOTNULL(base)),
+      cpu_profiling_(false),
+      background_task_(base_.get()) {
+  if (!FLAGS_background_profile_dir.empty()) {
+#ifdef HAVE_GPERFTOOLS
+    CHECK_GT(FLAGS_background_profile_seconds, 0);
+    CHECK_GE(FLAGS_background_profile_interval_seconds,
+             FLAGS_background_profile_seconds);
+    background_profiles_.reset(new PeriodicClosure(
+        base_, seconds(FLAGS_background_profile_interval_seconds),
+        bind(&Profiler::StartBackgroundProfile, this)));
+#else
+    LOG(WARNING) << "Built without gperftools, ignoring "
+                 << "--background_profile_dir";
+#endif
+  }
+}
+
+
+Profiler::~Profiler() {
+  background_profiles_.reset();
+  // Cuts the pending profiles short.
+  background_task_.Cancel();
+  background_task_.Wait();
+}
+
+
+void Profiler::AddHandlers(libevent::HttpServer* server) {
+  if (!FLAGS_profiling_endpoints) {
+    return;
+  }
+  CHECK_NOTNULL(server);
+  server->AddHandler("/debug/pprof/profile",
+                     bind(&Profiler::CpuProfile, this, _1));
+  server->AddHandler("/debug/pprof/heap",
+                     bind(&Profiler::HeapProfile, this, _1));
+}
+
+
+bool Profiler::StartCpuProfile(const string& path) {
+#ifdef HAVE_GPERFTOOLS
+  if (cpu_profiling_.exchange(true)) {
+    return false;
+  }
+  if (!ProfilerStart(path.c_str())) {
+    LOG(WARNING) << "Could not start a CPU profile into " << path;
+    cpu_profiling_ = false;
+    return false;
+  }
+  return true;
+#else
+  return false;
+#endif
+}
+
+
+void Profiler::StopCpuProfile() {
+#ifdef HAVE_GPERFTOOLS
+  ProfilerStop();
+  CHECK(cpu_profiling_.exchange(false));
+#endif
+}
+
+
+void Profiler::CpuProfile(evhttp_request* req) {
+  if (evhttp_request_get_command(req) != EVHTTP_REQ_GET) {
+    return SendError(req, HTTP_BADMETHOD, "Method not allowed.");
+  }
+#ifndef HAVE_GPERFTOOLS
+  return SendError(req, HTTP_NOTIMPLEMENTED, "Built without gperftools.");
+#else
+  const int duration(GetSecondsParam(req, 30));
+  if (duration < 0 || duration > FLAGS_profile_max_seconds) {
+    return SendError(req, HTTP_BADREQUEST, "Invalid seconds parameter.");
+  }
+  if (!background_task_.task()->IsActive()) {
+    return SendError(req, HTTP_SERVUNAVAIL, "Shutting down.");
+  }
+
+  char path[] = "/tmp/ct-cpu-profile-XXXXXX";
+  const int fd(mkstemp(path));
+  if (fd < 0) {
+    return SendError(req, HTTP_INTERNAL, "Could not create a profile file.");
+  }
+  close(fd);
+  if (!StartCpuProfile(path)) {
+    unlink(path);
+    return SendError(req, HTTP_SERVUNAVAIL,
+                     "Another CPU profile is being taken.");
+  }
+  profiles_taken->Increment("cpu");
+  VLOG(1) << "Taking a CPU profile of " << duration << " seconds";
+
+  PendingProfile* const pending(new PendingProfile(req, path));
+  evhttp_connection_set_closecb(evhttp_request_get_connection(req),
+                                &ProfileClientClosed, &pending->client_gone);
+  libevent::Base* const req_base(libevent::Base::ForRequest(req));
+  req_base->Delay(seconds(duration),
+                  background_task_.task()->AddChildWithExecutor(
+                      bind(&Profiler::CpuProfileDone, this, pending, _1),
+                      req_base));
+#endif
+}
+
+
+void Profiler::CpuProfileDone(PendingProfile* pending, util::Task* task) {
+  const unique_ptr<PendingProfile> pending_deleter(pending);
+  StopCpuProfile();
+  evhttp_request* const req(pending->req);
+  evhttp_connection* const conn(evhttp_request_get_connection(req));
+  if (conn) {
+    evhttp_connection_set_closecb(conn, nullptr, nullptr);
+  }
+
+  string profile;
+  const bool read(ReadFile(pending->path, &profile));
+  unlink(pending->path.c_str());
+  if (pending->client_gone) {
+    // The request was left to be freed by this.
+    evhttp_send_reply_end(req);
+    return;
+  }
+  if (!read) {
+    return SendError(req, HTTP_INTERNAL, "Could not read the profile.");
+  }
+  // Even if cut short by a shutdown, what was profiled is returned.
+  SendReply(req, HTTP_OK, "application/octet-stream", profile);
+}
+
+
+void Profiler::HeapProfile(evhttp_request* req) {
+  if (evhttp_request_get_command(req) != EVHTTP_REQ_GET) {
+    return SendError(req, HTTP_BADMETHOD, "Method not allowed.");
+  }
+#ifndef HAVE_HEAP_SAMPLE
+  SendError(req, HTTP_NOTIMPLEMENTED, "Built without tcmalloc.");
+#else
+  string sample;
+  MallocExtension::instance()->GetHeapSample(&sample);
+  profiles_taken->Increment("heap");
+  SendReply(req, HTTP_OK, "text/plain", sample);
+#endif
+}
+
+
+void Profiler::StartBackgroundProfile() {
+  const std::time_t now(std::time(nullptr));
+  char name[64];
+  CHECK_GT(std::strftime(name, sizeof(name), "/cpu-%Y%m%d-%H%M%S.prof",
+                         std::gmtime(&now)),
+           0U);
+  const string path(FLAGS_background_profile_dir + name);
+  if (!background_task_.task()->IsActive() || !StartCpuProfile(path)) {
+    // Maybe someone asked for one, this one will just be skipped.
+    VLOG(1) << "Skipping the background CPU profile into " << path;
+    return;
+  }
+  profiles_taken->Increment("background");
+  base_->Delay(seconds(FLAGS_background_profile_seconds),
+               background_task_.task()->AddChild(
+                   bind(&Profiler::BackgroundProfileDone, this, _1)));
+}
+
+
+void Profiler::BackgroundProfileDone(util::Task* task) {
+  StopCpuProfile();
+}
+
+
+}  // namespace cert_trans
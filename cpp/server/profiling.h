@@ -0,0 +1,62 @@
+#ifndef CERT_TRANS_SERVER_PROFILING_H_
+#define CERT_TRANS_SERVER_PROFILING_H_
+
+#include <atomic>
+#include <memory>
+#include <string>
+
+#include "base/macros.h"
+#include "util/libevent_wrapper.h"
+#include "util/periodic_closure.h"
+#include "util/sync_task.h"
+
+namespace cert_trans {
+
+
+// Takes CPU and heap profiles with gperftools, when built with it:
+//
+//  - if --profiling_endpoints is set, AddHandlers() registers
+//    /debug/pprof/profile?seconds=N, which replies with a CPU profile
+//    of the next N seconds, and /debug/pprof/heap, which replies with
+//    a sample of the heap (if tcmalloc samples it, see
+//    TCMALLOC_SAMPLE_PARAMETER);
+//  - if --background_profile_dir is set, a CPU profile of
+//    --background_profile_seconds is written there every
+//    --background_profile_interval_seconds.
+//
+// The profiles are in the pprof format. Only one CPU profile can be
+// taken at a time, others are turned away meanwhile.
+class Profiler {
+ public:
+  explicit Profiler(const std::shared_ptr<libevent::Base>& base);
+  ~Profiler();
+
+  void AddHandlers(libevent::HttpServer* server);
+
+ private:
+  struct PendingProfile;
+
+  // Starts a CPU profile into |path|, unless one is already running.
+  bool StartCpuProfile(const std::string& path);
+  void StopCpuProfile();
+
+  void CpuProfile(evhttp_request* req);
+  void CpuProfileDone(PendingProfile* pending, util::Task* task);
+  void HeapProfile(evhttp_request* req);
+
+  void StartBackgroundProfile();
+  void BackgroundProfileDone(util::Task* task);
+
+  const std::shared_ptr<libevent::Base> base_;
+  std::atomic<bool> cpu_profiling_;
+  // Holds the delays of the background profiles, until destroyed.
+  util::SyncTask background_task_;
+  std::unique_ptr<PeriodicClosure> background_profiles_;
+
+  DISALLOW_COPY_AND_ASSIGN(Profiler);
+};
+
+
+}  // namespace cert_trans
+
+#endif  // CERT_TRANS_SERVER_PROFILING_H_
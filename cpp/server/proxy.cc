@@ -1,3 +1,4 @@
+#include "config.h"
 #include "server/proxy.h"
 
 #include <algorithm>
@@ -5,7 +6,9 @@
 #include <event2/http.h>
 #include <event2/http_compat.h>
 #include <event2/keyvalq_struct.h>
+#include <gflags/gflags.h>
 #include <glog/logging.h>
+#include <memory>
 #include <string>
 #include <unordered_set>
 #include <vector>
@@ -18,19 +21,36 @@
 
 using ct::ClusterNodeState;
 using std::bind;
+using std::chrono::duration;
+using std::chrono::milliseconds;
+using std::chrono::steady_clock;
+using std::enable_shared_from_this;
+using std::function;
 using std::getline;
+using std::lock_guard;
 using std::make_pair;
+using std::make_shared;
+using std::milli;
+using std::move;
+using std::mutex;
 using std::pair;
 using std::placeholders::_1;
+using std::placeholders::_2;
 using std::rand;
+using std::shared_ptr;
 using std::string;
 using std::stringstream;
+using std::to_string;
 using std::unique_ptr;
 using std::unordered_set;
 using std::vector;
 using util::Executor;
 using util::Task;
 
+DEFINE_int32(proxy_fresh_nodes_refresh_ms, 1000,
+             "How often to refresh the list of fresh nodes requests can be "
+             "proxied to, in milliseconds.");
+
 namespace cert_trans {
 namespace {
 
@@ -42,45 +62,271 @@ static Counter<string, int>* total_proxied_responses(
     Counter<string, int>::New("total_proxied_responses", "path", "status_code",
                               "Number of proxied API requests by path "
                               "and status code."));
+static Gauge<string>* proxy_target_latency_ms(
+    Gauge<string>::New("proxy_target_latency_ms", "target",
+                       "Moving average of the latency of the requests "
+                       "proxied to each node."));
 
+// Weight of the latest request in the moving average of the latency
+// of a target.
+const double kLatencyWeight = 0.1;
 
-void ProxyRequestDone(libevent::Base* base, JsonOutput* output,
-                      evhttp_request* request, const string& path,
-                      UrlFetcher::Response* response, Task* task) {
-  CHECK_NOTNULL(request);
-  CHECK_NOTNULL(task);
-  unique_ptr<UrlFetcher::Response> response_deleter(CHECK_NOTNULL(response));
 
-  total_proxied_requests->Increment(path);
-  total_proxied_responses->Increment(path, response->status_code);
+// Bytes of a reply that can be waiting to be written to the client
+// before reading more of it from the target is paused.
+const size_t kMaxBufferedReplyBytes = 1 << 20;
 
-  if (!task->status().ok()) {
-    return output->SendError(request, HTTP_INTERNAL,
-                             "Proxied request failed.");
+
+}  // namespace
+
+
+// Passes the reply of a target on to the client as it arrives, instead
+// of once it was all received, so that large replies are neither held
+// in memory nor delayed. The reply is received on the event loop of
+// the fetcher, but can only be sent on that of the request.
+class StreamedReply : public enable_shared_from_this<StreamedReply> {
+ public:
+  StreamedReply(evhttp_request* request, const string& path)
+      : request_(CHECK_NOTNULL(request)),
+        base_(libevent::Base::ForRequest(request)),
+        path_(path),
+        started_(false),
+        client_gone_(false),
+        in_output_(0),
+        queued_(0),
+        fetch_(nullptr) {
+  }
+
+  UrlFetcher::Response* response() {
+    return &response_;
   }
 
+  // Arranges for |fetch| to be cancelled if the client goes away
+  // before the reply is over. Must be called before the fetch starts.
+  void Start(Task* fetch);
+
+  // The callbacks for UrlFetcher::FetchStreaming().
+  void HeadersReceived();
+  bool BodyReceived(evbuffer* chunk, const function<void()>& resume);
+
+  // Ends the reply, once the fetch is done with |status|.
+  void Done(JsonOutput* output, const util::Status& status);
+
+ private:
+  // These run on the event loop of the request.
+  void WatchClient();
+  void StartReply(const UrlFetcher::Headers& headers, int status_code);
+  void SendChunk(evbuffer* chunk);
+  void EndReply(JsonOutput* output, bool ok);
+  static void ChunkWritten(evhttp_connection* conn, void* userdata);
+  static void ConnectionClosed(evhttp_connection* conn, void* userdata);
+
+  // Marks the bytes that were in the output buffer as written, and
+  // resumes the fetch if it was paused.
+  void Written(size_t length);
+  void RunOnEventThread(const function<void()>& closure) const;
+
+  evhttp_request* const request_;
+  libevent::Base* const base_;
+  const string path_;
+  UrlFetcher::Response response_;
+
+  // Only used on the event loop of the request.
+  shared_ptr<StreamedReply> self_;
+  bool started_;
+  bool client_gone_;
+  size_t in_output_;
+
+  mutex lock_;
+  // Bytes passed on to the client but not written yet.
+  size_t queued_;
+  function<void()> resume_;
+  // Until it is done.
+  Task* fetch_;
+
+  DISALLOW_COPY_AND_ASSIGN(StreamedReply);
+};
+
+
+void StreamedReply::Start(Task* fetch) {
+  {
+    lock_guard<mutex> lock(lock_);
+    fetch_ = CHECK_NOTNULL(fetch);
+  }
+  const shared_ptr<StreamedReply> self(shared_from_this());
+  RunOnEventThread([self]() { self->WatchClient(); });
+}
+
+
+void StreamedReply::HeadersReceived() {
+  UrlFetcher::Headers headers(response_.headers);
   // TODO(alcutter): Consider retrying the proxied request some number of times
   // in the case where the request fails.
-  FilterHeaders(&response->headers);
-  for (auto it(response->headers.begin()); it != response->headers.end();
-       ++it) {
-    CHECK_EQ(evhttp_add_header(evhttp_request_get_output_headers(request),
-                               it->first.c_str(), it->second.c_str()),
+  FilterHeaders(&headers);
+  // The body is passed on as it is decoded, and re-encoded as needed
+  // for the client by libevent.
+  headers.erase("Transfer-Encoding");
+  const int status_code(response_.status_code);
+  const shared_ptr<StreamedReply> self(shared_from_this());
+  RunOnEventThread([self, headers, status_code]() {
+    self->StartReply(headers, status_code);
+  });
+}
+
+
+bool StreamedReply::BodyReceived(evbuffer* chunk,
+                                 const function<void()>& resume) {
+  bool keep_reading;
+  {
+    lock_guard<mutex> lock(lock_);
+    queued_ += evbuffer_get_length(chunk);
+    keep_reading = queued_ < kMaxBufferedReplyBytes;
+    if (!keep_reading) {
+      resume_ = resume;
+    }
+  }
+
+  evbuffer* const copy(CHECK_NOTNULL(evbuffer_new()));
+  CHECK_EQ(evbuffer_add_buffer(copy, chunk), 0);
+  const shared_ptr<StreamedReply> self(shared_from_this());
+  RunOnEventThread([self, copy]() { self->SendChunk(copy); });
+  return keep_reading;
+}
+
+
+void StreamedReply::Done(JsonOutput* output, const util::Status& status) {
+  {
+    lock_guard<mutex> lock(lock_);
+    fetch_ = nullptr;
+  }
+  total_proxied_requests->Increment(path_);
+  total_proxied_responses->Increment(path_, response_.status_code);
+
+  const bool ok(status.ok());
+  const shared_ptr<StreamedReply> self(shared_from_this());
+  RunOnEventThread([self, output, ok]() { self->EndReply(output, ok); });
+}
+
+
+void StreamedReply::WatchClient() {
+  evhttp_connection* const conn(evhttp_request_get_connection(request_));
+  if (!conn) {
+    return ConnectionClosed(nullptr, this);
+  }
+  // Kept alive until the reply ends, for the callbacks of the
+  // connection.
+  self_ = shared_from_this();
+  evhttp_connection_set_closecb(conn, &ConnectionClosed, this);
+}
+
+
+void StreamedReply::StartReply(const UrlFetcher::Headers& headers,
+                               int status_code) {
+  for (const auto& header : headers) {
+    CHECK_EQ(evhttp_add_header(evhttp_request_get_output_headers(request_),
+                               header.first.c_str(), header.second.c_str()),
              0);
   }
-  CHECK_GT(evbuffer_add_printf(evhttp_request_get_output_buffer(request), "%s",
-                               response->body.c_str()),
-           -1);
+  if (client_gone_) {
+    return;
+  }
+  evhttp_send_reply_start(request_, status_code, /*reason*/ NULL);
+  started_ = true;
+}
 
-  const int response_code(response->status_code);
-  base->Add([request, response_code]() {
-    evhttp_send_reply(request, response_code, /*reason*/ NULL,
-                      /*databuf*/ NULL);
-  });
+
+void StreamedReply::SendChunk(evbuffer* chunk) {
+  const size_t length(evbuffer_get_length(chunk));
+  if (!started_ || client_gone_) {
+    evbuffer_free(chunk);
+    Written(length);
+    return;
+  }
+
+  in_output_ += length;
+#ifdef HAVE_EVHTTP_SEND_REPLY_CHUNK_WITH_CB
+  evhttp_send_reply_chunk_with_cb(request_, chunk, &ChunkWritten, this);
+#else
+  // Without a way to know when the client took it, the reply cannot
+  // be paused.
+  evhttp_send_reply_chunk(request_, chunk);
+  ChunkWritten(nullptr, this);
+#endif
+  evbuffer_free(chunk);
 }
 
 
-}  // namespace
+void StreamedReply::EndReply(JsonOutput* output, bool ok) {
+  // Destroyed once this returns.
+  const shared_ptr<StreamedReply> self(move(self_));
+
+  evhttp_connection* const conn(evhttp_request_get_connection(request_));
+  if (!conn) {
+    // The client went away, this only frees the request.
+    evhttp_send_reply_end(request_);
+    return;
+  }
+  evhttp_connection_set_closecb(conn, NULL, NULL);
+  if (!started_) {
+    return output->SendError(request_, HTTP_INTERNAL,
+                             "Proxied request failed.");
+  }
+  if (!ok) {
+    // Part of the reply was already sent, so the client has to find
+    // out it is truncated by the connection closing on it.
+    evhttp_connection_free(conn);
+    return;
+  }
+  evhttp_send_reply_end(request_);
+}
+
+
+// static
+void StreamedReply::ChunkWritten(evhttp_connection*, void* userdata) {
+  StreamedReply* const reply(static_cast<StreamedReply*>(userdata));
+  const size_t length(reply->in_output_);
+  reply->in_output_ = 0;
+  reply->Written(length);
+}
+
+
+// static
+void StreamedReply::ConnectionClosed(evhttp_connection*, void* userdata) {
+  StreamedReply* const reply(static_cast<StreamedReply*>(userdata));
+  reply->client_gone_ = true;
+  {
+    lock_guard<mutex> lock(reply->lock_);
+    if (reply->fetch_) {
+      reply->fetch_->Cancel();
+    }
+  }
+  // Drain the rest of the reply, in case the fetch goes on.
+  ChunkWritten(nullptr, reply);
+}
+
+
+void StreamedReply::Written(size_t length) {
+  function<void()> resume;
+  {
+    lock_guard<mutex> lock(lock_);
+    queued_ -= length;
+    if (queued_ < kMaxBufferedReplyBytes) {
+      resume.swap(resume_);
+    }
+  }
+  if (resume) {
+    resume();
+  }
+}
+
+
+void StreamedReply::RunOnEventThread(const function<void()>& closure) const {
+  if (!base_->OnThisEventThread()) {
+    base_->Add(closure);
+  } else {
+    closure();
+  }
+}
 
 
 // Filters out any headers which should not be proxied on.
@@ -111,11 +357,9 @@ void FilterHeaders(UrlFetcher::Headers* headers) {
 }
 
 
-Proxy::Proxy(libevent::Base* base, JsonOutput* output,
-             const GetFreshNodesFunction& get_fresh_nodes, UrlFetcher* fetcher,
-             Executor* executor)
-    : base_(CHECK_NOTNULL(base)),
-      output_(CHECK_NOTNULL(output)),
+Proxy::Proxy(JsonOutput* output, const GetFreshNodesFunction& get_fresh_nodes,
+             UrlFetcher* fetcher, Executor* executor)
+    : output_(CHECK_NOTNULL(output)),
       get_fresh_nodes_(get_fresh_nodes),
       fetcher_(CHECK_NOTNULL(fetcher)),
       executor_(CHECK_NOTNULL(executor)) {
@@ -123,41 +367,133 @@ Proxy::Proxy(libevent::Base* base, JsonOutput* output,
 }
 
 
-void Proxy::ProxyRequest(evhttp_request* req) const {
-  CHECK_NOTNULL(req);
+bool Proxy::ChooseTarget(HostPort* target) const {
+  CHECK_NOTNULL(target);
+  const steady_clock::time_point now(steady_clock::now());
+  bool refresh;
+  {
+    lock_guard<mutex> lock(lock_);
+    refresh =
+        targets_.empty() ||
+        now - targets_updated_ >=
+            milliseconds(FLAGS_proxy_fresh_nodes_refresh_ms);
+  }
 
-  const vector<ClusterNodeState> fresh_nodes(get_fresh_nodes_());
-  if (fresh_nodes.empty()) {
-    return output_->SendError(req, HTTP_SERVUNAVAIL,
-                              "No node able to serve request.");
+  // Not called with |lock_| held, since it takes the lock of the
+  // cluster state controller.
+  vector<HostPort> fresh_targets;
+  if (refresh) {
+    for (const ClusterNodeState& node : get_fresh_nodes_()) {
+      fresh_targets.emplace_back(node.hostname(), node.log_port());
+    }
   }
-  const ClusterNodeState& target(fresh_nodes[rand() % fresh_nodes.size()]);
 
-  URL url(evhttp_request_uri(req));
-  url.SetProtocol("http");
-  url.SetHost(target.hostname());
-  url.SetPort(target.log_port());
+  lock_guard<mutex> lock(lock_);
+  if (refresh) {
+    targets_.swap(fresh_targets);
+    targets_updated_ = now;
+    // Forget about the nodes which are not fresh anymore.
+    for (auto it = stats_.begin(); it != stats_.end();) {
+      if (it->second.in_flight == 0 &&
+          std::find(targets_.begin(), targets_.end(), it->first) ==
+              targets_.end()) {
+        it = stats_.erase(it);
+      } else {
+        ++it;
+      }
+    }
+  }
+  if (targets_.empty()) {
+    return false;
+  }
 
-  UrlFetcher::Request fetcher_req(url);
+  // Picking the better of two random nodes spreads the load almost as
+  // well as picking the best one, without them all piling onto it.
+  size_t chosen(rand() % targets_.size());
+  if (targets_.size() > 1) {
+    size_t other(rand() % (targets_.size() - 1));
+    if (other >= chosen) {
+      ++other;
+    }
+    const TargetStats& a(stats_[targets_[chosen]]);
+    const TargetStats& b(stats_[targets_[other]]);
+    // Until both of them have a latency, only go by the requests in
+    // flight.
+    const bool b_is_better(
+        a.latency_ms < 0 || b.latency_ms < 0
+            ? b.in_flight < a.in_flight
+            : b.latency_ms * (b.in_flight + 1) <
+                  a.latency_ms * (a.in_flight + 1));
+    if (b_is_better) {
+      chosen = other;
+    }
+  }
+
+  *target = targets_[chosen];
+  ++stats_[*target].in_flight;
+  return true;
+}
+
+
+void Proxy::RequestDone(const HostPort& target,
+                        const steady_clock::time_point& start,
+                        const shared_ptr<StreamedReply>& reply,
+                        Task* task) const {
+  unique_ptr<Task> task_deleter(CHECK_NOTNULL(task));
+  const double latency_ms(
+      duration<double, milli>(steady_clock::now() - start).count());
+  {
+    lock_guard<mutex> lock(lock_);
+    TargetStats& stats(stats_[target]);
+    --stats.in_flight;
+    stats.latency_ms = stats.latency_ms < 0
+                           ? latency_ms
+                           : (1 - kLatencyWeight) * stats.latency_ms +
+                                 kLatencyWeight * latency_ms;
+    proxy_target_latency_ms->Set(target.first + ":" + to_string(target.second),
+                                 stats.latency_ms);
+  }
+
+  reply->Done(output_, task->status());
+}
 
+
+void Proxy::ProxyRequest(evhttp_request* req) const {
+  CHECK_NOTNULL(req);
+
+  UrlFetcher::Verb verb;
   switch (evhttp_request_get_command(req)) {
     case EVHTTP_REQ_DELETE:
-      fetcher_req.verb = UrlFetcher::Verb::DELETE;
+      verb = UrlFetcher::Verb::DELETE;
       break;
     case EVHTTP_REQ_GET:
-      fetcher_req.verb = UrlFetcher::Verb::GET;
+      verb = UrlFetcher::Verb::GET;
       break;
     case EVHTTP_REQ_POST:
-      fetcher_req.verb = UrlFetcher::Verb::POST;
+      verb = UrlFetcher::Verb::POST;
       break;
     case EVHTTP_REQ_PUT:
-      fetcher_req.verb = UrlFetcher::Verb::PUT;
+      verb = UrlFetcher::Verb::PUT;
       break;
     default:
       return output_->SendError(req, HTTP_BADMETHOD, "Bad method requested.");
       break;
   }
 
+  HostPort target;
+  if (!ChooseTarget(&target)) {
+    return output_->SendError(req, HTTP_SERVUNAVAIL,
+                              "No node able to serve request.");
+  }
+
+  URL url(evhttp_request_uri(req));
+  url.SetProtocol("http");
+  url.SetHost(target.first);
+  url.SetPort(target.second);
+
+  UrlFetcher::Request fetcher_req(url);
+  fetcher_req.verb = verb;
+
   for (evkeyval* ptr = evhttp_request_get_input_headers(req)->tqh_first; ptr;
        ptr = ptr->next.tqe_next) {
     fetcher_req.headers.insert(make_pair(ptr->key, ptr->value));
@@ -176,11 +512,16 @@ void Proxy::ProxyRequest(evhttp_request* req) const {
   }
   VLOG(1) << "Proxying request to " << url.Host() << ":" << url.Port()
           << url.PathQuery();
-  UrlFetcher::Response* resp(new UrlFetcher::Response);
-  fetcher_->Fetch(fetcher_req, resp,
-                  new Task(bind(&ProxyRequestDone, base_, output_, req,
-                                url.Path(), resp, _1),
-                           executor_));
+  const shared_ptr<StreamedReply> reply(
+      make_shared<StreamedReply>(req, url.Path()));
+  Task* const fetch(new Task(
+      bind(&Proxy::RequestDone, this, target, steady_clock::now(), reply, _1),
+      executor_));
+  reply->Start(fetch);
+  fetcher_->FetchStreaming(fetcher_req, reply->response(),
+                           bind(&StreamedReply::HeadersReceived, reply),
+                           bind(&StreamedReply::BodyReceived, reply, _1, _2),
+                           fetch);
 }
 
 
@@ -1,7 +1,14 @@
 #ifndef CERT_TRANS_SERVER_PROXY_H_
 #define CERT_TRANS_SERVER_PROXY_H_
 
+#include <chrono>
 #include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <utility>
 #include <vector>
 
 #include "base/macros.h"
@@ -22,36 +29,62 @@ class Task;
 
 
 namespace cert_trans {
-namespace libevent {
-class Base;
-}  // namespace libevent
 
 class JsonOutput;
+class StreamedReply;
 
 
 // Visible for testing
 void FilterHeaders(UrlFetcher::Headers* headers);
 
 
+// Forwards requests to the fresh nodes of the cluster. The list of
+// fresh nodes is only refreshed every --proxy_fresh_nodes_refresh_ms,
+// and each request goes to the less loaded of two of them picked at
+// random, going by the number of requests in flight to each and their
+// recent latency.
 class Proxy {
  public:
   typedef std::function<std::vector<ct::ClusterNodeState>()>
       GetFreshNodesFunction;
-  Proxy(libevent::Base* base, JsonOutput* output,
-        const GetFreshNodesFunction& get_fresh_nodes, UrlFetcher* fetcher,
-        util::Executor* executor);
+  Proxy(JsonOutput* output, const GetFreshNodesFunction& get_fresh_nodes,
+        UrlFetcher* fetcher, util::Executor* executor);
 
   virtual ~Proxy() = default;
 
   virtual void ProxyRequest(evhttp_request* req) const;
 
  private:
-  libevent::Base* const base_;
+  typedef std::pair<std::string, uint16_t> HostPort;
+
+  struct TargetStats {
+    TargetStats() : in_flight(0), latency_ms(-1) {
+    }
+
+    int in_flight;
+    // Moving average of the latency of the requests proxied to the
+    // target, or -1 until one has completed.
+    double latency_ms;
+  };
+
+  // Returns false if there is no fresh node to proxy to. Otherwise,
+  // counts the request as in flight to |target|.
+  bool ChooseTarget(HostPort* target) const;
+  void RequestDone(const HostPort& target,
+                   const std::chrono::steady_clock::time_point& start,
+                   const std::shared_ptr<StreamedReply>& reply,
+                   util::Task* task) const;
+
   JsonOutput* const output_;
   const GetFreshNodesFunction get_fresh_nodes_;
   UrlFetcher* const fetcher_;
   util::Executor* const executor_;
 
+  mutable std::mutex lock_;
+  mutable std::vector<HostPort> targets_;
+  mutable std::chrono::steady_clock::time_point targets_updated_;
+  mutable std::map<HostPort, TargetStats> stats_;
+
   DISALLOW_COPY_AND_ASSIGN(Proxy);
 };
 
@@ -0,0 +1,75 @@
+#include "server/rate_limiter.h"
+
+#include <algorithm>
+#include <glog/logging.h>
+
+using std::chrono::duration;
+using std::chrono::steady_clock;
+using std::lock_guard;
+using std::mutex;
+using std::string;
+
+namespace cert_trans {
+
+
+RateLimiter::RateLimiter(double rate, double burst)
+    : rate_(rate),
+      burst_(burst),
+      refill_time_(burst / rate),
+      last_pruned_(steady_clock::now()) {
+  CHECK_GT(rate_, 0);
+  CHECK_GE(burst_, 1);
+}
+
+
+bool RateLimiter::Allow(const string& client,
+                        const steady_clock::time_point& now) {
+  lock_guard<mutex> lock(lock_);
+  Prune(now);
+
+  const auto it(buckets_.find(client));
+  if (it == buckets_.end()) {
+    buckets_.emplace(client, Bucket{burst_ - 1, now});
+    return true;
+  }
+
+  Bucket* const bucket(&it->second);
+  if (now > bucket->updated) {
+    bucket->tokens =
+        std::min(burst_, bucket->tokens +
+                             duration<double>(now - bucket->updated).count() *
+                                 rate_);
+    bucket->updated = now;
+  }
+  if (bucket->tokens < 1) {
+    return false;
+  }
+  bucket->tokens -= 1;
+  return true;
+}
+
+
+size_t RateLimiter::NumClients() const {
+  lock_guard<mutex> lock(lock_);
+  return buckets_.size();
+}
+
+
+void RateLimiter::Prune(const steady_clock::time_point& now) {
+  // Checking every bucket is only worth it once some could have
+  // refilled.
+  if (now - last_pruned_ < refill_time_) {
+    return;
+  }
+  for (auto it(buckets_.begin()); it != buckets_.end();) {
+    if (now - it->second.updated >= refill_time_) {
+      it = buckets_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+  last_pruned_ = now;
+}
+
+
+}  // namespace cert_trans
@@ -0,0 +1,61 @@
+#ifndef CERT_TRANS_SERVER_RATE_LIMITER_H_
+#define CERT_TRANS_SERVER_RATE_LIMITER_H_
+
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "base/macros.h"
+
+namespace cert_trans {
+
+
+// Limits the rate of requests of each client with a token bucket, so
+// that a single client cannot use up the capacity meant for all of
+// them. Thread-safe.
+class RateLimiter {
+ public:
+  // Each client can make |rate| requests per second on average, in
+  // bursts of up to |burst| requests.
+  RateLimiter(double rate, double burst);
+
+  // Returns whether |client| can make a request at |now|, which
+  // should not go back in time, and takes a token from its bucket if
+  // so.
+  bool Allow(const std::string& client,
+             const std::chrono::steady_clock::time_point& now);
+  bool Allow(const std::string& client) {
+    return Allow(client, std::chrono::steady_clock::now());
+  }
+
+  // The number of clients being tracked. Those whose bucket refilled
+  // are forgotten from time to time.
+  size_t NumClients() const;
+
+ private:
+  struct Bucket {
+    double tokens;
+    std::chrono::steady_clock::time_point updated;
+  };
+
+  // Forgets the clients whose bucket refilled since their last
+  // request, which are no different from new ones.
+  void Prune(const std::chrono::steady_clock::time_point& now);
+
+  const double rate_;
+  const double burst_;
+  // How long it takes for an empty bucket to refill.
+  const std::chrono::duration<double> refill_time_;
+
+  mutable std::mutex lock_;
+  std::unordered_map<std::string, Bucket> buckets_;
+  std::chrono::steady_clock::time_point last_pruned_;
+
+  DISALLOW_COPY_AND_ASSIGN(RateLimiter);
+};
+
+
+}  // namespace cert_trans
+
+#endif  // CERT_TRANS_SERVER_RATE_LIMITER_H_
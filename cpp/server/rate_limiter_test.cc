@@ -0,0 +1,83 @@
+#include "server/rate_limiter.h"
+
+#include <chrono>
+#include <gtest/gtest.h>
+
+#include "util/testing.h"
+
+namespace cert_trans {
+namespace {
+
+using std::chrono::milliseconds;
+using std::chrono::seconds;
+using std::chrono::steady_clock;
+
+
+class RateLimiterTest : public ::testing::Test {
+ protected:
+  RateLimiterTest() : limiter_(2, 3), now_(steady_clock::now()) {
+  }
+
+  RateLimiter limiter_;
+  steady_clock::time_point now_;
+};
+
+
+TEST_F(RateLimiterTest, AllowsBurst) {
+  EXPECT_TRUE(limiter_.Allow("client", now_));
+  EXPECT_TRUE(limiter_.Allow("client", now_));
+  EXPECT_TRUE(limiter_.Allow("client", now_));
+  EXPECT_FALSE(limiter_.Allow("client", now_));
+}
+
+
+TEST_F(RateLimiterTest, Refills) {
+  for (int i = 0; i < 3; ++i) {
+    EXPECT_TRUE(limiter_.Allow("client", now_));
+  }
+  EXPECT_FALSE(limiter_.Allow("client", now_));
+
+  // Two tokens per second.
+  now_ += milliseconds(250);
+  EXPECT_FALSE(limiter_.Allow("client", now_));
+  now_ += milliseconds(250);
+  EXPECT_TRUE(limiter_.Allow("client", now_));
+  EXPECT_FALSE(limiter_.Allow("client", now_));
+
+  // Never more than the burst.
+  now_ += seconds(10);
+  for (int i = 0; i < 3; ++i) {
+    EXPECT_TRUE(limiter_.Allow("client", now_));
+  }
+  EXPECT_FALSE(limiter_.Allow("client", now_));
+}
+
+
+TEST_F(RateLimiterTest, ClientsAreIndependent) {
+  for (int i = 0; i < 3; ++i) {
+    EXPECT_TRUE(limiter_.Allow("greedy", now_));
+  }
+  EXPECT_FALSE(limiter_.Allow("greedy", now_));
+  EXPECT_TRUE(limiter_.Allow("other", now_));
+}
+
+
+TEST_F(RateLimiterTest, ForgetsRefilledClients) {
+  EXPECT_TRUE(limiter_.Allow("one", now_));
+  EXPECT_TRUE(limiter_.Allow("two", now_));
+  EXPECT_EQ(2U, limiter_.NumClients());
+
+  now_ += seconds(2);
+  EXPECT_TRUE(limiter_.Allow("three", now_));
+  EXPECT_EQ(1U, limiter_.NumClients());
+}
+
+
+}  // namespace
+}  // namespace cert_trans
+
+
+int main(int argc, char** argv) {
+  cert_trans::test::InitTesting(argv[0], &argc, &argv, true);
+  return RUN_ALL_TESTS();
+}
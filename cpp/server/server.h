@@ -1,15 +1,18 @@
 #ifndef CERT_TRANS_SERVER_SERVER_H_
 #define CERT_TRANS_SERVER_SERVER_H_
 
+#include <atomic>
 #include <chrono>
 #include <csignal>
 #include <cstring>
+#include <event2/buffer.h>
 #include <functional>
 #include <gflags/gflags.h>
 #include <iostream>
 #include <memory>
 #include <mutex>
 #include <openssl/crypto.h>
+#include <vector>
 
 #include "config.h"
 #include "log/cert_submission_handler.h"
@@ -18,6 +21,7 @@
 #include "log/file_storage.h"
 #include "log/frontend.h"
 #include "log/frontend_signer.h"
+#include "log/journaled_consistent_store.h"
 #include "log/leveldb_db.h"
 #include "log/log_lookup.h"
 #include "log/log_signer.h"
@@ -27,8 +31,14 @@
 #include "monitoring/latency.h"
 #include "monitoring/monitoring.h"
 #include "monitoring/registry.h"
+#include "server/entry_cache.h"
+#ifdef HAVE_NGHTTP2
+#include "server/http2_server.h"
+#endif
 #include "server/json_output.h"
+#include "server/profiling.h"
 #include "server/proxy.h"
+#include "server/tls_context.h"
 #include "util/etcd.h"
 #include "util/periodic_closure.h"
 #include "util/read_key.h"
@@ -45,9 +55,45 @@ DEFINE_int32(watchdog_seconds, 120,
              "before firing the watchdog timer.");
 DEFINE_bool(watchdog_timeout_is_fatal, true,
             "Exit if the watchdog timer fires.");
+DEFINE_int32(entry_cache_size_mb, 256,
+             "Memory to use for caching the get-entries responses of recent "
+             "entries, in megabytes. Nothing is cached if 0.");
+DEFINE_int32(entry_cache_block_size, 256,
+             "Number of consecutive entries cached together for get-entries "
+             "responses.");
+DEFINE_int32(http_server_event_loops, 1,
+             "Number of event loops accepting HTTP connections, each on its "
+             "own thread. If more than 1, they share the port with "
+             "SO_REUSEPORT.");
+DEFINE_int32(http2_port, 0,
+             "Port to also accept HTTP/2 connections on, in cleartext with "
+             "prior knowledge (h2c). Their requests are answered by the same "
+             "handlers as the HTTP/1.1 ones. Disabled if 0.");
+DEFINE_int32(tls_port, 0,
+             "Port to also accept HTTPS connections on, terminating TLS in "
+             "this process rather than in a load balancer in front of it. "
+             "Needs --tls_certificate and --tls_key. Disabled if 0.");
+DEFINE_string(tls_certificate, "",
+              "PEM file with the certificate of the HTTPS server, followed "
+              "by its intermediate certificates.");
+DEFINE_string(tls_key, "",
+              "PEM file with the private key of the HTTPS server.");
+DEFINE_int32(cluster_gossip_fanout, 0,
+             "If positive, each node also sends its new STHs straight to "
+             "this many other nodes, which pass on the ones they had not "
+             "heard of, and writes them to etcd only when refreshing its "
+             "node state. Disabled if 0.");
 
 namespace cert_trans {
 
+class SegmentStorage;
+
+// Where the nodes gossiping their STHs send them, under the path
+// prefix of the log.
+const char kGossipPath[] = "/internal/gossip-node-state";
+// The largest serialized ClusterNodeState accepted there.
+const size_t kMaxGossipBytes = 1 << 16;
+
 Gauge<>* latest_local_tree_size_gauge =
     Gauge<>::New("latest_local_tree_size",
                  "Size of latest locally generated STH.");
@@ -57,7 +103,16 @@ template <class Logged>
 class Server {
  public:
   struct Options {
-    Options() : port(0), num_http_server_threads(16) {
+    Options()
+        : port(0),
+          num_http_server_threads(16),
+          http_pool(nullptr),
+          serve_http(true),
+          start_unready(false),
+          entry_cache_size_mb(-1),
+          gossip_verifier(nullptr),
+          read_only_replica(false),
+          entry_segments(nullptr) {
     }
 
     std::string server;
@@ -65,7 +120,58 @@ class Server {
 
     std::string etcd_root;
 
+    // If set, the bodies of pending entries are kept in this directory,
+    // which all the nodes share, rather than in etcd.
+    std::string pending_entry_body_dir;
+
+    // If set, new pending entries are acknowledged once they are in a
+    // journal in this local directory, and written to etcd after.
+    std::string pending_entry_journal_dir;
+
     int num_http_server_threads;
+    // If set, the HTTP requests are handled on this pool, which can be
+    // shared with other servers, rather than on one of
+    // |num_http_server_threads| threads of our own.
+    ThreadPool* http_pool;
+
+    // Prepended to the paths of the handlers, so that the HTTP
+    // servers can serve several logs.
+    std::string path_prefix;
+
+    // If false, no connections are accepted for this log, which is
+    // served by another server it is added to with AddLog() instead.
+    bool serve_http;
+
+    // If true, the HTTP servers accept connections as soon as they are
+    // bound, but the node is not ready until SetReady() is called:
+    // until Initialise(), every request is answered with a 503, and
+    // then the node is treated as stale, as by
+    // HttpHandler::SetReady(). So that a restarting node is not
+    // reported as down while it loads its tree.
+    bool start_unready;
+
+    // The memory for the entry cache of this log, in megabytes, or -1
+    // for --entry_cache_size_mb. So that the logs sharing the HTTP
+    // servers can each have a cache sized for their traffic.
+    int entry_cache_size_mb;
+
+    // If set, and --cluster_gossip_fanout is positive, the nodes send
+    // each other their new STHs, which are checked with this verifier
+    // of the log key.
+    const LogSigVerifier* gossip_verifier;
+
+    // If true, this node is a read-only replica, which is not a member
+    // of the cluster: it takes no part in the election, does not
+    // publish its node state nor gossip, and never proxies requests.
+    // Its tree heads are written to its database by whoever
+    // replicates them, once it has all their entries.
+    bool read_only_replica;
+
+    // If set, the SegmentStorage the entries of |db| are kept in, by a
+    // FileDB that does not intern their chains, from which the other
+    // nodes can get them as they are stored, sent with sendfile(). See
+    // HttpHandler::ServeEntryRecords().
+    const SegmentStorage* entry_segments;
   };
 
   static void StaticInit();
@@ -86,13 +192,47 @@ class Server {
 
   void Initialise(bool is_mirror);
   void WaitForReplication() const;
+
+  // Ends the startup of a server with Options::start_unready set, from
+  // which on it serves requests normally.
+  void SetReady();
+
+  // Also serves the log of |other|, which must be initialised and not
+  // serve HTTP itself, under its Options::path_prefix. Does not take
+  // ownership of |other|, which must outlive this instance.
+  void AddLog(Server<Logged>* other);
+
   void Run();
 
  private:
+  // All the HTTP servers, the one on |event_base_| first, followed by
+  // the HTTPS ones.
+  std::vector<libevent::HttpServer*> HttpServers();
+
+  // Answers the requests for the paths without a handler of their
+  // own, if Options::start_unready is set.
+  void HandleUnknownPath(evhttp_request* req);
+
+  bool GossipEnabled() const;
+
+  // Adds the handlers of this log to |server|, under
+  // Options::path_prefix.
+  void AddHandlers(libevent::HttpServer* server);
+
+  // Takes a ClusterNodeState gossiped by another node.
+  void HandleGossip(evhttp_request* req);
+
   const Options options_;
   const std::shared_ptr<libevent::Base> event_base_;
   std::unique_ptr<libevent::EventPumpThread> event_pump_;
   libevent::HttpServer http_server_;
+  // The additional event loops accepting HTTP connections, if
+  // --http_server_event_loops is more than 1, and their servers.
+  std::vector<std::shared_ptr<libevent::Base>> http_bases_;
+  std::vector<std::unique_ptr<libevent::HttpServer>> http_servers_;
+  // If --tls_port is set, one HTTPS server for each event loop.
+  std::unique_ptr<TlsContext> tls_context_;
+  std::vector<std::unique_ptr<libevent::HttpServer>> https_servers_;
   Database<Logged>* const db_;
   CertChecker* const cert_checker_;
   const std::string node_id_;
@@ -100,19 +240,34 @@ class Server {
   EtcdClient* const etcd_client_;
   MasterElection election_;
   ThreadPool* internal_pool_;
+  // Runs the cluster maintenance work on |internal_pool_|, ahead of
+  // the bulk of the requests.
+  util::PriorityExecutor control_executor_;
   util::SyncTask server_task_;
+  const std::unique_ptr<KeyValueStorage> entry_bodies_;
   StrictConsistentStore<Logged> consistent_store_;
+  const std::unique_ptr<JournaledConsistentStore<Logged>> journaled_store_;
   const std::unique_ptr<Frontend> frontend_;
   std::unique_ptr<LogLookup<Logged>> log_lookup_;
   std::unique_ptr<ClusterStateController<LoggedCertificate>>
       cluster_controller_;
   std::unique_ptr<ContinuousFetcher> fetcher_;
-  ThreadPool http_pool_;
+  const std::unique_ptr<ThreadPool> own_http_pool_;
+  ThreadPool* const http_pool_;
   JsonOutput json_output_;
   std::unique_ptr<Proxy> proxy_;
+  std::unique_ptr<EntryCache> entry_cache_;
   std::unique_ptr<HttpHandler> handler_;
+  std::atomic<bool> ready_;
   std::unique_ptr<std::thread> node_refresh_thread_;
   std::unique_ptr<GCMExporter> gcm_exporter_;
+  std::unique_ptr<Profiler> profiler_;
+#ifdef HAVE_NGHTTP2
+  std::unique_ptr<Http2Server> http2_server_;
+#endif
+  // Destroyed first, to stop the event loops of |http_bases_| before
+  // anything they use goes away.
+  std::vector<std::unique_ptr<libevent::EventPumpThread>> http_pumps_;
 
   DISALLOW_COPY_AND_ASSIGN(Server);
 };
@@ -191,7 +346,11 @@ Server<Logged>::Server(const Options& opts,
                        LogSigner* log_signer, CertChecker* cert_checker)
     : options_(opts),
       event_base_(event_base),
-      event_pump_(new libevent::EventPumpThread(event_base_)),
+      // The event loop is already run by the server this one is
+      // added to, if it does not serve HTTP itself.
+      event_pump_(opts.serve_http
+                      ? new libevent::EventPumpThread(event_base_)
+                      : nullptr),
       http_server_(*event_base_),
       db_(CHECK_NOTNULL(db)),
       cert_checker_(cert_checker),
@@ -201,25 +360,85 @@ Server<Logged>::Server(const Options& opts,
       election_(event_base_, etcd_client_, options_.etcd_root + "/election",
                 node_id_),
       internal_pool_(CHECK_NOTNULL(internal_pool)),
+      control_executor_(internal_pool_, util::Executor::Priority::HIGH),
       server_task_(internal_pool_),
+      entry_bodies_(options_.pending_entry_body_dir.empty()
+                        ? nullptr
+                        : new FileStorage(options_.pending_entry_body_dir, 2)),
       consistent_store_(&election_,
                         new EtcdConsistentStore<LoggedCertificate>(
                             event_base_.get(), internal_pool_, etcd_client_,
-                            &election_, options_.etcd_root, node_id_)),
+                            &election_, options_.etcd_root, node_id_,
+                            entry_bodies_.get())),
+      journaled_store_(options_.pending_entry_journal_dir.empty()
+                           ? nullptr
+                           : new JournaledConsistentStore<Logged>(
+                                 internal_pool_, &consistent_store_,
+                                 options_.pending_entry_journal_dir)),
       frontend_((log_signer && cert_checker)
-                    ? new Frontend(new CertSubmissionHandler(cert_checker),
-                                   new FrontendSigner(db_, &consistent_store_,
-                                                      log_signer))
+                    ? new Frontend(
+                          new CertSubmissionHandler(cert_checker),
+                          new FrontendSigner(
+                              db_, journaled_store_
+                                       ? static_cast<ConsistentStore<Logged>*>(
+                                             journaled_store_.get())
+                                       : &consistent_store_,
+                              log_signer))
                     : nullptr),
-      http_pool_(options_.num_http_server_threads),
-      json_output_(event_base_.get()) {
+      own_http_pool_(options_.http_pool
+                         ? nullptr
+                         : new ThreadPool(options_.num_http_server_threads)),
+      http_pool_(options_.http_pool ? options_.http_pool
+                                    : own_http_pool_.get()),
+      ready_(!options_.start_unready) {
   CHECK_LT(0, options_.port);
   CHECK_LT(0, options_.num_http_server_threads);
+  CHECK_LE(0, FLAGS_entry_cache_size_mb);
+  CHECK_LE(-1, options_.entry_cache_size_mb);
+  CHECK_LT(0, FLAGS_http_server_event_loops);
+  CHECK_LE(0, FLAGS_http2_port);
+#ifndef HAVE_NGHTTP2
+  CHECK_EQ(0, FLAGS_http2_port) << "this binary was built without HTTP/2 "
+                                   "support";
+#endif
+  CHECK_LE(0, FLAGS_tls_port);
+
+  if (!options_.read_only_replica) {
+    election_.StartElection();
+  }
+  if (!options_.serve_http) {
+    return;
+  }
+
+  for (int i = 1; i < FLAGS_http_server_event_loops; ++i) {
+    http_bases_.emplace_back(std::make_shared<libevent::Base>());
+    http_servers_.emplace_back(new libevent::HttpServer(*http_bases_.back()));
+  }
+  if (FLAGS_tls_port > 0) {
+    CHECK(!FLAGS_tls_certificate.empty() && !FLAGS_tls_key.empty())
+        << "--tls_port needs --tls_certificate and --tls_key";
+    tls_context_.reset(new TlsContext(FLAGS_tls_certificate, FLAGS_tls_key));
+    https_servers_.emplace_back(new libevent::HttpServer(*event_base_));
+    for (const auto& base : http_bases_) {
+      https_servers_.emplace_back(new libevent::HttpServer(*base));
+    }
+    for (const auto& server : https_servers_) {
+      server->EnableTls(tls_context_->ssl_ctx());
+    }
+  }
+
+  profiler_.reset(new Profiler(event_base_));
+  for (libevent::HttpServer* server : HttpServers()) {
+    server->AddHandler("/debug/traces", bind(&cert_trans::ExportTraceEvents,
+                                             std::placeholders::_1));
+    profiler_->AddHandlers(server);
+  }
 
   if (FLAGS_monitoring == kPrometheus) {
-    http_server_.AddHandler("/metrics",
-                            bind(&cert_trans::ExportPrometheusMetrics,
-                                 std::placeholders::_1));
+    for (libevent::HttpServer* server : HttpServers()) {
+      server->AddHandler("/metrics", bind(&cert_trans::ExportPrometheusMetrics,
+                                          std::placeholders::_1));
+    }
   } else if (FLAGS_monitoring == kGcm) {
     gcm_exporter_.reset(
         new GCMExporter(options_.server, url_fetcher_, internal_pool_));
@@ -227,14 +446,42 @@ Server<Logged>::Server(const Options& opts,
     LOG(FATAL) << "Please set --monitoring to one of the supported values.";
   }
 
-  http_server_.Bind(nullptr, options_.port);
-  election_.StartElection();
+  if (options_.start_unready) {
+    for (libevent::HttpServer* server : HttpServers()) {
+      server->SetDefaultHandler(bind(&Server<Logged>::HandleUnknownPath, this,
+                                     std::placeholders::_1));
+    }
+  }
+
+  if (http_servers_.empty()) {
+    http_server_.Bind(nullptr, options_.port);
+    if (!https_servers_.empty()) {
+      https_servers_.front()->Bind(nullptr, FLAGS_tls_port);
+    }
+  } else {
+    http_server_.BindReusePort(nullptr, options_.port);
+    for (const auto& server : http_servers_) {
+      server->BindReusePort(nullptr, options_.port);
+    }
+    for (const auto& server : https_servers_) {
+      server->BindReusePort(nullptr, FLAGS_tls_port);
+    }
+  }
+#ifdef HAVE_NGHTTP2
+  if (FLAGS_http2_port > 0) {
+    http2_server_.reset(
+        new Http2Server(event_base_.get(), url_fetcher_, options_.port));
+    http2_server_->Bind(nullptr, FLAGS_http2_port);
+  }
+#endif
 }
 
 template <class Logged>
 Server<Logged>::~Server() {
   server_task_.Cancel();
-  node_refresh_thread_->join();
+  if (node_refresh_thread_) {
+    node_refresh_thread_->join();
+  }
   server_task_.Wait();
 }
 
@@ -267,6 +514,19 @@ LogLookup<Logged>* Server<Logged>::log_lookup() {
 }
 
 
+template <class Logged>
+std::vector<libevent::HttpServer*> Server<Logged>::HttpServers() {
+  std::vector<libevent::HttpServer*> servers{&http_server_};
+  for (const auto& server : http_servers_) {
+    servers.push_back(server.get());
+  }
+  for (const auto& server : https_servers_) {
+    servers.push_back(server.get());
+  }
+  return servers;
+}
+
+
 template <class Logged>
 void Server<Logged>::WaitForReplication() const {
   // If we're joining an existing cluster, this node needs to get its database
@@ -294,8 +554,13 @@ void Server<Logged>::Initialise(bool is_mirror) {
   log_lookup_.reset(new LogLookup<LoggedCertificate>(db_));
 
   cluster_controller_.reset(new ClusterStateController<LoggedCertificate>(
-      internal_pool_, event_base_, url_fetcher_, db_, &consistent_store_,
+      &control_executor_, event_base_, url_fetcher_, db_, &consistent_store_,
       &election_, fetcher_.get()));
+  if (GossipEnabled()) {
+    cluster_controller_->EnableGossip(options_.gossip_verifier,
+                                      options_.path_prefix + kGossipPath,
+                                      FLAGS_cluster_gossip_fanout);
+  }
 
   // Publish this node's hostname:port info
   cluster_controller_->SetNodeHostPort(options_.server, options_.port);
@@ -307,28 +572,129 @@ void Server<Logged>::Initialise(bool is_mirror) {
     }
   }
 
-  node_refresh_thread_.reset(new std::thread(&RefreshNodeState,
-                                             cluster_controller_.get(),
-                                             server_task_.task()));
+  if (!options_.read_only_replica) {
+    node_refresh_thread_.reset(new std::thread(&RefreshNodeState,
+                                               cluster_controller_.get(),
+                                               server_task_.task()));
+  }
 
   proxy_.reset(
-      new Proxy(event_base_.get(), &json_output_,
+      new Proxy(&json_output_,
                 bind(&ClusterStateController<LoggedCertificate>::GetFreshNodes,
                      cluster_controller_.get()),
-                url_fetcher_, &http_pool_));
-  handler_.reset(new HttpHandler(&json_output_, log_lookup_.get(), db_,
+                url_fetcher_, http_pool_));
+  const int entry_cache_size_mb(options_.entry_cache_size_mb < 0
+                                    ? FLAGS_entry_cache_size_mb
+                                    : options_.entry_cache_size_mb);
+  entry_cache_.reset(new EntryCache(
+      db_, static_cast<size_t>(entry_cache_size_mb) << 20,
+      FLAGS_entry_cache_block_size));
+  handler_.reset(new HttpHandler(&json_output_, log_lookup_.get(),
+                                 entry_cache_.get(),
                                  cluster_controller_.get(), cert_checker_,
-                                 frontend_.get(), proxy_.get(), &http_pool_,
+                                 frontend_.get(), proxy_.get(), http_pool_,
                                  event_base_.get()));
 
-  handler_->Add(&http_server_);
+  handler_->SetReady(ready_);
+  if (options_.read_only_replica) {
+    handler_->SetReadOnlyReplica();
+  }
+  if (options_.entry_segments) {
+    handler_->ServeEntryRecords(options_.entry_segments);
+  }
+
+  if (options_.serve_http) {
+    for (libevent::HttpServer* server : HttpServers()) {
+      AddHandlers(server);
+    }
+  }
+}
+
+
+template <class Logged>
+void Server<Logged>::SetReady() {
+  CHECK(handler_) << "the server must be initialised first";
+  ready_ = true;
+  handler_->SetReady(true);
+}
+
+
+template <class Logged>
+void Server<Logged>::HandleUnknownPath(evhttp_request* req) {
+  if (ready_) {
+    return evhttp_send_error(req, HTTP_NOTFOUND, nullptr);
+  }
+  json_output_.SendError(req, HTTP_SERVUNAVAIL, "Starting up.");
+}
+
+
+template <class Logged>
+void Server<Logged>::AddLog(Server<Logged>* other) {
+  CHECK(options_.serve_http);
+  CHECK(!CHECK_NOTNULL(other)->options_.serve_http);
+  CHECK_EQ(event_base_, other->event_base_);
+  CHECK(other->handler_) << "the other log must be initialised first";
+  CHECK_NE(options_.path_prefix, other->options_.path_prefix);
+  for (libevent::HttpServer* server : HttpServers()) {
+    other->AddHandlers(server);
+  }
+}
+
+
+template <class Logged>
+bool Server<Logged>::GossipEnabled() const {
+  return options_.gossip_verifier && FLAGS_cluster_gossip_fanout > 0 &&
+         !options_.read_only_replica;
+}
+
+
+template <class Logged>
+void Server<Logged>::AddHandlers(libevent::HttpServer* server) {
+  handler_->Add(server, options_.path_prefix);
+  if (GossipEnabled()) {
+    CHECK(server->AddHandler(options_.path_prefix + kGossipPath,
+                             bind(&Server<Logged>::HandleGossip, this,
+                                  std::placeholders::_1)));
+  }
+}
+
+
+template <class Logged>
+void Server<Logged>::HandleGossip(evhttp_request* req) {
+  if (evhttp_request_get_command(req) != EVHTTP_REQ_POST) {
+    return json_output_.SendError(req, HTTP_BADMETHOD, "Method not allowed.");
+  }
+  evbuffer* const body(evhttp_request_get_input_buffer(req));
+  const size_t body_length(evbuffer_get_length(body));
+  if (body_length > kMaxGossipBytes) {
+    return json_output_.SendError(req, HTTP_ENTITYTOOLARGE,
+                                  "Request too large.");
+  }
+  ct::ClusterNodeState state;
+  if (!state.ParseFromArray(evbuffer_pullup(body, -1), body_length)) {
+    return json_output_.SendError(req, HTTP_BADREQUEST,
+                                  "Unable to parse the node state.");
+  }
+
+  const util::Status status(cluster_controller_->ReceiveGossip(state));
+  if (!status.ok()) {
+    return json_output_.SendError(req, HTTP_BADREQUEST,
+                                  status.error_message());
+  }
+  json_output_.SendJsonReply(req, HTTP_OK, std::string("{}"));
 }
 
 
 template <class Logged>
 void Server<Logged>::Run() {
+  CHECK(options_.serve_http);
   // Ding the temporary event pump because we're about to enter the event loop
   event_pump_.reset();
+  // The other event loops leave the signals to this one, which exits
+  // on them, and are stopped when this is destroyed.
+  for (const auto& base : http_bases_) {
+    http_pumps_.emplace_back(new libevent::EventPumpThread(base, false));
+  }
   event_base_->Dispatch();
 }
 
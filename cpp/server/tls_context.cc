@@ -0,0 +1,167 @@
+#include "server/tls_context.h"
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <openssl/rand.h>
+#include <string.h>
+
+#include "util/openssl_util.h"
+
+using std::chrono::hours;
+using std::chrono::steady_clock;
+using std::mutex;
+using std::string;
+using std::unique_lock;
+using util::DumpOpenSSLErrorStack;
+
+DEFINE_int32(tls_ticket_key_rotation_hours, 12,
+             "How often to change the key that TLS session tickets are "
+             "encrypted with, in hours. Tickets encrypted with the previous "
+             "key are still accepted.");
+DEFINE_string(tls_ciphers,
+              "ECDHE-ECDSA-AES128-GCM-SHA256:ECDHE-RSA-AES128-GCM-SHA256:"
+              "ECDHE-ECDSA-AES256-GCM-SHA384:ECDHE-RSA-AES256-GCM-SHA384:"
+              "ECDHE-ECDSA-AES128-SHA:ECDHE-RSA-AES128-SHA:AES128-GCM-SHA256:"
+              "AES128-SHA",
+              "OpenSSL cipher list for the TLS connections of the HTTPS "
+              "server.");
+
+namespace cert_trans {
+
+
+TlsContext::TlsContext(const string& cert_chain_file, const string& key_file)
+    : ssl_ctx_(SSL_CTX_new(SSLv23_server_method()), SSL_CTX_free) {
+  CHECK(ssl_ctx_) << "could not build SSL context: " << DumpOpenSSLErrorStack();
+  CHECK_GT(FLAGS_tls_ticket_key_rotation_hours, 0);
+
+  SSL_CTX_set_options(ssl_ctx_.get(), SSL_OP_NO_SSLv2 | SSL_OP_NO_SSLv3 |
+                                          SSL_OP_NO_COMPRESSION |
+                                          SSL_OP_CIPHER_SERVER_PREFERENCE);
+  // The write buffers of idle connections are released, as there can
+  // be many of them.
+  SSL_CTX_set_mode(ssl_ctx_.get(), SSL_MODE_RELEASE_BUFFERS);
+  CHECK_EQ(SSL_CTX_set_cipher_list(ssl_ctx_.get(), FLAGS_tls_ciphers.c_str()),
+           1)
+      << "invalid --tls_ciphers: " << DumpOpenSSLErrorStack();
+#ifdef SSL_CTX_set_ecdh_auto
+  SSL_CTX_set_ecdh_auto(ssl_ctx_.get(), 1);
+#endif
+
+  CHECK_EQ(SSL_CTX_use_certificate_chain_file(ssl_ctx_.get(),
+                                              cert_chain_file.c_str()),
+           1)
+      << "could not load the certificate chain from " << cert_chain_file
+      << ": " << DumpOpenSSLErrorStack();
+  CHECK_EQ(SSL_CTX_use_PrivateKey_file(ssl_ctx_.get(), key_file.c_str(),
+                                       SSL_FILETYPE_PEM),
+           1)
+      << "could not load the private key from " << key_file << ": "
+      << DumpOpenSSLErrorStack();
+  CHECK_EQ(SSL_CTX_check_private_key(ssl_ctx_.get()), 1)
+      << "the private key does not match the certificate: "
+      << DumpOpenSSLErrorStack();
+
+  // Resumption only goes through tickets, which need no state to be
+  // kept for each client.
+  SSL_CTX_set_session_cache_mode(ssl_ctx_.get(), SSL_SESS_CACHE_OFF);
+  CHECK_EQ(SSL_CTX_set_ex_data(ssl_ctx_.get(), GetIndex(), this), 1);
+  SSL_CTX_set_tlsext_ticket_key_cb(ssl_ctx_.get(), &TicketKeyCallback);
+  RotateTicketKeys();
+}
+
+
+TlsContext::~TlsContext() {
+  // The keys are not left lying around in memory.
+  for (TicketKey& key : ticket_keys_) {
+    OPENSSL_cleanse(&key, sizeof(key));
+  }
+}
+
+
+void TlsContext::RotateTicketKeys() {
+  unique_lock<mutex> lock(lock_);
+  RotateTicketKeysLocked(lock);
+}
+
+
+// static
+int TlsContext::GetIndex() {
+  static const int index(
+      SSL_CTX_get_ex_new_index(0, nullptr, nullptr, nullptr, nullptr));
+  return index;
+}
+
+
+// static
+int TlsContext::TicketKeyCallback(SSL* ssl, unsigned char* key_name,
+                                  unsigned char* iv,
+                                  EVP_CIPHER_CTX* cipher_ctx,
+                                  HMAC_CTX* hmac_ctx, int encrypt) {
+  TlsContext* const context(static_cast<TlsContext*>(CHECK_NOTNULL(
+      SSL_CTX_get_ex_data(SSL_get_SSL_CTX(ssl), GetIndex()))));
+  return context->TicketKeys(key_name, iv, cipher_ctx, hmac_ctx, encrypt);
+}
+
+
+int TlsContext::TicketKeys(unsigned char* key_name, unsigned char* iv,
+                           EVP_CIPHER_CTX* cipher_ctx, HMAC_CTX* hmac_ctx,
+                           bool encrypt) {
+  unique_lock<mutex> lock(lock_);
+  if (steady_clock::now() - ticket_keys_.front().created >=
+      hours(FLAGS_tls_ticket_key_rotation_hours)) {
+    RotateTicketKeysLocked(lock);
+  }
+
+  if (encrypt) {
+    const TicketKey& key(ticket_keys_.front());
+    if (RAND_bytes(iv, EVP_CIPHER_iv_length(EVP_aes_128_cbc())) != 1) {
+      LOG(WARNING) << "could not generate a ticket IV: "
+                   << DumpOpenSSLErrorStack();
+      return -1;
+    }
+    memcpy(key_name, key.name, sizeof(key.name));
+    CHECK_EQ(EVP_EncryptInit_ex(cipher_ctx, EVP_aes_128_cbc(), nullptr,
+                                key.aes_key, iv),
+             1);
+    CHECK_EQ(HMAC_Init_ex(hmac_ctx, key.hmac_key, sizeof(key.hmac_key),
+                          EVP_sha256(), nullptr),
+             1);
+    return 1;
+  }
+
+  for (size_t i = 0; i < ticket_keys_.size(); ++i) {
+    const TicketKey& key(ticket_keys_[i]);
+    if (memcmp(key_name, key.name, sizeof(key.name)) != 0) {
+      continue;
+    }
+    CHECK_EQ(HMAC_Init_ex(hmac_ctx, key.hmac_key, sizeof(key.hmac_key),
+                          EVP_sha256(), nullptr),
+             1);
+    CHECK_EQ(EVP_DecryptInit_ex(cipher_ctx, EVP_aes_128_cbc(), nullptr,
+                                key.aes_key, iv),
+             1);
+    return i == 0 ? 1 : 2;
+  }
+  // Too old, or from another server.
+  return 0;
+}
+
+
+void TlsContext::RotateTicketKeysLocked(const unique_lock<mutex>& lock) {
+  CHECK(lock.owns_lock());
+  TicketKey key;
+  CHECK(RAND_bytes(key.name, sizeof(key.name)) == 1 &&
+        RAND_bytes(key.aes_key, sizeof(key.aes_key)) == 1 &&
+        RAND_bytes(key.hmac_key, sizeof(key.hmac_key)) == 1)
+      << "could not generate a ticket key: " << DumpOpenSSLErrorStack();
+  key.created = steady_clock::now();
+  ticket_keys_.push_front(key);
+  OPENSSL_cleanse(&key, sizeof(key));
+  while (ticket_keys_.size() > 2) {
+    OPENSSL_cleanse(&ticket_keys_.back(), sizeof(TicketKey));
+    ticket_keys_.pop_back();
+  }
+}
+
+
+}  // namespace cert_trans
@@ -0,0 +1,71 @@
+#ifndef CERT_TRANS_SERVER_TLS_CONTEXT_H_
+#define CERT_TRANS_SERVER_TLS_CONTEXT_H_
+
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+#include <openssl/ssl.h>
+#include <string>
+
+#include "base/macros.h"
+
+namespace cert_trans {
+
+
+// The TLS settings for serving HTTPS: the certificate chain, which can
+// be for an ECDSA or an RSA key, and the keys for session tickets, so
+// that clients can resume their sessions without doing a full
+// handshake. The ticket keys are generated at random, and rotated
+// every --tls_ticket_key_rotation_hours, the previous one still being
+// accepted for as long, after which the clients do a full handshake
+// again. Thread-safe.
+class TlsContext {
+ public:
+  // CHECK-fails if the certificate chain or the key cannot be loaded
+  // from their PEM files, or do not match.
+  TlsContext(const std::string& cert_chain_file, const std::string& key_file);
+  ~TlsContext();
+
+  SSL_CTX* ssl_ctx() const {
+    return ssl_ctx_.get();
+  }
+
+  // Visible for testing.
+  void RotateTicketKeys();
+
+ private:
+  struct TicketKey {
+    unsigned char name[16];
+    unsigned char aes_key[16];
+    unsigned char hmac_key[16];
+    std::chrono::steady_clock::time_point created;
+  };
+
+  static int GetIndex();
+  static int TicketKeyCallback(SSL* ssl, unsigned char* key_name,
+                               unsigned char* iv, EVP_CIPHER_CTX* cipher_ctx,
+                               HMAC_CTX* hmac_ctx, int encrypt);
+
+  // Returns 1 if encrypting, or the key was found for decrypting, 2 if
+  // it was the previous one and the ticket should be renewed, or 0 if
+  // the ticket cannot be decrypted.
+  int TicketKeys(unsigned char* key_name, unsigned char* iv,
+                 EVP_CIPHER_CTX* cipher_ctx, HMAC_CTX* hmac_ctx, bool encrypt);
+  void RotateTicketKeysLocked(const std::unique_lock<std::mutex>& lock);
+
+  const std::unique_ptr<SSL_CTX, void (*)(SSL_CTX*)> ssl_ctx_;
+
+  std::mutex lock_;
+  // The current key first, then the previous one.
+  std::deque<TicketKey> ticket_keys_;
+
+  DISALLOW_COPY_AND_ASSIGN(TlsContext);
+};
+
+
+}  // namespace cert_trans
+
+#endif  // CERT_TRANS_SERVER_TLS_CONTEXT_H_
@@ -0,0 +1,158 @@
+#include "server/tls_context.h"
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+#include <memory>
+#include <openssl/bio.h>
+#include <openssl/ssl.h>
+#include <string>
+
+#include "util/testing.h"
+
+DEFINE_string(cert_dir, "test/testdata/urlfetcher_test_certs",
+              "Directory containing the test certs.");
+
+namespace cert_trans {
+namespace {
+
+using std::unique_ptr;
+
+
+typedef unique_ptr<SSL_SESSION, void (*)(SSL_SESSION*)> SessionPtr;
+
+
+// Does a handshake with |server_ctx|, through memory BIOs, resuming
+// |session| if not null. Returns the session the client ended up
+// with, which is null if the handshake failed.
+SessionPtr Handshake(SSL_CTX* server_ctx, SSL_SESSION* session,
+                     bool* resumed) {
+  const unique_ptr<SSL_CTX, void (*)(SSL_CTX*)> client_ctx(
+      SSL_CTX_new(SSLv23_client_method()), SSL_CTX_free);
+  CHECK(client_ctx);
+  const unique_ptr<SSL, void (*)(SSL*)> client(SSL_new(client_ctx.get()),
+                                               SSL_free);
+  const unique_ptr<SSL, void (*)(SSL*)> server(SSL_new(server_ctx), SSL_free);
+  CHECK(client && server);
+  // TLS 1.3 tickets are only sent after the handshake, which this
+  // exchange of messages does not wait for.
+#ifdef SSL_OP_NO_TLSv1_3
+  SSL_set_options(client.get(), SSL_OP_NO_TLSv1_3);
+#endif
+  if (session) {
+    CHECK_EQ(SSL_set_session(client.get(), session), 1);
+  }
+
+  BIO* client_bio;
+  BIO* server_bio;
+  CHECK_EQ(BIO_new_bio_pair(&client_bio, 0, &server_bio, 0), 1);
+  SSL_set_bio(client.get(), client_bio, client_bio);
+  SSL_set_bio(server.get(), server_bio, server_bio);
+  SSL_set_connect_state(client.get());
+  SSL_set_accept_state(server.get());
+
+  bool client_done(false), server_done(false);
+  for (int i = 0; i < 10 && !(client_done && server_done); ++i) {
+    if (!client_done) {
+      const int ret(SSL_do_handshake(client.get()));
+      if (ret != 1 &&
+          SSL_get_error(client.get(), ret) != SSL_ERROR_WANT_READ) {
+        return SessionPtr(nullptr, SSL_SESSION_free);
+      }
+      client_done = ret == 1;
+    }
+    if (!server_done) {
+      const int ret(SSL_do_handshake(server.get()));
+      if (ret != 1 &&
+          SSL_get_error(server.get(), ret) != SSL_ERROR_WANT_READ) {
+        return SessionPtr(nullptr, SSL_SESSION_free);
+      }
+      server_done = ret == 1;
+    }
+  }
+  if (!client_done || !server_done) {
+    return SessionPtr(nullptr, SSL_SESSION_free);
+  }
+
+  *resumed = SSL_session_reused(client.get()) == 1;
+  // Otherwise, freeing |client| makes its session not resumable.
+  SSL_shutdown(client.get());
+  return SessionPtr(SSL_get1_session(client.get()), SSL_SESSION_free);
+}
+
+
+class TlsContextTest : public ::testing::Test {
+ protected:
+  TlsContextTest()
+      : context_(FLAGS_cert_dir + "/localhost-cert.pem",
+                 FLAGS_cert_dir + "/localhost-key.pem") {
+  }
+
+  TlsContext context_;
+};
+
+
+TEST_F(TlsContextTest, ResumesWithTicket) {
+  bool resumed(true);
+  const SessionPtr session(Handshake(context_.ssl_ctx(), nullptr, &resumed));
+  ASSERT_TRUE(session);
+  EXPECT_FALSE(resumed);
+
+  const SessionPtr resumed_session(
+      Handshake(context_.ssl_ctx(), session.get(), &resumed));
+  ASSERT_TRUE(resumed_session);
+  EXPECT_TRUE(resumed);
+}
+
+
+TEST_F(TlsContextTest, ResumesWithPreviousKey) {
+  bool resumed(true);
+  const SessionPtr session(Handshake(context_.ssl_ctx(), nullptr, &resumed));
+  ASSERT_TRUE(session);
+
+  context_.RotateTicketKeys();
+  const SessionPtr resumed_session(
+      Handshake(context_.ssl_ctx(), session.get(), &resumed));
+  ASSERT_TRUE(resumed_session);
+  EXPECT_TRUE(resumed);
+}
+
+
+TEST_F(TlsContextTest, DoesFullHandshakeWithExpiredKey) {
+  bool resumed(true);
+  const SessionPtr session(Handshake(context_.ssl_ctx(), nullptr, &resumed));
+  ASSERT_TRUE(session);
+
+  context_.RotateTicketKeys();
+  context_.RotateTicketKeys();
+  const SessionPtr new_session(
+      Handshake(context_.ssl_ctx(), session.get(), &resumed));
+  ASSERT_TRUE(new_session);
+  EXPECT_FALSE(resumed);
+}
+
+
+TEST_F(TlsContextTest, DoesFullHandshakeWithOtherServersTicket) {
+  TlsContext other(FLAGS_cert_dir + "/localhost-cert.pem",
+                   FLAGS_cert_dir + "/localhost-key.pem");
+  bool resumed(true);
+  const SessionPtr session(Handshake(other.ssl_ctx(), nullptr, &resumed));
+  ASSERT_TRUE(session);
+
+  const SessionPtr new_session(
+      Handshake(context_.ssl_ctx(), session.get(), &resumed));
+  ASSERT_TRUE(new_session);
+  EXPECT_FALSE(resumed);
+}
+
+
+}  // namespace
+}  // namespace cert_trans
+
+
+int main(int argc, char** argv) {
+  cert_trans::test::InitTesting(argv[0], &argc, &argv, true);
+  SSL_library_init();
+  SSL_load_error_strings();
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,161 @@
+#include "server/traffic_capture.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <glog/logging.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <vector>
+
+#include "util/util.h"
+
+using std::chrono::seconds;
+using std::chrono::steady_clock;
+using std::lock_guard;
+using std::mutex;
+using std::string;
+using std::to_string;
+using std::vector;
+
+namespace cert_trans {
+namespace {
+
+const size_t kSha256Size = 32;
+// Beyond this, the lines are written out right away.
+const size_t kMaxBufferedBytes = 1 << 16;
+
+
+bool ParseInt(const string& field, int64_t* value) {
+  if (field.empty()) {
+    return false;
+  }
+  char* end;
+  errno = 0;
+  *value = strtoll(field.c_str(), &end, 10);
+  return errno == 0 && *end == '\0' && *value >= 0;
+}
+
+
+bool IsHex(const string& field) {
+  for (const char c : field) {
+    if (!isxdigit(static_cast<unsigned char>(c))) {
+      return false;
+    }
+  }
+  return true;
+}
+
+
+// Splits |line| at its tabs, keeping the empty fields.
+vector<string> SplitFields(const string& line) {
+  vector<string> fields;
+  size_t begin(0);
+  while (true) {
+    const size_t end(line.find('\t', begin));
+    fields.emplace_back(line.substr(begin, end - begin));
+    if (end == string::npos) {
+      return fields;
+    }
+    begin = end + 1;
+  }
+}
+
+
+}  // namespace
+
+
+string FormatCapturedRequest(const CapturedRequest& request) {
+  return to_string(request.time_us) + '\t' + request.method + '\t' +
+         request.uri + '\t' + to_string(request.body_size) + '\t' +
+         (request.body_sha256.empty() ? "-"
+                                      : util::HexString(request.body_sha256)) +
+         '\t' + to_string(request.latency_us);
+}
+
+
+bool ParseCapturedRequest(const string& line, CapturedRequest* request) {
+  const vector<string> fields(SplitFields(line));
+  if (fields.size() != 6 || fields[1].empty() || fields[2].empty() ||
+      !ParseInt(fields[0], &request->time_us) ||
+      !ParseInt(fields[3], &request->body_size) ||
+      !ParseInt(fields[5], &request->latency_us)) {
+    return false;
+  }
+  request->method = fields[1];
+  request->uri = fields[2];
+  if (fields[4] == "-") {
+    request->body_sha256.clear();
+  } else if (fields[4].size() == 2 * kSha256Size && IsHex(fields[4])) {
+    request->body_sha256 = util::BinaryString(fields[4]);
+  } else {
+    return false;
+  }
+  return true;
+}
+
+
+TrafficCapture::TrafficCapture(const string& path, int one_in)
+    : path_(path),
+      one_in_(one_in),
+      seen_(0),
+      fd_(open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644)),
+      last_flush_(steady_clock::now()) {
+  CHECK_GT(one_in_, 0);
+  PCHECK(fd_ >= 0) << "cannot open " << path_;
+}
+
+
+TrafficCapture::~TrafficCapture() {
+  {
+    lock_guard<mutex> lock(lock_);
+    FlushLocked();
+  }
+  close(fd_);
+}
+
+
+bool TrafficCapture::Sample() {
+  return seen_.fetch_add(1) % one_in_ == 0;
+}
+
+
+void TrafficCapture::Record(const CapturedRequest& request) {
+  // A tab or newline in the URI would make the line unreadable; the
+  // clients are supposed to escape them.
+  if (request.uri.find_first_of("\t\n") != string::npos) {
+    VLOG(1) << "Not capturing a request with a tab or newline in its URI";
+    return;
+  }
+  const string line(FormatCapturedRequest(request) + '\n');
+
+  lock_guard<mutex> lock(lock_);
+  buffer_.append(line);
+  if (buffer_.size() >= kMaxBufferedBytes ||
+      steady_clock::now() - last_flush_ >= seconds(1)) {
+    FlushLocked();
+  }
+}
+
+
+void TrafficCapture::FlushLocked() {
+  last_flush_ = steady_clock::now();
+  size_t written(0);
+  while (written < buffer_.size()) {
+    const ssize_t ret(
+        write(fd_, buffer_.data() + written, buffer_.size() - written));
+    if (ret < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      PLOG(WARNING) << "cannot write to " << path_ << ", dropping "
+                    << buffer_.size() - written << " bytes of capture";
+      break;
+    }
+    written += ret;
+  }
+  buffer_.clear();
+}
+
+
+}  // namespace cert_trans
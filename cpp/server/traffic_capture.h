@@ -0,0 +1,83 @@
+#ifndef CERT_TRANS_SERVER_TRAFFIC_CAPTURE_H_
+#define CERT_TRANS_SERVER_TRAFFIC_CAPTURE_H_
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+
+#include "base/macros.h"
+
+namespace cert_trans {
+
+
+// The metadata of one request, as recorded by TrafficCapture: enough
+// to reissue the read requests as they were, and to tell the write
+// requests apart, but not their bodies.
+struct CapturedRequest {
+  CapturedRequest() : time_us(0), body_size(0), latency_us(0) {
+  }
+
+  // When the request came in, in microseconds since the epoch.
+  int64_t time_us;
+  // "GET", "POST", or "OTHER".
+  std::string method;
+  // The path and the query string, as sent by the client.
+  std::string uri;
+  int64_t body_size;
+  // The SHA-256 digest of the body, empty if there was none.
+  std::string body_sha256;
+  // How long the handler ran for, in microseconds. For the requests
+  // handed over to another thread (e.g. add-chain), this does not
+  // include the work done there.
+  int64_t latency_us;
+};
+
+
+// Formats |request| as one tab-separated line, without the newline:
+// the time, method, URI, body size, hex digest of the body (or "-")
+// and latency.
+std::string FormatCapturedRequest(const CapturedRequest& request);
+
+// The reverse of FormatCapturedRequest(). Returns false if |line| is
+// not a valid record.
+bool ParseCapturedRequest(const std::string& line, CapturedRequest* request);
+
+
+// Appends one in every |one_in| of the requests it is shown to a
+// file, one line each. The lines are buffered, and written out with
+// the first one recorded a second or more after the last write, when
+// they add up to 64kB, or when the capture is destroyed. Thread-safe.
+class TrafficCapture {
+ public:
+  // Dies if |path| cannot be opened.
+  TrafficCapture(const std::string& path, int one_in);
+  ~TrafficCapture();
+
+  // Whether the next request is to be recorded. Only the requests for
+  // which it returned true should be passed to Record().
+  bool Sample();
+
+  void Record(const CapturedRequest& request);
+
+ private:
+  // Writes out |buffer_|. Must be called with |lock_| held.
+  void FlushLocked();
+
+  const std::string path_;
+  const int one_in_;
+  std::atomic<uint64_t> seen_;
+
+  std::mutex lock_;
+  const int fd_;
+  std::string buffer_;
+  std::chrono::steady_clock::time_point last_flush_;
+
+  DISALLOW_COPY_AND_ASSIGN(TrafficCapture);
+};
+
+
+}  // namespace cert_trans
+
+#endif  // CERT_TRANS_SERVER_TRAFFIC_CAPTURE_H_
@@ -0,0 +1,104 @@
+#include "server/traffic_capture.h"
+
+#include <gtest/gtest.h>
+#include <string>
+#include <vector>
+
+#include "util/testing.h"
+#include "util/util.h"
+
+namespace cert_trans {
+namespace {
+
+using std::string;
+using std::vector;
+
+
+CapturedRequest AddChainRequest() {
+  CapturedRequest request;
+  request.time_us = 1234567890123456;
+  request.method = "POST";
+  request.uri = "/ct/v1/add-chain";
+  request.body_size = 2048;
+  request.body_sha256 = string(32, '\xab');
+  request.latency_us = 321;
+  return request;
+}
+
+
+TEST(TrafficCaptureTest, FormatsAndParses) {
+  const CapturedRequest request(AddChainRequest());
+  CapturedRequest parsed;
+  ASSERT_TRUE(ParseCapturedRequest(FormatCapturedRequest(request), &parsed));
+  EXPECT_EQ(request.time_us, parsed.time_us);
+  EXPECT_EQ(request.method, parsed.method);
+  EXPECT_EQ(request.uri, parsed.uri);
+  EXPECT_EQ(request.body_size, parsed.body_size);
+  EXPECT_EQ(request.body_sha256, parsed.body_sha256);
+  EXPECT_EQ(request.latency_us, parsed.latency_us);
+
+  CapturedRequest get;
+  get.time_us = 1;
+  get.method = "GET";
+  get.uri = "/ct/v1/get-entries?start=0&end=9";
+  EXPECT_EQ("1\tGET\t/ct/v1/get-entries?start=0&end=9\t0\t-\t0",
+            FormatCapturedRequest(get));
+  ASSERT_TRUE(ParseCapturedRequest(FormatCapturedRequest(get), &parsed));
+  EXPECT_EQ(get.uri, parsed.uri);
+  EXPECT_TRUE(parsed.body_sha256.empty());
+}
+
+
+TEST(TrafficCaptureTest, RejectsInvalidLines) {
+  CapturedRequest parsed;
+  EXPECT_FALSE(ParseCapturedRequest("", &parsed));
+  EXPECT_FALSE(ParseCapturedRequest("1\tGET\t/ct/v1/get-sth\t0\t-", &parsed));
+  EXPECT_FALSE(
+      ParseCapturedRequest("x\tGET\t/ct/v1/get-sth\t0\t-\t5", &parsed));
+  EXPECT_FALSE(
+      ParseCapturedRequest("1\tGET\t/ct/v1/get-sth\t0\tabcd\t5", &parsed));
+  EXPECT_FALSE(
+      ParseCapturedRequest("1\tGET\t/ct/v1/get-sth\t0\t-\t5\t6", &parsed));
+  EXPECT_FALSE(ParseCapturedRequest("1\tGET\t\t0\t-\t5", &parsed));
+}
+
+
+TEST(TrafficCaptureTest, RecordsOneInN) {
+  const string path(
+      util::CreateTemporaryDirectory("/tmp/traffic_capture_testXXXXXX") +
+      "/capture");
+  {
+    TrafficCapture capture(path, 3);
+    for (int i = 0; i < 10; ++i) {
+      if (capture.Sample()) {
+        CapturedRequest request(AddChainRequest());
+        request.time_us = i;
+        capture.Record(request);
+      }
+    }
+    // Not recorded, since it could not be read back.
+    CapturedRequest request(AddChainRequest());
+    request.uri = "/ct/v1/get-sth\tx";
+    capture.Record(request);
+  }
+
+  string contents;
+  ASSERT_TRUE(util::ReadBinaryFile(path, &contents));
+  const vector<string> lines(util::split(contents, '\n'));
+  ASSERT_EQ(4U, lines.size());
+  for (size_t i = 0; i < lines.size(); ++i) {
+    CapturedRequest parsed;
+    ASSERT_TRUE(ParseCapturedRequest(lines[i], &parsed)) << lines[i];
+    EXPECT_EQ(static_cast<int64_t>(3 * i), parsed.time_us);
+  }
+}
+
+
+}  // namespace
+}  // namespace cert_trans
+
+
+int main(int argc, char** argv) {
+  cert_trans::test::InitTesting(argv[0], &argc, &argv, true);
+  return RUN_ALL_TESTS();
+}
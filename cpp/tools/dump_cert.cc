@@ -2,22 +2,29 @@
 #include <gflags/gflags.h>
 #include <glog/logging.h>
 #include <iostream>
+#include <iterator>
+#include <string>
 
-#include "proto/ct.pb.h"
+#include "log/logged_certificate.h"
 #include "util/init.h"
 #include "util/util.h"
 
 using std::cout;
 using std::endl;
 using std::ifstream;
+using std::istreambuf_iterator;
+using std::string;
 
 namespace {
 
 
 void DumpLoggedCert(const char* filename) {
   ifstream input(filename);
-  ct::LoggedCertificatePB pb;
-  CHECK(pb.ParseFromIstream(&input));
+  const string data((istreambuf_iterator<char>(input)),
+                    istreambuf_iterator<char>());
+  CHECK(!input.bad()) << "Failed to read " << filename;
+  cert_trans::LoggedCertificate pb;
+  CHECK(pb.ParseFromStorage(data));
 
   if (pb.has_sequence_number())
     cout << "sequence number: " << pb.sequence_number() << endl;
@@ -0,0 +1,298 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <iostream>
+#include <memory>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "config.h"
+#include "log/database.h"
+#include "log/file_db.h"
+#include "log/file_storage.h"
+#include "log/leveldb_db.h"
+#include "log/logged_certificate.h"
+#include "log/prefetching_iterator.h"
+#ifdef HAVE_ROCKSDB
+#include "log/rocksdb_db.h"
+#endif
+#include "log/segment_storage.h"
+#include "log/sqlite_db.h"
+#include "proto/serializer.h"
+#include "util/base64.h"
+#include "util/init.h"
+#include "util/thread_pool.h"
+
+DEFINE_string(cert_dir, "", "Storage directory for certificates");
+DEFINE_string(tree_dir, "", "Storage directory for trees");
+DEFINE_string(meta_dir, "", "Storage directory for meta info");
+DEFINE_string(sqlite_db, "",
+              "SQLite database for certificate and tree storage");
+DEFINE_string(leveldb_db, "",
+              "LevelDB database for certificate and tree storage");
+DEFINE_string(rocksdb_db, "",
+              "RocksDB database for certificate and tree storage");
+DEFINE_int32(cert_storage_depth, 0,
+             "Subdirectory depth for certificates; must match the existing "
+             "depth.");
+DEFINE_int32(tree_storage_depth, 0,
+             "Subdirectory depth for tree signatures; must match the "
+             "existing depth.");
+DEFINE_int32(cert_segment_size_mb, 0,
+             "If not 0, --cert_dir holds segment files of about this many "
+             "MiB, as written by a server with the same flag.");
+DEFINE_string(output, "",
+              "Prefix of the output files; shard N of M is written to "
+              "<prefix>-NNNNN-of-MMMMM.");
+DEFINE_string(format, "records",
+              "\"records\" for each entry as stored by the databases, "
+              "\"leaves\" for each MerkleTreeLeaf, both preceded by their "
+              "length as 4 big-endian bytes, or \"csv\" for one line of "
+              "sequence number, timestamp, entry type and base64 leaf hash "
+              "per entry.");
+DEFINE_int64(start, 0, "First sequence number to export.");
+DEFINE_int64(end, -1,
+             "Sequence number after the last one to export; the number of "
+             "contiguous entries in the database if negative.");
+DEFINE_int32(shards, 0,
+             "Number of ranges of entries, each scanned and written to its "
+             "own file; --threads if 0.");
+DEFINE_int32(threads, 8, "Number of shards exported at once.");
+DEFINE_string(entry_type, "",
+              "If \"x509\" or \"precert\", only export the entries of that "
+              "type.");
+DEFINE_uint64(min_timestamp, 0,
+              "Only export the entries with an SCT timestamp at least this, "
+              "in milliseconds since the epoch.");
+DEFINE_uint64(max_timestamp, 0,
+              "If not 0, only export the entries with an SCT timestamp at "
+              "most this, in milliseconds since the epoch.");
+
+namespace cert_trans {
+namespace {
+
+using std::string;
+using std::unique_ptr;
+using std::vector;
+
+// How many entries are read from the database at once.
+const size_t kReadBlockEntries = 1000;
+// How much output is buffered before it is written out.
+const size_t kWriteBufferBytes = 1 << 20;
+
+
+struct ShardStats {
+  int64_t scanned = 0;
+  int64_t exported = 0;
+  int64_t bytes = 0;
+};
+
+
+ReadOnlyDatabase<LoggedCertificate>* OpenDatabase() {
+  if (!FLAGS_sqlite_db.empty()) {
+    return new SQLiteDB<LoggedCertificate>(FLAGS_sqlite_db);
+  }
+  if (!FLAGS_leveldb_db.empty()) {
+    return new LevelDB<LoggedCertificate>(FLAGS_leveldb_db);
+  }
+#ifdef HAVE_ROCKSDB
+  if (!FLAGS_rocksdb_db.empty()) {
+    return new RocksDB<LoggedCertificate>(FLAGS_rocksdb_db);
+  }
+#endif
+  KeyValueStorage* cert_storage;
+  if (FLAGS_cert_segment_size_mb > 0) {
+    cert_storage = new SegmentStorage(
+        FLAGS_cert_dir, static_cast<off_t>(FLAGS_cert_segment_size_mb) << 20);
+  } else {
+    cert_storage = new FileStorage(FLAGS_cert_dir, FLAGS_cert_storage_depth);
+  }
+  return new FileDB<LoggedCertificate>(
+      cert_storage, new FileStorage(FLAGS_tree_dir, FLAGS_tree_storage_depth),
+      new FileStorage(FLAGS_meta_dir, 0));
+}
+
+
+bool ShouldExport(const LoggedCertificate& logged) {
+  if (FLAGS_entry_type == "x509" &&
+      logged.contents().entry().type() != ct::X509_ENTRY) {
+    return false;
+  }
+  if (FLAGS_entry_type == "precert" &&
+      logged.contents().entry().type() != ct::PRECERT_ENTRY) {
+    return false;
+  }
+  const uint64_t timestamp(logged.timestamp());
+  return timestamp >= FLAGS_min_timestamp &&
+         (FLAGS_max_timestamp == 0 || timestamp <= FLAGS_max_timestamp);
+}
+
+
+// Appends |data|, preceded by its length, to |out|.
+void AppendLengthPrefixed(const string& data, string* out) {
+  out->append(Serializer::SerializeUint(data.size(), 4));
+  out->append(data);
+}
+
+
+void AppendEntry(const LoggedCertificate& logged, string* out) {
+  string data;
+  if (FLAGS_format == "records") {
+    CHECK(logged.SerializeForStorage(&data));
+    AppendLengthPrefixed(data, out);
+  } else if (FLAGS_format == "leaves") {
+    CHECK(logged.SerializeForLeaf(&data));
+    AppendLengthPrefixed(data, out);
+  } else {
+    CHECK(logged.LeafHash(&data));
+    out->append(std::to_string(logged.sequence_number()));
+    out->push_back(',');
+    out->append(std::to_string(logged.timestamp()));
+    out->push_back(',');
+    out->append(ct::LogEntryType_Name(logged.contents().entry().type()));
+    out->push_back(',');
+    out->append(util::ToBase64(data));
+    out->push_back('\n');
+  }
+}
+
+
+// Exports the entries with sequence numbers in [|begin|, |end|) to
+// |path|. Each shard has its own iterator and output file, so that
+// the shards only share the database.
+void ExportShard(const ReadOnlyDatabase<LoggedCertificate>* db,
+                 int64_t begin, int64_t end, const string& path,
+                 ShardStats* stats) {
+  std::ofstream output(path, std::ios::binary | std::ios::trunc);
+  CHECK(output) << "could not open " << path;
+
+  const unique_ptr<ReadOnlyDatabase<LoggedCertificate>::Iterator> it(
+      ScanEntriesPrefetching(db, begin, end - begin));
+  string buffer;
+  buffer.reserve(kWriteBufferBytes + kWriteBufferBytes / 4);
+  vector<LoggedCertificate> entries;
+  int64_t next(begin);
+  while (next < end) {
+    entries.clear();
+    if (it->GetNextEntries(
+            std::min<int64_t>(kReadBlockEntries, end - next), &entries) ==
+        0) {
+      break;
+    }
+    for (const LoggedCertificate& logged : entries) {
+      next = logged.sequence_number() + 1;
+      if (logged.sequence_number() >= end) {
+        break;
+      }
+      ++stats->scanned;
+      if (!ShouldExport(logged)) {
+        continue;
+      }
+      ++stats->exported;
+      AppendEntry(logged, &buffer);
+    }
+    if (buffer.size() >= kWriteBufferBytes) {
+      output.write(buffer.data(), buffer.size());
+      stats->bytes += buffer.size();
+      buffer.clear();
+    }
+  }
+  output.write(buffer.data(), buffer.size());
+  stats->bytes += buffer.size();
+  output.close();
+  CHECK(output) << "could not write " << path;
+}
+
+
+string ShardPath(int shard, int num_shards) {
+  char suffix[32];
+  snprintf(suffix, sizeof(suffix), "-%05d-of-%05d", shard, num_shards);
+  return FLAGS_output + suffix;
+}
+
+
+}  // namespace
+}  // namespace cert_trans
+
+
+int main(int argc, char* argv[]) {
+  using cert_trans::ShardStats;
+
+  util::InitCT(&argc, &argv);
+
+  CHECK(!FLAGS_output.empty()) << "--output is required";
+  CHECK(FLAGS_format == "records" || FLAGS_format == "leaves" ||
+        FLAGS_format == "csv")
+      << "unknown --format: " << FLAGS_format;
+  CHECK(FLAGS_entry_type.empty() || FLAGS_entry_type == "x509" ||
+        FLAGS_entry_type == "precert")
+      << "unknown --entry_type: " << FLAGS_entry_type;
+  CHECK_EQ(!FLAGS_sqlite_db.empty() + !FLAGS_leveldb_db.empty() +
+               !FLAGS_rocksdb_db.empty() + !FLAGS_cert_dir.empty(),
+           1)
+      << "must specify exactly one database";
+#ifndef HAVE_ROCKSDB
+  CHECK(FLAGS_rocksdb_db.empty()) << "this binary was built without RocksDB "
+                                     "support";
+#endif
+  CHECK_GE(FLAGS_start, 0);
+  CHECK_GT(FLAGS_threads, 0);
+  CHECK_GE(FLAGS_shards, 0);
+
+  // Only the read-only interface is used, but the databases are
+  // opened as by the servers: stop any server using a LevelDB or
+  // RocksDB database first, as they can only be opened once.
+  const std::unique_ptr<ReadOnlyDatabase<LoggedCertificate>> db(
+      cert_trans::OpenDatabase());
+  const int64_t end(FLAGS_end < 0 ? db->TreeSize() : FLAGS_end);
+  CHECK_GE(end, FLAGS_start);
+
+  const int num_shards(FLAGS_shards > 0 ? FLAGS_shards : FLAGS_threads);
+  const int64_t shard_size((end - FLAGS_start + num_shards - 1) / num_shards);
+  LOG(INFO) << "exporting entries " << FLAGS_start << " to " << end << " in "
+            << num_shards << " shards";
+
+  const std::chrono::steady_clock::time_point start_time(
+      std::chrono::steady_clock::now());
+  std::vector<ShardStats> stats(num_shards);
+  {
+    cert_trans::ThreadPool pool(FLAGS_threads);
+    for (int i = 0; i < num_shards; ++i) {
+      const int64_t begin(
+          std::min(end, FLAGS_start + static_cast<int64_t>(i) * shard_size));
+      const int64_t shard_end(std::min(end, begin + shard_size));
+      const std::string path(cert_trans::ShardPath(i, num_shards));
+      ShardStats* const shard_stats(&stats[i]);
+      pool.Add([&db, begin, shard_end, path, shard_stats]() {
+        cert_trans::ExportShard(db.get(), begin, shard_end, path,
+                                shard_stats);
+      });
+    }
+    // The destructor waits for the shards to be done.
+  }
+  const double seconds(
+      std::chrono::duration_cast<std::chrono::milliseconds>(
+          std::chrono::steady_clock::now() - start_time)
+          .count() /
+      1000.0);
+
+  ShardStats total;
+  for (const ShardStats& shard : stats) {
+    total.scanned += shard.scanned;
+    total.exported += shard.exported;
+    total.bytes += shard.bytes;
+  }
+  std::cout << "scanned " << total.scanned << " entries, exported "
+            << total.exported << " (" << total.bytes << " bytes) in "
+            << seconds << "s";
+  if (seconds > 0) {
+    std::cout << ", " << total.bytes / seconds / (1 << 20) << " MiB/s";
+  }
+  std::cout << std::endl;
+
+  return 0;
+}
@@ -0,0 +1,338 @@
+#include <algorithm>
+#include <fstream>
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "config.h"
+#include "log/database.h"
+#include "log/file_db.h"
+#include "log/file_storage.h"
+#include "log/leveldb_db.h"
+#include "log/logged_certificate.h"
+#include "log/prefetching_iterator.h"
+#ifdef HAVE_ROCKSDB
+#include "log/rocksdb_db.h"
+#endif
+#include "log/segment_storage.h"
+#include "log/sqlite_db.h"
+#include "merkletree/fixed_compact_merkle_tree.h"
+#include "merkletree/serial_hasher.h"
+#include "merkletree/tree_hasher.h"
+#include "proto/serializer.h"
+#include "util/init.h"
+#include "util/thread_pool.h"
+
+DEFINE_string(cert_dir, "", "Storage directory for certificates");
+DEFINE_string(tree_dir, "", "Storage directory for trees");
+DEFINE_string(meta_dir, "", "Storage directory for meta info");
+DEFINE_string(sqlite_db, "",
+              "SQLite database for certificate and tree storage");
+DEFINE_string(leveldb_db, "",
+              "LevelDB database for certificate and tree storage");
+DEFINE_string(rocksdb_db, "",
+              "RocksDB database for certificate and tree storage");
+DEFINE_int32(cert_storage_depth, 0,
+             "Subdirectory depth for certificates; must match the existing "
+             "depth.");
+DEFINE_int32(tree_storage_depth, 0,
+             "Subdirectory depth for tree signatures; must match the "
+             "existing depth.");
+DEFINE_int32(cert_segment_size_mb, 0,
+             "If not 0, --cert_dir holds segment files of about this many "
+             "MiB, as written by a server with the same flag.");
+DEFINE_int64(chunk_entries, 1 << 16,
+             "Number of entries hashed by each task; must be a power of "
+             "two, so that each chunk is a subtree of the log.");
+DEFINE_int32(threads, 8, "Number of chunks hashed at once.");
+
+namespace cert_trans {
+namespace {
+
+using std::map;
+using std::string;
+using std::unique_ptr;
+using std::vector;
+
+const size_t kReadBlockEntries = 1000;
+
+
+// What was found in the entries [begin, end) of the log.
+struct ChunkResult {
+  // The root of the subtree of all the entries of the chunk, and of
+  // the first |n| entries, for the STHs that end within the chunk,
+  // keyed by their tree size.
+  string root;
+  map<int64_t, string> prefix_roots;
+  // The index of the first entry that is missing or whose cached
+  // leaf input or hash do not match it, and what was wrong, or -1.
+  int64_t first_bad_index = -1;
+  string problem;
+};
+
+
+ReadOnlyDatabase<LoggedCertificate>* OpenDatabase() {
+  if (!FLAGS_sqlite_db.empty()) {
+    return new SQLiteDB<LoggedCertificate>(FLAGS_sqlite_db);
+  }
+  if (!FLAGS_leveldb_db.empty()) {
+    return new LevelDB<LoggedCertificate>(FLAGS_leveldb_db);
+  }
+#ifdef HAVE_ROCKSDB
+  if (!FLAGS_rocksdb_db.empty()) {
+    return new RocksDB<LoggedCertificate>(FLAGS_rocksdb_db);
+  }
+#endif
+  KeyValueStorage* cert_storage;
+  if (FLAGS_cert_segment_size_mb > 0) {
+    cert_storage = new SegmentStorage(
+        FLAGS_cert_dir, static_cast<off_t>(FLAGS_cert_segment_size_mb) << 20);
+  } else {
+    cert_storage = new FileStorage(FLAGS_cert_dir, FLAGS_cert_storage_depth);
+  }
+  return new FileDB<LoggedCertificate>(
+      cert_storage, new FileStorage(FLAGS_tree_dir, FLAGS_tree_storage_depth),
+      new FileStorage(FLAGS_meta_dir, 0));
+}
+
+
+// Computes the leaf hash of |logged| from its SCT and entry, rather
+// than trusting what is cached with it, and checks the caches against
+// it. Returns false and sets |problem| if they differ.
+bool HashEntry(const TreeHasher& hasher, const LoggedCertificate& logged,
+               string* leaf_hash, string* problem) {
+  string leaf_input;
+  if (Serializer::SerializeSCTMerkleTreeLeaf(logged.sct(), logged.entry(),
+                                             &leaf_input) != Serializer::OK) {
+    *problem = "entry does not serialize";
+    return false;
+  }
+  *leaf_hash = hasher.HashLeaf(leaf_input);
+  if (logged.contents().has_leaf_input() &&
+      logged.contents().leaf_input() != leaf_input) {
+    *problem = "cached leaf input does not match the entry";
+    return false;
+  }
+  if (logged.contents().has_leaf_hash() &&
+      logged.contents().leaf_hash() != *leaf_hash) {
+    *problem = "cached leaf hash does not match the entry";
+    return false;
+  }
+  if (logged.has_merkle_leaf_hash() &&
+      logged.merkle_leaf_hash() != *leaf_hash) {
+    *problem = "stored Merkle leaf hash does not match the entry";
+    return false;
+  }
+  return true;
+}
+
+
+// Hashes the entries [|begin|, |end|) with a scan of their own.
+// Stops at the first bad entry, as the roots past it are of no use.
+void HashChunk(const ReadOnlyDatabase<LoggedCertificate>* db,
+               int64_t begin, int64_t end, const vector<int64_t>& sizes,
+               ChunkResult* result) {
+  const TreeHasher hasher(new Sha256Hasher);
+  Sha256CompactMerkleTree tree;
+  vector<int64_t>::const_iterator next_size(
+      std::upper_bound(sizes.begin(), sizes.end(), begin));
+
+  const unique_ptr<ReadOnlyDatabase<LoggedCertificate>::Iterator> it(
+      ScanEntriesPrefetching(db, begin, end - begin));
+  vector<LoggedCertificate> entries;
+  int64_t next(begin);
+  while (next < end) {
+    entries.clear();
+    if (it->GetNextEntries(std::min<int64_t>(kReadBlockEntries, end - next),
+                           &entries) == 0) {
+      break;
+    }
+    for (const LoggedCertificate& logged : entries) {
+      if (logged.sequence_number() != next) {
+        result->first_bad_index = next;
+        result->problem = "entry is missing";
+        return;
+      }
+      string leaf_hash;
+      if (!HashEntry(hasher, logged, &leaf_hash, &result->problem)) {
+        result->first_bad_index = next;
+        return;
+      }
+      tree.AddLeafHash(leaf_hash);
+      ++next;
+      if (next_size != sizes.end() && *next_size == next && next < end) {
+        result->prefix_roots[next] = tree.CurrentRoot();
+        ++next_size;
+      }
+    }
+  }
+  if (next < end) {
+    result->first_bad_index = next;
+    result->problem = "entry is missing";
+    return;
+  }
+  result->root = tree.CurrentRoot();
+}
+
+
+// The root of the tree of the first |tree_size| entries, from the
+// roots of the chunks. As the chunks are the size of a power of two,
+// they are subtrees of that tree, and combining their roots as if
+// they were leaves gives its root.
+string TreeRoot(const vector<ChunkResult>& chunks, int64_t tree_size) {
+  Sha256CompactMerkleTree tree;
+  const int64_t full_chunks(tree_size / FLAGS_chunk_entries);
+  for (int64_t i = 0; i < full_chunks; ++i) {
+    tree.AddLeafHash(chunks[i].root);
+  }
+  if (tree_size % FLAGS_chunk_entries != 0) {
+    const ChunkResult& last(chunks[full_chunks]);
+    const map<int64_t, string>::const_iterator prefix(
+        last.prefix_roots.find(tree_size));
+    tree.AddLeafHash(prefix != last.prefix_roots.end() ? prefix->second
+                                                       : last.root);
+  }
+  return tree.CurrentRoot();
+}
+
+
+bool ReadSTH(const char* filename, ct::SignedTreeHead* sth) {
+  std::ifstream input(filename);
+  return sth->ParseFromIstream(&input);
+}
+
+
+}  // namespace
+}  // namespace cert_trans
+
+
+// Usage: verify_log <database flags> [STH file...]
+//
+// Checks the entries of the database against its latest tree head,
+// and any others from the files given, such as those in the tree
+// directory of a file database.
+int main(int argc, char* argv[]) {
+  using cert_trans::ChunkResult;
+
+  util::InitCT(&argc, &argv);
+
+  CHECK_EQ(!FLAGS_sqlite_db.empty() + !FLAGS_leveldb_db.empty() +
+               !FLAGS_rocksdb_db.empty() + !FLAGS_cert_dir.empty(),
+           1)
+      << "must specify exactly one database";
+#ifndef HAVE_ROCKSDB
+  CHECK(FLAGS_rocksdb_db.empty()) << "this binary was built without RocksDB "
+                                     "support";
+#endif
+  CHECK_GT(FLAGS_chunk_entries, 0);
+  CHECK_EQ(FLAGS_chunk_entries & (FLAGS_chunk_entries - 1), 0)
+      << "--chunk_entries must be a power of two";
+  CHECK_GT(FLAGS_threads, 0);
+
+  // As with export_log, stop any server using a LevelDB or RocksDB
+  // database first.
+  const std::unique_ptr<ReadOnlyDatabase<LoggedCertificate>> db(
+      cert_trans::OpenDatabase());
+
+  std::vector<ct::SignedTreeHead> sths(1);
+  if (db->LatestTreeHead(&sths.back()) != db->LOOKUP_OK) {
+    sths.pop_back();
+  }
+  for (int i = 1; i < argc; ++i) {
+    sths.emplace_back();
+    CHECK(cert_trans::ReadSTH(argv[i], &sths.back()))
+        << "could not read " << argv[i];
+  }
+  if (sths.empty()) {
+    std::cerr << "no tree head to check against" << std::endl;
+    return 1;
+  }
+
+  const int64_t tree_size(db->TreeSize());
+  std::vector<int64_t> sizes;
+  for (const ct::SignedTreeHead& sth : sths) {
+    sizes.push_back(sth.tree_size());
+  }
+  std::sort(sizes.begin(), sizes.end());
+  sizes.erase(std::unique(sizes.begin(), sizes.end()), sizes.end());
+
+  // Hash all the contiguous entries, whether or not a tree head
+  // covers them, so that bad entries past the last one are found too.
+  const int64_t num_chunks(
+      (tree_size + FLAGS_chunk_entries - 1) / FLAGS_chunk_entries);
+  LOG(INFO) << "hashing " << tree_size << " entries in " << num_chunks
+            << " chunks";
+  std::vector<ChunkResult> chunks(num_chunks);
+  {
+    cert_trans::ThreadPool pool(FLAGS_threads);
+    for (int64_t i = 0; i < num_chunks; ++i) {
+      const int64_t begin(i * FLAGS_chunk_entries);
+      const int64_t end(std::min(tree_size, begin + FLAGS_chunk_entries));
+      ChunkResult* const chunk(&chunks[i]);
+      pool.Add([&db, begin, end, &sizes, chunk]() {
+        cert_trans::HashChunk(db.get(), begin, end, sizes, chunk);
+      });
+    }
+    // The destructor waits for the chunks to be done.
+  }
+
+  int64_t first_bad_index(-1);
+  for (const ChunkResult& chunk : chunks) {
+    if (chunk.first_bad_index >= 0) {
+      first_bad_index = chunk.first_bad_index;
+      std::cout << "entry " << chunk.first_bad_index << ": " << chunk.problem
+                << std::endl;
+      break;
+    }
+  }
+
+  bool ok(first_bad_index < 0);
+  // The largest tree size known to be good, and the smallest known
+  // to be bad.
+  int64_t good_size(0);
+  int64_t bad_size(-1);
+  std::sort(sths.begin(), sths.end(),
+            [](const ct::SignedTreeHead& a, const ct::SignedTreeHead& b) {
+              return a.tree_size() < b.tree_size();
+            });
+  for (const ct::SignedTreeHead& sth : sths) {
+    std::cout << "tree head of size " << sth.tree_size() << " at "
+              << sth.timestamp() << ": ";
+    if (sth.tree_size() > tree_size) {
+      std::cout << "database only has " << tree_size << " entries"
+                << std::endl;
+    } else if (first_bad_index >= 0 && sth.tree_size() > first_bad_index) {
+      std::cout << "covers bad entry " << first_bad_index << std::endl;
+    } else if (cert_trans::TreeRoot(chunks, sth.tree_size()) !=
+               sth.sha256_root_hash()) {
+      std::cout << "root hash mismatch" << std::endl;
+    } else {
+      std::cout << "OK" << std::endl;
+      if (bad_size < 0) {
+        good_size = sth.tree_size();
+      }
+      continue;
+    }
+    ok = false;
+    if (bad_size < 0) {
+      bad_size = sth.tree_size();
+    }
+  }
+
+  if (ok) {
+    std::cout << "all " << tree_size << " entries match" << std::endl;
+    return 0;
+  }
+  if (first_bad_index >= 0) {
+    std::cout << "first diverging index: " << first_bad_index << std::endl;
+  } else if (bad_size >= 0) {
+    std::cout << "first diverging index: between " << good_size << " and "
+              << bad_size - 1 << std::endl;
+  }
+  return 1;
+}
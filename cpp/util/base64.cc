@@ -0,0 +1,297 @@
+#include "util/base64.h"
+
+#include <stdint.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define BASE64_SSSE3 1
+#include <tmmintrin.h>
+#endif
+
+namespace util {
+namespace {
+
+
+const char kAlphabet[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+// Values in the decoding table, besides the 6 bits of the characters
+// of the alphabet.
+const uint8_t kInvalid = 0xff;
+const uint8_t kWhitespace = 0xfe;
+const uint8_t kPad = 0xfd;
+
+
+struct DecodeTable {
+  DecodeTable() {
+    for (int i = 0; i < 256; ++i) {
+      values[i] = kInvalid;
+    }
+    for (int i = 0; i < 64; ++i) {
+      values[static_cast<uint8_t>(kAlphabet[i])] = i;
+    }
+    // The same as isspace() in the C locale.
+    for (const char* c = " \t\n\v\f\r"; *c; ++c) {
+      values[static_cast<uint8_t>(*c)] = kWhitespace;
+    }
+    values['='] = kPad;
+  }
+
+  uint8_t values[256];
+};
+
+
+const uint8_t* DecodeValues() {
+  static const DecodeTable* const table(new DecodeTable);
+  return table->values;
+}
+
+
+#ifdef BASE64_SSSE3
+bool HasSsse3() {
+  static const bool has_ssse3([]() {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("ssse3");
+  }());
+  return has_ssse3;
+}
+
+
+// Encodes the first 12 of the 16 bytes at |data| into 16 characters,
+// as described in "Faster Base64 Encoding and Decoding Using AVX2
+// Instructions" by Muła and Lemire, with 128 bit registers.
+inline __attribute__((target("ssse3"), always_inline)) void Encode12(
+    const char* data, char* out) {
+  __m128i in(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data)));
+  // Each group of 3 bytes s0 s1 s2 goes into a 32 bit lane as s1 s0 s2
+  // s1, so that each 6 bits can be moved into a byte of their own with
+  // 16 bit multiplications.
+  in = _mm_shuffle_epi8(in, _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3,
+                                         4, 1, 2, 0, 1));
+  const __m128i ac(_mm_mulhi_epu16(_mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00)),
+                                   _mm_set1_epi32(0x04000040)));
+  const __m128i bd(_mm_mullo_epi16(_mm_and_si128(in, _mm_set1_epi32(0x003f03f0)),
+                                   _mm_set1_epi32(0x01000010)));
+  const __m128i indices(_mm_or_si128(ac, bd));
+
+  // Map the ranges of the alphabet to the offset from each index to
+  // its character: 13 for 0-25 ('A'), 0 for 26-51 ('a'), then 1-10
+  // for the digits, 11 for '+' and 12 for '/'.
+  __m128i range(_mm_subs_epu8(indices, _mm_set1_epi8(51)));
+  range = _mm_or_si128(range, _mm_and_si128(_mm_cmpgt_epi8(_mm_set1_epi8(26),
+                                                           indices),
+                                            _mm_set1_epi8(13)));
+  const __m128i offsets(_mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52,
+                                      '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                      '0' - 52, '0' - 52, '0' - 52, '+' - 62,
+                                      '/' - 63, 'A', 0, 0));
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(out),
+                   _mm_add_epi8(indices, _mm_shuffle_epi8(offsets, range)));
+}
+
+
+// Decodes 16 characters at |b64| into 12 bytes, written as 16 to
+// |out|. Returns false, having written nothing, if they are not all
+// in the alphabet.
+inline __attribute__((target("ssse3"), always_inline)) bool Decode16(
+    const char* b64, char* out) {
+  const __m128i in(_mm_loadu_si128(reinterpret_cast<const __m128i*>(b64)));
+  // The signed comparisons exclude the characters above 0x7f.
+  const __m128i upper(
+      _mm_and_si128(_mm_cmpgt_epi8(in, _mm_set1_epi8('A' - 1)),
+                    _mm_cmpgt_epi8(_mm_set1_epi8('Z' + 1), in)));
+  const __m128i lower(
+      _mm_and_si128(_mm_cmpgt_epi8(in, _mm_set1_epi8('a' - 1)),
+                    _mm_cmpgt_epi8(_mm_set1_epi8('z' + 1), in)));
+  const __m128i digit(
+      _mm_and_si128(_mm_cmpgt_epi8(in, _mm_set1_epi8('0' - 1)),
+                    _mm_cmpgt_epi8(_mm_set1_epi8('9' + 1), in)));
+  const __m128i plus(_mm_cmpeq_epi8(in, _mm_set1_epi8('+')));
+  const __m128i slash(_mm_cmpeq_epi8(in, _mm_set1_epi8('/')));
+  const __m128i valid(_mm_or_si128(_mm_or_si128(upper, lower),
+                                   _mm_or_si128(_mm_or_si128(digit, plus),
+                                                slash)));
+  if (_mm_movemask_epi8(valid) != 0xffff) {
+    return false;
+  }
+
+  const __m128i shift(_mm_or_si128(
+      _mm_or_si128(_mm_and_si128(upper, _mm_set1_epi8(-'A')),
+                   _mm_and_si128(lower, _mm_set1_epi8(26 - 'a'))),
+      _mm_or_si128(_mm_or_si128(_mm_and_si128(digit, _mm_set1_epi8(52 - '0')),
+                                _mm_and_si128(plus, _mm_set1_epi8(62 - '+'))),
+                   _mm_and_si128(slash, _mm_set1_epi8(63 - '/')))));
+  const __m128i values(_mm_add_epi8(in, shift));
+
+  // Join the 6 bit values a b c d of each 32 bit lane into 24 bits,
+  // then keep the 3 bytes of each lane, most significant first.
+  const __m128i ab_cd(_mm_maddubs_epi16(values, _mm_set1_epi32(0x01400140)));
+  const __m128i abcd(_mm_madd_epi16(ab_cd, _mm_set1_epi32(0x00011000)));
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(out),
+                   _mm_shuffle_epi8(abcd,
+                                    _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8,
+                                                  14, 13, 12, -1, -1, -1,
+                                                  -1)));
+  return true;
+}
+
+
+// The loops around Encode12() and Decode16(), which are only inlined
+// into functions compiled for SSSE3. Both return the number of bytes
+// they consumed.
+__attribute__((target("ssse3"))) size_t EncodeSsse3(const char* data,
+                                                    size_t length,
+                                                    char* out) {
+  size_t i(0);
+  // Encode12() reads 16 bytes.
+  for (; length - i >= 16; i += 12, out += 16) {
+    Encode12(data + i, out);
+  }
+  return i;
+}
+
+
+__attribute__((target("ssse3"))) size_t DecodeSsse3(const char* b64,
+                                                    size_t length,
+                                                    char* out) {
+  size_t i(0);
+  // Decode16() writes 16 bytes, which fit as long as there are at
+  // least 16 more characters after the ones it decodes.
+  for (; length - i >= 32 && Decode16(b64 + i, out); i += 16, out += 12) {
+  }
+  return i;
+}
+#endif
+
+
+}  // namespace
+
+
+void Base64Encode(const char* data, size_t length, char* out) {
+  const uint8_t* in(reinterpret_cast<const uint8_t*>(data));
+#ifdef BASE64_SSSE3
+  if (length >= 16 && HasSsse3()) {
+    const size_t encoded(EncodeSsse3(data, length, out));
+    in += encoded;
+    length -= encoded;
+    out += encoded / 3 * 4;
+  }
+#endif
+
+  for (; length >= 3; in += 3, length -= 3, out += 4) {
+    const uint32_t bits((in[0] << 16) | (in[1] << 8) | in[2]);
+    out[0] = kAlphabet[bits >> 18];
+    out[1] = kAlphabet[(bits >> 12) & 0x3f];
+    out[2] = kAlphabet[(bits >> 6) & 0x3f];
+    out[3] = kAlphabet[bits & 0x3f];
+  }
+
+  if (length == 1) {
+    out[0] = kAlphabet[in[0] >> 2];
+    out[1] = kAlphabet[(in[0] & 0x03) << 4];
+    out[2] = '=';
+    out[3] = '=';
+  } else if (length == 2) {
+    out[0] = kAlphabet[in[0] >> 2];
+    out[1] = kAlphabet[((in[0] & 0x03) << 4) | (in[1] >> 4)];
+    out[2] = kAlphabet[(in[1] & 0x0f) << 2];
+    out[3] = '=';
+  }
+}
+
+
+bool Base64Decode(const char* b64, size_t length, char* out,
+                  size_t* out_length) {
+  const uint8_t* const in(reinterpret_cast<const uint8_t*>(b64));
+  uint8_t* const bytes(reinterpret_cast<uint8_t*>(out));
+  const uint8_t* const values(DecodeValues());
+  size_t i(0);
+  size_t o(0);
+
+#ifdef BASE64_SSSE3
+  if (length >= 32 && HasSsse3()) {
+    i = DecodeSsse3(b64, length, out);
+    o = i / 4 * 3;
+  }
+#endif
+
+  // Whole groups of 4 characters of the alphabet.
+  for (; length - i >= 4; i += 4, o += 3) {
+    const uint8_t a(values[in[i]]), b(values[in[i + 1]]),
+        c(values[in[i + 2]]), d(values[in[i + 3]]);
+    if ((a | b | c | d) & 0xc0) {
+      break;
+    }
+    bytes[o] = (a << 2) | (b >> 4);
+    bytes[o + 1] = (b << 4) | (c >> 2);
+    bytes[o + 2] = (c << 6) | d;
+  }
+
+  // Anything else, such as the padding or whitespace, one character at
+  // a time, as b64_pton() does.
+  int state(0);
+  for (; i < length; ++i) {
+    const uint8_t value(values[in[i]]);
+    if (value == kWhitespace) {
+      continue;
+    }
+    if (value == kPad) {
+      break;
+    }
+    if (value == kInvalid) {
+      return false;
+    }
+    switch (state) {
+      case 0:
+        bytes[o] = value << 2;
+        break;
+      case 1:
+        bytes[o++] |= value >> 4;
+        bytes[o] = (value & 0x0f) << 4;
+        break;
+      case 2:
+        bytes[o++] |= value >> 2;
+        bytes[o] = (value & 0x03) << 6;
+        break;
+      case 3:
+        bytes[o++] |= value;
+        break;
+    }
+    state = (state + 1) % 4;
+  }
+
+  if (i < length) {
+    // Padding, which is only valid after 2 or 3 characters of a group,
+    // with as many '=' as there are characters missing, and nothing
+    // but whitespace after.
+    if (state < 2) {
+      return false;
+    }
+    ++i;
+    if (state == 2) {
+      while (i < length && values[in[i]] == kWhitespace) {
+        ++i;
+      }
+      if (i == length || values[in[i]] != kPad) {
+        return false;
+      }
+      ++i;
+    }
+    for (; i < length; ++i) {
+      if (values[in[i]] != kWhitespace) {
+        return false;
+      }
+    }
+    // The bits past the last byte must be zero.
+    if (bytes[o] != 0) {
+      return false;
+    }
+  } else if (state != 0) {
+    return false;
+  }
+
+  *out_length = o;
+  return true;
+}
+
+
+}  // namespace util
@@ -0,0 +1,42 @@
+#ifndef CERT_TRANS_UTIL_BASE64_H_
+#define CERT_TRANS_UTIL_BASE64_H_
+
+#include <stddef.h>
+
+namespace util {
+
+// Base 64 encoding and decoding (RFC 4648, with the standard alphabet
+// and padding), into buffers provided by the caller, so that they can
+// go straight into a string or an evbuffer. Large inputs are done 12
+// bytes at a time with SSSE3, when the CPU has it.
+
+
+// The number of characters Base64Encode() writes for |length| bytes.
+inline size_t Base64EncodedLength(size_t length) {
+  return ((length + 2) / 3) * 4;
+}
+
+
+// Writes Base64EncodedLength(|length|) characters to |out|, without a
+// terminating NUL.
+void Base64Encode(const char* data, size_t length, char* out);
+
+
+// The most bytes Base64Decode() can write for |length| characters.
+inline size_t Base64DecodedMaxLength(size_t length) {
+  return ((length + 3) / 4) * 3;
+}
+
+
+// Decodes the |length| characters at |b64| into |out|, which must have
+// room for Base64DecodedMaxLength(|length|) bytes, and sets
+// |out_length| to the number written. Whitespace is ignored, as with
+// b64_pton(). Returns false if |b64| is not valid base 64, in which
+// case the contents of |out| are unspecified.
+bool Base64Decode(const char* b64, size_t length, char* out,
+                  size_t* out_length);
+
+
+}  // namespace util
+
+#endif  // CERT_TRANS_UTIL_BASE64_H_
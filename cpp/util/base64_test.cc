@@ -0,0 +1,166 @@
+#include "util/base64.h"
+
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+#include <netinet/in.h>  // for resolv.h
+#include <random>
+#include <resolv.h>  // for b64_ntop
+#include <string>
+
+#include "util/testing.h"
+
+namespace util {
+namespace {
+
+using std::string;
+
+
+string Encode(const string& data) {
+  string b64(Base64EncodedLength(data.size()), '\0');
+  Base64Encode(data.data(), data.size(), &b64[0]);
+  return b64;
+}
+
+
+bool Decode(const string& b64, string* data) {
+  data->assign(Base64DecodedMaxLength(b64.size()), '\0');
+  size_t length;
+  if (!Base64Decode(b64.data(), b64.size(), &(*data)[0], &length)) {
+    return false;
+  }
+  data->resize(length);
+  return true;
+}
+
+
+// What the resolver library, which this replaces, makes of |data|.
+string NtopEncode(const string& data) {
+  string b64(Base64EncodedLength(data.size()) + 1, '\0');
+  const int length(b64_ntop(reinterpret_cast<const u_char*>(data.data()),
+                            data.size(), &b64[0], b64.size()));
+  CHECK_GE(length, 0);
+  b64.resize(length);
+  return b64;
+}
+
+
+bool PtonDecode(const string& b64, string* data) {
+  data->assign(b64.size() + 1, '\0');
+  const int length(
+      b64_pton(b64.c_str(), reinterpret_cast<u_char*>(&(*data)[0]),
+               data->size()));
+  if (length < 0) {
+    return false;
+  }
+  data->resize(length);
+  return true;
+}
+
+
+class Base64Test : public ::testing::Test {
+ protected:
+  string RandomBytes(size_t length) {
+    string data(length, '\0');
+    for (char& c : data) {
+      c = std::uniform_int_distribution<int>(0, 255)(random_);
+    }
+    return data;
+  }
+
+  std::mt19937 random_;
+};
+
+
+TEST_F(Base64Test, EncodesTestVectors) {
+  // From RFC 4648.
+  EXPECT_EQ("", Encode(""));
+  EXPECT_EQ("Zg==", Encode("f"));
+  EXPECT_EQ("Zm8=", Encode("fo"));
+  EXPECT_EQ("Zm9v", Encode("foo"));
+  EXPECT_EQ("Zm9vYg==", Encode("foob"));
+  EXPECT_EQ("Zm9vYmE=", Encode("fooba"));
+  EXPECT_EQ("Zm9vYmFy", Encode("foobar"));
+}
+
+
+TEST_F(Base64Test, MatchesResolverLibrary) {
+  // Long enough for the vectorized loops, with every length of tail.
+  for (size_t length = 0; length < 200; ++length) {
+    const string data(RandomBytes(length));
+    const string b64(Encode(data));
+    EXPECT_EQ(NtopEncode(data), b64) << length;
+
+    string decoded;
+    ASSERT_TRUE(Decode(b64, &decoded)) << b64;
+    EXPECT_EQ(data, decoded);
+  }
+}
+
+
+TEST_F(Base64Test, EncodesEveryByte) {
+  string data;
+  for (int i = 0; i < 256; ++i) {
+    data += static_cast<char>(i);
+  }
+  const string b64(Encode(data));
+  EXPECT_EQ(NtopEncode(data), b64);
+  string decoded;
+  ASSERT_TRUE(Decode(b64, &decoded));
+  EXPECT_EQ(data, decoded);
+}
+
+
+TEST_F(Base64Test, RejectsLikeResolverLibrary) {
+  const string b64(Encode(RandomBytes(100)));
+  // Every byte, in turn, at every position of a group, both in the
+  // vectorized part and in the tail.
+  for (const size_t position : {0, 1, 2, 3, 17, 60, 130, 133, 135}) {
+    for (int c = 1; c < 256; ++c) {
+      string corrupted(b64);
+      corrupted[position] = c;
+      string expected, decoded;
+      const bool valid(PtonDecode(corrupted, &expected));
+      EXPECT_EQ(valid, Decode(corrupted, &decoded)) << position << " " << c;
+      if (valid) {
+        EXPECT_EQ(expected, decoded);
+      }
+    }
+  }
+}
+
+
+TEST_F(Base64Test, DecodesLikeResolverLibrary) {
+  for (const string b64 :
+       {"", "Zg==", "Zg=", "Zg", "Z", "Zm8=", "Zm8", "Zm9v", "Zm9vY",
+        "Zh==", "Zm9=", " Zm 9v\nYg= =\t", "Zm9vYg==Zg==", "Zm9vYg== x",
+        "====", "Zg==\n", "=", "Zm9vYmFy\r\n"}) {
+    string expected, decoded;
+    const bool valid(PtonDecode(b64, &expected));
+    EXPECT_EQ(valid, Decode(b64, &decoded)) << b64;
+    if (valid) {
+      EXPECT_EQ(expected, decoded) << b64;
+    }
+  }
+}
+
+
+TEST_F(Base64Test, IgnoresWhitespace) {
+  const string data(RandomBytes(120));
+  string b64(Encode(data));
+  for (size_t i = 76; i < b64.size(); i += 77) {
+    b64.insert(i, "\n");
+  }
+  string decoded;
+  ASSERT_TRUE(Decode(b64, &decoded));
+  EXPECT_EQ(data, decoded);
+}
+
+
+}  // namespace
+}  // namespace util
+
+
+int main(int argc, char** argv) {
+  cert_trans::test::InitTesting(argv[0], &argc, &argv, true);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,140 @@
+#include <chrono>
+#include <functional>
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <iomanip>
+#include <iostream>
+#include <netinet/in.h>  // for resolv.h
+#include <random>
+#include <resolv.h>  // for b64_ntop
+#include <sstream>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+
+#include "util/base64.h"
+#include "util/util.h"
+
+using std::function;
+using std::string;
+using std::vector;
+
+DEFINE_string(sizes, "32,1024,4096,65536",
+              "comma-separated sizes of the data to encode and decode, in "
+              "bytes");
+DEFINE_string(benchmarks, "",
+              "comma-separated names of the benchmarks to run; all of them "
+              "if empty");
+DEFINE_int32(min_time_ms, 500,
+             "minimum time to spend running each benchmark, in milliseconds");
+
+namespace {
+
+
+vector<size_t> ParseSizes(const string& sizes) {
+  vector<size_t> result;
+  std::istringstream in(sizes);
+  string size;
+  while (std::getline(in, size, ',')) {
+    char* end;
+    const unsigned long long value(strtoull(size.c_str(), &end, 10));
+    CHECK(!size.empty() && *end == '\0' && value > 0)
+        << "invalid size: " << size;
+    result.push_back(value);
+  }
+  return result;
+}
+
+
+bool ShouldRun(const string& name) {
+  if (FLAGS_benchmarks.empty()) {
+    return true;
+  }
+  const string benchmarks("," + FLAGS_benchmarks + ",");
+  return benchmarks.find("," + name + ",") != string::npos;
+}
+
+
+// Calls |op| in batches that grow until they are long enough to time
+// accurately, for at least --min_time_ms, and reports the time per
+// call and the throughput for |size| bytes per call.
+void Run(const string& name, size_t size, const function<void()>& op) {
+  if (!ShouldRun(name)) {
+    return;
+  }
+  const std::chrono::nanoseconds min_time(
+      (std::chrono::milliseconds(FLAGS_min_time_ms)));
+  uint64_t ops(0);
+  std::chrono::nanoseconds elapsed(0);
+  for (uint64_t batch = 1; elapsed < min_time; batch *= 2) {
+    const std::chrono::steady_clock::time_point start(
+        std::chrono::steady_clock::now());
+    for (uint64_t i = 0; i < batch; ++i) {
+      op();
+    }
+    elapsed += std::chrono::steady_clock::now() - start;
+    ops += batch;
+  }
+
+  const double ns_per_op(static_cast<double>(elapsed.count()) / ops);
+  std::cout << std::left << std::setw(24) << name << std::right
+            << std::setw(10) << size << std::setw(14) << std::fixed
+            << std::setprecision(1) << ns_per_op << std::setw(12)
+            << std::setprecision(0) << size / ns_per_op * 1e3 << std::endl;
+}
+
+
+void RunSize(size_t size) {
+  std::mt19937 random;
+  string data(size, '\0');
+  for (char& c : data) {
+    c = std::uniform_int_distribution<int>(0, 255)(random);
+  }
+  const string b64(util::ToBase64(data));
+  string out(util::Base64EncodedLength(size) + 1, '\0');
+
+  // The resolver library functions, as used before.
+  Run("b64_ntop", size, [&]() {
+    CHECK_GT(b64_ntop(reinterpret_cast<const u_char*>(data.data()),
+                      data.size(), &out[0], out.size()),
+             0);
+  });
+  Run("b64_pton", size, [&]() {
+    CHECK_GT(b64_pton(b64.c_str(), reinterpret_cast<u_char*>(&out[0]),
+                      out.size()),
+             0);
+  });
+
+  Run("base64_encode", size, [&]() {
+    util::Base64Encode(data.data(), data.size(), &out[0]);
+  });
+  Run("base64_decode", size, [&]() {
+    size_t length;
+    CHECK(util::Base64Decode(b64.data(), b64.size(), &out[0], &length));
+  });
+  // Including the allocation of the result.
+  Run("to_base64", size, [&]() { CHECK(!util::ToBase64(data).empty()); });
+  Run("from_base64", size,
+      [&]() { CHECK(!util::FromBase64(b64.c_str()).empty()); });
+}
+
+
+}  // namespace
+
+
+int main(int argc, char* argv[]) {
+  google::ParseCommandLineFlags(&argc, &argv, true);
+  google::InitGoogleLogging(argv[0]);
+
+  CHECK_GT(FLAGS_min_time_ms, 0);
+
+  std::cout << std::left << std::setw(24) << "benchmark" << std::right
+            << std::setw(10) << "bytes" << std::setw(14) << "ns/op"
+            << std::setw(12) << "MB/s" << std::endl;
+  for (const size_t size : ParseSizes(FLAGS_sizes)) {
+    RunSize(size);
+  }
+
+  return 0;
+}
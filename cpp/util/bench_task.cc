@@ -0,0 +1,134 @@
+#include <chrono>
+#include <functional>
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <stdint.h>
+#include <string>
+
+#include "util/executor.h"
+#include "util/sync_task.h"
+#include "util/task.h"
+#include "util/thread_pool.h"
+
+using std::function;
+using std::string;
+using std::unique_ptr;
+
+DEFINE_string(benchmarks, "",
+              "comma-separated names of the benchmarks to run; all of them "
+              "if empty");
+DEFINE_int32(min_time_ms, 500,
+             "minimum time to spend running each benchmark, in milliseconds");
+
+namespace {
+
+
+class InlineExecutor : public util::Executor {
+ public:
+  InlineExecutor() = default;
+
+  void Add(const function<void()>& closure) override {
+    closure();
+  }
+
+  void Delay(const std::chrono::duration<double>& delay,
+             util::Task* task) override {
+    LOG(FATAL) << "Not Implemented.";
+  }
+};
+
+
+bool ShouldRun(const string& name) {
+  if (FLAGS_benchmarks.empty()) {
+    return true;
+  }
+  const string benchmarks("," + FLAGS_benchmarks + ",");
+  return benchmarks.find("," + name + ",") != string::npos;
+}
+
+
+// Calls |op| in batches that grow until they are long enough to time
+// accurately, for at least --min_time_ms, and reports the time per
+// call.
+void Run(const string& name, const function<void()>& op) {
+  if (!ShouldRun(name)) {
+    return;
+  }
+  const std::chrono::nanoseconds min_time(
+      (std::chrono::milliseconds(FLAGS_min_time_ms)));
+  uint64_t ops(0);
+  std::chrono::nanoseconds elapsed(0);
+  for (uint64_t batch = 1; elapsed < min_time; batch *= 2) {
+    const std::chrono::steady_clock::time_point start(
+        std::chrono::steady_clock::now());
+    for (uint64_t i = 0; i < batch; ++i) {
+      op();
+    }
+    elapsed += std::chrono::steady_clock::now() - start;
+    ops += batch;
+  }
+
+  const double ns_per_op(static_cast<double>(elapsed.count()) / ops);
+  std::cout << std::left << std::setw(28) << name << std::right
+            << std::setw(14) << std::fixed << std::setprecision(1)
+            << ns_per_op << std::endl;
+}
+
+
+}  // namespace
+
+
+int main(int argc, char* argv[]) {
+  google::ParseCommandLineFlags(&argc, &argv, true);
+  google::InitGoogleLogging(argv[0]);
+
+  CHECK_GT(FLAGS_min_time_ms, 0);
+
+  std::cout << std::left << std::setw(28) << "benchmark" << std::right
+            << std::setw(14) << "ns/op" << std::endl;
+
+  InlineExecutor inline_executor;
+  const function<void(util::Task*)> done([](util::Task* task) {
+    CHECK(task->status().ok());
+  });
+
+  // The common case: one operation, returned once.
+  Run("return", [&]() {
+    util::Task task(done, &inline_executor);
+    task.Return();
+  });
+  Run("hold_return", [&]() {
+    util::Task task(done, &inline_executor);
+    util::TaskHold hold(&task);
+    task.Return();
+  });
+  Run("child_return", [&]() {
+    util::Task task(done, &inline_executor);
+    task.AddChild([&task](util::Task* child) {
+          task.Return(child->status());
+        })->Return();
+  });
+  Run("delete_when_done", [&]() {
+    util::Task task(done, &inline_executor);
+    task.DeleteWhenDone(new int(0));
+    task.Return();
+  });
+  Run("cancel_callback", [&]() {
+    util::Task task([](util::Task*) {}, &inline_executor);
+    task.WhenCancelled([&task]() { task.Return(util::Status::CANCELLED); });
+    task.Cancel();
+  });
+
+  // With the done callbacks run by a thread pool, as in the servers.
+  cert_trans::ThreadPool pool(1);
+  Run("sync_task_thread_pool", [&pool]() {
+    util::SyncTask task(&pool);
+    task.task()->Return();
+    task.Wait();
+  });
+
+  return 0;
+}
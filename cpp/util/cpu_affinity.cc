@@ -0,0 +1,93 @@
+#include "config.h"
+#include "util/cpu_affinity.h"
+
+#include <errno.h>
+#include <glog/logging.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+
+using std::string;
+using std::vector;
+
+namespace cert_trans {
+namespace {
+
+
+// Parses a CPU number at |*pos|, advancing it past the number.
+bool ParseCpu(const string& list, size_t* pos, int* cpu) {
+  if (*pos >= list.size() || list[*pos] < '0' || list[*pos] > '9') {
+    return false;
+  }
+  const char* const start(list.c_str() + *pos);
+  char* end;
+  errno = 0;
+  const long value(strtol(start, &end, 10));
+  if (errno != 0 || value > 65535) {
+    return false;
+  }
+  *pos += end - start;
+  *cpu = static_cast<int>(value);
+  return true;
+}
+
+
+}  // namespace
+
+
+bool ParseCpuList(const string& list, vector<int>* cpus) {
+  CHECK_NOTNULL(cpus)->clear();
+  size_t pos(0);
+  while (pos < list.size()) {
+    int first;
+    if (!ParseCpu(list, &pos, &first)) {
+      return false;
+    }
+    int last(first);
+    if (pos < list.size() && list[pos] == '-') {
+      ++pos;
+      if (!ParseCpu(list, &pos, &last) || last < first) {
+        return false;
+      }
+    }
+    for (int cpu = first; cpu <= last; ++cpu) {
+      cpus->push_back(cpu);
+    }
+
+    if (pos < list.size()) {
+      if (list[pos] != ',' || pos + 1 == list.size()) {
+        return false;
+      }
+      ++pos;
+    }
+  }
+  return true;
+}
+
+
+void PinCurrentThread(const string& list) {
+  if (list.empty()) {
+    return;
+  }
+  vector<int> cpus;
+  CHECK(ParseCpuList(list, &cpus)) << "Malformed list of CPUs: " << list;
+
+#ifdef HAVE_PTHREAD_SETAFFINITY_NP
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (const int cpu : cpus) {
+    CHECK_LT(cpu, CPU_SETSIZE) << "CPU out of range: " << cpu;
+    CPU_SET(cpu, &set);
+  }
+  const int ret(pthread_setaffinity_np(pthread_self(), sizeof(set), &set));
+  LOG_IF(WARNING, ret != 0) << "Could not pin thread to CPUs " << list
+                            << ": " << strerror(ret);
+#else
+  LOG(WARNING) << "Pinning threads to CPUs is not supported here, "
+               << "ignoring CPUs " << list;
+#endif
+}
+
+
+}  // namespace cert_trans
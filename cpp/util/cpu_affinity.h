@@ -0,0 +1,26 @@
+#ifndef CERT_TRANS_UTIL_CPU_AFFINITY_H_
+#define CERT_TRANS_UTIL_CPU_AFFINITY_H_
+
+#include <string>
+#include <vector>
+
+namespace cert_trans {
+
+
+// Parses a list of CPUs such as "0-7,16-23" into |cpus|, returning
+// false if it is malformed. An empty list gives no CPUs.
+bool ParseCpuList(const std::string& list, std::vector<int>* cpus);
+
+// Restricts the calling thread to the CPUs in |list| (as parsed by
+// ParseCpuList()), or does nothing if it is empty. As memory is
+// allocated on the NUMA node of the thread that first touches it,
+// this also keeps what the thread allocates local to those CPUs.
+//
+// Threads start with the CPUs of the thread that creates them, so
+// this is best done at the start of a thread.
+void PinCurrentThread(const std::string& list);
+
+
+}  // namespace cert_trans
+
+#endif  // CERT_TRANS_UTIL_CPU_AFFINITY_H_
@@ -0,0 +1,52 @@
+#include "util/cpu_affinity.h"
+
+#include <gtest/gtest.h>
+#include <string>
+#include <vector>
+
+#include "util/testing.h"
+
+namespace cert_trans {
+namespace {
+
+using std::vector;
+
+
+TEST(CpuAffinityTest, ParsesLists) {
+  vector<int> cpus;
+  EXPECT_TRUE(ParseCpuList("", &cpus));
+  EXPECT_TRUE(cpus.empty());
+
+  EXPECT_TRUE(ParseCpuList("3", &cpus));
+  EXPECT_EQ(vector<int>({3}), cpus);
+
+  EXPECT_TRUE(ParseCpuList("0-3,8,10-11", &cpus));
+  EXPECT_EQ(vector<int>({0, 1, 2, 3, 8, 10, 11}), cpus);
+}
+
+
+TEST(CpuAffinityTest, RejectsMalformedLists) {
+  vector<int> cpus;
+  EXPECT_FALSE(ParseCpuList("a", &cpus));
+  EXPECT_FALSE(ParseCpuList("1,", &cpus));
+  EXPECT_FALSE(ParseCpuList(",1", &cpus));
+  EXPECT_FALSE(ParseCpuList("1-", &cpus));
+  EXPECT_FALSE(ParseCpuList("3-1", &cpus));
+  EXPECT_FALSE(ParseCpuList("1 2", &cpus));
+  EXPECT_FALSE(ParseCpuList("-1", &cpus));
+}
+
+
+TEST(CpuAffinityTest, PinCurrentThreadWithEmptyListDoesNothing) {
+  PinCurrentThread("");
+}
+
+
+}  // namespace
+}  // namespace cert_trans
+
+
+int main(int argc, char** argv) {
+  cert_trans::test::InitTesting(argv[0], &argc, &argv, true);
+  return RUN_ALL_TESTS();
+}
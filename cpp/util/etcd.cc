@@ -1,10 +1,14 @@
 #include "util/etcd.h"
 
+#include <algorithm>
+#include <cmath>
 #include <ctime>
 #include <gflags/gflags.h>
 #include <glog/logging.h>
+#include <iterator>
 #include <utility>
 
+#include "monitoring/monitoring.h"
 #include "util/json_wrapper.h"
 #include "util/libevent_wrapper.h"
 #include "util/statusor.h"
@@ -13,7 +17,10 @@ namespace libevent = cert_trans::libevent;
 
 using std::atoll;
 using std::bind;
+using std::chrono::duration;
+using std::chrono::milliseconds;
 using std::chrono::seconds;
+using std::chrono::steady_clock;
 using std::chrono::system_clock;
 using std::ctime;
 using std::list;
@@ -22,11 +29,13 @@ using std::make_pair;
 using std::make_shared;
 using std::map;
 using std::max;
+using std::milli;
 using std::move;
 using std::mutex;
 using std::ostringstream;
 using std::placeholders::_1;
 using std::shared_ptr;
+using std::sort;
 using std::stoi;
 using std::string;
 using std::time_t;
@@ -41,12 +50,26 @@ using util::Task;
 
 DEFINE_int32(etcd_watch_error_retry_delay_seconds, 5,
              "delay between retrying etcd watch requests");
+DEFINE_int32(etcd_watch_coalesce_ms, 0,
+             "If not 0, the changes a watch sees within this many "
+             "milliseconds of each other are delivered in one callback, "
+             "with only the latest version of each key, rather than in one "
+             "callback each.");
 DEFINE_bool(etcd_consistent, true, "Add consistent=true param to all requests. "
             "Do not turn this off unless you *know* what you're doing.");
 DEFINE_bool(etcd_quorum, true, "Add quorum=true param to all requests. "
             "Do not turn this off unless you *know* what you're doing.");
 DEFINE_int32(etcd_connection_timeout_seconds, 10,
              "Number of seconds after which to timeout etcd connections.");
+DEFINE_string(etcd_read_endpoint_policy, "leader",
+              "Which etcd server to send the reads which do not need the "
+              "leader to: \"leader\", \"round_robin\" or "
+              "\"least_outstanding\". These are the watches, and all the "
+              "reads if --etcd_consistent and --etcd_quorum are off.");
+DEFINE_int32(etcd_hedged_read_percentile, 0,
+             "If not 0, the reads which do not need the leader, other than "
+             "watches, are also sent to a second etcd server once they take "
+             "longer than this percentile of the recent request latencies.");
 
 namespace cert_trans {
 
@@ -65,6 +88,32 @@ const char kStatsSpace[] = "/v2/stats";
 
 const char kStoreStatsKey[] = "/store";
 
+// Weight of the latest request in the moving average of the latency
+// of an endpoint.
+const double kLatencyWeight = 0.1;
+const size_t kMaxLatencySamples = 256;
+// Reads are not hedged until there are enough latencies to go by.
+const size_t kMinLatencySamples = 32;
+
+Gauge<string>* etcd_endpoint_latency_ms =
+    Gauge<string>::New("etcd_endpoint_latency_ms", "endpoint",
+                       "Moving average of the latency of the requests to "
+                       "each etcd server, other than watches.");
+
+Gauge<string>* etcd_endpoint_outstanding_requests =
+    Gauge<string>::New("etcd_endpoint_outstanding_requests", "endpoint",
+                       "Number of requests in flight to each etcd server.");
+
+Counter<>* etcd_hedged_reads =
+    Counter<>::New("etcd_hedged_reads",
+                   "Number of reads also sent to a second etcd server "
+                   "because the first was slow to answer.");
+
+
+string EndpointString(const EtcdClient::HostPortPair& endpoint) {
+  return endpoint.first + ":" + to_string(endpoint.second);
+}
+
 
 util::error::Code ErrorCodeForHttpResponseCode(int response_code) {
   switch (response_code) {
@@ -392,12 +441,25 @@ static const EtcdClient::Node kInvalidNode(-1, -1, "", false, "", {}, true);
 
 
 struct EtcdClient::RequestState {
+  // Whether the caller has been answered, shared by the two halves of
+  // a hedged read.
+  struct Outcome {
+    Outcome() : answered(false) {
+    }
+
+    mutex lock;
+    bool answered;
+  };
+
   RequestState(UrlFetcher::Verb verb, const string& key,
                const string& key_space, map<string, string> params,
                const HostPortPair& host_port, GenericResponse* gen_resp,
                Task* parent_task)
       : gen_resp_(CHECK_NOTNULL(gen_resp)),
-        parent_task_(CHECK_NOTNULL(parent_task)) {
+        parent_task_(CHECK_NOTNULL(parent_task)),
+        outcome_(make_shared<Outcome>()),
+        fetch_task_(nullptr),
+        is_watch_(params.count("wait") > 0) {
     CHECK(!key.empty());
     CHECK_EQ(key[0], '/');
 
@@ -430,17 +492,55 @@ struct EtcdClient::RequestState {
     VLOG(2) << "path query: " << req_.url.PathQuery();
   }
 
+  // The other half of a hedged read, sent to |host_port|.
+  RequestState(const RequestState& other, const HostPortPair& host_port)
+      : gen_resp_(other.gen_resp_),
+        parent_task_(other.parent_task_),
+        outcome_(other.outcome_),
+        fetch_task_(nullptr),
+        is_watch_(other.is_watch_),
+        req_(other.req_) {
+    SetHostPort(host_port);
+  }
+
   void SetHostPort(const HostPortPair& host_port) {
     CHECK(!host_port.first.empty());
     CHECK_GT(host_port.second, 0);
+    endpoint_ = host_port;
     req_.url.SetProtocol("http");
     req_.url.SetHost(host_port.first);
     req_.url.SetPort(host_port.second);
   }
 
+  Task* FetchParent() const {
+    return fetch_task_ ? fetch_task_ : parent_task_;
+  }
+
+  bool Answered() const {
+    lock_guard<mutex> lock(outcome_->lock);
+    return outcome_->answered;
+  }
+
+  // Returns true if the caller is to be answered by this request.
+  bool TryAnswer() {
+    lock_guard<mutex> lock(outcome_->lock);
+    if (outcome_->answered) {
+      return false;
+    }
+    outcome_->answered = true;
+    return true;
+  }
+
   GenericResponse* const gen_resp_;
   Task* const parent_task_;
-
+  const shared_ptr<Outcome> outcome_;
+  // For hedged reads, the task owning this request state, otherwise
+  // it is owned by |parent_task_|.
+  Task* fetch_task_;
+  const bool is_watch_;
+
+  HostPortPair endpoint_;
+  steady_clock::time_point fetch_start_;
   UrlFetcher::Request req_;
   UrlFetcher::Response resp_;
 };
@@ -451,7 +551,9 @@ struct EtcdClient::WatchState {
       : key_(key),
         cb_(cb),
         task_(CHECK_NOTNULL(task)),
-        highest_index_seen_(-1) {
+        highest_index_seen_(-1),
+        delivered_(false),
+        delivery_scheduled_(false) {
   }
 
   ~WatchState() {
@@ -464,6 +566,17 @@ struct EtcdClient::WatchState {
 
   int64_t highest_index_seen_;
   map<string, int64_t> known_keys_;
+
+  // Whether the first callback has been made, which is never delayed.
+  bool delivered_;
+
+  // With --etcd_watch_coalesce_ms, the latest version of each key
+  // changed since the last callback, and whether a delivery is
+  // scheduled or running. The deliveries do not run in the sequence
+  // of the requests, so these need locking.
+  mutex pending_lock_;
+  map<string, Node> pending_;
+  bool delivery_scheduled_;
 };
 
 
@@ -601,16 +714,81 @@ void EtcdClient::WatchRequestDone(WatchState* state, GetResponse* get_resp,
 // state->task_.
 void EtcdClient::SendWatchUpdates(WatchState* state,
                                   const vector<Node>& updates) {
-  if (!updates.empty() || state->highest_index_seen_ == -1) {
-    state->cb_(updates);
+  if (FLAGS_etcd_watch_coalesce_ms <= 0 || !state->delivered_) {
+    if (!updates.empty() || state->highest_index_seen_ == -1) {
+      state->cb_(updates);
+      state->delivered_ = true;
+    }
+
+    // Only start the next request once the callback has return, to
+    // make sure they are always delivered in order.
+    StartWatchRequest(state);
+    return;
+  }
+
+  bool schedule(false);
+  {
+    lock_guard<mutex> lock(state->pending_lock_);
+    // The updates come in order, so these replace older versions.
+    for (const auto& node : updates) {
+      state->pending_[node.key_] = node;
+    }
+    if (!state->pending_.empty() && !state->delivery_scheduled_) {
+      state->delivery_scheduled_ = true;
+      schedule = true;
+    }
+  }
+  if (schedule) {
+    state->task_->executor()->Delay(
+        milliseconds(FLAGS_etcd_watch_coalesce_ms),
+        state->task_->AddChild(
+            bind(&EtcdClient::DeliverWatchUpdates, this, state, _1)));
   }
 
-  // Only start the next request once the callback has return, to make
-  // sure they are always delivered in order.
+  // The next request can go out right away, the deliveries keep the
+  // callbacks in order.
   StartWatchRequest(state);
 }
 
 
+void EtcdClient::DeliverWatchUpdates(WatchState* state, Task* child_task) {
+  vector<Node> updates;
+  {
+    lock_guard<mutex> lock(state->pending_lock_);
+    CHECK(state->delivery_scheduled_);
+    for (auto& it : state->pending_) {
+      updates.emplace_back(move(it.second));
+    }
+    state->pending_.clear();
+  }
+  // In the order they happened, with the deletions found by a new
+  // initial get (which have no index) first.
+  sort(updates.begin(), updates.end(), [](const Node& a, const Node& b) {
+    return a.modified_index_ < b.modified_index_;
+  });
+
+  if (!state->task_->CancelRequested()) {
+    VLOG(1) << "Watch " << state << " : delivering " << updates.size()
+            << " coalesced update(s)";
+    state->cb_(updates);
+  }
+
+  // Another delivery is only scheduled once this callback has
+  // returned, so that they do not overlap.
+  {
+    lock_guard<mutex> lock(state->pending_lock_);
+    if (state->pending_.empty() || state->task_->CancelRequested()) {
+      state->delivery_scheduled_ = false;
+      return;
+    }
+  }
+  state->task_->executor()->Delay(
+      milliseconds(FLAGS_etcd_watch_coalesce_ms),
+      state->task_->AddChild(
+          bind(&EtcdClient::DeliverWatchUpdates, this, state, _1)));
+}
+
+
 void EtcdClient::StartWatchRequest(WatchState* state) {
   if (state->task_->CancelRequested()) {
     state->task_->Return(Status::CANCELLED);
@@ -678,10 +856,16 @@ EtcdClient::EtcdClient(Executor* executor, UrlFetcher* fetcher, const string& ho
 EtcdClient::EtcdClient(Executor* executor, UrlFetcher* fetcher, const list<HostPortPair>& etcds)
     : executor_(CHECK_NOTNULL(executor)),
       log_version_task_(new SyncTask(executor_)),
+      hedged_reads_task_(new SyncTask(executor_)),
       fetcher_(CHECK_NOTNULL(fetcher)),
+      read_policy_(ParseReadPolicy(FLAGS_etcd_read_endpoint_policy)),
       etcds_(etcds),
-      logged_version_(false) {
+      logged_version_(false),
+      next_read_endpoint_(0),
+      next_latency_(0) {
   CHECK(!etcds_.empty()) << "No etcd hosts provided.";
+  CHECK_LE(0, FLAGS_etcd_hedged_read_percentile);
+  CHECK_GE(100, FLAGS_etcd_hedged_read_percentile);
   VLOG(1) << "EtcdClient: " << this;
 
   for (const auto& e : etcds_) {
@@ -704,12 +888,21 @@ EtcdClient::HostPortPair EtcdClient::ChooseNextServer() {
 
 
 EtcdClient::EtcdClient()
-    : executor_(nullptr), log_version_task_(nullptr), fetcher_(nullptr) {
+    : executor_(nullptr),
+      log_version_task_(nullptr),
+      fetcher_(nullptr),
+      read_policy_(ReadPolicy::LEADER),
+      next_read_endpoint_(0),
+      next_latency_(0) {
 }
 
 
 EtcdClient::~EtcdClient() {
   VLOG(1) << "~EtcdClient: " << this;
+  if (hedged_reads_task_) {
+    hedged_reads_task_->task()->Return();
+    hedged_reads_task_->Wait();
+  }
   if (log_version_task_) {
     log_version_task_->task()->Return();
     log_version_task_->Wait();
@@ -719,6 +912,13 @@ EtcdClient::~EtcdClient() {
 
 void EtcdClient::FetchDone(RequestState* etcd_req, Task* task) {
   VLOG(2) << "EtcdClient::FetchDone: " << task->status();
+  FetchEnded(etcd_req, task->status().ok());
+
+  if (etcd_req->fetch_task_ && etcd_req->Answered()) {
+    // The other half of a hedged read answered first.
+    etcd_req->fetch_task_->Return();
+    return;
+  }
 
   if (!task->status().ok()) {
     if (task->status().error_code() == util::error::UNAVAILABLE) {
@@ -726,13 +926,11 @@ void EtcdClient::FetchDone(RequestState* etcd_req, Task* task) {
       LOG(WARNING) << "Etcd fetch failed: " << task->status() << ", retrying "
                    << "on next etcd server.";
       etcd_req->SetHostPort(ChooseNextServer());
-      fetcher_->Fetch(etcd_req->req_, &etcd_req->resp_,
-                      etcd_req->parent_task_->AddChild(
-                          bind(&EtcdClient::FetchDone, this, etcd_req, _1)));
+      StartFetch(etcd_req);
       return;
     }
     // Otherwise just let the requestor know.
-    etcd_req->parent_task_->Return(task->status());
+    Answer(etcd_req, task->status());
     return;
   }
 
@@ -743,17 +941,18 @@ void EtcdClient::FetchDone(RequestState* etcd_req, Task* task) {
         etcd_req->resp_.headers.find("location"));
 
     if (it == etcd_req->resp_.headers.end()) {
-      etcd_req->parent_task_->Return(
-          Status(util::error::INTERNAL,
-                 "etcd returned a redirect without a Location header?"));
+      Answer(etcd_req,
+             Status(util::error::INTERNAL,
+                    "etcd returned a redirect without a Location header?"));
       return;
     }
 
     const URL url(it->second);
     if (url.Host().empty() || url.Port() == 0) {
-      etcd_req->parent_task_->Return(
-          Status(util::error::INTERNAL,
-                 "could not parse Location header from etcd: " + it->second));
+      Answer(etcd_req,
+             Status(util::error::INTERNAL,
+                    "could not parse Location header from etcd: " +
+                        it->second));
       return;
     }
 
@@ -762,9 +961,15 @@ void EtcdClient::FetchDone(RequestState* etcd_req, Task* task) {
 
     MaybeLogEtcdVersion();
 
-    fetcher_->Fetch(etcd_req->req_, &etcd_req->resp_,
-                    etcd_req->parent_task_->AddChild(
-                        bind(&EtcdClient::FetchDone, this, etcd_req, _1)));
+    StartFetch(etcd_req);
+    return;
+  }
+
+  // The response is shared by the halves of a hedged read, so only
+  // the one answering can fill it in.
+  Task* const fetch_task(etcd_req->fetch_task_);
+  if (!etcd_req->TryAnswer()) {
+    fetch_task->Return();
     return;
   }
 
@@ -786,6 +991,77 @@ void EtcdClient::FetchDone(RequestState* etcd_req, Task* task) {
   etcd_req->parent_task_->Return(
       StatusFromResponse(etcd_req->resp_.status_code,
                          *etcd_req->gen_resp_->json_body));
+  if (fetch_task) {
+    fetch_task->Return();
+  }
+}
+
+
+void EtcdClient::Answer(RequestState* etcd_req, const Status& status) {
+  Task* const fetch_task(etcd_req->fetch_task_);
+  if (etcd_req->TryAnswer()) {
+    etcd_req->parent_task_->Return(status);
+  }
+  if (fetch_task) {
+    fetch_task->Return();
+  }
+}
+
+
+void EtcdClient::StartFetch(RequestState* etcd_req) {
+  {
+    lock_guard<mutex> lock(lock_);
+    ++endpoint_stats_[etcd_req->endpoint_].outstanding;
+  }
+  etcd_req->fetch_start_ = steady_clock::now();
+  fetcher_->Fetch(etcd_req->req_, &etcd_req->resp_,
+                  etcd_req->FetchParent()->AddChild(
+                      bind(&EtcdClient::FetchDone, this, etcd_req, _1)));
+}
+
+
+void EtcdClient::FetchEnded(RequestState* etcd_req, bool succeeded) {
+  const double latency_ms(
+      duration<double, milli>(steady_clock::now() - etcd_req->fetch_start_)
+          .count());
+  const string endpoint(EndpointString(etcd_req->endpoint_));
+
+  lock_guard<mutex> lock(lock_);
+  EndpointStats& stats(endpoint_stats_[etcd_req->endpoint_]);
+  --stats.outstanding;
+  etcd_endpoint_outstanding_requests->Set(endpoint, stats.outstanding);
+
+  // Watches wait for something to change, so how long they take says
+  // nothing about the server.
+  if (!succeeded || etcd_req->is_watch_) {
+    return;
+  }
+  stats.latency_ms =
+      stats.latency_ms < 0
+          ? latency_ms
+          : (1 - kLatencyWeight) * stats.latency_ms +
+                kLatencyWeight * latency_ms;
+  etcd_endpoint_latency_ms->Set(endpoint, stats.latency_ms);
+
+  if (recent_latencies_ms_.size() < kMaxLatencySamples) {
+    recent_latencies_ms_.push_back(latency_ms);
+  } else {
+    recent_latencies_ms_[next_latency_] = latency_ms;
+    next_latency_ = (next_latency_ + 1) % kMaxLatencySamples;
+  }
+}
+
+
+void EtcdClient::MaybeStartHedge(RequestState* hedge, Task* delay_task) {
+  if (!delay_task->status().ok() || hedge->Answered()) {
+    hedge->fetch_task_->Return();
+    return;
+  }
+
+  VLOG(1) << "hedging read of " << hedge->req_.url.PathQuery() << " on "
+          << EndpointString(hedge->endpoint_);
+  etcd_hedged_reads->Increment();
+  StartFetch(hedge);
 }
 
 
@@ -795,6 +1071,91 @@ EtcdClient::HostPortPair EtcdClient::GetEndpoint() const {
 }
 
 
+// static
+EtcdClient::ReadPolicy EtcdClient::ParseReadPolicy(const string& policy) {
+  if (policy == "leader") {
+    return ReadPolicy::LEADER;
+  } else if (policy == "round_robin") {
+    return ReadPolicy::ROUND_ROBIN;
+  } else if (policy == "least_outstanding") {
+    return ReadPolicy::LEAST_OUTSTANDING;
+  }
+  LOG(FATAL) << "unknown --etcd_read_endpoint_policy: " << policy;
+  return ReadPolicy::LEADER;
+}
+
+
+EtcdClient::HostPortPair EtcdClient::ChooseReadEndpoint() {
+  lock_guard<mutex> lock(lock_);
+  if (etcds_.size() == 1) {
+    return etcds_.front();
+  }
+
+  switch (read_policy_) {
+    case ReadPolicy::LEADER:
+      return etcds_.front();
+
+    case ReadPolicy::ROUND_ROBIN: {
+      auto it(etcds_.begin());
+      std::advance(it, next_read_endpoint_++ % etcds_.size());
+      return *it;
+    }
+
+    case ReadPolicy::LEAST_OUTSTANDING:
+      return LeastOutstandingEndpoint(nullptr);
+  }
+
+  LOG(FATAL) << "unknown read policy";
+  return etcds_.front();
+}
+
+
+EtcdClient::HostPortPair EtcdClient::LeastOutstandingEndpoint(
+    const HostPortPair* primary) {
+  const HostPortPair* best(nullptr);
+  const EndpointStats* best_stats(nullptr);
+  for (const auto& endpoint : etcds_) {
+    if (primary && endpoint == *primary) {
+      continue;
+    }
+    const EndpointStats& stats(endpoint_stats_[endpoint]);
+    // The endpoints with no latency yet are tried first, to get one.
+    if (!best || stats.outstanding < best_stats->outstanding ||
+        (stats.outstanding == best_stats->outstanding &&
+         stats.latency_ms < best_stats->latency_ms)) {
+      best = &endpoint;
+      best_stats = &stats;
+    }
+  }
+  CHECK_NOTNULL(best);
+  return *best;
+}
+
+
+duration<double, milli> EtcdClient::HedgeDelay() const {
+  const duration<double, milli> kNoHedge(-1);
+  if (FLAGS_etcd_hedged_read_percentile == 0 || !hedged_reads_task_) {
+    return kNoHedge;
+  }
+
+  vector<double> latencies;
+  {
+    lock_guard<mutex> lock(lock_);
+    if (etcds_.size() < 2 || recent_latencies_ms_.size() < kMinLatencySamples) {
+      return kNoHedge;
+    }
+    latencies = recent_latencies_ms_;
+  }
+
+  const size_t index(std::min(
+      latencies.size() - 1,
+      latencies.size() * FLAGS_etcd_hedged_read_percentile / 100));
+  std::nth_element(latencies.begin(), latencies.begin() + index,
+                   latencies.end());
+  return duration<double, milli>(latencies[index]);
+}
+
+
 EtcdClient::HostPortPair EtcdClient::UpdateEndpoint(
     HostPortPair&& new_endpoint) {
   lock_guard<mutex> lock(lock_);
@@ -917,6 +1278,19 @@ void EtcdClient::ForceSetWithTTL(const string& key, const string& value,
 }
 
 
+void EtcdClient::RefreshTTL(const string& key, const seconds& ttl,
+                            Response* resp, Task* task) {
+  map<string, string> params;
+  params["refresh"] = "true";
+  params["prevExist"] = "true";
+  params["ttl"] = to_string(ttl.count());
+  GenericResponse* const gen_resp(new GenericResponse);
+  task->DeleteWhenDone(gen_resp);
+  Generic(key, kKeysSpace, params, UrlFetcher::Verb::PUT, gen_resp,
+          task->AddChild(bind(&UpdateRequestDone, resp, task, gen_resp, _1)));
+}
+
+
 void EtcdClient::Delete(const string& key, const int64_t current_index,
                         Task* task) {
   map<string, string> params;
@@ -965,13 +1339,39 @@ void EtcdClient::Generic(const string& key, const string& key_space,
                          UrlFetcher::Verb verb, GenericResponse* resp,
                          Task* task) {
   MaybeLogEtcdVersion();
-  RequestState* const etcd_req(new RequestState(verb, key, key_space, params,
-                                                GetEndpoint(), resp, task));
-  task->DeleteWhenDone(etcd_req);
+  // Writes and linearizable reads have to go to the leader, but
+  // watches and reads without quorum can be served by any member.
+  const bool is_watch(params.count("wait") > 0);
+  const bool needs_leader(
+      verb != UrlFetcher::Verb::GET ||
+      (!is_watch && (FLAGS_etcd_consistent || FLAGS_etcd_quorum)));
+  RequestState* const etcd_req(new RequestState(
+      verb, key, key_space, params,
+      needs_leader ? GetEndpoint() : ChooseReadEndpoint(), resp, task));
+
+  const duration<double, milli> hedge_delay(
+      needs_leader || is_watch ? duration<double, milli>(-1) : HedgeDelay());
+  if (hedge_delay.count() < 0) {
+    task->DeleteWhenDone(etcd_req);
+    StartFetch(etcd_req);
+    return;
+  }
 
-  fetcher_->Fetch(etcd_req->req_, &etcd_req->resp_,
-                  etcd_req->parent_task_->AddChild(
-                      bind(&EtcdClient::FetchDone, this, etcd_req, _1)));
+  HostPortPair hedge_endpoint;
+  {
+    lock_guard<mutex> lock(lock_);
+    hedge_endpoint = LeastOutstandingEndpoint(&etcd_req->endpoint_);
+  }
+  RequestState* const hedge(new RequestState(*etcd_req, hedge_endpoint));
+  etcd_req->fetch_task_ = hedged_reads_task_->task()->AddChild([](Task*) {});
+  etcd_req->fetch_task_->DeleteWhenDone(etcd_req);
+  hedge->fetch_task_ = hedged_reads_task_->task()->AddChild([](Task*) {});
+  hedge->fetch_task_->DeleteWhenDone(hedge);
+
+  StartFetch(etcd_req);
+  executor_->Delay(hedge_delay,
+                   hedged_reads_task_->task()->AddChild(
+                       bind(&EtcdClient::MaybeStartHedge, this, hedge, _1)));
 }
 
 list<EtcdClient::HostPortPair> SplitHosts(const string& hosts_string) {
@@ -114,6 +114,14 @@ class EtcdClient {
                                const std::chrono::seconds& ttl, Response* resp,
                                util::Task* task);
 
+  // Extends the TTL of an existing |key| without changing its value,
+  // and so without waking up its watchers, which would each have to
+  // issue a new request. Fails with NOT_FOUND if |key| has expired
+  // already. This needs etcd 2.3 or later.
+  virtual void RefreshTTL(const std::string& key,
+                          const std::chrono::seconds& ttl, Response* resp,
+                          util::Task* task);
+
   virtual void Delete(const std::string& key, const int64_t current_index,
                       util::Task* task);
 
@@ -124,7 +132,9 @@ class EtcdClient {
   // The "cb" will be called on the "task" executor. Also, only one
   // will be sent to the executor at a time (for a given call to this
   // method, not for all of them), to make sure they are received in
-  // order.
+  // order. With --etcd_watch_coalesce_ms, the changes which come in
+  // within that window of each other are delivered together, with
+  // only the latest version of each key.
   virtual void Watch(const std::string& key, const WatchCallback& cb,
                      util::Task* task);
 
@@ -136,10 +146,42 @@ class EtcdClient {
   struct RequestState;
   struct WatchState;
 
+  // How to pick the endpoint for the reads which do not need to go to
+  // the leader, see --etcd_read_endpoint_policy.
+  enum class ReadPolicy {
+    LEADER,
+    ROUND_ROBIN,
+    LEAST_OUTSTANDING,
+  };
+
+  struct EndpointStats {
+    EndpointStats() : outstanding(0), latency_ms(-1) {
+    }
+
+    int outstanding;
+    // Moving average of the latency of the requests other than
+    // watches, or -1 until one has completed.
+    double latency_ms;
+  };
+
+  static ReadPolicy ParseReadPolicy(const std::string& policy);
   HostPortPair ChooseNextServer();
   HostPortPair GetEndpoint() const;
   HostPortPair UpdateEndpoint(HostPortPair&& new_endpoint);
+  HostPortPair ChooseReadEndpoint();
+  // Returns the least busy endpoint other than |primary|. This must be
+  // called with "lock_" held.
+  HostPortPair LeastOutstandingEndpoint(const HostPortPair* primary);
+  // Returns how long to wait for a read before sending it to a second
+  // endpoint as well, or a negative duration if it should not be.
+  std::chrono::duration<double, std::milli> HedgeDelay() const;
+  void StartFetch(RequestState* etcd_req);
+  void FetchEnded(RequestState* etcd_req, bool succeeded);
   void FetchDone(RequestState* etcd_req, util::Task* task);
+  void MaybeStartHedge(RequestState* hedge, util::Task* delay_task);
+  // Returns |status| to the caller of |etcd_req|, unless the other
+  // half of a hedged read did so already.
+  void Answer(RequestState* etcd_req, const util::Status& status);
   void Generic(const std::string& key, const std::string& key_space,
                const std::map<std::string, std::string>& params,
                UrlFetcher::Verb verb, GenericResponse* resp, util::Task* task);
@@ -147,6 +189,7 @@ class EtcdClient {
   void WatchInitialGetDone(WatchState* state, GetResponse* resp,
                            util::Task* task);
   void SendWatchUpdates(WatchState* state, const std::vector<Node>& updates);
+  void DeliverWatchUpdates(WatchState* state, util::Task* child_task);
   void StartWatchRequest(WatchState* state);
   void WatchRequestDone(WatchState* state, GetResponse* gen_resp,
                         util::Task* child_task);
@@ -155,11 +198,22 @@ class EtcdClient {
 
   util::Executor* const executor_;
   std::unique_ptr<util::SyncTask> log_version_task_;
+  // The parent of the fetches of hedged reads, which are not children
+  // of the caller's task, so that it does not wait for the slower one.
+  std::unique_ptr<util::SyncTask> hedged_reads_task_;
   UrlFetcher* const fetcher_;
+  const ReadPolicy read_policy_;
 
   mutable std::mutex lock_;
+  // The leader, as far as we know, first.
   std::list<HostPortPair> etcds_;
   bool logged_version_;
+  std::map<HostPortPair, EndpointStats> endpoint_stats_;
+  size_t next_read_endpoint_;
+  // The latencies of the last requests other than watches, in
+  // milliseconds, as a ring buffer.
+  std::vector<double> recent_latencies_ms_;
+  size_t next_latency_;
 
   DISALLOW_COPY_AND_ASSIGN(EtcdClient);
 };
@@ -1,11 +1,17 @@
 #include "util/etcd_delete.h"
 
+#include <algorithm>
+#include <chrono>
 #include <functional>
 #include <gflags/gflags.h>
 #include <glog/logging.h>
 #include <mutex>
 
 using std::bind;
+using std::chrono::milliseconds;
+using std::chrono::steady_clock;
+using std::max;
+using std::min;
 using std::move;
 using std::mutex;
 using std::placeholders::_1;
@@ -18,6 +24,14 @@ using util::TaskHold;
 
 DEFINE_int32(etcd_delete_concurrency, 4,
              "number of etcd keys to delete at a time");
+DEFINE_int32(etcd_delete_target_latency_ms, 0,
+             "if greater than 0, the number of etcd keys deleted at a time "
+             "starts at --etcd_delete_concurrency, and is adjusted for the "
+             "requests to take at most this long: it grows by one every "
+             "round of faster requests, and is halved when one is slower");
+DEFINE_int32(etcd_delete_max_concurrency, 32,
+             "maximum number of etcd keys to delete at a time, when "
+             "--etcd_delete_target_latency_ms is set");
 
 namespace cert_trans {
 namespace {
@@ -28,10 +42,17 @@ class DeleteState {
   DeleteState(EtcdClient* client, vector<string>&& keys, Task* task)
       : client_(CHECK_NOTNULL(client)),
         task_(CHECK_NOTNULL(task)),
+        concurrency_(FLAGS_etcd_delete_concurrency),
+        fast_requests_(0),
+        last_backoff_(steady_clock::now()),
         outstanding_(0),
         keys_(move(keys)),
         it_(keys_.begin()) {
     CHECK_GT(FLAGS_etcd_delete_concurrency, 0);
+    if (FLAGS_etcd_delete_target_latency_ms > 0) {
+      CHECK_GE(FLAGS_etcd_delete_max_concurrency,
+               FLAGS_etcd_delete_concurrency);
+    }
 
     if (it_ == keys_.end()) {
       // Nothing to do!
@@ -46,21 +67,33 @@ class DeleteState {
   }
 
  private:
-  void RequestDone(Task* child_task);
+  void RequestDone(const steady_clock::time_point& started, Task* child_task);
+  // Adjusts |concurrency_| on the latency of a request started at
+  // |started|, if --etcd_delete_target_latency_ms is set.
+  void AdjustConcurrency(const steady_clock::time_point& started);
   void StartNextRequest(unique_lock<mutex>&& lock);
 
   EtcdClient* const client_;
   Task* const task_;
   mutex mutex_;
+  int concurrency_;
+  // Number of requests faster than the target since |concurrency_|
+  // last changed.
+  int fast_requests_;
+  // Requests started before this were already outstanding when
+  // |concurrency_| was last reduced, and do not reduce it again.
+  steady_clock::time_point last_backoff_;
   int outstanding_;
   const vector<string> keys_;
   vector<string>::const_iterator it_;
 };
 
 
-void DeleteState::RequestDone(Task* child_task) {
+void DeleteState::RequestDone(const steady_clock::time_point& started,
+                              Task* child_task) {
   unique_lock<mutex> lock(mutex_);
   --outstanding_;
+  AdjustConcurrency(started);
 
   // If a child task has an error (except for not found, this is close
   // enough to success), return that error, and do not start any more
@@ -84,6 +117,29 @@ void DeleteState::RequestDone(Task* child_task) {
 }
 
 
+void DeleteState::AdjustConcurrency(const steady_clock::time_point& started) {
+  if (FLAGS_etcd_delete_target_latency_ms <= 0) {
+    return;
+  }
+
+  const steady_clock::time_point now(steady_clock::now());
+  if (now - started > milliseconds(FLAGS_etcd_delete_target_latency_ms)) {
+    fast_requests_ = 0;
+    if (started >= last_backoff_) {
+      concurrency_ = max(1, concurrency_ / 2);
+      last_backoff_ = now;
+      VLOG(1) << "etcd deletes too slow, concurrency now " << concurrency_;
+    }
+    return;
+  }
+
+  if (++fast_requests_ >= concurrency_) {
+    fast_requests_ = 0;
+    concurrency_ = min(concurrency_ + 1, FLAGS_etcd_delete_max_concurrency);
+  }
+}
+
+
 void DeleteState::StartNextRequest(unique_lock<mutex>&& lock) {
   CHECK(lock.owns_lock());
 
@@ -94,7 +150,7 @@ void DeleteState::StartNextRequest(unique_lock<mutex>&& lock) {
     return;
   }
 
-  while (outstanding_ < FLAGS_etcd_delete_concurrency && it_ != keys_.end() &&
+  while (outstanding_ < concurrency_ && it_ != keys_.end() &&
          task_->IsActive()) {
     CHECK(lock.owns_lock());
     const string& key(*it_);
@@ -104,8 +160,9 @@ void DeleteState::StartNextRequest(unique_lock<mutex>&& lock) {
     // In case the task uses an inline executor.
     lock.unlock();
 
-    client_->ForceDelete(key, task_->AddChild(
-                                  bind(&DeleteState::RequestDone, this, _1)));
+    client_->ForceDelete(key,
+                         task_->AddChild(bind(&DeleteState::RequestDone, this,
+                                              steady_clock::now(), _1)));
 
     // We must be holding the lock to evaluate the loop condition.
     lock.lock();
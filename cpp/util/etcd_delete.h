@@ -11,7 +11,9 @@ namespace cert_trans {
 
 
 // Force delete keys in batches (implemented using concurrent
-// requests). The "keys" argument are pairs of key and modified index.
+// requests, as many as set by the --etcd_delete_* flags, which can
+// back off if etcd gets slow). The "keys" argument are pairs of key
+// and modified index.
 void EtcdForceDeleteKeys(EtcdClient* client, std::vector<std::string>&& keys,
                          util::Task* task);
 
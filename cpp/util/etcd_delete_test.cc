@@ -1,5 +1,6 @@
 #include <gflags/gflags.h>
 #include <gtest/gtest.h>
+#include <thread>
 
 #include "util/etcd_delete.h"
 #include "util/mock_etcd.h"
@@ -9,11 +10,13 @@
 #include "util/thread_pool.h"
 
 using std::bind;
+using std::chrono::milliseconds;
 using std::chrono::seconds;
 using std::move;
 using std::placeholders::_2;
 using std::placeholders::_3;
 using std::string;
+using std::this_thread::sleep_for;
 using std::vector;
 using testing::DoAll;
 using testing::Exactly;
@@ -32,6 +35,8 @@ using util::Task;
 using util::testing::StatusIs;
 
 DECLARE_int32(etcd_delete_concurrency);
+DECLARE_int32(etcd_delete_max_concurrency);
+DECLARE_int32(etcd_delete_target_latency_ms);
 
 namespace cert_trans {
 namespace {
@@ -41,6 +46,15 @@ class EtcdDeleteTest : public ::testing::Test {
  protected:
   EtcdDeleteTest() : pool_(1) {
     FLAGS_etcd_delete_concurrency = 2;
+    FLAGS_etcd_delete_max_concurrency = 4;
+    FLAGS_etcd_delete_target_latency_ms = 0;
+  }
+
+  // Waits for what is already queued on |pool_| to have run.
+  void FlushPool() {
+    Notification flushed;
+    pool_.Add(bind(&Notification::Notify, &flushed));
+    ASSERT_TRUE(flushed.WaitForNotificationWithTimeout(seconds(1)));
   }
 
   ThreadPool pool_;
@@ -179,6 +193,95 @@ TEST_F(EtcdDeleteTest, WithinConcurrency) {
 }
 
 
+TEST_F(EtcdDeleteTest, GrowsConcurrencyWhenFast) {
+  FLAGS_etcd_delete_concurrency = 1;
+  FLAGS_etcd_delete_target_latency_ms = 1000;
+  vector<string> keys{"/one", "/two", "/three"};
+  SyncTask sync(&pool_);
+
+  Task* first_task(nullptr);
+  Notification first;
+  EXPECT_CALL(client_, ForceDelete("/one", _))
+      .WillOnce(DoAll(SaveArg<1>(&first_task),
+                      InvokeWithoutArgs(&first, &Notification::Notify)));
+  EtcdForceDeleteKeys(&client_, move(keys), sync.task());
+
+  ASSERT_TRUE(first.WaitForNotificationWithTimeout(seconds(1)));
+  ASSERT_TRUE(first_task);
+  Mock::VerifyAndClearExpectations(&client_);
+
+  // The first one was fast, so the next two go together.
+  Task* second_task(nullptr);
+  Notification second;
+  Task* third_task(nullptr);
+  Notification third;
+  EXPECT_CALL(client_, ForceDelete("/two", _))
+      .WillOnce(DoAll(SaveArg<1>(&second_task),
+                      InvokeWithoutArgs(&second, &Notification::Notify)));
+  EXPECT_CALL(client_, ForceDelete("/three", _))
+      .WillOnce(DoAll(SaveArg<1>(&third_task),
+                      InvokeWithoutArgs(&third, &Notification::Notify)));
+  first_task->Return();
+
+  ASSERT_TRUE(second.WaitForNotificationWithTimeout(seconds(1)));
+  ASSERT_TRUE(second_task);
+  ASSERT_TRUE(third.WaitForNotificationWithTimeout(seconds(1)));
+  ASSERT_TRUE(third_task);
+
+  second_task->Return();
+  third_task->Return();
+
+  sync.Wait();
+  EXPECT_OK(sync.status());
+}
+
+
+TEST_F(EtcdDeleteTest, BacksOffWhenSlow) {
+  FLAGS_etcd_delete_target_latency_ms = 20;
+  vector<string> keys{"/one", "/two", "/three"};
+  ASSERT_LT(FLAGS_etcd_delete_concurrency, keys.size());
+  SyncTask sync(&pool_);
+
+  Task* first_task(nullptr);
+  Notification first;
+  Task* second_task(nullptr);
+  Notification second;
+  EXPECT_CALL(client_, ForceDelete("/one", _))
+      .WillOnce(DoAll(SaveArg<1>(&first_task),
+                      InvokeWithoutArgs(&first, &Notification::Notify)));
+  EXPECT_CALL(client_, ForceDelete("/two", _))
+      .WillOnce(DoAll(SaveArg<1>(&second_task),
+                      InvokeWithoutArgs(&second, &Notification::Notify)));
+  EtcdForceDeleteKeys(&client_, move(keys), sync.task());
+
+  ASSERT_TRUE(first.WaitForNotificationWithTimeout(seconds(1)));
+  ASSERT_TRUE(first_task);
+  ASSERT_TRUE(second.WaitForNotificationWithTimeout(seconds(1)));
+  ASSERT_TRUE(second_task);
+  Mock::VerifyAndClearExpectations(&client_);
+
+  // Too slow: with the first one still outstanding, the third one
+  // must wait.
+  sleep_for(milliseconds(50));
+  second_task->Return();
+  FlushPool();
+
+  Task* third_task(nullptr);
+  Notification third;
+  EXPECT_CALL(client_, ForceDelete("/three", _))
+      .WillOnce(DoAll(SaveArg<1>(&third_task),
+                      InvokeWithoutArgs(&third, &Notification::Notify)));
+  first_task->Return();
+
+  ASSERT_TRUE(third.WaitForNotificationWithTimeout(seconds(1)));
+  ASSERT_TRUE(third_task);
+  third_task->Return();
+
+  sync.Wait();
+  EXPECT_OK(sync.status());
+}
+
+
 TEST_F(EtcdDeleteTest, ErrorHandling) {
   vector<string> keys{"/one", "/two", "/three"};
   ASSERT_LT(FLAGS_etcd_delete_concurrency, keys.size());
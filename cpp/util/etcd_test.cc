@@ -12,6 +12,10 @@
 #include "util/sync_task.h"
 #include "util/testing.h"
 
+DECLARE_bool(etcd_consistent);
+DECLARE_bool(etcd_quorum);
+DECLARE_string(etcd_read_endpoint_policy);
+DECLARE_int32(etcd_watch_coalesce_ms);
 DECLARE_int32(etcd_watch_error_retry_delay_seconds);
 
 namespace cert_trans {
@@ -60,6 +64,17 @@ const char kGetJson[] =
     "  }"
     "}";
 
+const char kWatchJson[] =
+    "{"
+    "  \"action\": \"set\","
+    "  \"node\": {"
+    "    \"createdIndex\": 6,"
+    "    \"key\": \"/some/key\","
+    "    \"modifiedIndex\": %d,"
+    "    \"value\": \"%d\""
+    "  }"
+    "}";
+
 const char kGetAllJson[] =
     "{"
     "  \"action\": \"get\","
@@ -631,6 +646,28 @@ TEST_F(EtcdTest, ForceSetWithTTLForNewKey) {
 }
 
 
+TEST_F(EtcdTest, RefreshTTL) {
+  EXPECT_CALL(url_fetcher_,
+              Fetch(IsUrlFetchRequest(
+                        UrlFetcher::Verb::PUT, URL(GetEtcdUrl(kEntryKey)),
+                        ElementsAre(Pair(StrCaseEq("content-type"),
+                                         "application/x-www-form-urlencoded")),
+                        "consistent=true&prevExist=true&quorum=true&"
+                        "refresh=true&ttl=100"),
+                    _, _))
+      .WillOnce(
+          Invoke(bind(HandleFetch, Status::OK, 200,
+                      UrlFetcher::Headers{make_pair("x-etcd-index", "1")},
+                      kUpdateJson, _1, _2, _3)));
+  SyncTask task(base_.get());
+  EtcdClient::Response resp;
+  client_.RefreshTTL(kEntryKey, seconds(100), &resp, task.task());
+  task.Wait();
+  EXPECT_OK(task);
+  EXPECT_EQ(6, resp.etcd_index);
+}
+
+
 TEST_F(EtcdTest, Delete) {
   EXPECT_CALL(
       url_fetcher_,
@@ -825,6 +862,83 @@ TEST_F(EtcdTest, WatchHangingGetTimeoutCausesRetry) {
 }
 
 
+TEST_F(EtcdTest, WatchCoalescesUpdates) {
+  FLAGS_etcd_watch_coalesce_ms = 100;
+
+  {
+    InSequence s;
+    EXPECT_CALL(url_fetcher_,
+                Fetch(IsUrlFetchRequest(UrlFetcher::Verb::GET,
+                                        URL(GetEtcdUrl(kEntryKey) +
+                                            "?consistent=true&quorum=true"),
+                                        IsEmpty(), ""),
+                      _, _))
+        .WillOnce(
+            Invoke(bind(HandleFetch, Status::OK, 200,
+                        UrlFetcher::Headers{make_pair("x-etcd-index", "9")},
+                        kGetJson, _1, _2, _3)));
+    for (int index = 10; index <= 11; ++index) {
+      char json[sizeof(kWatchJson) + 16];
+      snprintf(json, sizeof(json), kWatchJson, index, index);
+      EXPECT_CALL(url_fetcher_,
+                  Fetch(IsUrlFetchRequest(UrlFetcher::Verb::GET,
+                                          URL(GetEtcdUrl(kEntryKey) +
+                                              "?consistent=true"
+                                              "&quorum=false"
+                                              "&recursive=true&wait=true"
+                                              "&waitIndex=" +
+                                              to_string(index)),
+                                          IsEmpty(), ""),
+                        _, _))
+          .WillOnce(Invoke(
+              bind(HandleFetch, Status::OK, 200,
+                   UrlFetcher::Headers{
+                       make_pair("x-etcd-index", to_string(index))},
+                   string(json), _1, _2, _3)));
+    }
+    // Nothing else changes until the watch is cancelled.
+    EXPECT_CALL(url_fetcher_,
+                Fetch(IsUrlFetchRequest(UrlFetcher::Verb::GET,
+                                        URL(GetEtcdUrl(kEntryKey) +
+                                            "?consistent=true&quorum=false" +
+                                            "&recursive=true&wait=true" +
+                                            "&waitIndex=12"),
+                                        IsEmpty(), ""),
+                      _, _))
+        .WillRepeatedly(Invoke(bind(HandleFetch,
+                                    Status(util::error::DEADLINE_EXCEEDED, ""),
+                                    0, UrlFetcher::Headers{}, "", _1, _2,
+                                    _3)));
+  }
+
+  SyncTask task(base_.get());
+  int num_updates(0);
+  client_.Watch(kEntryKey,
+                [&task,
+                 &num_updates](const vector<EtcdClient::Node>& updates) {
+                  ASSERT_EQ(1, updates.size());
+                  if (num_updates == 0) {
+                    // The initial get is not delayed.
+                    EXPECT_EQ(9, updates[0].modified_index_);
+                    EXPECT_EQ("123", updates[0].value_);
+                  } else {
+                    // Both changes come in one callback, which only
+                    // has the latest.
+                    EXPECT_EQ(1, num_updates);
+                    EXPECT_EQ(11, updates[0].modified_index_);
+                    EXPECT_EQ("11", updates[0].value_);
+                    task.Cancel();
+                  }
+                  ++num_updates;
+                },
+                task.task());
+  task.Wait();
+  EXPECT_EQ(2, num_updates);
+
+  FLAGS_etcd_watch_coalesce_ms = 0;
+}
+
+
 TEST_F(EtcdTest, UnavailableEtcdRetriesOnNewServer) {
   EtcdClient multi_client(base_.get(), &url_fetcher_,
                           {EtcdClient::HostPortPair(kEtcdHost, kEtcdPort),
@@ -1030,6 +1144,87 @@ TEST_F(EtcdTest, GetStoreStats) {
 }
 
 
+TEST_F(EtcdTest, RoundRobinSpreadsRelaxedReads) {
+  FLAGS_etcd_consistent = false;
+  FLAGS_etcd_quorum = false;
+  FLAGS_etcd_read_endpoint_policy = "round_robin";
+  EtcdClient multi_client(base_.get(), &url_fetcher_,
+                          {EtcdClient::HostPortPair(kEtcdHost, kEtcdPort),
+                           EtcdClient::HostPortPair(kEtcdHost2, kEtcdPort2)});
+
+  {
+    InSequence s;
+
+    for (int i = 0; i < 2; ++i) {
+      EXPECT_CALL(url_fetcher_,
+                  Fetch(IsUrlFetchRequest(UrlFetcher::Verb::GET,
+                                          URL(GetEtcdUrl(kEntryKey)),
+                                          IsEmpty(), ""),
+                        _, _))
+          .WillOnce(
+              Invoke(bind(HandleFetch, Status::OK, 200,
+                          UrlFetcher::Headers{make_pair("x-etcd-index", "11")},
+                          kGetJson, _1, _2, _3)));
+      EXPECT_CALL(url_fetcher_,
+                  Fetch(IsUrlFetchRequest(UrlFetcher::Verb::GET,
+                                          URL(GetEtcdUrl(kEntryKey,
+                                                         kDefaultSpace,
+                                                         kEtcdHost2,
+                                                         kEtcdPort2)),
+                                          IsEmpty(), ""),
+                        _, _))
+          .WillOnce(
+              Invoke(bind(HandleFetch, Status::OK, 200,
+                          UrlFetcher::Headers{make_pair("x-etcd-index", "11")},
+                          kGetJson, _1, _2, _3)));
+    }
+  }
+
+  for (int i = 0; i < 4; ++i) {
+    SyncTask task(base_.get());
+    EtcdClient::GetResponse resp;
+    multi_client.Get(string(kEntryKey), &resp, task.task());
+    task.Wait();
+    EXPECT_OK(task);
+    EXPECT_EQ("123", resp.node.value_);
+  }
+
+  FLAGS_etcd_consistent = true;
+  FLAGS_etcd_quorum = true;
+  FLAGS_etcd_read_endpoint_policy = "leader";
+}
+
+
+TEST_F(EtcdTest, ConsistentReadsStayOnLeader) {
+  FLAGS_etcd_read_endpoint_policy = "round_robin";
+  EtcdClient multi_client(base_.get(), &url_fetcher_,
+                          {EtcdClient::HostPortPair(kEtcdHost, kEtcdPort),
+                           EtcdClient::HostPortPair(kEtcdHost2, kEtcdPort2)});
+
+  EXPECT_CALL(url_fetcher_,
+              Fetch(IsUrlFetchRequest(UrlFetcher::Verb::GET,
+                                      URL(GetEtcdUrl(kEntryKey) +
+                                          "?consistent=true&quorum=true"),
+                                      IsEmpty(), ""),
+                    _, _))
+      .Times(2)
+      .WillRepeatedly(
+          Invoke(bind(HandleFetch, Status::OK, 200,
+                      UrlFetcher::Headers{make_pair("x-etcd-index", "11")},
+                      kGetJson, _1, _2, _3)));
+
+  for (int i = 0; i < 2; ++i) {
+    SyncTask task(base_.get());
+    EtcdClient::GetResponse resp;
+    multi_client.Get(string(kEntryKey), &resp, task.task());
+    task.Wait();
+    EXPECT_OK(task);
+  }
+
+  FLAGS_etcd_read_endpoint_policy = "leader";
+}
+
+
 TEST_F(EtcdTest, SplitHosts) {
   const string hosts(string(kEtcdHost) + ":" + to_string(kEtcdPort) + "," +
                      kEtcdHost2 + ":" + to_string(kEtcdPort2));
@@ -12,12 +12,27 @@ class Task;
 
 class Executor {
  public:
+  // The classes of work an executor can tell apart.
+  enum class Priority {
+    // Latency-critical work, such as keeping the cluster state up to
+    // date, which should not wait behind the bulk of the requests.
+    HIGH,
+    NORMAL,
+  };
+
   virtual ~Executor() = default;
 
   virtual void Add(const std::function<void()>& closure) = 0;
   virtual void Delay(const std::chrono::duration<double>& delay,
                      Task* task) = 0;
 
+  // Same as Add(), but lets the executor run |closure| ahead of work
+  // of a lower |priority|. By default, the priority is ignored.
+  virtual void AddWithPriority(Priority priority,
+                               const std::function<void()>& closure) {
+    Add(closure);
+  }
+
  protected:
   Executor() = default;
 
@@ -26,6 +41,30 @@ class Executor {
 };
 
 
+// Adds everything to another executor with a given priority, so that
+// all the work of a Task, for example, gets that priority.
+class PriorityExecutor : public Executor {
+ public:
+  // Does not take ownership of |executor|.
+  PriorityExecutor(Executor* executor, Priority priority)
+      : executor_(executor), priority_(priority) {
+  }
+
+  void Add(const std::function<void()>& closure) override {
+    executor_->AddWithPriority(priority_, closure);
+  }
+
+  void Delay(const std::chrono::duration<double>& delay,
+             Task* task) override {
+    executor_->Delay(delay, task);
+  }
+
+ private:
+  Executor* const executor_;
+  const Priority priority_;
+};
+
+
 }  // namespace util
 
 #endif  // CERT_TRANS_UTIL_EXECUTOR_H_
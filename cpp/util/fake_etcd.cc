@@ -67,18 +67,19 @@ string NormalizeKey(const string& input) {
 }
 
 
-bool WatchMatchesKey(const string& watch_key, const string& notify_key,
-                     bool recursive) {
-  if (watch_key == notify_key) {
-    return true;
+// Returns all the directories above |key|, from "/" down, followed
+// by |key| itself.
+vector<string> ParentsAndKey(const string& key) {
+  vector<string> keys;
+  if (key != "/") {
+    keys.emplace_back("/");
   }
-
-  if (!recursive) {
-    return false;
+  for (string::size_type slash = key.find_first_of('/', 1);
+       slash != string::npos; slash = key.find_first_of('/', slash + 1)) {
+    keys.emplace_back(key.substr(0, slash));
   }
-
-  const string dir(watch_key + "/");
-  return watch_key == "/" || notify_key.compare(0, dir.size(), dir) == 0;
+  keys.emplace_back(key);
+  return keys;
 }
 
 
@@ -140,7 +141,7 @@ void FakeEtcdClient::Watch(const string& rawkey, const WatchCallback& cb,
   }
   ScheduleWatchCallback(lock, task, bind(cb, move(initial_updates)));
   watches_[key].push_back(make_pair(cb, task));
-  task->WhenCancelled(bind(&FakeEtcdClient::CancelWatch, this, task));
+  task->WhenCancelled(bind(&FakeEtcdClient::CancelWatch, this, key, task));
   ++stats_["watchers"];
 }
 
@@ -148,17 +149,40 @@ void FakeEtcdClient::Watch(const string& rawkey, const WatchCallback& cb,
 void FakeEtcdClient::PurgeExpiredEntriesWithLock(
     const unique_lock<mutex>& lock) {
   CHECK(lock.owns_lock());
-  for (auto it = entries_.begin(); it != entries_.end();) {
-    if (it->second.expires_ < system_clock::now()) {
-      VLOG(1) << "Deleting expired entry " << it->first;
-      it->second.deleted_ = true;
-      NotifyForPath(lock, it->first);
-      it = entries_.erase(it);
-      ++stats_["expireCount"];
-    } else {
-      ++it;
+  const system_clock::time_point now(system_clock::now());
+  while (!expiries_.empty() && expiries_.begin()->first < now) {
+    const string key(expiries_.begin()->second);
+    expiries_.erase(expiries_.begin());
+    const map<string, Node>::iterator it(entries_.find(key));
+    CHECK(it != entries_.end()) << key;
+    VLOG(1) << "Deleting expired entry " << it->first;
+    it->second.deleted_ = true;
+    NotifyForPath(lock, it->first);
+    entries_.erase(it);
+    ++stats_["expireCount"];
+  }
+}
+
+
+void FakeEtcdClient::AddExpiry(const Node& node) {
+  if (node.expires_ < system_clock::time_point::max()) {
+    expiries_.emplace(node.expires_, node.key_);
+  }
+}
+
+
+void FakeEtcdClient::RemoveExpiry(const Node& node) {
+  if (node.expires_ == system_clock::time_point::max()) {
+    return;
+  }
+  const auto range(expiries_.equal_range(node.expires_));
+  for (auto it = range.first; it != range.second; ++it) {
+    if (it->second == node.key_) {
+      expiries_.erase(it);
+      return;
     }
   }
+  LOG(FATAL) << "no expiry for " << node.key_;
 }
 
 
@@ -176,25 +200,33 @@ void FakeEtcdClient::NotifyForPath(const unique_lock<mutex>& lock,
   CHECK(node_it != entries_.end());
   const Node& node(node_it->second);
 
-  const multimap<string, tuple<bool, GetResponse*, Task*>>::iterator last(
-      waiting_gets_.upper_bound(path));
-  multimap<string, tuple<bool, GetResponse*, Task*>>::iterator it;
-  for (it = waiting_gets_.begin(); it != last;) {
-    if (WatchMatchesKey(it->first, node.key_, get<0>(it->second))) {
-      get<1>(it->second)->node = node;
-      get<2>(it->second)->Return();
-      it = waiting_gets_.erase(it);
-    } else {
-      ++it;
+  // Only the waiting gets and watches on the path itself or on one of
+  // its parents can match, so look those up rather than going through
+  // all of them.
+  const vector<string> keys(ParentsAndKey(path));
+  for (const string& key : keys) {
+    const bool is_parent(key != path);
+    const auto range(waiting_gets_.equal_range(key));
+    for (auto it = range.first; it != range.second;) {
+      // Waiting gets on a parent directory only match if recursive.
+      if (!is_parent || get<0>(it->second)) {
+        get<1>(it->second)->node = node;
+        get<2>(it->second)->Return();
+        it = waiting_gets_.erase(it);
+      } else {
+        ++it;
+      }
     }
   }
 
-  for (const auto& pair : watches_) {
-    if (path.find(pair.first) == 0) {
-      for (const auto& cb_cookie : pair.second) {
-        ScheduleWatchCallback(lock, cb_cookie.second,
-                              bind(cb_cookie.first, vector<Node>{node}));
-      }
+  for (const string& key : keys) {
+    const auto it(watches_.find(key));
+    if (it == watches_.end()) {
+      continue;
+    }
+    for (const auto& cb_cookie : it->second) {
+      ScheduleWatchCallback(lock, cb_cookie.second,
+                            bind(cb_cookie.first, vector<Node>{node}));
     }
   }
 }
@@ -253,9 +285,15 @@ void FakeEtcdClient::Get(const Request& req, GetResponse* resp, Task* task) {
         parent_nodes.push_back(&parent_nodes.back()->nodes_.back());
       }
     } else {
-      if (it->first.find_first_of('/', key_prefix.size()) == string::npos) {
-        resp->node.nodes_.emplace_back(it->second);
+      const string::size_type slash(
+          it->first.find_first_of('/', key_prefix.size()));
+      if (slash != string::npos) {
+        // Skip over the rest of the contents of this subdirectory,
+        // which sort between "<subdir>/" and "<subdir>0".
+        it = entries_.lower_bound(it->first.substr(0, slash) + "0");
+        continue;
       }
+      resp->node.nodes_.emplace_back(it->second);
     }
 
     ++it;
@@ -333,12 +371,18 @@ void FakeEtcdClient::InternalPut(const string& rawkey, const string& value,
     node.created_index_ = entry->second.created_index_;
   }
 
+  if (entry != entries_.end()) {
+    RemoveExpiry(entry->second);
+  }
+  AddExpiry(node);
   entries_[key] = node;
   resp->etcd_index = new_index;
   index_ = new_index;
   task->Return();
   NotifyForPath(lock, key);
-  DumpEntries(lock);
+  if (VLOG_IS_ON(1)) {
+    DumpEntries(lock);
+  }
   if (expires < system_clock::time_point::max()) {
     const std::chrono::duration<double> delay(expires - system_clock::now());
     base_->Delay(delay, parent_task_.task()->AddChild(
@@ -373,6 +417,7 @@ void FakeEtcdClient::InternalDelete(const string& key,
                             to_string(entry->second.modified_index_)));
     return;
   }
+  RemoveExpiry(entry->second);
   entry->second.modified_index_ = ++index_;
   entry->second.value_.clear();
   entry->second.deleted_ = true;
@@ -450,6 +495,32 @@ void FakeEtcdClient::ForceSetWithTTL(const std::string& key,
 }
 
 
+void FakeEtcdClient::RefreshTTL(const string& rawkey, const seconds& ttl,
+                                Response* resp, Task* task) {
+  task->CleanupWhenDone(
+      bind(&FakeEtcdClient::UpdateOperationStats, this, "update", task));
+  const string key(NormalizeKey(rawkey));
+  *resp = EtcdClient::Response();
+  unique_lock<mutex> lock(mutex_);
+  PurgeExpiredEntriesWithLock(lock);
+  const map<string, Node>::iterator entry(entries_.find(key));
+  if (entry == entries_.end()) {
+    task->Return(Status(util::error::NOT_FOUND, "Node doesn't exist: " + key));
+    return;
+  }
+
+  // Unlike InternalPut(), the watchers are not notified.
+  RemoveExpiry(entry->second);
+  entry->second.modified_index_ = ++index_;
+  entry->second.expires_ = system_clock::now() + ttl;
+  AddExpiry(entry->second);
+  resp->etcd_index = index_;
+  task->Return();
+  base_->Delay(ttl, parent_task_.task()->AddChild(bind(
+                        &FakeEtcdClient::PurgeExpiredEntries, this)));
+}
+
+
 void FakeEtcdClient::Delete(const string& key, const int64_t current_index,
                             Task* task) {
   CHECK_GT(current_index, 0);
@@ -470,26 +541,26 @@ void FakeEtcdClient::GetStoreStats(StatsResponse* resp, Task* task) {
 }
 
 
-void FakeEtcdClient::CancelWatch(Task* task) {
+void FakeEtcdClient::CancelWatch(const string& key, Task* task) {
   lock_guard<mutex> lock(mutex_);
-  bool found(false);
-  for (auto& pair : watches_) {
-    for (auto it(pair.second.begin()); it != pair.second.end();) {
-      if (it->second == task) {
-        CHECK(!found);
-        found = true;
-        VLOG(1) << "Removing watcher " << it->second << " on " << pair.first;
-        --stats_["watchers"];
-        // Outstanding notifications have a hold on this task, so they
-        // will all go through before the task actually completes. But
-        // we won't be sending new notifications.
-        task->Return(Status::CANCELLED);
-        it = pair.second.erase(it);
-      } else {
-        ++it;
+  const auto watches(watches_.find(key));
+  CHECK(watches != watches_.end()) << key;
+  for (auto it(watches->second.begin()); it != watches->second.end(); ++it) {
+    if (it->second == task) {
+      VLOG(1) << "Removing watcher " << it->second << " on " << key;
+      --stats_["watchers"];
+      // Outstanding notifications have a hold on this task, so they
+      // will all go through before the task actually completes. But
+      // we won't be sending new notifications.
+      task->Return(Status::CANCELLED);
+      watches->second.erase(it);
+      if (watches->second.empty()) {
+        watches_.erase(watches);
       }
+      return;
     }
   }
+  LOG(FATAL) << "watch not found on " << key;
 }
 
 
@@ -47,6 +47,9 @@ class FakeEtcdClient : public EtcdClient {
                        const std::chrono::seconds& ttl, Response* resp,
                        util::Task* task) override;
 
+  void RefreshTTL(const std::string& key, const std::chrono::seconds& ttl,
+                  Response* resp, util::Task* task) override;
+
   void Delete(const std::string& key, const int64_t current_index,
               util::Task* task) override;
 
@@ -69,6 +72,11 @@ class FakeEtcdClient : public EtcdClient {
   void NotifyForPath(const std::unique_lock<std::mutex>& lock,
                      const std::string& path);
 
+  // Keep |expiries_| in sync with the expiry of |node|, which is or
+  // was in |entries_|. Should be called with mutex_ held.
+  void AddExpiry(const Node& node);
+  void RemoveExpiry(const Node& node);
+
   void InternalPut(const std::string& rawkey, const std::string& value,
                    const std::chrono::system_clock::time_point& expires,
                    bool create, int64_t prev_index, Response* resp,
@@ -79,7 +87,7 @@ class FakeEtcdClient : public EtcdClient {
 
   void UpdateOperationStats(const std::string& op, const util::Task* task);
 
-  void CancelWatch(util::Task* task);
+  void CancelWatch(const std::string& key, util::Task* task);
   void CancelWaitingGet(const std::string& key, util::Task* task);
 
   // Arranges for the watch callbacks to be called in order. Should be
@@ -94,6 +102,8 @@ class FakeEtcdClient : public EtcdClient {
   std::mutex mutex_;
   int64_t index_;
   std::map<std::string, Node> entries_;
+  // The keys of the entries with a TTL, by expiry time.
+  std::multimap<std::chrono::system_clock::time_point, std::string> expiries_;
   std::multimap<std::string, std::tuple<bool, GetResponse*, util::Task*>>
       waiting_gets_;
   std::map<std::string, std::vector<std::pair<WatchCallback, util::Task*>>>
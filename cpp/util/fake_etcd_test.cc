@@ -43,6 +43,7 @@ using std::vector;
 using testing::DoAll;
 using testing::ElementsAre;
 using testing::InvokeWithoutArgs;
+using testing::IsEmpty;
 using testing::Matches;
 using testing::Mock;
 using testing::MockFunction;
@@ -151,6 +152,16 @@ class FakeEtcdTest : public ::testing::Test {
     return task.status();
   }
 
+  Status BlockingRefreshTTL(const string& key, const seconds& ttl,
+                            int64_t* modified_index) {
+    SyncTask task(base_.get());
+    EtcdClient::Response resp;
+    client_->RefreshTTL(key, ttl, &resp, task.task());
+    task.Wait();
+    *modified_index = resp.etcd_index;
+    return task.status();
+  }
+
   Status BlockingDelete(const string& key, int64_t previous_index) {
     SyncTask task(base_.get());
     client_->Delete(key, previous_index, task.task());
@@ -424,6 +435,38 @@ TEST_F(FakeEtcdTest, ForceSetWithTTLExpires) {
 }
 
 
+TEST_F(FakeEtcdTest, RefreshTTLExtendsExpiry) {
+  seconds kTtl(2);
+
+  int64_t created_index;
+  EXPECT_OK(BlockingCreateWithTTL(key_prefix_, kValue, kTtl, &created_index));
+
+  // Keep refreshing it for longer than its original TTL.
+  int64_t modified_index(created_index);
+  for (int i = 0; i < 3; ++i) {
+    sleep_for(seconds(1));
+    int64_t refreshed_index;
+    EXPECT_OK(BlockingRefreshTTL(key_prefix_, kTtl, &refreshed_index));
+    EXPECT_LT(modified_index, refreshed_index);
+    modified_index = refreshed_index;
+  }
+
+  EtcdClient::Node node;
+  EXPECT_OK(BlockingGet(key_prefix_, &node));
+  EXPECT_EQ(kValue, node.value_);
+  EXPECT_EQ(created_index, node.created_index_);
+  EXPECT_EQ(modified_index, node.modified_index_);
+
+  // Once it is no longer refreshed, it expires, and cannot be brought
+  // back with a refresh.
+  sleep_for(kTtl + seconds(1));
+  EXPECT_THAT(BlockingGet(key_prefix_, &node),
+              StatusIs(util::error::NOT_FOUND));
+  EXPECT_THAT(BlockingRefreshTTL(key_prefix_, kTtl, &modified_index),
+              StatusIs(util::error::NOT_FOUND));
+}
+
+
 TEST_F(FakeEtcdTest, DeleteNonExistent) {
   map<string, int64_t> expected_stats;
   ASSERT_OK(BlockingGetStats(&expected_stats));
@@ -613,6 +656,42 @@ TEST_F(FakeEtcdTest, WatcherForCreate) {
 }
 
 
+TEST_F(FakeEtcdTest, WatcherIgnoresKeysSharingItsPrefix) {
+  const string kDir(key_prefix_);
+  const string kPath(kDir + "/1");
+
+  StrictMock<MockFunction<void(const vector<EtcdClient::Node>&)>> watcher;
+  Notification initial;
+  EXPECT_CALL(watcher, Call(IsEmpty()))
+      .WillOnce(InvokeWithoutArgs(&initial, &Notification::Notify));
+
+  util::SyncTask watch_task(base_.get());
+  client_->Watch(
+      kDir, bind(&MockFunction<void(const vector<EtcdClient::Node>&)>::Call,
+                 &watcher, _1),
+      watch_task.task());
+
+  ASSERT_TRUE(initial.WaitForNotificationWithTimeout(seconds(1)));
+  Mock::VerifyAndClearExpectations(&watcher);
+
+  // Not under kDir, so the watcher only hears about the second one.
+  Notification second;
+  EXPECT_CALL(watcher,
+              Call(ElementsAre(EtcdClientNodeIs(kPath, kValue2, false))))
+      .WillOnce(InvokeWithoutArgs(&second, &Notification::Notify));
+
+  int64_t created_index;
+  EXPECT_OK(BlockingCreate(kDir + "x", kValue, &created_index));
+  EXPECT_OK(BlockingCreate(kPath, kValue2, &created_index));
+
+  EXPECT_TRUE(second.WaitForNotificationWithTimeout(seconds(1)));
+
+  watch_task.Cancel();
+  watch_task.Wait();
+  EXPECT_THAT(watch_task.status(), StatusIs(util::error::CANCELLED));
+}
+
+
 TEST_F(FakeEtcdTest, WatcherForDelete) {
   const string kDir(key_prefix_);
   const string kPath(kDir + "/subkey");
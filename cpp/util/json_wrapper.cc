@@ -1,13 +1,90 @@
 #include "json_wrapper.h"
 
+#include <limits>
 #include <memory>
+#include <mutex>
+#include <vector>
 
+using std::lock_guard;
+using std::mutex;
 using std::unique_ptr;
+using std::vector;
+
+namespace {
+
+
+// json_tokener_new() allocates the tokener, its stack and its buffer,
+// so they are kept for the next parse, on any thread.
+class TokenerPool {
+ public:
+  json_tokener* Get() {
+    {
+      lock_guard<mutex> lock(lock_);
+      if (!free_.empty()) {
+        json_tokener* const tokener(free_.back());
+        free_.pop_back();
+        return tokener;
+      }
+    }
+    return CHECK_NOTNULL(json_tokener_new());
+  }
+
+  void Put(json_tokener* tokener) {
+    json_tokener_reset(tokener);
+    {
+      lock_guard<mutex> lock(lock_);
+      if (free_.size() < kMaxFree) {
+        free_.push_back(tokener);
+        return;
+      }
+    }
+    json_tokener_free(tokener);
+  }
+
+ private:
+  // About as many as there are threads parsing at once.
+  static const size_t kMaxFree = 64;
+
+  mutex lock_;
+  vector<json_tokener*> free_;
+};
+
+
+class ScopedTokener {
+ public:
+  ScopedTokener() : tokener_(Pool()->Get()) {
+  }
+
+  ~ScopedTokener() {
+    Pool()->Put(tokener_);
+  }
+
+  json_tokener* get() const {
+    return tokener_;
+  }
+
+  json_tokener* operator->() const {
+    return tokener_;
+  }
+
+ private:
+  static TokenerPool* Pool() {
+    // Never destroyed, so that it can be used until the very end.
+    static TokenerPool* const pool(new TokenerPool);
+    return pool;
+  }
+
+  json_tokener* const tokener_;
+
+  DISALLOW_COPY_AND_ASSIGN(ScopedTokener);
+};
+
+
+}  // namespace
 
 
 JsonObject::JsonObject(evbuffer* buffer) : obj_(NULL) {
-  const unique_ptr<json_tokener, void (*)(json_tokener*)> tokener(
-      json_tokener_new(), json_tokener_free);
+  const ScopedTokener tokener;
 
   evbuffer_ptr ptr;
   evbuffer_ptr_set(buffer, &ptr, 0, EVBUFFER_PTR_SET);
@@ -60,6 +137,24 @@ JsonObject::JsonObject(evbuffer* buffer) : obj_(NULL) {
 }
 
 
+// static
+json_object* JsonObject::Parse(const char* json, size_t length) {
+  CHECK_LT(length, static_cast<size_t>(std::numeric_limits<int>::max()));
+  const ScopedTokener tokener;
+  // Including the NUL, which ends a number at the top level, as it
+  // does for json_tokener_parse().
+  json_object* const obj(json_tokener_parse_ex(tokener.get(), json,
+                                               static_cast<int>(length + 1)));
+  if (json_tokener_get_error(tokener.get()) != json_tokener_success) {
+    if (obj) {
+      json_object_put(obj);
+    }
+    return NULL;
+  }
+  return obj;
+}
+
+
 JsonObject::JsonObject(const JsonArray& from, int offset, json_type type) {
   obj_ = json_object_array_get_idx(from.obj_, offset);
   if (obj_ != NULL) {
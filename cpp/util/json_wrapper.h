@@ -13,6 +13,7 @@
 
 #include "base/macros.h"
 #include "proto/serializer.h"
+#include "util/base64.h"
 #include "util/util.h"
 
 class JsonArray;
@@ -27,11 +28,12 @@ class JsonObject {
   }
 
   explicit JsonObject(const std::ostringstream& response) {
-    obj_ = json_tokener_parse(response.str().c_str());
+    const std::string str(response.str());
+    obj_ = Parse(str.c_str(), str.size());
   }
 
-  explicit JsonObject(const std::string& response) {
-    obj_ = json_tokener_parse(response.c_str());
+  explicit JsonObject(const std::string& response)
+      : obj_(Parse(response.c_str(), response.size())) {
   }
 
   // This constructor is destructive: if a JSON object is parsed
@@ -71,7 +73,7 @@ class JsonObject {
   }
 
   const char* ToJson() const {
-    return json_object_to_json_string(obj_);
+    return json_object_to_json_string_ext(obj_, kToStringFlags);
   }
 
   void Add(const char* name, const JsonObject& addand) {
@@ -83,7 +85,7 @@ class JsonObject {
   }
 
   void Add(const char* name, const std::string& value) {
-    Add(name, json_object_new_string(value.c_str()));
+    Add(name, json_object_new_string_len(value.data(), value.size()));
   }
 
   void AddBase64(const char* name, const std::string& value) {
@@ -101,8 +103,12 @@ class JsonObject {
     Add(name, json_object_new_boolean(b));
   }
 
+  void AddDouble(const char* name, double value) {
+    Add(name, json_object_new_double(value));
+  }
+
   const char* ToString() const {
-    return json_object_to_json_string(obj_);
+    return json_object_to_json_string_ext(obj_, kToStringFlags);
   }
 
   std::string DebugString() const {
@@ -117,6 +123,20 @@ class JsonObject {
   json_object* obj_;
 
  private:
+  // As json_object_to_json_string(), but without escaping '/', which
+  // is frequent in base 64 and need not be.
+#ifdef JSON_C_TO_STRING_NOSLASHESCAPE
+  static const int kToStringFlags =
+      JSON_C_TO_STRING_SPACED | JSON_C_TO_STRING_NOSLASHESCAPE;
+#else
+  static const int kToStringFlags = JSON_C_TO_STRING_SPACED;
+#endif
+
+  // Same as json_tokener_parse(), for the |length| bytes at |json|,
+  // which are followed by a NUL, with a tokener that is kept for the
+  // next call rather than allocated each time.
+  static json_object* Parse(const char* json, size_t length);
+
   void InitFromChild(const JsonObject& from, const char* field,
                      json_type type) {
     if (json_object_object_get_ex(from.obj_, field, &obj_)) {
@@ -167,7 +187,16 @@ class JsonString : public JsonObject {
   }
 
   std::string FromBase64() {
-    return util::FromBase64(Value());
+    // json-c knows the length, there is no need to look for the NUL.
+    const int length(json_object_get_string_len(obj_));
+    std::string ret(util::Base64DecodedMaxLength(length), '\0');
+    size_t decoded_length;
+    // Treat decode errors as empty strings, as util::FromBase64().
+    if (!util::Base64Decode(Value(), length, &ret[0], &decoded_length)) {
+      return std::string();
+    }
+    ret.resize(decoded_length);
+    return ret;
   }
 };
 
@@ -198,7 +227,7 @@ class JsonArray : public JsonObject {
   }
 
   void Add(const std::string& addand) {
-    Add(json_object_new_string(addand.c_str()));
+    Add(json_object_new_string_len(addand.data(), addand.size()));
   }
 
   void Add(JsonObject* addand) {
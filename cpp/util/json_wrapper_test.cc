@@ -83,6 +83,47 @@ TEST_F(JsonWrapperTest, FragmentedEvBuffer) {
   EXPECT_EQ(0U, evbuffer_get_length(buffer.get()));
 }
 
+TEST_F(JsonWrapperTest, ParsesAfterError) {
+  // The tokeners are reused, and must not keep anything from a
+  // failed parse.
+  EXPECT_FALSE(JsonObject(string("{ \"foo\": ")).Ok());
+  EXPECT_FALSE(JsonObject(string("[1, 2")).Ok());
+  JsonObject obj(string("{ \"foo\": 42 }"));
+  ASSERT_TRUE(obj.Ok());
+  JsonInt foo(obj, "foo");
+  ASSERT_TRUE(foo.Ok());
+  EXPECT_EQ(42, foo.Value());
+
+  // Numbers at the top level end at the end of the string.
+  JsonObject number(string("123"));
+  ASSERT_TRUE(number.Ok());
+  EXPECT_TRUE(number.IsType(json_type_int));
+}
+
+TEST_F(JsonWrapperTest, StringsWithNul) {
+  const string value("a\0b", 3);
+  JsonObject obj;
+  obj.Add("value", value);
+  obj.AddBase64("base64", value);
+
+  JsonObject parsed(string(obj.ToJson()));
+  ASSERT_TRUE(parsed.Ok());
+  JsonString parsed_value(parsed, "value");
+  ASSERT_TRUE(parsed_value.Ok());
+  EXPECT_EQ(value, string(parsed_value.Value(), 3));
+  JsonString parsed_base64(parsed, "base64");
+  ASSERT_TRUE(parsed_base64.Ok());
+  EXPECT_EQ(value, parsed_base64.FromBase64());
+}
+
+TEST_F(JsonWrapperTest, InvalidBase64) {
+  JsonObject obj(string("{ \"foo\": \"Zm9v!\" }"));
+  ASSERT_TRUE(obj.Ok());
+  JsonString foo(obj, "foo");
+  ASSERT_TRUE(foo.Ok());
+  EXPECT_EQ("", foo.FromBase64());
+}
+
 int main(int argc, char** argv) {
   cert_trans::test::InitTesting(argv[0], &argc, &argv, true);
   return RUN_ALL_TESTS();
@@ -1,15 +1,28 @@
 #include "config.h"
 #include "util/libevent_wrapper.h"
+#include "monitoring/histogram.h"
+#include "util/cpu_affinity.h"
+#include "util/timer_wheel.h"
 
 #include <arpa/inet.h>
 #include <climits>
+#include <condition_variable>
+#include <errno.h>
+#include <event2/buffer.h>
+#include <event2/bufferevent_ssl.h>
 #include <evhtp.h>
 #include <event2/thread.h>
+#include <gflags/gflags.h>
 #include <glog/logging.h>
+#include <map>
 #include <math.h>
 #include <netdb.h>
 #include <sys/socket.h>
 #include <signal.h>
+#include <string.h>
+#include <unistd.h>
+
+using cert_trans::libevent::Base;
 
 using std::bind;
 using std::chrono::duration;
@@ -17,9 +30,12 @@ using std::chrono::duration_cast;
 using std::chrono::microseconds;
 using std::chrono::milliseconds;
 using std::chrono::seconds;
+using std::chrono::steady_clock;
 using std::chrono::system_clock;
 using std::function;
 using std::lock_guard;
+using std::make_pair;
+using std::map;
 using std::mutex;
 using std::placeholders::_1;
 using std::recursive_mutex;
@@ -27,7 +43,28 @@ using std::shared_ptr;
 using std::string;
 using std::unique_ptr;
 using std::vector;
-using util::TaskHold;
+
+DEFINE_int32(dns_cache_ttl_seconds, 60,
+             "how long to reuse the address a host was resolved to, in "
+             "seconds");
+DEFINE_int32(dns_negative_cache_ttl_seconds, 5,
+             "how long to wait before trying again to resolve a host that "
+             "could not be, in seconds");
+DEFINE_string(event_loop_cpus, "",
+              "if set, the CPUs (such as \"0-3\") the threads running the "
+              "event loops are pinned to");
+DEFINE_int32(libevent_max_closures_per_iteration, 1024,
+             "how many of the closures added to an event loop it runs in a "
+             "row before handling its I/O again");
+DEFINE_int32(http_server_reply_buffer_bytes, 1 << 20,
+             "how much of a streamed HTTP reply can be waiting for its "
+             "client to read it before the rest of it is paused");
+DEFINE_int32(http_server_output_buffer_bytes, 256 << 20,
+             "how much of all the streamed HTTP replies can be waiting for "
+             "their clients to read them before they are all paused");
+DEFINE_int32(http_server_write_timeout_seconds, 60,
+             "how long a streamed HTTP reply can stay paused for its client "
+             "to read it before the connection is dropped, in seconds");
 
 namespace {
 
@@ -51,26 +88,64 @@ void SetExitLoopHandler(event_base* base, int signum) {
 }
 
 
-void DelayCancel(event* timer, util::Task* task) {
-  event_del(timer);
-  task->Return(util::Status::CANCELLED);
-}
-
-
-void DelayDispatch(evutil_socket_t, short, void* userdata) {
-  static_cast<util::Task*>(CHECK_NOTNULL(userdata))->Return();
-}
-
-
 #ifdef HAVE_THREAD_LOCAL
 thread_local bool on_event_thread = false;
+thread_local const Base* dispatching_base = nullptr;
 #elif HAVE___THREAD
 __thread bool on_event_thread = false;
+__thread const Base* dispatching_base = nullptr;
 #else
 #error No suitable thread local storage available
 #endif
 
 
+// How late the closures added to the event loops run, never
+// destroyed either, as closures can run during static destruction.
+cert_trans::HistogramCell* EventLoopLagCell() {
+  static cert_trans::HistogramCell* const cell(
+      cert_trans::Histogram<>::New(
+          "event_loop_lag_us",
+          "Time between adding a closure to an event loop and it "
+          "running, in microseconds.")
+          ->GetCell());
+  return cell;
+}
+
+
+// The instances of Base, by their event_base, for
+// Base::ForRequest(). These are never destroyed, so that instances of
+// Base can be destroyed during static destruction.
+mutex* BasesLock() {
+  static mutex* const lock(new mutex);
+  return lock;
+}
+
+
+// For ReplyFlowControl, never destroyed either.
+mutex* FlowControlLock() {
+  static mutex* const lock(new mutex);
+  return lock;
+}
+
+
+std::condition_variable* FlowControlCondition() {
+  static std::condition_variable* const cv(new std::condition_variable);
+  return cv;
+}
+
+
+// The bytes buffered by all the ReplyFlowControl, protected by
+// FlowControlLock().
+size_t total_buffered = 0;
+
+
+map<const event_base*, Base*>* Bases() {
+  static map<const event_base*, Base*>* const bases(
+      new map<const event_base*, Base*>);
+  return bases;
+}
+
+
 }  // namespace
 
 namespace cert_trans {
@@ -100,9 +175,9 @@ class ResolverImpl : public Base::Resolver {
     hints.ai_socktype = SOCK_STREAM;
     const int resolved(getaddrinfo(host.c_str(), AF_UNSPEC, &hints, &info));
     if (resolved != 0) {
-      LOG(WARNING) << "Failed to resolve HTTPS hostname " << host << ": "
+      LOG(WARNING) << "Failed to resolve hostname " << host << ": "
                    << gai_strerror(resolved);
-      return nullptr;
+      return string();
     }
 
     struct addrinfo* res(info);
@@ -126,7 +201,8 @@ class ResolverImpl : public Base::Resolver {
 
     if (!addr) {
       LOG(WARNING) << "Got no usable address for " << host;
-      return nullptr;
+      freeaddrinfo(info);
+      return string();
     }
 
     char addr_str[INET6_ADDRSTRLEN];
@@ -141,14 +217,31 @@ Base::Base() : Base(unique_ptr<Resolver>(new ResolverImpl)) {
 }
 
 
+struct Base::ClosureNode {
+  explicit ClosureNode(const function<void()>& c)
+      : closure(c), added(steady_clock::now()), next(nullptr) {
+  }
+
+  const function<void()> closure;
+  const steady_clock::time_point added;
+  ClosureNode* next;
+};
+
+
 Base::Base(unique_ptr<Resolver>&& resolver)
     : base_(CHECK_NOTNULL(event_base_new()), event_base_free),
       dns_(nullptr, FreeEvDns),
       wake_closures_(event_new(base_.get(), -1, 0, &Base::RunClosures, this),
                      &event_free),
+      new_closures_(nullptr),
       resolver_(std::move(resolver)) {
   evthread_make_base_notifiable(base_.get());
 
+  {
+    lock_guard<mutex> lock(*BasesLock());
+    CHECK(Bases()->insert(std::make_pair(base_.get(), this)).second);
+  }
+
   // So much stuff breaks if there's not a Dns client around to keep the
   // event loop doing stuff that we may as well just have one from the get go.
   GetDns();
@@ -156,6 +249,17 @@ Base::Base(unique_ptr<Resolver>&& resolver)
 
 
 Base::~Base() {
+  {
+    lock_guard<mutex> lock(*BasesLock());
+    CHECK_EQ(Bases()->erase(base_.get()), 1U);
+  }
+
+  // The closures that never got to run are dropped.
+  ClosureNode* node(new_closures_.exchange(nullptr));
+  while (node) {
+    const unique_ptr<ClosureNode> deleter(node);
+    node = node->next;
+  }
 }
 
 
@@ -171,43 +275,41 @@ void Base::CheckNotOnEventThread() {
 }
 
 
-void Base::Add(const function<void()>& cb) {
-  lock_guard<mutex> lock(closures_lock_);
-  closures_.push_back(cb);
-  event_active(wake_closures_.get(), 0, 0);
+// static
+Base* Base::ForRequest(evhttp_request* req) {
+  const event_base* const base(evhttp_connection_get_base(
+      evhttp_request_get_connection(CHECK_NOTNULL(req))));
+  lock_guard<mutex> lock(*BasesLock());
+  const auto it(Bases()->find(base));
+  CHECK(it != Bases()->end());
+  return it->second;
 }
 
 
-void Base::Delay(const duration<double>& delay, util::Task* task) {
-  // If the delay is zero (or less?), what the heck, we're done!
-  if (delay <= delay.zero()) {
-    task->Return();
-    return;
-  }
-
-  // Make sure nothing "bad" happens while we're still setting up our
-  // callbacks.
-  TaskHold hold(task);
-
-  event* timer(CHECK_NOTNULL(evtimer_new(base_.get(), &DelayDispatch, task)));
-
-  // Ensure that the cancellation callback is run on this libevent::Base, to
-  // avoid races during cancellation.
+bool Base::OnThisEventThread() const {
+  return dispatching_base == this;
+}
 
-  // Cancellation callbacks are always called before the task enters
-  // the DONE state (and "timer" is freed), and "event_del" is
-  // thread-safe, so it does not matter on which thread "DelayCancel"
-  // is called on.
-  task->WhenCancelled(bind(DelayCancel, timer, task));
 
-  task->CleanupWhenDone(bind(event_free, timer));
+void Base::Add(const function<void()>& cb) {
+  ClosureNode* const node(new ClosureNode(cb));
+  node->next = new_closures_.load(std::memory_order_relaxed);
+  while (!new_closures_.compare_exchange_weak(node->next, node,
+                                              std::memory_order_release,
+                                              std::memory_order_relaxed)) {
+  }
+  // If there were closures already, the event loop was woken up for
+  // them, and takes this one along.
+  if (!node->next) {
+    event_active(wake_closures_.get(), 0, 0);
+  }
+}
 
-  timeval tv;
-  const seconds sec(duration_cast<seconds>(delay));
-  tv.tv_sec = sec.count();
-  tv.tv_usec = duration_cast<microseconds>(delay - sec).count();
 
-  CHECK_EQ(evtimer_add(timer, &tv), 0);
+void Base::Delay(const duration<double>& delay, util::Task* task) {
+  // The timer wheel hands the task back to this event loop once due,
+  // so that the delays do not weigh on the libevent timer heap.
+  util::TimerWheel::Default()->Delay(delay, task, this);
 }
 
 
@@ -216,15 +318,23 @@ void Base::Dispatch() {
   SetExitLoopHandler(base_.get(), SIGINT);
   SetExitLoopHandler(base_.get(), SIGTERM);
 
+  DispatchIgnoringSignals();
+}
+
+
+void Base::DispatchIgnoringSignals() {
   // There should /never/ be more than 1 thread trying to call Dispatch(), so
   // we should expect to always own the lock here.
   CHECK(dispatch_lock_.try_lock());
   LOG_IF(WARNING, on_event_thread)
       << "Huh?, Are you calling Dispatch() from a libevent thread?";
   const bool old_on_event_thread(on_event_thread);
+  const Base* const old_dispatching_base(dispatching_base);
   on_event_thread = true;
+  dispatching_base = this;
   CHECK_EQ(event_base_dispatch(base_.get()), 0);
   on_event_thread = old_on_event_thread;
+  dispatching_base = old_dispatching_base;
   dispatch_lock_.unlock();
 }
 
@@ -235,9 +345,12 @@ void Base::DispatchOnce() {
   LOG_IF(WARNING, on_event_thread)
       << "Huh?, Are you calling Dispatch() from a libevent thread?";
   const bool old_on_event_thread(on_event_thread);
+  const Base* const old_dispatching_base(dispatching_base);
   on_event_thread = true;
+  dispatching_base = this;
   CHECK_EQ(event_base_loop(base_.get(), EVLOOP_ONCE), 0);
   on_event_thread = old_on_event_thread;
+  dispatching_base = old_dispatching_base;
 }
 
 
@@ -258,6 +371,22 @@ evhttp* Base::HttpNew() const {
 }
 
 
+evconnlistener* Base::ListenerNew(const sockaddr* address, int address_len,
+                                  evconnlistener_cb cb,
+                                  void* userdata) const {
+  return evconnlistener_new_bind(base_.get(), cb, userdata,
+                                 LEV_OPT_CLOSE_ON_FREE | LEV_OPT_REUSEABLE |
+                                     LEV_OPT_CLOSE_ON_EXEC,
+                                 -1, address, address_len);
+}
+
+
+bufferevent* Base::BufferEventNew(evutil_socket_t sock) const {
+  return CHECK_NOTNULL(
+      bufferevent_socket_new(base_.get(), sock, BEV_OPT_CLOSE_ON_FREE));
+}
+
+
 evdns_base* Base::GetDns() {
   lock_guard<mutex> lock(dns_lock_);
 
@@ -269,10 +398,41 @@ evdns_base* Base::GetDns() {
 }
 
 
+string Base::Resolve(const string& host) {
+  CheckNotOnEventThread();
+  {
+    lock_guard<mutex> lock(resolved_lock_);
+    const auto it(resolved_.find(host));
+    if (it != resolved_.end() && it->second.first > steady_clock::now()) {
+      return it->second.second;
+    }
+  }
+
+  return resolutions_.Do(host, [this, &host]() {
+    const string addr(resolver_->Resolve(host));
+    VLOG(1) << "Resolved " << host << " to \"" << addr << "\"";
+    const steady_clock::time_point expiry(
+        steady_clock::now() +
+        seconds(addr.empty() ? FLAGS_dns_negative_cache_ttl_seconds
+                             : FLAGS_dns_cache_ttl_seconds));
+    lock_guard<mutex> lock(resolved_lock_);
+    resolved_[host] = make_pair(expiry, addr);
+    return addr;
+  });
+}
+
+
 evhtp_connection_t* Base::HttpConnectionNew(const string& host,
                                             unsigned short port) {
+  const string addr_str(Resolve(host));
+  if (addr_str.empty()) {
+    // Let evdns have a go, it reports failures through the error hook
+    // of the connection.
+    return CHECK_NOTNULL(
+        evhtp_connection_new_dns(base_.get(), GetDns(), host.c_str(), port));
+  }
   return CHECK_NOTNULL(
-      evhtp_connection_new_dns(base_.get(), GetDns(), host.c_str(), port));
+      evhtp_connection_new(base_.get(), addr_str.c_str(), port));
 }
 
 
@@ -283,7 +443,7 @@ evhtp_connection_t* Base::HttpsConnectionNew(const string& host,
 
   // TODO(alcutter): remove this all temporary name resolution stuff when this
   // PR is merged: https://github.com/ellzey/libevhtp/pull/163
-  const string addr_str(resolver_->Resolve(host));
+  const string addr_str(Resolve(host));
   VLOG(1) << "Got addr: " << addr_str << ":" << port;
   evhtp_connection_t* ret(CHECK_NOTNULL(
       evhtp_connection_ssl_new(base_.get(), addr_str.c_str(), port, ssl_ctx)));
@@ -294,15 +454,40 @@ evhtp_connection_t* Base::HttpsConnectionNew(const string& host,
 void Base::RunClosures(evutil_socket_t, short, void* userdata) {
   Base* self(static_cast<Base*>(CHECK_NOTNULL(userdata)));
 
-  vector<function<void()>> closures;
-  {
-    lock_guard<mutex> lock(self->closures_lock_);
-    closures.swap(self->closures_);
+  // Take all the new closures at once, and put them back in the order
+  // they were added in.
+  ClosureNode* node(
+      self->new_closures_.exchange(nullptr, std::memory_order_acquire));
+  ClosureNode* oldest(nullptr);
+  while (node) {
+    ClosureNode* const next(node->next);
+    node->next = oldest;
+    oldest = node;
+    node = next;
+  }
+  while (oldest) {
+    const unique_ptr<ClosureNode> deleter(oldest);
+    self->closures_.emplace_back(oldest->added, oldest->closure);
+    oldest = oldest->next;
   }
 
-  for (const auto& closure : closures) {
+  for (int i = 0; i < FLAGS_libevent_max_closures_per_iteration &&
+                  !self->closures_.empty();
+       ++i) {
+    const function<void()> closure(std::move(self->closures_.front().second));
+    const steady_clock::time_point added(self->closures_.front().first);
+    self->closures_.pop_front();
+    EventLoopLagCell()->Record(
+        duration_cast<microseconds>(steady_clock::now() - added).count());
     closure();
   }
+
+  if (!self->closures_.empty()) {
+    // Let the event loop handle its I/O before running the rest, which
+    // a zero timeout (unlike activating the event) makes it do.
+    const timeval zero = {0, 0};
+    event_add(self->wake_closures_.get(), &zero);
+  }
 }
 
 
@@ -355,6 +540,51 @@ void HttpServer::Bind(const char* address, ev_uint16_t port) {
 }
 
 
+void HttpServer::BindReusePort(const char* address, ev_uint16_t port) {
+#ifdef SO_REUSEPORT
+  addrinfo hints;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = AI_PASSIVE;
+  addrinfo* addr;
+  // Same default address as evhttp_bind_socket().
+  const int gai_ret(getaddrinfo(address ? address : "0.0.0.0",
+                                std::to_string(port).c_str(), &hints, &addr));
+  CHECK_EQ(gai_ret, 0) << gai_strerror(gai_ret);
+
+  const evutil_socket_t sock(
+      socket(addr->ai_family, addr->ai_socktype, addr->ai_protocol));
+  CHECK_GE(sock, 0) << strerror(errno);
+  const int on(1);
+  CHECK_EQ(setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)), 0)
+      << strerror(errno);
+  CHECK_EQ(setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)), 0)
+      << strerror(errno);
+  CHECK_EQ(bind(sock, addr->ai_addr, addr->ai_addrlen), 0) << strerror(errno);
+  freeaddrinfo(addr);
+  CHECK_EQ(listen(sock, 128), 0) << strerror(errno);
+  CHECK_EQ(evutil_make_socket_nonblocking(sock), 0);
+  CHECK_EQ(evutil_make_socket_closeonexec(sock), 0);
+
+  // The socket is closed when |http_| is freed.
+  CHECK_EQ(evhttp_accept_socket(http_, sock), 0);
+#else
+  LOG(FATAL) << "SO_REUSEPORT is not supported on this platform";
+#endif
+}
+
+
+void HttpServer::EnableTls(SSL_CTX* ssl_ctx) {
+  CHECK_NOTNULL(ssl_ctx);
+#ifdef HAVE_EVHTTP_SET_BEVCB
+  evhttp_set_bevcb(http_, &NewTlsBufferEvent, ssl_ctx);
+#else
+  LOG(FATAL) << "serving HTTPS needs libevent 2.1 or later";
+#endif
+}
+
+
 bool HttpServer::AddHandler(const string& path, const HandlerCallback& cb) {
   Handler* handler(new Handler(path, cb));
   handlers_.push_back(handler);
@@ -363,13 +593,168 @@ bool HttpServer::AddHandler(const string& path, const HandlerCallback& cb) {
 }
 
 
+void HttpServer::SetDefaultHandler(const HandlerCallback& cb) {
+  Handler* handler(new Handler(string(), cb));
+  handlers_.push_back(handler);
+
+  evhttp_set_gencb(http_, &HandleRequest, handler);
+}
+
+
 void HttpServer::HandleRequest(evhttp_request* req, void* userdata) {
   static_cast<Handler*>(userdata)->cb(req);
 }
 
 
-EventPumpThread::EventPumpThread(const shared_ptr<Base>& base)
+// static
+bufferevent* HttpServer::NewTlsBufferEvent(event_base* base, void* userdata) {
+  SSL* const ssl(SSL_new(static_cast<SSL_CTX*>(userdata)));
+  if (!ssl) {
+    // evhttp drops the connection.
+    LOG(WARNING) << "could not create SSL connection";
+    return nullptr;
+  }
+  // Freeing the bufferevent frees |ssl| and closes the socket, which
+  // evhttp sets later.
+  return bufferevent_openssl_socket_new(base, -1, ssl,
+                                        BUFFEREVENT_SSL_ACCEPTING,
+                                        BEV_OPT_CLOSE_ON_FREE);
+}
+
+
+ReplyFlowControl::ReplyFlowControl()
+    : buffered_(0), client_gone_(false), abandoned_(false) {
+}
+
+
+ReplyFlowControl::~ReplyFlowControl() {
+  lock_guard<mutex> lock(*FlowControlLock());
+  ReleaseLocked();
+}
+
+
+bool ReplyFlowControl::WaitForSpace() {
+  std::unique_lock<mutex> lock(*FlowControlLock());
+  const steady_clock::time_point deadline(
+      steady_clock::now() + seconds(FLAGS_http_server_write_timeout_seconds));
+  while (!client_gone_ && !abandoned_) {
+    if (buffered_ >= static_cast<size_t>(FLAGS_http_server_reply_buffer_bytes)) {
+      // Only this client is to blame for being over its own limit.
+      if (FlowControlCondition()->wait_until(lock, deadline) ==
+              std::cv_status::timeout &&
+          buffered_ >=
+              static_cast<size_t>(FLAGS_http_server_reply_buffer_bytes)) {
+        LOG(INFO) << "dropping an HTTP client that did not read its reply "
+                  << "for " << FLAGS_http_server_write_timeout_seconds
+                  << " seconds";
+        abandoned_ = true;
+      }
+    } else if (total_buffered >=
+               static_cast<size_t>(FLAGS_http_server_output_buffer_bytes)) {
+      FlowControlCondition()->wait(lock);
+    } else {
+      return true;
+    }
+  }
+  return false;
+}
+
+
+void ReplyFlowControl::Queued(size_t length) {
+  lock_guard<mutex> lock(*FlowControlLock());
+  if (!client_gone_) {
+    buffered_ += length;
+    total_buffered += length;
+  }
+}
+
+
+void ReplyFlowControl::Watch(evhttp_request* req) {
+  evhttp_connection* const conn(evhttp_request_get_connection(req));
+  if (!conn) {
+    return ConnectionClosed(nullptr, this);
+  }
+  evhttp_connection_set_closecb(conn, &ConnectionClosed, this);
+}
+
+
+void ReplyFlowControl::SendChunk(evhttp_request* req, evbuffer* chunk) {
+  bool gone;
+  {
+    lock_guard<mutex> lock(*FlowControlLock());
+    gone = client_gone_ || abandoned_;
+  }
+  if (gone || !evhttp_request_get_connection(req)) {
+    evbuffer_free(chunk);
+    return;
+  }
+
+#ifdef HAVE_EVHTTP_SEND_REPLY_CHUNK_WITH_CB
+  // The callback is replaced with each chunk, and called once
+  // everything sent so far is written.
+  evhttp_send_reply_chunk_with_cb(req, chunk, &ChunkWritten, this);
+#else
+  evhttp_send_reply_chunk(req, chunk);
+  ChunkWritten(nullptr, this);
+#endif
+  evbuffer_free(chunk);
+}
+
+
+bool ReplyFlowControl::EndReply(evhttp_request* req) {
+  bool abandoned;
+  {
+    lock_guard<mutex> lock(*FlowControlLock());
+    abandoned = abandoned_;
+    // What is left in the output buffer is not tracked any more, as
+    // ending the reply replaces the callback of the last chunk.
+    ReleaseLocked();
+  }
+
+  evhttp_connection* const conn(evhttp_request_get_connection(req));
+  if (!conn) {
+    return false;
+  }
+  evhttp_connection_set_closecb(conn, NULL, NULL);
+  if (abandoned) {
+    // This also frees |req|.
+    evhttp_connection_free(conn);
+  }
+  return abandoned;
+}
+
+
+// static
+void ReplyFlowControl::ChunkWritten(evhttp_connection*, void* userdata) {
+  ReplyFlowControl* const flow(static_cast<ReplyFlowControl*>(userdata));
+  lock_guard<mutex> lock(*FlowControlLock());
+  flow->ReleaseLocked();
+}
+
+
+// static
+void ReplyFlowControl::ConnectionClosed(evhttp_connection*, void* userdata) {
+  ReplyFlowControl* const flow(static_cast<ReplyFlowControl*>(userdata));
+  lock_guard<mutex> lock(*FlowControlLock());
+  flow->client_gone_ = true;
+  flow->ReleaseLocked();
+}
+
+
+void ReplyFlowControl::ReleaseLocked() {
+  CHECK_GE(total_buffered, buffered_);
+  total_buffered -= buffered_;
+  buffered_ = 0;
+  // The writers could be waiting for room, or for their client to go
+  // away.
+  FlowControlCondition()->notify_all();
+}
+
+
+EventPumpThread::EventPumpThread(const shared_ptr<Base>& base,
+                                 bool exit_on_signals)
     : base_(base),
+      exit_on_signals_(exit_on_signals),
       pump_thread_(bind(&EventPumpThread::Pump, this)) {
 }
 
@@ -381,7 +766,12 @@ EventPumpThread::~EventPumpThread() {
 
 
 void EventPumpThread::Pump() {
-  base_->Dispatch();
+  PinCurrentThread(FLAGS_event_loop_cpus);
+  if (exit_on_signals_) {
+    base_->Dispatch();
+  } else {
+    base_->DispatchIgnoringSignals();
+  }
 }
 
 
@@ -3,19 +3,27 @@
 
 #include <atomic>
 #include <chrono>
+#include <deque>
+#include <event2/bufferevent.h>
 #include <event2/dns.h>
 #include <event2/event.h>
 // TODO(alcutter): Use evhtp for the HttpServer too.
 #include <event2/http.h>
+#include <event2/listener.h>
 #include <evhtp.h>
 #include <functional>
+#include <map>
 #include <memory>
 #include <mutex>
+#include <openssl/ssl.h>
+#include <string>
 #include <thread>
+#include <utility>
 #include <vector>
 
 #include "base/macros.h"
 #include "util/executor.h"
+#include "util/single_flight.h"
 #include "util/task.h"
 
 namespace cert_trans {
@@ -29,12 +37,17 @@ class Base : public util::Executor {
  public:
   class Resolver {
    public:
+    // Returns an IPv4 address for |host|, or an empty string if it
+    // could not be resolved. May block.
     virtual std::string Resolve(const std::string& host) = 0;
   };
 
   static bool OnEventThread();
   static void CheckNotOnEventThread();
 
+  // Returns the instance whose event loop |req| was received on.
+  static Base* ForRequest(evhttp_request* req);
+
   Base();
   Base(std::unique_ptr<Resolver>&& resolver);
   ~Base();
@@ -45,13 +58,32 @@ class Base : public util::Executor {
   void Delay(const std::chrono::duration<double>& delay,
              util::Task* task) override;
 
+  // Whether the calling thread is the one running this instance's
+  // event loop.
+  bool OnThisEventThread() const;
+
   void Dispatch();
+  // Same as Dispatch(), but does not exit the loop on SIGHUP, SIGINT
+  // or SIGTERM, as only one instance can handle signals.
+  void DispatchIgnoringSignals();
   void DispatchOnce();
   void LoopExit();
 
   event* EventNew(evutil_socket_t& sock, short events, Event* event) const;
   evhttp* HttpNew() const;
+  // The listener closes its socket when freed, as does the
+  // bufferevent.
+  evconnlistener* ListenerNew(const sockaddr* address, int address_len,
+                              evconnlistener_cb cb, void* userdata) const;
+  bufferevent* BufferEventNew(evutil_socket_t sock) const;
   evdns_base* GetDns();
+  // Returns what the resolver returns for |host|, cached for
+  // --dns_cache_ttl_seconds, or --dns_negative_cache_ttl_seconds if it
+  // could not be resolved. Concurrent lookups of the same host that
+  // miss the cache share a single resolution. Blocks on misses, so
+  // must not be called on the event loop.
+  std::string Resolve(const std::string& host);
+  // These resolve |host| with Resolve().
   evhtp_connection_t* HttpConnectionNew(const std::string& host,
                                         unsigned short port);
   evhtp_connection_t* HttpsConnectionNew(const std::string& host,
@@ -68,13 +100,28 @@ class Base : public util::Executor {
   // "dns_" should be after base_, so that it gets destroyed first.
   std::unique_ptr<evdns_base, void (*)(evdns_base*)> dns_;
 
-  std::mutex closures_lock_;
+  struct ClosureNode;
+
   // "wake_closures_" should be after base_, so that it gets destroyed
   // first.
   const std::unique_ptr<event, void (*)(event*)> wake_closures_;
-  std::vector<std::function<void()>> closures_;
+  // The closures added since RunClosures() last took them, newest
+  // first. Add() pushes onto it without locking, and only wakes up the
+  // event loop if it was empty.
+  std::atomic<ClosureNode*> new_closures_;
+  // The closures taken by RunClosures() but not run yet, oldest first,
+  // with when they were added. Only used on the event loop.
+  std::deque<std::pair<std::chrono::steady_clock::time_point,
+                       std::function<void()>>> closures_;
   std::unique_ptr<Resolver> resolver_;
 
+  std::mutex resolved_lock_;
+  // The addresses hosts were resolved to, and when they expire.
+  std::map<std::string,
+           std::pair<std::chrono::steady_clock::time_point, std::string>>
+      resolved_;
+  SingleFlight<std::string, std::string> resolutions_;
+
   DISALLOW_COPY_AND_ASSIGN(Base);
 };
 
@@ -108,13 +155,28 @@ class HttpServer {
 
   void Bind(const char* address, ev_uint16_t port);
 
+  // Same as Bind(), but allows other sockets to bind to the same port
+  // (with SO_REUSEPORT), so that the connections are spread between
+  // several instances, each with its own event loop.
+  void BindReusePort(const char* address, ev_uint16_t port);
+
+  // Makes the connections accepted from then on speak TLS, with the
+  // settings of |ssl_ctx|, which must outlive this instance.
+  // LOG(FATAL)s if libevent is too old for it (before 2.1).
+  void EnableTls(SSL_CTX* ssl_ctx);
+
   // Returns false if there was an error adding the handler.
   bool AddHandler(const std::string& path, const HandlerCallback& cb);
 
+  // Sets the handler of the requests for the paths without one of
+  // their own, which are otherwise answered with a 404.
+  void SetDefaultHandler(const HandlerCallback& cb);
+
  private:
   struct Handler;
 
   static void HandleRequest(evhttp_request* req, void* userdata);
+  static bufferevent* NewTlsBufferEvent(event_base* base, void* userdata);
 
   evhttp* const http_;
   // Could have been a vector<Handler>, but it is important that
@@ -125,15 +187,75 @@ class HttpServer {
 };
 
 
+// Flow control for an HTTP reply whose body is sent a chunk at a time
+// by a thread other than the event loop of its request, so that the
+// body does not pile up in the output buffer of a client that reads
+// it slower than it is generated. The chunks count as buffered until
+// the client has taken them, both against the reply, up to
+// --http_server_reply_buffer_bytes, and against all the replies of
+// the process, up to --http_server_output_buffer_bytes.
+// WaitForSpace() blocks the writer while either is exceeded, and
+// gives up on the client if its reply stays over its limit for
+// --http_server_write_timeout_seconds.
+//
+// Knowing when the client took a chunk needs libevent 2.1, without
+// which the chunks only count until they are passed to libevent.
+class ReplyFlowControl {
+ public:
+  ReplyFlowControl();
+  ~ReplyFlowControl();
+
+  // Blocks until there is room for more of the reply. Returns false
+  // if the client went away or was too slow, after which the rest of
+  // the reply can be skipped, and AbandonReply() should end it.
+  bool WaitForSpace();
+
+  // Counts |length| more bytes as buffered, before they are passed to
+  // SendChunk().
+  void Queued(size_t length);
+
+  // These run on the event loop of |req|.
+  // Starts watching for the connection of |req| being closed, once
+  // the reply is started.
+  void Watch(evhttp_request* req);
+  // Sends |chunk| on |req|, and frees it.
+  void SendChunk(evhttp_request* req, evbuffer* chunk);
+  // Stops watching, before the reply is ended. Returns true if that
+  // was done by closing the connection, because the client was too
+  // slow, in which case |req| is freed. Otherwise, the reply should
+  // be ended with evhttp_send_reply_end(), which only frees |req| if
+  // the client went away.
+  bool EndReply(evhttp_request* req);
+
+ private:
+  static void ChunkWritten(evhttp_connection* conn, void* userdata);
+  static void ConnectionClosed(evhttp_connection* conn, void* userdata);
+  // Stops counting what is buffered, releasing room for the others.
+  void ReleaseLocked();
+
+  // These are protected by a lock shared by all the instances, so
+  // that the writers can wait for the total to go down.
+  size_t buffered_;
+  bool client_gone_;
+  bool abandoned_;
+
+  DISALLOW_COPY_AND_ASSIGN(ReplyFlowControl);
+};
+
+
 class EventPumpThread {
  public:
-  EventPumpThread(const std::shared_ptr<Base>& base);
+  // If |exit_on_signals| is false, the event loop is run with
+  // Base::DispatchIgnoringSignals().
+  EventPumpThread(const std::shared_ptr<Base>& base,
+                  bool exit_on_signals = true);
   ~EventPumpThread();
 
  private:
   void Pump();
 
   const std::shared_ptr<Base> base_;
+  const bool exit_on_signals_;
   std::thread pump_thread_;
 
   DISALLOW_COPY_AND_ASSIGN(EventPumpThread);
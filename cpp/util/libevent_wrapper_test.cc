@@ -1,15 +1,67 @@
+#include "config.h"
 #include "util/libevent_wrapper.h"
 
+#include <arpa/inet.h>
+#include <event2/buffer.h>
+#include <gflags/gflags.h>
+#include <glog/logging.h>
 #include <gtest/gtest.h>
-
+#include <netinet/in.h>
+#include <string.h>
+#include <string>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <vector>
+
+#include "base/notification.h"
 #include "util/testing.h"
 
+DECLARE_int32(dns_cache_ttl_seconds);
+DECLARE_int32(http_server_reply_buffer_bytes);
+DECLARE_int32(http_server_write_timeout_seconds);
+DECLARE_int32(libevent_max_closures_per_iteration);
+
 namespace cert_trans {
 namespace libevent {
 
 void DoNothing() {
 }
 
+
+// Resolves every host to |addr|, counting the resolutions.
+class CountingResolver : public Base::Resolver {
+ public:
+  CountingResolver(const std::string& addr, int* count)
+      : addr_(addr), count_(count) {
+  }
+
+  std::string Resolve(const std::string&) override {
+    ++*count_;
+    return addr_;
+  }
+
+ private:
+  const std::string addr_;
+  int* const count_;
+};
+
+
+// Returns a port that nothing listens on, as far as we can tell.
+uint16_t UnusedPort() {
+  const int sock(socket(AF_INET, SOCK_STREAM, 0));
+  CHECK_GE(sock, 0);
+  sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  CHECK_EQ(bind(sock, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)), 0);
+  socklen_t len(sizeof(addr));
+  CHECK_EQ(getsockname(sock, reinterpret_cast<sockaddr*>(&addr), &len), 0);
+  close(sock);
+  return ntohs(addr.sin_port);
+}
+
+
 class LibEventWrapperTest : public ::testing::Test {
  public:
   void ExpectToBeOnEventThread(const bool expect) {
@@ -43,6 +95,128 @@ TEST_F(LibEventWrapperTest, TestTurtlesAllTheWayDown) {
 }
 
 
+TEST_F(LibEventWrapperTest, TestClosuresRunInOrderWithinBudget) {
+  FLAGS_libevent_max_closures_per_iteration = 2;
+  std::shared_ptr<Base> base(std::make_shared<Base>());
+  std::vector<int> ran;
+  for (int i = 0; i < 5; ++i) {
+    base->Add([&ran, i]() { ran.push_back(i); });
+  }
+  base->DispatchOnce();
+  EXPECT_EQ(2U, ran.size());
+
+  // The rest run on the following iterations, along with those added
+  // meanwhile.
+  base->Add([&ran]() { ran.push_back(5); });
+  while (ran.size() < 6) {
+    base->DispatchOnce();
+  }
+  EXPECT_EQ(std::vector<int>({0, 1, 2, 3, 4, 5}), ran);
+  FLAGS_libevent_max_closures_per_iteration = 1024;
+}
+
+
+TEST_F(LibEventWrapperTest, TestResolveCachesAddresses) {
+  int count(0);
+  Base base(std::unique_ptr<Base::Resolver>(
+      new CountingResolver("192.0.2.1", &count)));
+  EXPECT_EQ("192.0.2.1", base.Resolve("example.com"));
+  EXPECT_EQ("192.0.2.1", base.Resolve("example.com"));
+  EXPECT_EQ(1, count);
+  EXPECT_EQ("192.0.2.1", base.Resolve("example.org"));
+  EXPECT_EQ(2, count);
+}
+
+
+TEST_F(LibEventWrapperTest, TestResolveCachesFailures) {
+  int count(0);
+  Base base(
+      std::unique_ptr<Base::Resolver>(new CountingResolver("", &count)));
+  EXPECT_EQ("", base.Resolve("example.com"));
+  EXPECT_EQ("", base.Resolve("example.com"));
+  EXPECT_EQ(1, count);
+}
+
+
+TEST_F(LibEventWrapperTest, TestResolveExpires) {
+  FLAGS_dns_cache_ttl_seconds = 0;
+  int count(0);
+  Base base(std::unique_ptr<Base::Resolver>(
+      new CountingResolver("192.0.2.1", &count)));
+  EXPECT_EQ("192.0.2.1", base.Resolve("example.com"));
+  EXPECT_EQ("192.0.2.1", base.Resolve("example.com"));
+  EXPECT_EQ(2, count);
+  FLAGS_dns_cache_ttl_seconds = 60;
+}
+
+
+#ifdef HAVE_EVHTTP_SEND_REPLY_CHUNK_WITH_CB
+TEST_F(LibEventWrapperTest, TestReplyFlowControlDropsSlowClient) {
+  FLAGS_http_server_reply_buffer_bytes = 1 << 16;
+  FLAGS_http_server_write_timeout_seconds = 1;
+  const std::shared_ptr<Base> base(std::make_shared<Base>());
+  HttpServer server(*base);
+  const uint16_t port(UnusedPort());
+  server.Bind("127.0.0.1", port);
+  const std::shared_ptr<ReplyFlowControl> flow(
+      std::make_shared<ReplyFlowControl>());
+  evhttp_request* request(nullptr);
+  Notification started;
+  ASSERT_TRUE(server.AddHandler("/", [flow, &request,
+                                      &started](evhttp_request* req) {
+    evhttp_send_reply_start(req, HTTP_OK, /*reason*/ NULL);
+    flow->Watch(req);
+    request = req;
+    started.Notify();
+  }));
+  EventPumpThread pump(base);
+
+  // A client that never reads its reply.
+  const int sock(socket(AF_INET, SOCK_STREAM, 0));
+  ASSERT_GE(sock, 0);
+  sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  ASSERT_EQ(0,
+            connect(sock, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)));
+  const std::string get("GET / HTTP/1.1\r\nHost: localhost\r\n\r\n");
+  ASSERT_EQ(static_cast<ssize_t>(get.size()),
+            write(sock, get.data(), get.size()));
+  started.WaitForNotification();
+
+  const std::string data(1 << 16, 'x');
+  const size_t kMaxSent(256 << 20);
+  size_t sent(0);
+  while (sent < kMaxSent && flow->WaitForSpace()) {
+    evbuffer* const chunk(evbuffer_new());
+    CHECK_EQ(evbuffer_add(chunk, data.data(), data.size()), 0);
+    flow->Queued(data.size());
+    base->Add([flow, request, chunk]() { flow->SendChunk(request, chunk); });
+    sent += data.size();
+  }
+  // Only as much as the socket buffers could take was sent.
+  EXPECT_LT(sent, kMaxSent);
+
+  Notification ended;
+  base->Add([flow, request, &ended]() {
+    EXPECT_TRUE(flow->EndReply(request));
+    ended.Notify();
+  });
+  ended.WaitForNotification();
+
+  // The connection was closed, after what was already written.
+  char buf[1 << 16];
+  ssize_t got;
+  while ((got = read(sock, buf, sizeof(buf))) > 0) {
+  }
+  EXPECT_EQ(0, got);
+  close(sock);
+}
+#endif
+
+
 TEST_F(LibEventWrapperDeathTest, TestCheckNotOnEventThread) {
   // Should be fine:
   Base::CheckNotOnEventThread();
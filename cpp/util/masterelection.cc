@@ -23,8 +23,13 @@ using std::unique_ptr;
 using std::vector;
 using util::Task;
 
-DEFINE_int32(master_keepalive_interval_seconds, 60,
+DEFINE_int32(master_keepalive_interval_seconds, 10,
              "Interval between refreshing mastership proposal.");
+DEFINE_int32(master_proposal_ttl_seconds, 30,
+             "TTL of the mastership proposals, after which the proposal of "
+             "a node which stopped refreshing it goes away, and another "
+             "node can take over as master. Must be greater than "
+             "--master_keepalive_interval_seconds.");
 DEFINE_int32(masterelection_retry_delay_seconds, 5,
              "Seconds to delay before retrying a failed attempt to create a "
              "proposal file.");
@@ -50,6 +55,13 @@ static Counter<>* proposal_creation_failures(
 const char kNoBacking[] = "";
 
 
+seconds ProposalTTL() {
+  CHECK_GT(FLAGS_master_proposal_ttl_seconds,
+           FLAGS_master_keepalive_interval_seconds);
+  return seconds(FLAGS_master_proposal_ttl_seconds);
+}
+
+
 // Returns |s| with a '/' appended if the last char is not already a '/'
 string EnsureEndsWithSlash(const string& s) {
   if (s.empty() || s.back() != '/') {
@@ -266,8 +278,7 @@ void MasterElection::CreateProposal() {
   // and then restarted before the TTL expired.
   EtcdClient::Response* const resp(new EtcdClient::Response);
   client_->CreateWithTTL(
-      my_proposal_path_, kNoBacking,
-      seconds(FLAGS_master_keepalive_interval_seconds * 2), resp,
+      my_proposal_path_, kNoBacking, ProposalTTL(), resp,
       new Task(bind(&MasterElection::ProposalCreateDone, this, resp, _1),
                base_.get()));
 }
@@ -345,8 +356,7 @@ void MasterElection::UpdateProposal(const string& backed) {
 
   // TODO(alcutter): Set the HTTP timeout inside here to something sensible.
   EtcdClient::Response* const resp(new EtcdClient::Response);
-  client_->UpdateWithTTL(my_proposal_path_, backed,
-                         seconds(FLAGS_master_keepalive_interval_seconds * 2),
+  client_->UpdateWithTTL(my_proposal_path_, backed, ProposalTTL(),
                          my_proposal_modified_index_, resp,
                          new Task(bind(&MasterElection::ProposalUpdateDone,
                                        this, resp, _1),
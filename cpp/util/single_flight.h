@@ -0,0 +1,81 @@
+#ifndef CERT_TRANS_UTIL_SINGLE_FLIGHT_H_
+#define CERT_TRANS_UTIL_SINGLE_FLIGHT_H_
+
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+
+#include "base/macros.h"
+
+namespace cert_trans {
+
+
+// Coalesces the identical computations that are requested at the same
+// time, such as the reads of the same entries by the many clients that
+// ask for them as soon as a new STH is published, so that only one of
+// them is done and its result is shared with the others. Thread-safe.
+template <class Key, class Value>
+class SingleFlight {
+ public:
+  SingleFlight() = default;
+
+  // Returns what |compute| returns for |key|. If another thread is
+  // already computing the value for the same |key|, waits for it and
+  // returns its value instead, without calling |compute|, and sets
+  // |coalesced| to true, if not NULL.
+  Value Do(const Key& key, const std::function<Value()>& compute,
+           bool* coalesced = nullptr);
+
+ private:
+  struct Flight {
+    Flight() : done(false) {
+    }
+
+    bool done;
+    Value value;
+  };
+
+  std::mutex mutex_;
+  // Signalled when any flight is done.
+  std::condition_variable done_;
+  std::map<Key, std::shared_ptr<Flight>> flights_;
+
+  DISALLOW_COPY_AND_ASSIGN(SingleFlight);
+};
+
+
+template <class Key, class Value>
+Value SingleFlight<Key, Value>::Do(const Key& key,
+                                   const std::function<Value()>& compute,
+                                   bool* coalesced) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  const auto it(flights_.find(key));
+  if (coalesced) {
+    *coalesced = it != flights_.end();
+  }
+  if (it != flights_.end()) {
+    const std::shared_ptr<Flight> flight(it->second);
+    done_.wait(lock, [&flight]() { return flight->done; });
+    return flight->value;
+  }
+
+  const std::shared_ptr<Flight> flight(std::make_shared<Flight>());
+  flights_.emplace(key, flight);
+  lock.unlock();
+
+  const Value value(compute());
+
+  lock.lock();
+  flight->value = value;
+  flight->done = true;
+  flights_.erase(key);
+  done_.notify_all();
+  return value;
+}
+
+
+}  // namespace cert_trans
+
+#endif  // CERT_TRANS_UTIL_SINGLE_FLIGHT_H_
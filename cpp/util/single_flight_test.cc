@@ -0,0 +1,85 @@
+#include "util/single_flight.h"
+
+#include <atomic>
+#include <chrono>
+#include <gtest/gtest.h>
+#include <thread>
+
+#include "base/notification.h"
+#include "util/testing.h"
+
+namespace cert_trans {
+namespace {
+
+using std::atomic;
+using std::chrono::milliseconds;
+using std::thread;
+
+
+TEST(SingleFlightTest, ReturnsValue) {
+  SingleFlight<int, int> flight;
+  bool coalesced(true);
+  EXPECT_EQ(42, flight.Do(1, []() { return 42; }, &coalesced));
+  EXPECT_FALSE(coalesced);
+}
+
+
+TEST(SingleFlightTest, CoalescesConcurrentCalls) {
+  SingleFlight<int, int> flight;
+  atomic<int> num_calls(0);
+  Notification started;
+  Notification release;
+  thread first([&]() {
+    EXPECT_EQ(1, flight.Do(1, [&]() {
+      ++num_calls;
+      started.Notify();
+      release.WaitForNotification();
+      return 1;
+    }));
+  });
+  started.WaitForNotification();
+
+  bool coalesced(false);
+  thread second([&]() {
+    EXPECT_EQ(1, flight.Do(1,
+                           [&]() {
+                             ++num_calls;
+                             return 2;
+                           },
+                           &coalesced));
+  });
+  // Gives the second call the time to start waiting.
+  std::this_thread::sleep_for(milliseconds(100));
+  release.Notify();
+  first.join();
+  second.join();
+
+  EXPECT_EQ(1, num_calls);
+  EXPECT_TRUE(coalesced);
+}
+
+
+TEST(SingleFlightTest, RunsDifferentKeys) {
+  SingleFlight<int, int> flight;
+  // The lock is not held while computing, so this does not deadlock.
+  EXPECT_EQ(3, flight.Do(1, [&flight]() {
+    return flight.Do(2, []() { return 2; }) + 1;
+  }));
+}
+
+
+TEST(SingleFlightTest, ComputesAgainOnceDone) {
+  SingleFlight<int, int> flight;
+  EXPECT_EQ(1, flight.Do(1, []() { return 1; }));
+  EXPECT_EQ(2, flight.Do(1, []() { return 2; }));
+}
+
+
+}  // namespace
+}  // namespace cert_trans
+
+
+int main(int argc, char** argv) {
+  cert_trans::test::InitTesting(argv[0], &argc, &argv, true);
+  return RUN_ALL_TESTS();
+}
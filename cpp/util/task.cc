@@ -2,13 +2,11 @@
 
 #include <glog/logging.h>
 
-using std::bind;
 using std::function;
 using std::lock_guard;
 using std::make_shared;
 using std::mutex;
 using std::ostream;
-using std::placeholders::_1;
 using std::shared_ptr;
 using std::unique_lock;
 using std::vector;
@@ -19,6 +17,8 @@ namespace util {
 Task::Task(const function<void(Task*)>& done_callback, Executor* executor)
     : done_callback_(done_callback),
       executor_(CHECK_NOTNULL(executor)),
+      trace_context_(TraceContext::Current()),
+      parent_(nullptr),
       state_(ACTIVE),
       cancelled_(false),
       holds_(0) {
@@ -62,7 +62,7 @@ void Task::Cancel() {
   }
 
   for (const auto& cb : cancel_callbacks) {
-    executor_->Add(bind(&Task::RunCancelCallback, this, cb));
+    executor_->Add([this, cb]() { RunCancelCallback(cb); });
   }
 }
 
@@ -129,7 +129,6 @@ void Task::RemoveHold() {
 
 
 bool Task::IsActive() const {
-  lock_guard<mutex> lock(lock_);
   return state_ == ACTIVE;
 }
 
@@ -141,7 +140,6 @@ bool Task::IsDone() const {
 
 
 bool Task::CancelRequested() const {
-  lock_guard<mutex> lock(lock_);
   return cancelled_;
 }
 
@@ -160,16 +158,16 @@ void Task::WhenCancelled(const std::function<void()>& cancel_cb) {
 
     // Give up the lock, in case the executor is synchronous.
     lock.unlock();
-    executor_->Add(bind(&Task::RunCancelCallback, this, cancel_cb));
+    executor_->Add([this, cancel_cb]() { RunCancelCallback(cancel_cb); });
   }
 }
 
 
 Task* Task::AddChildWithExecutor(const function<void(Task*)>& done_callback,
                                  Executor* executor) {
-  const shared_ptr<Task> child_task(make_shared<Task>(
-      bind(&Task::RunChildDoneCallback, this, done_callback, _1),
-      CHECK_NOTNULL(executor)));
+  const shared_ptr<Task> child_task(
+      make_shared<Task>(done_callback, CHECK_NOTNULL(executor)));
+  child_task->parent_ = this;
   bool cancel;
 
   {
@@ -219,8 +217,9 @@ void Task::TryDoneTransition(unique_lock<mutex>* lock) {
   // executor is synchronous.
   lock->unlock();
 
-  // Once this is called, the task might get deleted.
-  executor_->Add(bind(&Task::RunCleanupAndDoneCallbacks, this));
+  // Once this is called, the task might get deleted. This closure is
+  // small enough not to be allocated by std::function.
+  executor_->Add([this]() { RunCleanupAndDoneCallbacks(); });
 }
 
 
@@ -231,12 +230,9 @@ void Task::RunCancelCallback(const std::function<void()>& cb) {
 
 
 void Task::RunCleanupAndDoneCallbacks() {
+  // No lock needed, nothing can be added in the DONE state.
   vector<function<void()>> cleanup_callbacks;
-
-  {
-    lock_guard<mutex> lock(lock_);
-    cleanup_callbacks_.swap(cleanup_callbacks);
-  }
+  cleanup_callbacks_.swap(cleanup_callbacks);
 
   // We call the cleanup callbacks (and thus, any deleters) before
   // calling the done callback, which adds a little bit of latency,
@@ -247,15 +243,20 @@ void Task::RunCleanupAndDoneCallbacks() {
     cb();
   }
 
-  // Once this is called, the task might get deleted.
-  done_callback_(this);
+  // Once this is called, the task might get deleted (unless it is a
+  // child task, which its parent deletes).
+  Task* const parent(parent_);
+  {
+    ScopedTraceContext scoped_context(trace_context_);
+    done_callback_(this);
+  }
+  if (parent) {
+    parent->ChildDone(this);
+  }
 }
 
 
-void Task::RunChildDoneCallback(const function<void(Task*)>& done_callback,
-                                Task* child_task) {
-  done_callback(child_task);
-
+void Task::ChildDone(Task* child_task) {
   unique_lock<mutex> lock(lock_);
   vector<shared_ptr<Task>>::iterator it;
   for (it = child_tasks_.begin(); it != child_tasks_.end(); ++it) {
@@ -22,6 +22,7 @@
 #ifndef CERT_TRANS_UTIL_TASK_H_
 #define CERT_TRANS_UTIL_TASK_H_
 
+#include <atomic>
 #include <functional>
 #include <memory>
 #include <mutex>
@@ -30,6 +31,7 @@
 #include "base/macros.h"
 #include "util/executor.h"
 #include "util/status.h"
+#include "util/trace.h"
 
 namespace util {
 
@@ -165,16 +167,23 @@ class Task {
   void TryDoneTransition(std::unique_lock<std::mutex>* lock);
   void RunCancelCallback(const std::function<void()>& cb);
   void RunCleanupAndDoneCallbacks();
-  void RunChildDoneCallback(const std::function<void(Task*)>& done_callback,
-                            Task* child_task);
+  // Called once the done callback of |child_task| has returned.
+  void ChildDone(Task* child_task);
 
   const std::function<void(Task*)> done_callback_;
   Executor* const executor_;
+  // The done callback runs in the trace context the task was created
+  // in.
+  const TraceContext trace_context_;
+  // Set for child tasks, which are owned by their parent.
+  Task* parent_;
 
   mutable std::mutex lock_;
-  State state_;
+  // Only changed with |lock_| held, but atomic so that IsActive() and
+  // CancelRequested() do not need to take it.
+  std::atomic<State> state_;
   Status status_;  // not protected by lock_
-  bool cancelled_;
+  std::atomic<bool> cancelled_;
   int holds_;
   // References to child tasks are kept as shared pointers to avoid
   // some races.
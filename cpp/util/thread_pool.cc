@@ -1,136 +1,388 @@
+#include "config.h"
 #include "util/thread_pool.h"
+#include "monitoring/gauge.h"
+#include "util/cpu_affinity.h"
 #include "util/task.h"
+#include "util/timer_wheel.h"
+#include "util/trace.h"
 
+#include <algorithm>
+#include <atomic>
 #include <condition_variable>
+#include <deque>
+#include <gflags/gflags.h>
 #include <glog/logging.h>
 #include <mutex>
-#include <queue>
+#include <set>
+#include <string>
 #include <thread>
 #include <vector>
 
+using std::atomic;
 using std::chrono::duration;
-using std::chrono::duration_cast;
 using std::chrono::seconds;
 using std::chrono::steady_clock;
 using std::condition_variable;
+using std::deque;
 using std::function;
-using std::get;
+using std::once_flag;
 using std::lock_guard;
 using std::mutex;
-using std::priority_queue;
+using std::set;
+using std::string;
 using std::thread;
-using std::tuple;
 using std::unique_lock;
+using std::unique_ptr;
 using std::vector;
 
+DEFINE_string(thread_pool_cpus, "",
+              "if set, the CPUs (such as \"0-7,16-23\") the thread pool "
+              "workers are pinned to, along with the main thread of the "
+              "servers");
+DEFINE_int32(thread_pool_metrics_interval_seconds, 10,
+             "how often to export the number of closures queued in all the "
+             "thread pools, in seconds");
+
 namespace cert_trans {
 namespace {
 
-typedef tuple<steady_clock::time_point, function<void()>, util::Task*>
-    QueueEntry;
+// The pool whose worker is running on this thread (if any), and the
+// index of that worker, so that closures added from a worker go to
+// its own queue.
+#ifdef HAVE_THREAD_LOCAL
+thread_local const void* current_pool = nullptr;
+thread_local size_t current_worker = 0;
+#elif HAVE___THREAD
+__thread const void* current_pool = nullptr;
+__thread size_t current_worker = 0;
+#else
+#error No suitable thread local storage available
+#endif
 
 
-struct QueueOrdering {
-  bool operator()(const QueueEntry& lhs, const QueueEntry& rhs) const {
-    return get<0>(lhs) > get<0>(rhs);
-  }
-};
+Gauge<string>* thread_pool_queued_closures(
+    Gauge<string>::New("thread_pool_queued_closures", "priority",
+                       "Number of closures waiting for a thread pool "
+                       "worker, by priority."));
 
 
 }  // namespace
 
 
+// Each worker has its own queue, which it runs from the front. Those
+// which run out of work steal from the back of the queues of the
+// others, and only then go idle. Adding a closure wakes up a single
+// idle worker, if there is one. The delayed tasks are kept apart, in
+// a timer wheel which hands them to the workers once due.
 class ThreadPool::Impl {
  public:
+  explicit Impl(size_t num_threads);
   ~Impl();
 
-  void Worker();
+  void Add(const function<void()>& closure);
+  void AddHighPriority(const function<void()>& closure);
 
-  // TODO(pphaneuf): I'd like this to be const, but it required
-  // jumping through a few more hoops, keeping it simple for now.
-  vector<thread> threads_;
+  util::TimerWheel* timers() {
+    return timers_.get();
+  }
+
+ private:
+  struct Worker {
+    Worker() : wake_(false) {
+    }
 
-  mutex queue_lock_;
-  condition_variable queue_cond_var_;
-  priority_queue<QueueEntry, vector<QueueEntry>, QueueOrdering> queue_;
+    mutex queue_lock_;
+    deque<function<void()>> queue_;
+    condition_variable wake_cond_var_;
+    // Guarded by |idle_lock_| of the pool.
+    bool wake_;
+    thread thread_;
+  };
+
+  void RunWorker(size_t index);
+  bool TakeClosure(size_t index, function<void()>* closure);
+  void WakeOneIdle();
+
+  // The existing pools, for ExportMetrics().
+  static mutex* PoolsLock();
+  static set<const Impl*>* Pools();
+  // Sets |thread_pool_queued_closures| from all the existing pools,
+  // every --thread_pool_metrics_interval_seconds.
+  static void StartExportingMetrics();
+  static void ExportMetrics();
+
+  vector<unique_ptr<Worker>> workers_;
+  // Where the next closure added from outside of the pool goes.
+  atomic<size_t> next_worker_;
+  // The number of closures in all the queues, including
+  // |high_priority_queue_|.
+  atomic<int64_t> num_queued_;
+
+  // The closures of Priority::HIGH, shared by all the workers, which
+  // take from it before anything else.
+  mutex high_priority_lock_;
+  deque<function<void()>> high_priority_queue_;
+  atomic<int64_t> num_high_priority_queued_;
+
+  // Guards |idle_workers_|, |exiting_| and the wake-ups of the workers.
+  mutex idle_lock_;
+  vector<size_t> idle_workers_;
+  // The size of |idle_workers_|, to avoid taking |idle_lock_| in Add()
+  // when no worker is idle.
+  atomic<size_t> num_idle_;
+  bool exiting_;
+
+  unique_ptr<util::TimerWheel> timers_;
+
+  DISALLOW_COPY_AND_ASSIGN(Impl);
 };
 
 
+// static
+mutex* ThreadPool::Impl::PoolsLock() {
+  static mutex* const lock(new mutex);
+  return lock;
+}
+
+
+// static
+set<const ThreadPool::Impl*>* ThreadPool::Impl::Pools() {
+  static set<const Impl*>* const pools(new set<const Impl*>);
+  return pools;
+}
+
+
+ThreadPool::Impl::Impl(size_t num_threads)
+    : next_worker_(0),
+      num_queued_(0),
+      num_high_priority_queued_(0),
+      num_idle_(0),
+      exiting_(false),
+      timers_(new util::TimerWheel) {
+  CHECK_GT(num_threads, 0U);
+  // All the workers must exist before any of them starts stealing.
+  for (size_t i = 0; i < num_threads; ++i) {
+    workers_.emplace_back(new Worker);
+  }
+  for (size_t i = 0; i < num_threads; ++i) {
+    workers_[i]->thread_ = thread(&Impl::RunWorker, this, i);
+  }
+
+  {
+    lock_guard<mutex> lock(*PoolsLock());
+    Pools()->insert(this);
+  }
+  StartExportingMetrics();
+}
+
+
 ThreadPool::Impl::~Impl() {
-  // Start by sending an empty closure to every thread (and notify
-  // them), to have them exit cleanly.
   {
-    lock_guard<mutex> lock(queue_lock_);
-    for (int i = threads_.size(); i > 0; --i)
-      queue_.emplace(
-          make_tuple(steady_clock::time_point(), function<void()>(), nullptr));
+    lock_guard<mutex> lock(*PoolsLock());
+    CHECK_EQ(Pools()->erase(this), 1U);
   }
-  // Notify all the threads *after* adding all the empty closures, to
-  // avoid any races.
-  queue_cond_var_.notify_all();
 
-  // Wait for the threads to exit.
-  for (auto& thread : threads_) {
-    thread.join();
+  // Stop the timers first, so that they do not hand anything to the
+  // workers once they are gone.
+  timers_->Stop();
+
+  // Have the workers exit once they have run everything queued.
+  {
+    lock_guard<mutex> lock(idle_lock_);
+    exiting_ = true;
+    for (const auto& worker : workers_) {
+      worker->wake_ = true;
+      worker->wake_cond_var_.notify_one();
+    }
+    idle_workers_.clear();
+    num_idle_ = 0;
+  }
+  for (const auto& worker : workers_) {
+    worker->thread_.join();
+  }
+
+  // This cancels the delayed tasks. Anyone who tries to Add() more
+  // stuff when they're cancelled is going to cause a CHECK fail below,
+  // but at least they'll know about it that way.
+  VLOG(1) << "Cancelling delayed tasks...";
+  timers_.reset();
+
+  // Workers should've drained everything from the queues.
+  for (const auto& worker : workers_) {
+    lock_guard<mutex> lock(worker->queue_lock_);
+    CHECK(worker->queue_.empty());
+  }
+  lock_guard<mutex> lock(high_priority_lock_);
+  CHECK(high_priority_queue_.empty());
+}
+
+
+void ThreadPool::Impl::Add(const function<void()>& closure) {
+  const size_t index(current_pool == this
+                         ? current_worker
+                         : next_worker_.fetch_add(1) % workers_.size());
+  {
+    Worker* const worker(workers_[index].get());
+    lock_guard<mutex> lock(worker->queue_lock_);
+    worker->queue_.emplace_back(closure);
+  }
+  // This and the check of |num_queued_| by a worker going idle
+  // (after it updates |num_idle_|) guarantee that either that worker
+  // sees this closure, or this sees that worker.
+  ++num_queued_;
+  if (num_idle_ > 0) {
+    WakeOneIdle();
   }
+}
 
-  // Workers should've drained everything from the queue.
-  CHECK(queue_.empty());
+
+void ThreadPool::Impl::AddHighPriority(const function<void()>& closure) {
+  {
+    lock_guard<mutex> lock(high_priority_lock_);
+    high_priority_queue_.emplace_back(closure);
+  }
+  ++num_high_priority_queued_;
+  // Same as in Add().
+  ++num_queued_;
+  if (num_idle_ > 0) {
+    WakeOneIdle();
+  }
 }
 
 
-void ThreadPool::Impl::Worker() {
+void ThreadPool::Impl::RunWorker(size_t index) {
+  PinCurrentThread(FLAGS_thread_pool_cpus);
+  current_pool = this;
+  current_worker = index;
+  Worker* const self(workers_[index].get());
+
+  function<void()> closure;
   while (true) {
-    QueueEntry entry;
-
-    {
-      unique_lock<mutex> lock(queue_lock_);
-      while (queue_.empty() || get<0>(queue_.top()) > steady_clock::now()) {
-        if (queue_.empty()) {
-          // If there's nothing to do, wait until there is.
-          queue_cond_var_.wait(lock);
-        } else {
-          // Otherwise, wait until the next thing we currently know about is
-          // ready.
-          const steady_clock::duration duration(get<0>(queue_.top()) -
-                                                steady_clock::now());
-          queue_cond_var_.wait_for(lock, duration);
-        }
+    if (TakeClosure(index, &closure)) {
+      // Make sure not to hold any lock while calling the closure.
+      closure();
+      closure = nullptr;
+      continue;
+    }
+
+    unique_lock<mutex> lock(idle_lock_);
+    if (exiting_) {
+      if (num_queued_ > 0) {
+        // Still some to run (or steal) before exiting.
+        continue;
       }
+      return;
+    }
+    idle_workers_.push_back(index);
+    ++num_idle_;
+    if (num_queued_ > 0) {
+      // A closure was added just before going idle, go back for it.
+      // Nobody could have woken this up in the meantime, as this
+      // holds |idle_lock_|.
+      CHECK_EQ(index, idle_workers_.back());
+      idle_workers_.pop_back();
+      --num_idle_;
+      continue;
+    }
+    self->wake_ = false;
+    self->wake_cond_var_.wait(lock, [self]() { return self->wake_; });
+  }
+}
 
-      entry = queue_.top();
-      queue_.pop();
-
-      // If we received an empty entry, exit cleanly.
-      if (!get<1>(entry)) {
-        // Anything left in the queue must be either other exit sentinels, or
-        // future (delayed) tasks, so we'll cancel anything we find, up until
-        // either the next exit sentinel, or the end of the queue.
-        VLOG(1) << "Cancelling delayed tasks...";
-        vector<util::Task*> to_be_cancelled;
-        while (!queue_.empty() && get<2>(queue_.top())) {
-          to_be_cancelled.push_back(CHECK_NOTNULL(get<2>(queue_.top())));
-          queue_.pop();
-        }
 
-        // Cancel the callbacks below outside of the lock to avoid deadlocking
-        // anyone who tries to Add() more stuff when they're cancelled.
-        // Anyone who does that is going to cause a CHECK fail in the d'tor of
-        // the pool anyway, but at least they'll know about it that way.
-        lock.unlock();
+bool ThreadPool::Impl::TakeClosure(size_t index, function<void()>* closure) {
+  if (num_queued_ <= 0) {
+    return false;
+  }
 
-        for (const auto& t : to_be_cancelled) {
-          t->Return(util::Status::CANCELLED);
-        }
+  // The high priority closures first...
+  if (num_high_priority_queued_ > 0) {
+    lock_guard<mutex> lock(high_priority_lock_);
+    if (!high_priority_queue_.empty()) {
+      closure->swap(high_priority_queue_.front());
+      high_priority_queue_.pop_front();
+      --num_high_priority_queued_;
+      --num_queued_;
+      return true;
+    }
+  }
 
-        VLOG(1) << "Cancelled " << to_be_cancelled.size() << " delayed tasks.";
-        return;
-      }
+  // ...then the oldest closure of this worker's own queue...
+  {
+    Worker* const self(workers_[index].get());
+    lock_guard<mutex> lock(self->queue_lock_);
+    if (!self->queue_.empty()) {
+      closure->swap(self->queue_.front());
+      self->queue_.pop_front();
+      --num_queued_;
+      return true;
+    }
+  }
+
+  // ...or else the newest one of another worker.
+  for (size_t i = 1; i < workers_.size(); ++i) {
+    Worker* const victim(workers_[(index + i) % workers_.size()].get());
+    lock_guard<mutex> lock(victim->queue_lock_);
+    if (!victim->queue_.empty()) {
+      closure->swap(victim->queue_.back());
+      victim->queue_.pop_back();
+      --num_queued_;
+      return true;
     }
+  }
+
+  return false;
+}
+
+
+void ThreadPool::Impl::WakeOneIdle() {
+  lock_guard<mutex> lock(idle_lock_);
+  if (idle_workers_.empty()) {
+    return;
+  }
+  Worker* const worker(workers_[idle_workers_.back()].get());
+  idle_workers_.pop_back();
+  --num_idle_;
+  worker->wake_ = true;
+  worker->wake_cond_var_.notify_one();
+}
+
+
+// static
+void ThreadPool::Impl::StartExportingMetrics() {
+  static once_flag started;
+  std::call_once(started, []() {
+    CHECK_LT(0, FLAGS_thread_pool_metrics_interval_seconds);
+    ExportMetrics();
+  });
+}
+
 
-    // Make sure not to hold the lock while calling the closure.
-    get<1>(entry)();
+// static
+void ThreadPool::Impl::ExportMetrics() {
+  int64_t num_queued(0);
+  int64_t num_high_priority_queued(0);
+  {
+    lock_guard<mutex> lock(*PoolsLock());
+    for (const Impl* const pool : *Pools()) {
+      num_queued += pool->num_queued_;
+      num_high_priority_queued += pool->num_high_priority_queued_;
+    }
   }
+  thread_pool_queued_closures->Set("high", num_high_priority_queued);
+  // The two counts are not read at once, make sure this is not
+  // negative.
+  thread_pool_queued_closures->Set(
+      "normal", std::max<int64_t>(0, num_queued - num_high_priority_queued));
+
+  util::TimerWheel::Default()->Add(
+      steady_clock::now() +
+          seconds(FLAGS_thread_pool_metrics_interval_seconds),
+      [](bool fired) {
+        if (fired) {
+          ExportMetrics();
+        }
+      });
 }
 
 
@@ -141,11 +393,8 @@ ThreadPool::ThreadPool()
 }
 
 
-ThreadPool::ThreadPool(size_t num_threads) : impl_(new Impl) {
-  CHECK_GT(num_threads, 0);
+ThreadPool::ThreadPool(size_t num_threads) : impl_(new Impl(num_threads)) {
   LOG(INFO) << "ThreadPool starting with " << num_threads << " threads";
-  for (int i = 0; i < static_cast<int64_t>(num_threads); ++i)
-    impl_->threads_.emplace_back(thread(&Impl::Worker, impl_.get()));
 }
 
 
@@ -156,29 +405,31 @@ ThreadPool::~ThreadPool() {
 
 
 void ThreadPool::Add(const function<void()>& closure) {
-  // Empty closures signal a thread to exit, don't allow that (also,
-  // it doesn't make sense).
+  // Don't allow empty closures (it doesn't make sense).
   if (!closure) {
     return;
   }
 
-  {
-    lock_guard<mutex> lock(impl_->queue_lock_);
-    impl_->queue_.emplace(make_tuple(steady_clock::now(), closure, nullptr));
+  impl_->Add(util::WithTraceContext(closure));
+}
+
+
+void ThreadPool::AddWithPriority(Priority priority,
+                                 const function<void()>& closure) {
+  if (!closure) {
+    return;
+  }
+
+  if (priority == Priority::HIGH) {
+    impl_->AddHighPriority(util::WithTraceContext(closure));
+  } else {
+    impl_->Add(util::WithTraceContext(closure));
   }
-  impl_->queue_cond_var_.notify_one();
 }
 
 
 void ThreadPool::Delay(const duration<double>& delay, util::Task* task) {
-  CHECK_NOTNULL(task);
-  {
-    lock_guard<mutex> lock(impl_->queue_lock_);
-    impl_->queue_.emplace(make_tuple(
-        steady_clock::now() + duration_cast<std::chrono::microseconds>(delay),
-        [task]() { task->Return(); }, task));
-  }
-  impl_->queue_cond_var_.notify_one();
+  impl_->timers()->Delay(delay, task, this);
 }
 
 
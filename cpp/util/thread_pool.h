@@ -32,6 +32,11 @@ class ThreadPool : public util::Executor {
   void Delay(const std::chrono::duration<double>& delay,
              util::Task* task) override;
 
+  // Closures of Priority::HIGH are run before any of Priority::NORMAL
+  // that is still queued, by whichever worker is free first.
+  void AddWithPriority(Priority priority,
+                       const std::function<void()>& closure) override;
+
  private:
   class Impl;
   const std::unique_ptr<Impl> impl_;
@@ -4,6 +4,7 @@
 #include <glog/logging.h>
 #include <gtest/gtest.h>
 #include <memory>
+#include <vector>
 
 #include "base/notification.h"
 #include "util/sync_task.h"
@@ -14,6 +15,7 @@ namespace cert_trans {
 using std::chrono::milliseconds;
 using std::chrono::system_clock;
 using std::unique_ptr;
+using std::vector;
 using util::SyncTask;
 
 class ThreadPoolTest : public ::testing::Test {
@@ -76,6 +78,71 @@ TEST_F(ThreadPoolTest, NaturalOrderingPreserved) {
 }
 
 
+TEST_F(ThreadPoolTest, IdleWorkerStealsQueuedClosures) {
+  ThreadPool pool(2);
+  Notification stolen;
+  Notification done;
+  // The inner closure goes to the queue of the worker running the
+  // outer one, which waits for it, so only the other worker can run it.
+  pool.Add([&pool, &stolen, &done]() {
+    pool.Add([&stolen]() { stolen.Notify(); });
+    EXPECT_TRUE(stolen.WaitForNotificationWithTimeout(milliseconds(5000)));
+    done.Notify();
+  });
+  done.WaitForNotification();
+}
+
+
+TEST_F(ThreadPoolTest, RunsAllClosures) {
+  const int kNumClosures(10000);
+  std::atomic<int> num_run(0);
+  Notification done;
+  {
+    ThreadPool pool(4);
+    for (int i = 0; i < kNumClosures; ++i) {
+      pool.Add([&pool, &num_run, &done, kNumClosures]() {
+        pool.Add([&num_run, &done, kNumClosures]() {
+          if (++num_run == 2 * kNumClosures) {
+            done.Notify();
+          }
+        });
+        if (++num_run == 2 * kNumClosures) {
+          done.Notify();
+        }
+      });
+    }
+    done.WaitForNotification();
+  }
+  EXPECT_EQ(2 * kNumClosures, num_run.load());
+}
+
+
+TEST_F(ThreadPoolTest, HighPriorityRunsFirst) {
+  Notification blocked;
+  Notification unblock;
+  Notification done;
+  vector<int> order;
+  // Keep the only worker busy while the closures are queued.
+  pool_of_one_.Add([&blocked, &unblock]() {
+    blocked.Notify();
+    unblock.WaitForNotification();
+  });
+  blocked.WaitForNotification();
+  pool_of_one_.Add([&order]() { order.push_back(0); });
+  pool_of_one_.Add([&order]() { order.push_back(1); });
+  pool_of_one_.AddWithPriority(util::Executor::Priority::HIGH,
+                               [&order]() { order.push_back(2); });
+  pool_of_one_.AddWithPriority(util::Executor::Priority::NORMAL,
+                               [&order, &done]() {
+                                 order.push_back(3);
+                                 done.Notify();
+                               });
+  unblock.Notify();
+  done.WaitForNotification();
+  EXPECT_EQ(vector<int>({2, 0, 1, 3}), order);
+}
+
+
 TEST_F(ThreadPoolTest, CancelsDelayTasks) {
   unique_ptr<ThreadPool> pool(new ThreadPool(1));
 
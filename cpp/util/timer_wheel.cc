@@ -0,0 +1,299 @@
+#include "util/timer_wheel.h"
+
+#include <algorithm>
+#include <glog/logging.h>
+#include <memory>
+
+#include "util/executor.h"
+#include "util/task.h"
+
+using std::chrono::duration;
+using std::chrono::duration_cast;
+using std::chrono::milliseconds;
+using std::chrono::steady_clock;
+using std::lock_guard;
+using std::mutex;
+using std::thread;
+using std::unique_lock;
+using std::unique_ptr;
+using std::vector;
+
+namespace util {
+
+
+struct TimerWheel::Timer {
+  Timer(TimerId i, int64_t t, const Callback& c)
+      : id(i), tick(t), cb(c), slot(nullptr), prev(this), next(this) {
+  }
+
+  const TimerId id;
+  const int64_t tick;
+  const Callback cb;
+  // The head of the list this is in, and the neighbours in it.
+  Timer** slot;
+  Timer* prev;
+  Timer* next;
+};
+
+
+TimerWheel::TimerWheel()
+    : start_(steady_clock::now()),
+      current_tick_(0),
+      next_id_(1),
+      exiting_(false) {
+  std::fill(&slots_[0][0], &slots_[0][0] + kNumLevels * kNumSlots, nullptr);
+  thread_ = thread(&TimerWheel::Run, this);
+}
+
+
+TimerWheel::~TimerWheel() {
+  Stop();
+
+  std::unordered_map<TimerId, Timer*> timers;
+  {
+    lock_guard<mutex> lock(lock_);
+    timers.swap(timers_);
+  }
+  for (const auto& it : timers) {
+    const unique_ptr<Timer> timer(it.second);
+    timer->cb(false);
+  }
+}
+
+
+// static
+TimerWheel* TimerWheel::Default() {
+  static TimerWheel* const wheel(new TimerWheel);
+  return wheel;
+}
+
+
+TimerWheel::TimerId TimerWheel::Add(const steady_clock::time_point& when,
+                                    const Callback& cb) {
+  CHECK(cb);
+  // Rounds up, so that the timer never fires early.
+  const milliseconds::rep tick(
+      duration_cast<milliseconds>(when - start_ + milliseconds(1) -
+                                  steady_clock::duration(1))
+          .count());
+
+  bool wake_up;
+  TimerId id;
+  {
+    lock_guard<mutex> lock(lock_);
+    id = next_id_++;
+    // The current tick was processed already.
+    Timer* const timer(
+        new Timer(id, std::max<int64_t>(tick, current_tick_ + 1), cb));
+    // The thread might be waiting for nothing, or for a later tick of
+    // the first level (it always wakes up for the next cascade).
+    wake_up = timers_.empty();
+    timers_.emplace(id, timer);
+    wake_up |= Insert(timer) == 0;
+  }
+  if (wake_up) {
+    cond_var_.notify_one();
+  }
+  return id;
+}
+
+
+bool TimerWheel::Cancel(TimerId id) {
+  unique_ptr<Timer> timer;
+  {
+    lock_guard<mutex> lock(lock_);
+    const auto it(timers_.find(id));
+    if (it == timers_.end()) {
+      return false;
+    }
+    timer.reset(it->second);
+    timers_.erase(it);
+    Unlink(timer.get());
+  }
+  // The callback is destroyed outside of the lock.
+  return true;
+}
+
+
+void TimerWheel::Delay(const duration<double>& delay, Task* task,
+                       Executor* executor) {
+  CHECK_NOTNULL(task);
+  CHECK_NOTNULL(executor);
+  // If the delay is zero (or less?), what the heck, we're done!
+  if (delay <= delay.zero()) {
+    task->Return();
+    return;
+  }
+
+  // Make sure nothing "bad" happens while we're still setting up our
+  // callbacks.
+  TaskHold hold(task);
+
+  // This hold keeps |task| from being deleted while the timer might
+  // still return it, even if something else returns it meanwhile.
+  task->AddHold();
+  const TimerId id(
+      Add(steady_clock::now() + duration_cast<steady_clock::duration>(delay),
+          [task, executor](bool fired) {
+            if (fired) {
+              executor->Add([task]() {
+                task->Return();
+                task->RemoveHold();
+              });
+            } else {
+              task->Return(Status::CANCELLED);
+              task->RemoveHold();
+            }
+          }));
+
+  task->WhenCancelled([this, id, task]() {
+    // If the timer fired already, its callback takes care of |task|.
+    if (Cancel(id)) {
+      task->Return(Status::CANCELLED);
+      task->RemoveHold();
+    }
+  });
+}
+
+
+void TimerWheel::Stop() {
+  {
+    lock_guard<mutex> lock(lock_);
+    if (exiting_) {
+      return;
+    }
+    exiting_ = true;
+  }
+  cond_var_.notify_one();
+  thread_.join();
+}
+
+
+steady_clock::time_point TimerWheel::TimeOf(int64_t tick) const {
+  return start_ + milliseconds(tick);
+}
+
+
+int TimerWheel::Insert(Timer* timer) {
+  const int64_t delta(timer->tick - current_tick_);
+  int level(0);
+  while (level < kNumLevels - 1 &&
+         delta >= static_cast<int64_t>(1) << (kSlotBits * (level + 1))) {
+    ++level;
+  }
+  // Timers too far away for the last level are put in its farthest
+  // slot, and put back in the right place as it comes around.
+  const int64_t tick(std::min(
+      timer->tick,
+      current_tick_ + (static_cast<int64_t>(1) << (kSlotBits * kNumLevels)) -
+          1));
+
+  Timer** const slot(
+      &slots_[level][(tick >> (kSlotBits * level)) & (kNumSlots - 1)]);
+  timer->slot = slot;
+  if (*slot) {
+    timer->next = *slot;
+    timer->prev = (*slot)->prev;
+    timer->prev->next = timer;
+    timer->next->prev = timer;
+  } else {
+    timer->next = timer->prev = timer;
+    *slot = timer;
+  }
+  return level;
+}
+
+
+void TimerWheel::Unlink(Timer* timer) {
+  if (timer->next == timer) {
+    *timer->slot = nullptr;
+  } else {
+    timer->prev->next = timer->next;
+    timer->next->prev = timer->prev;
+    if (*timer->slot == timer) {
+      *timer->slot = timer->next;
+    }
+  }
+  timer->slot = nullptr;
+  timer->next = timer->prev = timer;
+}
+
+
+void TimerWheel::Cascade(int level, int slot) {
+  while (Timer* const timer = slots_[level][slot]) {
+    Unlink(timer);
+    Insert(timer);
+  }
+}
+
+
+void TimerWheel::Tick(vector<Timer*>* due) {
+  ++current_tick_;
+  // Every time a level wraps around, the next slot of the level above
+  // is spread over the levels below.
+  for (int level = 1; level < kNumLevels; ++level) {
+    const int shift(kSlotBits * level);
+    if ((current_tick_ & ((static_cast<int64_t>(1) << shift) - 1)) != 0) {
+      break;
+    }
+    Cascade(level, (current_tick_ >> shift) & (kNumSlots - 1));
+  }
+
+  Timer** const slot(&slots_[0][current_tick_ & (kNumSlots - 1)]);
+  while (Timer* const timer = *slot) {
+    DCHECK_LE(timer->tick, current_tick_);
+    Unlink(timer);
+    timers_.erase(timer->id);
+    due->push_back(timer);
+  }
+}
+
+
+int64_t TimerWheel::NextWakeUp() const {
+  // The next non-empty slot of the first level, or else the next
+  // cascade.
+  const int64_t next_cascade((current_tick_ | (kNumSlots - 1)) + 1);
+  for (int64_t tick = current_tick_ + 1; tick < next_cascade; ++tick) {
+    if (slots_[0][tick & (kNumSlots - 1)]) {
+      return tick;
+    }
+  }
+  return next_cascade;
+}
+
+
+void TimerWheel::Run() {
+  unique_lock<mutex> lock(lock_);
+  while (!exiting_) {
+    const int64_t now(
+        duration_cast<milliseconds>(steady_clock::now() - start_).count());
+
+    if (timers_.empty()) {
+      // Nothing to move through the wheel.
+      current_tick_ = std::max(current_tick_, now);
+      cond_var_.wait(lock);
+      continue;
+    }
+
+    vector<Timer*> due;
+    while (current_tick_ < now) {
+      Tick(&due);
+    }
+    if (due.empty()) {
+      cond_var_.wait_until(lock, TimeOf(NextWakeUp()));
+      continue;
+    }
+
+    // Make sure not to hold the lock while calling the callbacks, as
+    // they might add more timers.
+    lock.unlock();
+    for (Timer* const timer : due) {
+      const unique_ptr<Timer> deleter(timer);
+      timer->cb(true);
+    }
+    lock.lock();
+  }
+}
+
+
+}  // namespace util
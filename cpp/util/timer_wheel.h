@@ -0,0 +1,109 @@
+#ifndef CERT_TRANS_UTIL_TIMER_WHEEL_H_
+#define CERT_TRANS_UTIL_TIMER_WHEEL_H_
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <stdint.h>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "base/macros.h"
+
+namespace util {
+class Executor;
+class Task;
+
+
+// Runs callbacks at a given time, on a thread of its own. Adding and
+// cancelling a timer are O(1): the timers are kept in a hierarchical
+// timing wheel of millisecond ticks, where each level has 64 slots of
+// 64 times the duration of the slots of the level below. A timer is
+// put in the level whose range covers its deadline, and moves down a
+// level every time the level below wraps around, until it fires.
+//
+// The callbacks must be quick, as they delay the other timers, and
+// typically hand their work to an executor.
+class TimerWheel {
+ public:
+  typedef uint64_t TimerId;
+  // Called with true when the timer fires, or with false if the
+  // TimerWheel is destroyed first.
+  typedef std::function<void(bool fired)> Callback;
+
+  // Starts the thread.
+  TimerWheel();
+
+  // Stops the thread, then calls the callbacks of the timers that did
+  // not fire, with false.
+  ~TimerWheel();
+
+  // A TimerWheel shared by the whole process, which is never
+  // destroyed.
+  static TimerWheel* Default();
+
+  // Arranges for |cb| to be called at |when| (or as soon as possible,
+  // if it is in the past).
+  TimerId Add(const std::chrono::steady_clock::time_point& when,
+              const Callback& cb);
+
+  // Removes the timer |id| without calling its callback, if it did
+  // not fire yet, returning whether it did so.
+  bool Cancel(TimerId id);
+
+  // Implements util::Executor::Delay() for |executor|: returns |task|
+  // on |executor| after |delay|, or with Status::CANCELLED if it is
+  // cancelled first, or if this is destroyed first.
+  void Delay(const std::chrono::duration<double>& delay, Task* task,
+             Executor* executor);
+
+  // Stops the thread, so that no timer fires anymore. Their callbacks
+  // are still called (with false) by the destructor. This is for users
+  // which must stop the timers before being able to handle that.
+  void Stop();
+
+ private:
+  struct Timer;
+
+  static const int kNumLevels = 4;
+  static const int kSlotBits = 6;
+  static const int kNumSlots = 1 << kSlotBits;
+
+  std::chrono::steady_clock::time_point TimeOf(int64_t tick) const;
+  // Puts |timer| in its slot, returning the level of that slot.
+  // REQUIRES: |lock_| held.
+  int Insert(Timer* timer);
+  // Takes |timer| out of its slot. REQUIRES: |lock_| held.
+  void Unlink(Timer* timer);
+  // Moves the timers of |slot| of |level| down the wheel. REQUIRES:
+  // |lock_| held.
+  void Cascade(int level, int slot);
+  // Advances |current_tick_| by one, appending the timers that are due
+  // to |due|. REQUIRES: |lock_| held.
+  void Tick(std::vector<Timer*>* due);
+  // Returns the tick at which Run() should look again. REQUIRES:
+  // |lock_| held, and at least one timer.
+  int64_t NextWakeUp() const;
+  void Run();
+
+  const std::chrono::steady_clock::time_point start_;
+  std::mutex lock_;
+  std::condition_variable cond_var_;
+  // Every tick up to |current_tick_| has been processed.
+  int64_t current_tick_;
+  TimerId next_id_;
+  // Each slot is a circular list of timers, or nullptr.
+  Timer* slots_[kNumLevels][kNumSlots];
+  std::unordered_map<TimerId, Timer*> timers_;
+  bool exiting_;
+  std::thread thread_;
+
+  DISALLOW_COPY_AND_ASSIGN(TimerWheel);
+};
+
+
+}  // namespace util
+
+#endif  // CERT_TRANS_UTIL_TIMER_WHEEL_H_
@@ -0,0 +1,116 @@
+#include "util/timer_wheel.h"
+
+#include <atomic>
+#include <gtest/gtest.h>
+#include <memory>
+
+#include "base/notification.h"
+#include "util/sync_task.h"
+#include "util/testing.h"
+#include "util/thread_pool.h"
+
+namespace util {
+
+using cert_trans::Notification;
+using cert_trans::ThreadPool;
+using std::chrono::milliseconds;
+using std::chrono::seconds;
+using std::chrono::steady_clock;
+using std::unique_ptr;
+
+
+class TimerWheelTest : public ::testing::Test {
+ protected:
+  TimerWheel wheel_;
+};
+
+
+TEST_F(TimerWheelTest, FiresInOrderAndNotEarly) {
+  const steady_clock::time_point start(steady_clock::now());
+  std::atomic<int> fired(0);
+  Notification done;
+  // Far enough apart to go in different levels of the wheel.
+  wheel_.Add(start + milliseconds(5000), [&](bool ok) {
+    EXPECT_TRUE(ok);
+    EXPECT_GE(steady_clock::now(), start + milliseconds(5000));
+    EXPECT_EQ(2, fired++);
+    done.Notify();
+  });
+  wheel_.Add(start + milliseconds(100), [&](bool ok) {
+    EXPECT_TRUE(ok);
+    EXPECT_GE(steady_clock::now(), start + milliseconds(100));
+    EXPECT_EQ(1, fired++);
+  });
+  wheel_.Add(start + milliseconds(10), [&](bool ok) {
+    EXPECT_TRUE(ok);
+    EXPECT_GE(steady_clock::now(), start + milliseconds(10));
+    EXPECT_EQ(0, fired++);
+  });
+  EXPECT_TRUE(done.WaitForNotificationWithTimeout(milliseconds(10000)));
+  EXPECT_EQ(3, fired.load());
+}
+
+
+TEST_F(TimerWheelTest, PastTimersFireSoon) {
+  Notification done;
+  wheel_.Add(steady_clock::now() - seconds(10),
+             [&done](bool ok) { done.Notify(); });
+  EXPECT_TRUE(done.WaitForNotificationWithTimeout(milliseconds(1000)));
+}
+
+
+TEST_F(TimerWheelTest, Cancel) {
+  const TimerWheel::TimerId id(wheel_.Add(
+      steady_clock::now() + milliseconds(50),
+      [](bool ok) { ADD_FAILURE() << "cancelled timer called"; }));
+  EXPECT_TRUE(wheel_.Cancel(id));
+  EXPECT_FALSE(wheel_.Cancel(id));
+
+  Notification done;
+  const TimerWheel::TimerId fired_id(wheel_.Add(
+      steady_clock::now(), [&done](bool ok) { done.Notify(); }));
+  done.WaitForNotification();
+  EXPECT_FALSE(wheel_.Cancel(fired_id));
+}
+
+
+TEST_F(TimerWheelTest, DestructionCallsPendingTimers) {
+  unique_ptr<TimerWheel> wheel(new TimerWheel);
+  bool called(false);
+  wheel->Add(steady_clock::now() + seconds(3600), [&called](bool ok) {
+    EXPECT_FALSE(ok);
+    called = true;
+  });
+  wheel.reset();
+  EXPECT_TRUE(called);
+}
+
+
+TEST_F(TimerWheelTest, DelayTask) {
+  ThreadPool pool(1);
+  SyncTask task(&pool);
+  const steady_clock::time_point start(steady_clock::now());
+  wheel_.Delay(milliseconds(100), task.task(), &pool);
+  task.Wait();
+  EXPECT_EQ(Status::OK, task.status());
+  EXPECT_GE(steady_clock::now(), start + milliseconds(100));
+}
+
+
+TEST_F(TimerWheelTest, DelayTaskCancelled) {
+  ThreadPool pool(1);
+  SyncTask task(&pool);
+  wheel_.Delay(seconds(3600), task.task(), &pool);
+  task.Cancel();
+  task.Wait();
+  EXPECT_EQ(Status::CANCELLED, task.status());
+}
+
+
+}  // namespace util
+
+
+int main(int argc, char** argv) {
+  cert_trans::test::InitTesting(argv[0], &argc, &argv, true);
+  return RUN_ALL_TESTS();
+}
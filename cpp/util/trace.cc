@@ -0,0 +1,240 @@
+#include "config.h"
+#include "util/trace.h"
+
+#include <algorithm>
+#include <atomic>
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <iomanip>
+#include <mutex>
+#include <unistd.h>
+#include <vector>
+
+DEFINE_double(trace_sample_rate, 0,
+              "fraction of the requests whose processing is traced, from 0 "
+              "(none) to 1 (all)");
+DEFINE_int32(trace_buffer_spans, 4096,
+             "number of the latest trace spans kept by each thread, for "
+             "export");
+
+using std::atomic;
+using std::chrono::duration_cast;
+using std::chrono::microseconds;
+using std::chrono::steady_clock;
+using std::function;
+using std::lock_guard;
+using std::memory_order_relaxed;
+using std::mutex;
+using std::ostream;
+using std::vector;
+
+namespace util {
+
+namespace {
+
+
+struct SpanRecord {
+  const char* name;
+  uint64_t trace_id;
+  uint64_t span_id;
+  uint64_t parent_id;
+  int64_t start_us;
+  int64_t duration_us;
+};
+
+
+// The latest spans that ended on one thread.
+class SpanBuffer {
+ public:
+  explicit SpanBuffer(int thread_id)
+      : thread_id_(thread_id), next_(0), full_(false) {
+  }
+
+  void Add(const SpanRecord& span) {
+    lock_guard<mutex> lock(lock_);
+    if (spans_.empty()) {
+      spans_.resize(std::max(1, FLAGS_trace_buffer_spans));
+    }
+    spans_[next_] = span;
+    if (++next_ == spans_.size()) {
+      next_ = 0;
+      full_ = true;
+    }
+  }
+
+  // Calls |span_cb| with each span, oldest first.
+  void ForEach(const function<void(int, const SpanRecord&)>& span_cb) const {
+    lock_guard<mutex> lock(lock_);
+    if (full_) {
+      for (size_t i = next_; i < spans_.size(); ++i) {
+        span_cb(thread_id_, spans_[i]);
+      }
+    }
+    for (size_t i = 0; i < next_; ++i) {
+      span_cb(thread_id_, spans_[i]);
+    }
+  }
+
+ private:
+  const int thread_id_;
+  mutable mutex lock_;
+  vector<SpanRecord> spans_;
+  size_t next_;
+  bool full_;
+
+  DISALLOW_COPY_AND_ASSIGN(SpanBuffer);
+};
+
+
+// The buffers of all the threads that recorded spans. They are never
+// freed, as the threads mostly come from long-lived pools.
+mutex buffers_lock;
+vector<SpanBuffer*>* buffers(new vector<SpanBuffer*>);
+
+atomic<uint64_t> next_id(1);
+atomic<uint64_t> roots(0);
+
+#ifdef HAVE_THREAD_LOCAL
+thread_local uint64_t current_trace_id = 0;
+thread_local uint64_t current_span_id = 0;
+thread_local SpanBuffer* thread_buffer = nullptr;
+#elif HAVE___THREAD
+__thread uint64_t current_trace_id = 0;
+__thread uint64_t current_span_id = 0;
+__thread SpanBuffer* thread_buffer = nullptr;
+#else
+#error No suitable thread local storage available
+#endif
+
+
+int64_t Microseconds(const steady_clock::time_point& time) {
+  return duration_cast<microseconds>(time.time_since_epoch()).count();
+}
+
+
+void RecordSpan(const SpanRecord& span) {
+  if (!thread_buffer) {
+    lock_guard<mutex> lock(buffers_lock);
+    thread_buffer = new SpanBuffer(buffers->size());
+    buffers->push_back(thread_buffer);
+  }
+  thread_buffer->Add(span);
+}
+
+
+}  // namespace
+
+
+// static
+TraceContext TraceContext::NewRoot() {
+  const double rate(FLAGS_trace_sample_rate);
+  if (rate <= 0) {
+    return TraceContext();
+  }
+  // Samples one root in every 1 / |rate|, evenly.
+  const uint64_t count(roots.fetch_add(1, memory_order_relaxed));
+  if (rate < 1 && static_cast<uint64_t>((count + 1) * rate) ==
+                      static_cast<uint64_t>(count * rate)) {
+    return TraceContext();
+  }
+  return TraceContext(next_id.fetch_add(1, memory_order_relaxed), 0);
+}
+
+
+// static
+TraceContext TraceContext::Current() {
+  return TraceContext(current_trace_id, current_span_id);
+}
+
+
+ScopedTraceContext::ScopedTraceContext(const TraceContext& context)
+    : previous_(TraceContext::Current()) {
+  current_trace_id = context.trace_id();
+  current_span_id = context.span_id();
+}
+
+
+ScopedTraceContext::~ScopedTraceContext() {
+  current_trace_id = previous_.trace_id();
+  current_span_id = previous_.span_id();
+}
+
+
+function<void()> WithTraceContext(const function<void()>& closure) {
+  const TraceContext context(TraceContext::Current());
+  if (!context.sampled()) {
+    return closure;
+  }
+  return [context, closure]() {
+    ScopedTraceContext scoped(context);
+    closure();
+  };
+}
+
+
+TraceSpan::TraceSpan(const char* name)
+    : TraceSpan(name, TraceContext::Current()) {
+}
+
+
+TraceSpan::TraceSpan(const char* name, const TraceContext& parent)
+    : name_(CHECK_NOTNULL(name)),
+      parent_id_(parent.span_id()),
+      context_(parent.sampled()
+                   ? TraceContext(parent.trace_id(),
+                                  next_id.fetch_add(1, memory_order_relaxed))
+                   : TraceContext()),
+      start_(context_.sampled() ? steady_clock::now()
+                                : steady_clock::time_point()) {
+}
+
+
+TraceSpan::~TraceSpan() {
+  if (context_.sampled()) {
+    const steady_clock::time_point end(steady_clock::now());
+    RecordSpan(SpanRecord{name_, context_.trace_id(), context_.span_id(),
+                          parent_id_, Microseconds(start_),
+                          Microseconds(end) - Microseconds(start_)});
+  }
+}
+
+
+// static
+void TraceSpan::Record(const char* name, const TraceContext& parent,
+                       const steady_clock::time_point& start) {
+  if (parent.sampled()) {
+    RecordSpan(SpanRecord{CHECK_NOTNULL(name), parent.trace_id(),
+                          next_id.fetch_add(1, memory_order_relaxed),
+                          parent.span_id(), Microseconds(start),
+                          Microseconds(steady_clock::now()) -
+                              Microseconds(start)});
+  }
+}
+
+
+void ExportTraces(ostream* os) {
+  vector<SpanBuffer*> all_buffers;
+  {
+    lock_guard<mutex> lock(buffers_lock);
+    all_buffers = *buffers;
+  }
+
+  const pid_t pid(getpid());
+  bool first(true);
+  *CHECK_NOTNULL(os) << "{\"traceEvents\":[";
+  for (const auto& buffer : all_buffers) {
+    buffer->ForEach([os, pid, &first](int thread_id, const SpanRecord& span) {
+      *os << (first ? "\n" : ",\n") << "{\"name\":\"" << span.name
+          << "\",\"cat\":\"ct\",\"ph\":\"X\",\"ts\":" << span.start_us
+          << ",\"dur\":" << span.duration_us << ",\"pid\":" << pid
+          << ",\"tid\":" << thread_id << ",\"args\":{\"trace_id\":\""
+          << std::hex << span.trace_id << "\",\"span_id\":\"" << span.span_id
+          << "\",\"parent_id\":\"" << span.parent_id << "\"}}" << std::dec;
+      first = false;
+    });
+  }
+  *os << "\n],\"displayTimeUnit\":\"ms\"}\n";
+}
+
+
+}  // namespace util
@@ -0,0 +1,133 @@
+#ifndef CERT_TRANS_UTIL_TRACE_H_
+#define CERT_TRANS_UTIL_TRACE_H_
+
+#include <chrono>
+#include <functional>
+#include <ostream>
+#include <stdint.h>
+
+#include "base/macros.h"
+
+namespace util {
+
+
+// Identifies a span of a trace, for the spans started under it to be
+// its children. A default constructed context is not sampled, and
+// nothing is recorded under it.
+//
+// Traces are started by TraceContext::NewRoot(), at the rate given by
+// --trace_sample_rate, and their context follows the work through the
+// threads: util::Task runs its done callback with the context it was
+// created under, and ThreadPool::Add() runs closures with the context
+// they were added under.
+class TraceContext {
+ public:
+  TraceContext() : trace_id_(0), span_id_(0) {
+  }
+
+  // Starts a new trace, if it is sampled.
+  static TraceContext NewRoot();
+
+  // The context of the calling thread.
+  static TraceContext Current();
+
+  bool sampled() const {
+    return trace_id_ != 0;
+  }
+
+  uint64_t trace_id() const {
+    return trace_id_;
+  }
+
+  // Zero for the root of a trace.
+  uint64_t span_id() const {
+    return span_id_;
+  }
+
+ private:
+  friend class TraceSpan;
+
+  TraceContext(uint64_t trace_id, uint64_t span_id)
+      : trace_id_(trace_id), span_id_(span_id) {
+  }
+
+  uint64_t trace_id_;
+  uint64_t span_id_;
+};
+
+
+// Makes |context| that of the calling thread, until destroyed.
+class ScopedTraceContext {
+ public:
+  explicit ScopedTraceContext(const TraceContext& context);
+  ~ScopedTraceContext();
+
+ private:
+  const TraceContext previous_;
+
+  DISALLOW_COPY_AND_ASSIGN(ScopedTraceContext);
+};
+
+
+// Returns a closure that runs |closure| with the context of the
+// calling thread, or |closure| itself if it is not sampled.
+std::function<void()> WithTraceContext(const std::function<void()>& closure);
+
+
+// A span of work named |name|, which must outlive it (a string
+// literal), from the construction of this object to its destruction,
+// which can happen on another thread. It is recorded in a ring buffer
+// of the thread it ends on, if its trace is sampled.
+class TraceSpan {
+ public:
+  // A child of the context of the calling thread.
+  explicit TraceSpan(const char* name);
+  TraceSpan(const char* name, const TraceContext& parent);
+  ~TraceSpan();
+
+  // The context for the children of this span.
+  const TraceContext& context() const {
+    return context_;
+  }
+
+  // Records a child of |parent| that started at |start| and ends now,
+  // for spans that do not map to an object's lifetime.
+  static void Record(const char* name, const TraceContext& parent,
+                     const std::chrono::steady_clock::time_point& start);
+
+ private:
+  const char* const name_;
+  const uint64_t parent_id_;
+  const TraceContext context_;
+  const std::chrono::steady_clock::time_point start_;
+
+  DISALLOW_COPY_AND_ASSIGN(TraceSpan);
+};
+
+
+// A TraceSpan whose context is that of the calling thread until it
+// ends, so that the spans started meanwhile are its children. It must
+// end on the thread it started on.
+class ScopedTraceSpan {
+ public:
+  explicit ScopedTraceSpan(const char* name)
+      : span_(name), scoped_context_(span_.context()) {
+  }
+
+ private:
+  TraceSpan span_;
+  ScopedTraceContext scoped_context_;
+
+  DISALLOW_COPY_AND_ASSIGN(ScopedTraceSpan);
+};
+
+
+// Writes the spans in the ring buffers of all the threads, in the
+// JSON format of the Chrome trace event profiler (also read by
+// Perfetto and others), as complete ("X") events.
+void ExportTraces(std::ostream* os);
+
+
+}  // namespace util
+
+#endif  // CERT_TRANS_UTIL_TRACE_H_
@@ -0,0 +1,116 @@
+#include <gflags/gflags.h>
+#include <gtest/gtest.h>
+#include <sstream>
+#include <string>
+#include <thread>
+
+#include "util/testing.h"
+#include "util/thread_pool.h"
+#include "util/trace.h"
+
+DECLARE_double(trace_sample_rate);
+
+using cert_trans::ThreadPool;
+using std::ostringstream;
+using std::string;
+using std::thread;
+using util::ScopedTraceContext;
+using util::ScopedTraceSpan;
+using util::TraceContext;
+using util::TraceSpan;
+
+namespace {
+
+
+string Traces() {
+  ostringstream oss;
+  util::ExportTraces(&oss);
+  return oss.str();
+}
+
+
+class TraceTest : public ::testing::Test {
+ protected:
+  ~TraceTest() {
+    FLAGS_trace_sample_rate = 0;
+  }
+};
+
+
+TEST_F(TraceTest, NotSampledByDefault) {
+  const TraceContext root(TraceContext::NewRoot());
+  EXPECT_FALSE(root.sampled());
+  ScopedTraceContext scoped(root);
+  const TraceSpan span("test.not_sampled");
+  EXPECT_FALSE(span.context().sampled());
+}
+
+
+TEST_F(TraceTest, SamplesAtRate) {
+  FLAGS_trace_sample_rate = 0.25;
+  int sampled(0);
+  for (int i = 0; i < 100; ++i) {
+    if (TraceContext::NewRoot().sampled()) {
+      ++sampled;
+    }
+  }
+  EXPECT_EQ(25, sampled);
+}
+
+
+TEST_F(TraceTest, SpansAreChildrenOfCurrentContext) {
+  FLAGS_trace_sample_rate = 1;
+  const TraceContext root(TraceContext::NewRoot());
+  ASSERT_TRUE(root.sampled());
+  EXPECT_EQ(0U, root.span_id());
+
+  ScopedTraceContext scoped(root);
+  uint64_t parent_id;
+  {
+    const ScopedTraceSpan parent("test.parent");
+    const TraceContext current(TraceContext::Current());
+    EXPECT_EQ(root.trace_id(), current.trace_id());
+    parent_id = current.span_id();
+    EXPECT_NE(0U, parent_id);
+
+    const TraceSpan child("test.child");
+    EXPECT_EQ(root.trace_id(), child.context().trace_id());
+    EXPECT_NE(parent_id, child.context().span_id());
+  }
+  EXPECT_EQ(0U, TraceContext::Current().span_id());
+
+  const string traces(Traces());
+  EXPECT_NE(string::npos, traces.find("\"name\":\"test.parent\""));
+  EXPECT_NE(string::npos, traces.find("\"name\":\"test.child\""));
+}
+
+
+TEST_F(TraceTest, ThreadPoolPropagatesContext) {
+  FLAGS_trace_sample_rate = 1;
+  const TraceContext root(TraceContext::NewRoot());
+  TraceContext seen;
+  {
+    ThreadPool pool(1);
+    ScopedTraceContext scoped(root);
+    pool.Add([&seen]() { seen = TraceContext::Current(); });
+  }
+  EXPECT_EQ(root.trace_id(), seen.trace_id());
+}
+
+
+TEST_F(TraceTest, SpanCanEndOnAnotherThread) {
+  FLAGS_trace_sample_rate = 1;
+  ScopedTraceContext scoped(TraceContext::NewRoot());
+  TraceSpan* const span(new TraceSpan("test.other_thread"));
+  thread([span]() { delete span; }).join();
+  EXPECT_NE(string::npos, Traces().find("\"name\":\"test.other_thread\""));
+}
+
+
+}  // namespace
+
+
+int main(int argc, char** argv) {
+  cert_trans::test::InitTesting(argv[0], &argc, &argv, true);
+  return RUN_ALL_TESTS();
+}
@@ -1,21 +1,23 @@
 #include "util/util.h"
 
+#include <algorithm>
+#include <atomic>
 #include <cstring>
 #include <fstream>
 #include <glog/logging.h>
 #include <iostream>
-#include <netinet/in.h>  // for resolv.h
-#include <resolv.h>      // for b64_ntop
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string>
 #include <sstream>
 #include <sys/time.h>
+#include <time.h>
 #include <unistd.h>
 #include <vector>
 
 #include "log/ct_extensions.h"
+#include "util/base64.h"
 #include "version.h"
 
 using std::getline;
@@ -163,6 +165,24 @@ uint64_t TimeInMilliseconds() {
          static_cast<uint64_t>(tv.tv_usec) / 1000;
 }
 
+uint64_t NonDecreasingTimeInMilliseconds() {
+  // The latest time returned, by any thread.
+  static std::atomic<uint64_t> latest(0);
+
+  // Served from the vDSO rather than making a system call.
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  const uint64_t now(static_cast<uint64_t>(ts.tv_sec) * 1000 +
+                     static_cast<uint64_t>(ts.tv_nsec) / 1000000);
+
+  uint64_t previous(latest.load(std::memory_order_relaxed));
+  while (now > previous &&
+         !latest.compare_exchange_weak(previous, now,
+                                       std::memory_order_relaxed)) {
+  }
+  return std::max(now, previous);
+}
+
 string RandomString(size_t min_length, size_t max_length) {
   size_t length = min_length == max_length
                       ? min_length
@@ -176,27 +196,20 @@ string RandomString(size_t min_length, size_t max_length) {
 }
 
 string FromBase64(const char* b64) {
-  size_t length = strlen(b64);
-  // Lazy: base 64 encoding is always >= in length to decoded value
-  // (equality occurs for zero length).
-  u_char* buf = new u_char[length];
-  int rlength = b64_pton(b64, buf, length);
+  const size_t length(strlen(b64));
+  string ret(Base64DecodedMaxLength(length), '\0');
+  size_t decoded_length;
   // Treat decode errors as empty strings.
-  if (rlength < 0)
-    rlength = 0;
-  string ret(reinterpret_cast<char*>(buf), rlength);
-  delete[] buf;
+  if (!Base64Decode(b64, length, &ret[0], &decoded_length)) {
+    return string();
+  }
+  ret.resize(decoded_length);
   return ret;
 }
 
 string ToBase64(const string& from) {
-  // base 64 is 4 output bytes for every 3 input bytes (rounded up).
-  size_t length = ((from.size() + 2) / 3) * 4;
-  char* buf = new char[length + 1];
-  length =
-      b64_ntop((const u_char*)from.data(), from.length(), buf, length + 1);
-  string ret(buf, length);
-  delete[] buf;
+  string ret(Base64EncodedLength(from.size()), '\0');
+  Base64Encode(from.data(), from.size(), &ret[0]);
   return ret;
 }
 
@@ -30,6 +30,11 @@ std::string CreateTemporaryDirectory(const std::string& dir_template);
 
 uint64_t TimeInMilliseconds();
 
+// Like TimeInMilliseconds(), but never returns less than it returned
+// before, on any thread, even if the system clock is stepped back. For
+// the timestamps of SCTs and tree heads, which must not go back.
+uint64_t NonDecreasingTimeInMilliseconds();
+
 // Return a non-cryptographic random string. Caller needs to ensure
 // srand() is called if needed.
 std::string RandomString(size_t min_length, size_t max_length);
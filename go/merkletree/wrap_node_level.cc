@@ -0,0 +1 @@
+#include "merkletree/node_level.cc"
@@ -0,0 +1 @@
+#include "base/notification.cc"
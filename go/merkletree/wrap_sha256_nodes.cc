@@ -0,0 +1 @@
+#include "merkletree/sha256_nodes.cc"
@@ -0,0 +1 @@
+#include "util/status.cc"